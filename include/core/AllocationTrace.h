@@ -0,0 +1,268 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ALLOCATIONTRACE_H_
+#define ZILLIANS_ALLOCATIONTRACE_H_
+
+#include "core/Buffer.h"
+#include "utility/TimerUtil.h"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief AllocationTraceRecord is a single allocator operation in the binary trace log.
+ *
+ * The pointer is kept as its address, AllocationTrace pairs each allocation with the
+ * following deallocation of the same address to identify it.
+ */
+struct AllocationTraceRecord
+{
+	enum operation_t
+	{
+		ALLOCATE	= 0,
+		DEALLOCATE	= 1,
+	};
+
+	uint64 timestamp;	///< Nanoseconds since the tracer was created
+	uint64 address;		///< The allocated or deallocated memory
+	uint32 size;		///< Requested size of an allocation, 0 for deallocations
+	uint16 thread;		///< Index of the recording thread, in the order threads first recorded
+	uint8 operation;	///< One of operation_t
+	uint8 reserved;
+};
+
+BOOST_STATIC_ASSERT(sizeof(AllocationTraceRecord) == 24);
+
+/**
+ * @brief AllocationTracer records allocator operations into a compact binary log.
+ *
+ * Hook it into an allocator (see ScalablePoolAllocator::setTracer() and
+ * FragmentAllocator::setTracer()) to capture the production allocation mix, then
+ * load the log by AllocationTrace and replay it against any BufferAllocator.
+ *
+ * Records are appended to a per-thread batch without any lock, only a full batch
+ * takes the file lock to be written out. The log is a small header followed by
+ * AllocationTraceRecord's, ordered by thread batches rather than by time.
+ *
+ * @code
+ * AllocationTracer tracer("/tmp/allocation.trace");
+ * pool.setTracer(&tracer);
+ * ...
+ * pool.setTracer(NULL);
+ * tracer.flush();
+ * @endcode
+ *
+ * @note Like MetricCounter, the tracer must outlive the threads recording into it,
+ * and flush() only writes records of threads which are done recording.
+ */
+class AllocationTracer : public boost::noncopyable
+{
+public:
+	enum
+	{
+		BATCH_SIZE	= 4096,			///< Records buffered per thread before written out
+		MAGIC		= 0x5254415a,	///< "ZATR" in little endian
+		VERSION		= 1,
+	};
+
+	struct Header
+	{
+		uint32 magic;
+		uint16 version;
+		uint16 recordSize;
+	};
+
+	/**
+	 * @brief Create (or truncate) the log file.
+	 *
+	 * @throw std::runtime_error If the file can't be opened
+	 */
+	explicit AllocationTracer(const std::string& path);
+	~AllocationTracer();
+
+public:
+	inline void recordAllocate(const void* p, std::size_t size)
+	{
+		record(AllocationTraceRecord::ALLOCATE, p, size);
+	}
+
+	inline void recordDeallocate(const void* p)
+	{
+		record(AllocationTraceRecord::DEALLOCATE, p, 0);
+	}
+
+	/**
+	 * @brief Write all buffered records to the log file.
+	 */
+	void flush();
+
+	/**
+	 * @brief Get the number of records written and buffered so far.
+	 */
+	uint64 recordCount() const;
+
+private:
+	struct Batch
+	{
+		uint16 thread;
+		std::size_t count;
+		AllocationTraceRecord records[BATCH_SIZE];
+	};
+
+	inline void record(uint8 operation, const void* p, std::size_t size)
+	{
+		Batch* batch = mLocal.get();
+		if(UNLIKELY(!batch))
+			batch = registerThread();
+		else if(UNLIKELY(batch->count == BATCH_SIZE))
+			writeBatch(batch);
+
+		AllocationTraceRecord& r = batch->records[batch->count++];
+		r.timestamp = TimerUtil::now_ns() - mStart;
+		r.address = reinterpret_cast<uintptr_t>(p);
+		r.size = static_cast<uint32>(size);
+		r.thread = batch->thread;
+		r.operation = operation;
+		r.reserved = 0;
+	}
+
+	Batch* registerThread();
+	void writeBatch(Batch* batch);
+
+private:
+	uint64 mStart;
+	boost::thread_specific_ptr<Batch> mLocal;
+
+	mutable boost::mutex mFileLock;
+	FILE* mFile;
+	uint64 mWrittenCount;
+	std::vector< boost::shared_ptr<Batch> > mBatches;
+};
+
+/**
+ * @brief AllocationReplayResult is what AllocationTrace::replay() measured.
+ */
+struct AllocationReplayResult
+{
+	AllocationReplayResult();
+
+	/**
+	 * @brief Get the replayed operations per second.
+	 */
+	double throughput() const;
+
+	void print(const std::string& name) const;
+
+	uint64 operations;				///< Allocations and deallocations replayed
+	uint64 failures;				///< Allocations which returned NULL
+	uint64 elapsed;					///< Wall time of the replay in nanoseconds
+	TimerHistogram allocateLatency;
+	TimerHistogram deallocateLatency;
+	std::size_t peakRequestedBytes;	///< Peak of live requested bytes, in trace order
+	std::size_t peakResidentBytes;	///< Peak growth of the resident set during the replay
+};
+
+/**
+ * @brief AllocationTrace loads a log written by AllocationTracer and replays it.
+ *
+ * On loading, the records are ordered by time and each allocation is paired with
+ * the next deallocation of its address, which gives every allocation a unique id
+ * no matter how addresses are reused. Deallocations of memory allocated before the
+ * trace started are dropped.
+ *
+ * replay() runs one thread per traced thread, each issuing its own operations as
+ * fast as it can. A deallocation of memory allocated by another thread waits until
+ * that allocation is replayed, so cross-thread frees keep their order.
+ *
+ * @code
+ * AllocationTrace trace("/tmp/allocation.trace");
+ * ScalablePoolBufferAllocator allocator(pool);
+ * trace.replay(allocator).print("ScalablePoolAllocator");
+ * @endcode
+ */
+class AllocationTrace : public boost::noncopyable
+{
+public:
+	/**
+	 * @throw std::runtime_error If the file can't be read or isn't an allocation trace
+	 */
+	explicit AllocationTrace(const std::string& path);
+	explicit AllocationTrace(const std::vector<AllocationTraceRecord>& records);
+
+public:
+	/**
+	 * @brief Replay the trace against the given allocator.
+	 *
+	 * Each allocated chunk has a byte written per page, so the resident set reflects
+	 * the memory actually handed out. Allocations never deallocated in the trace are
+	 * deallocated after the measurement.
+	 */
+	AllocationReplayResult replay(BufferAllocator& allocator) const;
+
+	inline std::size_t threadCount() const
+	{
+		return mThreads.size();
+	}
+
+	inline std::size_t allocationCount() const
+	{
+		return mAllocationCount;
+	}
+
+	inline std::size_t operationCount() const
+	{
+		return mOperationCount;
+	}
+
+	/**
+	 * @brief Get the peak of live requested bytes, in trace order.
+	 */
+	inline std::size_t peakRequestedBytes() const
+	{
+		return mPeakRequestedBytes;
+	}
+
+private:
+	struct Operation
+	{
+		uint32 id;		///< The allocation id
+		uint32 size;	///< Requested size, 0 for deallocations
+		uint8 operation;
+	};
+
+	void prepare(std::vector<AllocationTraceRecord>& records);
+
+private:
+	std::vector< std::vector<Operation> > mThreads;
+	std::size_t mAllocationCount;
+	std::size_t mOperationCount;
+	std::size_t mPeakRequestedBytes;
+};
+
+}
+
+#endif/*ZILLIANS_ALLOCATIONTRACE_H_*/
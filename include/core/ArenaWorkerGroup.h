@@ -0,0 +1,304 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ARENAWORKERGROUP_H_
+#define ZILLIANS_ARENAWORKERGROUP_H_
+
+#include "core/Worker.h"
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace zillians {
+
+/**
+ * @brief ArenaWorkerGroup runs handlers on the threads of a tbb::task_arena.
+ *
+ * Handlers are enqueued to the arena as TBB tasks, so the threads running them
+ * are the same threads running the parallel algorithms they call. A handler
+ * calling tbb::parallel_for splits its range over the threads of the group,
+ * the idle ones pick up the chunks, and no second pool competes with the
+ * group for the cpus.
+ *
+ * Each handler runs isolated (see tbb::this_task_arena::isolate), so a handler
+ * waiting for its parallel_for only takes chunks of that parallel_for and never
+ * starts another handler in the middle of it.
+ *
+ * Handlers are not bound to a thread and run in no particular order, as in
+ * WorkStealingWorkerGroup. Code running on a plain Worker uses execute() to run
+ * its parallel algorithms in the arena of the group instead of the default one.
+ *
+ * @code
+ * ArenaWorkerGroup group(8);
+ * group.post([&] {
+ *     tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n), body);// runs on the 8 threads
+ * });
+ * @endcode
+ *
+ * @note TBB never starts more threads than its global limit allows, the hardware
+ * concurrency by default, so a group larger than that doesn't get all its threads.
+ */
+class ArenaWorkerGroup
+{
+public:
+	/**
+	 * @param threads The concurrency of the arena, none of its slots is reserved
+	 * for threads calling execute().
+	 * @param placement The placement of the threads, the thread in the index-th
+	 * slot of the arena is placed by placement.at(index).
+	 */
+	explicit ArenaWorkerGroup(std::size_t threads = 4, const ThreadPlacement& placement = ThreadPlacement()) :
+		mArena((int)threads, 0),
+		mPending(0),
+		mTerminated(false)
+	{
+		mArena.initialize();
+		if(!placement.empty())
+			mObserver.reset(new PlacementObserver(mArena, placement));
+	}
+
+	virtual ~ArenaWorkerGroup()
+	{
+		stop();
+	}
+
+public:
+	/**
+	 * @brief Request the group to invoke the given handler.
+	 *
+	 * If called from a handler of the group, the handler is executed inside
+	 * this method, otherwise it's the same as post().
+	 */
+	template<typename CompletionHandler>
+	inline void dispatch(CompletionHandler handler, bool blocking = false)
+	{
+		if(current() == this)
+		{
+			handler();
+		}
+		else
+		{
+			post(handler, blocking);
+		}
+	}
+
+	/**
+	 * @brief Post the given handler to the group and return.
+	 *
+	 * @param handler The handler to be called. The function signature of the
+	 * handler must be: @code void handler(); @endcode
+	 *
+	 * @param blocking True to wait for the completion of the handler.
+	 */
+	template<typename CompletionHandler>
+	inline void post(CompletionHandler handler, bool blocking = false)
+	{
+		if(blocking)
+		{
+			boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+			enqueue(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+			completion->wait();
+		}
+		else
+		{
+			enqueue(handler);
+		}
+	}
+
+	template<typename CompletionHandler>
+	inline WorkerFuture async(CompletionHandler handler)
+	{
+		boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+		enqueue(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+		return WorkerFuture(completion);
+	}
+
+	inline void wait(const WorkerFuture& key)
+	{
+		key.wait();
+	}
+
+	bool timed_wait(const WorkerFuture& key, const boost::system_time& absolute)
+	{
+		return key.timed_wait(absolute);
+	}
+
+	template<typename DurationType>
+	bool timed_wait(const WorkerFuture& key, const DurationType& relative)
+	{
+		return key.timed_wait(relative);
+	}
+
+	void cancel(const WorkerFuture& key)
+	{
+		key.cancel();
+	}
+
+	/**
+	 * @brief Run the given function in the arena of the group and wait for it.
+	 *
+	 * The calling thread joins the arena, or waits for a thread of the arena
+	 * to run the function, so the parallel algorithms called by the function
+	 * share the threads of the group.
+	 *
+	 * @param f The function to be called, the signature must be: @code void f(); @endcode
+	 */
+	template<typename F>
+	inline void execute(const F& f)
+	{
+		if(current() == this)
+			f();
+		else
+			mArena.execute(f);
+	}
+
+	/**
+	 * @brief Stop the group once every pending handler has been executed,
+	 * including the ones they post meanwhile.
+	 */
+	void stop()
+	{
+		if(!mTerminated.exchange(true))
+		{
+			boost::mutex::scoped_lock lock(mPendingMutex);
+			while(mPending.load() != 0)
+				mPendingDone.wait(lock);
+			lock.unlock();
+
+			mObserver.reset();
+			mArena.terminate();
+		}
+	}
+
+	/**
+	 * @brief Get the group whose handler the calling thread is running, NULL if none.
+	 */
+	static ArenaWorkerGroup* current()
+	{
+		return *currentSlot();
+	}
+
+	inline std::size_t size() const
+	{
+		return (std::size_t)mArena.max_concurrency();
+	}
+
+	tbb::task_arena& getArena()
+	{ return mArena; }
+
+protected:
+	/**
+	 * The task enqueued to the arena for each handler.
+	 */
+	struct Task
+	{
+		Task(ArenaWorkerGroup* g, const boost::function<void()>& h) : group(g), handler(h)
+		{ }
+
+		void operator() () const
+		{
+			ArenaWorkerGroup*& slot = *currentSlot();
+			ArenaWorkerGroup* previous = slot;
+			slot = group;
+			try
+			{
+				tbb::this_task_arena::isolate(handler);
+			}
+			catch(std::exception& e)
+			{
+				printf("exception e: %s\n", e.what());
+			}
+			slot = previous;
+			group->retire();
+		}
+
+		ArenaWorkerGroup* group;
+		boost::function<void()> handler;
+	};
+
+	/**
+	 * Apply the placement to the threads TBB brings into the arena.
+	 */
+	class PlacementObserver : public tbb::task_scheduler_observer
+	{
+	public:
+		PlacementObserver(tbb::task_arena& arena, const ThreadPlacement& placement) : tbb::task_scheduler_observer(arena), mPlacement(placement)
+		{
+			observe(true);
+		}
+
+		~PlacementObserver()
+		{
+			observe(false);
+		}
+
+		virtual void on_scheduler_entry(bool is_worker)
+		{
+			// threads calling execute() keep their own placement
+			if(is_worker)
+				mPlacement.at((std::size_t)tbb::this_task_arena::current_thread_index()).apply();
+		}
+
+	private:
+		ThreadPlacement mPlacement;
+	};
+
+	void enqueue(const boost::function<void()>& handler)
+	{
+		++mPending;
+		mArena.enqueue(Task(this, handler));
+	}
+
+	void retire()
+	{
+		// the last one decrements under the lock, so stop() can't return and
+		// destroy the group between the decrement and the notification
+		std::size_t n = mPending.load();
+		while(n > 1)
+		{
+			if(mPending.compare_exchange_weak(n, n - 1))
+				return;
+		}
+
+		boost::mutex::scoped_lock lock(mPendingMutex);
+		if(--mPending == 0)
+			mPendingDone.notify_all();
+	}
+
+	static ArenaWorkerGroup** currentSlot()
+	{
+		static __thread ArenaWorkerGroup* group = NULL;
+		return &group;
+	}
+
+protected:
+	tbb::task_arena mArena;
+	boost::scoped_ptr<PlacementObserver> mObserver;
+
+	std::atomic<std::size_t> mPending;
+	std::atomic<bool> mTerminated;
+	boost::mutex mPendingMutex;
+	boost::condition_variable mPendingDone;
+};
+
+}
+
+#endif/*ZILLIANS_ARENAWORKERGROUP_H_*/
@@ -0,0 +1,316 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ASYNCLOGGER_H_
+#define ZILLIANS_ASYNCLOGGER_H_
+
+#include "core/Common.h"
+#include "core/Logger.h"
+#include "utility/TimerUtil.h"
+#include <tbb/atomic.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/type_traits.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <string>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief AsyncLogger moves formatting and writing of log records off the calling threads.
+ *
+ * The caller only captures the format string pointer and the arguments into a fixed-size
+ * record in its own single-producer ring, which takes neither lock nor system call. A
+ * background thread drains all rings, formats the records printf-style and hands the
+ * lines to the sink, so a slow disk or appender never stalls the caller.
+ *
+ * Memory is bounded by the ring capacity per thread. When a ring is full the record is
+ * either dropped (counted, and reported to the sink once the ring drains) or the caller
+ * waits for space, as selected by the overflow policy.
+ *
+ * @code
+ * AsyncLogger logger(AsyncLogger::log4cxxSink(GlobalLogger()));
+ * logger.info("session %llu connected from %s:%d", id, address.c_str(), port);
+ * @endcode
+ *
+ * @note The format string is kept by pointer until the record is written, so it must be
+ * a string literal or otherwise outlive the logger. String arguments are copied, up to
+ * MAX_STRING_SIZE bytes per record in total, beyond which they are truncated.
+ */
+class AsyncLogger : public boost::noncopyable
+{
+public:
+	enum
+	{
+		MAX_ARGUMENTS = 8,
+		MAX_STRING_SIZE = 96,
+		DEFAULT_CAPACITY = 1024,	///< Records per thread, about 200KB
+	};
+
+	struct OverflowPolicy
+	{
+		enum type
+		{
+			drop	= 0,	///< Drop the record if the ring of the thread is full
+			block	= 1,	///< Wait until the background thread makes space
+		};
+	};
+
+	/**
+	 * The signature of sinks: @code void sink(LogLevel::type level, uint64 timestamp_ms, const char* message); @endcode
+	 * where timestamp_ms is the TimerUtil::clock_get_time_ms() of the caller. Sinks are only
+	 * called from the background thread.
+	 */
+	typedef boost::function<void(LogLevel::type, uint64, const char*)> Sink;
+
+public:
+	/**
+	 * @param sink Called for each formatted record.
+	 * @param capacity The size of the ring of each thread, must be a power of two.
+	 * @param policy What to do on a full ring.
+	 */
+	explicit AsyncLogger(const Sink& sink, std::size_t capacity = DEFAULT_CAPACITY, OverflowPolicy::type policy = OverflowPolicy::drop);
+
+	/**
+	 * Write all records logged so far and stop the background thread.
+	 */
+	~AsyncLogger();
+
+public:
+	/**
+	 * @brief Capture a record to be formatted and written by the background thread.
+	 *
+	 * Arguments can be integers, enums, floating points, pointers, C strings and std::string.
+	 *
+	 * @return False if the record is dropped.
+	 */
+	template<typename... Args>
+	inline bool log(LogLevel::type level, const char* format, const Args&... args)
+	{
+		BOOST_STATIC_ASSERT(sizeof...(Args) <= MAX_ARGUMENTS);
+
+		Ring* ring = localRing();
+		Record* record = ring->acquire();
+		if(UNLIKELY(!record))
+		{
+			record = (mPolicy == OverflowPolicy::block) ? waitForSpace(ring) : NULL;
+			if(!record)
+			{
+				ring->dropped = ring->dropped + 1;
+				return false;
+			}
+		}
+
+		record->format = format;
+		record->timestamp = TimerUtil::clock_get_time_ms();
+		record->level = (uint8)level;
+		record->count = 0;
+		record->string_size = 0;
+		captureAll(*record, args...);
+
+		ring->publish();
+		return true;
+	}
+
+	template<typename... Args> inline bool trace(const char* format, const Args&... args) { return log(LogLevel::trace, format, args...); }
+	template<typename... Args> inline bool debug(const char* format, const Args&... args) { return log(LogLevel::debug, format, args...); }
+	template<typename... Args> inline bool info(const char* format, const Args&... args) { return log(LogLevel::info, format, args...); }
+	template<typename... Args> inline bool warn(const char* format, const Args&... args) { return log(LogLevel::warn, format, args...); }
+	template<typename... Args> inline bool error(const char* format, const Args&... args) { return log(LogLevel::error, format, args...); }
+	template<typename... Args> inline bool fatal(const char* format, const Args&... args) { return log(LogLevel::fatal, format, args...); }
+
+	/**
+	 * Wait until every record logged before the call has been passed to the sink.
+	 */
+	void flush();
+
+	/**
+	 * Get the number of records dropped on full rings so far.
+	 */
+	uint64 dropped() const;
+
+public:
+	/**
+	 * Write lines of "timestamp level message" to the given stream, e.g. stderr.
+	 */
+	static Sink fileSink(FILE* file);
+
+#ifdef BUILD_WITH_LOG4CXX
+	/**
+	 * Forward to the given log4cxx logger, so its appenders run on the background thread.
+	 */
+	static Sink log4cxxSink(log4cxx::LoggerPtr logger);
+#endif
+
+private:
+	struct Argument
+	{
+		enum type { signed_integer, unsigned_integer, floating_point, pointer, string };
+	};
+
+	/**
+	 * The compact form of a log record, in which strings are stored as offsets into text.
+	 */
+	struct Record
+	{
+		const char* format;
+		uint64 timestamp;
+		uint8 level;
+		uint8 count;
+		uint8 string_size;
+		uint8 types[MAX_ARGUMENTS];
+		union
+		{
+			int64 i;
+			uint64 u;
+			double d;
+			const void* p;
+		} values[MAX_ARGUMENTS];
+		char text[MAX_STRING_SIZE];
+	};
+
+	/**
+	 * Ring is the single-producer single-consumer queue of records of one thread.
+	 *
+	 * It's co-owned by the thread and the logger, so whichever goes first leaves it to the other.
+	 */
+	struct Ring
+	{
+		explicit Ring(std::size_t capacity) : records(new Record[capacity]), mask(capacity - 1)
+		{
+			head = 0;
+			tail = 0;
+			dropped = 0;
+			reported = 0;
+			closed = false;
+		}
+
+		inline Record* acquire()
+		{
+			std::size_t t = tail;
+			if(t - head > mask) return NULL;
+			return &records[t & mask];
+		}
+
+		inline void publish()
+		{
+			tail = tail + 1;
+		}
+
+		boost::scoped_array<Record> records;
+		std::size_t mask;
+		tbb::atomic<std::size_t> head;		///< Written by the background thread only
+		char padding[64];
+		tbb::atomic<std::size_t> tail;		///< Written by the owning thread only
+		tbb::atomic<uint64> dropped;		///< Written by the owning thread only
+		uint64 reported;					///< Drops already reported to the sink
+		tbb::atomic<bool> closed;			///< Set when the owning thread exits
+	};
+
+	typedef boost::shared_ptr<Ring> RingPtr;
+
+private:
+	inline Ring* localRing()
+	{
+		RingPtr* ring = mLocal.get();
+		if(UNLIKELY(!ring)) ring = registerThread();
+		return ring->get();
+	}
+
+	RingPtr* registerThread();
+	Record* waitForSpace(Ring* ring);
+	static void releaseRing(RingPtr* ring);
+
+	void run();
+	std::size_t drain();
+	void write(const Record& record);
+
+	static inline void captureAll(Record&)
+	{ }
+
+	template<typename T, typename... Rest>
+	static inline void captureAll(Record& record, const T& first, const Rest&... rest)
+	{
+		capture(record, first);
+		captureAll(record, rest...);
+	}
+
+	template<typename T>
+	static inline typename boost::enable_if_c<boost::is_integral<T>::value && boost::is_signed<T>::value>::type capture(Record& record, T value)
+	{
+		record.types[record.count] = Argument::signed_integer;
+		record.values[record.count++].i = value;
+	}
+
+	template<typename T>
+	static inline typename boost::enable_if_c<(boost::is_integral<T>::value && !boost::is_signed<T>::value) || boost::is_enum<T>::value>::type capture(Record& record, T value)
+	{
+		record.types[record.count] = Argument::unsigned_integer;
+		record.values[record.count++].u = value;
+	}
+
+	template<typename T>
+	static inline typename boost::enable_if<boost::is_floating_point<T> >::type capture(Record& record, T value)
+	{
+		record.types[record.count] = Argument::floating_point;
+		record.values[record.count++].d = value;
+	}
+
+	template<typename T>
+	static inline void capture(Record& record, T* value)
+	{
+		record.types[record.count] = Argument::pointer;
+		record.values[record.count++].p = value;
+	}
+
+	static inline void capture(Record& record, const std::string& value)
+	{
+		capture(record, value.c_str());
+	}
+
+	static inline void capture(Record& record, char* value)
+	{
+		capture(record, (const char*)value);
+	}
+
+	static void capture(Record& record, const char* value);
+
+private:
+	Sink mSink;
+	std::size_t mCapacity;
+	OverflowPolicy::type mPolicy;
+
+	boost::thread_specific_ptr<RingPtr> mLocal;
+	mutable boost::mutex mRingsLock;
+	std::vector<RingPtr> mRings;
+
+	tbb::atomic<bool> mStopping;
+	std::string mLine;	///< Used by the background thread only
+	boost::thread mThread;
+};
+
+}
+
+#endif/*ZILLIANS_ASYNCLOGGER_H_*/
@@ -24,6 +24,9 @@
 #define ZILLIANS_ATOMIC_H_
 
 #include "core/Types.h"
+#include "utility/BitTrickUtil.h"
+#include <boost/assert.hpp>
+#include <atomic>
 
 #if defined(WIN32)
 #include <intrin.h>
@@ -33,6 +36,8 @@
 #pragma intrinsic(_InterlockedExchangeAdd)
 #pragma intrinsic(_InterlockedCompareExchange)
 #pragma intrinsic(_InterlockedCompareExchange64)
+#pragma intrinsic(_InterlockedOr64)
+#pragma intrinsic(_InterlockedAnd64)
 
 #if defined(_WIN64)
 #pragma intrinsic(_InterlockedCompareExchange128)
@@ -41,11 +46,33 @@
 
 namespace zillians { namespace atomic {
 
+/**
+ * Atomic operations on plain (volatile) variables and on std::atomic.
+ *
+ * Every operation takes the memory order it needs, defaulting to the full barrier
+ * the operations used to have (memory_order_seq_cst), so callers can relax it to
+ * acquire, release or relaxed where the ordering is known. Prefer std::atomic
+ * variables in new code, the plain overloads are kept for structures which can't
+ * hold a std::atomic (e.g. fields shared with volatile pointer casts).
+ */
+namespace detail {
+
+/**
+ * The order used when a compare-and-swap fails, which may not contain a release.
+ */
+inline std::memory_order cas_failure_order(std::memory_order order)
+{
+	return (order == std::memory_order_acq_rel) ? std::memory_order_acquire :
+			(order == std::memory_order_release) ? std::memory_order_relaxed : order;
+}
+
+}
+
 template<typename T>
-inline T inc(volatile T* ptr)
+inline T inc(volatile T* ptr, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_add_and_fetch(ptr, static_cast<T> (1));
+	return __atomic_add_fetch(ptr, static_cast<T> (1), static_cast<int>(order));
 #elif defined(WIN32)
 	BOOST_ASSERT(sizeof(T) == 4);
 	return _InterlockedIncrement(reinterpret_cast<volatile long*>(ptr));
@@ -53,10 +80,10 @@ inline T inc(volatile T* ptr)
 }
 
 template<typename T>
-inline T dec(volatile T* ptr)
+inline T dec(volatile T* ptr, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_sub_and_fetch(ptr, static_cast<T> (1));
+	return __atomic_sub_fetch(ptr, static_cast<T> (1), static_cast<int>(order));
 #elif defined(WIN32)
 	BOOST_ASSERT(sizeof(T) == 4);
 	return _InterlockedDecrement(reinterpret_cast<volatile long*>(ptr));
@@ -64,10 +91,10 @@ inline T dec(volatile T* ptr)
 }
 
 template<typename T>
-inline T add(volatile T* ptr, const T val)
+inline T add(volatile T* ptr, const T val, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_fetch_and_add(ptr, val);
+	return __atomic_fetch_add(ptr, val, static_cast<int>(order));
 #elif defined(WIN32)
 	BOOST_ASSERT(sizeof(T) == 4);
 	return _InterlockedExchangeAdd(reinterpret_cast<volatile long*>(ptr), val);
@@ -75,10 +102,12 @@ inline T add(volatile T* ptr, const T val)
 }
 
 template<typename T>
-inline T cas(volatile T* ptr, const T val, const T cmp)
+inline T cas(volatile T* ptr, const T val, const T cmp, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_val_compare_and_swap(ptr, cmp, val);
+	T expected = cmp;
+	__atomic_compare_exchange_n(ptr, &expected, val, false, static_cast<int>(order), static_cast<int>(detail::cas_failure_order(order)));
+	return expected;
 #elif defined(WIN32)
 	if(sizeof(T) == 4)
 		return _InterlockedCompareExchange(reinterpret_cast<volatile long*>(ptr), val, cmp);
@@ -88,10 +117,11 @@ inline T cas(volatile T* ptr, const T val, const T cmp)
 }
 
 template<typename T>
-inline bool b_cas(volatile T* ptr, const T val, const T cmp)
+inline bool b_cas(volatile T* ptr, const T val, const T cmp, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_bool_compare_and_swap(ptr, cmp, val);
+	T expected = cmp;
+	return __atomic_compare_exchange_n(ptr, &expected, val, false, static_cast<int>(order), static_cast<int>(detail::cas_failure_order(order)));
 #elif defined(WIN32)
 	if(sizeof(T) == 4)
 		return _InterlockedCompareExchange(reinterpret_cast<volatile long*>(ptr), val, cmp) == cmp;
@@ -100,13 +130,34 @@ inline bool b_cas(volatile T* ptr, const T val, const T cmp)
 #endif
 }
 
-inline void* cas_ptr(void* volatile* pdst, void* pval, void* pcmp)
+template<typename T>
+inline T fetch_or(volatile T* ptr, const T val, std::memory_order order = std::memory_order_seq_cst)
+{
+#if defined(__GNUC__)
+	return __atomic_fetch_or(ptr, val, static_cast<int>(order));
+#elif defined(WIN32)
+	BOOST_ASSERT(sizeof(T) == 8);
+	return _InterlockedOr64(reinterpret_cast<volatile int64*>(ptr), val);
+#endif
+}
+
+template<typename T>
+inline T fetch_and(volatile T* ptr, const T val, std::memory_order order = std::memory_order_seq_cst)
+{
+#if defined(__GNUC__)
+	return __atomic_fetch_and(ptr, val, static_cast<int>(order));
+#elif defined(WIN32)
+	BOOST_ASSERT(sizeof(T) == 8);
+	return _InterlockedAnd64(reinterpret_cast<volatile int64*>(ptr), val);
+#endif
+}
+
+inline void* cas_ptr(void* volatile* pdst, void* pval, void* pcmp, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return reinterpret_cast<void*> (__sync_val_compare_and_swap(
-			reinterpret_cast<volatile ptrdiff_t*> (pdst),
-			reinterpret_cast<ptrdiff_t> (pcmp),
-			reinterpret_cast<ptrdiff_t> (pval)));
+	void* expected = pcmp;
+	__atomic_compare_exchange_n(pdst, &expected, pval, false, static_cast<int>(order), static_cast<int>(detail::cas_failure_order(order)));
+	return expected;
 #elif defined(WIN32)
 	return reinterpret_cast<void*>(_InterlockedCompareExchange(
 					reinterpret_cast<volatile long *>(pdst),
@@ -115,13 +166,11 @@ inline void* cas_ptr(void* volatile* pdst, void* pval, void* pcmp)
 #endif
 }
 
-inline bool b_cas_ptr(void* volatile* pdst, void* pval, void* pcmp)
+inline bool b_cas_ptr(void* volatile* pdst, void* pval, void* pcmp, std::memory_order order = std::memory_order_seq_cst)
 {
 #if defined(__GNUC__)
-	return __sync_bool_compare_and_swap(
-			reinterpret_cast<volatile ptrdiff_t*> (pdst),
-			reinterpret_cast<ptrdiff_t> (pcmp),
-			reinterpret_cast<ptrdiff_t> (pval));
+	void* expected = pcmp;
+	return __atomic_compare_exchange_n(pdst, &expected, pval, false, static_cast<int>(order), static_cast<int>(detail::cas_failure_order(order)));
 #elif defined(WIN32)
 	return _InterlockedCompareExchange(
 			reinterpret_cast<volatile long *>(pdst),
@@ -131,134 +180,341 @@ inline bool b_cas_ptr(void* volatile* pdst, void* pval, void* pcmp)
 }
 
 template<typename T>
-inline T exchange(T& val, T val_new)
+inline T exchange(T& val, T val_new, std::memory_order order = std::memory_order_seq_cst)
 {
-	T val_old;
 #if defined(__GNUC__)
-	val_old = val_new;
-	__asm__ volatile (
-			"lock; xchg %0, %1"
-			: "=r" (val_old)
-			: "m" (val), "0" (val_old)
-			: "memory"
-			);
+	return __atomic_exchange_n(&val, val_new, static_cast<int>(order));
 #elif defined(WIN32)
-	val_old = _InterlockedExchange((volatile T*)&val, val_new);
+	return _InterlockedExchange((volatile T*)&val, val_new);
 #endif
-	return val_old;
 }
 
-inline bool bitmap_btsr(uint64& bitmap, int index_to_set, int index_to_reset)
+//////////////////////////////////////////////////////////////////////////
+// the same operations on std::atomic
+
+template<typename T>
+inline T inc(std::atomic<T>& v, std::memory_order order = std::memory_order_seq_cst)
 {
-	uint64 bitmap_old;
-#if defined(__GNUC__)
-	uint64 dummy;
-	__asm__ volatile (
-			"mov %0, %1\n\t"
-			"1:\n\t"
-			"mov %1, %2\n\t"
-			"bts %3, %2\n\t"
-			"btr %4, %2\n\t"
-			"lock cmpxchg %2, %0\n\t"
-			"jnz 1b\n\t"
-			: "+m" (bitmap), "=&a" (bitmap_old), "=&r" (dummy)
-			: "r" (uint64(index_to_set)), "r" (uint64(index_to_reset))
-			: "cc"
-			);
+	return v.fetch_add(static_cast<T>(1), order) + static_cast<T>(1);
+}
+
+template<typename T>
+inline T dec(std::atomic<T>& v, std::memory_order order = std::memory_order_seq_cst)
+{
+	return v.fetch_sub(static_cast<T>(1), order) - static_cast<T>(1);
+}
+
+template<typename T, typename U>
+inline T add(std::atomic<T>& v, const U val, std::memory_order order = std::memory_order_seq_cst)
+{
+	return v.fetch_add(static_cast<T>(val), order);
+}
+
+template<typename T, typename U>
+inline T cas(std::atomic<T>& v, const U val, const U cmp, std::memory_order order = std::memory_order_seq_cst)
+{
+	T expected = static_cast<T>(cmp);
+	v.compare_exchange_strong(expected, static_cast<T>(val), order);
+	return expected;
+}
+
+template<typename T, typename U>
+inline bool b_cas(std::atomic<T>& v, const U val, const U cmp, std::memory_order order = std::memory_order_seq_cst)
+{
+	T expected = static_cast<T>(cmp);
+	return v.compare_exchange_strong(expected, static_cast<T>(val), order);
+}
+
+template<typename T, typename U>
+inline T fetch_or(std::atomic<T>& v, const U val, std::memory_order order = std::memory_order_seq_cst)
+{
+	return v.fetch_or(static_cast<T>(val), order);
+}
+
+template<typename T, typename U>
+inline T fetch_and(std::atomic<T>& v, const U val, std::memory_order order = std::memory_order_seq_cst)
+{
+	return v.fetch_and(static_cast<T>(val), order);
+}
+
+template<typename T, typename U>
+inline T exchange(std::atomic<T>& v, const U val_new, std::memory_order order = std::memory_order_seq_cst)
+{
+	return v.exchange(static_cast<T>(val_new), order);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// bitmap operations, all of them are read-modify-write on the whole word
+
+/**
+ * Set the bit index_to_set and reset the bit index_to_reset at once.
+ *
+ * @return The previous value of the bit index_to_reset.
+ */
+inline bool bitmap_btsr(std::atomic<uint64>& bitmap, int index_to_set, int index_to_reset, std::memory_order order = std::memory_order_seq_cst)
+{
+	uint64 bitmap_old = bitmap.load(std::memory_order_relaxed);
+	while(!bitmap.compare_exchange_weak(bitmap_old, (bitmap_old | uint64(1) << index_to_set) & ~(uint64(1) << index_to_reset),
+			order, std::memory_order_relaxed))
+	{ }
 	return (bool) (bitmap_old & (uint64(1) << index_to_reset));
-#elif defined(WIN32)
-	uint64 bitmap_new;
-	while(true)
-	{
-		bitmap_old = bitmap;
-		bitmap_new = (bitmap_old | uint64(1) << index_to_set) & ~(uint64(1) << index_to_reset);
-		if(_InterlockedCompareExchange((volatile LONG*)&bitmap, bitmap_new, bitmap_old) == (LONG)bitmap_old)
-			return (bool) (bitmap_old & (uint64(1) << index_to_reset));
-	}
-#endif
 }
 
-inline uint64 bitmap_xchg(uint64& bitmap, uint64 bitmap_new)
+inline uint64 bitmap_xchg(std::atomic<uint64>& bitmap, uint64 bitmap_new, std::memory_order order = std::memory_order_seq_cst)
 {
-	uint64 bitmap_old;
-#if defined(__GNUC__)
-	bitmap_old = bitmap_new;
-	__asm__ volatile (
-			"lock; xchg %0, %1"
-			: "=r" (bitmap_old)
-			: "m" (bitmap), "0" (bitmap_old)
-			: "memory"
-			);
-#elif defined(WIN32)
-	bitmap_old = _InterlockedExchange((volatile LONG*)&bitmap, bitmap_new);
-#endif
-	return bitmap_old;
+	return bitmap.exchange(bitmap_new, order);
 }
 
 // itez => "if-zero-then-else" atomic operation
 // if the value is zero, then it's substituted by valueThen, otherwise by valueElse
 // and return the original value
-inline uint64 bitmap_izte(uint64& bitmap, uint64 bitmap_then, uint64 bitmap_else)
+inline uint64 bitmap_izte(std::atomic<uint64>& bitmap, uint64 bitmap_then, uint64 bitmap_else, std::memory_order order = std::memory_order_seq_cst)
 {
-	uint64 bitmap_old;
-#if defined(__GNUC__)
-	uint64 dummy;
-	__asm__ volatile (
-			"mov %0, %1\n\t"
-			"1:\n\t"
-			"mov %3, %2\n\t"
-			"test %1, %1\n\t"
-			"jz 2f\n\t"
-			"mov %4, %2\n\t"
-			"2:\n\t"
-			"lock cmpxchg %2, %0\n\t"
-			"jnz 1b\n\t"
-			: "+m" (bitmap), "=&a" (bitmap_old), "=&r" (dummy)
-			: "r" (bitmap_then), "r" (bitmap_else)
-			: "cc"
-			);
-#elif defined(WIN32)
-	uint64 bitmap_new;
-	while(true)
-	{
-		bitmap_old = bitmap;
-		bitmap_new = (bitmap_old == 0) ? bitmap_then : bitmap_else;
-		if(_InterlockedCompareExchange((volatile LONG*)&bitmap, bitmap_new, bitmap_old) == (LONG)bitmap_old)
-			return bitmap_old;
-	}
-#endif
+	uint64 bitmap_old = bitmap.load(std::memory_order_relaxed);
+	while(!bitmap.compare_exchange_weak(bitmap_old, (bitmap_old == 0) ? bitmap_then : bitmap_else,
+			order, std::memory_order_relaxed))
+	{ }
 	return bitmap_old;
 }
 
-inline bool bitmap_or(uint64& bitmap, uint64 bitmap_or)
+/**
+ * @return True if any bit was set before.
+ */
+inline bool bitmap_or(std::atomic<uint64>& bitmap, uint64 bitmap_or, std::memory_order order = std::memory_order_seq_cst)
 {
-	uint64 bitmap_old;
-#if defined(__GNUC__)
-	uint64 dummy;
-	__asm__ volatile (
-			"mov %0, %1\n\t"
-			"1:\n\t"
-			"mov %1, %2\n\t"
-			"or %3, %2\n\t"
-			"lock cmpxchg %2, %0\n\t"
-			"jnz 1b\n\t"
-			: "+m" (bitmap), "=&a" (bitmap_old), "=&r" (dummy)
-			: "r" (bitmap_or)
-			: "cc"
-			);
-	return bitmap_old;
-#elif defined(WIN32)
-	uint64 bitmap_new;
-	while(true)
+	return bitmap.fetch_or(bitmap_or, order) != 0;
+}
+
+}
+
+template<bool Striped>
+struct atomic_bitset_word
+{
+	std::atomic<uint64> bits;
+	byte padding[64 - sizeof(uint64)];
+};
+
+template<>
+struct atomic_bitset_word<false>
+{
+	std::atomic<uint64> bits;
+};
+
+/**
+ * @brief AtomicBitset is a fixed-size bitset of any width whose bits are set and reset atomically.
+ *
+ * Bits are kept in 64-bit words, and each word takes a cache line of its own unless Striped is
+ * false, so threads working on bits of different words never contend. Scanning visits one word
+ * at a time and jumps between set bits with tzcnt, so it costs by the number of words plus the
+ * number of set bits rather than by N.
+ *
+ * Every operation on a single bit is atomic, operations on many bits (count(), scanning) see
+ * each word atomically but not the whole set at one instant.
+ * Changing a bit is acquire-release and reading one is acquire, so data written before set()
+ * is visible to the thread which sees the bit set.
+ *
+ * @code
+ * AtomicBitset<1024> slots;
+ * std::size_t slot = slots.acquire();	// first free slot, or slots.size() if full
+ * ...
+ * slots.reset(slot);
+ * @endcode
+ */
+template<std::size_t N, bool Striped = true>
+class AtomicBitset
+{
+public:
+	enum
 	{
-		bitmap_old = bitmap;
-		bitmap_new = (bitmap_old | bitmap_or);
-		if(_InterlockedCompareExchange((volatile LONG*)&bitmap, bitmap_new, bitmap_old) == (LONG)bitmap_old)
-			return bitmap_old;
+		BITS_PER_WORD = 64,
+		WORD_COUNT = (N + BITS_PER_WORD - 1) / BITS_PER_WORD,
+	};
+
+	AtomicBitset()
+	{
+		clear();
+	}
+
+public:
+	inline std::size_t size() const
+	{
+		return N;
+	}
+
+	inline bool test(std::size_t i) const
+	{
+		BOOST_ASSERT(i < N);
+		return (mWords[i / BITS_PER_WORD].bits.load(std::memory_order_acquire) >> (i % BITS_PER_WORD)) & 1;
+	}
+
+	/**
+	 * @return The previous value of the bit, so it's also test-and-set.
+	 */
+	inline bool set(std::size_t i)
+	{
+		BOOST_ASSERT(i < N);
+		const uint64 mask = uint64(1) << (i % BITS_PER_WORD);
+		return (mWords[i / BITS_PER_WORD].bits.fetch_or(mask, std::memory_order_acq_rel) & mask) != 0;
+	}
+
+	/**
+	 * @return The previous value of the bit, so it's also test-and-reset.
+	 */
+	inline bool reset(std::size_t i)
+	{
+		BOOST_ASSERT(i < N);
+		const uint64 mask = uint64(1) << (i % BITS_PER_WORD);
+		return (mWords[i / BITS_PER_WORD].bits.fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0;
+	}
+
+	inline bool test_and_set(std::size_t i)
+	{
+		return set(i);
+	}
+
+	/**
+	 * Reset all bits, not atomic as a whole.
+	 */
+	void clear()
+	{
+		for(std::size_t w = 0; w < WORD_COUNT; ++w)
+			mWords[w].bits.store(0, std::memory_order_release);
+	}
+
+	/**
+	 * Set a bit which was not set, searching from the word of the given hint and wrapping around.
+	 *
+	 * Spreading the hints of different threads (e.g. by thread id) keeps them on different words.
+	 *
+	 * @return The index of the bit set, or size() if all bits are set.
+	 */
+	std::size_t acquire(std::size_t hint = 0)
+	{
+		const std::size_t first = (hint % N) / BITS_PER_WORD;
+		for(std::size_t n = 0; n < WORD_COUNT; ++n)
+		{
+			const std::size_t w = (first + n) % WORD_COUNT;
+			uint64 bits = mWords[w].bits.load(std::memory_order_relaxed);
+			while(~bits & valid(w))
+			{
+				const uint64 mask = uint64(1) << count_trailing_zeros(~bits & valid(w));
+				bits = mWords[w].bits.fetch_or(mask, std::memory_order_acq_rel);
+				if(!(bits & mask))
+					return w * BITS_PER_WORD + count_trailing_zeros(mask);
+			}
+		}
+		return N;
+	}
+
+	/**
+	 * Atomically take all bits of a word and reset them, e.g. to consume pending signals.
+	 */
+	inline uint64 take_word(std::size_t w)
+	{
+		BOOST_ASSERT(w < WORD_COUNT);
+		return mWords[w].bits.exchange(0, std::memory_order_acq_rel);
 	}
-#endif
-}
 
-} }
+	inline uint64 word(std::size_t w) const
+	{
+		BOOST_ASSERT(w < WORD_COUNT);
+		return mWords[w].bits.load(std::memory_order_acquire);
+	}
+
+public:
+	std::size_t count() const
+	{
+		std::size_t n = 0;
+		for(std::size_t w = 0; w < WORD_COUNT; ++w)
+			n += population_count(mWords[w].bits.load(std::memory_order_acquire));
+		return n;
+	}
+
+	bool any() const
+	{
+		for(std::size_t w = 0; w < WORD_COUNT; ++w)
+		{
+			if(mWords[w].bits.load(std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	inline bool none() const
+	{
+		return !any();
+	}
+
+	/**
+	 * @return The index of the lowest set bit, or size() if none.
+	 */
+	inline std::size_t find_first() const
+	{
+		return find_from(0);
+	}
+
+	/**
+	 * @return The index of the lowest set bit after i, or size() if none.
+	 */
+	inline std::size_t find_next(std::size_t i) const
+	{
+		return (i + 1 >= N) ? N : find_from(i + 1);
+	}
+
+	/**
+	 * @return The index of the highest set bit, or size() if none.
+	 */
+	std::size_t find_last() const
+	{
+		for(std::size_t w = WORD_COUNT; w-- > 0; )
+		{
+			uint64 bits = mWords[w].bits.load(std::memory_order_acquire);
+			if(bits)
+				return w * BITS_PER_WORD + floor_log2(bits);
+		}
+		return N;
+	}
+
+	/**
+	 * Call handler(i) for each set bit i in ascending order, with the words read one at a time.
+	 */
+	template<typename Handler>
+	void for_each(Handler handler) const
+	{
+		for(std::size_t w = 0; w < WORD_COUNT; ++w)
+		{
+			for(uint64 bits = mWords[w].bits.load(std::memory_order_acquire); bits; bits &= bits - 1)
+				handler(w * BITS_PER_WORD + count_trailing_zeros(bits));
+		}
+	}
+
+private:
+	std::size_t find_from(std::size_t i) const
+	{
+		std::size_t w = i / BITS_PER_WORD;
+		uint64 bits = mWords[w].bits.load(std::memory_order_acquire) & (~uint64(0) << (i % BITS_PER_WORD));
+		while(true)
+		{
+			if(bits)
+				return w * BITS_PER_WORD + count_trailing_zeros(bits);
+			if(++w == WORD_COUNT)
+				return N;
+			bits = mWords[w].bits.load(std::memory_order_acquire);
+		}
+	}
+
+	/**
+	 * The bits of the word within the size, only the last word may be partial.
+	 */
+	static inline uint64 valid(std::size_t w)
+	{
+		return (w + 1 < WORD_COUNT || N % BITS_PER_WORD == 0) ? ~uint64(0) : (uint64(1) << (N % BITS_PER_WORD)) - 1;
+	}
+
+private:
+	atomic_bitset_word<Striped> mWords[WORD_COUNT];
+};
+
+}
 
 #endif /* ZILLIANS_ATOMIC_H_ */
@@ -99,6 +99,94 @@ public:
         return true;
     }
 
+    /**
+     * @brief Push up to count elements with a single CAS on the enqueue position.
+     *
+     * The producer claims the longest run of free cells (up to count) at the
+     * tail at once, then fills them in order.
+     *
+     * @return The number of elements pushed, which is less than count if the queue is (nearly) full.
+     */
+    size_t push_n(T const* data, size_t count)
+    {
+        if (count == 0)
+            return 0;
+
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        size_t n;
+        for (;;)
+        {
+            size_t seq = buffer[pos & buffer_mask].sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                // cells after the first one are free only if consumers are done with them
+                for (n = 1; n < count; ++n)
+                {
+                    if (buffer[(pos + n) & buffer_mask].sequence.load(std::memory_order_acquire) != pos + n)
+                        break;
+                }
+                if (enqueue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return 0;
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            cell_t* cell = &buffer[(pos + i) & buffer_mask];
+            cell->data = data[i];
+            cell->sequence.store(pos + i + 1, std::memory_order_release);
+        }
+
+        return n;
+    }
+
+    /**
+     * @brief Pop up to count elements with a single CAS on the dequeue position.
+     *
+     * @return The number of elements popped, which is less than count if the queue is (nearly) empty.
+     */
+    size_t pop_n(T* data, size_t count)
+    {
+        if (count == 0)
+            return 0;
+
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        size_t n;
+        for (;;)
+        {
+            size_t seq = buffer[pos & buffer_mask].sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                for (n = 1; n < count; ++n)
+                {
+                    if (buffer[(pos + n) & buffer_mask].sequence.load(std::memory_order_acquire) != pos + n + 1)
+                        break;
+                }
+                if (dequeue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return 0;
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            cell_t* cell = &buffer[(pos + i) & buffer_mask];
+            data[i] = cell->data;
+            cell->sequence.store(pos + i + buffer_mask + 1, std::memory_order_release);
+        }
+
+        return n;
+    }
+
 private:
     struct cell_t
     {
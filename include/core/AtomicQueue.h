@@ -26,6 +26,12 @@
 #include "core/Atomic.h"
 #include "core/AtomicStack.h"
 #include <tbb/atomic.h>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <new>
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+#include <utility>
+#endif
 
 namespace zillians { namespace atomic {
 
@@ -239,8 +245,139 @@ public:
 
 #else
 
+/**
+ * Atomic Linked List FIFO Queue
+ *
+ * Michael and Scott's lock-free queue using single-word CAS only: nodes are
+ * reclaimed through HazardPointer, so they can't be reused while a concurrent
+ * push or pop still reads them, which rules out ABA without tagged pointers.
+ *
+ * Items are linked through internal nodes, so T doesn't need to derive from
+ * any node type. pop() returns NULL if the queue is empty.
+ */
+template<class T>
+class queue
+{
+private:
+	struct node
+	{
+		explicit node(T* const i) : _item(i), _next(NULL)
+		{ }
+
+		T* _item;
+		std::atomic<node*> _next;
+	};
+
+public:
+	queue()
+	{
+		node* dummy = new node(NULL);
+		_head.store(dummy, std::memory_order_relaxed);
+		_tail.store(dummy, std::memory_order_relaxed);
+	}
+
+	~queue()
+	{
+		node* p = _head.load(std::memory_order_relaxed);
+		while(p)
+		{
+			node* next = p->_next.load(std::memory_order_relaxed);
+			delete p;
+			p = next;
+		}
+	}
+
+	void push(T * const item)
+	{
+		node* n = new node(item);
+
+		while(true)
+		{
+			node* tail = HazardPointer::protect(_tail);
+			node* next = tail->_next.load(std::memory_order_acquire);
+
+			if(tail != _tail.load(std::memory_order_acquire))
+				continue;
+
+			if(next != NULL)
+			{
+				// help a concurrent push to swing the tail
+				_tail.compare_exchange_weak(tail, next);
+				continue;
+			}
+
+			if(tail->_next.compare_exchange_weak(next, n))
+			{
+				_tail.compare_exchange_strong(tail, n);
+				break;
+			}
+		}
+
+		HazardPointer::clear();
+	}
+
+	T* pop()
+	{
+		T* item = NULL;
+		node* head;
+
+		while(true)
+		{
+			head = HazardPointer::protect(_head, 0);
+			node* tail = _tail.load(std::memory_order_acquire);
+			node* next = HazardPointer::protect(head->_next, 1);
+
+			if(head != _head.load(std::memory_order_acquire))
+				continue;
+
+			if(next == NULL)
+			{
+				head = NULL;
+				break;
+			}
+
+			if(head == tail)
+			{
+				_tail.compare_exchange_weak(tail, next);
+				continue;
+			}
+
+			item = next->_item;
+			if(_head.compare_exchange_weak(head, next))
+				break;
+		}
+
+		HazardPointer::clear(0);
+		HazardPointer::clear(1);
+
+		if(head)
+			HazardPointer::retire(head);
+
+		return item;
+	}
+
+	bool empty() const
+	{
+		node* head = HazardPointer::protect(_head);
+		bool result = (head->_next.load(std::memory_order_acquire) == NULL);
+		HazardPointer::clear();
+		return result;
+	}
+
+private:
+	std::atomic<node*> _head;
+	std::atomic<node*> _tail;
+
+private:
+	queue (const queue&);
+	void operator = (const queue&);
+};
+
 /**
  * AtomicQueue is based on ZeroMQ y-suite.
+ *
+ * Slots are raw storage, elements are constructed and destroyed in place by
+ * the user of the queue (i.e. AtomicPipe).
  */
 template <typename T, int N> class AtomicQueue
 {
@@ -254,7 +391,8 @@ public:
          back_pos = 0;
          end_chunk = begin_chunk;
          end_pos = 0;
-         spare_chunk = NULL;
+         for (int i = 0; i != SPARE_CHUNKS; ++i)
+             spare_chunks [i] = NULL;
     }
 
     inline ~AtomicQueue()
@@ -271,19 +409,22 @@ public:
             free (o);
         }
 
-        chunk_t *sc = spare_chunk.fetch_and_store(NULL);
-        if (sc)
-            free (sc);
+        for (int i = 0; i != SPARE_CHUNKS; ++i)
+        {
+            chunk_t *sc = spare_chunks [i].fetch_and_store(NULL);
+            if (sc)
+                free (sc);
+        }
     }
 
     inline T &front()
     {
-         return begin_chunk->values [begin_pos];
+         return *reinterpret_cast<T*> (&begin_chunk->values [begin_pos]);
     }
 
     inline T &back()
     {
-        return back_chunk->values [back_pos];
+        return *reinterpret_cast<T*> (&back_chunk->values [back_pos]);
     }
 
     inline void push ()
@@ -294,7 +435,7 @@ public:
         if (++end_pos != N)
             return;
 
-        chunk_t *sc = spare_chunk.fetch_and_store(NULL);
+        chunk_t *sc = take_spare ();
         if (sc) {
             end_chunk->next = sc;
             sc->prev = end_chunk;
@@ -337,20 +478,49 @@ public:
             begin_chunk->prev = NULL;
             begin_pos = 0;
 
-            chunk_t *cs = spare_chunk.fetch_and_store(o);
-            if (cs)
-                free(cs);
+            put_spare (o);
         }
     }
 
 private:
     struct chunk_t
     {
-         T values [N];
+         typename boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value>::type values [N];
          chunk_t *prev;
          chunk_t *next;
     };
 
+    /**
+     * Chunks released by the reader are kept for the writer, so a pipe going
+     * up and down by a few chunks doesn't go to the heap at all. The writer
+     * only takes and the reader only puts, starting from opposite ends of the array.
+     */
+    enum { SPARE_CHUNKS = 4 };
+
+    inline chunk_t *take_spare ()
+    {
+        for (int i = SPARE_CHUNKS - 1; i >= 0; --i)
+        {
+            if (spare_chunks [i] != NULL)
+            {
+                chunk_t *sc = spare_chunks [i].fetch_and_store(NULL);
+                if (sc)
+                    return sc;
+            }
+        }
+        return NULL;
+    }
+
+    inline void put_spare (chunk_t *chunk_)
+    {
+        for (int i = 0; i != SPARE_CHUNKS; ++i)
+        {
+            if (spare_chunks [i] == NULL && spare_chunks [i].compare_and_swap(chunk_, NULL) == NULL)
+                return;
+        }
+        free (chunk_);
+    }
+
     chunk_t *begin_chunk;
     int begin_pos;
     chunk_t *back_chunk;
@@ -358,7 +528,7 @@ private:
     chunk_t *end_chunk;
     int end_pos;
 
-    tbb::atomic<chunk_t*> spare_chunk;
+    tbb::atomic<chunk_t*> spare_chunks [SPARE_CHUNKS];
 
 private:
     AtomicQueue (const AtomicQueue&);
@@ -368,6 +538,10 @@ private:
 
 /**
  * AtomicPipe is based on ZeroMQ y-suite
+ *
+ * Elements are constructed in place by write() and emplace(), and moved out
+ * and destroyed by read(), so passing non-trivial messages (e.g. holding a
+ * shared_ptr) through the pipe costs no extra copy with C++0x.
  */
 template <typename T, int N> class AtomicPipe
 {
@@ -378,26 +552,65 @@ public:
 
         r = w = f = &queue.back ();
         c = &queue.back();
+
+        written.store (0, std::memory_order_relaxed);
+        consumed.store (0, std::memory_order_relaxed);
+        consumed_seen = 0;
+    }
+
+    inline ~AtomicPipe ()
+    {
+        // destroy the elements written but never read
+        while (&queue.front () != &queue.back ())
+        {
+            queue.front ().~T ();
+            queue.pop ();
+        }
     }
 
     inline void write (const T &value_, bool incomplete_)
     {
-        queue.back () = value_;
-        queue.push ();
+        new (&queue.back ()) T (value_);
+        commit (incomplete_);
+    }
 
-        if (!incomplete_)
-            f = &queue.back ();
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+    inline void write (T &&value_, bool incomplete_)
+    {
+        new (&queue.back ()) T (std::move (value_));
+        commit (incomplete_);
+    }
+
+    /**
+     * Construct the element in place from the given arguments.
+     */
+    template <typename... Args>
+    inline void emplace (bool incomplete_, Args&&... args_)
+    {
+        new (&queue.back ()) T (std::forward<Args> (args_)...);
+        commit (incomplete_);
     }
+#endif
 
     inline bool unwrite (T *value_)
     {
         if (f == &queue.back ())
             return false;
         queue.unpush ();
-        *value_ = queue.back ();
+        take (queue.back (), value_);
+        written.store (written.load (std::memory_order_relaxed) - 1, std::memory_order_relaxed);
         return true;
     }
 
+    /**
+     * Complete the elements written by incomplete writes, so the next flush()
+     * publishes them too.
+     */
+    inline void complete ()
+    {
+        f = &queue.back ();
+    }
+
     inline bool flush ()
     {
         if (w == f)
@@ -432,12 +645,62 @@ public:
         if (!check_read ())
             return false;
 
-        *value_ = queue.front ();
+        take (queue.front (), value_);
         queue.pop ();
+        consumed.store (consumed.load (std::memory_order_relaxed) + 1, std::memory_order_release);
         return true;
     }
 
+    /**
+     * Tell if at least capacity_ elements are written but not read yet, must
+     * be called by the writer. The reader's count is only re-read when the
+     * last one seen says the pipe is full, so a pipe with room costs no
+     * access to the reader's cache line.
+     */
+    inline bool full (std::size_t capacity_)
+    {
+        std::size_t count = written.load (std::memory_order_relaxed);
+        if (count - consumed_seen < capacity_)
+            return false;
+
+        consumed_seen = consumed.load (std::memory_order_acquire);
+        return count - consumed_seen >= capacity_;
+    }
+
+    /**
+     * The number of elements written (flushed or not) but not read yet, it's
+     * only a snapshot when called by neither the writer nor the reader.
+     */
+    inline std::size_t depth () const
+    {
+        // read the reader's count first, it never overtakes the writer's
+        std::size_t read_count = consumed.load (std::memory_order_acquire);
+        return written.load (std::memory_order_acquire) - read_count;
+    }
+
 protected:
+    inline void commit (bool incomplete_)
+    {
+        queue.push ();
+        written.store (written.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+
+        if (!incomplete_)
+            f = &queue.back ();
+    }
+
+    /**
+     * Move the element out of its slot and destroy it.
+     */
+    static inline void take (T &slot_, T *value_)
+    {
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+        *value_ = std::move (slot_);
+#else
+        *value_ = slot_;
+#endif
+        slot_.~T ();
+    }
+
     AtomicQueue <T, N> queue;
 
     T *w;
@@ -445,6 +708,11 @@ protected:
     T *f;
     tbb::atomic<T*> c;
 
+    //  element counts, each written by one side only
+    std::atomic<std::size_t> written;
+    std::size_t consumed_seen;
+    std::atomic<std::size_t> consumed;
+
 private:
     AtomicPipe (const AtomicPipe&);
     void operator = (const AtomicPipe&);
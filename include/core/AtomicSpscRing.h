@@ -0,0 +1,185 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ATOMICSPSCRING_H_
+#define ZILLIANS_ATOMICSPSCRING_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include <boost/assert.hpp>
+#include <atomic>
+
+namespace zillians {
+
+/**
+ * AtomicSpscRing is a bounded ring buffer for exactly one producer thread and one consumer thread.
+ *
+ * Unlike AtomicBoundedQueue, there is no per-cell sequence and no CAS: the producer owns
+ * the write position and the consumer owns the read position, each on its own cache line.
+ * Each side also keeps a cached copy of the other side's position and only reloads it
+ * (touching the other side's line) when the cached view says the ring is full or
+ * empty, so a link that rarely runs full or empty costs one store per operation.
+ *
+ * @note Calling push() from more than one thread, or pop() from more than one thread, is undefined.
+ */
+template<typename T>
+class AtomicSpscRing
+{
+public:
+    AtomicSpscRing(std::size_t buffer_size) : buffer(new T[buffer_size]), buffer_mask(buffer_size - 1)
+    {
+        BOOST_ASSERT((buffer_size >= 2) && ((buffer_size & (buffer_size - 1)) == 0) && "the buffer size must be greater than 2 and is power of 2");
+        write_pos.store(0, std::memory_order_relaxed);
+        read_pos_cache = 0;
+        read_pos.store(0, std::memory_order_relaxed);
+        write_pos_cache = 0;
+    }
+
+    ~AtomicSpscRing()
+    {
+        delete [] buffer;
+    }
+
+public:
+    /**
+     * @brief Push an element, must be called by the producer only.
+     *
+     * @return False if the ring is full.
+     */
+    bool push(T const& data)
+    {
+        size_t pos = write_pos.load(std::memory_order_relaxed);
+        if (pos - read_pos_cache > buffer_mask)
+        {
+            read_pos_cache = read_pos.load(std::memory_order_acquire);
+            if (pos - read_pos_cache > buffer_mask)
+                return false;
+        }
+
+        buffer[pos & buffer_mask] = data;
+        write_pos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pop an element, must be called by the consumer only.
+     *
+     * @return False if the ring is empty.
+     */
+    bool pop(T& data)
+    {
+        size_t pos = read_pos.load(std::memory_order_relaxed);
+        if (pos == write_pos_cache)
+        {
+            write_pos_cache = write_pos.load(std::memory_order_acquire);
+            if (pos == write_pos_cache)
+                return false;
+        }
+
+        data = buffer[pos & buffer_mask];
+        read_pos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Push up to count elements, published to the consumer by a single store.
+     *
+     * @return The number of elements pushed, which is less than count if the ring is (nearly) full.
+     */
+    size_t push_n(T const* data, size_t count)
+    {
+        size_t pos = write_pos.load(std::memory_order_relaxed);
+        size_t free = buffer_mask + 1 - (pos - read_pos_cache);
+        if (free < count)
+        {
+            read_pos_cache = read_pos.load(std::memory_order_acquire);
+            free = buffer_mask + 1 - (pos - read_pos_cache);
+        }
+
+        size_t n = (count < free) ? count : free;
+        for (size_t i = 0; i < n; ++i)
+            buffer[(pos + i) & buffer_mask] = data[i];
+
+        if (n > 0)
+            write_pos.store(pos + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief Pop up to count elements, handed back to the producer by a single store.
+     *
+     * @return The number of elements popped, which is less than count if the ring is (nearly) empty.
+     */
+    size_t pop_n(T* data, size_t count)
+    {
+        size_t pos = read_pos.load(std::memory_order_relaxed);
+        size_t available = write_pos_cache - pos;
+        if (available < count)
+        {
+            write_pos_cache = write_pos.load(std::memory_order_acquire);
+            available = write_pos_cache - pos;
+        }
+
+        size_t n = (count < available) ? count : available;
+        for (size_t i = 0; i < n; ++i)
+            data[i] = buffer[(pos + i) & buffer_mask];
+
+        if (n > 0)
+            read_pos.store(pos + n, std::memory_order_release);
+        return n;
+    }
+
+    inline size_t capacity() const
+    {
+        return buffer_mask + 1;
+    }
+
+    /**
+     * @brief The number of elements pushed but not popped yet, only a snapshot when called by neither side.
+     */
+    inline size_t size() const
+    {
+        // read the consumer's position first, it never overtakes the producer's
+        size_t read = read_pos.load(std::memory_order_acquire);
+        return write_pos.load(std::memory_order_acquire) - read;
+    }
+
+private:
+    static size_t const         cacheline_size = 64;
+    typedef char                cacheline_pad_t[cacheline_size];
+
+    cacheline_pad_t             pad0;
+    T* const                    buffer;
+    size_t const                buffer_mask;
+    cacheline_pad_t             pad1;
+    // producer side
+    std::atomic<size_t>         write_pos;
+    size_t                      read_pos_cache;
+    cacheline_pad_t             pad2;
+    // consumer side
+    std::atomic<size_t>         read_pos;
+    size_t                      write_pos_cache;
+    cacheline_pad_t             pad3;
+
+    AtomicSpscRing(AtomicSpscRing const&);
+    void operator= (AtomicSpscRing const&);
+};
+
+}
+#endif /* ZILLIANS_ATOMICSPSCRING_H_ */
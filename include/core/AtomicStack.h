@@ -24,82 +24,240 @@
 #define ZILLIANS_ATOMIC_ATOMICSTACK_H_
 
 #include "core/Atomic.h"
+#include "core/HazardPointer.h"
+
+/**
+ * The number of elimination slots of each atomic::stack, each on its own cache line.
+ */
+#ifndef ZILLIANS_ATOMIC_STACK_ELIMINATION_SLOTS
+#define ZILLIANS_ATOMIC_STACK_ELIMINATION_SLOTS 16
+#endif
 
 namespace zillians { namespace atomic {
 
-#if 0
 struct stack_node
 {
-	stack_node() : _nexts(0)
+	stack_node() : _nexts(NULL)
 	{ }
 
-	stack_node* volatile _nexts;
+	std::atomic<stack_node*> _nexts;
 };
 
+namespace detail {
+
+/**
+ * A per-thread xorshift generator picking elimination slots, so threads
+ * colliding on one slot don't keep colliding on the next one.
+ */
+inline uint32 elimination_random()
+{
+	static __thread uint32 seed = 0;
+	if(seed == 0)
+		seed = (uint32)reinterpret_cast<uintptr_t>(&seed) | 1;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+inline void elimination_relax()
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__asm__ volatile ("pause" ::: "memory");
+#endif
+}
+
+}
+
 /**
  * Simple Atomic Stack
+ *
+ * Treiber stack using a single-word CAS, the popping thread protects the head
+ * node by HazardPointer while reading its successor, so no tagged pointer (and
+ * no double-word CAS) is needed against ABA.
+ *
+ * A push or pop losing the CAS on the head goes to an elimination array
+ * (Hendler, Shavit and Yerushalmi, "A Scalable Lock-free Stack Algorithm")
+ * before retrying: a push parks its node in a random slot for a while, and a
+ * pop finding a parked node takes it, so the pair completes without touching
+ * the head at all. The number of slots in use grows when threads meet (or
+ * collide) in the array and shrinks when they wait in vain, and each retry
+ * waits twice as long as the one before, so an uncontended stack stays a
+ * plain Treiber stack and a contended one spreads out over the slots.
+ *
+ * @note A popped node may still be read by a concurrent pop for a while, so
+ * it must be freed by HazardPointer::retire() instead of delete, and must not
+ * be pushed again before that (otherwise ABA comes back).
  */
 template<class T>
 class stack
 {
-private:
-	struct ptr_t
+public:
+	stack() : _head(NULL), _range(1)
 	{
-		ptr_t() : _ptr(0), _pops(0)
-		{ }
+		for(int i = 0; i < ELIMINATION_SLOTS; ++i)
+			_slots[i]._node.store(NULL, std::memory_order_relaxed);
+	}
 
-		ptr_t(stack_node* const ptr, const uint32 pops) : _ptr(ptr), _pops(pops)
-		{ }
+	void push(T * item)
+	{
+		stack_node* node = item;
+		stack_node* head = _head.load(std::memory_order_relaxed);
 
-		union
+		for(uint32 spins = MIN_ELIMINATION_SPINS;; spins = std::min<uint32>(spins * 2, MAX_ELIMINATION_SPINS))
 		{
-			struct
-			{
-				stack_node* volatile _ptr;
-				volatile uint32 _pops;
-			};
-			volatile int64 _data;
-		};
-	};
+			node->_nexts.store(head, std::memory_order_relaxed);
+			if(_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed))
+				return;
 
-	ptr_t _head;
+			if(eliminate_push(node, spins))
+				return;
 
-public:
-	stack() : _head()
-	{ }
+			head = _head.load(std::memory_order_relaxed);
+		}
+	}
 
-	void push(T * item)
+	T* pop()
 	{
-		stack_node* node = item;
-
-		while(true)
+		stack_node* head;
+		for(uint32 spins = MIN_ELIMINATION_SPINS;; spins = std::min<uint32>(spins * 2, MAX_ELIMINATION_SPINS))
 		{
-			node->_nexts = _head._ptr;
-			if(b_cas_ptr(reinterpret_cast<void* volatile*> (&_head._ptr), node, node->_nexts))
+			head = HazardPointer::protect(_head);
+
+			if(head == NULL)
+				break;
+
+			stack_node* next = head->_nexts.load(std::memory_order_relaxed);
+			if(_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_relaxed))
 				break;
+
+			HazardPointer::clear();
+			if((head = eliminate_pop(spins)) != NULL)
+				return static_cast<T*> (head);
 		}
+
+		HazardPointer::clear();
+		return static_cast<T*> (head);
 	}
 
-	T* pop()
+	bool empty() const
 	{
-		while(true)
+		return _head.load(std::memory_order_relaxed) == NULL;
+	}
+
+private:
+	enum
+	{
+		ELIMINATION_SLOTS = ZILLIANS_ATOMIC_STACK_ELIMINATION_SLOTS,
+		MIN_ELIMINATION_SPINS = 16,
+		MAX_ELIMINATION_SPINS = 1024,
+	};
+
+	struct slot
+	{
+		std::atomic<stack_node*> _node;	///< The node parked by a push, or NULL
+		char _pad[64 - sizeof(std::atomic<stack_node*>)];
+	};
+
+	inline slot& pick_slot()
+	{
+		return _slots[detail::elimination_random() % _range.load(std::memory_order_relaxed)];
+	}
+
+	// both only hints, so racing updates may be lost
+	inline void widen()
+	{
+		uint32 range = _range.load(std::memory_order_relaxed);
+		if(range < ELIMINATION_SLOTS)
+			_range.store(range + 1, std::memory_order_relaxed);
+	}
+
+	inline void narrow()
+	{
+		uint32 range = _range.load(std::memory_order_relaxed);
+		if(range > 1)
+			_range.store(range - 1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Park the node in a slot until a pop takes it or the time runs out.
+	 *
+	 * @return True if a pop took the node, which completes the push.
+	 */
+	bool eliminate_push(stack_node* node, uint32 spins)
+	{
+		slot& s = pick_slot();
+
+		stack_node* expected = NULL;
+		if(!s._node.compare_exchange_strong(expected, node, std::memory_order_release, std::memory_order_relaxed))
 		{
-			const ptr_t head = _head;
+			// another push is parked here, spread out
+			widen();
+			return false;
+		}
+
+		for(uint32 i = 0; i < spins; ++i)
+		{
+			if(s._node.load(std::memory_order_relaxed) != node)
+			{
+				widen();
+				return true;
+			}
+			detail::elimination_relax();
+		}
 
-			if(head._ptr == 0)
-				return 0;
+		expected = node;
+		if(s._node.compare_exchange_strong(expected, NULL, std::memory_order_relaxed, std::memory_order_relaxed))
+		{
+			// nobody came, use fewer slots so pushes and pops meet more often
+			narrow();
+			return false;
+		}
 
-			const ptr_t next(head._ptr->_nexts, head._pops + 1);
+		// taken right before withdrawal
+		return true;
+	}
 
-			if(b_cas(&_head._data, next._data, head._data))
+	/**
+	 * Wait in a slot for a parked node until the time runs out.
+	 *
+	 * @return The node taken from a push, or NULL.
+	 */
+	stack_node* eliminate_pop(uint32 spins)
+	{
+		slot& s = pick_slot();
+
+		for(uint32 i = 0; i < spins; ++i)
+		{
+			stack_node* node = s._node.load(std::memory_order_relaxed);
+			if(node != NULL)
 			{
-				return static_cast<T*> (head._ptr);
+				if(s._node.compare_exchange_strong(node, NULL, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					widen();
+					return node;
+				}
+				// another pop took it
+				widen();
+				return NULL;
 			}
+			detail::elimination_relax();
 		}
+
+		narrow();
+		return NULL;
 	}
-};
 
-#endif
+private:
+	std::atomic<stack_node*> _head;
+	char _pad[64 - sizeof(std::atomic<stack_node*>)];
+	std::atomic<uint32> _range;		///< The number of slots in use, from 1 to ELIMINATION_SLOTS
+	slot _slots[ELIMINATION_SLOTS];
+
+private:
+	stack (const stack&);
+	void operator = (const stack&);
+};
 
 } }
 
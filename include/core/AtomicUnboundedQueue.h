@@ -0,0 +1,307 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ATOMICUNBOUNDEDQUEUE_H_
+#define ZILLIANS_ATOMICUNBOUNDEDQUEUE_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include "core/EventCount.h"
+#include "core/HazardPointer.h"
+#include <boost/noncopyable.hpp>
+
+namespace zillians {
+
+/**
+ * @brief AtomicUnboundedQueue is a lock-free unbounded queue supporting multiple producers multiple consumers
+ *
+ * Elements are stored in a linked list of fixed-size segments. Producers and
+ * consumers claim cells in the tail and head segment by a single fetch_add
+ * each, a new segment is linked only every SegmentSize pushes, and drained
+ * segments are reclaimed through HazardPointer.
+ *
+ * The interface is the same as ConcurrentQueue, so it can be used as a drop-in
+ * replacement. Blocking consumers sleep on an EventCount, so push() only pays a
+ * fence and an atomic load when no consumer is waiting.
+ *
+ * @note T must be default constructible, popped cells are reset to T() so the
+ * queue doesn't hold on to resources of popped elements.
+ */
+template<typename T, std::size_t SegmentSize = 256>
+class AtomicUnboundedQueue : public boost::noncopyable
+{
+public:
+	AtomicUnboundedQueue()
+	{
+		Segment* s = new Segment;
+		head.store(s, std::memory_order_relaxed);
+		tail.store(s, std::memory_order_relaxed);
+	}
+
+	~AtomicUnboundedQueue()
+	{
+		Segment* s = head.load(std::memory_order_relaxed);
+		while(s)
+		{
+			Segment* next = s->next.load(std::memory_order_relaxed);
+			delete s;
+			s = next;
+		}
+	}
+
+public:
+	void push(T const& data)
+	{
+		for(;;)
+		{
+			Segment* s = HazardPointer::protect(tail);
+			std::size_t i = s->enqueue_pos.fetch_add(1, std::memory_order_relaxed);
+			if(LIKELY(i < SegmentSize))
+			{
+				Cell& cell = s->cells[i];
+				cell.data = data;
+
+				unsigned expected = CELL_EMPTY;
+				if(LIKELY(cell.state.compare_exchange_strong(expected, CELL_FULL, std::memory_order_release, std::memory_order_relaxed)))
+					break;
+
+				// a consumer gave up on the cell before we filled it
+				cell.data = T();
+				continue;
+			}
+
+			// the segment is full, link a new one starting with our element
+			Segment* next = s->next.load(std::memory_order_acquire);
+			if(!next)
+			{
+				Segment* n = new Segment;
+				n->enqueue_pos.store(1, std::memory_order_relaxed);
+				n->cells[0].data = data;
+				n->cells[0].state.store(CELL_FULL, std::memory_order_relaxed);
+
+				if(s->next.compare_exchange_strong(next, n, std::memory_order_release, std::memory_order_acquire))
+				{
+					tail.compare_exchange_strong(s, n);
+					break;
+				}
+				delete n;
+			}
+			tail.compare_exchange_strong(s, next);
+		}
+		HazardPointer::clear();
+
+		not_empty.notify_one();
+	}
+
+	bool try_pop(T& value)
+	{
+		bool result = pop(value);
+		HazardPointer::clear();
+		return result;
+	}
+
+	bool try_peek(T& value)
+	{
+		for(;;)
+		{
+			Segment* s = HazardPointer::protect(head);
+			std::size_t pos = s->dequeue_pos.load(std::memory_order_acquire);
+			for(; pos < SegmentSize; ++pos)
+			{
+				unsigned state = s->cells[pos].state.load(std::memory_order_acquire);
+				if(state == CELL_FULL)
+				{
+					value = s->cells[pos].data;
+					HazardPointer::clear();
+					return true;
+				}
+				if(state == CELL_EMPTY)
+				{
+					HazardPointer::clear();
+					return false;
+				}
+			}
+			if(!advance(s))
+			{
+				HazardPointer::clear();
+				return false;
+			}
+		}
+	}
+
+	bool empty() const
+	{
+		Segment* s = HazardPointer::protect(head);
+		std::size_t pos = s->dequeue_pos.load(std::memory_order_acquire);
+		bool result = pos >= std::min<std::size_t>(s->enqueue_pos.load(std::memory_order_acquire), SegmentSize) && !s->next.load(std::memory_order_acquire);
+		HazardPointer::clear();
+		return result;
+	}
+
+	void clear()
+	{
+		T value;
+		while(try_pop(value));
+	}
+
+	void wait_and_pop(T& value)
+	{
+		while(!try_pop(value))
+		{
+			not_empty.prepare_wait();
+			if(try_pop(value))
+			{
+				not_empty.retire_wait();
+				return;
+			}
+			not_empty.wait();
+		}
+	}
+
+	bool timed_wait_and_pop(T& value, const boost::system_time& absolute)
+	{
+		while(!try_pop(value))
+		{
+			not_empty.prepare_wait();
+			if(try_pop(value))
+			{
+				not_empty.retire_wait();
+				return true;
+			}
+			if(!not_empty.timed_wait(absolute))
+				return try_pop(value);
+		}
+		return true;
+	}
+
+	template<typename DurationType>
+	bool timed_wait_and_pop(T& value, const DurationType& relative)
+	{
+		return timed_wait_and_pop(value, boost::get_system_time() + relative);
+	}
+
+private:
+	enum
+	{
+		CELL_EMPTY,
+		CELL_FULL,
+		CELL_ABANDONED,		///< Given up by a consumer before the producer filled it
+
+		SPIN_COUNT = 64,	///< # of times a consumer waits for the producer of a claimed cell
+	};
+
+	struct Cell
+	{
+		Cell() : state(CELL_EMPTY)
+		{ }
+
+		std::atomic<unsigned> state;
+		T data;
+	};
+
+	struct Segment
+	{
+		Segment() : enqueue_pos(0), dequeue_pos(0), next(NULL)
+		{ }
+
+		std::atomic<std::size_t> enqueue_pos;
+		char pad0[64];
+		std::atomic<std::size_t> dequeue_pos;
+		char pad1[64];
+		std::atomic<Segment*> next;
+		Cell cells[SegmentSize];
+	};
+
+	/**
+	 * Pop from the head segment, the caller clears the hazard pointer.
+	 */
+	bool pop(T& value)
+	{
+		for(;;)
+		{
+			Segment* s = HazardPointer::protect(head);
+			std::size_t pos = s->dequeue_pos.load(std::memory_order_acquire);
+			if(pos >= SegmentSize)
+			{
+				if(!advance(s))
+					return false;
+				continue;
+			}
+
+			// don't claim cells of an empty queue
+			if(pos >= s->enqueue_pos.load(std::memory_order_acquire))
+				return false;
+
+			std::size_t i = s->dequeue_pos.fetch_add(1, std::memory_order_acq_rel);
+			if(i >= SegmentSize)
+				continue;
+
+			Cell& cell = s->cells[i];
+			unsigned state = cell.state.load(std::memory_order_acquire);
+			if(state != CELL_FULL)
+			{
+				// the producer claimed the cell but hasn't filled it yet, wait for it a little
+				if(i < s->enqueue_pos.load(std::memory_order_acquire))
+				{
+					for(int spin = 0; spin < SPIN_COUNT && state != CELL_FULL; ++spin)
+						state = cell.state.load(std::memory_order_acquire);
+				}
+
+				unsigned expected = CELL_EMPTY;
+				if(state != CELL_FULL && cell.state.compare_exchange_strong(expected, CELL_ABANDONED, std::memory_order_acquire, std::memory_order_acquire))
+					continue;
+			}
+
+			value = cell.data;
+			cell.data = T();
+			return true;
+		}
+	}
+
+	/**
+	 * Move head past the drained segment s if there is a next one, and retire s.
+	 */
+	bool advance(Segment* s)
+	{
+		Segment* next = s->next.load(std::memory_order_acquire);
+		if(!next)
+			return false;
+
+		// tail must never point to a retired segment
+		Segment* expected = s;
+		tail.compare_exchange_strong(expected, next);
+		expected = s;
+		if(head.compare_exchange_strong(expected, next))
+		{
+			HazardPointer::clear();
+			HazardPointer::retire(s);
+		}
+		return true;
+	}
+
+	std::atomic<Segment*> head;
+	char pad0[64];
+	std::atomic<Segment*> tail;
+	char pad1[64];
+	EventCount not_empty;
+};
+
+}
+
+#endif /* ZILLIANS_ATOMICUNBOUNDEDQUEUE_H_ */
@@ -24,228 +24,154 @@
 #define ZILLIANS_BIMAP_H_
 
 #include "core/Prerequisite.h"
-#include <boost/thread/tss.hpp>
-#include <boost/bimap.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
-#include <tbb/tbb_thread.h>
-#include <tbb/spin_rw_mutex.h>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <tbb/concurrent_unordered_map.h>
+#include "core/ProfiledMutex.h"
+#include <tbb/spin_mutex.h>
+#include <tbb/atomic.h>
+#include <stdexcept>
 
 namespace zillians {
 
+namespace detail {
+ZILLIANS_LOCK_SITE(BiMapInsertLockSite, "bimap.insert");
+}
+
+/**
+ * @brief BiMap is a concurrent, insert-only bidirectional map for read-mostly lookups.
+ *
+ * Both directions are kept in a concurrent hash map pointing to a shared entry.
+ * Lookups never take a lock and never wait for writers. Inserts are serialized
+ * by a spin lock and become visible in both directions at the same instant,
+ * when the entry is published, so an insert() which has returned is seen by
+ * every subsequent lookup on any thread.
+ *
+ * Like the boost::bimap it replaces, a pair whose left or right value is already
+ * present is not inserted.
+ *
+ * @note There's no erase, entries live until the BiMap is destroyed.
+ */
 template <class TypeLeft, class TypeRight>
-class BiMap
+class BiMap : public boost::noncopyable
 {
-public:
-	BiMap();
-
-public:
-	typedef boost::bimaps::bimap< typename boost::bimaps::unordered_set_of< TypeLeft >, typename boost::bimaps::unordered_set_of< TypeRight > > MapType;
-
-public:
-	struct ThreadData
-	{
-		MapType* mMainMap;
-		MapType* mBufMap;
-		tbb::spin_rw_mutex mLock;
-		tbb::tick_count mLastMerge;
-	};
-
-	class ThreadPool : public std::map<tbb::tbb_thread::id, ThreadData*>
+private:
+	struct Entry
 	{
-	public:
-		ThreadPool();
+		Entry(const TypeLeft& l, const TypeRight& r) : left(l), right(r)
+		{ published = false; }
 
-	public:
-		void addThread(ThreadData* threadData);
-		void removeThread();
+		TypeLeft left;
+		TypeRight right;
+		tbb::atomic<bool> published;
 	};
 
-public:
-	void initThreadData();
-	static void cleanupThreadData(ThreadData* data);
-	void mergeMap();
-	void insert(TypeLeft left, TypeRight right);
-	TypeLeft mapLeft(TypeRight lookup);
-	TypeRight mapRight(TypeLeft lookup);
-
-private:
-	static shared_ptr<ThreadPool> mThreadPool;
-	static tbb::spin_rw_mutex mLockThreadPool;
-	boost::thread_specific_ptr<ThreadData> mThreadData;
-
-	tbb::tick_count tick;
-	float mMergeInterval;
-};
-
-///////////////////////////////////////////////////////////////////////////////
-
-template<class TypeLeft, class TypeRight>
-BiMap<TypeLeft, TypeRight>::BiMap()
-: mMergeInterval(100.0), //100ms
-mThreadData(&BiMap::cleanupThreadData)
-{
-	mThreadPool = shared_ptr<ThreadPool>(new ThreadPool());
-}
-
-template<class TypeLeft, class TypeRight>
-shared_ptr<typename BiMap<TypeLeft, TypeRight>::ThreadPool> BiMap<TypeLeft, TypeRight>::mThreadPool;
-
-template<class TypeLeft, class TypeRight>
-tbb::spin_rw_mutex BiMap<TypeLeft, TypeRight>::mLockThreadPool;
-
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::initThreadData()
-{
-	ThreadData* threadData = new ThreadData();
-	threadData->mMainMap = new MapType();
-	threadData->mBufMap = new MapType();
-	threadData->mLastMerge = tbb::tick_count::now();
-	mThreadData.reset(threadData);
-
-
-	tbb::spin_rw_mutex::scoped_lock lockThreadPool(mLockThreadPool, true);
-	mThreadPool->addThread(threadData);
-}
-
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::cleanupThreadData(ThreadData* threadData)
-{
-	{
-		tbb::spin_rw_mutex::scoped_lock lockThreadPool(mLockThreadPool, true);
-		mThreadPool->removeThread();
-	}
-
-	SAFE_DELETE(threadData->mMainMap);
-	SAFE_DELETE(threadData->mBufMap);
-	SAFE_DELETE(threadData);
-}
+	typedef tbb::concurrent_unordered_map<TypeLeft, Entry*, boost::hash<TypeLeft> > LeftMapType;
+	typedef tbb::concurrent_unordered_map<TypeRight, Entry*, boost::hash<TypeRight> > RightMapType;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, detail::BiMapInsertLockSite) insert_mutex_t;
 
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::mergeMap()
-{
-	tbb::spin_rw_mutex::scoped_lock lockMap(mThreadData->mLock, true);
-	if (mThreadData->mBufMap->size() <= 0)
+public:
+	BiMap()
 	{
-		//no data to merge
-		return;
+		mSize = 0;
 	}
 
-	//merge mBufMap to mMainMap
-	MapType* mainMap = mThreadData->mMainMap;
-	MapType* newMap = new MapType(*mainMap);
-
-	for (typename MapType::iterator i = mThreadData->mBufMap->begin(); i != mThreadData->mBufMap->end(); i++)
+	~BiMap()
 	{
-		newMap->insert(typename MapType::value_type(i->left, i->right));
+		for(typename LeftMapType::iterator i = mLeftMap.begin(); i != mLeftMap.end(); ++i)
+			SAFE_DELETE(i->second);
 	}
-	mThreadData->mBufMap->clear();
-
-	mThreadData->mMainMap = newMap;
-	SAFE_DELETE(mainMap);
-}
 
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::insert(TypeLeft left, TypeRight right)
-{
-	if (mThreadData.get() == NULL)
+public:
+	/**
+	 * @brief Insert a pair into the map.
+	 *
+	 * @return True if inserted, false if the left or the right value is already mapped.
+	 */
+	bool insert(const TypeLeft& left, const TypeRight& right)
 	{
-		initThreadData();
-	}
+		typename insert_mutex_t::scoped_lock lock(mInsertLock);
 
-	tbb::spin_rw_mutex::scoped_lock lockThreadPool(mLockThreadPool, false);
+		if(mLeftMap.find(left) != mLeftMap.end() || mRightMap.find(right) != mRightMap.end())
+			return false;
 
-	//insert data into mBufMap
-	for (typename ThreadPool::iterator i = mThreadPool->begin(); i != mThreadPool->end(); i++)
-	{
-		tbb::spin_rw_mutex::scoped_lock lockMap(i->second->mLock, true);
-		i->second->mBufMap->insert(typename MapType::value_type(left, right));
-	}
-}
+		Entry* entry = new Entry(left, right);
+		mLeftMap.insert(std::make_pair(left, entry));
+		mRightMap.insert(std::make_pair(right, entry));
 
-template<class TypeLeft, class TypeRight>
-TypeLeft BiMap<TypeLeft, TypeRight>::mapLeft(TypeRight lookup)
-{
-	if (mThreadData.get() == NULL)
-	{
-		initThreadData();
+		// linearization point, the pair becomes visible in both directions at once
+		entry->published = true;
+		++mSize;
+		return true;
 	}
 
-	if ((tbb::tick_count::now() - mThreadData->mLastMerge).seconds() * 1000.0 >= mMergeInterval)
+	/**
+	 * @brief Find the left value mapped to the given right value.
+	 *
+	 * @throw std::out_of_range if it's not mapped.
+	 */
+	TypeLeft mapLeft(const TypeRight& lookup) const
 	{
-		mThreadData->mLastMerge = tbb::tick_count::now();
-		mergeMap();
+		TypeLeft result;
+		if(!mapLeft(lookup, result))
+			throw std::out_of_range("out_of_range");
+		return result;
 	}
 
-	typename MapType::right_const_iterator iter;
-
-	//lookup in mMainMap
-	iter = mThreadData->mMainMap->right.find(lookup);
-	if (iter == mThreadData->mMainMap->right.end())
+	/**
+	 * @brief Find the right value mapped to the given left value.
+	 *
+	 * @throw std::out_of_range if it's not mapped.
+	 */
+	TypeRight mapRight(const TypeLeft& lookup) const
 	{
-		//lookup in mBufMap
-		iter = mThreadData->mBufMap->right.find(lookup);
-		if (iter == mThreadData->mBufMap->right.end())
-		{
+		TypeRight result;
+		if(!mapRight(lookup, result))
 			throw std::out_of_range("out_of_range");
-		}
+		return result;
 	}
 
-	return iter->second;
-}
-
-template<class TypeLeft, class TypeRight>
-TypeRight BiMap<TypeLeft, TypeRight>::mapRight(TypeLeft lookup)
-{
-	if (mThreadData.get() == NULL)
+	/**
+	 * @brief Find the left value mapped to the given right value, without throwing.
+	 *
+	 * @return True if found and stored into result.
+	 */
+	bool mapLeft(const TypeRight& lookup, TypeLeft& result) const
 	{
-		initThreadData();
-	}
+		typename RightMapType::const_iterator i = mRightMap.find(lookup);
+		if(i == mRightMap.end() || !i->second->published)
+			return false;
 
-	if ((tbb::tick_count::now() - mThreadData->mLastMerge).seconds() * 1000.0 >= mMergeInterval)
-	{
-		mThreadData->mLastMerge = tbb::tick_count::now();
-		mergeMap();
+		result = i->second->left;
+		return true;
 	}
 
-	typename MapType::left_const_iterator iter;
-
-	//lookup in mMainMap
-	iter = mThreadData->mMainMap->left.find(lookup);
-	if (iter == mThreadData->mMainMap->left.end())
+	/**
+	 * @brief Find the right value mapped to the given left value, without throwing.
+	 *
+	 * @return True if found and stored into result.
+	 */
+	bool mapRight(const TypeLeft& lookup, TypeRight& result) const
 	{
-		//lookup in mBufMap
-		iter = mThreadData->mBufMap->left.find(lookup);
-		if (iter == mThreadData->mBufMap->left.end())
-		{
-			throw std::out_of_range("out_of_range");
-		}
-	}
-
-	return iter->second;
-}
-
-///////////////////////////////////////////////////////////////////////////////
-
-template<class TypeLeft, class TypeRight>
-BiMap<TypeLeft, TypeRight>::ThreadPool::ThreadPool()
-{
-}
+		typename LeftMapType::const_iterator i = mLeftMap.find(lookup);
+		if(i == mLeftMap.end() || !i->second->published)
+			return false;
 
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::ThreadPool::addThread(ThreadData* threadData)
-{
-	this->insert(std::pair<tbb::tbb_thread::id , ThreadData*>(tbb::this_tbb_thread::get_id(), threadData));
-}
+		result = i->second->right;
+		return true;
+	}
 
-template<class TypeLeft, class TypeRight>
-void BiMap<TypeLeft, TypeRight>::ThreadPool::removeThread()
-{
-	typename BiMap<TypeLeft, TypeRight>::ThreadPool::iterator i = this->find(tbb::this_tbb_thread::get_id());
-	if (i != this->end())
+	inline std::size_t size() const
 	{
-		this->erase(i);
+		return mSize;
 	}
-}
+
+private:
+	LeftMapType mLeftMap;
+	RightMapType mRightMap;
+	insert_mutex_t mInsertLock;
+	tbb::atomic<std::size_t> mSize;
+};
 
 }
 
@@ -25,6 +25,22 @@
 
 #include "core/Types.h"
 
+#include <boost/type_traits/is_arithmetic.hpp>
+#include <boost/static_assert.hpp>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ZILLIANS_BIG_ENDIAN	1	///< The host stores the most significant byte first, i.e. network byte order
+#else
+#define ZILLIANS_BIG_ENDIAN	0
+#endif
+
 namespace zillians {
 
 namespace {
@@ -283,6 +299,147 @@ T binary_cast(const U& value)
 	return binary_cast_impl<T,U,sizeof(T)>::cast(value);
 }
 
+namespace {
+
+template<std::size_t Size>
+struct byte_swap_impl;
+
+template<>
+struct byte_swap_impl<1>
+{
+	template<typename T>
+	static inline T swap(const T& value) { return value; }
+};
+
+template<>
+struct byte_swap_impl<2>
+{
+	template<typename T>
+	static inline T swap(const T& value) { return binary_cast<T>(__builtin_bswap16(binary_cast<uint16>(value))); }
+};
+
+template<>
+struct byte_swap_impl<4>
+{
+	template<typename T>
+	static inline T swap(const T& value) { return binary_cast<T>(__builtin_bswap32(binary_cast<uint32>(value))); }
+};
+
+template<>
+struct byte_swap_impl<8>
+{
+	template<typename T>
+	static inline T swap(const T& value) { return binary_cast<T>(__builtin_bswap64(binary_cast<uint64>(value))); }
+};
+
+template<std::size_t Size>
+inline void byte_swap_scalar(byte* dest, const byte* source, std::size_t count)
+{
+	for(std::size_t i = 0; i < count; ++i, dest += Size, source += Size)
+	{
+		byte v[Size];
+		for(std::size_t j = 0; j < Size; ++j)
+			v[j] = source[Size - 1 - j];
+		::memcpy(dest, v, Size);
+	}
+}
+
+#if defined(__x86_64__)
+template<std::size_t Size>
+__attribute__((target("ssse3")))
+inline void byte_swap_ssse3(byte* dest, const byte* source, std::size_t count)
+{
+	// reverse the bytes within each Size-byte lane of the 16-byte vector
+	char mask[16];
+	for(int i = 0; i < 16; ++i)
+		mask[i] = (char)((i / Size) * Size + (Size - 1 - i % Size));
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*)mask);
+
+	std::size_t bytes = count * Size;
+	std::size_t i = 0;
+	for(; i + 16 <= bytes; i += 16)
+		_mm_storeu_si128((__m128i*)(dest + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i)), shuffle));
+	byte_swap_scalar<Size>(dest + i, source + i, (bytes - i) / Size);
+}
+
+inline bool byte_swap_has_ssse3()
+{
+	static const bool supported = __builtin_cpu_supports("ssse3");
+	return supported;
+}
+#elif defined(__ARM_NEON)
+template<std::size_t Size>
+inline uint8x16_t byte_swap_neon(uint8x16_t v);
+
+template<> inline uint8x16_t byte_swap_neon<2>(uint8x16_t v) { return vrev16q_u8(v); }
+template<> inline uint8x16_t byte_swap_neon<4>(uint8x16_t v) { return vrev32q_u8(v); }
+template<> inline uint8x16_t byte_swap_neon<8>(uint8x16_t v) { return vrev64q_u8(v); }
+#endif
+
+template<std::size_t Size>
+inline void byte_swap_array_impl(byte* dest, const byte* source, std::size_t count)
+{
+#if defined(__x86_64__)
+	if(byte_swap_has_ssse3())
+	{
+		byte_swap_ssse3<Size>(dest, source, count);
+		return;
+	}
+#elif defined(__ARM_NEON)
+	std::size_t bytes = count * Size;
+	std::size_t i = 0;
+	for(; i + 16 <= bytes; i += 16)
+		vst1q_u8(dest + i, byte_swap_neon<Size>(vld1q_u8(source + i)));
+	dest += i; source += i; count = (bytes - i) / Size;
+#endif
+	byte_swap_scalar<Size>(dest, source, count);
+}
+
+}
+
+/**
+ * Reverse the byte order of a 2, 4 or 8 byte integer or floating point value.
+ */
+template<typename T>
+inline T byte_swap(const T& value)
+{
+	return byte_swap_impl<sizeof(T)>::swap(value);
+}
+
+/**
+ * Reverse the byte order of every element of an array, using pshufb (SSSE3) or vrev (NEON) when available.
+ *
+ * @param dest The destination array, may be the same as the source for in-place conversion.
+ * @param source The source array.
+ * @param count The number of elements.
+ */
+template<typename T>
+inline void byte_swap_array(T* dest, const T* source, std::size_t count)
+{
+	BOOST_STATIC_ASSERT(boost::is_arithmetic<T>::value);
+	if(sizeof(T) == 1)
+	{
+		if(dest != source) ::memmove(dest, source, count);
+		return;
+	}
+	byte_swap_array_impl<sizeof(T) == 1 ? 2 : sizeof(T)>((byte*)dest, (const byte*)source, count);
+}
+
+/**
+ * Convert between host and network (big-endian) byte order, a no-op on big-endian hosts.
+ */
+template<typename T>
+inline T host_to_network(const T& value)
+{
+	return ZILLIANS_BIG_ENDIAN ? value : byte_swap(value);
+}
+
+template<typename T>
+inline T network_to_host(const T& value)
+{
+	return host_to_network(value);
+}
+
 }
 
 #endif /* ZILLIANS_BINARYCAST_H_ */
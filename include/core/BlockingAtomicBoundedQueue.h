@@ -0,0 +1,166 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BLOCKINGATOMICBOUNDEDQUEUE_H_
+#define ZILLIANS_BLOCKINGATOMICBOUNDEDQUEUE_H_
+
+#include "core/AtomicBoundedQueue.h"
+#include "core/EventCount.h"
+
+namespace zillians {
+
+/**
+ * @brief BlockingAtomicBoundedQueue adds blocking waits on top of AtomicBoundedQueue.
+ *
+ * Waiting consumers (or producers on a full queue) sleep on an EventCount
+ * instead of spinning, while the non-blocking push/pop stay lock-free and only
+ * pay a fence and an atomic load to check for sleepers.
+ *
+ * The wait functions follow the naming of ConcurrentQueue.
+ */
+template<typename T>
+class BlockingAtomicBoundedQueue
+{
+public:
+	BlockingAtomicBoundedQueue(std::size_t buffer_size) : queue(buffer_size)
+	{ }
+
+public:
+	bool push(T const& data)
+	{
+		if(!queue.push(data))
+			return false;
+		not_empty.notify_one();
+		return true;
+	}
+
+	bool pop(T& data)
+	{
+		if(!queue.pop(data))
+			return false;
+		not_full.notify_one();
+		return true;
+	}
+
+	size_t push_n(T const* data, size_t count)
+	{
+		size_t n = queue.push_n(data, count);
+		notify(not_empty, n);
+		return n;
+	}
+
+	size_t pop_n(T* data, size_t count)
+	{
+		size_t n = queue.pop_n(data, count);
+		notify(not_full, n);
+		return n;
+	}
+
+	void wait_and_push(T const& data)
+	{
+		while(!push(data))
+		{
+			not_full.prepare_wait();
+			if(push(data))
+			{
+				not_full.retire_wait();
+				return;
+			}
+			not_full.wait();
+		}
+	}
+
+	bool timed_wait_and_push(T const& data, const boost::system_time& absolute)
+	{
+		while(!push(data))
+		{
+			not_full.prepare_wait();
+			if(push(data))
+			{
+				not_full.retire_wait();
+				return true;
+			}
+			if(!not_full.timed_wait(absolute))
+				return push(data);
+		}
+		return true;
+	}
+
+	template<typename DurationType>
+	bool timed_wait_and_push(T const& data, const DurationType& relative)
+	{
+		return timed_wait_and_push(data, boost::get_system_time() + relative);
+	}
+
+	void wait_and_pop(T& data)
+	{
+		while(!pop(data))
+		{
+			not_empty.prepare_wait();
+			if(pop(data))
+			{
+				not_empty.retire_wait();
+				return;
+			}
+			not_empty.wait();
+		}
+	}
+
+	bool timed_wait_and_pop(T& data, const boost::system_time& absolute)
+	{
+		while(!pop(data))
+		{
+			not_empty.prepare_wait();
+			if(pop(data))
+			{
+				not_empty.retire_wait();
+				return true;
+			}
+			if(!not_empty.timed_wait(absolute))
+				return pop(data);
+		}
+		return true;
+	}
+
+	template<typename DurationType>
+	bool timed_wait_and_pop(T& data, const DurationType& relative)
+	{
+		return timed_wait_and_pop(data, boost::get_system_time() + relative);
+	}
+
+private:
+	static void notify(EventCount& ec, size_t n)
+	{
+		if(n == 1)
+			ec.notify_one();
+		else if(n > 1)
+			ec.notify_all();
+	}
+
+	AtomicBoundedQueue<T> queue;
+	EventCount not_empty;
+	EventCount not_full;
+
+	BlockingAtomicBoundedQueue(BlockingAtomicBoundedQueue const&);
+	void operator= (BlockingAtomicBoundedQueue const&);
+};
+
+}
+
+#endif /* ZILLIANS_BLOCKINGATOMICBOUNDEDQUEUE_H_ */
@@ -21,10 +21,14 @@
 #define ZILLIANS_BUFFER_H_
 
 #include "core/Common.h"
+#include "core/Atomic.h"
 #include "core/ObjectPool.h"
 #include "core/SharedPtr.h"
+#include "core/BinaryCast.h"
+#include "core/MemoryCopy.h"
 #include "utility/UUIDUtil.h"
 #include "utility/BitTrickUtil.h"
+#include "utility/ChecksumUtil.h"
 
 #include <boost/type_traits.hpp>
 #include <boost/mpl/bool.hpp>
@@ -32,6 +36,9 @@
 #include <boost/system/error_code.hpp>
 #include <boost/array.hpp>
 #include <boost/thread.hpp>
+#include <boost/static_assert.hpp>
+
+#include <atomic>
 
 #ifndef ZILLIANS_BUFFER_DEFAULT_SIZE
 #define ZILLIANS_BUFFER_DEFAULT_SIZE	128
@@ -113,9 +120,50 @@ struct is_std_pair< std::pair<K, V> >
 	enum { value = true };
 };
 
+/**
+ * @brief Helper class to identify whether a given type is declared to have direct (trivially copyable) layout.
+ *
+ * @see ZILLIANS_BUFFER_DIRECT_LAYOUT
+ */
+template<typename T>
+struct is_direct_layout
+{
+	enum { value = false };
+};
+
+template<typename T>
+struct is_direct_layout<const T>
+{
+	enum { value = is_direct_layout<T>::value };
+};
 
 }
 
+/**
+ * @brief Declare a trivially copyable, fixed-layout structure to be read/written by BufferBase as raw memory.
+ *
+ * Such structure does not need to implement serialize(), its probeSize() is sizeof(T) at compile time,
+ * read/write is a single memcpy, and std::vector of such structure is transferred in one bulk copy.
+ *
+ * @note The macro must be used in the global namespace. The structure layout (including padding and
+ * byte order) goes over the wire as-is, so both sides must agree on it.
+ *
+ * @code
+ * 		struct Telemetry { int32 id; float x, y, z; };
+ * 		ZILLIANS_BUFFER_DIRECT_LAYOUT(Telemetry)
+ * @endcode
+ */
+#define ZILLIANS_BUFFER_DIRECT_LAYOUT(T) \
+	namespace zillians { namespace detail { \
+	template<> struct is_direct_layout< T > { enum { value = true }; }; \
+	} }
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+#define ZILLIANS_BUFFER_CONSTEXPR constexpr
+#else
+#define ZILLIANS_BUFFER_CONSTEXPR
+#endif
+
 /**
  * @brief BufferContext allows user structure to be associated with (or
  * super-imposed on) BufferBase object.
@@ -131,15 +179,107 @@ struct BufferMode
 	};
 };
 
+/**
+ * @brief BufferConcurrency selects how many threads may access the buffer at the same time.
+ *
+ * @li none - no concurrent access at all.
+ * @li spsc - one producer thread and one consumer thread.
+ * @li mpsc - many producer threads and one consumer thread, circular buffer only.
+ * @li mpmc - many producer threads and many consumer threads, circular buffer only.
+ *
+ * For mpsc and mpmc, producers reserve space by atomically advancing a reservation
+ * cursor, copy data into the reserved space, and commit in reservation order, so every
+ * value put by operator<< becomes visible to consumers as a whole. Under mpmc each value
+ * is prefixed by its length so that consumers can reserve a whole value before reading
+ * it, and data must be put and got by operator<< and operator>> only.
+ *
+ * @note spsc, mpsc and mpmc positions are C++0x atomics with acquire/release ordering.
+ */
 struct BufferConcurrency
 {
 	enum type
 	{
 		none,
-		spsc
+		spsc,
+		mpsc,
+		mpmc
+	};
+};
+
+/**
+ * @brief BufferEncoding selects how integers are laid out in the buffer.
+ *
+ * @li fixed - all integers (including lengths of strings and containers) are written in their native size.
+ * @li varint_length - lengths of strings and containers are written as LEB128 varint, other integers are native.
+ * @li varint - lengths and all integers wider than one byte are written as LEB128 varint, and signed integers are zigzag encoded.
+ * @li network - like fixed, but lengths, integers and floating point values are in network byte order (big-endian),
+ * which is a no-op on big-endian hosts. Arrays of them are converted in bulk by byte_swap_array(). Direct layout
+ * structures and wide strings are still copied as they are.
+ *
+ * @note Both sides of a channel must use the same encoding.
+ */
+struct BufferEncoding
+{
+	enum type
+	{
+		fixed,
+		varint_length,
+		varint,
+		network
+	};
+};
+
+/**
+ * @brief BufferChecksum selects the checksum folded into the data stream of the buffer.
+ *
+ * @li none - no checksum.
+ * @li crc32c - CRC32C (Castagnoli) of every byte passing the write pointer and the read pointer, see checksum() and verify().
+ *
+ * @note Checksum is only for non-concurrent and spsc buffers.
+ */
+struct BufferChecksum
+{
+	enum type
+	{
+		none,
+		crc32c
 	};
 };
 
+/**
+ * @brief BufferRanges is a fixed-capacity list of physical memory ranges.
+ *
+ * A single buffer has at most two data or free ranges, i.e. a circular buffer
+ * wrapping around its end, so BufferRanges can be filled by getDataRanges() or
+ * getFreeRanges() without allocating a std::vector on every send.
+ */
+struct BufferRanges
+{
+	enum { capacity = 2 };
+
+	typedef std::pair<byte*,std::size_t> value_type;
+	typedef const value_type* const_iterator;
+
+	BufferRanges() : count(0)
+	{ }
+
+	inline void push_back(const value_type& range)
+	{
+		BOOST_ASSERT(count < capacity);
+		ranges[count++] = range;
+	}
+
+	inline void clear() { count = 0; }
+	inline std::size_t size() const { return count; }
+	inline bool empty() const { return count == 0; }
+	inline const value_type& operator[] (std::size_t index) const { return ranges[index]; }
+	inline const_iterator begin() const { return ranges; }
+	inline const_iterator end() const { return ranges + count; }
+
+	value_type ranges[capacity];
+	std::size_t count;
+};
+
 struct BufferObjectPoolStrategy
 {
 	enum type
@@ -150,9 +290,119 @@ struct BufferObjectPoolStrategy
 	};
 };
 
-template<bool ShadowRead, bool ShadowWrite>
-struct BufferRef
-{ };
+#define ZILLIANS_BUFFER_STATISTICS ///< Enable process-wide buffer statistics.
+#define ZILLIANS_BUFFER_ATOMIC_STACK_SIZE 256 ///< Values not larger than this are serialized on stack by writeAtomic() and readAtomic().
+
+/**
+ * @brief BufferStat collects process-wide statistics of all buffers.
+ *
+ * @see getBufferStat()
+ */
+struct BufferStat
+{
+	BufferStat()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		Reallocations.store(0, std::memory_order_relaxed);
+		ReallocatedBytes.store(0, std::memory_order_relaxed);
+		Shrinks.store(0, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64> Reallocations;		///< Number of times on-demand buffers were grown.
+	std::atomic<uint64> ReallocatedBytes;	///< Total size requested by the reallocations.
+	std::atomic<uint64> Shrinks;			///< Number of shrinkToFit() calls.
+};
+
+inline BufferStat& getBufferStat()
+{
+	static BufferStat stat;
+	return stat;
+}
+
+/**
+ * @brief BufferAllocator is the memory backend used by BufferBase to allocate its internal data.
+ *
+ * By default all buffers allocate from the global heap through DefaultBufferAllocator. Implement
+ * this interface to let buffer payload come from other memory pools (for example, ScalablePoolAllocator).
+ *
+ * @note The allocator must outlive all buffers using it.
+ */
+struct BufferAllocator
+{
+	virtual ~BufferAllocator() { }
+
+	virtual byte* allocate(std::size_t size) = 0;
+	virtual void deallocate(byte* data) = 0;
+
+	/**
+	 * @brief Whether the allocated memory is mapped twice back-to-back.
+	 *
+	 * For such memory, any range of up to the allocated size starting inside the block is
+	 * contiguous in the address space, so circular buffer never splits data at the boundary.
+	 */
+	virtual bool isMirrored() const { return false; }
+
+	/**
+	 * @brief Get the allocation granularity, to which the size of mirrored memory must be rounded up.
+	 */
+	virtual std::size_t getGranularity() const { return 1; }
+
+	/**
+	 * @brief Grow the given memory block to the new size, preserving its content.
+	 *
+	 * @note The default implementation allocates a new block and copies old data.
+	 *
+	 * @param data The memory block to grow, or NULL.
+	 * @param old_size The size of the existing memory block.
+	 * @param new_size The requested new size.
+	 * @return The new memory block.
+	 */
+	virtual byte* reallocate(byte* data, std::size_t old_size, std::size_t new_size)
+	{
+		byte* new_data = allocate(new_size);
+		if(data)
+		{
+			memory_copy(new_data, data, std::min(old_size, new_size));
+			deallocate(data);
+		}
+		return new_data;
+	}
+};
+
+/**
+ * @brief DefaultBufferAllocator allocates buffer data from the global heap by malloc/realloc/free.
+ */
+struct DefaultBufferAllocator : public BufferAllocator
+{
+	virtual byte* allocate(std::size_t size)
+	{
+		return (byte*)malloc(size);
+	}
+
+	virtual void deallocate(byte* data)
+	{
+		free((void*)data);
+	}
+
+	virtual byte* reallocate(byte* data, std::size_t old_size, std::size_t new_size)
+	{
+		UNUSED_ARGUMENT(old_size);
+		if(data)
+			return (byte*)realloc((void*)data, new_size);
+		else
+			return (byte*)malloc(new_size);
+	}
+
+	static DefaultBufferAllocator* instance()
+	{
+		static DefaultBufferAllocator allocator;
+		return &allocator;
+	}
+};
 
 namespace {
 
@@ -165,10 +415,55 @@ struct position_type_selector<BufferConcurrency::none>
 	typedef std::size_t type;
 };
 
+/**
+ * @brief atomic_position is a copyable buffer position with acquire/release semantic.
+ *
+ * Reading the position is an acquire load and assigning the position is a release
+ * store, so data put into the buffer before moving a position is visible to the
+ * thread which sees the new position.
+ */
+struct atomic_position
+{
+	atomic_position() : value(0) { }
+	atomic_position(std::size_t v) : value(v) { }
+	atomic_position(const atomic_position& p) : value(p.load()) { }
+
+	inline atomic_position& operator = (const atomic_position& p) { store(p.load()); return *this; }
+	inline atomic_position& operator = (std::size_t v) { store(v); return *this; }
+
+	// NOTE: these are not atomic read-modify-write, the position must only be moved by its owner thread
+	inline atomic_position& operator += (std::size_t v) { store(load(std::memory_order_relaxed) + v); return *this; }
+	inline atomic_position& operator -= (std::size_t v) { store(load(std::memory_order_relaxed) - v); return *this; }
+
+	inline operator std::size_t () const { return load(); }
+
+	inline std::size_t load(std::memory_order order = std::memory_order_acquire) const { return value.load(order); }
+	inline void store(std::size_t v, std::memory_order order = std::memory_order_release) { value.store(v, order); }
+
+	inline bool compare_exchange(std::size_t& expected, std::size_t desired)
+	{
+		return value.compare_exchange_weak(expected, desired, std::memory_order_acq_rel, std::memory_order_relaxed);
+	}
+
+	std::atomic<std::size_t> value;
+};
+
 template<>
 struct position_type_selector<BufferConcurrency::spsc>
 {
-	typedef volatile std::size_t type;	// we use volatile to prevent GCC optimization around buffer pointers to get correct set/get ordering
+	typedef atomic_position type;
+};
+
+template<>
+struct position_type_selector<BufferConcurrency::mpsc>
+{
+	typedef atomic_position type;
+};
+
+template<>
+struct position_type_selector<BufferConcurrency::mpmc>
+{
+	typedef atomic_position type;
 };
 
 }
@@ -183,22 +478,49 @@ struct position_type_selector<BufferConcurrency::spsc>
  * append or extract data from the internal data array. BufferBase supports
  * context object to let to impose some relationship among buffer classes.
  */
-template<BufferMode::type Mode, BufferConcurrency::type Concurrency>
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding = BufferEncoding::fixed, BufferChecksum::type Checksum = BufferChecksum::none>
 class BufferBase
 {
 	typedef typename position_type_selector<Concurrency>::type position_t;
 
+	enum
+	{
+		multi_producer = (Concurrency == BufferConcurrency::mpsc || Concurrency == BufferConcurrency::mpmc),
+		multi_consumer = (Concurrency == BufferConcurrency::mpmc),
+		swap_byte_order = (Encoding == BufferEncoding::network && !ZILLIANS_BIG_ENDIAN)
+	};
+
+	BOOST_STATIC_ASSERT(Mode == BufferMode::circular || !multi_producer);
+	BOOST_STATIC_ASSERT(Checksum == BufferChecksum::none || !multi_producer);
+
+	/**
+	 * @brief Helper class to identify whether a given type is (or is derived from) any kind of BufferBase.
+	 */
 	template <typename T>
 	struct is_buffer
 	{
-		//enum { value = boost::is_same<T, BufferBase >::value };
-		//enum { value = boost::is_base_and_derived<typename boost::remove_const<T>::type, BufferBase<Mode> >::value };
+		typedef char yes_type;
+		typedef struct { char dummy[2]; } no_type;
+
+		template<BufferMode::type M, BufferConcurrency::type C, BufferEncoding::type E, BufferChecksum::type K>
+		static yes_type test(const volatile BufferBase<M,C,E,K>*);
+		static no_type test(...);
+
+		enum { value = boost::is_class<T>::value && sizeof(test((T*)0)) == sizeof(yes_type) };
+	};
+
+	/**
+	 * @brief Helper class to identify whether a given type is an integer written as varint under current encoding.
+	 */
+	template <typename T>
+	struct is_varint_types
+	{
 		enum { value =
-				boost::is_base_and_derived<BufferBase<BufferMode::plain,BufferConcurrency::none>, T>::value ||
-				boost::is_base_and_derived<BufferBase<BufferMode::plain,BufferConcurrency::spsc>, T>::value ||
-				boost::is_base_and_derived<BufferBase<BufferMode::circular,BufferConcurrency::none>, T>::value ||
-				boost::is_base_and_derived<BufferBase<BufferMode::circular,BufferConcurrency::spsc>, T>::value
-		};
+			Encoding == BufferEncoding::varint &&
+			boost::is_integral<typename boost::remove_const<T>::type>::value &&
+			!boost::is_same<typename boost::remove_const<T>::type, bool>::value &&
+			(sizeof(T) > 1)
+			};
 	};
 
 	/**
@@ -214,6 +536,7 @@ class BufferBase
 			detail::is_std_vector<T>::value ||
 			detail::is_std_list<T>::value ||
 			detail::is_std_map<T>::value ||
+			is_varint_types<T>::value ||
 			//boost::is_same<T, BufferBase >::value
 			//boost::is_base_and_derived<typename boost::remove_const<T>::type, BufferBase>::value
 			is_buffer<T>::value
@@ -309,20 +632,37 @@ class BufferBase
 			};
 	};
 
+	/**
+	 * @brief Helper class to identify whether an array of the given type can be
+	 * read/write in one bulk memcpy (used by std::vector).
+	 */
+	template <typename T>
+	struct is_bulk_copyable_types
+	{
+		enum { value =
+			detail::is_direct_layout<T>::value ||
+			(is_direct_types<T>::value && !boost::is_pointer<T>::value && !is_varint_types<T>::value)
+			};
+	};
+
 public:
 	BufferBase()
 	{
-		mOwner = true; mReadOnly = false; mOnDemand = true;
+		mOwner = true; mReadOnly = false; mOnDemand = true; mMirrored = false;
+		mAllocator = DefaultBufferAllocator::instance();
+		mGrowthFactor = DEFAULT_GROWTH_FACTOR;
 		mData = NULL;
 		mAllocatedSize = 0;
 		if(Mode == BufferMode::plain)
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 		else
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 	}
@@ -334,23 +674,29 @@ public:
 	 * be freed in the BufferBase's destructor.
 	 *
 	 * @param size The internal data size.
+	 * @param allocator The memory backend to allocate the internal data from, or NULL to use the global heap.
 	 */
-	BufferBase(std::size_t size)
+	BufferBase(std::size_t size, BufferAllocator* allocator = NULL)
 	{
 		BOOST_ASSERT(size > 0);
-		mOwner = true; mReadOnly = false; mOnDemand = false;
+		mOwner = true; mReadOnly = false; mOnDemand = false; mMirrored = false;
+		mAllocator = allocator ? allocator : DefaultBufferAllocator::instance();
+		mGrowthFactor = DEFAULT_GROWTH_FACTOR;
 		if(Mode == BufferMode::plain)
 		{
-			mData = (byte*)malloc(size);
+			mData = mAllocator->allocate(size);
 			mAllocatedSize = size;
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 		else
 		{
-			mData = (byte*)malloc(size + 1);
-			mAllocatedSize = size + 1;
+			mMirrored = mAllocator->isMirrored();
+			mAllocatedSize = (mMirrored) ? round_up_to_granularity(size + 1, mAllocator->getGranularity()) : size + 1;
+			mData = mAllocator->allocate(mAllocatedSize);
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 	}
@@ -366,17 +712,21 @@ public:
 	 */
 	BufferBase(byte* data, std::size_t size)
 	{
-		mOwner = false; mReadOnly = false; mOnDemand = false;
+		mOwner = false; mReadOnly = false; mOnDemand = false; mMirrored = false;
+		mAllocator = DefaultBufferAllocator::instance();
+		mGrowthFactor = DEFAULT_GROWTH_FACTOR;
 		mData = data;
 		mAllocatedSize = size;
 		if(Mode == BufferMode::plain)
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 		else
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 	}
@@ -396,21 +746,53 @@ public:
 	 */
 	BufferBase(const byte* data, std::size_t size)
 	{
-		mOwner = false; mReadOnly = true; mOnDemand = false;
+		mOwner = false; mReadOnly = true; mOnDemand = false; mMirrored = false;
+		mAllocator = DefaultBufferAllocator::instance();
+		mGrowthFactor = DEFAULT_GROWTH_FACTOR;
 		mData = (byte*)data;
 		mAllocatedSize = size;
 		if(Mode == BufferMode::plain)
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 		else
 		{
 			mReadPos = mWritePos = 0;
+			mReadReservePos = mWriteReservePos = 0;
 			mReadPosMarked = mWritePosMarked = 0;
 		}
 	}
 
+	/**
+	 * @brief Construct a plain BufferBase object adopting the memory block allocated by the given allocator.
+	 *
+	 * The whole block is treated as existing data, i.e. the write pointer is placed at the end of
+	 * the block, and the block is given back to the allocator in the BufferBase's destructor. This
+	 * is typically used to wrap a memory-mapped file (see MappedFileBufferAllocator).
+	 *
+	 * @note A mutable buffer grows on demand through the allocator when writing beyond the block.
+	 *
+	 * @param allocator The allocator which allocated the memory block.
+	 * @param data The memory block, or NULL if the block is empty.
+	 * @param size The size of the memory block.
+	 * @param read_only True to make the BufferBase read-only.
+	 */
+	BufferBase(BufferAllocator* allocator, byte* data, std::size_t size, bool read_only)
+	{
+		BOOST_ASSERT(Mode == BufferMode::plain);
+		BOOST_ASSERT(allocator != NULL);
+		mOwner = true; mReadOnly = read_only; mOnDemand = !read_only; mMirrored = false;
+		mAllocator = allocator;
+		mGrowthFactor = DEFAULT_GROWTH_FACTOR;
+		mData = data;
+		mAllocatedSize = (data) ? size : 0;
+		mReadPos = 0; mWritePos = mAllocatedSize;
+		mReadReservePos = mWriteReservePos = 0;
+		mReadPosMarked = mWritePosMarked = 0;
+	}
+
 	/**
 	 * @brief Consutrct a clone of given buffer
 	 *
@@ -419,56 +801,76 @@ public:
 	 */
 	BufferBase(const BufferBase& buffer)
 	{
+		mAllocator = buffer.mAllocator;
+		mGrowthFactor = buffer.mGrowthFactor;
 		if(buffer.mOwner)
 		{
 			mOwner = true;
 			mReadOnly = false;
 			mOnDemand = buffer.mOnDemand;
-			mData = (byte*)malloc(buffer.mAllocatedSize);
+			mMirrored = buffer.mMirrored;
+			mData = mAllocator->allocate(buffer.mAllocatedSize);
 			mAllocatedSize = buffer.mAllocatedSize;
 			mReadPos = buffer.mReadPos;
 			mWritePos = buffer.mWritePos;
+			mReadReservePos = buffer.mReadReservePos;
+			mWriteReservePos = buffer.mWriteReservePos;
 			mReadPosMarked = buffer.mReadPosMarked;
 			mWritePosMarked = buffer.mWritePosMarked;
+			mChecksum = buffer.mChecksum;
 
-			::memcpy(mData, buffer.mData, buffer.mAllocatedSize);
+			memory_copy(mData, buffer.mData, buffer.mAllocatedSize);
 		}
 		else
 		{
 			mOwner = false;
 			mReadOnly = buffer.mReadOnly;
 			mOnDemand = buffer.mOnDemand;
+			mMirrored = buffer.mMirrored;
 			mData = buffer.mData;
 			mAllocatedSize = buffer.mAllocatedSize;
 			mReadPos = buffer.mReadPos;
 			mWritePos = buffer.mWritePos;
+			mReadReservePos = buffer.mReadReservePos;
+			mWriteReservePos = buffer.mWriteReservePos;
 			mReadPosMarked = buffer.mReadPosMarked;
 			mWritePosMarked = buffer.mWritePosMarked;
+			mChecksum = buffer.mChecksum;
 		}
 	}
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
 	BufferBase(BufferBase&& buffer)
 	{
+		mAllocator = buffer.mAllocator;
+		mGrowthFactor = buffer.mGrowthFactor;
 		mOwner = buffer.mOwner;
 		mReadOnly = buffer.mReadOnly;
 		mOnDemand = buffer.mOnDemand;
+		mMirrored = buffer.mMirrored;
 		mData = buffer.mData;
 		mAllocatedSize = buffer.mAllocatedSize;
 		mReadPos = buffer.mReadPos;
 		mWritePos = buffer.mWritePos;
+		mReadReservePos = buffer.mReadReservePos;
+		mWriteReservePos = buffer.mWriteReservePos;
 		mReadPosMarked = buffer.mReadPosMarked;
 		mWritePosMarked = buffer.mWritePosMarked;
+		mChecksum = buffer.mChecksum;
 
 		buffer.mOwner = false;
 		buffer.mReadOnly = false;
 		buffer.mOnDemand = false;
+		buffer.mMirrored = false;
 		buffer.mData = NULL;
 		buffer.mAllocatedSize = 0;
 		buffer.mReadPos = 0;
 		buffer.mWritePos = 0;
+		buffer.mReadReservePos = 0;
+		buffer.mWriteReservePos = 0;
 		buffer.mReadPosMarked = 0;
 		buffer.mWritePosMarked = 0;
+		buffer.mChecksum = ChecksumState();
 	}
 #endif
 
@@ -479,7 +881,7 @@ public:
 	{
 		if(mOwner && mData)
 		{
-			free((void*)mData); mData = NULL;
+			mAllocator->deallocate(mData); mData = NULL;
 		}
 	}
 
@@ -488,21 +890,27 @@ public:
 	{
 		if(mOwner && mData)
 		{
-			free((void*)mData); mData = NULL;
+			mAllocator->deallocate(mData); mData = NULL;
 		}
 
+		mAllocator = buffer.mAllocator;
+		mGrowthFactor = buffer.mGrowthFactor;
+		mMirrored = buffer.mMirrored;
 		if(buffer.mOwner)
 		{
 			mOwner = true;
 			mReadOnly = false;
-			mData = (byte*)malloc(buffer.mAllocatedSize);
+			mData = mAllocator->allocate(buffer.mAllocatedSize);
 			mAllocatedSize = buffer.mAllocatedSize;
 			mReadPos = buffer.mReadPos;
 			mWritePos = buffer.mWritePos;
+			mReadReservePos = buffer.mReadReservePos;
+			mWriteReservePos = buffer.mWriteReservePos;
 			mReadPosMarked = buffer.mReadPosMarked;
 			mWritePosMarked = buffer.mWritePosMarked;
+			mChecksum = buffer.mChecksum;
 
-			::memcpy(mData, buffer.mData, buffer.mAllocatedSize);
+			memory_copy(mData, buffer.mData, buffer.mAllocatedSize);
 		}
 		else
 		{
@@ -512,8 +920,11 @@ public:
 			mAllocatedSize = buffer.mAllocatedSize;
 			mReadPos = buffer.mReadPos;
 			mWritePos = buffer.mWritePos;
+			mReadReservePos = buffer.mReadReservePos;
+			mWriteReservePos = buffer.mWriteReservePos;
 			mReadPosMarked = buffer.mReadPosMarked;
 			mWritePosMarked = buffer.mWritePosMarked;
+			mChecksum = buffer.mChecksum;
 		}
 
 		return *this;
@@ -527,28 +938,38 @@ public:
 
 		if(mOwner && mData)
 		{
-			free((void*)mData); mData = NULL;
+			mAllocator->deallocate(mData); mData = NULL;
 		}
 
+		mAllocator = buffer.mAllocator;
+		mGrowthFactor = buffer.mGrowthFactor;
 		mOwner = buffer.mOwner;
 		mReadOnly = buffer.mReadOnly;
 		mOnDemand = buffer.mOnDemand;
+		mMirrored = buffer.mMirrored;
 		mData = buffer.mData;
 		mAllocatedSize = buffer.mAllocatedSize;
 		mReadPos = buffer.mReadPos;
 		mWritePos = buffer.mWritePos;
+		mReadReservePos = buffer.mReadReservePos;
+		mWriteReservePos = buffer.mWriteReservePos;
 		mReadPosMarked = buffer.mReadPosMarked;
 		mWritePosMarked = buffer.mWritePosMarked;
+		mChecksum = buffer.mChecksum;
 
 		buffer.mOwner = false;
 		buffer.mReadOnly = false;
 		buffer.mOnDemand = false;
+		buffer.mMirrored = false;
 		buffer.mData = NULL;
 		buffer.mAllocatedSize = 0;
 		buffer.mReadPos = 0;
 		buffer.mWritePos = 0;
+		buffer.mReadReservePos = 0;
+		buffer.mWriteReservePos = 0;
 		buffer.mReadPosMarked = 0;
 		buffer.mWritePosMarked = 0;
+		buffer.mChecksum = ChecksumState();
 
 		return *this;
 	}
@@ -558,6 +979,27 @@ public:
 	bool isMutable() { return !mReadOnly; }
 	void setMutable(bool m = true) { mReadOnly = !m; }
 
+	bool isOnDemand() const { return mOnDemand; }
+
+	/**
+	 * @brief Get the memory backend of the internal data.
+	 */
+	BufferAllocator* getAllocator() const { return mAllocator; }
+
+	/**
+	 * @brief Set the memory backend of the internal data.
+	 *
+	 * @note This can only be done before any data is allocated, i.e. on a default-constructed (on-demand) buffer.
+	 *
+	 * @param allocator The memory backend, or NULL to use the global heap.
+	 */
+	void setAllocator(BufferAllocator* allocator)
+	{
+		BOOST_ASSERT(mData == NULL && mOwner);
+		BOOST_ASSERT(!allocator || !allocator->isMirrored());	// mirrored memory can't grow on demand
+		mAllocator = allocator ? allocator : DefaultBufferAllocator::instance();
+	}
+
 public:
 	/**
 	 * @brief Probe the actual data size of a given type.
@@ -565,12 +1007,37 @@ public:
 	 * @return The actual size stored in BufferBase object.
 	 */
 	template <typename T>
-	inline static std::size_t probeSize()
+	inline static ZILLIANS_BUFFER_CONSTEXPR std::size_t probeSize()
 	{
-		if(UNLIKELY(typeid(T) == typeid(bool)))
-			return sizeof(int8);
+		return boost::is_same<typename boost::remove_cv<T>::type, bool>::value ? sizeof(int8) :
+				(is_varint_types<T>::value ? (sizeof(T) * 8 + 6) / 7 /* the maximum encoded size */ : sizeof(T));
+	}
+
+	/**
+	 * @brief Probe the actual data size of a length field (of strings, containers, etc.)
+	 *
+	 * @param length The length to be stored.
+	 * @return The actual size of the length field stored in BufferBase object.
+	 */
+	inline static std::size_t probeLengthSize(uint32 length)
+	{
+		if(Encoding == BufferEncoding::fixed)
+			return sizeof(uint32);
 		else
-			return sizeof(T);
+			return probeVarintSize(length);
+	}
+
+	/**
+	 * @brief Probe the LEB128 encoded size of the given unsigned integer.
+	 */
+	inline static std::size_t probeVarintSize(uint64 value)
+	{
+		std::size_t size = 1;
+		while(value >= 0x80)
+		{
+			value >>= 7; ++size;
+		}
+		return size;
 	}
 
 	/**
@@ -594,6 +1061,19 @@ public:
 
 	template <typename T>
 	inline static std::size_t probeSizeDispatch(const T &value, boost::mpl::false_ /* is_builtin_type */)
+	{
+		return probeSizeDispatchSerializable(value, boost::mpl::bool_< detail::is_direct_layout<T>::value >());
+	}
+
+	template <typename T>
+	inline static std::size_t probeSizeDispatchSerializable(const T &value, boost::mpl::true_ /* is_direct_layout */)
+	{
+		UNUSED_ARGUMENT(value);
+		return sizeof(T);
+	}
+
+	template <typename T>
+	inline static std::size_t probeSizeDispatchSerializable(const T &value, boost::mpl::false_ /* is_direct_layout */)
 	{
 		return probeSizeSerializable(value);
 	}
@@ -619,7 +1099,7 @@ public:
 	template <typename T>
 	inline static std::size_t probeSizeBuiltin(const std::vector<T> &value)
 	{
-		std::size_t size = sizeof(uint32);
+		std::size_t size = probeLengthSize(value.size());
 		size += probeSizeBuiltinForVector<T>(value, boost::mpl::bool_<is_variable_types<T>::value>());
 		return size;
 	}
@@ -653,7 +1133,7 @@ public:
 	template <typename T>
 	inline static std::size_t probeSizeBuiltin(const std::list<T> &value)
 	{
-		std::size_t size = sizeof(uint32);
+		std::size_t size = probeLengthSize(value.size());
 		size += probeSizeBuiltinForList<T>(value, boost::mpl::bool_<is_variable_types<T>::value>());
 		return size;
 	}
@@ -687,7 +1167,7 @@ public:
 	template <typename K, typename V>
 	inline static std::size_t probeSizeBuiltin(const std::map<K,V> &value)
 	{
-		std::size_t size = sizeof(uint32);
+		std::size_t size = probeLengthSize(value.size());
 		size += probeSizeBuiltinForMap<K,V>(value, boost::mpl::or_< boost::mpl::bool_<is_variable_types<K>::value>, boost::mpl::bool_<is_variable_types<V>::value> >());
 		return size;
 	}
@@ -722,7 +1202,7 @@ public:
 	template <typename T, std::size_t N>
 	inline static std::size_t probeSizeBuiltin(const boost::array<T,N> &value)
 	{
-		return N * sizeof(T) + sizeof(uint32);
+		return N * sizeof(T) + probeLengthSize(N * sizeof(T));
 	}
 
 	/**
@@ -751,7 +1231,8 @@ public:
 	 */
 	inline static std::size_t probeSizeBuiltin(const char* value)
 	{
-		return strlen(value) + sizeof(uint32);
+		std::size_t length = strlen(value);
+		return length + probeLengthSize(length);
 	}
 
 	/**
@@ -762,7 +1243,7 @@ public:
 	 */
 	inline static std::size_t probeSizeBuiltin(const std::string &value)
 	{
-		return value.length() + sizeof(uint32);
+		return value.length() + probeLengthSize(value.length());
 	}
 
 	/**
@@ -773,7 +1254,7 @@ public:
 	 */
 	inline static std::size_t probeSizeBuiltin(const std::wstring &value)
 	{
-		return (value.length() + 1) * sizeof(wchar_t);
+		return value.length() * sizeof(wchar_t) + probeLengthSize(value.length());
 	}
 
 	/**
@@ -784,7 +1265,7 @@ public:
 	 */
 	inline static std::size_t probeSizeBuiltin(const BufferBase* value)
 	{
-		return value->dataSize() + sizeof(uint32);
+		return value->dataSize() + probeLengthSize(value->dataSize());
 	}
 
 	/**
@@ -824,6 +1305,18 @@ public:
 	 */
 	template<typename T>
 	inline static std::size_t probeSizeBuiltin(const T& value)
+	{
+		return probeSizeBuiltinInteger(value, boost::mpl::bool_< is_varint_types<T>::value >());
+	}
+
+	template<typename T>
+	inline static std::size_t probeSizeBuiltinInteger(const T& value, boost::mpl::true_ /* is_varint_types */)
+	{
+		return probeVarintSize(encodeZigZag(value, boost::mpl::bool_< boost::is_signed<T>::value >()));
+	}
+
+	template<typename T>
+	inline static std::size_t probeSizeBuiltinInteger(const T& value, boost::mpl::false_ /* is_varint_types */)
 	{
 		UNUSED_ARGUMENT(value);
 		return sizeof(T);
@@ -893,7 +1386,9 @@ public:
 	inline void clear()
 	{
 		mReadPos = mWritePos = 0;
+		mReadReservePos = mWriteReservePos = 0;
 		mReadPosMarked = mWritePosMarked = 0;
+		mChecksum = ChecksumState();
 	}
 
 	/**
@@ -910,6 +1405,8 @@ public:
 	 */
 	inline void crunch()
 	{
+		BOOST_ASSERT(!multi_producer);
+
 		if(Mode == BufferMode::plain)
 		{
 			if(dataSize() > 0 && rpos() > 0)
@@ -917,12 +1414,16 @@ public:
 				std::size_t size = dataSize();
 				if(LIKELY(size > 0))
 				{
-					::memmove(mData, mData + rpos(), size);
+					memory_move(mData, mData + rpos(), size);
 				}
 				wpos(size);
 				rpos(0);
 			}
 		}
+		else if(mMirrored)
+		{
+			// data in mirrored buffer is always contiguous, no need to move
+		}
 		else
 		{
 			//TODO use for-loop to iterate over all elements
@@ -935,9 +1436,9 @@ public:
 				if(LIKELY(size > 0))
 				{
 					byte* temporary = new byte[size];
-					::memmove(temporary, mData + rpos(), size_to_end);
-					::memmove(temporary + size_to_end, mData, size_from_begin);
-					::memmove(mData, temporary, size);
+					memory_copy(temporary, mData + rpos(), size_to_end);
+					memory_copy(temporary + size_to_end, mData, size_from_begin);
+					memory_copy(mData, temporary, size);
 					delete[] temporary;
 				}
 			}
@@ -946,7 +1447,7 @@ public:
 				size = wpos() - rpos();
 				if(LIKELY(size > 0 && rpos() > 0))
 				{
-					::memmove(mData, mData + rpos(), size);
+					memory_move(mData, mData + rpos(), size);
 				}
 			}
 			wpos(size);
@@ -1027,7 +1528,16 @@ public:
 	 */
 	inline std::size_t freeSize() const
 	{
-		return allocatedSize() - dataSize();
+		if(multi_producer)
+		{
+			// reserved but not yet committed space is not free
+			std::size_t current_rpos = mReadPos;
+			return allocatedSize() - (mWriteReservePos - current_rpos);
+		}
+		else
+		{
+			return allocatedSize() - dataSize();
+		}
 	}
 
 	/**
@@ -1040,6 +1550,14 @@ public:
 	 */
 	inline std::size_t dataSize() const
 	{
+		if(multi_producer)
+		{
+			// positions of multi-producer buffer are never wrapped around
+			std::size_t current_rpos = mReadPos;
+			std::size_t current_wpos = mWritePos;
+			return current_wpos - current_rpos;
+		}
+
 		std::size_t current_wpos = wpos();	// get snapshot of wpos
 		std::size_t current_rpos = rpos();	// get snapshot of rpos
 
@@ -1065,9 +1583,12 @@ public:
 	 *
 	 * This method is basically used in circular buffer scenario, in which we need to get the physical memory ranges for available data
 	 *
+	 * @param ranges Ranges are appended to it, either std::vector<std::pair<byte*,std::size_t> > or BufferRanges to avoid allocation
+	 *
 	 * @return The current available data size
 	 */
-	inline std::size_t getDataRanges(std::vector<std::pair<byte*,std::size_t> >& ranges)
+	template<typename Ranges>
+	inline std::size_t getDataRanges(Ranges& ranges)
 	{
 		std::size_t current_wpos = wpos();
 		std::size_t current_rpos = rpos();
@@ -1082,8 +1603,15 @@ public:
 			if(current_wpos < current_rpos)
 			{
 				//return current_wpos + mAllocatedSize - current_rpos;
-				ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos));
-				ranges.push_back(std::make_pair(mData, current_wpos));
+				if(mMirrored)
+				{
+					ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos + current_wpos));
+				}
+				else
+				{
+					ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos));
+					ranges.push_back(std::make_pair(mData, current_wpos));
+				}
 				return mAllocatedSize - current_rpos + current_wpos;
 			}
 			else
@@ -1106,9 +1634,12 @@ public:
 	 *
 	 * This method is basically used in circular buffer scenario, in which we need to get the physical memory ranges for available data
 	 *
+	 * @param ranges Ranges are appended to it, either std::vector<std::pair<byte*,std::size_t> > or BufferRanges to avoid allocation
+	 *
 	 * @return The current available data size
 	 */
-	inline std::size_t getDataRangesFromMark(std::vector<std::pair<byte*,std::size_t> >& ranges)
+	template<typename Ranges>
+	inline std::size_t getDataRangesFromMark(Ranges& ranges)
 	{
 		std::size_t current_wpos = mWritePosMarked;
 		std::size_t current_rpos = mReadPosMarked;
@@ -1123,9 +1654,16 @@ public:
 			if(current_wpos < current_rpos)
 			{
 				//return current_wpos + mAllocatedSize - current_rpos;
-				ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos));
-				if(current_wpos != 0 )
-					ranges.push_back(std::make_pair(mData, current_wpos));
+				if(mMirrored)
+				{
+					ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos + current_wpos));
+				}
+				else
+				{
+					ranges.push_back(std::make_pair(mData + current_rpos, mAllocatedSize - current_rpos));
+					if(current_wpos != 0 )
+						ranges.push_back(std::make_pair(mData, current_wpos));
+				}
 				return mAllocatedSize - current_rpos + current_wpos;
 			}
 			else
@@ -1142,23 +1680,88 @@ public:
 			}
 		}
 	}
-public:
-	/**
-	 * @brief Get the current read pointer position.
-	 *
-	 * @return The current read pointer position.
-	 */
-	inline std::size_t rpos() const { return mReadPos; }
 
 	/**
-	 * @brief Get the current write pointer position.
+	 * Get the current free range vector
 	 *
-	 * @return The current write pointer position.
+	 * This is the counterpart of getDataRanges(), used to read from a device straight into the buffer
+	 * memory. Once the data arrives, call wskip() with the number of bytes written to the ranges in order.
+	 *
+	 * @note For plain buffer only the space after the write pointer is returned, crunch() to reclaim the space before the read pointer.
+	 *
+	 * @param ranges Ranges are appended to it, either std::vector<std::pair<byte*,std::size_t> > or BufferRanges to avoid allocation
+	 *
+	 * @return The total size of the returned ranges
 	 */
-	inline std::size_t wpos() const { return mWritePos; }
+	template<typename Ranges>
+	inline std::size_t getFreeRanges(Ranges& ranges)
+	{
+		BOOST_ASSERT(!multi_producer);
 
-	/**
-	 * @brief Manually set the current read pointer position.
+		std::size_t current_wpos = wpos();
+		std::size_t current_rpos = rpos();
+
+		if(Mode == BufferMode::plain)
+		{
+			if(current_wpos == mAllocatedSize)
+				return 0;
+
+			ranges.push_back(std::make_pair(mData + current_wpos, mAllocatedSize - current_wpos));
+			return mAllocatedSize - current_wpos;
+		}
+		else
+		{
+			std::size_t size = freeSize();
+			if(size == 0)
+				return 0;
+
+			if(mMirrored || current_wpos < current_rpos)
+			{
+				ranges.push_back(std::make_pair(mData + current_wpos, size));
+			}
+			else
+			{
+				// one slot before the read pointer is always kept empty
+				std::size_t tail = (current_rpos == 0) ? mAllocatedSize - current_wpos - 1 : mAllocatedSize - current_wpos;
+				ranges.push_back(std::make_pair(mData + current_wpos, tail));
+				if(size > tail)
+					ranges.push_back(std::make_pair(mData, size - tail));
+			}
+			return size;
+		}
+	}
+
+	/**
+	 * Get the physical memory backing the buffer, including the mirror of a mirrored buffer
+	 *
+	 * Every range returned by getDataRanges() or getFreeRanges() lies in this memory, until the buffer is resized.
+	 */
+	inline std::pair<byte*,std::size_t> getMemoryRange() const
+	{
+		return std::make_pair(mData, mMirrored ? mAllocatedSize * 2 : mAllocatedSize);
+	}
+public:
+	/**
+	 * @brief Get the current read pointer position.
+	 *
+	 * @note For multi-producer buffer the positions are kept as ever-increasing counters,
+	 * and the returned value is the physical position in the internal data buffer.
+	 *
+	 * @return The current read pointer position.
+	 */
+	inline std::size_t rpos() const { std::size_t position = mReadPos; return multi_producer ? position % mAllocatedSize : position; }
+
+	/**
+	 * @brief Get the current write pointer position.
+	 *
+	 * @note For multi-producer buffer this is the position of the last committed write.
+	 *
+	 * @return The current write pointer position.
+	 */
+	inline std::size_t wpos() const { std::size_t position = mWritePos; return multi_producer ? position % mAllocatedSize : position; }
+
+	/**
+	 * @brief Manually set the current read pointer position.
 	 *
 	 * @param position The absolute read pointer position.
 	 * @return The updated current read pointer position.
@@ -1181,7 +1784,7 @@ public:
 	 *
 	 * @return The current read pointer.
 	 */
-	inline byte* rptr() const { return (byte*)(mData + mReadPos); }
+	inline byte* rptr() const { return (byte*)(mData + rpos()); }
 
 	/**
 	 * @brief Get the current write pointer.
@@ -1191,7 +1794,7 @@ public:
 	 *
 	 * @return The current write pointer.
 	 */
-	inline byte* wptr() const { return (byte*)(mData + mWritePos); }
+	inline byte* wptr() const { return (byte*)(mData + wpos()); }
 
 	/**
 	 * @brief Move forward the current read pointer by given number of bytes.
@@ -1200,10 +1803,22 @@ public:
 	 */
 	inline void rskip(std::size_t bytes)
 	{
-		if(Mode == BufferMode::plain)
+		if(multi_consumer)
+		{
+			readConcurrent(NULL, bytes, boost::mpl::bool_<multi_consumer>());
+		}
+		else if(multi_producer)
+		{
+			if(bytes > dataSize())
+				throw std::length_error("out of data buffer");
+
+			mReadPos = mReadPos + bytes;
+		}
+		else if(Mode == BufferMode::plain)
 		{
 			BOOST_ASSERT(bytes <= mAllocatedSize);
 
+			if(Checksum != BufferChecksum::none) mChecksum.read = foldChecksum(mChecksum.read, rpos(), bytes);
 			mReadPos += bytes;
 			BOOST_ASSERT(mReadPos <= mAllocatedSize);
 		}
@@ -1214,11 +1829,15 @@ public:
 			if(bytes > dataSize())
 				throw std::length_error("out of data buffer");
 
+			if(Checksum != BufferChecksum::none) mChecksum.read = foldChecksum(mChecksum.read, rpos(), bytes);
+
 			//std::size_t size_before = dataSize();
 
-			mReadPos += bytes;
-			if(mReadPos >= mAllocatedSize)
-				mReadPos -= mAllocatedSize;
+			// update the position at once so the other side never sees an out-of-range position
+			std::size_t position = mReadPos + bytes;
+			if(position >= mAllocatedSize)
+				position -= mAllocatedSize;
+			mReadPos = position;
 
 			//std::size_t size_after = dataSize();
 			//BOOST_ASSERT(size_before - bytes == size_after);
@@ -1232,10 +1851,15 @@ public:
 	 */
 	inline void wskip(std::size_t bytes)
 	{
-		if(Mode == BufferMode::plain)
+		if(multi_producer)
+		{
+			writeConcurrent(NULL, bytes, boost::mpl::bool_<multi_producer>());
+		}
+		else if(Mode == BufferMode::plain)
 		{
 			BOOST_ASSERT(bytes <= mAllocatedSize);
 
+			if(Checksum != BufferChecksum::none) mChecksum.write = foldChecksum(mChecksum.write, wpos(), bytes);
 			mWritePos += bytes;
 			BOOST_ASSERT(mWritePos <= mAllocatedSize);
 		}
@@ -1246,11 +1870,15 @@ public:
 			if(bytes > freeSize())
 				throw std::length_error("out of free buffer");
 
+			if(Checksum != BufferChecksum::none) mChecksum.write = foldChecksum(mChecksum.write, wpos(), bytes);
+
 			//std::size_t size_before = dataSize();
 
-			mWritePos += bytes;
-			if(mWritePos >= mAllocatedSize)
-				mWritePos -= mAllocatedSize;
+			// update the position at once so the other side never sees an out-of-range position
+			std::size_t position = mWritePos + bytes;
+			if(position >= mAllocatedSize)
+				position -= mAllocatedSize;
+			mWritePos = position;
 
 			//std::size_t size_after = dataSize();
 			//BOOST_ASSERT(size_before + bytes == size_after);
@@ -1264,6 +1892,8 @@ public:
 	 */
 	inline void rrev(std::size_t bytes)
 	{
+		BOOST_ASSERT(!multi_producer);
+
 		if(Mode == BufferMode::plain)
 		{
 			BOOST_ASSERT(bytes <= mAllocatedSize);
@@ -1289,6 +1919,8 @@ public:
 	 */
 	inline void wrev(std::size_t bytes)
 	{
+		BOOST_ASSERT(!multi_producer);
+
 		if(Mode == BufferMode::plain)
 		{
 			BOOST_ASSERT(bytes <= mAllocatedSize);
@@ -1354,6 +1986,18 @@ public:
 	 */
 	template <typename T>
 	inline void readDispatch(T& value, boost::mpl::false_ /*is_builtin_types*/)
+	{
+		readDispatchSerializable(value, boost::mpl::bool_< detail::is_direct_layout<T>::value >() );
+	}
+
+	template <typename T>
+	inline void readDispatchSerializable(T& value, boost::mpl::true_ /*is_direct_layout*/)
+	{
+		readArray((char*)&value, sizeof(T));
+	}
+
+	template <typename T>
+	inline void readDispatchSerializable(T& value, boost::mpl::false_ /*is_direct_layout*/)
 	{
 		readSerializable(value);
 	}
@@ -1443,7 +2087,7 @@ public:
 	 */
 	inline void readBuiltin(int16& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1453,7 +2097,7 @@ public:
 	 */
 	inline void readBuiltin(uint16& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1463,7 +2107,7 @@ public:
 	 */
 	inline void readBuiltin(int32& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1473,7 +2117,7 @@ public:
 	 */
 	inline void readBuiltin(uint32& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1483,7 +2127,7 @@ public:
 	 */
 	inline void readBuiltin(int64& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1493,7 +2137,7 @@ public:
 	 */
 	inline void readBuiltin(long long int& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1503,7 +2147,7 @@ public:
 	 */
 	inline void readBuiltin(uint64& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1513,7 +2157,7 @@ public:
 	 */
 	inline void readBuiltin(unsigned long long int& value)
 	{
-		readDirect(value);
+		readInteger(value);
 	}
 
 	/**
@@ -1523,7 +2167,7 @@ public:
 	 */
 	inline void readBuiltin(float& value)
 	{
-		readDirect(value);
+		readOrdered(value);
 	}
 
 	/**
@@ -1533,7 +2177,7 @@ public:
 	 */
 	inline void readBuiltin(double& value)
 	{
-		readDirect(value);
+		readOrdered(value);
 	}
 
 	/**
@@ -1554,7 +2198,7 @@ public:
 	 */
 	inline void readBuiltin(std::string& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
 			value.clear();
@@ -1564,7 +2208,7 @@ public:
 			}
 			else
 			{
-				if(rpos() + length <= mAllocatedSize)
+				if(isContiguous(rpos(), length))
 				{
 					value.append((char*)rptr(), length);
 				}
@@ -1591,7 +2235,7 @@ public:
 	 */
 	inline void readBuiltin(std::wstring& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		uint32 bytes_count = length * sizeof(wchar_t);
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
@@ -1602,7 +2246,7 @@ public:
 			}
 			else
 			{
-				if(rpos() + bytes_count <= mAllocatedSize)
+				if(isContiguous(rpos(), bytes_count))
 				{
 					value.append((wchar_t*)rptr(), length);
 				}
@@ -1635,7 +2279,7 @@ public:
 	 */
 	inline void readBuiltin(char* value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
 			BOOST_ASSERT(length <= dataSize());
@@ -1668,17 +2312,10 @@ public:
 	template <typename T>
 	inline void readBuiltin(std::vector<T>& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length <= MAX_VECTOR_LENGTH))
 		{
-			value.clear();
-			// since we know the number of elements to read, just reserve it first for better performance
-			value.reserve(length);
-			for(uint32 i = 0; i < length; ++i)
-			{
-				T x; read(x);
-				value.push_back(x);
-			}
+			readVectorImpl(value, length, boost::mpl::bool_< is_bulk_copyable_types<T>::value >());
 		}
 		else
 		{
@@ -1686,6 +2323,33 @@ public:
 		}
 	}
 
+	/**
+	 * @brief The vector element can be copied by memcpy, so read all elements at once.
+	 */
+	template <typename T>
+	inline void readVectorImpl(std::vector<T>& value, uint32 length, boost::mpl::true_ /*bulk_copy*/)
+	{
+		value.resize(length);
+		if(length > 0)
+			readArrayOrdered(&value[0], length);
+	}
+
+	/**
+	 * @brief The vector element is not bulk copyable, read the element one by one.
+	 */
+	template <typename T>
+	inline void readVectorImpl(std::vector<T>& value, uint32 length, boost::mpl::false_ /*bulk_copy*/)
+	{
+		value.clear();
+		// since we know the number of elements to read, just reserve it first for better performance
+		value.reserve(length);
+		for(uint32 i = 0; i < length; ++i)
+		{
+			T x; read(x);
+			value.push_back(x);
+		}
+	}
+
 	/**
 	 * @brief Read a std::pair<K, V> object.
 	 *
@@ -1706,7 +2370,7 @@ public:
 	template <typename T>
 	inline void readBuiltin(std::list<T>& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length <= MAX_LIST_LENGTH))
 		{
 			value.clear();
@@ -1730,7 +2394,7 @@ public:
 	template <typename K, typename V>
 	inline void readBuiltin(std::map<K,V>& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length <= MAX_LIST_LENGTH))
 		{
 			value.clear();
@@ -1755,7 +2419,7 @@ public:
 	template <typename T, std::size_t N>
 	inline void readBuiltin(boost::array<T, N>& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 		if(LIKELY(length == N * sizeof(T)))
 		{
 			readBoostArrayImpl(value, boost::mpl::bool_< is_direct_types<T>::value >());
@@ -1795,10 +2459,10 @@ public:
 	 *
 	 * @param value The BufferBase variable to be read.
 	 */
-	template<BufferMode::type M, BufferConcurrency::type C>
-	inline void readBuiltin(BufferBase<M, C>& value)
+	template<BufferMode::type M, BufferConcurrency::type C, BufferEncoding::type E, BufferChecksum::type K>
+	inline void readBuiltin(BufferBase<M,C,E,K>& value)
 	{
-		uint32 length; readDirect(length);
+		uint32 length; readLength(length);
 
 		BOOST_ASSERT(dataSize() >= length);
 
@@ -1813,7 +2477,7 @@ public:
 	template <typename T, std::size_t N>
 	inline void readBoostArrayImpl(boost::array<T, N>& value, boost::mpl::true_ /*native_copy*/)
 	{
-		readArray((char*)value.data(), N * sizeof(T));
+		readArrayOrdered(value.data(), N);
 	}
 
 	/**
@@ -1830,6 +2494,113 @@ public:
 		}
 	}
 
+	/**
+	 * @brief Read a length field (of strings, containers, etc.) according to the buffer encoding.
+	 *
+	 * @param length The length to be read.
+	 */
+	inline void readLength(uint32& length)
+	{
+		if(Encoding == BufferEncoding::fixed || Encoding == BufferEncoding::network)
+		{
+			readOrdered(length);
+		}
+		else
+		{
+			uint64 x; readVarint(x);
+			if(UNLIKELY(x > 0xFFFFFFFFULL))
+				throw std::length_error("length out of range");
+			length = (uint32)x;
+		}
+	}
+
+	/**
+	 * @brief Read an integer according to the buffer encoding.
+	 *
+	 * @param value The integer to be read.
+	 */
+	template <typename T>
+	inline void readInteger(T& value)
+	{
+		if(is_varint_types<T>::value)
+		{
+			uint64 x; readVarint(x);
+			value = (T)decodeZigZag(x, boost::mpl::bool_< boost::is_signed<T>::value >());
+		}
+		else
+		{
+			readOrdered(value);
+		}
+	}
+
+	/**
+	 * @brief Read a fixed-size value in the byte order of the buffer encoding.
+	 *
+	 * @param value The value to be read.
+	 */
+	template <typename T>
+	inline void readOrdered(T& value)
+	{
+		readDirect(value);
+		if(swap_byte_order)
+			value = byte_swap(value);
+	}
+
+	/**
+	 * @brief Read an array of values in the byte order of the buffer encoding.
+	 *
+	 * Elements other than integers and floating point values are read as they are.
+	 *
+	 * @param items The array to be read into.
+	 * @param n The number of elements.
+	 */
+	template <typename T>
+	inline void readArrayOrdered(T* items, std::size_t n)
+	{
+		readArray((char*)items, n * sizeof(T));
+		readArraySwap(items, n, boost::mpl::bool_< swap_byte_order && boost::is_arithmetic<T>::value && (sizeof(T) > 1) >());
+	}
+
+	template <typename T>
+	inline void readArraySwap(T* items, std::size_t n, boost::mpl::true_ /*swap*/)
+	{
+		byte_swap_array(items, items, n);
+	}
+
+	template <typename T>
+	inline void readArraySwap(T* items, std::size_t n, boost::mpl::false_ /*swap*/)
+	{
+		UNUSED_ARGUMENT(items);
+		UNUSED_ARGUMENT(n);
+	}
+
+	/**
+	 * @brief Read an LEB128 encoded unsigned integer.
+	 *
+	 * @note Throws std::length_error if the data ends in the middle of the integer, or if
+	 * it's longer than 10 bytes or doesn't fit in 64 bits.
+	 *
+	 * @param value The integer to be read.
+	 */
+	inline void readVarint(uint64& value)
+	{
+		value = 0;
+		for(int shift = 0; shift < 64; shift += 7)
+		{
+			if(!multi_consumer && UNLIKELY(dataSize() == 0))
+				throw std::length_error("out of data buffer");
+
+			uint8 b; readDirect(b);
+			if(UNLIKELY(shift == 63 && (b & 0x7E) != 0))
+				throw std::length_error("varint overflow");
+
+			value |= ((uint64)(b & 0x7F)) << shift;
+			if(LIKELY((b & 0x80) == 0))
+				return;
+		}
+		throw std::length_error("malformed varint");
+	}
+
 	/**
 	 * @brief Read an arbitrary type of object.
 	 *
@@ -1838,8 +2609,15 @@ public:
 	template <typename T>
 	inline void readDirect(T& value)
 	{
-		getDirect(value, rpos());
-		rskip(sizeof(T));
+		if(multi_consumer)
+		{
+			readConcurrent((char*)&value, sizeof(T), boost::mpl::bool_<multi_consumer>());
+		}
+		else
+		{
+			getDirect(value, rpos());
+			rskip(sizeof(T));
+		}
 	}
 
 	/**
@@ -1852,8 +2630,156 @@ public:
 	{
 		if(UNLIKELY(!dest))	return;
 
-		getArray(dest, rpos(), size);
-		rskip(size);
+		if(multi_consumer)
+		{
+			readConcurrent(dest, size, boost::mpl::bool_<multi_consumer>());
+		}
+		else
+		{
+			getArray(dest, rpos(), size);
+			rskip(size);
+		}
+	}
+
+public:
+	/**
+	 * @brief Reserve a length prefix, to be patched by endLengthPrefix() once the payload is written.
+	 *
+	 * Writing a length-prefixed value by probeSize() first walks the value twice, while
+	 * this writes it in a single traversal. Together with an on-demand buffer the payload
+	 * size doesn't have to be known in advance at all.
+	 *
+	 * @code
+	 * std::size_t mark = buffer.beginLengthPrefix();
+	 * buffer << snapshot;
+	 * uint32 length = buffer.endLengthPrefix(mark);
+	 * @endcode
+	 *
+	 * @note The prefix is a fixed-size uint32 regardless of the encoding so it can be patched in place, read it by readLengthPrefix().
+	 * @note The prefix is not covered by the buffer checksum.
+	 * @note The prefix is visible before it's patched, so this is for non-concurrent buffers only.
+	 *
+	 * @return The mark to pass to endLengthPrefix().
+	 */
+	inline std::size_t beginLengthPrefix()
+	{
+		BOOST_ASSERT(Concurrency == BufferConcurrency::none);
+
+		// relative to the read pointer, which stays valid when the buffer grows
+		std::size_t mark = dataSize();
+
+		// the prefix is patched later, so it's left out of the checksum
+		uint32 checksum = mChecksum.write;
+		writeDirect((uint32)0);
+		mChecksum.write = checksum;
+
+		return mark;
+	}
+
+	/**
+	 * @brief Patch the length prefix reserved by beginLengthPrefix() with the size written since then.
+	 *
+	 * @param mark The mark returned by beginLengthPrefix().
+	 * @param flags Bits to be or-ed into the prefix, the length must leave them clear.
+	 *
+	 * @return The payload length, excluding the prefix and the flags.
+	 */
+	inline uint32 endLengthPrefix(std::size_t mark, uint32 flags = 0)
+	{
+		BOOST_ASSERT(Concurrency == BufferConcurrency::none);
+		BOOST_ASSERT(mark + sizeof(uint32) <= dataSize());
+
+		uint32 length = (uint32)(dataSize() - mark - sizeof(uint32));
+		BOOST_ASSERT((length & flags) == 0);
+
+		std::size_t position = rpos() + mark;
+		if(Mode == BufferMode::circular && position >= mAllocatedSize)
+			position -= mAllocatedSize;
+		setDirect(length | flags, position);
+
+		return length;
+	}
+
+	/**
+	 * @brief Write a value prefixed by its length in a single traversal.
+	 *
+	 * @return The length of the value.
+	 */
+	template <typename T>
+	inline uint32 writeLengthPrefixed(const T& value)
+	{
+		std::size_t mark = beginLengthPrefix();
+		write(value);
+		return endLengthPrefix(mark);
+	}
+
+	/**
+	 * @brief Read a length prefix written by beginLengthPrefix() and endLengthPrefix().
+	 */
+	inline uint32 readLengthPrefix()
+	{
+		uint32 checksum = mChecksum.read;
+		uint32 length;
+		readDirect(length);
+		mChecksum.read = checksum;
+		return length;
+	}
+
+	/**
+	 * @brief Get the checksum of all bytes written so far, including those written by wskip().
+	 *
+	 * Bytes are checksummed as they pass the write pointer, so it costs no extra pass over
+	 * the data. The checksum restarts by clear() or resetChecksum().
+	 *
+	 * @code
+	 * // sender
+	 * buffer << message;
+	 * buffer.writeChecksum();
+	 * // receiver
+	 * buffer >> message;
+	 * if(!buffer.verify()) ...
+	 * @endcode
+	 */
+	inline uint32 checksum() const
+	{
+		BOOST_STATIC_ASSERT(Checksum != BufferChecksum::none);
+		return mChecksum.write;
+	}
+
+	/**
+	 * @brief Tell if the checksum of all bytes read so far, including those skipped by rskip(), matches the given one.
+	 */
+	inline bool verify(uint32 expected) const
+	{
+		BOOST_STATIC_ASSERT(Checksum != BufferChecksum::none);
+		return mChecksum.read == expected;
+	}
+
+	/**
+	 * @brief Append the checksum of all bytes written so far as a uint32 trailer.
+	 */
+	inline void writeChecksum()
+	{
+		uint32 value = checksum();
+		writeDirect(value);
+	}
+
+	/**
+	 * @brief Read a trailer written by writeChecksum() and verify the bytes read before it.
+	 *
+	 * The trailer itself is checksummed on both sides, so the checksums stay in sync for the next message.
+	 */
+	inline bool verify()
+	{
+		uint32 actual = mChecksum.read;
+		uint32 expected;
+		readDirect(expected);
+		return actual == expected;
+	}
+
+	inline void resetChecksum()
+	{
+		mChecksum = ChecksumState();
 	}
 
 public:
@@ -1871,6 +2797,18 @@ public:
 
 	template <typename T>
 	inline void writeDispatch(const T& value, boost::mpl::false_ /*is_builtin_types*/)
+	{
+		writeDispatchSerializable(value, boost::mpl::bool_< detail::is_direct_layout<T>::value >() );
+	}
+
+	template <typename T>
+	inline void writeDispatchSerializable(const T& value, boost::mpl::true_ /*is_direct_layout*/)
+	{
+		writeArray((const char*)&value, sizeof(T));
+	}
+
+	template <typename T>
+	inline void writeDispatchSerializable(const T& value, boost::mpl::false_ /*is_direct_layout*/)
 	{
 		writeSerializable(value);
 	}
@@ -1961,7 +2899,7 @@ public:
 	 */
 	inline void writeBuiltin(const int16& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -1971,7 +2909,7 @@ public:
 	 */
 	inline void writeBuiltin(const uint16& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -1981,7 +2919,7 @@ public:
 	 */
 	inline void writeBuiltin(const int32& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -1991,7 +2929,7 @@ public:
 	 */
 	inline void writeBuiltin(const long long int& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -2001,7 +2939,7 @@ public:
 	 */
 	inline void writeBuiltin(const uint32& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -2011,7 +2949,7 @@ public:
 	 */
 	inline void writeBuiltin(const int64& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -2021,7 +2959,7 @@ public:
 	 */
 	inline void writeBuiltin(const uint64& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -2031,7 +2969,7 @@ public:
 	 */
 	inline void writeBuiltin(const unsigned long long int& value)
 	{
-		writeDirect(value);
+		writeInteger(value);
 	}
 
 	/**
@@ -2041,7 +2979,7 @@ public:
 	 */
 	inline void writeBuiltin(const float& value)
 	{
-		writeDirect(value);
+		writeOrdered(value);
 	}
 
 	/**
@@ -2051,7 +2989,7 @@ public:
 	 */
 	inline void writeBuiltin(const double& value)
 	{
-		writeDirect(value);
+		writeOrdered(value);
 	}
 
 	/**
@@ -2075,7 +3013,7 @@ public:
 		uint32 length = value.length();
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
-			writeDirect(length);
+			writeLength(length);
 			writeArray((const char*)value.data(), length);
 		}
 		else
@@ -2095,7 +3033,7 @@ public:
 		uint32 bytes_count = length * sizeof(wchar_t);
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
-			writeDirect(length);
+			writeLength(length);
 			writeArray((const char*)value.data(), bytes_count);
 		}
 		else
@@ -2114,7 +3052,7 @@ public:
 		uint32 length = strlen(value);
 		if(LIKELY(length <= MAX_STRING_LENGTH))
 		{
-			writeDirect(length);
+			writeLength(length);
 			writeArray(value, length);
 		}
 		else
@@ -2145,11 +3083,8 @@ public:
 		uint32 length = value.size();
 		if(LIKELY(length <= MAX_VECTOR_LENGTH))
 		{
-			writeDirect(length);
-			for(typename std::vector<T>::const_iterator i = value.begin(); i != value.end(); ++i)
-			{
-				write(*i);
-			}
+			writeLength(length);
+			writeVectorImpl(value, boost::mpl::bool_< is_bulk_copyable_types<T>::value >());
 		}
 		else
 		{
@@ -2158,7 +3093,29 @@ public:
 	}
 
 	/**
-	 * @brief Write a std::list<T> object.
+	 * @brief The vector element can be copied by memcpy, so write all elements at once.
+	 */
+	template <typename T>
+	inline void writeVectorImpl(const std::vector<T>& value, boost::mpl::true_ /*bulk_copy*/)
+	{
+		if(!value.empty())
+			writeArrayOrdered(&value[0], value.size());
+	}
+
+	/**
+	 * @brief The vector element is not bulk copyable, write the element one by one.
+	 */
+	template <typename T>
+	inline void writeVectorImpl(const std::vector<T>& value, boost::mpl::false_ /*bulk_copy*/)
+	{
+		for(typename std::vector<T>::const_iterator i = value.begin(); i != value.end(); ++i)
+		{
+			write(*i);
+		}
+	}
+
+	/**
+	 * @brief Write a std::list<T> object.
 	 *
 	 * @param value The std::list<T> variable to be written.
 	 */
@@ -2168,7 +3125,7 @@ public:
 		uint32 length = value.size();
 		if(LIKELY(length <= MAX_VECTOR_LENGTH))
 		{
-			writeDirect(length);
+			writeLength(length);
 			for(typename std::list<T>::const_iterator i = value.begin(); i != value.end(); ++i)
 			{
 				write(*i);
@@ -2191,7 +3148,7 @@ public:
 		uint32 length = value.size();
 		if(LIKELY(length <= MAX_VECTOR_LENGTH))
 		{
-			writeDirect(length);
+			writeLength(length);
 			for(typename std::map<K,V>::const_iterator i = value.begin(); i != value.end(); ++i)
 			{
 				write(i->first);
@@ -2227,7 +3184,7 @@ public:
 		if(LIKELY(N * sizeof(T) <= MAX_ARRAY_LENGTH))
 		{
 			uint32 length = N * sizeof(T);
-			writeDirect(length);
+			writeLength(length);
 			writeBoostArrayImpl(value, boost::mpl::bool_< is_direct_types<T>::value >());
 		}
 		else
@@ -2272,15 +3229,15 @@ public:
 	 *
 	 * @param value Another BufferBase object to be written.
 	 */
-	template<BufferMode::type M, BufferConcurrency::type C>
-	inline void writeBuiltin(const BufferBase<M,C>& value)
+	template<BufferMode::type M, BufferConcurrency::type C, BufferEncoding::type E, BufferChecksum::type K>
+	inline void writeBuiltin(const BufferBase<M,C,E,K>& value)
 	{
 		uint32 length = value.dataSize();
-		writeDirect(length);
+		writeLength(length);
 
 		BOOST_ASSERT(value.dataSize() >= length);
 
-		BufferBase<M,C>* non_const_value = const_cast<BufferBase<M,C>*>(&value);
+		BufferBase<M,C,E,K>* non_const_value = const_cast<BufferBase<M,C,E,K>*>(&value);
 		append(*non_const_value, length);
 	}
 
@@ -2292,7 +3249,7 @@ public:
 	template <typename T, std::size_t N>
 	inline void writeBoostArrayImpl(const boost::array<T, N>& value, boost::mpl::true_ /*native_copy*/)
 	{
-		writeArray((const char*)value.data(), N * sizeof(T));
+		writeArrayOrdered(value.data(), N);
 	}
 
 	/**
@@ -2309,6 +3266,129 @@ public:
 		}
 	}
 
+	/**
+	 * @brief Write a length field (of strings, containers, etc.) according to the buffer encoding.
+	 *
+	 * @param length The length to be written.
+	 */
+	inline void writeLength(uint32 length)
+	{
+		if(Encoding == BufferEncoding::fixed || Encoding == BufferEncoding::network)
+			writeOrdered(length);
+		else
+			writeVarint(length);
+	}
+
+	/**
+	 * @brief Write an integer according to the buffer encoding.
+	 *
+	 * @param value The integer to be written.
+	 */
+	template <typename T>
+	inline void writeInteger(const T& value)
+	{
+		if(is_varint_types<T>::value)
+			writeVarint(encodeZigZag(value, boost::mpl::bool_< boost::is_signed<T>::value >()));
+		else
+			writeOrdered(value);
+	}
+
+	/**
+	 * @brief Write a fixed-size value in the byte order of the buffer encoding.
+	 *
+	 * @param value The value to be written.
+	 */
+	template <typename T>
+	inline void writeOrdered(const T& value)
+	{
+		if(swap_byte_order)
+			writeDirect(byte_swap(value));
+		else
+			writeDirect(value);
+	}
+
+	/**
+	 * @brief Write an array of values in the byte order of the buffer encoding.
+	 *
+	 * Elements other than integers and floating point values are written as they are.
+	 *
+	 * @param items The array to be written.
+	 * @param n The number of elements.
+	 */
+	template <typename T>
+	inline void writeArrayOrdered(const T* items, std::size_t n)
+	{
+		writeArraySwap(items, n, boost::mpl::bool_< swap_byte_order && boost::is_arithmetic<T>::value && (sizeof(T) > 1) >());
+	}
+
+	template <typename T>
+	inline void writeArraySwap(const T* items, std::size_t n, boost::mpl::true_ /*swap*/)
+	{
+		// convert through a small chunk which stays in cache, as the buffer space may not be contiguous
+		T chunk[SWAP_CHUNK_SIZE / sizeof(T)];
+		while(n > 0)
+		{
+			std::size_t count = std::min(n, sizeof(chunk) / sizeof(T));
+			byte_swap_array(chunk, items, count);
+			writeArray((const char*)chunk, count * sizeof(T));
+			items += count;
+			n -= count;
+		}
+	}
+
+	template <typename T>
+	inline void writeArraySwap(const T* items, std::size_t n, boost::mpl::false_ /*swap*/)
+	{
+		writeArray((const char*)items, n * sizeof(T));
+	}
+
+	/**
+	 * @brief Write an unsigned integer in LEB128 encoding.
+	 *
+	 * @param value The integer to be written.
+	 */
+	inline void writeVarint(uint64 value)
+	{
+		if(LIKELY(value < 0x80))
+		{
+			uint8 b = (uint8)value;
+			writeDirect(b);
+			return;
+		}
+
+		char encoded[10]; std::size_t size = 0;
+		while(value >= 0x80)
+		{
+			encoded[size++] = (char)((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		encoded[size++] = (char)value;
+		writeArray(encoded, size);
+	}
+
+	template <typename T>
+	inline static uint64 encodeZigZag(const T& value, boost::mpl::true_ /*is_signed*/)
+	{
+		int64 x = (int64)value;
+		return ((uint64)x << 1) ^ (uint64)(x >> 63);
+	}
+
+	template <typename T>
+	inline static uint64 encodeZigZag(const T& value, boost::mpl::false_ /*is_signed*/)
+	{
+		return (uint64)value;
+	}
+
+	inline static int64 decodeZigZag(uint64 value, boost::mpl::true_ /*is_signed*/)
+	{
+		return (int64)(value >> 1) ^ -(int64)(value & 1);
+	}
+
+	inline static uint64 decodeZigZag(uint64 value, boost::mpl::false_ /*is_signed*/)
+	{
+		return value;
+	}
+
 	/**
 	 * @brief Write an arbitrary type of object.
 	 *
@@ -2319,7 +3399,11 @@ public:
 	{
 		BOOST_ASSERT(!mReadOnly);
 
-		if(Mode == BufferMode::plain)
+		if(multi_producer)
+		{
+			writeConcurrent((const char*)&t, sizeof(T), boost::mpl::bool_<multi_producer>());
+		}
+		else if(Mode == BufferMode::plain)
 		{
 			std::size_t current_wpos = wpos();
 
@@ -2330,7 +3414,7 @@ public:
 			else if(mAllocatedSize < wpos() + sizeof(T))
 			{
 				std::size_t s = current_wpos + sizeof(T);
-				resize(round_up_to_nearest_power_of_two<uint64>::apply(s));
+				grow(s);
 			}
 
 			setDirect(t, wpos());
@@ -2347,7 +3431,7 @@ public:
 			else if(mAllocatedSize < current_size + sizeof(T) + 1)
 			{
 				std::size_t s = current_size + sizeof(T);
-				resize(round_up_to_nearest_power_of_two<uint64>::apply(s) + 1);
+				grow(s);
 			}
 
 			setDirect(t, wpos());
@@ -2365,7 +3449,11 @@ public:
 	{
 		BOOST_ASSERT(!mReadOnly);
 
-		if(Mode == BufferMode::plain)
+		if(multi_producer)
+		{
+			writeConcurrent(source, size, boost::mpl::bool_<multi_producer>());
+		}
+		else if(Mode == BufferMode::plain)
 		{
 			std::size_t current_wpos = wpos();
 
@@ -2376,7 +3464,7 @@ public:
 			else if(mAllocatedSize < current_wpos + size)
 			{
 				std::size_t s = current_wpos + size;
-				resize(round_up_to_nearest_power_of_two<uint64>::apply(s));
+				grow(s);
 			}
 
 			setArray(source, current_wpos, size);
@@ -2393,7 +3481,7 @@ public:
 			else if(mAllocatedSize < current_size + size + 1)
 			{
 				std::size_t s = current_size + size;
-				resize(round_up_to_nearest_power_of_two<uint64>::apply(s) + 1);
+				grow(s);
 			}
 
 			setArray(source, wpos(), size);
@@ -2419,7 +3507,7 @@ public:
 		else
 		{
 			// if we just cross the boundary
-			if(position + sizeof(T) > mAllocatedSize)
+			if(!isContiguous(position, sizeof(T)))
 			{
 				std::size_t size_to_end = mAllocatedSize - position;
 				::memcpy(((byte*)&t), mData + position, size_to_end);
@@ -2448,20 +3536,20 @@ public:
 		if(Mode == BufferMode::plain)
 		{
 			if(UNLIKELY(size == 0)) return;
-			::memcpy(dest, mData + position, size);
+			memory_copy(dest, mData + position, size);
 		}
 		else
 		{
 			// if we just cross the boundary
-			if(position + size > mAllocatedSize)
+			if(!isContiguous(position, size))
 			{
 				std::size_t size_to_end = mAllocatedSize - position;
-				::memcpy(dest, mData + position, size_to_end);
-				::memcpy(dest + size_to_end, mData, size - size_to_end);
+				memory_copy(dest, mData + position, size_to_end);
+				memory_copy(dest + size_to_end, mData, size - size_to_end);
 			}
 			else
 			{
-				::memcpy(dest, mData + position, size);
+				memory_copy(dest, mData + position, size);
 			}
 		}
 	}
@@ -2484,7 +3572,7 @@ public:
 		else
 		{
 			// if we just cross the boundary
-			if(position + sizeof(T) > mAllocatedSize)
+			if(!isContiguous(position, sizeof(T)))
 			{
 				// TODO use for-loop instead of memcpy
 				std::size_t size_to_end = mAllocatedSize - position;
@@ -2509,29 +3597,125 @@ public:
 	 */
 	inline void setArray(const char* source, std::size_t position, std::size_t size)
 	{
-		BOOST_ASSERT(size <= freeSize());
+		BOOST_ASSERT(multi_producer || size <= freeSize());	// for multi-producer buffer the space is reserved before hand
 
 		if(Mode == BufferMode::plain)
 		{
 			if(UNLIKELY(size == 0)) return;
-			::memcpy(mData + position, source, size);
+			memory_copy(mData + position, source, size);
 		}
 		else
 		{
 			// if we just cross the boundary
-			if(position + size > mAllocatedSize)
+			if(!isContiguous(position, size))
 			{
 				std::size_t size_to_end = mAllocatedSize - position;
-				::memcpy(mData + position, source, size_to_end);
-				::memcpy(mData, source + size_to_end, size - size_to_end);
+				memory_copy(mData + position, source, size_to_end);
+				memory_copy(mData, source + size_to_end, size - size_to_end);
 			}
 			else
 			{
-				::memcpy(mData + position, source, size);
+				memory_copy(mData + position, source, size);
 			}
 		}
 	}
 
+public:
+	/**
+	 * @brief Probe the total serialized size of an array of objects.
+	 *
+	 * @param items The pointer to the array.
+	 * @param n The number of objects in the array.
+	 * @return The total size needed by writeBatch().
+	 */
+	template <typename T>
+	inline static std::size_t probeBatchSize(const T* items, std::size_t n)
+	{
+		return probeBatchSizeDispatch(items, n, boost::mpl::bool_< is_bulk_copyable_types<T>::value >());
+	}
+
+	/**
+	 * @brief Write an array of objects of the same type.
+	 *
+	 * The total size is probed once and the buffer is grown at most once, then the objects
+	 * are written in a tight loop, or copied at once if the type can be copied in bulk.
+	 *
+	 * @note The number of objects is not written, so the reader must know it before hand.
+	 *
+	 * @param items The pointer to the array.
+	 * @param n The number of objects in the array.
+	 */
+	template <typename T>
+	inline void writeBatch(const T* items, std::size_t n)
+	{
+		writeBatchDispatch(items, n, boost::mpl::bool_< is_bulk_copyable_types<T>::value >());
+	}
+
+	/**
+	 * @brief Read an array of objects of the same type written by writeBatch().
+	 *
+	 * @param items The pointer to the array.
+	 * @param n The number of objects to read.
+	 */
+	template <typename T>
+	inline void readBatch(T* items, std::size_t n)
+	{
+		readBatchDispatch(items, n, boost::mpl::bool_< is_bulk_copyable_types<T>::value >());
+	}
+
+private:
+	template <typename T>
+	inline static std::size_t probeBatchSizeDispatch(const T* items, std::size_t n, boost::mpl::true_ /*bulk_copy*/)
+	{
+		UNUSED_ARGUMENT(items);
+		return sizeof(T) * n;
+	}
+
+	template <typename T>
+	inline static std::size_t probeBatchSizeDispatch(const T* items, std::size_t n, boost::mpl::false_ /*bulk_copy*/)
+	{
+		std::size_t size = 0;
+		for(std::size_t i = 0; i < n; ++i)
+			size += probeSize(items[i]);
+		return size;
+	}
+
+	template <typename T>
+	inline void writeBatchDispatch(const T* items, std::size_t n, boost::mpl::true_ /*bulk_copy*/)
+	{
+		writeArrayOrdered(items, n);
+	}
+
+	template <typename T>
+	inline void writeBatchDispatch(const T* items, std::size_t n, boost::mpl::false_ /*bulk_copy*/)
+	{
+		if(multi_producer)
+		{
+			// every object has to go through its own reservation
+			for(std::size_t i = 0; i < n; ++i)
+				*this << items[i];
+			return;
+		}
+
+		if(mOnDemand) reserve(probeBatchSize(items, n));
+
+		for(std::size_t i = 0; i < n; ++i)
+			write(items[i]);
+	}
+
+	template <typename T>
+	inline void readBatchDispatch(T* items, std::size_t n, boost::mpl::true_ /*bulk_copy*/)
+	{
+		readArrayOrdered(items, n);
+	}
+
+	template <typename T>
+	inline void readBatchDispatch(T* items, std::size_t n, boost::mpl::false_ /*bulk_copy*/)
+	{
+		for(std::size_t i = 0; i < n; ++i)
+			*this >> items[i];
+	}
+
 public:
 	/**
 	 * @brief Append another buffer object.
@@ -2554,8 +3738,8 @@ public:
 	 * @param source The buffer object to be read.
 	 * @param size The specific data size to append.
 	 */
-	template<BufferMode::type M, BufferConcurrency::type C>
-	inline void append(BufferBase<M, C> &source, std::size_t size)
+	template<BufferMode::type M, BufferConcurrency::type C, BufferEncoding::type E, BufferChecksum::type K>
+	inline void append(BufferBase<M,C,E,K> &source, std::size_t size)
 	{
 		BOOST_ASSERT(size <= source.dataSize());
 		writeArray(source.rptr(), size);
@@ -2572,15 +3756,373 @@ public:
 			crunch();
 		}
 
-		if(mData)
+#ifdef ZILLIANS_BUFFER_STATISTICS
+		atomic::inc(getBufferStat().Reallocations, std::memory_order_relaxed);
+		atomic::add(getBufferStat().ReallocatedBytes, size, std::memory_order_relaxed);
+#endif
+
+		mData = mAllocator->reallocate(mData, mAllocatedSize, size);
+		mAllocatedSize = size;
+	}
+
+	/**
+	 * @brief Make sure the given size of data can be written without reallocation.
+	 *
+	 * Unlike the automatic growth on write, the buffer is grown to exactly what is needed.
+	 *
+	 * @note Only on-demand buffer can be grown.
+	 *
+	 * @param size The size of data to be written.
+	 */
+	inline void reserve(std::size_t size)
+	{
+		BOOST_ASSERT(mOnDemand);
+
+		std::size_t required = (Mode == BufferMode::plain) ? wpos() + size : dataSize() + size + 1;
+		if(mAllocatedSize < required)
+			resize(required);
+	}
+
+	/**
+	 * @brief Give the unused memory of an on-demand buffer back to its allocator.
+	 *
+	 * The data is moved to the beginning of the buffer, and the buffer is shrunk to the data size
+	 * (or released entirely if there's no data). This is typically called before parking a
+	 * long-lived buffer which grew for one big message.
+	 *
+	 * @note Marked positions are reset.
+	 */
+	inline void shrinkToFit()
+	{
+		BOOST_ASSERT(mOwner && mOnDemand);
+
+		if(!mData) return;
+
+		crunch();
+		mReadPosMarked = mWritePosMarked = 0;
+
+		std::size_t size = dataSize();
+		if(size == 0)
 		{
-			mData = (byte*)realloc((void*)mData, size);
+			mAllocator->deallocate(mData); mData = NULL;
+			mAllocatedSize = 0;
+			clear();
 		}
 		else
 		{
-			mData = (byte*)malloc(size);
+			std::size_t required = (Mode == BufferMode::plain) ? size : size + 1;
+			if(required < mAllocatedSize)
+			{
+				mData = mAllocator->reallocate(mData, mAllocatedSize, required);
+				mAllocatedSize = required;
+			}
+		}
+
+#ifdef ZILLIANS_BUFFER_STATISTICS
+		atomic::inc(getBufferStat().Shrinks, std::memory_order_relaxed);
+#endif
+	}
+
+	/**
+	 * @brief Set the growth factor of on-demand buffer, which is applied to the current size
+	 * when a write doesn't fit (default is 2).
+	 */
+	inline void setGrowthFactor(float factor)
+	{
+		BOOST_ASSERT(factor > 1.0f);
+		mGrowthFactor = factor;
+	}
+
+	inline float getGrowthFactor() const
+	{
+		return mGrowthFactor;
+	}
+
+private:
+	/**
+	 * @brief Fold the given range of data into the checksum, the range may wrap around the end of a circular buffer.
+	 */
+	inline uint32 foldChecksum(uint32 checksum, std::size_t position, std::size_t size) const
+	{
+		if(Mode == BufferMode::circular && position + size > mAllocatedSize)
+		{
+			std::size_t size_to_end = mAllocatedSize - position;
+			checksum = crc32c(checksum, mData + position, size_to_end);
+			return crc32c(checksum, mData, size - size_to_end);
+		}
+		return crc32c(checksum, mData + position, size);
+	}
+
+	/**
+	 * @brief Grow the on-demand buffer geometrically to hold at least the given size of data.
+	 */
+	inline void grow(std::size_t size)
+	{
+		std::size_t capacity = (Mode == BufferMode::plain || mAllocatedSize == 0) ? mAllocatedSize : mAllocatedSize - 1;
+		std::size_t grown = (std::size_t)(capacity * mGrowthFactor);
+		std::size_t required = round_up_to_nearest_power_of_two<uint64>::apply(size);
+
+		std::size_t new_capacity = std::max(required, grown);
+		resize((Mode == BufferMode::plain) ? new_capacity : new_capacity + 1);
+	}
+
+public:
+
+public:
+	/**
+	 * @brief Reserve space of given size for writing on a multi-producer buffer.
+	 *
+	 * The reserved space starts from the returned position and is exclusively owned by
+	 * the caller, who must fill it (by setArray() or setDirect() at the physical position,
+	 * i.e. position % mAllocatedSize) and then call commitWrite() with the same position and size.
+	 *
+	 * @note Reservations must be committed in time, or the following producers will be blocked.
+	 *
+	 * @param size The size to reserve.
+	 * @return The logical position of the reserved space.
+	 */
+	inline std::size_t reserveWrite(std::size_t size)
+	{
+		BOOST_ASSERT(multi_producer);
+		BOOST_ASSERT(!mReadOnly && !mOnDemand);
+
+		std::size_t position = mWriteReservePos.load(std::memory_order_relaxed);
+		do
+		{
+			std::size_t current_rpos = mReadPos;
+			if(size > allocatedSize() - (position - current_rpos))
+				throw std::length_error("out of free buffer");
+		}
+		while(!mWriteReservePos.compare_exchange(position, position + size));
+
+		return position;
+	}
+
+	/**
+	 * @brief Publish the reserved space to consumers.
+	 *
+	 * @note Commits are made in reservation order, so this waits for all previous reservations to be committed.
+	 *
+	 * @param position The logical position returned by reserveWrite().
+	 * @param size The size given to reserveWrite().
+	 */
+	inline void commitWrite(std::size_t position, std::size_t size)
+	{
+		waitPosition(mWritePos, position);
+		mWritePos.store(position + size, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Reserve data of given size for reading on a multi-consumer buffer.
+	 *
+	 * @param size The size to reserve.
+	 * @return The logical position of the reserved data.
+	 */
+	inline std::size_t reserveRead(std::size_t size)
+	{
+		BOOST_ASSERT(multi_consumer);
+
+		std::size_t position = mReadReservePos.load(std::memory_order_relaxed);
+		do
+		{
+			std::size_t current_wpos = mWritePos;
+			if(size > current_wpos - position)
+				throw std::length_error("out of data buffer");
+		}
+		while(!mReadReservePos.compare_exchange(position, position + size));
+
+		return position;
+	}
+
+	/**
+	 * @brief Release the reserved data so that the space can be reused by producers.
+	 *
+	 * @note Commits are made in reservation order, so this waits for all previous reservations to be committed.
+	 *
+	 * @param position The logical position returned by reserveRead().
+	 * @param size The size given to reserveRead().
+	 */
+	inline void commitRead(std::size_t position, std::size_t size)
+	{
+		waitPosition(mReadPos, position);
+		mReadPos.store(position + size, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Write an arbitrary variable into a multi-producer buffer as a whole.
+	 *
+	 * The value is serialized into a single reservation, so values written by
+	 * different producers are never interleaved. This is what operator<< does
+	 * for mpsc and mpmc buffer.
+	 *
+	 * @param value The value to be written.
+	 */
+	template <typename T>
+	inline void writeAtomic(const T& value)
+	{
+		typedef BufferBase<BufferMode::plain, BufferConcurrency::none, Encoding> view_type;
+
+		std::size_t size = probeSize(value);
+		std::size_t total = multi_consumer ? size + sizeof(uint32) : size;
+
+		// serialize before reserving, so a throwing value never leaves behind an uncommitted
+		// reservation, which would block all the following producers in commitWrite()
+		byte local[ZILLIANS_BUFFER_ATOMIC_STACK_SIZE];
+		byte* data = LIKELY(total <= sizeof(local)) ? local : getAtomicScratch(total);
+		{
+			view_type view(data, total);
+			if(multi_consumer) view.writeDirect((uint32)size);
+			view.write(value);
+			BOOST_ASSERT(view.dataSize() == total);
+		}
+
+		std::size_t position = reserveWrite(total);
+		setArray((const char*)data, position % mAllocatedSize, total);
+		commitWrite(position, total);
+	}
+
+	/**
+	 * @brief Read an arbitrary variable written by writeAtomic() from a concurrent buffer.
+	 *
+	 * For mpmc buffer the whole value is reserved before reading, so each value
+	 * is consumed by exactly one consumer. This is what operator>> does for mpmc buffer.
+	 *
+	 * @param value The value to be read.
+	 */
+	template <typename T>
+	inline void readAtomic(T& value)
+	{
+		readAtomicDispatch(value, boost::mpl::bool_<multi_consumer>());
+	}
+
+private:
+	template <typename T>
+	inline void readAtomicDispatch(T& value, boost::mpl::true_ /*multi_consumer*/)
+	{
+		typedef BufferBase<BufferMode::plain, BufferConcurrency::none, Encoding> view_type;
+
+		// the length prefix can be read without reservation because a value is always committed as a whole,
+		// and the reservation below fails if the prefix was consumed (and overwritten) during the way
+		std::size_t position = mReadReservePos.load(std::memory_order_relaxed);
+		uint32 size;
+		do
+		{
+			std::size_t current_wpos = mWritePos;
+			if(current_wpos - position < sizeof(uint32))
+				throw std::length_error("out of data buffer");
+
+			getDirect(size, position % mAllocatedSize);
+		}
+		while(!mReadReservePos.compare_exchange(position, position + sizeof(uint32) + size));
+
+		// the value is consumed even if reading it throws, otherwise the uncommitted reservation
+		// would block all the following consumers in commitRead()
+		ReadCommitGuard guard(*this, position, sizeof(uint32) + size);
+
+		std::size_t offset = (position + sizeof(uint32)) % mAllocatedSize;
+		if(LIKELY(isContiguous(offset, size)))
+		{
+			view_type view((const byte*)(mData + offset), size);
+			view.wpos(size);
+			view.read(value);
+		}
+		else
+		{
+			byte local[ZILLIANS_BUFFER_ATOMIC_STACK_SIZE];
+			byte* data = LIKELY(size <= sizeof(local)) ? local : getAtomicScratch(size);
+			getArray((char*)data, offset, size);
+			view_type view((const byte*)data, size);
+			view.wpos(size);
+			view.read(value);
+		}
+	}
+
+	struct ReadCommitGuard
+	{
+		ReadCommitGuard(BufferBase& buffer, std::size_t position, std::size_t size) : mBuffer(buffer), mPosition(position), mSize(size)
+		{ }
+
+		~ReadCommitGuard()
+		{
+			mBuffer.commitRead(mPosition, mSize);
+		}
+
+		BufferBase& mBuffer;
+		std::size_t mPosition;
+		std::size_t mSize;
+	};
+
+	/**
+	 * @brief Get the per-thread scratch space used by writeAtomic() and readAtomic() for large values.
+	 *
+	 * @param size The minimal size of the scratch space.
+	 * @return The scratch space, which is valid until the next call from the same thread.
+	 */
+	static byte* getAtomicScratch(std::size_t size)
+	{
+		static boost::thread_specific_ptr< std::vector<byte> > scratch;
+		if(UNLIKELY(!scratch.get())) scratch.reset(new std::vector<byte>());
+		if(scratch->size() < size) scratch->resize(size);
+		return &(*scratch)[0];
+	}
+
+	template <typename T>
+	inline void readAtomicDispatch(T& value, boost::mpl::false_ /*multi_consumer*/)
+	{
+		read(value);
+	}
+
+	inline void writeConcurrent(const char* source, std::size_t size, boost::mpl::true_ /*multi_producer*/)
+	{
+		std::size_t position = reserveWrite(size);
+		if(source) setArray(source, position % mAllocatedSize, size);
+		commitWrite(position, size);
+	}
+
+	inline void writeConcurrent(const char* source, std::size_t size, boost::mpl::false_ /*multi_producer*/)
+	{
+		UNUSED_ARGUMENT(source); UNUSED_ARGUMENT(size);
+		BOOST_ASSERT(false);
+	}
+
+	inline void readConcurrent(char* dest, std::size_t size, boost::mpl::true_ /*multi_consumer*/)
+	{
+		std::size_t position = reserveRead(size);
+		if(dest) getArray(dest, position % mAllocatedSize, size);
+		commitRead(position, size);
+	}
+
+	inline void readConcurrent(char* dest, std::size_t size, boost::mpl::false_ /*multi_consumer*/)
+	{
+		UNUSED_ARGUMENT(dest); UNUSED_ARGUMENT(size);
+		BOOST_ASSERT(false);
+	}
+
+	/**
+	 * @brief Check if the given range of a circular buffer can be accessed as a single memory range.
+	 */
+	inline bool isContiguous(std::size_t position, std::size_t size) const
+	{
+		return mMirrored || position + size <= mAllocatedSize;
+	}
+
+	inline static std::size_t round_up_to_granularity(std::size_t size, std::size_t granularity)
+	{
+		return (size + granularity - 1) / granularity * granularity;
+	}
+
+	/**
+	 * @brief Wait until the given position reaches the given value, which is committed by another thread.
+	 */
+	inline static void waitPosition(const position_t& p, std::size_t value)
+	{
+		for(int spin = 0; p.load(std::memory_order_acquire) != value; )
+		{
+			if(spin < 64)
+				++spin;
+			else
+				boost::this_thread::yield();
 		}
-		mAllocatedSize = size;
 	}
 
 public:
@@ -2608,7 +4150,7 @@ public:
 	template <typename T>
 	inline BufferBase& operator<< (const T& value)
 	{
-		write(value);
+		putDispatch(value, boost::mpl::bool_<multi_producer>());
 		return *this;
 	}
 
@@ -2624,10 +4166,35 @@ public:
 	template <typename T>
 	inline BufferBase& operator>> (T& value)
 	{
-		read(value);
+		getDispatch(value, boost::mpl::bool_<multi_consumer>());
 		return *this;
 	}
 
+private:
+	template <typename T>
+	inline void putDispatch(const T& value, boost::mpl::true_ /*multi_producer*/)
+	{
+		writeAtomic(value);
+	}
+
+	template <typename T>
+	inline void putDispatch(const T& value, boost::mpl::false_ /*multi_producer*/)
+	{
+		write(value);
+	}
+
+	template <typename T>
+	inline void getDispatch(T& value, boost::mpl::true_ /*multi_consumer*/)
+	{
+		readAtomic(value);
+	}
+
+	template <typename T>
+	inline void getDispatch(T& value, boost::mpl::false_ /*multi_consumer*/)
+	{
+		read(value);
+	}
+
 public:
 	/**
 	 * @brief Get the context object associated with the BufferBase object.
@@ -2663,140 +4230,346 @@ public:
 
 private:
 	const static std::size_t DEFAULT_SIZE = 0x1000; // default size is 4Kb
+	static const float DEFAULT_GROWTH_FACTOR;
 	const static std::size_t MAX_STRING_LENGTH = 8192;
 	const static std::size_t MAX_VECTOR_LENGTH = 65536;
 	const static std::size_t MAX_LIST_LENGTH = 65536;
 	const static std::size_t MAX_ARRAY_LENGTH = 65536;
+	const static std::size_t SWAP_CHUNK_SIZE = 512;	///< Bytes converted at once by writeArrayOrdered()
 
 	bool mOwner;
 	bool mReadOnly;
 	bool mOnDemand;
+	bool mMirrored;
+
+	BufferAllocator* mAllocator;
+	float mGrowthFactor;
 
 	position_t mReadPos;
 	position_t mWritePos;
+	position_t mReadReservePos;	// only used by multi-consumer buffer
+	position_t mWriteReservePos;	// only used by multi-producer buffer
 	position_t mReadPosMarked;
 	position_t mWritePosMarked;
 
+	struct ChecksumState
+	{
+		ChecksumState() : write(0), read(0) { }
+		uint32 write;	///< Checksum of bytes passed the write pointer
+		uint32 read;	///< Checksum of bytes passed the read pointer
+	};
+	ChecksumState mChecksum;
+
 	BufferContext mContext;
 };
 
-template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferObjectPoolStrategy::type ObjectPoolStrategy>
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+const float BufferBase<Mode,Concurrency,Encoding,Checksum>::DEFAULT_GROWTH_FACTOR = 2.0f;
+
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferObjectPoolStrategy::type ObjectPoolStrategy, BufferEncoding::type Encoding = BufferEncoding::fixed, BufferChecksum::type Checksum = BufferChecksum::none>
 class BufferT;
 
-template<BufferMode::type Mode,BufferConcurrency::type Concurrency>
-class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::none> : public BufferBase<Mode,Concurrency>
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::none, Encoding, Checksum> : public BufferBase<Mode,Concurrency,Encoding,Checksum>
 {
 public:
-	BufferT() : BufferBase<Mode,Concurrency>()
+	BufferT() : BufferBase<Mode,Concurrency,Encoding,Checksum>()
+	{
+	}
+
+	BufferT(std::size_t size, BufferAllocator* allocator = NULL) : BufferBase<Mode,Concurrency,Encoding,Checksum>(size, allocator)
 	{
 	}
 
-	BufferT(std::size_t size) : BufferBase<Mode,Concurrency>(size)
+	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(BufferAllocator* allocator, byte* data, std::size_t size, bool read_only) : BufferBase<Mode,Concurrency,Encoding,Checksum>(allocator, data, size, read_only)
 	{
 	}
 
-	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency>(buffer)
+	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(buffer)
 	{
 	}
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
-	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency>(std::move(buffer))
+	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(std::move(buffer))
 	{ }
 
 	BufferT& operator=(BufferT&& x)   // rvalues bind here
 	{
-		BufferBase<Mode,Concurrency>::operator=(std::move(x));
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(std::move(x));
+		return *this;
 	}
 #endif
+
+	BufferT& operator=(const BufferT& x)
+	{
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(x);
+		return *this;
+	}
 };
 
-template<BufferMode::type Mode, BufferConcurrency::type Concurrency>
-class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::concurrently_pooled> : public BufferBase<Mode,Concurrency>, public ConcurrentObjectPool< BufferT<Mode, Concurrency, BufferObjectPoolStrategy::concurrently_pooled> >
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::concurrently_pooled, Encoding, Checksum> : public BufferBase<Mode,Concurrency,Encoding,Checksum>, public ConcurrentObjectPool< BufferT<Mode, Concurrency, BufferObjectPoolStrategy::concurrently_pooled, Encoding, Checksum> >
 {
 public:
-	BufferT() : BufferBase<Mode,Concurrency>()
+	BufferT() : BufferBase<Mode,Concurrency,Encoding,Checksum>()
 	{
 	}
 
-	BufferT(std::size_t size) : BufferBase<Mode,Concurrency>(size)
+	BufferT(std::size_t size, BufferAllocator* allocator = NULL) : BufferBase<Mode,Concurrency,Encoding,Checksum>(size, allocator)
 	{
 	}
 
-	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency>(buffer)
+	BufferT(BufferAllocator* allocator, byte* data, std::size_t size, bool read_only) : BufferBase<Mode,Concurrency,Encoding,Checksum>(allocator, data, size, read_only)
+	{
+	}
+
+	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(buffer)
 	{
 	}
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
-	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency>(std::move(buffer))
+	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(std::move(buffer))
 	{ }
 
 	BufferT& operator=(BufferT&& x)   // rvalues bind here
 	{
-		BufferBase<Mode,Concurrency>::operator=(std::move(x));
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(std::move(x));
+		return *this;
 	}
 #endif
 
+	BufferT& operator=(const BufferT& x)
+	{
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(x);
+		return *this;
+	}
+
 	void setMutable()
 	{
 		// NOTE: fix-me! -- i am broken because someone forgot to check-in code
 	}
 };
 
-template<BufferMode::type Mode, BufferConcurrency::type Concurrency>
-class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::pooled> : public BufferBase<Mode,Concurrency>, public ObjectPool< BufferT<Mode, Concurrency, BufferObjectPoolStrategy::pooled> >
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+class BufferT<Mode, Concurrency, BufferObjectPoolStrategy::pooled, Encoding, Checksum> : public BufferBase<Mode,Concurrency,Encoding,Checksum>, public ObjectPool< BufferT<Mode, Concurrency, BufferObjectPoolStrategy::pooled, Encoding, Checksum> >
 {
 public:
-	BufferT() : BufferBase<Mode,Concurrency>()
+	BufferT() : BufferBase<Mode,Concurrency,Encoding,Checksum>()
 	{
 	}
 
-	BufferT(std::size_t size) : BufferBase<Mode,Concurrency>(size)
+	BufferT(std::size_t size, BufferAllocator* allocator = NULL) : BufferBase<Mode,Concurrency,Encoding,Checksum>(size, allocator)
 	{
 	}
 
-	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency>(data, size)
+	BufferT(const byte* data, std::size_t size) : BufferBase<Mode,Concurrency,Encoding,Checksum>(data, size)
 	{
 	}
 
-	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency>(buffer)
+	BufferT(BufferAllocator* allocator, byte* data, std::size_t size, bool read_only) : BufferBase<Mode,Concurrency,Encoding,Checksum>(allocator, data, size, read_only)
+	{
+	}
+
+	BufferT(const BufferT& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(buffer)
 	{
 	}
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
-	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency>(std::move(buffer))
+	BufferT(BufferT&& buffer) : BufferBase<Mode,Concurrency,Encoding,Checksum>(std::move(buffer))
 	{ }
 
 	BufferT& operator=(BufferT&& x)   // rvalues bind here
 	{
-		BufferBase<Mode,Concurrency>::operator=(std::move(x));
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(std::move(x));
+		return *this;
 	}
 #endif
+
+	BufferT& operator=(const BufferT& x)
+	{
+		BufferBase<Mode,Concurrency,Encoding,Checksum>::operator=(x);
+		return *this;
+	}
 };
 
 typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled> Buffer;
 typedef BufferT<BufferMode::circular, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled> CircularBuffer;
 typedef BufferT<BufferMode::plain, BufferConcurrency::spsc, BufferObjectPoolStrategy::concurrently_pooled> SpscBuffer;
 typedef BufferT<BufferMode::circular, BufferConcurrency::spsc, BufferObjectPoolStrategy::concurrently_pooled> SpscCircularBuffer;
+typedef BufferT<BufferMode::circular, BufferConcurrency::mpsc, BufferObjectPoolStrategy::concurrently_pooled> MpscCircularBuffer;
+typedef BufferT<BufferMode::circular, BufferConcurrency::mpmc, BufferObjectPoolStrategy::concurrently_pooled> MpmcCircularBuffer;
+typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::varint> VarintBuffer;
+typedef BufferT<BufferMode::circular, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::varint> VarintCircularBuffer;
+typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::network> NetworkBuffer;
+typedef BufferT<BufferMode::circular, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::network> NetworkCircularBuffer;
+typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::fixed, BufferChecksum::crc32c> CheckedBuffer;
+typedef BufferT<BufferMode::circular, BufferConcurrency::none, BufferObjectPoolStrategy::concurrently_pooled, BufferEncoding::fixed, BufferChecksum::crc32c> CheckedCircularBuffer;
+
+/**
+ * @brief Buffer with an embedded non-atomic reference count, for buffers held by intrusive_ptr on a single thread.
+ */
+typedef ref_counted<Buffer> RefCountedBuffer;
+
+/**
+ * @brief BufferRef is a lightweight reference-counted view over a window of a shared Buffer.
+ *
+ * The view keeps the shared Buffer alive and has its own read and write cursors, so a parsed
+ * frame can hand sub-messages (or the same payload) to different threads without cloning the
+ * data. Copying a BufferRef only copies the shared pointer and the cursors.
+ *
+ * @li ShadowRead - the view has a private read cursor and supports operator>>.
+ * @li ShadowWrite - the view has a private write cursor and supports operator<<, which writes in place into the window.
+ *
+ * Offsets are absolute positions in the shared Buffer (the same as Buffer::rpos()).
+ *
+ * @note The shared Buffer must not be resized while any view is alive, and writing into one
+ * window concurrently with reading from an overlapped window is not synchronized.
+ */
+template<bool ShadowRead, bool ShadowWrite>
+class BufferRef
+{
+public:
+	typedef BufferBase<BufferMode::plain, BufferConcurrency::none> view_type;
+
+public:
+	BufferRef()
+	{ }
+
+	/**
+	 * @brief Construct a view over the current available data of the given buffer, i.e. [rpos(), wpos()).
+	 */
+	explicit BufferRef(const shared_ptr<Buffer>& buffer) :
+		mBuffer(buffer), mView(createView(*buffer, buffer->rpos(), buffer->dataSize()))
+	{ }
+
+	/**
+	 * @brief Construct a view over the window of given offset and length of the given buffer.
+	 */
+	BufferRef(const shared_ptr<Buffer>& buffer, std::size_t offset, std::size_t length) :
+		mBuffer(buffer), mView(createView(*buffer, offset, length))
+	{ }
+
+public:
+	/**
+	 * @brief Create a sub-view relative to the beginning of this view.
+	 *
+	 * The sub-view shares the same Buffer but has its own cursors.
+	 */
+	template<bool SubShadowRead, bool SubShadowWrite>
+	inline BufferRef<SubShadowRead, SubShadowWrite> slice(std::size_t offset, std::size_t length) const
+	{
+		BOOST_ASSERT(offset + length <= mView.allocatedSize());
+		return BufferRef<SubShadowRead, SubShadowWrite>(mBuffer, base() + offset, length);
+	}
+
+	inline BufferRef slice(std::size_t offset, std::size_t length) const
+	{
+		return slice<ShadowRead, ShadowWrite>(offset, length);
+	}
+
+	inline const shared_ptr<Buffer>& buffer() const { return mBuffer; }
+
+	/**
+	 * @brief Get the offset of the window in the shared Buffer.
+	 */
+	inline std::size_t base() const { return (std::size_t)(mView.baseptr() - mBuffer->baseptr()); }
+
+	/**
+	 * @brief Get the length of the window.
+	 */
+	inline std::size_t length() const { return mView.allocatedSize(); }
+
+	inline std::size_t dataSize() const { return mView.dataSize(); }
+	inline std::size_t freeSize() const { return mView.freeSize(); }
+
+	inline std::size_t rpos() const { return mView.rpos(); }
+	inline std::size_t wpos() const { return mView.wpos(); }
+
+	inline byte* rptr() const { return mView.rptr(); }
+	inline byte* wptr() const { return mView.wptr(); }
+
+	inline void rskip(std::size_t bytes)
+	{
+		BOOST_STATIC_ASSERT(ShadowRead);
+		BOOST_ASSERT(bytes <= mView.dataSize());
+		mView.rskip(bytes);
+	}
+
+	inline void wskip(std::size_t bytes)
+	{
+		BOOST_STATIC_ASSERT(ShadowWrite);
+		BOOST_ASSERT(bytes <= mView.freeSize());
+		mView.wskip(bytes);
+	}
+
+	/**
+	 * @brief Reset the cursors to the beginning of the window.
+	 */
+	inline void reset()
+	{
+		mView.rpos(0);
+		mView.wpos(ShadowWrite ? 0 : mView.allocatedSize());
+	}
+
+	template <typename T>
+	inline BufferRef& operator>> (T& value)
+	{
+		BOOST_STATIC_ASSERT(ShadowRead);
+		mView.read(value);
+		return *this;
+	}
+
+	template <typename T>
+	inline BufferRef& operator<< (const T& value)
+	{
+		BOOST_STATIC_ASSERT(ShadowWrite);
+		BOOST_ASSERT(view_type::probeSize(value) <= mView.freeSize());
+		mView.write(value);
+		return *this;
+	}
+
+private:
+	static view_type createView(Buffer& buffer, std::size_t offset, std::size_t length)
+	{
+		BOOST_ASSERT(offset + length <= buffer.allocatedSize());
+		if(ShadowWrite)
+		{
+			// the window starts empty for writing
+			return view_type(buffer.baseptr() + offset, length);
+		}
+		else
+		{
+			// read-only window over existing data
+			view_type view((const byte*)buffer.baseptr() + offset, length);
+			view.wpos(length);
+			return view;
+		}
+	}
+
+private:
+	shared_ptr<Buffer> mBuffer;
+	view_type mView;
+};
 
 inline std::ostream& operator << (std::ostream &stream, Buffer& b)
 {
@@ -0,0 +1,659 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BUFFERCHAIN_H_
+#define ZILLIANS_BUFFERCHAIN_H_
+
+#include "core/Buffer.h"
+
+#include <sys/uio.h>
+#include <stdexcept>
+
+namespace zillians {
+
+/**
+ * @brief BufferChainT is a scatter/gather view over a list of BufferBase segments.
+ *
+ * The chain does not own its segments, it only keeps references to them, so
+ * a message made of a header buffer and N payload buffers can be streamed or
+ * sent without flattening them into one contiguous buffer first. Reading and
+ * writing through the chain works just like BufferBase, and values crossing
+ * segment boundaries are handled transparently.
+ *
+ * @note The caller must make sure the segments outlive the chain.
+ */
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency>
+class BufferChainT
+{
+public:
+	typedef BufferBase<Mode, Concurrency> segment_type;
+
+	/**
+	 * @brief Helper class to identify whether a given type has fixed size
+	 * so that we know how many bytes to gather before decoding it.
+	 */
+	template <typename T>
+	struct is_fixed_size_types
+	{
+		enum { value =
+			boost::is_arithmetic<typename boost::remove_const<T>::type>::value ||
+			boost::is_same<typename boost::remove_const<T>::type, UUID>::value
+			};
+	};
+
+	/**
+	 * @brief The size returned by measure() for a value whose size can't be told without decoding it.
+	 */
+	enum { unknown_size = ~(std::size_t)0 };
+
+public:
+	BufferChainT() : mReadIndex(0), mWriteIndex(0)
+	{ }
+
+	~BufferChainT()
+	{ }
+
+public:
+	/**
+	 * @brief Append a segment to the end of the chain.
+	 *
+	 * @note The segment is held by reference and its data is never copied.
+	 *
+	 * @param segment The segment to be appended.
+	 */
+	inline void push_back(segment_type& segment)
+	{
+		mSegments.push_back(&segment);
+	}
+
+	/**
+	 * @brief Remove all segments from the chain.
+	 *
+	 * @note The segments themselves are not altered.
+	 */
+	inline void clear()
+	{
+		mSegments.clear();
+		mReadIndex = mWriteIndex = 0;
+	}
+
+	inline std::size_t segmentCount() const
+	{
+		return mSegments.size();
+	}
+
+	inline segment_type& segment(std::size_t index)
+	{
+		BOOST_ASSERT(index < mSegments.size());
+		return *mSegments[index];
+	}
+
+	/**
+	 * @brief Get the total data size over all segments.
+	 */
+	inline std::size_t dataSize() const
+	{
+		std::size_t size = 0;
+		for(std::size_t i = mReadIndex; i < mSegments.size(); ++i)
+			size += mSegments[i]->dataSize();
+		return size;
+	}
+
+	/**
+	 * @brief Get the total free size over all segments.
+	 *
+	 * @note On-demand segments can grow beyond this value.
+	 */
+	inline std::size_t freeSize() const
+	{
+		std::size_t size = 0;
+		for(std::size_t i = mWriteIndex; i < mSegments.size(); ++i)
+			size += writableSize(*mSegments[i]);
+		return size;
+	}
+
+	/**
+	 * @brief Get the physical memory ranges of all available data in the chain.
+	 *
+	 * Ranges are appended in segment order, and a circular segment may
+	 * contribute up to two ranges.
+	 *
+	 * @param ranges Ranges are appended to it, anything with push_back() of std::pair<byte*,std::size_t>.
+	 *
+	 * @return The total available data size.
+	 */
+	template<typename Ranges>
+	inline std::size_t getDataRanges(Ranges& ranges)
+	{
+		std::size_t size = 0;
+		for(std::size_t i = mReadIndex; i < mSegments.size(); ++i)
+			size += mSegments[i]->getDataRanges(ranges);
+		return size;
+	}
+
+	/**
+	 * @brief Export all available data in the chain as an iovec list for writev()/sendmsg().
+	 *
+	 * The iovecs are appended to the given container, e.g. a std::vector<struct iovec>
+	 * reused across sends (clear() keeps its capacity) so nothing is allocated per send.
+	 *
+	 * @param iovecs Anything with push_back() of struct iovec.
+	 *
+	 * @return The total available data size.
+	 */
+	template<typename IoVecs>
+	inline std::size_t getIoVecs(IoVecs& iovecs)
+	{
+		std::size_t size = 0;
+		for(std::size_t s = mReadIndex; s < mSegments.size(); ++s)
+		{
+			BufferRanges ranges;
+			size += mSegments[s]->getDataRanges(ranges);
+
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+			{
+				if(i->second == 0) continue;
+
+				struct iovec v;
+				v.iov_base = (void*)i->first;
+				v.iov_len = i->second;
+				iovecs.push_back(v);
+			}
+		}
+		return size;
+	}
+
+	/**
+	 * @brief Export the available data in the chain into a caller supplied iovec array.
+	 *
+	 * Segments are exported in order until the array is full, what's left out is
+	 * exported by the next call once the written bytes have been skipped by rskip().
+	 *
+	 * @param vectors The iovec array to be filled.
+	 * @param capacity The number of iovecs in the array, at least BufferRanges::capacity.
+	 * @param size Set to the data size covered by the filled iovecs if not NULL.
+	 *
+	 * @return The number of iovecs filled, empty ranges are left out.
+	 */
+	inline int getIoVecs(struct iovec* vectors, int capacity, std::size_t* size = NULL)
+	{
+		BOOST_ASSERT(capacity >= (int)BufferRanges::capacity);
+
+		int count = 0;
+		std::size_t covered = 0;
+		for(std::size_t s = mReadIndex; s < mSegments.size(); ++s)
+		{
+			BufferRanges ranges;
+			std::size_t n = mSegments[s]->getDataRanges(ranges);
+
+			int used = 0;
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+				if(i->second > 0) ++used;
+
+			// a segment is exported as a whole or not at all
+			if(count + used > capacity)
+				break;
+
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+			{
+				if(i->second == 0) continue;
+				vectors[count].iov_base = (void*)i->first;
+				vectors[count].iov_len = i->second;
+				++count;
+			}
+			covered += n;
+		}
+
+		if(size) *size = covered;
+		return count;
+	}
+
+	/**
+	 * @brief Export all available data in the chain as a buffer sequence.
+	 *
+	 * The sequence type is anything with push_back() whose value_type can be
+	 * constructed from (pointer, size), for example std::vector<boost::asio::const_buffer>
+	 * reused across sends, which can be passed directly to boost::asio::async_write().
+	 *
+	 * @return The total available data size.
+	 */
+	template<typename BufferSequence>
+	inline std::size_t getBufferSequence(BufferSequence& sequence)
+	{
+		std::size_t size = 0;
+		for(std::size_t s = mReadIndex; s < mSegments.size(); ++s)
+		{
+			BufferRanges ranges;
+			size += mSegments[s]->getDataRanges(ranges);
+
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+			{
+				if(i->second == 0) continue;
+				sequence.push_back(typename BufferSequence::value_type(i->first, i->second));
+			}
+		}
+		return size;
+	}
+
+public:
+	/**
+	 * @brief Move forward the read pointer by given number of bytes across segments.
+	 *
+	 * @note This is typically called after a gathered write completes.
+	 *
+	 * @param bytes The number of bytes to skip reading.
+	 */
+	inline void rskip(std::size_t bytes)
+	{
+		while(bytes > 0)
+		{
+			segment_type* s = currentReadSegment();
+			if(UNLIKELY(!s))
+				throw std::length_error("out of data buffer");
+
+			std::size_t n = std::min(bytes, s->dataSize());
+			s->rskip(n);
+			bytes -= n;
+		}
+	}
+
+	/**
+	 * @brief Read an array of data with given size across segments.
+	 *
+	 * @param dest The pointer to the array.
+	 * @param size The given size to be read.
+	 */
+	inline void readArray(char* dest, std::size_t size)
+	{
+		while(size > 0)
+		{
+			segment_type* s = currentReadSegment();
+			if(UNLIKELY(!s))
+				throw std::length_error("out of data buffer");
+
+			std::size_t n = std::min(size, s->dataSize());
+			s->readArray(dest, n);
+			dest += n;
+			size -= n;
+		}
+	}
+
+	/**
+	 * @brief Write an array of data with given size across segments.
+	 *
+	 * @note The free space of each segment is filled in order, and the last
+	 * segment grows if it's on-demand.
+	 *
+	 * @param source The pointer to the array.
+	 * @param size The given size to be written.
+	 */
+	inline void writeArray(const char* source, std::size_t size)
+	{
+		while(size > 0)
+		{
+			segment_type* s = currentWriteSegment();
+			if(UNLIKELY(!s))
+				throw std::length_error("out of free buffer");
+
+			std::size_t n = (s->isOnDemand() && isLastWriteSegment()) ? size : std::min(size, writableSize(*s));
+			s->writeArray(source, n);
+			source += n;
+			size -= n;
+		}
+	}
+
+	/**
+	 * @brief Read an arbitrary variable from the chain.
+	 *
+	 * If the variable lies entirely in the current segment, it's read
+	 * directly from the segment. Otherwise the bytes are gathered first.
+	 *
+	 * @param value The value to be read.
+	 */
+	template <typename T>
+	inline void read(T& value)
+	{
+		segment_type* s = currentReadSegment();
+		if(UNLIKELY(!s))
+			throw std::length_error("out of data buffer");
+
+		readDispatch(value, *s, boost::mpl::bool_< is_fixed_size_types<T>::value >());
+	}
+
+	/**
+	 * @brief Write an arbitrary variable into the chain.
+	 *
+	 * If the variable fits into the current segment, it's written directly
+	 * into the segment. Otherwise it's serialized first and scattered.
+	 *
+	 * @param value The value to be written.
+	 */
+	template <typename T>
+	inline void write(const T& value)
+	{
+		segment_type* s = currentWriteSegment();
+		if(UNLIKELY(!s))
+			throw std::length_error("out of free buffer");
+
+		std::size_t size = segment_type::probeSize(value);
+		if(size <= writableSize(*s) || (s->isOnDemand() && isLastWriteSegment()))
+		{
+			s->write(value);
+		}
+		else
+		{
+			mScratch.clear();
+			mScratch.write(value);
+			writeArray(mScratch.rptr(), mScratch.dataSize());
+		}
+	}
+
+	template <typename T>
+	inline BufferChainT& operator<< (const T& value)
+	{
+		write(value);
+		return *this;
+	}
+
+	template <typename T>
+	inline BufferChainT& operator>> (T& value)
+	{
+		read(value);
+		return *this;
+	}
+
+private:
+	template <typename T>
+	inline void readDispatch(T& value, segment_type& s, boost::mpl::true_ /*is_fixed_size_types*/)
+	{
+		std::size_t size = segment_type::template probeSize<T>();
+		if(LIKELY(size <= s.dataSize()))
+		{
+			s.read(value);
+		}
+		else
+		{
+			char temporary[sizeof(T) > sizeof(int8) ? sizeof(T) : sizeof(int8)];
+			readArray(temporary, size);
+
+			BufferBase<BufferMode::plain, BufferConcurrency::none> b((const byte*)temporary, size);
+			b.wpos(size);
+			b.read(value);
+		}
+	}
+
+	template <typename T>
+	inline void readDispatch(T& value, segment_type& s, boost::mpl::false_ /*is_fixed_size_types*/)
+	{
+		std::size_t available = dataSize();
+		if(LIKELY(s.dataSize() == available))
+		{
+			s.read(value);
+			return;
+		}
+
+		// the value may span segments, so find its size by peeking the length prefixes
+		// and gather just those bytes, unless it's a serializable type without a length
+		// prefix, for which the rest of the chain is gathered
+		std::size_t size = measure((const T*)0, 0, available);
+		if(size == unknown_size)
+			size = available;
+		else if(UNLIKELY(size > available))
+			throw std::length_error("out of data buffer");
+
+		if(size <= s.dataSize())
+		{
+			s.read(value);
+			return;
+		}
+
+		gather(size);
+		mScratch.read(value);
+		BOOST_ASSERT(mScratch.rpos() <= size);
+		rskip(mScratch.rpos());
+	}
+
+	/**
+	 * @brief The size of a value stored at the given offset from the read pointer,
+	 * or unknown_size if it can't be told without decoding the value.
+	 *
+	 * @param offset The offset of the value from the read pointer.
+	 * @param limit The available data size, peeking beyond it throws std::length_error.
+	 */
+	template <typename T>
+	inline std::size_t measure(const T*, std::size_t offset, std::size_t limit)
+	{
+		UNUSED_ARGUMENT(offset);
+		UNUSED_ARGUMENT(limit);
+		if(is_fixed_size_types<T>::value)
+			return segment_type::template probeSize<T>();
+		if(detail::is_direct_layout<T>::value)
+			return sizeof(T);
+		return unknown_size;
+	}
+
+	inline std::size_t measure(const std::string*, std::size_t offset, std::size_t limit)
+	{
+		return sizeof(uint32) + peekLength(offset, limit);
+	}
+
+	inline std::size_t measure(const std::wstring*, std::size_t offset, std::size_t limit)
+	{
+		return sizeof(uint32) + (std::size_t)peekLength(offset, limit) * sizeof(wchar_t);
+	}
+
+	inline std::size_t measure(const boost::system::error_code*, std::size_t offset, std::size_t limit)
+	{
+		UNUSED_ARGUMENT(offset);
+		UNUSED_ARGUMENT(limit);
+		return sizeof(int32) * 2;
+	}
+
+	template<BufferMode::type M, BufferConcurrency::type C, BufferEncoding::type E, BufferChecksum::type K>
+	inline std::size_t measure(const BufferBase<M,C,E,K>*, std::size_t offset, std::size_t limit)
+	{
+		return sizeof(uint32) + peekLength(offset, limit);
+	}
+
+	template <typename T>
+	inline std::size_t measure(const std::vector<T>*, std::size_t offset, std::size_t limit)
+	{
+		uint32 length = peekLength(offset, limit);
+		return addSize(sizeof(uint32), measureElements((const T*)0, length, offset + sizeof(uint32), limit));
+	}
+
+	template <typename T>
+	inline std::size_t measure(const std::list<T>*, std::size_t offset, std::size_t limit)
+	{
+		uint32 length = peekLength(offset, limit);
+		return addSize(sizeof(uint32), measureElements((const T*)0, length, offset + sizeof(uint32), limit));
+	}
+
+	template <typename K, typename V>
+	inline std::size_t measure(const std::map<K,V>*, std::size_t offset, std::size_t limit)
+	{
+		uint32 length = peekLength(offset, limit);
+		return addSize(sizeof(uint32), measureElements((const std::pair<K,V>*)0, length, offset + sizeof(uint32), limit));
+	}
+
+	template <typename T, std::size_t N>
+	inline std::size_t measure(const boost::array<T,N>*, std::size_t offset, std::size_t limit)
+	{
+		return addSize(sizeof(uint32), measureElements((const T*)0, N, offset + sizeof(uint32), limit));
+	}
+
+	template <typename K, typename V>
+	inline std::size_t measure(const std::pair<K,V>*, std::size_t offset, std::size_t limit)
+	{
+		std::size_t first = measure((const K*)0, offset, limit);
+		if(first == unknown_size)
+			return unknown_size;
+		return addSize(first, measure((const V*)0, offset + first, limit));
+	}
+
+	/**
+	 * @brief The total size of the given number of consecutive elements.
+	 */
+	template <typename T>
+	inline std::size_t measureElements(const T*, std::size_t count, std::size_t offset, std::size_t limit)
+	{
+		if(is_fixed_size_types<T>::value || detail::is_direct_layout<T>::value)
+			return count * measure((const T*)0, offset, limit);
+
+		std::size_t size = 0;
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			std::size_t n = measure((const T*)0, offset + size, limit);
+			if(n == unknown_size)
+				return unknown_size;
+
+			size += n;
+			if(UNLIKELY(offset + size > limit))
+				throw std::length_error("out of data buffer");
+		}
+		return size;
+	}
+
+	static inline std::size_t addSize(std::size_t a, std::size_t b)
+	{
+		return (a == unknown_size || b == unknown_size) ? unknown_size : a + b;
+	}
+
+	/**
+	 * @brief Peek a length field at the given offset from the read pointer.
+	 */
+	inline uint32 peekLength(std::size_t offset, std::size_t limit)
+	{
+		if(UNLIKELY(offset + sizeof(uint32) > limit))
+			throw std::length_error("out of data buffer");
+
+		uint32 length = 0;
+		peekArray((char*)&length, offset, sizeof(uint32));
+		return length;
+	}
+
+	/**
+	 * @brief Copy data at the given offset from the read pointer across segments without consuming it.
+	 */
+	inline void peekArray(char* dest, std::size_t offset, std::size_t size)
+	{
+		for(std::size_t s = mReadIndex; s < mSegments.size() && size > 0; ++s)
+		{
+			BufferRanges ranges;
+			mSegments[s]->getDataRanges(ranges);
+
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end() && size > 0; ++i)
+			{
+				if(offset >= i->second)
+				{
+					offset -= i->second;
+					continue;
+				}
+
+				std::size_t n = std::min(size, i->second - offset);
+				memcpy(dest, i->first + offset, n);
+				dest += n;
+				size -= n;
+				offset = 0;
+			}
+		}
+		BOOST_ASSERT(size == 0);
+	}
+
+	/**
+	 * @brief Copy the given number of bytes from the read pointer into the scratch buffer without consuming them.
+	 */
+	inline void gather(std::size_t size)
+	{
+		mScratch.clear();
+		mScratch.reserve(size);
+		for(std::size_t s = mReadIndex; s < mSegments.size() && size > 0; ++s)
+		{
+			BufferRanges ranges;
+			mSegments[s]->getDataRanges(ranges);
+
+			for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end() && size > 0; ++i)
+			{
+				std::size_t n = std::min(size, i->second);
+				mScratch.writeArray(i->first, n);
+				size -= n;
+			}
+		}
+	}
+
+	inline segment_type* currentReadSegment()
+	{
+		for(std::size_t i = mReadIndex; i < mSegments.size(); ++i)
+		{
+			if(mSegments[i]->dataSize() > 0)
+			{
+				mReadIndex = i;
+				return mSegments[i];
+			}
+		}
+		return NULL;
+	}
+
+	inline segment_type* currentWriteSegment()
+	{
+		while(mWriteIndex + 1 < mSegments.size() && writableSize(*mSegments[mWriteIndex]) == 0)
+			++mWriteIndex;
+
+		if(mWriteIndex >= mSegments.size())
+			return NULL;
+
+		segment_type* s = mSegments[mWriteIndex];
+		if(writableSize(*s) == 0 && !s->isOnDemand())
+			return NULL;
+
+		return s;
+	}
+
+	inline bool isLastWriteSegment() const
+	{
+		return mWriteIndex + 1 == mSegments.size();
+	}
+
+	/**
+	 * @brief Get the number of bytes that can be written into the segment without growing it.
+	 *
+	 * @note For plain buffer the free segment is the tail after the write pointer,
+	 * which may be smaller than freeSize() if some data has been read.
+	 */
+	static inline std::size_t writableSize(const segment_type& s)
+	{
+		if(Mode == BufferMode::plain)
+			return s.allocatedSize() - s.wpos();
+		else
+			return s.freeSize();
+	}
+
+private:
+	std::vector<segment_type*> mSegments;
+	std::size_t mReadIndex;
+	std::size_t mWriteIndex;
+	BufferBase<BufferMode::plain, BufferConcurrency::none> mScratch;
+};
+
+typedef BufferChainT<BufferMode::plain, BufferConcurrency::none> BufferChain;
+typedef BufferChainT<BufferMode::circular, BufferConcurrency::none> CircularBufferChain;
+
+}
+
+#endif/*ZILLIANS_BUFFERCHAIN_H_*/
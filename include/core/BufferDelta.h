@@ -0,0 +1,154 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BUFFERDELTA_H_
+#define ZILLIANS_BUFFERDELTA_H_
+
+#include "core/Buffer.h"
+#include "core/SharedPtr.h"
+
+namespace zillians {
+
+/**
+ * @brief DeltaBaseline is the snapshot deltas are taken against, attached to a buffer as its BufferContext.
+ *
+ * The sequence tells the peers which snapshot it is, usually the sequence
+ * number of the snapshot the client acknowledged last.
+ */
+struct DeltaBaseline
+{
+	DeltaBaseline(const shared_ptr<Buffer>& snapshot, uint32 sequence) : snapshot(snapshot), sequence(sequence)
+	{ }
+
+	shared_ptr<Buffer> snapshot;
+	uint32 sequence;
+};
+
+/**
+ * BufferDelta encodes a serialized snapshot as its difference from a previous one.
+ *
+ * The data of the current snapshot is compared with the baseline byte by byte,
+ * with SSE2 or AVX2 where available, and the frame keeps only the ranges which
+ * differ, XOR-ed with the baseline, separated by the lengths of the equal runs
+ * in between. Equal runs shorter than MIN_SKIP stay in the literal, since the
+ * run lengths would cost more than the bytes. Data past the end of the baseline
+ * is XOR-ed with zero, so it's stored as it is. A frame which would not be
+ * smaller than the snapshot stores the snapshot in full instead, as does a
+ * snapshot without baseline, and applyDelta() takes both kinds.
+ *
+ * @code
+ * // sender, with the last acknowledged snapshot of the client attached to the new one
+ * BufferDelta::setBaseline(*snapshot, make_shared<DeltaBaseline>(acked_snapshot, acked_sequence));
+ * BufferDelta::encodeDelta(*snapshot, outgoing);
+ *
+ * // receiver, with the same snapshot attached to the buffer being rebuilt
+ * BufferDelta::setBaseline(snapshot, make_shared<DeltaBaseline>(acked_snapshot, acked_sequence));
+ * BufferDelta::applyDelta(incoming, snapshot);
+ * @endcode
+ *
+ * The frame records the sequence of its baseline, and applyDelta() refuses a
+ * frame taken against another baseline, see getFrameBaseline() to pick the
+ * right one. The encoding works on the bytes only, it knows nothing about the
+ * fields, so it pays off when the snapshots are serialized in a stable order
+ * with fixed size fields, like the fixed encoding of Buffer does.
+ *
+ * @note Only the data between the read and the write position of the baseline is used, and it's left untouched.
+ * @note All functions are stateless and thread-safe, as long as the buffers aren't shared.
+ */
+class BufferDelta
+{
+public:
+	enum
+	{
+		HEADER_SIZE = 13,	///< Frame header: type, baseline sequence, snapshot size and payload size
+		MIN_SKIP = 8,		///< Shortest equal run encoded as a skip
+	};
+
+public:
+	/**
+	 * Encode all data of the current snapshot against the baseline into a frame appended to dest.
+	 *
+	 * @param baseline : the snapshot the peer already has
+	 * @param sequence : the sequence of the baseline, recorded in the frame
+	 * @param current : the new snapshot, consumed on success
+	 * @param dest : the buffer to append the frame to, grown if it's on-demand
+	 * @return True if success; otherwise, false if dest is full, leaving both untouched
+	 */
+	static bool encodeDelta(const Buffer& baseline, uint32 sequence, Buffer& current, Buffer& dest);
+
+	/**
+	 * Encode the current snapshot against the baseline attached to it, or in full if there's none.
+	 */
+	static bool encodeDelta(Buffer& current, Buffer& dest);
+
+	/**
+	 * Rebuild the snapshot of the frame at the read position of source and append it to dest.
+	 *
+	 * @param baseline : the snapshot the frame is taken against
+	 * @param sequence : the sequence of the baseline, must match the one in the frame
+	 * @param source : the frames, the first one is consumed on success
+	 * @param dest : the buffer to append the snapshot to, grown if it's on-demand
+	 * @return True if success; otherwise, false if the frame is incomplete, corrupted, against another
+	 * baseline, or dest is full, leaving source untouched
+	 */
+	static bool applyDelta(const Buffer& baseline, uint32 sequence, Buffer& source, Buffer& dest);
+
+	/**
+	 * Rebuild the snapshot against the baseline attached to dest, only frames in full can be applied without one.
+	 */
+	static bool applyDelta(Buffer& source, Buffer& dest);
+
+	/**
+	 * Get the sequence of the baseline the frame at the read position of source is taken against.
+	 *
+	 * @return False if the frame is incomplete or stores the snapshot in full
+	 */
+	static bool getFrameBaseline(const Buffer& source, /*OUT*/ uint32& sequence);
+
+public:
+	/**
+	 * Attach the baseline to the buffer, replacing its context.
+	 */
+	static inline void setBaseline(Buffer& buffer, const shared_ptr<DeltaBaseline>& baseline)
+	{
+		buffer.setContext(baseline);
+	}
+
+	/**
+	 * Get the baseline attached to the buffer.
+	 *
+	 * @note The context of the buffer must have been set by setBaseline(), if at all.
+	 */
+	static inline shared_ptr<DeltaBaseline> getBaseline(Buffer& buffer)
+	{
+		return static_pointer_cast<DeltaBaseline>(buffer.getContext());
+	}
+
+private:
+	static bool encodeFull(uint32 sequence, Buffer& current, Buffer& dest);
+
+	/**
+	 * Apply the frame against the baseline, a NULL sequence means there's no baseline and only full frames apply.
+	 */
+	static bool applyFrame(const byte* baseline, std::size_t baseline_size, const uint32* sequence, Buffer& source, Buffer& dest);
+};
+
+}
+
+#endif/*ZILLIANS_BUFFERDELTA_H_*/
@@ -0,0 +1,195 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BUFFERIO_H_
+#define ZILLIANS_BUFFERIO_H_
+
+#include "core/Buffer.h"
+
+#include <boost/asio/buffer.hpp>
+#include <sys/uio.h>
+#include <cerrno>
+
+/**
+ * Maximum number of iovecs kept on stack by writeBuffers(), buffers beyond that are left for the next call.
+ */
+#define ZILLIANS_BUFFER_IO_MAX_VECTORS	64
+
+namespace zillians {
+
+/**
+ * @brief BufferSequenceT exposes the ranges of a buffer as an asio buffer sequence without allocation.
+ *
+ * Use dataBuffers() for a ConstBufferSequence of the available data, and freeBuffers()
+ * for a MutableBufferSequence of the free space. Both are two ranges at most, so
+ * a circular buffer wrapping around its end is sent or received in one operation.
+ *
+ * @code
+ * std::size_t n = socket.write_some(dataBuffers(buffer));
+ * buffer.rskip(n);
+ * n = socket.read_some(freeBuffers(buffer));
+ * buffer.wskip(n);
+ * @endcode
+ *
+ * @note The sequence refers to the buffer memory, the buffer must not be written
+ * (for dataBuffers()) or read (for freeBuffers()) until the operation completes.
+ */
+template<typename Value>
+class BufferSequenceT
+{
+public:
+	typedef Value value_type;
+	typedef const Value* const_iterator;
+
+public:
+	explicit BufferSequenceT(const BufferRanges& ranges) : mCount(0), mSize(0)
+	{
+		for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+		{
+			if(i->second == 0) continue;
+			mBuffers[mCount++] = Value(i->first, i->second);
+			mSize += i->second;
+		}
+	}
+
+public:
+	inline const_iterator begin() const { return mBuffers; }
+	inline const_iterator end() const { return mBuffers + mCount; }
+
+	/**
+	 * @brief Get the total size of all ranges.
+	 */
+	inline std::size_t size() const { return mSize; }
+
+private:
+	Value mBuffers[BufferRanges::capacity];
+	std::size_t mCount;
+	std::size_t mSize;
+};
+
+typedef BufferSequenceT<boost::asio::const_buffer> BufferConstSequence;
+typedef BufferSequenceT<boost::asio::mutable_buffer> BufferMutableSequence;
+
+/**
+ * @brief Get the available data of the buffer as an asio ConstBufferSequence.
+ */
+template<typename BufferType>
+inline BufferConstSequence dataBuffers(BufferType& buffer)
+{
+	BufferRanges ranges;
+	buffer.getDataRanges(ranges);
+	return BufferConstSequence(ranges);
+}
+
+/**
+ * @brief Get the free space of the buffer as an asio MutableBufferSequence.
+ *
+ * @note For plain buffer only the space after the write pointer is included.
+ */
+template<typename BufferType>
+inline BufferMutableSequence freeBuffers(BufferType& buffer)
+{
+	BufferRanges ranges;
+	buffer.getFreeRanges(ranges);
+	return BufferMutableSequence(ranges);
+}
+
+/**
+ * @brief Get the available data of the buffer as iovecs for writev()/sendmsg().
+ *
+ * @param vectors At least BufferRanges::capacity iovecs.
+ *
+ * @return The number of iovecs filled, empty ranges are left out.
+ */
+template<typename BufferType>
+inline int getIoVecs(BufferType& buffer, struct iovec* vectors)
+{
+	BufferRanges ranges;
+	buffer.getDataRanges(ranges);
+
+	int count = 0;
+	for(BufferRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+	{
+		if(i->second == 0) continue;
+		vectors[count].iov_base = (void*)i->first;
+		vectors[count].iov_len = i->second;
+		++count;
+	}
+	return count;
+}
+
+/**
+ * @brief Consume written bytes from a list of buffers in order.
+ *
+ * This handles partial writes of a gathered send, the first buffers are drained
+ * and the last one touched keeps what's not written yet.
+ *
+ * @param begin,end The buffers, the iterator dereferences to a pointer or shared_ptr of the buffer.
+ * @param bytes The number of bytes written.
+ */
+template<typename Iterator>
+inline void consumeBuffers(Iterator begin, Iterator end, std::size_t bytes)
+{
+	for(Iterator i = begin; i != end && bytes > 0; ++i)
+	{
+		std::size_t n = std::min(bytes, (**i).dataSize());
+		(**i).rskip(n);
+		bytes -= n;
+	}
+	BOOST_ASSERT(bytes == 0);
+}
+
+/**
+ * @brief Write the data of a list of buffers with a single writev(), and consume what's written.
+ *
+ * At most ZILLIANS_BUFFER_IO_MAX_VECTORS iovecs are written at once, the data
+ * of the remaining buffers, as well as what a partial write leaves, stays in
+ * the buffers for the next call.
+ *
+ * @param fd The file descriptor to write to.
+ * @param begin,end The buffers, the iterator dereferences to a pointer or shared_ptr of the buffer.
+ *
+ * @return The number of bytes written, or -1 with errno set, e.g. EAGAIN for a full non-blocking socket.
+ */
+template<typename Iterator>
+inline ssize_t writeBuffers(int fd, Iterator begin, Iterator end)
+{
+	struct iovec vectors[ZILLIANS_BUFFER_IO_MAX_VECTORS];
+	int count = 0;
+	for(Iterator i = begin; i != end && count + (int)BufferRanges::capacity <= ZILLIANS_BUFFER_IO_MAX_VECTORS; ++i)
+		count += getIoVecs(**i, vectors + count);
+
+	if(count == 0)
+		return 0;
+
+	ssize_t written;
+	do
+	{
+		written = ::writev(fd, vectors, count);
+	} while(written < 0 && errno == EINTR);
+
+	if(written > 0)
+		consumeBuffers(begin, end, (std::size_t)written);
+
+	return written;
+}
+
+}
+
+#endif/*ZILLIANS_BUFFERIO_H_*/
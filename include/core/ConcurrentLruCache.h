@@ -0,0 +1,406 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_CONCURRENTLRUCACHE_H_
+#define ZILLIANS_CONCURRENTLRUCACHE_H_
+
+#include "core/Prerequisite.h"
+#include "core/HashMap.h"
+#include "core/ProfiledMutex.h"
+#include "utility/HashUtil.h"
+#include <tbb/spin_rw_mutex.h>
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+#include <atomic>
+#include <unordered_map>
+
+namespace zillians {
+
+namespace detail {
+ZILLIANS_LOCK_SITE(ConcurrentLruCacheShardLockSite, "concurrent_lru_cache.shard");
+}
+
+/**
+ * @brief ConcurrentLruCache is a thread-safe bounded cache split into independently locked shards.
+ *
+ * The keys are hashed and compared by HashCompare, the same traits taken by
+ * tbb::concurrent_hash_map, so UUIDHasher, PointerHashCompare and
+ * SharedPointerHashCompare can be used as they are. Each shard keeps its
+ * entries on an intrusive recency list and evicts from its own tail, so a
+ * shard never waits for another one.
+ *
+ * Two eviction policies are supported:
+ * - lru moves an entry to the front of the list on every hit, which takes
+ *   the shard lock exclusively.
+ * - clock only marks the entry as referenced on a hit, under a shared lock,
+ *   and gives marked entries a second chance when they reach the tail. The
+ *   order is an approximation of LRU, but hits on the same shard don't
+ *   serialize.
+ *
+ * The capacity and the byte limit are divided evenly among the shards, so an
+ * entry may be evicted a bit before the whole cache is full. The values are
+ * copied in and out under the lock, use a shared_ptr for values that are
+ * expensive to copy.
+ *
+ * @code
+ * ConcurrentLruCache<UUID, shared_ptr<Profile>, UUIDHasher> profiles(10000);
+ * shared_ptr<Profile> profile;
+ * if(!profiles.find(id, profile))
+ * {
+ *     profile = loadProfile(id);
+ *     profiles.insert(id, profile);
+ * }
+ * @endcode
+ */
+template<typename K, typename V, typename HashCompare = tbb::tbb_hash_compare<K>, std::size_t Shards = 16>
+class ConcurrentLruCache : public boost::noncopyable
+{
+	BOOST_STATIC_ASSERT((Shards & (Shards - 1)) == 0);
+public:
+	typedef std::size_t size_type;
+
+	struct policy_t
+	{
+		enum type { lru, clock };
+	};
+
+	struct Statistics
+	{
+		Statistics() : hits(0), misses(0), evictions(0), entries(0), bytes(0)
+		{ }
+
+		uint64 hits;
+		uint64 misses;
+		uint64 evictions;
+		size_type entries;
+		size_type bytes;
+	};
+
+public:
+	/**
+	 * @param capacity The maximum number of entries, 0 for no limit.
+	 * @param byteLimit The maximum total of the sizes given to insert(), 0 for no limit.
+	 * @param policy The eviction policy.
+	 */
+	explicit ConcurrentLruCache(size_type capacity, size_type byteLimit = 0, typename policy_t::type policy = policy_t::lru, const HashCompare& compare = HashCompare()) :
+		mPolicy(policy), mCompare(compare)
+	{
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			mShards[i].capacity = (capacity + Shards - 1) / Shards;
+			mShards[i].byteLimit = (byteLimit + Shards - 1) / Shards;
+			mShards[i].map = new map_t(0, Hasher(compare), Equal(compare));
+		}
+	}
+
+	~ConcurrentLruCache()
+	{
+		clear();
+		for(std::size_t i = 0; i < Shards; ++i)
+			delete mShards[i].map;
+	}
+
+public:
+	/**
+	 * @brief Look up the key and copy its value out.
+	 *
+	 * @return True on a hit.
+	 */
+	bool find(const K& key, V& value)
+	{
+		Shard& shard = shardOf(key);
+		if(mPolicy == policy_t::clock)
+		{
+			typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+			Node* node = lookup(shard, key);
+			if(!node)
+				return miss(shard);
+
+			if(!node->referenced.load(std::memory_order_relaxed))
+				node->referenced.store(true, std::memory_order_relaxed);
+			value = node->value;
+		}
+		else
+		{
+			typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+			Node* node = lookup(shard, key);
+			if(!node)
+				return miss(shard);
+
+			unlink(shard, node);
+			linkFront(shard, node);
+			value = node->value;
+		}
+		shard.hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * @brief Check whether the key is cached, without counting a hit or a miss or touching its recency.
+	 */
+	bool contains(const K& key) const
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+		return lookup(shard, key) != NULL;
+	}
+
+	/**
+	 * @brief Insert or replace the value of the key, evicting the least recently used entries of its shard when over the limits.
+	 *
+	 * @param bytes The size of the entry counted against the byte limit.
+	 */
+	void insert(const K& key, const V& value, size_type bytes = 0)
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+
+		Node* node = lookup(shard, key);
+		if(node)
+		{
+			node->value = value;
+			shard.bytes = shard.bytes - node->bytes + bytes;
+			node->bytes = bytes;
+			unlink(shard, node);
+		}
+		else
+		{
+			node = new Node(key, value, bytes);
+			shard.map->insert(std::make_pair(key, node));
+			shard.bytes += bytes;
+		}
+		node->referenced.store(false, std::memory_order_relaxed);
+		linkFront(shard, node);
+
+		evict(shard, node);
+	}
+
+	bool erase(const K& key)
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+
+		typename map_t::iterator it = shard.map->find(key);
+		if(it == shard.map->end())
+			return false;
+
+		Node* node = it->second;
+		shard.map->erase(it);
+		unlink(shard, node);
+		shard.bytes -= node->bytes;
+		delete node;
+		return true;
+	}
+
+	void clear()
+	{
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			Shard& shard = mShards[i];
+			typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+			for(Node* node = shard.head; node; )
+			{
+				Node* next = node->next;
+				delete node;
+				node = next;
+			}
+			shard.map->clear();
+			shard.head = shard.tail = NULL;
+			shard.bytes = 0;
+		}
+	}
+
+	/**
+	 * @brief Number of entries, which is only a snapshot while other threads are modifying the cache.
+	 */
+	size_type size() const
+	{
+		size_type n = 0;
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			typename shard_mutex_t::scoped_lock lock(mShards[i].lock, false);
+			n += mShards[i].map->size();
+		}
+		return n;
+	}
+
+	/**
+	 * @brief Sum up the counters and the sizes of all shards.
+	 */
+	Statistics statistics() const
+	{
+		Statistics s;
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			const Shard& shard = mShards[i];
+			typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+			s.hits += shard.hits.load(std::memory_order_relaxed);
+			s.misses += shard.misses.load(std::memory_order_relaxed);
+			s.evictions += shard.evictions;
+			s.entries += shard.map->size();
+			s.bytes += shard.bytes;
+		}
+		return s;
+	}
+
+private:
+	struct Node
+	{
+		Node(const K& k, const V& v, size_type b) : key(k), value(v), bytes(b), prev(NULL), next(NULL), referenced(false)
+		{ }
+
+		K key;
+		V value;
+		size_type bytes;
+		Node* prev;
+		Node* next;
+		std::atomic<bool> referenced;	///< Set by hits under the clock policy
+	};
+
+	struct Hasher
+	{
+		explicit Hasher(const HashCompare& c) : compare(c)
+		{ }
+
+		std::size_t operator() (const K& key) const
+		{
+			return compare.hash(key);
+		}
+
+		HashCompare compare;
+	};
+
+	struct Equal
+	{
+		explicit Equal(const HashCompare& c) : compare(c)
+		{ }
+
+		bool operator() (const K& a, const K& b) const
+		{
+			return compare.equal(a, b);
+		}
+
+		HashCompare compare;
+	};
+
+	typedef std::unordered_map<K, Node*, Hasher, Equal> map_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_rw_mutex, detail::ConcurrentLruCacheShardLockSite) shard_mutex_t;
+
+	/**
+	 * Shards are padded to a cache line so locking one doesn't invalidate its neighbours.
+	 */
+	struct Shard
+	{
+		Shard() : map(NULL), head(NULL), tail(NULL), capacity(0), byteLimit(0), bytes(0), hits(0), misses(0), evictions(0)
+		{ }
+
+		mutable shard_mutex_t lock;
+		map_t* map;
+		Node* head;		///< Most recently used, or inserted under the clock policy
+		Node* tail;		///< Next to be evicted
+		size_type capacity;
+		size_type byteLimit;
+		size_type bytes;
+		std::atomic<uint64> hits;
+		std::atomic<uint64> misses;
+		uint64 evictions;
+		char padding[64];
+	};
+
+	inline Shard& shardOf(const K& key) const
+	{
+		// mix first, the hash of the traits may have weak high bits like UUIDHasher's
+		return mShards[(HashUtil::hashInteger(mCompare.hash(key)) >> 40) & (Shards - 1)];
+	}
+
+	inline Node* lookup(const Shard& shard, const K& key) const
+	{
+		typename map_t::const_iterator it = shard.map->find(key);
+		return (it == shard.map->end()) ? NULL : it->second;
+	}
+
+	inline bool miss(Shard& shard)
+	{
+		shard.misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	inline void linkFront(Shard& shard, Node* node)
+	{
+		node->prev = NULL;
+		node->next = shard.head;
+		if(shard.head)
+			shard.head->prev = node;
+		else
+			shard.tail = node;
+		shard.head = node;
+	}
+
+	inline void unlink(Shard& shard, Node* node)
+	{
+		if(node->prev)
+			node->prev->next = node->next;
+		else
+			shard.head = node->next;
+
+		if(node->next)
+			node->next->prev = node->prev;
+		else
+			shard.tail = node->prev;
+	}
+
+	inline bool overLimit(const Shard& shard) const
+	{
+		return (shard.capacity && shard.map->size() > shard.capacity) || (shard.byteLimit && shard.bytes > shard.byteLimit);
+	}
+
+	/**
+	 * Evict from the tail until the shard is within its limits, never evicting the entry just inserted.
+	 */
+	void evict(Shard& shard, Node* inserted)
+	{
+		while(overLimit(shard) && shard.tail != inserted)
+		{
+			Node* victim = shard.tail;
+			unlink(shard, victim);
+
+			// second chance, every referenced entry is passed over once per sweep
+			if(victim->referenced.load(std::memory_order_relaxed))
+			{
+				victim->referenced.store(false, std::memory_order_relaxed);
+				linkFront(shard, victim);
+				continue;
+			}
+
+			shard.map->erase(victim->key);
+			shard.bytes -= victim->bytes;
+			++shard.evictions;
+			delete victim;
+		}
+	}
+
+private:
+	typename policy_t::type mPolicy;
+	HashCompare mCompare;
+	mutable Shard mShards[Shards];
+};
+
+}
+
+#endif/*ZILLIANS_CONCURRENTLRUCACHE_H_*/
@@ -212,4 +212,104 @@ private:
 
 #endif
 
+#include "core/Futex.h"
+#include <boost/noncopyable.hpp>
+
+namespace zillians {
+
+/**
+ * OneShotConditionVariable passes one value from a single signal() to any number of waiters.
+ *
+ * Unlike ConditionVariable, signals are not queued: once signaled, every wait() returns
+ * the same value right away until reset(). signal() is a single atomic exchange when no
+ * one is waiting, waiters sleep on a futex and are woken at once.
+ *
+ * @note Signal at most once between two reset() calls, and only reset() when no thread waits.
+ */
+template <typename T>
+class OneShotConditionVariable : public boost::noncopyable
+{
+	enum { EMPTY, WAITING, SIGNALED };
+
+public:
+	OneShotConditionVariable()
+	{
+		mState.store(EMPTY, std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		mState.store(EMPTY, std::memory_order_release);
+	}
+
+	void signal(const T& result)
+	{
+		mValue = result;
+		if(mState.exchange(SIGNALED, std::memory_order_acq_rel) == WAITING)
+			futex::wake_all(mState);
+	}
+
+	bool is_signaled() const
+	{
+		return mState.load(std::memory_order_acquire) == SIGNALED;
+	}
+
+	bool try_wait(T& result)
+	{
+		if(!is_signaled())
+			return false;
+
+		result = mValue;
+		return true;
+	}
+
+	void wait(T& result)
+	{
+		await(NULL);
+		result = mValue;
+	}
+
+	/**
+	 * @return False if the absolute time is reached before the signal.
+	 */
+	bool timed_wait(T& result, const boost::system_time& absolute)
+	{
+		if(!await(&absolute))
+			return false;
+
+		result = mValue;
+		return true;
+	}
+
+	template<typename DurationType>
+	bool timed_wait(T& result, const DurationType& relative)
+	{
+		return timed_wait(result, boost::get_system_time() + relative);
+	}
+
+private:
+	bool await(const boost::system_time* absolute)
+	{
+		uint32 state = mState.load(std::memory_order_acquire);
+		while(state != SIGNALED)
+		{
+			// tell signal() there's someone to wake up, or see the signal if it just came
+			if(state == EMPTY && !mState.compare_exchange_weak(state, uint32(WAITING), std::memory_order_acquire, std::memory_order_acquire))
+				continue;
+
+			if(!futex::wait(mState, uint32(WAITING), absolute))
+				return is_signaled();
+
+			state = mState.load(std::memory_order_acquire);
+		}
+		return true;
+	}
+
+private:
+	std::atomic<uint32> mState;
+	T mValue;
+};
+
+}
+
 #endif/*ZILLIANS_CONDITIONVARIABLE_H_*/
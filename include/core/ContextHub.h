@@ -26,6 +26,12 @@
 #include "core/Common.h"
 #include "core/SharedPtr.h"
 #include "core/Atomic.h"
+#include "core/Snapshot.h"
+#include "utility/Symbol.h"
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <typeinfo>
 
 #ifdef __PLATFORM_WINDOWS__
 #if (_MSC_VER >= 1500)
@@ -69,6 +75,12 @@ struct ContextOwnership
  * @note There's only one slot for each different type of object. Suppose you have
  * three different types named A, B, and C. You can only save one instance of A into
  * one instance of ContextHub. Same for B and C.
+ *
+ * Besides the shared pointers owning the objects, the hub keeps a plain pointer
+ * table for get(), so lookups never touch a reference count and never grow the
+ * table. Call freeze() once all types are set up to pre-size the slot table:
+ * from then on the table is never reallocated, so get() can be called from
+ * several threads as long as nobody calls set() or reset() concurrently.
  */
 template<ContextOwnership::type TransferOwnershipDefault = ContextOwnership::transfer>
 class ContextHub
@@ -81,7 +93,7 @@ private:
 	};
 
 public:
-	ContextHub() : mSharedContextObjects(NULL)
+	ContextHub() : mSharedContextObjects(NULL), mFrozen(false)
 	{ }
 
 	virtual ~ContextHub()
@@ -108,6 +120,7 @@ public:
 		{
 			refSharedContext<T>() = shared_ptr<T>(ctx, NullDeleter());
 		}
+		mRawContextObjects[getContextIndex<T>()] = ctx;
 	}
 	template <typename T>
 	inline void set(T* ctx)
@@ -120,6 +133,36 @@ public:
 		{
 			refSharedContext<T>() = shared_ptr<T>(ctx, NullDeleter());
 		}
+		mRawContextObjects[getContextIndex<T>()] = ctx;
+	}
+
+	/**
+	 * Save an object held by a smart pointer into the universal storage, the hub keeps a reference until reset().
+	 *
+	 * Besides shared_ptr, objects held by intrusive_ptr or local_shared_ptr can be shared with the hub.
+	 * Since get() never touches the reference count, a hub is as cheap with any of them.
+	 *
+	 * @note An object held by local_shared_ptr must not be set into a hub which is reset by other threads.
+	 *
+	 * @param ctx The given object of type T
+	 */
+	template <typename T>
+	inline void set(const shared_ptr<T>& ctx)
+	{
+		refSharedContext<T>() = ctx;
+		mRawContextObjects[getContextIndex<T>()] = ctx.get();
+	}
+	template <typename T>
+	inline void set(const intrusive_ptr<T>& ctx)
+	{
+		refSharedContext<T>() = shared_ptr<T>(ctx.get(), pointer_holder< intrusive_ptr<T> >(ctx));
+		mRawContextObjects[getContextIndex<T>()] = ctx.get();
+	}
+	template <typename T>
+	inline void set(const local_shared_ptr<T>& ctx)
+	{
+		refSharedContext<T>() = shared_ptr<T>(ctx.get(), pointer_holder< local_shared_ptr<T> >(ctx));
+		mRawContextObjects[getContextIndex<T>()] = ctx.get();
 	}
 
 	/**
@@ -130,7 +173,10 @@ public:
 	template <typename T>
 	inline T* get()
 	{
-		return static_pointer_cast<T>(refSharedContext<T>()).get();
+		uint32 index = getContextIndex<T>();
+		if(LIKELY(index < mRawContextObjects.size()))
+			return static_cast<T*>(mRawContextObjects[index]);
+		return NULL;
 	}
 
 	/**
@@ -141,25 +187,119 @@ public:
 	template <typename T>
 	inline void reset()
 	{
-		refSharedContext<T>().reset();
+		uint32 index = getContextIndex<T>();
+		if(index < mRawContextObjects.size())
+		{
+			mRawContextObjects[index] = NULL;
+			(*mSharedContextObjects)[index].reset();
+		}
+	}
+
+	/**
+	 * Register the context of type T as snapshot-published.
+	 *
+	 * The hub owns a Snapshot<T> holding the versions of the context, readers use
+	 * getSnapshot<T>() within a read section instead of get<T>(), and writers
+	 * replace the whole context by publish<T>() instead of set<T>():
+	 *
+	 * @code
+	 * hub.setSnapshot<RoutingTable>(new RoutingTable);
+	 * ...
+	 * Snapshot<RoutingTable>::ReadGuard routes(*hub.getSnapshot<RoutingTable>());
+	 * @endcode
+	 *
+	 * @param initial The first version of the context, the snapshot takes ownership.
+	 * @return The snapshot of the context.
+	 */
+	template <typename T>
+	inline Snapshot<T>* setSnapshot(T* initial = NULL)
+	{
+		Snapshot<T>* snapshot = new Snapshot<T>(initial);
+		set<Snapshot<T>, ContextOwnership::transfer>(snapshot);
+		return snapshot;
+	}
+
+	/**
+	 * Retrieve the snapshot of the context of type T registered by setSnapshot().
+	 *
+	 * @return The snapshot, or null pointer if the context isn't snapshot-published.
+	 */
+	template <typename T>
+	inline Snapshot<T>* getSnapshot()
+	{
+		return get< Snapshot<T> >();
+	}
+
+	/**
+	 * Publish a new version of a snapshot-published context, the old version is deleted after a grace period.
+	 *
+	 * @note Unlike set(), this can be called while other threads read the context.
+	 */
+	template <typename T>
+	inline void publish(T* ctx)
+	{
+		Snapshot<T>* snapshot = getSnapshot<T>();
+		BOOST_ASSERT(snapshot && "the context isn't registered by setSnapshot()");
+		snapshot->publish(ctx);
 	}
 
 	inline void resetAll()
 	{
-		SAFE_DELETE(mSharedContextObjects);
+		std::fill(mRawContextObjects.begin(), mRawContextObjects.end(), (void*)NULL);
+		if(mSharedContextObjects)
+			std::fill(mSharedContextObjects->begin(), mSharedContextObjects->end(), shared_ptr<void>());
+	}
+
+	/**
+	 * Fix the size of the slot table, so it's never reallocated afterwards.
+	 *
+	 * The table gets a slot for every type used with any ContextHub so far, or
+	 * for the given number of types if larger. Types seen for the first time
+	 * after freeze() must not be set() on this hub.
+	 *
+	 * @param slots The minimum number of slots to reserve.
+	 */
+	inline void freeze(std::size_t slots = 0)
+	{
+		std::size_t size = std::max<std::size_t>(std::max<std::size_t>(slots, msContextIndexer.load(std::memory_order_relaxed)), mRawContextObjects.size());
+		if(!mSharedContextObjects)
+		{
+			mSharedContextObjects = new std::vector< shared_ptr<void> >();
+		}
+		mSharedContextObjects->resize(size);
+		mRawContextObjects.resize(size, NULL);
+		mFrozen = true;
+	}
+
+	inline bool isFrozen() const
+	{
+		return mFrozen;
 	}
 
 private:
 	/**
-	 * The magic trick to store and access context object by using static
-	 * initialization to identify the index of a specific type.
+	 * The magic trick to identify the index of a specific type by using static
+	 * initialization.
+	 *
+	 * @return The slot index of type T
+	 */
+	template <typename T>
+	inline uint32 getContextIndex()
+	{
+		// the index only has to be unique, and the local static is already initialized once
+		static uint32 index = atomic::add(msContextIndexer, 1, std::memory_order_relaxed);
+		return index;
+	}
+
+	/**
+	 * Get the owning shared pointer of type T, growing the slot tables if needed.
 	 *
 	 * @return The reference to the shared pointer
 	 */
 	template <typename T>
 	inline std::vector< shared_ptr<void> >::reference refSharedContext()
 	{
-		static uint32 index = atomic::add<uint32>(&msContextIndexer, 1);
+		uint32 index = getContextIndex<T>();
 		if(UNLIKELY(!mSharedContextObjects))
 		{
 			mSharedContextObjects = new std::vector< shared_ptr<void> >();
@@ -167,10 +307,9 @@ private:
 
 		if(UNLIKELY(index >= mSharedContextObjects->size()))
 		{
-			while(index >= mSharedContextObjects->size())
-			{
-				mSharedContextObjects->push_back(shared_ptr<void>());
-			}
+			BOOST_ASSERT(!mFrozen && "ContextHub is frozen, the slot table can't grow");
+			mSharedContextObjects->resize(index + 1);
+			mRawContextObjects.resize(index + 1, NULL);
 		}
 
 		BOOST_ASSERT(index < mSharedContextObjects->size());
@@ -178,16 +317,18 @@ private:
 	}
 
 	std::vector< shared_ptr<void> >* mSharedContextObjects;
+	std::vector<void*> mRawContextObjects;
+	bool mFrozen;
 #if ZILLIANS_SERVICEHUB_ALLOW_ARBITRARY_CONTEXT_PLACEMENT_FOR_DIFFERENT_INSTANCE
-	uint32 msContextIndexer;
+	std::atomic<uint32> msContextIndexer;
 #else
-	static uint32 msContextIndexer;
+	static std::atomic<uint32> msContextIndexer;
 #endif
 };
 
 #if ZILLIANS_SERVICEHUB_ALLOW_ARBITRARY_CONTEXT_PLACEMENT_FOR_DIFFERENT_INSTANCE
 #else
-template<ContextOwnership::type TransferOwnershipDefault> uint32 ContextHub<TransferOwnershipDefault>::msContextIndexer;
+template<ContextOwnership::type TransferOwnershipDefault> std::atomic<uint32> ContextHub<TransferOwnershipDefault>::msContextIndexer;
 #endif
 
 
@@ -198,6 +339,18 @@ template<ContextOwnership::type TransferOwnershipDefault> uint32 ContextHub<Tran
  * an optional key (string) can be provided as the identifier of the
  * context pointer. By default, the key is the name (typeid) of the
  * given type object.
+ *
+ * Names are interned into the global Symbol table, and the symbol id is
+ * the slot index. Resolve a name once with intern() and use the returned Key
+ * on hot paths, where get() is a plain array lookup like ContextHub:
+ *
+ * @code
+ * static const NamedContextHub<ContextOwnership::transfer>::Key session_key = NamedContextHub<ContextOwnership::transfer>::intern("session");
+ * hub.set(new Session, session_key);
+ * Session* session = hub.get<Session>(session_key);
+ * @endcode
+ *
+ * The string overloads go through the intern table on every call and are kept for compatibility.
  */
 template<ContextOwnership::type TransferOwnershipDefault>
 class NamedContextHub
@@ -210,12 +363,66 @@ private:
 	};
 
 public:
-	NamedContextHub()
+	/**
+	 * An interned name, see intern().
+	 */
+	class Key
+	{
+		friend class NamedContextHub;
+	public:
+		Key() : mIndex(INVALID_INDEX)
+		{ }
+
+		inline bool valid() const { return mIndex != INVALID_INDEX; }
+		inline uint32 index() const { return mIndex; }
+
+		inline bool operator== (const Key& other) const { return mIndex == other.mIndex; }
+		inline bool operator!= (const Key& other) const { return mIndex != other.mIndex; }
+
+	private:
+		enum { INVALID_INDEX = 0xFFFFFFFF };
+
+		explicit Key(uint32 index) : mIndex(index)
+		{ }
+
+		uint32 mIndex;
+	};
+
+public:
+	NamedContextHub() : mCount(0)
 	{ }
 
 	virtual ~NamedContextHub()
 	{ }
 
+public:
+	/**
+	 * Resolve the given name to its key, interning the name if it's seen for the first time.
+	 *
+	 * @note Thread-safe, lock-free once the name is interned, but still hashes the name, so keep the returned key instead of calling it per access.
+	 */
+	static Key intern(const std::string& name)
+	{
+		return Key(Symbol(name).id());
+	}
+
+	static Key intern(const Symbol& symbol)
+	{
+		BOOST_ASSERT(symbol.valid());
+		return Key(symbol.id());
+	}
+
+	/**
+	 * Look up the key of the given name without interning it.
+	 *
+	 * @return The key, or an invalid key if the name has never been interned.
+	 */
+	static Key find(const std::string& name)
+	{
+		Symbol symbol = Symbol::find(name);
+		return symbol.valid() ? Key(symbol.id()) : Key();
+	}
+
 public:
 	/**
 	 * Save an object of type T into the universal storage.
@@ -223,83 +430,111 @@ public:
 	 * @note If the TransferOwnership template parameter is set, the ownership of the given object is transferred to this ContextHub instance.
 	 *
 	 * @param ctx The given object of type T
+	 * @param key The interned name of the slot
 	 */
 	template <typename T, ContextOwnership::type TransferOwnership/* = TransferOwnershipDefault*/>// NOTE 20101015 Nothing - Default template argument in template function is a C++0x feature, not supported in C++03 standard.
-	inline void set(T* ctx, const std::string& name = typeid(T).name())
+	inline void set(T* ctx, const Key& key)
 	{
 		if(TransferOwnership == ContextOwnership::transfer)
 		{
-			refSharedContext<T>(name) = shared_ptr<T>(ctx);
+			refSharedContext(key) = shared_ptr<T>(ctx);
 		}
 		else
 		{
-			refSharedContext<T>(name) = shared_ptr<T>(ctx, NullDeleter());
+			refSharedContext(key) = shared_ptr<T>(ctx, NullDeleter());
 		}
+
+		void*& raw = mRawContextObjects[key.index()];
+		if(!raw && ctx) ++mCount;
+		if(raw && !ctx) --mCount;
+		raw = ctx;
 	}
 	template <typename T>
+	inline void set(T* ctx, const Key& key)
+	{
+		set<T, TransferOwnershipDefault>(ctx, key);
+	}
+	template <typename T, ContextOwnership::type TransferOwnership/* = TransferOwnershipDefault*/>
 	inline void set(T* ctx, const std::string& name = typeid(T).name())
 	{
-		if(TransferOwnershipDefault == ContextOwnership::transfer)
-		{
-			refSharedContext<T>(name) = shared_ptr<T>(ctx);
-		}
-		else
-		{
-			refSharedContext<T>(name) = shared_ptr<T>(ctx, NullDeleter());
-		}
+		set<T, TransferOwnership>(ctx, intern(name));
+	}
+	template <typename T>
+	inline void set(T* ctx, const std::string& name = typeid(T).name())
+	{
+		set<T, TransferOwnershipDefault>(ctx, intern(name));
 	}
 
 	/**
-	 * Retrieve the object according to the given type T.
+	 * Retrieve the object according to the given key.
+	 *
+	 * @return The pointer to the stored object. Return null pointer if it's not set previously.
+	 */
+	template <typename T>
+	inline T* get(const Key& key)
+	{
+		if(LIKELY(key.index() < mRawContextObjects.size()))
+			return static_cast<T*>(mRawContextObjects[key.index()]);
+		return NULL;
+	}
+
+	/**
+	 * Retrieve the object according to the given name.
 	 *
 	 * @return The pointer to the stored object. Return null pointer if it's not set previously.
 	 */
 	template <typename T>
 	inline T* get(const std::string& name = typeid(T).name())
 	{
-		return static_pointer_cast<T>(refSharedContext<T>(name)).get();
+		return get<T>(find(name));
 	}
 
 	/**
-	 * Remove the previously stored object instance of type T.
+	 * Remove the previously stored object instance of the given key.
 	 *
 	 * @note If the TransferOwnership template parameter is set, ContextHub will automatically destroy the object; otherwise
 	 */
+	template <typename T>
+	inline void reset(const Key& key)
+	{
+		if(key.index() < mRawContextObjects.size() && mRawContextObjects[key.index()])
+		{
+			mRawContextObjects[key.index()] = NULL;
+			mSharedContextObjects[key.index()].reset();
+			--mCount;
+		}
+	}
+
 	template <typename T>
 	inline void reset(const std::string& name = typeid(T).name())
 	{
-		refSharedContext<T>(name).reset();
+		reset<T>(find(name));
 	}
 
+	/**
+	 * @return The number of contexts currently stored.
+	 */
 	inline std::size_t size()
 	{
-		return mSharedContextObjects.size();
+		return mCount;
 	}
 
 private:
-	/**
-	 * The magic trick to store and access context object by using static
-	 * initialization to identify the index of a specific type.
-	 *
-	 * @return The reference to the shared pointer
-	 */
-	template <typename T>
-	inline shared_ptr<void>& refSharedContext(const std::string& name)
+	inline shared_ptr<void>& refSharedContext(const Key& key)
 	{
-		std::map< std::string, shared_ptr<void> >::iterator it = mSharedContextObjects.find(name);
-		if(UNLIKELY(it == mSharedContextObjects.end()))
-		{
-			//mSharedContextObjects[name] = shared_ptr<void>();
-			mSharedContextObjects.insert(std::make_pair(name, shared_ptr<void>()));
-			return mSharedContextObjects[name];
-		}
-		else
+		BOOST_ASSERT(key.valid());
+		if(UNLIKELY(key.index() >= mSharedContextObjects.size()))
 		{
-			return it->second;
+			mSharedContextObjects.resize(key.index() + 1);
+			mRawContextObjects.resize(key.index() + 1, NULL);
 		}
+
+		return mSharedContextObjects[key.index()];
 	}
 
-	std::map< std::string, shared_ptr<void> > mSharedContextObjects;
+	std::vector< shared_ptr<void> > mSharedContextObjects;
+	std::vector<void*> mRawContextObjects;
+	std::size_t mCount;
 };
 
 /**
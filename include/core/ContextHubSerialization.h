@@ -21,6 +21,7 @@
 #define ZILLIANS_CONTEXTHUBSERIALIZATION_H_
 
 #include "core/ContextHub.h"
+#include "core/Buffer.h"
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/export.hpp>
 #include <boost/serialization/vector.hpp>
@@ -30,6 +31,11 @@
 #include <boost/mpl/at.hpp>
 #include <boost/mpl/int.hpp>
 #include <boost/mpl/vector.hpp>
+#include <boost/mpl/bool.hpp>
+#include <boost/mpl/if.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/type_traits/is_pointer.hpp>
+#include <boost/type_traits/remove_pointer.hpp>
 
 namespace zillians {
 
@@ -116,6 +122,212 @@ struct ContextHubSerialization
     ContextHubSerializationImpl<boost::mpl::size<Types>::value, Types> t;
 };
 
+namespace detail {
+
+/**
+ * Tell whether T has an intrusive serialize() member usable with the given archive.
+ */
+template<typename T, typename Archive>
+struct has_serialize_member
+{
+	typedef char yes_type;
+	typedef struct { char dummy[2]; } no_type;
+
+	template<typename U, void (U::*)(Archive&, const unsigned int)>
+	struct check;
+
+	template<typename U> static yes_type test(check<U, &U::template serialize<Archive> >*);
+	template<typename U> static no_type test(...);
+
+	enum { value = (sizeof(test<T>(0)) == sizeof(yes_type)) };
+};
+
+struct buffer_archive_tag
+{
+	enum type { builtin, pointer, serializable };
+};
+
+template<typename T, typename Archive>
+struct buffer_archive_dispatch
+{
+	enum { value =
+		boost::is_pointer<T>::value ? buffer_archive_tag::pointer :
+		has_serialize_member<T, Archive>::value ? buffer_archive_tag::serializable :
+		buffer_archive_tag::builtin };
+
+	typedef boost::mpl::int_<value> type;
+};
+
+}
+
+/**
+ * @brief ContextHubBufferOArchive saves serializable structures directly into a Buffer.
+ *
+ * It's a minimal archive adapter for ContextHubSerialization (or anything
+ * else using intrusive serialize()/save()/load() members) which skips the
+ * machinery of boost archives: no RTTI lookup, no object tracking, no class
+ * versioning and no header. Types with a serialize() member are visited
+ * recursively, everything else is written by Buffer::operator<<, so all
+ * types supported by Buffer work as members.
+ *
+ * @code
+ * Buffer buffer;
+ * ContextHubBufferOArchive<Buffer> oa(buffer);
+ * ContextHubSerialization<boost::mpl::vector<Context1, Context2> > serializer(hub);
+ * oa << serializer;
+ * @endcode
+ *
+ * @note Pointers are saved by value with a presence flag, two pointers to the
+ * same object are loaded as two objects.
+ * @note The version passed to serialize() is always 0, and non-intrusive
+ * (free function) serialization is not supported.
+ */
+template<typename BufferType>
+class ContextHubBufferOArchive
+{
+public:
+	typedef boost::mpl::bool_<true> is_saving;
+	typedef boost::mpl::bool_<false> is_loading;
+
+	explicit ContextHubBufferOArchive(BufferType& buffer) : mBuffer(buffer)
+	{ }
+
+public:
+	template<typename T>
+	inline ContextHubBufferOArchive& operator & (const T& v)
+	{
+		save(v, typename detail::buffer_archive_dispatch<T, ContextHubBufferOArchive>::type());
+		return *this;
+	}
+
+	template<typename T>
+	inline ContextHubBufferOArchive& operator & (const boost::serialization::nvp<T>& v)
+	{
+		return *this & v.const_value();
+	}
+
+	template<typename T>
+	inline ContextHubBufferOArchive& operator << (const T& v)
+	{
+		return *this & v;
+	}
+
+	inline BufferType& buffer()
+	{
+		return mBuffer;
+	}
+
+private:
+	template<typename T>
+	inline void save(const T& v, boost::mpl::int_<detail::buffer_archive_tag::builtin>)
+	{
+		mBuffer << v;
+	}
+
+	template<typename T>
+	inline void save(const T& v, boost::mpl::int_<detail::buffer_archive_tag::pointer>)
+	{
+		bool present = (v != NULL);
+		mBuffer << present;
+		if(present)
+			*this & *v;
+	}
+
+	template<typename T>
+	inline void save(const T& v, boost::mpl::int_<detail::buffer_archive_tag::serializable>)
+	{
+		// serialize() is shared with loading so it's not const
+		const_cast<T&>(v).serialize(*this, 0);
+	}
+
+private:
+	BufferType& mBuffer;
+};
+
+/**
+ * @brief ContextHubBufferIArchive loads structures saved by ContextHubBufferOArchive.
+ *
+ * @see ContextHubBufferOArchive
+ */
+template<typename BufferType>
+class ContextHubBufferIArchive
+{
+public:
+	typedef boost::mpl::bool_<false> is_saving;
+	typedef boost::mpl::bool_<true> is_loading;
+
+	explicit ContextHubBufferIArchive(BufferType& buffer) : mBuffer(buffer)
+	{ }
+
+public:
+	template<typename T>
+	inline ContextHubBufferIArchive& operator & (T& v)
+	{
+		load(v, typename detail::buffer_archive_dispatch<T, ContextHubBufferIArchive>::type());
+		return *this;
+	}
+
+	template<typename T>
+	inline ContextHubBufferIArchive& operator & (const boost::serialization::nvp<T>& v)
+	{
+		return *this & v.value();
+	}
+
+	template<typename T>
+	inline ContextHubBufferIArchive& operator >> (T& v)
+	{
+		return *this & v;
+	}
+
+	inline BufferType& buffer()
+	{
+		return mBuffer;
+	}
+
+private:
+	template<typename T>
+	inline void load(T& v, boost::mpl::int_<detail::buffer_archive_tag::builtin>)
+	{
+		mBuffer >> v;
+	}
+
+	template<typename T>
+	inline void load(T& v, boost::mpl::int_<detail::buffer_archive_tag::pointer>)
+	{
+		typedef typename boost::remove_pointer<T>::type value_type;
+
+		bool present = false;
+		mBuffer >> present;
+		if(present)
+		{
+			value_type* p = new value_type;
+			try
+			{
+				*this & *p;
+			}
+			catch(...)
+			{
+				SAFE_DELETE(p);
+				throw;
+			}
+			v = p;
+		}
+		else
+		{
+			v = NULL;
+		}
+	}
+
+	template<typename T>
+	inline void load(T& v, boost::mpl::int_<detail::buffer_archive_tag::serializable>)
+	{
+		v.serialize(*this, 0);
+	}
+
+private:
+	BufferType& mBuffer;
+};
+
 }
 
 //BOOST_CLASS_EXPORT_GUID(zillians::ContextHubSerializationBase, "ContextHubSerializationBase")
@@ -0,0 +1,252 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * Based on the fine-grained eventcount by Dmitriy S. V'jukov.
+ */
+
+#ifndef ZILLIANS_EVENTCOUNT_H_
+#define ZILLIANS_EVENTCOUNT_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include "core/Semaphore.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/thread_time.hpp>
+
+namespace zillians {
+
+/**
+ * @brief EventCount lets threads block on an arbitrary lock-free condition.
+ *
+ * A waiter registers with prepare_wait(), re-checks its condition, and then
+ * either calls retire_wait() if the condition holds or wait() otherwise. A
+ * notifier changes the condition and calls notify_one() or notify_all(). When
+ * no thread is waiting, notifying costs a fence and an atomic load.
+ *
+ * @code
+ * while(!queue.pop(x))
+ * {
+ *     ec.prepare_wait();
+ *     if(queue.pop(x)) { ec.retire_wait(); break; }
+ *     ec.wait();
+ * }
+ * @endcode
+ *
+ * @note A thread can only wait on one EventCount at a time.
+ */
+class EventCount
+{
+public:
+	EventCount() : epoch(0), waiters(0)
+	{
+		waitset.prev = waitset.next = &waitset;
+	}
+
+public:
+	void prepare_wait()
+	{
+		Waiter* w = Waiter::current();
+		// pump the post of a previous notification we have given up on
+		if(w->spurious)
+		{
+			w->spurious = false;
+			w->sema.wait();
+		}
+
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			w->in_waitset = true;
+			w->epoch = epoch.load(std::memory_order_relaxed);
+			link(w);
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void wait()
+	{
+		Waiter* w = Waiter::current();
+		if(w->epoch == epoch.load(std::memory_order_relaxed))
+			w->sema.wait();
+		else
+			retire_wait();
+	}
+
+	/**
+	 * @brief Wait until notified or the absolute time is reached.
+	 *
+	 * @return False on timeout.
+	 */
+	bool timed_wait(const boost::system_time& absolute)
+	{
+		Waiter* w = Waiter::current();
+		if(w->epoch != epoch.load(std::memory_order_relaxed))
+		{
+			retire_wait();
+			return true;
+		}
+
+		if(w->sema.timed_wait(absolute))
+			return true;
+
+		retire_wait();
+		return false;
+	}
+
+	/**
+	 * @brief Leave the waitset without waiting.
+	 */
+	void retire_wait()
+	{
+		Waiter* w = Waiter::current();
+		// if a notifier already took us from the waitset, its post is pumped by the next prepare_wait()
+		boost::mutex::scoped_lock lock(mutex);
+		if(w->in_waitset)
+		{
+			w->in_waitset = false;
+			unlink(w);
+		}
+		else
+		{
+			w->spurious = true;
+		}
+	}
+
+	void notify_one()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiters.load(std::memory_order_relaxed) == 0)
+			return;
+
+		Waiter* w = NULL;
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			epoch.fetch_add(1, std::memory_order_relaxed);
+			if(waitset.next != &waitset)
+			{
+				w = static_cast<Waiter*>(waitset.next);
+				w->in_waitset = false;
+				unlink(w);
+			}
+		}
+		if(w)
+			w->sema.post();
+	}
+
+	void notify_all()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiters.load(std::memory_order_relaxed) == 0)
+			return;
+
+		Node woken;
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			epoch.fetch_add(1, std::memory_order_relaxed);
+			if(waitset.next == &waitset)
+				return;
+
+			woken.next = waitset.next;
+			woken.prev = waitset.prev;
+			woken.next->prev = woken.prev->next = &woken;
+			waitset.prev = waitset.next = &waitset;
+			waiters.store(0, std::memory_order_relaxed);
+
+			for(Node* n = woken.next; n != &woken; n = n->next)
+				static_cast<Waiter*>(n)->in_waitset = false;
+		}
+
+		// the waiter may be gone once posted, so move on before posting
+		for(Node* n = woken.next; n != &woken; )
+		{
+			Waiter* w = static_cast<Waiter*>(n);
+			n = n->next;
+			w->sema.post();
+		}
+	}
+
+private:
+	struct Node
+	{
+		Node* prev;
+		Node* next;
+	};
+
+	/**
+	 * Per-thread wait descriptor, shared by all EventCount instances.
+	 */
+	struct Waiter : Node
+	{
+		Waiter() : epoch(0), in_waitset(false), spurious(false)
+		{ }
+
+		~Waiter()
+		{
+			// wait for the pending post so the semaphore outlives its notifier
+			if(spurious)
+				sema.wait();
+		}
+
+		static Waiter* current()
+		{
+			static boost::thread_specific_ptr<Waiter> instance;
+			Waiter* w = instance.get();
+			if(UNLIKELY(!w))
+			{
+				w = new Waiter;
+				instance.reset(w);
+			}
+			return w;
+		}
+
+		Semaphore sema;
+		unsigned epoch;
+		bool in_waitset;	///< Guarded by the mutex of the EventCount being waited
+		bool spurious;
+	};
+
+	void link(Waiter* w)
+	{
+		w->next = waitset.next;
+		w->prev = &waitset;
+		waitset.next->prev = w;
+		waitset.next = w;
+		waiters.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void unlink(Waiter* w)
+	{
+		w->prev->next = w->next;
+		w->next->prev = w->prev;
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+private:
+	boost::mutex mutex;
+	Node waitset;
+	std::atomic<unsigned> epoch;
+	std::atomic<std::size_t> waiters;
+
+	EventCount(EventCount const&);
+	void operator= (EventCount const&);
+};
+
+}
+
+#endif /* ZILLIANS_EVENTCOUNT_H_ */
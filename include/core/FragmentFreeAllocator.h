@@ -30,18 +30,30 @@
 #include <boost/assert.hpp>
 #include <boost/function.hpp>
 #include <boost/bind/arg.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+#include <atomic>
+#include <vector>
 
 #define ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_OBJECT_POOL				1
 #define ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_CONCURRENT_ALLOCATION		1
 
 namespace zillians {
 
+class AllocationTracer;
+class FragmentBlock;
+
 /**
  * @brief (Internal Use) The pointer wrapper to facilitate defragment operator.
  *
  * Since we store the real data pointer inside FragmentPointer, upon
  * defragment, we can easily update the pointer location by changing the
  * data in the FragmentPointer.
+ *
+ * The FragmentPointer also refers back to its FragmentBlock, so the allocator
+ * can find the block in constant time without keeping a side table (the
+ * pool memory may not even be accessible from host, so there's no header
+ * stored next to the data).
  */
 struct FragmentPointer
 #if ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_OBJECT_POOL
@@ -52,10 +64,11 @@ struct FragmentPointer
 #endif
 #endif
 {
-	FragmentPointer(byte* p) : data(p)
+	FragmentPointer(byte* p) : data(p), block(NULL)
 	{ }
 
 	byte* data;
+	FragmentBlock* block;
 };
 
 /**
@@ -66,6 +79,11 @@ struct FragmentPointer
  * free memory block. Each memory allocation in FragmentAllocator creates
  * a FragmentPointer pointint to the actual memory, enclosed by a
  * corresponding FragmentBlock.
+ *
+ * Free blocks are linked by nextFree/prevFree into the free list of their
+ * size class, and all blocks are linked by nextBlock/prevBlock in address order.
+ * Allocated blocks waiting to be freed by their allocator (see
+ * FragmentAllocator::deallocateDeferred()) are linked by nextFree instead.
  */
 class FragmentBlock
 #if ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_OBJECT_POOL
@@ -191,34 +209,156 @@ public:
 	bool allocate(MutablePointer **pointer, std::size_t size);
 	bool deallocate(MutablePointer  *pointer);
 
-	inline size_t total();
-	inline size_t used();
-	inline size_t available();
+	/**
+	 * @brief Deallocate without taking the allocation lock.
+	 *
+	 * The MutablePointer is destroyed right away, while its block is pushed onto a lock-free
+	 * list and released by the next allocate(), compaction or drainDeferred(). It's meant
+	 * for threads other than the ones allocating from the allocator, which would otherwise
+	 * contend on the lock.
+	 */
+	bool deallocateDeferred(MutablePointer *pointer);
+
+	/**
+	 * @brief Release the blocks of all deferred deallocations.
+	 */
+	void drainDeferred();
+
+	inline size_t total()
+	{
+		return mConfiguredChunkSize * mConfiguredNumChunks;
+	}
+
+	inline size_t used()
+	{
+		return mAllocatedSize;
+	}
+
+	inline size_t available()
+	{
+		return total() - used();
+	}
 
 	bool isValid(MutablePointer *ptr);
 	size_t infoSize(MutablePointer *ptr);
 
 	void debug();
 
+	/**
+	 * @brief Record all allocations and deallocations into the given tracer, or stop recording if NULL.
+	 *
+	 * Allocations are identified by their MutablePointer, which stays the same when
+	 * defragmentation relocates the memory.
+	 */
+	inline void setTracer(AllocationTracer* tracer)
+	{
+		mTracer = tracer;
+	}
+
 private:
-	typedef std::map<FragmentPointer*, FragmentBlock*> PointerToBlockMap;
+	/**
+	 * Free blocks are segregated by size, where class i holds blocks of
+	 * [2^i, 2^(i+1)) chunks, so allocation only scans blocks of similar size.
+	 */
+	enum { FREE_CLASS_COUNT = sizeof(std::size_t) * 8 };
+
+	std::size_t getFreeClass(std::size_t size);
+	FragmentBlock* findFreeBlock(std::size_t size);
+	void insertFreeBlock(FragmentBlock* block);
+	void removeFreeBlock(FragmentBlock* block);
 
+	void releaseBlock(FragmentBlock* block);
+	void releaseDeferredBlocks();// must hold the allocation lock
+
+private:
 	size_t mConfiguredChunkSize;
 	size_t mConfiguredNumChunks;
 
 	size_t mAllocatedSize;
 	byte* mDeviceBasePointer;
 
-	FragmentBlock* mFragmentBlockHeadFree;
+	FragmentBlock* mFragmentBlockHeadFree[FREE_CLASS_COUNT];
+	std::size_t mFreeClassMask;	///< Bit i is set if the free list of class i is not empty
 	FragmentBlock* mFragmentBlockHead;
 
-	PointerToBlockMap   mPointerToBlockMap;
+	AllocationTracer* mTracer;
+	std::atomic<FragmentBlock*> mDeferredBlocks;	///< Blocks of deferred deallocations, linked by nextFree
 
 #if ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_CONCURRENT_ALLOCATION
 	tbb::mutex mAllocationLock;
 #endif
 };
 
+/**
+ * @brief ConcurrentFragmentAllocator is a FragmentAllocator striped into regions for concurrent use.
+ *
+ * The pool is split into equally sized regions, each being a FragmentAllocator with its own
+ * lock. Every thread allocates from its home region, picked round robin on first use, and
+ * falls back to the other regions in turn when the home region is full, so threads only
+ * contend when there are more of them than regions. Deallocation never takes a lock, the
+ * block is handed back to its region by FragmentAllocator::deallocateDeferred() and released
+ * by the next allocation from the region.
+ *
+ * Blocks never leave their region, so MutablePointer's keep working the same way and
+ * FragmentFreeOperator compacts the regions one at a time.
+ *
+ * @note A single allocation can't be larger than a region.
+ */
+class ConcurrentFragmentAllocator : public boost::noncopyable
+{
+public:
+	/**
+	 * @param pool The pool memory.
+	 * @param size The size of the pool memory.
+	 * @param regionCount The number of regions, or 0 for one per hardware thread.
+	 */
+	ConcurrentFragmentAllocator(byte* pool, std::size_t size, std::size_t regionCount = 0);
+	~ConcurrentFragmentAllocator();
+
+	bool allocate(MutablePointer **pointer, std::size_t size);
+	bool deallocate(MutablePointer  *pointer);
+
+	size_t total();
+	size_t used();
+
+	inline size_t available()
+	{
+		return total() - used();
+	}
+
+	bool isValid(MutablePointer *ptr);
+	size_t infoSize(MutablePointer *ptr);
+
+	/**
+	 * @brief Release the blocks of all deferred deallocations, so used() is exact.
+	 */
+	void drainDeferred();
+
+	void setTracer(AllocationTracer* tracer);
+
+	inline std::size_t getRegionCount() const
+	{
+		return mRegions.size();
+	}
+
+	inline FragmentAllocator& getRegion(std::size_t index)
+	{
+		return *mRegions[index];
+	}
+
+private:
+	std::size_t getHomeRegion();
+	FragmentAllocator* getOwnerRegion(MutablePointer* pointer);
+
+private:
+	byte* mPool;
+	std::size_t mRegionSize;
+	std::vector<FragmentAllocator*> mRegions;
+
+	std::atomic<std::size_t> mNextHomeRegion;
+	boost::thread_specific_ptr<std::size_t> mHomeRegion;	///< TLS storing the home region of current thread
+};
+
 class FragmentFreeOperator
 {
 public:
@@ -240,12 +380,52 @@ public:
 		}
 	};
 
-	FragmentFreeOperator(boost::function< void(void*,void*,std::size_t) > copyFunctor);
-
+	/**
+	 * @brief Create the operator with the copy functor and an optional relocation callback.
+	 *
+	 * @param copyFunctor Called as (dst, src, size) to move a memory block, which must support
+	 * overlapped copy (i.e. memmove() or cudaMemcpy() on device memory).
+	 * @param relocationCallback Called as (oldData, newData, size) after a memory block is moved
+	 * and its FragmentPointer is updated, so anything caching the raw address can be fixed up.
+	 */
+	FragmentFreeOperator(boost::function< void(void*,void*,std::size_t) > copyFunctor,
+			boost::function< void(byte*,byte*,std::size_t) > relocationCallback = boost::function< void(byte*,byte*,std::size_t) >());
+
+	/**
+	 * @brief Defragment the whole allocator, so all free space is merged at the end of the pool.
+	 */
 	bool operator() (FragmentAllocator& allocator);
 
+	/**
+	 * @brief Incrementally defragment the allocator by sliding allocated blocks toward the
+	 * start of the pool.
+	 *
+	 * Each step moves the first allocated block after the first free block down into the free
+	 * space, so no state is kept between calls and allocations/deallocations may happen in
+	 * between. The call stops once the moved bytes reach the budget, which is exceeded by at
+	 * most one block to always make progress.
+	 *
+	 * @param allocator The allocator to be compacted.
+	 * @param budget The maximum number of bytes to move in this call.
+	 *
+	 * @return True if the allocator is fully compacted, false if there's more to move.
+	 */
+	bool compact(FragmentAllocator& allocator, std::size_t budget);
+
+	/**
+	 * @brief Defragment all regions of the concurrent allocator.
+	 */
+	bool operator() (ConcurrentFragmentAllocator& allocator);
+
+	/**
+	 * @brief Incrementally defragment all regions of the concurrent allocator, with the budget
+	 * split evenly among regions.
+	 */
+	bool compact(ConcurrentFragmentAllocator& allocator, std::size_t budget);
+
 private:
 	boost::function< void(void*,void*,std::size_t) > mCopyFunctor;
+	boost::function< void(byte*,byte*,std::size_t) > mRelocationCallback;
 };
 
 }
@@ -0,0 +1,168 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_FUTEX_H_
+#define ZILLIANS_FUTEX_H_
+
+#include "core/Common.h"
+#include <boost/static_assert.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <atomic>
+#include <climits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#elif defined(WIN32)
+#include <windows.h>	// WaitOnAddress() needs _WIN32_WINNT >= 0x0602 (Windows 8)
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#endif
+
+namespace zillians { namespace futex {
+
+/**
+ * Futex lets a thread sleep on a 32-bit atomic word until another thread changes the
+ * word and wakes it, so synchronization primitives only enter the kernel when there's
+ * really someone to wait for or to wake up.
+ *
+ * It's the Linux futex, WaitOnAddress() on Windows, and a small table of mutex and
+ * condition pairs hashed by address on other platforms.
+ *
+ * Like the Linux futex, wait() may return spuriously, so callers must re-check the word
+ * in a loop. The waker must change the word before calling wake().
+ *
+ * Words in memory shared by several processes must be waited and woken with process_shared
+ * set. That's only supported by the Linux futex, elsewhere such a waiter is only woken by
+ * its timeout, so it must give one.
+ */
+
+#if !defined(__linux__) && !defined(WIN32)
+namespace detail {
+
+struct parking_bucket
+{
+	boost::mutex mutex;
+	boost::condition_variable condition;
+};
+
+inline parking_bucket& bucket_of(const volatile void* address)
+{
+	static parking_bucket buckets[64];
+	return buckets[(reinterpret_cast<uintptr_t>(address) >> 4) % 64];
+}
+
+}
+#endif
+
+/**
+ * @brief Sleep while the word still holds the expected value.
+ *
+ * @param absolute The time to give up, or NULL to wait forever.
+ * @param process_shared True if the word lives in memory shared with other processes.
+ *
+ * @return False on timeout, true if woken up, spuriously or because the word didn't hold the expected value.
+ */
+template<typename T>
+inline bool wait(std::atomic<T>& word, T expected, const boost::system_time* absolute = NULL, bool process_shared = false)
+{
+	BOOST_STATIC_ASSERT(sizeof(std::atomic<T>) == 4);
+#if defined(__linux__)
+	timespec ts;
+	timespec* pts = NULL;
+	if(absolute)
+	{
+		boost::posix_time::time_duration since_epoch = *absolute - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+		ts.tv_sec = since_epoch.total_seconds();
+		ts.tv_nsec = since_epoch.fractional_seconds() * (1000000000 / boost::posix_time::time_duration::ticks_per_second());
+		pts = &ts;
+	}
+
+	// the bitset variant takes an absolute time on the realtime clock, just like boost::system_time
+	long result = syscall(SYS_futex, reinterpret_cast<uint32*>(&word), (process_shared ? FUTEX_WAIT_BITSET : FUTEX_WAIT_BITSET_PRIVATE) | FUTEX_CLOCK_REALTIME, uint32(expected), pts, NULL, FUTEX_BITSET_MATCH_ANY);
+	return !(result == -1 && errno == ETIMEDOUT);
+#elif defined(WIN32)
+	UNUSED_ARGUMENT(process_shared);
+	DWORD milliseconds = INFINITE;
+	if(absolute)
+	{
+		boost::system_time now = boost::get_system_time();
+		milliseconds = (*absolute > now) ? static_cast<DWORD>((*absolute - now).total_milliseconds()) : 0;
+	}
+
+	if(WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(T), milliseconds))
+		return true;
+	return GetLastError() != ERROR_TIMEOUT;
+#else
+	UNUSED_ARGUMENT(process_shared);
+	detail::parking_bucket& bucket = detail::bucket_of(&word);
+	boost::mutex::scoped_lock lock(bucket.mutex);
+	if(word.load(std::memory_order_relaxed) != expected)
+		return true;
+	if(!absolute)
+	{
+		bucket.condition.wait(lock);
+		return true;
+	}
+	return bucket.condition.timed_wait(lock, *absolute);
+#endif
+}
+
+/**
+ * @brief Wake up at most the given number of threads sleeping on the word.
+ */
+template<typename T>
+inline void wake(std::atomic<T>& word, uint32 count, bool process_shared = false)
+{
+	BOOST_STATIC_ASSERT(sizeof(std::atomic<T>) == 4);
+#if defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<uint32*>(&word), process_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, (count > uint32(INT_MAX)) ? INT_MAX : int(count), NULL, NULL, 0);
+#elif defined(WIN32)
+	UNUSED_ARGUMENT(process_shared);
+	if(count == 1)
+		WakeByAddressSingle(reinterpret_cast<PVOID>(&word));
+	else
+		WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#else
+	// the bucket is shared by other words, so everyone has to re-check
+	UNUSED_ARGUMENT(count);
+	UNUSED_ARGUMENT(process_shared);
+	detail::parking_bucket& bucket = detail::bucket_of(&word);
+	boost::mutex::scoped_lock lock(bucket.mutex);
+	bucket.condition.notify_all();
+#endif
+}
+
+/**
+ * @brief Wake up all threads sleeping on the word.
+ */
+template<typename T>
+inline void wake_all(std::atomic<T>& word, bool process_shared = false)
+{
+	wake(word, uint32(INT_MAX), process_shared);
+}
+
+} }
+
+#endif /* ZILLIANS_FUTEX_H_ */
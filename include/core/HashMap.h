@@ -26,15 +26,19 @@
 
 #include <map>
 #include "tbb/concurrent_hash_map.h"
+#include "utility/HashUtil.h"
 
 namespace zillians {
 
+/**
+ * Hash compare of raw pointers, the address is mixed since alignment leaves its low bits zero.
+ */
 template <typename T>
 struct PointerHashCompare
 {
     static size_t hash( const T& x )
     {
-    	return reinterpret_cast<size_t>(x);
+    	return HashUtil::hashPointer(x);
     }
     static bool equal( const T& x, const T& y )
     {
@@ -47,7 +51,7 @@ struct SharedPointerHashCompare
 {
     static size_t hash( const T& x )
     {
-    	return reinterpret_cast<size_t>(x.get());
+    	return HashUtil::hashPointer(x.get());
     }
     static bool equal( const T& x, const T& y )
     {
@@ -0,0 +1,192 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_HAZARDPOINTER_H_
+#define ZILLIANS_HAZARDPOINTER_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include <atomic>
+#include <boost/thread/tss.hpp>
+#include <algorithm>
+#include <vector>
+
+#define ZILLIANS_HAZARD_POINTER_SLOTS		2
+#define ZILLIANS_HAZARD_POINTER_SCAN_SIZE	64
+
+namespace zillians {
+
+/**
+ * @brief HazardPointer provides safe memory reclamation for lock-free containers.
+ *
+ * Before dereferencing a shared pointer, a thread publishes it with protect();
+ * nodes unlinked from a container are given to retire() and only deleted once
+ * no thread has them published. This is Maged Michael's hazard pointer scheme,
+ * with a single process-wide set of per-thread records, so retired nodes may
+ * outlive the container they came from.
+ *
+ * @note Each thread has ZILLIANS_HAZARD_POINTER_SLOTS slots, a container
+ * operation must clear() its slots before returning.
+ */
+class HazardPointer
+{
+public:
+	/**
+	 * @brief Publish the current value of src in the given slot and return it.
+	 */
+	template<typename T>
+	static T* protect(const std::atomic<T*>& src, int slot = 0)
+	{
+		std::atomic<void*>& hazard = current()->hazards[slot];
+		T* p = src.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			hazard.store(p, std::memory_order_seq_cst);
+			T* q = src.load(std::memory_order_seq_cst);
+			if(LIKELY(p == q))
+				return p;
+			p = q;
+		}
+	}
+
+	static void clear(int slot = 0)
+	{
+		current()->hazards[slot].store(NULL, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Delete p once no thread has it published.
+	 *
+	 * @note p must already be unreachable from the container.
+	 */
+	template<typename T>
+	static void retire(T* p)
+	{
+		Record* r = current();
+		r->retired.push_back(Retired(p, &deleter<T>));
+		if(r->retired.size() >= ZILLIANS_HAZARD_POINTER_SCAN_SIZE)
+			scan(r);
+	}
+
+private:
+	struct Retired
+	{
+		Retired(void* p, void (*d)(void*)) : pointer(p), deleter(d)
+		{ }
+
+		void* pointer;
+		void (*deleter)(void*);
+	};
+
+	struct Record
+	{
+		Record() : next(NULL)
+		{
+			for(int i = 0; i < ZILLIANS_HAZARD_POINTER_SLOTS; ++i)
+				hazards[i].store(NULL, std::memory_order_relaxed);
+			active.store(true, std::memory_order_relaxed);
+		}
+
+		std::atomic<void*> hazards[ZILLIANS_HAZARD_POINTER_SLOTS];
+		std::atomic<bool> active;
+		Record* next;
+		std::vector<Retired> retired;	///< Only touched by the owning thread
+	};
+
+	template<typename T>
+	static void deleter(void* p)
+	{
+		delete static_cast<T*>(p);
+	}
+
+	static std::atomic<Record*>& records()
+	{
+		// records are never freed, a record released by an exiting thread is reused along with its retired nodes
+		static std::atomic<Record*> head(NULL);
+		return head;
+	}
+
+	static void release(Record* r)
+	{
+		for(int i = 0; i < ZILLIANS_HAZARD_POINTER_SLOTS; ++i)
+			r->hazards[i].store(NULL, std::memory_order_relaxed);
+		scan(r);
+		r->active.store(false, std::memory_order_release);
+	}
+
+	static Record* current()
+	{
+		static boost::thread_specific_ptr<Record> instance(&HazardPointer::release);
+		Record* r = instance.get();
+		if(UNLIKELY(!r))
+		{
+			r = acquire();
+			instance.reset(r);
+		}
+		return r;
+	}
+
+	static Record* acquire()
+	{
+		for(Record* r = records().load(std::memory_order_acquire); r; r = r->next)
+		{
+			bool expected = false;
+			if(!r->active.load(std::memory_order_relaxed) && r->active.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return r;
+		}
+
+		Record* r = new Record;
+		Record* head = records().load(std::memory_order_relaxed);
+		do
+		{
+			r->next = head;
+		} while(!records().compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+		return r;
+	}
+
+	static void scan(Record* owner)
+	{
+		std::vector<void*> hazards;
+		for(Record* r = records().load(std::memory_order_acquire); r; r = r->next)
+		{
+			for(int i = 0; i < ZILLIANS_HAZARD_POINTER_SLOTS; ++i)
+			{
+				void* p = r->hazards[i].load(std::memory_order_seq_cst);
+				if(p)
+					hazards.push_back(p);
+			}
+		}
+		std::sort(hazards.begin(), hazards.end());
+
+		std::size_t kept = 0;
+		for(std::size_t i = 0; i < owner->retired.size(); ++i)
+		{
+			Retired& retired = owner->retired[i];
+			if(std::binary_search(hazards.begin(), hazards.end(), retired.pointer))
+				owner->retired[kept++] = retired;
+			else
+				retired.deleter(retired.pointer);
+		}
+		owner->retired.erase(owner->retired.begin() + kept, owner->retired.end());
+	}
+};
+
+}
+
+#endif /* ZILLIANS_HAZARDPOINTER_H_ */
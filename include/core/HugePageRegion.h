@@ -0,0 +1,111 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_HUGEPAGEREGION_H_
+#define ZILLIANS_HUGEPAGEREGION_H_
+
+#include "core/Prerequisite.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace zillians {
+
+/**
+ * @brief HugePageRegion maps a private anonymous region backed by huge pages if possible.
+ *
+ * Random access over a big region backed by 4KB pages misses the TLB all the time, a 2MB
+ * page covers 512 times the memory per TLB entry. The region tries the preferred page size
+ * first and falls back to smaller ones:
+ *
+ * 1GB hugetlb pages -> 2MB hugetlb pages -> transparent huge pages (madvise) -> normal pages
+ *
+ * hugetlb pages come from the pool reserved by the administrator (vm.nr_hugepages), and are
+ * reserved when the region is mapped, so a region either gets all its pages or falls back.
+ * Transparent huge pages need "madvise" or "always" in /sys/kernel/mm/transparent_hugepage/enabled
+ * and are given on first touch if the kernel finds free 2MB ranges.
+ *
+ * The region is aligned to the huge page size in all cases except normal pages, so the
+ * 16KB blocks of ScalablePoolAllocator, which are aligned to their size, never cross a
+ * huge page:
+ *
+ * @code
+ * HugePageRegion region(1024 * 1024 * 1024);
+ * ScalablePoolAllocator pool(region.data(), region.size());
+ * @endcode
+ *
+ * @note Don't call ScalablePoolAllocator::trim() on hugetlb backed pools, hugetlb pages
+ * can only be given back as a whole. It's fine for transparent huge pages, which the
+ * kernel splits as needed.
+ */
+class HugePageRegion : public boost::noncopyable
+{
+public:
+	enum Backing
+	{
+		NORMAL_PAGES,
+		TRANSPARENT_HUGE_PAGES,
+		HUGE_PAGES_2MB,
+		HUGE_PAGES_1GB,
+	};
+
+	/**
+	 * @brief Map the region with the largest page size up to the preferred one.
+	 *
+	 * @param size The size of the region, rounded up to the page size finally used.
+	 * @param preferred The largest page size to try.
+	 *
+	 * @throw std::runtime_error if the region can't be mapped even with normal pages.
+	 */
+	HugePageRegion(std::size_t size, Backing preferred = HUGE_PAGES_2MB);
+	~HugePageRegion();
+
+public:
+	inline byte* data() const
+	{ return mData; }
+
+	inline std::size_t size() const
+	{ return mSize; }
+
+	/**
+	 * @brief Get the kind of pages backing the region.
+	 */
+	inline Backing backing() const
+	{ return mBacking; }
+
+	/**
+	 * @brief Get the page size the region is aligned to.
+	 */
+	inline std::size_t pageSize() const
+	{ return mPageSize; }
+
+private:
+	bool mapHugeTLB(std::size_t size, std::size_t pageSize, int pageShift);
+	bool mapTransparent(std::size_t size);// the region is mapped even if huge pages are not available
+	void mapNormal(std::size_t size);
+
+private:
+	byte* mData;
+	std::size_t mSize;
+	std::size_t mPageSize;
+	Backing mBacking;
+};
+
+}
+
+#endif/*ZILLIANS_HUGEPAGEREGION_H_*/
@@ -0,0 +1,345 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_INDEXEDMESSAGE_H_
+#define ZILLIANS_INDEXEDMESSAGE_H_
+
+#include "core/Buffer.h"
+#include <boost/static_assert.hpp>
+#include <stdexcept>
+#include <vector>
+#include <tuple>
+
+namespace zillians {
+
+/**
+ * @brief Field type of IndexedMessage, a std::vector<T> whose elements can be decoded one by one.
+ */
+template<typename T>
+struct Indexed
+{ };
+
+namespace detail {
+
+template<typename T>
+struct indexed_field
+{
+	enum { indexed = 0 };
+	typedef T type;
+	typedef T element_type;
+
+	template<typename Buffer>
+	static inline void write(Buffer& buffer, const T& value)
+	{
+		buffer << value;
+	}
+
+	template<typename Buffer>
+	static inline void read(Buffer& buffer, T& value)
+	{
+		buffer >> value;
+	}
+};
+
+template<typename T>
+struct indexed_field<Indexed<T> >
+{
+	enum { indexed = 1 };
+	typedef std::vector<T> type;
+	typedef T element_type;
+
+	template<typename Buffer>
+	static inline void write(Buffer& buffer, const std::vector<T>& value);
+
+	template<typename Buffer>
+	static inline void read(Buffer& buffer, std::vector<T>& value)
+	{
+		uint32 count;
+		buffer.readOrdered(count);
+		buffer.rskip((count + 1) * sizeof(uint32));
+
+		value.resize(count);
+		for(uint32 i = 0; i < count; ++i)
+			buffer >> value[i];
+	}
+};
+
+/**
+ * Back-patch the i-th entry of an offset table at the given mark (relative to the read pointer).
+ */
+template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+inline void patch_indexed_offset(BufferBase<Mode, Concurrency, Encoding, Checksum>& buffer, std::size_t mark, std::size_t i, std::size_t offset)
+{
+	BufferBase<BufferMode::plain, BufferConcurrency::none, Encoding> patch(buffer.rptr() + mark + i * sizeof(uint32), sizeof(uint32));
+	patch.writeOrdered((uint32)offset);
+}
+
+template<typename T>
+template<typename Buffer>
+inline void indexed_field<Indexed<T> >::write(Buffer& buffer, const std::vector<T>& value)
+{
+	std::size_t mark = buffer.dataSize();
+	std::size_t count = value.size();
+
+	buffer.writeOrdered((uint32)count);
+	for(std::size_t i = 0; i <= count; ++i)
+		buffer.writeOrdered((uint32)0);
+
+	// patch each entry as the element is written, the buffer may grow in between
+	std::size_t table = mark + sizeof(uint32);
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		patch_indexed_offset(buffer, table, i, buffer.dataSize() - mark);
+		buffer << value[i];
+	}
+	patch_indexed_offset(buffer, table, count, buffer.dataSize() - mark);
+}
+
+}
+
+/**
+ * @brief IndexedMessage is an encoding of large messages which can be decoded field by field.
+ *
+ * operator>> decodes a message sequentially, so getting the last field means decoding
+ * every field before it. IndexedMessage writes a table of field offsets after the
+ * header, and View jumps to the requested field without touching the others. A field
+ * declared as Indexed<T> is a std::vector<T> with its own table of element offsets,
+ * so View::vectorAt() decodes a single element of it.
+ *
+ * The wire layout, with all offsets in uint32 relative to the start of their table owner:
+ *
+ * @code
+ * [field count][offset of field 0]...[offset of field N-1][end offset][field 0]...[field N-1]
+ * Indexed<T> field: [element count][offset of element 0]...[end offset][element 0]...
+ * @endcode
+ *
+ * @code
+ * typedef IndexedMessage<uint32, std::string, Indexed<EntityState> > Snapshot;
+ * Snapshot::write(buffer, frame, name, entities);
+ * ...
+ * Snapshot::View<> snapshot(buffer);
+ * EntityState e = snapshot.vectorAt<2>(42);// nothing else is decoded
+ * buffer.rskip(snapshot.size());
+ * @endcode
+ *
+ * @note Offsets are patched in place after the fields are written, so the buffer must be
+ * plain, single-threaded and without checksum, like the one used by beginLengthPrefix().
+ * Views need the whole message in contiguous memory.
+ */
+template<typename... Fields>
+class IndexedMessage
+{
+public:
+	enum
+	{
+		FIELD_COUNT = sizeof...(Fields),
+		HEADER_SIZE = sizeof(uint32) * (sizeof...(Fields) + 2),
+	};
+
+	template<std::size_t N>
+	struct field
+	{
+		typedef typename std::tuple_element<N, std::tuple<Fields...> >::type declared_type;
+		typedef typename detail::indexed_field<declared_type>::type type;
+		typedef typename detail::indexed_field<declared_type>::element_type element_type;
+		enum { indexed = detail::indexed_field<declared_type>::indexed };
+	};
+
+public:
+	/**
+	 * @brief Write a message with all its fields and the offset tables.
+	 *
+	 * @return The size of the message.
+	 */
+	template<BufferMode::type Mode, BufferConcurrency::type Concurrency, BufferEncoding::type Encoding, BufferChecksum::type Checksum>
+	static std::size_t write(BufferBase<Mode, Concurrency, Encoding, Checksum>& buffer, const typename detail::indexed_field<Fields>::type&... values)
+	{
+		BOOST_STATIC_ASSERT(Mode == BufferMode::plain && Concurrency == BufferConcurrency::none && Checksum == BufferChecksum::none);
+
+		std::size_t mark = buffer.dataSize();
+
+		buffer.writeOrdered((uint32)FIELD_COUNT);
+		for(std::size_t i = 0; i <= FIELD_COUNT; ++i)
+			buffer.writeOrdered((uint32)0);
+
+		// braced initializers are evaluated in order, so fields are written as declared
+		std::size_t table = mark + sizeof(uint32);
+		std::size_t i = 0;
+		int sequence[] = { 0, (detail::patch_indexed_offset(buffer, table, i++, buffer.dataSize() - mark), detail::indexed_field<Fields>::write(buffer, values), 0)... };
+		UNUSED_ARGUMENT(sequence);
+
+		std::size_t size = buffer.dataSize() - mark;
+		detail::patch_indexed_offset(buffer, table, FIELD_COUNT, size);
+
+		return size;
+	}
+
+	/**
+	 * @brief View decodes fields of a message in place, on request.
+	 *
+	 * Only the header is decoded on construction. The memory must outlive the view.
+	 */
+	template<BufferEncoding::type Encoding = BufferEncoding::fixed>
+	class View
+	{
+	public:
+		typedef BufferBase<BufferMode::plain, BufferConcurrency::none, Encoding> view_type;
+
+		/**
+		 * @brief View the message at the beginning of the given memory.
+		 *
+		 * @param data The message, there may be more data after it.
+		 * @param size The size of the memory.
+		 */
+		View(const byte* data, std::size_t size) : mData(data)
+		{
+			init(size);
+		}
+
+		/**
+		 * @brief View the message at the read pointer of the given buffer without consuming it.
+		 */
+		template<BufferConcurrency::type Concurrency, BufferChecksum::type Checksum>
+		explicit View(const BufferBase<BufferMode::plain, Concurrency, Encoding, Checksum>& buffer) : mData(buffer.rptr())
+		{
+			init(buffer.dataSize());
+		}
+
+	public:
+		/**
+		 * @brief Get the size of the whole message, including the header.
+		 */
+		inline std::size_t size() const
+		{
+			return mOffsets[FIELD_COUNT];
+		}
+
+		/**
+		 * @brief Get the encoded size of the N-th field.
+		 */
+		template<std::size_t N>
+		inline std::size_t fieldSize() const
+		{
+			return mOffsets[N + 1] - mOffsets[N];
+		}
+
+		/**
+		 * @brief Decode the N-th field.
+		 */
+		template<std::size_t N>
+		inline void get(typename field<N>::type& value) const
+		{
+			BOOST_STATIC_ASSERT(N < FIELD_COUNT);
+
+			view_type in(mData + mOffsets[N], fieldSize<N>());
+			in.wpos(fieldSize<N>());
+			detail::indexed_field<typename field<N>::declared_type>::read(in, value);
+		}
+
+		template<std::size_t N>
+		inline typename field<N>::type get() const
+		{
+			typename field<N>::type value;
+			get<N>(value);
+			return value;
+		}
+
+		/**
+		 * @brief Get the number of elements of the N-th field, which must be declared as Indexed<T>.
+		 */
+		template<std::size_t N>
+		inline std::size_t vectorSize() const
+		{
+			BOOST_STATIC_ASSERT(N < FIELD_COUNT && field<N>::indexed);
+
+			view_type in(mData + mOffsets[N], fieldSize<N>());
+			in.wpos(fieldSize<N>());
+
+			uint32 count;
+			in.readOrdered(count);
+			if(UNLIKELY((count + 2) * (std::size_t)sizeof(uint32) > fieldSize<N>()))
+				throw std::runtime_error("malformed indexed message");
+			return count;
+		}
+
+		/**
+		 * @brief Decode the i-th element of the N-th field, which must be declared as Indexed<T>.
+		 */
+		template<std::size_t N>
+		inline void vectorAt(std::size_t i, typename field<N>::element_type& value) const
+		{
+			BOOST_ASSERT(i < vectorSize<N>());
+
+			uint32 begin, end;
+			{
+				view_type table(mData + mOffsets[N] + (i + 1) * sizeof(uint32), 2 * sizeof(uint32));
+				table.wpos(2 * sizeof(uint32));
+				table.readOrdered(begin);
+				table.readOrdered(end);
+			}
+			if(UNLIKELY(begin > end || end > fieldSize<N>()))
+				throw std::runtime_error("malformed indexed message");
+
+			view_type in(mData + mOffsets[N] + begin, end - begin);
+			in.wpos(end - begin);
+			in >> value;
+		}
+
+		template<std::size_t N>
+		inline typename field<N>::element_type vectorAt(std::size_t i) const
+		{
+			typename field<N>::element_type value;
+			vectorAt<N>(i, value);
+			return value;
+		}
+
+	private:
+		void init(std::size_t size)
+		{
+			if(UNLIKELY(size < HEADER_SIZE))
+				throw std::length_error("out of data buffer");
+
+			view_type header(mData, HEADER_SIZE);
+			header.wpos(HEADER_SIZE);
+
+			uint32 count;
+			header.readOrdered(count);
+			if(UNLIKELY(count != FIELD_COUNT))
+				throw std::runtime_error("indexed message field count mismatch");
+
+			// offsets must be ordered and within the data, so fields can be decoded without further checks
+			std::size_t previous = HEADER_SIZE;
+			for(std::size_t i = 0; i <= FIELD_COUNT; ++i)
+			{
+				header.readOrdered(mOffsets[i]);
+				if(UNLIKELY(mOffsets[i] < previous || mOffsets[i] > size))
+					throw std::runtime_error("malformed indexed message");
+				previous = mOffsets[i];
+			}
+		}
+
+	private:
+		const byte* mData;
+		uint32 mOffsets[FIELD_COUNT + 1];
+	};
+};
+
+}
+
+#endif/*ZILLIANS_INDEXEDMESSAGE_H_*/
@@ -0,0 +1,334 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_INVERTEDSOA_H_
+#define ZILLIANS_INVERTEDSOA_H_
+
+#include "core/Types.h"
+#include <boost/assert.hpp>
+#include <vector>
+#include <tuple>
+#include <utility>
+
+namespace zillians {
+
+namespace detail {
+
+template<std::size_t... Is>
+struct inverted_soa_indices
+{ };
+
+template<std::size_t N, std::size_t... Is>
+struct make_inverted_soa_indices : make_inverted_soa_indices<N - 1, N - 1, Is...>
+{ };
+
+template<std::size_t... Is>
+struct make_inverted_soa_indices<0, Is...>
+{
+	typedef inverted_soa_indices<Is...> type;
+};
+
+}
+
+/**
+ * @brief InvertedSoA is the structure-of-arrays counterpart of InvertedArray.
+ *
+ * Each field is kept in its own contiguous array, so a sweep over one or two
+ * fields of every element reads dense memory instead of chasing a pointer per
+ * element. Removal moves the last element into the hole like InvertedArray
+ * does, so the arrays never have gaps and erase is O(1).
+ *
+ * Since elements move, they are referred by Handle instead of by index. A
+ * handle stays valid until its element is erased, and an erased handle is
+ * detected by valid() even after its slot is reused.
+ *
+ * @code
+ * InvertedSoA<float, float, int> entities;// position, velocity, flags
+ * InvertedSoA<float, float, int>::Handle h = entities.pushBack(0.0f, 1.0f, 0);
+ * entities.for_each_field<0, 1>(Integrate(dt));// f(position, velocity) in a plain loop
+ * entities.erase(h);
+ * @endcode
+ */
+template<typename... Fields>
+class InvertedSoA
+{
+public:
+	enum { FIELD_COUNT = sizeof...(Fields) };
+
+	struct Handle
+	{
+		Handle() : slot(INVALID_SLOT), generation(0)
+		{ }
+
+		Handle(uint32 s, uint32 g) : slot(s), generation(g)
+		{ }
+
+		inline bool operator== (const Handle& other) const { return slot == other.slot && generation == other.generation; }
+		inline bool operator!= (const Handle& other) const { return !(*this == other); }
+
+		uint32 slot;
+		uint32 generation;
+	};
+
+	template<std::size_t N>
+	struct field
+	{
+		typedef typename std::tuple_element<N, std::tuple<Fields...> >::type type;
+	};
+
+public:
+	InvertedSoA()
+	{ }
+
+	~InvertedSoA()
+	{ }
+
+public:
+	inline bool empty() const
+	{
+		return mIndexToSlot.empty();
+	}
+
+	inline std::size_t size() const
+	{
+		return mIndexToSlot.size();
+	}
+
+	void reserve(std::size_t n)
+	{
+		reserveFields(n, indices());
+		mIndexToSlot.reserve(n);
+		mSlotToIndex.reserve(n);
+		mGenerations.reserve(n);
+	}
+
+	/**
+	 * @brief Append an element at the end of every field array.
+	 *
+	 * @return The handle to refer the element until it's erased.
+	 */
+	Handle pushBack(const Fields&... values)
+	{
+		pushBackFields(indices(), values...);
+
+		uint32 slot;
+		if(mFreeSlots.empty())
+		{
+			slot = (uint32)mSlotToIndex.size();
+			mSlotToIndex.push_back(0);
+			mGenerations.push_back(0);
+		}
+		else
+		{
+			slot = mFreeSlots.back();
+			mFreeSlots.pop_back();
+		}
+
+		mSlotToIndex[slot] = (uint32)mIndexToSlot.size();
+		mIndexToSlot.push_back(slot);
+		return Handle(slot, mGenerations[slot]);
+	}
+
+	inline void erase(const Handle& handle)
+	{
+		BOOST_ASSERT(valid(handle));
+		erase((std::size_t)mSlotToIndex[handle.slot]);
+	}
+
+	/**
+	 * @brief Erase the element at the given index by moving the last element into its place.
+	 */
+	void erase(std::size_t index)
+	{
+		BOOST_ASSERT(index < size());
+
+		std::size_t last = size() - 1;
+		uint32 slot = mIndexToSlot[index];
+		if(index != last)
+		{
+			moveFields(last, index, indices());
+			mIndexToSlot[index] = mIndexToSlot[last];
+			mSlotToIndex[mIndexToSlot[index]] = (uint32)index;
+		}
+		popBackFields(indices());
+		mIndexToSlot.pop_back();
+
+		++mGenerations[slot];
+		mFreeSlots.push_back(slot);
+	}
+
+	void swap(std::size_t index1, std::size_t index2)
+	{
+		swapFields(index1, index2, indices());
+		std::swap(mIndexToSlot[index1], mIndexToSlot[index2]);
+		mSlotToIndex[mIndexToSlot[index1]] = (uint32)index1;
+		mSlotToIndex[mIndexToSlot[index2]] = (uint32)index2;
+	}
+
+	void clear()
+	{
+		clearFields(indices());
+		for(std::size_t i = 0; i < mIndexToSlot.size(); ++i)
+		{
+			++mGenerations[mIndexToSlot[i]];
+			mFreeSlots.push_back(mIndexToSlot[i]);
+		}
+		mIndexToSlot.clear();
+	}
+
+public:
+	inline bool valid(const Handle& handle) const
+	{
+		return handle.slot < mGenerations.size() && mGenerations[handle.slot] == handle.generation;
+	}
+
+	inline std::size_t index(const Handle& handle) const
+	{
+		BOOST_ASSERT(valid(handle));
+		return mSlotToIndex[handle.slot];
+	}
+
+	inline Handle handle(std::size_t index) const
+	{
+		uint32 slot = mIndexToSlot[index];
+		return Handle(slot, mGenerations[slot]);
+	}
+
+	template<std::size_t N>
+	inline typename field<N>::type& get(const Handle& handle)
+	{
+		return std::get<N>(mFields)[index(handle)];
+	}
+
+	template<std::size_t N>
+	inline typename field<N>::type& at(std::size_t index)
+	{
+		return std::get<N>(mFields)[index];
+	}
+
+	/**
+	 * @brief The contiguous array of the N-th field, valid until the next pushBack() or erase().
+	 */
+	template<std::size_t N>
+	inline typename field<N>::type* data()
+	{
+		return std::get<N>(mFields).data();
+	}
+
+	/**
+	 * @brief Call f with the selected fields of every element, in index order.
+	 *
+	 * The loop runs over plain array pointers taken before the loop starts, so
+	 * once f is inlined it's the same loop one would write by hand and GCC can
+	 * vectorize it. f must not add or remove elements.
+	 *
+	 * @code
+	 * soa.for_each_field<0, 1>([=](float& p, const float& v) { p += v * dt; });
+	 * @endcode
+	 */
+	template<std::size_t... Is, typename F>
+	inline void for_each_field(F f)
+	{
+		sweep(f, size(), std::get<Is>(mFields).data()...);
+	}
+
+	/**
+	 * @brief Call f with all fields of every element.
+	 */
+	template<typename F>
+	inline void for_each(F f)
+	{
+		sweepAll(f, indices());
+	}
+
+private:
+	typedef typename detail::make_inverted_soa_indices<sizeof...(Fields)>::type indices;
+
+	template<typename... Args>
+	static inline void expand(Args&&...)
+	{ }
+
+	template<typename F, typename... Ps>
+	static inline void sweep(F& f, std::size_t n, Ps* __restrict__... p)
+	{
+		for(std::size_t i = 0; i < n; ++i)
+			f(p[i]...);
+	}
+
+	template<typename F, std::size_t... Is>
+	inline void sweepAll(F& f, detail::inverted_soa_indices<Is...>)
+	{
+		sweep(f, size(), std::get<Is>(mFields).data()...);
+	}
+
+	template<std::size_t... Is>
+	inline void pushBackFields(detail::inverted_soa_indices<Is...>, const Fields&... values)
+	{
+		expand((std::get<Is>(mFields).push_back(values), 0)...);
+	}
+
+	template<std::size_t... Is>
+	inline void popBackFields(detail::inverted_soa_indices<Is...>)
+	{
+		expand((std::get<Is>(mFields).pop_back(), 0)...);
+	}
+
+	template<std::size_t... Is>
+	inline void moveFields(std::size_t from, std::size_t to, detail::inverted_soa_indices<Is...>)
+	{
+		expand((std::get<Is>(mFields)[to] = std::move(std::get<Is>(mFields)[from]), 0)...);
+	}
+
+	template<std::size_t... Is>
+	inline void swapFields(std::size_t index1, std::size_t index2, detail::inverted_soa_indices<Is...>)
+	{
+		using std::swap;
+		expand((swap(std::get<Is>(mFields)[index1], std::get<Is>(mFields)[index2]), 0)...);
+	}
+
+	template<std::size_t... Is>
+	inline void reserveFields(std::size_t n, detail::inverted_soa_indices<Is...>)
+	{
+		expand((std::get<Is>(mFields).reserve(n), 0)...);
+	}
+
+	template<std::size_t... Is>
+	inline void clearFields(detail::inverted_soa_indices<Is...>)
+	{
+		expand((std::get<Is>(mFields).clear(), 0)...);
+	}
+
+private:
+	enum { INVALID_SLOT = 0xFFFFFFFF };
+
+	std::tuple<std::vector<Fields>...> mFields;
+	std::vector<uint32> mIndexToSlot;	///< Handle slot of the element at each index
+	std::vector<uint32> mSlotToIndex;	///< Index of the element of each handle slot
+	std::vector<uint32> mGenerations;	///< Bumped whenever the element of a slot is erased
+	std::vector<uint32> mFreeSlots;
+
+	// forbid object copy constructor and copy operator
+private:
+	InvertedSoA(const InvertedSoA&);
+	void operator = (const InvertedSoA&);
+};
+
+}
+
+#endif /* ZILLIANS_INVERTEDSOA_H_ */
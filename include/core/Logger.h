@@ -23,6 +23,36 @@
 #ifndef ZILLIANS_LOGGER_H_
 #define ZILLIANS_LOGGER_H_
 
+#include "core/Common.h"
+
+/**
+ * Log statements of ZILLIANS_LOG_TRACE() and friends below this level are
+ * compiled out entirely, i.e. -DZILLIANS_LOG_COMPILE_LEVEL=2 removes trace
+ * and debug statements from a release build. See LogLevel for the values.
+ */
+#ifndef ZILLIANS_LOG_COMPILE_LEVEL
+#define ZILLIANS_LOG_COMPILE_LEVEL 0
+#endif
+
+namespace zillians {
+
+struct LogLevel
+{
+	enum type
+	{
+		trace	= 0,
+		debug	= 1,
+		info	= 2,
+		warn	= 3,
+		error	= 4,
+		fatal	= 5,
+	};
+
+	static const char* name(type level);
+};
+
+}
+
 #ifdef BUILD_WITH_LOG4CXX
 
 #ifndef LOG4CXX_WCHAR_T_API
@@ -31,13 +61,119 @@
 
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
+#include "core/JustThread.h"
+#include <boost/noncopyable.hpp>
+#include <string>
 
 namespace zillians {
 
 log4cxx::LoggerPtr GlobalLogger();
 
+/**
+ * @brief CachedLogger keeps the level threshold of a log4cxx logger in a plain integer.
+ *
+ * Checking whether a level is enabled is a load and a compare, instead of
+ * walking the logger hierarchy and the repository threshold of log4cxx on
+ * every statement. Use it with the ZILLIANS_LOG_* macros:
+ *
+ * @code
+ * static CachedLogger logger("zillians.network.Session");
+ * ZILLIANS_LOG_DEBUG(logger, "session " << id << " received " << describe(message));
+ * @endcode
+ *
+ * where describe() is only called if debug logging is enabled for the logger.
+ *
+ * @note The threshold is read from log4cxx on construction. Call refreshAll()
+ * after changing logger levels or reconfiguring log4cxx.
+ */
+class CachedLogger : public boost::noncopyable
+{
+public:
+	explicit CachedLogger(const log4cxx::LoggerPtr& logger);
+	explicit CachedLogger(const std::string& name);
+	~CachedLogger();
+
+public:
+	inline bool isEnabledFor(LogLevel::type level) const
+	{
+		return (int)level >= mThreshold.load(std::memory_order_relaxed);
+	}
+
+	inline const log4cxx::LoggerPtr& get() const
+	{
+		return mLogger;
+	}
+
+	/**
+	 * Read the threshold of this logger from log4cxx again.
+	 */
+	void refresh();
+
+	/**
+	 * Read the thresholds of all cached loggers from log4cxx again.
+	 */
+	static void refreshAll();
+
+	static const log4cxx::LevelPtr& toLog4cxx(LogLevel::type level);
+
+private:
+	log4cxx::LoggerPtr mLogger;
+	std::atomic<int> mThreshold;	///< The lowest enabled LogLevel, above fatal if none
+};
+
 }
 
+#define ZILLIANS_LOG_IMPL(logger, level, message) \
+	do { \
+		if(UNLIKELY((logger).isEnabledFor(level))) \
+		{ \
+			::log4cxx::helpers::MessageBuffer oss_; \
+			(logger).get()->forcedLog(::zillians::CachedLogger::toLog4cxx(level), oss_.str(oss_ << message), LOG4CXX_LOCATION); \
+		} \
+	} while(0)
+
+#else
+
+#define ZILLIANS_LOG_IMPL(logger, level, message) do { } while(0)
+
+#endif
+
+/**
+ * Log statements taking a CachedLogger and a stream expression like LOG4CXX_DEBUG().
+ *
+ * The stream expression is only evaluated if the statement emits, and
+ * statements below ZILLIANS_LOG_COMPILE_LEVEL generate no code at all.
+ */
+#if ZILLIANS_LOG_COMPILE_LEVEL <= 0
+#define ZILLIANS_LOG_TRACE(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::trace, message)
+#else
+#define ZILLIANS_LOG_TRACE(logger, message) do { } while(0)
+#endif
+
+#if ZILLIANS_LOG_COMPILE_LEVEL <= 1
+#define ZILLIANS_LOG_DEBUG(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::debug, message)
+#else
+#define ZILLIANS_LOG_DEBUG(logger, message) do { } while(0)
+#endif
+
+#if ZILLIANS_LOG_COMPILE_LEVEL <= 2
+#define ZILLIANS_LOG_INFO(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::info, message)
+#else
+#define ZILLIANS_LOG_INFO(logger, message) do { } while(0)
 #endif
 
+#if ZILLIANS_LOG_COMPILE_LEVEL <= 3
+#define ZILLIANS_LOG_WARN(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::warn, message)
+#else
+#define ZILLIANS_LOG_WARN(logger, message) do { } while(0)
+#endif
+
+#if ZILLIANS_LOG_COMPILE_LEVEL <= 4
+#define ZILLIANS_LOG_ERROR(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::error, message)
+#else
+#define ZILLIANS_LOG_ERROR(logger, message) do { } while(0)
+#endif
+
+#define ZILLIANS_LOG_FATAL(logger, message) ZILLIANS_LOG_IMPL(logger, ::zillians::LogLevel::fatal, message)
+
 #endif /* ZILLIANS_LOGGER_H_ */
@@ -0,0 +1,99 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_MAPPEDFILEBUFFERALLOCATOR_H_
+#define ZILLIANS_MAPPEDFILEBUFFERALLOCATOR_H_
+
+#include "core/Buffer.h"
+
+#include <string>
+
+namespace zillians {
+
+/**
+ * @brief MappedFileBufferAllocator backs buffer data by a memory-mapped file region.
+ *
+ * The allocator owns the file descriptor and at most one mapping at a time. Use it with the
+ * adopting BufferBase constructor to deserialize directly from the file without reading it
+ * into heap memory:
+ *
+ * @code
+ * MappedFileBufferAllocator file("session.log");
+ * Buffer b(&file, file.map(), file.fileSize(), true);
+ * while(b.dataSize() > 0) { b >> message; ... }
+ * @endcode
+ *
+ * A writable file grows by ftruncate() and mremap() whenever the buffer resizes on demand. Since
+ * the buffer grows in power of two, call truncate() with the final write position after the
+ * buffer is destroyed to trim the file to its real content.
+ *
+ * @note The allocator must outlive the buffer using it.
+ */
+class MappedFileBufferAllocator : public BufferAllocator
+{
+public:
+	/**
+	 * @brief Open (or create, if writable) the given file.
+	 *
+	 * @param path The file path.
+	 * @param writable True to open the file for read and write, false for read only.
+	 *
+	 * @throw std::runtime_error if the file can't be opened.
+	 */
+	MappedFileBufferAllocator(const std::string& path, bool writable = false);
+	virtual ~MappedFileBufferAllocator();
+
+public:
+	/**
+	 * @brief Map the whole file.
+	 *
+	 * @return The mapped memory, or NULL if the file is empty.
+	 */
+	byte* map();
+
+	/**
+	 * @brief Get the current file size.
+	 */
+	std::size_t fileSize() const;
+
+	/**
+	 * @brief Cut the file to the given size.
+	 *
+	 * @note This must not be called while the mapping is larger than the given size and still in use.
+	 */
+	void truncate(std::size_t size);
+
+	bool isWritable() const { return mWritable; }
+
+public:
+	virtual byte* allocate(std::size_t size);
+	virtual void deallocate(byte* data);
+	virtual byte* reallocate(byte* data, std::size_t old_size, std::size_t new_size);
+
+private:
+	std::string mPath;
+	bool mWritable;
+	int mFileDescriptor;
+	byte* mMappedData;
+	std::size_t mMappedSize;
+};
+
+}
+
+#endif/*ZILLIANS_MAPPEDFILEBUFFERALLOCATOR_H_*/
@@ -0,0 +1,175 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_MEMORYCOPY_H_
+#define ZILLIANS_MEMORYCOPY_H_
+
+#include "core/Common.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Copies of at least this many bytes bypass the cache with non-temporal stores. The
+ * default is about the size of a shared L3 slice, so a copy below it is likely to be
+ * read again soon while a larger copy would only evict everybody else's working set.
+ */
+#ifndef ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD
+#define ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD	(4 * 1024 * 1024)
+#endif
+
+namespace zillians {
+
+namespace detail {
+
+#if defined(__x86_64__)
+enum
+{
+	STREAM_BLOCK_SIZE = 64,				///< One cache line per loop iteration
+	STREAM_PREFETCH_DISTANCE = 512,		///< How far ahead of the loads the source is prefetched
+};
+
+/**
+ * Copy whole cache lines with streaming stores, dest must be cache line aligned and size
+ * a multiple of the cache line.
+ */
+__attribute__((target("avx512f")))
+inline void memory_stream_avx512(byte* dest, const byte* src, std::size_t size)
+{
+	for(std::size_t i = 0; i < size; i += STREAM_BLOCK_SIZE)
+	{
+		_mm_prefetch((const char*)src + i + STREAM_PREFETCH_DISTANCE, _MM_HINT_NTA);
+		_mm512_stream_si512((__m512i*)(dest + i), _mm512_loadu_si512((const void*)(src + i)));
+	}
+}
+
+__attribute__((target("avx2")))
+inline void memory_stream_avx2(byte* dest, const byte* src, std::size_t size)
+{
+	for(std::size_t i = 0; i < size; i += STREAM_BLOCK_SIZE)
+	{
+		_mm_prefetch((const char*)src + i + STREAM_PREFETCH_DISTANCE, _MM_HINT_NTA);
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+		_mm256_stream_si256((__m256i*)(dest + i), a);
+		_mm256_stream_si256((__m256i*)(dest + i + 32), b);
+	}
+}
+
+inline void memory_stream_sse2(byte* dest, const byte* src, std::size_t size)
+{
+	for(std::size_t i = 0; i < size; i += STREAM_BLOCK_SIZE)
+	{
+		_mm_prefetch((const char*)src + i + STREAM_PREFETCH_DISTANCE, _MM_HINT_NTA);
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+		_mm_stream_si128((__m128i*)(dest + i), a);
+		_mm_stream_si128((__m128i*)(dest + i + 16), b);
+		_mm_stream_si128((__m128i*)(dest + i + 32), c);
+		_mm_stream_si128((__m128i*)(dest + i + 48), d);
+	}
+}
+
+typedef void (*memory_stream_function)(byte*, const byte*, std::size_t);
+
+inline memory_stream_function memory_stream_select()
+{
+	if(__builtin_cpu_supports("avx512f"))
+		return &memory_stream_avx512;
+	if(__builtin_cpu_supports("avx2"))
+		return &memory_stream_avx2;
+	return &memory_stream_sse2;
+}
+
+/**
+ * Copy non-overlapping memory with non-temporal stores, so the destination doesn't
+ * pollute the cache. The unaligned head and the tail are copied by memcpy.
+ */
+inline void memory_copy_non_temporal(byte* dest, const byte* src, std::size_t size)
+{
+	static const memory_stream_function stream = memory_stream_select();
+
+	std::size_t head = (std::size_t)(-(uintptr_t)dest) & (STREAM_BLOCK_SIZE - 1);
+	::memcpy(dest, src, head);
+	dest += head; src += head; size -= head;
+
+	std::size_t body = size & ~(std::size_t)(STREAM_BLOCK_SIZE - 1);
+	stream(dest, src, body);
+
+	// streaming stores are weakly ordered, make them visible before anyone is told the copy is done
+	_mm_sfence();
+
+	::memcpy(dest + body, src + body, size - body);
+}
+#endif
+
+}
+
+/**
+ * @brief Copy non-overlapping memory, picking the strategy by the size of the copy.
+ *
+ * Copies below ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD go to memcpy, which the compiler
+ * inlines for small constant sizes and glibc already dispatches to AVX2 or AVX-512
+ * at run time for the rest. Larger copies are streamed to the destination with
+ * non-temporal stores of the widest vector the CPU supports, while the source is
+ * prefetched, so a multi-megabyte copy doesn't flush the shared cache.
+ *
+ * @note The destination of a non-temporal copy won't be in cache afterwards, which is
+ * the point for clones and moves of big payloads, but not if it's read right away.
+ */
+inline void memory_copy(void* dest, const void* src, std::size_t size)
+{
+#if defined(__x86_64__)
+	if(UNLIKELY(size >= ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD))
+	{
+		detail::memory_copy_non_temporal((byte*)dest, (const byte*)src, size);
+		return;
+	}
+#endif
+	::memcpy(dest, src, size);
+}
+
+/**
+ * @brief Copy possibly overlapping memory, large non-overlapping copies are streamed like memory_copy().
+ */
+inline void memory_move(void* dest, const void* src, std::size_t size)
+{
+#if defined(__x86_64__)
+	if(UNLIKELY(size >= ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD))
+	{
+		const byte* d = (const byte*)dest;
+		const byte* s = (const byte*)src;
+		if(d + size <= s || s + size <= d)
+		{
+			detail::memory_copy_non_temporal((byte*)dest, s, size);
+			return;
+		}
+	}
+#endif
+	::memmove(dest, src, size);
+}
+
+}
+
+#endif/*ZILLIANS_MEMORYCOPY_H_*/
@@ -0,0 +1,180 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_METRICS_H_
+#define ZILLIANS_METRICS_H_
+
+#include "core/Common.h"
+#include "utility/TimerUtil.h"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <string>
+#include <vector>
+
+//#define ZILLIANS_ENABLE_METRICS ///< Enable the built-in instrumentation of Worker, Dispatcher and ScalablePoolAllocator.
+
+namespace zillians {
+
+/**
+ * @brief MetricCounter counts events into one counter per thread, summed up by value().
+ *
+ * Incrementing is a plain add to a thread-local counter padded to its own cache line,
+ * there is neither lock nor atomic instruction on the recording path. The counter
+ * is registered to MetricRegistry for its whole lifetime.
+ *
+ * @note Like TimerStatistics, a metric must outlive the threads recording into it,
+ * which is why metrics are usually static.
+ *
+ * @code
+ * static MetricCounter dropped("session.dropped");
+ * dropped.increment();
+ * @endcode
+ */
+class MetricCounter : public boost::noncopyable
+{
+public:
+	explicit MetricCounter(const std::string& name);
+	~MetricCounter();
+
+public:
+	inline void increment(uint64 n = 1)
+	{
+		Shard* shard = mLocal.get();
+		if(UNLIKELY(!shard)) shard = registerThread();
+		shard->value += n;
+	}
+
+	/**
+	 * Sum the counters of all threads, exact once the recording threads are done.
+	 */
+	uint64 value() const;
+	void reset();
+
+	inline const std::string& name() const
+	{
+		return mName;
+	}
+
+private:
+	struct Shard
+	{
+		uint64 value;
+		byte padding[64 - sizeof(uint64)];
+	};
+
+	Shard* registerThread();
+
+private:
+	std::string mName;
+	boost::thread_specific_ptr<Shard> mLocal;
+
+	mutable boost::mutex mShardsLock;
+	std::vector< boost::shared_ptr<Shard> > mShards;
+};
+
+/**
+ * @brief MetricHistogram is a TimerStatistics registered to MetricRegistry.
+ *
+ * Values are kept in per-thread log-linear histograms (see TimerHistogram) and merged
+ * on collect(), so it's suitable for latencies as well as sizes or queue depths. Use
+ * ScopedTimer to record durations.
+ */
+class MetricHistogram : public TimerStatistics
+{
+public:
+	explicit MetricHistogram(const std::string& name);
+	~MetricHistogram();
+};
+
+/**
+ * @brief The merged value of one metric at the time of MetricRegistry::scrape().
+ */
+struct MetricSample
+{
+	enum Type { COUNTER, HISTOGRAM };
+
+	std::string name;
+	Type type;
+	uint64 value;				///< The total of a counter, or the number of values of a histogram
+	TimerHistogram histogram;	///< The merged histogram, empty for counters
+};
+
+/**
+ * @brief MetricRegistry keeps track of all live metrics so an exporter can poll them.
+ *
+ * Metrics register themselves on construction and unregister on destruction, the
+ * registry never owns them. Scraping merges the per-thread shards of every metric,
+ * which takes a lock per metric but never blocks the recording threads.
+ */
+class MetricRegistry : public boost::noncopyable
+{
+public:
+	static MetricRegistry& instance();
+
+public:
+	void add(MetricCounter* counter);
+	void remove(MetricCounter* counter);
+	void add(MetricHistogram* histogram);
+	void remove(MetricHistogram* histogram);
+
+	/**
+	 * Append a sample of every registered metric, counters first, in registration order.
+	 */
+	void scrape(std::vector<MetricSample>& samples) const;
+
+	/**
+	 * Reset all registered metrics, values recorded concurrently may survive.
+	 */
+	void reset();
+
+	/**
+	 * Print one line per metric to stdout, histograms in the unit they are recorded.
+	 */
+	void print() const;
+
+private:
+	MetricRegistry() { }
+
+private:
+	mutable boost::mutex mLock;
+	std::vector<MetricCounter*> mCounters;
+	std::vector<MetricHistogram*> mHistograms;
+};
+
+#ifdef ZILLIANS_ENABLE_METRICS
+/**
+ * @brief The metrics recorded by the built-in instrumentation.
+ */
+struct BuiltinMetrics
+{
+	static MetricHistogram& worker_queue_delay();		///< "worker.queue_delay_ns", from posting a call to a worker till it starts
+	static MetricHistogram& worker_run_time();			///< "worker.run_time_ns", time spent in the handler of a call
+	static MetricCounter& dispatcher_writes();			///< "dispatcher.writes", messages written to any pipe
+	static MetricHistogram& dispatcher_pipe_depth();	///< "dispatcher.pipe_depth", messages taken from a pipe on each visit of the reader
+	static MetricCounter& dispatcher_overflows();		///< "dispatcher.overflows", writes finding a bounded pipe full
+	static MetricHistogram& allocator_size();			///< "allocator.allocate_size", sizes requested from ScalablePoolAllocator
+	static MetricCounter& allocator_failures();			///< "allocator.allocate_failures", allocations running out of memory
+};
+#endif
+
+}
+
+#endif/*ZILLIANS_METRICS_H_*/
@@ -0,0 +1,66 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_MIRROREDBUFFERALLOCATOR_H_
+#define ZILLIANS_MIRROREDBUFFERALLOCATOR_H_
+
+#include "core/Buffer.h"
+
+#include <map>
+
+namespace zillians {
+
+/**
+ * @brief MirroredBufferAllocator maps the same physical pages twice back-to-back.
+ *
+ * When used as the allocator of a circular buffer, every value or range in the buffer (up to
+ * the buffer capacity) is a single contiguous memory range even if it crosses the end of the
+ * buffer, so readers never handle two ranges and crunch() is not needed.
+ *
+ * @code
+ * SpscCircularBuffer b(65536, MirroredBufferAllocator::instance());
+ * @endcode
+ *
+ * @note The buffer capacity is rounded up to the page size, and the buffer can't grow on demand.
+ */
+class MirroredBufferAllocator : public BufferAllocator
+{
+public:
+	MirroredBufferAllocator();
+	virtual ~MirroredBufferAllocator();
+
+public:
+	virtual byte* allocate(std::size_t size);
+	virtual void deallocate(byte* data);
+	virtual byte* reallocate(byte* data, std::size_t old_size, std::size_t new_size);
+
+	virtual bool isMirrored() const { return true; }
+	virtual std::size_t getGranularity() const { return mPageSize; }
+
+	static MirroredBufferAllocator* instance();
+
+private:
+	std::size_t mPageSize;
+	std::map<byte*, std::size_t> mMappings;
+	boost::mutex mMappingsLock;
+};
+
+}
+
+#endif/*ZILLIANS_MIRROREDBUFFERALLOCATOR_H_*/
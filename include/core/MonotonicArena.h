@@ -0,0 +1,252 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_MONOTONICARENA_H_
+#define ZILLIANS_MONOTONICARENA_H_
+
+#include "core/Buffer.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <limits>
+#include <new>
+
+namespace zillians {
+
+/**
+ * @brief MonotonicArena bump-allocates memory for objects sharing the same lifetime.
+ *
+ * Memory is carved out of chunks taken from the upstream allocator, individual
+ * deallocation is a no-op, and everything is released at once by reset(). This
+ * replaces the many small malloc/free pairs of a request with a few chunk
+ * allocations. Combine it with ScalablePoolBufferAllocator to take the chunks
+ * from a ScalablePoolAllocator:
+ *
+ * @code
+ * ScalablePoolBufferAllocator upstream(pool);
+ * MonotonicArena arena(&upstream);
+ * std::vector<int, ArenaAllocator<int> > v(ArenaAllocator<int>(arena));
+ * ...
+ * arena.reset();// after v is gone
+ * @endcode
+ *
+ * @note Destructors of objects in the arena are never called by the arena.
+ * @note MonotonicArena is not thread-safe, use one arena per request or per thread.
+ */
+class MonotonicArena : public boost::noncopyable
+{
+public:
+	enum
+	{
+		DEFAULT_CHUNK_SIZE = 64 * 1024,	///< Size of chunks taken from upstream, including the chunk header
+		DEFAULT_ALIGNMENT = 16,			///< Alignment of allocate() if not given, good for any fundamental type
+	};
+
+	/**
+	 * @brief Create an empty arena, no memory is taken from upstream until the first allocation.
+	 *
+	 * @param upstream The allocator to take chunks from, or NULL for the global heap.
+	 * @param chunkSize The size of each chunk.
+	 */
+	MonotonicArena(BufferAllocator* upstream = NULL, std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+	~MonotonicArena();
+
+public:
+	/**
+	 * @brief Allocate memory from the current chunk.
+	 *
+	 * Requests larger than a quarter of the chunk size get a dedicated chunk,
+	 * so they don't waste the rest of the current chunk.
+	 *
+	 * @param size The requested size.
+	 * @param alignment The alignment of the returned memory, must be a power of two.
+	 *
+	 * @return The allocated memory, or NULL if upstream runs out of memory.
+	 */
+	inline void* allocate(std::size_t size, std::size_t alignment = DEFAULT_ALIGNMENT)
+	{
+		BOOST_ASSERT((alignment & (alignment - 1)) == 0);
+
+		byte* p = reinterpret_cast<byte*>((reinterpret_cast<uintptr_t>(mCurrent) + (alignment - 1)) & ~(uintptr_t)(alignment - 1));
+		if(LIKELY(mCurrent && p <= mEnd && size <= (std::size_t)(mEnd - p)))
+		{
+			mCurrent = p + size;
+			return p;
+		}
+		return allocateSlow(size, alignment);
+	}
+
+	/**
+	 * @brief Memory in the arena is only released by reset(), so this does nothing.
+	 */
+	inline void deallocate(void* p)
+	{
+		UNUSED_ARGUMENT(p);
+	}
+
+	/**
+	 * @brief Release all memory allocated from the arena at once.
+	 *
+	 * One regular chunk is kept and reused, so an arena reset after every request
+	 * only goes to upstream when a request needs more than one chunk.
+	 */
+	void reset();
+
+	/**
+	 * @brief Give all chunks back to upstream, including the first one.
+	 */
+	void release();
+
+	/**
+	 * @brief Get the total size of chunks taken from upstream.
+	 */
+	inline std::size_t reservedSize() const
+	{
+		return mReservedSize;
+	}
+
+	inline std::size_t chunkCount() const
+	{
+		return mChunkCount;
+	}
+
+private:
+	/**
+	 * Header stored at the beginning of each chunk.
+	 */
+	struct Chunk
+	{
+		Chunk* next;
+		std::size_t size;
+	};
+
+	void* allocateSlow(std::size_t size, std::size_t alignment);
+	Chunk* allocateChunk(std::size_t size);
+	void deallocateChunks(Chunk* chunks);
+
+	inline byte* chunkBegin(Chunk* chunk) { return reinterpret_cast<byte*>(chunk) + sizeof(Chunk); }
+	inline byte* chunkEnd(Chunk* chunk) { return reinterpret_cast<byte*>(chunk) + chunk->size; }
+
+private:
+	BufferAllocator* mUpstream;
+	std::size_t mChunkSize;
+
+	byte* mCurrent;		///< Next free byte in the current chunk
+	byte* mEnd;			///< End of the current chunk
+
+	Chunk* mChunks;		///< All chunks, the current chunk, if any, is always at the front
+	std::size_t mReservedSize;
+	std::size_t mChunkCount;
+};
+
+/**
+ * @brief ArenaAllocator is a std-compatible allocator adapter of MonotonicArena.
+ *
+ * Containers using it never free memory individually, so growing a container
+ * leaves its old storage in the arena until reset(). Reserve the capacity
+ * up front when the final size is known.
+ */
+template<typename T>
+class ArenaAllocator
+{
+	template<typename U> friend class ArenaAllocator;
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef ArenaAllocator<U> other;
+	};
+
+public:
+	explicit ArenaAllocator(MonotonicArena& arena) : mArena(&arena)
+	{ }
+
+	ArenaAllocator(const ArenaAllocator& other) : mArena(other.mArena)
+	{ }
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : mArena(other.mArena)
+	{ }
+
+public:
+	inline pointer address(reference x) const { return &x; }
+	inline const_pointer address(const_reference x) const { return &x; }
+
+	inline pointer allocate(size_type n, const void* hint = 0)
+	{
+		UNUSED_ARGUMENT(hint);
+		void* p = mArena->allocate(n * sizeof(T), boost::alignment_of<T>::value);
+		if(UNLIKELY(!p))
+			throw std::bad_alloc();
+		return static_cast<pointer>(p);
+	}
+
+	inline void deallocate(pointer p, size_type n)
+	{
+		UNUSED_ARGUMENT(n);
+		mArena->deallocate(p);
+	}
+
+	inline size_type max_size() const
+	{
+		return std::numeric_limits<size_type>::max() / sizeof(T);
+	}
+
+	inline void construct(pointer p, const T& value)
+	{
+		new((void*)p) T(value);
+	}
+
+	inline void destroy(pointer p)
+	{
+		p->~T();
+	}
+
+	inline MonotonicArena& arena() const
+	{
+		return *mArena;
+	}
+
+	template<typename U>
+	inline bool operator== (const ArenaAllocator<U>& other) const
+	{
+		return mArena == other.mArena;
+	}
+
+	template<typename U>
+	inline bool operator!= (const ArenaAllocator<U>& other) const
+	{
+		return mArena != other.mArena;
+	}
+
+private:
+	MonotonicArena* mArena;
+};
+
+}
+
+#endif/*ZILLIANS_MONOTONICARENA_H_*/
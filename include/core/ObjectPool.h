@@ -21,20 +21,168 @@
 #define ZILLIANS_OBJECTPOOL_H_
 
 #include "core/Common.h"
-#if BUILD_WITH_TBB
-#include <tbb/concurrent_queue.h>
-#else
-#include "core/ConcurrentQueue.h"
-#endif
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <algorithm>
+#include <vector>
 
 #define ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE     0
 #define ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER  0
+#define ZILLIANS_OBJPOOL_MAGAZINE_SIZE            32
+#define ZILLIANS_OBJPOOL_SLAB_SIZE                (64 * 1024)
 
 namespace zillians {
 
+namespace detail {
+
+/**
+ * Contiguous slabs of objects preallocated by reservePool().
+ *
+ * Objects carved from a slab can't be given back to the heap individually, so
+ * they always stay in the pool, and a slab is freed by shrinkPool() only once all
+ * of its objects are back in the pool.
+ */
+class ObjectPoolSlabs
+{
+public:
+	/**
+	 * Allocate slabs for count objects and append the objects to the pooled list.
+	 */
+	void allocate(std::size_t objectSize, std::size_t count, std::vector<void*>& objects)
+	{
+		std::size_t objectsPerSlab = std::max<std::size_t>(1, ZILLIANS_OBJPOOL_SLAB_SIZE / objectSize);
+		while(count > 0)
+		{
+			Slab slab;
+			slab.count = std::min(count, objectsPerSlab);
+			slab.begin = static_cast<byte*>(::operator new(slab.count * objectSize));
+			slab.end = slab.begin + slab.count * objectSize;
+			slabs.insert(std::upper_bound(slabs.begin(), slabs.end(), slab), slab);
+
+			// pools are LIFO, so push in reverse to hand the objects out in address order
+			for(std::size_t i = slab.count; i > 0; --i)
+				objects.push_back(slab.begin + (i - 1) * objectSize);
+			count -= slab.count;
+		}
+	}
+
+	/**
+	 * Release pooled objects until at most n are left.
+	 *
+	 * Heap objects are deleted first, starting from the least recently pooled
+	 * ones, then the slabs with no object in use. Slabs with objects in use are
+	 * kept along with their pooled objects, so more than n objects may be left.
+	 */
+	void shrink(std::vector<void*>& objects, std::size_t n)
+	{
+		if(objects.size() <= n)
+			return;
+		std::size_t excess = objects.size() - n;
+
+		std::size_t kept = 0;
+		for(std::size_t i = 0; i < objects.size(); ++i)
+		{
+			if(excess > 0 && !contains(objects[i]))
+			{
+				::operator delete(objects[i]);
+				--excess;
+			}
+			else
+			{
+				objects[kept++] = objects[i];
+			}
+		}
+		objects.resize(kept);
+
+		if(excess == 0)
+			return;
+
+		// all heap objects are gone, count the pooled objects of each slab
+		std::vector<std::size_t> pooled(slabs.size(), 0);
+		for(std::size_t i = 0; i < objects.size(); ++i)
+			++pooled[find(objects[i]) - slabs.begin()];
+
+		std::vector<bool> freed(slabs.size(), false);
+		for(std::size_t i = 0; i < slabs.size() && excess > 0; ++i)
+		{
+			if(pooled[i] == slabs[i].count)
+			{
+				freed[i] = true;
+				excess -= std::min(excess, slabs[i].count);
+			}
+		}
+
+		kept = 0;
+		for(std::size_t i = 0; i < objects.size(); ++i)
+		{
+			if(!freed[find(objects[i]) - slabs.begin()])
+				objects[kept++] = objects[i];
+		}
+		objects.resize(kept);
+
+		kept = 0;
+		for(std::size_t i = 0; i < slabs.size(); ++i)
+		{
+			if(freed[i])
+				::operator delete(slabs[i].begin);
+			else
+				slabs[kept++] = slabs[i];
+		}
+		slabs.resize(kept);
+	}
+
+	inline bool contains(void* p) const
+	{
+		return find(p) != slabs.end();
+	}
+
+private:
+	struct Slab
+	{
+		bool operator< (const Slab& other) const { return begin < other.begin; }
+
+		byte* begin;
+		byte* end;
+		std::size_t count;
+	};
+
+	std::vector<Slab>::const_iterator find(void* p) const
+	{
+		Slab key;
+		key.begin = static_cast<byte*>(p);
+		std::vector<Slab>::const_iterator it = std::upper_bound(slabs.begin(), slabs.end(), key);
+		if(it == slabs.begin() || static_cast<byte*>(p) >= (--it)->end)
+			return slabs.end();
+		return it;
+	}
+
+	std::vector<Slab> slabs;	///< Sorted by address
+};
+
+}
+
+/**
+ * @brief Statistics of a single pooled type.
+ *
+ * All counters are cumulative except for Pooled. For ConcurrentObjectPool the
+ * counters only cover the shared depot, since allocations served by thread
+ * local magazines are never seen by other threads.
+ */
+struct ObjectPoolStat
+{
+	std::size_t Hits;		///< # of allocations served from the pool (or the depot)
+	std::size_t Misses;		///< # of allocations falling back to the global heap
+	std::size_t Releases;	///< # of objects given back to the global heap because the pool is full
+	std::size_t Pooled;		///< # of objects currently kept in the pool (or the depot)
+	std::size_t Capacity;	///< The maximum number of objects kept, 0 for unlimited
+};
+
 /**
  * @brief ObjectPool is a simple object pooling template.
  *
+ * The number of pooled objects can be tuned per type by setCapacity(), which
+ * defaults to ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE (0 for unlimited).
+ *
  * @note ObjectPool does not support concurrent new/delete on the same
  * type of object, use ConcurrentObjectPool for that case.
  *
@@ -58,12 +206,14 @@ public:
 #endif
  		if(mPool.allocations.empty())
  		{
+ 			++mPool.stat.Misses;
  			return ::operator new(size);
  		}
  		else
  		{
- 	 		void* obj = mPool.allocations.front();
- 	 		mPool.allocations.pop();
+ 			++mPool.stat.Hits;
+ 	 		void* obj = mPool.allocations.back();
+ 	 		mPool.allocations.pop_back();
  	 		return obj;
  		}
 	}
@@ -73,27 +223,66 @@ public:
 #if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
 		--mPool.allocationCount;
 #endif
-		if(ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE > 0 && mPool.allocations.size() > ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE)
+		if(mPool.stat.Capacity > 0 && mPool.allocations.size() >= mPool.stat.Capacity && !mPool.slabs.contains(p))
 		{
+			++mPool.stat.Releases;
 			::operator delete(p);
 		}
 		else
 		{
-			mPool.allocations.push(p);
+			mPool.allocations.push_back(p);
 		}
 	}
 
+	/**
+	 * @brief Delete all pooled objects.
+	 *
+	 * @note Slabs from reservePool() with objects still in use are kept.
+	 */
 	static void purge()
 	{
-		while(!mPool.allocations.empty())
-		{
-			void* obj = mPool.allocations.front();
-			::operator delete(obj);
-			mPool.allocations.pop();
-#if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
-			--mPool.allocationCount;
-#endif
-		}
+		mPool.slabs.shrink(mPool.allocations, 0);
+	}
+
+	/**
+	 * @brief Preallocate objects until n objects are pooled.
+	 *
+	 * Objects are allocated in contiguous slabs of ZILLIANS_OBJPOOL_SLAB_SIZE
+	 * bytes, so objects allocated one after another are adjacent in memory. Call
+	 * it at startup to avoid falling through to the global heap under the first
+	 * traffic. The pool capacity, if any, limits n.
+	 */
+	static void reservePool(std::size_t n)
+	{
+		if(mPool.stat.Capacity > 0 && n > mPool.stat.Capacity)
+			n = mPool.stat.Capacity;
+		if(mPool.allocations.size() < n)
+			mPool.slabs.allocate(sizeof(T), n - mPool.allocations.size(), mPool.allocations);
+	}
+
+	/**
+	 * @brief Release pooled objects until at most n objects are pooled.
+	 *
+	 * @note Slabs from reservePool() are freed as a whole, and only when none of their objects is in use.
+	 */
+	static void shrinkPool(std::size_t n)
+	{
+		mPool.slabs.shrink(mPool.allocations, n);
+	}
+
+	/**
+	 * @brief Set the maximum number of objects kept in the pool, 0 for unlimited.
+	 */
+	static void setCapacity(std::size_t capacity)
+	{
+		mPool.stat.Capacity = capacity;
+	}
+
+	static ObjectPoolStat getStat()
+	{
+		ObjectPoolStat stat = mPool.stat;
+		stat.Pooled = mPool.allocations.size();
+		return stat;
 	}
 
 protected:
@@ -103,12 +292,19 @@ protected:
 	 */
 	struct AutoPoolImpl
 	{
-		AutoPoolImpl() { }
+		AutoPoolImpl()
+		{
+			stat.Hits = stat.Misses = stat.Releases = stat.Pooled = 0;
+			stat.Capacity = ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE;
+		}
 		~AutoPoolImpl() { ObjectPool<T>::purge(); }
 #if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
 		tbb::atomic<long> allocationCount;
 #endif
-		std::queue<void*> allocations;
+		// objects are reused in LIFO order, which are more likely to be still in cache
+		std::vector<void*> allocations;
+		detail::ObjectPoolSlabs slabs;
+		ObjectPoolStat stat;
 	};
 	static AutoPoolImpl mPool;
 };
@@ -119,9 +315,17 @@ template<typename T> typename ObjectPool<T>::AutoPoolImpl ObjectPool<T>::mPool;
  * ConcurrentObjectPool is a simple object pooling template supporting
  * concurrent allocations and deallocations.
  *
- * @note Since ConcurrentObjectPool does support concurrent new/delete on
- * the same type of object, it also brings some overhead while managing
- * the internal queue. Use it with performance caution.
+ * Like a slab allocator, each thread caches objects in two magazines (one being
+ * loaded and one previously used) of ZILLIANS_OBJPOOL_MAGAZINE_SIZE objects, so
+ * most new/delete never leave the thread. Only when both magazines are empty
+ * (or full) the thread exchanges a whole magazine with the shared depot under
+ * a lock, so the depot is touched once per magazine instead of once per object.
+ *
+ * The number of objects kept in the depot can be tuned per type by
+ * setCapacity(), which defaults to ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE (0 for
+ * unlimited). Each thread keeps up to two magazines of objects on top of that.
+ *
+ * @note Objects cached by a thread are handed to the depot when the thread exits.
  *
  * @see ObjectPool
  */
@@ -141,17 +345,48 @@ public:
 #if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
 		++mPool.allocationCount;
 #endif
- 		void* obj = NULL;
- 		mPool.allocations.try_pop(obj);
-
-		if(obj)
-		{
-			return obj;
-		}
-		else
+		Cache* cache = getCache();
+		if(cache->loaded->count == 0)
 		{
-			return ::operator new(size);
+			if(cache->previous->count > 0)
+			{
+				std::swap(cache->loaded, cache->previous);
+			}
+			else
+			{
+				// exchange the empty magazine for a full one from depot
+				boost::mutex::scoped_lock lock(mPool.depotLock);
+				Magazine* full = mPool.fullMagazines;
+				if(!full)
+				{
+					if(!mPool.spare.empty())
+					{
+						// refill the empty magazine from loose objects
+						std::size_t count = std::min<std::size_t>(mPool.spare.size(), ZILLIANS_OBJPOOL_MAGAZINE_SIZE);
+						std::copy(mPool.spare.end() - count, mPool.spare.end(), cache->loaded->objects);
+						cache->loaded->count = count;
+						mPool.spare.resize(mPool.spare.size() - count);
+						mPool.stat.Pooled -= count;
+						++mPool.stat.Hits;
+						lock.unlock();
+						return cache->loaded->objects[--cache->loaded->count];
+					}
+
+					++mPool.stat.Misses;
+					lock.unlock();
+					return ::operator new(size);
+				}
+				mPool.fullMagazines = full->next;
+				mPool.stat.Pooled -= full->count;
+				++mPool.stat.Hits;
+
+				cache->loaded->next = mPool.emptyMagazines;
+				mPool.emptyMagazines = cache->loaded;
+				cache->loaded = full;
+			}
 		}
+
+		return cache->loaded->objects[--cache->loaded->count];
 	}
 
 	static void operator delete(void* p)
@@ -159,48 +394,262 @@ public:
 #if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
 		--mPool.allocationCount;
 #endif
-		if(ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE > 0 && mPool.allocations.size() > ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE)
+		Cache* cache = getCache();
+		if(cache->loaded->count == ZILLIANS_OBJPOOL_MAGAZINE_SIZE)
 		{
-			::operator delete(p);
+			if(cache->previous->count == 0)
+			{
+				std::swap(cache->loaded, cache->previous);
+			}
+			else
+			{
+				// exchange the full magazine for an empty one from depot
+				boost::mutex::scoped_lock lock(mPool.depotLock);
+				if(mPool.stat.Capacity > 0 && mPool.stat.Pooled + ZILLIANS_OBJPOOL_MAGAZINE_SIZE > mPool.stat.Capacity)
+				{
+					if(mPool.slabs.contains(p))
+					{
+						mPool.spare.push_back(p);
+						++mPool.stat.Pooled;
+						return;
+					}
+
+					++mPool.stat.Releases;
+					lock.unlock();
+					::operator delete(p);
+					return;
+				}
+
+				Magazine* empty = mPool.emptyMagazines;
+				if(empty)
+					mPool.emptyMagazines = empty->next;
+
+				cache->loaded->next = mPool.fullMagazines;
+				mPool.fullMagazines = cache->loaded;
+				mPool.stat.Pooled += cache->loaded->count;
+
+				lock.unlock();
+				cache->loaded = empty ? empty : new Magazine;
+			}
 		}
-		else
+
+		cache->loaded->objects[cache->loaded->count++] = p;
+	}
+
+	/**
+	 * @brief Delete all objects in the depot and the magazines of the calling thread.
+	 *
+	 * @note Objects cached by other threads are not affected, neither are slabs
+	 * from reservePool() with objects still in use.
+	 */
+	static void purge()
+	{
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		Cache* cache = mPool.cache.get();
+		if(cache)
 		{
-			mPool.allocations.push(p);
+			mPool.unload(cache->loaded);
+			mPool.unload(cache->previous);
 		}
+
+		mPool.shrink(0);
+		mPool.deleteMagazines(mPool.emptyMagazines);
 	}
 
-	static void purge()
+	/**
+	 * @brief Preallocate objects into the depot until n objects are pooled.
+	 *
+	 * Objects are allocated in contiguous slabs of ZILLIANS_OBJPOOL_SLAB_SIZE
+	 * bytes and handed to threads a magazine at a time, so objects allocated one
+	 * after another by a thread are adjacent in memory. Call it at startup to
+	 * avoid falling through to the global heap under the first traffic. The depot
+	 * capacity, if any, limits n.
+	 */
+	static void reservePool(std::size_t n)
+	{
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		if(mPool.stat.Capacity > 0 && n > mPool.stat.Capacity)
+			n = mPool.stat.Capacity;
+		if(mPool.stat.Pooled < n)
+		{
+			mPool.slabs.allocate(sizeof(T), n - mPool.stat.Pooled, mPool.spare);
+			mPool.stat.Pooled = n;
+		}
+	}
+
+	/**
+	 * @brief Release objects in the depot until at most n objects are pooled.
+	 *
+	 * @note Slabs from reservePool() are freed as a whole, and only when none of
+	 * their objects is in use or cached by a thread.
+	 */
+	static void shrinkPool(std::size_t n)
+	{
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		mPool.shrink(n);
+	}
+
+	/**
+	 * @brief Set the maximum number of objects kept in the depot, 0 for unlimited.
+	 */
+	static void setCapacity(std::size_t capacity)
+	{
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		mPool.stat.Capacity = capacity;
+	}
+
+	static ObjectPoolStat getStat()
+	{
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		return mPool.stat;
+	}
+
+protected:
+	struct Magazine
+	{
+		Magazine() : next(NULL), count(0)
+		{ }
+
+		Magazine* next;
+		std::size_t count;
+		void* objects[ZILLIANS_OBJPOOL_MAGAZINE_SIZE];
+	};
+
+	struct Cache
+	{
+		Magazine* loaded;
+		Magazine* previous;
+	};
+
+	static inline Cache* getCache()
 	{
-		while(!mPool.allocations.empty())
+		Cache* cache = mPool.cache.get();
+		if(UNLIKELY(!cache))
 		{
-			void* obj = NULL;
-			if(mPool.allocations.try_pop(obj))
+			cache = new Cache;
+			cache->loaded = new Magazine;
+			cache->previous = new Magazine;
+			mPool.cache.reset(cache);
+		}
+		return cache;
+	}
+
+	/**
+	 * Hand the objects cached by an exiting thread to the depot.
+	 */
+	static void CacheCleanUpFunction(Cache* cache)
+	{
+		Magazine* magazines[2] = { cache->loaded, cache->previous };
+		delete cache;
+
+		boost::mutex::scoped_lock lock(mPool.depotLock);
+		for(int i = 0; i < 2; ++i)
+		{
+			Magazine* m = magazines[i];
+			if(m->count == 0 || (mPool.stat.Capacity > 0 && mPool.stat.Pooled + m->count > mPool.stat.Capacity))
 			{
-				::operator delete(obj);
-#if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
-				--mPool.allocationCount;
-#endif
+				mPool.release(m);
+				m->next = mPool.emptyMagazines;
+				mPool.emptyMagazines = m;
+			}
+			else
+			{
+				mPool.stat.Pooled += m->count;
+				m->next = mPool.fullMagazines;
+				mPool.fullMagazines = m;
 			}
 		}
 	}
 
-protected:
 	/**
 	 * This is used to ensure the ObjectPool<T>::purge() is called before
 	 * destroying the internal object pool container.
 	 */
 	struct AutoPoolImpl
 	{
-		AutoPoolImpl() { }
-		~AutoPoolImpl() { ConcurrentObjectPool<T>::purge(); }
+		AutoPoolImpl() : fullMagazines(NULL), emptyMagazines(NULL), cache(CacheCleanUpFunction)
+		{
+			stat.Hits = stat.Misses = stat.Releases = stat.Pooled = 0;
+			stat.Capacity = ZILLIANS_OBJPOOL_PREFERABLE_POOL_SIZE;
+		}
+		~AutoPoolImpl()
+		{
+			// flush the magazines of the destructing thread first
+			cache.reset();
+			ConcurrentObjectPool<T>::purge();
+		}
+
+		/**
+		 * Give the objects of the magazine back to the heap, except for slab
+		 * objects which are kept as loose objects. The depot lock must be held.
+		 */
+		void release(Magazine* m)
+		{
+			for(std::size_t i = 0; i < m->count; ++i)
+			{
+				if(slabs.contains(m->objects[i]))
+				{
+					spare.push_back(m->objects[i]);
+					++stat.Pooled;
+				}
+				else
+				{
+					++stat.Releases;
+					::operator delete(m->objects[i]);
+				}
+			}
+			m->count = 0;
+		}
+
+		/**
+		 * Move the objects of the magazine to the loose objects of the depot.
+		 */
+		void unload(Magazine* m)
+		{
+			spare.insert(spare.end(), m->objects, m->objects + m->count);
+			stat.Pooled += m->count;
+			m->count = 0;
+		}
+
+		/**
+		 * Release objects in the depot until at most n are left, the remaining
+		 * ones are kept as loose objects. The depot lock must be held.
+		 */
+		void shrink(std::size_t n)
+		{
+			while(fullMagazines)
+			{
+				Magazine* m = fullMagazines;
+				fullMagazines = m->next;
+				unload(m);
+				m->next = emptyMagazines;
+				emptyMagazines = m;
+			}
+
+			slabs.shrink(spare, n);
+			stat.Pooled = spare.size();
+		}
+
+		void deleteMagazines(Magazine*& head)
+		{
+			while(head)
+			{
+				Magazine* m = head;
+				head = m->next;
+				delete m;
+			}
+		}
+
 #if ZILLIANS_OBJPOOL_ENABLE_OBJ_POOL_COUNTER
 		tbb::atomic<long> allocationCount;
 #endif
-#if BUILD_WITH_TBB
-		tbb::concurrent_bounded_queue<void*> allocations;
-#else
-		ConcurrentQueue<void*> allocations;
-#endif
+		boost::mutex depotLock;
+		Magazine* fullMagazines;	///< Magazines holding objects, not necessarily full
+		Magazine* emptyMagazines;
+		std::vector<void*> spare;	///< Loose objects, handed out a magazine at a time
+		detail::ObjectPoolSlabs slabs;
+		ObjectPoolStat stat;
+		boost::thread_specific_ptr<Cache> cache;
 	};
 	static AutoPoolImpl mPool;
 };
@@ -0,0 +1,173 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_PINNEDBUFFERALLOCATOR_H_
+#define ZILLIANS_PINNEDBUFFERALLOCATOR_H_
+
+#include "core/Buffer.h"
+
+#include <boost/noncopyable.hpp>
+#include <map>
+#include <cuda_runtime_api.h>
+
+namespace zillians {
+
+/**
+ * @brief PinnedBufferAllocator allocates page-locked host memory by cudaHostAlloc().
+ *
+ * The driver can DMA page-locked memory directly, so uploads from a buffer using this
+ * allocator skip the staging copy through the driver's bounce buffer and can run
+ * asynchronously with cudaMemcpyAsync(). Pinning memory is expensive, so freed blocks
+ * are kept and reused up to the cache limit. The same applies to device memory taken
+ * by allocateDevice(), which DeviceMirroredBuffer uses for its device copy.
+ *
+ * @code
+ * Buffer b(1024 * 1024, PinnedBufferAllocator::instance());
+ * @endcode
+ *
+ * @note Only available when built with CUDA (BUILD_WITH_CUDA).
+ */
+class PinnedBufferAllocator : public BufferAllocator
+{
+public:
+	enum
+	{
+		DEFAULT_CACHE_LIMIT = 64 * 1024 * 1024,	///< Total size of freed blocks kept for reuse, for host and device each
+	};
+
+	/**
+	 * @param flags The flags passed to cudaHostAlloc(), e.g. add cudaHostAllocWriteCombined for upload-only buffers.
+	 * @param cacheLimit The total size of freed blocks kept for reuse.
+	 */
+	PinnedBufferAllocator(unsigned int flags = cudaHostAllocPortable, std::size_t cacheLimit = DEFAULT_CACHE_LIMIT);
+	virtual ~PinnedBufferAllocator();
+
+public:
+	virtual byte* allocate(std::size_t size);
+	virtual void deallocate(byte* data);
+
+	virtual std::size_t getGranularity() const { return mPageSize; }
+
+	/**
+	 * @brief Allocate device memory on the current device, reusing a cached block if possible.
+	 */
+	void* allocateDevice(std::size_t size);
+	void deallocateDevice(void* data);
+
+	/**
+	 * @brief Give all cached host and device blocks back to the driver.
+	 */
+	void trim();
+
+	static PinnedBufferAllocator* instance();
+
+private:
+	struct BlockCache
+	{
+		BlockCache() : cachedSize(0)
+		{ }
+
+		std::map<void*, std::size_t> blocks;		///< All live blocks and their real sizes
+		std::multimap<std::size_t, void*> freed;	///< Freed blocks by size
+		std::size_t cachedSize;
+	};
+
+	void* take(BlockCache& cache, std::size_t size);
+	bool give(BlockCache& cache, void* data);
+	void release(BlockCache& cache, bool device);
+
+private:
+	unsigned int mFlags;
+	std::size_t mPageSize;
+	std::size_t mCacheLimit;
+
+	BlockCache mHost;
+	BlockCache mDevice;
+	boost::mutex mLock;
+};
+
+/**
+ * @brief DeviceMirroredBuffer pairs a pinned host buffer with a device allocation of the same capacity.
+ *
+ * Data written into host() is uploaded to the beginning of device() asynchronously on the
+ * given stream, so the transfer overlaps with kernels on other streams and with the host
+ * preparing the next batch. Results come back the same way by download(). Objects are
+ * allocated from ConcurrentObjectPool and the memory from the cache of the allocator, so
+ * a buffer per batch is cheap.
+ *
+ * @code
+ * DeviceMirroredBuffer* b = new DeviceMirroredBuffer(capacity, stream);
+ * b->host() << input;
+ * b->upload();
+ * kernel<<<grid, block, 0, stream>>>(b->device());
+ * b->download(outputSize);
+ * b->synchronize();
+ * b->host() >> output;
+ * delete b;
+ * @endcode
+ *
+ * @note The host data must not be modified while an upload is in flight, i.e. until synchronize().
+ */
+class DeviceMirroredBuffer : public ConcurrentObjectPool<DeviceMirroredBuffer>, public boost::noncopyable
+{
+public:
+	DeviceMirroredBuffer(std::size_t capacity, cudaStream_t stream = 0, PinnedBufferAllocator* allocator = PinnedBufferAllocator::instance());
+	~DeviceMirroredBuffer();
+
+public:
+	inline Buffer& host() { return mHost; }
+	inline void* device() const { return mDevice; }
+	inline std::size_t capacity() const { return mCapacity; }
+	inline cudaStream_t stream() const { return mStream; }
+
+	/**
+	 * @brief Start copying the data of the host buffer to the beginning of the device memory.
+	 *
+	 * The host buffer is not consumed.
+	 *
+	 * @return The number of bytes being uploaded.
+	 */
+	std::size_t upload();
+
+	/**
+	 * @brief Start copying bytes from the beginning of the device memory into the free space of the host buffer.
+	 *
+	 * The data becomes readable from host() after synchronize().
+	 *
+	 * @param size The number of bytes to download.
+	 */
+	void download(std::size_t size);
+
+	/**
+	 * @brief Wait for all transfers and kernels on the stream, and commit pending downloads.
+	 */
+	void synchronize();
+
+private:
+	PinnedBufferAllocator* mAllocator;
+	Buffer mHost;
+	void* mDevice;
+	std::size_t mCapacity;
+	cudaStream_t mStream;
+	std::size_t mPendingDownload;
+};
+
+}
+
+#endif/*ZILLIANS_PINNEDBUFFERALLOCATOR_H_*/
@@ -38,4 +38,9 @@
 #define NOMINMAX
 #endif
 
+// native coroutines (C++20, or -fcoroutines on gcc 10), see threading/Awaitable.h
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define ZILLIANS_HAS_COROUTINES 1
+#endif
+
 #endif/*ZILLIANS_PLATFORM_H_*/
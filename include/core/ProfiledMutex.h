@@ -0,0 +1,236 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_PROFILEDMUTEX_H_
+#define ZILLIANS_PROFILEDMUTEX_H_
+
+#include "core/Common.h"
+#include <tbb/spin_mutex.h>
+#include <tbb/spin_rw_mutex.h>
+
+//#define ZILLIANS_ENABLE_LOCK_PROFILING ///< Record wait time, hold time and contention of every lock declared by ZILLIANS_PROFILED_MUTEX.
+
+/**
+ * Spinning locks never show up as blocking in a profiler, so the locks which
+ * limit scaling are found by declaring them through ZILLIANS_PROFILED_MUTEX
+ * with a named lock site:
+ *
+ * @code
+ * ZILLIANS_LOCK_SITE(PoolLockSite, "scalable_pool.pool");
+ * typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, PoolLockSite) pool_mutex_t;
+ *
+ * pool_mutex_t mPoolLock;
+ * ...
+ * pool_mutex_t::scoped_lock lock(mPoolLock);
+ * @endcode
+ *
+ * With ZILLIANS_ENABLE_LOCK_PROFILING the mutex is a ProfiledMutex recording into
+ * the metrics "lock.<site>.acquisitions", "lock.<site>.contentions", "lock.<site>.wait_ns"
+ * (contended acquisitions only) and "lock.<site>.hold_ns" of MetricRegistry, shared
+ * by all mutexes of the site. Without it, the type is the plain mutex.
+ */
+#ifdef ZILLIANS_ENABLE_LOCK_PROFILING
+#include "core/Metrics.h"
+
+#define ZILLIANS_LOCK_SITE(tag, name) \
+	struct tag \
+	{ \
+		static zillians::LockSite& site() { static zillians::LockSite s(name); return s; } \
+	}
+
+#define ZILLIANS_PROFILED_MUTEX(mutex_type, tag) zillians::ProfiledMutex<mutex_type, tag>
+
+#else
+
+#define ZILLIANS_LOCK_SITE(tag, name) struct tag { }
+#define ZILLIANS_PROFILED_MUTEX(mutex_type, tag) mutex_type
+
+#endif
+
+#ifdef ZILLIANS_ENABLE_LOCK_PROFILING
+namespace zillians {
+
+/**
+ * @brief The metrics of one named lock site.
+ */
+class LockSite : public boost::noncopyable
+{
+public:
+	explicit LockSite(const std::string& name) :
+		acquisitions("lock." + name + ".acquisitions"),
+		contentions("lock." + name + ".contentions"),
+		wait("lock." + name + ".wait_ns"),
+		hold("lock." + name + ".hold_ns")
+	{ }
+
+public:
+	MetricCounter acquisitions;
+	MetricCounter contentions;	///< Acquisitions which found the lock taken
+	MetricHistogram wait;		///< Time spent to acquire a taken lock
+	MetricHistogram hold;		///< Time from acquisition to release
+};
+
+namespace detail {
+
+// exclusive locks ignore the write flag, tbb::spin_rw_mutex takes it
+template<typename Lock, typename Mutex>
+inline bool try_acquire_lock(Lock& lock, Mutex& mutex, bool write)
+{
+	UNUSED_ARGUMENT(write);
+	return lock.try_acquire(mutex);
+}
+
+template<typename Lock, typename Mutex>
+inline void acquire_lock(Lock& lock, Mutex& mutex, bool write)
+{
+	UNUSED_ARGUMENT(write);
+	lock.acquire(mutex);
+}
+
+inline bool try_acquire_lock(tbb::spin_rw_mutex::scoped_lock& lock, tbb::spin_rw_mutex& mutex, bool write)
+{
+	return lock.try_acquire(mutex, write);
+}
+
+inline void acquire_lock(tbb::spin_rw_mutex::scoped_lock& lock, tbb::spin_rw_mutex& mutex, bool write)
+{
+	lock.acquire(mutex, write);
+}
+
+}
+
+/**
+ * @brief ProfiledMutex wraps a tbb mutex and records how it's used into the metrics of its site.
+ *
+ * An uncontended acquisition costs a try-lock and two clock reads (for the hold time),
+ * only a contended one is timed while waiting.
+ */
+template<typename Mutex, typename Site>
+class ProfiledMutex : public boost::noncopyable
+{
+public:
+	ProfiledMutex() : mAcquired(0)
+	{ }
+
+public:
+	class scoped_lock : public boost::noncopyable
+	{
+	public:
+		scoped_lock() : mMutex(NULL), mAcquired(0)
+		{ }
+
+		scoped_lock(ProfiledMutex& mutex, bool write = true) : mMutex(NULL), mAcquired(0)
+		{
+			acquire(mutex, write);
+		}
+
+		~scoped_lock()
+		{
+			if(mMutex) release();
+		}
+
+	public:
+		void acquire(ProfiledMutex& mutex, bool write = true)
+		{
+			LockSite& site = Site::site();
+			if(!detail::try_acquire_lock(mLock, mutex.mMutex, write))
+			{
+				uint64 start = TimerUtil::now_ns();
+				detail::acquire_lock(mLock, mutex.mMutex, write);
+				mAcquired = TimerUtil::now_ns();
+				site.contentions.increment();
+				site.wait.record(mAcquired - start);
+			}
+			else
+			{
+				mAcquired = TimerUtil::now_ns();
+			}
+			site.acquisitions.increment();
+			mMutex = &mutex;
+		}
+
+		bool try_acquire(ProfiledMutex& mutex, bool write = true)
+		{
+			if(!detail::try_acquire_lock(mLock, mutex.mMutex, write))
+				return false;
+			mAcquired = TimerUtil::now_ns();
+			Site::site().acquisitions.increment();
+			mMutex = &mutex;
+			return true;
+		}
+
+		void release()
+		{
+			uint64 held = TimerUtil::now_ns() - mAcquired;
+			mLock.release();
+			mMutex = NULL;
+			Site::site().hold.record(held);
+		}
+
+	private:
+		typename Mutex::scoped_lock mLock;
+		ProfiledMutex* mMutex;
+		uint64 mAcquired;
+	};
+
+public:
+	// for exclusive use only, readers of a read-write mutex go through scoped_lock
+	void lock()
+	{
+		LockSite& site = Site::site();
+		if(!mMutex.try_lock())
+		{
+			uint64 start = TimerUtil::now_ns();
+			mMutex.lock();
+			mAcquired = TimerUtil::now_ns();
+			site.contentions.increment();
+			site.wait.record(mAcquired - start);
+		}
+		else
+		{
+			mAcquired = TimerUtil::now_ns();
+		}
+		site.acquisitions.increment();
+	}
+
+	bool try_lock()
+	{
+		if(!mMutex.try_lock())
+			return false;
+		mAcquired = TimerUtil::now_ns();
+		Site::site().acquisitions.increment();
+		return true;
+	}
+
+	void unlock()
+	{
+		uint64 held = TimerUtil::now_ns() - mAcquired;
+		mMutex.unlock();
+		Site::site().hold.record(held);
+	}
+
+private:
+	Mutex mMutex;
+	uint64 mAcquired;	///< When lock() returned, only valid while held exclusively
+};
+
+}
+#endif
+
+#endif/*ZILLIANS_PROFILEDMUTEX_H_*/
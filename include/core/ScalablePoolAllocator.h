@@ -26,15 +26,23 @@
 #define ZILLIANS_SCALABLEPOOLALLOCATOR_H_
 
 #include "core/Prerequisite.h"
+#include "core/Atomic.h"
+#include "core/Metrics.h"
+#include "core/ProfiledMutex.h"
 #include "tbb/spin_mutex.h"// for synchronization
 #include "tbb/atomic.h"
 #include "boost/thread.hpp"
 #include "log4cxx/logger.h"
+#include <vector>
+#include <limits>
+#include <new>
 
 #define ZILLIANS_SCALABLEALLOCATOR_STATISTICS ///< Enable statistics for debugging purposes.
 
 namespace zillians {
 
+class AllocationTracer;
+
 /**
  * @brief ScalablePoolAllocator is an allocator which allocates memory from the given memory pool
  *
@@ -48,29 +56,146 @@ namespace zillians {
  *
  * Inside ScalablePoolAllocator we have a global free memory block list, multiple bins within which
  * we have a list of memory blocks.
+ *
+ * On NUMA machines the free block list can be partitioned per node by giving nodeCount (or 0 to
+ * detect the number of nodes from the system). Blocks are then carved for, and bound to, the node
+ * of the calling thread, and a thread only takes blocks from other nodes when the pool runs out
+ * of uncarved memory. In this mode the pool memory is not touched by the constructor, so pass in
+ * memory that hasn't been touched yet (i.e. fresh from mmap()) to keep pages off the node of the
+ * constructing thread.
+ *
+ * Big pools suffer from TLB misses with normal pages, take the pool memory from HugePageRegion
+ * to back it by huge pages instead. Blocks never cross a huge page since they're aligned to
+ * their size.
  */
 class ScalablePoolAllocator
 {
 public:// Interface
-	ScalablePoolAllocator(byte* pMemory, size_t size, size_t* binSizes = 0, size_t binCount = 0);
+	/**
+	 * @param pMemory The pool memory.
+	 * @param size The size of the pool memory.
+	 * @param binSizes The chunk sizes of the bins, or NULL for the default 32 bins between 8 and 8K bytes.
+	 * @param binCount The number of bins in binSizes.
+	 * @param nodeCount The number of NUMA nodes to partition the pool for, or 0 to detect.
+	 * @param zeroFilled True if the pool memory is known to be zero-filled (i.e. fresh from mmap()),
+	 * so the constructor doesn't touch the whole pool to clear it and only the used part becomes resident.
+	 */
+	ScalablePoolAllocator(byte* pMemory, size_t size, size_t* binSizes = 0, size_t binCount = 0, size_t nodeCount = 1, bool zeroFilled = false);
 	virtual ~ScalablePoolAllocator();
 
 	virtual byte* allocate(size_t sz);
 	virtual void deallocate(byte* mem);
 
+	/**
+	 * @brief Deallocate a batch of memory at once.
+	 *
+	 * Chunks owned by other threads are grouped by block, so each block's public freelist is
+	 * updated once per batch instead of once per chunk. This is the preferred way to release
+	 * objects received from another thread, i.e. in producer/consumer pipelines.
+	 *
+	 * @param mems The array of memory to deallocate, NULL entries are ignored.
+	 * @param n The number of entries in the array.
+	 */
+	void deallocateBatch(byte** mems, size_t n);
+
+	/**
+	 * @brief Tell if the memory is inside the pool.
+	 */
+	inline bool contains(const byte* mem) const { return mem >= mPool && mem < mPoolEnd; }
+
+	/**
+	 * @brief Get the usable size of allocated memory, i.e. the chunk size, which may be larger than requested.
+	 */
+	size_t getUsableSize(byte* mem);
+
+	/**
+	 * @brief Hand all cross-thread frees cached by the calling thread back to their owners.
+	 *
+	 * deallocate() keeps chunks owned by other threads in a small per-thread cache, which is
+	 * flushed when a block's batch is full, when the cache runs out of slots, at the end of
+	 * deallocateBatch() and on thread exit. Call this when a thread goes idle so the owners can
+	 * reuse the memory earlier.
+	 */
+	void flushRemoteFrees();
+
+	/**
+	 * @brief Override the NUMA node of the calling thread.
+	 *
+	 * By default the node is detected from the CPU the thread first allocates on, which is only
+	 * reliable for threads pinned to a node.
+	 */
+	void setThreadNode(size_t node);
+	size_t getNodeCount() const { return NODE_COUNT; }
+
+	/**
+	 * @brief Give the pages of unused blocks back to the operating system.
+	 *
+	 * Empty blocks are never returned to the pool, so once a burst has touched the whole pool
+	 * it stays resident. trim() keeps the most recently freed blocks of each node up to the
+	 * given watermark, merges the rest into address-adjacent runs and madvise(MADV_DONTNEED)'s
+	 * each run except for the page holding its header. The blocks stay in the free block stacks
+	 * and are faulted back in (zero filled) when they're used again. Call it periodically from an idle or timer thread.
+	 *
+	 * @note Only meaningful for private anonymous memory, i.e. from mmap(MAP_PRIVATE | MAP_ANONYMOUS).
+	 * Don't call it on pinned, shared or file-backed pool memory.
+	 *
+	 * @param retainedBytes The bytes of free blocks to keep resident, split evenly among nodes.
+	 *
+	 * @return The number of bytes given back, which may include free space never touched before.
+	 */
+	size_t trim(size_t retainedBytes = 0);
+
+	/**
+	 * @brief Record all allocations and deallocations into the given tracer, or stop recording if NULL.
+	 *
+	 * Set it before the pool is shared with other threads, or make sure they're done with
+	 * the pool, since the tracer is read without synchronization.
+	 *
+	 * @note Don't trace the pool behind ScalablePoolMalloc, the tracer allocates its batches from the global heap.
+	 */
+	inline void setTracer(AllocationTracer* tracer) { mTracer = tracer; }
+
 private:// Types and forward declaration
 	typedef size_t ThreadID;
+
+	ZILLIANS_LOCK_SITE(PoolLockSite, "scalable_pool.pool");
+	ZILLIANS_LOCK_SITE(TrimLockSite, "scalable_pool.trim");
+	ZILLIANS_LOCK_SITE(TLSAllocationLockSite, "scalable_pool.tls_allocation");
+	ZILLIANS_LOCK_SITE(StackLockSite, "scalable_pool.stack");
+	ZILLIANS_LOCK_SITE(MailBoxLockSite, "scalable_pool.mail_box");
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, PoolLockSite) pool_mutex_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, TrimLockSite) trim_mutex_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, TLSAllocationLockSite) tls_allocation_mutex_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, StackLockSite) stack_mutex_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, MailBoxLockSite) mail_box_mutex_t;
 protected:
 	class FreeChunk;
 	class Block;
 	class Bin;
+	class RemoteFreeCache;
 
 private:// Method act on pool
+	byte* allocateChunk(size_t sz);
 	byte* allocateLarge(size_t sz);
 	void deallocateLarge(byte* mem);
 	bool isLargeChunk(byte* mem);
 
-	bool allocateBlocks();// Add more blocks to free block stack (mallocBigBlock)
+	size_t getLargeBinIndex(size_t sz);
+	size_t getLargeBinFloorIndex(size_t sz);
+	size_t getLargeBinSize(size_t idx);
+	byte* popLargeChunk(size_t idx, size_t sz);
+	byte* findLargeChunk(size_t sz);
+	void pushLargeChunk(byte* mem);
+	void splitLargeChunk(byte* mem, size_t sz);
+	byte* carveLargeChunk(size_t sz);
+	bool consolidateLargeChunks();
+	inline size_t& largeChunkSize(byte* mem) { return *reinterpret_cast<size_t*>(mem - sizeof(size_t)); }
+
+	bool allocateBlocks(size_t node);// Add more blocks to free block stack of the given node (mallocBigBlock)
+	void bindToNode(byte* mem, size_t sz, size_t node);
+	void decommitBlocks(Block* block);
+	size_t getHeaderPageSize(Block* block);
+	size_t getCommittedSize(Block* block);// Resident bytes of a free block (run) in free block stack
 
 private:
 
@@ -89,10 +214,15 @@ private:
 	void restoreBumpPtr(Block* block);
 
 private:// public freelist operations
-	tbb::spin_mutex mPublicFreeListLock;
 	Block* getPublicFreeListBlock(Bin* bin);
-	void privatizePublicFreeList(Block* block);
+	size_t privatizePublicFreeList(Block* block);
 	void freePublicChunk(Block* block, FreeChunk* chunk);
+	void freePublicChunks(Block* block, FreeChunk* head, FreeChunk* tail);
+
+private:// remote free cache operations
+	RemoteFreeCache* getRemoteFreeCache();
+	void freeRemoteChunk(RemoteFreeCache* cache, Block* block, FreeChunk* chunk);
+	void flushRemoteFreeCache(RemoteFreeCache* cache);
 
 private:// Per block operations
 	byte* allocateFromBlock(Block* block);
@@ -107,6 +237,8 @@ private:// Per block operations
 private:
 	Bin* allocateTLS(size_t sz);//bootstrapMalloc(tls size)
 	void deallocateTLS(Bin* p);//bootstrapFree
+	void registerTLS(Bin* bins);
+	void retireTLS(Bin* bins);
 
 protected:// Internal classes
 	class FreeChunk
@@ -127,8 +259,10 @@ protected:// Internal classes
 		FreeChunk*	mFreeList;			///< Pointer to private freelist
 		size_t		mAllocationCount;	///< # of objects allocated within the block
 		bool		mIsFull;			///< Indicate whether the block is ready for more allocation
-		FreeChunk*	mPublicFreeList;	///< FreeChunk's returned by threads other than owning thread.
+		FreeChunk* volatile	mPublicFreeList;	///< FreeChunk's returned by threads other than owning thread, updated by CAS only
 		Block*		mNextPrivatizable;//?
+		size_t		mNodeID;			///< The NUMA node partition the block memory belongs to, kept when the block is recycled
+		bool		mIsDecommitted;		///< Indicate whether the free space of a block (run) in free block stack has been given back by trim()
 	};//Block
 
 	class Bin
@@ -136,20 +270,48 @@ protected:// Internal classes
 	public:
 		Block*			mActiveBlock;	///< Points to the active block
 		Block*			mMailBox;		///<
-		tbb::spin_mutex	mMailBoxLock;	///< Lock to mail box
+		mail_box_mutex_t	mMailBoxLock;	///< Lock to mail box
+
+		/// Runtime counters, written by the owning thread only and read by getStats()
+		volatile size_t	mAllocations;			///< # of chunks allocated by the owning thread
+		volatile size_t	mDeallocations;			///< # of chunks of this size freed by the owning thread
+		volatile size_t	mPublicDeallocations;	///< # of chunks of this size freed into other thread's public freelist
+		volatile size_t	mPrivatizations;		///< # of chunks taken back from public freelist
+		volatile size_t	mBlockCount;			///< # of blocks linked into the bin
 
 		inline Block* getActiveBlock() { return mActiveBlock; }
 		inline void setActiveBlock(Block* block) { mActiveBlock = block; }
 		inline Block* setPreviousBlockActive();
 	};//Bin
 
-	class LargeChunk
+	class RemoteFreeCache
 	{
 	public:
-		LargeChunk*	mNext;
-		size_t		mSize;	///< The size available for allocation. (excluding the size header when allocated)
-		LargeChunk*	mPrev;
-	};
+		enum
+		{
+			SLOT_COUNT = 8,		///< Number of blocks the cache can batch for at the same time
+			BATCH_SIZE = 32,	///< Number of chunks batched for a block before they're pushed
+		};
+
+		class Slot
+		{
+		public:
+			Block*		mBlock;	///< The block all chunks in the slot belong to
+			FreeChunk*	mHead;
+			FreeChunk*	mTail;
+			size_t		mCount;
+		};
+
+		Slot	mSlots[SLOT_COUNT];
+		size_t	mVictim;	///< The next slot to be evicted when all slots are in use
+	};//RemoteFreeCache
+
+	class BinArrayHeader
+	{
+	public:
+		ScalablePoolAllocator*	mAllocator;	///< Owner of the TLS bins, it MUST be the first field (see BinTLSCleanUpFunction)
+		Bin*					mNextBins;	///< Next registered TLS bins
+	};//BinArrayHeader
 
 	class Stack// Helper class
 	{
@@ -157,9 +319,37 @@ protected:// Internal classes
 		inline Stack();
 		inline void push(void** p);
 		inline void* pop();
+		inline void* popAll(size_t& count);
+		inline void pushList(void** head, void** tail, size_t count);
+		inline size_t size() const { return mCount; }
 	private:
 		void* mTop;
-		tbb::spin_mutex mLock;
+		volatile size_t mCount;
+		stack_mutex_t mLock;
+	};
+
+	/**
+	 * Lock-free stack of large free chunks, one per large size class.
+	 *
+	 * The head packs the offset of the top chunk from the stack itself with a pop counter, so a pop
+	 * which read the successor of a chunk that was taken and pushed back in the meantime fails its
+	 * CAS instead of corrupting the list (ABA), without double-word CAS or hazard pointers. Large
+	 * chunks are never unmapped, so reading the successor of a chunk just taken by another thread
+	 * is harmless, the value is simply discarded.
+	 */
+	class LargeStack// Helper class
+	{
+	public:
+		inline LargeStack();
+		inline void push(void** p);
+		inline void* pop();
+		inline void* popAll();
+	private:
+		enum { OFFSET_BITS = 40 };	///< Chunks up to 8TB (in 8 byte units) above the stack, leaving 24 bits of pop counter
+		inline uint64 pack(void** p, uint64 pops) const;
+		inline void** unpack(uint64 head) const;
+		std::atomic<uint64> mHead;
+		char mPad[64 - sizeof(std::atomic<uint64>)];	///< Classes don't share cache lines
 	};
 
 private:// Constants
@@ -173,6 +363,9 @@ private:// Constants
 	const size_t TLS_SIZE;				///< Size of TLS, depends on number of Bins
 	const float EMPTY_ENOUGH_THRESHOLD;	///< The amount of which the usage in a block when it can be called "empty enough". Valid values are floats between [0, 1]
 	const size_t OWNER_ID_NULL;			///< Represent a null ID  (uint max)
+	const size_t NODE_COUNT;			///< Number of NUMA node partitions
+	const size_t LARGE_BIN_BASE;		///< Size of the smallest large chunk class, each power of two above is split into 8 classes
+	const size_t LARGE_BIN_COUNT;		///< Number of large chunk classes, the last one also holds everything larger
 
 private:// Utility methods
 	inline uintptr_t alignUp(uintptr_t ptr, uintptr_t alignTo)
@@ -205,15 +398,25 @@ private:// Utility methods
 private:// Pool variables
 	byte* mPool;	///< Pointer to memory-aligned pool
 	byte* mPoolEnd;	///< Pointer to the end of pool
-	tbb::spin_mutex mPoolLock;
+	pool_mutex_t mPoolLock;
 
 	byte* mBlockAllocPtr;	///< Points to free space start point at bottom address
-	Stack mFreeBlockStack;	///< A stack-ful of blocks ready to be allocated (freeBlockList)
+	Stack* mFreeBlockStacks;	///< Per node stack-ful of blocks ready to be allocated (freeBlockList)
 
 	byte* mBumpPtr;	///< Points to free space start point at top address. NOTE: This bump has different meaning to Block::mBumpPtr
 	/// @remarks While ScalableAllocator::mBumpPtr points to the end of the space, Block::mBumpPtr points to (UsedAddress - ChunkSize)
 
-	LargeChunk* mLargeFreeList;	///< Freelist of large chunks, in ascending size order
+	LargeStack* mLargeBins;	///< Size-segregated freelists of large chunks, coalesced in address order only when the pool runs out
+
+	byte* mLargeRegionEnd;		///< The initial value of mBumpPtr, where large allocation starts
+	tbb::atomic<size_t> mLargeChunkBytes;	///< Bytes held by allocated large chunks (including size header)
+	tbb::atomic<size_t> mLargeFreeBytes;	///< Bytes held by large chunks in mLargeBins (including size header)
+	size_t mHighWaterMark;		///< The maximum bytes ever taken from the pool by blocks and large chunks
+	inline void updateHighWaterMark()
+	{
+		size_t used = (mBlockAllocPtr - mPool) + (mLargeRegionEnd - mBumpPtr);
+		if(used > mHighWaterMark) mHighWaterMark = used;
+	}
 
 
 
@@ -224,15 +427,27 @@ private:// Thread local storage control
 	ThreadID	getThreadID();
 	tbb::atomic<ThreadID> mThreadCount;
 
+	size_t		getNodeID();
+	std::vector<size_t>	mCpuNodes;	///< Maps CPU index to NUMA node
+	tbb::atomic<size_t>	mLocalBlocks;	///< # of blocks handed to threads on the same node
+	tbb::atomic<size_t>	mRemoteBlocks;	///< # of blocks handed to threads on another node
+	tbb::atomic<size_t>	mTrimmedBytes;	///< Total bytes given back by trim()
+	trim_mutex_t		mTrimLock;		///< Serializes concurrent trim() calls
+
 	Bin* getBin(size_t sz);
-	tbb::spin_mutex	mTLSAllocationLock;	///< Lock used for alloc/dealloc of TLS(bins)
+	tls_allocation_mutex_t	mTLSAllocationLock;	///< Lock used for alloc/dealloc of TLS(bins)
 	FreeChunk*		mTLSChunkList;	///< Chunks freed and used for next TLS allocation (bootStrapObjectList)
 	Block*			mTLSUsedBlocks;	///< Blocks used for TLS allocation (bootStrapBlockUsed)
 	Block*			mTLSAllocBlock;	///< Block used for next TLS allocation (bootStrapBlock)
+	Bin*			mTLSBinList;	///< All live TLS bins, walked by getStats()
+	Bin*			mRetiredBins;	///< Counters folded from TLS bins of exited threads
 
 	boost::thread_specific_ptr<ThreadID>	mThreadID;///< TLS storing current thread's ID
+	boost::thread_specific_ptr<size_t>		mNodeID;///< TLS storing current thread's NUMA node plus one
 	boost::thread_specific_ptr<Bin>			mBins;///< TLS storing sized bins
 
+	AllocationTracer* mTracer;	///< Records allocations for replay, NULL if not tracing
+
 private:// Bins
 	typedef std::pair<size_t, size_t> SizePair;
 	size_t *mBinSizes;
@@ -277,6 +492,54 @@ public:// Statistics
 			GarbageCollection = 0;
 		}
 	};
+
+	/**
+	 * @brief Runtime statistics of a single size-class bin, aggregated over all threads.
+	 */
+	struct BinStat
+	{
+		size_t ChunkSize;			///< The chunk size of the bin
+		size_t ChunksPerBlock;		///< # of chunks fit into a single block
+		size_t LiveChunks;			///< # of chunks allocated and not yet freed
+		size_t FreeChunks;			///< # of chunks available in blocks of this size (including pending public frees)
+		size_t BlocksInTLS;			///< # of blocks held by thread local bins
+		size_t BlocksInGlobalBin;	///< # of partial blocks returned by exited threads
+		size_t PublicFreeListLength;///< # of chunks freed by non-owner threads and not yet privatized
+		size_t TotalAllocations;
+		size_t TotalDeallocations;
+	};
+
+	/**
+	 * @brief Runtime statistics of the whole pool.
+	 */
+	struct PoolStat
+	{
+		size_t PoolSize;			///< Usable bytes of the pool
+		size_t BlockBytes;			///< Bytes taken by blocks, which are never given back
+		size_t LargeChunkBytes;		///< Bytes held by allocated large chunks
+		size_t LargeFreeBytes;		///< Bytes in the large chunk freelist
+		size_t HighWaterMark;		///< The maximum bytes ever taken by blocks and large chunks
+		size_t ThreadCount;			///< # of threads currently holding thread local bins
+		size_t NodeCount;			///< # of NUMA node partitions
+		size_t LocalBlocks;			///< # of blocks handed to threads on the node the block belongs to
+		size_t RemoteBlocks;		///< # of blocks handed to threads on another node, i.e. cross-socket memory
+		size_t TrimmedBytes;		///< Total bytes given back to the operating system by trim()
+		std::vector<BinStat> Bins;
+	};
+
+	/**
+	 * @brief Collect the runtime statistics.
+	 *
+	 * Unlike getAllocatorStat(), this is always available. Counters are kept per thread
+	 * and per bin without atomic operations, and are only summed up here, so the
+	 * allocation path stays cheap and other threads are never blocked except for
+	 * thread creation/exit and large allocations during the call.
+	 *
+	 * @note Since threads keep running, the result is a close approximation rather than
+	 * a consistent snapshot.
+	 */
+	PoolStat getStats();
+
 #ifdef ZILLIANS_SCALABLEALLOCATOR_STATISTICS
 private:
 	AllocatorStat mStatistics;
@@ -299,6 +562,136 @@ inline AllocatorStat getAllocatorStat() { AllocatorStat a; a.StatAvailable = fal
 #endif//ZILLIANS_SCALABLEALLOCATOR_STATISTICS
 };
 
+/**
+ * @brief ScalablePoolBufferAllocator adapts ScalablePoolAllocator to BufferAllocator,
+ * so that the internal data of BufferBase objects can be drawn from the memory pool.
+ *
+ * @code
+ * 		ScalablePoolAllocator pool(memory, size);
+ * 		ScalablePoolBufferAllocator allocator(pool);
+ * 		Buffer* b = new Buffer(1024, &allocator);
+ * @endcode
+ */
+class ScalablePoolBufferAllocator : public BufferAllocator
+{
+public:
+	ScalablePoolBufferAllocator(ScalablePoolAllocator& pool) : mPool(pool)
+	{ }
+
+	virtual ~ScalablePoolBufferAllocator()
+	{ }
+
+public:
+	virtual byte* allocate(std::size_t size)
+	{
+		return mPool.allocate(size);
+	}
+
+	virtual void deallocate(byte* data)
+	{
+		mPool.deallocate(data);
+	}
+
+private:
+	ScalablePoolAllocator& mPool;
+};
+
+/**
+ * @brief ScalablePoolStlAllocator is a std-compatible allocator adapter of ScalablePoolAllocator.
+ *
+ * Use it to put a particular container on the per-thread bins of a pool without replacing
+ * the global heap (see ScalablePoolMalloc for that).
+ *
+ * @code
+ * 		ScalablePoolAllocator pool(memory, size);
+ * 		std::map<int, int, std::less<int>, ScalablePoolStlAllocator<std::pair<const int, int> > > m(std::less<int>(), pool);
+ * @endcode
+ */
+template<typename T>
+class ScalablePoolStlAllocator
+{
+	template<typename U> friend class ScalablePoolStlAllocator;
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef ScalablePoolStlAllocator<U> other;
+	};
+
+public:
+	ScalablePoolStlAllocator(ScalablePoolAllocator& pool) : mPool(&pool)
+	{ }
+
+	ScalablePoolStlAllocator(const ScalablePoolStlAllocator& other) : mPool(other.mPool)
+	{ }
+
+	template<typename U>
+	ScalablePoolStlAllocator(const ScalablePoolStlAllocator<U>& other) : mPool(other.mPool)
+	{ }
+
+public:
+	inline pointer address(reference x) const { return &x; }
+	inline const_pointer address(const_reference x) const { return &x; }
+
+	inline pointer allocate(size_type n, const void* hint = 0)
+	{
+		UNUSED_ARGUMENT(hint);
+		byte* p = mPool->allocate(n * sizeof(T));
+		if(UNLIKELY(!p))
+			throw std::bad_alloc();
+		return reinterpret_cast<pointer>(p);
+	}
+
+	inline void deallocate(pointer p, size_type n)
+	{
+		UNUSED_ARGUMENT(n);
+		mPool->deallocate(reinterpret_cast<byte*>(p));
+	}
+
+	inline size_type max_size() const
+	{
+		return std::numeric_limits<size_type>::max() / sizeof(T);
+	}
+
+	inline void construct(pointer p, const T& value)
+	{
+		new((void*)p) T(value);
+	}
+
+	inline void destroy(pointer p)
+	{
+		p->~T();
+	}
+
+	inline ScalablePoolAllocator& pool() const
+	{
+		return *mPool;
+	}
+
+	template<typename U>
+	inline bool operator== (const ScalablePoolStlAllocator<U>& other) const
+	{
+		return mPool == other.mPool;
+	}
+
+	template<typename U>
+	inline bool operator!= (const ScalablePoolStlAllocator<U>& other) const
+	{
+		return mPool != other.mPool;
+	}
+
+private:
+	ScalablePoolAllocator* mPool;
+};
+
 }
 
 #endif/*ZILLIANS_SCALABLEPOOLALLOCATOR_H_*/
@@ -0,0 +1,51 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SCALABLEPOOLMALLOC_H_
+#define ZILLIANS_SCALABLEPOOLMALLOC_H_
+
+#include "core/ScalablePoolAllocator.h"
+
+namespace zillians {
+
+/**
+ * @brief Get the pool behind the process-wide malloc() and operator new replacement.
+ *
+ * Linking zillians-common-malloc into an executable replaces malloc(), calloc(), realloc(),
+ * free(), posix_memalign(), aligned_alloc(), memalign(), malloc_usable_size() and all forms
+ * of operator new and delete of the process. Requests
+ * up to the largest bin (8KB) are served from the per-thread bins of a ScalablePoolAllocator
+ * over a reserved arena, which covers STL nodes, boost::function targets and shared_ptr
+ * control blocks. Larger or over-aligned requests (large chunks are only 8-byte aligned),
+ * requests made while the pool itself allocates, and requests after the arena runs out go
+ * to the glibc heap, and free() tells them apart by address.
+ *
+ * The arena is mapped on the first allocation with transparent huge pages if possible (see
+ * HugePageRegion), its size is taken from the ZILLIANS_MALLOC_ARENA_SIZE environment variable
+ * (1GB by default). Only the touched part of the arena becomes resident.
+ *
+ * @note Only available in the zillians-common-malloc library.
+ *
+ * @return The pool, or NULL if the arena couldn't be mapped and glibc serves everything.
+ */
+ScalablePoolAllocator* getMallocPool();
+
+}
+
+#endif/*ZILLIANS_SCALABLEPOOLMALLOC_H_*/
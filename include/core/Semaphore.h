@@ -24,40 +24,133 @@
 #define ZILLIANS_SEMAPHORE_H_
 
 #include "core/Common.h"
-#include <semaphore.h>
+#include "core/Futex.h"
+#include <boost/thread/thread_time.hpp>
+#include <algorithm>
 
 namespace zillians {
 
+/**
+ * Semaphore is a counting semaphore which only enters the kernel to sleep or to wake up.
+ *
+ * The count goes negative by the number of waiting threads, so post() is a single
+ * atomic add unless the count was negative, and wait() is a single atomic subtract
+ * unless the count was not positive. Sleeping threads park on a separate futex word
+ * which counts the wakeups handed out by post().
+ */
 class Semaphore
 {
 public:
-	Semaphore()
+	Semaphore(uint32 initial = 0)
 	{
-		int result = sem_init(&mSemaphore, 0 /* in-process semaphore */, 0 /* initial value */);
-		BOOST_ASSERT(result != -1);
+		mCount.store(static_cast<int32>(initial), std::memory_order_relaxed);
+		mWakeups.store(0, std::memory_order_relaxed);
 	}
 
 	~Semaphore()
 	{
-		int result = sem_destroy(&mSemaphore);
-		BOOST_ASSERT(result != -1);
+		BOOST_ASSERT(mCount.load(std::memory_order_relaxed) >= 0 && "destroying a semaphore with waiters");
 	}
 
 public:
 	inline void wait()
 	{
-		int result = sem_wait(&mSemaphore);
-		BOOST_ASSERT(result != -1);
+		if(mCount.fetch_sub(1, std::memory_order_acquire) > 0)
+			return;
+
+		park(NULL);
+	}
+
+	/**
+	 * @brief Take the semaphore only if it's available right now.
+	 */
+	inline bool try_wait()
+	{
+		int32 count = mCount.load(std::memory_order_relaxed);
+		while(count > 0)
+		{
+			if(mCount.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @brief Wait until the semaphore is posted or the absolute time is reached.
+	 *
+	 * @return True if the semaphore is posted, false on timeout.
+	 */
+	inline bool timed_wait(const boost::system_time& absolute)
+	{
+		if(mCount.fetch_sub(1, std::memory_order_acquire) > 0)
+			return true;
+
+		if(park(&absolute))
+			return true;
+
+		// give up our place as a waiter, unless a post() has already counted us in
+		int32 count = mCount.load(std::memory_order_relaxed);
+		while(count < 0)
+		{
+			if(mCount.compare_exchange_weak(count, count + 1, std::memory_order_relaxed, std::memory_order_relaxed))
+				return false;
+		}
+
+		// the wakeup for us is on its way, take it
+		park(NULL);
+		return true;
 	}
 
 	inline void post()
 	{
-		int result = sem_post(&mSemaphore);
-		BOOST_ASSERT(result != -1);
+		if(mCount.fetch_add(1, std::memory_order_release) < 0)
+			release(1);
+	}
+
+	/**
+	 * @brief Post the semaphore for n times at once, waking up at most n waiters with one call.
+	 */
+	inline void post(uint32 n)
+	{
+		if(n == 0)
+			return;
+
+		int32 count = mCount.fetch_add(static_cast<int32>(n), std::memory_order_release);
+		if(count < 0)
+			release(std::min<uint32>(static_cast<uint32>(-count), n));
+	}
+
+private:
+	/**
+	 * Take one wakeup handed out by release(), sleeping until there's one.
+	 *
+	 * @return False on timeout.
+	 */
+	bool park(const boost::system_time* absolute)
+	{
+		while(true)
+		{
+			uint32 wakeups = mWakeups.load(std::memory_order_relaxed);
+			while(wakeups > 0)
+			{
+				if(mWakeups.compare_exchange_weak(wakeups, wakeups - 1, std::memory_order_acquire, std::memory_order_relaxed))
+					return true;
+			}
+
+			if(!futex::wait(mWakeups, uint32(0), absolute))
+				return false;
+		}
+	}
+
+	void release(uint32 n)
+	{
+		mWakeups.fetch_add(n, std::memory_order_release);
+		futex::wake(mWakeups, n);
 	}
 
 private:
-	sem_t mSemaphore;
+	std::atomic<int32> mCount;
+	std::atomic<uint32> mWakeups;
 
 	// forbid object copy constructor and copy operator
 private:
@@ -0,0 +1,218 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SHARDEDWORKERGROUP_H_
+#define ZILLIANS_SHARDEDWORKERGROUP_H_
+
+#include "core/Worker.h"
+#include "core/ThreadPlacement.h"
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief ShardedWorkerGroup runs one Worker per core, each accepting connections by itself.
+ *
+ * Every worker has its own acceptor bound to the same port with SO_REUSEPORT,
+ * and the kernel spreads incoming connections over the acceptors. A connection
+ * is handed to the worker which accepted it, and is meant to stay there for
+ * its lifetime, so neither the accept nor any later handler of the connection
+ * crosses a thread. Compare that to a single acceptor posting each accepted
+ * session to another worker, where every accept goes through one thread and
+ * every session starts with a cross-thread post.
+ *
+ * @code
+ * ShardedWorkerGroup group;
+ * group.listen(tcp::endpoint(tcp::v4(), 8080), [](Worker& worker, const shared_ptr<tcp::socket>& socket) {
+ *     // running on worker, and so will every handler of the socket
+ *     startSession(worker, socket);
+ * });
+ * @endcode
+ *
+ * @note Without SO_REUSEPORT (Linux before 3.9) only the first worker accepts.
+ */
+class ShardedWorkerGroup : public boost::noncopyable
+{
+public:
+	typedef boost::asio::ip::tcp tcp;
+
+	/**
+	 * The signature of the handler called on the accepting worker for each new connection.
+	 */
+	typedef boost::function<void(Worker&, const shared_ptr<tcp::socket>&)> AcceptHandler;
+
+public:
+	/**
+	 * @param workers The number of workers, 0 for one per cpu.
+	 * @param placement The placement of the workers, the index-th worker is
+	 * placed by placement.at(index). If empty, each worker is pinned to a
+	 * single cpu in turn.
+	 */
+	explicit ShardedWorkerGroup(std::size_t workers = 0, const ThreadPlacement& placement = ThreadPlacement())
+	{
+		if(workers == 0)
+			workers = std::max<uint32>(1, ThreadPlacement::getCpuCount());
+
+		ThreadPlacement p = placement;
+		if(p.empty())
+			p.withName("shard").spread();
+
+		for(std::size_t i = 0; i < workers; ++i)
+			mWorkers.push_back(new Worker(p.at(i)));
+	}
+
+	virtual ~ShardedWorkerGroup()
+	{
+		close();
+
+		// the acceptors must go before the io_service they belong to
+		for(std::vector<Worker*>::iterator i = mWorkers.begin(); i != mWorkers.end(); ++i)
+			(*i)->stop();
+		mShards.clear();
+
+		for(std::vector<Worker*>::iterator i = mWorkers.begin(); i != mWorkers.end(); ++i)
+			SAFE_DELETE(*i);
+	}
+
+public:
+	/**
+	 * @brief Start accepting connections on the given endpoint on every worker.
+	 *
+	 * @param endpoint The endpoint to bind, port 0 picks a free port for all workers.
+	 * @param handler Called on the accepting worker for every connection.
+	 *
+	 * @return The endpoint actually bound.
+	 *
+	 * @throw boost::system::system_error if any acceptor fails to bind or listen.
+	 */
+	tcp::endpoint listen(const tcp::endpoint& endpoint, const AcceptHandler& handler, int backlog = boost::asio::socket_base::max_connections)
+	{
+		tcp::endpoint bound = endpoint;
+		for(std::size_t i = 0; i < mWorkers.size(); ++i)
+		{
+#ifndef SO_REUSEPORT
+			if(i > 0)
+				break;
+#endif
+			shared_ptr<Shard> shard(new Shard(*mWorkers[i], handler));
+			shard->acceptor.open(bound.protocol());
+			shard->acceptor.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+			shard->acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+			shard->acceptor.bind(bound);
+			shard->acceptor.listen(backlog);
+
+			// the rest bind the port picked by the first one
+			bound = shard->acceptor.local_endpoint();
+
+			mShards.push_back(shard);
+			mWorkers[i]->post(boost::bind(&Shard::accept, shard.get()));
+		}
+		return bound;
+	}
+
+	/**
+	 * @brief Stop accepting on all workers, the established connections are not affected.
+	 */
+	void close()
+	{
+		for(std::vector<shared_ptr<Shard> >::iterator i = mShards.begin(); i != mShards.end(); ++i)
+			(*i)->worker.dispatch(boost::bind(&Shard::close, i->get()), true);
+	}
+
+	std::size_t size() const
+	{
+		return mWorkers.size();
+	}
+
+	Worker& getWorker(std::size_t index)
+	{
+		return *mWorkers[index];
+	}
+
+	/**
+	 * @brief Get the number of connections accepted by the index-th worker, for checking the balance.
+	 */
+	uint64 getAcceptCount(std::size_t index) const
+	{
+		return index < mShards.size() ? mShards[index]->accepted : 0;
+	}
+
+private:
+	/**
+	 * The acceptor of a worker, only touched on the worker after listen().
+	 */
+	struct Shard
+	{
+		Shard(Worker& w, const AcceptHandler& h) : worker(w), handler(h), acceptor(w.getIoService()), closed(false)
+		{
+			accepted = 0;
+		}
+
+		void accept()
+		{
+			if(closed)
+				return;
+
+			socket.reset(new tcp::socket(worker.getIoService()));
+			acceptor.async_accept(*socket, boost::bind(&Shard::handleAccept, this, boost::asio::placeholders::error));
+		}
+
+		void handleAccept(const boost::system::error_code& ec)
+		{
+			if(ec == boost::asio::error::operation_aborted || closed)
+				return;
+
+			if(!ec)
+			{
+				++accepted;
+				shared_ptr<tcp::socket> s;
+				s.swap(socket);
+				handler(worker, s);
+			}
+
+			// on other errors (like running out of descriptors) keep accepting, the next accept may succeed
+			accept();
+		}
+
+		void close()
+		{
+			closed = true;
+			boost::system::error_code ec;
+			acceptor.close(ec);
+		}
+
+		Worker& worker;
+		AcceptHandler handler;
+		tcp::acceptor acceptor;
+		shared_ptr<tcp::socket> socket;
+		tbb::atomic<uint64> accepted;
+		bool closed;
+	};
+
+	std::vector<Worker*> mWorkers;
+	std::vector<shared_ptr<Shard> > mShards;
+};
+
+}
+
+#endif/*ZILLIANS_SHARDEDWORKERGROUP_H_*/
@@ -0,0 +1,92 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SHAREDMEMORYSEGMENT_H_
+#define ZILLIANS_SHAREDMEMORYSEGMENT_H_
+
+#include "core/Prerequisite.h"
+
+#include <boost/noncopyable.hpp>
+#include <string>
+
+namespace zillians {
+
+/**
+ * @brief SharedMemorySegment maps a named POSIX shared memory object.
+ *
+ * The first process opening the name creates the object and sees isCreator()
+ * true, it's responsible to initialize the content. The object stays in the
+ * system until remove() is called, even after every process unmapped it, so
+ * processes can come and go without losing what's shared.
+ *
+ * @code
+ * SharedMemorySegment segment("/my-service", sizeof(Header));
+ * Header* header = reinterpret_cast<Header*>(segment.data());
+ * if(segment.isCreator()) new(header) Header();
+ * @endcode
+ *
+ * @note The memory of a newly created object is zero-filled.
+ */
+class SharedMemorySegment : public boost::noncopyable
+{
+public:
+	/**
+	 * @brief Open or create the shared memory object and map it.
+	 *
+	 * @param name The name of the object, must start with a slash and have no other slash.
+	 * @param size The size to map, an existing object must be at least that large.
+	 *
+	 * @throw std::runtime_error if the object can't be opened, created or mapped.
+	 */
+	SharedMemorySegment(const std::string& name, std::size_t size);
+	~SharedMemorySegment();
+
+public:
+	inline byte* data() const
+	{ return mData; }
+
+	inline std::size_t size() const
+	{ return mSize; }
+
+	inline const std::string& name() const
+	{ return mName; }
+
+	/**
+	 * @brief Tell if this segment created the object, the content must be initialized then.
+	 */
+	inline bool isCreator() const
+	{ return mCreator; }
+
+	/**
+	 * @brief Remove the name from the system, the memory is released once every process unmapped it.
+	 *
+	 * @return False if there's no such object.
+	 */
+	static bool remove(const std::string& name);
+
+private:
+	std::string mName;
+	byte* mData;
+	std::size_t mSize;
+	bool mCreator;
+};
+
+}
+
+#endif/*ZILLIANS_SHAREDMEMORYSEGMENT_H_*/
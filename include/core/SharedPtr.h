@@ -21,6 +21,14 @@
 #define ZILLIANS_SHAREDPTR_H_
 
 #include "core/Common.h"
+#include "core/ObjectPool.h"
+#include "utility/HashUtil.h"
+#include <boost/intrusive_ptr.hpp>
+#include <atomic>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <hash_set>
 
 #if defined _WIN32
@@ -35,6 +43,7 @@
 	using boost::weak_ptr;
 	using boost::enable_shared_from_this;
 	using boost::make_shared;
+	using boost::allocate_shared;
 #else
 	#ifndef __GXX_EXPERIMENTAL_CXX0X__
 		#include <boost/shared_ptr.hpp>
@@ -48,6 +57,7 @@
 		using boost::weak_ptr;
 		using boost::enable_shared_from_this;
 		using boost::make_shared;
+		using boost::allocate_shared;
 	#else
 		#include <memory>
 		using std::static_pointer_cast;
@@ -57,9 +67,12 @@
 		using std::weak_ptr;
 		using std::enable_shared_from_this;
 		using std::make_shared;
+		using std::allocate_shared;
 	#endif
 #endif
 
+using boost::intrusive_ptr;
+
 namespace zillians {
 
 struct null_deleter
@@ -83,6 +96,457 @@ shared_ptr<B> reinterpret_pointer_cast(const shared_ptr<A>& obj)
 	return shared_ptr<B>((B*)obj.get(), reference_holder<A>(obj));
 }
 
+/**
+ * @brief Deleter keeping a reference of any smart pointer, used to hand an object held by
+ * intrusive_ptr or local_shared_ptr to an interface taking shared_ptr.
+ */
+template<typename Pointer>
+struct pointer_holder
+{
+	pointer_holder(const Pointer& obj) : ref(obj) { }
+	void operator()(void const*) const
+	{ }
+	const Pointer ref;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Plain reference count, for objects which never leave their owning thread.
+ */
+struct local_ref_count
+{
+	typedef uint32 type;
+
+	static inline void increment(type& count) { ++count; }
+	static inline uint32 decrement(type& count) { return --count; }
+	static inline uint32 load(const type& count) { return count; }
+};
+
+/**
+ * @brief Atomic reference count, for objects shared between threads.
+ */
+struct atomic_ref_count
+{
+	typedef std::atomic<uint32> type;
+
+	static inline void increment(type& count) { count.fetch_add(1, std::memory_order_relaxed); }
+	static inline uint32 decrement(type& count) { return count.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+	static inline uint32 load(const type& count) { return count.load(std::memory_order_relaxed); }
+};
+
+/**
+ * @brief intrusive_ref_counter embeds the reference count into the object for intrusive_ptr.
+ *
+ * Unlike shared_ptr, there's no separate control block to allocate and the count is next to
+ * the object, and with the default local_ref_count copying an intrusive_ptr is a plain
+ * increment instead of an atomic one. Use atomic_ref_count for objects passed between threads.
+ *
+ * @code
+ * class Session : public intrusive_ref_counter<Session> { ... };
+ * intrusive_ptr<Session> session(new Session);
+ * @endcode
+ *
+ * @note Copying the object doesn't copy its reference count.
+ */
+template<typename Derived, typename CountPolicy = local_ref_count>
+class intrusive_ref_counter
+{
+public:
+	intrusive_ref_counter() : mRefCount(0)
+	{ }
+
+	intrusive_ref_counter(const intrusive_ref_counter&) : mRefCount(0)
+	{ }
+
+	intrusive_ref_counter& operator= (const intrusive_ref_counter&)
+	{
+		return *this;
+	}
+
+	inline uint32 use_count() const
+	{
+		return CountPolicy::load(mRefCount);
+	}
+
+	friend inline void intrusive_ptr_add_ref(const intrusive_ref_counter* p)
+	{
+		CountPolicy::increment(p->mRefCount);
+	}
+
+	friend inline void intrusive_ptr_release(const intrusive_ref_counter* p)
+	{
+		if(CountPolicy::decrement(p->mRefCount) == 0)
+			delete static_cast<const Derived*>(p);
+	}
+
+protected:
+	~intrusive_ref_counter()
+	{ }
+
+private:
+	mutable typename CountPolicy::type mRefCount;
+};
+
+/**
+ * @brief ref_counted adds an intrusive reference count to an existing type, i.e. Buffer.
+ *
+ * The objects are pooled by ConcurrentObjectPool, so pooled base types (which only
+ * pool objects of their own size) never serve the larger derived objects.
+ *
+ * @code
+ * intrusive_ptr< ref_counted<Buffer> > buffer(new ref_counted<Buffer>(4096));
+ * @endcode
+ */
+template<typename T, typename CountPolicy = local_ref_count>
+class ref_counted : public T, public intrusive_ref_counter<ref_counted<T, CountPolicy>, CountPolicy>
+{
+public:
+	template<typename... Args>
+	ref_counted(Args&&... args) : T(std::forward<Args>(args)...)
+	{ }
+
+	static void* operator new(std::size_t size)
+	{
+		return ConcurrentObjectPool<ref_counted>::operator new(size);
+	}
+
+	static void operator delete(void* p)
+	{
+		ConcurrentObjectPool<ref_counted>::operator delete(p);
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////
+namespace detail {
+
+struct local_shared_count
+{
+	local_shared_count() : count(1)
+	{ }
+
+	virtual ~local_shared_count()
+	{ }
+
+	/**
+	 * Destroy the owned object, the count itself is deleted afterwards.
+	 */
+	virtual void dispose() = 0;
+
+	long count;
+};
+
+template<typename T, typename Deleter>
+struct local_shared_count_pointer : local_shared_count
+{
+	local_shared_count_pointer(T* p, const Deleter& d) : pointer(p), deleter(d)
+	{ }
+
+	virtual void dispose()
+	{
+		deleter(pointer);
+	}
+
+	T* pointer;
+	Deleter deleter;
+};
+
+template<typename T>
+struct local_shared_count_inplace : local_shared_count
+{
+	inline T* get()
+	{
+		return reinterpret_cast<T*>(&storage);
+	}
+
+	virtual void dispose()
+	{
+		get()->~T();
+	}
+
+	typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+};
+
+template<typename T>
+struct local_shared_delete
+{
+	void operator()(T* p) const
+	{
+		delete p;
+	}
+};
+
+}
+
+/**
+ * @brief local_shared_ptr is a shared_ptr with non-atomic reference counting.
+ *
+ * Most handles passed between our message handlers never leave their owning thread,
+ * where the atomic increment and decrement of shared_ptr on every copy is pure overhead.
+ * local_shared_ptr has the same interface for the common cases (without weak pointers),
+ * and make_local_shared() puts the count and the object into a single allocation.
+ *
+ * @note All copies of a local_shared_ptr must stay on the same thread. Use shared_ptr
+ * (optionally with make_pooled_shared()) once the object is passed to another thread.
+ */
+template<typename T>
+class local_shared_ptr
+{
+	template<typename U> friend class local_shared_ptr;
+	template<typename U, typename... Args> friend local_shared_ptr<U> make_local_shared(Args&&... args);
+
+public:
+	typedef T element_type;
+
+public:
+	local_shared_ptr() : mPointer(NULL), mCount(NULL)
+	{ }
+
+	template<typename Y>
+	explicit local_shared_ptr(Y* p) : mPointer(p), mCount(NULL)
+	{
+		try
+		{
+			mCount = new detail::local_shared_count_pointer< Y, detail::local_shared_delete<Y> >(p, detail::local_shared_delete<Y>());
+		}
+		catch(...)
+		{
+			delete p;
+			throw;
+		}
+	}
+
+	template<typename Y, typename Deleter>
+	local_shared_ptr(Y* p, Deleter d) : mPointer(p), mCount(NULL)
+	{
+		try
+		{
+			mCount = new detail::local_shared_count_pointer<Y, Deleter>(p, d);
+		}
+		catch(...)
+		{
+			d(p);
+			throw;
+		}
+	}
+
+	local_shared_ptr(const local_shared_ptr& other) : mPointer(other.mPointer), mCount(other.mCount)
+	{
+		if(mCount) ++mCount->count;
+	}
+
+	template<typename Y>
+	local_shared_ptr(const local_shared_ptr<Y>& other) : mPointer(other.mPointer), mCount(other.mCount)
+	{
+		if(mCount) ++mCount->count;
+	}
+
+	/**
+	 * @brief The aliasing constructor, share the ownership of other but point to p.
+	 */
+	template<typename Y>
+	local_shared_ptr(const local_shared_ptr<Y>& other, T* p) : mPointer(p), mCount(other.mCount)
+	{
+		if(mCount) ++mCount->count;
+	}
+
+	local_shared_ptr(local_shared_ptr&& other) : mPointer(other.mPointer), mCount(other.mCount)
+	{
+		other.mPointer = NULL;
+		other.mCount = NULL;
+	}
+
+	~local_shared_ptr()
+	{
+		release();
+	}
+
+public:
+	local_shared_ptr& operator= (const local_shared_ptr& other)
+	{
+		local_shared_ptr(other).swap(*this);
+		return *this;
+	}
+
+	template<typename Y>
+	local_shared_ptr& operator= (const local_shared_ptr<Y>& other)
+	{
+		local_shared_ptr(other).swap(*this);
+		return *this;
+	}
+
+	local_shared_ptr& operator= (local_shared_ptr&& other)
+	{
+		local_shared_ptr(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	inline void reset()
+	{
+		local_shared_ptr().swap(*this);
+	}
+
+	template<typename Y>
+	inline void reset(Y* p)
+	{
+		local_shared_ptr(p).swap(*this);
+	}
+
+	template<typename Y, typename Deleter>
+	inline void reset(Y* p, Deleter d)
+	{
+		local_shared_ptr(p, d).swap(*this);
+	}
+
+	inline void swap(local_shared_ptr& other)
+	{
+		std::swap(mPointer, other.mPointer);
+		std::swap(mCount, other.mCount);
+	}
+
+	inline T* get() const { return mPointer; }
+	inline T& operator* () const { BOOST_ASSERT(mPointer); return *mPointer; }
+	inline T* operator-> () const { BOOST_ASSERT(mPointer); return mPointer; }
+
+	inline long use_count() const { return mCount ? mCount->count : 0; }
+	inline bool unique() const { return use_count() == 1; }
+
+	inline explicit operator bool () const { return mPointer != NULL; }
+
+private:
+	inline void release()
+	{
+		if(mCount && --mCount->count == 0)
+		{
+			mCount->dispose();
+			delete mCount;
+		}
+	}
+
+private:
+	T* mPointer;
+	detail::local_shared_count* mCount;
+};
+
+template<typename T, typename U>
+inline bool operator== (const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) { return a.get() == b.get(); }
+
+template<typename T, typename U>
+inline bool operator!= (const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) { return a.get() != b.get(); }
+
+template<typename T, typename U>
+inline bool operator< (const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) { return a.get() < b.get(); }
+
+/**
+ * @brief Create an object owned by local_shared_ptr, with the reference count in the same allocation.
+ */
+template<typename T, typename... Args>
+local_shared_ptr<T> make_local_shared(Args&&... args)
+{
+	detail::local_shared_count_inplace<T>* count = new detail::local_shared_count_inplace<T>;
+	try
+	{
+		new (count->get()) T(std::forward<Args>(args)...);
+	}
+	catch(...)
+	{
+		// the object is not constructed, so don't dispose it
+		::operator delete(static_cast<void*>(count));
+		throw;
+	}
+
+	local_shared_ptr<T> result;
+	result.mPointer = count->get();
+	result.mCount = count;
+	return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * @brief ObjectPoolAllocator is a std-compatible allocator drawing single objects from ConcurrentObjectPool.
+ *
+ * It's meant for allocate_shared(), which allocates one control block (holding the object)
+ * at a time, so the block is recycled by the per-thread magazines of the pool instead of
+ * going to the global heap. Arrays are allocated from the global heap.
+ */
+template<typename T>
+class ObjectPoolAllocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef ObjectPoolAllocator<U> other;
+	};
+
+public:
+	ObjectPoolAllocator()
+	{ }
+
+	template<typename U>
+	ObjectPoolAllocator(const ObjectPoolAllocator<U>&)
+	{ }
+
+public:
+	inline pointer address(reference x) const { return &x; }
+	inline const_pointer address(const_reference x) const { return &x; }
+
+	inline pointer allocate(size_type n, const void* hint = 0)
+	{
+		UNUSED_ARGUMENT(hint);
+		if(n == 1)
+			return static_cast<pointer>(ConcurrentObjectPool<T>::operator new(sizeof(T)));
+		return static_cast<pointer>(::operator new(n * sizeof(T)));
+	}
+
+	inline void deallocate(pointer p, size_type n)
+	{
+		if(n == 1)
+			ConcurrentObjectPool<T>::operator delete(p);
+		else
+			::operator delete(p);
+	}
+
+	inline size_type max_size() const
+	{
+		return std::numeric_limits<size_type>::max() / sizeof(T);
+	}
+
+	template<typename U, typename... Args>
+	inline void construct(U* p, Args&&... args)
+	{
+		new((void*)p) U(std::forward<Args>(args)...);
+	}
+
+	template<typename U>
+	inline void destroy(U* p)
+	{
+		p->~U();
+	}
+
+	template<typename U>
+	inline bool operator== (const ObjectPoolAllocator<U>&) const { return true; }
+
+	template<typename U>
+	inline bool operator!= (const ObjectPoolAllocator<U>&) const { return false; }
+};
+
+/**
+ * @brief Create an object owned by shared_ptr, with the object and its control block drawn from ConcurrentObjectPool.
+ */
+template<typename T, typename... Args>
+shared_ptr<T> make_pooled_shared(Args&&... args)
+{
+	return allocate_shared<T>(ObjectPoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
 }
 
 /**
@@ -112,7 +576,7 @@ namespace __gnu_cxx
 	{
 		size_t operator()(const shared_ptr<T>& __x) const
 		{
-			return reinterpret_cast<size_t>(__x.get());
+			return zillians::HashUtil::hashPointer(__x.get());
 		}
 	};
 }
@@ -124,7 +588,7 @@ namespace stdext
 	{
 		size_t operator()(const shared_ptr<T>& __x) const
 		{
-			return reinterpret_cast<size_t>(__x.get());
+			return zillians::HashUtil::hashPointer(__x.get());
 		}
 
 		bool operator()(const shared_ptr<T>& v1, const shared_ptr<T>& v2) const
@@ -25,6 +25,9 @@
 
 #include "core/Common.h"
 #include <boost/assert.hpp>
+#include <boost/thread/tss.hpp>
+#include <atomic>
+#include <mutex>
 
 namespace zillians {
 
@@ -37,8 +40,8 @@ namespace zillians {
  * order and destruction order manually.
  *
  * On the other hand, for automatic singleton initialization, the instance is created
- * if necessary whenever the Singleton::instance() is called, and is destroyed when
- * program exit.
+ * by the first Singleton::instance() call, exactly once even when several threads call
+ * it at the same time. It's never destroyed, so it stays usable during static destruction.
  *
  * @see Singleton
  */
@@ -57,7 +60,14 @@ struct SingletonInitialization
  *
  * Inspired by OGRE, the Singleton class can be created once, and access through instance() method
  * NOTE: have potential problem when linking against dynamic library (nothing said that...)
- * NOTE: this is NOT thread-safe because the Singleton object can be created in two different threads in the same time
+ *
+ * instance() is meant for hot paths (i.e. logger and registry lookups): once the instance
+ * exists it's a single load of the cached pointer and a branch which is always predicted.
+ * Automatic instances are created under std::call_once and published only after their
+ * constructor returns, so no thread ever sees a partially constructed instance.
+ *
+ * @note The pointer is still checked on every call since instance() may be called during
+ * static initialization of other translation units, before any eager initialization could run.
  */
 template <class T, SingletonInitialization::type Init = SingletonInitialization::manual>
 class Singleton
@@ -68,57 +78,121 @@ class Singleton
 	template<typename V>
 	struct CreateDelegate<V, SingletonInitialization::automatic>
 	{
-		static void create(V** p)
+		static void create(std::atomic<V*>* p)
 		{
-			*p = new V;
+			p->store(new V, std::memory_order_release);
 		}
 	};
 
 	template<typename V>
 	struct CreateDelegate<V, SingletonInitialization::manual>
 	{
-		static void create(V** p)
+		static void create(std::atomic<V*>* p)
 		{ UNUSED_ARGUMENT(p); }
 	};
 
 public:
 	Singleton()
 	{
-		BOOST_ASSERT(!mInstance);
+		BOOST_ASSERT(!mInstance.load(std::memory_order_relaxed));
 
+		// automatic instances are published by CreateDelegate once fully constructed
+		if(Init == SingletonInitialization::manual)
+		{
 #if defined( _MSC_VER ) && _MSC_VER < 1200
-		int offset = (int)(T*)1 - (int)(Singleton <T>*)(T*)1;
-		mInstance = (T*)((int)this + offset);
+			int offset = (int)(T*)1 - (int)(Singleton <T>*)(T*)1;
+			mInstance.store((T*)((int)this + offset), std::memory_order_release);
 #else
-		mInstance = static_cast<T*>(this);
+			mInstance.store(static_cast<T*>(this), std::memory_order_release);
 #endif
+		}
 	}
 
 	~Singleton()
 	{
-		if(Init)
-		{
-			SAFE_DELETE(mInstance);
-		}
+		mInstance.store(NULL, std::memory_order_relaxed);
 	}
 
 public:
-	static T* instance()
+	static inline T* instance()
 	{
-		if(Init == SingletonInitialization::automatic && !mInstance)
-		{
-			CreateDelegate<T, Init>::create(&mInstance);
-			//mInstance = new T;
-		}
+		T* p = mInstance.load(std::memory_order_acquire);
+		if(Init == SingletonInitialization::automatic && UNLIKELY(!p))
+			return create();
+
+		return p;
+	}
 
-		return mInstance;
+private:
+	static T* create() __attribute__((noinline))
+	{
+		std::call_once(mCreated, &CreateDelegate<T, Init>::create, &mInstance);
+		return mInstance.load(std::memory_order_acquire);
+	}
+
+private:
+	static std::atomic<T*> mInstance;
+	static std::once_flag mCreated;
+};
+
+template <typename T, SingletonInitialization::type Init> std::atomic<T*> Singleton<T, Init>::mInstance(NULL);
+template <typename T, SingletonInitialization::type Init> std::once_flag Singleton<T, Init>::mCreated;
+
+/**
+ * ThreadLocalSingleton gives every thread its own instance, i.e. for per-thread scratch state.
+ *
+ * The instance is created by the first instance() call of each thread and destroyed when
+ * the thread exits. instance() reads the pointer cached in a __thread variable, which is
+ * a single load from the thread pointer, without going through thread_specific_ptr.
+ *
+ * @code
+ * struct Scratch : public ThreadLocalSingleton<Scratch> { Buffer buffer; };
+ * Scratch::instance()->buffer.clear();
+ * @endcode
+ *
+ * @note The instance of the main thread is not destroyed at program exit.
+ */
+template <class T>
+class ThreadLocalSingleton
+{
+public:
+	static inline T* instance()
+	{
+		T* p = tInstance;
+		if(UNLIKELY(!p))
+			return create();
+
+		return p;
+	}
+
+private:
+	static T* create() __attribute__((noinline))
+	{
+		T* p = new T;
+		tInstance = p;
+		getOwner().reset(p);
+		return p;
+	}
+
+	static void destroy(T* p)
+	{
+		// destructors of other thread locals may run later on the exiting thread
+		if(tInstance == p)
+			tInstance = NULL;
+		delete p;
+	}
+
+	static boost::thread_specific_ptr<T>& getOwner()
+	{
+		static boost::thread_specific_ptr<T> owner(&ThreadLocalSingleton::destroy);
+		return owner;
 	}
 
 private:
-	static T* mInstance;
+	static __thread T* tInstance;
 };
 
-template <typename T, SingletonInitialization::type Init> T* Singleton<T, Init>::mInstance = NULL;
+template <typename T> __thread T* ThreadLocalSingleton<T>::tInstance = NULL;
 
 }
 
@@ -0,0 +1,259 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SMALLFUNCTION_H_
+#define ZILLIANS_SMALLFUNCTION_H_
+
+#include "core/Common.h"
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/decay.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/type_traits/remove_cv.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/function.hpp>
+#include <utility>
+#include <new>
+
+/**
+ * @brief The size of the inline buffer of SmallFunction if not given.
+ *
+ * Big enough for a boost::function, a boost::bind of a member function with
+ * a couple of arguments, or a lambda capturing about six pointers.
+ */
+#define ZILLIANS_SMALL_FUNCTION_BUFFER_SIZE	48
+
+namespace zillians {
+
+template<typename Signature, std::size_t BufferSize = ZILLIANS_SMALL_FUNCTION_BUFFER_SIZE>
+class SmallFunction;
+
+/**
+ * @brief SmallFunction is a callable wrapper like boost::function which keeps the callable inline.
+ *
+ * Any callable up to BufferSize bytes is stored in the object itself, so
+ * constructing, copying and moving a SmallFunction never touches the heap.
+ * Bigger callables still work but are allocated on the heap, isInline()
+ * tells which way a callable went.
+ *
+ * @code
+ * SmallFunction<bool(State&)> f = boost::bind(&Service::commit, service, _1, id);
+ * f(state);
+ * @endcode
+ */
+template<typename R, typename... Args, std::size_t BufferSize>
+class SmallFunction<R(Args...), BufferSize>
+{
+	template<typename F>
+	struct is_self : boost::is_same<typename boost::remove_cv<typename boost::remove_reference<F>::type>::type, SmallFunction>
+	{ };
+
+public:
+	typedef R result_type;
+
+public:
+	SmallFunction() : mManager(NULL)
+	{ }
+
+	template<typename F>
+	SmallFunction(F&& f, typename boost::disable_if< is_self<F> >::type* = 0) : mManager(NULL)
+	{
+		assign(std::forward<F>(f));
+	}
+
+	SmallFunction(const SmallFunction& other) : mManager(other.mManager)
+	{
+		if(mManager)
+			mManager->copy(&other.mStorage, &mStorage);
+	}
+
+	SmallFunction(SmallFunction&& other) noexcept : mManager(other.mManager)
+	{
+		if(mManager)
+		{
+			mManager->move(&other.mStorage, &mStorage);
+			other.mManager = NULL;
+		}
+	}
+
+	~SmallFunction()
+	{
+		clear();
+	}
+
+	SmallFunction& operator= (const SmallFunction& other)
+	{
+		if(this != &other)
+		{
+			clear();
+			if(other.mManager)
+			{
+				other.mManager->copy(&other.mStorage, &mStorage);
+				mManager = other.mManager;
+			}
+		}
+		return *this;
+	}
+
+	SmallFunction& operator= (SmallFunction&& other)
+	{
+		if(this != &other)
+		{
+			clear();
+			if(other.mManager)
+			{
+				other.mManager->move(&other.mStorage, &mStorage);
+				mManager = other.mManager;
+				other.mManager = NULL;
+			}
+		}
+		return *this;
+	}
+
+	template<typename F>
+	typename boost::disable_if< is_self<F>, SmallFunction& >::type operator= (F&& f)
+	{
+		clear();
+		assign(std::forward<F>(f));
+		return *this;
+	}
+
+public:
+	inline R operator() (Args... args) const
+	{
+		if(UNLIKELY(!mManager))
+			boost::throw_exception(boost::bad_function_call());
+		return mManager->invoke(const_cast<Storage*>(&mStorage), std::forward<Args>(args)...);
+	}
+
+	inline bool empty() const
+	{
+		return mManager == NULL;
+	}
+
+	inline operator bool () const
+	{
+		return mManager != NULL;
+	}
+
+	/**
+	 * @brief Whether the callable is kept in the inline buffer rather than on the heap.
+	 */
+	inline bool isInline() const
+	{
+		return mManager && mManager->isInline;
+	}
+
+	inline void clear()
+	{
+		if(mManager)
+		{
+			mManager->destroy(&mStorage);
+			mManager = NULL;
+		}
+	}
+
+private:
+	typedef typename boost::aligned_storage<BufferSize, boost::alignment_of<long double>::value>::type Storage;
+
+	/**
+	 * One static table of operations per callable type, instead of a virtual
+	 * base, so the stored callable needs no wrapper object.
+	 */
+	struct Manager
+	{
+		R (*invoke)(Storage*, Args&&...);
+		void (*copy)(const Storage*, Storage*);
+		void (*move)(Storage*, Storage*);
+		void (*destroy)(Storage*);
+		bool isInline;
+	};
+
+	template<typename F>
+	struct InlineManager
+	{
+		static R invoke(Storage* s, Args&&... args) { return (*reinterpret_cast<F*>(s))(std::forward<Args>(args)...); }
+		static void copy(const Storage* from, Storage* to) { new (to) F(*reinterpret_cast<const F*>(from)); }
+		static void move(Storage* from, Storage* to) { new (to) F(std::move(*reinterpret_cast<F*>(from))); reinterpret_cast<F*>(from)->~F(); }
+		static void destroy(Storage* s) { reinterpret_cast<F*>(s)->~F(); }
+		static const Manager manager;
+	};
+
+	template<typename F>
+	struct HeapManager
+	{
+		static F*& get(Storage* s) { return *reinterpret_cast<F**>(s); }
+		static R invoke(Storage* s, Args&&... args) { return (*get(s))(std::forward<Args>(args)...); }
+		static void copy(const Storage* from, Storage* to) { get(to) = new F(*get(const_cast<Storage*>(from))); }
+		static void move(Storage* from, Storage* to) { get(to) = get(from); }
+		static void destroy(Storage* s) { delete get(s); }
+		static const Manager manager;
+	};
+
+	template<typename F>
+	inline void assign(F&& f)
+	{
+		typedef typename boost::decay<typename boost::remove_reference<F>::type>::type Functor;
+		if(!isCallable(f))
+			return;
+
+		if(sizeof(Functor) <= sizeof(Storage) && boost::alignment_of<Functor>::value <= boost::alignment_of<Storage>::value)
+		{
+			new (&mStorage) Functor(std::forward<F>(f));
+			mManager = &InlineManager<Functor>::manager;
+		}
+		else
+		{
+			HeapManager<Functor>::get(&mStorage) = new Functor(std::forward<F>(f));
+			mManager = &HeapManager<Functor>::manager;
+		}
+	}
+
+	// empty function objects and null function pointers make an empty SmallFunction
+	template<typename F> static inline bool isCallable(const F&) { return true; }
+	template<typename S> static inline bool isCallable(S* f) { return f != NULL; }
+	template<typename S> static inline bool isCallable(const boost::function<S>& f) { return !f.empty(); }
+
+private:
+	const Manager* mManager;
+	Storage mStorage;
+};
+
+template<typename R, typename... Args, std::size_t BufferSize>
+template<typename F>
+const typename SmallFunction<R(Args...), BufferSize>::Manager SmallFunction<R(Args...), BufferSize>::InlineManager<F>::manager = {
+	&SmallFunction<R(Args...), BufferSize>::InlineManager<F>::invoke,
+	&SmallFunction<R(Args...), BufferSize>::InlineManager<F>::copy,
+	&SmallFunction<R(Args...), BufferSize>::InlineManager<F>::move,
+	&SmallFunction<R(Args...), BufferSize>::InlineManager<F>::destroy,
+	true };
+
+template<typename R, typename... Args, std::size_t BufferSize>
+template<typename F>
+const typename SmallFunction<R(Args...), BufferSize>::Manager SmallFunction<R(Args...), BufferSize>::HeapManager<F>::manager = {
+	&SmallFunction<R(Args...), BufferSize>::HeapManager<F>::invoke,
+	&SmallFunction<R(Args...), BufferSize>::HeapManager<F>::copy,
+	&SmallFunction<R(Args...), BufferSize>::HeapManager<F>::move,
+	&SmallFunction<R(Args...), BufferSize>::HeapManager<F>::destroy,
+	false };
+
+}
+
+#endif/*ZILLIANS_SMALLFUNCTION_H_*/
@@ -0,0 +1,364 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SNAPSHOT_H_
+#define ZILLIANS_SNAPSHOT_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <tbb/spin_mutex.h>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief SnapshotEpoch tracks the read sections of all threads for Snapshot.
+ *
+ * A reader announces the current global epoch on entering its outermost read
+ * section and clears it on leaving. A writer advances the global epoch after
+ * unlinking a version, the version can be deleted as soon as every thread in
+ * a read section announces a newer epoch. Like HazardPointer, there's one
+ * process-wide set of per-thread records, and records of exited threads are
+ * reused.
+ *
+ * Read sections nest, and one section covers any number of snapshots:
+ *
+ * @code
+ * SnapshotEpoch::Section section;
+ * const RoutingTable* routes = routing.read();
+ * const Config* config = settings.read();
+ * @endcode
+ *
+ * @note A thread must not publish or synchronize while it's in a read section
+ * of its own, synchronize() would wait for itself.
+ */
+class SnapshotEpoch
+{
+public:
+	class Section : public boost::noncopyable
+	{
+	public:
+		Section()  { SnapshotEpoch::enter(); }
+		~Section() { SnapshotEpoch::exit(); }
+	};
+
+public:
+	static inline void enter()
+	{
+		Record* r = current();
+		if(r->nesting++ == 0)
+		{
+			r->epoch.store(global().load(std::memory_order_relaxed), std::memory_order_relaxed);
+			// the announcement must be visible before any pointer is read in the section
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	}
+
+	static inline void exit()
+	{
+		Record* r = current();
+		BOOST_ASSERT(r->nesting > 0);
+		if(--r->nesting == 0)
+			r->epoch.store(0, std::memory_order_release);
+	}
+
+	static inline bool inSection()
+	{
+		Record* r = cached();
+		return r && r->nesting > 0;
+	}
+
+	/**
+	 * @brief Start a new epoch, called by writers after a version is unlinked.
+	 *
+	 * @return The epoch the unlinked version was retired in.
+	 */
+	static inline uint64 advance()
+	{
+		return global().fetch_add(1, std::memory_order_seq_cst);
+	}
+
+	/**
+	 * @brief Get the oldest epoch announced by a thread in a read section.
+	 *
+	 * @return The oldest epoch, or the maximum of uint64 if no thread is reading.
+	 */
+	static uint64 oldest()
+	{
+		uint64 e = std::numeric_limits<uint64>::max();
+		for(Record* r = records().load(std::memory_order_acquire); r; r = r->next)
+		{
+			uint64 announced = r->epoch.load(std::memory_order_seq_cst);
+			if(announced != 0 && announced < e)
+				e = announced;
+		}
+		return e;
+	}
+
+	/**
+	 * @brief Wait until all read sections entered in or before the given epoch are left.
+	 */
+	static void wait(uint64 epoch)
+	{
+		BOOST_ASSERT(!inSection() && "waiting for a grace period inside a read section never returns");
+		while(oldest() <= epoch)
+			boost::this_thread::yield();
+	}
+
+private:
+	struct Record
+	{
+		Record() : nesting(0), next(NULL)
+		{
+			epoch.store(0, std::memory_order_relaxed);
+			active.store(true, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64> epoch;	///< Announced epoch, zero if not in a read section
+		uint32 nesting;				///< Only touched by the owning thread
+		std::atomic<bool> active;
+		Record* next;
+	};
+
+	static std::atomic<uint64>& global()
+	{
+		// epoch zero means "not reading"
+		static std::atomic<uint64> epoch(1);
+		return epoch;
+	}
+
+	static std::atomic<Record*>& records()
+	{
+		static std::atomic<Record*> head(NULL);
+		return head;
+	}
+
+	static Record*& cached()
+	{
+		static __thread Record* r = NULL;
+		return r;
+	}
+
+	static inline Record* current()
+	{
+		Record* r = cached();
+		if(UNLIKELY(!r))
+			return attach();
+		return r;
+	}
+
+	static boost::thread_specific_ptr<Record>& owner()
+	{
+		static boost::thread_specific_ptr<Record> instance(&SnapshotEpoch::release);
+		return instance;
+	}
+
+	static Record* attach() __attribute__((noinline))
+	{
+		Record* r = acquire();
+		cached() = r;
+		owner().reset(r);
+		return r;
+	}
+
+	static void release(Record* r)
+	{
+		BOOST_ASSERT(r->nesting == 0);
+		if(cached() == r)
+			cached() = NULL;
+		r->epoch.store(0, std::memory_order_relaxed);
+		r->active.store(false, std::memory_order_release);
+	}
+
+	static Record* acquire()
+	{
+		for(Record* r = records().load(std::memory_order_acquire); r; r = r->next)
+		{
+			bool expected = false;
+			if(!r->active.load(std::memory_order_relaxed) && r->active.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return r;
+		}
+
+		Record* r = new Record;
+		Record* head = records().load(std::memory_order_relaxed);
+		do
+		{
+			r->next = head;
+		} while(!records().compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+		return r;
+	}
+};
+
+/**
+ * @brief Snapshot publishes versions of read-mostly shared state, RCU style.
+ *
+ * Readers get a plain const pointer to the current version inside a read
+ * section, without touching a reference count, so reading costs an epoch
+ * announcement and a load. Writers publish a complete new version instead of
+ * modifying the current one, the replaced version is deleted after a grace
+ * period, once no read section which could have seen it is left:
+ *
+ * @code
+ * Snapshot<RoutingTable> routing(new RoutingTable);
+ *
+ * // readers
+ * {
+ *     Snapshot<RoutingTable>::ReadGuard routes(routing);
+ *     routes->lookup(id);
+ * }
+ *
+ * // writer
+ * RoutingTable* next = new RoutingTable(*routing.unsafe_get());
+ * next->add(id, target);
+ * routing.publish(next);
+ * @endcode
+ *
+ * publish() never waits for readers, replaced versions are kept until a later
+ * publish() or synchronize() finds their grace period over. Call synchronize()
+ * to wait for it and delete them right away.
+ *
+ * @note A pointer read from the snapshot must not be used after its read section is left.
+ * @note Publishers are serialized by a spin lock, they are expected to be rare.
+ */
+template<typename T>
+class Snapshot : public boost::noncopyable
+{
+public:
+	/**
+	 * @brief Keep a read section open and the version read on entering it.
+	 */
+	class ReadGuard : public boost::noncopyable
+	{
+	public:
+		explicit ReadGuard(const Snapshot& snapshot) : mValue(snapshot.read())
+		{ }
+
+		inline const T* get() const { return mValue; }
+		inline const T* operator-> () const { return mValue; }
+		inline const T& operator* () const { return *mValue; }
+
+	private:
+		SnapshotEpoch::Section mSection;
+		const T* mValue;
+	};
+
+public:
+	explicit Snapshot(T* initial = NULL)
+	{
+		mCurrent.store(initial, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @note All readers must be done with the snapshot, the current and all retired versions are deleted.
+	 */
+	~Snapshot()
+	{
+		delete mCurrent.load(std::memory_order_relaxed);
+		for(typename std::vector<Retired>::iterator it = mRetired.begin(); it != mRetired.end(); ++it)
+			delete it->second;
+	}
+
+public:
+	/**
+	 * @brief Get the current version, only valid within a read section.
+	 */
+	inline const T* read() const
+	{
+		BOOST_ASSERT(SnapshotEpoch::inSection());
+		return mCurrent.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief Get the current version outside a read section, i.e. by the writer to copy it.
+	 *
+	 * @note Only safe when no other thread can publish concurrently.
+	 */
+	inline T* unsafe_get() const
+	{
+		return mCurrent.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief Replace the current version, the old one is deleted after a grace period.
+	 *
+	 * @param next The new version, the snapshot takes ownership.
+	 */
+	void publish(T* next)
+	{
+		tbb::spin_mutex::scoped_lock lock(mWriteLock);
+		T* old = mCurrent.exchange(next, std::memory_order_seq_cst);
+		if(old)
+			mRetired.push_back(Retired(SnapshotEpoch::advance(), old));
+		reclaim(SnapshotEpoch::oldest());
+	}
+
+	/**
+	 * @brief Wait for the grace period of all replaced versions and delete them.
+	 */
+	void synchronize()
+	{
+		std::vector<Retired> retired;
+		{
+			tbb::spin_mutex::scoped_lock lock(mWriteLock);
+			retired.swap(mRetired);
+		}
+
+		if(retired.empty())
+			return;
+
+		SnapshotEpoch::wait(retired.back().first);
+		for(typename std::vector<Retired>::iterator it = retired.begin(); it != retired.end(); ++it)
+			delete it->second;
+	}
+
+	/**
+	 * @brief Get the number of replaced versions still waiting for their grace period.
+	 */
+	std::size_t pending() const
+	{
+		tbb::spin_mutex::scoped_lock lock(mWriteLock);
+		return mRetired.size();
+	}
+
+private:
+	typedef std::pair<uint64, T*> Retired;	///< The epoch a version was retired in, and the version
+
+	void reclaim(uint64 oldest)
+	{
+		// retired in increasing epochs, so the reclaimable ones are a prefix
+		std::size_t n = 0;
+		while(n < mRetired.size() && mRetired[n].first < oldest)
+			delete mRetired[n++].second;
+		mRetired.erase(mRetired.begin(), mRetired.begin() + n);
+	}
+
+private:
+	std::atomic<T*> mCurrent;
+	std::vector<Retired> mRetired;
+	mutable tbb::spin_mutex mWriteLock;
+};
+
+}
+
+#endif /* ZILLIANS_SNAPSHOT_H_ */
@@ -0,0 +1,175 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADPLACEMENT_H_
+#define ZILLIANS_THREADPLACEMENT_H_
+
+#include "core/Prerequisite.h"
+#include <string>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief ThreadPlacement describes where and how a thread runs.
+ *
+ * A placement carries the cpus a thread may run on, the thread name shown
+ * by top/perf, and the scheduling class. Anything left unset is not touched
+ * by apply(), so the default placement is a no-op:
+ *
+ * @code
+ * // four workers pinned to one cpu each of numa node 0, named "io/0" .. "io/3"
+ * WorkStealingWorkerGroup group(4, ThreadPlacement::onNumaNode(0).withName("io").spread());
+ *
+ * // put a dispatcher thread next to the cpu 2 on the same last level cache
+ * context->place(ThreadPlacement::onCacheOf(2).withName("dispatcher"));
+ * @endcode
+ *
+ * @note Linux only, apply() does nothing and returns false elsewhere.
+ */
+class ThreadPlacement
+{
+public:
+	struct scheduling_t
+	{
+		enum type { inherit, normal, batch, idle, fifo, round_robin };
+	};
+
+public:
+	ThreadPlacement() : mSpread(false), mScheduling(scheduling_t::inherit), mPriority(0)
+	{ }
+
+	/**
+	 * @brief Run on the given cpu only.
+	 */
+	static ThreadPlacement onCpu(uint32 cpu);
+
+	/**
+	 * @brief Run on any cpu of the given list.
+	 */
+	static ThreadPlacement onCpus(const std::vector<uint32>& cpus);
+
+	/**
+	 * @brief Run on any cpu of the given NUMA node.
+	 */
+	static ThreadPlacement onNumaNode(uint32 node);
+
+	/**
+	 * @brief Run on any cpu sharing the last level cache with the given cpu.
+	 */
+	static ThreadPlacement onCacheOf(uint32 cpu);
+
+public:
+	/**
+	 * @brief Set the thread name, Linux keeps the first 15 characters only.
+	 */
+	ThreadPlacement& withName(const std::string& name)
+	{
+		mName = name;
+		return *this;
+	}
+
+	/**
+	 * @brief Set the scheduling class, priority is only meaningful for fifo and round_robin.
+	 *
+	 * @note The real-time classes usually require CAP_SYS_NICE.
+	 */
+	ThreadPlacement& withScheduling(scheduling_t::type scheduling, int priority = 0)
+	{
+		mScheduling = scheduling;
+		mPriority = priority;
+		return *this;
+	}
+
+	/**
+	 * @brief Let at() pin each thread of a group to a single cpu of the list in turn.
+	 */
+	ThreadPlacement& spread()
+	{
+		mSpread = true;
+		return *this;
+	}
+
+	/**
+	 * @brief Get the placement of the index-th thread of a group.
+	 *
+	 * The name gets "/index" appended, and if spread() is set the cpus are
+	 * narrowed down to the (index % count)-th cpu.
+	 */
+	ThreadPlacement at(std::size_t index) const;
+
+public:
+	/**
+	 * @brief Apply the placement to the calling thread.
+	 *
+	 * @return False if any part of the placement failed, the rest is still applied.
+	 */
+	bool apply() const;
+
+	/**
+	 * @brief Apply the placement to an already running thread.
+	 */
+	bool apply(boost::thread& thread) const;
+
+	bool empty() const
+	{
+		return mCpus.empty() && mName.empty() && mScheduling == scheduling_t::inherit;
+	}
+
+	const std::vector<uint32>& getCpus() const
+	{ return mCpus; }
+
+	const std::string& getName() const
+	{ return mName; }
+
+public:
+	/**
+	 * @brief Get the number of online cpus.
+	 */
+	static uint32 getCpuCount();
+
+	/**
+	 * @brief Get the number of NUMA nodes, at least 1.
+	 */
+	static uint32 getNumaNodeCount();
+
+	/**
+	 * @brief Get the cpus of the given NUMA node, or all cpus if there's no NUMA information.
+	 */
+	static std::vector<uint32> getCpusOfNumaNode(uint32 node);
+
+	/**
+	 * @brief Get the cpus sharing the last level cache with the given cpu, including itself.
+	 */
+	static std::vector<uint32> getCpusSharingCache(uint32 cpu);
+
+private:
+	bool applyTo(boost::thread::native_handle_type handle) const;
+
+private:
+	std::vector<uint32> mCpus;
+	std::string mName;
+	bool mSpread;
+	scheduling_t::type mScheduling;
+	int mPriority;
+};
+
+}
+
+#endif/*ZILLIANS_THREADPLACEMENT_H_*/
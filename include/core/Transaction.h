@@ -25,94 +25,231 @@
 
 #include "core/Prerequisite.h"
 #include "core/Worker.h"
+#include "core/SmallFunction.h"
 
 // c++0x threading
 #include <thread>
 #include <future>
 #include <mutex>
+#include <exception>
 
 namespace zillians {
 
+/**
+ * @brief Transaction runs a sequence of steps with rollback on failure.
+ *
+ * Each step is an action and the rollback undoing it. Steps run one after
+ * another on the executor given to the constructor, and independent steps
+ * can be declared as a group between beginGroup() and endGroup(), in which
+ * case they are all dispatched to the executor at once and the transaction
+ * continues when the last of them finishes:
+ *
+ * @code
+ * Transaction<State> t(state, worker);
+ * t.add(lock, unlock)
+ *  .beginGroup()
+ *     .add(writeServiceA, revertServiceA)
+ *     .add(writeServiceB, revertServiceB)
+ *  .endGroup()
+ *  .add(commit, abort)
+ *  .next(true);
+ * @endcode
+ *
+ * If an action throws, the rollbacks of the failing step (or every step of
+ * the failing group) and of all completed steps are called in reverse order,
+ * again with the rollbacks of a group running in parallel, and the exception
+ * is rethrown to whoever waits for the result.
+ *
+ * No step ever blocks an executor thread waiting for another step, so a
+ * single-threaded Worker is a valid executor.
+ *
+ * Routines are kept in SmallFunction, and clear() keeps the storage of the
+ * steps, so a transaction rebuilt after clear() (or rerun after reset())
+ * doesn't allocate once it has seen the same number of steps.
+ *
+ * @note Steps of a group share the TransactionState, so they must not modify
+ * the same part of it without synchronization.
+ * @note Steps must not be added while the transaction is running.
+ */
 template<typename TransactionState>
 class Transaction
 {
 public:
 	/// Each ActionRoutine would return a boolean value, which indicates whether to continue the next execution or to pause (can be resumed by calling next())
-	typedef boost::function< bool(TransactionState&) > ActionRoutine;
+	typedef SmallFunction< bool(TransactionState&) > ActionRoutine;
 
 	/// Each RollbackRoutine is a counter-part of ActionRoutine which invalidate all changes made by ActionRoutine
-	typedef boost::function< void(TransactionState&) > RollbackRoutine;
+	typedef SmallFunction< void(TransactionState&) > RollbackRoutine;
+
+	/// The Executor runs the given task asynchronously, for example by posting it to a Worker or enqueueing it to a tbb::task_arena
+	typedef boost::function< void(const boost::function<void()>&) > Executor;
 
 public:
-	Transaction(TransactionState& state) : mTransactionState(state), mProgramCounter(0)
-	{ }
+	/**
+	 * @brief Create a transaction running steps on threads of their own, as std::async would.
+	 */
+	Transaction(TransactionState& state) : mTransactionState(state), mExecutor(&Transaction::spawnThread)
+	{
+		initialize();
+	}
+
+	/**
+	 * @brief Create a transaction running steps on the given worker.
+	 */
+	Transaction(TransactionState& state, Worker& worker) : mTransactionState(state), mExecutor(boost::bind(&Transaction::postToWorker, &worker, _1))
+	{
+		initialize();
+	}
+
+	Transaction(TransactionState& state, const Executor& executor) : mTransactionState(state), mExecutor(executor)
+	{
+		initialize();
+	}
 
 	~Transaction()
-	{ }
+	{
+		waitForIdle();
+	}
 
 public:
-#ifndef __GXX_EXPERIMENTAL_CXX0X__
-	inline Transaction& add(ActionRoutine action, RollbackRoutine rollback)
+	/**
+	 * @brief Add a step, the action and the rollback can be any callables that fit the routine signatures.
+	 */
+	template<typename Action, typename Rollback>
+	inline Transaction& add(Action&& action, Rollback&& rollback)
 	{
-		mTransactions.push_back(std::make_pair(action, rollback));
+		addStep(Step(ActionRoutine(std::forward<Action>(action)), RollbackRoutine(std::forward<Rollback>(rollback))));
 		return *this;
 	}
-#else
-	inline Transaction& add(ActionRoutine&& action, RollbackRoutine&& rollback)
+
+	/**
+	 * @brief Steps added until endGroup() are independent and run in parallel.
+	 */
+	inline Transaction& beginGroup()
+	{
+		BOOST_ASSERT(!mGrouping);
+		mGrouping = true;
+		mStages.push_back(Stage(mSteps.size(), 0));
+		return *this;
+	}
+
+	inline Transaction& endGroup()
 	{
-		mTransactions.push_back(std::make_pair(std::forward<ActionRoutine>(action), std::forward<RollbackRoutine>(rollback)));
+		BOOST_ASSERT(mGrouping);
+		mGrouping = false;
+		if(mStages.back().count == 0)
+			mStages.pop_back();
 		return *this;
 	}
-#endif
 
 public:
 	inline bool next(bool blocking = false)
 	{
-		if(mProgramCounter == -1)
-			return true;
-
-		if(mProgramCounter < (int32)mTransactions.size())
+		std::shared_future<bool> result;
+		bool start = false;
 		{
-			mResult = std::async(boost::bind(&Transaction::run, this));
+			std::lock_guard<std::mutex> lock(mLock);
+
+			if(mProgramCounter == -1)
+				return true;
 
-			if(blocking)
+			if(mRunning)
+			{
+				// the running step will pause, so let it continue instead
+				mResumeRequested = true;
+			}
+			else if(mProgramCounter < (int32)mStages.size())
 			{
-				return mResult.get();
+				mRunning = true;
+				mPromise = std::promise<bool>();
+				mResult = std::shared_future<bool>(mPromise.get_future());
+				start = true;
 			}
 			else
 			{
-				return false;
+				mProgramCounter = -1;
+				return true;
 			}
+			result = mResult;
+		}
+
+		if(start)
+			mExecutor(boost::bind(&Transaction::run, this));
+
+		if(blocking)
+		{
+			return result.get();
 		}
 		else
 		{
-			mProgramCounter = -1;
-			return true;
+			return false;
 		}
 	}
 
+	/**
+	 * @brief Undo all completed steps, in reverse order.
+	 */
 	inline void rollback()
 	{
-		std::lock_guard<std::mutex> lock(mRunLock);
+		waitForIdle();
 
-		int rollbackCounter = (mProgramCounter == -1) ? mTransactions.size() - 1 : mProgramCounter;
-		while(rollbackCounter >= 0)
+		int32 completed;
 		{
-			mTransactions[rollbackCounter].second(mTransactionState);
-			--rollbackCounter;
+			std::lock_guard<std::mutex> lock(mLock);
+			completed = (mProgramCounter == -1) ? (int32)mStages.size() : mProgramCounter;
 		}
+
+		std::promise<void> done;
+		std::future<void> finished(done.get_future());
+		rollbackFrom(completed - 1, boost::bind(&Transaction::signal, &done));
+		finished.wait();
+
+		std::lock_guard<std::mutex> lock(mLock);
 		mProgramCounter = 0;
 	}
 
 	inline bool waitForCompletion()
 	{
-		return mResult.get();
+		std::shared_future<bool> result;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if(!mResult.valid())
+				return mProgramCounter == -1;
+			result = mResult;
+		}
+		return result.get();
 	}
 
 	inline void reset()
 	{
-		std::lock_guard<std::mutex> lock(mRunLock);
+		waitForIdle();
+
+		std::lock_guard<std::mutex> lock(mLock);
+		mProgramCounter = 0;
+	}
+
+	/**
+	 * @brief Remove all steps so the transaction can be built again, the storage is kept for reuse.
+	 */
+	inline void clear()
+	{
+		waitForIdle();
+
+		std::lock_guard<std::mutex> lock(mLock);
+		mSteps.clear();
+		mStages.clear();
+		mGrouping = false;
 		mProgramCounter = 0;
+		mResult = std::shared_future<bool>();
+	}
+
+	/**
+	 * @brief Reserve storage for the given number of steps.
+	 */
+	inline void reserve(std::size_t steps)
+	{
+		mSteps.reserve(steps);
+		mStages.reserve(steps);
 	}
 
 	inline TransactionState& currentState()
@@ -121,59 +258,286 @@ public:
 	}
 
 private:
-	inline bool run()
+	typedef std::pair<ActionRoutine, RollbackRoutine> Step;
+
+	/// Steps of all stages are kept in one vector, a stage is a range of it
+	struct Stage
 	{
-		// how to deal with race condition here? (i.e. running an action which returns false but the next() call happened before the end of the current thread context)
-		// for example, we send a message and wait for its return, but the return happened before the end of current thread, so next() is called here, which creates a new thread
-		// the current solution here is to make sure there's only one thread in the run() function
-		std::lock_guard<std::mutex> lock(mRunLock);
+		Stage(std::size_t first, std::size_t count) : first(first), count(count)
+		{ }
 
-		if(mProgramCounter < 0)
-			return true;
+		std::size_t first;
+		std::size_t count;
+	};
 
-		while(mProgramCounter < (int32)mTransactions.size())
+	inline Step& stepOf(int32 stage, std::size_t index)
+	{
+		return mSteps[mStages[stage].first + index];
+	}
+
+	inline void initialize()
+	{
+		mProgramCounter = 0;
+		mGrouping = false;
+		mRunning = false;
+		mResumeRequested = false;
+		mPending = 0;
+		mPaused = false;
+		mRollbackStage = -1;
+	}
+
+	inline void addStep(Step&& step)
+	{
+		if(mGrouping)
+			++mStages.back().count;
+		else
+			mStages.push_back(Stage(mSteps.size(), 1));
+		mSteps.push_back(std::move(step));
+	}
+
+	/**
+	 * Run stages starting from the program counter. Single steps run inline,
+	 * a group is dispatched to the executor and its last finishing step
+	 * calls run() again.
+	 */
+	void run()
+	{
+		while(true)
 		{
+			if(mStages[mProgramCounter].count > 1)
+			{
+				runGroup();
+				return;
+			}
+
+			bool result;
 			try
 			{
-				bool result = mTransactions[mProgramCounter].first(mTransactionState);
-				++mProgramCounter;
-				if(!result) break;
+				result = stepOf(mProgramCounter, 0).first(mTransactionState);
 			}
 			catch(...)
 			{
-				int rollbackCounter = mProgramCounter;
-				while(rollbackCounter >= 0)
-				{
-					try
-					{
-						mTransactions[rollbackCounter].second(mTransactionState);
-					}
-					catch(...)
-					{
-						// log here since we failed to rollback
-					}
-					--rollbackCounter;
-				}
-				mProgramCounter = 0;
-				throw;
+				fail(std::current_exception());
+				return;
 			}
+
+			if(!advance(result))
+				return;
+		}
+	}
+
+	void runGroup()
+	{
+		const std::size_t count = mStages[mProgramCounter].count;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			mPending = count;
+			mPaused = false;
+			mError = std::exception_ptr();
 		}
 
-		if(mProgramCounter == (int32)mTransactions.size())
+		for(std::size_t i = 1; i < count; ++i)
+			mExecutor(boost::bind(&Transaction::runGroupStep, this, i));
+		runGroupStep(0);
+	}
+
+	void runGroupStep(std::size_t index)
+	{
+		bool result = true;
+		std::exception_ptr error;
+		try
+		{
+			result = stepOf(mProgramCounter, index).first(mTransactionState);
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if(!result)
+				mPaused = true;
+			if(error && !mError)
+				mError = error;
+			if(--mPending > 0)
+				return;
+		}
+
+		// the last step of the group continues the transaction
+		if(mError)
+			fail(mError);
+		else if(advance(!mPaused))
+			run();
+	}
+
+	/**
+	 * Move past the stage just completed.
+	 *
+	 * @return True if the next stage should run now.
+	 */
+	bool advance(bool result)
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+
+		++mProgramCounter;
+		if(mProgramCounter == (int32)mStages.size())
 		{
 			mProgramCounter = -1;
-			return true;
+			complete(lock, true);
+			return false;
 		}
 
-		return false;
+		if(!result)
+		{
+			if(!mResumeRequested)
+			{
+				complete(lock, false);
+				return false;
+			}
+			mResumeRequested = false;
+		}
+		return true;
+	}
+
+	void fail(std::exception_ptr error)
+	{
+		rollbackFrom(mProgramCounter, boost::bind(&Transaction::abort, this, error));
+	}
+
+	void abort(std::exception_ptr error)
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mProgramCounter = 0;
+		mRunning = false;
+		mResumeRequested = false;
+		std::promise<bool> promise(std::move(mPromise));
+		lock.unlock();
+
+		// nothing touches the transaction after this, it may be destroyed right away
+		promise.set_exception(error);
+	}
+
+	void complete(std::unique_lock<std::mutex>& lock, bool result)
+	{
+		mRunning = false;
+		mResumeRequested = false;
+		std::promise<bool> promise(std::move(mPromise));
+		lock.unlock();
+
+		promise.set_value(result);
+	}
+
+	/**
+	 * Call the rollbacks of the given stage and all stages before it, then call done.
+	 */
+	void rollbackFrom(int32 stage, const boost::function<void()>& done)
+	{
+		while(stage >= 0)
+		{
+			if(mStages[stage].count > 1)
+			{
+				rollbackGroup(stage, done);
+				return;
+			}
+
+			try
+			{
+				stepOf(stage, 0).second(mTransactionState);
+			}
+			catch(...)
+			{
+				// log here since we failed to rollback
+			}
+			--stage;
+		}
+
+		done();
+	}
+
+	void rollbackGroup(int32 stage, const boost::function<void()>& done)
+	{
+		const std::size_t count = mStages[stage].count;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			mPending = count;
+			mRollbackStage = stage;
+			mRollbackDone = done;
+		}
+
+		for(std::size_t i = 1; i < count; ++i)
+			mExecutor(boost::bind(&Transaction::rollbackGroupStep, this, i));
+		rollbackGroupStep(0);
+	}
+
+	void rollbackGroupStep(std::size_t index)
+	{
+		try
+		{
+			stepOf(mRollbackStage, index).second(mTransactionState);
+		}
+		catch(...)
+		{
+			// log here since we failed to rollback
+		}
+
+		boost::function<void()> done;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if(--mPending > 0)
+				return;
+			done.swap(mRollbackDone);
+		}
+		rollbackFrom(mRollbackStage - 1, done);
+	}
+
+	inline void waitForIdle()
+	{
+		std::shared_future<bool> result;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if(!mRunning)
+				return;
+			result = mResult;
+		}
+		result.wait();
+	}
+
+	static void spawnThread(const boost::function<void()>& task)
+	{
+		std::thread t(task);
+		t.detach();
+	}
+
+	static void postToWorker(Worker* worker, const boost::function<void()>& task)
+	{
+		worker->post(task);
+	}
+
+	static void signal(std::promise<void>* done)
+	{
+		done->set_value();
 	}
 
 protected:
-	std::vector< std::pair<ActionRoutine, RollbackRoutine> > mTransactions;
+	std::vector<Step> mSteps;
+	std::vector<Stage> mStages;
 	TransactionState& mTransactionState;
-	std::future<bool> mResult;
-	std::mutex mRunLock;
-	int32 mProgramCounter;
+	Executor mExecutor;
+	std::promise<bool> mPromise;
+	std::shared_future<bool> mResult;
+	std::mutex mLock;
+	int32 mProgramCounter;		///< Index of the next stage to run, or -1 once all stages have completed
+	bool mGrouping;
+	bool mRunning;
+	bool mResumeRequested;		///< next() was called while running, so a pausing stage doesn't pause
+
+	// state of the group being run or rolled back
+	std::size_t mPending;
+	bool mPaused;
+	std::exception_ptr mError;
+	int32 mRollbackStage;
+	boost::function<void()> mRollbackDone;
 };
 
 }
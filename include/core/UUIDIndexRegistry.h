@@ -0,0 +1,345 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_UUIDINDEXREGISTRY_H_
+#define ZILLIANS_UUIDINDEXREGISTRY_H_
+
+#include "core/Prerequisite.h"
+#include "core/UUIDMap.h"
+#include "core/ProfiledMutex.h"
+#include <tbb/spin_mutex.h>
+#include <tbb/spin_rw_mutex.h>
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+#include <atomic>
+#include <vector>
+
+namespace zillians {
+
+namespace detail {
+ZILLIANS_LOCK_SITE(UUIDIndexRegistryShardLockSite, "uuid_index_registry.shard");
+ZILLIANS_LOCK_SITE(UUIDIndexRegistryFreeLockSite, "uuid_index_registry.free");
+}
+
+/**
+ * @brief UUIDIndexRegistry gives each live UUID a dense 32-bit index, so per-entity data can live in plain arrays.
+ *
+ * The UUID is looked up once where a message enters, and the Handle travels
+ * on with the message. Subsystems index their own arrays by the handle index,
+ * sized to capacity(), instead of hashing the UUID again:
+ *
+ * @code
+ * UUIDIndexRegistry<> registry;
+ * std::vector<Vector3> positions;
+ *
+ * UUIDIndexRegistry<>::Handle h = registry.acquire(entity_id);// at the network edge
+ * if(positions.size() < registry.capacity()) positions.resize(registry.capacity());
+ * positions[h.index] = position;
+ * @endcode
+ *
+ * Indices of released UUIDs are reused, most recently released first so the
+ * arrays stay as dense as the live set. Every index has a generation which is
+ * bumped on acquire and on release, odd while the index is live, so a handle
+ * kept past the release of its UUID is caught by valid() even after the index
+ * is given to another UUID. valid() and getUUID() don't take any lock.
+ *
+ * The UUID to handle map is a set of UUIDMap shards, each with its own lock,
+ * and the free indices are kept under one spin lock which is only taken by
+ * acquiring a new UUID and by releasing one. Per-index data is kept in
+ * segments doubling in size, which are never moved once allocated.
+ *
+ * To keep the elements packed for sweeps, an InvertedSoA::Handle can be kept
+ * in an array indexed by the registry index instead of the data itself.
+ */
+template<std::size_t Shards = 64>
+class UUIDIndexRegistry : public boost::noncopyable
+{
+	BOOST_STATIC_ASSERT((Shards & (Shards - 1)) == 0);
+public:
+	struct Handle
+	{
+		Handle() : index(INVALID_INDEX), generation(0)
+		{ }
+
+		Handle(uint32 i, uint32 g) : index(i), generation(g)
+		{ }
+
+		inline bool operator== (const Handle& other) const { return index == other.index && generation == other.generation; }
+		inline bool operator!= (const Handle& other) const { return !(*this == other); }
+
+		uint32 index;
+		uint32 generation;
+	};
+
+	enum { INVALID_INDEX = 0xFFFFFFFFU };
+
+public:
+	UUIDIndexRegistry() : mCapacity(0), mSize(0)
+	{
+		for(std::size_t i = 0; i < SEGMENT_COUNT; ++i)
+			mSegments[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	~UUIDIndexRegistry()
+	{
+		for(std::size_t i = 0; i < SEGMENT_COUNT; ++i)
+			delete[] mSegments[i].load(std::memory_order_relaxed);
+	}
+
+public:
+	/**
+	 * @brief Get the handle of the UUID, assigning it an index if it has none.
+	 *
+	 * @param inserted Set to whether the UUID got a new index, if not NULL.
+	 */
+	Handle acquire(const UUID& id, bool* inserted = NULL)
+	{
+		Shard& shard = shardOf(id);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+
+		typename UUIDMap<Handle>::iterator i = shard.map.find(id);
+		if(i != shard.map.end())
+		{
+			if(inserted) *inserted = false;
+			return i->second;
+		}
+
+		uint32 index = allocateIndex();
+		Slot& slot = slotAt(index);
+
+		// the same order as a seqlock writer, see getUUID()
+		const uint32 generation = slot.generation.load(std::memory_order_relaxed) + 1;
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.id[0].store(id.data.u64[0], std::memory_order_relaxed);
+		slot.id[1].store(id.data.u64[1], std::memory_order_relaxed);
+		slot.generation.store(generation, std::memory_order_release);
+
+		Handle handle(index, generation);
+		shard.map.insert(std::make_pair(id, handle));
+		mSize.fetch_add(1, std::memory_order_relaxed);
+
+		if(inserted) *inserted = true;
+		return handle;
+	}
+
+	/**
+	 * @brief Get the handle of the UUID without assigning one.
+	 *
+	 * @return True if the UUID has an index.
+	 */
+	bool find(const UUID& id, Handle& handle) const
+	{
+		Shard& shard = shardOf(id);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+
+		typename UUIDMap<Handle>::const_iterator i = shard.map.find(id);
+		if(i == shard.map.end())
+			return false;
+		handle = i->second;
+		return true;
+	}
+
+	/**
+	 * @brief Give the index of the UUID back, which invalidates all of its handles.
+	 *
+	 * @return False if the UUID has no index.
+	 */
+	bool release(const UUID& id)
+	{
+		return releaseIf(id, NULL);
+	}
+
+	/**
+	 * @brief Give the index back if the handle is still valid.
+	 *
+	 * @return False if the handle is stale, in which case nothing is released.
+	 */
+	bool release(const Handle& handle)
+	{
+		UUID id;
+		if(!getUUID(handle, id))
+			return false;
+		return releaseIf(id, &handle);
+	}
+
+	/**
+	 * @brief Tell if the handle still refers to the UUID it was given for.
+	 *
+	 * A handle of a UUID being released concurrently may be seen as valid
+	 * until release() returns.
+	 */
+	inline bool valid(const Handle& handle) const
+	{
+		if((handle.generation & 1) == 0 || handle.index >= mCapacity.load(std::memory_order_acquire))
+			return false;
+		return slotAt(handle.index).generation.load(std::memory_order_acquire) == handle.generation;
+	}
+
+	/**
+	 * @brief Get the UUID the handle was given for.
+	 *
+	 * @return False if the handle is stale.
+	 */
+	bool getUUID(const Handle& handle, UUID& id) const
+	{
+		if((handle.generation & 1) == 0 || handle.index >= mCapacity.load(std::memory_order_acquire))
+			return false;
+
+		// the index may be given to another UUID while it's read, so check the generation again after
+		const Slot& slot = slotAt(handle.index);
+		if(slot.generation.load(std::memory_order_acquire) != handle.generation)
+			return false;
+		id.data.u64[0] = slot.id[0].load(std::memory_order_relaxed);
+		id.data.u64[1] = slot.id[1].load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slot.generation.load(std::memory_order_relaxed) == handle.generation;
+	}
+
+	/**
+	 * @brief Number of UUIDs holding an index.
+	 */
+	inline std::size_t size() const
+	{
+		return mSize.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Upper bound of the indices given so far, the size of arrays indexed by the registry.
+	 *
+	 * It never shrinks, released indices are reused before it grows.
+	 */
+	inline std::size_t capacity() const
+	{
+		return mCapacity.load(std::memory_order_acquire);
+	}
+
+private:
+	enum
+	{
+		FIRST_SEGMENT_BITS = 10,
+		SEGMENT_COUNT = 32 - FIRST_SEGMENT_BITS + 1,		///< Enough segments for every 32-bit index but INVALID_INDEX
+	};
+
+	struct Slot
+	{
+		Slot() : generation(0)
+		{
+			id[0].store(0, std::memory_order_relaxed);
+			id[1].store(0, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint32> generation;		///< Odd while the index is given to a UUID
+		std::atomic<uint64> id[2];			///< Words of the UUID, atomic since getUUID() reads them without lock
+	};
+
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_rw_mutex, detail::UUIDIndexRegistryShardLockSite) shard_mutex_t;
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, detail::UUIDIndexRegistryFreeLockSite) free_mutex_t;
+
+	/**
+	 * Shards are padded to a cache line so locking one doesn't invalidate its neighbours.
+	 */
+	struct Shard
+	{
+		mutable shard_mutex_t lock;
+		UUIDMap<Handle> map;
+		char padding[64];
+	};
+
+	/**
+	 * Segment 0 holds the first 2^FIRST_SEGMENT_BITS indices, and each of the
+	 * following ones as many indices as all segments before it.
+	 */
+	static inline uint32 segmentOf(uint32 index)
+	{
+		uint32 high = index >> FIRST_SEGMENT_BITS;
+		return high ? (32 - __builtin_clz(high)) : 0;
+	}
+
+	static inline uint32 segmentBase(uint32 segment)
+	{
+		return segment ? (1U << (FIRST_SEGMENT_BITS + segment - 1)) : 0;
+	}
+
+	static inline uint32 segmentSize(uint32 segment)
+	{
+		return segment ? (1U << (FIRST_SEGMENT_BITS + segment - 1)) : (1U << FIRST_SEGMENT_BITS);
+	}
+
+	inline Slot& slotAt(uint32 index) const
+	{
+		uint32 segment = segmentOf(index);
+		return mSegments[segment].load(std::memory_order_acquire)[index - segmentBase(segment)];
+	}
+
+	inline Shard& shardOf(const UUID& id) const
+	{
+		return mShards[(UUIDMap<Handle>::hash(id) >> 40) & (Shards - 1)];
+	}
+
+	uint32 allocateIndex()
+	{
+		typename free_mutex_t::scoped_lock lock(mFreeLock);
+		if(!mFreeIndices.empty())
+		{
+			uint32 index = mFreeIndices.back();
+			mFreeIndices.pop_back();
+			return index;
+		}
+
+		uint32 index = mCapacity.load(std::memory_order_relaxed);
+		BOOST_ASSERT(index != (uint32)INVALID_INDEX);
+		uint32 segment = segmentOf(index);
+		if(index == segmentBase(segment))
+			mSegments[segment].store(new Slot[segmentSize(segment)], std::memory_order_release);
+		mCapacity.store(index + 1, std::memory_order_release);
+		return index;
+	}
+
+	bool releaseIf(const UUID& id, const Handle* expected)
+	{
+		Shard& shard = shardOf(id);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+
+		typename UUIDMap<Handle>::iterator i = shard.map.find(id);
+		if(i == shard.map.end() || (expected && i->second != *expected))
+			return false;
+
+		Handle handle = i->second;
+		shard.map.erase(i);
+		slotAt(handle.index).generation.store(handle.generation + 1, std::memory_order_release);
+		mSize.fetch_sub(1, std::memory_order_relaxed);
+
+		typename free_mutex_t::scoped_lock free(mFreeLock);
+		mFreeIndices.push_back(handle.index);
+		return true;
+	}
+
+private:
+	mutable Shard mShards[Shards];
+	mutable std::atomic<Slot*> mSegments[SEGMENT_COUNT];
+	std::atomic<uint32> mCapacity;
+	std::atomic<std::size_t> mSize;
+
+	free_mutex_t mFreeLock;
+	std::vector<uint32> mFreeIndices;		///< Released indices, reused last in first out
+};
+
+}
+
+#endif/*ZILLIANS_UUIDINDEXREGISTRY_H_*/
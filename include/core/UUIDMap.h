@@ -0,0 +1,702 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_UUIDMAP_H_
+#define ZILLIANS_UUIDMAP_H_
+
+#include "core/Prerequisite.h"
+#include "utility/UUIDUtil.h"
+#include "core/ProfiledMutex.h"
+#include <tbb/spin_rw_mutex.h>
+#include <boost/noncopyable.hpp>
+#include <boost/assert.hpp>
+#include <boost/static_assert.hpp>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <cstring>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace zillians {
+
+namespace detail {
+
+/**
+ * Control byte values of UUIDMap slots. A full slot keeps the 7-bit H2 of
+ * its key (0..127), so empty and deleted slots are the only negative ones.
+ */
+struct uuid_map_ctrl_t
+{
+	enum type
+	{
+		EMPTY   = -128,
+		DELETED = -2,
+	};
+};
+
+/**
+ * @brief A group of 16 control bytes probed at once.
+ *
+ * Each match function returns a bit mask where bit i tells slot i of the
+ * group matches. With SSE2 a whole group is compared in a couple of
+ * instructions, otherwise it falls back to a plain loop.
+ */
+class UUIDMapGroup
+{
+public:
+	enum { WIDTH = 16 };
+
+	explicit UUIDMapGroup(const int8* ctrl)
+#ifdef __SSE2__
+		: mCtrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)))
+#else
+		: mCtrl(ctrl)
+#endif
+	{ }
+
+	inline uint32 match(int8 h2) const
+	{
+#ifdef __SSE2__
+		return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), mCtrl));
+#else
+		uint32 mask = 0;
+		for(int i = 0; i < WIDTH; ++i)
+			if(mCtrl[i] == h2) mask |= (1u << i);
+		return mask;
+#endif
+	}
+
+	inline uint32 matchEmpty() const
+	{
+		return match((int8)uuid_map_ctrl_t::EMPTY);
+	}
+
+	inline uint32 matchEmptyOrDeleted() const
+	{
+#ifdef __SSE2__
+		return (uint32)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), mCtrl));
+#else
+		uint32 mask = 0;
+		for(int i = 0; i < WIDTH; ++i)
+			if(mCtrl[i] < -1) mask |= (1u << i);
+		return mask;
+#endif
+	}
+
+	static inline uint32 lowestBit(uint32 mask)
+	{
+		return (uint32)__builtin_ctz(mask);
+	}
+
+private:
+#ifdef __SSE2__
+	__m128i mCtrl;
+#else
+	const int8* mCtrl;
+#endif
+};
+
+/**
+ * Control bytes of a map without any storage, so lookups on an empty map
+ * need no special case: nothing matches and the group has an empty slot.
+ */
+template<typename Dummy>
+struct uuid_map_empty_group
+{
+	static const int8 ctrl[UUIDMapGroup::WIDTH];
+};
+
+template<typename Dummy>
+const int8 uuid_map_empty_group<Dummy>::ctrl[UUIDMapGroup::WIDTH] = {
+	-128, -128, -128, -128, -128, -128, -128, -128,
+	-128, -128, -128, -128, -128, -128, -128, -128 };
+
+}
+
+/**
+ * @brief UUIDMap is a flat open-addressing hash map specialized for UUID keys.
+ *
+ * Entries live in one flat slot array next to an array of one-byte control
+ * words, in the layout of Google's SwissTable. The hash is split into H1,
+ * which picks the group of 16 slots to start probing from, and H2, the 7 bits
+ * kept in the control byte. A lookup compares H2 against a whole group at
+ * once and only touches the slots that match, so a miss rarely reads a key
+ * at all.
+ *
+ * The UUID already is a random number, so the hash is just its two words
+ * folded together. The fold is multiplied once by a odd constant since the
+ * time-based UUIDs generated by APR differ mostly in the low word.
+ *
+ * Removal leaves a tombstone unless the group still has an empty slot, and
+ * the table is rebuilt once empty slots run out, at a load factor of 7/8.
+ *
+ * @note Like std::unordered_map, iterators and pointers to elements are
+ * invalidated by any insertion that grows the table.
+ * @note UUIDMap is not thread-safe, see ConcurrentUUIDMap.
+ */
+template<typename V>
+class UUIDMap
+{
+public:
+	typedef UUID key_type;
+	typedef V mapped_type;
+	typedef std::pair<const UUID, V> value_type;
+	typedef std::size_t size_type;
+
+private:
+	typedef detail::UUIDMapGroup Group;
+	typedef detail::uuid_map_ctrl_t ctrl_t;
+
+	template<typename Value>
+	class Iterator
+	{
+		friend class UUIDMap;
+		template<typename U> friend class Iterator;
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef Value value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef Value* pointer;
+		typedef Value& reference;
+
+	public:
+		Iterator() : mCtrl(NULL), mSlot(NULL), mCtrlEnd(NULL)
+		{ }
+
+		template<typename U>
+		Iterator(const Iterator<U>& other) : mCtrl(other.mCtrl), mSlot(other.mSlot), mCtrlEnd(other.mCtrlEnd)
+		{ }
+
+	public:
+		inline reference operator* () const { return *mSlot; }
+		inline pointer operator-> () const { return mSlot; }
+
+		inline Iterator& operator++ ()
+		{
+			++mCtrl; ++mSlot;
+			skipEmptyOrDeleted();
+			return *this;
+		}
+
+		inline Iterator operator++ (int)
+		{
+			Iterator i(*this);
+			++(*this);
+			return i;
+		}
+
+		template<typename U>
+		inline bool operator== (const Iterator<U>& other) const { return mSlot == other.mSlot; }
+
+		template<typename U>
+		inline bool operator!= (const Iterator<U>& other) const { return mSlot != other.mSlot; }
+
+	private:
+		Iterator(const int8* ctrl, Value* slot, const int8* ctrlEnd) : mCtrl(ctrl), mSlot(slot), mCtrlEnd(ctrlEnd)
+		{ }
+
+		inline void skipEmptyOrDeleted()
+		{
+			while(mCtrl != mCtrlEnd && *mCtrl < 0)
+			{
+				++mCtrl; ++mSlot;
+			}
+		}
+
+		const int8* mCtrl;
+		Value* mSlot;
+		const int8* mCtrlEnd;
+	};
+
+public:
+	typedef Iterator<value_type> iterator;
+	typedef Iterator<const value_type> const_iterator;
+
+public:
+	UUIDMap() : mCtrl(const_cast<int8*>(detail::uuid_map_empty_group<void>::ctrl)), mSlots(NULL), mCapacity(0), mGroupMask(0), mSize(0), mGrowthLeft(0)
+	{ }
+
+	explicit UUIDMap(size_type expected) : mCtrl(const_cast<int8*>(detail::uuid_map_empty_group<void>::ctrl)), mSlots(NULL), mCapacity(0), mGroupMask(0), mSize(0), mGrowthLeft(0)
+	{
+		reserve(expected);
+	}
+
+	UUIDMap(const UUIDMap& other) : mCtrl(const_cast<int8*>(detail::uuid_map_empty_group<void>::ctrl)), mSlots(NULL), mCapacity(0), mGroupMask(0), mSize(0), mGrowthLeft(0)
+	{
+		reserve(other.size());
+		for(const_iterator i = other.begin(); i != other.end(); ++i)
+			insertUnique(*i, hash(i->first));
+	}
+
+	~UUIDMap()
+	{
+		destroyAll();
+		deallocateStorage();
+	}
+
+	UUIDMap& operator= (const UUIDMap& other)
+	{
+		if(this != &other)
+		{
+			UUIDMap copy(other);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	void swap(UUIDMap& other)
+	{
+		std::swap(mCtrl, other.mCtrl);
+		std::swap(mSlots, other.mSlots);
+		std::swap(mCapacity, other.mCapacity);
+		std::swap(mGroupMask, other.mGroupMask);
+		std::swap(mSize, other.mSize);
+		std::swap(mGrowthLeft, other.mGrowthLeft);
+	}
+
+public:
+	/**
+	 * @brief The hash of a UUID, H2 is the top 7 bits and H1 is the rest.
+	 */
+	static inline uint64 hash(const UUID& key)
+	{
+		return (key.data.u64[0] ^ key.data.u64[1]) * 0x9E3779B97F4A7C15ULL;
+	}
+
+public:
+	inline iterator begin()
+	{
+		iterator i(mCtrl, mSlots, mCtrl + mCapacity);
+		i.skipEmptyOrDeleted();
+		return i;
+	}
+
+	inline iterator end()
+	{
+		return iterator(mCtrl + mCapacity, mSlots + mCapacity, mCtrl + mCapacity);
+	}
+
+	inline const_iterator begin() const
+	{
+		return const_cast<UUIDMap*>(this)->begin();
+	}
+
+	inline const_iterator end() const
+	{
+		return const_cast<UUIDMap*>(this)->end();
+	}
+
+	inline size_type size() const { return mSize; }
+	inline bool empty() const { return mSize == 0; }
+
+	/**
+	 * @brief Number of slots in the table.
+	 */
+	inline size_type capacity() const { return mCapacity; }
+
+public:
+	inline iterator find(const UUID& key)
+	{
+		size_type i = findIndex(key, hash(key));
+		return (i == npos) ? end() : iteratorAt(i);
+	}
+
+	inline const_iterator find(const UUID& key) const
+	{
+		return const_cast<UUIDMap*>(this)->find(key);
+	}
+
+	inline size_type count(const UUID& key) const
+	{
+		return (findIndex(key, hash(key)) == npos) ? 0 : 1;
+	}
+
+	/**
+	 * @brief Insert the given value unless the key is already in the map.
+	 *
+	 * @return The iterator to the element with the key, and whether the value is inserted.
+	 */
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		uint64 h = hash(value.first);
+		size_type i = findIndex(value.first, h);
+		if(i != npos)
+			return std::make_pair(iteratorAt(i), false);
+
+		i = insertUnique(value, h);
+		return std::make_pair(iteratorAt(i), true);
+	}
+
+	V& operator[] (const UUID& key)
+	{
+		uint64 h = hash(key);
+		size_type i = findIndex(key, h);
+		if(i == npos)
+			i = insertUnique(value_type(key, V()), h);
+		return mSlots[i].second;
+	}
+
+	size_type erase(const UUID& key)
+	{
+		size_type i = findIndex(key, hash(key));
+		if(i == npos)
+			return 0;
+
+		eraseAt(i);
+		return 1;
+	}
+
+	void erase(iterator position)
+	{
+		eraseAt(position.mSlot - mSlots);
+	}
+
+	/**
+	 * @brief Remove all elements, the storage is kept for reuse.
+	 */
+	void clear()
+	{
+		destroyAll();
+		if(mCapacity > 0)
+			std::memset(mCtrl, ctrl_t::EMPTY, mCapacity);
+		mSize = 0;
+		mGrowthLeft = maxLoad(mCapacity);
+	}
+
+	/**
+	 * @brief Make room for the given number of elements so that inserting them all doesn't rehash.
+	 */
+	void reserve(size_type n)
+	{
+		if(n <= mSize + mGrowthLeft)
+			return;
+
+		size_type capacity = Group::WIDTH;
+		while(maxLoad(capacity) < n)
+			capacity <<= 1;
+		rehash(capacity);
+	}
+
+private:
+	static const size_type npos = (size_type)-1;
+
+	static inline int8 h2(uint64 h)
+	{
+		return (int8)(h >> 57);
+	}
+
+	static inline size_type maxLoad(size_type capacity)
+	{
+		return capacity - capacity / 8;
+	}
+
+	inline iterator iteratorAt(size_type i)
+	{
+		return iterator(mCtrl + i, mSlots + i, mCtrl + mCapacity);
+	}
+
+	/**
+	 * Groups are probed in triangular steps from the H1 group, which visits
+	 * every group of a power-of-two table once. The probe ends at the first
+	 * group with an empty slot, since an insertion would have stopped there.
+	 */
+	inline size_type findIndex(const UUID& key, uint64 h) const
+	{
+		size_type g = (size_type)h & mGroupMask;
+		for(size_type step = 1; ; ++step)
+		{
+			const size_type base = g * Group::WIDTH;
+			Group group(mCtrl + base);
+			for(uint32 m = group.match(h2(h)); m; m &= m - 1)
+			{
+				size_type i = base + Group::lowestBit(m);
+				if(LIKELY(mSlots[i].first == key))
+					return i;
+			}
+			if(LIKELY(group.matchEmpty()))
+				return npos;
+			g = (g + step) & mGroupMask;
+		}
+	}
+
+	inline size_type findFirstNonFull(uint64 h) const
+	{
+		size_type g = (size_type)h & mGroupMask;
+		for(size_type step = 1; ; ++step)
+		{
+			uint32 m = Group(mCtrl + g * Group::WIDTH).matchEmptyOrDeleted();
+			if(LIKELY(m))
+				return g * Group::WIDTH + Group::lowestBit(m);
+			g = (g + step) & mGroupMask;
+		}
+	}
+
+	/**
+	 * Place a value whose key is known not to be in the map.
+	 */
+	size_type insertUnique(const value_type& value, uint64 h)
+	{
+		size_type i = 0;
+		if(mCapacity > 0)
+			i = findFirstNonFull(h);
+		if(UNLIKELY(mGrowthLeft == 0 && (mCapacity == 0 || mCtrl[i] != (int8)ctrl_t::DELETED)))
+		{
+			// keep the capacity if mostly tombstones took the room
+			rehash((mCapacity > 0 && mSize * 2 <= maxLoad(mCapacity)) ? mCapacity : std::max<size_type>(mCapacity * 2, Group::WIDTH));
+			i = findFirstNonFull(h);
+		}
+
+		new ((void*)(mSlots + i)) value_type(value);
+		if(mCtrl[i] == (int8)ctrl_t::EMPTY)
+			--mGrowthLeft;
+		mCtrl[i] = h2(h);
+		++mSize;
+		return i;
+	}
+
+	void eraseAt(size_type i)
+	{
+		BOOST_ASSERT(mCtrl[i] >= 0);
+		mSlots[i].~value_type();
+		--mSize;
+
+		// no probe went past a group which still has an empty slot, so no tombstone is needed
+		if(Group(mCtrl + (i & ~(size_type)(Group::WIDTH - 1))).matchEmpty())
+		{
+			mCtrl[i] = ctrl_t::EMPTY;
+			++mGrowthLeft;
+		}
+		else
+		{
+			mCtrl[i] = ctrl_t::DELETED;
+		}
+	}
+
+	void rehash(size_type capacity)
+	{
+		BOOST_ASSERT(capacity >= Group::WIDTH && (capacity & (capacity - 1)) == 0);
+		BOOST_ASSERT(maxLoad(capacity) >= mSize);
+
+		int8* oldCtrl = mCtrl;
+		value_type* oldSlots = mSlots;
+		size_type oldCapacity = mCapacity;
+
+		mSlots = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+		try
+		{
+			mCtrl = new int8[capacity];
+		}
+		catch(...)
+		{
+			::operator delete(mSlots);
+			mSlots = oldSlots;
+			throw;
+		}
+		std::memset(mCtrl, ctrl_t::EMPTY, capacity);
+		mCapacity = capacity;
+		mGroupMask = capacity / Group::WIDTH - 1;
+		mGrowthLeft = maxLoad(capacity) - mSize;
+
+		for(size_type i = 0; i < oldCapacity; ++i)
+		{
+			if(oldCtrl[i] >= 0)
+			{
+				uint64 h = hash(oldSlots[i].first);
+				size_type j = findFirstNonFull(h);
+				new ((void*)(mSlots + j)) value_type(std::move(oldSlots[i]));
+				mCtrl[j] = h2(h);
+				oldSlots[i].~value_type();
+			}
+		}
+
+		if(oldCapacity > 0)
+		{
+			delete[] oldCtrl;
+			::operator delete(oldSlots);
+		}
+	}
+
+	void destroyAll()
+	{
+		for(size_type i = 0; i < mCapacity; ++i)
+		{
+			if(mCtrl[i] >= 0)
+				mSlots[i].~value_type();
+		}
+	}
+
+	void deallocateStorage()
+	{
+		if(mCapacity > 0)
+		{
+			delete[] mCtrl;
+			::operator delete(mSlots);
+		}
+	}
+
+private:
+	int8* mCtrl;				///< One control byte per slot, or the shared empty group
+	value_type* mSlots;
+	size_type mCapacity;		///< Number of slots, zero or a power of two of at least one group
+	size_type mGroupMask;		///< Number of groups minus one, zero for the empty group
+	size_type mSize;
+	size_type mGrowthLeft;		///< Empty slots that can be used before the table has to be rebuilt
+};
+
+namespace detail {
+ZILLIANS_LOCK_SITE(ConcurrentUUIDMapShardLockSite, "concurrent_uuid_map.shard");
+}
+
+/**
+ * @brief ConcurrentUUIDMap is a thread-safe UUIDMap split into independently locked shards.
+ *
+ * The shard is picked from hash bits which UUIDMap doesn't use for small
+ * tables, and each shard is guarded by a reader-writer spin lock, so threads
+ * working on different keys rarely meet on the same lock. The values are
+ * copied in and out under the lock, there is no way to hold a reference to
+ * an element.
+ */
+template<typename V, std::size_t Shards = 64>
+class ConcurrentUUIDMap : public boost::noncopyable
+{
+	BOOST_STATIC_ASSERT((Shards & (Shards - 1)) == 0);
+public:
+	typedef std::size_t size_type;
+
+public:
+	ConcurrentUUIDMap()
+	{ }
+
+	explicit ConcurrentUUIDMap(size_type expected)
+	{
+		reserve(expected);
+	}
+
+public:
+	/**
+	 * @brief Insert the value unless the key is already in the map.
+	 *
+	 * @return True if the value is inserted.
+	 */
+	bool insert(const UUID& key, const V& value)
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+		return shard.map.insert(std::make_pair(key, value)).second;
+	}
+
+	/**
+	 * @brief Insert the value or overwrite the existing one.
+	 */
+	void assign(const UUID& key, const V& value)
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+		shard.map[key] = value;
+	}
+
+	/**
+	 * @brief Copy the value of the given key.
+	 *
+	 * @return True if the key is found.
+	 */
+	bool find(const UUID& key, V& value) const
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+		typename UUIDMap<V>::const_iterator i = shard.map.find(key);
+		if(i == shard.map.end())
+			return false;
+		value = i->second;
+		return true;
+	}
+
+	bool contains(const UUID& key) const
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, false);
+		return shard.map.count(key) != 0;
+	}
+
+	bool erase(const UUID& key)
+	{
+		Shard& shard = shardOf(key);
+		typename shard_mutex_t::scoped_lock lock(shard.lock, true);
+		return shard.map.erase(key) != 0;
+	}
+
+	/**
+	 * @brief Number of elements, which is only a snapshot while other threads are modifying the map.
+	 */
+	size_type size() const
+	{
+		size_type n = 0;
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			typename shard_mutex_t::scoped_lock lock(mShards[i].lock, false);
+			n += mShards[i].map.size();
+		}
+		return n;
+	}
+
+	void clear()
+	{
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			typename shard_mutex_t::scoped_lock lock(mShards[i].lock, true);
+			mShards[i].map.clear();
+		}
+	}
+
+	void reserve(size_type n)
+	{
+		for(std::size_t i = 0; i < Shards; ++i)
+		{
+			typename shard_mutex_t::scoped_lock lock(mShards[i].lock, true);
+			mShards[i].map.reserve((n + Shards - 1) / Shards);
+		}
+	}
+
+private:
+	/**
+	 * Shards are padded to a cache line so locking one doesn't invalidate its neighbours.
+	 */
+	typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_rw_mutex, detail::ConcurrentUUIDMapShardLockSite) shard_mutex_t;
+
+	struct Shard
+	{
+		mutable shard_mutex_t lock;
+		UUIDMap<V> map;
+		char padding[64];
+	};
+
+	inline Shard& shardOf(const UUID& key) const
+	{
+		return mShards[(UUIDMap<V>::hash(key) >> 40) & (Shards - 1)];
+	}
+
+	mutable Shard mShards[Shards];
+};
+
+}
+
+#endif/*ZILLIANS_UUIDMAP_H_*/
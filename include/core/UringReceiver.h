@@ -0,0 +1,265 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_URINGRECEIVER_H_
+#define ZILLIANS_URINGRECEIVER_H_
+
+#include "core/Buffer.h"
+
+#include <boost/noncopyable.hpp>
+#include <sys/uio.h>
+#include <vector>
+#include <deque>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace zillians {
+
+/**
+ * @brief UringReceiver receives from many sockets straight into their Buffers using Linux io_uring.
+ *
+ * Each socket is added with the buffer its data goes to. Once started, the memory of
+ * every buffer is registered to the kernel and a read is kept in flight per socket,
+ * targeting wptr() of a plain buffer or both free ranges of a circular buffer. poll()
+ * submits all queued reads and reaps all completions with a single system call, and
+ * the received bytes are already committed by wskip() when a completion is returned,
+ * so there's neither a temporary array to copy from nor a recv() per packet.
+ *
+ * @code
+ * UringReceiver receiver;
+ * uint32 id = receiver.add(fd, buffer);
+ * receiver.start();
+ * std::vector<UringReceiver::Completion> completions;
+ * while(receiver.poll(completions) > 0)
+ * {
+ *     ... // consume the buffers, then resume() those that were full
+ *     completions.clear();
+ * }
+ * @endcode
+ *
+ * @note Buffers must not be resized or destroyed while the receiver is alive, and are
+ * only touched from the thread calling poll() and resume(). While a read is in flight the
+ * consumer may only read from the buffer, i.e. no write, crunch() or clear().
+ * @note If the buffer memory can't be registered, e.g. RLIMIT_MEMLOCK is too low, plain
+ * reads are used instead, see isRegistered().
+ */
+class UringReceiver : public boost::noncopyable
+{
+public:
+	enum
+	{
+		DEFAULT_ENTRIES = 256,	///< Default size of the submission queue
+	};
+
+	struct Completion
+	{
+		uint32 id;		///< The id returned by add()
+		int result;		///< Number of bytes committed to the buffer, 0 at the end of stream, or the negated errno
+	};
+
+	/**
+	 * @brief Create the io_uring instance.
+	 *
+	 * @param entries The size of the submission queue, reads beyond that are queued until the next poll().
+	 *
+	 * @throw std::runtime_error if io_uring is not available.
+	 */
+	UringReceiver(uint32 entries = DEFAULT_ENTRIES);
+
+	/**
+	 * @brief Cancel all reads in flight and wait for them before the buffers can go away.
+	 */
+	~UringReceiver();
+
+public:
+	/**
+	 * @brief Tell if the running kernel supports io_uring.
+	 */
+	static bool isSupported();
+
+	/**
+	 * @brief Add a socket to receive from, must be called before start().
+	 *
+	 * @param fd The socket, it's never closed by the receiver.
+	 * @param buffer The buffer to receive into, any non-concurrent or spsc BufferT.
+	 *
+	 * @return The id of the socket, given back by completions.
+	 */
+	template<typename BufferType>
+	uint32 add(int fd, BufferType& buffer)
+	{
+		BOOST_ASSERT(!mStarted);
+
+		Slot slot;
+		slot.fd = fd;
+		slot.state = Slot::IDLE;
+		slot.buffer = &buffer;
+		slot.memory = buffer.getMemoryRange();
+		slot.getFreeRanges = &getFreeRangesOf<BufferType>;
+		slot.commit = &commitOf<BufferType>;
+		mSlots.push_back(slot);
+
+		return (uint32)(mSlots.size() - 1);
+	}
+
+	/**
+	 * @brief Register the memory of all buffers and queue a read on every socket.
+	 */
+	void start();
+
+	/**
+	 * @brief Submit queued reads and reap completed ones.
+	 *
+	 * After a completion the next read of the socket is queued right away as long as its
+	 * buffer has room, otherwise the socket stays idle until resume(). Sockets reaching
+	 * the end of stream or failing are not read anymore.
+	 *
+	 * @param completions Completions are appended to it.
+	 * @param wait Block until at least one read completes, unless no read is in flight.
+	 *
+	 * @return The number of completions appended.
+	 *
+	 * @throw std::runtime_error if the submission fails.
+	 */
+	std::size_t poll(std::vector<Completion>& completions, bool wait = true);
+
+	/**
+	 * @brief Queue a read on an idle socket after its buffer has been consumed.
+	 *
+	 * Space before the read pointer of a plain buffer is reclaimed by crunch().
+	 *
+	 * @return True if a read is queued or in flight, false if the buffer is still full or the socket is closed.
+	 */
+	bool resume(uint32 id);
+
+	inline bool isClosed(uint32 id) const
+	{
+		return mSlots[id].state == Slot::CLOSED;
+	}
+
+	inline std::size_t size() const
+	{
+		return mSlots.size();
+	}
+
+	/**
+	 * @brief Tell if buffer memory is registered, so reads into a single range use IORING_OP_READ_FIXED.
+	 */
+	inline bool isRegistered() const
+	{
+		return mRegistered;
+	}
+
+	/**
+	 * @brief Get the number of io_uring_enter() system calls made so far.
+	 */
+	inline uint64 getEnterCount() const
+	{
+		return mEnterCount;
+	}
+
+private:
+	typedef BufferRanges Ranges;
+
+	struct Slot
+	{
+		enum State
+		{
+			IDLE,		///< No read queued, the buffer was full
+			QUEUED,		///< Waiting for a submission queue entry
+			READING,	///< Read in flight
+			CLOSED,		///< End of stream or error
+		};
+
+		int fd;
+		State state;
+		void* buffer;
+		std::pair<byte*,std::size_t> memory;
+		std::size_t (*getFreeRanges)(void* buffer, Ranges& ranges);
+		void (*commit)(void* buffer, std::size_t bytes);
+
+		Ranges ranges;
+		struct iovec vectors[2];	///< Must stay valid until the read completes
+	};
+
+	template<typename BufferType>
+	static std::size_t getFreeRangesOf(void* buffer, Ranges& ranges)
+	{
+		BufferType& b = *static_cast<BufferType*>(buffer);
+		std::size_t size = b.getFreeRanges(ranges);
+		if(size == 0 && b.freeSize() > 0)
+		{
+			// only a plain buffer can have room before the read pointer only
+			if(b.dataSize() == 0)
+				b.clear();
+			else
+				b.crunch();
+			size = b.getFreeRanges(ranges);
+		}
+		return size;
+	}
+
+	template<typename BufferType>
+	static void commitOf(void* buffer, std::size_t bytes)
+	{
+		static_cast<BufferType*>(buffer)->wskip(bytes);
+	}
+
+	bool queue(uint32 id);
+	void submitQueued();
+	io_uring_sqe* getSqe();
+	void enter(uint32 submit, uint32 wait);
+	std::size_t reap(std::vector<Completion>* completions);
+
+private:
+	int mRing;
+	bool mStarted;
+	bool mRegistered;
+	uint64 mEnterCount;
+
+	std::vector<Slot> mSlots;
+	std::deque<uint32> mQueued;
+	uint32 mInflight;
+
+	void* mSqRing;
+	std::size_t mSqRingSize;
+	void* mCqRing;
+	std::size_t mCqRingSize;
+	io_uring_sqe* mSqes;
+	std::size_t mSqesSize;
+
+	uint32* mSqHead;
+	uint32* mSqTail;
+	uint32* mSqArray;
+	uint32 mSqMask;
+	uint32 mSqEntries;
+	uint32 mSqLocalTail;
+	uint32 mSqSubmitted;
+
+	uint32* mCqHead;
+	uint32* mCqTail;
+	io_uring_cqe* mCqes;
+	uint32 mCqMask;
+	uint32 mCqEntries;
+};
+
+}
+
+#endif/*ZILLIANS_URINGRECEIVER_H_*/
@@ -29,10 +29,38 @@
 #include <boost/mpl/front.hpp>
 #include <boost/mpl/pop_front.hpp>
 #include <boost/mpl/empty.hpp>
+#include <boost/mpl/find.hpp>
+#include <boost/mpl/size.hpp>
+#include <boost/mpl/assert.hpp>
+#include <boost/type_traits/remove_const.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <queue>
 
 #define ENABLE_DEBUG_VISITOR	0
 
-namespace zillians { namespace visitor { namespace detail {
+namespace zillians { namespace visitor {
+
+/**
+ * The complete list of visitable types of a class hierarchy rooted at Base.
+ *
+ * It's not declared by default, in which case tags are assigned at run time and
+ * each visitor keeps a growable table. Declare it with ZILLIANS_VISITABLE_LIST
+ * to get compile-time tags and fixed-size tables instead.
+ */
+template<typename Base>
+struct visitable_list
+{
+	enum { declared = false };
+};
+
+namespace detail {
 
 template<typename Base>
 struct tag_counter
@@ -90,9 +118,12 @@ struct vtable {
 #endif
 	}
 
+	void finalize()
+	{ }
+
 	Function operator[] (size_t index) const
 	{
-		if(index > mTable.size())
+		if(index >= mTable.size())
 		{
 #if ENABLE_DEBUG_VISITOR
 			printf("getting index larger then mTable, index = %ld, mTable.size() = %ld\n", index, mTable.size());
@@ -109,6 +140,83 @@ struct vtable {
 };
 
 
+/**
+ * Tag of a visitable type in a hierarchy with a declared visitable_list, which
+ * is simply its position in the list, known at compile time.
+ */
+template<typename Visitable, typename Base>
+struct static_tag
+{
+	typedef typename visitable_list<typename boost::remove_const<Base>::type>::type list_type;
+	typedef typename boost::mpl::find<list_type, typename boost::remove_const<Visitable>::type>::type iterator;
+
+	BOOST_MPL_ASSERT_MSG((!boost::is_same<iterator, typename boost::mpl::end<list_type>::type>::value), VISITABLE_TYPE_IS_NOT_IN_VISITABLE_LIST, (Visitable));
+
+	static constexpr size_t value = iterator::pos::value;
+};
+
+/**
+ * Fixed-size dispatch table for hierarchies with a declared visitable_list.
+ *
+ * The table has exactly one slot per visitable type, so operator[] is a plain
+ * indexed load. Slots of types not registered by the visitor fall back to the
+ * function of Base, same as the growable vtable.
+ */
+template<typename Base, typename Function>
+struct static_vtable {
+	typedef typename visitable_list<typename boost::remove_const<Base>::type>::type list_type;
+	enum { size = boost::mpl::size<list_type>::value };
+
+	std::array<Function, size> mTable;
+
+	static_vtable()
+	{
+		mTable.fill(0);
+	}
+
+	template<typename Visitable>
+	void add(Function f)
+	{
+		mTable[static_tag<Visitable, Base>::value] = f;
+	}
+
+	void finalize()
+	{
+		Function default_function = mTable[static_tag<Base, Base>::value];
+		std::replace(mTable.begin(), mTable.end(), (Function)0, default_function);
+	}
+
+	Function operator[] (size_t index) const
+	{
+		BOOST_ASSERT(index < size);
+		return mTable[index];
+	}
+};
+
+template<typename Base, typename Function, bool Static = visitable_list<typename boost::remove_const<Base>::type>::declared>
+struct select_vtable
+{
+	typedef vtable<Base, Function> type;
+};
+
+template<typename Base, typename Function>
+struct select_vtable<Base, Function, true>
+{
+	typedef static_vtable<Base, Function> type;
+};
+
+template<typename Visitable, typename Base, bool Static = visitable_list<typename boost::remove_const<Base>::type>::declared>
+struct tag_of
+{
+	static inline size_t get() { return get_tag<Visitable, Base>(); }
+};
+
+template<typename Visitable, typename Base>
+struct tag_of<Visitable, Base, true>
+{
+	static constexpr size_t get() { return static_tag<Visitable, Base>::value; }
+};
+
 template<typename Visitable, typename Base>
 struct get_visit_method_argument_type {
 	typedef Visitable Type;
@@ -162,6 +270,7 @@ struct create_vtable
 	create_vtable()
 	{
 		vtable_append_helper<Visitor, VisitedList, Invoker>::add(vtable);
+		vtable.finalize();
 	}
 };
 
@@ -177,7 +286,91 @@ struct get_static_vtable {
 template< typename Visitor, typename VisitedList, typename Invoker>
 create_vtable<Visitor, VisitedList, Invoker> get_static_vtable<Visitor, VisitedList, Invoker>::s_table;
 
-} } // detail::visitor
+} // detail
+
+/**
+ * A list of nodes bucketed by their tag, for Visitor::visit_batch().
+ *
+ * assign() sorts the nodes by tag in one counting pass, the nodes of tag t end
+ * up contiguous in [begin(t), end(t)) and keep their relative order. Building
+ * a batch is the expensive part, since it calls the virtual _tag() of every
+ * node, so rebuild it only when the list changes. The buffers are kept between
+ * assign() calls, so rebuilding a list of similar size doesn't allocate.
+ *
+ * @code
+ * visitor::batch<const Node> entities;
+ * entities.assign(list.begin(), list.end());
+ * updater.visit_batch(entities);
+ * @endcode
+ */
+template<typename Base>
+class batch
+{
+public:
+	/**
+	 * Replace the content with the given range of pointers (raw or smart) to nodes.
+	 */
+	template<typename Iterator>
+	void assign(Iterator first, Iterator last)
+	{
+		mInput.clear();
+		mOffsets.clear();
+		for(; first != last; ++first)
+		{
+			Base* b = &**first;
+			std::size_t tag = b->_tag();
+			if(tag + 2 > mOffsets.size())
+				mOffsets.resize(tag + 2, 0);
+			++mOffsets[tag + 1];
+			mInput.push_back(std::make_pair(tag, b));
+		}
+
+		for(std::size_t tag = 1; tag < mOffsets.size(); ++tag)
+			mOffsets[tag] += mOffsets[tag - 1];
+
+		mCursors.assign(mOffsets.begin(), mOffsets.end());
+		mNodes.resize(mInput.size());
+		for(std::size_t i = 0; i < mInput.size(); ++i)
+			mNodes[mCursors[mInput[i].first]++] = mInput[i].second;
+	}
+
+	void clear()
+	{
+		mNodes.clear();
+		mOffsets.clear();
+	}
+
+	inline std::size_t size() const
+	{
+		return mNodes.size();
+	}
+
+	/**
+	 * Get the number of buckets, which is one past the largest tag in the batch.
+	 */
+	inline std::size_t bucket_count() const
+	{
+		return mOffsets.empty() ? 0 : mOffsets.size() - 1;
+	}
+
+	inline Base* const* begin(std::size_t tag) const
+	{
+		return mNodes.data() + mOffsets[tag];
+	}
+
+	inline Base* const* end(std::size_t tag) const
+	{
+		return mNodes.data() + mOffsets[tag + 1];
+	}
+
+private:
+	std::vector<std::pair<std::size_t, Base*> > mInput;	///< Scratch of assign(), the tag of each node in range order
+	std::vector<std::size_t> mCursors;					///< Scratch of assign()
+	std::vector<std::size_t> mOffsets;					///< Start of each bucket in mNodes, plus the end of the last one
+	std::vector<Base*> mNodes;
+};
+
+} // visitor
 
 template<typename Base>
 struct VisitableBase
@@ -187,7 +380,7 @@ struct VisitableBase
 	{
 		UNUSED_ARGUMENT(v);
 
-		std::size_t t = visitor::detail::get_tag<Visitable, Base>();
+		std::size_t t = visitor::detail::tag_of<Visitable, Base>::get();
 #if ENABLE_DEBUG_VISITOR
 		printf("tag for %s = %ld\n", typeid(v).name(), t);
 #endif
@@ -201,11 +394,33 @@ struct VisitableBase
 			return _get_tag_helper(this);	\
 		}
 
+/**
+ * Declare the complete list of visitable types of the hierarchy rooted at Base.
+ *
+ * Tags become the compile-time positions in the list and every visitor of the
+ * hierarchy dispatches through a fixed-size table, with no guard checks and no
+ * bounds check. The list must be declared in the global namespace before the
+ * definition of any of the classes (forward declarations are enough), and it
+ * must contain Base itself:
+ *
+ * @code
+ * class Node; class Leaf; class Branch;
+ * ZILLIANS_VISITABLE_LIST(Node, Node, Leaf, Branch)
+ *
+ * class Node : public VisitableBase<Node> { public: DEFINE_VISITABLE(); };
+ * @endcode
+ */
+#define ZILLIANS_VISITABLE_LIST(Base, ...) \
+	namespace zillians { namespace visitor { \
+	template<> struct visitable_list< Base > { enum { declared = true }; typedef boost::mpl::vector<__VA_ARGS__> type; }; \
+	} }
+
 enum class VisitorImplementation
 {
 	recursive_dfs,
-	iterative_dfs, // TODO implement this
-	iterative_bfs, // TODO implement this, the problem is how to handle the return type (simple ignore it
+	iterative_dfs, // explicit stack, children are visited in the order they are passed to visit()
+	iterative_bfs, // explicit queue, return type must be void
+	parallel_dfs, // recursive, children visited through visit_all() are spread over TBB tasks
 };
 
 template< typename Base, typename ReturnType, VisitorImplementation Impl = VisitorImplementation::recursive_dfs>
@@ -217,7 +432,7 @@ struct Visitor<Base, ReturnType, VisitorImplementation::recursive_dfs>
 	typedef Base BaseT;
 	typedef ReturnType ReturnT;
 	typedef ReturnType (Visitor::*FunctionT)(Base&);
-	typedef visitor::detail::vtable<const Base, FunctionT> VTableT;
+	typedef typename visitor::detail::select_vtable<const Base, FunctionT>::type VTableT;
 
 	template<typename VisitorImpl, typename Visitable, typename Invoker>
 	ReturnType _thunk(Base& b)
@@ -246,6 +461,74 @@ struct Visitor<Base, ReturnType, VisitorImplementation::recursive_dfs>
 		}
 	}
 
+	/**
+	 * Visit every node of the batch, grouped by type instead of in the original order.
+	 *
+	 * Each handler runs over its whole bucket back to back, so visiting a large
+	 * heterogeneous list doesn't jump between handlers at random on every node.
+	 * The return values of handlers are discarded.
+	 *
+	 * @see visitor::batch
+	 */
+	void visit_batch(const visitor::batch<Base>& nodes)
+	{
+		for(std::size_t tag = 0; tag < nodes.bucket_count() && !mTerminated; ++tag)
+		{
+			if(nodes.begin(tag) == nodes.end(tag))
+				continue;
+
+			FunctionT f = (*mVTable)[tag];
+			for(Base* const* i = nodes.begin(tag); i != nodes.end(tag) && !mTerminated; ++i)
+				(this->*f)(**i);
+		}
+	}
+
+	/**
+	 * Same as visit_batch(), but the nodes of each bucket are visited in parallel by TBB.
+	 *
+	 * Buckets are still visited one after another, so all threads run the same
+	 * handler at a time. Handlers must be safe to call concurrently on this
+	 * visitor, and terminate() only takes effect between buckets.
+	 *
+	 * @param grain The number of nodes below which a bucket is not split further.
+	 */
+	void visit_batch_parallel(const visitor::batch<Base>& nodes, std::size_t grain = 64)
+	{
+		for(std::size_t tag = 0; tag < nodes.bucket_count() && !mTerminated; ++tag)
+		{
+			if(nodes.begin(tag) == nodes.end(tag))
+				continue;
+
+			FunctionT f = (*mVTable)[tag];
+			Base* const* first = nodes.begin(tag);
+			tbb::parallel_for(tbb::blocked_range<std::size_t>(0, nodes.end(tag) - first, grain), [this, f, first](const tbb::blocked_range<std::size_t>& r) {
+				for(std::size_t i = r.begin(); i != r.end(); ++i)
+					(this->*f)(*first[i]);
+			});
+		}
+	}
+
+	/**
+	 * Bucket the range and visit it grouped by type, see visit_batch(const visitor::batch<Base>&).
+	 *
+	 * The bucketing pass still calls _tag() on every node in range order, so when
+	 * the same list is visited every tick, keep a visitor::batch and rebuild it
+	 * only when the list changes.
+	 */
+	template<typename Iterator>
+	void visit_batch(Iterator first, Iterator last)
+	{
+		mBatch.assign(first, last);
+		visit_batch(mBatch);
+	}
+
+	template<typename Iterator>
+	void visit_batch_parallel(Iterator first, Iterator last, std::size_t grain = 64)
+	{
+		mBatch.assign(first, last);
+		visit_batch_parallel(mBatch, grain);
+	}
+
 	inline void terminate()
 	{
 		mTerminated = true;
@@ -267,6 +550,9 @@ struct Visitor<Base, ReturnType, VisitorImplementation::recursive_dfs>
 	{
 		visitor.mVTable = visitor::detail::get_static_vtable<Visitor, VisitedList, Invoker>();
 	}
+
+private:
+	visitor::batch<Base> mBatch;
 };
 
 template< typename Base, typename ReturnType>
@@ -275,7 +561,7 @@ struct Visitor<Base, ReturnType, VisitorImplementation::iterative_bfs>
 	typedef Base BaseT;
 	typedef ReturnType ReturnT;
 	typedef ReturnType (Visitor::*FunctionT)(Base&);
-	typedef visitor::detail::vtable<const Base, FunctionT> VTableT;
+	typedef typename visitor::detail::select_vtable<const Base, FunctionT>::type VTableT;
 
 	Visitor() : mTerminated(false)
 	{
@@ -357,9 +643,9 @@ struct Visitor<Base, ReturnType, VisitorImplementation::iterative_dfs>
 	typedef Base BaseT;
 	typedef ReturnType ReturnT;
 	typedef ReturnType (Visitor::*FunctionT)(Base&);
-	typedef visitor::detail::vtable<const Base, FunctionT> VTableT;
+	typedef typename visitor::detail::select_vtable<const Base, FunctionT>::type VTableT;
 
-	Visitor() : mTerminated(false)
+	Visitor() : mTerminated(false), mRunning(false)
 	{
 		// all iterative visitor must have void return type
 		BOOST_MPL_ASSERT(( boost::is_same<ReturnType, void> ));
@@ -390,6 +676,8 @@ struct Visitor<Base, ReturnType, VisitorImplementation::iterative_dfs>
 	inline void reset()
 	{
 		mTerminated = false;
+		mRunning = false;
+		next.clear();
 	}
 
 	ReturnType visit(Base& b)
@@ -400,37 +688,34 @@ struct Visitor<Base, ReturnType, VisitorImplementation::iterative_dfs>
 			// but this is a bit risky if the object is destroyed during the visitor phase
 			// in most scenario, the visiting operation should be const (non-modifying)
 			// however if there's modification to the tree, all changes to the tree or all object destruction should be staged and processed later
-			if(next.size() == 0)
-			{
-				next.push(&b);
+			next.push_back(&b);
 
-				// run at the first insertion of visitable object
+			// run at the first insertion of visitable object, nested visits only push onto the explicit stack
+			if(!mRunning)
 				_run();
-			}
-			else
-			{
-				temp.push(&b);
-			}
 		}
 	}
 
 	void _run()
 	{
-		while(!next.empty())
+		mRunning = true;
+		while(!next.empty() && !mTerminated)
 		{
-			Base* b = next.top();
+			Base* b = next.back();
+			next.pop_back();
+
+			std::size_t mark = next.size();
 			FunctionT f = (*mVTable)[b->_tag()];
 #if ENABLE_DEBUG_VISITOR
-			printf("invoke iterative bfs visitor::%p\n", f);
+			printf("invoke iterative dfs visitor::%p\n", f);
 #endif
 			(this->*f)(*b);
-			next.pop();
-			while(!temp.empty())
-			{
-				next.push(temp.top());
-				temp.pop();
-			}
+
+			// children are pushed in visiting order, flip them so the first one is on top
+			std::reverse(next.begin() + mark, next.end());
 		}
+		next.clear();
+		mRunning = false;
 	}
 
 	// global helper function
@@ -441,12 +726,129 @@ struct Visitor<Base, ReturnType, VisitorImplementation::iterative_dfs>
 	}
 
 protected:
-	std::stack<Base*> next;
-	std::stack<Base*> temp;
+	std::vector<Base*> next;
+	bool mRunning;
+};
+
+/**
+ * Depth-first visitor which visits the children of wide nodes in parallel.
+ *
+ * Handlers visit their children with visit_all() instead of calling visit() on
+ * each of them. visit_all() splits the children into TBB tasks, down to the
+ * grain size given to the constructor, so a node with no more children than the
+ * grain size is visited serially on the current thread. Return values of the
+ * children are combined with the given reduction, which must be associative:
+ *
+ * @code
+ * class Counter : public Visitor<const Node, std::size_t, VisitorImplementation::parallel_dfs>
+ * {
+ *     ...
+ *     std::size_t count(const Branch& branch)
+ *     {
+ *         return 1 + visit_all(branch.children.begin(), branch.children.end(), std::size_t(0), std::plus<std::size_t>());
+ *     }
+ * };
+ * @endcode
+ *
+ * @note Handlers run concurrently on the same visitor object, so they must not
+ * modify visitor state without synchronization, prefer returning values instead.
+ */
+template< typename Base, typename ReturnType>
+struct Visitor<Base, ReturnType, VisitorImplementation::parallel_dfs>
+{
+	typedef Base BaseT;
+	typedef ReturnType ReturnT;
+	typedef ReturnType (Visitor::*FunctionT)(Base&);
+	typedef typename visitor::detail::select_vtable<const Base, FunctionT>::type VTableT;
+
+	template<typename VisitorImpl, typename Visitable, typename Invoker>
+	ReturnType _thunk(Base& b)
+	{
+		typedef typename visitor::detail::get_visit_method_argument_type<Visitable, Base>::Type VisitableType;
+		VisitorImpl& visitor = static_cast<VisitorImpl&>(*this);
+		VisitableType& visitable = static_cast<VisitableType&>(b);
+		return Invoker::invoke(visitor, visitable);
+	}
+
+	const VTableT* mVTable;
+	std::atomic<bool> mTerminated;
+	std::size_t mGrainSize;
+
+	/**
+	 * @param grain Ranges of at most this many children are not split into more tasks.
+	 */
+	explicit Visitor(std::size_t grain = 1) : mTerminated(false), mGrainSize(grain)
+	{ }
+
+	/**
+	 * Visit a single node on the current thread.
+	 *
+	 * @return The result of the handler, or a default constructed value if the visitor is terminated.
+	 */
+	ReturnType visit(Base& b)
+	{
+		if(mTerminated.load(std::memory_order_relaxed))
+			return ReturnType();
+
+		FunctionT f = (*mVTable)[b._tag()];
+		return (this->*f)(b);
+	}
+
+	/**
+	 * Visit all nodes of a random access range of pointers (raw or smart), in parallel if the range is larger than the grain size.
+	 */
+	template<typename Iterator>
+	void visit_all(Iterator first, Iterator last)
+	{
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, last - first, mGrainSize), [this, first](const tbb::blocked_range<std::size_t>& r) {
+			for(std::size_t i = r.begin(); i != r.end(); ++i)
+				this->visit(*first[i]);
+		});
+	}
+
+	/**
+	 * Visit all nodes of the range like visit_all(), and combine their results.
+	 *
+	 * @param identity The result for an empty range, it must not change the result when reduced with any value.
+	 * @param reduce The associative function combining two results.
+	 */
+	template<typename Iterator, typename T, typename Reduce>
+	T visit_all(Iterator first, Iterator last, const T& identity, Reduce reduce)
+	{
+		return tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, last - first, mGrainSize), identity,
+				[this, first, &reduce](const tbb::blocked_range<std::size_t>& r, T value) -> T {
+					for(std::size_t i = r.begin(); i != r.end(); ++i)
+						value = reduce(value, this->visit(*first[i]));
+					return value;
+				},
+				reduce);
+	}
+
+	inline void terminate()
+	{
+		mTerminated.store(true, std::memory_order_relaxed);
+	}
+
+	inline bool isTerminated()
+	{
+		return mTerminated.load(std::memory_order_relaxed);
+	}
+
+	inline void reset()
+	{
+		mTerminated.store(false, std::memory_order_relaxed);
+	}
+
+	// global helper function
+	template<typename Visitor, typename VisitedList, typename Invoker>
+	static void _register_visitable(Visitor& visitor, const VisitedList&, const Invoker&)
+	{
+		visitor.mVTable = visitor::detail::get_static_vtable<Visitor, VisitedList, Invoker>();
+	}
 };
 
 #define REGISTER_VISITABLE(invoker, ...)		\
-		_register_visitable(*this, boost::mpl::vector<__VA_ARGS__>(), invoker());
+		this->_register_visitable(*this, boost::mpl::vector<__VA_ARGS__>(), invoker());
 
 #define INDIRECT_REGISTER_VISITABLE(p, invoker, ...)		\
 		_register_visitable(*p, boost::mpl::vector<__VA_ARGS__>(), invoker());
@@ -0,0 +1,201 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * Based on "Correct and Efficient Work-Stealing for Weak Memory Models" by
+ * Nhat Minh Lê, Antoniu Pop, Albert Cohen and Francesco Zappa Nardelli.
+ */
+
+#ifndef ZILLIANS_WORKSTEALINGDEQUE_H_
+#define ZILLIANS_WORKSTEALINGDEQUE_H_
+
+#include "core/Common.h"
+#include "core/JustThread.h"
+#include <boost/assert.hpp>
+#include <atomic>
+#include <vector>
+
+#define ZILLIANS_WORK_STEALING_DEQUE_DEFAULT_CAPACITY	256
+
+namespace zillians {
+
+/**
+ * @brief WorkStealingDeque is the Chase-Lev deque of a single owner thread.
+ *
+ * The owner push() and pop() at the bottom without any CAS unless the deque
+ * is about to be empty, while any other thread may steal() from the top. The
+ * circular buffer grows on demand; old buffers are kept until the deque is
+ * destroyed since a thief may still be reading them.
+ *
+ * @note T is copied through std::atomic<T>, so it should be a pointer or a
+ * small trivially copyable type.
+ */
+template<typename T>
+class WorkStealingDeque
+{
+public:
+	WorkStealingDeque(std::size_t capacity = ZILLIANS_WORK_STEALING_DEQUE_DEFAULT_CAPACITY)
+	{
+		BOOST_ASSERT((capacity >= 2) && ((capacity & (capacity - 1)) == 0) && "the capacity must be greater than 2 and is power of 2");
+		top.store(0, std::memory_order_relaxed);
+		bottom.store(0, std::memory_order_relaxed);
+		array.store(new array_t(capacity), std::memory_order_relaxed);
+	}
+
+	~WorkStealingDeque()
+	{
+		delete array.load(std::memory_order_relaxed);
+		for(std::size_t i = 0; i < retired.size(); ++i)
+			delete retired[i];
+	}
+
+public:
+	/**
+	 * @brief Push an item at the bottom, may only be called by the owner.
+	 */
+	void push(T const& item)
+	{
+		int64 b = bottom.load(std::memory_order_relaxed);
+		int64 t = top.load(std::memory_order_acquire);
+		array_t* a = array.load(std::memory_order_relaxed);
+
+		if(UNLIKELY(b - t > (int64)a->mask))
+			a = grow(a, t, b);
+
+		a->put(b, item);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Pop the most recently pushed item, may only be called by the owner.
+	 *
+	 * @return False if the deque is empty (or the last item has been stolen).
+	 */
+	bool pop(T& item)
+	{
+		int64 b = bottom.load(std::memory_order_relaxed) - 1;
+		array_t* a = array.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64 t = top.load(std::memory_order_relaxed);
+
+		if(t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		item = a->get(b);
+		if(t == b)
+		{
+			// the last item, race against thieves for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Take the oldest item from the top, may be called by any thread.
+	 *
+	 * @return False if the deque is empty or another thread won the item.
+	 */
+	bool steal(T& item)
+	{
+		int64 t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64 b = bottom.load(std::memory_order_acquire);
+
+		if(t >= b)
+			return false;
+
+		array_t* a = array.load(std::memory_order_acquire);
+		item = a->get(t);
+		return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Get the approximate number of items.
+	 */
+	std::size_t size() const
+	{
+		int64 b = bottom.load(std::memory_order_relaxed);
+		int64 t = top.load(std::memory_order_relaxed);
+		return (b > t) ? (std::size_t)(b - t) : 0;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+private:
+	struct array_t
+	{
+		explicit array_t(std::size_t capacity) : slots(new std::atomic<T>[capacity]), mask(capacity - 1)
+		{ }
+
+		~array_t()
+		{
+			delete [] slots;
+		}
+
+		inline T get(int64 i) const
+		{
+			return slots[i & mask].load(std::memory_order_relaxed);
+		}
+
+		inline void put(int64 i, T const& item)
+		{
+			slots[i & mask].store(item, std::memory_order_relaxed);
+		}
+
+		std::atomic<T>* slots;
+		std::size_t mask;
+	};
+
+	array_t* grow(array_t* a, int64 t, int64 b)
+	{
+		array_t* bigger = new array_t((a->mask + 1) * 2);
+		for(int64 i = t; i < b; ++i)
+			bigger->put(i, a->get(i));
+
+		retired.push_back(a);
+		array.store(bigger, std::memory_order_release);
+		return bigger;
+	}
+
+private:
+	typedef char cacheline_pad_t [64];
+
+	cacheline_pad_t pad0;
+	std::atomic<int64> top;
+	cacheline_pad_t pad1;
+	std::atomic<int64> bottom;
+	std::atomic<array_t*> array;
+	std::vector<array_t*> retired;
+
+private:
+	WorkStealingDeque(WorkStealingDeque const&);
+	void operator= (WorkStealingDeque const&);
+};
+
+}
+
+#endif/*ZILLIANS_WORKSTEALINGDEQUE_H_*/
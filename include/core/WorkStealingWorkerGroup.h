@@ -0,0 +1,269 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_WORKSTEALINGWORKERGROUP_H_
+#define ZILLIANS_WORKSTEALINGWORKERGROUP_H_
+
+#include "core/Worker.h"
+#include "core/EventCount.h"
+#include "core/WorkStealingDeque.h"
+#include <tbb/concurrent_queue.h>
+#include <boost/thread/tss.hpp>
+
+namespace zillians {
+
+/**
+ * @brief WorkStealingWorkerGroup schedules handlers over workers that steal from each other.
+ *
+ * Unlike WorkerGroup, handlers are not bound to a worker when they are posted.
+ * Handlers posted from outside go to a shared queue, and handlers posted from
+ * a worker thread go to the bottom of that worker's WorkStealingDeque. An idle
+ * worker takes from its own deque first, then the shared queue, and then
+ * steals the oldest handler of a sibling, so one slow handler never holds up
+ * the ones queued behind it.
+ */
+class WorkStealingWorkerGroup
+{
+public:
+	/**
+	 * @param placement The placement of the workers, the index-th worker
+	 * thread is placed by placement.at(index).
+	 */
+	explicit WorkStealingWorkerGroup(std::size_t workers = 4, const ThreadPlacement& placement = ThreadPlacement()) : mPlacement(placement)
+	{
+		mTerminated = false;
+
+		// all deques must exist before any worker starts stealing
+		mWorkerSize = workers;
+		mDeques = new WorkStealingDeque<Task*>*[workers];
+		for(std::size_t i=0;i<workers;++i)
+		{
+			mDeques[i] = new WorkStealingDeque<Task*>();
+		}
+
+		for(std::size_t i=0;i<workers;++i)
+		{
+			boost::thread *t = new boost::thread(boost::bind(&WorkStealingWorkerGroup::run, this, i));
+			mWorkerThreads.push_back(t);
+		}
+	}
+
+	virtual ~WorkStealingWorkerGroup()
+	{
+		stop();
+
+		for(std::size_t i=0;i<mWorkerSize;++i)
+		{
+			SAFE_DELETE(mDeques[i]);
+		}
+		SAFE_DELETE_ARRAY(mDeques);
+	}
+
+public:
+	/**
+	 * @brief Request the group to invoke the given handler.
+	 *
+	 * If called from one of the group's worker threads, the handler is executed
+	 * inside this method, otherwise it's the same as post().
+	 */
+	template<typename CompletionHandler>
+	inline void dispatch(CompletionHandler handler, bool blocking = false)
+	{
+		if(mCurrentIndex.get())
+		{
+			handler();
+		}
+		else
+		{
+			post(handler, blocking);
+		}
+	}
+
+	/**
+	 * @brief Post the given handler to the group and return.
+	 *
+	 * @param handler The handler to be called. The function signature of the
+	 * handler must be: @code void handler(); @endcode
+	 *
+	 * @param blocking True to wait for the completion of the handler.
+	 */
+	template<typename CompletionHandler>
+	inline void post(CompletionHandler handler, bool blocking = false)
+	{
+		if(blocking)
+		{
+			boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+			enqueue(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+			completion->wait();
+		}
+		else
+		{
+			enqueue(handler);
+		}
+	}
+
+	template<typename CompletionHandler>
+	inline WorkerFuture async(CompletionHandler handler)
+	{
+		boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+		enqueue(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+		return WorkerFuture(completion);
+	}
+
+	inline void wait(const WorkerFuture& key)
+	{
+		key.wait();
+	}
+
+	bool timed_wait(const WorkerFuture& key, const boost::system_time& absolute)
+	{
+		return key.timed_wait(absolute);
+	}
+
+	template<typename DurationType>
+	bool timed_wait(const WorkerFuture& key, const DurationType& relative)
+	{
+		return key.timed_wait(relative);
+	}
+
+	void cancel(const WorkerFuture& key)
+	{
+		key.cancel();
+	}
+
+	/**
+	 * @brief Stop all workers once every pending handler has been executed.
+	 */
+	void stop()
+	{
+		if(!mTerminated.exchange(true))
+		{
+			mIdle.notify_all();
+
+			for(std::vector<boost::thread*>::iterator i = mWorkerThreads.begin(); i != mWorkerThreads.end(); ++i)
+			{
+				if((*i)->joinable())
+				{
+					(*i)->join();
+				}
+				delete (*i);
+			}
+			mWorkerThreads.clear();
+		}
+	}
+
+protected:
+	struct Task
+	{
+		explicit Task(const boost::function<void()>& h) : handler(h)
+		{ }
+
+		boost::function<void()> handler;
+	};
+
+	void enqueue(const boost::function<void()>& handler)
+	{
+		Task* task = new Task(handler);
+
+		std::size_t* index = mCurrentIndex.get();
+		if(index)
+			mDeques[*index]->push(task);
+		else
+			mSharedQueue.push(task);
+
+		mIdle.notify_one();
+	}
+
+	Task* next(std::size_t index)
+	{
+		Task* task = NULL;
+
+		if(mDeques[index]->pop(task))
+			return task;
+
+		if(mSharedQueue.try_pop(task))
+			return task;
+
+		for(std::size_t i=1;i<mWorkerSize;++i)
+		{
+			if(mDeques[(index + i) % mWorkerSize]->steal(task))
+				return task;
+		}
+
+		return NULL;
+	}
+
+	/**
+	 * @brief The internal thread run procedure of the index-th worker.
+	 */
+	void run(std::size_t index)
+	{
+		mCurrentIndex.reset(new std::size_t(index));
+		if(!mPlacement.empty())
+			mPlacement.at(index).apply();
+
+		while(true)
+		{
+			Task* task = next(index);
+			if(!task)
+			{
+				mIdle.prepare_wait();
+				task = next(index);
+				if(task)
+				{
+					mIdle.retire_wait();
+				}
+				else if(mTerminated)
+				{
+					mIdle.retire_wait();
+					break;
+				}
+				else
+				{
+					mIdle.wait();
+					continue;
+				}
+			}
+
+			try
+			{
+				task->handler();
+			}
+			catch(std::exception& e)
+			{
+				printf("exception e: %s\n", e.what());
+			}
+			delete task;
+		}
+	}
+
+protected:
+	std::size_t mWorkerSize;
+	WorkStealingDeque<Task*>** mDeques;
+	tbb::concurrent_queue<Task*> mSharedQueue;
+	EventCount mIdle;
+	std::atomic<bool> mTerminated;
+	boost::thread_specific_ptr<std::size_t> mCurrentIndex;
+	ThreadPlacement mPlacement;
+	std::vector<boost::thread*> mWorkerThreads;
+};
+
+}
+
+#endif/*ZILLIANS_WORKSTEALINGWORKERGROUP_H_*/
@@ -24,86 +24,451 @@
 #define ZILLIANS_WORKER_H_
 
 #include "core/Prerequisite.h"
-#include "core/ConditionVariable.h"
+#include "core/ObjectPool.h"
+#include "core/Metrics.h"
+#include "core/Futex.h"
 #include "core/Singleton.h"
-#include <tbb/concurrent_queue.h>
+#include "core/ThreadPlacement.h"
+#include "core/SmallFunction.h"
+#include "threading/AdaptiveWait.h"
+#include "threading/TimingWheel.h"
+#include <tbb/atomic.h>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/asio.hpp>
+#ifdef ZILLIANS_HAS_COROUTINES
+#include <coroutine>
+#endif
 
 /**
- * @brief The maximum concurrent blocking calls to a single worker instance.
+ * @brief The number of yielding spins before a synchronous call starts to back off.
  *
- * Since the worker relies on asynchronous completion reactor (i.e. the
- * boost::asio::io_service), all calls are executed in the internal thread
- * context. The blocking (synchronous) dispatch uses a condition variable
- * to wait for completion acknowledgment sent by the internal thread.
+ * Synchronous calls into a worker are usually short, so the caller spins on
+ * the completion for a while before sleeping, and sleeps (with increasing
+ * intervals up to ZILLIANS_WORKER_COMPLETION_MAX_BACKOFF microseconds) before
+ * finally parking on a futex.
  */
-#define ZILLIANS_WORKER_DEFAULT_MAXIMUM_CONCURRENT_CALLS 1024
+#define ZILLIANS_WORKER_COMPLETION_SPIN_COUNT	256
+#define ZILLIANS_WORKER_COMPLETION_MAX_BACKOFF	64
+
+/**
+ * @brief The most handlers staged for a worker before they are posted anyway.
+ *
+ * Handlers posted from a handler running on a worker are staged and posted as
+ * a single batch once the handler returns (see WorkerStaging). A handler
+ * posting more than that sends a batch every ZILLIANS_WORKER_STAGING_LIMIT
+ * handlers, so the first ones don't wait for the whole loop.
+ */
+#define ZILLIANS_WORKER_STAGING_LIMIT	64
+
+/**
+ * @brief The number of different workers a thread stages handlers for at the same time.
+ */
+#define ZILLIANS_WORKER_STAGING_TARGETS	4
+
+#if defined(_MSC_VER)
+	#define ZILLIANS_WORKER_TLS __declspec(thread)
+#else
+	#define ZILLIANS_WORKER_TLS __thread
+#endif
 
 namespace zillians {
 
 /**
- * @brief Worker mimics boost::asio::io_service to serve as a task dispatcher.
+ * @brief WorkerCompletion is the state shared by a call into a worker and its caller.
  *
- * Worker is a generalized and simplified version of boost::asio::io_service,
- * providing an internal worker thread to execute specific functions.
+ * Completions are reference counted through boost::intrusive_ptr and recycled
+ * by ConcurrentObjectPool, so a call costs no heap allocation in steady state
+ * and there is no upper bound on concurrent calls.
  */
-class Worker
+class WorkerCompletion : public ConcurrentObjectPool<WorkerCompletion>
 {
-	friend class WorkerGroup;
-	Worker(zillians::ConditionVariable<uint32>** conditions, tbb::concurrent_bounded_queue<uint32>* slots, volatile bool* flags) :
-		mTerminated(false),
-		mConditionTableOwner(false),
-		mThread(boost::bind(&Worker::run, this))
+	typedef threading::AdaptiveWait<ZILLIANS_WORKER_COMPLETION_SPIN_COUNT, 1, 1, ZILLIANS_WORKER_COMPLETION_MAX_BACKOFF, 16, 16> backoff_t;
+
+	/**
+	 * The state is kept in the low bits, and PARKED is set once a waiter may sleep on
+	 * the state word, so the waker only enters the kernel if someone is parked.
+	 */
+	enum { PENDING, RUNNING, DONE, CANCELLED, STATE_MASK = 3, PARKED = 4 };
+
+public:
+	WorkerCompletion()
 	{
-		mConditionSlots = slots;
-		mConditions = conditions;
-		mCancellationFlags = flags;
+		mState.store(PENDING, std::memory_order_relaxed);
+		mRefCount = 0;
+#ifdef ZILLIANS_ENABLE_METRICS
+		mPosted = TimerUtil::now_ns();
+#endif
 	}
 
 public:
 	/**
-	 * @brief Construct a worker object.
+	 * @brief Called by the worker before invoking the handler.
+	 *
+	 * @return False if the call has been cancelled and the handler must be skipped.
 	 */
-	Worker(std::size_t maxConcurrentCalls = ZILLIANS_WORKER_DEFAULT_MAXIMUM_CONCURRENT_CALLS) :
-		mTerminated(false),
-		mConditionTableOwner(true),
-		mConditionTableSize(maxConcurrentCalls),
-		mThread(boost::bind(&Worker::run, this))
+	bool start()
+	{
+		uint32 state = mState.load(std::memory_order_relaxed);
+		do
+		{
+			if((state & STATE_MASK) != PENDING)
+				return false;
+		} while(!mState.compare_exchange_weak(state, (state & PARKED) | RUNNING, std::memory_order_acquire, std::memory_order_relaxed));
+		return true;
+	}
+
+	/**
+	 * @brief Called by the worker after invoking the handler to release the waiters.
+	 */
+	void complete()
 	{
-		mConditionSlots = new tbb::concurrent_bounded_queue<uint32>();
-		mConditions = new zillians::ConditionVariable<uint32>*[mConditionTableSize];
-		mCancellationFlags = new bool[mConditionTableSize];
+		wakeup(mState.exchange(DONE, std::memory_order_release));
+	}
 
-		for(uint32 i=0;i<mConditionTableSize;++i)
+	/**
+	 * @brief Prevent the handler from being invoked if it hasn't started yet.
+	 *
+	 * @return True if the handler will never be invoked.
+	 */
+	bool cancel()
+	{
+		uint32 state = mState.load(std::memory_order_relaxed);
+		do
 		{
-			mConditionSlots->push(i);
-			mConditions[i] = new zillians::ConditionVariable<uint32>();
-			mCancellationFlags[i] = false;
-		}
+			if((state & STATE_MASK) != PENDING)
+				return (state & STATE_MASK) == CANCELLED;
+		} while(!mState.compare_exchange_weak(state, CANCELLED, std::memory_order_release, std::memory_order_relaxed));
+
+		wakeup(state);
+		return true;
 	}
 
 	/**
-	 * @brief Destroy a worker object.
+	 * @brief Whether the handler has completed or has been cancelled.
 	 */
-	virtual ~Worker()
+	bool is_ready() const
 	{
-		stop();
+		return ready(mState.load(std::memory_order_acquire));
+	}
+
+	void wait()
+	{
+		await(NULL);
+	}
 
-		if(mConditionTableOwner)
+	/**
+	 * @return False if the absolute time is reached before the call is ready.
+	 */
+	bool timed_wait(const boost::system_time& absolute)
+	{
+		return await(&absolute);
+	}
+
+#ifdef ZILLIANS_ENABLE_METRICS
+	/**
+	 * @brief The time of TimerUtil::now_ns() when the call was created.
+	 */
+	uint64 posted() const
+	{
+		return mPosted;
+	}
+#endif
+
+private:
+	bool await(const boost::system_time* absolute)
+	{
+		backoff_t backoff;
+		while(!is_ready())
 		{
-			for(uint32 i=0;i<mConditionTableSize;++i)
+			if(!backoff.is_waiting())
+			{
+				boost::this_thread::yield();
+			}
+			else if(backoff.time_to_wait() < ZILLIANS_WORKER_COMPLETION_MAX_BACKOFF)
 			{
-				SAFE_DELETE(mConditions[i]);
+				if(absolute && boost::get_system_time() >= *absolute)
+					return false;
+				backoff.wait();
 			}
-			SAFE_DELETE_ARRAY(mCancellationFlags);
-			SAFE_DELETE_ARRAY(mConditions);
-			SAFE_DELETE(mConditionSlots);
+			else
+			{
+				return park(absolute);
+			}
+			backoff.slowdown();
+		}
+		return true;
+	}
+
+	bool park(const boost::system_time* absolute)
+	{
+		// either complete() and cancel() see the PARKED bit, or we see the final state
+		uint32 state = mState.fetch_or(PARKED, std::memory_order_acquire) | PARKED;
+		while(!ready(state))
+		{
+			if(!futex::wait(mState, state, absolute))
+				return is_ready();
+			state = mState.load(std::memory_order_acquire);
+		}
+		return true;
+	}
+
+	void wakeup(uint32 previous)
+	{
+		if(previous & PARKED)
+			futex::wake_all(mState);
+	}
+
+	static inline bool ready(uint32 state)
+	{
+		state &= STATE_MASK;
+		return state == DONE || state == CANCELLED;
+	}
+
+	friend inline void intrusive_ptr_add_ref(WorkerCompletion* p)
+	{
+		++p->mRefCount;
+	}
+
+	friend inline void intrusive_ptr_release(WorkerCompletion* p)
+	{
+		if(--p->mRefCount == 0)
+			delete p;
+	}
+
+private:
+	std::atomic<uint32> mState;
+	tbb::atomic<long> mRefCount;
+#ifdef ZILLIANS_ENABLE_METRICS
+	uint64 mPosted;
+#endif
+};
+
+/**
+ * @brief WorkerFuture refers to an asynchronous call into a worker.
+ *
+ * It's returned by async() and can be waited or cancelled by any thread. An
+ * empty future (default constructed) must not be waited.
+ */
+class WorkerFuture
+{
+public:
+	WorkerFuture()
+	{ }
+
+	explicit WorkerFuture(const boost::intrusive_ptr<WorkerCompletion>& completion) : mCompletion(completion)
+	{ }
+
+public:
+	bool valid() const
+	{
+		return !!mCompletion;
+	}
+
+	bool is_ready() const
+	{
+		return mCompletion->is_ready();
+	}
+
+	void wait() const
+	{
+		mCompletion->wait();
+	}
+
+	bool timed_wait(const boost::system_time& absolute) const
+	{
+		return mCompletion->timed_wait(absolute);
+	}
+
+	template<typename DurationType>
+	bool timed_wait(const DurationType& relative) const
+	{
+		return mCompletion->timed_wait(boost::get_system_time() + relative);
+	}
+
+	bool cancel() const
+	{
+		return mCompletion->cancel();
+	}
+
+private:
+	boost::intrusive_ptr<WorkerCompletion> mCompletion;
+};
+
+/**
+ * @brief WorkerBatch is a list of handlers run in sequence by a single io_service operation.
+ *
+ * Like WorkerCompletion, batches are reference counted through
+ * boost::intrusive_ptr and recycled by ConcurrentObjectPool.
+ */
+class WorkerBatch : public ConcurrentObjectPool<WorkerBatch>
+{
+public:
+	typedef SmallFunction<void()> Handler;
+
+	WorkerBatch() : mNext(0)
+	{
+		mRefCount = 0;
+	}
+
+public:
+	template<typename H>
+	void push(const H& handler)
+	{
+		mHandlers.push_back(Handler(handler));
+	}
+
+	/**
+	 * @brief The number of handlers not run yet.
+	 */
+	std::size_t size() const
+	{
+		return mHandlers.size() - mNext;
+	}
+
+	bool empty() const
+	{
+		return mNext == mHandlers.size();
+	}
+
+	/**
+	 * @brief Run the handlers in order.
+	 *
+	 * If a handler throws, the exception is propagated and the handlers after
+	 * it are left for the next call.
+	 */
+	void run()
+	{
+		while(mNext < mHandlers.size())
+		{
+			Handler& handler = mHandlers[mNext++];
+			handler();
+			handler = Handler();
 		}
 	}
 
+private:
+	friend inline void intrusive_ptr_add_ref(WorkerBatch* p)
+	{
+		++p->mRefCount;
+	}
+
+	friend inline void intrusive_ptr_release(WorkerBatch* p)
+	{
+		if(--p->mRefCount == 0)
+			delete p;
+	}
+
+private:
+	std::vector<Handler> mHandlers;
+	std::size_t mNext;
+	tbb::atomic<long> mRefCount;
+};
+
+class Worker;
+
+/**
+ * @brief WorkerStaging collects the handlers posted by a handler running on a worker thread.
+ *
+ * Worker::run() installs one on every thread running a worker, and flushes it
+ * after each handler, so all the handlers a handler posts to the same worker
+ * reach the io_service as one WorkerBatch: one queue lock and at most one
+ * wake-up instead of one for each handler. This is the same idea as the
+ * incomplete writes of Dispatcher.
+ *
+ * Handlers posted by other threads are not staged.
+ */
+class WorkerStaging : public boost::noncopyable
+{
+public:
+	/**
+	 * @param owner The worker run by the thread, if any.
+	 */
+	explicit WorkerStaging(Worker* owner = NULL) : mOwner(owner), mCount(0), mPrevious(current())
+	{
+		current() = this;
+	}
+
+	~WorkerStaging()
+	{
+		flush();
+		current() = mPrevious;
+	}
+
+public:
+	/**
+	 * @brief Get the staging of the calling thread, NULL if it's not running a worker.
+	 */
+	static WorkerStaging*& current()
+	{
+		static ZILLIANS_WORKER_TLS WorkerStaging* instance = NULL;
+		return instance;
+	}
+
+	Worker* getOwner() const
+	{
+		return mOwner;
+	}
+
+	template<typename CompletionHandler>
+	void stage(Worker& worker, const CompletionHandler& handler);
+
+	/**
+	 * @brief Post the handlers staged for the given worker.
+	 */
+	void flush(Worker& worker);
+
+	/**
+	 * @brief Post all staged handlers.
+	 */
+	void flush();
+
+private:
+	struct Entry
+	{
+		Worker* worker;
+		boost::intrusive_ptr<WorkerBatch> batch;
+	};
+
+	Worker* mOwner;
+	Entry mEntries[ZILLIANS_WORKER_STAGING_TARGETS];
+	std::size_t mCount;
+	WorkerStaging* mPrevious;
+};
+
+/**
+ * @brief Worker mimics boost::asio::io_service to serve as a task dispatcher.
+ *
+ * Worker is a generalized and simplified version of boost::asio::io_service,
+ * providing an internal worker thread to execute specific functions.
+ */
+class Worker
+{
+	friend class WorkerStaging;
+public:
+	/**
+	 * @brief Construct a worker object.
+	 *
+	 * @param placement The placement applied to every thread running the
+	 * worker, including the internal one, before it runs any handler.
+	 */
+	explicit Worker(const ThreadPlacement& placement = ThreadPlacement()) :
+		mTerminated(false),
+		mPlacement(placement),
+		mTimingWheel(mIoService),
+		mThread(boost::bind(&Worker::run, this))
+	{ }
+
+	/**
+	 * @brief Destroy a worker object.
+	 */
+	virtual ~Worker()
+	{
+		stop();
+	}
+
 public:
 	/**
 	 * @brief Request the worker to invoke the given handler.
@@ -124,14 +489,12 @@ public:
 	template<typename CompletionHandler>//NOTE 20100728 Nothing - Tha name "CompletionHandler" sounds like it's a handler to be called after completion of the dispatched job, strange.
 	inline void dispatch(CompletionHandler handler, bool blocking = false)
 	{
+		flush();
 		if(blocking)
 		{
-			void (Worker::*f)(uint32 /*key*/, boost::tuple<CompletionHandler> /*handler*/) = &Worker::wrap<CompletionHandler>;
-
-			uint32 key = 0; mConditionSlots->pop(key);
-			mCancellationFlags[key] = false;
-			mIoService.dispatch(boost::bind(f, this, key, boost::make_tuple(handler)));
-			uint32 dummy = 0; mConditions[key]->wait(dummy);
+			boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+			mIoService.dispatch(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+			completion->wait();
 		}
 		else
 		{
@@ -140,39 +503,33 @@ public:
 	}
 
 	template<typename CompletionHandler>
-	inline int async(CompletionHandler handler)
+	inline WorkerFuture async(CompletionHandler handler)
 	{
-		void (Worker::*f)(uint32 /*key*/, boost::tuple<CompletionHandler> /*handler*/) = &Worker::wrap<CompletionHandler>;
-
-		uint32 key = 0; mConditionSlots->pop(key);
-		mCancellationFlags[key] = false;
-		mConditions[key]->reset();
-		mIoService.post(boost::bind(f, this, key, boost::make_tuple(handler)));
-		return key;
+		flush();
+		boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+		mIoService.post(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+		return WorkerFuture(completion);
 	}
 
-	inline void wait(int key)
+	inline void wait(const WorkerFuture& key)
 	{
-		uint32 dummy = 0;
-		mConditions[key]->wait(dummy);
+		key.wait();
 	}
 
-	bool timed_wait(int key, const boost::system_time& absolute)
+	bool timed_wait(const WorkerFuture& key, const boost::system_time& absolute)
 	{
-		uint32 dummy = 0;
-		return mConditions[key]->timed_wait(dummy, absolute);
+		return key.timed_wait(absolute);
 	}
 
     template<typename DurationType>
-    bool timed_wait(int key, const DurationType& relative)
+    bool timed_wait(const WorkerFuture& key, const DurationType& relative)
     {
-    	uint32 dummy = 0;
-    	return mConditions[key]->timed_wait(dummy, relative);
+    	return key.timed_wait(relative);
     }
 
-    void cancel(int key)
+    void cancel(const WorkerFuture& key)
     {
-    	mCancellationFlags[key] = true;
+    	key.cancel();
     }
 
 	/**
@@ -182,6 +539,11 @@ public:
 	 * and returns immediately. The handler will not be executed inside
 	 * this method.
 	 *
+	 * Called from a handler running on a worker, an asynchronous post is
+	 * staged and goes to the job queue along with the other handlers posted
+	 * to the same worker once the current handler returns (see WorkerStaging).
+	 * Call flush() to post them earlier.
+	 *
 	 * @param handler The handler to be called. The worker will a copy of
 	 * the handler object as required. The function signature of the handler
 	 * must be: @code void handler(); @endcode
@@ -191,12 +553,14 @@ public:
 	{
 		if(blocking)
 		{
-			void (Worker::*f)(uint32 /*key*/, boost::tuple<CompletionHandler> /*handler*/) = &Worker::wrap<CompletionHandler>;
-
-			uint32 key = 0; mConditionSlots->pop(key);
-			mCancellationFlags[key] = false;
-			mIoService.post(boost::bind(f, this, key, boost::make_tuple(handler)));
-			uint32 dummy = 0; mConditions[key]->wait(dummy);
+			flush();
+			boost::intrusive_ptr<WorkerCompletion> completion(new WorkerCompletion());
+			mIoService.post(boost::bind(&Worker::wrap<CompletionHandler>, completion, boost::make_tuple(handler)));
+			completion->wait();
+		}
+		else if(WorkerStaging* staging = WorkerStaging::current())
+		{
+			staging->stage(*this, handler);
 		}
 		else
 		{
@@ -204,23 +568,64 @@ public:
 		}
 	}
 
+	/**
+	 * @brief Post all the given handlers as a single job to run them in sequence.
+	 *
+	 * The handlers run in order on the same thread, taking one slot in the job
+	 * queue and at most one wake-up of the worker. If a handler throws, the
+	 * exception is reported and the rest of them still run in order.
+	 *
+	 * @param begin The first handler, the signature of the handlers must be:
+	 * @code void handler(); @endcode
+	 * @param end The end of the handlers.
+	 */
+	template<typename Iterator>
+	inline void post_batch(Iterator begin, Iterator end)
+	{
+		if(begin == end)
+			return;
+
+		flush();
+		boost::intrusive_ptr<WorkerBatch> batch(new WorkerBatch());
+		for(; begin != end; ++begin)
+			batch->push(*begin);
+		postBatch(batch);
+	}
+
+	/**
+	 * @brief Post the handlers the calling thread has staged for this worker now.
+	 */
+	inline void flush()
+	{
+		if(WorkerStaging* staging = WorkerStaging::current())
+			staging->flush(*this);
+	}
+
 public:
 	/**
 	 * @brief The internal thread run procedure.
 	 */
 	void run()
 	{
+		if(!mPlacement.empty())
+			mPlacement.apply();
+
 		// create a dummy work to avoid running out of job until stop() is explicitly called
 		boost::asio::io_service::work w(mIoService);
+
+		// run one handler at a time to post what it has staged right after it
+		WorkerStaging staging(this);
 		while(!mTerminated)
 		{
 			try
 			{
-				mIoService.run();
+				while(mIoService.run_one())
+					staging.flush();
 				break;
 			}
 			catch(std::exception& e)
 			{
+				staging.flush();
 				printf("exception e: %s\n", e.what());
 			}
 		}
@@ -238,46 +643,217 @@ public:
 	}
 
 public:
+	/**
+	 * @brief Get the worker the calling thread is running, NULL if none.
+	 */
+	static Worker* current()
+	{
+		WorkerStaging* staging = WorkerStaging::current();
+		return staging ? staging->getOwner() : NULL;
+	}
+
 	boost::asio::io_service& getIoService()
 	{ return mIoService; }
 
-protected:
 	/**
-	 * @brief Wrap the given handler with synchronous acknowledgment.
+	 * @brief Get the timing wheel ticking on the worker.
 	 *
-	 * @param key The acknowledgment key, which is basically the
-	 * index of used condition variable.
+	 * Prefer it to one deadline_timer per timeout when there are many of them,
+	 * like per-session timeouts. It must only be used from handlers running on
+	 * the worker.
+	 */
+	threading::TimingWheel& getTimingWheel()
+	{ return mTimingWheel; }
+
+#ifdef ZILLIANS_HAS_COROUTINES
+	/**
+	 * @brief Resumes the awaiting coroutine on the worker, see schedule().
+	 */
+	class ScheduleAwaiter
+	{
+	public:
+		explicit ScheduleAwaiter(Worker& worker) : mWorker(worker)
+		{ }
+
+		bool await_ready() const noexcept
+		{
+			return current() == &mWorker;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			mWorker.post(Resume(handle));
+		}
+
+		void await_resume() const noexcept
+		{ }
+
+	private:
+		struct Resume
+		{
+			explicit Resume(std::coroutine_handle<> h) : handle(h)
+			{ }
+
+			void operator() () const
+			{
+				handle.resume();
+			}
+
+			std::coroutine_handle<> handle;
+		};
+
+		Worker& mWorker;
+	};
+
+	/**
+	 * @brief Hop the awaiting coroutine onto the worker.
+	 *
+	 * The coroutine goes on running in a handler posted to the worker, unless
+	 * it's already running on the worker.
+	 *
+	 * @code
+	 * co_await worker.schedule();
+	 * // running on worker from here on
+	 * @endcode
+	 */
+	ScheduleAwaiter schedule()
+	{
+		return ScheduleAwaiter(*this);
+	}
+#endif
+
+public:
+	/**
+	 * @brief Wrap the given handler with completion acknowledgment.
+	 *
+	 * @param completion The completion to be signaled after the handler
+	 * returns (or throws), the handler is skipped if it's cancelled.
 	 *
 	 * @param handler The handler to be called. he worker will a copy of
 	 * the handler object as required. The function signature of the handler
 	 * must be: @code void handler(); @endcode
 	 */
 	template<typename CompletionHandler>
-	inline void wrap(uint32 key, boost::tuple<CompletionHandler> handler)
+	static void wrap(boost::intrusive_ptr<WorkerCompletion> completion, boost::tuple<CompletionHandler> handler)
 	{
-		if(!mCancellationFlags[key])
+		if(completion->start())
 		{
-			boost::get<0>(handler)();
-			mConditions[key]->signal(0);
-			mConditionSlots->push(key);
+#ifdef ZILLIANS_ENABLE_METRICS
+			BuiltinMetrics::worker_queue_delay().record(TimerUtil::now_ns() - completion->posted());
+			ScopedTimer timer(BuiltinMetrics::worker_run_time());
+#endif
+			try
+			{
+				boost::get<0>(handler)();
+			}
+			catch(...)
+			{
+				flushStaged();
+				completion->complete();
+				throw;
+			}
+
+			// whatever the handler posted goes out before the caller is released
+			flushStaged();
+			completion->complete();
 		}
-		else
+	}
+
+protected:
+	static void flushStaged()
+	{
+		if(WorkerStaging* staging = WorkerStaging::current())
+			staging->flush();
+	}
+
+	void postBatch(const boost::intrusive_ptr<WorkerBatch>& batch)
+	{
+		mIoService.post(boost::bind(&Worker::runBatch, this, batch));
+	}
+
+	void runBatch(const boost::intrusive_ptr<WorkerBatch>& batch)
+	{
+		// a throwing handler is reported like in run() and the rest of the batch
+		// carries on in place, so nothing posted after the batch can overtake it
+		while(!batch->empty())
 		{
-			mCancellationFlags[key] = false;
+			try
+			{
+				batch->run();
+			}
+			catch(std::exception& e)
+			{
+				flushStaged();
+				printf("exception e: %s\n", e.what());
+			}
 		}
 	}
 
 protected:
 	boost::asio::io_service mIoService;
 	bool mTerminated;
-	bool mConditionTableOwner;
-	uint32 mConditionTableSize;
+	ThreadPlacement mPlacement;
+	threading::TimingWheel mTimingWheel;
 	boost::thread mThread;
-	tbb::concurrent_bounded_queue<uint32>* mConditionSlots;
-	zillians::ConditionVariable<uint32>** mConditions;
-	volatile bool* mCancellationFlags;
 };
 
+template<typename CompletionHandler>
+inline void WorkerStaging::stage(Worker& worker, const CompletionHandler& handler)
+{
+	Entry* entry = NULL;
+	for(std::size_t i = 0; i < mCount; ++i)
+	{
+		if(mEntries[i].worker == &worker)
+		{
+			entry = &mEntries[i];
+			break;
+		}
+	}
+
+	if(!entry)
+	{
+		if(mCount == ZILLIANS_WORKER_STAGING_TARGETS)
+			flush();
+		entry = &mEntries[mCount++];
+		entry->worker = &worker;
+		entry->batch.reset(new WorkerBatch());
+	}
+
+	entry->batch->push(handler);
+	if(entry->batch->size() >= ZILLIANS_WORKER_STAGING_LIMIT)
+	{
+		worker.postBatch(entry->batch);
+		entry->batch.reset(new WorkerBatch());
+	}
+}
+
+inline void WorkerStaging::flush(Worker& worker)
+{
+	for(std::size_t i = 0; i < mCount; ++i)
+	{
+		if(mEntries[i].worker == &worker)
+		{
+			worker.postBatch(mEntries[i].batch);
+
+			// the order between workers doesn't matter
+			mEntries[i].worker = mEntries[mCount - 1].worker;
+			mEntries[i].batch.swap(mEntries[mCount - 1].batch);
+			mEntries[--mCount].batch.reset();
+			return;
+		}
+	}
+}
+
+inline void WorkerStaging::flush()
+{
+	for(std::size_t i = 0; i < mCount; ++i)
+	{
+		mEntries[i].worker->postBatch(mEntries[i].batch);
+		mEntries[i].batch.reset();
+	}
+	mCount = 0;
+}
+
 class WorkerGroup
 {
 public:
@@ -286,7 +862,7 @@ public:
 		enum type { round_robin, least_load_first };
 	};
 
-	explicit WorkerGroup(std::size_t workers = 1, std::size_t threads_per_worker = 16, load_balancing_t::type policy = load_balancing_t::round_robin, std::size_t maxConcurrentCalls = ZILLIANS_WORKER_DEFAULT_MAXIMUM_CONCURRENT_CALLS)
+	explicit WorkerGroup(std::size_t workers = 1, std::size_t threads_per_worker = 16, load_balancing_t::type policy = load_balancing_t::round_robin, const ThreadPlacement& placement = ThreadPlacement())
 	{
 		// initialize load balancing context
 		mLoadBalancingPolicy = policy;
@@ -303,25 +879,12 @@ public:
 			BOOST_ASSERT("unknown load balancing policy is provided" && 0);
 		}
 
-		// create shared condition variables and slots
-		mConditionTableSize = workers * maxConcurrentCalls;
-		mConditionSlots = new tbb::concurrent_bounded_queue<uint32>();
-		mConditions = new zillians::ConditionVariable<uint32>*[mConditionTableSize];
-		mCancellationFlags = new bool[mConditionTableSize];
-
-		for(uint32 i=0;i<mConditionTableSize;++i)
-		{
-			mConditionSlots->push(i);
-			mConditions[i] = new zillians::ConditionVariable<uint32>();
-			mCancellationFlags[i] = false;
-		}
-
-		// create all workers with shared condition variables and slots
+		// create all workers
 		mWorkerSize = workers;
 		mWorkers = new Worker*[workers];
 		for(std::size_t i=0;i<workers;++i)
 		{
-			mWorkers[i] = new Worker(mConditions, mConditionSlots, mCancellationFlags);
+			mWorkers[i] = new Worker(placement.at(i));
 
 			// spawn default threads on each worker
 			// (note that there's one thread associated with the worker by default, that's why we minus one here)
@@ -358,14 +921,6 @@ public:
 			SAFE_DELETE(mWorkers[i]);
 		}
 		SAFE_DELETE_ARRAY(mWorkers);
-
-		// destroy shared condition variables and slots
-		for(uint32 i=0;i<mConditionTableSize;++i)
-		{
-			SAFE_DELETE(mConditions[i]);
-		}
-		SAFE_DELETE_ARRAY(mConditions);
-		SAFE_DELETE(mConditionSlots);
 	}
 
 public:
@@ -400,11 +955,12 @@ public:
 	}
 
 	template<typename CompletionHandler>
-	inline int async(CompletionHandler handler)
+	inline WorkerFuture async(CompletionHandler handler)
 	{
+		WorkerFuture key;
 		if(mLoadBalancingPolicy == load_balancing_t::round_robin)
 		{
-			mWorkers[mLoadBalancingContext.round_robin.current]->async(handler);
+			key = mWorkers[mLoadBalancingContext.round_robin.current]->async(handler);
 			++mLoadBalancingContext.round_robin.current;
 			if(mLoadBalancingContext.round_robin.current >= mWorkerSize) mLoadBalancingContext.round_robin.current -= mWorkerSize;
 		}
@@ -412,12 +968,12 @@ public:
 		{
 			BOOST_ASSERT("least-load-first policy is not yet implemented" && 0);
 		}
+		return key;
 	}
 
-	inline void wait(int key)
+	inline void wait(const WorkerFuture& key)
 	{
-		uint32 dummy = 0;
-		mConditions[key]->wait(dummy);
+		key.wait();
 	}
 
 protected:
@@ -437,10 +993,6 @@ protected:
 		} least_load_first;
 	} mLoadBalancingContext;
 	std::vector<boost::thread*> mWorkerThreads;
-	uint32 mConditionTableSize;
-	tbb::concurrent_bounded_queue<uint32>* mConditionSlots;
-	zillians::ConditionVariable<uint32>** mConditions;
-	volatile bool* mCancellationFlags;
 };
 
 /**
@@ -0,0 +1,504 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADING_AWAITABLE_H_
+#define ZILLIANS_THREADING_AWAITABLE_H_
+
+#include "core/Prerequisite.h"
+#include "core/Buffer.h"
+#include "core/Worker.h"
+
+#ifdef ZILLIANS_HAS_COROUTINES
+
+#include <boost/asio.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/**
+ * This is the native coroutine counterpart of Coroutine.h and StackfulCoroutine.h,
+ * only available when the compiler supports C++20 coroutines (see ZILLIANS_HAS_COROUTINES):
+ *
+ * @code
+ * Task<void> echo(Worker& worker, shared_ptr<tcp::socket> socket)
+ * {
+ *     co_await worker.schedule();
+ *
+ *     Buffer buffer(4096);
+ *     boost::system::error_code ec;
+ *     for(;;)
+ *     {
+ *         co_await asyncRead(*socket, buffer, ec);
+ *         if(ec) break;
+ *         co_await asyncWrite(*socket, buffer, ec);
+ *         if(ec) break;
+ *         buffer.clear();
+ *     }
+ * }
+ *
+ * spawn(echo(worker, socket));
+ * @endcode
+ *
+ * Coroutine frames come from CoroutineFrameAllocator, and the awaiters keep
+ * their state in the frame, so there's no boost::function nor heap
+ * allocation per step.
+ */
+
+namespace zillians { namespace threading {
+
+namespace detail {
+
+template<std::size_t Size>
+struct CoroutineFrameBlock : public ConcurrentObjectPool< CoroutineFrameBlock<Size> >
+{
+	boost::aligned_storage<Size> storage;
+};
+
+}
+
+/**
+ * @brief CoroutineFrameAllocator allocates coroutine frames from ConcurrentObjectPool by size classes.
+ *
+ * Frames are usually freed on another thread than the one creating them (a
+ * coroutine hopping onto a worker), which the magazines of ConcurrentObjectPool
+ * handle without a lock in the common case. Frames bigger than the largest
+ * class go to the heap.
+ */
+struct CoroutineFrameAllocator
+{
+	static void* allocate(std::size_t size)
+	{
+		if(size <= 256)		return detail::CoroutineFrameBlock<256>::operator new(sizeof(detail::CoroutineFrameBlock<256>));
+		if(size <= 512)		return detail::CoroutineFrameBlock<512>::operator new(sizeof(detail::CoroutineFrameBlock<512>));
+		if(size <= 1024)	return detail::CoroutineFrameBlock<1024>::operator new(sizeof(detail::CoroutineFrameBlock<1024>));
+		if(size <= 4096)	return detail::CoroutineFrameBlock<4096>::operator new(sizeof(detail::CoroutineFrameBlock<4096>));
+		return ::operator new(size);
+	}
+
+	static void deallocate(void* p, std::size_t size)
+	{
+		if(size <= 256)		detail::CoroutineFrameBlock<256>::operator delete(p);
+		else if(size <= 512)	detail::CoroutineFrameBlock<512>::operator delete(p);
+		else if(size <= 1024)	detail::CoroutineFrameBlock<1024>::operator delete(p);
+		else if(size <= 4096)	detail::CoroutineFrameBlock<4096>::operator delete(p);
+		else ::operator delete(p);
+	}
+};
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase
+{
+	static void* operator new(std::size_t size)
+	{
+		return CoroutineFrameAllocator::allocate(size);
+	}
+
+	static void operator delete(void* p, std::size_t size)
+	{
+		CoroutineFrameAllocator::deallocate(p, size);
+	}
+
+	/**
+	 * Resumes the awaiting coroutine, if any, once the task is done.
+	 */
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{ }
+	};
+
+	std::suspend_always initial_suspend() const noexcept
+	{
+		return std::suspend_always();
+	}
+
+	FinalAwaiter final_suspend() const noexcept
+	{
+		return FinalAwaiter();
+	}
+
+	void unhandled_exception()
+	{
+		exception = std::current_exception();
+	}
+
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+};
+
+template<typename T>
+struct TaskPromise : public TaskPromiseBase
+{
+	Task<T> get_return_object();
+
+	template<typename U>
+	void return_value(U&& v)
+	{
+		value.emplace(std::forward<U>(v));
+	}
+
+	T result()
+	{
+		if(exception)
+			std::rethrow_exception(exception);
+		return std::move(*value);
+	}
+
+	std::optional<T> value;
+};
+
+template<>
+struct TaskPromise<void> : public TaskPromiseBase
+{
+	Task<void> get_return_object();
+
+	void return_void() const noexcept
+	{ }
+
+	void result()
+	{
+		if(exception)
+			std::rethrow_exception(exception);
+	}
+};
+
+}
+
+/**
+ * @brief Task is a lazily started coroutine producing a T.
+ *
+ * A task doesn't run until it's awaited (or spawned), and resumes the
+ * awaiting coroutine in place once it's done, so a chain of tasks costs no
+ * post() nor thread hop unless a task asks for one. An exception escaping the
+ * task is rethrown to the awaiting coroutine.
+ */
+template<typename T>
+class Task : public boost::noncopyable
+{
+public:
+	typedef detail::TaskPromise<T> promise_type;
+
+public:
+	Task() : mHandle()
+	{ }
+
+	explicit Task(std::coroutine_handle<promise_type> handle) : mHandle(handle)
+	{ }
+
+	Task(Task&& other) noexcept : mHandle(other.mHandle)
+	{
+		other.mHandle = nullptr;
+	}
+
+	~Task()
+	{
+		if(mHandle)
+			mHandle.destroy();
+	}
+
+	Task& operator= (Task&& other) noexcept
+	{
+		if(this != &other)
+		{
+			if(mHandle)
+				mHandle.destroy();
+			mHandle = other.mHandle;
+			other.mHandle = nullptr;
+		}
+		return *this;
+	}
+
+public:
+	bool valid() const
+	{
+		return !!mHandle;
+	}
+
+	bool await_ready() const noexcept
+	{
+		return !mHandle || mHandle.done();
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		mHandle.promise().continuation = awaiting;
+		return mHandle;
+	}
+
+	T await_resume()
+	{
+		return mHandle.promise().result();
+	}
+
+private:
+	std::coroutine_handle<promise_type> mHandle;
+};
+
+namespace detail {
+
+template<typename T>
+inline Task<T> TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+/**
+ * A coroutine starting right away and destroying itself when done, to run a spawned task.
+ */
+struct DetachedTask
+{
+	struct promise_type
+	{
+		static void* operator new(std::size_t size)
+		{
+			return CoroutineFrameAllocator::allocate(size);
+		}
+
+		static void operator delete(void* p, std::size_t size)
+		{
+			CoroutineFrameAllocator::deallocate(p, size);
+		}
+
+		DetachedTask get_return_object() const noexcept
+		{
+			return DetachedTask();
+		}
+
+		std::suspend_never initial_suspend() const noexcept
+		{
+			return std::suspend_never();
+		}
+
+		std::suspend_never final_suspend() const noexcept
+		{
+			return std::suspend_never();
+		}
+
+		void return_void() const noexcept
+		{ }
+
+		void unhandled_exception() const noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+inline DetachedTask runDetached(Worker* worker, Task<void> task)
+{
+	if(worker)
+		co_await worker->schedule();
+
+	try
+	{
+		co_await task;
+	}
+	catch(std::exception& e)
+	{
+		// same as an exception escaping a handler of Worker
+		printf("exception e: %s\n", e.what());
+	}
+}
+
+}
+
+/**
+ * @brief Start the task on the calling thread without waiting for it.
+ *
+ * The task runs until its first suspension before spawn() returns, and its
+ * frame is freed once it's done.
+ */
+inline void spawn(Task<void> task)
+{
+	detail::runDetached(NULL, std::move(task));
+}
+
+/**
+ * @brief Start the task on the given worker without waiting for it.
+ */
+inline void spawn(Worker& worker, Task<void> task)
+{
+	detail::runDetached(&worker, std::move(task));
+}
+
+namespace detail {
+
+/**
+ * Common part of the socket awaiters, the completion handler stores the
+ * result in the awaiter living in the coroutine frame and resumes it.
+ */
+template<typename Derived>
+class BufferIoAwaiter
+{
+public:
+	BufferIoAwaiter(Buffer& buffer, boost::system::error_code& ec) : mBuffer(buffer), mError(ec), mTransferred(0)
+	{ }
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	std::size_t await_resume() const noexcept
+	{
+		return mTransferred;
+	}
+
+protected:
+	struct Completion
+	{
+		explicit Completion(BufferIoAwaiter* a) : awaiter(a)
+		{ }
+
+		void operator() (const boost::system::error_code& ec, std::size_t transferred) const
+		{
+			awaiter->mError = ec;
+			awaiter->mTransferred = transferred;
+			static_cast<Derived*>(awaiter)->complete();
+			awaiter->mHandle.resume();
+		}
+
+		BufferIoAwaiter* awaiter;
+	};
+
+	Buffer& mBuffer;
+	boost::system::error_code& mError;
+	std::size_t mTransferred;
+	std::coroutine_handle<> mHandle;
+};
+
+}
+
+/**
+ * @brief Awaitable reading some bytes from the stream to the write pointer of the buffer.
+ *
+ * The write position is moved past the bytes read before the coroutine
+ * resumes. The buffer is crunched first if there's no room after the write
+ * pointer.
+ */
+template<typename Stream>
+class BufferReadAwaiter : public detail::BufferIoAwaiter< BufferReadAwaiter<Stream> >
+{
+	typedef detail::BufferIoAwaiter< BufferReadAwaiter<Stream> > base_type;
+	friend class detail::BufferIoAwaiter< BufferReadAwaiter<Stream> >;
+	using base_type::mBuffer;
+	using base_type::mHandle;
+	using base_type::mTransferred;
+	typedef typename base_type::Completion Completion;
+public:
+	BufferReadAwaiter(Stream& stream, Buffer& buffer, boost::system::error_code& ec) : base_type(buffer, ec), mStream(stream)
+	{ }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		if(mBuffer.allocatedSize() == mBuffer.wpos())
+			mBuffer.crunch();
+		mStream.async_read_some(boost::asio::buffer(mBuffer.wptr(), mBuffer.allocatedSize() - mBuffer.wpos()), Completion(this));
+	}
+
+private:
+	void complete()
+	{
+		mBuffer.wskip(mTransferred);
+	}
+
+	Stream& mStream;
+};
+
+/**
+ * @brief Awaitable writing all the data of the buffer to the stream.
+ *
+ * The read position is moved past the bytes written before the coroutine
+ * resumes, so the buffer is empty on success.
+ */
+template<typename Stream>
+class BufferWriteAwaiter : public detail::BufferIoAwaiter< BufferWriteAwaiter<Stream> >
+{
+	typedef detail::BufferIoAwaiter< BufferWriteAwaiter<Stream> > base_type;
+	friend class detail::BufferIoAwaiter< BufferWriteAwaiter<Stream> >;
+	using base_type::mBuffer;
+	using base_type::mHandle;
+	using base_type::mTransferred;
+	typedef typename base_type::Completion Completion;
+public:
+	BufferWriteAwaiter(Stream& stream, Buffer& buffer, boost::system::error_code& ec) : base_type(buffer, ec), mStream(stream)
+	{ }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		boost::asio::async_write(mStream, boost::asio::buffer(mBuffer.rptr(), mBuffer.dataSize()), Completion(this));
+	}
+
+private:
+	void complete()
+	{
+		mBuffer.rskip(mTransferred);
+	}
+
+	Stream& mStream;
+};
+
+/**
+ * @brief Read some bytes from the stream into the buffer, resolving to the number of bytes read.
+ */
+template<typename Stream>
+inline BufferReadAwaiter<Stream> asyncRead(Stream& stream, Buffer& buffer, boost::system::error_code& ec)
+{
+	return BufferReadAwaiter<Stream>(stream, buffer, ec);
+}
+
+/**
+ * @brief Write the data of the buffer to the stream, resolving to the number of bytes written.
+ */
+template<typename Stream>
+inline BufferWriteAwaiter<Stream> asyncWrite(Stream& stream, Buffer& buffer, boost::system::error_code& ec)
+{
+	return BufferWriteAwaiter<Stream>(stream, buffer, ec);
+}
+
+} }
+
+#endif/*ZILLIANS_HAS_COROUTINES*/
+
+#endif /* ZILLIANS_THREADING_AWAITABLE_H_ */
@@ -35,8 +35,17 @@
 #ifndef ZILLIANS_COROUTINE_H_
 #define ZILLIANS_COROUTINE_H_
 
+#include "core/Types.h"
 #include <boost/asio.hpp>
 #include <boost/asio/error.hpp>
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/addressof.hpp>
+
+/**
+ * Size of each slot in CoroutineHandlerMemory, big enough for a socket operation with a small coroutine handler
+ */
+#define ZILLIANS_COROUTINE_HANDLER_MEMORY_SIZE	512
 
 namespace zillians {
 
@@ -91,6 +100,143 @@ protected:
 	int& mInternalCoroutineState;
 };
 
+/**
+ * @brief CoroutineHandlerMemory is a per-connection arena for asio handler allocation.
+ *
+ * Every asynchronous operation allocates storage for the operation and its
+ * handler through the asio_handler_allocate() hook, which falls back to the
+ * heap. A connection driven by a coroutine has at most one or two operations
+ * outstanding at a time, so keeping a couple of fixed slots per connection
+ * and handing them out through CoroutineAllocHandler makes the steady state
+ * free of heap allocations:
+ *
+ * @code
+ * CoroutineYield socket_->async_read_some(buffer(*buffer_), makeCoroutineHandler(*memory_, *this));
+ * @endcode
+ *
+ * Requests larger than a slot, or made while all slots are in use, go to the heap.
+ *
+ * @note Not thread-safe, the operations of a connection must not complete concurrently (use a strand otherwise).
+ */
+class CoroutineHandlerMemory : public boost::noncopyable
+{
+public:
+	enum
+	{
+		SLOT_SIZE = ZILLIANS_COROUTINE_HANDLER_MEMORY_SIZE,
+		SLOT_COUNT = 2,
+	};
+
+	CoroutineHandlerMemory()
+	{
+		for(int i = 0; i < SLOT_COUNT; ++i)
+			mInUse[i] = false;
+	}
+
+public:
+	void* allocate(std::size_t size)
+	{
+		if(size <= SLOT_SIZE)
+		{
+			for(int i = 0; i < SLOT_COUNT; ++i)
+			{
+				if(!mInUse[i])
+				{
+					mInUse[i] = true;
+					return mSlots[i].address();
+				}
+			}
+		}
+		return ::operator new(size);
+	}
+
+	void deallocate(void* p)
+	{
+		for(int i = 0; i < SLOT_COUNT; ++i)
+		{
+			if(p == mSlots[i].address())
+			{
+				mInUse[i] = false;
+				return;
+			}
+		}
+		::operator delete(p);
+	}
+
+private:
+	boost::aligned_storage<SLOT_SIZE> mSlots[SLOT_COUNT];
+	bool mInUse[SLOT_COUNT];
+};
+
+/**
+ * @brief CoroutineAllocHandler wraps a completion handler to allocate from a CoroutineHandlerMemory.
+ *
+ * The wrapper forwards invocation to the wrapped handler, including the
+ * asio_handler_invoke() hook, so it composes with strands.
+ *
+ * @see makeCoroutineHandler
+ */
+template<typename Handler>
+class CoroutineAllocHandler
+{
+public:
+	CoroutineAllocHandler(CoroutineHandlerMemory& memory, Handler handler) :
+		mMemory(memory), mHandler(handler)
+	{ }
+
+	void operator() ()
+	{
+		mHandler();
+	}
+
+	template<typename Arg1>
+	void operator() (Arg1 arg1)
+	{
+		mHandler(arg1);
+	}
+
+	template<typename Arg1, typename Arg2>
+	void operator() (Arg1 arg1, Arg2 arg2)
+	{
+		mHandler(arg1, arg2);
+	}
+
+	friend void* asio_handler_allocate(std::size_t size, CoroutineAllocHandler<Handler>* this_handler)
+	{
+		return this_handler->mMemory.allocate(size);
+	}
+
+	friend void asio_handler_deallocate(void* pointer, std::size_t size, CoroutineAllocHandler<Handler>* this_handler)
+	{
+		UNUSED_ARGUMENT(size);
+		this_handler->mMemory.deallocate(pointer);
+	}
+
+	template<typename Function>
+	friend void asio_handler_invoke(Function& function, CoroutineAllocHandler<Handler>* this_handler)
+	{
+		using boost::asio::asio_handler_invoke;
+		asio_handler_invoke(function, boost::addressof(this_handler->mHandler));
+	}
+
+	template<typename Function>
+	friend void asio_handler_invoke(const Function& function, CoroutineAllocHandler<Handler>* this_handler)
+	{
+		using boost::asio::asio_handler_invoke;
+		asio_handler_invoke(function, boost::addressof(this_handler->mHandler));
+	}
+
+private:
+	CoroutineHandlerMemory& mMemory;
+	Handler mHandler;
+};
+
+template<typename Handler>
+inline CoroutineAllocHandler<Handler> makeCoroutineHandler(CoroutineHandlerMemory& memory, Handler handler)
+{
+	return CoroutineAllocHandler<Handler>(memory, handler);
+}
+
 #define CoroutineReenter(c) \
   switch (CoroutineRef _coro_value = c)
 
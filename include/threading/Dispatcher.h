@@ -26,39 +26,64 @@
 #include "core/Prerequisite.h"
 #include "core/Semaphore.h"
 #include "core/AtomicQueue.h"
+#include "core/Metrics.h"
 #include "threading/DispatcherThreadContext.h"
 #include "threading/DispatcherNetwork.h"
 
-#define ZILLIANS_DISPATCHER_MAX_THREADS		63
-#define ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE	256
+/**
+ * The maximum number of thread contexts is bounded by the two-level bitmap
+ * of DispatcherThreadSignaler (63 words of 64 sources), shared by the lanes.
+ */
+#define ZILLIANS_DISPATCHER_MAX_THREADS		((63 / ZILLIANS_DISPATCHER_LANES) * 64)
+#define ZILLIANS_DISPATCHER_DEFAULT_THREADS	63
 
 namespace zillians { namespace threading {
 
+/**
+ * Dispatcher connects every pair of thread contexts with an AtomicPipe.
+ *
+ * Pipes are created on the first write from a source to a destination, and
+ * the table of pipes of a source is created on its first write as well, so
+ * the memory grows with the pairs actually talking to each other instead of
+ * the square of the maximum number of contexts.
+ *
+ * Each pair has ZILLIANS_DISPATCHER_LANES pipes, and the destination reads
+ * the lower lanes first.
+ *
+ * Pipes are unbounded by default. Given a pipe capacity, a write to a pipe
+ * holding that many unread messages blocks or fails by the overflow policy,
+ * so a slow destination can't make its sources allocate without limit.
+ */
 template<typename Message>
 class Dispatcher : public DispatcherNetwork<Message>
 {
 public:
-	typedef atomic::AtomicPipe<Message, ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE> ContextPipe;
+	typedef typename DispatcherNetwork<Message>::ContextPipe ContextPipe;
+
+private:
+	typedef tbb::atomic<ContextPipe*> PipeSlot;
 
 public:
-	Dispatcher(uint32 max_dispatcher_threads = ZILLIANS_DISPATCHER_MAX_THREADS) : mMaxThreadContextCount(max_dispatcher_threads)
+	/**
+	 * @param max_dispatcher_threads The maximum number of thread contexts.
+	 * @param pipe_capacity The maximum number of unread messages in each pipe, or zero for unbounded pipes.
+	 * @param policy What a write to a full pipe does.
+	 */
+	Dispatcher(uint32 max_dispatcher_threads = ZILLIANS_DISPATCHER_DEFAULT_THREADS, uint32 pipe_capacity = 0, DispatcherOverflowPolicy::type policy = DispatcherOverflowPolicy::block) :
+		mMaxThreadContextCount(max_dispatcher_threads), mPipeCapacity(pipe_capacity), mOverflowPolicy(policy)
 	{
 		BOOST_ASSERT(max_dispatcher_threads <= ZILLIANS_DISPATCHER_MAX_THREADS);
 
-		mPipes = new ContextPipe*[max_dispatcher_threads * max_dispatcher_threads];
+		mPipes = new tbb::atomic<PipeSlot*>[max_dispatcher_threads];
 		mSignalers = new DispatcherThreadSignaler*[max_dispatcher_threads];
 		mAttachedFlags = new bool[mMaxThreadContextCount];
 
 		for(uint32 i = 0; i < mMaxThreadContextCount; ++i)
 		{
+			mPipes[i] = NULL;
 			mSignalers[i] = NULL;
 			mAttachedFlags[i] = false;
 		}
-
-		for(uint32 i = 0; i < mMaxThreadContextCount * mMaxThreadContextCount; ++i)
-		{
-			mPipes[i] = new ContextPipe();
-		}
 	}
 
 	~Dispatcher()
@@ -68,9 +93,18 @@ public:
 			BOOST_ASSERT(!mAttachedFlags[i]);
 		}
 
-		for(uint32 i = 0; i < mMaxThreadContextCount * mMaxThreadContextCount; ++i)
+		for(uint32 i = 0; i < mMaxThreadContextCount; ++i)
 		{
-			SAFE_DELETE(mPipes[i]);
+			PipeSlot* row = mPipes[i];
+			if(!row)
+				continue;
+
+			for(uint32 j = 0; j < mMaxThreadContextCount * ZILLIANS_DISPATCHER_LANES; ++j)
+			{
+				ContextPipe* pipe = row[j];
+				SAFE_DELETE(pipe);
+			}
+			SAFE_DELETE_ARRAY(row);
 		}
 
 		SAFE_DELETE_ARRAY(mPipes);
@@ -80,6 +114,17 @@ public:
 
 public:
 	shared_ptr<DispatcherThreadContext<Message> > createThreadContext(int contextId = -1)
+	{
+		return createThreadContext(contextId, this);
+	}
+
+	/**
+	 * Create a context writing through the given network instead of this
+	 * dispatcher, so a network layered on top of the dispatcher (like
+	 * RemoteDispatcher) can route the writes while the local pipes and
+	 * signalers stay here.
+	 */
+	shared_ptr<DispatcherThreadContext<Message> > createThreadContext(int contextId, DispatcherNetwork<Message>* network)
 	{
 		if(contextId == -1)
 		{
@@ -101,7 +146,7 @@ public:
 		BOOST_ASSERT(mAttachedFlags[contextId] == false && "context already assigned");
 
 		mAttachedFlags[contextId] = true;
-		shared_ptr<DispatcherThreadContext<Message> > context = shared_ptr<DispatcherThreadContext<Message> >(new DispatcherThreadContext<Message>(this, contextId, mMaxThreadContextCount));
+		shared_ptr<DispatcherThreadContext<Message> > context = shared_ptr<DispatcherThreadContext<Message> >(new DispatcherThreadContext<Message>(network, contextId, mMaxThreadContextCount));
 
 		// store the signaler object into the local signaler array
 		mSignalers[contextId] = &context->getSignaler();
@@ -116,29 +161,203 @@ public:
 		mSignalers[contextId] = NULL;
 	}
 
+	bool isAttached(uint32 contextId) const
+	{
+		return contextId < mMaxThreadContextCount && mAttachedFlags[contextId];
+	}
+
+	uint32 getMaxThreadContextCount() const
+	{
+		return mMaxThreadContextCount;
+	}
+
+	uint32 getPipeCapacity() const
+	{
+		return mPipeCapacity;
+	}
+
+	/**
+	 * Get the number of messages written from source to destination and not read yet.
+	 */
+	std::size_t getPipeDepth(uint32 source, uint32 destination, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		ContextPipe* pipe = getPipe(source, destination, lane);
+		return pipe ? pipe->depth() : 0;
+	}
+
 public:
-	virtual void write(uint32 source, uint32 destination, const Message& message, bool incomplete)
+	virtual bool write(uint32 source, uint32 destination, const Message& message, bool incomplete, uint32 lane)
 	{
-		ContextPipe* pipes = mPipes[source * mMaxThreadContextCount + destination];
+		ContextPipe* pipes = getOrCreatePipe(source, destination, lane);
+		if(UNLIKELY(mPipeCapacity && pipes->full(mPipeCapacity)) && !waitForSpace(pipes, source, destination, lane))
+			return false;
+#ifdef ZILLIANS_ENABLE_METRICS
+		BuiltinMetrics::dispatcher_writes().increment();
+#endif
 		pipes->write(message, incomplete);
+		commit(pipes, source, destination, incomplete, lane);
+		return true;
+	}
 
-		if(!incomplete)
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	virtual bool write(uint32 source, uint32 destination, Message&& message, bool incomplete, uint32 lane)
+	{
+		ContextPipe* pipes = getOrCreatePipe(source, destination, lane);
+		if(UNLIKELY(mPipeCapacity && pipes->full(mPipeCapacity)) && !waitForSpace(pipes, source, destination, lane))
+			return false;
+#ifdef ZILLIANS_ENABLE_METRICS
+		BuiltinMetrics::dispatcher_writes().increment();
+#endif
+		pipes->write(std::move(message), incomplete);
+		commit(pipes, source, destination, incomplete, lane);
+		return true;
+	}
+#endif
+
+	/**
+	 * All destinations are written first and then flushed and signaled, so
+	 * each destination is woken at most once for the whole batch, and the
+	 * messages are delivered to a destination as one unit.
+	 *
+	 * @note With bounded pipes, a destination whose pipe fills up under the
+	 * reject policy misses the rest of the messages.
+	 */
+	virtual void multicast(uint32 source, const uint32* destinations, uint32 destination_count, const Message* messages, uint32 count, uint32 lane)
+	{
+		if(!count)
+			return;
+
+		for(uint32 i = 0; i < destination_count; ++i)
+			stage(source, destinations[i], messages, count, lane);
+
+		for(uint32 i = 0; i < destination_count; ++i)
+			commit(getPipe(source, destinations[i], lane), source, destinations[i], false, lane);
+	}
+
+	/**
+	 * @note A context attached or detached concurrently may or may not receive the messages.
+	 */
+	virtual void broadcast(uint32 source, const Message* messages, uint32 count, uint32 lane)
+	{
+		if(!count)
+			return;
+
+		for(uint32 i = 0; i < mMaxThreadContextCount; ++i)
 		{
-			pipes->flush();
-			mSignalers[destination]->signal(source);
+			if(i != source && mAttachedFlags[i])
+				stage(source, i, messages, count, lane);
+		}
+
+		for(uint32 i = 0; i < mMaxThreadContextCount; ++i)
+		{
+			if(i != source && mAttachedFlags[i])
+				commit(getPipe(source, i, lane), source, i, false, lane);
+		}
+	}
+
+	virtual bool read(uint32 source, uint32 destination, Message* message, uint32 lane)
+	{
+		ContextPipe* pipe = getPipe(source, destination, lane);
+		return pipe ? pipe->read(message) : false;
+	}
+
+	virtual ContextPipe* getPipe(uint32 source, uint32 destination, uint32 lane)
+	{
+		BOOST_ASSERT(lane < ZILLIANS_DISPATCHER_LANES);
+		PipeSlot* row = mPipes[source];
+		return row ? (ContextPipe*)row[lane * mMaxThreadContextCount + destination] : NULL;
+	}
+
+	virtual DispatcherThreadSignaler* getLocalSignaler(uint32 contextId)
+	{
+		return (contextId < mMaxThreadContextCount) ? mSignalers[contextId] : NULL;
+	}
+
+private:
+	/**
+	 * Only the thread owning the source context writes, so the row and the
+	 * pipe are created without racing against other creators, and published
+	 * to the destination by the release store of tbb::atomic.
+	 */
+	inline ContextPipe* getOrCreatePipe(uint32 source, uint32 destination, uint32 lane)
+	{
+		BOOST_ASSERT(lane < ZILLIANS_DISPATCHER_LANES);
+
+		PipeSlot* row = mPipes[source];
+		if(UNLIKELY(!row))
+		{
+			row = new PipeSlot[mMaxThreadContextCount * ZILLIANS_DISPATCHER_LANES];
+			for(uint32 i = 0; i < mMaxThreadContextCount * ZILLIANS_DISPATCHER_LANES; ++i)
+				row[i] = NULL;
+			mPipes[source] = row;
+		}
+
+		PipeSlot& slot = row[lane * mMaxThreadContextCount + destination];
+		ContextPipe* pipe = slot;
+		if(UNLIKELY(!pipe))
+		{
+			pipe = new ContextPipe();
+			slot = pipe;
 		}
+		return pipe;
 	}
 
-	virtual bool read(uint32 source, uint32 destination, Message* message)
+	inline void stage(uint32 source, uint32 destination, const Message* messages, uint32 count, uint32 lane)
 	{
-		return mPipes[source * mMaxThreadContextCount + destination]->read(message);
+		ContextPipe* pipe = getOrCreatePipe(source, destination, lane);
+#ifdef ZILLIANS_ENABLE_METRICS
+		BuiltinMetrics::dispatcher_writes().increment(count);
+#endif
+		for(uint32 i = 0; i < count; ++i)
+		{
+			if(UNLIKELY(mPipeCapacity && pipe->full(mPipeCapacity)) && !waitForSpace(pipe, source, destination, lane))
+				break;
+			pipe->write(messages[i], i + 1 < count);
+		}
+	}
+
+	/**
+	 * Flush what's staged so the destination can make room, then wait for it
+	 * by the block policy.
+	 *
+	 * @return True if there's room now.
+	 */
+	bool waitForSpace(ContextPipe* pipe, uint32 source, uint32 destination, uint32 lane)
+	{
+#ifdef ZILLIANS_ENABLE_METRICS
+		BuiltinMetrics::dispatcher_overflows().increment();
+#endif
+		pipe->complete();
+		commit(pipe, source, destination, false, lane);
+
+		if(mOverflowPolicy == DispatcherOverflowPolicy::reject)
+			return false;
+
+		while(pipe->full(mPipeCapacity))
+		{
+			if(!mAttachedFlags[destination])
+				return false;
+			boost::this_thread::yield();
+		}
+		return true;
+	}
+
+	inline void commit(ContextPipe* pipes, uint32 source, uint32 destination, bool incomplete, uint32 lane)
+	{
+		if(!incomplete)
+		{
+			pipes->flush();
+			mSignalers[destination]->signal(source, lane);
+		}
 	}
 
 private:
-	ContextPipe** mPipes;
+	tbb::atomic<PipeSlot*>* mPipes;
 	DispatcherThreadSignaler** mSignalers;
 	bool* mAttachedFlags;
 	uint32 mMaxThreadContextCount;
+	uint32 mPipeCapacity;
+	DispatcherOverflowPolicy::type mOverflowPolicy;
 };
 
 } }
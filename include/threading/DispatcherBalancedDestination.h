@@ -0,0 +1,199 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADING_DISPATCHERBALANCEDDESTINATION_H_
+#define ZILLIANS_THREADING_DISPATCHERBALANCEDDESTINATION_H_
+
+#include "core/Prerequisite.h"
+#include "threading/DispatcherNetwork.h"
+#include "threading/DispatcherThreadSignaler.h"
+#include <vector>
+
+namespace zillians { namespace threading {
+
+/**
+ * @brief DispatcherBalancedDestination writes each message to the least loaded context of a group.
+ *
+ * Two members are sampled for each write and the message goes to the one with
+ * fewer unread messages in the pipe from this source, the power of two choices.
+ * On a tie the one which is not parked is preferred, since waking a parked
+ * context costs a semaphore post. Only the pipes and the signalers of the two
+ * candidates are read, and nothing shared is written besides the pipe of the
+ * chosen member, so balancing adds no hot cache line to the write path.
+ *
+ * Messages written with a key go to the member the key hashes to, by jump
+ * consistent hashing, so messages of the same key stay in order on one member,
+ * and appending a member to the group only moves 1/n of the keys.
+ *
+ * @code
+ * std::vector<uint32> workers = ...;
+ * shared_ptr<DispatcherBalancedDestination<Task> > tasks = context->createBalancedDestination(workers);
+ * tasks->write(task);							// whoever is least busy
+ * tasks->write(update, session_id);			// always the same member for the session
+ * @endcode
+ *
+ * @note The load is measured on the pipes from this source only, so each
+ * source balances its own writes, like a DispatcherDestination it must only be
+ * used by the thread owning the source context.
+ */
+template<typename Message>
+class DispatcherBalancedDestination
+{
+public:
+	DispatcherBalancedDestination(DispatcherNetwork<Message>* dispatcher, uint32 sourceId, const std::vector<uint32>& members, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE) :
+		mDispatcher(dispatcher), mMembers(members), mSourceId(sourceId), mLane(lane), mSeed(sourceId * 2654435761U + 1)
+	{
+		BOOST_ASSERT(lane < ZILLIANS_DISPATCHER_LANES);
+		BOOST_ASSERT(!members.empty());
+	}
+
+public:
+	DispatcherNetwork<Message>* getDispatcherNetwork() const
+	{ return mDispatcher; }
+
+	const std::vector<uint32>& getMembers() const
+	{ return mMembers; }
+
+	uint32 getLane() const
+	{ return mLane; }
+
+public:
+	/**
+	 * @return False if the message is not written, see DispatcherNetwork::write().
+	 */
+	bool write(const Message& message)
+	{
+		return mDispatcher->write(mSourceId, pick(), message, false, mLane);
+	}
+
+	/**
+	 * Write the messages as one batch to a single member, which is signaled once.
+	 *
+	 * @return The number of messages written.
+	 */
+	uint32 write(const Message* messages, uint32 count)
+	{
+		const uint32 destination = pick();
+		for(uint32 i = 0; i < count; ++i)
+		{
+			if(!mDispatcher->write(mSourceId, destination, messages[i], i + 1 < count, mLane))
+				return i;
+		}
+		return count;
+	}
+
+	/**
+	 * Write the message to the member the key is bound to, regardless of its load.
+	 */
+	bool write(const Message& message, uint64 key)
+	{
+		return mDispatcher->write(mSourceId, pick(key), message, false, mLane);
+	}
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	bool write(Message&& message)
+	{
+		return mDispatcher->write(mSourceId, pick(), std::move(message), false, mLane);
+	}
+
+	bool write(Message&& message, uint64 key)
+	{
+		return mDispatcher->write(mSourceId, pick(key), std::move(message), false, mLane);
+	}
+#endif
+
+	/**
+	 * @brief Choose the member for the next message, the less loaded of two sampled ones.
+	 */
+	uint32 pick()
+	{
+		const uint32 n = mMembers.size();
+		if(n == 1)
+			return mMembers[0];
+
+		uint32 r = next();
+		uint32 a = r % n;
+		uint32 b = (r / n) % (n - 1);
+		if(b >= a)
+			++b;
+
+		const std::size_t loadA = load(mMembers[a]);
+		const std::size_t loadB = load(mMembers[b]);
+		if(loadA != loadB)
+			return mMembers[(loadA < loadB) ? a : b];
+
+		return mMembers[isParked(mMembers[a]) ? b : a];
+	}
+
+	/**
+	 * @brief Get the member the key is bound to.
+	 */
+	uint32 pick(uint64 key) const
+	{
+		return mMembers[jump(key, mMembers.size())];
+	}
+
+	/**
+	 * @brief Jump consistent hash (Lamping and Veach) of the key to one of the buckets.
+	 */
+	static uint32 jump(uint64 key, uint32 buckets)
+	{
+		int64 b = -1;
+		int64 j = 0;
+		while(j < (int64)buckets)
+		{
+			b = j;
+			key = key * 2862933555777941757ULL + 1;
+			j = (int64)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+		}
+		return (uint32)b;
+	}
+
+private:
+	inline std::size_t load(uint32 member) const
+	{
+		typename DispatcherNetwork<Message>::ContextPipe* pipe = mDispatcher->getPipe(mSourceId, member, mLane);
+		return pipe ? pipe->depth() : 0;
+	}
+
+	inline bool isParked(uint32 member) const
+	{
+		DispatcherThreadSignaler* signaler = mDispatcher->getLocalSignaler(member);
+		return signaler && signaler->isParked();
+	}
+
+	inline uint32 next()
+	{
+		mSeed ^= mSeed << 13;
+		mSeed ^= mSeed >> 17;
+		mSeed ^= mSeed << 5;
+		return mSeed;
+	}
+
+private:
+	DispatcherNetwork<Message>* mDispatcher;
+	std::vector<uint32> mMembers;
+	uint32 mSourceId;
+	uint32 mLane;
+	uint32 mSeed;
+};
+
+} }
+
+#endif /* ZILLIANS_THREADING_DISPATCHERBALANCEDDESTINATION_H_ */
@@ -34,11 +34,13 @@ template<typename Message>
 class DispatcherDestination : public ContextHub<ContextOwnership::transfer>
 {
 public:
-	DispatcherDestination(DispatcherNetwork<Message>* dispatcher, uint32 sourceId, uint32 destId)
+	DispatcherDestination(DispatcherNetwork<Message>* dispatcher, uint32 sourceId, uint32 destId, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
 	{
+		BOOST_ASSERT(lane < ZILLIANS_DISPATCHER_LANES);
 		mDispatcher = dispatcher;
 		mDestinationId = destId;
 		mSouceId = sourceId;
+		mLane = lane;
 	}
 
 	~DispatcherDestination()
@@ -48,18 +50,40 @@ public:
 	DispatcherNetwork<Message>* getDispatcherNetwork() const
 	{ return mDispatcher; }
 
+	uint32 getLane() const
+	{ return mLane; }
+
 public:
-	void write(const Message& message)
+	/**
+	 * @return False if the message is not written, see DispatcherNetwork::write().
+	 */
+	bool write(const Message& message)
+	{
+		return write(&message, 1) == 1;
+	}
+
+	/**
+	 * Write the messages as one batch, the destination is signaled once.
+	 *
+	 * @return The number of messages written, the rest are not written when a
+	 * bounded pipe rejects one of them.
+	 */
+	uint32 write(const Message* message, uint32 count)
 	{
-		write(&message, 1);
+		for(uint32 i = 0; i < count; ++i)
+		{
+			if(!mDispatcher->write(mSouceId, mDestinationId, message[i], i + 1 < count, mLane))
+				return i;
+		}
+		return count;
 	}
 
-	void write(const Message* message, uint32 count)
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	bool write(Message&& message)
 	{
-		for(uint32 i = 0; i < count - 1; ++i)
-			mDispatcher->write(mSouceId, mDestinationId, message[i], true);
-		mDispatcher->write(mSouceId, mDestinationId, message[count-1], false);
+		return mDispatcher->write(mSouceId, mDestinationId, std::move(message), false, mLane);
 	}
+#endif
 
 	bool read(Message* message, bool blocking = false)
 	{
@@ -72,13 +96,13 @@ public:
 
 		if(UNLIKELY(blocking))
 		{
-			while(!mDispatcher->read(mSouceId, mDestinationId, messages)) { }
+			while(!mDispatcher->read(mSouceId, mDestinationId, messages, mLane)) { }
 			++n;
 		}
 
 		for(;n < count; ++n)
 		{
-			if(!mDispatcher->read(mSouceId, mDestinationId, messages))
+			if(!mDispatcher->read(mSouceId, mDestinationId, messages, mLane))
 				break;
 		}
 
@@ -89,6 +113,7 @@ private:
 	DispatcherNetwork<Message>* mDispatcher;
 	uint32 mDestinationId;
 	uint32 mSouceId;
+	uint32 mLane;
 };
 
 } }
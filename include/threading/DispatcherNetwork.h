@@ -23,14 +23,81 @@
 #ifndef ZILLIANS_THREADING_DISPATCHERNETWORK_H_
 #define ZILLIANS_THREADING_DISPATCHERNETWORK_H_
 
+#include "core/AtomicQueue.h"
+
+#define ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE	256
+
+/**
+ * Every source and destination pair has one pipe per lane, and the lower
+ * lanes are read first, so control messages sent on lane 0 don't wait behind
+ * the data backlog of the default lane.
+ */
+#define ZILLIANS_DISPATCHER_LANES			2
+#define ZILLIANS_DISPATCHER_URGENT_LANE		0
+#define ZILLIANS_DISPATCHER_DEFAULT_LANE	(ZILLIANS_DISPATCHER_LANES - 1)
+
 namespace zillians { namespace threading {
 
+class DispatcherThreadSignaler;
+
+/**
+ * What a write to a full pipe does, if the network bounds its pipes.
+ *
+ * @li block - wait until the destination reads enough, or detaches.
+ * @li reject - fail the write right away, the caller decides to retry or drop.
+ *
+ * Either way the messages staged by incomplete writes before are flushed, so
+ * the destination can make room.
+ */
+struct DispatcherOverflowPolicy
+{
+	enum type
+	{
+		block,
+		reject
+	};
+};
+
 template<typename Message>
 struct DispatcherNetwork
 {
-	virtual void write(uint32 source, uint32 destination, const Message& message, bool incomplete) = 0;
-	virtual bool read(uint32 source, uint32 destination, Message* message) = 0;
+	typedef atomic::AtomicPipe<Message, ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE> ContextPipe;
+
+	/**
+	 * @param lane The lane of the pipe, below ZILLIANS_DISPATCHER_LANES.
+	 *
+	 * @return False if the message is not written, e.g. the pipe is full or the destination is gone.
+	 */
+	virtual bool write(uint32 source, uint32 destination, const Message& message, bool incomplete, uint32 lane) = 0;
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	virtual bool write(uint32 source, uint32 destination, Message&& message, bool incomplete, uint32 lane) = 0;
+#endif
+	/**
+	 * @brief Write the same messages to every destination in the list, each destination is signaled once.
+	 */
+	virtual void multicast(uint32 source, const uint32* destinations, uint32 destination_count, const Message* messages, uint32 count, uint32 lane) = 0;
+
+	/**
+	 * @brief Write the same messages to every attached context except the source.
+	 */
+	virtual void broadcast(uint32 source, const Message* messages, uint32 count, uint32 lane) = 0;
+
+	virtual bool read(uint32 source, uint32 destination, Message* message, uint32 lane) = 0;
+
+	/**
+	 * @brief Get the pipe from source to destination, only the destination thread may read from it.
+	 */
+	virtual ContextPipe* getPipe(uint32 source, uint32 destination, uint32 lane) = 0;
 	virtual void distroyThreadContext(uint32 contextId) = 0;
+
+	/**
+	 * @brief Get the signaler of a local context, NULL if the network doesn't know it.
+	 */
+	virtual DispatcherThreadSignaler* getLocalSignaler(uint32 contextId)
+	{
+		UNUSED_ARGUMENT(contextId);
+		return NULL;
+	}
 };
 
 } }
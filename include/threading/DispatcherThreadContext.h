@@ -26,10 +26,23 @@
 #include "core/Prerequisite.h"
 #include "core/SharedPtr.h"
 #include "core/ContextHub.h"
+#include "core/ThreadPlacement.h"
+#include "core/Metrics.h"
 #include "threading/Dispatcher.h"
 #include "threading/DispatcherNetwork.h"
 #include "threading/DispatcherDestination.h"
+#include "threading/DispatcherBalancedDestination.h"
 #include "threading/DispatcherThreadSignaler.h"
+#ifdef ZILLIANS_HAS_COROUTINES
+#include "core/Worker.h"
+#include <coroutine>
+#include <utility>
+#endif
+
+/**
+ * @brief The number of times a coroutine awaiting read() polls by posting itself before polling by ticks.
+ */
+#define ZILLIANS_DISPATCHER_AWAIT_SPIN_COUNT	64
 
 namespace zillians { namespace threading {
 
@@ -37,7 +50,7 @@ template<typename Message>
 class DispatcherThreadContext : public ContextHub<ContextOwnership::transfer>
 {
 public:
-	DispatcherThreadContext(DispatcherNetwork<Message>* dispatcher, uint32 id, uint32 max_thread_id) : mId(id), mMaxThreadId(max_thread_id), mDispatcher(dispatcher)
+	DispatcherThreadContext(DispatcherNetwork<Message>* dispatcher, uint32 id, uint32 max_thread_id) : mId(id), mMaxThreadId(max_thread_id), mDispatcher(dispatcher), mSignaler(max_thread_id, ZILLIANS_DISPATCHER_LANES)
 	{ }
 
 	virtual ~DispatcherThreadContext()
@@ -55,10 +68,58 @@ public:
 	DispatcherThreadSignaler& getSignaler()
 	{ return mSignaler; }
 
+	/**
+	 * @brief Place the thread owning this context, must be called from that thread.
+	 *
+	 * Contexts exchanging most of their messages can be co-located by giving
+	 * them the placement of ThreadPlacement::onCacheOf() the same cpu.
+	 */
+	bool place(const ThreadPlacement& placement)
+	{ return placement.apply(); }
+
 public:
-	shared_ptr<DispatcherDestination<Message> > createDestination(uint32 dest)
+	/**
+	 * @param lane The lane to write to, use ZILLIANS_DISPATCHER_URGENT_LANE for control messages.
+	 */
+	shared_ptr<DispatcherDestination<Message> > createDestination(uint32 dest, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		return shared_ptr<DispatcherDestination<Message> >(new DispatcherDestination<Message>(mDispatcher, mId, dest, lane));
+	}
+
+	/**
+	 * Create a destination spreading the messages over the given contexts, see DispatcherBalancedDestination.
+	 */
+	shared_ptr<DispatcherBalancedDestination<Message> > createBalancedDestination(const std::vector<uint32>& members, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		return shared_ptr<DispatcherBalancedDestination<Message> >(new DispatcherBalancedDestination<Message>(mDispatcher, mId, members, lane));
+	}
+
+	/**
+	 * Send the message to every destination in the list, waking each of them once.
+	 */
+	void multicast(const std::vector<uint32>& destinations, const Message& message, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		if(!destinations.empty())
+			mDispatcher->multicast(mId, &destinations[0], destinations.size(), &message, 1, lane);
+	}
+
+	void multicast(const std::vector<uint32>& destinations, const Message* messages, uint32 count, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		if(!destinations.empty())
+			mDispatcher->multicast(mId, &destinations[0], destinations.size(), messages, count, lane);
+	}
+
+	/**
+	 * Send the message to every other attached context.
+	 */
+	void broadcast(const Message& message, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
+	{
+		mDispatcher->broadcast(mId, &message, 1, lane);
+	}
+
+	void broadcast(const Message* messages, uint32 count, uint32 lane = ZILLIANS_DISPATCHER_DEFAULT_LANE)
 	{
-		return shared_ptr<DispatcherDestination<Message> >(new DispatcherDestination<Message>(mDispatcher, mId, dest));
+		mDispatcher->broadcast(mId, messages, count, lane);
 	}
 
 public:
@@ -69,46 +130,219 @@ public:
 	}
 
 	/**
-	 * Read the first message available from any pipes
+	 * Read the first message available from any pipes, the pipes of lower
+	 * lanes first.
 	 * @param source
 	 * @param message
 	 */
 	bool read(/*OUT*/ uint32* source, /*OUT*/ Message* message, /*INOUT*/ uint32& count, bool blocking = false)
 	{
-		uint64 signals = 0;
+		uint64 words = 0;
 		uint32 n = 0;
 
 		if(blocking)
-			signals = mSignaler.poll(mId);
+			words = mSignaler.poll(mId);
 		else
-			signals = mSignaler.check();
+			words = mSignaler.check();
 
-		if(signals)
+		while(words)
 		{
-			for(uint32 i = 0; i < mMaxThreadId && n < count; ++i)
+			uint32 w = __builtin_ctzll(words);
+			words &= words - 1;
+
+			if(n == count)
+			{
+				// not visited, keep it signaled
+				mSignaler.restore(w, 0);
+				continue;
+			}
+
+			uint64 signals = mSignaler.take(w);
+			for(uint64 pending = signals; pending && n < count; pending &= pending - 1)
 			{
-				if(signals & (uint64 (1) << i))
+				uint32 bit = __builtin_ctzll(pending);
+				uint32 lane = w / mSignaler.getSourceWordCount();
+				uint32 i = (w % mSignaler.getSourceWordCount()) * DispatcherThreadSignaler::BITS_PER_WORD + bit;
+#ifdef ZILLIANS_ENABLE_METRICS
+				uint32 first = n;
+#endif
+
+				for(; n < count; ++n)
 				{
-					for(; n < count; ++n)
+					if(!mDispatcher->read(i, mId, &message[n], lane))
 					{
-						if(!mDispatcher->read(i, mId, &message[n]))
-						{
-							signals = signals & ~(uint64(1) << i);
-							break;
-						}
-
-						if(source)
-							source[n] = i;
+						signals = signals & ~(uint64(1) << bit);
+						break;
 					}
+
+					if(source)
+						source[n] = i;
 				}
+#ifdef ZILLIANS_ENABLE_METRICS
+				BuiltinMetrics::dispatcher_pipe_depth().record(n - first);
+#endif
 			}
-			count = n;
-			mSignaler.bitOr(signals);
+
+			if(signals)
+				mSignaler.restore(w, signals);
 		}
+		count = n;
 
 		return n > 0;
 	}
 
+	/**
+	 * Consume every message available from all signaled pipes.
+	 *
+	 * The signaled bitmap is taken once and each signaled pipe is read until
+	 * it's empty, lower lanes first, calling handler(source, message) for each message. Messages
+	 * are read from the pipes directly, so there is no virtual call per message
+	 * and the handler can be inlined into the loop.
+	 *
+	 * @param handler The handler to be called, the signature must be:
+	 * @code void handler(uint32 source, Message& message); @endcode
+	 * @param blocking True to wait until any pipe is signaled.
+	 * @return The number of messages consumed.
+	 */
+	template<typename Handler>
+	uint32 drain(Handler handler, bool blocking = false)
+	{
+		uint64 words = 0;
+		uint32 n = 0;
+
+		if(blocking)
+			words = mSignaler.poll(mId);
+		else
+			words = mSignaler.check();
+
+		Message message;
+		while(words)
+		{
+			uint32 w = __builtin_ctzll(words);
+			words &= words - 1;
+
+			for(uint64 signals = mSignaler.take(w); signals; signals &= signals - 1)
+			{
+				uint32 lane = w / mSignaler.getSourceWordCount();
+				uint32 i = (w % mSignaler.getSourceWordCount()) * DispatcherThreadSignaler::BITS_PER_WORD + __builtin_ctzll(signals);
+
+				typename DispatcherNetwork<Message>::ContextPipe* pipe = mDispatcher->getPipe(i, mId, lane);
+				if(!pipe)
+					continue;
+
+#ifdef ZILLIANS_ENABLE_METRICS
+				uint32 first = n;
+#endif
+				while(pipe->read(&message))
+				{
+					handler(i, message);
+					++n;
+				}
+#ifdef ZILLIANS_ENABLE_METRICS
+				BuiltinMetrics::dispatcher_pipe_depth().record(n - first);
+#endif
+			}
+		}
+
+		return n;
+	}
+
+#ifdef ZILLIANS_HAS_COROUTINES
+	/**
+	 * @brief Reads a message for a coroutine, see read().
+	 */
+	class ReadAwaiter
+	{
+	public:
+		explicit ReadAwaiter(DispatcherThreadContext& context) : mContext(context), mWorker(NULL), mSource(0), mSpins(0)
+		{ }
+
+		bool await_ready()
+		{
+			return mContext.read(mSource, mMessage);
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			mHandle = handle;
+			mWorker = Worker::current();
+			BOOST_ASSERT(mWorker && "DispatcherThreadContext::read() must be awaited on a worker");
+			retryLater();
+		}
+
+		std::pair<uint32, Message> await_resume()
+		{
+			return std::pair<uint32, Message>(mSource, std::move(mMessage));
+		}
+
+	private:
+		struct Retry
+		{
+			explicit Retry(ReadAwaiter* a) : awaiter(a)
+			{ }
+
+			void operator() () const
+			{
+				awaiter->retry();
+			}
+
+			ReadAwaiter* awaiter;
+		};
+
+		void retry()
+		{
+			if(mContext.read(mSource, mMessage))
+				mHandle.resume();
+			else
+				retryLater();
+		}
+
+		void retryLater()
+		{
+			if(mSpins < ZILLIANS_DISPATCHER_AWAIT_SPIN_COUNT)
+			{
+				++mSpins;
+				mWorker->post(Retry(this));
+			}
+			else
+			{
+				mWorker->getTimingWheel().schedule(boost::posix_time::milliseconds(0), Retry(this));
+			}
+		}
+
+		DispatcherThreadContext& mContext;
+		Worker* mWorker;
+		std::coroutine_handle<> mHandle;
+		uint32 mSource;
+		Message mMessage;
+		uint32 mSpins;
+	};
+
+	/**
+	 * @brief Awaitable reading the first message available, resolving to the source and the message.
+	 *
+	 * It must be awaited by a coroutine running on a Worker, the thread owning
+	 * the context. The signaler has no way to resume a coroutine, so while no
+	 * message is available the coroutine polls the context from its worker,
+	 * by posting itself ZILLIANS_DISPATCHER_AWAIT_SPIN_COUNT times, then on
+	 * every tick of the worker's TimingWheel. The worker runs other handlers
+	 * in between.
+	 *
+	 * @code
+	 * co_await worker.schedule();
+	 * for(;;)
+	 * {
+	 *     std::pair<uint32, Message> received = co_await context.read();
+	 *     ...
+	 * }
+	 * @endcode
+	 */
+	ReadAwaiter read()
+	{
+		return ReadAwaiter(*this);
+	}
+#endif
+
 private:
 	uint32 mId;
 	uint32 mMaxThreadId;
@@ -26,53 +26,226 @@
 #include "core/Prerequisite.h"
 #include "core/Semaphore.h"
 #include "core/Atomic.h"
+#include "threading/AdaptiveWait.h"
+
+/**
+ * The number of empty checks before poll() stops spinning, for the
+ * spin_then_yield policy (then it yields) and the adaptive policy (then it
+ * sleeps for growing intervals up to ZILLIANS_DISPATCHER_SIGNALER_MAX_SLEEP
+ * microseconds, and finally parks on the semaphore).
+ */
+#define ZILLIANS_DISPATCHER_SIGNALER_SPIN_COUNT	1024
+#define ZILLIANS_DISPATCHER_SIGNALER_MAX_SLEEP	200
 
 namespace zillians { namespace threading {
 
+/**
+ * DispatcherThreadSignaler records which sources have signaled a destination.
+ *
+ * Sources are kept in a two-level bitmap: one word for every 64 sources, and
+ * a summary word telling which source words may be non-zero. The highest bit
+ * of the summary marks the destination as waiting on the semaphore, so up to
+ * 63 words (4032 sources) are supported.
+ *
+ * The destination takes the summary by poll() or check(), and then each
+ * marked word by take(). Bits not consumed are given back by restore().
+ *
+ * With several lanes, the source words of lane l follow those of lane l - 1,
+ * so visiting the summary from the lowest bit visits the lanes in order.
+ *
+ * How poll() waits for a signal is chosen by setIdlePolicy(), so latency
+ * critical threads can spin without any syscall while others sleep:
+ * - park: wait on the semaphore right away, the default
+ * - busy_spin: spin on the bitmap forever, never parks
+ * - spin_then_yield: spin for a while, then yield the cpu between checks
+ * - adaptive: follow AdaptiveWait, spin first and sleep for longer intervals
+ *   as polls keep coming up empty, then park; signals found right away make
+ *   the next polls spin again
+ */
 class DispatcherThreadSignaler
 {
 public:
-	DispatcherThreadSignaler() : mWaitSignal(sizeof (uint64) * 8 - 1)
-	{ mBitmap = 0; }
+	enum { BITS_PER_WORD = sizeof(uint64) * 8, MAX_WORDS = BITS_PER_WORD - 1 };
+
+	struct idle_policy_t
+	{
+		enum type { park, busy_spin, spin_then_yield, adaptive };
+	};
+
+	DispatcherThreadSignaler(uint32 sources = MAX_WORDS, uint32 lanes = 1) : mWaitSignal(MAX_WORDS),
+		mSourceWordCount((sources + BITS_PER_WORD - 1) / BITS_PER_WORD), mWordCount(mSourceWordCount * lanes),
+		mIdlePolicy(idle_policy_t::park), mSpinCount(ZILLIANS_DISPATCHER_SIGNALER_SPIN_COUNT)
+	{
+		BOOST_ASSERT(lanes >= 1);
+		BOOST_ASSERT(mWordCount >= 1 && mWordCount <= MAX_WORDS);
+
+		mSummary.store(0, std::memory_order_relaxed);
+		mWords = new std::atomic<uint64>[mWordCount];
+		for(uint32 i = 0; i < mWordCount; ++i)
+			mWords[i].store(0, std::memory_order_relaxed);
+	}
 
 	~DispatcherThreadSignaler()
-	{ }
+	{
+		SAFE_DELETE_ARRAY(mWords);
+	}
 
 public:
-	void signal(uint32 signal)
+	void signal(uint32 signal, uint32 lane = 0)
 	{
-		if(atomic::bitmap_btsr(mBitmap, signal, mWaitSignal))
-			mSemaphore.post();
+		uint32 word = lane * mSourceWordCount + signal / BITS_PER_WORD;
+
+		// only the source turning the word non-zero has to mark the summary,
+		// the others are covered either by it or by the destination taking the word,
+		// which is decided by the order of operations on the word alone; the release
+		// on the summary makes the word visible to the destination acquiring it
+		if(!atomic::bitmap_or(mWords[word], uint64(1) << (signal % BITS_PER_WORD), std::memory_order_release))
+		{
+			if(atomic::bitmap_btsr(mSummary, word, mWaitSignal, std::memory_order_acq_rel))
+				mSemaphore.post();
+		}
 	}
 
+	/**
+	 * @brief Take the summary of signaled words, wait for any signal if there's none.
+	 */
 	uint64 poll(uint32 id)
 	{
-		uint64 result = atomic::bitmap_izte(mBitmap, uint64(1) << mWaitSignal, 0);
+		UNUSED_ARGUMENT(id);
+
+		switch(mIdlePolicy)
+		{
+		case idle_policy_t::busy_spin:
+			while(!peek())
+				relax();
+			return check();
+		case idle_policy_t::spin_then_yield:
+			for(uint32 i = 0; !peek(); ++i)
+			{
+				if(i < mSpinCount)
+					relax();
+				else
+					boost::this_thread::yield();
+			}
+			return check();
+		case idle_policy_t::adaptive:
+			if(spinAdaptively())
+				return check();
+			break;
+		default:
+			break;
+		}
+
+		uint64 result = atomic::bitmap_izte(mSummary, uint64(1) << mWaitSignal, 0, std::memory_order_acq_rel);
 
 		if(!result)
 		{
 			mSemaphore.wait();
-			result = atomic::bitmap_xchg (mBitmap, 0);
+			result = atomic::bitmap_xchg(mSummary, 0, std::memory_order_acquire);
 		}
 
 		return result;
 	}
 
+	/**
+	 * @brief Take the summary of signaled words without waiting.
+	 */
 	uint64 check()
-	{ return atomic::bitmap_xchg(mBitmap, 0); }
+	{ return atomic::bitmap_xchg(mSummary, 0, std::memory_order_acquire); }
+
+	/**
+	 * @brief Take the signaled sources of the given word, the bit i stands for the source ((word % getSourceWordCount()) * 64 + i).
+	 */
+	uint64 take(uint32 word)
+	{ return atomic::bitmap_xchg(mWords[word], 0, std::memory_order_acquire); }
+
+	/**
+	 * @brief Give back sources of the given word which are not consumed yet.
+	 */
+	void restore(uint32 word, uint64 bitmap)
+	{
+		if(bitmap)
+			atomic::bitmap_or(mWords[word], bitmap, std::memory_order_relaxed);
+		atomic::bitmap_or(mSummary, uint64(1) << word, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Tell if the destination is parked in poll(), waiting for the semaphore, a snapshot for other threads.
+	 */
+	bool isParked() const
+	{ return (mSummary.load(std::memory_order_relaxed) >> mWaitSignal) & 1; }
 
-	uint64 bitOr(uint64 bitmap)
-	{ return atomic::bitmap_or(mBitmap, bitmap); }
+	uint32 getWordCount() const
+	{ return mWordCount; }
 
-	void bitReset(uint32 bit)
+	/**
+	 * @brief Get the number of words of each lane, the word w belongs to the lane (w / getSourceWordCount()).
+	 */
+	uint32 getSourceWordCount() const
+	{ return mSourceWordCount; }
+
+	/**
+	 * @brief Choose how poll() waits, must be called by the destination thread.
+	 *
+	 * @param spins The number of empty checks before yielding (spin_then_yield).
+	 */
+	void setIdlePolicy(idle_policy_t::type policy, uint32 spins = ZILLIANS_DISPATCHER_SIGNALER_SPIN_COUNT)
 	{
-		atomic::bitmap_btsr(mBitmap, bit, bit);
+		mIdlePolicy = policy;
+		mSpinCount = spins;
+	}
+
+	idle_policy_t::type getIdlePolicy() const
+	{ return mIdlePolicy; }
+
+private:
+	typedef AdaptiveWait<ZILLIANS_DISPATCHER_SIGNALER_SPIN_COUNT, 1, 1, ZILLIANS_DISPATCHER_SIGNALER_MAX_SLEEP, 20, 100> adaptive_wait_t;
+
+	inline bool peek() const
+	{ return mSummary.load(std::memory_order_relaxed) != 0; }
+
+	static inline void relax()
+	{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+		__asm__ volatile ("pause" ::: "memory");
+#endif
+	}
+
+	/**
+	 * @return True if signaled, false if it's time to park.
+	 */
+	bool spinAdaptively()
+	{
+		if(peek())
+		{
+			mAdaptiveWait.speedup();
+			return true;
+		}
+
+		while(!(mAdaptiveWait.is_waiting() && mAdaptiveWait.time_to_wait() >= ZILLIANS_DISPATCHER_SIGNALER_MAX_SLEEP))
+		{
+			mAdaptiveWait.slowdown();
+			if(mAdaptiveWait.is_waiting())
+				mAdaptiveWait.wait();
+			else
+				relax();
+
+			if(peek())
+				return true;
+		}
+		return false;
 	}
 
 private:
 	Semaphore mSemaphore;
-	uint64 mBitmap;
+	std::atomic<uint64> mSummary;
+	std::atomic<uint64>* mWords;
 	const int mWaitSignal;
+	const uint32 mSourceWordCount;
+	const uint32 mWordCount;
+	idle_policy_t::type mIdlePolicy;
+	uint32 mSpinCount;
+	adaptive_wait_t mAdaptiveWait;
 };
 
 } }
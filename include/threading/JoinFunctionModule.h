@@ -17,8 +17,16 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifndef ZILLIANS_JOINFUNCTIONMODULE_H_
+#define ZILLIANS_JOINFUNCTIONMODULE_H_
+
 #include "core/Prerequisite.h"
 #include "tbb/flow_graph.h"
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
 
 namespace zillians {
 
@@ -26,53 +34,77 @@ namespace zillians {
 // declaration
 //////////////////////////////////////////////////////////////////////////////
 
+/**
+ * JoinFunctionModule joins the messages of any number of input ports and fires the
+ * output node once every port has delivered.
+ *
+ * Instead of a tree of binary join_nodes, the r-th message of every port is stored
+ * into a preallocated slot of round r and counted by one atomic arrival counter, so
+ * a message costs one slot write and one atomic increment, and the last arrival fires
+ * the join. In batching mode, K consecutive rounds are joined at once, so the output
+ * fires once for every K messages of each port.
+ *
+ * Up to MAX_BATCHES_IN_FLIGHT batches can be collected at the same time. A port
+ * running further ahead of the others parks its messages in its overflow queue until
+ * their batch is being collected, which is slower but never blocks.
+ *
+ * @code
+ * JoinFunctionModule join(g, 3, 1, boost::bind(&gather, _1));    // 3 ports, 1 round per join
+ * make_edge(a, join.getNextInputPort());
+ * make_edge(b, join.getNextInputPort());
+ * make_edge(c, join.getNextInputPort());
+ * make_edge(join.getOutputPort(), next);
+ * @endcode
+ */
 class JoinFunctionModule
 {
 private:
     typedef int value_type;
-    const static size_t MAX_IN_PORT = 2;
-    typedef std::tuple<value_type,value_type> TP2;
-    typedef tbb::flow::join_node<TP2> JoinNodeType;
-    typedef tbb::flow::function_node<TP2, value_type> FoldNodeType;
     typedef tbb::flow::function_node<value_type, value_type> DummyFuncType;
-    static value_type dummyTP2Func(const TP2& t) { UNUSED_ARGUMENT(t); return 0; }
-    static value_type dummyFunc(const value_type& t) { UNUSED_ARGUMENT(t); return 0; }
 
 public:
+    enum { MAX_BATCHES_IN_FLIGHT = 16 };
+
+    /**
+     * Gather functor of a joined batch, the values are laid out round by round,
+     * i.e. values[round * numInputPort + port].
+     */
+    typedef boost::function<value_type(const std::vector<value_type>&)> GatherFunctor;
+
+    /**
+     * @param functor_ The body of the output node, called with 0 once per joined batch.
+     * @param numInputPort The number of input ports.
+     * @param roundsPerBatch The number of rounds joined at once.
+     */
     JoinFunctionModule(tbb::flow::graph& g,
                        boost::function<int(int)> functor_,
-                       const size_t numInputPort = 1)
+                       const size_t numInputPort = 1,
+                       const size_t roundsPerBatch = 1)
         : f(new DummyFuncType(g, 1, functor_))
         , size(numInputPort)
-        , inputPorts(size)
+        , rounds(roundsPerBatch)
         , connectingInputPort(0)
     {
-        using tbb::flow::make_edge;
-        using tbb::flow::input_port;
-        assert(numInputPort > 0);
-        createJoinLevels(g, size);
-        linkJoinLevels();
-        for(size_t i = 0; i != size; ++i)
-        {
-            inputPorts[i] = std::make_shared<DummyFuncType>(g, 1, dummyFunc);
-            JoinNodeType& b = *(levels[0].joins[i/MAX_IN_PORT].joinNode);
-            switch(i % MAX_IN_PORT)
-            {
-            case 0:
-                make_edge(*inputPorts[i], input_port<0>(b));
-                break;
-            case 1:
-                make_edge(*inputPorts[i], input_port<1>(b));
-                break;
-            }
-        }
-        if(size % MAX_IN_PORT != 0)
-        {
-            size_t i = size - 1 ;
-            DummyFuncType& a = *inputPorts[i];
-            JoinNodeType& b = *(levels[0].joins[i/MAX_IN_PORT].joinNode);
-            make_edge(a, tbb::flow::input_port<1>(b));
-        }
+        initialize(g);
+    }
+
+    /**
+     * @param numInputPort The number of input ports.
+     * @param roundsPerBatch The number of rounds joined at once.
+     * @param gather_ Called with the values of all ports once per joined batch, its result
+     * is passed to the output node.
+     */
+    JoinFunctionModule(tbb::flow::graph& g,
+                       const size_t numInputPort,
+                       const size_t roundsPerBatch,
+                       GatherFunctor gather_)
+        : f(new DummyFuncType(g, 1, forward))
+        , gather(gather_)
+        , size(numInputPort)
+        , rounds(roundsPerBatch)
+        , connectingInputPort(0)
+    {
+        initialize(g);
     }
 
     tbb::flow::function_node<value_type, value_type>& getOutputPort()
@@ -91,89 +123,144 @@ public:
     }
 
 private:
-    struct Join
+    /**
+     * The slots of one batch, reused for the batches tag, tag + MAX_BATCHES_IN_FLIGHT, ...
+     */
+    struct Batch
     {
-        Join(tbb::flow::graph& g, const size_t n)
-          : size(n)
-          , joinNode(new JoinNodeType(g))
-          , foldNode(new FoldNodeType(g, 1, dummyTP2Func))
-        {
-            tbb::flow::make_edge(*joinNode, *foldNode);
-        }
+        std::atomic<uint64> tag;
+        std::atomic<size_t> arrived;
+        std::vector<value_type> values;
+    };
 
-        size_t size;
-        std::shared_ptr<JoinNodeType> joinNode;
-        std::shared_ptr<FoldNodeType> foldNode;
+    struct Pending
+    {
+        uint64 round;
+        value_type value;
     };
 
-    struct JoinLevel
+    static value_type forward(const value_type& t) { return t; }
+
+    void initialize(tbb::flow::graph& g)
     {
-        JoinLevel(tbb::flow::graph& g, const size_t n) : size(n)
+        assert(size > 0 && rounds > 0);
+
+        batches.reset(new Batch[MAX_BATCHES_IN_FLIGHT]);
+        for(size_t i = 0; i != MAX_BATCHES_IN_FLIGHT; ++i)
         {
-            for(size_t i = 0; i != n / MAX_IN_PORT; ++i)
-            {
-                joins.push_back(Join(g, MAX_IN_PORT));
-            }
-            if(n % MAX_IN_PORT != 0)
-            {
-                joins.push_back(Join(g, n % MAX_IN_PORT));
-            }
+            batches[i].tag.store(i, std::memory_order_relaxed);
+            batches[i].arrived.store(0, std::memory_order_relaxed);
+            batches[i].values.resize(size * rounds);
         }
-        size_t size;
-        std::vector<Join> joins;
-    };
+        pendingCount.store(0, std::memory_order_relaxed);
 
-private:
-    void createJoinLevels(tbb::flow::graph& g, size_t n)
-    {
-        do {
-            levels.push_back(JoinLevel(g, n));
-            n = (n - 1) / 2 + 1;
-        } while(n > 1);
+        // ports are serial, so each port numbers its own messages without synchronization
+        portRounds.resize(size, 0);
+        pending.resize(size);
+        inputPorts.resize(size);
+        for(size_t i = 0; i != size; ++i)
+        {
+            inputPorts[i] = std::make_shared<DummyFuncType>(g, 1, [this, i](const value_type& v) -> value_type {
+                this->arrive(i, this->portRounds[i]++, v);
+                return 0;
+            });
+        }
     }
 
-    void linkTwoJoinLevels(JoinLevel& in, JoinLevel& next)
+    void arrive(size_t port, uint64 round, value_type value)
     {
-        assert(in.joins.size() == next.size);
-        for(size_t i = 0; i != in.joins.size(); ++i)
-        {
-            FoldNodeType& a = *(in.joins[i].foldNode);
-            JoinNodeType& b = *(next.joins[i/MAX_IN_PORT].joinNode);
-            switch(i % MAX_IN_PORT)
-            {
-            case 0:
-                tbb::flow::make_edge(a, tbb::flow::input_port<0>(b));
-                break;
-            case 1:
-                tbb::flow::make_edge(a, tbb::flow::input_port<1>(b));
-                break;
-            }
-        }
-        if(in.joins.size() % MAX_IN_PORT != 0)
+        if(LIKELY(place(port, round, value)))
+            return;
+
+        // the slot is still used by an older batch, park the message for fire() to place it;
+        // the count is raised before checking again, pairing with fire() raising the tag before checking the count
+        boost::mutex::scoped_lock lock(pendingLock);
+        pendingCount.fetch_add(1, std::memory_order_seq_cst);
+        if(batches[(round / rounds) % MAX_BATCHES_IN_FLIGHT].tag.load(std::memory_order_seq_cst) == round / rounds)
         {
-            size_t i = in.joins.size() - 1 ;
-            FoldNodeType& a = *(in.joins[i].foldNode);
-            JoinNodeType& b = *(next.joins[i/MAX_IN_PORT].joinNode);
-            tbb::flow::make_edge(a, tbb::flow::input_port<1>(b));
+            pendingCount.fetch_sub(1, std::memory_order_relaxed);
+            lock.unlock();
+            place(port, round, value);
+            return;
         }
+        Pending p = { round, value };
+        pending[port].push_back(p);
     }
 
-    void linkJoinLevels()
+    bool place(size_t port, uint64 round, value_type value)
     {
-        for(size_t l = 0; l < levels.size() - 1; ++l)
+        const uint64 index = round / rounds;
+        Batch& batch = batches[index % MAX_BATCHES_IN_FLIGHT];
+        if(batch.tag.load(std::memory_order_acquire) != index)
+            return false;
+
+        batch.values[(round % rounds) * size + port] = value;
+        if(batch.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == size * rounds)
+            fire(batch, index);
+        return true;
+    }
+
+    void fire(Batch& batch, uint64 index)
+    {
+        value_type result = gather ? gather(batch.values) : 0;
+
+        batch.arrived.store(0, std::memory_order_relaxed);
+        batch.tag.store(index + MAX_BATCHES_IN_FLIGHT, std::memory_order_seq_cst);
+
+        f->try_put(result);
+
+        if(UNLIKELY(pendingCount.load(std::memory_order_seq_cst) > 0))
+            replay();
+    }
+
+    /**
+     * Place the parked messages whose batch is now being collected.
+     *
+     * Each overflow queue is in round order, and the oldest batch not fired yet is
+     * always being collected, so looking at the front of each queue is enough to
+     * make progress.
+     */
+    void replay()
+    {
+        std::vector<std::pair<size_t, Pending> > ready;
         {
-            linkTwoJoinLevels(levels[l], levels[l + 1]);
+            boost::mutex::scoped_lock lock(pendingLock);
+            for(size_t port = 0; port != size; ++port)
+            {
+                std::deque<Pending>& queue = pending[port];
+                while(!queue.empty())
+                {
+                    const uint64 index = queue.front().round / rounds;
+                    if(batches[index % MAX_BATCHES_IN_FLIGHT].tag.load(std::memory_order_relaxed) != index)
+                        break;
+
+                    ready.push_back(std::make_pair(port, queue.front()));
+                    queue.pop_front();
+                    pendingCount.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
         }
-        FoldNodeType& b = *levels[levels.size()-1].joins[0].foldNode;
-        tbb::flow::make_edge(b, *f);
+
+        for(size_t i = 0; i != ready.size(); ++i)
+            place(ready[i].first, ready[i].second.round, ready[i].second.value);
     }
 
 private:
     std::shared_ptr<DummyFuncType> f;
+    GatherFunctor gather;
     size_t size;
+    size_t rounds;
     std::vector<std::shared_ptr<DummyFuncType>> inputPorts;
-    std::vector<JoinLevel> levels;
+    std::vector<uint64> portRounds;
     size_t connectingInputPort;
+
+    std::unique_ptr<Batch[]> batches;
+
+    boost::mutex pendingLock;
+    std::atomic<size_t> pendingCount;
+    std::vector<std::deque<Pending> > pending;	///< The overflow queue of each port
 };
 
-} // namespace ziilians
+} // namespace zillians
+
+#endif /* ZILLIANS_JOINFUNCTIONMODULE_H_ */
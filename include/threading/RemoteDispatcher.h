@@ -0,0 +1,527 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADING_REMOTEDISPATCHER_H_
+#define ZILLIANS_THREADING_REMOTEDISPATCHER_H_
+
+#include "core/Prerequisite.h"
+#include "core/SharedPtr.h"
+#include "core/Buffer.h"
+#include "threading/Dispatcher.h"
+#include "threading/DispatcherThreadContext.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace zillians { namespace threading {
+
+/**
+ * RemoteDispatcher extends Dispatcher to thread contexts living in other
+ * processes or on other machines.
+ *
+ * Context ids are global to the whole cluster. Contexts created here by
+ * createThreadContext() talk to each other through the pipes of an in-process
+ * Dispatcher as before, and the contexts of a peer are mapped to a TCP
+ * connection by connect(). A write to a remote context is serialized by
+ * operator<< of Buffer and sent to the peer, which deserializes it into the
+ * pipe from the remote source to the local destination, so DispatcherDestination
+ * and DispatcherThreadContext read and write the same way wherever the other
+ * side is.
+ *
+ * Writes are batched per connection: an incomplete write is only appended to
+ * the outgoing buffer, and a complete write flushes it. While a socket write is
+ * in flight, further flushes are coalesced into the next socket write.
+ *
+ * @code
+ * boost::asio::io_service io;
+ * RemoteDispatcher<Message> dispatcher(io);
+ * dispatcher.listen(tcp::endpoint(tcp::v4(), 9000));
+ * dispatcher.connect(peerContexts, peerEndpoint);
+ * // run io in a thread, then create the local contexts
+ * shared_ptr<DispatcherThreadContext<Message> > context = dispatcher.createThreadContext(0);
+ * @endcode
+ *
+ * @note Message must be default constructible and serializable by Buffer.
+ * @note All contexts of one peer must be mapped by a single connect(), so the
+ * messages of a remote source always arrive through one connection and each
+ * pipe keeps a single producer.
+ * @note connect() must be called before the contexts start writing, and the
+ * io_service must be stopped before the dispatcher is destroyed.
+ */
+template<typename Message>
+class RemoteDispatcher : public DispatcherNetwork<Message>
+{
+public:
+	typedef typename DispatcherNetwork<Message>::ContextPipe ContextPipe;
+
+	enum
+	{
+		HEADER_SIZE = 3 * sizeof(uint32),		///< Frame header: source, destination, then length with the lane and the incomplete flag
+		MAX_BATCH_SIZE = 64 * 1024,			///< Outgoing bytes after which an incomplete batch is flushed anyway
+		MAX_FRAME_SIZE = 64 * 1024 * 1024,		///< Larger frames are taken as a corrupted stream and close the connection
+		RECEIVE_CHUNK_SIZE = 64 * 1024,
+	};
+
+private:
+	static const uint32 INCOMPLETE_FLAG = 0x80000000u;
+	static const uint32 LANE_SHIFT = 28;
+	static const uint32 LANE_MASK = 0x70000000u;
+	static const uint32 LENGTH_MASK = ~(INCOMPLETE_FLAG | LANE_MASK);
+	static const uint32 BROADCAST_DESTINATION = 0xFFFFFFFFu;
+
+	class Connection : public enable_shared_from_this<Connection>
+	{
+	public:
+		Connection(RemoteDispatcher& dispatcher, boost::asio::io_service& io_service) :
+			mDispatcher(dispatcher), mSocket(io_service), mStrand(io_service),
+			mPending(&mBuffers[0]), mSending(&mBuffers[1]), mWriting(false), mConnected(false)
+		{ }
+
+	public:
+		boost::asio::ip::tcp::socket& socket()
+		{ return mSocket; }
+
+		bool isConnected()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mConnected;
+		}
+
+		void start()
+		{
+			boost::system::error_code ignored;
+			mSocket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				mConnected = true;
+			}
+			mStrand.dispatch(boost::bind(&Connection::receive, this->shared_from_this()));
+		}
+
+		void close()
+		{
+			mStrand.dispatch(boost::bind(&Connection::shutdown, this->shared_from_this()));
+		}
+
+		/**
+		 * Append the frames to the outgoing batch, the writes to a closed connection are dropped.
+		 *
+		 * @return False if the connection is closed.
+		 */
+		bool append(uint32 source, uint32 destination, const Message* messages, uint32 count, bool incomplete, uint32 lane)
+		{
+			bool full = false;
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				if(UNLIKELY(!mConnected))
+					return false;
+
+				for(uint32 i = 0; i < count; ++i)
+				{
+					uint32 flags = lane << LANE_SHIFT;
+					if(incomplete || i + 1 < count)
+						flags |= INCOMPLETE_FLAG;
+
+					// the length is patched after the message is written, so it's serialized only once
+					*mPending << source << destination;
+					std::size_t mark = mPending->beginLengthPrefix();
+					*mPending << messages[i];
+					uint32 length = mPending->endLengthPrefix(mark, flags);
+					BOOST_ASSERT(length <= MAX_FRAME_SIZE);
+					UNUSED_ARGUMENT(length);
+				}
+				full = (mPending->dataSize() >= MAX_BATCH_SIZE);
+			}
+
+			if(UNLIKELY(full))
+				flush();
+			return true;
+		}
+
+		/**
+		 * Send the outgoing batch unless a socket write is in flight, in which
+		 * case the batch goes out right after it completes.
+		 */
+		void flush()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			if(mWriting || mPending->dataSize() == 0)
+				return;
+
+			mWriting = true;
+			mStrand.post(boost::bind(&Connection::send, this->shared_from_this()));
+		}
+
+	private:
+		void send()
+		{
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				std::swap(mPending, mSending);
+			}
+
+			boost::asio::async_write(mSocket,
+					boost::asio::buffer(mSending->rptr(), mSending->dataSize()),
+					mStrand.wrap(boost::bind(&Connection::handleSend, this->shared_from_this(), boost::asio::placeholders::error)));
+		}
+
+		void handleSend(const boost::system::error_code& error)
+		{
+			mSending->clear();
+			if(error)
+			{
+				shutdown();
+				return;
+			}
+
+			bool more = false;
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				more = (mPending->dataSize() > 0);
+				if(!more)
+					mWriting = false;
+			}
+
+			if(more)
+				send();
+		}
+
+		void receive()
+		{
+			mReceived.reserve(RECEIVE_CHUNK_SIZE);
+			mSocket.async_read_some(
+					boost::asio::buffer(mReceived.wptr(), mReceived.freeSize()),
+					mStrand.wrap(boost::bind(&Connection::handleReceive, this->shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+		}
+
+		void handleReceive(const boost::system::error_code& error, std::size_t bytes_transferred)
+		{
+			if(error)
+			{
+				shutdown();
+				return;
+			}
+
+			mReceived.wskip(bytes_transferred);
+
+			while(mReceived.dataSize() >= HEADER_SIZE)
+			{
+				uint32 length = 0;
+				::memcpy(&length, mReceived.rptr() + 2 * sizeof(uint32), sizeof(uint32));
+
+				bool incomplete = (length & INCOMPLETE_FLAG);
+				uint32 lane = (length & LANE_MASK) >> LANE_SHIFT;
+				length &= LENGTH_MASK;
+				if(UNLIKELY(length > MAX_FRAME_SIZE || lane >= ZILLIANS_DISPATCHER_LANES))
+				{
+					shutdown();
+					return;
+				}
+
+				if(mReceived.dataSize() < HEADER_SIZE + length)
+					break;
+
+				uint32 source = 0;
+				uint32 destination = 0;
+				mReceived >> source >> destination >> length;
+
+				std::size_t end = mReceived.rpos() + (length & LENGTH_MASK);
+				Message message;
+				mReceived >> message;
+				if(UNLIKELY(mReceived.rpos() != end))
+				{
+					shutdown();
+					return;
+				}
+
+				mDispatcher.deliver(source, destination, message, incomplete, lane);
+			}
+
+			if(mReceived.dataSize() == 0)
+				mReceived.clear();
+			else
+				mReceived.crunch();
+
+			receive();
+		}
+
+		void shutdown()
+		{
+			boost::system::error_code ignored;
+			mSocket.close(ignored);
+
+			boost::mutex::scoped_lock lock(mMutex);
+			mConnected = false;
+			mWriting = false;
+			mPending->clear();
+		}
+
+	private:
+		RemoteDispatcher& mDispatcher;
+		boost::asio::ip::tcp::socket mSocket;
+		boost::asio::io_service::strand mStrand;
+
+		boost::mutex mMutex;	///< Guards the outgoing batch and the connection state
+		Buffer mBuffers[2];
+		Buffer* mPending;		///< Batch being appended to by the writers
+		Buffer* mSending;		///< Batch being written to the socket, only touched in the strand
+		bool mWriting;
+		bool mConnected;
+
+		Buffer mReceived;		///< Partially received frames, only touched in the strand
+	};
+
+public:
+	RemoteDispatcher(boost::asio::io_service& io_service, uint32 max_dispatcher_threads = ZILLIANS_DISPATCHER_DEFAULT_THREADS) :
+		mIoService(io_service), mLocal(max_dispatcher_threads), mRoutes(max_dispatcher_threads), mAcceptor(io_service)
+	{ }
+
+	~RemoteDispatcher()
+	{
+		boost::system::error_code ignored;
+		mAcceptor.close(ignored);
+
+		boost::mutex::scoped_lock lock(mConnectionsMutex);
+		for(typename std::vector<shared_ptr<Connection> >::iterator i = mConnections.begin(); i != mConnections.end(); ++i)
+			(*i)->socket().close(ignored);
+	}
+
+public:
+	/**
+	 * Accept connections of peers on the given endpoint, the messages sent by them are delivered to the local contexts.
+	 *
+	 * @throw boost::system::system_error if the endpoint can't be bound.
+	 */
+	void listen(const boost::asio::ip::tcp::endpoint& endpoint)
+	{
+		mAcceptor.open(endpoint.protocol());
+		mAcceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+		mAcceptor.bind(endpoint);
+		mAcceptor.listen();
+		accept();
+	}
+
+	boost::asio::ip::tcp::endpoint getListenEndpoint() const
+	{
+		return mAcceptor.local_endpoint();
+	}
+
+	/**
+	 * Connect to the peer hosting the given contexts, and route the writes to them through the connection.
+	 *
+	 * @throw boost::system::system_error if the peer can't be reached.
+	 */
+	void connect(const std::vector<uint32>& contexts, const boost::asio::ip::tcp::endpoint& endpoint)
+	{
+		shared_ptr<Connection> connection(new Connection(*this, mIoService));
+		connection->socket().connect(endpoint);
+		connection->start();
+
+		for(std::vector<uint32>::const_iterator i = contexts.begin(); i != contexts.end(); ++i)
+		{
+			BOOST_ASSERT(*i < mRoutes.size());
+			BOOST_ASSERT(!mRoutes[*i] && "context already mapped");
+			BOOST_ASSERT(!mLocal.isAttached(*i) && "context already attached locally");
+			mRoutes[*i] = connection;
+		}
+
+		boost::mutex::scoped_lock lock(mConnectionsMutex);
+		mConnections.push_back(connection);
+		mPeers.push_back(connection);
+	}
+
+	/**
+	 * Check if the writes to the given context can be delivered, that is the
+	 * context is local or the connection to its peer is still up.
+	 */
+	bool isReachable(uint32 contextId)
+	{
+		return mRoutes[contextId] ? mRoutes[contextId]->isConnected() : mLocal.isAttached(contextId);
+	}
+
+	/**
+	 * Create a local context, the id must be given since it's global to the cluster.
+	 */
+	shared_ptr<DispatcherThreadContext<Message> > createThreadContext(uint32 contextId)
+	{
+		BOOST_ASSERT(!mRoutes[contextId] && "context is mapped to a peer");
+		return mLocal.createThreadContext(contextId, this);
+	}
+
+	virtual void distroyThreadContext(uint32 contextId)
+	{
+		mLocal.distroyThreadContext(contextId);
+	}
+
+public:
+	virtual bool write(uint32 source, uint32 destination, const Message& message, bool incomplete, uint32 lane)
+	{
+		Connection* route = mRoutes[destination].get();
+		if(LIKELY(!route))
+			return mLocal.write(source, destination, message, incomplete, lane);
+
+		if(!route->append(source, destination, &message, 1, incomplete, lane))
+			return false;
+		if(!incomplete)
+			route->flush();
+		return true;
+	}
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	virtual bool write(uint32 source, uint32 destination, Message&& message, bool incomplete, uint32 lane)
+	{
+		Connection* route = mRoutes[destination].get();
+		if(LIKELY(!route))
+			return mLocal.write(source, destination, std::move(message), incomplete, lane);
+
+		if(!route->append(source, destination, &message, 1, incomplete, lane))
+			return false;
+		if(!incomplete)
+			route->flush();
+		return true;
+	}
+#endif
+
+	/**
+	 * The remote destinations are appended to the batches of their connections
+	 * first and flushed afterwards, so each connection is written once.
+	 */
+	virtual void multicast(uint32 source, const uint32* destinations, uint32 destination_count, const Message* messages, uint32 count, uint32 lane)
+	{
+		if(!count)
+			return;
+
+		std::vector<uint32> locals;
+		locals.reserve(destination_count);
+
+		for(uint32 i = 0; i < destination_count; ++i)
+		{
+			Connection* route = mRoutes[destinations[i]].get();
+			if(route)
+				route->append(source, destinations[i], messages, count, false, lane);
+			else
+				locals.push_back(destinations[i]);
+		}
+
+		if(!locals.empty())
+			mLocal.multicast(source, &locals[0], locals.size(), messages, count, lane);
+
+		for(uint32 i = 0; i < destination_count; ++i)
+		{
+			Connection* route = mRoutes[destinations[i]].get();
+			if(route)
+				route->flush();
+		}
+	}
+
+	/**
+	 * The messages are sent once to each peer, which broadcasts them to its own contexts.
+	 */
+	virtual void broadcast(uint32 source, const Message* messages, uint32 count, uint32 lane)
+	{
+		if(!count)
+			return;
+
+		mLocal.broadcast(source, messages, count, lane);
+
+		for(typename std::vector<shared_ptr<Connection> >::iterator i = mPeers.begin(); i != mPeers.end(); ++i)
+		{
+			(*i)->append(source, BROADCAST_DESTINATION, messages, count, false, lane);
+			(*i)->flush();
+		}
+	}
+
+	virtual bool read(uint32 source, uint32 destination, Message* message, uint32 lane)
+	{
+		return mLocal.read(source, destination, message, lane);
+	}
+
+	virtual ContextPipe* getPipe(uint32 source, uint32 destination, uint32 lane)
+	{
+		return mLocal.getPipe(source, destination, lane);
+	}
+
+	virtual DispatcherThreadSignaler* getLocalSignaler(uint32 contextId)
+	{
+		return mLocal.getLocalSignaler(contextId);
+	}
+
+private:
+	void accept()
+	{
+		shared_ptr<Connection> connection(new Connection(*this, mIoService));
+		mAcceptor.async_accept(connection->socket(), boost::bind(&RemoteDispatcher::handleAccept, this, connection, boost::asio::placeholders::error));
+	}
+
+	void handleAccept(shared_ptr<Connection> connection, const boost::system::error_code& error)
+	{
+		if(error)
+			return;
+
+		connection->start();
+		{
+			boost::mutex::scoped_lock lock(mConnectionsMutex);
+			mConnections.push_back(connection);
+		}
+		accept();
+	}
+
+	/**
+	 * Called in the strand of the connection the message arrived from, which
+	 * is the only producer of the pipes of the remote source.
+	 */
+	void deliver(uint32 source, uint32 destination, Message& message, bool incomplete, uint32 lane)
+	{
+		if(UNLIKELY(source >= mRoutes.size()))
+			return;
+
+		if(destination == BROADCAST_DESTINATION)
+		{
+			mLocal.broadcast(source, &message, 1, lane);
+			return;
+		}
+
+		// drop the messages to contexts not attached, like the writes to a closed connection
+		if(UNLIKELY(!mLocal.isAttached(destination)))
+			return;
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+		mLocal.write(source, destination, std::move(message), incomplete, lane);
+#else
+		mLocal.write(source, destination, message, incomplete, lane);
+#endif
+	}
+
+private:
+	boost::asio::io_service& mIoService;
+	Dispatcher<Message> mLocal;
+	std::vector<shared_ptr<Connection> > mRoutes;	///< The connection of each remote context, NULL for local ones
+
+	boost::mutex mConnectionsMutex;
+	std::vector<shared_ptr<Connection> > mConnections;	///< All connections, to close them on destruction
+	std::vector<shared_ptr<Connection> > mPeers;		///< The connections made by connect(), to broadcast to
+
+	boost::asio::ip::tcp::acceptor mAcceptor;
+};
+
+} }
+
+#endif /* ZILLIANS_THREADING_REMOTEDISPATCHER_H_ */
@@ -0,0 +1,630 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADING_SHAREDMEMORYDISPATCHER_H_
+#define ZILLIANS_THREADING_SHAREDMEMORYDISPATCHER_H_
+
+#include "core/Prerequisite.h"
+#include "core/SharedPtr.h"
+#include "core/Atomic.h"
+#include "core/Futex.h"
+#include "core/SharedMemorySegment.h"
+#include "threading/DispatcherNetwork.h"
+#include "threading/DispatcherDestination.h"
+
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_pod.hpp>
+#include <stdexcept>
+#include <vector>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+
+#define ZILLIANS_SHARED_DISPATCHER_DEFAULT_CONTEXTS		16
+#define ZILLIANS_SHARED_DISPATCHER_DEFAULT_CAPACITY		(4 * ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE)
+
+namespace zillians { namespace threading {
+
+namespace detail {
+
+/**
+ * The same two-level bitmap as DispatcherThreadSignaler, living in shared
+ * memory. The destination parks on a process-shared futex instead of a
+ * semaphore, and always with a timeout, so a source dying right before the
+ * wake-up costs a spurious return instead of a hang.
+ */
+struct SharedMemorySignaler
+{
+	enum { BITS_PER_WORD = sizeof(uint64) * 8, MAX_WORDS = BITS_PER_WORD - 1, PARK_TIMEOUT_MS = 100 };
+
+	std::atomic<uint64> summary;
+	std::atomic<uint32> sequence;	///< Bumped by the source clearing the waiting bit, then woken
+	std::atomic<uint64> words[MAX_WORDS];
+
+	void reset()
+	{
+		for(uint32 i = 0; i < MAX_WORDS; ++i)
+			words[i].store(0, std::memory_order_relaxed);
+		summary.store(0, std::memory_order_release);
+	}
+
+	void signal(uint32 source)
+	{
+		uint32 word = source / BITS_PER_WORD;
+		if(!atomic::bitmap_or(words[word], uint64(1) << (source % BITS_PER_WORD), std::memory_order_release))
+		{
+			if(atomic::bitmap_btsr(summary, word, MAX_WORDS, std::memory_order_acq_rel))
+			{
+				sequence.fetch_add(1, std::memory_order_release);
+				futex::wake_all(sequence, true);
+			}
+		}
+	}
+
+	uint64 poll()
+	{
+		uint32 seen = sequence.load(std::memory_order_acquire);
+		uint64 result = atomic::bitmap_izte(summary, uint64(1) << MAX_WORDS, 0, std::memory_order_acq_rel);
+
+		if(!result)
+		{
+			boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds((long)PARK_TIMEOUT_MS);
+			while(sequence.load(std::memory_order_acquire) == seen)
+			{
+				if(!futex::wait(sequence, seen, &deadline, true))
+					break;
+			}
+			result = atomic::bitmap_xchg(summary, 0, std::memory_order_acquire);
+		}
+
+		// the waiting bit is left set if we timed out
+		return result & ~(uint64(1) << MAX_WORDS);
+	}
+
+	uint64 check()
+	{ return atomic::bitmap_xchg(summary, 0, std::memory_order_acquire) & ~(uint64(1) << MAX_WORDS); }
+
+	uint64 take(uint32 word)
+	{ return atomic::bitmap_xchg(words[word], 0, std::memory_order_acquire); }
+
+	void restore(uint32 word, uint64 bitmap)
+	{
+		if(bitmap)
+			atomic::bitmap_or(words[word], bitmap, std::memory_order_relaxed);
+		atomic::bitmap_or(summary, uint64(1) << word, std::memory_order_release);
+	}
+};
+
+}
+
+template<typename Message>
+class SharedMemoryThreadContext;
+
+/**
+ * SharedMemoryDispatcher connects thread contexts of different processes on
+ * the same host through a POSIX shared memory segment.
+ *
+ * Every pair of contexts has a single-producer single-consumer ring of POD
+ * messages in the segment. Like AtomicPipe, an incomplete write only stages
+ * the message, and the complete write publishes everything staged at once and
+ * signals the destination, so a batch costs one release store and at most one
+ * wake-up. The destination is signaled through a two-level bitmap mirroring
+ * DispatcherThreadSignaler, parked on a process-shared futex.
+ *
+ * There's a single ring per pair, so the lane parameters of DispatcherNetwork
+ * are ignored and urgent messages are delivered in order with the others.
+ *
+ * Context ids are global to all processes opening the same name. A process
+ * attaches a context by createThreadContext() and detaches it by releasing
+ * the context; a context left attached by a process that died is taken over
+ * by the next process attaching it. Writes to a detached context are dropped.
+ *
+ * @code
+ * SharedMemoryDispatcher<Message> dispatcher("/my-service");
+ * shared_ptr<SharedMemoryThreadContext<Message> > context = dispatcher.createThreadContext(0);
+ * context->createDestination(1)->write(message);
+ * @endcode
+ *
+ * @note The rings are bounded, a writer to a full ring publishes what it has
+ * staged and yields until the destination catches up or detaches.
+ * @note Every process must open the segment with the same parameters and the
+ * same Message type, and the segment outlives the processes until remove().
+ */
+template<typename Message>
+class SharedMemoryDispatcher : public DispatcherNetwork<Message>
+{
+	BOOST_STATIC_ASSERT(boost::is_pod<Message>::value);
+
+public:
+	typedef typename DispatcherNetwork<Message>::ContextPipe ContextPipe;
+
+	enum { CACHE_LINE_SIZE = 64, MAX_CONTEXTS = detail::SharedMemorySignaler::MAX_WORDS * detail::SharedMemorySignaler::BITS_PER_WORD };
+
+private:
+	static const uint32 MAGIC = 0x5a534d44;	// "ZSMD"
+	static const uint32 VERSION = 1;
+
+	struct Header
+	{
+		std::atomic<uint32> ready;	///< MAGIC once the creator has initialized the segment
+		uint32 version;
+		uint32 contexts;
+		uint32 capacity;
+		uint32 message_size;
+	};
+
+	struct ContextSlot
+	{
+		std::atomic<uint32> owner;		///< Process id of the attached process, or zero
+		std::atomic<uint32> active;		///< Set once the rings are reset, writes are dropped while it's clear
+		detail::SharedMemorySignaler signaler;
+	};
+
+	/**
+	 * The producer and the consumer side are kept on different cache lines,
+	 * and the messages follow the ring header.
+	 */
+	struct Ring
+	{
+		std::atomic<uint32> tail;	///< End of the published messages
+		uint32 staged;				///< End of the staged messages, only touched by the producer
+		uint32 cached_head;			///< Last head seen by the producer
+		byte padding0[CACHE_LINE_SIZE - 3 * sizeof(uint32)];
+		std::atomic<uint32> head;	///< Next message to read, only written by the consumer
+		byte padding1[CACHE_LINE_SIZE - sizeof(uint32)];
+	};
+
+public:
+	/**
+	 * @brief Open the segment of the given name, creating it if it's the first process.
+	 *
+	 * @param name The name of the POSIX shared memory object, like "/my-service".
+	 * @param max_contexts The number of contexts, at most MAX_CONTEXTS.
+	 * @param capacity The number of messages in each ring, must be a power of two.
+	 *
+	 * @throw std::runtime_error if the segment can't be mapped, or was created with different parameters.
+	 */
+	SharedMemoryDispatcher(const std::string& name, uint32 max_contexts = ZILLIANS_SHARED_DISPATCHER_DEFAULT_CONTEXTS, uint32 capacity = ZILLIANS_SHARED_DISPATCHER_DEFAULT_CAPACITY) :
+		mContexts(max_contexts), mCapacity(capacity),
+		mSlotStride(align(sizeof(ContextSlot))), mRingStride(align(sizeof(Ring) + capacity * sizeof(Message))),
+		mSegment(name, layoutSize(max_contexts, capacity))
+	{
+		BOOST_ASSERT(max_contexts >= 1 && max_contexts <= MAX_CONTEXTS);
+		BOOST_ASSERT(capacity >= 1 && (capacity & (capacity - 1)) == 0);
+
+		Header* header = getHeader();
+		if(mSegment.isCreator())
+		{
+			// the new segment is zero-filled, so every slot starts detached and every ring empty
+			header->version = VERSION;
+			header->contexts = max_contexts;
+			header->capacity = capacity;
+			header->message_size = sizeof(Message);
+			header->ready.store(MAGIC, std::memory_order_release);
+		}
+		else
+		{
+			for(int i = 0; header->ready.load(std::memory_order_acquire) != MAGIC; ++i)
+			{
+				if(i == 1000)
+					throw std::runtime_error("shared memory \"" + name + "\" is not initialized");
+				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			}
+
+			if(header->version != VERSION || header->contexts != max_contexts || header->capacity != capacity || header->message_size != sizeof(Message))
+				throw std::runtime_error("shared memory \"" + name + "\" was created with different parameters");
+		}
+	}
+
+	~SharedMemoryDispatcher()
+	{ }
+
+public:
+	/**
+	 * @brief Remove the segment from the system, the processes having it open keep using it.
+	 */
+	static bool remove(const std::string& name)
+	{
+		return SharedMemorySegment::remove(name);
+	}
+
+	/**
+	 * @brief Attach the context to this process.
+	 *
+	 * The messages left in the rings to the context by its previous owner are discarded.
+	 *
+	 * @return The context, or NULL if it's attached by a live process.
+	 */
+	shared_ptr<SharedMemoryThreadContext<Message> > createThreadContext(uint32 contextId)
+	{
+		BOOST_ASSERT(contextId < mContexts);
+
+		ContextSlot& slot = getSlot(contextId);
+		uint32 self = (uint32)::getpid();
+		uint32 owner = 0;
+		while(!slot.owner.compare_exchange_strong(owner, self, std::memory_order_acq_rel))
+		{
+			// take over the context of a process gone without detaching
+			if(owner == self || ::kill((pid_t)owner, 0) == 0 || errno != ESRCH)
+				return shared_ptr<SharedMemoryThreadContext<Message> >();
+		}
+
+		slot.active.store(0, std::memory_order_relaxed);
+		slot.signaler.reset();
+		for(uint32 i = 0; i < mContexts; ++i)
+		{
+			Ring& incoming = getRing(i, contextId);
+			incoming.head.store(incoming.tail.load(std::memory_order_acquire), std::memory_order_release);
+
+			Ring& outgoing = getRing(contextId, i);
+			outgoing.staged = outgoing.tail.load(std::memory_order_relaxed);
+			outgoing.cached_head = outgoing.head.load(std::memory_order_acquire);
+		}
+		slot.active.store(1, std::memory_order_release);
+
+		return shared_ptr<SharedMemoryThreadContext<Message> >(new SharedMemoryThreadContext<Message>(this, contextId));
+	}
+
+	virtual void distroyThreadContext(uint32 contextId)
+	{
+		ContextSlot& slot = getSlot(contextId);
+		BOOST_ASSERT(slot.owner.load(std::memory_order_relaxed) == (uint32)::getpid());
+
+		slot.active.store(0, std::memory_order_release);
+		slot.owner.store(0, std::memory_order_release);
+	}
+
+	bool isAttached(uint32 contextId)
+	{
+		return contextId < mContexts && getSlot(contextId).active.load(std::memory_order_acquire);
+	}
+
+	uint32 getMaxThreadContextCount() const
+	{
+		return mContexts;
+	}
+
+	detail::SharedMemorySignaler& getSignaler(uint32 contextId)
+	{
+		return getSlot(contextId).signaler;
+	}
+
+	/**
+	 * The contexts of a shared memory dispatcher are signaled through the segment, not by a DispatcherThreadSignaler.
+	 */
+	virtual DispatcherThreadSignaler* getLocalSignaler(uint32 contextId)
+	{
+		UNUSED_ARGUMENT(contextId);
+		return NULL;
+	}
+
+public:
+	virtual bool write(uint32 source, uint32 destination, const Message& message, bool incomplete, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		if(!stage(source, destination, message))
+			return false;
+		if(!incomplete)
+			commit(source, destination);
+		return true;
+	}
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	virtual bool write(uint32 source, uint32 destination, Message&& message, bool incomplete, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		if(!stage(source, destination, message))
+			return false;
+		if(!incomplete)
+			commit(source, destination);
+		return true;
+	}
+#endif
+
+	virtual void multicast(uint32 source, const uint32* destinations, uint32 destination_count, const Message* messages, uint32 count, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		if(!count)
+			return;
+
+		for(uint32 i = 0; i < destination_count; ++i)
+		{
+			for(uint32 j = 0; j < count; ++j)
+				stage(source, destinations[i], messages[j]);
+		}
+
+		for(uint32 i = 0; i < destination_count; ++i)
+			commit(source, destinations[i]);
+	}
+
+	/**
+	 * @note A context attached or detached concurrently may or may not receive the messages.
+	 */
+	virtual void broadcast(uint32 source, const Message* messages, uint32 count, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		if(!count)
+			return;
+
+		for(uint32 i = 0; i < mContexts; ++i)
+		{
+			if(i != source)
+			{
+				for(uint32 j = 0; j < count; ++j)
+					stage(source, i, messages[j]);
+			}
+		}
+
+		for(uint32 i = 0; i < mContexts; ++i)
+		{
+			if(i != source)
+				commit(source, i);
+		}
+	}
+
+	virtual bool read(uint32 source, uint32 destination, Message* message, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		Ring& ring = getRing(source, destination);
+
+		uint32 head = ring.head.load(std::memory_order_relaxed);
+		if(head == ring.tail.load(std::memory_order_acquire))
+			return false;
+
+		*message = getMessages(ring)[head & (mCapacity - 1)];
+		ring.head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief There's no AtomicPipe in shared memory, read the messages by read() instead.
+	 */
+	virtual ContextPipe* getPipe(uint32 source, uint32 destination, uint32 lane)
+	{
+		UNUSED_ARGUMENT(lane);
+		UNUSED_ARGUMENT(source);
+		UNUSED_ARGUMENT(destination);
+		return NULL;
+	}
+
+private:
+	/**
+	 * Only the thread owning the source context touches the producer side of its rings.
+	 *
+	 * @return False if the message is dropped since the destination is detached.
+	 */
+	inline bool stage(uint32 source, uint32 destination, const Message& message)
+	{
+		if(UNLIKELY(!isAttached(destination)))
+			return false;
+
+		Ring& ring = getRing(source, destination);
+		if(UNLIKELY(ring.staged - ring.cached_head == mCapacity))
+		{
+			if(!waitForSpace(ring, source, destination))
+				return false;
+		}
+
+		getMessages(ring)[ring.staged & (mCapacity - 1)] = message;
+		++ring.staged;
+		return true;
+	}
+
+	inline void commit(uint32 source, uint32 destination)
+	{
+		Ring& ring = getRing(source, destination);
+		if(ring.staged != ring.tail.load(std::memory_order_relaxed))
+		{
+			ring.tail.store(ring.staged, std::memory_order_release);
+			getSlot(destination).signaler.signal(source);
+		}
+	}
+
+	bool waitForSpace(Ring& ring, uint32 source, uint32 destination)
+	{
+		// the destination can only make room for what's published
+		commit(source, destination);
+
+		while(true)
+		{
+			ring.cached_head = ring.head.load(std::memory_order_acquire);
+			if(ring.staged - ring.cached_head < mCapacity)
+				return true;
+			if(!isAttached(destination))
+				return false;
+			boost::this_thread::yield();
+		}
+	}
+
+	static inline std::size_t align(std::size_t size)
+	{
+		return (size + CACHE_LINE_SIZE - 1) & ~(std::size_t)(CACHE_LINE_SIZE - 1);
+	}
+
+	static std::size_t layoutSize(uint32 contexts, uint32 capacity)
+	{
+		return align(sizeof(Header)) + contexts * align(sizeof(ContextSlot)) + contexts * contexts * align(sizeof(Ring) + capacity * sizeof(Message));
+	}
+
+	inline Header* getHeader()
+	{
+		return reinterpret_cast<Header*>(mSegment.data());
+	}
+
+	inline ContextSlot& getSlot(uint32 contextId)
+	{
+		return *reinterpret_cast<ContextSlot*>(mSegment.data() + align(sizeof(Header)) + contextId * mSlotStride);
+	}
+
+	inline Ring& getRing(uint32 source, uint32 destination)
+	{
+		std::size_t rings = align(sizeof(Header)) + mContexts * mSlotStride;
+		return *reinterpret_cast<Ring*>(mSegment.data() + rings + (source * mContexts + destination) * mRingStride);
+	}
+
+	inline Message* getMessages(Ring& ring)
+	{
+		return reinterpret_cast<Message*>(reinterpret_cast<byte*>(&ring) + sizeof(Ring));
+	}
+
+private:
+	const uint32 mContexts;
+	const uint32 mCapacity;
+	const std::size_t mSlotStride;
+	const std::size_t mRingStride;
+	SharedMemorySegment mSegment;
+};
+
+/**
+ * The context of a thread attached to a SharedMemoryDispatcher, reading the
+ * same way as DispatcherThreadContext.
+ */
+template<typename Message>
+class SharedMemoryThreadContext
+{
+public:
+	SharedMemoryThreadContext(SharedMemoryDispatcher<Message>* dispatcher, uint32 id) : mId(id), mDispatcher(dispatcher), mSignaler(dispatcher->getSignaler(id))
+	{ }
+
+	~SharedMemoryThreadContext()
+	{
+		mDispatcher->distroyThreadContext(mId);
+	}
+
+public:
+	uint32 getIdentity() const
+	{ return mId; }
+
+	DispatcherNetwork<Message>* getDispatcherNetwork() const
+	{ return mDispatcher; }
+
+public:
+	shared_ptr<DispatcherDestination<Message> > createDestination(uint32 dest)
+	{
+		return shared_ptr<DispatcherDestination<Message> >(new DispatcherDestination<Message>(mDispatcher, mId, dest));
+	}
+
+	void multicast(const std::vector<uint32>& destinations, const Message& message)
+	{
+		if(!destinations.empty())
+			mDispatcher->multicast(mId, &destinations[0], destinations.size(), &message, 1, ZILLIANS_DISPATCHER_DEFAULT_LANE);
+	}
+
+	void broadcast(const Message& message)
+	{
+		mDispatcher->broadcast(mId, &message, 1, ZILLIANS_DISPATCHER_DEFAULT_LANE);
+	}
+
+public:
+	bool read(/*OUT*/ uint32& source, /*OUT*/ Message& message, bool blocking = false)
+	{
+		uint32 n = 1;
+		return read(&source, &message, n, blocking);
+	}
+
+	/**
+	 * Read the first messages available from any rings.
+	 *
+	 * @note A blocking read may return false, on a timeout of the park.
+	 */
+	bool read(/*OUT*/ uint32* source, /*OUT*/ Message* message, /*INOUT*/ uint32& count, bool blocking = false)
+	{
+		uint64 words = blocking ? mSignaler.poll() : mSignaler.check();
+		uint32 n = 0;
+
+		while(words)
+		{
+			uint32 w = __builtin_ctzll(words);
+			words &= words - 1;
+
+			if(n == count)
+			{
+				// not visited, keep it signaled
+				mSignaler.restore(w, 0);
+				continue;
+			}
+
+			uint64 signals = mSignaler.take(w);
+			for(uint64 pending = signals; pending && n < count; pending &= pending - 1)
+			{
+				uint32 bit = __builtin_ctzll(pending);
+				uint32 i = w * detail::SharedMemorySignaler::BITS_PER_WORD + bit;
+
+				for(; n < count; ++n)
+				{
+					if(!mDispatcher->read(i, mId, &message[n], ZILLIANS_DISPATCHER_DEFAULT_LANE))
+					{
+						signals = signals & ~(uint64(1) << bit);
+						break;
+					}
+
+					if(source)
+						source[n] = i;
+				}
+			}
+
+			if(signals)
+				mSignaler.restore(w, signals);
+		}
+		count = n;
+
+		return n > 0;
+	}
+
+	/**
+	 * Consume every message available from all signaled rings, calling
+	 * handler(source, message) for each of them.
+	 *
+	 * @return The number of messages consumed.
+	 */
+	template<typename Handler>
+	uint32 drain(Handler handler, bool blocking = false)
+	{
+		uint64 words = blocking ? mSignaler.poll() : mSignaler.check();
+		uint32 n = 0;
+
+		Message message;
+		while(words)
+		{
+			uint32 w = __builtin_ctzll(words);
+			words &= words - 1;
+
+			for(uint64 signals = mSignaler.take(w); signals; signals &= signals - 1)
+			{
+				uint32 i = w * detail::SharedMemorySignaler::BITS_PER_WORD + __builtin_ctzll(signals);
+				while(mDispatcher->read(i, mId, &message, ZILLIANS_DISPATCHER_DEFAULT_LANE))
+				{
+					handler(i, message);
+					++n;
+				}
+			}
+		}
+
+		return n;
+	}
+
+private:
+	uint32 mId;
+	SharedMemoryDispatcher<Message>* mDispatcher;
+	detail::SharedMemorySignaler& mSignaler;
+};
+
+} }
+
+#endif /* ZILLIANS_THREADING_SHAREDMEMORYDISPATCHER_H_ */
@@ -0,0 +1,480 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_STACKFULCOROUTINE_H_
+#define ZILLIANS_STACKFULCOROUTINE_H_
+
+#include "core/Prerequisite.h"
+#include "core/Worker.h"
+#include "threading/Coroutine.h"
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+#include <new>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Usable stack size of each coroutine, one extra guard page is mapped below it
+ */
+#define ZILLIANS_STACKFUL_COROUTINE_STACK_SIZE			(64 * 1024)
+
+/**
+ * Number of released stacks kept mapped by CoroutineStackPool for reuse
+ */
+#define ZILLIANS_STACKFUL_COROUTINE_MAX_CACHED_STACKS	1024
+
+namespace zillians {
+
+/**
+ * @brief CoroutineStackPool hands out guard-paged stacks for StackfulCoroutine.
+ *
+ * Each stack is an anonymous mapping whose lowest page is PROT_NONE, so a
+ * coroutine overflowing its stack faults right away instead of scribbling
+ * over its neighbour. Released stacks are cached and reused, which keeps
+ * mmap/munmap out of the spawn path of short-lived coroutines.
+ *
+ * @note The pool is thread-safe, stacks can be released on any thread.
+ */
+class CoroutineStackPool : public boost::noncopyable
+{
+public:
+	struct Stack
+	{
+		Stack() : mapping(NULL), mapping_size(0)
+		{ }
+
+		inline void* base()  { return mapping + page_size(); }
+		inline std::size_t size() const { return mapping_size - page_size(); }
+
+		byte* mapping;
+		std::size_t mapping_size;
+	};
+
+public:
+	explicit CoroutineStackPool(std::size_t stackSize = ZILLIANS_STACKFUL_COROUTINE_STACK_SIZE, std::size_t maxCached = ZILLIANS_STACKFUL_COROUTINE_MAX_CACHED_STACKS) :
+		mMappingSize(round_to_page(stackSize) + page_size()), mMaxCached(maxCached)
+	{ }
+
+	~CoroutineStackPool()
+	{
+		for(std::vector<Stack>::iterator it = mCached.begin(); it != mCached.end(); ++it)
+			munmap(it->mapping, it->mapping_size);
+	}
+
+public:
+	/**
+	 * @brief Take a stack from the cache or map a new one.
+	 *
+	 * @throw std::bad_alloc if the stack can't be mapped.
+	 */
+	Stack allocate()
+	{
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			if(!mCached.empty())
+			{
+				Stack stack = mCached.back();
+				mCached.pop_back();
+				return stack;
+			}
+		}
+
+		void* p = mmap(NULL, mMappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(p == MAP_FAILED)
+			throw std::bad_alloc();
+
+		if(mprotect(p, page_size(), PROT_NONE) != 0)
+		{
+			munmap(p, mMappingSize);
+			throw std::bad_alloc();
+		}
+
+		Stack stack;
+		stack.mapping = static_cast<byte*>(p);
+		stack.mapping_size = mMappingSize;
+		return stack;
+	}
+
+	/**
+	 * @brief Give a stack back, it's unmapped if the cache is full.
+	 */
+	void deallocate(const Stack& stack)
+	{
+		BOOST_ASSERT(stack.mapping_size == mMappingSize);
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			if(mCached.size() < mMaxCached)
+			{
+				mCached.push_back(stack);
+				return;
+			}
+		}
+		munmap(stack.mapping, stack.mapping_size);
+	}
+
+	inline std::size_t getStackSize() const
+	{
+		return mMappingSize - page_size();
+	}
+
+	inline std::size_t getCachedCount() const
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		return mCached.size();
+	}
+
+	/**
+	 * @brief The pool used by StackfulCoroutine::spawn() if none is given.
+	 */
+	static CoroutineStackPool& global()
+	{
+		static CoroutineStackPool pool;
+		return pool;
+	}
+
+private:
+	static inline std::size_t page_size()
+	{
+		static const std::size_t size = (std::size_t)sysconf(_SC_PAGESIZE);
+		return size;
+	}
+
+	static inline std::size_t round_to_page(std::size_t size)
+	{
+		return (size + page_size() - 1) & ~(page_size() - 1);
+	}
+
+private:
+	std::size_t mMappingSize;
+	std::size_t mMaxCached;
+	mutable boost::mutex mMutex;
+	std::vector<Stack> mCached;
+};
+
+/**
+ * @brief StackfulCoroutine runs a function on its own stack on top of an io_service.
+ *
+ * Unlike the switch-based Coroutine, the body is an ordinary function: locals
+ * survive across suspension points, so there is no need to move state into
+ * members or to allocate a handler object per step. Asynchronous operations
+ * are awaited by passing handler() as the completion handler and calling
+ * await(), which suspends the coroutine until the operation completes:
+ *
+ * @code
+ * void session(StackfulCoroutine& self, boost::shared_ptr<tcp::socket> socket)
+ * {
+ *     char data[1024];
+ *     boost::system::error_code ec;
+ *     for(;;)
+ *     {
+ *         socket->async_read_some(boost::asio::buffer(data), self.handler());
+ *         std::size_t n = self.await(ec);
+ *         if(ec) break;
+ *
+ *         boost::asio::async_write(*socket, boost::asio::buffer(data, n), self.handler());
+ *         self.await(ec);
+ *         if(ec) break;
+ *     }
+ * }
+ *
+ * StackfulCoroutine::spawn(worker, boost::bind(session, _1, socket));
+ * @endcode
+ *
+ * Operations awaited through handler() allocate from a CoroutineHandlerMemory
+ * owned by the coroutine, so steady-state awaiting does not touch the heap.
+ *
+ * A coroutine scheduled by spawn() or handler() always runs inside its own
+ * strand, so it is safe on an io_service run by several threads. yield() and
+ * resume() are also available for hand-written scheduling; a coroutine that
+ * just wants to let others run calls schedule() followed by yield().
+ *
+ * The coroutine is kept alive by shared pointers held by the pending
+ * handler. If it's destroyed while suspended, for example because the
+ * io_service is destroyed with the handler still queued, its stack is
+ * unwound by throwing forced_unwind from the suspension point, so locals
+ * on the coroutine stack are destructed properly.
+ *
+ * @note Exceptions escaping the body are rethrown from resume(), and therefore
+ * come out of io_service::run() just like exceptions of regular handlers.
+ * @note Do not swallow forced_unwind in the body, rethrow it from catch(...).
+ */
+class StackfulCoroutine : public boost::enable_shared_from_this<StackfulCoroutine>, public boost::noncopyable
+{
+public:
+	typedef boost::function<void(StackfulCoroutine&)> body_type;
+
+	struct state_t
+	{
+		enum type { ready, running, suspended, finished };
+	};
+
+	/**
+	 * @brief Thrown from the suspension point to unwind a destroyed coroutine.
+	 */
+	struct forced_unwind { };
+
+	/**
+	 * @brief Completion handler resuming the coroutine, see handler().
+	 */
+	class Handler
+	{
+	public:
+		explicit Handler(const boost::shared_ptr<StackfulCoroutine>& coroutine) : mCoroutine(coroutine)
+		{ }
+
+		void operator() (const boost::system::error_code& ec = boost::system::error_code(), std::size_t bytes_transferred = 0)
+		{
+			mCoroutine->mResultError = ec;
+			mCoroutine->mResultBytes = bytes_transferred;
+			mCoroutine->mStrand.post(makeCoroutineHandler(mCoroutine->mHandlerMemory, boost::bind(&StackfulCoroutine::resumeHandler, mCoroutine)));
+		}
+
+		friend void* asio_handler_allocate(std::size_t size, Handler* this_handler)
+		{
+			return this_handler->allocate(size);
+		}
+
+		friend void asio_handler_deallocate(void* pointer, std::size_t size, Handler* this_handler)
+		{
+			UNUSED_ARGUMENT(size);
+			this_handler->deallocate(pointer);
+		}
+
+	private:
+		inline void* allocate(std::size_t size) { return mCoroutine->mHandlerMemory.allocate(size); }
+		inline void deallocate(void* pointer) { mCoroutine->mHandlerMemory.deallocate(pointer); }
+
+	private:
+		boost::shared_ptr<StackfulCoroutine> mCoroutine;
+	};
+
+public:
+	/**
+	 * @brief Create a coroutine and schedule its first run on the given io_service.
+	 */
+	static boost::shared_ptr<StackfulCoroutine> spawn(boost::asio::io_service& io_service, const body_type& body, CoroutineStackPool& pool = CoroutineStackPool::global())
+	{
+		boost::shared_ptr<StackfulCoroutine> coroutine(new StackfulCoroutine(io_service, body, pool));
+		coroutine->schedule();
+		return coroutine;
+	}
+
+	/**
+	 * @brief Create a coroutine and schedule its first run on the worker thread.
+	 */
+	static boost::shared_ptr<StackfulCoroutine> spawn(Worker& worker, const body_type& body, CoroutineStackPool& pool = CoroutineStackPool::global())
+	{
+		return spawn(worker.getIoService(), body, pool);
+	}
+
+	/**
+	 * @brief Create a coroutine without scheduling it, call resume() or schedule() to start it.
+	 */
+	StackfulCoroutine(boost::asio::io_service& io_service, const body_type& body, CoroutineStackPool& pool = CoroutineStackPool::global()) :
+		mIoService(io_service), mStrand(io_service), mBody(body), mPool(pool), mStack(pool.allocate()), mState(state_t::ready), mUnwinding(false), mResultBytes(0)
+	{
+		getcontext(&mContext);
+		mContext.uc_stack.ss_sp = mStack.base();
+		mContext.uc_stack.ss_size = mStack.size();
+		mContext.uc_link = &mCaller;
+
+		uintptr_t self = reinterpret_cast<uintptr_t>(this);
+		makecontext(&mContext, (void(*)())&StackfulCoroutine::entry, 2, (uint32)(self >> 32), (uint32)self);
+	}
+
+	~StackfulCoroutine()
+	{
+		BOOST_ASSERT(mState != state_t::running);
+		if(mState == state_t::suspended)
+		{
+			mUnwinding = true;
+			switchIn();
+		}
+
+		if(mStack.mapping)
+			mPool.deallocate(mStack);
+	}
+
+public:
+	/**
+	 * @brief Run the coroutine until it yields or finishes.
+	 *
+	 * Must not be called from inside the coroutine itself, and must not race
+	 * with the strand, so prefer schedule() if the coroutine was spawned.
+	 */
+	void resume()
+	{
+		BOOST_ASSERT(mState == state_t::ready || mState == state_t::suspended);
+		switchIn();
+
+		if(mException)
+		{
+			boost::exception_ptr e = mException;
+			mException = boost::exception_ptr();
+			boost::rethrow_exception(e);
+		}
+	}
+
+	/**
+	 * @brief Suspend the coroutine and go back to whoever resumed it.
+	 *
+	 * @throw forced_unwind if the coroutine is destroyed while suspended.
+	 */
+	void yield()
+	{
+		BOOST_ASSERT(mState == state_t::running);
+		mState = state_t::suspended;
+		swapcontext(&mContext, &mCaller);
+		mState = state_t::running;
+
+		if(UNLIKELY(mUnwinding))
+			throw forced_unwind();
+	}
+
+	/**
+	 * @brief Queue a resume() on the strand of the coroutine, can be called from any thread.
+	 */
+	void schedule()
+	{
+		mStrand.post(boost::bind(&StackfulCoroutine::resumeHandler, shared_from_this()));
+	}
+
+	/**
+	 * @brief Get a completion handler which stores the result of an asynchronous operation and resumes the coroutine.
+	 *
+	 * Only one operation may be outstanding per await().
+	 */
+	Handler handler()
+	{
+		return Handler(shared_from_this());
+	}
+
+	/**
+	 * @brief Suspend until the handler() passed to an asynchronous operation is called.
+	 *
+	 * @param ec Set to the error code of the operation.
+	 * @return The number of bytes transferred, if the operation reports any.
+	 */
+	std::size_t await(boost::system::error_code& ec)
+	{
+		yield();
+		ec = mResultError;
+		return mResultBytes;
+	}
+
+	/**
+	 * @brief Suspend until the handler() passed to an asynchronous operation is called.
+	 *
+	 * @throw boost::system::system_error if the operation fails.
+	 */
+	std::size_t await()
+	{
+		boost::system::error_code ec;
+		std::size_t n = await(ec);
+		if(ec)
+			throw boost::system::system_error(ec);
+		return n;
+	}
+
+	inline state_t::type getState() const
+	{
+		return mState;
+	}
+
+	inline bool isFinished() const
+	{
+		return mState == state_t::finished;
+	}
+
+	inline boost::asio::io_service& getIoService()
+	{
+		return mIoService;
+	}
+
+	inline boost::asio::io_service::strand& getStrand()
+	{
+		return mStrand;
+	}
+
+private:
+	static void entry(uint32 high, uint32 low)
+	{
+		StackfulCoroutine* self = reinterpret_cast<StackfulCoroutine*>(((uintptr_t)high << 32) | (uintptr_t)low);
+		try
+		{
+			self->mBody(*self);
+		}
+		catch(forced_unwind&)
+		{ }
+		catch(...)
+		{
+			self->mException = boost::current_exception();
+		}
+		self->mState = state_t::finished;
+		// returning switches to uc_link, which is mCaller
+	}
+
+	static void resumeHandler(const boost::shared_ptr<StackfulCoroutine>& coroutine)
+	{
+		if(!coroutine->isFinished())
+			coroutine->resume();
+	}
+
+	void switchIn()
+	{
+		mState = state_t::running;
+		swapcontext(&mCaller, &mContext);
+
+		if(mState == state_t::finished && mStack.mapping)
+		{
+			mPool.deallocate(mStack);
+			mStack = CoroutineStackPool::Stack();
+		}
+	}
+
+private:
+	boost::asio::io_service& mIoService;
+	boost::asio::io_service::strand mStrand;
+	body_type mBody;
+
+	CoroutineStackPool& mPool;
+	CoroutineStackPool::Stack mStack;
+
+	ucontext_t mContext;
+	ucontext_t mCaller;
+
+	state_t::type mState;
+	bool mUnwinding;
+	boost::exception_ptr mException;
+
+	boost::system::error_code mResultError;
+	std::size_t mResultBytes;
+
+	CoroutineHandlerMemory mHandlerMemory;
+};
+
+}
+
+#endif/*ZILLIANS_STACKFULCOROUTINE_H_*/
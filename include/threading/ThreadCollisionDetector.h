@@ -23,83 +23,202 @@
 #ifndef ZILLIANS_THREADCOLLISIONDETECTOR_H_
 #define ZILLIANS_THREADCOLLISIONDETECTOR_H_
 
+#include "core/Common.h"
+#include "core/Metrics.h"
+#include "core/Logger.h"
+#include <boost/preprocessor/stringize.hpp>
+#include <pthread.h>
+#include <atomic>
+#include <cstdio>
 #include <stdexcept>
 
-#ifdef NDEBUG
+/**
+ * ZILLIANS_THREAD_COLLISION_SAMPLING chooses how watched regions are checked:
+ * - 0: compiled out, the default of release builds
+ * - 1: every entry is checked and a collision throws, the default of debug builds
+ * - N: only one in about N entries of each thread claims the detector, the others
+ *   just read it, and a collision is reported by the "threading.collisions" metric
+ *   and the log instead of thrown; cheap enough to leave on in production canaries
+ */
+#ifndef ZILLIANS_THREAD_COLLISION_SAMPLING
+	#ifdef NDEBUG
+		#define ZILLIANS_THREAD_COLLISION_SAMPLING 0
+	#else
+		#define ZILLIANS_THREAD_COLLISION_SAMPLING 1
+	#endif
+#endif
+
+#if ZILLIANS_THREAD_COLLISION_SAMPLING == 0
 	#define DETECTOR(obj)
 	#define SCOPED_WATCH(obj)
 	#define WATCH(obj)
 #else
 	#define DETECTOR(obj)		ThreadCollisionDetector _##obj;
-	#define SCOPED_WATCH(obj)	ThreadCollisionDetector::ScopedWatcher _scoped_watcher_##obj(_##obj);
-	#define WATCH(obj)			ThreadCollisionDetector::Watcher _watcher_##obj(_##obj);
+	#define SCOPED_WATCH(obj)	ThreadCollisionDetector::ScopedWatcher _scoped_watcher_##obj(_##obj, #obj " at " __FILE__ ":" BOOST_PP_STRINGIZE(__LINE__));
+	#define WATCH(obj)			ThreadCollisionDetector::Watcher _watcher_##obj(_##obj, #obj " at " __FILE__ ":" BOOST_PP_STRINGIZE(__LINE__));
+#endif
+
+#if defined(_MSC_VER)
+	#define ZILLIANS_THREAD_COLLISION_TLS __declspec(thread)
+#else
+	#define ZILLIANS_THREAD_COLLISION_TLS __thread
 #endif
 
 namespace zillians {
 
 /**
  * ThreadCollisionDetector is used to detect whether two thread accessing the same region of code or variable
+ *
+ * In sampling mode (see ZILLIANS_THREAD_COLLISION_SAMPLING), a sampled ScopedWatcher claims
+ * the detector for its scope while the other entries only check that nobody else holds it,
+ * so the common case is a thread-local countdown and a read of the detector, and a thread
+ * overlapping a sampled scope of another thread is caught with a probability close to 1/N.
  */
 class ThreadCollisionDetector
 {
 public:
-	ThreadCollisionDetector() : mActiveThread(0)
-    { }
+	enum { SAMPLING = ZILLIANS_THREAD_COLLISION_SAMPLING };
 
-    ~ThreadCollisionDetector()
-    { }
+	ThreadCollisionDetector()
+	{
+		mActiveThread.store(0, std::memory_order_relaxed);
+	}
 
-    class Watcher
-    {
-    public:
-    	Watcher(ThreadCollisionDetector& _v) : v(_v)
-    	{ v.enterSelf(); }
+	~ThreadCollisionDetector()
+	{ }
 
-    	~Watcher()
-    	{ }
+	class Watcher
+	{
+	public:
+		Watcher(ThreadCollisionDetector& _v, const char* where = NULL) : v(_v)
+		{ v.enterSelf(where); }
+
+		~Watcher()
+		{ }
 
 	private:
-    	ThreadCollisionDetector& v;
-    };
+		ThreadCollisionDetector& v;
+	};
 
-    class ScopedWatcher {
+	class ScopedWatcher {
 	public:
-    	ScopedWatcher(ThreadCollisionDetector& _v) : v(_v)
-		{ v.enter(); }
-
-    	~ScopedWatcher()
-    	{ v.leave(); }
+		ScopedWatcher(ThreadCollisionDetector& _v, const char* where = NULL) : v(_v), sampled(sample())
+		{
+			if(sampled)
+				v.enter(where);
+			else
+				v.check(where);
+		}
+
+		~ScopedWatcher()
+		{
+			if(sampled)
+				v.leave();
+		}
 
 	private:
-    	ThreadCollisionDetector& v;
-    };
+		ThreadCollisionDetector& v;
+		bool sampled;
+	};
+
+	/**
+	 * @brief The number of collisions reported so far in sampling mode.
+	 */
+	static uint64 collisions()
+	{
+		return collisionCount().load(std::memory_order_relaxed);
+	}
 
 private:
-    void enterSelf()
-    {
-        if(!__sync_bool_compare_and_swap(&mActiveThread, 0, pthread_self()))
-        {
-            if(!__sync_bool_compare_and_swap(&mActiveThread, pthread_self(), mActiveThread))
-            {
-                throw std::runtime_error("thread collision detected");
-            }
-        }
-    }
-
-    void enter()
-    {
-        if(!__sync_bool_compare_and_swap(&mActiveThread, 0, pthread_self()))
-        {
-            throw std::runtime_error("thread collision detected");
-        }
-    }
-
-    void leave()
-    {
-        __sync_fetch_and_xor(&mActiveThread, mActiveThread);
-    }
-
-    pthread_t mActiveThread;
+	void enterSelf(const char* where)
+	{
+		pthread_t self = pthread_self();
+		pthread_t active = mActiveThread.load(std::memory_order_relaxed);
+		if(LIKELY(active == self))
+			return;
+
+		if(active != 0 || !mActiveThread.compare_exchange_strong(active, self, std::memory_order_acquire))
+		{
+			if(active != self)
+				collide(where);
+		}
+	}
+
+	void enter(const char* where)
+	{
+		pthread_t expected = 0;
+		if(!mActiveThread.compare_exchange_strong(expected, pthread_self(), std::memory_order_acquire))
+			collide(where);
+	}
+
+	/**
+	 * Entries not sampled only look, they never write the detector.
+	 */
+	void check(const char* where)
+	{
+		pthread_t active = mActiveThread.load(std::memory_order_relaxed);
+		if(UNLIKELY(active != 0 && active != pthread_self()))
+			collide(where);
+	}
+
+	void leave()
+	{
+		mActiveThread.store(0, std::memory_order_release);
+	}
+
+	/**
+	 * Decide whether this entry of the calling thread is checked, about one in SAMPLING.
+	 *
+	 * The countdown is drawn from a per-thread xorshift so sampling doesn't lock step
+	 * with periodic access patterns.
+	 */
+	static inline bool sample()
+	{
+		if(SAMPLING <= 1)
+			return true;
+
+		static ZILLIANS_THREAD_COLLISION_TLS uint32 countdown = 0;
+		static ZILLIANS_THREAD_COLLISION_TLS uint32 seed = 0;
+		if(LIKELY(countdown > 0))
+		{
+			--countdown;
+			return false;
+		}
+
+		if(UNLIKELY(seed == 0))
+			seed = static_cast<uint32>(reinterpret_cast<uintptr_t>(&countdown)) | 1;
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+		countdown = SAMPLING / 2 + seed % SAMPLING;
+		return true;
+	}
+
+	static void collide(const char* where)
+	{
+		if(SAMPLING <= 1)
+			throw std::runtime_error(where ? std::string("thread collision detected: ") + where : std::string("thread collision detected"));
+
+		static MetricCounter metric("threading.collisions");
+		metric.increment();
+
+		// log the first collision and then every time the count doubles, so a hot region doesn't flood the log
+		uint64 count = collisionCount().fetch_add(1, std::memory_order_relaxed) + 1;
+		if((count & (count - 1)) == 0)
+		{
+#ifdef BUILD_WITH_LOG4CXX
+			LOG4CXX_ERROR(GlobalLogger(), "thread collision detected: " << (where ? where : "unknown") << " (" << count << " so far)");
+#else
+			fprintf(stderr, "thread collision detected: %s (%llu so far)\n", where ? where : "unknown", (unsigned long long)count);
+#endif
+		}
+	}
+
+	static std::atomic<uint64>& collisionCount()
+	{
+		static std::atomic<uint64> count(0);
+		return count;
+	}
+
+	std::atomic<pthread_t> mActiveThread;
 };
 
 }
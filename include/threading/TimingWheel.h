@@ -0,0 +1,456 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_THREADING_TIMINGWHEEL_H_
+#define ZILLIANS_THREADING_TIMINGWHEEL_H_
+
+#include "core/Prerequisite.h"
+#include "core/SmallFunction.h"
+#include "utility/TimerUtil.h"
+#include <boost/asio.hpp>
+#include <vector>
+
+/**
+ * @brief The default tick of TimingWheel in milliseconds.
+ */
+#define ZILLIANS_TIMING_WHEEL_DEFAULT_TICK	10
+
+/**
+ * @brief The number of timer nodes TimingWheel allocates at once when its pool runs out.
+ */
+#define ZILLIANS_TIMING_WHEEL_SLAB_SIZE		1024
+
+namespace zillians { namespace threading {
+
+/**
+ * @brief TimingWheel schedules a large number of timeouts on an io_service with O(1) operations.
+ *
+ * Timers are kept in four levels of 256 slots each, the first level covers
+ * the next 256 ticks one slot per tick, the second the next 65536 ticks 256
+ * ticks per slot, and so on, so a timer can be as far as 2^32 ticks away.
+ * Scheduling, cancelling and rescheduling only link or unlink the timer node
+ * in a slot list, whatever the number of timers. Once every 256 ticks the
+ * timers in the next slot of an upper level are cascaded down, which costs
+ * each timer at most three moves over its lifetime.
+ *
+ * The wheel is driven by a single deadline_timer ticking while there are
+ * timers pending, instead of one asio timer per timeout, so the io_service
+ * only sees one timer. Timer nodes are intrusive list nodes carved from
+ * slabs owned by the wheel and recycled on expiry or cancellation, so after
+ * warming up no operation touches the heap (the handler is kept inline by
+ * SmallFunction).
+ *
+ * Timeouts are rounded up to whole ticks, and counted from the end of the
+ * current tick, so a timer never fires early, and fires less than two ticks
+ * late as long as the io_service keeps up. Timers due in the same tick fire in no particular
+ * order.
+ *
+ * @code
+ * TimingWheel::TimerKey key = worker.getTimingWheel().schedule(boost::posix_time::seconds(30), boost::bind(&Session::onIdle, session));
+ * ...
+ * // some traffic on the session, push the timeout back
+ * worker.getTimingWheel().reschedule(key, boost::posix_time::seconds(30));
+ * @endcode
+ *
+ * @note TimingWheel is not thread-safe. All calls must be made from handlers
+ * running on its io_service, which are serialized for a Worker running a
+ * single thread (the default); use Worker::dispatch() from other threads.
+ */
+class TimingWheel : public boost::noncopyable
+{
+public:
+	typedef SmallFunction<void()> Handler;
+
+	enum
+	{
+		LEVELS = 4,
+		SLOT_BITS = 8,
+		SLOTS = 1 << SLOT_BITS,
+		SLOT_MASK = SLOTS - 1,
+	};
+
+private:
+	struct Link
+	{
+		Link* prev;
+		Link* next;
+	};
+
+	struct Node : Link
+	{
+		Node() : generation(0), firing(false)
+		{
+			prev = next = NULL;
+		}
+
+		uint64 expiry;		///< The absolute tick to fire at
+		uint32 generation;	///< Bumped whenever the node is recycled, so stale keys are detected
+		bool firing;		///< Set while the handler runs, so it may reschedule its own timer
+		Handler handler;
+	};
+
+public:
+	/**
+	 * @brief TimerKey refers to a scheduled timer.
+	 *
+	 * A key stays safe to use after the timer has fired or has been cancelled,
+	 * it's just no longer pending, but it must not outlive the wheel. A default
+	 * constructed key refers to no timer.
+	 */
+	class TimerKey
+	{
+		friend class TimingWheel;
+	public:
+		TimerKey() : mNode(NULL), mGeneration(0)
+		{ }
+
+		bool valid() const
+		{
+			return mNode != NULL;
+		}
+
+	private:
+		TimerKey(Node* node, uint32 generation) : mNode(node), mGeneration(generation)
+		{ }
+
+		Node* mNode;
+		uint32 mGeneration;
+	};
+
+public:
+	/**
+	 * @brief Create an idle wheel on the given io_service.
+	 *
+	 * @param ioService The io_service running the tick timer and the handlers.
+	 * @param tick The resolution of the wheel.
+	 */
+	explicit TimingWheel(boost::asio::io_service& ioService, const boost::posix_time::time_duration& tick = boost::posix_time::milliseconds(ZILLIANS_TIMING_WHEEL_DEFAULT_TICK)) :
+		mTicker(ioService),
+		mTickNs(std::max<uint64>(1, tick.total_nanoseconds())),
+		mStart(TimerUtil::now_ns()),
+		mNext(0),
+		mPending(0),
+		mTicking(false),
+		mFree(NULL),
+		mThis(new TimingWheel*(this))
+	{
+		for(int i = 0; i < LEVELS; ++i)
+		{
+			for(int j = 0; j < SLOTS; ++j)
+				mSlots[i][j].prev = mSlots[i][j].next = &mSlots[i][j];
+		}
+	}
+
+	/**
+	 * @brief Destroy the wheel, pending timers are dropped without calling their handlers.
+	 */
+	~TimingWheel()
+	{
+		mThis.reset();
+		boost::system::error_code ec;
+		mTicker.cancel(ec);
+
+		for(std::vector<Node*>::iterator i = mSlabs.begin(); i != mSlabs.end(); ++i)
+			delete[] *i;
+	}
+
+public:
+	/**
+	 * @brief Schedule the handler to be called once the timeout elapses.
+	 *
+	 * @param timeout The relative timeout, rounded up to whole ticks.
+	 * @param handler The handler to be called on the io_service, the signature
+	 * must be: @code void handler(); @endcode
+	 *
+	 * @return The key to cancel or reschedule the timer.
+	 */
+	template<typename F>
+	TimerKey schedule(const boost::posix_time::time_duration& timeout, F&& handler)
+	{
+		Node* node = allocate();
+		node->handler = std::forward<F>(handler);
+		insert(node, toExpiry(timeout));
+		return TimerKey(node, node->generation);
+	}
+
+	/**
+	 * @brief Cancel a pending timer, its handler is dropped without being called.
+	 *
+	 * @return False if the timer has already fired or has been cancelled.
+	 */
+	bool cancel(const TimerKey& key)
+	{
+		if(!isPending(key))
+			return false;
+
+		Node* node = key.mNode;
+		unlink(node);
+		if(!node->firing)
+			release(node);
+		return true;
+	}
+
+	/**
+	 * @brief Move a pending timer to fire once the new timeout elapses from now.
+	 *
+	 * A handler may also reschedule its own timer while it runs, which makes it
+	 * fire again (a periodic timer), even though the timer is no longer pending
+	 * at that point.
+	 *
+	 * @return False if the timer has already fired or has been cancelled.
+	 */
+	bool reschedule(const TimerKey& key, const boost::posix_time::time_duration& timeout)
+	{
+		Node* node = key.mNode;
+		if(!node || node->generation != key.mGeneration)
+			return false;
+		if(node->next)
+			unlink(node);
+		else if(!node->firing)
+			return false;
+
+		insert(node, toExpiry(timeout));
+		return true;
+	}
+
+	/**
+	 * @brief Whether the timer is still waiting to fire.
+	 */
+	bool isPending(const TimerKey& key) const
+	{
+		return key.mNode && key.mNode->generation == key.mGeneration && key.mNode->next;
+	}
+
+	/**
+	 * @brief The number of pending timers.
+	 */
+	std::size_t size() const
+	{
+		return mPending;
+	}
+
+	boost::posix_time::time_duration getTick() const
+	{
+		return boost::posix_time::microseconds(mTickNs / 1000);
+	}
+
+	/**
+	 * @brief Fire all timers due by now.
+	 *
+	 * It's called by the tick timer, so there's no need to call it unless the
+	 * io_service is blocked for a long time by a single handler.
+	 *
+	 * @return The number of handlers called.
+	 */
+	std::size_t poll()
+	{
+		uint64 now = currentTick();
+
+		std::size_t fired = 0;
+		while(mNext <= now && mPending > 0)
+			fired += advance();
+
+		// nothing left on the wheel, skip the empty ticks at once
+		if(mPending == 0 && mNext <= now)
+			mNext = now + 1;
+
+		return fired;
+	}
+
+private:
+	/**
+	 * Process the tick mNext, cascading the upper levels whenever the lower
+	 * level wraps around, and fire the timers due.
+	 */
+	std::size_t advance()
+	{
+		uint32 index = mNext & SLOT_MASK;
+		for(int level = 1; level < LEVELS && index == 0; ++level)
+		{
+			index = (mNext >> (level * SLOT_BITS)) & SLOT_MASK;
+			cascade(mSlots[level][index]);
+		}
+
+		Link& slot = mSlots[0][mNext & SLOT_MASK];
+		++mNext;
+
+		std::size_t fired = 0;
+		while(slot.next != &slot)
+		{
+			Node* node = static_cast<Node*>(slot.next);
+			unlink(node);
+
+			node->firing = true;
+			node->handler();
+			node->firing = false;
+			++fired;
+
+			// the handler may have rescheduled the timer
+			if(!node->next)
+				release(node);
+		}
+		return fired;
+	}
+
+	void cascade(Link& slot)
+	{
+		Link* link = slot.next;
+		slot.prev = slot.next = &slot;
+
+		while(link != &slot)
+		{
+			Node* node = static_cast<Node*>(link);
+			link = link->next;
+			place(node);
+		}
+	}
+
+	void insert(Node* node, uint64 expiry)
+	{
+		node->expiry = expiry;
+		place(node);
+		++mPending;
+
+		if(!mTicking)
+			arm();
+	}
+
+	/**
+	 * Link the node into the slot of its expiry relative to the next tick.
+	 * Beyond the range of the top level, the node waits in the farthest slot
+	 * and is placed again when that slot is cascaded.
+	 */
+	void place(Node* node)
+	{
+		uint64 expiry = std::max(node->expiry, mNext);
+		uint64 delta = expiry - mNext;
+
+		int level = 0;
+		while(level < LEVELS - 1 && delta >= (uint64(1) << ((level + 1) * SLOT_BITS)))
+			++level;
+
+		if(delta >= (uint64(1) << (LEVELS * SLOT_BITS)))
+			expiry = mNext + (uint64(1) << (LEVELS * SLOT_BITS)) - 1;
+
+		Link& slot = mSlots[level][(expiry >> (level * SLOT_BITS)) & SLOT_MASK];
+		node->prev = slot.prev;
+		node->next = &slot;
+		slot.prev->next = node;
+		slot.prev = node;
+	}
+
+	void unlink(Node* node)
+	{
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->prev = node->next = NULL;
+		--mPending;
+	}
+
+	uint64 toExpiry(const boost::posix_time::time_duration& timeout)
+	{
+		int64 ns = timeout.total_nanoseconds();
+		uint64 ticks = ns > 0 ? (uint64(ns) + mTickNs - 1) / mTickNs : 0;
+
+		// an idle wheel doesn't tick, catch up with the time first
+		if(!mTicking)
+			poll();
+
+		// the current tick has partly elapsed, so count from the end of it
+		return currentTick() + ticks + 1;
+	}
+
+	inline uint64 currentTick() const
+	{
+		return (TimerUtil::now_ns() - mStart) / mTickNs;
+	}
+
+	void arm()
+	{
+		if(mPending == 0)
+		{
+			mTicking = false;
+			return;
+		}
+
+		uint64 due = mStart + mNext * mTickNs;
+		uint64 now = TimerUtil::now_ns();
+
+		mTicking = true;
+		mTicker.expires_from_now(boost::posix_time::microseconds(due > now ? (due - now + 999) / 1000 : 0));
+		mTicker.async_wait(boost::bind(&TimingWheel::onTick, weak_ptr<TimingWheel*>(mThis), boost::asio::placeholders::error));
+	}
+
+	static void onTick(const weak_ptr<TimingWheel*>& target, const boost::system::error_code& ec)
+	{
+		shared_ptr<TimingWheel*> wheel = target.lock();
+		if(!wheel || ec == boost::asio::error::operation_aborted)
+			return;
+
+		(*wheel)->poll();
+		(*wheel)->arm();
+	}
+
+	Node* allocate()
+	{
+		if(!mFree)
+		{
+			Node* slab = new Node[ZILLIANS_TIMING_WHEEL_SLAB_SIZE];
+			mSlabs.push_back(slab);
+			for(int i = ZILLIANS_TIMING_WHEEL_SLAB_SIZE - 1; i >= 0; --i)
+			{
+				slab[i].prev = mFree;
+				mFree = &slab[i];
+			}
+		}
+
+		// free nodes are chained through prev, so next stays NULL as for any node not linked
+		Node* node = mFree;
+		mFree = static_cast<Node*>(node->prev);
+		node->prev = NULL;
+		return node;
+	}
+
+	void release(Node* node)
+	{
+		node->handler = Handler();
+		++node->generation;
+		node->prev = mFree;
+		mFree = node;
+	}
+
+private:
+	boost::asio::deadline_timer mTicker;
+	uint64 mTickNs;
+	uint64 mStart;			///< TimerUtil::now_ns() of tick 0
+	uint64 mNext;			///< The next tick to process
+	std::size_t mPending;
+	bool mTicking;
+
+	Link mSlots[LEVELS][SLOTS];
+
+	Node* mFree;
+	std::vector<Node*> mSlabs;
+
+	shared_ptr<TimingWheel*> mThis;	///< Expires on destruction so a queued tick does nothing
+};
+
+} }
+
+#endif /* ZILLIANS_THREADING_TIMINGWHEEL_H_ */
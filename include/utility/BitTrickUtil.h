@@ -34,47 +34,103 @@ namespace zillians {
  * @return the rounded value (upward)
  */
 template<typename Value, typename Multiple>
-inline static Value round_up_to_nearest_power(const Value& v, const Multiple& m)
+inline constexpr Value round_up_to_nearest_power(const Value& v, const Multiple& m)
 {
-	if(v == 0 || m == 0 || v % m == 0)
-		return v;
-	else
-		return (v / m + 1) * m;
+	return (v == 0 || m == 0 || v % m == 0) ? v : (v / m + 1) * m;
 }
 
+/**
+ * Count the zero bits below the lowest set bit (tzcnt), the width of the type if v is zero.
+ */
+inline constexpr uint32 count_trailing_zeros(uint32 v)
+{
+	return (v == 0) ? 32 : __builtin_ctz(v);
+}
+
+inline constexpr uint32 count_trailing_zeros(uint64 v)
+{
+	return (v == 0) ? 64 : __builtin_ctzll(v);
+}
+
+/**
+ * Count the zero bits above the highest set bit (lzcnt), the width of the type if v is zero.
+ */
+inline constexpr uint32 count_leading_zeros(uint32 v)
+{
+	return (v == 0) ? 32 : __builtin_clz(v);
+}
+
+inline constexpr uint32 count_leading_zeros(uint64 v)
+{
+	return (v == 0) ? 64 : __builtin_clzll(v);
+}
+
+/**
+ * Count the set bits (popcnt).
+ */
+inline constexpr uint32 population_count(uint32 v)
+{
+	return __builtin_popcount(v);
+}
+
+inline constexpr uint32 population_count(uint64 v)
+{
+	return __builtin_popcountll(v);
+}
+
+template<typename T>
+inline constexpr bool is_power_of_two(T v)
+{
+	return v != 0 && (v & (v - 1)) == 0;
+}
+
+/**
+ * The index of the highest set bit, v must not be zero.
+ */
+inline constexpr uint32 floor_log2(uint32 v)
+{
+	return 31 - __builtin_clz(v);
+}
+
+inline constexpr uint32 floor_log2(uint64 v)
+{
+	return 63 - __builtin_clzll(v);
+}
+
+/**
+ * The smallest n with (1 << n) >= v, v must not be zero.
+ */
+inline constexpr uint32 ceil_log2(uint32 v)
+{
+	return (v == 1) ? 0 : 32 - __builtin_clz(v - 1);
+}
+
+inline constexpr uint32 ceil_log2(uint64 v)
+{
+	return (v == 1) ? 0 : 64 - __builtin_clzll(v - 1);
+}
+
+/**
+ * Round up to the nearest power of two, zero stays zero and so does a value above the highest power of two.
+ */
 template<typename T>
 struct round_up_to_nearest_power_of_two;
 
 template<>
 struct round_up_to_nearest_power_of_two<uint32>
 {
-	static uint32 apply(uint32 v)
+	static constexpr uint32 apply(uint32 v)
 	{
-		v--;
-		v |= v >> 1;
-		v |= v >> 2;
-		v |= v >> 4;
-		v |= v >> 8;
-		v |= v >> 16;
-		v++;
-		return v;
+		return (v <= 1) ? v : ((v - 1) >> 31) ? 0 : uint32(1) << (32 - __builtin_clz(v - 1));
 	}
 };
 
 template<>
 struct round_up_to_nearest_power_of_two<uint64>
 {
-	static uint64 apply(uint64 v)
+	static constexpr uint64 apply(uint64 v)
 	{
-		v--;
-		v |= v >> 1;
-		v |= v >> 2;
-		v |= v >> 4;
-		v |= v >> 8;
-		v |= v >> 16;
-		v |= v >> 32;
-		v++;
-		return v;
+		return (v <= 1) ? v : ((v - 1) >> 63) ? 0 : uint64(1) << (64 - __builtin_clzll(v - 1));
 	}
 };
 
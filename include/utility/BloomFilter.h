@@ -0,0 +1,334 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BLOOMFILTER_H_
+#define ZILLIANS_BLOOMFILTER_H_
+
+#include "core/Buffer.h"
+#include "utility/HashUtil.h"
+#include "utility/UUIDUtil.h"
+
+#include <boost/noncopyable.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace zillians {
+
+namespace detail {
+
+/**
+ * Odd multipliers picking the bit of each word of a block, one per word.
+ */
+static const uint32 BLOOM_FILTER_SALTS[8] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+}
+
+/**
+ * @brief BlockedBloomFilter is a split block Bloom filter for fast membership tests.
+ *
+ * Each key sets one bit in each of the eight 32-bit words of a single 32-byte
+ * block, so a test touches one cache line and no more, and the eight bits are
+ * computed and tested with a couple of AVX2 instructions when available. The
+ * filter never reports a false negative, and reports a false positive at about
+ * the rate it's sized for.
+ *
+ * Keys are given as 64-bit hashes, the high half picks the block and the low
+ * half the bits. Use hashOf() to hash UUIDs, a single multiply over both halves
+ * since not all UUIDs are random: the time-based ones keep most of their entropy
+ * in a few bytes.
+ *
+ * insertConcurrent() can be called by many threads at once, while insert() and
+ * the tests must not race with any insertion. serialize() writes the filter to
+ * a Buffer, to be read back by deserialize() on another node.
+ *
+ * @code
+ * BlockedBloomFilter known(expected_ids, 0.01);
+ * known.insert(id);
+ * ...
+ * if(known.contains(id))
+ *     lookup(id);// may still be a miss, once in a hundred
+ * @endcode
+ */
+class BlockedBloomFilter : public boost::noncopyable
+{
+public:
+	enum
+	{
+		BLOCK_WORDS = 8,
+		BLOCK_SIZE = BLOCK_WORDS * sizeof(uint32),
+	};
+
+	/**
+	 * @brief Create a filter sized for the given number of keys and false positive rate.
+	 */
+	explicit BlockedBloomFilter(std::size_t expected = 1024, double false_positive_rate = 0.01);
+	~BlockedBloomFilter();
+
+public:
+	static inline uint64 hashOf(const UUID& id)
+	{
+		return HashUtil::mix(id.data.u64[0] ^ 0x9e3779b97f4a7c15ULL, id.data.u64[1] ^ 0xc2b2ae3d27d4eb4fULL);
+	}
+
+	inline void insert(uint64 hash)
+	{
+		uint32* block = blockOf(hash);
+#if defined(__AVX2__)
+		__m256i* b = reinterpret_cast<__m256i*>(block);
+		_mm256_store_si256(b, _mm256_or_si256(_mm256_load_si256(b), maskOf((uint32)hash)));
+#else
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+			block[i] |= bitOf((uint32)hash, i);
+#endif
+	}
+
+	/**
+	 * @brief Insert from any number of threads at once, words having the bit already are not written.
+	 */
+	inline void insertConcurrent(uint64 hash)
+	{
+		uint32* block = blockOf(hash);
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+		{
+			const uint32 bit = bitOf((uint32)hash, i);
+			if((__atomic_load_n(&block[i], __ATOMIC_RELAXED) & bit) == 0)
+				__atomic_fetch_or(&block[i], bit, __ATOMIC_RELAXED);
+		}
+	}
+
+	inline bool contains(uint64 hash) const
+	{
+		const uint32* block = blockOf(hash);
+#if defined(__AVX2__)
+		return _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(block)), maskOf((uint32)hash)) != 0;
+#else
+		uint32 missing = 0;
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+			missing |= ~block[i] & bitOf((uint32)hash, i);
+		return missing == 0;
+#endif
+	}
+
+	inline void insert(const UUID& id)
+	{
+		insert(hashOf(id));
+	}
+
+	inline void insertConcurrent(const UUID& id)
+	{
+		insertConcurrent(hashOf(id));
+	}
+
+	inline bool contains(const UUID& id) const
+	{
+		return contains(hashOf(id));
+	}
+
+	void clear();
+
+	/**
+	 * @brief Add all keys of the other filter, which must have the same number of blocks.
+	 *
+	 * @return False if the filters have different sizes.
+	 */
+	bool merge(const BlockedBloomFilter& other);
+
+	void serialize(Buffer& buffer) const;
+
+	/**
+	 * @brief Replace the filter by the one serialized at the read position of the buffer.
+	 *
+	 * @return False if the buffer doesn't hold a whole filter, which is then left untouched.
+	 */
+	bool deserialize(Buffer& buffer);
+
+	inline std::size_t blockCount() const
+	{
+		return mBlockCount;
+	}
+
+	inline std::size_t sizeInBytes() const
+	{
+		return mBlockCount * BLOCK_SIZE;
+	}
+
+	/**
+	 * @brief The number of blocks holding the given number of keys at the given false positive rate.
+	 */
+	static std::size_t blocksFor(std::size_t expected, double false_positive_rate);
+
+private:
+	inline uint32* blockOf(uint64 hash) const
+	{
+		return mBlocks + ((((hash >> 32) * mBlockCount) >> 32) * BLOCK_WORDS);
+	}
+
+	static inline uint32 bitOf(uint32 key, std::size_t word)
+	{
+		return 1U << ((key * detail::BLOOM_FILTER_SALTS[word]) >> 27);
+	}
+
+#if defined(__AVX2__)
+	static inline __m256i maskOf(uint32 key)
+	{
+		const __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(detail::BLOOM_FILTER_SALTS));
+		__m256i shifts = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((int)key), salts), 27);
+		return _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+	}
+#endif
+
+	void allocate(std::size_t blocks);
+
+private:
+	uint32* mBlocks;
+	std::size_t mBlockCount;
+};
+
+/**
+ * @brief CountingBloomFilter is a blocked Bloom filter whose keys can be removed.
+ *
+ * Each key increments one 4-bit counter in each of the eight 64-bit words of
+ * a 64-byte block, so it still touches a single cache line but takes about four
+ * times the memory of BlockedBloomFilter for a given false positive rate. A
+ * counter stops at 15 and is never decremented from there, so a saturated
+ * counter keeps its keys in the filter once they are all removed, it never
+ * causes a false negative.
+ *
+ * @note Unlike BlockedBloomFilter, there is no concurrent insertion, guard the
+ * filter with a lock when it's modified by many threads.
+ */
+class CountingBloomFilter : public boost::noncopyable
+{
+public:
+	enum
+	{
+		BLOCK_WORDS = 8,
+		BLOCK_SIZE = BLOCK_WORDS * sizeof(uint64),
+		COUNTER_MAX = 15,
+	};
+
+	explicit CountingBloomFilter(std::size_t expected = 1024, double false_positive_rate = 0.01);
+	~CountingBloomFilter();
+
+public:
+	inline void insert(uint64 hash)
+	{
+		uint64* block = blockOf(hash);
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+		{
+			const uint32 shift = shiftOf((uint32)hash, i);
+			if(((block[i] >> shift) & COUNTER_MAX) != COUNTER_MAX)
+				block[i] += uint64(1) << shift;
+		}
+	}
+
+	/**
+	 * @brief Remove a key inserted before, removing a key which was never inserted corrupts the filter.
+	 *
+	 * @return False if the key is not in the filter, which is then left untouched.
+	 */
+	inline bool remove(uint64 hash)
+	{
+		if(!contains(hash))
+			return false;
+
+		uint64* block = blockOf(hash);
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+		{
+			const uint32 shift = shiftOf((uint32)hash, i);
+			if(((block[i] >> shift) & COUNTER_MAX) != COUNTER_MAX)
+				block[i] -= uint64(1) << shift;
+		}
+		return true;
+	}
+
+	inline bool contains(uint64 hash) const
+	{
+		const uint64* block = blockOf(hash);
+		bool found = true;
+		for(std::size_t i = 0; i < BLOCK_WORDS; ++i)
+			found &= ((block[i] >> shiftOf((uint32)hash, i)) & COUNTER_MAX) != 0;
+		return found;
+	}
+
+	inline void insert(const UUID& id)
+	{
+		insert(BlockedBloomFilter::hashOf(id));
+	}
+
+	inline bool remove(const UUID& id)
+	{
+		return remove(BlockedBloomFilter::hashOf(id));
+	}
+
+	inline bool contains(const UUID& id) const
+	{
+		return contains(BlockedBloomFilter::hashOf(id));
+	}
+
+	void clear();
+
+	void serialize(Buffer& buffer) const;
+
+	/**
+	 * @brief Replace the filter by the one serialized at the read position of the buffer.
+	 *
+	 * @return False if the buffer doesn't hold a whole filter, which is then left untouched.
+	 */
+	bool deserialize(Buffer& buffer);
+
+	inline std::size_t blockCount() const
+	{
+		return mBlockCount;
+	}
+
+	inline std::size_t sizeInBytes() const
+	{
+		return mBlockCount * BLOCK_SIZE;
+	}
+
+private:
+	inline uint64* blockOf(uint64 hash) const
+	{
+		return mBlocks + ((((hash >> 32) * mBlockCount) >> 32) * BLOCK_WORDS);
+	}
+
+	/**
+	 * The counter of each word is picked by the top 4 bits of the salted key.
+	 */
+	static inline uint32 shiftOf(uint32 key, std::size_t word)
+	{
+		return ((key * detail::BLOOM_FILTER_SALTS[word]) >> 28) * 4;
+	}
+
+	void allocate(std::size_t blocks);
+
+private:
+	uint64* mBlocks;
+	std::size_t mBlockCount;
+};
+
+}
+
+#endif/*ZILLIANS_BLOOMFILTER_H_*/
@@ -0,0 +1,137 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_CHECKSUMUTIL_H_
+#define ZILLIANS_CHECKSUMUTIL_H_
+
+#include "core/Types.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace zillians {
+
+namespace detail {
+
+/**
+ * Table of the reflected Castagnoli polynomial for the byte-wise software CRC32C.
+ */
+struct crc32c_table
+{
+	crc32c_table()
+	{
+		for(uint32 i = 0; i < 256; ++i)
+		{
+			uint32 crc = i;
+			for(int bit = 0; bit < 8; ++bit)
+				crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+			entries[i] = crc;
+		}
+	}
+
+	static const crc32c_table& instance()
+	{
+		static crc32c_table table;
+		return table;
+	}
+
+	uint32 entries[256];
+};
+
+inline uint32 crc32c_software(uint32 crc, const byte* data, std::size_t size)
+{
+	const uint32* table = crc32c_table::instance().entries;
+	for(std::size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32 crc32c_hardware(uint32 crc, const byte* data, std::size_t size)
+{
+	uint64 crc64 = crc;
+	for(; size >= sizeof(uint64); size -= sizeof(uint64), data += sizeof(uint64))
+	{
+		uint64 v; ::memcpy(&v, data, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = (uint32)crc64;
+	for(; size > 0; --size, ++data)
+		crc = _mm_crc32_u8(crc, *data);
+	return crc;
+}
+
+inline bool crc32c_has_hardware()
+{
+	static const bool supported = __builtin_cpu_supports("sse4.2");
+	return supported;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+inline uint32 crc32c_hardware(uint32 crc, const byte* data, std::size_t size)
+{
+	for(; size >= sizeof(uint64); size -= sizeof(uint64), data += sizeof(uint64))
+	{
+		uint64 v; ::memcpy(&v, data, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	for(; size > 0; --size, ++data)
+		crc = __crc32cb(crc, *data);
+	return crc;
+}
+
+inline bool crc32c_has_hardware()
+{
+	return true;
+}
+#endif
+
+}
+
+/**
+ * Update a CRC32C (Castagnoli) checksum with more data, start from zero.
+ *
+ * Checksums chain, i.e. crc32c(crc32c(0, a), b) is the checksum of a followed by b, so
+ * data can be checksummed piece by piece as it streams through. SSE4.2 or ARMv8 CRC
+ * instructions are used when available, otherwise a table-driven software version.
+ *
+ * @param crc The checksum of the preceding data.
+ * @param data The data to be added.
+ * @param size The size of the data.
+ * @return The checksum of the preceding data followed by the given data.
+ */
+inline uint32 crc32c(uint32 crc, const void* data, std::size_t size)
+{
+	const byte* p = static_cast<const byte*>(data);
+	crc = ~crc;
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+	if(detail::crc32c_has_hardware())
+		return ~detail::crc32c_hardware(crc, p, size);
+#endif
+	return ~detail::crc32c_software(crc, p, size);
+}
+
+}
+
+#endif/*ZILLIANS_CHECKSUMUTIL_H_*/
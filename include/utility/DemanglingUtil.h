@@ -30,12 +30,23 @@
 
 namespace zillians {
 
-std::string demangle(const std::type_info &ti);
+/**
+ * @brief Get the human readable name of the type.
+ *
+ * Each type is only demangled once, the name is kept in a process-wide cache keyed
+ * by the address of the type_info, safe to be read and filled from any thread. The
+ * returned name lives as long as the process.
+ */
+const std::string& demangle(const std::type_info &ti);
 
+/**
+ * @brief Get the human readable name of T, looked up only on the first call per type.
+ */
 template<typename T>
-std::string demangle()
+const std::string& demangle()
 {
-	return demangle(typeid(T));
+	static const std::string& name = demangle(typeid(T));
+	return name;
 }
 
 
@@ -120,11 +131,19 @@ struct tuple_dumper<boost::tuple<T0,T1,T2,T3,T4,T5,T6,T7,T8,T9>>
 }
 
 template<typename T>
-std::string demangle_tuple()
+const std::string& demangle_tuple()
 {
-	std::stringstream ss;
-	detail::tuple_dumper<T>::dump(ss);
-	return ss.str();
+	struct dumper
+	{
+		static std::string dump()
+		{
+			std::stringstream ss;
+			detail::tuple_dumper<T>::dump(ss);
+			return ss.str();
+		}
+	};
+	static const std::string name = dumper::dump();
+	return name;
 }
 
 }
@@ -0,0 +1,152 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_DEPENDENCYSNAPSHOT_H_
+#define ZILLIANS_DEPENDENCYSNAPSHOT_H_
+
+#include "core/Prerequisite.h"
+#include "utility/GraphUtil.h"
+
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief DependencySnapshot is a memory-mapped, read-only dependency graph saved by DependencySolver::save().
+ *
+ * The file holds the graph in CSR form, see compact_digraph_view, the node names
+ * as an interned string table, and an open addressing hash table from the names
+ * to the node ids. Everything is addressed by file offsets, so open() only maps
+ * the file and checks the header, and all queries run on the mapped pages in
+ * place. Node ids of a snapshot are the positions of the nodes in load order,
+ * thus every requirement of a node has a smaller id than the node.
+ *
+ * @code
+ * DependencySnapshot snapshot;
+ * if(snapshot.open("modules.dep"))
+ * {
+ *     std::vector<DependencySnapshot::NodeId> requirements;
+ *     snapshot.compileRequireNodes(snapshot.getNodeId("renderer"), requirements);
+ * }
+ * @endcode
+ *
+ * The layout is in native byte order and the header records it, a snapshot
+ * written on a machine of the other byte order is rejected by open().
+ *
+ * @note All query functions are const and safe to call concurrently.
+ */
+class DependencySnapshot : public boost::noncopyable
+{
+public:
+	typedef compact_digraph_view::vertex_id NodeId;
+
+	static inline NodeId invalidNodeId()
+	{
+		return (NodeId)-1;
+	}
+
+public:
+	DependencySnapshot();
+	~DependencySnapshot();
+
+public:
+	/**
+	 * @brief Map the snapshot file.
+	 *
+	 * Only the header and the bounds of the sections are checked unless verify
+	 * is set, which also checks every edge and name, touching the whole file.
+	 * Use it for snapshots from an untrusted source.
+	 *
+	 * @return False if the file can't be mapped or is not a valid snapshot.
+	 */
+	bool open(const std::string& path, bool verify = false);
+	void close();
+
+	inline bool isOpen() const
+	{
+		return mData != NULL;
+	}
+
+	/**
+	 * @brief Write a snapshot of the graph to the file, replacing it atomically.
+	 *
+	 * @param names The name of each node, the nodes must be given in load order.
+	 * @param offsets The requirements of node i are requirements[offsets[i]] up to requirements[offsets[i + 1]].
+	 * @param requirements The requirements of all nodes, each one must have a smaller id than its node.
+	 *
+	 * @return False if the graph breaks the load order or the file can't be written.
+	 */
+	static bool write(const std::string& path, const std::vector<std::string>& names, const std::vector<uint32>& offsets, const std::vector<NodeId>& requirements);
+
+public:
+	inline std::size_t getNodeCount() const
+	{
+		return mGraph.vertexCount();
+	}
+
+	inline const compact_digraph_view& getGraph() const
+	{
+		return mGraph;
+	}
+
+	NodeId getNodeId(const std::string& id) const;
+
+	/**
+	 * @brief Get the name of the node, which stays valid until the snapshot is closed.
+	 */
+	const char* getNodeName(NodeId node) const;
+	std::size_t getNodeNameLength(NodeId node) const;
+
+	bool isDependencyExist(NodeId node, NodeId require_node) const;
+
+	/**
+	 * @brief Get all nodes required by the node, directly or not, in load order.
+	 */
+	bool compileRequireNodes(NodeId node, /*OUT*/ std::vector<NodeId>& result) const;
+
+	/**
+	 * @brief Get all nodes depending on the node, directly or not, in unload order.
+	 */
+	bool compileDependentNodes(NodeId node, /*OUT*/ std::vector<NodeId>& result) const;
+
+private:
+	bool validate(std::size_t size, bool verify);
+	void compileClosure(NodeId node, bool requirements, std::vector<NodeId>& result) const;
+
+private:
+	struct Header;
+
+	byte* mData;
+	std::size_t mSize;
+
+	compact_digraph_view mGraph;
+	const uint32* mNameOffsets;		///< Offset of the name of each node in mNames, one more for the end of the last name
+	const char* mNames;				///< Node names, each one null terminated
+	const uint32* mBuckets;			///< Hash table from names to node ids, invalidNodeId() for empty buckets
+	uint32 mBucketMask;
+
+private:
+	static log4cxx::LoggerPtr mLogger;
+};
+
+}
+
+#endif /* ZILLIANS_DEPENDENCYSNAPSHOT_H_ */
@@ -29,14 +29,36 @@
 #include "core/Singleton.h"
 #include "utility/GraphUtil.h"
 
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/visitors.hpp>
-#include <boost/graph/graph_traits.hpp>
-#include <boost/graph/topological_sort.hpp>
-#include <boost/pending/property.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <vector>
+#include <list>
 
 namespace zillians {
 
+class DependencySnapshot;
+
+/**
+ * @brief DependencySolver orders named nodes (modules, services...) by the requirements among them.
+ *
+ * Names are interned into NodeId once when the node is added, and the graph
+ * itself is a compact_digraph on those ids, where an edge goes from a node to
+ * each node it requires. The string based functions are thin wrappers which
+ * look up the id, so callers dealing with many operations on the same nodes
+ * can use the NodeId overloads directly.
+ *
+ * The load order is maintained incrementally with the dynamic topological sort
+ * of Pearce and Kelly: adding a dependency which is already satisfied by the
+ * current order costs nothing, otherwise only the nodes positioned between the
+ * two ends of the new dependency are visited and reordered. A dependency which
+ * would close a cycle is rejected right away by addDependency(), so the graph
+ * is always a DAG and the compile functions never have to sort it again.
+ *
+ * The transitive requirements and dependents of a node are memoized the first
+ * time they're compiled, and a changed dependency only drops the memoized
+ * closures of the nodes on either side of it, see compileRequireNodes().
+ */
 class DependencySolver
 {
 public:
@@ -44,23 +66,19 @@ public:
 	virtual ~DependencySolver();
 
 public:
-	typedef indirect_graph_traits<std::string, int > IndirectGraphTraits;
+	typedef compact_digraph::vertex_id NodeId;
 
-	typedef boost::property<boost::vertex_index_t, std::size_t,
-			boost::property<boost::vertex_color_t, bool,
-			boost::property<boost::vertex_name_t, std::string,
-			IndirectGraphTraits::vertex_property> > > ModuleProperty;
-	typedef boost::property<boost::edge_name_t, std::string,
-			IndirectGraphTraits::edge_property> EdgeProperty;
+	/// Nodes in the same level don't depend on each other, and all their requirements are in earlier levels
+	typedef std::vector< std::vector<std::string> > Levels;
+	typedef std::vector< std::vector<NodeId> > NodeIdLevels;
 
-	typedef boost::adjacency_list<boost::setS, boost::listS, boost::bidirectionalS, ModuleProperty, EdgeProperty> Graph;
-	typedef boost::graph_traits<Graph> Traits;
+	/// Called once for each node by execute(), the function signature must be: @code void handler(const std::string& id); @endcode
+	typedef boost::function< void(const std::string&) > NodeHandler;
 
-	typedef Traits::edge_descriptor EdgeDescriptor;
-	typedef Traits::vertex_descriptor VertexDescriptor;
-	typedef Traits::vertex_iterator vertex_iter;
-	typedef Traits::in_edge_iterator in_edge_iter;
-	typedef Traits::out_edge_iterator out_edge_iter;
+	static inline NodeId invalidNodeId()
+	{
+		return compact_digraph::null_vertex();
+	}
 
 public:
 	bool addNode(const std::string& id);
@@ -71,21 +89,143 @@ public:
 	bool isDependencyExist(const std::string& id, const std::string& require_id);
 	void clear();
 
+public:
+	/**
+	 * @brief Get the interned id of the node, or invalidNodeId() if there's no such node.
+	 *
+	 * The id of a node is valid until the node is removed, after which it may be given to another node.
+	 */
+	NodeId getNodeId(const std::string& id) const;
+	const std::string& getNodeName(NodeId node) const;
+
+	/**
+	 * @brief Add the dependency and update the load order.
+	 *
+	 * @return False if the dependency is invalid, duplicated, or makes a cycle,
+	 * in which case the graph is left unchanged.
+	 */
+	bool addDependency(NodeId node, NodeId require_node);
+	bool removeNode(NodeId node);
+	bool removeDependency(NodeId node, NodeId require_node);
+	bool isDependencyExist(NodeId node, NodeId require_node) const;
+
+	/**
+	 * @brief Get all nodes required by the node, directly or not, in load order.
+	 *
+	 * The result is memoized per node, so asking again for the same node only
+	 * copies the memoized list. Adding or removing a dependency drops the
+	 * memoized requirements of the depending node and of everything depending
+	 * on it, and the memoized dependents of the required node and of its
+	 * requirements. A new dependency which reorders the load order drops all.
+	 *
+	 * @note Safe to call concurrently with the other const functions, but not
+	 * with functions changing the graph.
+	 */
+	bool compileRequireNodes(NodeId node, /*OUT*/ std::vector<NodeId>& result) const;
+
+	/**
+	 * @brief Get all nodes depending on the node, directly or not, in unload order.
+	 *
+	 * Memoized like compileRequireNodes().
+	 */
+	bool compileDependentNodes(NodeId node, /*OUT*/ std::vector<NodeId>& result) const;
+
+	inline std::size_t getNodeCount() const
+	{
+		return mGraph.vertexCount();
+	}
+
+public:
+	/**
+	 * @brief Write the graph to a snapshot file, which DependencySnapshot maps for read-only queries.
+	 *
+	 * The nodes are numbered by their position in the load order in the snapshot,
+	 * so their ids there generally differ from the ids here.
+	 */
+	bool save(const std::string& path) const;
+
+	/**
+	 * @brief Replace the graph by the one in the snapshot file.
+	 *
+	 * This takes the load order from the snapshot instead of sorting the graph
+	 * one dependency at a time, and the node ids become the ids in the snapshot.
+	 *
+	 * @return False if the file is not a valid snapshot, in which case the graph is left unchanged.
+	 */
+	bool load(const std::string& path);
+	bool load(const DependencySnapshot& snapshot);
+
 public:
 	 bool compileTopologicalOrder(std::list<std::string>& result);
 	 bool compileReversedTopologicalOrder(std::list<std::string>& result);
 	 bool compileRequireNodes(/*IN*/ const std::string& id, /*OUT*/ std::list<std::string>& result);
 	 bool compileDependentNodes(/*IN*/ const std::string& id, /*OUT*/ std::list<std::string>& result);
 
+	 /**
+	  * @brief Group nodes into topological levels, the first level has no requirement at all.
+	  *
+	  * All nodes of a level can be loaded at once after the previous levels
+	  * are loaded, and the levels in reverse give an unload order.
+	  */
+	 bool compileTopologicalLevels(/*OUT*/ Levels& result);
+	 bool compileTopologicalLevels(/*OUT*/ NodeIdLevels& result);
+
+	 /**
+	  * @brief Call the handler for every node in load order, the nodes of each level in parallel.
+	  *
+	  * A level starts only after the handlers of all nodes in the previous
+	  * level returned. If a handler throws, the remaining levels are skipped
+	  * and the exception is propagated by TBB to the caller.
+	  *
+	  * @return False if the dependency graph is not a DAG, in which case no handler is called.
+	  */
+	 bool execute(const NodeHandler& handler);
+
 private:
-	 void findRequireNode(/*IN*/ const VertexDescriptor& v);
-	 void findDependentNode(/*IN*/ const VertexDescriptor& v);
+	 /**
+	  * Kahn's algorithm over the nodes selected by the mask, or all nodes if
+	  * mask is NULL. Only requirements among the selected nodes count.
+	  */
+	 bool compileLevels(/*IN*/ const std::vector<bool>* mask, /*OUT*/ NodeIdLevels& levels);
+
+	 /**
+	  * Move require_node before node in the load order if it's not already,
+	  * return false if node is required by require_node (directly or not).
+	  */
+	 bool reorder(NodeId node, NodeId require_node);
+	 void compactOrder();
+	 void sortByPosition(std::vector<NodeId>& nodes) const;
+
+	 typedef shared_ptr<const std::vector<NodeId> > Closure;
+
+	 /**
+	  * The memoized transitive requirements (or dependents) of node in load
+	  * order, computed on the first call. The search doesn't descend into the
+	  * nodes whose closure is already memoized, it takes their closure instead.
+	  */
+	 Closure getClosure(NodeId node, bool requirements) const;
+
+	 /**
+	  * Drop the memoized closures of node and of all nodes reached from it
+	  * through the in-edges (requirements == true) or the out-edges.
+	  */
+	 void invalidateClosures(NodeId node, bool requirements);
+	 void invalidateClosures();
 
 private:
-	Graph mDependencyGraph;
-	indirect_graph_mapping<IndirectGraphTraits, VertexDescriptor, EdgeDescriptor>  mMapping;
-	boost::property_map<Graph, boost::vertex_index_t>::type mIndex; ///< the vertex index for topological sort(for listS)
-	boost::property_map<Graph, boost::vertex_color_t>::type mGroupFlag;///< the flag to mark traveled vertices in recursive work
+	compact_digraph mGraph;
+	boost::unordered_map<std::string, NodeId> mNodeIds;
+	std::vector<std::string> mNodeNames;		///< Name of each node indexed by NodeId
+
+	std::vector<std::size_t> mPosition;			///< Position of each node in the load order, indexed by NodeId
+	std::vector<NodeId> mOrder;					///< Nodes in load order, removed nodes leave invalidNodeId() behind
+	std::size_t mOrderHoles;					///< Number of removed nodes left in mOrder
+	std::vector<bool> mVisited;					///< Scratch marks of reorder(), all false between calls
+
+	mutable boost::shared_mutex mClosureMutex;
+	mutable std::vector<Closure> mRequireClosures;		///< Memoized requirements of each node, indexed by NodeId
+	mutable std::vector<Closure> mDependentClosures;	///< Memoized dependents of each node, indexed by NodeId
+	mutable std::size_t mClosureCount[2];				///< Number of memoized dependent and require closures, nothing to drop when zero
 
 private:
 	static log4cxx::LoggerPtr mLogger;
@@ -21,6 +21,15 @@
 #define ZILLIANS_FILESYSTEM_H_
 
 #include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <deque>
+#include <list>
+#include <vector>
 #ifdef _WIN32
 #else
 #include <unistd.h>
@@ -113,6 +122,152 @@ public:
 		return boost::filesystem::path(sym_link);
 #endif
 	}
+
+	typedef boost::function<void(const boost::filesystem::path&)> FileVisitor;
+
+	/**
+	 * @brief Visit all regular files under root, walking sub-directories in parallel.
+	 *
+	 * Each directory is listed by a task of its own. On Linux the entries are read
+	 * in batches with getdents64, and their types come along, so only links and file
+	 * systems not telling types cost a stat() per entry. Links to directories are
+	 * not followed.
+	 *
+	 * @note The visitor is called concurrently from several threads.
+	 */
+	static void walk(const boost::filesystem::path& root, const FileVisitor& visitor);
+
+	/**
+	 * @brief Collect all regular files under root, see walk().
+	 *
+	 * Meant for the initial scan only, use a Watcher to follow the changes afterwards.
+	 * The order of the returned files is unspecified.
+	 */
+	static void scan(const boost::filesystem::path& root, std::vector<boost::filesystem::path>& files);
+
+	/**
+	 * @brief PathCache remembers normalize_path() of the most recently used paths.
+	 *
+	 * Normalizing resolves the path against the current directory and walks its
+	 * components, checking for links on the way, which adds up when the same paths
+	 * come by again and again. The least recently used path is forgotten once the
+	 * cache is full.
+	 *
+	 * Cached results are not checked again, so clear() the cache when links in the
+	 * cached paths may have changed, e.g. on the events of a Watcher.
+	 *
+	 * @note PathCache is thread-safe.
+	 */
+	class PathCache : public boost::noncopyable
+	{
+	public:
+		explicit PathCache(std::size_t capacity = 4096);
+
+	public:
+		boost::filesystem::path normalize(const boost::filesystem::path& p);
+		void clear();
+
+		std::size_t size() const;
+		std::size_t capacity() const
+		{
+			return mCapacity;
+		}
+
+	private:
+		typedef std::list<std::pair<std::string, boost::filesystem::path> > Entries;
+
+		mutable boost::mutex mMutex;
+		std::size_t mCapacity;
+		Entries mEntries;		///< Most recently used first
+		boost::unordered_map<std::string, Entries::iterator> mIndex;
+	};
+
+	/**
+	 * @brief Watcher delivers the changes under a directory tree from the operating system.
+	 *
+	 * The changes come from inotify on Linux, ReadDirectoryChangesW() on Windows and kqueue
+	 * elsewhere, so following a tree costs nothing until something changes, instead of a
+	 * rescan of the whole tree each time:
+	 *
+	 * @code
+	 * std::vector<boost::filesystem::path> files;
+	 * Filesystem::Watcher watcher(root);		// before the scan, so nothing is missed
+	 * Filesystem::scan(root, files);
+	 * ...
+	 * std::vector<Filesystem::Watcher::Event> events;
+	 * while(watcher.poll(events, boost::posix_time::seconds(1)))
+	 *     ...
+	 * @endcode
+	 *
+	 * Events are reported for files and directories alike. A directory created or moved
+	 * into the tree is reported with everything it contains, a directory moved out of the
+	 * tree is only reported itself. When the system drops events, a single RESCAN event
+	 * on root tells that the state of the tree is unknown and it has to be scanned again.
+	 *
+	 * @note Watcher is not thread-safe, poll() it from one thread.
+	 * @note kqueue keeps a descriptor open for each watched file and directory.
+	 */
+	class Watcher : public boost::noncopyable
+	{
+	public:
+		enum Action
+		{
+			ADDED,
+			REMOVED,
+			MODIFIED,
+			RESCAN,
+		};
+
+		struct Event
+		{
+			Event(const boost::filesystem::path& path, Action action) : path(path), action(action)
+			{ }
+
+			boost::filesystem::path path;
+			Action action;
+		};
+
+		/**
+		 * @brief Start watching the tree under root.
+		 *
+		 * @param latency How long poll() keeps collecting once something changed, so
+		 *                bursts like a file being written in pieces come out as one event.
+		 */
+		explicit Watcher(const boost::filesystem::path& root, const boost::posix_time::time_duration& latency = boost::posix_time::milliseconds(50));
+		~Watcher();
+
+	public:
+		/**
+		 * @brief Check if the tree is really watched, false if root is no directory or the system refuses.
+		 */
+		bool valid() const;
+
+		const boost::filesystem::path& root() const
+		{
+			return mRoot;
+		}
+
+		/**
+		 * @brief Wait for changes and get them coalesced, at most one event per path.
+		 *
+		 * A path added and modified is ADDED, removed and added again is MODIFIED, and
+		 * added and removed again is not reported at all. Events keep the order in
+		 * which their paths first changed.
+		 *
+		 * @param events The events, replacing the previous content.
+		 * @param timeout How long to wait for the first change.
+		 *
+		 * @return The number of events, zero on timeout.
+		 */
+		std::size_t poll(std::vector<Event>& events, const boost::posix_time::time_duration& timeout);
+
+	private:
+		struct Impl;
+
+		boost::filesystem::path mRoot;
+		boost::posix_time::time_duration mLatency;
+		boost::scoped_ptr<Impl> mImpl;
+	};
 };
 
 }
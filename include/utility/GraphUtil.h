@@ -26,6 +26,9 @@
 
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graph_traits.hpp>
+#include <boost/cstdint.hpp>
+#include <vector>
+#include <algorithm>
 
 enum edge_indirect_reference_t { edge_indirect_reference };
 enum vertex_indirect_reference_t { vertex_indirect_reference };
@@ -739,6 +742,280 @@ inline typename Graph::edge_descriptor edge(
 	return result.first;
 }
 
+/**
+ * Compact Digraph View is a read-only directed graph in compressed sparse row (CSR) form over external memory.
+ *
+ * The out-edges of vertex u are out_targets[out_offsets[u]] up to out_targets[out_offsets[u + 1]],
+ * and likewise for the in-edges, so the arrays can live anywhere, typically in a
+ * memory-mapped file, and the view never copies or frees them. Vertex ids are dense,
+ * every id below vertexCount() is a vertex, and hasEdge() expects the edge lists to be
+ * sorted by id.
+ *
+ * @see compact_digraph::assign
+ */
+class compact_digraph_view
+{
+public:
+	typedef boost::uint32_t vertex_id;
+
+	/// Range of the edge list of a vertex, usable with the same loops as compact_digraph::edge_list
+	struct edge_range
+	{
+		typedef const vertex_id* const_iterator;
+
+		edge_range(const vertex_id* first, const vertex_id* last) : first(first), last(last)
+		{ }
+
+		inline const_iterator begin() const { return first; }
+		inline const_iterator end() const { return last; }
+		inline std::size_t size() const { return last - first; }
+		inline bool empty() const { return first == last; }
+
+		const vertex_id* first;
+		const vertex_id* last;
+	};
+
+public:
+	compact_digraph_view() :
+		mVertexCount(0), mOutOffsets(NULL), mOutTargets(NULL), mInOffsets(NULL), mInSources(NULL)
+	{ }
+
+	/**
+	 * @param vertex_count The number of vertices, each offset array has vertex_count + 1 entries.
+	 */
+	compact_digraph_view(std::size_t vertex_count, const boost::uint32_t* out_offsets, const vertex_id* out_targets, const boost::uint32_t* in_offsets, const vertex_id* in_sources) :
+		mVertexCount(vertex_count), mOutOffsets(out_offsets), mOutTargets(out_targets), mInOffsets(in_offsets), mInSources(in_sources)
+	{ }
+
+public:
+	inline bool isVertex(vertex_id u) const
+	{
+		return u < mVertexCount;
+	}
+
+	inline edge_range outEdges(vertex_id u) const
+	{
+		return edge_range(mOutTargets + mOutOffsets[u], mOutTargets + mOutOffsets[u + 1]);
+	}
+
+	inline edge_range inEdges(vertex_id u) const
+	{
+		return edge_range(mInSources + mInOffsets[u], mInSources + mInOffsets[u + 1]);
+	}
+
+	bool hasEdge(vertex_id u, vertex_id v) const
+	{
+		if(!isVertex(u) || !isVertex(v)) return false;
+
+		edge_range out = outEdges(u);
+		edge_range in = inEdges(v);
+		if(out.size() <= in.size())
+			return std::binary_search(out.begin(), out.end(), v);
+		else
+			return std::binary_search(in.begin(), in.end(), u);
+	}
+
+	inline std::size_t vertexCount() const
+	{
+		return mVertexCount;
+	}
+
+	inline std::size_t vertexCapacity() const
+	{
+		return mVertexCount;
+	}
+
+	inline std::size_t edgeCount() const
+	{
+		return mVertexCount ? mOutOffsets[mVertexCount] : 0;
+	}
+
+private:
+	std::size_t mVertexCount;
+	const boost::uint32_t* mOutOffsets;
+	const vertex_id* mOutTargets;
+	const boost::uint32_t* mInOffsets;
+	const vertex_id* mInSources;
+};
+
+/**
+ * Compact Digraph is a directed graph on integer vertex ids, kept in plain vectors indexed by id.
+ *
+ * It's the lightweight alternative to an adjacency_list with an indirect_graph_mapping
+ * for big graphs: looking up a vertex is an array access, and each vertex has one
+ * vector of out-edges and one of in-edges. Ids of removed vertices are reused by
+ * later addVertex() calls, so the id space stays as dense as the graph itself.
+ *
+ * Edges are kept unordered, hasEdge() scans the shorter of the two edge lists
+ * involved, which stays cheap as long as one side has a small degree.
+ */
+class compact_digraph
+{
+public:
+	typedef boost::uint32_t vertex_id;
+	typedef std::vector<vertex_id> edge_list;
+
+	static inline vertex_id null_vertex()
+	{
+		return (vertex_id)-1;
+	}
+
+public:
+	compact_digraph() : mVertexCount(0)
+	{ }
+
+public:
+	vertex_id addVertex()
+	{
+		vertex_id u;
+		if(mFreeVertices.empty())
+		{
+			u = (vertex_id)mAlive.size();
+			mAlive.push_back(true);
+			mOutEdges.push_back(edge_list());
+			mInEdges.push_back(edge_list());
+		}
+		else
+		{
+			u = mFreeVertices.back();
+			mFreeVertices.pop_back();
+			mAlive[u] = true;
+		}
+		++mVertexCount;
+		return u;
+	}
+
+	/**
+	 * Remove the vertex with all of its edges, the id will be reused by a later addVertex().
+	 */
+	bool removeVertex(vertex_id u)
+	{
+		if(!isVertex(u)) return false;
+
+		for(edge_list::iterator it = mOutEdges[u].begin(); it != mOutEdges[u].end(); ++it)
+			if(*it != u) eraseFrom(mInEdges[*it], u);
+		for(edge_list::iterator it = mInEdges[u].begin(); it != mInEdges[u].end(); ++it)
+			if(*it != u) eraseFrom(mOutEdges[*it], u);
+
+		// swap to actually release the memory of high degree vertices
+		edge_list().swap(mOutEdges[u]);
+		edge_list().swap(mInEdges[u]);
+		mAlive[u] = false;
+		mFreeVertices.push_back(u);
+		--mVertexCount;
+		return true;
+	}
+
+	bool addEdge(vertex_id u, vertex_id v)
+	{
+		if(!isVertex(u) || !isVertex(v) || hasEdge(u, v)) return false;
+
+		mOutEdges[u].push_back(v);
+		mInEdges[v].push_back(u);
+		return true;
+	}
+
+	bool removeEdge(vertex_id u, vertex_id v)
+	{
+		if(!isVertex(u) || !isVertex(v) || !eraseFrom(mOutEdges[u], v)) return false;
+
+		eraseFrom(mInEdges[v], u);
+		return true;
+	}
+
+	bool hasEdge(vertex_id u, vertex_id v) const
+	{
+		if(!isVertex(u) || !isVertex(v)) return false;
+
+		if(mOutEdges[u].size() <= mInEdges[v].size())
+			return std::find(mOutEdges[u].begin(), mOutEdges[u].end(), v) != mOutEdges[u].end();
+		else
+			return std::find(mInEdges[v].begin(), mInEdges[v].end(), u) != mInEdges[v].end();
+	}
+
+	inline bool isVertex(vertex_id u) const
+	{
+		return u < mAlive.size() && mAlive[u];
+	}
+
+	inline const edge_list& outEdges(vertex_id u) const
+	{
+		return mOutEdges[u];
+	}
+
+	inline const edge_list& inEdges(vertex_id u) const
+	{
+		return mInEdges[u];
+	}
+
+	/**
+	 * Number of vertices in the graph.
+	 */
+	inline std::size_t vertexCount() const
+	{
+		return mVertexCount;
+	}
+
+	/**
+	 * Upper bound of vertex ids, the size of arrays indexed by vertex id.
+	 */
+	inline std::size_t vertexCapacity() const
+	{
+		return mAlive.size();
+	}
+
+	void clear()
+	{
+		mOutEdges.clear();
+		mInEdges.clear();
+		mAlive.clear();
+		mFreeVertices.clear();
+		mVertexCount = 0;
+	}
+
+	/**
+	 * Replace the graph by a copy of the view, vertex ids are kept as they are.
+	 *
+	 * The edges are copied in bulk with no duplicate check, which makes this far
+	 * cheaper than adding them one by one for a high degree vertex.
+	 */
+	void assign(const compact_digraph_view& view)
+	{
+		const std::size_t n = view.vertexCount();
+		mOutEdges.assign(n, edge_list());
+		mInEdges.assign(n, edge_list());
+		mAlive.assign(n, true);
+		mFreeVertices.clear();
+		mVertexCount = n;
+
+		for(std::size_t u = 0; u < n; ++u)
+		{
+			compact_digraph_view::edge_range out = view.outEdges(u);
+			compact_digraph_view::edge_range in = view.inEdges(u);
+			mOutEdges[u].assign(out.begin(), out.end());
+			mInEdges[u].assign(in.begin(), in.end());
+		}
+	}
+
+private:
+	static bool eraseFrom(edge_list& edges, vertex_id u)
+	{
+		edge_list::iterator it = std::find(edges.begin(), edges.end(), u);
+		if(it == edges.end()) return false;
+
+		*it = edges.back();
+		edges.pop_back();
+		return true;
+	}
+
+private:
+	std::vector<edge_list> mOutEdges;
+	std::vector<edge_list> mInEdges;
+	std::vector<bool> mAlive;
+	std::vector<vertex_id> mFreeVertices;
+	std::size_t mVertexCount;
+};
+
 }
 
 #endif/*ZILLIANS_GRAPHUTIL_H_*/
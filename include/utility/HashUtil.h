@@ -0,0 +1,170 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_HASHUTIL_H_
+#define ZILLIANS_HASHUTIL_H_
+
+#include "core/Types.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace zillians {
+
+/**
+ * @brief Fast, well-distributed hash functions for hash containers.
+ *
+ * hash() is a wyhash-style byte hash: it reads the input 8 or 16 bytes at a time
+ * and mixes with a full 64x64->128 bit multiply, so every input bit reaches
+ * every output bit, including the low bits used by power-of-two bucket masks.
+ *
+ * hashPointer() is a multiply-fold mix of the address. Raw addresses make poor
+ * hashes since alignment leaves their low bits zero, which puts all pointers of
+ * a tbb::concurrent_hash_map into a fraction of its buckets.
+ *
+ * @note The values are not stable across versions and must not be persisted.
+ */
+class HashUtil
+{
+private:
+	HashUtil();
+	~HashUtil();
+
+public:
+	static inline std::size_t hash(const void* data, std::size_t length, uint64 seed = 0)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+
+		seed ^= mix(seed ^ SECRET0, SECRET1);
+
+		uint64 a, b;
+		if(length <= 16)
+		{
+			if(length >= 4)
+			{
+				std::size_t middle = (length >> 3) << 2;
+				a = (read32(p) << 32) | read32(p + middle);
+				b = (read32(p + length - 4) << 32) | read32(p + length - 4 - middle);
+			}
+			else if(length > 0)
+			{
+				a = ((uint64)p[0] << 16) | ((uint64)p[length >> 1] << 8) | p[length - 1];
+				b = 0;
+			}
+			else
+			{
+				a = b = 0;
+			}
+		}
+		else
+		{
+			std::size_t i = length;
+			if(i > 48)
+			{
+				uint64 see1 = seed, see2 = seed;
+				do
+				{
+					seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+					see1 = mix(read64(p + 16) ^ SECRET2, read64(p + 24) ^ see1);
+					see2 = mix(read64(p + 32) ^ SECRET3, read64(p + 40) ^ see2);
+					p += 48;
+					i -= 48;
+				} while(i > 48);
+				seed ^= see1 ^ see2;
+			}
+			while(i > 16)
+			{
+				seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+				p += 16;
+				i -= 16;
+			}
+			a = read64(p + i - 16);
+			b = read64(p + i - 8);
+		}
+
+		a ^= SECRET1;
+		b ^= seed;
+		multiply(a, b);
+		return (std::size_t)mix(a ^ SECRET0 ^ length, b ^ SECRET1);
+	}
+
+	static inline std::size_t hashPointer(const void* p)
+	{
+		return (std::size_t)mix(reinterpret_cast<uintptr_t>(p), SECRET0);
+	}
+
+	static inline std::size_t hashInteger(uint64 x)
+	{
+		return (std::size_t)mix(x, SECRET0);
+	}
+
+	/**
+	 * Fold a 64-bit multiply into 64 bits, the high half of the product carries the most mixed bits.
+	 */
+	static inline uint64 mix(uint64 a, uint64 b)
+	{
+		multiply(a, b);
+		return a ^ b;
+	}
+
+private:
+	/**
+	 * Replace a and b by the low and the high half of their 128-bit product.
+	 */
+	static inline void multiply(uint64& a, uint64& b)
+	{
+#if defined(__SIZEOF_INT128__)
+		unsigned __int128 r = (unsigned __int128)a * b;
+		a = (uint64)r;
+		b = (uint64)(r >> 64);
+#else
+		uint64 ha = a >> 32, hb = b >> 32, la = (uint32)a, lb = (uint32)b;
+		uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+		uint64 t = rl + (rm0 << 32);
+		uint64 c = t < rl;
+		uint64 lo = t + (rm1 << 32);
+		c += lo < t;
+		a = lo;
+		b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+	}
+
+	static inline uint64 read64(const unsigned char* p)
+	{
+		uint64 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static inline uint64 read32(const unsigned char* p)
+	{
+		uint32 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static const uint64 SECRET0 = 0xa0761d6478bd642fULL;
+	static const uint64 SECRET1 = 0xe7037ed1a0b428dbULL;
+	static const uint64 SECRET2 = 0x8ebc6af09c88c6e3ULL;
+	static const uint64 SECRET3 = 0x589965cc75374cc3ULL;
+};
+
+}
+
+#endif/*ZILLIANS_HASHUTIL_H_*/
@@ -0,0 +1,143 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_PARALLELFOREACH_H_
+#define ZILLIANS_PARALLELFOREACH_H_
+
+#include "utility/Foreach.h"
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/pipeline.h>
+#include <algorithm>
+#include <iterator>
+
+/**
+ * @brief The number of elements of a node-based container handed to a worker at once.
+ */
+#define ZILLIANS_PARALLEL_FOREACH_CHUNK_SIZE	64
+
+namespace zillians {
+
+/**
+ * Integer ranges and random-access iterators can be split by TBB, anything else is walked sequentially.
+ */
+template<typename Iterator, bool Integral = boost::is_integral<Iterator>::value>
+struct foreach_random_access : boost::is_convertible<BOOST_DEDUCED_TYPENAME std::iterator_traits<Iterator>::iterator_category, std::random_access_iterator_tag>
+{ };
+
+template<typename Iterator>
+struct foreach_random_access<Iterator, true> : boost::true_type
+{ };
+
+/**
+ * The range of parallel_foreach, which runs the loop body given by operator->*.
+ */
+template<typename Iterator>
+struct parallel_foreach_range
+{
+	parallel_foreach_range(Iterator begin, Iterator end) : begin(begin), end(end)
+	{ }
+
+	template<typename Body>
+	void operator ->* (const Body& body) const
+	{
+		if(begin != end)
+			run(body, foreach_random_access<Iterator>());
+	}
+
+private:
+	/**
+	 * Random-access ranges are split recursively by tbb::parallel_for.
+	 */
+	template<typename Body>
+	void run(const Body& body, boost::true_type) const
+	{
+		tbb::parallel_for(tbb::blocked_range<Iterator>(begin, end), [&body](const tbb::blocked_range<Iterator>& r) {
+			for(Iterator i = r.begin(); i != r.end(); ++i)
+				body(i);
+		});
+	}
+
+	/**
+	 * Node-based containers can only be walked in order, so the walk is the serial stage of a pipeline
+	 * and the chunks of iterators it collects are processed in parallel.
+	 */
+	template<typename Body>
+	void run(const Body& body, boost::false_type) const
+	{
+		typedef std::vector<Iterator> chunk_type;
+
+		Iterator current = begin;
+		const Iterator last = end;
+		tbb::parallel_pipeline(std::max(1u, boost::thread::hardware_concurrency()) * 4,
+				tbb::make_filter<void, chunk_type*>(tbb::filter::serial_in_order, [&current, &last](tbb::flow_control& control) -> chunk_type* {
+					if(current == last)
+					{
+						control.stop();
+						return NULL;
+					}
+					chunk_type* chunk = new chunk_type();
+					chunk->reserve(ZILLIANS_PARALLEL_FOREACH_CHUNK_SIZE);
+					for(; current != last && chunk->size() < ZILLIANS_PARALLEL_FOREACH_CHUNK_SIZE; ++current)
+						chunk->push_back(current);
+					return chunk;
+				}) &
+				tbb::make_filter<chunk_type*, void>(tbb::filter::parallel, [&body](chunk_type* chunk) {
+					boost::scoped_ptr<chunk_type> guard(chunk);
+					for(typename chunk_type::const_iterator i = chunk->begin(); i != chunk->end(); ++i)
+						body(*i);
+				}));
+	}
+
+private:
+	Iterator begin;
+	Iterator end;
+};
+
+template<typename Iterator>
+inline parallel_foreach_range<Iterator> make_parallel_foreach(Iterator begin, Iterator end)
+{
+	return parallel_foreach_range<Iterator>(begin, end);
+}
+
+}
+
+/**
+ * parallel_foreach runs the loop body for each iterator of the container concurrently, using the
+ * same foreach_trait as foreach. The body becomes a lambda capturing by reference, so it must be
+ * enclosed in braces and followed by a semicolon, use return instead of continue, and any shared
+ * state it writes must be thread-safe:
+ *
+ * @code
+ * tbb::atomic<int> sum; sum = 0;
+ * parallel_foreach(i, values)
+ * {
+ *     sum += *i;
+ * };
+ * @endcode
+ */
+#define parallel_foreach(i, c) \
+		zillians::make_parallel_foreach(make_begin((c)), make_end((c))) ->* [&](decltype(make_begin((c))) i)
+
+#define deduced_parallel_foreach(i, c) \
+		zillians::make_parallel_foreach(make_deduced_begin((c)), make_deduced_end((c))) ->* [&](decltype(make_deduced_begin((c))) i)
+
+#endif /* ZILLIANS_PARALLELFOREACH_H_ */
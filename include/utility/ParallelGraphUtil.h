@@ -0,0 +1,530 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_PARALLELGRAPHUTIL_H_
+#define ZILLIANS_PARALLELGRAPHUTIL_H_
+
+#include "utility/GraphUtil.h"
+
+#include <boost/unordered_map.hpp>
+#include <boost/cstdint.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * CSR Snapshot is a read-only, compressed sparse row copy of the out-edges of a BGL graph.
+ *
+ * The parallel algorithms below work on dense vertex indices, so frontiers can
+ * be bitmaps and distances plain arrays, while an adjacency_list with listS
+ * storage only has opaque vertex descriptors. The snapshot assigns each vertex
+ * a dense index in vertex iteration order and keeps the mapping in both ways,
+ * so results can be translated back to the descriptors (and with them to the
+ * references kept by indirect_graph_mapping).
+ *
+ * Building a snapshot is a serial pass over the whole graph, build it once and
+ * reuse it across queries until the graph changes.
+ *
+ * @code
+ * csr_snapshot<Graph, double> snapshot(g, get(edge_weight, g));
+ * std::vector<double> distances;
+ * parallel_delta_stepping_shortest_paths(snapshot, snapshot.index(vertex(10, g, mapping)), 1.0, distances);
+ * @endcode
+ */
+template <class Graph, class Weight = boost::uint32_t>
+class csr_snapshot
+{
+public:
+	typedef typename boost::graph_traits<Graph>::vertex_descriptor vertex_descriptor;
+	typedef boost::uint32_t index_type;
+	typedef Weight weight_type;
+
+	static inline index_type null_index()
+	{
+		return (index_type)-1;
+	}
+
+public:
+	/**
+	 * Take a snapshot where every edge weighs one.
+	 */
+	explicit csr_snapshot(const Graph& g)
+	{
+		build(g, unit_weight());
+	}
+
+	/**
+	 * Take a snapshot with edge weights read from the given property map.
+	 */
+	template <class WeightMap>
+	csr_snapshot(const Graph& g, WeightMap weights)
+	{
+		build(g, weights);
+	}
+
+public:
+	inline std::size_t vertex_count() const
+	{
+		return mDescriptors.size();
+	}
+
+	inline std::size_t edge_count() const
+	{
+		return mTargets.size();
+	}
+
+	/**
+	 * @return The dense index of the vertex, or null_index() if it was not in the graph when the snapshot was taken.
+	 */
+	inline index_type index(vertex_descriptor u) const
+	{
+		typename boost::unordered_map<vertex_descriptor, index_type>::const_iterator it = mIndices.find(u);
+		return (it == mIndices.end()) ? null_index() : it->second;
+	}
+
+	inline vertex_descriptor descriptor(index_type u) const
+	{
+		return mDescriptors[u];
+	}
+
+	inline const index_type* targets_begin(index_type u) const
+	{
+		return mTargets.data() + mOffsets[u];
+	}
+
+	inline const index_type* targets_end(index_type u) const
+	{
+		return mTargets.data() + mOffsets[u + 1];
+	}
+
+	inline const weight_type* weights_begin(index_type u) const
+	{
+		return mWeights.data() + mOffsets[u];
+	}
+
+private:
+	struct unit_weight
+	{ };
+
+	template <class WeightMap, class Edge>
+	static inline weight_type weight_of(WeightMap& weights, const Edge& e)
+	{
+		return (weight_type)get(weights, e);
+	}
+
+	template <class Edge>
+	static inline weight_type weight_of(unit_weight&, const Edge&)
+	{
+		return 1;
+	}
+
+	template <class WeightMap>
+	void build(const Graph& g, WeightMap weights)
+	{
+		typename boost::graph_traits<Graph>::vertex_iterator vi, vend;
+		for(boost::tie(vi, vend) = boost::vertices(g); vi != vend; ++vi)
+		{
+			mIndices[*vi] = (index_type)mDescriptors.size();
+			mDescriptors.push_back(*vi);
+		}
+
+		mOffsets.reserve(mDescriptors.size() + 1);
+		mOffsets.push_back(0);
+		for(std::size_t u = 0; u < mDescriptors.size(); ++u)
+		{
+			typename boost::graph_traits<Graph>::out_edge_iterator ei, eend;
+			for(boost::tie(ei, eend) = boost::out_edges(mDescriptors[u], g); ei != eend; ++ei)
+			{
+				mTargets.push_back(mIndices[boost::target(*ei, g)]);
+				mWeights.push_back(weight_of(weights, *ei));
+			}
+			mOffsets.push_back(mTargets.size());
+		}
+	}
+
+private:
+	std::vector<vertex_descriptor> mDescriptors;
+	boost::unordered_map<vertex_descriptor, index_type> mIndices;
+	std::vector<std::size_t> mOffsets;		///< Out-edges of index u are [mOffsets[u], mOffsets[u + 1])
+	std::vector<index_type> mTargets;
+	std::vector<weight_type> mWeights;
+};
+
+namespace detail {
+
+/**
+ * A concurrent bitmap over vertex indices, one bit per vertex.
+ */
+class atomic_bitmap
+{
+public:
+	explicit atomic_bitmap(std::size_t size) : mWords((size + 63) / 64)
+	{
+		clear();
+	}
+
+	/**
+	 * Set the bit, return true if this call is the one which set it.
+	 */
+	inline bool claim(std::size_t i)
+	{
+		boost::uint64_t mask = (boost::uint64_t)1 << (i & 63);
+		std::atomic<boost::uint64_t>& word = mWords[i >> 6];
+		if(word.load(std::memory_order_relaxed) & mask)
+			return false;
+		return !(word.fetch_or(mask, std::memory_order_relaxed) & mask);
+	}
+
+	inline void set(std::size_t i)
+	{
+		mWords[i >> 6].fetch_or((boost::uint64_t)1 << (i & 63), std::memory_order_relaxed);
+	}
+
+	inline boost::uint64_t word(std::size_t w) const
+	{
+		return mWords[w].load(std::memory_order_relaxed);
+	}
+
+	inline std::size_t word_count() const
+	{
+		return mWords.size();
+	}
+
+	void clear()
+	{
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, mWords.size(), 4096), [this](const tbb::blocked_range<std::size_t>& r) {
+			for(std::size_t w = r.begin(); w != r.end(); ++w)
+				mWords[w].store(0, std::memory_order_relaxed);
+		});
+	}
+
+	void swap(atomic_bitmap& other)
+	{
+		mWords.swap(other.mWords);
+	}
+
+private:
+	std::vector< std::atomic<boost::uint64_t> > mWords;
+};
+
+template <class T>
+inline bool atomic_min(std::atomic<T>& target, T value)
+{
+	T current = target.load(std::memory_order_relaxed);
+	while(value < current)
+	{
+		if(target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+}
+
+/**
+ * Level-synchronous parallel breadth first search from the source vertex.
+ *
+ * Each level expands the vertices of the frontier bitmap in parallel. A vertex
+ * joins the next frontier when a thread wins the atomic claim of its visited
+ * bit, so every vertex is expanded exactly once. The cost per level is the
+ * edges of the frontier plus a scan of the frontier bitmap, n / 64 words.
+ *
+ * @param distances Set to the number of hops from the source for each vertex index, null_index() for unreachable vertices.
+ */
+template <class Graph, class Weight>
+void parallel_breadth_first_search(
+		const csr_snapshot<Graph, Weight>& g_,
+		typename csr_snapshot<Graph, Weight>::index_type source_,
+		/*OUT*/ std::vector<typename csr_snapshot<Graph, Weight>::index_type>& distances_)
+{
+	typedef typename csr_snapshot<Graph, Weight>::index_type index_type;
+
+	const std::size_t n = g_.vertex_count();
+	distances_.assign(n, csr_snapshot<Graph, Weight>::null_index());
+	if(source_ >= n)
+		throw std::invalid_argument("invalid source vertex index while searching");
+
+	detail::atomic_bitmap visited(n);
+	detail::atomic_bitmap frontier(n);
+	detail::atomic_bitmap next(n);
+
+	visited.set(source_);
+	frontier.set(source_);
+	distances_[source_] = 0;
+
+	for(index_type level = 1; ; ++level)
+	{
+		std::atomic<bool> expanded(false);
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, frontier.word_count(), 64), [&](const tbb::blocked_range<std::size_t>& r) {
+			bool found = false;
+			for(std::size_t w = r.begin(); w != r.end(); ++w)
+			{
+				for(boost::uint64_t bits = frontier.word(w); bits; bits &= bits - 1)
+				{
+					index_type u = (index_type)(w * 64 + __builtin_ctzll(bits));
+					for(const index_type* v = g_.targets_begin(u); v != g_.targets_end(u); ++v)
+					{
+						if(visited.claim(*v))
+						{
+							distances_[*v] = level;
+							next.set(*v);
+							found = true;
+						}
+					}
+				}
+			}
+			if(found)
+				expanded.store(true, std::memory_order_relaxed);
+		});
+
+		if(!expanded.load(std::memory_order_relaxed))
+			break;
+
+		frontier.swap(next);
+		next.clear();
+	}
+}
+
+/**
+ * Parallel single source shortest paths by delta-stepping (Meyer and Sanders).
+ *
+ * Tentative distances are kept in buckets of width delta. The lowest bucket is
+ * settled by relaxing the light edges (weight <= delta) of its vertices in
+ * parallel, until no vertex falls back into it, then the heavy edges of all its
+ * vertices are relaxed once. Distances are lowered with an atomic min, so any
+ * number of threads may relax edges into the same vertex.
+ *
+ * A delta about the average edge weight is a good start: a small delta does
+ * little work per bucket (Dijkstra-like), a large one re-relaxes a lot of edges
+ * (Bellman-Ford-like) but has more parallelism per bucket.
+ *
+ * @param delta The bucket width, must be positive. Edge weights must not be negative.
+ * @param distances Set to the shortest distance from the source for each vertex index, std::numeric_limits<Weight>::max() for unreachable vertices.
+ */
+template <class Graph, class Weight>
+void parallel_delta_stepping_shortest_paths(
+		const csr_snapshot<Graph, Weight>& g_,
+		typename csr_snapshot<Graph, Weight>::index_type source_,
+		Weight delta_,
+		/*OUT*/ std::vector<Weight>& distances_)
+{
+	typedef typename csr_snapshot<Graph, Weight>::index_type index_type;
+	typedef std::vector<index_type> vertex_list;
+
+	const std::size_t n = g_.vertex_count();
+	const Weight infinity = std::numeric_limits<Weight>::max();
+	if(source_ >= n)
+		throw std::invalid_argument("invalid source vertex index while finding shortest paths");
+	if(!(delta_ > 0))
+		throw std::invalid_argument("delta must be positive");
+
+	std::vector< std::atomic<Weight> > distances(n);
+	tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, 4096), [&](const tbb::blocked_range<std::size_t>& r) {
+		for(std::size_t u = r.begin(); u != r.end(); ++u)
+			distances[u].store(infinity, std::memory_order_relaxed);
+	});
+	distances[source_].store(0, std::memory_order_relaxed);
+
+	// stamps remove duplicates in the serial gather steps without clearing a whole array each time
+	std::vector<std::size_t> queued(n, 0);
+	std::vector<std::size_t> settled(n, 0);
+	std::size_t round = 0;
+	std::size_t phase = 1;
+
+	std::vector<vertex_list> buckets(1, vertex_list(1, source_));
+	tbb::enumerable_thread_specific<vertex_list> relaxed;
+
+	auto bucket_of = [&](index_type u) -> std::size_t {
+		return (std::size_t)(distances[u].load(std::memory_order_relaxed) / delta_);
+	};
+
+	// relax the light or the heavy edges of the given vertices, collecting the lowered ones per thread
+	auto relax = [&](const vertex_list& vertices, bool light) {
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, vertices.size(), 64), [&](const tbb::blocked_range<std::size_t>& r) {
+			vertex_list& lowered = relaxed.local();
+			for(std::size_t i = r.begin(); i != r.end(); ++i)
+			{
+				index_type u = vertices[i];
+				Weight du = distances[u].load(std::memory_order_relaxed);
+				const Weight* w = g_.weights_begin(u);
+				for(const index_type* v = g_.targets_begin(u); v != g_.targets_end(u); ++v, ++w)
+				{
+					if((*w <= delta_) != light)
+						continue;
+					if(detail::atomic_min(distances[*v], du + *w))
+						lowered.push_back(*v);
+				}
+			}
+		});
+	};
+
+	// move the lowered vertices into their buckets, those of the current bucket go to current instead
+	auto gather = [&](std::size_t bucket, vertex_list& current) {
+		++round;
+		for(typename tbb::enumerable_thread_specific<vertex_list>::iterator it = relaxed.begin(); it != relaxed.end(); ++it)
+		{
+			for(typename vertex_list::iterator v = it->begin(); v != it->end(); ++v)
+			{
+				std::size_t b = bucket_of(*v);
+				if(b == bucket)
+				{
+					if(queued[*v] != round)
+					{
+						queued[*v] = round;
+						current.push_back(*v);
+					}
+				}
+				else
+				{
+					if(b >= buckets.size())
+						buckets.resize(b + 1);
+					buckets[b].push_back(*v);
+				}
+			}
+			it->clear();
+		}
+	};
+
+	for(std::size_t bucket = 0; bucket < buckets.size(); ++bucket)
+	{
+		// drop vertices which moved to a lower bucket since they were put here, and duplicates
+		vertex_list current;
+		++round;
+		for(typename vertex_list::iterator v = buckets[bucket].begin(); v != buckets[bucket].end(); ++v)
+		{
+			if(bucket_of(*v) == bucket && queued[*v] != round)
+			{
+				queued[*v] = round;
+				current.push_back(*v);
+			}
+		}
+		vertex_list().swap(buckets[bucket]);
+
+		vertex_list members;
+		while(!current.empty())
+		{
+			for(typename vertex_list::iterator v = current.begin(); v != current.end(); ++v)
+			{
+				if(settled[*v] != phase)
+				{
+					settled[*v] = phase;
+					members.push_back(*v);
+				}
+			}
+
+			relax(current, true);
+			current.clear();
+			gather(bucket, current);
+
+			if(current.empty())
+			{
+				// distances in this bucket are final now, heavy edges lead to later buckets
+				// (except for rounding of floating point weights, which just brings vertices back to current)
+				relax(members, false);
+				members.clear();
+				++phase;
+				gather(bucket, current);
+			}
+		}
+	}
+
+	distances_.resize(n);
+	for(std::size_t u = 0; u < n; ++u)
+		distances_[u] = distances[u].load(std::memory_order_relaxed);
+}
+
+/**
+ * Derive a shortest path tree from the distances given by parallel_delta_stepping_shortest_paths().
+ *
+ * The predecessor of each reachable vertex is the lowest-indexed vertex with an edge
+ * on a shortest path to it, so the result doesn't depend on thread scheduling.
+ *
+ * @param predecessors Set to the predecessor index of each vertex, null_index() for the source and unreachable vertices.
+ */
+template <class Graph, class Weight>
+void shortest_path_predecessors(
+		const csr_snapshot<Graph, Weight>& g_,
+		typename csr_snapshot<Graph, Weight>::index_type source_,
+		const std::vector<Weight>& distances_,
+		/*OUT*/ std::vector<typename csr_snapshot<Graph, Weight>::index_type>& predecessors_)
+{
+	typedef typename csr_snapshot<Graph, Weight>::index_type index_type;
+
+	const std::size_t n = g_.vertex_count();
+	const Weight infinity = std::numeric_limits<Weight>::max();
+
+	std::vector< std::atomic<index_type> > predecessors(n);
+	tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, 4096), [&](const tbb::blocked_range<std::size_t>& r) {
+		for(std::size_t u = r.begin(); u != r.end(); ++u)
+			predecessors[u].store(csr_snapshot<Graph, Weight>::null_index(), std::memory_order_relaxed);
+	});
+
+	tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, 256), [&](const tbb::blocked_range<std::size_t>& r) {
+		for(std::size_t u = r.begin(); u != r.end(); ++u)
+		{
+			if(distances_[u] == infinity)
+				continue;
+
+			const Weight* w = g_.weights_begin((index_type)u);
+			for(const index_type* v = g_.targets_begin((index_type)u); v != g_.targets_end((index_type)u); ++v, ++w)
+			{
+				if(*v != source_ && *v != u && distances_[u] + *w == distances_[*v])
+					detail::atomic_min(predecessors[*v], (index_type)u);
+			}
+		}
+	});
+
+	predecessors_.resize(n);
+	for(std::size_t u = 0; u < n; ++u)
+		predecessors_[u] = predecessors[u].load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////
+template <class IndirectGraphTraits, class Graph, class Weight>
+inline void parallel_breadth_first_search(
+		const typename IndirectGraphTraits::vertex_reference_type& ru_,
+		const Graph& g_,
+		indirect_graph_mapping< IndirectGraphTraits, typename Graph::vertex_descriptor, typename Graph::edge_descriptor>& m_,
+		const csr_snapshot<Graph, Weight>& s_,
+		/*OUT*/ std::vector<typename csr_snapshot<Graph, Weight>::index_type>& distances_)
+{
+	parallel_breadth_first_search(s_, s_.index(vertex(ru_, g_, m_)), distances_);
+}
+
+template <class IndirectGraphTraits, class Graph, class Weight>
+inline void parallel_delta_stepping_shortest_paths(
+		const typename IndirectGraphTraits::vertex_reference_type& ru_,
+		const Graph& g_,
+		indirect_graph_mapping< IndirectGraphTraits, typename Graph::vertex_descriptor, typename Graph::edge_descriptor>& m_,
+		const csr_snapshot<Graph, Weight>& s_,
+		Weight delta_,
+		/*OUT*/ std::vector<Weight>& distances_)
+{
+	parallel_delta_stepping_shortest_paths(s_, s_.index(vertex(ru_, g_, m_)), delta_, distances_);
+}
+
+}
+
+#endif/*ZILLIANS_PARALLELGRAPHUTIL_H_*/
@@ -23,11 +23,17 @@
 #ifndef ZILLIANS_STRINGUTIL_H_
 #define ZILLIANS_STRINGUTIL_H_
 
+#include "utility/HashUtil.h"
+
 #include <boost/bind.hpp> // bind
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
 #include <locale>         // tolower
 #include <algorithm>      // transform
 #include <string>
 #include <vector>
+#include <cstring>
 
 namespace std {
 
@@ -51,6 +57,123 @@ public:
 	static std::vector<std::string> tokenize(const std::string& str, const std::string& delimiters, bool allowEmptyTokenString = false);
 	static std::vector<std::wstring> tokenize(const std::wstring& str, const std::wstring& delimiters, bool allowEmptyTokenString = false);
 
+	/**
+	 * @brief A token found by the view based tokenize(), pointing into the tokenized string.
+	 *
+	 * The token does not own its characters, it's only valid as long as the
+	 * tokenized string is alive and unchanged.
+	 */
+	struct Token
+	{
+		Token() : data(NULL), length(0)
+		{ }
+
+		Token(const char* data, std::size_t length) : data(data), length(length)
+		{ }
+
+		inline std::string str() const
+		{
+			return std::string(data, length);
+		}
+
+		inline bool operator== (const std::string& s) const
+		{
+			return s.length() == length && std::memcmp(s.data(), data, length) == 0;
+		}
+
+		inline bool operator!= (const std::string& s) const
+		{
+			return !(*this == s);
+		}
+
+		const char* data;
+		std::size_t length;
+	};
+
+	/**
+	 * @brief A set of delimiter characters prepared for fast scanning.
+	 *
+	 * Build it once and reuse it when tokenizing many strings with the same
+	 * delimiters. A single delimiter is scanned by memchr(), up to 16 of them
+	 * by SSE4.2 string compare if the build enables SSE4.2, and a lookup table
+	 * is used otherwise.
+	 */
+	class Delimiters
+	{
+	public:
+		explicit Delimiters(const std::string& delimiters);
+		Delimiters(const char* delimiters, std::size_t count);
+
+	public:
+		inline bool contains(char c) const
+		{
+			return mTable[(unsigned char)c];
+		}
+
+		/**
+		 * @brief Find the first delimiter in [first, last), or last if there's none.
+		 */
+		const char* find(const char* first, const char* last) const;
+
+	private:
+		void init(const char* delimiters, std::size_t count);
+
+	private:
+		bool mTable[256];
+		char mSet[16];
+		std::size_t mCount;
+	};
+
+	/**
+	 * @brief Tokenize without allocating, calling the callback for each token.
+	 *
+	 * The tokens are the same as the std::string version gives, the callback
+	 * signature must be: @code void callback(const char* token, std::size_t length); @endcode
+	 * and the token points into str.
+	 *
+	 * @return The number of tokens found.
+	 */
+	template<typename Callback>
+	static std::size_t tokenize(const char* str, std::size_t length, const Delimiters& delimiters, Callback callback, bool allowEmptyTokenString = false)
+	{
+		if(length == 0)
+			return 0;
+
+		std::size_t count = 0;
+		const char* const last = str + length;
+		const char* pos = str;
+		while(true)
+		{
+			const char* delim = delimiters.find(pos, last);
+			if(delim != pos || allowEmptyTokenString)
+			{
+				callback(pos, (std::size_t)(delim - pos));
+				++count;
+			}
+
+			if(delim == last)
+				break;
+			pos = delim + 1;
+		}
+		return count;
+	}
+
+	/**
+	 * @brief Tokenize without allocating, appending the tokens to the given vector.
+	 *
+	 * Reusing the same vector for many strings avoids any allocation after the first few.
+	 */
+	static std::size_t tokenize(const char* str, std::size_t length, const Delimiters& delimiters, std::vector<Token>& tokens, bool allowEmptyTokenString = false);
+	static std::size_t tokenize(const std::string& str, const Delimiters& delimiters, std::vector<Token>& tokens, bool allowEmptyTokenString = false);
+
+	/**
+	 * @brief Replace all occurrences of to_search in s by to_replace.
+	 *
+	 * The replaced string is built in a single pass, and replacements are not
+	 * searched again, so to_replace may contain to_search.
+	 *
+	 * @return True if anything was replaced.
+	 */
 	static bool substitute(std::string &s, const std::string &to_search, const std::string &to_replace);
 
 	template<typename ForwardIterator> inline static ForwardIterator tolower(ForwardIterator first, ForwardIterator last, const std::locale& locale_ref = std::locale())
@@ -88,12 +211,58 @@ public:
 	template<typename T>
 	static void itoa(T t, std::string& s)
 	{
-		unsigned char index;
-		for(int i = sizeof(T)-1; i >= 0; --i)
+		char buffer[2 * sizeof(T)];
+		toHexChars(buffer, buffer + sizeof(buffer), t);
+		s.append(buffer, sizeof(buffer));
+	}
+
+	/**
+	 * @brief Write the decimal digits of an integer into [first, last), std::to_chars style.
+	 *
+	 * Two digits are produced at a time from a lookup table, and nothing is
+	 * allocated or null-terminated.
+	 *
+	 * @return The end of the written characters, or NULL if the buffer is too small.
+	 */
+	template<typename T>
+	static char* toChars(char* first, char* last, T value)
+	{
+		typedef typename boost::make_unsigned<T>::type unsigned_type;
+		unsigned_type u = static_cast<unsigned_type>(value);
+		if(isNegative(value, boost::is_signed<T>()))
 		{
-			index = (t >> (i*8)) & 0xFF;
-			s.append(itoaAlphabet[index]);
+			if(first == last)
+				return NULL;
+			*first++ = '-';
+			u = unsigned_type(0) - u;
 		}
+
+		if(sizeof(T) <= sizeof(boost::uint32_t))
+			return toCharsUnsigned(first, last, static_cast<boost::uint32_t>(u));
+		else
+			return toCharsUnsigned(first, last, static_cast<boost::uint64_t>(u));
+	}
+
+	/**
+	 * @brief Write the bytes as hex, two characters per byte in memory order.
+	 *
+	 * Eight bytes are converted at a time, with the nibbles of all of them
+	 * turned into characters by the same few word operations.
+	 *
+	 * @return The end of the written characters, or NULL if the buffer is smaller than 2 * size.
+	 */
+	static char* encodeHex(char* first, char* last, const void* data, std::size_t size, bool uppercase = true);
+
+	/**
+	 * @brief Write an integer as fixed width hex, most significant byte first.
+	 */
+	template<typename T>
+	static char* toHexChars(char* first, char* last, T value, bool uppercase = true)
+	{
+		unsigned char bytes[sizeof(T)];
+		for(std::size_t i = 0; i < sizeof(T); ++i)
+			bytes[i] = static_cast<unsigned char>(value >> ((sizeof(T) - 1 - i) * 8));
+		return encodeHex(first, last, bytes, sizeof(T), uppercase);
 	}
 
 	/**
@@ -301,116 +470,68 @@ public:
 
 	
 private:
-	static const char* itoaAlphabet [256];
-};
+	template<typename T>
+	static inline bool isNegative(T value, boost::true_type)
+	{
+		return value < 0;
+	}
 
-/*
-struct StringHasher
-{
-	inline static size_t hash(const std::string& str)
+	template<typename T>
+	static inline bool isNegative(T, boost::false_type)
 	{
-		size_t s;
-		const char* data = str.data();
-		for(size_t i = 0; i < str.length(); ++i)
-		{
-			s += data[i];
-		}
-		return s;
+		return false;
 	}
 
-	inline static bool equal( const std::string& x, const std::string& y )
-    {
-    	return (x == y);
-    }
-};
+	static char* toCharsUnsigned(char* first, char* last, boost::uint32_t value);
+	static char* toCharsUnsigned(char* first, char* last, boost::uint64_t value);
 
-extern std::size_t hash_value(const std::string& __x);
+private:
+	static const char digitPairs[201];
+};
 
-#ifdef __PLATFORM_LINUX__
-namespace __gnu_cxx
-{
-	template<>
-	struct hash<std::string>
-	{
-		size_t operator()(const std::string& __x) const
-		{
-			return StringHasher::hash(__x);
-		}
-	};
-}
-#else
-namespace stdext
+/**
+ * @brief Hash compare of std::string for tbb::concurrent_hash_map and the like, based on HashUtil::hash().
+ *
+ * @code
+ * tbb::concurrent_hash_map<std::string, int, StringHasher> m;
+ * boost::unordered_map<std::string, int, StringHasher> n;
+ * @endcode
+ */
+struct StringHasher
 {
-	template<>
-	struct hash_compare<std::string>
+	inline static size_t hash(const std::string& str)
 	{
-		size_t operator()(const std::string& __x) const
-		{
-			return StringHasher::hash(__x);
-		}
+		return HashUtil::hash(str.data(), str.length());
+	}
 
-		bool operator()(const std::string& v1, const std::string& v2) const
-		{
-			return (v1 == v2) ? true : false;
-		}
-	};
-}
-#endif
+	inline static bool equal(const std::string& x, const std::string& y)
+	{
+		return (x == y);
+	}
 
+	inline size_t operator() (const std::string& str) const
+	{
+		return hash(str);
+	}
+};
 
 struct WStringHasher
 {
 	inline static size_t hash(const std::wstring& str)
 	{
-		size_t s;
-		const wchar_t* data = str.data();
-		for(size_t i = 0; i < str.length(); ++i)
-		{
-			s += data[i];
-		}
-		return s;
+		return HashUtil::hash(str.data(), str.length() * sizeof(wchar_t));
 	}
 
-	inline static bool equal( const std::wstring& x, const std::wstring& y )
-    {
-    	return (x == y);
-    }
-};
-
-extern std::size_t hash_value(const std::wstring& __x);
-
-#ifdef __PLATFORM_LINUX__
-namespace __gnu_cxx
-{
-	template<>
-	struct hash<std::wstring>
+	inline static bool equal(const std::wstring& x, const std::wstring& y)
 	{
-		size_t operator()(const std::wstring& __x) const
-		{
-			return WStringHasher::hash(__x);
-		}
-	};
-}
-#else
-namespace stdext
-{
-	template<>
-	struct hash_compare<std::wstring>
-	{
-		size_t operator()(const std::wstring& __x) const
-		{
-			return WStringHasher::hash(__x);
-		}
-
-		bool operator()(const std::wstring& v1, const std::wstring& v2) const
-		{
-			return (v1 == v2) ? true : false;
-		}
-	};
-}
-#endif
+		return (x == y);
+	}
 
-*/
+	inline size_t operator() (const std::wstring& str) const
+	{
+		return hash(str);
+	}
+};
 }
 
 #endif/*ZILLIANS_STRINGUTIL_H_*/
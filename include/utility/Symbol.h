@@ -0,0 +1,180 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_SYMBOL_H_
+#define ZILLIANS_SYMBOL_H_
+
+#include <boost/cstdint.hpp>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace zillians {
+
+namespace detail {
+
+/**
+ * An interned string in the symbol table, never moved or freed once created.
+ */
+struct SymbolEntry
+{
+	boost::uint32_t hash;
+	boost::uint32_t id;
+	boost::uint32_t length;
+	char name[1];			///< Null-terminated, the entry is allocated long enough for the whole name
+};
+
+}
+
+/**
+ * @brief Symbol is a string interned into the global symbol table.
+ *
+ * Each distinct string is stored once and given a stable 32-bit id, ids are
+ * dense and handed out from zero in interning order. Copying and comparing
+ * symbols compares pointers, so a Symbol is a cheap replacement for string
+ * keys which are compared over and over, and id() can index a plain array.
+ *
+ * Looking up a string which is already interned is lock-free, only interning
+ * a new string takes a lock. The characters live in append-only storage for
+ * the rest of the process, so c_str() never dangles and symbols can be used
+ * during static destruction.
+ *
+ * @code
+ * static const Symbol session("session");
+ * if(Symbol::find(name) == session) ...
+ * @endcode
+ *
+ * @note Interned strings are never released, don't intern unbounded input like user names.
+ */
+class Symbol
+{
+public:
+	typedef boost::uint32_t id_type;
+
+	enum { INVALID_ID = 0xFFFFFFFF };
+
+public:
+	/**
+	 * Create an invalid symbol, which is not in the table.
+	 */
+	Symbol() : mEntry(NULL)
+	{ }
+
+	/**
+	 * Intern the given string, adding it to the table if it's seen for the first time.
+	 */
+	explicit Symbol(const std::string& name);
+	explicit Symbol(const char* name);
+	Symbol(const char* name, std::size_t length);
+
+public:
+	/**
+	 * Look up the symbol of the given string without interning it.
+	 *
+	 * @return The symbol, or an invalid symbol if the string has never been interned.
+	 */
+	static Symbol find(const std::string& name);
+	static Symbol find(const char* name);
+	static Symbol find(const char* name, std::size_t length);
+
+	/**
+	 * Get the symbol of the given id.
+	 *
+	 * @return The symbol, or an invalid symbol if no symbol has that id yet.
+	 */
+	static Symbol fromId(id_type id);
+
+	/**
+	 * Get the number of interned symbols, which is also the next id to be given.
+	 */
+	static std::size_t count();
+
+public:
+	inline bool valid() const
+	{
+		return mEntry != NULL;
+	}
+
+	inline id_type id() const
+	{
+		return mEntry ? mEntry->id : (id_type)INVALID_ID;
+	}
+
+	/**
+	 * @return The interned string, or an empty string for an invalid symbol.
+	 */
+	inline const char* c_str() const
+	{
+		return mEntry ? mEntry->name : "";
+	}
+
+	inline std::size_t length() const
+	{
+		return mEntry ? mEntry->length : 0;
+	}
+
+	inline std::string str() const
+	{
+		return std::string(c_str(), length());
+	}
+
+	/**
+	 * Get the hash of the string, which is computed once when it's interned.
+	 */
+	inline std::size_t hash() const
+	{
+		return mEntry ? mEntry->hash : 0;
+	}
+
+public:
+	inline bool operator== (const Symbol& other) const { return mEntry == other.mEntry; }
+	inline bool operator!= (const Symbol& other) const { return mEntry != other.mEntry; }
+
+	/// Order by id, that is the interning order, not the string order
+	inline bool operator< (const Symbol& other) const { return id() < other.id(); }
+
+private:
+	explicit Symbol(const detail::SymbolEntry* entry) : mEntry(entry)
+	{ }
+
+	const detail::SymbolEntry* mEntry;
+};
+
+inline std::size_t hash_value(const Symbol& symbol)
+{
+	return symbol.hash();
+}
+
+}
+
+namespace std {
+
+template<>
+struct hash<zillians::Symbol>
+{
+	inline std::size_t operator() (const zillians::Symbol& symbol) const
+	{
+		return symbol.hash();
+	}
+};
+
+}
+
+#endif/*ZILLIANS_SYMBOL_H_*/
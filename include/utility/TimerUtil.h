@@ -24,13 +24,239 @@
 #define ZILLIANS_TIMERUTIL_H_
 
 #include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 
 namespace zillians {
 
 class TimerUtil
 {
 public:
+	/**
+	 * Get the wall clock time in milliseconds, which jumps whenever the system time is adjusted.
+	 */
 	static uint64_t clock_get_time_ms();
+
+	/**
+	 * Get CLOCK_MONOTONIC_RAW in nanoseconds, which is never adjusted by NTP.
+	 */
+	static uint64_t clock_get_time_ns();
+
+	/**
+	 * Get a monotonic time in nanoseconds, cheap enough to measure single messages.
+	 *
+	 * The cycle counter is used if it runs at a constant rate on all cores (invariant TSC on x86, the generic
+	 * timer on ARMv8), converted by the rate calibrated on first use; otherwise it's clock_get_time_ns().
+	 * Only differences between two values are meaningful.
+	 */
+	static uint64_t now_ns();
+
+	/**
+	 * Read the cycle counter, or clock_get_time_ns() on platforms without one.
+	 */
+	static inline uint64_t cycles()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		uint32_t low, high;
+		__asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+		return ((uint64_t)high << 32) | low;
+#elif defined(__aarch64__)
+		uint64_t value;
+		__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (value));
+		return value;
+#else
+		return clock_get_time_ns();
+#endif
+	}
+
+	/**
+	 * Convert a difference of cycles() to nanoseconds.
+	 */
+	static uint64_t cycles_to_ns(uint64_t cycles);
+
+	/**
+	 * Get the calibrated length of a cycle in nanoseconds.
+	 */
+	static double ns_per_cycle();
+
+	/**
+	 * Check whether now_ns() is driven by the cycle counter.
+	 */
+	static bool has_constant_cycle_counter();
+};
+
+/**
+ * TimerHistogram counts durations in log-linear buckets, eight per power of two, so every
+ * recorded value is kept within 12.5% whatever its magnitude, in a fixed 4KB.
+ */
+class TimerHistogram
+{
+public:
+	enum
+	{
+		SUB_BUCKET_BITS = 3,
+		SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+		BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT,
+	};
+
+public:
+	TimerHistogram();
+
+public:
+	inline void record(uint64_t value)
+	{
+		++mCounts[bucketOf(value)];
+		++mCount;
+		mSum += value;
+		if (value < mMin) mMin = value;
+		if (value > mMax) mMax = value;
+	}
+
+	void merge(const TimerHistogram& other);
+	void reset();
+
+	inline uint64_t count() const { return mCount; }
+	inline uint64_t sum() const { return mSum; }
+	inline uint64_t min() const { return (mCount == 0) ? 0 : mMin; }
+	inline uint64_t max() const { return mMax; }
+	double mean() const;
+
+	/**
+	 * Get the value below which the given percentage of recorded values fall.
+	 *
+	 * @param percentage : 0~100
+	 * @return The highest value of the bucket reached, but never more than max()
+	 */
+	uint64_t percentile(double percentage) const;
+
+	/**
+	 * Print count, mean, min, percentiles and max in microseconds, assuming values are nanoseconds.
+	 */
+	void print(const std::string& name) const;
+
+public:
+	static inline std::size_t bucketOf(uint64_t value)
+	{
+		if (value < SUB_BUCKET_COUNT) return value;
+		const int magnitude = 63 - __builtin_clzll(value);
+		return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + ((value >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1));
+	}
+
+	static uint64_t lowestOf(std::size_t bucket);
+	static uint64_t highestOf(std::size_t bucket);
+
+private:
+	uint64_t mCounts[BUCKET_COUNT];
+	uint64_t mCount;
+	uint64_t mSum;
+	uint64_t mMin;
+	uint64_t mMax;
+};
+
+/**
+ * TimerStatistics collects durations of the same kind into one histogram per thread, so recording
+ * takes no lock. The histograms are merged on collect(), which is exact once the recording threads
+ * are done and a close estimate while they are still running.
+ */
+class TimerStatistics : public boost::noncopyable
+{
+public:
+	explicit TimerStatistics(const std::string& name);
+	~TimerStatistics();
+
+public:
+	inline void record(uint64_t ns)
+	{
+		TimerHistogram* histogram = mLocal.get();
+		if (!histogram) histogram = registerThread();
+		histogram->record(ns);
+	}
+
+	TimerHistogram collect() const;
+	void reset();
+
+	inline void print() const
+	{
+		collect().print(mName);
+	}
+
+	inline const std::string& name() const
+	{
+		return mName;
+	}
+
+private:
+	TimerHistogram* registerThread();
+
+private:
+	std::string mName;
+	boost::thread_specific_ptr<TimerHistogram> mLocal;
+
+	mutable boost::mutex mShardsLock;
+	std::vector< boost::shared_ptr<TimerHistogram> > mShards;
+};
+
+/**
+ * ScopedTimer records the time from its construction to its destruction, or to stop().
+ *
+ * @code
+ * static TimerStatistics dispatch_time("dispatch");
+ * {
+ *     ScopedTimer timer(dispatch_time);
+ *     dispatch(message);
+ * }
+ * dispatch_time.print();
+ * @endcode
+ */
+class ScopedTimer : public boost::noncopyable
+{
+public:
+	explicit ScopedTimer(TimerStatistics& statistics) : mStatistics(&statistics), mHistogram(NULL), mElapsed(NULL), mRunning(true), mStart(TimerUtil::now_ns())
+	{ }
+
+	explicit ScopedTimer(TimerHistogram& histogram) : mStatistics(NULL), mHistogram(&histogram), mElapsed(NULL), mRunning(true), mStart(TimerUtil::now_ns())
+	{ }
+
+	/**
+	 * Only to measure, the elapsed nanoseconds are written to the given variable.
+	 */
+	explicit ScopedTimer(uint64_t& elapsed) : mStatistics(NULL), mHistogram(NULL), mElapsed(&elapsed), mRunning(true), mStart(TimerUtil::now_ns())
+	{ }
+
+	~ScopedTimer()
+	{
+		stop();
+	}
+
+public:
+	/**
+	 * Record the elapsed time now instead of on destruction, only the first call counts.
+	 */
+	inline void stop()
+	{
+		if (!mRunning) return;
+		const uint64_t elapsed = elapsed_ns();
+		if (mStatistics) mStatistics->record(elapsed);
+		if (mHistogram) mHistogram->record(elapsed);
+		if (mElapsed) *mElapsed = elapsed;
+		mRunning = false;
+	}
+
+	inline uint64_t elapsed_ns() const
+	{
+		return TimerUtil::now_ns() - mStart;
+	}
+
+private:
+	TimerStatistics* mStatistics;
+	TimerHistogram* mHistogram;
+	uint64_t* mElapsed;
+	bool mRunning;
+	uint64_t mStart;
 };
 
 }
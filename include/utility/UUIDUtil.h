@@ -25,12 +25,73 @@
 
 #include "core/Common.h"
 #include <apr_uuid.h>
+#include <boost/functional/hash.hpp>
+#include <cstring>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <hash_set>
 
 namespace zillians {
 
 #define ENABLE_CASE_INSENSITIVE_UUID
 
+namespace detail {
+
+/**
+ * Lookup tables of the UUID text form when SSE2 is not available, a template
+ * only so the definitions can stay in the header.
+ */
+template<typename T = void>
+struct uuid_text
+{
+	static const unsigned char hex_values[256];	///< Value of each hex digit, or 0xF0 for any other character
+	static const char hex_pairs[513];			///< Two lower case hex digits for each byte value
+};
+
+template<typename T>
+const unsigned char uuid_text<T>::hex_values[256] = {
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0
+};
+
+template<typename T>
+const char uuid_text<T>::hex_pairs[513] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+}
+
 struct UUID
 {
 public:
@@ -53,13 +114,15 @@ public:
 	UUID(const char* text)
 	{
 		// parse the data
-		apr_uuid_parse(&data.raw, text);
+		if(!parse(text, *this))
+			invalidate();
 	}
 
 	UUID(const std::string& text)
 	{
 		// parse the data
-		apr_uuid_parse(&data.raw, text.c_str());
+		if(!parse(text, *this))
+			invalidate();
 	}
 
 	~UUID()
@@ -98,6 +161,86 @@ public:
 		apr_uuid_get(&id.data.raw);
 	}
 
+	/**
+	 * @brief Generate random (RFC 4122 version 4) UUIDs without taking any lock.
+	 *
+	 * Unlike random(), which goes through the serialized APR generator, this
+	 * draws from a xoshiro256** generator private to the calling thread, seeded
+	 * from the system entropy source on first use and again in a forked child.
+	 * The generator is fast, not cryptographically secure, so don't use these
+	 * ids as secrets.
+	 */
+	static void random_n(UUID* ids, std::size_t n);
+
+	/**
+	 * @brief Generate time-ordered (version 7) UUIDs without taking any lock.
+	 *
+	 * The first 48 bits are the Unix time in milliseconds, followed by a 12
+	 * bit counter and random bits, so ids minted one after another sort in
+	 * minting order by their bytes or text, which keeps database index inserts
+	 * local. The order is strict among the ids of one thread and follows the
+	 * clock across threads.
+	 *
+	 * @note operator< compares the native words, not the bytes, so std::map
+	 * does not keep version 7 ids in time order.
+	 */
+	static void ordered(UUID& id);
+	static void ordered_n(UUID* ids, std::size_t n);
+
+	/**
+	 * @brief Parse the 36 character text form, like "1a03c570-379a-11de-9b9a-001d92648305".
+	 *
+	 * All 32 digits are decoded and validated at once with SSE2, or by table
+	 * lookups without branching on the digits otherwise. Upper and lower case
+	 * digits are both accepted. The text may continue after the 36
+	 * characters, but the std::string version wants exactly 36.
+	 *
+	 * @return False if the text is not a UUID, in which case id is unchanged.
+	 */
+	inline static bool parse(const char* text, UUID& id)
+	{
+		if(strnlen(text, APR_UUID_FORMATTED_LENGTH) < APR_UUID_FORMATTED_LENGTH)
+			return false;
+		return parseUnchecked(reinterpret_cast<const unsigned char*>(text), id);
+	}
+
+	inline static bool parse(const std::string& text, UUID& id)
+	{
+		if(text.size() != APR_UUID_FORMATTED_LENGTH)
+			return false;
+		return parseUnchecked(reinterpret_cast<const unsigned char*>(text.data()), id);
+	}
+
+	/**
+	 * @brief Write the 36 character lower case text form, the output is not null-terminated.
+	 */
+	inline static void format(const UUID& id, char* out)
+	{
+		char hex[32];
+#ifdef __SSE2__
+		// split into nibbles, interleave them in text order and turn them into digits all at once
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(id.data.raw.data));
+		const __m128i mask = _mm_set1_epi8(0x0F);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		const __m128i lo = _mm_and_si128(v, mask);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(hex), hexDigits(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(hex + 16), hexDigits(_mm_unpackhi_epi8(hi, lo)));
+#else
+		typedef detail::uuid_text<> table;
+		for(int i = 0; i < 16; ++i)
+			std::memcpy(hex + 2 * i, table::hex_pairs + 2 * id.data.raw.data[i], 2);
+#endif
+		std::memcpy(out, hex, 8);
+		out[8] = '-';
+		std::memcpy(out + 9, hex + 8, 4);
+		out[13] = '-';
+		std::memcpy(out + 14, hex + 12, 4);
+		out[18] = '-';
+		std::memcpy(out + 19, hex + 16, 4);
+		out[23] = '-';
+		std::memcpy(out + 24, hex + 20, 12);
+	}
+
 	inline static void invalidate(UUID& id)
 	{
 #if __WORDSIZE == 32
@@ -144,13 +287,15 @@ public:
 	inline UUID& operator = (const char* text)
 	{
 		// parse the data
-		apr_uuid_parse(&data.raw, text);
+		if(!parse(text, *this))
+			invalidate();
 		return *this;
 	}
 	inline UUID& operator = (const std::string& text)
 	{
 		// parse the data
-		apr_uuid_parse(&data.raw, text.c_str());
+		if(!parse(text, *this))
+			invalidate();
 		return *this;
 	}
 	inline bool operator == (const UUID& b) const
@@ -167,8 +312,11 @@ public:
 	}
 	inline bool operator == (const std::string& b) const
 	{
-		char temp[APR_UUID_FORMATTED_LENGTH+1];
-		apr_uuid_format(temp, &data.raw);
+		if(b.size() < APR_UUID_FORMATTED_LENGTH)
+			return false;
+
+		char temp[APR_UUID_FORMATTED_LENGTH];
+		format(*this, temp);
 
 		// perform case insensitive comparison while comparing UUID to string
 		for(int i=0;i<APR_UUID_FORMATTED_LENGTH;++i)
@@ -188,6 +336,10 @@ public:
 	{
 		return  !((*this) == b);
 	}
+	inline bool operator != (const std::string& b) const
+	{
+		return  !((*this) == b);
+	}
 	inline bool operator < (const UUID& b) const
 	{
 		// TODO find a more efficient implementation here...
@@ -273,11 +425,76 @@ public:
 public:
 	inline operator std::string() const
 	{
-		char temp[APR_UUID_FORMATTED_LENGTH+1];
-		apr_uuid_format(temp, &data.raw);
+		char temp[APR_UUID_FORMATTED_LENGTH];
+		format(*this, temp);
+
+		return std::string(temp, APR_UUID_FORMATTED_LENGTH);
+	}
+
+private:
+#ifdef __SSE2__
+	/// nibble values to lower case hex digits, '0' + n plus the gap to 'a' for n > 9
+	static inline __m128i hexDigits(__m128i n)
+	{
+		const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+		return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+	}
+
+	/// hex digits to pairs of bytes, returns false if any is not a hex digit
+	static inline bool hexBytes(__m128i c, __m128i& bytes)
+	{
+		const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+		const __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+		const __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+		const __m128i value = _mm_or_si128(_mm_and_si128(digit, isDigit), _mm_and_si128(_mm_add_epi8(letter, _mm_set1_epi8(10)), isLetter));
+
+		// each 16-bit lane holds the high nibble in its low byte and the low nibble in its high byte
+		bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(value, 8));
+		return _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) == 0xFFFF;
+	}
+#endif
+
+	inline static bool parseUnchecked(const unsigned char* text, UUID& id)
+	{
+		if((text[8] ^ '-') | (text[13] ^ '-') | (text[18] ^ '-') | (text[23] ^ '-'))
+			return false;
+
+		unsigned char hex[32];
+		std::memcpy(hex, text, 8);
+		std::memcpy(hex + 8, text + 9, 4);
+		std::memcpy(hex + 12, text + 14, 4);
+		std::memcpy(hex + 16, text + 19, 4);
+		std::memcpy(hex + 20, text + 24, 12);
+
+#ifdef __SSE2__
+		__m128i lo, hi;
+		const bool valid = hexBytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hex)), lo) &
+				hexBytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hex + 16)), hi);
+		if(!valid)
+			return false;
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(id.data.raw.data), _mm_packus_epi16(lo, hi));
+		return true;
+#else
+		typedef detail::uuid_text<> table;
+
+		// any invalid digit sets one of the high bits, checked once at the end
+		unsigned char bytes[16];
+		unsigned int invalid = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			const unsigned char h = table::hex_values[hex[2 * i]];
+			const unsigned char l = table::hex_values[hex[2 * i + 1]];
+			invalid |= h | l;
+			bytes[i] = (unsigned char)((h << 4) | l);
+		}
+		if(invalid & 0xF0)
+			return false;
 
-		std::string to_string= temp;
-		return to_string;
+		std::memcpy(id.data.raw.data, bytes, 16);
+		return true;
+#endif
 	}
 
 public:
@@ -292,17 +509,18 @@ public:
 
 inline std::ostream& operator << (std::ostream &stream, const UUID& id)
 {
-	char temp[APR_UUID_FORMATTED_LENGTH+1];
-	apr_uuid_format(temp, &id.data.raw);
-	stream << temp;
+	char temp[APR_UUID_FORMATTED_LENGTH];
+	UUID::format(id, temp);
+	stream.write(temp, APR_UUID_FORMATTED_LENGTH);
 	return stream;
 }
 
 inline std::istream& operator >> (std::istream& stream, const UUID& id)
 {
-	char temp[APR_UUID_FORMATTED_LENGTH+1];
+	std::string temp;
 	stream >> temp;
-	apr_uuid_parse((apr_uuid_t*)&id.data.raw, temp);
+	if(!UUID::parse(temp, const_cast<UUID&>(id)))
+		const_cast<UUID&>(id).invalidate();
 	return stream;
 }
 
@@ -330,6 +548,19 @@ namespace boost {
 
 extern std::size_t hash_value(const zillians::UUID& __x);
 
+/**
+ * boost::hash_value() above is only found if it's declared before the hash
+ * template is instantiated, the specialization works for any include order.
+ */
+template<>
+struct hash<zillians::UUID>
+{
+	std::size_t operator()(const zillians::UUID& __x) const
+	{
+		return zillians::UUIDHasher::hash(__x);
+	}
+};
+
 }
 
 #ifdef __PLATFORM_LINUX__
@@ -29,6 +29,7 @@
 #include <memory>
 #include <string>
 #include <algorithm>
+#include <boost/cstdint.hpp>
 #include <boost/regex/pending/unicode_iterator.hpp>
 
 namespace zillians {
@@ -80,6 +81,26 @@ void enable_c_locale(StreamT& stream)
 void utf8_to_ucs4(const std::string& input, std::wstring& output);
 void ucs4_to_utf8(const std::wstring& input, std::string& output);
 
+/**
+ * @brief Transcode between UTF-8 and UCS-4 (or UTF-16) into preallocated output.
+ *
+ * Runs of ASCII are converted 16 characters at a time with SSE2, everything
+ * else goes through a validating scalar path which rejects overlong forms,
+ * surrogates in UTF-8 or UCS-4, unpaired surrogates in UTF-16, and code
+ * points above U+10FFFF.
+ *
+ * The output must have room for the worst case: length units when decoding
+ * UTF-8, 4 * length bytes when encoding UCS-4 and 3 * length bytes when
+ * encoding UTF-16. Nothing is null-terminated.
+ *
+ * @param written The number of output units written, up to the first invalid input if any.
+ * @return False if the input is not valid.
+ */
+bool utf8_to_ucs4(const char* input, std::size_t length, wchar_t* output, std::size_t& written);
+bool ucs4_to_utf8(const wchar_t* input, std::size_t length, char* output, std::size_t& written);
+bool utf8_to_utf16(const char* input, std::size_t length, boost::uint16_t* output, std::size_t& written);
+bool utf16_to_utf8(const boost::uint16_t* input, std::size_t length, char* output, std::size_t& written);
+
 void wcs_to_cstr(const wchar_t* src, char* dest);
 void cstr_to_wcs(const char* src, wchar_t* dest);
 std::wstring s_to_ws(std::string s);
@@ -23,9 +23,15 @@
 #ifndef ZILLIANS_ARCHIVE_H_
 #define ZILLIANS_ARCHIVE_H_
 
+#include "core/Buffer.h"
+#include "utility/archive/ArchiveCodec.h"
 #include "zlib/minizip/zip.h"
 #include "zlib/minizip/unzip.h"
 
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -37,6 +43,7 @@ enum ArchiveMode
 {
 	ARCHIVE_FILE_COMPRESS,
 	ARCHIVE_FILE_DECOMPRESS,
+	ARCHIVE_FILE_MAPPED,		///< Random access by file name over a memory-mapped archive
 };
 
 struct ArchiveItem_t
@@ -53,11 +60,32 @@ struct ArchiveItem_t
 	};
 };
 
-
+/**
+ * Archive reads and writes zip files, or packed archives for the other codecs.
+ *
+ * A packed archive is a plain concatenation of entries, each either stored or compressed in independent frames, followed
+ * by the dictionary, the index and a trailer. It's meant for bundles read back by this class, where decompression speed
+ * matters more than compatibility. Archives opened to decompress or map are recognized by their content, whatever codec
+ * is given to the constructor.
+ */
 class Archive
 {
 public:
-	Archive(const std::string& archive_name, ArchiveMode mode);
+	enum
+	{
+		DEFAULT_CHUNK_SIZE = 1024 * 1024,
+	};
+
+	/**
+	 * Receive the content of archive entries piece by piece.
+	 *
+	 * The handler is called once with data == NULL at the beginning of each entry, then for every chunk of its content.
+	 * Return false to stop the extraction.
+	 */
+	typedef boost::function< bool(const ArchiveItem_t& item, const unsigned char* data, std::size_t size) > ExtractHandler;
+
+public:
+	Archive(const std::string& archive_name, ArchiveMode mode, ArchiveCodecType codec = ARCHIVE_CODEC_ZIP);
 	virtual ~Archive();
 
 public:
@@ -82,11 +110,26 @@ public:
 	/**
 	 * Add a file into the archive in which the file name is the same as the input parameter
 	 *
+	 * The file is read and compressed chunk by chunk, so it's never held in memory as a whole.
+	 *
 	 * @param filename : the file name which could be used to access local file
 	 * @return True if success; otherwise, false
 	 */
 	bool add(const std::string& filename);
 
+	/**
+	 * Add a list of files, compressing independent files in parallel and writing them to the archive in the given order.
+	 *
+	 * At most thread_count files are in flight at a time. Files up to the chunk size are read and compressed as a whole by
+	 * the worker threads, larger ones are streamed by add(filename) when their turn comes, so the memory used is bounded
+	 * by about chunk size * thread_count.
+	 *
+	 * @param filenames : the file names which could be used to access local files
+	 * @param thread_count : the number of files in flight, 0 for the number of hardware threads
+	 * @return True if success; otherwise, false
+	 */
+	bool addAll(const std::vector<std::string>& filenames, std::size_t thread_count = 0);
+
 	/**
 	 * Extract all files in the archive, represented as a list of ArchiveItem_t
 	 *
@@ -95,24 +138,185 @@ public:
 	 */
 	bool extractAll(std::vector<ArchiveItem_t>& archive_items);
 
+	/**
+	 * Extract all files in the archive chunk by chunk to the handler, without holding any entry in memory as a whole
+	 *
+	 * @param handler : the handler receiving the content of entries
+	 * @return True if success; otherwise, false
+	 */
+	bool extractAll(const ExtractHandler& handler);
+
 	/**
 	 * Extract all files in the archive to the specific folder, also return a list of ArchiveItem_t
 	 *
+	 * With more than one thread, the archive is mapped and its index read directly, and thread_count entries at a time
+	 * are decoded straight into their files, whose size is allocated up front. The largest entries go first. The
+	 * returned items then only have the name, sizes, CRC and method filled in. Archives whose index can't be read that
+	 * way, and a single thread, stream the content to the files one by one.
+	 *
+	 * The buffers of the returned items are left empty, the items are in the order of the archive.
+	 *
 	 * @param archive_items: return a list of archive items
 	 * @param folder_path : the folder to place the extracted files
+	 * @param thread_count : the number of entries extracted at a time, 0 for the number of hardware threads
+	 * @return True if success; otherwise, false
+	 */
+	bool extractAllToFolder(std::vector<ArchiveItem_t>& archive_items, std::string folder_path = "", std::size_t thread_count = 0);
+
+	/**
+	 * Extract one file by name, only for ARCHIVE_FILE_MAPPED
+	 *
+	 * The central directory is indexed when the archive is opened, so this jumps straight to the entry. The content is
+	 * appended at the write position of the buffer, which must have enough free space unless it grows on demand.
+	 *
+	 * @param filename : the file name represented in the archive
+	 * @param buffer : the buffer to write the content to
 	 * @return True if success; otherwise, false
 	 */
-	bool extractAllToFolder(std::vector<ArchiveItem_t>& archive_items, std::string folder_path = "");
+	bool extract(const std::string& filename, Buffer& buffer);
+
+	/**
+	 * Extract one file by name as a read-only view, only for ARCHIVE_FILE_MAPPED
+	 *
+	 * Stored (uncompressed) entries are zero-copy views into the mapped archive, which is kept mapped as long as any
+	 * view is alive, even after the archive is closed. Compressed ones are inflated into a new buffer. The CRC of
+	 * stored entries is not verified, since that would mean reading all of them.
+	 *
+	 * @param filename : the file name represented in the archive
+	 * @return The view, whose buffer() is NULL if the file is not found or can't be extracted
+	 */
+	BufferRef<true, false> extract(const std::string& filename);
+
+	/**
+	 * Check whether the file is in the archive, only for ARCHIVE_FILE_MAPPED
+	 */
+	bool contains(const std::string& filename) const;
 
 	/**
 	 * Set the compress level. Range is 0~9.
 	 *
+	 * Files added at level 0 are stored without compression, which ARCHIVE_FILE_MAPPED serves without any copy.
+	 *
 	 * @param level : level of compression
 	 */
 	void setCompressLevel(int level);
 
+	/**
+	 * Set the dictionary to compress with, only for ARCHIVE_CODEC_ZSTD and before anything is added.
+	 *
+	 * The dictionary is saved in the archive, so readers don't need to know it.
+	 *
+	 * @param dictionary : the dictionary, usually from ArchiveCodec::trainDictionary()
+	 * @return True if success; otherwise, false
+	 */
+	bool setDictionary(const std::vector<unsigned char>& dictionary);
+
+	/**
+	 * Train the dictionary from files up to the chunk size, usually those about to be added, and set it.
+	 *
+	 * @param filenames : the files to sample
+	 * @param capacity : the maximal size of the dictionary
+	 * @return True if success; otherwise, false
+	 */
+	bool trainDictionary(const std::vector<std::string>& filenames, std::size_t capacity = ArchiveCodec::DEFAULT_DICTIONARY_SIZE);
+
+	/**
+	 * Store identical content only once, only for packed archives and before anything is added.
+	 *
+	 * The content of each entry is hashed with SHA-1, and an entry whose content is in the archive already refers to the
+	 * data written the first time instead. Readers don't notice, the index just has several entries pointing to the same
+	 * data. Zip archives have no way to share data between entries, so they're not supported.
+	 *
+	 * @param enable : true to deduplicate the entries added from now on
+	 * @return True if success; otherwise, false
+	 */
+	bool setDeduplication(bool enable);
+
+	/**
+	 * Keep the hashes of the added files in a cache file between builds, only along with deduplication.
+	 *
+	 * A file whose size and modification time are the same as in the cache is not hashed again, and if its content is in
+	 * the archive already, it's neither read nor compressed at all. The cache is read here, and rewritten by close() with
+	 * the files added this time.
+	 *
+	 * @note Like make, this trusts the modification time, a file changed without it is taken for its old content.
+	 *
+	 * @param cache_name : the cache file, which doesn't have to exist yet
+	 * @return True if success; otherwise, false
+	 */
+	bool setHashCache(const std::string& cache_name);
+
+	/**
+	 * Get the codec of the archive, which is what's found in the file when decompressing or mapping.
+	 */
+	ArchiveCodecType getCodec() const;
+
+	/**
+	 * Write the files extracted in parallel by extractAllToFolder() with direct I/O from this size on.
+	 *
+	 * Direct I/O keeps very large files out of the page cache, which they'd otherwise flush, at the cost of holding the
+	 * decoded entry in memory once. File systems without direct I/O get the file written as usual.
+	 *
+	 * @param size : the smallest file size to write with direct I/O, 0 to never use it
+	 */
+	void setDirectIoThreshold(std::size_t size);
+
+	/**
+	 * Set the size of chunks read from and written to files, which also bounds the size of files compressed as a whole by addAll().
+	 *
+	 * @param size : size of chunks in bytes
+	 */
+	void setChunkSize(std::size_t size);
+
 private:
 	bool extractCurrentFile(ArchiveItem_t& archive_item);
+	bool extractCurrentFile(ArchiveItem_t& archive_item, const ExtractHandler& handler);
+	bool openNewFile(const std::string& filename, zip_fileinfo& zip_info, bool raw, bool large_file);
+	bool addPrepared(const std::string& filename, const std::vector<unsigned char>& data, int method, ZPOS64_T size, uLong crc, const std::string& hash);
+	ArchiveCodec* codec();
+
+	struct MappedEntry
+	{
+		ZPOS64_T local_header_offset;	///< Or the offset of data in a packed archive
+		ZPOS64_T compressed_size;
+		ZPOS64_T uncompressed_size;
+		uLong crc;
+		int method;
+		int flag;
+	};
+
+	bool openMapped();
+	bool indexCentralDirectory();
+	const byte* findMappedData(const std::string& filename, const MappedEntry*& entry) const;
+	const byte* locateEntryData(const byte* base, std::size_t size, const MappedEntry& entry) const;
+	bool decodeMappedData(const MappedEntry& entry, const byte* data, byte* dest, ArchiveCodec* decoder = NULL);
+
+	typedef std::pair<std::string, MappedEntry> PackedEntry;
+
+	bool readCentralDirectory(const byte* base, std::size_t size, std::vector<PackedEntry>& entries) const;
+	bool extractAllInParallel(std::vector<ArchiveItem_t>& archive_items, const boost::filesystem::path& folder, std::size_t thread_count, bool& handled);
+	bool extractEntryToFile(const MappedEntry& entry, const byte* data, ArchiveCodec* decoder, const std::string& path);
+
+	bool openPacked();
+	bool indexPackedArchive();
+	bool closePacked();
+	bool loadPackedIndex(const byte* trailer, const byte* dictionary, const byte* index, std::size_t index_size);
+	bool writePacked(const std::string& filename, const unsigned char* data, std::size_t size, int method, ZPOS64_T uncompressed_size, uLong crc);
+	bool addPacked(const std::string& filename);
+	bool extractPackedEntry(const PackedEntry& entry, ArchiveItem_t& archive_item, const ExtractHandler& handler);
+
+	bool addReference(const std::string& filename, const std::string& hash);
+	void rememberContent(const std::string& hash);
+	bool stampFile(const std::string& filename, uint64& size, uint64& time, std::string& hash) const;
+	void rememberHash(const std::string& filename, uint64 size, uint64 time, const std::string& hash);
+	bool saveHashCache() const;
+
+	struct HashCacheEntry
+	{
+		uint64 size;
+		uint64 time;		///< Modification time in nanoseconds
+		std::string hash;	///< SHA-1 of the content, 20 bytes
+	};
 
 private:
 	zip_file_t mArchive;
@@ -121,6 +325,31 @@ private:
 
 	// Only work for compression
 	int mCompressLevel;
+
+	std::size_t mChunkSize;
+
+	ArchiveCodecType mCodec;
+	shared_ptr<ArchiveCodec> mCodecInstance;
+	std::vector<unsigned char> mDictionary;
+
+	// Only work for packed archives, the index is kept in order until mapped
+	std::FILE* mPackFile;
+	std::vector<PackedEntry> mPackedEntries;
+	std::size_t mPackFrameSize;
+
+	// Only work for deduplication of packed archives, entries are keyed by the SHA-1 of their content
+	bool mDeduplicate;
+	boost::unordered_map<std::string, MappedEntry> mContentEntries;
+	std::string mHashCacheName;
+	boost::unordered_map<std::string, HashCacheEntry> mHashCache;			///< As read from the cache file, never changed while adding
+	boost::unordered_map<std::string, HashCacheEntry> mUpdatedHashCache;	///< Files added this time
+
+	// Only work for the parallel extractAllToFolder()
+	std::size_t mDirectIoThreshold;
+
+	// Only work for ARCHIVE_FILE_MAPPED
+	shared_ptr<Buffer> mMappedArchive;
+	boost::unordered_map<std::string, MappedEntry> mMappedEntries;
 };
 
 }
@@ -0,0 +1,115 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_ARCHIVECODEC_H_
+#define ZILLIANS_ARCHIVECODEC_H_
+
+#include "core/SharedPtr.h"
+
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+namespace zillians {
+
+enum ArchiveCodecType
+{
+	ARCHIVE_CODEC_ZIP = 0,		///< Raw deflate in a standard zip file, the default
+	ARCHIVE_CODEC_LZ4 = 1,		///< LZ4 (LZ4HC from level 3) in a packed archive, the fastest to decompress
+	ARCHIVE_CODEC_ZSTD = 2,		///< Zstandard in a packed archive, optionally with a dictionary for many small files
+};
+
+/**
+ * ArchiveCodec compresses and decompresses blocks of which the uncompressed size is known by the caller.
+ *
+ * compress() may be called from several threads at the same time, decompress() may not, since it
+ * reuses the decompression context of the codec.
+ */
+class ArchiveCodec : public boost::noncopyable
+{
+public:
+	enum
+	{
+		DEFAULT_DICTIONARY_SIZE = 112640,	///< What the zstd command line trains by default
+	};
+
+public:
+	virtual ~ArchiveCodec() { }
+
+public:
+	virtual ArchiveCodecType type() const = 0;
+
+	/**
+	 * Get the worst case compressed size of the given number of bytes.
+	 */
+	virtual std::size_t compressBound(std::size_t size) const = 0;
+
+	/**
+	 * Compress a block.
+	 *
+	 * @param source : the data to compress
+	 * @param source_size : the size of data
+	 * @param dest : the buffer to write to, compressBound(source_size) bytes are always enough
+	 * @param dest_capacity : the size of buffer
+	 * @return The compressed size, or 0 on failure
+	 */
+	virtual std::size_t compress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_capacity) const = 0;
+
+	/**
+	 * Decompress a block produced by compress().
+	 *
+	 * @param source : the compressed data
+	 * @param source_size : the size of compressed data
+	 * @param dest : the buffer to write to
+	 * @param dest_size : the uncompressed size, which must be exactly what the block decompresses to
+	 * @return True if success; otherwise, false
+	 */
+	virtual bool decompress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_size) = 0;
+
+public:
+	/**
+	 * Check whether the codec is compiled in, the zip one always is.
+	 */
+	static bool isSupported(ArchiveCodecType type);
+
+	/**
+	 * Create a codec.
+	 *
+	 * @param type : the codec type
+	 * @param level : the compress level, negative for the default one of the codec
+	 * @param dictionary : the dictionary to compress and decompress with, only used by ARCHIVE_CODEC_ZSTD
+	 * @return The codec, or NULL if it's not supported
+	 */
+	static shared_ptr<ArchiveCodec> create(ArchiveCodecType type, int level, const std::vector<unsigned char>& dictionary = std::vector<unsigned char>());
+
+	/**
+	 * Train a zstd dictionary from samples of typical content.
+	 *
+	 * A few hundred samples are usually needed, and it pays off for files of a few KB or less.
+	 *
+	 * @param samples : the samples, usually whole small files
+	 * @param capacity : the maximal size of the dictionary
+	 * @param dictionary : return the dictionary
+	 * @return True if success; otherwise, false, which also happens if zstd is not supported or the samples are too few
+	 */
+	static bool trainDictionary(const std::vector< std::vector<unsigned char> >& samples, std::size_t capacity, std::vector<unsigned char>& dictionary);
+};
+
+}
+
+#endif/*ZILLIANS_ARCHIVECODEC_H_*/
@@ -0,0 +1,136 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BUFFERCOMPRESSOR_H_
+#define ZILLIANS_BUFFERCOMPRESSOR_H_
+
+#include "core/Buffer.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+namespace zillians {
+
+/**
+ * BufferCompressor compresses messages held in Buffer with LZ4, one frame per message.
+ *
+ * compressInto() consumes the data of the source buffer and appends a frame of
+ * it to the destination, decompressInto() consumes one frame and appends the
+ * original message. Data is compressed straight into the destination if it has
+ * room, otherwise into a scratch buffer reused by each thread, so no per-message
+ * allocation is made either way.
+ *
+ * Messages smaller than the threshold, and messages which don't shrink, are
+ * stored as they are. In streaming mode each message is compressed with the
+ * previous 64KB of messages as dictionary, which pays off for many small similar
+ * messages on the same connection. The frames must then be decompressed in
+ * order by the peer's compressor, and a lost frame corrupts the rest of the stream
+ * until both sides reset().
+ *
+ * @code
+ * BufferCompressor compressor(BufferCompressor::Mode::streaming);
+ * compressor.compressInto(message, outgoing);
+ * ...
+ * peer_compressor.decompressInto(incoming, message);
+ * @endcode
+ *
+ * @note A compressor keeps the dictionaries of one connection, it's not thread-safe.
+ * @note Without LZ4 support all messages are stored uncompressed, and LZ4 frames can't be decompressed.
+ */
+class BufferCompressor : public boost::noncopyable
+{
+public:
+	enum
+	{
+		HEADER_SIZE = 9,				///< Frame header: type, original size and payload size
+		DEFAULT_THRESHOLD = 128,		///< Messages smaller than this aren't worth compressing
+		DICTIONARY_SIZE = 64 * 1024,	///< The LZ4 window
+	};
+
+	struct Mode
+	{
+		enum type
+		{
+			independent	= 0,	///< Every frame can be decompressed on its own
+			streaming	= 1,	///< Frames depend on the previous ones
+		};
+	};
+
+public:
+	/**
+	 * @param mode : whether to keep the dictionary across messages
+	 * @param threshold : the size below which messages are stored uncompressed
+	 * @param acceleration : the LZ4 acceleration, larger is faster but compresses less
+	 */
+	explicit BufferCompressor(Mode::type mode = Mode::independent, std::size_t threshold = DEFAULT_THRESHOLD, int acceleration = 1);
+	~BufferCompressor();
+
+public:
+	/**
+	 * Compress all data of the source buffer into a frame appended to dest.
+	 *
+	 * @param source : the message, consumed on success
+	 * @param dest : the buffer to append the frame to, grown if it's on-demand
+	 * @return True if success; otherwise, false if dest is full or the message is too large, leaving both untouched
+	 */
+	bool compressInto(Buffer& source, Buffer& dest);
+
+	/**
+	 * Decompress the frame at the read position of source and append the message to dest.
+	 *
+	 * @param source : the frames, the first one is consumed on success
+	 * @param dest : the buffer to append the message to, grown if it's on-demand
+	 * @return True if success; otherwise, false if the frame is incomplete, corrupted or dest is full, leaving source untouched
+	 */
+	bool decompressInto(Buffer& source, Buffer& dest);
+
+	/**
+	 * Forget the dictionaries of streaming mode, i.e. on reconnection.
+	 */
+	void reset();
+
+	inline Mode::type mode() const
+	{
+		return mMode;
+	}
+
+	/**
+	 * Check whether LZ4 is compiled in.
+	 */
+	static bool isSupported();
+
+private:
+	bool store(Buffer& source, std::size_t size, Buffer& dest);
+	void appendDictionary(const char* data, std::size_t size);
+
+private:
+	Mode::type mMode;
+	std::size_t mThreshold;
+	int mAcceleration;
+
+	void* mStream;									///< The LZ4 stream of streaming mode
+	boost::scoped_array<char> mCompressDictionary;	///< Last messages compressed, where mStream refers to
+	std::size_t mCompressDictionarySize;
+	boost::scoped_array<char> mDecompressDictionary;///< Last messages decompressed from dependent frames
+	std::size_t mDecompressDictionarySize;
+};
+
+}
+
+#endif/*ZILLIANS_BUFFERCOMPRESSOR_H_*/
@@ -23,11 +23,123 @@
 #ifndef ZILLIANS_CRYPTO_H_
 #define ZILLIANS_CRYPTO_H_
 
+#include "core/Prerequisite.h"
+#include <boost/noncopyable.hpp>
 #include <string>
 #include <vector>
 
+struct evp_cipher_ctx_st;
+
 namespace zillians {
 
+/**
+ * Stateful symmetric cipher wrapping an openssl EVP cipher context.
+ *
+ * Data is processed as it arrives, so a payload never needs to be held in memory as a whole, and a
+ * context initialized once can be reset() with a new IV for each message without running the key
+ * schedule again. Stream modes (CTR, GCM, ChaCha20...) can be applied in place over Buffer ranges.
+ *
+ * For AEAD modes (AES-GCM, ChaCha20-Poly1305), additional authenticated data goes to updateAAD()
+ * before any update(), the encoder fetches the tag by getTag() after final(), and the decoder gives
+ * the expected tag to setTag() before final(), which then fails if the data has been tampered with.
+ */
+class CipherContext : public boost::noncopyable
+{
+public:
+	CipherContext();
+	~CipherContext();
+
+	/**
+	 * Select the algorithm and set up the key.
+	 *
+	 * @param nid : specify algorithm (ref. grep NID_ /usr/include/openssl/obj_mac.h)
+	 * @param key : key for specific algorithm
+	 * @param iv : IV for specific algorithm, AEAD modes accept any IV (nonce) length the algorithm supports
+	 * @param encode : true to encrypt; otherwise, decrypt
+	 * @return True if success; otherwise, false
+	 */
+	bool init(int nid, const std::string& key, const std::string& iv, bool encode);
+
+	/**
+	 * Start a new message with the same algorithm, key and direction.
+	 *
+	 * @param iv : IV for the new message, of the same length as the one given to init()
+	 * @return True if success; otherwise, false
+	 */
+	bool reset(const std::string& iv);
+
+	/**
+	 * Feed additional authenticated data, only valid for AEAD modes and before the first update().
+	 */
+	bool updateAAD(const byte* data, std::size_t size);
+
+	/**
+	 * Encrypt/decrypt the next piece of data.
+	 *
+	 * Block modes may hold back up to blockSize() bytes until the next update() or final(), so out
+	 * should have room for size + blockSize() bytes. out may be the same as in, but must not overlap
+	 * it otherwise.
+	 *
+	 * @param written : number of bytes written to out
+	 * @return True if success; otherwise, false
+	 */
+	bool update(const byte* in, std::size_t size, byte* out, std::size_t& written);
+
+	/**
+	 * Encrypt/decrypt the readable data of a Buffer in place, only for stream modes (blockSize() == 1).
+	 *
+	 * The read position of the buffer is not changed.
+	 */
+	template<typename BufferT>
+	bool update(BufferT& buffer)
+	{
+		if(blockSize() != 1)
+			return false;
+
+		std::vector<std::pair<byte*, std::size_t> > ranges;
+		ranges.reserve(2);
+		buffer.getDataRanges(ranges);
+		for(std::size_t i = 0; i < ranges.size(); ++i)
+		{
+			std::size_t written = 0;
+			if(!update(ranges[i].first, ranges[i].second, ranges[i].first, written) || written != ranges[i].second)
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Finish the message, writing at most blockSize() bytes of padding or held back data to out.
+	 *
+	 * @param written : number of bytes written to out
+	 * @return True if success; otherwise, false, which for AEAD decryption means authentication failed
+	 */
+	bool final(byte* out, std::size_t& written);
+
+	/**
+	 * Get the authentication tag of an AEAD encryption, call it after final().
+	 */
+	bool getTag(byte* tag, std::size_t size);
+
+	/**
+	 * Set the expected authentication tag of an AEAD decryption, call it before final().
+	 */
+	bool setTag(const byte* tag, std::size_t size);
+
+	std::size_t blockSize() const;
+
+	inline bool isAEAD() const
+	{
+		return mAEAD;
+	}
+
+private:
+	evp_cipher_ctx_st* mContext;
+	std::size_t mIvLength;
+	bool mAEAD;
+	bool mInitialized;
+};
+
 struct Crypto_t
 {
 	static std::string encryptStringBasic(std::string Data, std::string Key, bool PostBase64Encode = true);
@@ -28,8 +28,48 @@
 #define ZILLIANS_BASE64_H_
 
 #include <string>
+#include <cstddef>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
 std::string base64_decode(std::string const& s);
 
+/**
+ * Exact number of characters base64_encode() writes for len bytes, padding included.
+ */
+inline std::size_t base64_encoded_size(std::size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
+
+/**
+ * Exact number of bytes base64_decode() writes for the given text, with or without padding.
+ * Returns 0 for lengths no base64 text can have.
+ */
+inline std::size_t base64_decoded_size(const char* src, std::size_t len)
+{
+    for (int pad = 0; pad < 2 && len > 0 && src[len - 1] == '='; ++pad)
+        --len;
+    if (len % 4 == 1)
+        return 0;
+    return len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+}
+
+/**
+ * Encode into a caller-provided buffer, which must hold base64_encoded_size(len) characters.
+ * The output is not NUL-terminated.
+ *
+ * @return The number of characters written.
+ */
+std::size_t base64_encode(const unsigned char* src, std::size_t len, char* out);
+
+/**
+ * Decode into a caller-provided buffer, which must hold base64_decoded_size(src, len) bytes.
+ *
+ * Unlike base64_decode(std::string), which stops at the first unexpected character, the whole
+ * text must be valid base64, optionally padded with '='.
+ *
+ * @return True if success; otherwise, false, and the content of out is undefined.
+ */
+bool base64_decode(const char* src, std::size_t len, unsigned char* out, std::size_t& written);
+
 #endif
@@ -29,15 +29,82 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define SHA1_DEFINED
 
 #include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
 
 namespace sha1
 {
+        /**
+                Incremental SHA-1, for data that arrives in pieces or lives in several memory ranges.
+
+                @code
+                sha1::Context context;
+                context.update(header, headerLength);
+                context.update(buffer);
+                context.final(hash);
+                @endcode
+
+                Whole blocks are hashed with SHA-NI on x86 or the ARMv8 crypto extensions when the CPU has them, and with the portable code otherwise.
+        */
+        class Context
+        {
+        public:
+                Context();
+
+                /**
+                        Start over, forgetting everything given to update().
+                */
+                void reset();
+
+                /**
+                        @param src points to the next piece of data to be hashed.
+                        @param bytelength the number of bytes to hash from the src pointer.
+                */
+                void update(const void *src, std::size_t bytelength);
+
+                /**
+                        Hash the readable data of a zillians::Buffer in place, a circular buffer is read as its (at most two) physical ranges.
+                        The read position of the buffer is not changed, call rskip() afterwards to consume the data.
+                */
+                template<typename BufferT>
+                void update(BufferT& buffer)
+                {
+                        std::vector<std::pair<char*, std::size_t> > ranges;
+                        ranges.reserve(2);
+                        buffer.getDataRanges(ranges);
+                        for(std::size_t i = 0; i < ranges.size(); ++i)
+                        {
+                                update(ranges[i].first, ranges[i].second);
+                        }
+                }
+
+                /**
+                        Finish the hash and reset the context, so it can be reused for the next message.
+                        @param hash should point to a buffer of at least 20 bytes of size for storing the sha1 result in.
+                */
+                void final(unsigned char *hash);
+
+        private:
+                unsigned int mState[5];
+                unsigned long long mLength;
+                unsigned char mBlock[64];
+                std::size_t mBlockSize;
+        };
+
         /**
                 @param src points to any kind of data to be hashed.
                 @param bytelength the number of bytes to hash from the src pointer.
                 @param hash should point to a buffer of at least 20 bytes of size for storing the sha1 result in.
         */
         void calc(const void *src, const int bytelength, unsigned char *hash);
+        /**
+                Hash several independent messages at once. Without SHA instructions four messages are hashed in parallel in the lanes of SSE2 registers, so this is much faster than calling calc() for each of many small messages.
+                @param srcs points to count pointers to the messages.
+                @param bytelengths points to count message lengths.
+                @param hashes should point to a buffer of at least 20 * count bytes, the hash of message i is stored at hashes + 20 * i.
+        */
+        void calcMultiple(const void *const *srcs, const std::size_t *bytelengths, std::size_t count, unsigned char *hashes);
         /**
                 @param hash is 20 bytes of sha1 hash. This is the same data that is the result from the calc function.
                 @param hexstring should point to a buffer of at least 41 bytes of size for storing the hexadecimal representation of the hash. A zero will be written at position 40, so the buffer will be a valid zero ended string.
@@ -0,0 +1,340 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/AllocationTrace.h"
+#include <boost/scoped_array.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace zillians {
+
+namespace {
+
+// batches are owned by the tracer, so they survive the threads that recorded into them
+template<typename T>
+void keepBatch(T*)
+{ }
+
+bool earlierThan(const AllocationTraceRecord& a, const AllocationTraceRecord& b)
+{
+	return a.timestamp < b.timestamp;
+}
+
+std::size_t getResidentBytes()
+{
+	FILE* f = fopen("/proc/self/statm", "r");
+	if(!f) return 0;
+
+	unsigned long total = 0, resident = 0;
+	if(fscanf(f, "%lu %lu", &total, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// marks the slot of an allocation which failed in replay, so its deallocation is skipped
+byte* const FAILED_ALLOCATION = reinterpret_cast<byte*>(1);
+
+const std::size_t TOUCH_STRIDE = 4096;
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+AllocationTracer::AllocationTracer(const std::string& path) : mStart(TimerUtil::now_ns()), mLocal(&keepBatch<Batch>), mWrittenCount(0)
+{
+	mFile = fopen(path.c_str(), "wb");
+	if(!mFile)
+		throw std::runtime_error(std::string("failed to open allocation trace: ") + strerror(errno));
+
+	Header header;
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.recordSize = sizeof(AllocationTraceRecord);
+	fwrite(&header, sizeof(header), 1, mFile);
+}
+
+AllocationTracer::~AllocationTracer()
+{
+	flush();
+	fclose(mFile);
+}
+
+void AllocationTracer::flush()
+{
+	boost::mutex::scoped_lock lock(mFileLock);
+	for(std::size_t i = 0; i < mBatches.size(); ++i)
+	{
+		Batch* batch = mBatches[i].get();
+		fwrite(batch->records, sizeof(AllocationTraceRecord), batch->count, mFile);
+		mWrittenCount += batch->count;
+		batch->count = 0;
+	}
+	fflush(mFile);
+}
+
+uint64 AllocationTracer::recordCount() const
+{
+	boost::mutex::scoped_lock lock(mFileLock);
+	uint64 count = mWrittenCount;
+	for(std::size_t i = 0; i < mBatches.size(); ++i)
+		count += mBatches[i]->count;
+	return count;
+}
+
+AllocationTracer::Batch* AllocationTracer::registerThread()
+{
+	boost::shared_ptr<Batch> batch(new Batch);
+	batch->count = 0;
+	{
+		boost::mutex::scoped_lock lock(mFileLock);
+		batch->thread = static_cast<uint16>(mBatches.size());
+		mBatches.push_back(batch);
+	}
+	mLocal.reset(batch.get());
+	return batch.get();
+}
+
+void AllocationTracer::writeBatch(Batch* batch)
+{
+	boost::mutex::scoped_lock lock(mFileLock);
+	fwrite(batch->records, sizeof(AllocationTraceRecord), batch->count, mFile);
+	mWrittenCount += batch->count;
+	batch->count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+AllocationReplayResult::AllocationReplayResult() :
+	operations(0), failures(0), elapsed(0),
+	peakRequestedBytes(0), peakResidentBytes(0)
+{ }
+
+double AllocationReplayResult::throughput() const
+{
+	return (elapsed == 0) ? 0.0 : (double)operations * 1000000000.0 / (double)elapsed;
+}
+
+void AllocationReplayResult::print(const std::string& name) const
+{
+	printf("%s: %llu operations in %.3lf ms (%.0lf ops/s), %llu failures, peak requested = %lu KB, peak resident = %lu KB\n",
+			name.c_str(), (unsigned long long)operations, elapsed / 1000000.0, throughput(), (unsigned long long)failures,
+			(unsigned long)(peakRequestedBytes / 1024), (unsigned long)(peakResidentBytes / 1024));
+	allocateLatency.print(name + " allocate");
+	deallocateLatency.print(name + " deallocate");
+}
+
+//////////////////////////////////////////////////////////////////////////
+AllocationTrace::AllocationTrace(const std::string& path) : mAllocationCount(0), mOperationCount(0), mPeakRequestedBytes(0)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if(!f)
+		throw std::runtime_error(std::string("failed to open allocation trace: ") + strerror(errno));
+
+	AllocationTracer::Header header;
+	if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != AllocationTracer::MAGIC ||
+			header.version != AllocationTracer::VERSION || header.recordSize != sizeof(AllocationTraceRecord))
+	{
+		fclose(f);
+		throw std::runtime_error("invalid allocation trace");
+	}
+
+	fseek(f, 0, SEEK_END);
+	long end = ftell(f);
+	fseek(f, sizeof(header), SEEK_SET);
+
+	// a truncated trailing record (i.e. the tracing process was killed) is ignored
+	std::vector<AllocationTraceRecord> records((end - sizeof(header)) / sizeof(AllocationTraceRecord));
+	if(!records.empty() && fread(&records[0], sizeof(AllocationTraceRecord), records.size(), f) != records.size())
+	{
+		fclose(f);
+		throw std::runtime_error("failed to read allocation trace");
+	}
+	fclose(f);
+
+	prepare(records);
+}
+
+AllocationTrace::AllocationTrace(const std::vector<AllocationTraceRecord>& records) : mAllocationCount(0), mOperationCount(0), mPeakRequestedBytes(0)
+{
+	std::vector<AllocationTraceRecord> copy(records);
+	prepare(copy);
+}
+
+void AllocationTrace::prepare(std::vector<AllocationTraceRecord>& records)
+{
+	// batches are written as they fill up, so the log is only ordered within each thread
+	std::stable_sort(records.begin(), records.end(), earlierThan);
+
+	std::map<uint16, std::size_t> threads;
+	std::map<uint64, uint32> live;
+	std::vector<uint32> sizes;
+	std::size_t requested = 0;
+
+	for(std::size_t i = 0; i < records.size(); ++i)
+	{
+		const AllocationTraceRecord& r = records[i];
+
+		std::map<uint16, std::size_t>::iterator thread = threads.find(r.thread);
+		if(thread == threads.end())
+		{
+			thread = threads.insert(std::make_pair(r.thread, mThreads.size())).first;
+			mThreads.push_back(std::vector<Operation>());
+		}
+
+		Operation op;
+		op.operation = r.operation;
+		if(r.operation == AllocationTraceRecord::ALLOCATE)
+		{
+			op.id = static_cast<uint32>(sizes.size());
+			op.size = r.size;
+			sizes.push_back(r.size);
+
+			// without a deallocation in between, the previous allocation of the address is never freed
+			live[r.address] = op.id;
+			requested += r.size;
+			mPeakRequestedBytes = std::max(mPeakRequestedBytes, requested);
+		}
+		else
+		{
+			std::map<uint64, uint32>::iterator it = live.find(r.address);
+			if(it == live.end())
+				continue;
+
+			op.id = it->second;
+			op.size = 0;
+			live.erase(it);
+			requested -= sizes[op.id];
+		}
+
+		mThreads[thread->second].push_back(op);
+		++mOperationCount;
+	}
+
+	mAllocationCount = sizes.size();
+}
+
+AllocationReplayResult AllocationTrace::replay(BufferAllocator& allocator) const
+{
+	AllocationReplayResult result;
+	result.peakRequestedBytes = mPeakRequestedBytes;
+
+	boost::scoped_array< std::atomic<byte*> > slots(new std::atomic<byte*>[mAllocationCount]);
+	for(std::size_t i = 0; i < mAllocationCount; ++i)
+		slots[i].store(NULL, std::memory_order_relaxed);
+
+	boost::mutex resultLock;
+	boost::barrier ready(mThreads.size() + 1);
+	std::atomic<bool> done(false);
+
+	const std::size_t baseline = getResidentBytes();
+	std::size_t peak = baseline;
+
+	boost::thread_group group;
+	for(std::size_t t = 0; t < mThreads.size(); ++t)
+	{
+		const std::vector<Operation>& ops = mThreads[t];
+		group.create_thread([&, t]() {
+			TimerHistogram allocateLatency;
+			TimerHistogram deallocateLatency;
+			uint64 failures = 0;
+
+			ready.wait();
+			for(std::size_t i = 0; i < ops.size(); ++i)
+			{
+				const Operation& op = ops[i];
+				std::atomic<byte*>& slot = slots[op.id];
+				if(op.operation == AllocationTraceRecord::ALLOCATE)
+				{
+					uint64 start = TimerUtil::now_ns();
+					byte* p = allocator.allocate(op.size);
+					allocateLatency.record(TimerUtil::now_ns() - start);
+
+					if(UNLIKELY(!p))
+					{
+						++failures;
+						slot.store(FAILED_ALLOCATION, std::memory_order_release);
+						continue;
+					}
+
+					for(std::size_t offset = 0; offset < op.size; offset += TOUCH_STRIDE)
+						p[offset] = 0;
+					slot.store(p, std::memory_order_release);
+				}
+				else
+				{
+					// wait for the allocating thread if it's behind
+					byte* p;
+					while(!(p = slot.load(std::memory_order_acquire)))
+						boost::this_thread::yield();
+					slot.store(NULL, std::memory_order_relaxed);
+					if(UNLIKELY(p == FAILED_ALLOCATION))
+						continue;
+
+					uint64 start = TimerUtil::now_ns();
+					allocator.deallocate(p);
+					deallocateLatency.record(TimerUtil::now_ns() - start);
+				}
+			}
+
+			boost::mutex::scoped_lock lock(resultLock);
+			result.allocateLatency.merge(allocateLatency);
+			result.deallocateLatency.merge(deallocateLatency);
+			result.failures += failures;
+		});
+	}
+
+	// sample the resident set while the replay threads are busy
+	boost::thread sampler([&]() {
+		while(!done.load(std::memory_order_acquire))
+		{
+			peak = std::max(peak, getResidentBytes());
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		}
+	});
+
+	ready.wait();
+	uint64 start = TimerUtil::now_ns();
+	group.join_all();
+	result.elapsed = TimerUtil::now_ns() - start;
+
+	done.store(true, std::memory_order_release);
+	sampler.join();
+	peak = std::max(peak, getResidentBytes());
+
+	result.operations = mOperationCount;
+	result.peakResidentBytes = peak - baseline;
+
+	for(std::size_t i = 0; i < mAllocationCount; ++i)
+	{
+		byte* p = slots[i].load(std::memory_order_relaxed);
+		if(p && p != FAILED_ALLOCATION)
+			allocator.deallocate(p);
+	}
+
+	return result;
+}
+
+}
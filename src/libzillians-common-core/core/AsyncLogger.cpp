@@ -0,0 +1,338 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/AsyncLogger.h"
+#include "threading/AdaptiveWait.h"
+#include <boost/bind.hpp>
+#include <stdio.h>
+#include <string.h>
+
+namespace zillians {
+
+namespace {
+
+void writeToFile(FILE* file, LogLevel::type level, uint64 timestamp, const char* message)
+{
+	fprintf(file, "%llu %-5s %s\n", (unsigned long long)timestamp, LogLevel::name(level), message);
+}
+
+#ifdef BUILD_WITH_LOG4CXX
+void writeToLog4cxx(log4cxx::LoggerPtr logger, LogLevel::type level, uint64 timestamp, const char* message)
+{
+	UNUSED_ARGUMENT(timestamp);
+	switch(level)
+	{
+	case LogLevel::trace: LOG4CXX_TRACE(logger, message); break;
+	case LogLevel::debug: LOG4CXX_DEBUG(logger, message); break;
+	case LogLevel::info: LOG4CXX_INFO(logger, message); break;
+	case LogLevel::warn: LOG4CXX_WARN(logger, message); break;
+	case LogLevel::error: LOG4CXX_ERROR(logger, message); break;
+	default: LOG4CXX_FATAL(logger, message); break;
+	}
+}
+#endif
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+AsyncLogger::AsyncLogger(const Sink& sink, std::size_t capacity, OverflowPolicy::type policy) :
+	mSink(sink), mCapacity(capacity), mPolicy(policy), mLocal(&AsyncLogger::releaseRing)
+{
+	BOOST_ASSERT(capacity >= 2 && (capacity & (capacity - 1)) == 0 && "the capacity must be a power of two");
+
+	mStopping = false;
+	mThread = boost::thread(boost::bind(&AsyncLogger::run, this));
+}
+
+AsyncLogger::~AsyncLogger()
+{
+	// the background thread drains once more after seeing the flag
+	mStopping = true;
+	if(mThread.joinable())
+		mThread.join();
+}
+
+void AsyncLogger::flush()
+{
+	std::vector< std::pair<RingPtr, std::size_t> > targets;
+	{
+		boost::mutex::scoped_lock lock(mRingsLock);
+		targets.reserve(mRings.size());
+		for(std::size_t i = 0; i < mRings.size(); ++i)
+			targets.push_back(std::make_pair(mRings[i], (std::size_t)mRings[i]->tail));
+	}
+
+	for(std::size_t i = 0; i < targets.size(); ++i)
+	{
+		while(targets[i].first->head < targets[i].second)
+			boost::this_thread::sleep(boost::posix_time::microseconds(100));
+	}
+}
+
+uint64 AsyncLogger::dropped() const
+{
+	uint64 total = 0;
+	boost::mutex::scoped_lock lock(mRingsLock);
+	for(std::size_t i = 0; i < mRings.size(); ++i)
+		total += mRings[i]->dropped;
+	return total;
+}
+
+AsyncLogger::Sink AsyncLogger::fileSink(FILE* file)
+{
+	return boost::bind(&writeToFile, file, _1, _2, _3);
+}
+
+#ifdef BUILD_WITH_LOG4CXX
+AsyncLogger::Sink AsyncLogger::log4cxxSink(log4cxx::LoggerPtr logger)
+{
+	return boost::bind(&writeToLog4cxx, logger, _1, _2, _3);
+}
+#endif
+
+AsyncLogger::RingPtr* AsyncLogger::registerThread()
+{
+	RingPtr* ring = new RingPtr(new Ring(mCapacity));
+	{
+		boost::mutex::scoped_lock lock(mRingsLock);
+		mRings.push_back(*ring);
+	}
+	mLocal.reset(ring);
+	return ring;
+}
+
+AsyncLogger::Record* AsyncLogger::waitForSpace(Ring* ring)
+{
+	Record* record;
+	while(!(record = ring->acquire()))
+		boost::this_thread::yield();
+	return record;
+}
+
+void AsyncLogger::releaseRing(RingPtr* ring)
+{
+	// the records left are still written, the background thread removes the ring once it's empty
+	(*ring)->closed = true;
+	delete ring;
+}
+
+void AsyncLogger::capture(Record& record, const char* value)
+{
+	if(!value) value = "(null)";
+
+	record.types[record.count] = Argument::string;
+	if(record.string_size == MAX_STRING_SIZE)
+	{
+		// out of space, point to the terminator of the last string
+		record.values[record.count++].u = MAX_STRING_SIZE - 1;
+		return;
+	}
+
+	std::size_t size = std::min(strlen(value), (std::size_t)(MAX_STRING_SIZE - record.string_size - 1));
+	memcpy(record.text + record.string_size, value, size);
+	record.text[record.string_size + size] = '\0';
+	record.values[record.count++].u = record.string_size;
+	record.string_size += size + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void AsyncLogger::run()
+{
+	threading::AdaptiveWait<16, 1, 50, 1000, 50, 1000> idle;
+	while(true)
+	{
+		bool stopping = mStopping;
+		if(drain() > 0)
+		{
+			idle.speedup();
+			continue;
+		}
+		if(stopping)
+			break;
+
+		idle.slowdown();
+		if(idle.is_waiting())
+			idle.wait();
+		else
+			boost::this_thread::yield();
+	}
+}
+
+std::size_t AsyncLogger::drain()
+{
+	std::vector<RingPtr> rings;
+	{
+		boost::mutex::scoped_lock lock(mRingsLock);
+		rings = mRings;
+	}
+
+	std::size_t n = 0;
+	bool any_closed = false;
+	for(std::size_t i = 0; i < rings.size(); ++i)
+	{
+		Ring& ring = *rings[i];
+
+		// the owner never writes again once closed, so it's checked before reading the tail
+		bool closed = ring.closed;
+		std::size_t head = ring.head;
+		for(std::size_t tail = ring.tail; head != tail; ++head)
+		{
+			write(ring.records[head & ring.mask]);
+			ring.head = head + 1;
+			++n;
+		}
+
+		uint64 dropped = ring.dropped;
+		if(dropped != ring.reported)
+		{
+			char message[64];
+			snprintf(message, sizeof(message), "%llu log records dropped", (unsigned long long)(dropped - ring.reported));
+			mSink(LogLevel::warn, TimerUtil::clock_get_time_ms(), message);
+			ring.reported = dropped;
+		}
+
+		if(closed)
+			any_closed = true;
+	}
+
+	if(any_closed)
+	{
+		boost::mutex::scoped_lock lock(mRingsLock);
+		for(std::vector<RingPtr>::iterator it = mRings.begin(); it != mRings.end(); )
+		{
+			if((*it)->closed && (*it)->head == (*it)->tail)
+				it = mRings.erase(it);
+			else
+				++it;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Format the record printf-style one conversion at a time, so each argument is passed
+ * to snprintf with the type it was captured as. Length modifiers in the format are
+ * ignored, conversions without an argument are written literally.
+ */
+void AsyncLogger::write(const Record& record)
+{
+	mLine.clear();
+
+	std::size_t next = 0;
+	char spec[32];
+	char buffer[512];
+	for(const char* p = record.format; *p; ++p)
+	{
+		if(*p != '%')
+		{
+			mLine += *p;
+			continue;
+		}
+		if(p[1] == '%')
+		{
+			mLine += '%';
+			++p;
+			continue;
+		}
+
+		const char* begin = p++;
+		std::size_t n = 0;
+		spec[n++] = '%';
+		while(*p && strchr("-+ #0123456789.", *p))
+		{
+			if(n < sizeof(spec) - 4) spec[n++] = *p;
+			++p;
+		}
+		while(*p && strchr("hlLqjzt", *p))
+			++p;
+
+		if(!*p)
+		{
+			mLine.append(begin);
+			break;
+		}
+
+		char conversion = *p;
+		if(next >= record.count || !strchr("diouxXeEfFgGaAcspn", conversion))
+		{
+			mLine.append(begin, p + 1);
+			continue;
+		}
+
+		std::size_t i = next++;
+		Argument::type type = (Argument::type)record.types[i];
+		if(type == Argument::string && conversion != 's')
+			conversion = 's';
+
+		int64 as_signed = (type == Argument::floating_point) ? (int64)record.values[i].d : record.values[i].i;
+		uint64 as_unsigned = (type == Argument::floating_point) ? (uint64)record.values[i].d : record.values[i].u;
+		double as_double = (type == Argument::floating_point) ? record.values[i].d : ((type == Argument::signed_integer) ? (double)record.values[i].i : (double)record.values[i].u);
+
+		int size = 0;
+		switch(conversion)
+		{
+		case 'd': case 'i':
+			spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conversion; spec[n] = '\0';
+			size = snprintf(buffer, sizeof(buffer), spec, (long long)as_signed);
+			break;
+		case 'o': case 'u': case 'x': case 'X':
+			spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conversion; spec[n] = '\0';
+			size = snprintf(buffer, sizeof(buffer), spec, (unsigned long long)as_unsigned);
+			break;
+		case 'c':
+			spec[n++] = 'c'; spec[n] = '\0';
+			size = snprintf(buffer, sizeof(buffer), spec, (int)as_signed);
+			break;
+		case 'p':
+			spec[n++] = 'p'; spec[n] = '\0';
+			size = snprintf(buffer, sizeof(buffer), spec, (type == Argument::pointer) ? record.values[i].p : (const void*)(uintptr_t)as_unsigned);
+			break;
+		case 's':
+			if(type == Argument::string)
+			{
+				spec[n++] = 's'; spec[n] = '\0';
+				size = snprintf(buffer, sizeof(buffer), spec, record.text + record.values[i].u);
+			}
+			else if(type == Argument::floating_point)
+				size = snprintf(buffer, sizeof(buffer), "%g", as_double);
+			else if(type == Argument::pointer)
+				size = snprintf(buffer, sizeof(buffer), "%p", record.values[i].p);
+			else if(type == Argument::signed_integer)
+				size = snprintf(buffer, sizeof(buffer), "%lld", (long long)as_signed);
+			else
+				size = snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)as_unsigned);
+			break;
+		case 'n':
+			// never write through the format
+			break;
+		default:
+			spec[n++] = conversion; spec[n] = '\0';
+			size = snprintf(buffer, sizeof(buffer), spec, as_double);
+			break;
+		}
+
+		if(size > 0)
+			mLine.append(buffer, std::min((std::size_t)size, sizeof(buffer) - 1));
+	}
+
+	mSink((LogLevel::type)record.level, record.timestamp, mLine.c_str());
+}
+
+}
@@ -0,0 +1,480 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/BufferDelta.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+enum FrameType
+{
+	FRAME_FULL = 0,		///< The snapshot as it is
+	FRAME_DELTA = 1,	///< Skips and XOR-ed literals against the baseline
+};
+
+// the header is little-endian whatever the encoding of the buffer is, like the frames of BufferCompressor
+inline void writeUInt32(byte* p, uint32 value)
+{
+	for(int i = 0; i < 4; ++i)
+		p[i] = (byte)(value >> (8 * i));
+}
+
+inline uint32 readUInt32(const byte* p)
+{
+	// byte may be signed
+	const uint8* u = reinterpret_cast<const uint8*>(p);
+	return (uint32)u[0] | ((uint32)u[1] << 8) | ((uint32)u[2] << 16) | ((uint32)u[3] << 24);
+}
+
+void writeHeader(byte* header, FrameType type, uint32 sequence, uint32 size, uint32 payload_size)
+{
+	header[0] = (byte)type;
+	writeUInt32(header + 1, sequence);
+	writeUInt32(header + 5, size);
+	writeUInt32(header + 9, payload_size);
+}
+
+void readHeader(const byte* header, FrameType& type, uint32& sequence, uint32& size, uint32& payload_size)
+{
+	type = (FrameType)(uint8)header[0];
+	sequence = readUInt32(header + 1);
+	size = readUInt32(header + 5);
+	payload_size = readUInt32(header + 9);
+}
+
+inline std::size_t varintSize(uint32 value)
+{
+	std::size_t n = 1;
+	while(value >= 0x80)
+	{
+		value >>= 7;
+		++n;
+	}
+	return n;
+}
+
+inline uint8* writeVarint(uint8* p, uint32 value)
+{
+	while(value >= 0x80)
+	{
+		*p++ = (uint8)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8)value;
+	return p;
+}
+
+inline bool readVarint(const uint8*& p, const uint8* end, uint32& value)
+{
+	value = 0;
+	for(int shift = 0; shift < 35 && p != end; shift += 7)
+	{
+		uint8 b = *p++;
+		value |= (uint32)(b & 0x7F) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// freeSize() of a plain buffer counts the consumed space before the read pointer as well
+inline std::size_t tailSize(const Buffer& buffer)
+{
+	return buffer.allocatedSize() - buffer.wpos();
+}
+
+bool ensureFree(Buffer& buffer, std::size_t size)
+{
+	if(tailSize(buffer) >= size)
+		return true;
+	if(!buffer.isOnDemand())
+		return false;
+	buffer.reserve(size);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// comparison loops, the scalar versions handle the tails of the vector ones
+
+/// Length of the common prefix of a and b
+std::size_t mismatch_scalar(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 8 <= size; i += 8)
+	{
+		uint64 x, y;
+		std::memcpy(&x, a + i, 8);
+		std::memcpy(&y, b + i, 8);
+		if(x != y)
+		{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + (__builtin_ctzll(x ^ y) >> 3);
+#else
+			break;
+#endif
+		}
+	}
+	while(i < size && a[i] == b[i])
+		++i;
+	return i;
+}
+
+/// Length of the prefix of a and b where no byte is equal
+std::size_t match_scalar(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	while(i < size && a[i] != b[i])
+		++i;
+	return i;
+}
+
+void xor_scalar(uint8* dest, const uint8* a, const uint8* b, std::size_t size)
+{
+	for(std::size_t i = 0; i < size; ++i)
+		dest[i] = a[i] ^ b[i];
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, so it needs no check
+std::size_t mismatch_sse2(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+		uint32 equal = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if(equal != 0xFFFF)
+			return i + __builtin_ctz(~equal);
+	}
+	return i + mismatch_scalar(a + i, b + i, size - i);
+}
+
+std::size_t match_sse2(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+		uint32 equal = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if(equal != 0)
+			return i + __builtin_ctz(equal);
+	}
+	return i + match_scalar(a + i, b + i, size - i);
+}
+
+void xor_sse2(uint8* dest, const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(dest + i), _mm_xor_si128(x, y));
+	}
+	xor_scalar(dest + i, a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+std::size_t mismatch_avx2(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+		uint32 equal = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if(equal != 0xFFFFFFFFU)
+			return i + __builtin_ctz(~equal);
+	}
+	return i + mismatch_sse2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+std::size_t match_avx2(const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+		uint32 equal = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if(equal != 0)
+			return i + __builtin_ctz(equal);
+	}
+	return i + match_sse2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+void xor_avx2(uint8* dest, const uint8* a, const uint8* b, std::size_t size)
+{
+	std::size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+		_mm256_storeu_si256((__m256i*)(dest + i), _mm256_xor_si256(x, y));
+	}
+	xor_sse2(dest + i, a + i, b + i, size - i);
+}
+#endif
+
+struct DeltaLoops
+{
+	typedef std::size_t (*compare_function)(const uint8*, const uint8*, std::size_t);
+	typedef void (*xor_function)(uint8*, const uint8*, const uint8*, std::size_t);
+
+	DeltaLoops()
+	{
+#if defined(__x86_64__)
+		if(__builtin_cpu_supports("avx2"))
+		{
+			mismatch = &mismatch_avx2;
+			match = &match_avx2;
+			xorInto = &xor_avx2;
+		}
+		else
+		{
+			mismatch = &mismatch_sse2;
+			match = &match_sse2;
+			xorInto = &xor_sse2;
+		}
+#else
+		mismatch = &mismatch_scalar;
+		match = &match_scalar;
+		xorInto = &xor_scalar;
+#endif
+	}
+
+	compare_function mismatch;
+	compare_function match;
+	xor_function xorInto;
+};
+
+inline const DeltaLoops& loops()
+{
+	static const DeltaLoops instance;
+	return instance;
+}
+
+/**
+ * Write the XOR of the literal at [begin, end) of the snapshot, past the end of the baseline the bytes are stored as they are.
+ */
+inline uint8* writeLiteral(uint8* out, const uint8* current, const uint8* baseline, std::size_t common, std::size_t begin, std::size_t end)
+{
+	std::size_t xored = (begin < common) ? std::min(end, common) - begin : 0;
+	loops().xorInto(out, current + begin, baseline + begin, xored);
+	std::memcpy(out + xored, current + begin + xored, end - begin - xored);
+	return out + (end - begin);
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool BufferDelta::encodeDelta(const Buffer& baseline, uint32 sequence, Buffer& current, Buffer& dest)
+{
+	const std::size_t size = current.dataSize();
+	if(size > 0xFFFFFFFFU)
+		return false;
+
+	// a delta is only kept if it's smaller than the snapshot, so the room of a full frame is enough
+	if(!ensureFree(dest, HEADER_SIZE + size))
+		return false;
+
+	const uint8* cur = reinterpret_cast<const uint8*>(current.rptr());
+	const uint8* base = reinterpret_cast<const uint8*>(baseline.rptr());
+	const std::size_t common = std::min(size, baseline.dataSize());
+	const DeltaLoops& f = loops();
+
+	uint8* const payload = reinterpret_cast<uint8*>(dest.wptr()) + HEADER_SIZE;
+	uint8* out = payload;
+	std::size_t pos = 0;
+	while(pos < size)
+	{
+		// the equal run, the rest of the snapshot is implied equal if the frame ends
+		const std::size_t skip = (pos < common) ? f.mismatch(cur + pos, base + pos, common - pos) : 0;
+		const std::size_t begin = pos + skip;
+		if(begin == size)
+			break;
+
+		// the literal runs until an equal run long enough to skip, or to the end
+		std::size_t end = begin;
+		while(true)
+		{
+			if(end >= common)
+			{
+				end = size;
+				break;
+			}
+			end += f.match(cur + end, base + end, common - end);
+			if(end >= common)
+			{
+				end = size;
+				break;
+			}
+			std::size_t run = f.mismatch(cur + end, base + end, common - end);
+			if(run >= MIN_SKIP || end + run == size)
+				break;
+			end += run;
+		}
+
+		const std::size_t literal = end - begin;
+		if((std::size_t)(out - payload) + varintSize(skip) + varintSize(literal) + literal >= size)
+			return encodeFull(sequence, current, dest);
+
+		out = writeVarint(out, skip);
+		out = writeVarint(out, literal);
+		out = writeLiteral(out, cur, base, common, begin, end);
+		pos = end;
+	}
+
+	const std::size_t payload_size = out - payload;
+	if(payload_size >= size && size > 0)
+		return encodeFull(sequence, current, dest);
+
+	writeHeader(dest.wptr(), FRAME_DELTA, sequence, size, payload_size);
+	dest.wskip(HEADER_SIZE + payload_size);
+	current.rskip(size);
+	return true;
+}
+
+bool BufferDelta::encodeDelta(Buffer& current, Buffer& dest)
+{
+	shared_ptr<DeltaBaseline> baseline = getBaseline(current);
+	if(!baseline || !baseline->snapshot)
+		return encodeFull(0, current, dest);
+	return encodeDelta(*baseline->snapshot, baseline->sequence, current, dest);
+}
+
+bool BufferDelta::applyDelta(const Buffer& baseline, uint32 sequence, Buffer& source, Buffer& dest)
+{
+	return applyFrame(baseline.rptr(), baseline.dataSize(), &sequence, source, dest);
+}
+
+bool BufferDelta::applyDelta(Buffer& source, Buffer& dest)
+{
+	shared_ptr<DeltaBaseline> baseline = getBaseline(dest);
+	if(!baseline || !baseline->snapshot)
+		return applyFrame(NULL, 0, NULL, source, dest);
+	return applyDelta(*baseline->snapshot, baseline->sequence, source, dest);
+}
+
+bool BufferDelta::getFrameBaseline(const Buffer& source, uint32& sequence)
+{
+	if(source.dataSize() < HEADER_SIZE)
+		return false;
+
+	FrameType type;
+	uint32 size;
+	uint32 payload_size;
+	readHeader(source.rptr(), type, sequence, size, payload_size);
+	return type == FRAME_DELTA;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool BufferDelta::applyFrame(const byte* baseline, std::size_t baseline_size, const uint32* sequence, Buffer& source, Buffer& dest)
+{
+	if(source.dataSize() < HEADER_SIZE)
+		return false;
+
+	FrameType type;
+	uint32 frame_sequence;
+	uint32 size;
+	uint32 payload_size;
+	readHeader(source.rptr(), type, frame_sequence, size, payload_size);
+	if(source.dataSize() < HEADER_SIZE + (std::size_t)payload_size)
+		return false;
+
+	const uint8* in = reinterpret_cast<const uint8*>(source.rptr()) + HEADER_SIZE;
+	const uint8* const in_end = in + payload_size;
+	switch(type)
+	{
+	case FRAME_FULL:
+		if(payload_size != size || !ensureFree(dest, size))
+			return false;
+		std::memcpy(dest.wptr(), in, size);
+		break;
+
+	case FRAME_DELTA:
+	{
+		// every byte comes from either the baseline or the payload, check that before growing dest by a corrupted size
+		if(!sequence || frame_sequence != *sequence || size > baseline_size + payload_size || !ensureFree(dest, size))
+			return false;
+
+		const uint8* base = reinterpret_cast<const uint8*>(baseline);
+		const std::size_t common = std::min((std::size_t)size, baseline_size);
+		uint8* out = reinterpret_cast<uint8*>(dest.wptr());
+		std::size_t pos = 0;
+		while(in != in_end)
+		{
+			uint32 skip, literal;
+			if(!readVarint(in, in_end, skip) || !readVarint(in, in_end, literal))
+				return false;
+			if(skip > common - std::min(pos, common) || literal > size - pos - skip || literal > (std::size_t)(in_end - in))
+				return false;
+
+			std::memcpy(out + pos, base + pos, skip);
+			pos += skip;
+
+			// undo writeLiteral()
+			std::size_t xored = (pos < common) ? std::min((std::size_t)literal, common - pos) : 0;
+			loops().xorInto(out + pos, in, base + pos, xored);
+			std::memcpy(out + pos + xored, in + xored, literal - xored);
+			pos += literal;
+			in += literal;
+		}
+
+		// the rest is equal to the baseline
+		if(size - pos > common - std::min(pos, common))
+			return false;
+		std::memcpy(out + pos, base + pos, size - pos);
+		break;
+	}
+
+	default:
+		return false;
+	}
+
+	dest.wskip(size);
+	source.rskip(HEADER_SIZE + payload_size);
+	return true;
+}
+
+bool BufferDelta::encodeFull(uint32 sequence, Buffer& current, Buffer& dest)
+{
+	const std::size_t size = current.dataSize();
+	if(!ensureFree(dest, HEADER_SIZE + size))
+		return false;
+
+	writeHeader(dest.wptr(), FRAME_FULL, sequence, size, size);
+	std::memcpy(dest.wptr() + HEADER_SIZE, current.rptr(), size);
+	dest.wskip(HEADER_SIZE + size);
+	current.rskip(size);
+	return true;
+}
+
+}
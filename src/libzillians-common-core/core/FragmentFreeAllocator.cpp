@@ -21,6 +21,10 @@
  */
 
 #include "core/FragmentFreeAllocator.h"
+#include "core/AllocationTrace.h"
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <limits>
 
 namespace zillians {
 
@@ -29,8 +33,10 @@ FragmentAllocator::FragmentAllocator(byte* pool, std::size_t size) :
 	mConfiguredNumChunks(0),
 	mAllocatedSize(0),
 	mDeviceBasePointer(NULL),
-	mFragmentBlockHeadFree(NULL),
-	mFragmentBlockHead(NULL)
+	mFreeClassMask(0),
+	mFragmentBlockHead(NULL),
+	mTracer(NULL),
+	mDeferredBlocks(NULL)
 {
 	BOOST_ASSERT(pool != NULL);
 	BOOST_ASSERT(size > 0);
@@ -45,6 +51,10 @@ FragmentAllocator::FragmentAllocator(byte* pool, std::size_t size) :
 	mAllocatedSize = 0;
 	mDeviceBasePointer = pool;
 
+	// initialize free lists
+	for(std::size_t i = 0; i < FREE_CLASS_COUNT; ++i)
+		mFragmentBlockHeadFree[i] = NULL;
+
 	// initialize allocation list
 	mFragmentBlockHead = new FragmentBlock;
 
@@ -55,13 +65,15 @@ FragmentAllocator::FragmentAllocator(byte* pool, std::size_t size) :
 	mFragmentBlockHead->nextFree = mFragmentBlockHead->prevFree = NULL;
 	mFragmentBlockHead->nextBlock = mFragmentBlockHead->prevBlock = NULL;
 
-	mFragmentBlockHeadFree = mFragmentBlockHead;
+	insertFreeBlock(mFragmentBlockHead);
 }
 
 FragmentAllocator::~FragmentAllocator()
 {
 	BOOST_ASSERT(mDeviceBasePointer != NULL);
 
+	releaseDeferredBlocks();
+
 	BOOST_ASSERT(mAllocatedSize == 0);
 
 	mDeviceBasePointer = NULL;
@@ -70,26 +82,20 @@ FragmentAllocator::~FragmentAllocator()
 	mConfiguredNumChunks = 0;
 
 	// clean up memory block
+	// note that all blocks should be free, so there's no FragmentPointer left to delete
 	FragmentBlock* currentBlock = mFragmentBlockHead;
 	while(currentBlock)
 	{
 		FragmentBlock* next = currentBlock->nextBlock;
+		BOOST_ASSERT(currentBlock->free);
 		delete currentBlock;
 		currentBlock = next;
 	}
 
-	mFragmentBlockHeadFree = NULL;
+	for(std::size_t i = 0; i < FREE_CLASS_COUNT; ++i)
+		mFragmentBlockHeadFree[i] = NULL;
+	mFreeClassMask = 0;
 	mFragmentBlockHead = NULL;
-
-	// clean up allocation map
-	// note that the map should be empty
-	BOOST_ASSERT(mPointerToBlockMap.empty());
-	for(PointerToBlockMap::iterator it = mPointerToBlockMap.begin(); it != mPointerToBlockMap.end(); ++it)
-	{
-		//SAFE_DELETE(it->first);
-		delete it->first;
-	}
-	mPointerToBlockMap.clear();
 }
 
 bool FragmentAllocator::allocate(MutablePointer **pointer, std::size_t size)
@@ -100,44 +106,26 @@ bool FragmentAllocator::allocate(MutablePointer **pointer, std::size_t size)
 
 	printf("trying to allocate %ld bytes (%ld KB) (%ld MB)\n", size, size/1024, size/(1024*1024));
 
-	if(!mFragmentBlockHeadFree)
+	releaseDeferredBlocks();
+
+	if(!mFreeClassMask)
 		return false;
 
 	// round the requested size to multiple of chunk size
+	const std::size_t requested = size;
 	if(size % mConfiguredChunkSize != 0)
 		size = ((size / mConfiguredChunkSize) + 1) * mConfiguredChunkSize;
 
 	// find the free block with enough free space
-	FragmentBlock* currentBlock = mFragmentBlockHeadFree;
-	bool found = false;
+	FragmentBlock* currentBlock = findFreeBlock(size);
+	if(!currentBlock)
 	{
-		while (currentBlock)
-		{
-			// current block has enough size, end search
-			if (currentBlock->size >= size)
-			{
-				found = true;
-				break;
-			}
-
-			// no remaining free blocks, end search
-			if (!currentBlock->nextFree)
-			{
-				found = false;
-				break;
-			}
-
-			// continue on next free block
-			currentBlock = currentBlock->nextFree;
-		}
-
-		if (!found)
-		{
-			printf("no available free block\n");
-			return false;
-		}
+		printf("no available free block\n");
+		return false;
 	}
 
+	removeFreeBlock(currentBlock);
+
 	// as we found the free block,...
 	// insert new allocated block on the left of current block
 	FragmentBlock* newBlock = NULL;
@@ -161,30 +149,19 @@ bool FragmentAllocator::allocate(MutablePointer **pointer, std::size_t size)
 		newBlock->nextBlock = currentBlock;
 	}
 
-	// check if current block, which is going to be delete, is the head of all blocks
+	// check if current block is the head of all blocks
 	if(currentBlock == mFragmentBlockHead)
-		mFragmentBlockHead = currentBlock->prevBlock;
+		mFragmentBlockHead = newBlock;
 
 	// modify the existing free block
 	{
 		if (currentBlock->size == size)
 		{
 			// maintain the double linked-list
-			if (currentBlock->prevFree)
-				currentBlock->prevFree->nextFree = currentBlock->nextFree;
-
-			if (currentBlock->nextFree)
-				currentBlock->nextFree->prevFree = currentBlock->prevFree;
-
-			if (currentBlock->prevBlock)
-				currentBlock->prevBlock->nextBlock = currentBlock->nextBlock;
+			newBlock->nextBlock = currentBlock->nextBlock;
 
 			if (currentBlock->nextBlock)
-				currentBlock->nextBlock->prevBlock = currentBlock->prevBlock;
-
-			// check if current block, which is going to be delete, is the head of free blocks
-			if (currentBlock == mFragmentBlockHeadFree)
-				mFragmentBlockHeadFree = currentBlock->nextFree;
+				currentBlock->nextBlock->prevBlock = newBlock;
 
 			SAFE_DELETE(currentBlock);
 		}
@@ -192,21 +169,25 @@ bool FragmentAllocator::allocate(MutablePointer **pointer, std::size_t size)
 		{
 			currentBlock->offset += size;
 			currentBlock->size   -= size;
+
+			// the remaining may fall into a smaller size class
+			insertFreeBlock(currentBlock);
 		}
 	}
 
 	// create the mutable pointer
 	*pointer = new MutablePointer(mDeviceBasePointer + newBlock->offset);
 
-	// set the reference pointer
+	// set the reference pointer in both ways
 	newBlock->pointerReference = (*pointer)->pointerReference;
-
-	// insert new entry in allocation map
-	mPointerToBlockMap[(*pointer)->pointerReference] = newBlock;
+	newBlock->pointerReference->block = newBlock;
 
 	// bookkeeping the allocated size
 	mAllocatedSize += size;
 
+	if(mTracer)
+		mTracer->recordAllocate(*pointer, requested);
+
 	std::size_t availmem = available();
 	printf("allocated %ld bytes (%ld KB) (%ld MB), free memory %ld bytes (%ld KB) (%ld MB)\n", size, size/1024, size/(1024*1024), availmem, availmem/1024, availmem/(1024*1024));
 	return true;
@@ -221,241 +202,216 @@ bool FragmentAllocator::deallocate(MutablePointer *pointer)
 	if(!pointer)
 		return false;
 
-	if(!pointer->pointerReference)
+	// if the pointer does not refer to an allocation, return fail
+	if(!isValid(pointer))
 		return false;
 
-	// find the memory block from allocation map
-	PointerToBlockMap::iterator it = mPointerToBlockMap.find(pointer->pointerReference);
-
-	// if we cannot find the allocation, return fail
-	if(it == mPointerToBlockMap.end())
-		return false;
+	if(mTracer)
+		mTracer->recordDeallocate(pointer);
 
 	// we have the corresponding memory block now
-	FragmentBlock* currentBlock = it->second;
-
-	// delete the entry in allocation map
-	mPointerToBlockMap.erase(it);
+	FragmentBlock* currentBlock = pointer->pointerReference->block;
 
 	// free the mutable pointer object
+	currentBlock->pointerReference = NULL;
 	SAFE_DELETE(pointer);
 
-	// bookkeeping the allocated size
-	mAllocatedSize -= currentBlock->size;
+	releaseBlock(currentBlock);
 
-	// four cases: merge left, merge right, merge both left and right, and no merge
-	FragmentBlock* prevBlock = currentBlock->prevBlock;
-	FragmentBlock* nextBlock = currentBlock->nextBlock;
+	return true;
+}
 
-	// determine whether left/right is a free block
-	bool isPrevFree = false;
-	bool isNextFree = false;
-	{
-		if (prevBlock)
-			if (prevBlock->free)
-				isPrevFree = true;
-		if (nextBlock)
-			if (nextBlock->free)
-				isNextFree = true;
-	}
+bool FragmentAllocator::deallocateDeferred(MutablePointer *pointer)
+{
+	if(!pointer)
+		return false;
+
+	if(!isValid(pointer))
+		return false;
+
+	if(mTracer)
+		mTracer->recordDeallocate(pointer);
 
-	// when left and right block are both free, merge left and right block into one free block
-	// (here we delete the prev/next block and keep the current block)
-	if(isPrevFree && isNextFree)
+	FragmentBlock* block = pointer->pointerReference->block;
+
+	// the block keeps the FragmentPointer, it may still be relocated until it's released
+	pointer->pointerOwner = false;
+	SAFE_DELETE(pointer);
+
+	FragmentBlock* head = mDeferredBlocks.load(std::memory_order_relaxed);
+	do
 	{
-		currentBlock->prevFree = prevBlock->prevFree;
-		currentBlock->nextFree = nextBlock->nextFree;
-		currentBlock->prevBlock = prevBlock->prevBlock;
-		currentBlock->nextBlock = nextBlock->nextBlock;
+		block->nextFree = head;
+	} while(!mDeferredBlocks.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
 
-		if(prevBlock->prevFree)
-			prevBlock->prevFree->nextFree = currentBlock;
-		if(nextBlock->nextFree)
-			nextBlock->nextFree->prevFree = currentBlock;
-		if(prevBlock->prevBlock)
-			prevBlock->prevBlock->nextBlock = currentBlock;
-		if(nextBlock->nextBlock)
-			nextBlock->nextBlock->prevBlock = currentBlock;
+	return true;
+}
 
-		currentBlock->free = true;
-		currentBlock->offset = prevBlock->offset;
-		currentBlock->size = prevBlock->size + currentBlock->size + nextBlock->size;
+void FragmentAllocator::drainDeferred()
+{
+#if ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_CONCURRENT_ALLOCATION
+	tbb::mutex::scoped_lock lock(mAllocationLock);
+#endif
 
-		BOOST_ASSERT(mFragmentBlockHeadFree != NULL);
+	releaseDeferredBlocks();
+}
 
-		// check if prev block, which is going to be delete, is the head of free blocks
-		if (prevBlock == mFragmentBlockHeadFree)
-			mFragmentBlockHeadFree = currentBlock;
+void FragmentAllocator::releaseDeferredBlocks()
+{
+	if(!mDeferredBlocks.load(std::memory_order_relaxed))
+		return;
 
-		// check if prev block, which is going to be delete, is the head of all blocks
-		if(prevBlock == mFragmentBlockHead)
-			mFragmentBlockHead = currentBlock;
+	FragmentBlock* block = mDeferredBlocks.exchange(NULL, std::memory_order_acquire);
+	while(block)
+	{
+		FragmentBlock* next = block->nextFree;
+		block->nextFree = NULL;
 
-		SAFE_DELETE(prevBlock);
-		SAFE_DELETE(nextBlock);
+		SAFE_DELETE(block->pointerReference);
+		releaseBlock(block);
+
+		block = next;
 	}
-	// when previous block is free and next is not free, merge current block into previous block (toward left)
+}
+
+void FragmentAllocator::releaseBlock(FragmentBlock* currentBlock)
+{
+	// bookkeeping the allocated size
+	mAllocatedSize -= currentBlock->size;
+
+	currentBlock->free = true;
+
+	// merge into previous block if it's free (toward left)
 	// (here we delete the current block and keep previous block)
-	else if(isPrevFree && !isNextFree)
+	FragmentBlock* prevBlock = currentBlock->prevBlock;
+	if(prevBlock && prevBlock->free)
 	{
-		prevBlock->nextBlock = nextBlock;
+		removeFreeBlock(prevBlock);
 
-		if(nextBlock)
-			nextBlock->prevBlock = prevBlock;
+		prevBlock->nextBlock = currentBlock->nextBlock;
+		if(currentBlock->nextBlock)
+			currentBlock->nextBlock->prevBlock = prevBlock;
 
 		prevBlock->size += currentBlock->size;
 
-		BOOST_ASSERT(mFragmentBlockHeadFree != NULL);
-		BOOST_ASSERT(currentBlock != mFragmentBlockHeadFree);
 		BOOST_ASSERT(currentBlock != mFragmentBlockHead);
 
 		SAFE_DELETE(currentBlock);
+		currentBlock = prevBlock;
 	}
-	// when next block is free and previous block is not free, merge current block into previous block (toward right)
-	// (here we delete the current block and keep next block)
-	else if(!isPrevFree && isNextFree)
-	{
-		nextBlock->prevBlock = prevBlock;
-
-		if(prevBlock)
-			prevBlock->nextBlock = nextBlock;
 
-		nextBlock->offset = currentBlock->offset;
-		nextBlock->size  += currentBlock->size;
+	// merge next block into current block if it's free (toward right)
+	// (here we delete the next block and keep the current block)
+	FragmentBlock* nextBlock = currentBlock->nextBlock;
+	if(nextBlock && nextBlock->free)
+	{
+		removeFreeBlock(nextBlock);
 
-		BOOST_ASSERT(mFragmentBlockHeadFree != NULL);
-		BOOST_ASSERT(currentBlock != mFragmentBlockHeadFree);
+		currentBlock->nextBlock = nextBlock->nextBlock;
+		if(nextBlock->nextBlock)
+			nextBlock->nextBlock->prevBlock = currentBlock;
 
-		// check if current block, which is going to be delete, is the head of all blocks
-		if(currentBlock == mFragmentBlockHead)
-			mFragmentBlockHead = currentBlock->nextBlock;
+		currentBlock->size += nextBlock->size;
 
-		SAFE_DELETE(currentBlock);
+		SAFE_DELETE(nextBlock);
 	}
-	// when both next block and previous block are not free, set the current block as free block
-	// and search toward left and right to update free block link
-	else
-	{
-		// free the current block
-		currentBlock->free = true;
 
-		// search toward left for free block to update the free link
-		bool foundPrevFreeBlock = false;
-		{
-			while (prevBlock)
-			{
-				if (prevBlock->free)
-				{
-					foundPrevFreeBlock = true;
-					break;
-				}
-				prevBlock = prevBlock->prevBlock;
-			}
-
-			if (foundPrevFreeBlock)
-			{
-				// if we found previous free block, then we know the next free block (which is on the right side)
-				nextBlock = prevBlock->nextFree;
+	insertFreeBlock(currentBlock);
+}
 
-				// update free link for both left and right side
-				prevBlock->nextFree = currentBlock;
+bool FragmentAllocator::isValid(MutablePointer*pointer)
+{
+	if(!pointer->pointerReference)
+		return false;
 
-				currentBlock->prevFree = prevBlock;
-				currentBlock->nextFree = nextBlock;
+	// the block must be allocated and owned by the given pointer
+	FragmentBlock* currentBlock = pointer->pointerReference->block;
+	if(!currentBlock || currentBlock->free || currentBlock->pointerReference != pointer->pointerReference)
+		return false;
 
-				if(nextBlock)
-					nextBlock->prevFree = currentBlock;
-			}
-			else
-			{
-				currentBlock->prevFree = NULL;
+	return true;
+}
 
-				// the current block is the first free block of all blocks
-				mFragmentBlockHeadFree = currentBlock;
-			}
-		}
+size_t FragmentAllocator::infoSize(MutablePointer*pointer)
+{
+	// if we cannot find the allocation, return fail
+	if(!isValid(pointer))
+		return false;
 
-		bool foundNextFreeBlock = false;
-		// when we didn't found previous free block, it's still possible that there's free block on the right
-		// search toward right for free block to update the free link
-		if(!foundPrevFreeBlock)
-		{
-			while(nextBlock)
-			{
-				if(nextBlock->free)
-				{
-					foundNextFreeBlock = true;
-					break;
-				}
-				nextBlock = nextBlock->nextBlock;
-			}
+	// we have the corresponding memory block now
+	FragmentBlock* currentBlock = pointer->pointerReference->block;
 
-			if(foundNextFreeBlock)
-			{
-				// if we found next free block, then we know the previous free block (which is on the left side) (which should be NULL)
-				prevBlock = nextBlock->prevFree;
+	return currentBlock->size;
+}
 
-				BOOST_ASSERT(prevBlock == NULL);
+std::size_t FragmentAllocator::getFreeClass(std::size_t size)
+{
+	std::size_t chunks = size / mConfiguredChunkSize;
+	if(chunks == 0)
+		return 0;
 
-				// update the free link for both left and right side
-				nextBlock->prevFree = currentBlock;
+	// floor(log2(chunks))
+	return sizeof(unsigned long) * 8 - 1 - __builtin_clzl((unsigned long)chunks);
+}
 
-				currentBlock->prevFree = prevBlock;
-				currentBlock->nextFree = nextBlock;
+FragmentBlock* FragmentAllocator::findFreeBlock(std::size_t size)
+{
+	std::size_t freeClass = getFreeClass(size);
 
-				if(prevBlock)
-					prevBlock->nextFree = currentBlock;
-			}
-			else
-			{
-				currentBlock->nextFree = NULL;
-			}
-		}
+	// blocks in the same class may or may not be large enough, take the first fit
+	for(FragmentBlock* currentBlock = mFragmentBlockHeadFree[freeClass]; currentBlock; currentBlock = currentBlock->nextFree)
+	{
+		if(currentBlock->size >= size)
+			return currentBlock;
 	}
 
-	return true;
-}
+	// any block in larger classes is large enough, take the smallest non-empty class
+	if(freeClass + 1 >= FREE_CLASS_COUNT)
+		return NULL;
 
-size_t FragmentAllocator::total()
-{
-	return mConfiguredChunkSize * mConfiguredNumChunks;
-}
+	std::size_t mask = mFreeClassMask & (~(std::size_t)0 << (freeClass + 1));
+	if(!mask)
+		return NULL;
 
-size_t FragmentAllocator::used()
-{
-	return mAllocatedSize;
+	return mFragmentBlockHeadFree[__builtin_ctzl((unsigned long)mask)];
 }
 
-size_t FragmentAllocator::available()
+void FragmentAllocator::insertFreeBlock(FragmentBlock* block)
 {
-	return total() - used();
-}
+	BOOST_ASSERT(block->free);
 
-bool FragmentAllocator::isValid(MutablePointer*pointer)
-{
-	// find the memory block from allocation map
-	PointerToBlockMap::iterator it = mPointerToBlockMap.find(pointer->pointerReference);
+	std::size_t freeClass = getFreeClass(block->size);
 
-	// if we cannot find the allocation, return fail
-	if(it == mPointerToBlockMap.end())
-		return false;
+	block->prevFree = NULL;
+	block->nextFree = mFragmentBlockHeadFree[freeClass];
+	if(block->nextFree)
+		block->nextFree->prevFree = block;
 
-	return true;
+	mFragmentBlockHeadFree[freeClass] = block;
+	mFreeClassMask |= (std::size_t)1 << freeClass;
 }
 
-size_t FragmentAllocator::infoSize(MutablePointer*pointer)
+void FragmentAllocator::removeFreeBlock(FragmentBlock* block)
 {
-	// find the memory block from allocation map
-	PointerToBlockMap::iterator it = mPointerToBlockMap.find(pointer->pointerReference);
+	BOOST_ASSERT(block->free);
 
-	// if we cannot find the allocation, return fail
-	if(it == mPointerToBlockMap.end())
-		return false;
+	std::size_t freeClass = getFreeClass(block->size);
 
-	// we have the corresponding memory block now
-	FragmentBlock* currentBlock = it->second;
+	if(block->prevFree)
+		block->prevFree->nextFree = block->nextFree;
+	else
+	{
+		BOOST_ASSERT(mFragmentBlockHeadFree[freeClass] == block);
+		mFragmentBlockHeadFree[freeClass] = block->nextFree;
+	}
 
-	return currentBlock->size;
+	if(block->nextFree)
+		block->nextFree->prevFree = block->prevFree;
+
+	block->prevFree = block->nextFree = NULL;
+
+	if(!mFragmentBlockHeadFree[freeClass])
+		mFreeClassMask &= ~((std::size_t)1 << freeClass);
 }
 
 void FragmentAllocator::debug()
@@ -467,12 +423,7 @@ void FragmentAllocator::debug()
 		{
 			printf("\thead block has prevBlock entry\n");
 		}
-		if(currentBlock->prevFree)
-		{
-			printf("\thead block has prevFree entry\n");
-		}
 
-		bool isNoMoreFreeBlock = false;
 		size_t sumSize = 0;
 		size_t sumUsed = 0;
 		while(currentBlock)
@@ -496,25 +447,13 @@ void FragmentAllocator::debug()
 
 			if(currentBlock->free)
 			{
-				if(isNoMoreFreeBlock)
+				if(currentBlock->nextBlock && currentBlock->nextBlock->free)
 				{
-					printf("\tno more free block is defined, but another free block found\n");
-				}
-
-				if(currentBlock->nextFree)
-				{
-					if(currentBlock->nextFree == currentBlock->nextBlock)
-					{
-						printf("\tconsecutive free block error\n");
-					}
-					if(currentBlock->nextFree->prevFree != currentBlock)
-					{
-						printf("\tprev free link error\n");
-					}
+					printf("\tconsecutive free block error\n");
 				}
-				else
+				if(currentBlock->pointerReference)
 				{
-					isNoMoreFreeBlock = true;
+					printf("\tfree block has pointer reference\n");
 				}
 			}
 			else
@@ -527,6 +466,10 @@ void FragmentAllocator::debug()
 				{
 					printf("\tnonfree block has nextFree link\n");
 				}
+				if(!currentBlock->pointerReference || currentBlock->pointerReference->block != currentBlock)
+				{
+					printf("\tnonfree block has incorrect pointer reference\n");
+				}
 			}
 
 			currentBlock = currentBlock->nextBlock;
@@ -545,18 +488,25 @@ void FragmentAllocator::debug()
 		printf("mFragmentBlockHead == NULL\n");
 	}
 
-	if(mFragmentBlockHeadFree)
+	size_t sumSize = 0;
+	for(std::size_t i = 0; i < FREE_CLASS_COUNT; ++i)
 	{
-		FragmentBlock* currentBlock = mFragmentBlockHeadFree;
+		FragmentBlock* currentBlock = mFragmentBlockHeadFree[i];
+		if(((mFreeClassMask >> i) & 1) != (currentBlock ? 1 : 0))
+		{
+			printf("\tfree class mask error on class %ld\n", i);
+		}
+		if(!currentBlock)
+			continue;
+
 		if(currentBlock->prevFree)
 		{
 			printf("\thead free block has prevFree entry\n");
 		}
 
-		size_t sumSize = 0;
 		while(currentBlock)
 		{
-			printf("<--> (%p, %s, offset=%ld, size=%ld (%ld KB) (%ld MB))\n", currentBlock, (currentBlock->free) ? "   free" : "nonfree", currentBlock->offset, currentBlock->size, currentBlock->size/1024, currentBlock->size/(1024*1024));
+			printf("<--> (%p, %s, class=%ld, offset=%ld, size=%ld (%ld KB) (%ld MB))\n", currentBlock, (currentBlock->free) ? "   free" : "nonfree", i, currentBlock->offset, currentBlock->size, currentBlock->size/1024, currentBlock->size/(1024*1024));
 
 			sumSize += currentBlock->size;
 
@@ -566,12 +516,12 @@ void FragmentAllocator::debug()
 			}
 			else
 			{
+				if(getFreeClass(currentBlock->size) != i)
+				{
+					printf("\tfree block in wrong size class\n");
+				}
 				if(currentBlock->nextFree)
 				{
-					if(currentBlock->nextFree->prevFree != currentBlock)
-					{
-						printf("\tincorrect free link\n");
-					}
 					if(currentBlock->nextFree->prevFree != currentBlock)
 					{
 						printf("\tprev free link error\n");
@@ -581,98 +531,219 @@ void FragmentAllocator::debug()
 
 			currentBlock = currentBlock->nextFree;
 		}
-		printf("free size: %ld bytes (%ld KB) (%ld MB)\n", sumSize, sumSize/1024, sumSize/(1024*1024));
-	}
-	else
-	{
-		printf("mFragmentBlockHeadFree = NULL\n");
 	}
+	printf("free size: %ld bytes (%ld KB) (%ld MB)\n", sumSize, sumSize/1024, sumSize/(1024*1024));
 }
 
-FragmentFreeOperator::FragmentFreeOperator(boost::function< void(void*,void*,std::size_t) > copyFunctor) :
-	mCopyFunctor(copyFunctor)
+FragmentFreeOperator::FragmentFreeOperator(boost::function< void(void*,void*,std::size_t) > copyFunctor, boost::function< void(byte*,byte*,std::size_t) > relocationCallback) :
+	mCopyFunctor(copyFunctor), mRelocationCallback(relocationCallback)
 { }
 
 bool FragmentFreeOperator::operator() (FragmentAllocator& allocator)
+{
+	// every allocated block is moved at most once, so this is as cheap as a single full pass
+	return compact(allocator, std::numeric_limits<std::size_t>::max());
+}
+
+bool FragmentFreeOperator::compact(FragmentAllocator& allocator, std::size_t budget)
 {
 #if ZILLIANS_FRAGMENTFREEALLOCATOR_ENABLE_CONCURRENT_ALLOCATION
 	tbb::mutex::scoped_lock lock(allocator.mAllocationLock);
 #endif
 
-	FragmentBlock* currentBlock = allocator.mFragmentBlockHead;
-	if(!currentBlock)
+	allocator.releaseDeferredBlocks();
+
+	// find the lowest free block, everything before it is already compacted
+	FragmentBlock* freeBlock = allocator.mFragmentBlockHead;
+	while(freeBlock && !freeBlock->free)
+		freeBlock = freeBlock->nextBlock;
+
+	if(!freeBlock || !freeBlock->nextBlock)
 		return true;
 
-	size_t sumOffset = 0;
-	size_t sumFreeSpace = 0;
-	FragmentBlock* lastAllocatedBlock = NULL;
-	while(true)
+	// the free block grows while sliding, so put it back to the right size class at the end
+	allocator.removeFreeBlock(freeBlock);
+
+	std::size_t moved = 0;
+	while(freeBlock->nextBlock && moved < budget)
 	{
-		FragmentBlock* nextBlock = NULL;
+		// since adjacent free blocks are always merged, the next block must be allocated
+		FragmentBlock* usedBlock = freeBlock->nextBlock;
+		BOOST_ASSERT(!usedBlock->free);
+
+		// migrate memory block
+		// note that the copy functor must support overlapped copy (i.e. the source and destination memory region are overlapped)
+		byte* srcPtr = usedBlock->pointerReference->data;
+		byte* dstPtr = allocator.mDeviceBasePointer + freeBlock->offset;
+		mCopyFunctor(dstPtr, srcPtr, usedBlock->size);
+		moved += usedBlock->size;
+
+		usedBlock->pointerReference->data = dstPtr;
+		usedBlock->offset = freeBlock->offset;
+		freeBlock->offset = usedBlock->offset + usedBlock->size;
+
+		// swap the two blocks in the block link, (prev, free, used, next) becomes (prev, used, free, next)
+		FragmentBlock* prevBlock = freeBlock->prevBlock;
+		FragmentBlock* nextBlock = usedBlock->nextBlock;
+
+		usedBlock->prevBlock = prevBlock;
+		if(prevBlock)
+			prevBlock->nextBlock = usedBlock;
 
-		if(currentBlock->free)
-		{
-			sumFreeSpace += currentBlock->size;
+		usedBlock->nextBlock = freeBlock;
+		freeBlock->prevBlock = usedBlock;
 
-			if(currentBlock->prevBlock)
-				currentBlock->prevBlock->nextBlock = currentBlock->nextBlock;
-			if(currentBlock->nextBlock)
-				currentBlock->nextBlock->prevBlock = currentBlock->prevBlock;
-
-			nextBlock = currentBlock->nextBlock;
+		freeBlock->nextBlock = nextBlock;
+		if(nextBlock)
+			nextBlock->prevBlock = freeBlock;
 
-			if(currentBlock == allocator.mFragmentBlockHead)
-				allocator.mFragmentBlockHead = nextBlock;
+		if(freeBlock == allocator.mFragmentBlockHead)
+			allocator.mFragmentBlockHead = usedBlock;
 
-			SAFE_DELETE(currentBlock);
-		}
-		else
+		// merge with the free block on the right
+		if(nextBlock && nextBlock->free)
 		{
-			lastAllocatedBlock = currentBlock;
+			allocator.removeFreeBlock(nextBlock);
 
-			sumOffset += currentBlock->size;
+			freeBlock->size += nextBlock->size;
 
-			if(sumFreeSpace > 0)
-			{
-				// migrate memory block
-				byte* dstPtr = currentBlock->pointerReference->data - sumFreeSpace;
-				byte* srcPtr = currentBlock->pointerReference->data;
-
-				// copy through given copy functor
-				// note that the copy functor must support overlapped copy (i.e. the source and destination memory region are overlapped)
-				mCopyFunctor(dstPtr, srcPtr, currentBlock->size);
-				currentBlock->offset -= sumFreeSpace;
-			}
+			freeBlock->nextBlock = nextBlock->nextBlock;
+			if(nextBlock->nextBlock)
+				nextBlock->nextBlock->prevBlock = freeBlock;
 
-			nextBlock = currentBlock->nextBlock;
+			SAFE_DELETE(nextBlock);
 		}
 
-		if(!nextBlock)
-			break;
-
-		currentBlock = nextBlock;
+		if(mRelocationCallback)
+			mRelocationCallback(srcPtr, dstPtr, usedBlock->size);
 	}
 
-	// append a single free memory block if there's free space
-	if(sumFreeSpace > 0)
+	allocator.insertFreeBlock(freeBlock);
+
+	return !freeBlock->nextBlock;
+}
+
+bool FragmentFreeOperator::operator() (ConcurrentFragmentAllocator& allocator)
+{
+	return compact(allocator, std::numeric_limits<std::size_t>::max());
+}
+
+bool FragmentFreeOperator::compact(ConcurrentFragmentAllocator& allocator, std::size_t budget)
+{
+	std::size_t regionBudget = std::max<std::size_t>(budget / allocator.getRegionCount(), 1);
+
+	bool compacted = true;
+	for(std::size_t i = 0; i < allocator.getRegionCount(); ++i)
 	{
-		FragmentBlock* freeBlock = new FragmentBlock;
-		freeBlock->free = true;
-		freeBlock->offset = sumOffset;
-		freeBlock->size = sumFreeSpace;
+		if(!compact(allocator.getRegion(i), regionBudget))
+			compacted = false;
+	}
+	return compacted;
+}
 
-		freeBlock->prevFree = freeBlock->nextFree = NULL;
-		freeBlock->prevBlock = lastAllocatedBlock;
-		lastAllocatedBlock->nextBlock = freeBlock;
-		freeBlock->nextBlock = NULL;
+//////////////////////////////////////////////////////////////////////////
+ConcurrentFragmentAllocator::ConcurrentFragmentAllocator(byte* pool, std::size_t size, std::size_t regionCount) :
+	mPool(pool),
+	mRegionSize(0),
+	mNextHomeRegion(0)
+{
+	BOOST_ASSERT(pool != NULL);
+
+	if(regionCount == 0)
+		regionCount = std::max(boost::thread::hardware_concurrency(), 1u);
+
+	// keep regions on the chunk boundary of FragmentAllocator
+	mRegionSize = (size / regionCount) & ~(std::size_t)(1024 - 1);
+	BOOST_ASSERT(mRegionSize > 0);
+
+	for(std::size_t i = 0; i < regionCount; ++i)
+		mRegions.push_back(new FragmentAllocator(pool + i * mRegionSize, mRegionSize));
+}
+
+ConcurrentFragmentAllocator::~ConcurrentFragmentAllocator()
+{
+	for(std::size_t i = 0; i < mRegions.size(); ++i)
+		SAFE_DELETE(mRegions[i]);
+	mRegions.clear();
+}
 
-		allocator.mFragmentBlockHeadFree = freeBlock;
+bool ConcurrentFragmentAllocator::allocate(MutablePointer **pointer, std::size_t size)
+{
+	std::size_t home = getHomeRegion();
+	for(std::size_t i = 0; i < mRegions.size(); ++i)
+	{
+		if(mRegions[(home + i) % mRegions.size()]->allocate(pointer, size))
+			return true;
 	}
-	else
+	return false;
+}
+
+bool ConcurrentFragmentAllocator::deallocate(MutablePointer *pointer)
+{
+	if(!pointer || !pointer->pointerReference)
+		return false;
+
+	return getOwnerRegion(pointer)->deallocateDeferred(pointer);
+}
+
+size_t ConcurrentFragmentAllocator::total()
+{
+	return mRegions.size() * mRegions[0]->total();
+}
+
+size_t ConcurrentFragmentAllocator::used()
+{
+	std::size_t sum = 0;
+	for(std::size_t i = 0; i < mRegions.size(); ++i)
+		sum += mRegions[i]->used();
+	return sum;
+}
+
+bool ConcurrentFragmentAllocator::isValid(MutablePointer *pointer)
+{
+	if(!pointer->pointerReference)
+		return false;
+
+	return getOwnerRegion(pointer)->isValid(pointer);
+}
+
+size_t ConcurrentFragmentAllocator::infoSize(MutablePointer *pointer)
+{
+	if(!pointer->pointerReference)
+		return 0;
+
+	return getOwnerRegion(pointer)->infoSize(pointer);
+}
+
+void ConcurrentFragmentAllocator::drainDeferred()
+{
+	for(std::size_t i = 0; i < mRegions.size(); ++i)
+		mRegions[i]->drainDeferred();
+}
+
+void ConcurrentFragmentAllocator::setTracer(AllocationTracer* tracer)
+{
+	for(std::size_t i = 0; i < mRegions.size(); ++i)
+		mRegions[i]->setTracer(tracer);
+}
+
+std::size_t ConcurrentFragmentAllocator::getHomeRegion()
+{
+	std::size_t* home = mHomeRegion.get();
+	if(UNLIKELY(!home))
 	{
-		allocator.mFragmentBlockHeadFree = NULL;
+		home = new std::size_t(mNextHomeRegion.fetch_add(1, std::memory_order_relaxed) % mRegions.size());
+		mHomeRegion.reset(home);
 	}
+	return *home;
+}
 
-	return true;
+FragmentAllocator* ConcurrentFragmentAllocator::getOwnerRegion(MutablePointer* pointer)
+{
+	// relocation keeps blocks inside their region, so the current address tells the owner
+	std::size_t index = (pointer->pointerReference->data - mPool) / mRegionSize;
+	BOOST_ASSERT(index < mRegions.size());
+	return mRegions[index];
 }
+
 }
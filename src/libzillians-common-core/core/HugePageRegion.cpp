@@ -0,0 +1,135 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/HugePageRegion.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace zillians {
+
+namespace {
+
+const std::size_t HUGE_PAGE_SIZE_2MB = 2UL * 1024 * 1024;
+const std::size_t HUGE_PAGE_SIZE_1GB = 1024UL * 1024 * 1024;
+
+inline std::size_t roundUp(std::size_t size, std::size_t granularity)
+{
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+}
+
+HugePageRegion::HugePageRegion(std::size_t size, Backing preferred) : mData(NULL), mSize(0), mPageSize(0), mBacking(NORMAL_PAGES)
+{
+	BOOST_ASSERT(size > 0);
+
+	if(preferred >= HUGE_PAGES_1GB && mapHugeTLB(size, HUGE_PAGE_SIZE_1GB, 30))
+	{
+		mBacking = HUGE_PAGES_1GB;
+		return;
+	}
+	if(preferred >= HUGE_PAGES_2MB && mapHugeTLB(size, HUGE_PAGE_SIZE_2MB, 21))
+	{
+		mBacking = HUGE_PAGES_2MB;
+		return;
+	}
+	if(preferred >= TRANSPARENT_HUGE_PAGES)
+	{
+		mBacking = mapTransparent(size) ? TRANSPARENT_HUGE_PAGES : NORMAL_PAGES;
+		return;
+	}
+	mapNormal(size);
+}
+
+HugePageRegion::~HugePageRegion()
+{
+	if(mData)
+		::munmap(mData, mSize);
+}
+
+bool HugePageRegion::mapHugeTLB(std::size_t size, std::size_t pageSize, int pageShift)
+{
+	size = roundUp(size, pageSize);
+
+	// without MAP_NORESERVE the pages are reserved here, instead of SIGBUS on first touch when the pool runs dry
+	void* data = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+	if(data == MAP_FAILED)
+		return false;
+
+	mData = (byte*)data;
+	mSize = size;
+	mPageSize = pageSize;
+	return true;
+}
+
+bool HugePageRegion::mapTransparent(std::size_t size)
+{
+	size = roundUp(size, HUGE_PAGE_SIZE_2MB);
+
+	// over-map by a huge page and cut the region at a huge page boundary, the kernel only backs aligned ranges
+	byte* data = (byte*)::mmap(NULL, size + HUGE_PAGE_SIZE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if((void*)data == MAP_FAILED)
+		throw std::runtime_error(std::string("failed to map region: ") + ::strerror(errno));
+
+	byte* aligned = (byte*)roundUp((uintptr_t)data, HUGE_PAGE_SIZE_2MB);
+	if(aligned > data)
+		::munmap(data, aligned - data);
+	if(aligned + size < data + size + HUGE_PAGE_SIZE_2MB)
+		::munmap(aligned + size, (data + size + HUGE_PAGE_SIZE_2MB) - (aligned + size));
+
+	mData = aligned;
+	mSize = size;
+	mPageSize = HUGE_PAGE_SIZE_2MB;
+
+#ifdef MADV_HUGEPAGE
+	if(::madvise(mData, mSize, MADV_HUGEPAGE) == 0)
+		return true;
+#endif
+
+	// transparent huge pages are disabled, keep the region with normal pages
+	mPageSize = (std::size_t)::sysconf(_SC_PAGESIZE);
+	return false;
+}
+
+void HugePageRegion::mapNormal(std::size_t size)
+{
+	mPageSize = (std::size_t)::sysconf(_SC_PAGESIZE);
+	size = roundUp(size, mPageSize);
+
+	void* data = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(data == MAP_FAILED)
+		throw std::runtime_error(std::string("failed to map region: ") + ::strerror(errno));
+
+	mData = (byte*)data;
+	mSize = size;
+}
+
+}
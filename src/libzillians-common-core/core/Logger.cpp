@@ -21,11 +21,37 @@
  */
 
 #include "core/Logger.h"
+#ifdef BUILD_WITH_LOG4CXX
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <vector>
+#endif
 
 namespace zillians {
 
+//////////////////////////////////////////////////////////////////////////
+const char* LogLevel::name(type level)
+{
+	static const char* names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+	return (level >= trace && level <= fatal) ? names[level] : "?";
+}
+
+#ifdef BUILD_WITH_LOG4CXX
 namespace {
 log4cxx::LoggerPtr gLogger(log4cxx::Logger::getLogger("Global"));
+
+// all live cached loggers, for refreshAll()
+boost::mutex& cachedLoggersMutex()
+{
+	static boost::mutex mutex;
+	return mutex;
+}
+
+std::vector<CachedLogger*>& cachedLoggers()
+{
+	static std::vector<CachedLogger*> loggers;
+	return loggers;
+}
 }
 
 log4cxx::LoggerPtr GlobalLogger()
@@ -33,4 +59,62 @@ log4cxx::LoggerPtr GlobalLogger()
 	return gLogger;
 }
 
+//////////////////////////////////////////////////////////////////////////
+CachedLogger::CachedLogger(const log4cxx::LoggerPtr& logger) : mLogger(logger)
+{
+	refresh();
+	boost::mutex::scoped_lock lock(cachedLoggersMutex());
+	cachedLoggers().push_back(this);
+}
+
+CachedLogger::CachedLogger(const std::string& name) : mLogger(log4cxx::Logger::getLogger(name))
+{
+	refresh();
+	boost::mutex::scoped_lock lock(cachedLoggersMutex());
+	cachedLoggers().push_back(this);
+}
+
+CachedLogger::~CachedLogger()
+{
+	boost::mutex::scoped_lock lock(cachedLoggersMutex());
+	std::vector<CachedLogger*>& loggers = cachedLoggers();
+	loggers.erase(std::remove(loggers.begin(), loggers.end(), this), loggers.end());
+}
+
+void CachedLogger::refresh()
+{
+	// let log4cxx decide, so the repository threshold is taken into account as well
+	int threshold = LogLevel::fatal + 1;
+	for(int level = LogLevel::trace; level <= LogLevel::fatal; ++level)
+	{
+		if(mLogger->isEnabledFor(toLog4cxx((LogLevel::type)level)))
+		{
+			threshold = level;
+			break;
+		}
+	}
+	mThreshold.store(threshold, std::memory_order_relaxed);
+}
+
+void CachedLogger::refreshAll()
+{
+	boost::mutex::scoped_lock lock(cachedLoggersMutex());
+	std::vector<CachedLogger*>& loggers = cachedLoggers();
+	for(std::vector<CachedLogger*>::iterator it = loggers.begin(); it != loggers.end(); ++it)
+		(*it)->refresh();
+}
+
+const log4cxx::LevelPtr& CachedLogger::toLog4cxx(LogLevel::type level)
+{
+	static const log4cxx::LevelPtr levels[] = {
+			log4cxx::Level::getTrace(),
+			log4cxx::Level::getDebug(),
+			log4cxx::Level::getInfo(),
+			log4cxx::Level::getWarn(),
+			log4cxx::Level::getError(),
+			log4cxx::Level::getFatal() };
+	return levels[std::min<int>(std::max<int>(level, LogLevel::trace), LogLevel::fatal)];
+}
+#endif
+
 }
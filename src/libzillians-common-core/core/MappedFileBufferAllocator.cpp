@@ -0,0 +1,130 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/MappedFileBufferAllocator.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace zillians {
+
+MappedFileBufferAllocator::MappedFileBufferAllocator(const std::string& path, bool writable) :
+	mPath(path), mWritable(writable), mFileDescriptor(-1), mMappedData(NULL), mMappedSize(0)
+{
+	mFileDescriptor = writable ? ::open(path.c_str(), O_RDWR | O_CREAT, 0644) : ::open(path.c_str(), O_RDONLY);
+	if(mFileDescriptor < 0)
+		throw std::runtime_error("failed to open \"" + path + "\": " + ::strerror(errno));
+}
+
+MappedFileBufferAllocator::~MappedFileBufferAllocator()
+{
+	if(mMappedData)
+		deallocate(mMappedData);
+
+	if(mFileDescriptor >= 0)
+		::close(mFileDescriptor);
+}
+
+byte* MappedFileBufferAllocator::map()
+{
+	std::size_t size = fileSize();
+	if(size == 0)
+		return NULL;
+
+	return allocate(size);
+}
+
+std::size_t MappedFileBufferAllocator::fileSize() const
+{
+	struct stat s;
+	if(::fstat(mFileDescriptor, &s) != 0)
+		return 0;
+
+	return (std::size_t)s.st_size;
+}
+
+void MappedFileBufferAllocator::truncate(std::size_t size)
+{
+	BOOST_ASSERT(mWritable);
+
+	if(::ftruncate(mFileDescriptor, (off_t)size) != 0)
+		throw std::runtime_error("failed to truncate \"" + mPath + "\": " + ::strerror(errno));
+}
+
+byte* MappedFileBufferAllocator::allocate(std::size_t size)
+{
+	BOOST_ASSERT(mMappedData == NULL);	// only one mapping at a time
+
+	// extend the file so the whole mapping is backed by the file
+	if(mWritable && fileSize() < size)
+		truncate(size);
+
+	void* data = ::mmap(NULL, size, mWritable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, mFileDescriptor, 0);
+	if(data == MAP_FAILED)
+		throw std::runtime_error("failed to map \"" + mPath + "\": " + ::strerror(errno));
+
+	mMappedData = (byte*)data;
+	mMappedSize = size;
+
+	return mMappedData;
+}
+
+void MappedFileBufferAllocator::deallocate(byte* data)
+{
+	BOOST_ASSERT(data == mMappedData);
+
+	if(data)
+	{
+		::munmap((void*)data, mMappedSize);
+		mMappedData = NULL;
+		mMappedSize = 0;
+	}
+}
+
+byte* MappedFileBufferAllocator::reallocate(byte* data, std::size_t old_size, std::size_t new_size)
+{
+	UNUSED_ARGUMENT(old_size);
+
+	if(!data)
+		return allocate(new_size);
+
+	BOOST_ASSERT(data == mMappedData);
+	BOOST_ASSERT(mWritable);
+
+	if(fileSize() < new_size)
+		truncate(new_size);
+
+	// the mapping may be moved, and the content is preserved by the file itself
+	void* remapped = ::mremap((void*)mMappedData, mMappedSize, new_size, MREMAP_MAYMOVE);
+	if(remapped == MAP_FAILED)
+		throw std::runtime_error("failed to remap \"" + mPath + "\": " + ::strerror(errno));
+
+	mMappedData = (byte*)remapped;
+	mMappedSize = new_size;
+
+	return mMappedData;
+}
+
+}
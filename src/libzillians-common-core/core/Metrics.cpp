@@ -0,0 +1,224 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Metrics.h"
+#include <algorithm>
+#include <stdio.h>
+
+namespace zillians {
+
+namespace {
+
+// shards are owned by the counter, so they survive the threads that recorded into them
+template<typename T>
+void keepShard(T*)
+{ }
+
+template<typename T>
+void removeFrom(std::vector<T*>& metrics, T* metric)
+{
+	typename std::vector<T*>::iterator it = std::find(metrics.begin(), metrics.end(), metric);
+	if(it != metrics.end())
+		metrics.erase(it);
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+MetricCounter::MetricCounter(const std::string& name) : mName(name), mLocal(&keepShard<Shard>)
+{
+	MetricRegistry::instance().add(this);
+}
+
+MetricCounter::~MetricCounter()
+{
+	MetricRegistry::instance().remove(this);
+}
+
+uint64 MetricCounter::value() const
+{
+	uint64 total = 0;
+	boost::mutex::scoped_lock lock(mShardsLock);
+	for(std::size_t i = 0; i < mShards.size(); ++i)
+		total += mShards[i]->value;
+	return total;
+}
+
+void MetricCounter::reset()
+{
+	boost::mutex::scoped_lock lock(mShardsLock);
+	for(std::size_t i = 0; i < mShards.size(); ++i)
+		mShards[i]->value = 0;
+}
+
+MetricCounter::Shard* MetricCounter::registerThread()
+{
+	boost::shared_ptr<Shard> shard(new Shard());
+	shard->value = 0;
+	{
+		boost::mutex::scoped_lock lock(mShardsLock);
+		mShards.push_back(shard);
+	}
+	mLocal.reset(shard.get());
+	return shard.get();
+}
+
+//////////////////////////////////////////////////////////////////////////
+MetricHistogram::MetricHistogram(const std::string& name) : TimerStatistics(name)
+{
+	MetricRegistry::instance().add(this);
+}
+
+MetricHistogram::~MetricHistogram()
+{
+	MetricRegistry::instance().remove(this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+MetricRegistry& MetricRegistry::instance()
+{
+	// constructed on first use, so it outlives every metric registering into it
+	static MetricRegistry registry;
+	return registry;
+}
+
+void MetricRegistry::add(MetricCounter* counter)
+{
+	boost::mutex::scoped_lock lock(mLock);
+	mCounters.push_back(counter);
+}
+
+void MetricRegistry::remove(MetricCounter* counter)
+{
+	boost::mutex::scoped_lock lock(mLock);
+	removeFrom(mCounters, counter);
+}
+
+void MetricRegistry::add(MetricHistogram* histogram)
+{
+	boost::mutex::scoped_lock lock(mLock);
+	mHistograms.push_back(histogram);
+}
+
+void MetricRegistry::remove(MetricHistogram* histogram)
+{
+	boost::mutex::scoped_lock lock(mLock);
+	removeFrom(mHistograms, histogram);
+}
+
+void MetricRegistry::scrape(std::vector<MetricSample>& samples) const
+{
+	boost::mutex::scoped_lock lock(mLock);
+	samples.reserve(samples.size() + mCounters.size() + mHistograms.size());
+	for(std::size_t i = 0; i < mCounters.size(); ++i)
+	{
+		samples.push_back(MetricSample());
+		MetricSample& sample = samples.back();
+		sample.name = mCounters[i]->name();
+		sample.type = MetricSample::COUNTER;
+		sample.value = mCounters[i]->value();
+	}
+	for(std::size_t i = 0; i < mHistograms.size(); ++i)
+	{
+		samples.push_back(MetricSample());
+		MetricSample& sample = samples.back();
+		sample.name = mHistograms[i]->name();
+		sample.type = MetricSample::HISTOGRAM;
+		sample.histogram = mHistograms[i]->collect();
+		sample.value = sample.histogram.count();
+	}
+}
+
+void MetricRegistry::reset()
+{
+	boost::mutex::scoped_lock lock(mLock);
+	for(std::size_t i = 0; i < mCounters.size(); ++i)
+		mCounters[i]->reset();
+	for(std::size_t i = 0; i < mHistograms.size(); ++i)
+		mHistograms[i]->reset();
+}
+
+void MetricRegistry::print() const
+{
+	std::vector<MetricSample> samples;
+	scrape(samples);
+	for(std::size_t i = 0; i < samples.size(); ++i)
+	{
+		const MetricSample& sample = samples[i];
+		if(sample.type == MetricSample::COUNTER)
+		{
+			printf("%s: %llu\n", sample.name.c_str(), (unsigned long long)sample.value);
+		}
+		else
+		{
+			const TimerHistogram& h = sample.histogram;
+			printf("%s: count = %llu, mean = %.1lf, min = %llu, p50 = %llu, p99 = %llu, p99.9 = %llu, max = %llu\n",
+					sample.name.c_str(), (unsigned long long)h.count(), h.mean(), (unsigned long long)h.min(),
+					(unsigned long long)h.percentile(50.0), (unsigned long long)h.percentile(99.0),
+					(unsigned long long)h.percentile(99.9), (unsigned long long)h.max());
+		}
+	}
+}
+
+#ifdef ZILLIANS_ENABLE_METRICS
+//////////////////////////////////////////////////////////////////////////
+MetricHistogram& BuiltinMetrics::worker_queue_delay()
+{
+	static MetricHistogram metric("worker.queue_delay_ns");
+	return metric;
+}
+
+MetricHistogram& BuiltinMetrics::worker_run_time()
+{
+	static MetricHistogram metric("worker.run_time_ns");
+	return metric;
+}
+
+MetricCounter& BuiltinMetrics::dispatcher_writes()
+{
+	static MetricCounter metric("dispatcher.writes");
+	return metric;
+}
+
+MetricHistogram& BuiltinMetrics::dispatcher_pipe_depth()
+{
+	static MetricHistogram metric("dispatcher.pipe_depth");
+	return metric;
+}
+
+MetricCounter& BuiltinMetrics::dispatcher_overflows()
+{
+	static MetricCounter metric("dispatcher.overflows");
+	return metric;
+}
+
+MetricHistogram& BuiltinMetrics::allocator_size()
+{
+	static MetricHistogram metric("allocator.allocate_size");
+	return metric;
+}
+
+MetricCounter& BuiltinMetrics::allocator_failures()
+{
+	static MetricCounter metric("allocator.allocate_failures");
+	return metric;
+}
+#endif
+
+}
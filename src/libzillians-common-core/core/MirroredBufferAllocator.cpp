@@ -0,0 +1,137 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/MirroredBufferAllocator.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace zillians {
+
+namespace {
+
+// create an anonymous file to back the pages, shared memory is preferred to stay off the disk
+int createBackingFile(std::size_t size)
+{
+	const char* templates[] = { "/dev/shm/zillians-mirrored-XXXXXX", "/tmp/zillians-mirrored-XXXXXX" };
+	for(std::size_t i = 0; i < sizeof(templates) / sizeof(templates[0]); ++i)
+	{
+		char path[64];
+		::strcpy(path, templates[i]);
+
+		int fd = ::mkstemp(path);
+		if(fd < 0)
+			continue;
+
+		::unlink(path);
+		if(::ftruncate(fd, (off_t)size) == 0)
+			return fd;
+
+		::close(fd);
+	}
+	return -1;
+}
+
+}
+
+MirroredBufferAllocator::MirroredBufferAllocator()
+{
+	mPageSize = (std::size_t)::sysconf(_SC_PAGESIZE);
+}
+
+MirroredBufferAllocator::~MirroredBufferAllocator()
+{
+	BOOST_ASSERT(mMappings.empty());
+}
+
+byte* MirroredBufferAllocator::allocate(std::size_t size)
+{
+	BOOST_ASSERT(size > 0 && size % mPageSize == 0);
+
+	int fd = createBackingFile(size);
+	if(fd < 0)
+		throw std::runtime_error(std::string("failed to create mirrored buffer backing file: ") + ::strerror(errno));
+
+	// reserve the address space for both mappings first, then map the file over it twice
+	byte* data = (byte*)::mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if((void*)data == MAP_FAILED)
+	{
+		::close(fd);
+		throw std::runtime_error(std::string("failed to reserve mirrored buffer: ") + ::strerror(errno));
+	}
+
+	if(::mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	   ::mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		int error = errno;
+		::munmap(data, size * 2);
+		::close(fd);
+		throw std::runtime_error(std::string("failed to map mirrored buffer: ") + ::strerror(error));
+	}
+
+	// the mappings keep the pages alive
+	::close(fd);
+
+	boost::mutex::scoped_lock lock(mMappingsLock);
+	mMappings[data] = size;
+
+	return data;
+}
+
+void MirroredBufferAllocator::deallocate(byte* data)
+{
+	if(!data) return;
+
+	std::size_t size;
+	{
+		boost::mutex::scoped_lock lock(mMappingsLock);
+		std::map<byte*, std::size_t>::iterator it = mMappings.find(data);
+		BOOST_ASSERT(it != mMappings.end());
+		if(it == mMappings.end())
+			return;
+
+		size = it->second;
+		mMappings.erase(it);
+	}
+
+	::munmap(data, size * 2);
+}
+
+byte* MirroredBufferAllocator::reallocate(byte* data, std::size_t old_size, std::size_t new_size)
+{
+	UNUSED_ARGUMENT(data);
+	UNUSED_ARGUMENT(old_size);
+	UNUSED_ARGUMENT(new_size);
+
+	// the circular buffer would have to be re-laid out anyway, so growing is not supported
+	BOOST_ASSERT(false && "mirrored buffer can't be resized");
+	return NULL;
+}
+
+MirroredBufferAllocator* MirroredBufferAllocator::instance()
+{
+	static MirroredBufferAllocator allocator;
+	return &allocator;
+}
+
+}
@@ -0,0 +1,149 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/MonotonicArena.h"
+
+namespace zillians {
+
+MonotonicArena::MonotonicArena(BufferAllocator* upstream, std::size_t chunkSize) :
+	mUpstream(upstream ? upstream : DefaultBufferAllocator::instance()),
+	mChunkSize(chunkSize),
+	mCurrent(NULL), mEnd(NULL),
+	mChunks(NULL), mReservedSize(0), mChunkCount(0)
+{
+	BOOST_ASSERT(chunkSize > sizeof(Chunk));
+}
+
+MonotonicArena::~MonotonicArena()
+{
+	release();
+}
+
+void MonotonicArena::reset()
+{
+	// keep the oldest regular chunk, dedicated chunks may be linked behind it
+	Chunk* kept = NULL;
+	for(Chunk* chunk = mChunks; chunk; chunk = chunk->next)
+	{
+		if(chunk->size == mChunkSize)
+			kept = chunk;
+	}
+
+	if(!kept)
+	{
+		release();
+		return;
+	}
+
+	Chunk* chunk = mChunks;
+	while(chunk)
+	{
+		Chunk* next = chunk->next;
+		if(chunk != kept)
+			mUpstream->deallocate(reinterpret_cast<byte*>(chunk));
+		chunk = next;
+	}
+
+	mChunks = kept;
+	kept->next = NULL;
+	mReservedSize = kept->size;
+	mChunkCount = 1;
+
+	mCurrent = chunkBegin(kept);
+	mEnd = chunkEnd(kept);
+}
+
+void MonotonicArena::release()
+{
+	deallocateChunks(mChunks);
+
+	mChunks = NULL;
+	mReservedSize = 0;
+	mChunkCount = 0;
+
+	mCurrent = mEnd = NULL;
+}
+
+void* MonotonicArena::allocateSlow(std::size_t size, std::size_t alignment)
+{
+	std::size_t required = sizeof(Chunk) + (alignment - 1) + size;
+	if(required < size)
+		return NULL;// overflow
+
+	// large requests get their own chunk, which is linked behind the current one so its free space is kept
+	if(size > mChunkSize / 4)
+	{
+		Chunk* chunk = allocateChunk(required);
+		if(!chunk)
+			return NULL;
+
+		if(mCurrent)
+		{
+			chunk->next = mChunks->next;
+			mChunks->next = chunk;
+		}
+		else
+		{
+			chunk->next = mChunks;
+			mChunks = chunk;
+			mCurrent = mEnd = chunkEnd(chunk);
+		}
+
+		return reinterpret_cast<byte*>((reinterpret_cast<uintptr_t>(chunkBegin(chunk)) + (alignment - 1)) & ~(uintptr_t)(alignment - 1));
+	}
+
+	Chunk* chunk = allocateChunk(mChunkSize);
+	if(!chunk)
+		return NULL;
+
+	chunk->next = mChunks;
+	mChunks = chunk;
+
+	mCurrent = chunkBegin(chunk);
+	mEnd = chunkEnd(chunk);
+
+	return allocate(size, alignment);
+}
+
+MonotonicArena::Chunk* MonotonicArena::allocateChunk(std::size_t size)
+{
+	Chunk* chunk = reinterpret_cast<Chunk*>(mUpstream->allocate(size));
+	if(!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+
+	mReservedSize += size;
+	++mChunkCount;
+
+	return chunk;
+}
+
+void MonotonicArena::deallocateChunks(Chunk* chunks)
+{
+	while(chunks)
+	{
+		Chunk* next = chunks->next;
+		mUpstream->deallocate(reinterpret_cast<byte*>(chunks));
+		chunks = next;
+	}
+}
+
+}
@@ -0,0 +1,224 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/PinnedBufferAllocator.h"
+
+#include <stdexcept>
+#include <unistd.h>
+
+namespace zillians {
+
+namespace {
+
+void check(cudaError_t error, const char* what)
+{
+	if(error != cudaSuccess)
+		throw std::runtime_error(std::string(what) + ": " + ::cudaGetErrorString(error));
+}
+
+}
+
+PinnedBufferAllocator::PinnedBufferAllocator(unsigned int flags, std::size_t cacheLimit) : mFlags(flags), mCacheLimit(cacheLimit)
+{
+	mPageSize = (std::size_t)::sysconf(_SC_PAGESIZE);
+}
+
+PinnedBufferAllocator::~PinnedBufferAllocator()
+{
+	trim();
+}
+
+byte* PinnedBufferAllocator::allocate(std::size_t size)
+{
+	// every block is a whole number of pages, so freed blocks of similar sizes can be reused
+	size = (size + mPageSize - 1) / mPageSize * mPageSize;
+
+	{
+		boost::mutex::scoped_lock lock(mLock);
+		void* data = take(mHost, size);
+		if(data)
+			return (byte*)data;
+	}
+
+	// the driver call may take long, so it's made without holding the lock
+	void* data;
+	check(::cudaHostAlloc(&data, size, mFlags), "failed to allocate pinned buffer");
+
+	boost::mutex::scoped_lock lock(mLock);
+	mHost.blocks[data] = size;
+	return (byte*)data;
+}
+
+void PinnedBufferAllocator::deallocate(byte* data)
+{
+	if(!data) return;
+
+	{
+		boost::mutex::scoped_lock lock(mLock);
+		if(give(mHost, data))
+			return;
+	}
+
+	::cudaFreeHost(data);
+}
+
+void* PinnedBufferAllocator::allocateDevice(std::size_t size)
+{
+	size = (size + mPageSize - 1) / mPageSize * mPageSize;
+
+	{
+		boost::mutex::scoped_lock lock(mLock);
+		void* data = take(mDevice, size);
+		if(data)
+			return data;
+	}
+
+	void* data;
+	check(::cudaMalloc(&data, size), "failed to allocate device buffer");
+
+	boost::mutex::scoped_lock lock(mLock);
+	mDevice.blocks[data] = size;
+	return data;
+}
+
+void PinnedBufferAllocator::deallocateDevice(void* data)
+{
+	if(!data) return;
+
+	{
+		boost::mutex::scoped_lock lock(mLock);
+		if(give(mDevice, data))
+			return;
+	}
+
+	::cudaFree(data);
+}
+
+void PinnedBufferAllocator::trim()
+{
+	boost::mutex::scoped_lock lock(mLock);
+	release(mHost, false);
+	release(mDevice, true);
+}
+
+PinnedBufferAllocator* PinnedBufferAllocator::instance()
+{
+	static PinnedBufferAllocator allocator;
+	return &allocator;
+}
+
+void* PinnedBufferAllocator::take(BlockCache& cache, std::size_t size)
+{
+	// take the smallest cached block that fits, but don't waste more than half of it
+	std::multimap<std::size_t, void*>::iterator it = cache.freed.lower_bound(size);
+	if(it == cache.freed.end() || it->first > size * 2)
+		return NULL;
+
+	void* data = it->second;
+	cache.cachedSize -= it->first;
+	cache.freed.erase(it);
+	return data;
+}
+
+bool PinnedBufferAllocator::give(BlockCache& cache, void* data)
+{
+	std::map<void*, std::size_t>::iterator it = cache.blocks.find(data);
+	BOOST_ASSERT(it != cache.blocks.end());
+	if(it == cache.blocks.end())
+		return true;
+
+	if(cache.cachedSize + it->second > mCacheLimit)
+	{
+		cache.blocks.erase(it);
+		return false;
+	}
+
+	cache.freed.insert(std::make_pair(it->second, data));
+	cache.cachedSize += it->second;
+	return true;
+}
+
+void PinnedBufferAllocator::release(BlockCache& cache, bool device)
+{
+	for(std::multimap<std::size_t, void*>::iterator it = cache.freed.begin(); it != cache.freed.end(); ++it)
+	{
+		if(device)
+			::cudaFree(it->second);
+		else
+			::cudaFreeHost(it->second);
+		cache.blocks.erase(it->second);
+	}
+	cache.freed.clear();
+	cache.cachedSize = 0;
+}
+
+DeviceMirroredBuffer::DeviceMirroredBuffer(std::size_t capacity, cudaStream_t stream, PinnedBufferAllocator* allocator) :
+	mAllocator(allocator), mHost(capacity, allocator), mCapacity(capacity), mStream(stream), mPendingDownload(0)
+{
+	mDevice = mAllocator->allocateDevice(capacity);
+}
+
+DeviceMirroredBuffer::~DeviceMirroredBuffer()
+{
+	// in-flight transfers still refer to both blocks
+	::cudaStreamSynchronize(mStream);
+	mAllocator->deallocateDevice(mDevice);
+}
+
+std::size_t DeviceMirroredBuffer::upload()
+{
+	std::size_t size = mHost.dataSize();
+	if(size > mCapacity)
+		throw std::length_error("out of device buffer");
+
+	if(size > 0)
+		check(::cudaMemcpyAsync(mDevice, mHost.rptr(), size, cudaMemcpyHostToDevice, mStream), "failed to upload buffer");
+	return size;
+}
+
+void DeviceMirroredBuffer::download(std::size_t size)
+{
+	BOOST_ASSERT(mPendingDownload == 0);
+
+	if(size > mCapacity)
+		throw std::length_error("out of device buffer");
+	if(size > mHost.freeSize())
+	{
+		mHost.crunch();
+		if(size > mHost.freeSize())
+			throw std::length_error("out of free buffer");
+	}
+
+	if(size > 0)
+		check(::cudaMemcpyAsync(mHost.wptr(), mDevice, size, cudaMemcpyDeviceToHost, mStream), "failed to download buffer");
+	mPendingDownload = size;
+}
+
+void DeviceMirroredBuffer::synchronize()
+{
+	check(::cudaStreamSynchronize(mStream), "failed to synchronize stream");
+
+	if(mPendingDownload > 0)
+	{
+		mHost.wskip(mPendingDownload);
+		mPendingDownload = 0;
+	}
+}
+
+}
@@ -23,33 +23,113 @@
  */
 
 #include "core/ScalablePoolAllocator.h"
+#include "core/AllocationTrace.h"
 #include "tbb/tbb_thread.h"
+#include <boost/static_assert.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/mempolicy.h>
+#endif
 
 namespace zillians {
 
+namespace {
+
+/**
+ * Parse a sysfs cpu list, i.e. "0-3,8-11", and mark each cpu with the given node.
+ */
+void parseCpuList(const std::string& list, size_t node, std::vector<size_t>& cpuNodes)
+{
+	std::stringstream ss(list);
+	std::string range;
+	while(std::getline(ss, range, ','))
+	{
+		size_t first = 0, last = 0;
+		char dash = 0;
+		std::stringstream rs(range);
+		if(!(rs >> first)) continue;
+		last = (rs >> dash >> last) ? last : first;
+
+		if(cpuNodes.size() <= last)
+			cpuNodes.resize(last + 1, 0);
+		for(size_t cpu = first; cpu <= last; ++cpu)
+			cpuNodes[cpu] = node;
+	}
+}
+
+/**
+ * Read the cpu to node mapping from sysfs.
+ *
+ * @return The number of nodes found, at least 1.
+ */
+size_t detectNodes(std::vector<size_t>& cpuNodes)
+{
+	size_t count = 0;
+	for(size_t node = 0; ; ++node)
+	{
+		std::stringstream path;
+		path << "/sys/devices/system/node/node" << node << "/cpulist";
+		std::ifstream f(path.str().c_str());
+		if(!f) break;
+
+		std::string list;
+		std::getline(f, list);
+		parseCpuList(list, node, cpuNodes);
+		++count;
+	}
+	return count ? count : 1;
+}
+
+size_t detectNodeCount()
+{
+	std::vector<size_t> cpuNodes;
+	return detectNodes(cpuNodes);
+}
+
+}
+
 #if BUILD_WITH_LOG4CXX
 log4cxx::LoggerPtr ScalablePoolAllocator::mLogger(log4cxx::Logger::getLogger("zillians.common.core.ScalablePoolAllocator"));
 #endif
 
-ScalablePoolAllocator::ScalablePoolAllocator(byte* pMemory, size_t size, size_t* binSizes, size_t binCount)
+ScalablePoolAllocator::ScalablePoolAllocator(byte* pMemory, size_t size, size_t* binSizes, size_t binCount, size_t nodeCount, bool zeroFilled)
 : BLOCK_SIZE(16384)// Default to 16K blocks
 , BIG_BLOCK_BLOCK_COUNT(16)// Allocate 16 new blocks at a time whenever there's not enough blocks to go around
 , BIG_BLOCK_SIZE(BLOCK_SIZE * BIG_BLOCK_BLOCK_COUNT)
 , MIN_LARGE_CHUNK_SIZE(binSizes?binSizes[binCount-1]+1:8193)
 , INVALID(0x1)
 , BIN_COUNT(binCount?binCount:32)// Default to 32 bins between 4 to 8K bytes
-, TLS_SIZE(sizeof(Bin) * (BIN_COUNT + 1))// Bin size times number of bins, 1 for additional space to store "this" pointer
+, TLS_SIZE(sizeof(Bin) * (BIN_COUNT + 1) + sizeof(RemoteFreeCache))// Bin size times number of bins, 1 for additional space to store "this" pointer, followed by the remote free cache
 // TODO: above line needs more explaination.
 , EMPTY_ENOUGH_THRESHOLD((BLOCK_SIZE - sizeof(Block)) * 0.75f)// 75% full is empty enough
 , OWNER_ID_NULL(static_cast<size_t>(-1))
+, NODE_COUNT(nodeCount ? nodeCount : detectNodeCount())
+, LARGE_BIN_BASE(8192)
+, LARGE_BIN_COUNT(96)// Up to 32MB, i.e. 8K * 2^12
 , mThreadID(ThreadIDTLSCleanUpFunction)
+, mNodeID(ThreadIDTLSCleanUpFunction)
 , mBins(BinTLSCleanUpFunction)
+, mTracer(NULL)
 {
 	// check minimum buffer size
-	if(size < BLOCK_SIZE * 17)
-		throw std::length_error("ScalablePoolAllocator needs at least BLOCK_SIZE * 17 bytes");
+	if(size < BLOCK_SIZE * (16 * NODE_COUNT + 1))
+		throw std::length_error("ScalablePoolAllocator needs at least BLOCK_SIZE * (16 * nodeCount + 1) bytes");
 
-	memset(pMemory, 0, size);
+	detectNodes(mCpuNodes);
+
+	const size_t stackBytes = (BIN_COUNT + NODE_COUNT) * sizeof(Stack) + LARGE_BIN_COUNT * sizeof(LargeStack);
+
+	// NOTE: Leave the pool untouched in NUMA mode so pages are placed on first touch by the allocating thread
+	if(NODE_COUNT == 1 && !zeroFilled)
+		memset(pMemory, 0, size);
+	else
+		memset(pMemory, 0, stackBytes);
 
 	// Store mGlobalBins in our heap. (NOTE 20101230 Nothing: This is needed before we cannot delete it prior to deletion of ScalablePoolAllocator
 	mGlobalBins = (Stack*)pMemory;//new Stack[BIN_COUNT];
@@ -59,10 +139,24 @@ ScalablePoolAllocator::ScalablePoolAllocator(byte* pMemory, size_t size, size_t*
 	}
 	pMemory += BIN_COUNT * sizeof(Stack);
 
+	mFreeBlockStacks = (Stack*)pMemory;
+	for(size_t i = 0; i < NODE_COUNT; ++i)
+	{
+		mFreeBlockStacks[i] = Stack();
+	}
+	pMemory += NODE_COUNT * sizeof(Stack);
+
+	mLargeBins = (LargeStack*)pMemory;
+	for(size_t i = 0; i < LARGE_BIN_COUNT; ++i)
+	{
+		new (&mLargeBins[i]) LargeStack();
+	}
+	pMemory += LARGE_BIN_COUNT * sizeof(LargeStack);
+
 	// Set pool end-points
 	// Only use memory aligned part
 	mPool = reinterpret_cast<byte*>( alignUp(reinterpret_cast<uintptr_t>(pMemory), BLOCK_SIZE) );
-	mPoolEnd = pMemory + size - BIN_COUNT * sizeof(Stack);
+	mPoolEnd = pMemory + size - stackBytes;
 
 	// Create TLS variables
 	// 20090302 nothing - They are now created on heap
@@ -72,14 +166,17 @@ ScalablePoolAllocator::ScalablePoolAllocator(byte* pMemory, size_t size, size_t*
 	mTLSChunkList = NULL;
 	mTLSUsedBlocks = NULL;
 	mTLSAllocBlock = NULL;
+	mTLSBinList = NULL;
 	mThreadCount = 0;
+	mLocalBlocks = 0;
+	mRemoteBlocks = 0;
+	mTrimmedBytes = 0;
 
 	// Initialize pool
 	mBlockAllocPtr = mPool;
 
 	// Large Allocation
 	mBumpPtr = mPoolEnd;
-	mLargeFreeList = NULL;
 
 	// Initialize bin settings
 	// 20090302 nothing - Allocate mBinSizes in mPool, and align to 128 byte boundary for cache coherence.
@@ -104,6 +201,16 @@ ScalablePoolAllocator::ScalablePoolAllocator(byte* pMemory, size_t size, size_t*
 		mBinSizes[28] = 5120;	mBinSizes[29] = 6144;	mBinSizes[30] = 7168;	mBinSizes[31] = 8192;
 	}
 
+	// Counters of exited threads are folded into bins allocated in mPool as well
+	mBumpPtr = reinterpret_cast<byte*>(alignDown(reinterpret_cast<uintptr_t>(mBumpPtr - (sizeof(Bin) * BIN_COUNT)), 128));
+	mRetiredBins = reinterpret_cast<Bin*>(mBumpPtr);
+	memset(mRetiredBins, 0, sizeof(Bin) * BIN_COUNT);
+
+	mLargeRegionEnd = mBumpPtr;
+	mLargeChunkBytes = 0;
+	mLargeFreeBytes = 0;
+	mHighWaterMark = 0;
+
 	STAT_RESET();
 
 }//c'tor
@@ -120,13 +227,32 @@ ScalablePoolAllocator::~ScalablePoolAllocator()
 	//delete mThreadID;
 }
 
-byte* ScalablePoolAllocator::allocate(size_t sz)//done
+byte* ScalablePoolAllocator::allocate(size_t sz)
+{
+	byte* mem = allocateChunk(sz);
+	if(UNLIKELY(mTracer != NULL) && mem)
+	{
+		mTracer->recordAllocate(mem, sz);
+	}
+	return mem;
+}
+
+byte* ScalablePoolAllocator::allocateChunk(size_t sz)//done
 {
 	STAT_ADD(mStatistics.TotalAllocations);
+#ifdef ZILLIANS_ENABLE_METRICS
+	BuiltinMetrics::allocator_size().record(sz);
+#endif
 
 	if( sz >= MIN_LARGE_CHUNK_SIZE )
 	{
+#ifdef ZILLIANS_ENABLE_METRICS
+		byte* large = allocateLarge(sz);
+		if(!large) BuiltinMetrics::allocator_failures().increment();
+		return large;
+#else
 		return allocateLarge(sz);
+#endif
 	}
 
 	STAT_ADD(mStatistics.TotalSmallAllocations);
@@ -135,8 +261,13 @@ byte* ScalablePoolAllocator::allocate(size_t sz)//done
 	Bin* bin = getBin(sz);
 	if(bin == NULL)//Out of memory
 	{
+#ifdef ZILLIANS_ENABLE_METRICS
+		BuiltinMetrics::allocator_failures().increment();
+#endif
 		return NULL;
 	}
+	bin->mAllocations++;
+
 	byte* ret = NULL;
 	Block* block = bin->getActiveBlock();
 
@@ -164,7 +295,8 @@ byte* ScalablePoolAllocator::allocate(size_t sz)//done
 			return ret;
 		}
 		STAT_ADD(mStatistics.AllocationRecursion);
-		return allocate(sz);// Code should not reach this line
+		bin->mAllocations--;
+		return allocateChunk(sz);// Code should not reach this line
 	}
 
 	block = getPartialBlock(bin, sz);
@@ -189,10 +321,15 @@ byte* ScalablePoolAllocator::allocate(size_t sz)//done
 			return ret;
 		}
 		STAT_ADD(mStatistics.AllocationRecursion);
-		return allocate(sz);// Code should not reach this line
+		bin->mAllocations--;
+		return allocateChunk(sz);// Code should not reach this line
 	}
 
 	STAT_SUB(mStatistics.ChunksInUse);
+	bin->mAllocations--;
+#ifdef ZILLIANS_ENABLE_METRICS
+	BuiltinMetrics::allocator_failures().increment();
+#endif
 	return NULL;// Out of memory
 }
 
@@ -211,6 +348,11 @@ void ScalablePoolAllocator::deallocate(byte* mem)//done
 	}
 	STAT_ADD(mStatistics.TotalDeallocations);
 
+	if(UNLIKELY(mTracer != NULL))
+	{
+		mTracer->recordDeallocate(mem);
+	}
+
 	if(isLargeChunk(mem))
 	{
 		deallocateLarge(mem);
@@ -223,7 +365,22 @@ void ScalablePoolAllocator::deallocate(byte* mem)//done
 	ThreadID tid = getThreadID();
 	Block* block = reinterpret_cast<Block*>( alignDown(reinterpret_cast<uintptr_t>(mem), BLOCK_SIZE) );
 
-	if(tid == block->mOwnerID)
+	bool isOwner = (tid == block->mOwnerID);
+	Bin* bin = getBin(block->mChunkSize);
+	if(bin)
+	{
+		bin->mDeallocations++;
+		if(!isOwner) bin->mPublicDeallocations++;
+	}
+	else// no TLS for the thread, most likely out of memory
+	{
+		tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
+		Bin* retired = mRetiredBins + getIndex(block->mChunkSize);
+		retired->mDeallocations++;
+		if(!isOwner) retired->mPublicDeallocations++;
+	}
+
+	if(isOwner)
 	{
 		chunk->mNext = block->mFreeList;
 		block->mFreeList = chunk;
@@ -246,208 +403,291 @@ void ScalablePoolAllocator::deallocate(byte* mem)//done
 	}
 	else
 	{
-		freePublicChunk(block, chunk);
+		RemoteFreeCache* cache = getRemoteFreeCache();
+		if(cache)
+		{
+			freeRemoteChunk(cache, block, chunk);
+		}
+		else
+		{
+			freePublicChunk(block, chunk);
+		}
+	}
+}
+
+void ScalablePoolAllocator::deallocateBatch(byte** mems, size_t n)
+{
+	for(size_t i = 0; i < n; ++i)
+	{
+		deallocate(mems[i]);
+	}
+	flushRemoteFrees();
+}
+
+size_t ScalablePoolAllocator::getUsableSize(byte* mem)
+{
+	BOOST_ASSERT(contains(mem));
+
+	if(isLargeChunk(mem))
+	{
+		return largeChunkSize(mem);
+	}
+
+	Block* block = reinterpret_cast<Block*>( alignDown(reinterpret_cast<uintptr_t>(mem), BLOCK_SIZE) );
+	return block->mChunkSize;
+}
+
+void ScalablePoolAllocator::flushRemoteFrees()
+{
+	RemoteFreeCache* cache = getRemoteFreeCache();
+	if(cache)
+	{
+		flushRemoteFreeCache(cache);
 	}
 }
 
 
 byte* ScalablePoolAllocator::allocateLarge(size_t sz)
 {
-	tbb::spin_mutex::scoped_lock lock(mPoolLock);
 	STAT_ADD(mStatistics.TotalLargeAllocations);
-	STAT_ADDV(mStatistics.AllocatedSize, sz);
-	STAT_ADDV(mStatistics.AllocatedSize, sizeof(size_t));
 
+	size_t idx = getLargeBinIndex(sz);
+	size_t capacity = (idx < LARGE_BIN_COUNT) ? getLargeBinSize(idx) : alignUp(sz, LARGE_BIN_BASE / 8);
+
+	// 1. Take a free chunk of the same size class, a lock-free pop on the class
+	byte* mem = popLargeChunk(idx, sz);
 
-	LargeChunk* chunk = mLargeFreeList;
-	size_t* psz = NULL;
+	// 2. Carve from mBumpPtr
+	if(!mem)
+	{
+		mem = carveLargeChunk(capacity);
+	}
 
-	// 1. Search for a FreeChunk that's large enough for allocation
-	while(chunk)
+	// 3. Out of uncarved memory, coalesce free chunks and try any larger class
+	if(!mem)
 	{
-		if(chunk->mSize == sz)// Exact fit
 		{
-			// Detach chunk from list
-			if(chunk->mPrev)
-			{
-				chunk->mPrev->mNext = chunk->mNext;
-			}
-			else
+			pool_mutex_t::scoped_lock lock(mPoolLock);
+			consolidateLargeChunks();
+			for(size_t i = idx; i < LARGE_BIN_COUNT - 1 && !mem; ++i)
 			{
-				mLargeFreeList = chunk->mNext;
+				mem = popLargeChunk(i, sz);
 			}
-			if(chunk->mNext)
+			if(!mem)
 			{
-				chunk->mNext->mPrev = chunk->mPrev;
+				mem = findLargeChunk(sz);
 			}
-
-			psz = reinterpret_cast<size_t*>(chunk);
-			*psz = sz;
-			return reinterpret_cast<byte*>(psz) + sizeof(size_t);
 		}
-		else if(chunk->mSize > sz)// Fit
+		if(mem)
 		{
-			if(chunk->mSize - sz > sizeof(LargeChunk))// add a new LargeChunk
-			{
-				LargeChunk* newchunk = reinterpret_cast<LargeChunk*>( reinterpret_cast<byte*>(chunk) + sz + sizeof(size_t) );
-				newchunk->mNext = chunk->mNext;
-				newchunk->mPrev = chunk->mPrev;
-				newchunk->mSize = chunk->mSize - sz -sizeof(size_t);
-				if(newchunk->mPrev)
-				{
-					newchunk->mPrev->mNext = newchunk;
-				}
-				else
-				{
-					mLargeFreeList = newchunk;
-				}
-				if(newchunk->mNext)
-				{
-					newchunk->mNext->mPrev = newchunk;
-				}
-				psz = reinterpret_cast<size_t*>(chunk);
-				*psz = sz;
-				return reinterpret_cast<byte*>(psz) + sizeof(size_t);
-			}
-			else// remain space cannot fit a new LargeChunk, give entire LargeChunk to user.
-			{
-				// Detach chunk from list
-				if(chunk->mPrev)
-				{
-					chunk->mPrev->mNext = chunk->mNext;
-				}
-				else
-				{
-					mLargeFreeList = chunk->mNext;
-				}
-				if(chunk->mNext)
-				{
-					chunk->mNext->mPrev = chunk->mPrev;
-				}
-
-				psz = reinterpret_cast<size_t*>(chunk);
-				*psz = sz;
-				return reinterpret_cast<byte*>(psz) + sizeof(size_t);
-			}
+			splitLargeChunk(mem, capacity);
 		}
-		chunk = chunk->mNext;
-	}//while(chunk)
+		else
+		{
+			mem = carveLargeChunk(capacity);
+		}
+	}
 
-	// 2. Allocate from mBumpPtr
-	mBumpPtr = mBumpPtr - sz - sizeof(size_t);
-	if(mBumpPtr < mBlockAllocPtr)
+	if(!mem)
 	{
-		// Out of memory!
-		mBumpPtr = mBumpPtr + sz + sizeof(size_t);
-		STAT_ADD(mStatistics.GarbageCollection);// TODO: Need some sort of garbage collection
-		STAT_SUBV(mStatistics.AllocatedSize, sizeof(size_t));
-		STAT_SUBV(mStatistics.AllocatedSize, sz);
-		return NULL;
+		STAT_ADD(mStatistics.GarbageCollection);
+		return NULL;// Out of memory!
 	}
-	psz = reinterpret_cast<size_t*>(mBumpPtr);
-	*psz = sz;
-
-	return reinterpret_cast<byte*>(psz) + sizeof(size_t);
 
+	STAT_ADDV(mStatistics.AllocatedSize, largeChunkSize(mem) + sizeof(size_t));
+	mLargeChunkBytes += largeChunkSize(mem) + sizeof(size_t);
+	return mem;
 }//allocateLarge(size_t sz)
 
 
 void ScalablePoolAllocator::deallocateLarge(byte* mem)
 {
-	tbb::spin_mutex::scoped_lock lock(mPoolLock);
 	STAT_ADD(mStatistics.TotalLargeDeallocations);
+	STAT_SUBV(mStatistics.AllocatedSize, largeChunkSize(mem) + sizeof(size_t));
+	mLargeChunkBytes -= largeChunkSize(mem) + sizeof(size_t);
+
+	pushLargeChunk(mem);
+}//deallocateLarge(byte* mem)
+
+
+size_t ScalablePoolAllocator::getLargeBinIndex(size_t sz)
+{
+	// smallest class holding sz, classes are (8 + i % 8) / 8 * LARGE_BIN_BASE << (i / 8)
+	if(sz <= LARGE_BIN_BASE) { return 0; }
+
+	size_t e = 0;
+	while( (LARGE_BIN_BASE << (e + 1)) < sz ) { ++e; }
+
+	size_t step = (LARGE_BIN_BASE << e) / 8;
+	return e * 8 + (sz - (LARGE_BIN_BASE << e) + step - 1) / step;
+}
+
+
+size_t ScalablePoolAllocator::getLargeBinFloorIndex(size_t sz)
+{
+	// largest class not larger than sz
+	BOOST_ASSERT(sz >= LARGE_BIN_BASE);
+
+	size_t e = 0;
+	while( (LARGE_BIN_BASE << (e + 1)) <= sz ) { ++e; }
+
+	size_t step = (LARGE_BIN_BASE << e) / 8;
+	size_t idx = e * 8 + (sz - (LARGE_BIN_BASE << e)) / step;
+	return (idx < LARGE_BIN_COUNT) ? idx : LARGE_BIN_COUNT - 1;
+}
+
+
+size_t ScalablePoolAllocator::getLargeBinSize(size_t idx)
+{
+	return ((8 + idx % 8) * (LARGE_BIN_BASE / 8)) << (idx / 8);
+}
 
-	size_t* psz = (reinterpret_cast<size_t*>(mem - sizeof(size_t)));
-	STAT_SUBV(mStatistics.AllocatedSize, *psz);
-	STAT_SUBV(mStatistics.AllocatedSize, sizeof(size_t));
 
-	if(mem == mBumpPtr + sizeof(size_t))// At front, move the bump pointer back
+byte* ScalablePoolAllocator::popLargeChunk(size_t idx, size_t sz)
+{
+	if(idx >= LARGE_BIN_COUNT)
 	{
-		mBumpPtr = mBumpPtr + (*psz) + sizeof(size_t);
-		return;
+		idx = LARGE_BIN_COUNT - 1;
 	}
-	else
+
+	byte* mem = reinterpret_cast<byte*>(mLargeBins[idx].pop());
+	if(!mem)
 	{
-		LargeChunk* lc = reinterpret_cast<LargeChunk*>(psz);
-		lc->mSize = *psz;
-		LargeChunk* list = mLargeFreeList;
+		return NULL;
+	}
+	if(largeChunkSize(mem) < sz)// only possible in the last class, which holds all sizes above
+	{
+		mLargeBins[idx].push(reinterpret_cast<void**>(mem));
+		return NULL;
+	}
+
+	STAT_SUB(mStatistics.LargeChunkInFreeList);
+	mLargeFreeBytes -= largeChunkSize(mem) + sizeof(size_t);
+	return mem;
+}
 
-		if(list == NULL)// The only item in freelist
-		{
-			lc->mPrev = lc->mNext = NULL;
-			mLargeFreeList = lc;
-			STAT_ADD(mStatistics.LargeChunkInFreeList);
-			return;
-		}
 
-		// Find position in the list
-		while((list->mNext != NULL) && (list < lc))
+byte* ScalablePoolAllocator::findLargeChunk(size_t sz)
+{
+	// NOTE: Must be called with mPoolLock held. The last class holds all sizes above, so a chunk
+	// large enough may sit anywhere in the stack, detach the whole class and take the first fit.
+	byte* mem = reinterpret_cast<byte*>(mLargeBins[LARGE_BIN_COUNT - 1].popAll());
+	byte* found = NULL;
+	while(mem)
+	{
+		byte* next = *reinterpret_cast<byte**>(mem);
+		if(!found && largeChunkSize(mem) >= sz)
 		{
-			list = list->mNext;
+			found = mem;
 		}
-		if(list->mNext == NULL)// last item
+		else
 		{
-			if(list < lc)// Append to the end of freelist
-			{
-				lc->mNext = NULL;
-				lc->mPrev = list;
-				list->mNext = lc;
-			}
-			else// Insert before last item
-			{
-				lc->mNext = list;
-				lc->mPrev = list->mPrev;
-				list->mPrev = lc;
-				if(lc->mPrev)
-				{
-					lc->mPrev->mNext = lc;
-				}
-				else//lc is head
-				{
-					mLargeFreeList = lc;
-				}
-			}
+			mLargeBins[LARGE_BIN_COUNT - 1].push(reinterpret_cast<void**>(mem));
 		}
-		else// list > lc
+		mem = next;
+	}
+	if(!found)
+	{
+		return NULL;
+	}
+
+	STAT_SUB(mStatistics.LargeChunkInFreeList);
+	mLargeFreeBytes -= largeChunkSize(found) + sizeof(size_t);
+	return found;
+}
+
+
+void ScalablePoolAllocator::pushLargeChunk(byte* mem)
+{
+	STAT_ADD(mStatistics.LargeChunkInFreeList);
+	mLargeFreeBytes += largeChunkSize(mem) + sizeof(size_t);
+	mLargeBins[getLargeBinFloorIndex(largeChunkSize(mem))].push(reinterpret_cast<void**>(mem));
+}
+
+
+void ScalablePoolAllocator::splitLargeChunk(byte* mem, size_t sz)
+{
+	size_t total = largeChunkSize(mem);
+	if(total < sz + sizeof(size_t) + LARGE_BIN_BASE)// remaining space cannot fit a new large chunk, give entire chunk to user
+	{
+		return;
+	}
+
+	byte* rest = mem + sz + sizeof(size_t);
+	largeChunkSize(rest) = total - sz - sizeof(size_t);
+	largeChunkSize(mem) = sz;
+	pushLargeChunk(rest);
+}
+
+
+byte* ScalablePoolAllocator::carveLargeChunk(size_t sz)
+{
+	pool_mutex_t::scoped_lock lock(mPoolLock);
+
+	if(mBumpPtr - mBlockAllocPtr < static_cast<ptrdiff_t>(sz + sizeof(size_t)))
+	{
+		return NULL;// Out of memory!
+	}
+	mBumpPtr = mBumpPtr - sz - sizeof(size_t);
+	updateHighWaterMark();
+
+	byte* mem = mBumpPtr + sizeof(size_t);
+	largeChunkSize(mem) = sz;
+	return mem;
+}
+
+
+bool ScalablePoolAllocator::consolidateLargeChunks()
+{
+	// NOTE: Must be called with mPoolLock held. Other threads may still push and pop
+	// the large bins in the meantime, which is fine since we only touch chunks we took out.
+	std::vector<byte*> chunks;
+	for(size_t i = 0; i < LARGE_BIN_COUNT; ++i)
+	{
+		// detach the whole class at once, the chunks are ours from then on
+		byte* mem = reinterpret_cast<byte*>(mLargeBins[i].popAll());
+		while(mem)
 		{
-			lc->mNext = list;
-			lc->mPrev = list->mPrev;
-			list->mPrev = lc;
-			if(lc->mPrev)
-			{
-				lc->mPrev->mNext = lc;
-			}
-			else
-			{
-				mLargeFreeList = lc;
-			}
+			byte* next = *reinterpret_cast<byte**>(mem);
+			STAT_SUB(mStatistics.LargeChunkInFreeList);
+			mLargeFreeBytes -= largeChunkSize(mem) + sizeof(size_t);
+			chunks.push_back(mem);
+			mem = next;
 		}
-		STAT_ADD(mStatistics.LargeChunkInFreeList);
+	}
+	if(chunks.empty())
+	{
+		return false;
+	}
 
-		// Merge next/prev blocks if they are neighbours
-		if((lc->mPrev) && (reinterpret_cast<byte*>(lc->mPrev) + lc->mPrev->mSize + sizeof(size_t) == reinterpret_cast<byte*>(lc)))
+	// merge neighbours in address order
+	std::sort(chunks.begin(), chunks.end());
+	std::vector<byte*> merged;
+	for(std::vector<byte*>::iterator i = chunks.begin(); i != chunks.end(); ++i)
+	{
+		if(!merged.empty() && merged.back() + largeChunkSize(merged.back()) + sizeof(size_t) == *i)
 		{
-			lc->mPrev->mSize += (lc->mSize + sizeof(size_t));
-			lc->mPrev->mNext = lc->mNext;
-			if(lc->mNext)
-			{
-				lc->mNext->mPrev = lc->mPrev;
-			}
-			lc = lc->mPrev;
-			STAT_SUB(mStatistics.LargeChunkInFreeList);
+			largeChunkSize(merged.back()) += largeChunkSize(*i) + sizeof(size_t);
 		}
-		if((lc->mNext) && (reinterpret_cast<byte*>(lc) + lc->mSize + sizeof(size_t) == reinterpret_cast<byte*>(lc->mNext)))
+		else
 		{
-			lc->mSize += (lc->mNext->mSize + sizeof(size_t));
-			lc->mNext = lc->mNext->mNext;
-			if(lc->mNext)
-			{
-				lc->mNext->mPrev = lc;
-			}
-			STAT_SUB(mStatistics.LargeChunkInFreeList);
+			merged.push_back(*i);
 		}
 	}
-}//deallocateLarge(byte* mem)
+
+	// give the chunk at front back to the bump pointer, so blocks can use it as well
+	std::vector<byte*>::iterator i = merged.begin();
+	if(*i - sizeof(size_t) == mBumpPtr)
+	{
+		mBumpPtr = mBumpPtr + largeChunkSize(*i) + sizeof(size_t);
+		++i;
+	}
+	for(; i != merged.end(); ++i)
+	{
+		pushLargeChunk(*i);
+	}
+	return true;
+}
 
 
 bool ScalablePoolAllocator::isLargeChunk(byte* mem)// done
@@ -468,6 +708,32 @@ ScalablePoolAllocator::ThreadID ScalablePoolAllocator::getThreadID()
 }
 
 
+size_t ScalablePoolAllocator::getNodeID()
+{
+	size_t ret = reinterpret_cast<size_t>(mNodeID.get());
+	if( ret == 0 )
+	{
+		size_t node = 0;
+#ifdef __linux__
+		int cpu = sched_getcpu();
+		if(cpu >= 0 && (size_t)cpu < mCpuNodes.size())
+		{
+			node = mCpuNodes[cpu];
+		}
+#endif
+		ret = node + 1;
+		mNodeID.reset(reinterpret_cast<size_t*>(ret));
+	}
+	return ret - 1;
+}
+
+
+void ScalablePoolAllocator::setThreadNode(size_t node)
+{
+	mNodeID.reset(reinterpret_cast<size_t*>(node + 1));
+}
+
+
 ScalablePoolAllocator::Bin* ScalablePoolAllocator::getBin(size_t sz)//done
 {
 	Bin* bins = mBins.get();
@@ -482,6 +748,7 @@ ScalablePoolAllocator::Bin* ScalablePoolAllocator::getBin(size_t sz)//done
 		uintptr_t* sa = reinterpret_cast<uintptr_t*>(bins);
 		*sa = reinterpret_cast<uintptr_t>(this);
 		bins = bins + 1;
+		registerTLS(bins);
 		mBins.reset(bins);
 	}
 	return bins + getIndex(sz);
@@ -493,7 +760,7 @@ ScalablePoolAllocator::Bin* ScalablePoolAllocator::allocateTLS(size_t sz)// done
 	Bin* ret;
 
 	{
-		tbb::spin_mutex::scoped_lock lock(mTLSAllocationLock);
+		tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
 
 		if(mTLSChunkList)// Free chunk ready to use
 		{
@@ -530,34 +797,227 @@ ScalablePoolAllocator::Bin* ScalablePoolAllocator::allocateTLS(size_t sz)// done
 void ScalablePoolAllocator::deallocateTLS(Bin* p)//done (bootStrapFree)
 {
 	{// lock
-		tbb::spin_mutex::scoped_lock lock(mTLSAllocationLock);
+		tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
 		reinterpret_cast<FreeChunk*>(p)->mNext = mTLSChunkList;
 		mTLSChunkList = reinterpret_cast<FreeChunk*>(p);
 	}// unlock
 }
 
 
-bool ScalablePoolAllocator::allocateBlocks()//done (mallocBigBlock)
+void ScalablePoolAllocator::registerTLS(Bin* bins)
+{
+	BOOST_STATIC_ASSERT(sizeof(BinArrayHeader) <= sizeof(Bin));
+
+	BinArrayHeader* header = reinterpret_cast<BinArrayHeader*>(bins - 1);
+	{// lock
+		tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
+		header->mNextBins = mTLSBinList;
+		mTLSBinList = bins;
+	}// unlock
+}
+
+
+void ScalablePoolAllocator::retireTLS(Bin* bins)
 {
-	tbb::spin_mutex::scoped_lock lock(mPoolLock);// NOTE: can be replace with atomic addition to mBlockAllocPtr
-	Block* blk = reinterpret_cast<Block*>(mBlockAllocPtr);
-	mBlockAllocPtr += BIG_BLOCK_SIZE;
+	tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
 
-	STAT_ADDV(mStatistics.AllocatedSize, BIG_BLOCK_SIZE);
-	if(mBlockAllocPtr > mBumpPtr)
+	// fold the counters so that they survive the thread
+	for(size_t idx = 0; idx < BIN_COUNT; ++idx)
 	{
-		STAT_SUBV(mStatistics.AllocatedSize, BIG_BLOCK_SIZE);
-		return false;// Out of memory!
+		mRetiredBins[idx].mAllocations += bins[idx].mAllocations;
+		mRetiredBins[idx].mDeallocations += bins[idx].mDeallocations;
+		mRetiredBins[idx].mPublicDeallocations += bins[idx].mPublicDeallocations;
+		mRetiredBins[idx].mPrivatizations += bins[idx].mPrivatizations;
+	}
+
+	// unlink from the registered TLS bins
+	Bin** link = &mTLSBinList;
+	while(*link != bins)
+	{
+		BOOST_ASSERT(*link != NULL);
+		link = &reinterpret_cast<BinArrayHeader*>(*link - 1)->mNextBins;
+	}
+	*link = reinterpret_cast<BinArrayHeader*>(bins - 1)->mNextBins;
+}
+
+
+bool ScalablePoolAllocator::allocateBlocks(size_t node)//done (mallocBigBlock)
+{
+	Block* blk;
+	{
+		pool_mutex_t::scoped_lock lock(mPoolLock);// NOTE: can be replace with atomic addition to mBlockAllocPtr
+		if(mBlockAllocPtr + BIG_BLOCK_SIZE > mBumpPtr)
+		{
+			// free large chunks at the front of the large region can be given back
+			consolidateLargeChunks();
+			if(mBlockAllocPtr + BIG_BLOCK_SIZE > mBumpPtr)
+			{
+				return false;// Out of memory!
+			}
+		}
+		blk = reinterpret_cast<Block*>(mBlockAllocPtr);
+		mBlockAllocPtr += BIG_BLOCK_SIZE;
+
+		STAT_ADDV(mStatistics.AllocatedSize, BIG_BLOCK_SIZE);
+		updateHighWaterMark();
+	}
+
+	// bind before the first touch (writing the block header below), so the pages are placed on the node
+	if(NODE_COUNT > 1)
+	{
+		bindToNode(reinterpret_cast<byte*>(blk), BIG_BLOCK_SIZE, node);
 	}
 
 	blk->mBumpPtr = reinterpret_cast<FreeChunk*>( reinterpret_cast<uintptr_t>(blk) + BIG_BLOCK_SIZE );
-	mFreeBlockStack.push(reinterpret_cast<void**>(blk));
+	blk->mNodeID = node;
+	blk->mIsDecommitted = false;
+	mFreeBlockStacks[node].push(reinterpret_cast<void**>(blk));
 
 	STAT_ADDV(mStatistics.BlocksInFreeBlockStack, BIG_BLOCK_BLOCK_COUNT);
 	return true;
 }
 
 
+void ScalablePoolAllocator::bindToNode(byte* mem, size_t sz, size_t node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	// prefer the node rather than strictly bind to it, so the kernel can still fall back when the node is full
+	unsigned long mask[4] = { 0 };
+	if(node >= sizeof(mask) * 8) return;
+	mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+	if(syscall(SYS_mbind, mem, sz, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1, MPOL_MF_MOVE) != 0)
+	{
+#if BUILD_WITH_LOG4CXX
+		LOG4CXX_DEBUG(mLogger, "failed to bind block to node " << node);
+#endif
+	}
+#else
+	UNUSED_ARGUMENT(mem);
+	UNUSED_ARGUMENT(sz);
+	UNUSED_ARGUMENT(node);
+#endif
+}
+
+
+size_t ScalablePoolAllocator::trim(size_t retainedBytes)
+{
+	trim_mutex_t::scoped_lock trimLock(mTrimLock);
+
+	size_t trimmed = 0;
+	size_t retainedPerNode = retainedBytes / NODE_COUNT;
+	for(size_t node = 0; node < NODE_COUNT; ++node)
+	{
+		size_t count = 0;
+		void** head = reinterpret_cast<void**>(mFreeBlockStacks[node].popAll(count));
+		if(!head) continue;
+
+		// keep the top of the stack resident, which is freed most recently and reused first
+		size_t retained = 0;
+		size_t retainedCount = 0;
+		void** tail = NULL;
+		void** p = head;
+		for(; p && retained < retainedPerNode; p = reinterpret_cast<void**>(*p))
+		{
+			Block* block = reinterpret_cast<Block*>(p);
+			if(!block->mIsDecommitted)
+			{
+				retained += reinterpret_cast<uintptr_t>(block->mBumpPtr) - reinterpret_cast<uintptr_t>(block);
+			}
+			tail = p;
+			++retainedCount;
+		}
+		if(tail)
+		{
+			// hand the retained part back first, so allocation doesn't see an empty stack for long
+			*tail = NULL;
+			mFreeBlockStacks[node].pushList(head, tail, retainedCount);
+		}
+		if(!p) continue;
+
+		// merge address-adjacent free blocks, so only the first page of each run stays resident
+		std::vector<Block*> blocks;
+		for(; p; p = reinterpret_cast<void**>(*p))
+		{
+			blocks.push_back(reinterpret_cast<Block*>(p));
+			trimmed += getCommittedSize(blocks.back());
+		}
+		std::sort(blocks.begin(), blocks.end());
+
+		std::vector<Block*> runs;
+		for(std::vector<Block*>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+		{
+			if(!runs.empty() && reinterpret_cast<Block*>(runs.back()->mBumpPtr) == *i)
+			{
+				runs.back()->mBumpPtr = (*i)->mBumpPtr;
+				runs.back()->mIsDecommitted = false;
+			}
+			else
+			{
+				runs.push_back(*i);
+			}
+		}
+
+		head = tail = NULL;
+		for(std::vector<Block*>::reverse_iterator i = runs.rbegin(); i != runs.rend(); ++i)
+		{
+			decommitBlocks(*i);
+			trimmed -= getCommittedSize(*i);
+
+			void** link = reinterpret_cast<void**>(*i);
+			*link = head;
+			head = link;
+			if(!tail) tail = link;
+		}
+		mFreeBlockStacks[node].pushList(head, tail, runs.size());
+	}
+
+	mTrimmedBytes += trimmed;
+	return trimmed;
+}
+
+
+void ScalablePoolAllocator::decommitBlocks(Block* block)
+{
+	// NOTE: The block must have been taken out of the free block stack. All free space from the
+	// block to its bump pointer is decommitted except for the page holding the header and stack link.
+	if(block->mIsDecommitted) return;
+
+#ifdef __linux__
+	uintptr_t begin = reinterpret_cast<uintptr_t>(block) + getHeaderPageSize(block);
+	uintptr_t end = alignDown(reinterpret_cast<uintptr_t>(block->mBumpPtr), static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)));
+	if(begin < end && madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED) != 0)
+	{
+#if BUILD_WITH_LOG4CXX
+		LOG4CXX_DEBUG(mLogger, "failed to decommit block at " << block);
+#endif
+		return;
+	}
+	block->mIsDecommitted = true;
+#endif
+}
+
+
+size_t ScalablePoolAllocator::getHeaderPageSize(Block* block)
+{
+	size_t sz = reinterpret_cast<uintptr_t>(block->mBumpPtr) - reinterpret_cast<uintptr_t>(block);
+#ifdef __linux__
+	uintptr_t headerEnd = alignUp(reinterpret_cast<uintptr_t>(block) + sizeof(Block), static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)));
+	return std::min(sz, static_cast<size_t>(headerEnd - reinterpret_cast<uintptr_t>(block)));
+#else
+	return sz;
+#endif
+}
+
+
+size_t ScalablePoolAllocator::getCommittedSize(Block* block)
+{
+	if(block->mIsDecommitted)
+		return getHeaderPageSize(block);
+	else
+		return reinterpret_cast<uintptr_t>(block->mBumpPtr) - reinterpret_cast<uintptr_t>(block);
+}
+
+
 template<bool asIndex>
 size_t ScalablePoolAllocator::getIndexOrChunkSize(size_t sz)
 {
@@ -669,25 +1129,42 @@ ScalablePoolAllocator::Block* ScalablePoolAllocator::getEmptyBlock(size_t chunkS
 {
 	Block* ret = NULL;
 	Block* bigBlock;
+	size_t threadNode = getNodeID();
+	size_t node = threadNode % NODE_COUNT;
 
-	bigBlock = reinterpret_cast<Block*>(mFreeBlockStack.pop());
+	bigBlock = reinterpret_cast<Block*>(mFreeBlockStacks[node].pop());
 	while( !bigBlock )
 	{
-		if( !allocateBlocks() )// Failed to allocate, most likely out of memory
+		if( !allocateBlocks(node) )// Failed to allocate, most likely out of memory
 		{
-			return NULL;
+			// under memory pressure, take blocks from other nodes
+			for(size_t i = 1; i < NODE_COUNT && !bigBlock; ++i)
+			{
+				bigBlock = reinterpret_cast<Block*>(mFreeBlockStacks[(node + i) % NODE_COUNT].pop());
+			}
+			if( !bigBlock )
+			{
+				return NULL;
+			}
+			break;
 		}
-		bigBlock = reinterpret_cast<Block*>(mFreeBlockStack.pop());
+		bigBlock = reinterpret_cast<Block*>(mFreeBlockStacks[node].pop());
 	}
 
 	bigBlock->mBumpPtr = reinterpret_cast<FreeChunk*>( reinterpret_cast<uintptr_t>(bigBlock->mBumpPtr) - BLOCK_SIZE);
 	ret = reinterpret_cast<Block*>(bigBlock->mBumpPtr);
 	if(ret != bigBlock)
 	{
-		mFreeBlockStack.push( reinterpret_cast<void**>(bigBlock) );
+		ret->mNodeID = bigBlock->mNodeID;
+		mFreeBlockStacks[bigBlock->mNodeID].push( reinterpret_cast<void**>(bigBlock) );
 	}
 	initEmptyBlock(ret, chunkSize);
 
+	if(ret->mNodeID == threadNode)
+		mLocalBlocks++;
+	else
+		mRemoteBlocks++;
+
 	STAT_SUB(mStatistics.BlocksInFreeBlockStack);
 	STAT_ADD(mStatistics.BlocksInUse);
 	return ret;
@@ -709,10 +1186,11 @@ void ScalablePoolAllocator::returnEmptyBlock(Block* block)//done
 	block->mFreeList = NULL;
 	block->mAllocationCount = 0;
 	block->mIsFull = false;
+	block->mIsDecommitted = false;
 
 	STAT_SUB(mStatistics.BlocksInUse);
 	STAT_ADD(mStatistics.BlocksInFreeBlockStack);
-	mFreeBlockStack.push( reinterpret_cast<void**>(block) );
+	mFreeBlockStacks[block->mNodeID].push( reinterpret_cast<void**>(block) );
 }
 
 
@@ -727,7 +1205,7 @@ ScalablePoolAllocator::Block* ScalablePoolAllocator::getPartialBlock(Bin* bin, s
 		ret->mPrev = NULL;
 		ret->mOwnerID = getThreadID();
 		ret->mNextPrivatizable = reinterpret_cast<Block*>(bin);
-		privatizePublicFreeList(ret);
+		bin->mPrivatizations += privatizePublicFreeList(ret);
 		if(ret->mAllocationCount)
 		{
 			emptyEnoughToUse(ret);
@@ -746,14 +1224,7 @@ void ScalablePoolAllocator::returnPartialBlock(Bin* bin, Block* block)//done
 	size_t idx = getIndex(block->mChunkSize);
 	if( reinterpret_cast<uintptr_t>(block->mNextPrivatizable) == reinterpret_cast<uintptr_t>(bin) )
 	{
-		void* oldval = NULL;
-		{//lock
-			tbb::spin_mutex::scoped_lock lock(mPublicFreeListLock);
-			if( (oldval = reinterpret_cast<void*>(block->mPublicFreeList)) == NULL)
-			{
-				block->mPublicFreeList = reinterpret_cast<FreeChunk*>(INVALID);
-			}
-		}//unlock
+		void* oldval = atomic::cas_ptr(reinterpret_cast<void* volatile*>(&block->mPublicFreeList), reinterpret_cast<void*>(INVALID), NULL);
 		if(oldval != NULL)
 		{
 			// need to wait for the other thread finishes freeing the object
@@ -837,7 +1308,7 @@ ScalablePoolAllocator::Block* ScalablePoolAllocator::getPublicFreeListBlock(Bin*
 {
 	Block* ret;
 	{//lock
-		tbb::spin_mutex::scoped_lock lock(bin->mMailBoxLock);
+		mail_box_mutex_t::scoped_lock lock(bin->mMailBoxLock);
 		ret = bin->mMailBox;
 		if(ret)
 		{
@@ -847,55 +1318,65 @@ ScalablePoolAllocator::Block* ScalablePoolAllocator::getPublicFreeListBlock(Bin*
 	}//unlock
 	if(ret)
 	{
-		privatizePublicFreeList(ret);
+		bin->mPrivatizations += privatizePublicFreeList(ret);
 	}
 	return ret;
 }
 
 
-void ScalablePoolAllocator::privatizePublicFreeList(Block* block)//done
+size_t ScalablePoolAllocator::privatizePublicFreeList(Block* block)//done
 {
 	FreeChunk* tmp, *publicFreeList;
+	size_t count = 0;
 
-	///{ public freelist locking scheme
+	///{ public freelist lock-free scheme, detach the whole list at once
+	do
 	{
-		tbb::spin_mutex::scoped_lock lock(mPublicFreeListLock);
 		publicFreeList = block->mPublicFreeList;
-		block->mPublicFreeList = NULL;
-	}
+	} while( atomic::cas_ptr(reinterpret_cast<void* volatile*>(&block->mPublicFreeList), NULL, publicFreeList) != publicFreeList );
 	tmp = publicFreeList;
 	///}
 	if( !isInvalid( reinterpret_cast<uintptr_t>(tmp) ) )// return/getPartialBlock could set it to INVALID
 	{
 		block->mAllocationCount--;
+		count++;
 		while( isValid( reinterpret_cast<uintptr_t>(tmp->mNext) ) )// the list will end with either NULL or UNUSABLE
 		{
 			tmp = tmp->mNext;
 			block->mAllocationCount--;
+			count++;
 		}
 		// prepend to private freelist
 		tmp->mNext = block->mFreeList;
 		block->mFreeList = publicFreeList;
 	}
+	return count;
 }
 
 
 void ScalablePoolAllocator::freePublicChunk(Block* block, FreeChunk* chunk)//done
+{
+	freePublicChunks(block, chunk, chunk);
+}
+
+
+void ScalablePoolAllocator::freePublicChunks(Block* block, FreeChunk* head, FreeChunk* tail)
 {
 	Bin* bin;
 	FreeChunk* publicFreeList;
-	{//lock
-		tbb::spin_mutex::scoped_lock lock(mPublicFreeListLock);
-		publicFreeList = chunk->mNext = block->mPublicFreeList;
-		block->mPublicFreeList = chunk;
-	}//unlock
+
+	// prepend the whole [head, tail] list with a single CAS
+	do
+	{
+		publicFreeList = tail->mNext = block->mPublicFreeList;
+	} while( atomic::cas_ptr(reinterpret_cast<void* volatile*>(&block->mPublicFreeList), head, publicFreeList) != publicFreeList );
 
 	if( publicFreeList == NULL )
 	{
 		if( !isInvalid( reinterpret_cast<uintptr_t>(block->mNextPrivatizable) ) )
 		{
 			bin = reinterpret_cast<Bin*>(block->mNextPrivatizable);
-			tbb::spin_mutex::scoped_lock maillock(bin->mMailBoxLock);
+			mail_box_mutex_t::scoped_lock maillock(bin->mMailBoxLock);
 			block->mNextPrivatizable = bin->mMailBox;
 			bin->mMailBox = block;
 		}
@@ -907,6 +1388,68 @@ void ScalablePoolAllocator::freePublicChunk(Block* block, FreeChunk* chunk)//don
 }
 
 
+ScalablePoolAllocator::RemoteFreeCache* ScalablePoolAllocator::getRemoteFreeCache()
+{
+	Bin* bins = mBins.get();
+	return bins ? reinterpret_cast<RemoteFreeCache*>(bins + BIN_COUNT) : NULL;
+}
+
+
+void ScalablePoolAllocator::freeRemoteChunk(RemoteFreeCache* cache, Block* block, FreeChunk* chunk)
+{
+	RemoteFreeCache::Slot* slot = NULL;
+	for(size_t i = 0; i < RemoteFreeCache::SLOT_COUNT; ++i)
+	{
+		if(cache->mSlots[i].mBlock == block)
+		{
+			slot = &cache->mSlots[i];
+			break;
+		}
+	}
+
+	if(slot)
+	{
+		chunk->mNext = slot->mHead;
+		slot->mHead = chunk;
+		slot->mCount++;
+	}
+	else
+	{
+		// take over a slot, evict in round-robin if it's in use
+		slot = &cache->mSlots[cache->mVictim];
+		cache->mVictim = (cache->mVictim + 1) % RemoteFreeCache::SLOT_COUNT;
+		if(slot->mBlock)
+		{
+			freePublicChunks(slot->mBlock, slot->mHead, slot->mTail);
+		}
+		chunk->mNext = NULL;
+		slot->mBlock = block;
+		slot->mHead = slot->mTail = chunk;
+		slot->mCount = 1;
+	}
+
+	if(slot->mCount >= RemoteFreeCache::BATCH_SIZE)
+	{
+		freePublicChunks(slot->mBlock, slot->mHead, slot->mTail);
+		slot->mBlock = NULL;
+	}
+}
+
+
+void ScalablePoolAllocator::flushRemoteFreeCache(RemoteFreeCache* cache)
+{
+	for(size_t i = 0; i < RemoteFreeCache::SLOT_COUNT; ++i)
+	{
+		RemoteFreeCache::Slot& slot = cache->mSlots[i];
+		if(slot.mBlock)
+		{
+			freePublicChunks(slot.mBlock, slot.mHead, slot.mTail);
+			slot.mBlock = NULL;
+		}
+	}
+}
+
+
 bool ScalablePoolAllocator::emptyEnoughToUse(Block* block)//done
 {
 	if(block->mBumpPtr)
@@ -936,6 +1479,7 @@ void ScalablePoolAllocator::removeBlock(Bin* bin, Block* block)//done
 	}
 	block->mNext = NULL;
 	block->mPrev = NULL;
+	bin->mBlockCount--;
 }
 
 
@@ -958,6 +1502,7 @@ void ScalablePoolAllocator::prependBlock(Bin* bin, Block* block)//done
 	{
 		bin->mActiveBlock = block;
 	}
+	bin->mBlockCount++;
 }
 
 
@@ -999,26 +1544,99 @@ ScalablePoolAllocator::Block* ScalablePoolAllocator::Bin::setPreviousBlockActive
 
 /// Stack
 ///{
-ScalablePoolAllocator::Stack::Stack() : mTop(NULL)
+ScalablePoolAllocator::Stack::Stack() : mTop(NULL), mCount(0)
 {}
 void ScalablePoolAllocator::Stack::push(void** p)
 {
-	tbb::spin_mutex::scoped_lock lock(mLock);
+	stack_mutex_t::scoped_lock lock(mLock);
 	*p = mTop;
 	mTop = reinterpret_cast<void*>(p);
+	mCount++;
 }
 void* ScalablePoolAllocator::Stack::pop()
 {
 	void** ret = NULL;
 	{
-		tbb::spin_mutex::scoped_lock lock(mLock);
+		stack_mutex_t::scoped_lock lock(mLock);
 		if( !mTop ) { return ret; }
 		ret = reinterpret_cast<void**>(mTop);
 		mTop = *ret;
+		mCount--;
 	}
 	*ret = NULL;
 	return ret;
 }
+void* ScalablePoolAllocator::Stack::popAll(size_t& count)
+{
+	stack_mutex_t::scoped_lock lock(mLock);
+	void* ret = mTop;
+	count = mCount;
+	mTop = NULL;
+	mCount = 0;
+	return ret;
+}
+void ScalablePoolAllocator::Stack::pushList(void** head, void** tail, size_t count)
+{
+	stack_mutex_t::scoped_lock lock(mLock);
+	*tail = mTop;
+	mTop = reinterpret_cast<void*>(head);
+	mCount += count;
+}
+///}
+
+/// LargeStack
+///{
+ScalablePoolAllocator::LargeStack::LargeStack() : mHead(0)
+{}
+uint64 ScalablePoolAllocator::LargeStack::pack(void** p, uint64 pops) const
+{
+	if(!p) { return pops << OFFSET_BITS; }
+
+	uint64 offset = (reinterpret_cast<byte*>(p) - reinterpret_cast<const byte*>(this)) / sizeof(size_t);
+	BOOST_ASSERT(reinterpret_cast<byte*>(p) > reinterpret_cast<const byte*>(this));
+	BOOST_ASSERT(offset < (1ULL << OFFSET_BITS));
+	return (pops << OFFSET_BITS) | offset;
+}
+void** ScalablePoolAllocator::LargeStack::unpack(uint64 head) const
+{
+	uint64 offset = head & ((1ULL << OFFSET_BITS) - 1);
+	if(!offset) { return NULL; }
+	return reinterpret_cast<void**>(const_cast<byte*>(reinterpret_cast<const byte*>(this)) + offset * sizeof(size_t));
+}
+void ScalablePoolAllocator::LargeStack::push(void** p)
+{
+	uint64 head = mHead.load(std::memory_order_relaxed);
+	do
+	{
+		__atomic_store_n(p, reinterpret_cast<void*>(unpack(head)), __ATOMIC_RELAXED);
+	} while( !mHead.compare_exchange_weak(head, pack(p, head >> OFFSET_BITS), std::memory_order_release, std::memory_order_relaxed) );
+}
+void* ScalablePoolAllocator::LargeStack::pop()
+{
+	uint64 head = mHead.load(std::memory_order_acquire);
+	void** ret;
+	do
+	{
+		ret = unpack(head);
+		if( !ret ) { return NULL; }
+
+		// the chunk may be taken (and written) by another thread right now, which
+		// bumps the pop counter, so a stale successor never makes it into the head
+		void** next = reinterpret_cast<void**>(__atomic_load_n(ret, __ATOMIC_RELAXED));
+		if( mHead.compare_exchange_weak(head, pack(next, (head >> OFFSET_BITS) + 1), std::memory_order_acquire, std::memory_order_acquire) )
+			break;
+	} while(true);
+
+	*ret = NULL;
+	return ret;
+}
+void* ScalablePoolAllocator::LargeStack::popAll()
+{
+	uint64 head = mHead.load(std::memory_order_acquire);
+	while( unpack(head) && !mHead.compare_exchange_weak(head, pack(NULL, (head >> OFFSET_BITS) + 1), std::memory_order_acquire, std::memory_order_acquire) )
+		;
+	return unpack(head);
+}
 ///}
 
 /// TLS Clean up functions
@@ -1038,6 +1656,9 @@ void ScalablePoolAllocator::BinTLSCleanUpFunction(Bin* bins)
 
 	if(bins)
 	{
+		// hand cached cross-thread frees back first, they may belong to our own blocks as well
+		_this->flushRemoteFreeCache(reinterpret_cast<RemoteFreeCache*>(bins + _this->BIN_COUNT));
+
 		for(size_t idx = 0; idx < _this->BIN_COUNT; idx++)
 		{
 			if(bins[idx].mActiveBlock == NULL) { continue; }
@@ -1071,7 +1692,9 @@ void ScalablePoolAllocator::BinTLSCleanUpFunction(Bin* bins)
 				threadlessBlock = threadBlock;
 			}
 			bins[idx].mActiveBlock = NULL;
+			bins[idx].mBlockCount = 0;
 		}
+		_this->retireTLS(bins);
 		_this->deallocateTLS(bins - 1);// Including the "this" pointer upon deallocation
 		bins = NULL;
 	}
@@ -1083,6 +1706,72 @@ void ScalablePoolAllocator::BinTLSCleanUpFunction(Bin* bins)
 
 /// Statistics
 ///{
+ScalablePoolAllocator::PoolStat ScalablePoolAllocator::getStats()
+{
+	PoolStat stat;
+	std::vector<size_t> publicDeallocations(BIN_COUNT, 0);
+	std::vector<size_t> privatizations(BIN_COUNT, 0);
+
+	stat.Bins.resize(BIN_COUNT);
+	stat.ThreadCount = 0;
+	stat.NodeCount = NODE_COUNT;
+	stat.LocalBlocks = mLocalBlocks;
+	stat.RemoteBlocks = mRemoteBlocks;
+	stat.TrimmedBytes = mTrimmedBytes;
+
+	{// lock, which only prevents threads from creating or destroying their bins in the meantime
+		tls_allocation_mutex_t::scoped_lock lock(mTLSAllocationLock);
+		for(size_t idx = 0; idx < BIN_COUNT; ++idx)
+		{
+			BinStat& b = stat.Bins[idx];
+			b.TotalAllocations = mRetiredBins[idx].mAllocations;
+			b.TotalDeallocations = mRetiredBins[idx].mDeallocations;
+			b.BlocksInTLS = 0;
+			publicDeallocations[idx] = mRetiredBins[idx].mPublicDeallocations;
+			privatizations[idx] = mRetiredBins[idx].mPrivatizations;
+		}
+		for(Bin* bins = mTLSBinList; bins; bins = reinterpret_cast<BinArrayHeader*>(bins - 1)->mNextBins)
+		{
+			for(size_t idx = 0; idx < BIN_COUNT; ++idx)
+			{
+				BinStat& b = stat.Bins[idx];
+				b.TotalAllocations += bins[idx].mAllocations;
+				b.TotalDeallocations += bins[idx].mDeallocations;
+				b.BlocksInTLS += bins[idx].mBlockCount;
+				publicDeallocations[idx] += bins[idx].mPublicDeallocations;
+				privatizations[idx] += bins[idx].mPrivatizations;
+			}
+			stat.ThreadCount++;
+		}
+	}// unlock
+
+	for(size_t idx = 0; idx < BIN_COUNT; ++idx)
+	{
+		BinStat& b = stat.Bins[idx];
+		b.ChunkSize = mBinSizes[idx];
+		b.ChunksPerBlock = (BLOCK_SIZE - sizeof(Block)) / mBinSizes[idx];
+		b.BlocksInGlobalBin = mGlobalBins[idx].size();
+
+		// counters of different threads are read at different times, so never let them go below zero
+		b.LiveChunks = (b.TotalAllocations > b.TotalDeallocations) ? b.TotalAllocations - b.TotalDeallocations : 0;
+		b.PublicFreeListLength = (publicDeallocations[idx] > privatizations[idx]) ? publicDeallocations[idx] - privatizations[idx] : 0;
+
+		size_t capacity = (b.BlocksInTLS + b.BlocksInGlobalBin) * b.ChunksPerBlock;
+		b.FreeChunks = (capacity > b.LiveChunks) ? capacity - b.LiveChunks : 0;
+	}
+
+	{// lock
+		pool_mutex_t::scoped_lock lock(mPoolLock);
+		stat.PoolSize = mLargeRegionEnd - mPool;
+		stat.BlockBytes = mBlockAllocPtr - mPool;
+		stat.LargeChunkBytes = mLargeChunkBytes;
+		stat.HighWaterMark = mHighWaterMark;
+		stat.LargeFreeBytes = mLargeFreeBytes;
+	}// unlock
+
+	return stat;
+}
+
 #ifdef ZILLIANS_SCALABLEALLOCATOR_STATISTICS
 void ScalablePoolAllocator::resetAllocatorStat()
 {
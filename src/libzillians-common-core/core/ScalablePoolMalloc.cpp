@@ -0,0 +1,306 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/ScalablePoolMalloc.h"
+#include "core/HugePageRegion.h"
+
+#include <boost/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* mem, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* mem);
+}
+
+namespace zillians {
+
+namespace {
+
+const std::size_t DEFAULT_ARENA_SIZE = 1024UL * 1024 * 1024;
+const std::size_t MAX_POOLED_SIZE = 8192;	///< The largest default bin, anything larger is a large chunk
+const std::size_t POOLED_ALIGNMENT = 16;	///< Chunks of every bin but the 8-byte one are 16-byte aligned
+
+pthread_once_t gInitialized = PTHREAD_ONCE_INIT;
+ScalablePoolAllocator* gPool = NULL;
+
+// glibc has no internal alias of malloc_usable_size(), so its own is looked up behind this one
+size_t (*gLibcUsableSize)(void*) = NULL;
+
+// never destroyed, memory is freed by static destructors as late as the process exits
+boost::aligned_storage<sizeof(HugePageRegion), boost::alignment_of<HugePageRegion>::value> gRegionStorage;
+boost::aligned_storage<sizeof(ScalablePoolAllocator), boost::alignment_of<ScalablePoolAllocator>::value> gPoolStorage;
+
+// set while the pool is running, so whatever it allocates itself (TLS, node lists, ...) comes from glibc
+__thread bool tBypass __attribute__((tls_model("initial-exec"))) = false;
+
+struct Bypass
+{
+	Bypass() : previous(tBypass) { tBypass = true; }
+	~Bypass() { tBypass = previous; }
+	bool previous;
+};
+
+void initialize()
+{
+	Bypass bypass;
+
+	gLibcUsableSize = (size_t (*)(void*))::dlsym(RTLD_NEXT, "malloc_usable_size");
+
+	std::size_t size = DEFAULT_ARENA_SIZE;
+	if(const char* value = ::getenv("ZILLIANS_MALLOC_ARENA_SIZE"))
+		size = (std::size_t)::strtoull(value, NULL, 0);
+
+	try
+	{
+		HugePageRegion* region = new(gRegionStorage.address()) HugePageRegion(size, HugePageRegion::TRANSPARENT_HUGE_PAGES);
+		gPool = new(gPoolStorage.address()) ScalablePoolAllocator(region->data(), region->size(), 0, 0, 1, true);
+	}
+	catch(...)
+	{
+		gPool = NULL;
+	}
+}
+
+inline ScalablePoolAllocator* pool()
+{
+	if(UNLIKELY(tBypass))
+		return NULL;
+
+	::pthread_once(&gInitialized, initialize);
+	return gPool;
+}
+
+inline bool isPooled(void* mem)
+{
+	return gPool && gPool->contains((byte*)mem);
+}
+
+void* allocate(std::size_t size)
+{
+	if(LIKELY(size <= MAX_POOLED_SIZE))
+	{
+		if(ScalablePoolAllocator* p = pool())
+		{
+			Bypass bypass;
+			void* mem = p->allocate(size ? size : 1);
+			if(LIKELY(mem != NULL))
+				return mem;
+		}
+	}
+	return __libc_malloc(size);
+}
+
+void release(void* mem)
+{
+	if(!mem) return;
+
+	if(isPooled(mem))
+	{
+		Bypass bypass;
+		gPool->deallocate((byte*)mem);
+		return;
+	}
+	__libc_free(mem);
+}
+
+void* allocateAligned(std::size_t alignment, std::size_t size)
+{
+	// the 8-byte bin is only 8-byte aligned
+	if(alignment <= POOLED_ALIGNMENT && (alignment <= sizeof(void*) || size > sizeof(void*)))
+		return allocate(size);
+	return __libc_memalign(alignment, size);
+}
+
+void* allocateOrThrow(std::size_t size)
+{
+	for(;;)
+	{
+		void* mem = allocate(size);
+		if(LIKELY(mem != NULL))
+			return mem;
+
+		std::new_handler handler = std::set_new_handler(0);
+		std::set_new_handler(handler);
+		if(!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+}
+
+ScalablePoolAllocator* getMallocPool()
+{
+	return pool();
+}
+
+}
+
+using namespace zillians;
+
+extern "C" {
+
+void* malloc(size_t size)
+{
+	return allocate(size);
+}
+
+void free(void* mem)
+{
+	release(mem);
+}
+
+void* calloc(size_t n, size_t size)
+{
+	if(size && n > (size_t)-1 / size)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	size_t total = n * size;
+	if(total > MAX_POOLED_SIZE)
+		return __libc_calloc(n, size);
+
+	// pooled chunks are recycled, so they must be cleared
+	void* mem = allocate(total);
+	if(mem)
+		::memset(mem, 0, total);
+	return mem;
+}
+
+void* realloc(void* mem, size_t size)
+{
+	if(!mem)
+		return allocate(size);
+
+	if(!isPooled(mem))
+		return __libc_realloc(mem, size);
+
+	if(size == 0)
+	{
+		release(mem);
+		return NULL;
+	}
+
+	size_t usable;
+	{
+		Bypass bypass;
+		usable = gPool->getUsableSize((byte*)mem);
+	}
+	if(size <= usable)
+		return mem;
+
+	void* grown = allocate(size);
+	if(grown)
+	{
+		::memcpy(grown, mem, usable);
+		release(mem);
+	}
+	return grown;
+}
+
+int posix_memalign(void** result, size_t alignment, size_t size)
+{
+	if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	void* mem = allocateAligned(alignment, size);
+	if(!mem)
+		return ENOMEM;
+
+	*result = mem;
+	return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+	return allocateAligned(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+	return allocateAligned(alignment, size);
+}
+
+size_t malloc_usable_size(void* mem)
+{
+	if(!mem)
+		return 0;
+
+	if(isPooled(mem))
+	{
+		Bypass bypass;
+		return gPool->getUsableSize((byte*)mem);
+	}
+
+	pool();
+	return gLibcUsableSize ? gLibcUsableSize(mem) : 0;
+}
+
+}
+
+void* operator new(std::size_t size) throw(std::bad_alloc)
+{
+	return allocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size) throw(std::bad_alloc)
+{
+	return allocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+	return allocate(size);
+}
+
+void operator delete(void* mem) throw()
+{
+	release(mem);
+}
+
+void operator delete[](void* mem) throw()
+{
+	release(mem);
+}
+
+void operator delete(void* mem, const std::nothrow_t&) throw()
+{
+	release(mem);
+}
+
+void operator delete[](void* mem, const std::nothrow_t&) throw()
+{
+	release(mem);
+}
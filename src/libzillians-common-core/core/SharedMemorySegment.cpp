@@ -0,0 +1,104 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/SharedMemorySegment.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/thread/thread.hpp>
+
+namespace zillians {
+
+namespace {
+
+/**
+ * The number of times to check if the creator has sized the object, one millisecond apart.
+ */
+const int SIZE_CHECK_ATTEMPTS = 1000;
+
+}
+
+SharedMemorySegment::SharedMemorySegment(const std::string& name, std::size_t size) :
+	mName(name), mData(NULL), mSize(size), mCreator(false)
+{
+	BOOST_ASSERT(size > 0);
+
+	int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd >= 0)
+	{
+		mCreator = true;
+		if(::ftruncate(fd, (off_t)size) != 0)
+		{
+			int error = errno;
+			::close(fd);
+			::shm_unlink(name.c_str());
+			throw std::runtime_error("failed to truncate shared memory \"" + name + "\": " + ::strerror(error));
+		}
+	}
+	else if(errno == EEXIST)
+	{
+		fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+		if(fd < 0)
+			throw std::runtime_error("failed to open shared memory \"" + name + "\": " + ::strerror(errno));
+
+		// the creator truncates right after creating, but we may get there in between
+		struct stat s;
+		for(int i = 0; ::fstat(fd, &s) == 0 && (std::size_t)s.st_size < size; ++i)
+		{
+			if(i == SIZE_CHECK_ATTEMPTS)
+			{
+				::close(fd);
+				throw std::runtime_error("shared memory \"" + name + "\" is smaller than expected");
+			}
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		}
+	}
+	else
+	{
+		throw std::runtime_error("failed to create shared memory \"" + name + "\": " + ::strerror(errno));
+	}
+
+	void* data = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	::close(fd);	// the mapping keeps the object open
+
+	if(data == MAP_FAILED)
+		throw std::runtime_error("failed to map shared memory \"" + name + "\": " + ::strerror(error));
+
+	mData = (byte*)data;
+}
+
+SharedMemorySegment::~SharedMemorySegment()
+{
+	if(mData)
+		::munmap((void*)mData, mSize);
+}
+
+bool SharedMemorySegment::remove(const std::string& name)
+{
+	return ::shm_unlink(name.c_str()) == 0;
+}
+
+}
@@ -0,0 +1,244 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/ThreadPlacement.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+/**
+ * Parse a sysfs cpu list, i.e. "0-3,8-11".
+ */
+std::vector<uint32> parseCpuList(const std::string& list)
+{
+	std::vector<uint32> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while(std::getline(ss, range, ','))
+	{
+		uint32 first = 0, last = 0;
+		char dash = 0;
+		std::stringstream rs(range);
+		if(!(rs >> first)) continue;
+		last = (rs >> dash >> last) ? last : first;
+
+		for(uint32 cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+bool readLine(const std::string& path, std::string& line)
+{
+	std::ifstream f(path.c_str());
+	if(!f) return false;
+	return !!std::getline(f, line);
+}
+
+std::vector<uint32> allCpus()
+{
+	std::vector<uint32> cpus;
+	for(uint32 cpu = 0; cpu < ThreadPlacement::getCpuCount(); ++cpu)
+		cpus.push_back(cpu);
+	return cpus;
+}
+
+}
+
+ThreadPlacement ThreadPlacement::onCpu(uint32 cpu)
+{
+	ThreadPlacement placement;
+	placement.mCpus.push_back(cpu);
+	return placement;
+}
+
+ThreadPlacement ThreadPlacement::onCpus(const std::vector<uint32>& cpus)
+{
+	ThreadPlacement placement;
+	placement.mCpus = cpus;
+	return placement;
+}
+
+ThreadPlacement ThreadPlacement::onNumaNode(uint32 node)
+{
+	return onCpus(getCpusOfNumaNode(node));
+}
+
+ThreadPlacement ThreadPlacement::onCacheOf(uint32 cpu)
+{
+	return onCpus(getCpusSharingCache(cpu));
+}
+
+ThreadPlacement ThreadPlacement::at(std::size_t index) const
+{
+	ThreadPlacement placement(*this);
+	placement.mSpread = false;
+
+	if(!mName.empty())
+	{
+		std::stringstream name;
+		name << mName << "/" << index;
+		placement.mName = name.str();
+	}
+
+	if(mSpread)
+	{
+		std::vector<uint32> cpus = mCpus.empty() ? allCpus() : mCpus;
+		placement.mCpus.assign(1, cpus[index % cpus.size()]);
+	}
+
+	return placement;
+}
+
+bool ThreadPlacement::apply() const
+{
+#ifdef __linux__
+	return applyTo(pthread_self());
+#else
+	return false;
+#endif
+}
+
+bool ThreadPlacement::apply(boost::thread& thread) const
+{
+	return applyTo(thread.native_handle());
+}
+
+bool ThreadPlacement::applyTo(boost::thread::native_handle_type handle) const
+{
+#ifdef __linux__
+	bool success = true;
+
+	if(!mCpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(std::size_t i = 0; i < mCpus.size(); ++i)
+		{
+			if(mCpus[i] < CPU_SETSIZE)
+				CPU_SET(mCpus[i], &set);
+		}
+		success &= (pthread_setaffinity_np(handle, sizeof(set), &set) == 0);
+	}
+
+	if(!mName.empty())
+	{
+		// the kernel limit is 16 bytes including the terminating null
+		success &= (pthread_setname_np(handle, mName.substr(0, 15).c_str()) == 0);
+	}
+
+	if(mScheduling != scheduling_t::inherit)
+	{
+		int policy = SCHED_OTHER;
+		switch(mScheduling)
+		{
+		case scheduling_t::batch: policy = SCHED_BATCH; break;
+		case scheduling_t::idle: policy = SCHED_IDLE; break;
+		case scheduling_t::fifo: policy = SCHED_FIFO; break;
+		case scheduling_t::round_robin: policy = SCHED_RR; break;
+		default: break;
+		}
+
+		sched_param param;
+		param.sched_priority = (policy == SCHED_FIFO || policy == SCHED_RR) ? mPriority : 0;
+		success &= (pthread_setschedparam(handle, policy, &param) == 0);
+	}
+
+	return success;
+#else
+	UNUSED_ARGUMENT(handle);
+	return empty();
+#endif
+}
+
+uint32 ThreadPlacement::getCpuCount()
+{
+#ifdef __linux__
+	long count = ::sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (uint32)count : 1;
+#else
+	return std::max(boost::thread::hardware_concurrency(), 1U);
+#endif
+}
+
+uint32 ThreadPlacement::getNumaNodeCount()
+{
+	uint32 count = 0;
+	for(uint32 node = 0; ; ++node)
+	{
+		std::stringstream path;
+		path << "/sys/devices/system/node/node" << node << "/cpulist";
+		std::string list;
+		if(!readLine(path.str(), list)) break;
+		++count;
+	}
+	return count ? count : 1;
+}
+
+std::vector<uint32> ThreadPlacement::getCpusOfNumaNode(uint32 node)
+{
+	std::stringstream path;
+	path << "/sys/devices/system/node/node" << node << "/cpulist";
+
+	std::string list;
+	if(readLine(path.str(), list))
+		return parseCpuList(list);
+
+	return allCpus();
+}
+
+std::vector<uint32> ThreadPlacement::getCpusSharingCache(uint32 cpu)
+{
+	// pick the unified or data cache of the highest level
+	std::vector<uint32> cpus;
+	uint32 highest = 0;
+	for(uint32 index = 0; ; ++index)
+	{
+		std::stringstream dir;
+		dir << "/sys/devices/system/cpu/cpu" << cpu << "/cache/index" << index << "/";
+
+		std::string level, type, list;
+		if(!readLine(dir.str() + "level", level)) break;
+		if(readLine(dir.str() + "type", type) && type == "Instruction") continue;
+		if(!readLine(dir.str() + "shared_cpu_list", list)) continue;
+
+		uint32 l = 0;
+		std::stringstream(level) >> l;
+		if(l >= highest)
+		{
+			highest = l;
+			cpus = parseCpuList(list);
+		}
+	}
+
+	if(cpus.empty())
+		cpus.push_back(cpu);
+	return cpus;
+}
+
+}
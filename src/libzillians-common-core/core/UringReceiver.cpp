@@ -0,0 +1,359 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/UringReceiver.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+namespace zillians {
+
+namespace {
+
+/**
+ * The user data of cancellations, which are not reported.
+ */
+const uint64 CANCEL_USER_DATA = ~(uint64)0;
+
+// there's no liburing wrapper for these in glibc
+inline int io_uring_setup(uint32 entries, struct io_uring_params* params)
+{
+	return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+inline int io_uring_enter(int fd, uint32 submit, uint32 wait, uint32 flags)
+{
+	return (int)::syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+inline int io_uring_register(int fd, uint32 opcode, const void* arg, uint32 count)
+{
+	return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+inline uint32* ring_at(void* ring, uint32 offset)
+{
+	return reinterpret_cast<uint32*>(reinterpret_cast<byte*>(ring) + offset);
+}
+
+}
+
+UringReceiver::UringReceiver(uint32 entries) :
+	mRing(-1), mStarted(false), mRegistered(false), mEnterCount(0), mInflight(0),
+	mSqRing(MAP_FAILED), mSqRingSize(0), mCqRing(MAP_FAILED), mCqRingSize(0), mSqes((io_uring_sqe*)MAP_FAILED), mSqesSize(0)
+{
+	struct io_uring_params params;
+	::memset(&params, 0, sizeof(params));
+
+	mRing = io_uring_setup(entries, &params);
+	if(mRing < 0)
+		throw std::runtime_error(std::string("failed to setup io_uring: ") + ::strerror(errno));
+
+	mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+	mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+	mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	mSqRing = ::mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQ_RING);
+	if(mSqRing != MAP_FAILED)
+	{
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			mCqRing = mSqRing;
+		else
+			mCqRing = ::mmap(NULL, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_CQ_RING);
+	}
+	if(mCqRing != MAP_FAILED)
+		mSqes = (io_uring_sqe*)::mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRing, IORING_OFF_SQES);
+	if(mSqes == MAP_FAILED)
+	{
+		int error = errno;
+		if(mCqRing != MAP_FAILED && mCqRing != mSqRing) ::munmap(mCqRing, mCqRingSize);
+		if(mSqRing != MAP_FAILED) ::munmap(mSqRing, mSqRingSize);
+		::close(mRing);
+		throw std::runtime_error(std::string("failed to map io_uring: ") + ::strerror(error));
+	}
+
+	mSqHead = ring_at(mSqRing, params.sq_off.head);
+	mSqTail = ring_at(mSqRing, params.sq_off.tail);
+	mSqArray = ring_at(mSqRing, params.sq_off.array);
+	mSqMask = *ring_at(mSqRing, params.sq_off.ring_mask);
+	mSqEntries = params.sq_entries;
+	mSqLocalTail = mSqSubmitted = *mSqTail;
+
+	mCqHead = ring_at(mCqRing, params.cq_off.head);
+	mCqTail = ring_at(mCqRing, params.cq_off.tail);
+	mCqes = reinterpret_cast<io_uring_cqe*>(reinterpret_cast<byte*>(mCqRing) + params.cq_off.cqes);
+	mCqMask = *ring_at(mCqRing, params.cq_off.ring_mask);
+	mCqEntries = params.cq_entries;
+}
+
+UringReceiver::~UringReceiver()
+{
+	// the kernel may write into the buffers until every read is gone
+	for(uint32 id = 0; id < mSlots.size(); ++id)
+	{
+		if(mSlots[id].state != Slot::READING)
+			continue;
+
+		io_uring_sqe* sqe;
+		while((sqe = getSqe()) == NULL)
+			enter(mSqLocalTail - mSqSubmitted, 0);
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = id;
+		sqe->user_data = CANCEL_USER_DATA;
+	}
+
+	try
+	{
+		while(mInflight > 0 || mSqLocalTail != mSqSubmitted)
+		{
+			enter(mSqLocalTail - mSqSubmitted, mInflight > 0 ? 1 : 0);
+			reap(NULL);
+		}
+	}
+	catch(const std::runtime_error&)
+	{
+		// closing the ring cancels whatever is left
+	}
+
+	if(mRegistered)
+		io_uring_register(mRing, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+	::munmap(mSqes, mSqesSize);
+	if(mCqRing != mSqRing)
+		::munmap(mCqRing, mCqRingSize);
+	::munmap(mSqRing, mSqRingSize);
+	::close(mRing);
+}
+
+bool UringReceiver::isSupported()
+{
+	struct io_uring_params params;
+	::memset(&params, 0, sizeof(params));
+
+	int fd = io_uring_setup(1, &params);
+	if(fd < 0)
+		return false;
+
+	::close(fd);
+	return true;
+}
+
+void UringReceiver::start()
+{
+	BOOST_ASSERT(!mStarted);
+	mStarted = true;
+
+	if(!mSlots.empty())
+	{
+		std::vector<struct iovec> vectors(mSlots.size());
+		for(std::size_t i = 0; i < mSlots.size(); ++i)
+		{
+			vectors[i].iov_base = mSlots[i].memory.first;
+			vectors[i].iov_len = mSlots[i].memory.second;
+		}
+
+		// registration pins the pages, which may exceed RLIMIT_MEMLOCK, plain reads work anyway
+		mRegistered = (io_uring_register(mRing, IORING_REGISTER_BUFFERS, &vectors[0], (uint32)vectors.size()) == 0);
+	}
+
+	for(uint32 id = 0; id < mSlots.size(); ++id)
+		queue(id);
+}
+
+std::size_t UringReceiver::poll(std::vector<Completion>& completions, bool wait)
+{
+	BOOST_ASSERT(mStarted);
+
+	submitQueued();
+
+	uint32 submit = mSqLocalTail - mSqSubmitted;
+	bool ready = (__atomic_load_n(mCqTail, __ATOMIC_ACQUIRE) != *mCqHead);
+	uint32 min_complete = (wait && !ready && mInflight > 0) ? 1 : 0;
+
+	if(submit > 0 || min_complete > 0)
+		enter(submit, min_complete);
+
+	// reads queued by these completions go out with the next poll()
+	return reap(&completions);
+}
+
+bool UringReceiver::resume(uint32 id)
+{
+	BOOST_ASSERT(mStarted);
+	return queue(id);
+}
+
+bool UringReceiver::queue(uint32 id)
+{
+	Slot& slot = mSlots[id];
+	if(slot.state != Slot::IDLE)
+		return slot.state != Slot::CLOSED;
+
+	slot.ranges.clear();
+	if(slot.getFreeRanges(slot.buffer, slot.ranges) == 0)
+		return false;
+
+	slot.state = Slot::QUEUED;
+	mQueued.push_back(id);
+	submitQueued();
+	return true;
+}
+
+void UringReceiver::submitQueued()
+{
+	// one completion entry per read in flight, so the completion queue never overflows
+	while(!mQueued.empty() && mInflight < mCqEntries)
+	{
+		io_uring_sqe* sqe = getSqe();
+		if(!sqe)
+			break;
+
+		uint32 id = mQueued.front();
+		mQueued.pop_front();
+
+		Slot& slot = mSlots[id];
+		slot.ranges.clear();
+		slot.getFreeRanges(slot.buffer, slot.ranges);
+		BOOST_ASSERT(!slot.ranges.empty());
+
+		sqe->fd = slot.fd;
+		sqe->user_data = id;
+		if(slot.ranges.size() == 1)
+		{
+			sqe->opcode = mRegistered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+			sqe->addr = reinterpret_cast<uint64>(slot.ranges[0].first);
+			sqe->len = (uint32)slot.ranges[0].second;
+			sqe->buf_index = mRegistered ? (uint16)id : 0;
+		}
+		else
+		{
+			// the two ranges of a circular buffer
+			for(std::size_t i = 0; i < 2; ++i)
+			{
+				slot.vectors[i].iov_base = slot.ranges[i].first;
+				slot.vectors[i].iov_len = slot.ranges[i].second;
+			}
+			sqe->opcode = IORING_OP_READV;
+			sqe->addr = reinterpret_cast<uint64>(slot.vectors);
+			sqe->len = 2;
+		}
+
+		slot.state = Slot::READING;
+		++mInflight;
+	}
+}
+
+io_uring_sqe* UringReceiver::getSqe()
+{
+	uint32 head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+	if(mSqLocalTail - head == mSqEntries)
+		return NULL;
+
+	uint32 index = mSqLocalTail & mSqMask;
+	io_uring_sqe* sqe = &mSqes[index];
+	::memset(sqe, 0, sizeof(*sqe));
+	mSqArray[index] = index;
+	++mSqLocalTail;
+	return sqe;
+}
+
+void UringReceiver::enter(uint32 submit, uint32 wait)
+{
+	__atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+
+	while(true)
+	{
+		++mEnterCount;
+		int result = io_uring_enter(mRing, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+		if(result >= 0)
+		{
+			mSqSubmitted += (uint32)result;
+			return;
+		}
+		if(errno == EINTR)
+			continue;
+		if(errno == EAGAIN || errno == EBUSY)
+			return;
+
+		throw std::runtime_error(std::string("failed to enter io_uring: ") + ::strerror(errno));
+	}
+}
+
+std::size_t UringReceiver::reap(std::vector<Completion>* completions)
+{
+	std::size_t count = 0;
+
+	uint32 head = *mCqHead;
+	uint32 tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+	for(; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = mCqes[head & mCqMask];
+		if(cqe.user_data == CANCEL_USER_DATA)
+			continue;
+
+		uint32 id = (uint32)cqe.user_data;
+		int result = cqe.res;
+
+		Slot& slot = mSlots[id];
+		BOOST_ASSERT(slot.state == Slot::READING);
+		--mInflight;
+
+		if(result > 0)
+		{
+			slot.commit(slot.buffer, (std::size_t)result);
+			slot.state = Slot::IDLE;
+		}
+		else if(result == -EAGAIN || result == -EINTR)
+		{
+			// spurious wake-up of a non-blocking socket, read again without reporting
+			slot.state = Slot::IDLE;
+			if(completions)
+				queue(id);
+			continue;
+		}
+		else
+		{
+			slot.state = Slot::CLOSED;
+		}
+
+		if(completions)
+		{
+			Completion completion = { id, result };
+			completions->push_back(completion);
+			++count;
+
+			queue(id);
+		}
+	}
+	__atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+}
@@ -0,0 +1,210 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/BloomFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+
+namespace zillians {
+
+namespace {
+
+enum FilterTag
+{
+	TAG_BLOCKED = 0x31464242,	///< "BBF1"
+	TAG_COUNTING = 0x31464243,	///< "CBF1"
+};
+
+const std::size_t CACHE_LINE_SIZE = 64;
+
+template<typename T>
+T* allocateBlocks(std::size_t words)
+{
+	void* p = NULL;
+	if(posix_memalign(&p, CACHE_LINE_SIZE, std::max<std::size_t>(words * sizeof(T), CACHE_LINE_SIZE)) != 0)
+		throw std::bad_alloc();
+	memset(p, 0, words * sizeof(T));
+	return static_cast<T*>(p);
+}
+
+/**
+ * The false positive rate of a split block filter, averaged over the Poisson
+ * distributed number of keys per block. Blocks get unequal shares of the keys,
+ * so the rate is notably higher than that of a classic filter of the same size.
+ *
+ * @param slots The number of bits, or counters, per word.
+ */
+double falsePositiveRate(double keys, double blocks, double slots)
+{
+	const double lambda = keys / blocks;
+	const std::size_t last = (std::size_t)(lambda + 12.0 * std::sqrt(lambda) + 12.0);
+
+	double rate = 0.0;
+	double p = std::exp(-lambda);	// the probability of i keys in a block
+	for(std::size_t i = 0; i <= last; ++i)
+	{
+		rate += p * std::pow(1.0 - std::pow(1.0 - 1.0 / slots, (double)i), 8.0);
+		p *= lambda / (double)(i + 1);
+	}
+	return rate;
+}
+
+/**
+ * The fewest blocks reaching the given false positive rate, starting from the
+ * estimate of a classic filter and growing by 1% steps.
+ */
+std::size_t blocksFor(std::size_t expected, double false_positive_rate, double slots)
+{
+	const double keys = (double)std::max<std::size_t>(expected, 1);
+	false_positive_rate = std::min(std::max(false_positive_rate, 1e-9), 0.5);
+
+	const double bits = -8.0 * keys / std::log(1.0 - std::pow(false_positive_rate, 1.0 / 8.0));
+	double blocks = std::max(std::ceil(bits / (8.0 * slots)), 1.0);
+	while(falsePositiveRate(keys, blocks, slots) > false_positive_rate)
+		blocks = std::ceil(blocks * 1.01);
+	return (std::size_t)blocks;
+}
+
+/**
+ * Read the header written by serialize(), checking the whole filter is in the buffer.
+ */
+template<typename T>
+bool readHeader(Buffer& buffer, uint32 tag, std::size_t words_per_block, uint64& blocks)
+{
+	if(buffer.dataSize() < sizeof(uint32) + sizeof(uint64))
+		return false;
+
+	const std::size_t start = buffer.rpos();
+	uint32 t;
+	buffer >> t >> blocks;
+	if(t != tag || blocks == 0 || blocks > (std::numeric_limits<uint32>::max)() || buffer.dataSize() < blocks * words_per_block * sizeof(T))
+	{
+		buffer.rpos(start);
+		return false;
+	}
+	return true;
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+BlockedBloomFilter::BlockedBloomFilter(std::size_t expected, double false_positive_rate) : mBlocks(NULL), mBlockCount(0)
+{
+	allocate(blocksFor(expected, false_positive_rate));
+}
+
+BlockedBloomFilter::~BlockedBloomFilter()
+{
+	free(mBlocks);
+}
+
+void BlockedBloomFilter::clear()
+{
+	memset(mBlocks, 0, sizeInBytes());
+}
+
+bool BlockedBloomFilter::merge(const BlockedBloomFilter& other)
+{
+	if(other.mBlockCount != mBlockCount)
+		return false;
+
+	for(std::size_t i = 0; i < mBlockCount * BLOCK_WORDS; ++i)
+		mBlocks[i] |= other.mBlocks[i];
+	return true;
+}
+
+void BlockedBloomFilter::serialize(Buffer& buffer) const
+{
+	buffer << (uint32)TAG_BLOCKED << (uint64)mBlockCount;
+	buffer.writeArrayOrdered(mBlocks, mBlockCount * BLOCK_WORDS);
+}
+
+bool BlockedBloomFilter::deserialize(Buffer& buffer)
+{
+	uint64 blocks;
+	if(!readHeader<uint32>(buffer, TAG_BLOCKED, BLOCK_WORDS, blocks))
+		return false;
+
+	if(blocks != mBlockCount)
+		allocate(blocks);
+	buffer.readArrayOrdered(mBlocks, mBlockCount * BLOCK_WORDS);
+	return true;
+}
+
+std::size_t BlockedBloomFilter::blocksFor(std::size_t expected, double false_positive_rate)
+{
+	return zillians::blocksFor(expected, false_positive_rate, 32.0);
+}
+
+void BlockedBloomFilter::allocate(std::size_t blocks)
+{
+	uint32* p = allocateBlocks<uint32>(blocks * BLOCK_WORDS);
+	free(mBlocks);
+	mBlocks = p;
+	mBlockCount = blocks;
+}
+
+//////////////////////////////////////////////////////////////////////////
+CountingBloomFilter::CountingBloomFilter(std::size_t expected, double false_positive_rate) : mBlocks(NULL), mBlockCount(0)
+{
+	// a word has 16 counters instead of 32 bits
+	allocate(zillians::blocksFor(expected, false_positive_rate, 16.0));
+}
+
+CountingBloomFilter::~CountingBloomFilter()
+{
+	free(mBlocks);
+}
+
+void CountingBloomFilter::clear()
+{
+	memset(mBlocks, 0, sizeInBytes());
+}
+
+void CountingBloomFilter::serialize(Buffer& buffer) const
+{
+	buffer << (uint32)TAG_COUNTING << (uint64)mBlockCount;
+	buffer.writeArrayOrdered(mBlocks, mBlockCount * BLOCK_WORDS);
+}
+
+bool CountingBloomFilter::deserialize(Buffer& buffer)
+{
+	uint64 blocks;
+	if(!readHeader<uint64>(buffer, TAG_COUNTING, BLOCK_WORDS, blocks))
+		return false;
+
+	if(blocks != mBlockCount)
+		allocate(blocks);
+	buffer.readArrayOrdered(mBlocks, mBlockCount * BLOCK_WORDS);
+	return true;
+}
+
+void CountingBloomFilter::allocate(std::size_t blocks)
+{
+	uint64* p = allocateBlocks<uint64>(blocks * BLOCK_WORDS);
+	free(mBlocks);
+	mBlocks = p;
+	mBlockCount = blocks;
+}
+
+}
@@ -21,6 +21,9 @@
  */
 
 #include "utility/DemanglingUtil.h"
+#include <tbb/concurrent_unordered_map.h>
+#include <functional>
+#include <memory>
 
 #if defined(__GNUC__)
     #include <cxxabi.h>
@@ -29,7 +32,9 @@
 
 namespace zillians {
 
-std::string demangle(const std::type_info &ti)
+namespace {
+
+std::string demangleName(const std::type_info &ti)
 {
 #if defined(__GNUC__)
 
@@ -49,4 +54,30 @@ std::string demangle(const std::type_info &ti)
     return ti.name();
 }
 
+// the standard allocator keeps the names visible to leak checkers, the TBB one hides them
+typedef tbb::concurrent_unordered_map<const std::type_info*, std::string,
+		std::hash<const std::type_info*>, std::equal_to<const std::type_info*>,
+		std::allocator<std::pair<const std::type_info* const, std::string> > > DemangledNames;
+
+DemangledNames& demangledNames()
+{
+	// never destroyed, names are still asked for by loggers in static destructors
+	static DemangledNames* names = new DemangledNames();
+	return *names;
+}
+
+}
+
+const std::string& demangle(const std::type_info &ti)
+{
+	// elements of the map never move, so the name can be handed out once it's in
+	DemangledNames& names = demangledNames();
+	DemangledNames::const_iterator it = names.find(&ti);
+	if(it != names.end())
+		return it->second;
+
+	// racing threads may demangle the same type, only the first insertion is kept
+	return names.insert(std::make_pair(&ti, demangleName(ti))).first->second;
+}
+
 }
@@ -0,0 +1,453 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/DependencySnapshot.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace zillians {
+
+//////////////////////////////////////////////////////////////////////////
+log4cxx::LoggerPtr DependencySnapshot::mLogger(log4cxx::Logger::getLogger("zillians.utility.DependencySnapshot"));
+
+/**
+ * The file starts with the header, followed by the sections at the recorded
+ * offsets, each one aligned to eight bytes.
+ */
+struct DependencySnapshot::Header
+{
+	char magic[8];
+	uint32 version;
+	uint32 byteOrder;
+
+	uint32 nodeCount;
+	uint32 edgeCount;
+	uint32 nameSize;		///< Size of the name section, including the terminating nulls
+	uint32 bucketCount;		///< Size of the hash table, a power of two larger than nodeCount
+	uint64 fileSize;
+
+	uint64 outOffsets;		///< uint32[nodeCount + 1]
+	uint64 outTargets;		///< NodeId[edgeCount], the requirements of each node sorted by id
+	uint64 inOffsets;		///< uint32[nodeCount + 1]
+	uint64 inSources;		///< NodeId[edgeCount], the dependents of each node sorted by id
+	uint64 nameOffsets;		///< uint32[nodeCount + 1]
+	uint64 buckets;			///< NodeId[bucketCount]
+	uint64 names;			///< char[nameSize]
+};
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = { 'Z', 'D', 'E', 'P', 'S', 'N', 'A', 'P' };
+const uint32 SNAPSHOT_VERSION = 1;
+const uint32 SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+/// FNV-1a, which unlike boost::hash gives the same value in every build
+inline uint64 hashName(const char* name, std::size_t length)
+{
+	uint64 h = 14695981039346656037ULL;
+	for(std::size_t i = 0; i < length; ++i)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+inline uint64 alignSection(uint64 offset)
+{
+	return (offset + 7) & ~(uint64)7;
+}
+
+template<typename T>
+inline void copySection(std::vector<char>& image, uint64 offset, const std::vector<T>& section)
+{
+	if(!section.empty())
+		std::memcpy(&image[offset], &section[0], section.size() * sizeof(T));
+}
+
+}
+
+DependencySnapshot::DependencySnapshot() :
+	mData(NULL), mSize(0), mNameOffsets(NULL), mNames(NULL), mBuckets(NULL), mBucketMask(0)
+{ }
+
+DependencySnapshot::~DependencySnapshot()
+{
+	close();
+}
+
+bool DependencySnapshot::open(const std::string& path, bool verify)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		LOG4CXX_ERROR(mLogger, "fail to open snapshot \"" << path << "\": " << ::strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if(::fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(Header))
+	{
+		LOG4CXX_ERROR(mLogger, "fail to open snapshot \"" << path << "\": not a snapshot");
+		::close(fd);
+		return false;
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	void* data = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(data == MAP_FAILED)
+	{
+		LOG4CXX_ERROR(mLogger, "fail to map snapshot \"" << path << "\": " << ::strerror(errno));
+		return false;
+	}
+
+	mData = static_cast<byte*>(data);
+	mSize = st.st_size;
+	if(!validate(mSize, verify))
+	{
+		LOG4CXX_ERROR(mLogger, "fail to open snapshot \"" << path << "\": corrupted or incompatible snapshot");
+		close();
+		return false;
+	}
+	return true;
+}
+
+void DependencySnapshot::close()
+{
+	if(mData)
+		::munmap(mData, mSize);
+
+	mData = NULL;
+	mSize = 0;
+	mGraph = compact_digraph_view();
+	mNameOffsets = NULL;
+	mNames = NULL;
+	mBuckets = NULL;
+	mBucketMask = 0;
+}
+
+bool DependencySnapshot::write(const std::string& path, const std::vector<std::string>& names, const std::vector<uint32>& offsets, const std::vector<NodeId>& requirements)
+{
+	const std::size_t n = names.size();
+	if(n >= invalidNodeId() || offsets.size() != n + 1 || offsets[0] != 0 || offsets[n] != requirements.size() || requirements.size() > 0xFFFFFFFFU)
+	{
+		LOG4CXX_ERROR(mLogger, "fail to write snapshot: malformed graph");
+		return false;
+	}
+
+	// requirements of each node sorted, and the dependents gathered by counting sort,
+	// visiting the nodes in order leaves them sorted as well
+	std::vector<NodeId> outTargets(requirements);
+	std::vector<uint32> inOffsets(n + 1, 0);
+	for(std::size_t u = 0; u < n; ++u)
+	{
+		if(offsets[u + 1] < offsets[u])
+		{
+			LOG4CXX_ERROR(mLogger, "fail to write snapshot: malformed graph");
+			return false;
+		}
+
+		std::sort(outTargets.begin() + offsets[u], outTargets.begin() + offsets[u + 1]);
+		for(uint32 i = offsets[u]; i < offsets[u + 1]; ++i)
+		{
+			if(outTargets[i] >= u || (i > offsets[u] && outTargets[i] == outTargets[i - 1]))
+			{
+				LOG4CXX_ERROR(mLogger, "fail to write snapshot: " << names[u] << " has a duplicated requirement or one not before it in load order");
+				return false;
+			}
+			++inOffsets[outTargets[i] + 1];
+		}
+	}
+	for(std::size_t v = 0; v < n; ++v)
+		inOffsets[v + 1] += inOffsets[v];
+
+	std::vector<NodeId> inSources(outTargets.size());
+	{
+		std::vector<uint32> next(inOffsets.begin(), inOffsets.end() - 1);
+		for(std::size_t u = 0; u < n; ++u)
+			for(uint32 i = offsets[u]; i < offsets[u + 1]; ++i)
+				inSources[next[outTargets[i]]++] = u;
+	}
+
+	// interned names and the hash table on them, at most half full
+	std::vector<uint32> nameOffsets(n + 1, 0);
+	uint64 nameSize = 0;
+	for(std::size_t u = 0; u < n; ++u)
+	{
+		nameSize += names[u].size() + 1;
+		if(nameSize > 0xFFFFFFFFU)
+		{
+			LOG4CXX_ERROR(mLogger, "fail to write snapshot: too many names");
+			return false;
+		}
+		nameOffsets[u + 1] = nameSize;
+	}
+
+	uint32 bucketCount = 1;
+	while(bucketCount <= n * 2)
+		bucketCount <<= 1;
+	std::vector<NodeId> buckets(bucketCount, invalidNodeId());
+	for(std::size_t u = 0; u < n; ++u)
+	{
+		uint32 b = hashName(names[u].data(), names[u].size()) & (bucketCount - 1);
+		while(buckets[b] != invalidNodeId())
+		{
+			if(names[buckets[b]] == names[u])
+			{
+				LOG4CXX_ERROR(mLogger, "fail to write snapshot: duplicated node " << names[u]);
+				return false;
+			}
+			b = (b + 1) & (bucketCount - 1);
+		}
+		buckets[b] = u;
+	}
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.nodeCount = n;
+	header.edgeCount = outTargets.size();
+	header.nameSize = nameSize;
+	header.bucketCount = bucketCount;
+	header.outOffsets = alignSection(sizeof(Header));
+	header.outTargets = alignSection(header.outOffsets + offsets.size() * sizeof(uint32));
+	header.inOffsets = alignSection(header.outTargets + outTargets.size() * sizeof(NodeId));
+	header.inSources = alignSection(header.inOffsets + inOffsets.size() * sizeof(uint32));
+	header.nameOffsets = alignSection(header.inSources + inSources.size() * sizeof(NodeId));
+	header.buckets = alignSection(header.nameOffsets + nameOffsets.size() * sizeof(uint32));
+	header.names = alignSection(header.buckets + buckets.size() * sizeof(NodeId));
+	header.fileSize = header.names + nameSize;
+
+	std::vector<char> image(header.fileSize, 0);
+	std::memcpy(&image[0], &header, sizeof(header));
+	copySection(image, header.outOffsets, offsets);
+	copySection(image, header.outTargets, outTargets);
+	copySection(image, header.inOffsets, inOffsets);
+	copySection(image, header.inSources, inSources);
+	copySection(image, header.nameOffsets, nameOffsets);
+	copySection(image, header.buckets, buckets);
+	for(std::size_t u = 0; u < n; ++u)
+		std::memcpy(&image[header.names + nameOffsets[u]], names[u].c_str(), names[u].size() + 1);
+
+	// write aside and rename, so a reader never maps a partially written snapshot
+	const std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		file.write(&image[0], image.size());
+		file.close();
+		if(!file)
+		{
+			LOG4CXX_ERROR(mLogger, "fail to write snapshot \"" << temporary << "\"");
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	if(std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		LOG4CXX_ERROR(mLogger, "fail to replace snapshot \"" << path << "\": " << ::strerror(errno));
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+DependencySnapshot::NodeId DependencySnapshot::getNodeId(const std::string& id) const
+{
+	if(!mBuckets)
+		return invalidNodeId();
+
+	uint32 b = hashName(id.data(), id.size()) & mBucketMask;
+	for(uint32 probe = 0; probe <= mBucketMask; ++probe)
+	{
+		NodeId node = mBuckets[b];
+		if(node == invalidNodeId())
+			break;
+		if(getNodeNameLength(node) == id.size() && std::memcmp(getNodeName(node), id.data(), id.size()) == 0)
+			return node;
+		b = (b + 1) & mBucketMask;
+	}
+	return invalidNodeId();
+}
+
+const char* DependencySnapshot::getNodeName(NodeId node) const
+{
+	BOOST_ASSERT(mGraph.isVertex(node));
+	return mNames + mNameOffsets[node];
+}
+
+std::size_t DependencySnapshot::getNodeNameLength(NodeId node) const
+{
+	BOOST_ASSERT(mGraph.isVertex(node));
+	return mNameOffsets[node + 1] - mNameOffsets[node] - 1;
+}
+
+bool DependencySnapshot::isDependencyExist(NodeId node, NodeId require_node) const
+{
+	return mGraph.hasEdge(node, require_node);
+}
+
+bool DependencySnapshot::compileRequireNodes(NodeId node, std::vector<NodeId>& result) const
+{
+	if(!mGraph.isVertex(node))
+		return false;
+
+	// ids are positions in load order
+	compileClosure(node, true, result);
+	std::sort(result.begin(), result.end());
+	return true;
+}
+
+bool DependencySnapshot::compileDependentNodes(NodeId node, std::vector<NodeId>& result) const
+{
+	if(!mGraph.isVertex(node))
+		return false;
+
+	compileClosure(node, false, result);
+	std::sort(result.begin(), result.end(), std::greater<NodeId>());
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void DependencySnapshot::compileClosure(NodeId node, bool requirements, std::vector<NodeId>& result) const
+{
+	result.clear();
+	std::vector<bool> mask(mGraph.vertexCount(), false);
+	std::vector<NodeId> stack(1, node);
+	while(!stack.empty())
+	{
+		NodeId u = stack.back();
+		stack.pop_back();
+
+		compact_digraph_view::edge_range edges = requirements ? mGraph.outEdges(u) : mGraph.inEdges(u);
+		for(compact_digraph_view::edge_range::const_iterator it = edges.begin(); it != edges.end(); ++it)
+		{
+			if(!mask[*it])
+			{
+				mask[*it] = true;
+				result.push_back(*it);
+				stack.push_back(*it);
+			}
+		}
+	}
+}
+
+bool DependencySnapshot::validate(std::size_t size, bool verify)
+{
+	const Header& header = *reinterpret_cast<const Header*>(mData);
+	if(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != SNAPSHOT_VERSION || header.byteOrder != SNAPSHOT_BYTE_ORDER || header.fileSize != size)
+		return false;
+
+	const uint64 n = header.nodeCount;
+	const uint64 e = header.edgeCount;
+	struct { uint64 offset; uint64 bytes; } sections[] = {
+		{ header.outOffsets, (n + 1) * sizeof(uint32) },
+		{ header.outTargets, e * sizeof(NodeId) },
+		{ header.inOffsets, (n + 1) * sizeof(uint32) },
+		{ header.inSources, e * sizeof(NodeId) },
+		{ header.nameOffsets, (n + 1) * sizeof(uint32) },
+		{ header.buckets, (uint64)header.bucketCount * sizeof(NodeId) },
+		{ header.names, header.nameSize },
+	};
+	for(std::size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); ++i)
+	{
+		if(sections[i].offset % 8 != 0 || sections[i].offset < sizeof(Header) || sections[i].offset > size || sections[i].bytes > size - sections[i].offset)
+			return false;
+	}
+	if(header.bucketCount <= n || (header.bucketCount & (header.bucketCount - 1)) != 0)
+		return false;
+
+	const uint32* outOffsets = reinterpret_cast<const uint32*>(mData + header.outOffsets);
+	const NodeId* outTargets = reinterpret_cast<const NodeId*>(mData + header.outTargets);
+	const uint32* inOffsets = reinterpret_cast<const uint32*>(mData + header.inOffsets);
+	const NodeId* inSources = reinterpret_cast<const NodeId*>(mData + header.inSources);
+	const uint32* nameOffsets = reinterpret_cast<const uint32*>(mData + header.nameOffsets);
+	if(outOffsets[n] != e || inOffsets[n] != e || nameOffsets[n] != header.nameSize)
+		return false;
+
+	mGraph = compact_digraph_view(n, outOffsets, outTargets, inOffsets, inSources);
+	mNameOffsets = nameOffsets;
+	mNames = reinterpret_cast<const char*>(mData + header.names);
+	mBuckets = reinterpret_cast<const NodeId*>(mData + header.buckets);
+	mBucketMask = header.bucketCount - 1;
+
+	if(!verify)
+		return true;
+
+	// the offsets sizing every list, then the lists themselves
+	if(outOffsets[0] != 0 || inOffsets[0] != 0 || nameOffsets[0] != 0)
+		return false;
+	for(uint32 u = 0; u < n; ++u)
+	{
+		if(outOffsets[u + 1] < outOffsets[u] || outOffsets[u + 1] > e || inOffsets[u + 1] < inOffsets[u] || inOffsets[u + 1] > e)
+			return false;
+		if(nameOffsets[u + 1] <= nameOffsets[u] || nameOffsets[u + 1] > header.nameSize)
+			return false;
+		if(mNames[nameOffsets[u + 1] - 1] != '\0')
+			return false;
+
+		compact_digraph_view::edge_range out = mGraph.outEdges(u);
+		for(const NodeId* it = out.begin(); it != out.end(); ++it)
+		{
+			if(*it >= u || (it != out.begin() && *it <= *(it - 1)))
+				return false;
+		}
+		compact_digraph_view::edge_range in = mGraph.inEdges(u);
+		for(const NodeId* it = in.begin(); it != in.end(); ++it)
+		{
+			if(*it >= n || *it <= u || (it != in.begin() && *it <= *(it - 1)))
+				return false;
+		}
+	}
+	for(uint32 b = 0; b <= mBucketMask; ++b)
+	{
+		if(mBuckets[b] != invalidNodeId() && mBuckets[b] >= n)
+			return false;
+	}
+	for(uint32 u = 0; u < n; ++u)
+	{
+		compact_digraph_view::edge_range out = mGraph.outEdges(u);
+		for(const NodeId* it = out.begin(); it != out.end(); ++it)
+		{
+			compact_digraph_view::edge_range in = mGraph.inEdges(*it);
+			if(!std::binary_search(in.begin(), in.end(), u))
+				return false;
+		}
+		if(getNodeId(std::string(getNodeName(u), getNodeNameLength(u))) != u)
+			return false;
+	}
+	return true;
+}
+
+}
@@ -21,17 +21,20 @@
  */
 
 #include "utility/DependencySolver.h"
+#include "utility/DependencySnapshot.h"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <boost/thread/locks.hpp>
+#include <algorithm>
 
 namespace zillians {
 
 //////////////////////////////////////////////////////////////////////////
 log4cxx::LoggerPtr DependencySolver::mLogger(log4cxx::Logger::getLogger("zillians.utility.DependencySolver"));
 
-DependencySolver::DependencySolver()
+DependencySolver::DependencySolver() : mOrderHoles(0)
 {
-	// set the property map
-	mIndex = get(boost::vertex_index, mDependencyGraph);
-	mGroupFlag = get(boost::vertex_color, mDependencyGraph);
+	mClosureCount[0] = mClosureCount[1] = 0;
 }
 
 DependencySolver::~DependencySolver()
@@ -43,16 +46,28 @@ bool DependencySolver::addNode(const std::string& id)
 {
 	// add given node to the dependency graph
 	//LOG4CXX_DEBUG(mLogger, "add node " << id);
-	try
+	if(mNodeIds.find(id) != mNodeIds.end())
 	{
-		VertexDescriptor vd;
-		vd = add_vertex(id, mDependencyGraph, mMapping);
+		LOG4CXX_ERROR(mLogger, "fail to add node : duplicated node " << id);
+		return false;
 	}
-	catch(std::invalid_argument& ia)
+
+	NodeId node = mGraph.addVertex();
+	if(node >= mNodeNames.size())
+		mNodeNames.resize(node + 1);
+	mNodeNames[node] = id;
+	mNodeIds[id] = node;
+
+	// a new node has no dependency yet, so it can go anywhere in the load order
+	if(node >= mPosition.size())
 	{
-		LOG4CXX_ERROR(mLogger, "fail to add node : " << ia.what());
-		return false;
+		mPosition.resize(node + 1);
+		mVisited.resize(node + 1, false);
+		mRequireClosures.resize(node + 1);
+		mDependentClosures.resize(node + 1);
 	}
+	mPosition[node] = mOrder.size();
+	mOrder.push_back(node);
 	return true;
 }
 
@@ -60,149 +75,259 @@ bool DependencySolver::addDependency(const std::string& id, const std::string& r
 {
 	// add dependency between the given nodes
 	//LOG4CXX_DEBUG(mLogger, "add dependency " << id << " " << require_id);
-	try
+	NodeId node = getNodeId(id);
+	NodeId require_node = getNodeId(require_id);
+	if(node == invalidNodeId() || require_node == invalidNodeId())
 	{
-		static int increment_number = 0;
-		increment_number++;
-		Graph::edge_descriptor newEdge = add_edge(increment_number, id, require_id, mDependencyGraph, mMapping);
-	}
-	catch(std::invalid_argument& ia)
-	{
-		LOG4CXX_ERROR(mLogger, "fail to add dependency: " << ia.what());
+		LOG4CXX_ERROR(mLogger, "fail to add dependency: invalid node " << id << " or " << require_id);
 		return false;
 	}
-	//LOG4CXX_DEBUG(mLogger, "successfully add dependency " << id << " " << require_id);
-	return true;
+	return addDependency(node, require_node);
 }
 
 bool DependencySolver::removeNode(const std::string& id)
 {
 	// remove given node from the dependency graph
 	//LOG4CXX_DEBUG(mLogger, "remove node " << id);
-	try
+	NodeId node = getNodeId(id);
+	if(node == invalidNodeId())
 	{
-		clear_vertex(id, mDependencyGraph, mMapping);
-		remove_vertex(id, mDependencyGraph, mMapping);
-	}
-	catch(std::invalid_argument& ia)
-	{
-		LOG4CXX_ERROR(mLogger, "fail to remove node: " << ia.what());
+		LOG4CXX_ERROR(mLogger, "fail to remove node: invalid node " << id);
 		return false;
 	}
-	return true;
+	return removeNode(node);
 }
 
 bool DependencySolver::removeDependency(const std::string& id, const std::string& require_id)
 {
 	// remove dependency between the given nodes
 	//LOG4CXX_DEBUG(mLogger, "remove dependency " << id << " " << require_id);
-	try
+	NodeId node = getNodeId(id);
+	NodeId require_node = getNodeId(require_id);
+	if(node == invalidNodeId() || require_node == invalidNodeId())
 	{
-		remove_edge(id, require_id, mDependencyGraph, mMapping);
-	}
-	catch(std::invalid_argument& ia)
-	{
-		LOG4CXX_ERROR(mLogger, "fail to remove dependency: " << ia.what());
+		LOG4CXX_ERROR(mLogger, "fail to remove dependency: invalid node " << id << " or " << require_id);
 		return false;
 	}
-	return true;
+	return removeDependency(node, require_node);
 }
 
 bool DependencySolver::isNodeExist(const std::string& id)
 {
 	// return if the node with specified id exist in the graph
-	try
+	return getNodeId(id) != invalidNodeId();
+}
+
+bool DependencySolver::isDependencyExist(const std::string& id, const std::string& require_id)
+{
+	// return if the dependency between the given nodes exist in the graph
+	return isDependencyExist(getNodeId(id), getNodeId(require_id));
+}
+
+void DependencySolver::clear()
+{
+	// clear the dependency graph, remove all nodes and dependencies
+	//LOG4CXX_DEBUG(mLogger, "clear dependency graph");
+	mGraph.clear();
+	mNodeIds.clear();
+	mNodeNames.clear();
+	mPosition.clear();
+	mOrder.clear();
+	mOrderHoles = 0;
+	mVisited.clear();
+	invalidateClosures();
+	mRequireClosures.clear();
+	mDependentClosures.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+DependencySolver::NodeId DependencySolver::getNodeId(const std::string& id) const
+{
+	boost::unordered_map<std::string, NodeId>::const_iterator it = mNodeIds.find(id);
+	return (it == mNodeIds.end()) ? invalidNodeId() : it->second;
+}
+
+const std::string& DependencySolver::getNodeName(NodeId node) const
+{
+	BOOST_ASSERT(mGraph.isVertex(node));
+	return mNodeNames[node];
+}
+
+bool DependencySolver::addDependency(NodeId node, NodeId require_node)
+{
+	if(!mGraph.isVertex(node) || !mGraph.isVertex(require_node) || mGraph.hasEdge(node, require_node))
 	{
-		vertex(id, mDependencyGraph, mMapping);
+		LOG4CXX_ERROR(mLogger, "fail to add dependency: invalid or duplicated dependency");
+		return false;
 	}
-	catch(std::invalid_argument& ia)
+
+	// an already satisfied order is left as it is, otherwise the memoized closures
+	// of the moved nodes are no longer in load order
+	const bool ordered = mPosition[require_node] < mPosition[node];
+	if(!reorder(node, require_node))
 	{
+		LOG4CXX_ERROR(mLogger, "fail to add dependency: " << mNodeNames[node] << " requiring " << mNodeNames[require_node] << " introduces a cycle");
 		return false;
 	}
+
+	mGraph.addEdge(node, require_node);
+	if(ordered)
+	{
+		invalidateClosures(node, true);
+		invalidateClosures(require_node, false);
+	}
+	else
+		invalidateClosures();
 	return true;
 }
 
-bool DependencySolver::isDependencyExist(const std::string& id, const std::string& require_id)
+bool DependencySolver::removeNode(NodeId node)
 {
-	// return if the node with specified id exist in the graph
-	try
+	if(!mGraph.isVertex(node))
 	{
-		edge(id, require_id, mDependencyGraph, mMapping);
+		LOG4CXX_ERROR(mLogger, "fail to remove node: invalid node id " << node);
+		return false;
 	}
-	catch(std::invalid_argument& ia)
+
+	invalidateClosures(node, true);
+	invalidateClosures(node, false);
+
+	mNodeIds.erase(mNodeNames[node]);
+	std::string().swap(mNodeNames[node]);
+	mGraph.removeVertex(node);
+
+	// removing a node never breaks the order of the others, just leave a hole
+	mOrder[mPosition[node]] = invalidNodeId();
+	if(++mOrderHoles > 64 && mOrderHoles * 2 > mOrder.size())
+		compactOrder();
+	return true;
+}
+
+bool DependencySolver::removeDependency(NodeId node, NodeId require_node)
+{
+	if(!mGraph.removeEdge(node, require_node))
 	{
+		LOG4CXX_ERROR(mLogger, "fail to remove dependency: dependency does not exist");
 		return false;
 	}
+
+	invalidateClosures(node, true);
+	invalidateClosures(require_node, false);
 	return true;
 }
 
-void DependencySolver::clear()
+bool DependencySolver::isDependencyExist(NodeId node, NodeId require_node) const
 {
-	// clear the dependency graph, remove all nodes and dependencies
-	//LOG4CXX_DEBUG(mLogger, "clear dependency graph");
-	zillians::clear(mDependencyGraph, mMapping);
+	return mGraph.hasEdge(node, require_node);
 }
 
-bool DependencySolver::compileTopologicalOrder(std::list<std::string>& result)
+bool DependencySolver::compileRequireNodes(NodeId node, std::vector<NodeId>& result) const
 {
-	// compile the complete list to load node (by topological sort)
-	//LOG4CXX_DEBUG(mLogger, "compile topological ordering");
-	std::list<VertexDescriptor> make_order;
-	try
-	{
-		boost::graph_traits<Graph>::vertex_iterator vi, vi_end;
-		boost::graph_traits<Graph>::vertices_size_type cnt = 0;
-		for(boost::tie(vi,vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-			put(mIndex, *vi, cnt++);
+	if(!mGraph.isVertex(node))
+		return false;
 
-		boost::topological_sort(mDependencyGraph, std::front_inserter(make_order));
-		std::list<VertexDescriptor>::iterator it, it_end = make_order.end();
-		for (it = make_order.begin(); it != it_end; ++it)
-		{
-			result.push_front(vertex_ref(*it, mDependencyGraph, mMapping));
-		}
+	Closure closure = getClosure(node, true);
+	result.assign(closure->begin(), closure->end());
+	return true;
+}
+
+bool DependencySolver::compileDependentNodes(NodeId node, std::vector<NodeId>& result) const
+{
+	if(!mGraph.isVertex(node))
+		return false;
+
+	Closure closure = getClosure(node, false);
+	result.assign(closure->rbegin(), closure->rend());
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool DependencySolver::save(const std::string& path) const
+{
+	// renumber the nodes by load order, which skips the holes left by removed nodes
+	std::vector<NodeId> renumbered(mGraph.vertexCapacity(), invalidNodeId());
+	std::vector<std::string> names;
+	names.reserve(mGraph.vertexCount());
+	for(std::vector<NodeId>::const_iterator it = mOrder.begin(); it != mOrder.end(); ++it)
+	{
+		if(*it == invalidNodeId())
+			continue;
+		renumbered[*it] = names.size();
+		names.push_back(mNodeNames[*it]);
 	}
-	catch(const boost::not_a_dag &nad)
+
+	std::vector<uint32> offsets(1, 0);
+	std::vector<NodeId> requirements;
+	offsets.reserve(names.size() + 1);
+	for(std::vector<NodeId>::const_iterator it = mOrder.begin(); it != mOrder.end(); ++it)
 	{
-		LOG4CXX_ERROR(mLogger, "dependency graph is not a DAG, topological sort failed: " << nad.what());
+		if(*it == invalidNodeId())
+			continue;
+		const compact_digraph::edge_list& edges = mGraph.outEdges(*it);
+		for(compact_digraph::edge_list::const_iterator e = edges.begin(); e != edges.end(); ++e)
+			requirements.push_back(renumbered[*e]);
+		offsets.push_back(requirements.size());
+	}
+
+	return DependencySnapshot::write(path, names, offsets, requirements);
+}
+
+bool DependencySolver::load(const std::string& path)
+{
+	DependencySnapshot snapshot;
+	if(!snapshot.open(path))
 		return false;
+	return load(snapshot);
+}
+
+bool DependencySolver::load(const DependencySnapshot& snapshot)
+{
+	if(!snapshot.isOpen())
+		return false;
+
+	clear();
+
+	// the snapshot is in load order already, node i is at position i
+	const std::size_t n = snapshot.getNodeCount();
+	mGraph.assign(snapshot.getGraph());
+	mNodeNames.resize(n);
+	mNodeIds.rehash(n);
+	mPosition.resize(n);
+	mOrder.resize(n);
+	for(NodeId u = 0; u < n; ++u)
+	{
+		mNodeNames[u].assign(snapshot.getNodeName(u), snapshot.getNodeNameLength(u));
+		mNodeIds[mNodeNames[u]] = u;
+		mPosition[u] = u;
+		mOrder[u] = u;
 	}
-	catch(std::invalid_argument& ia)
+	mVisited.assign(n, false);
+	mRequireClosures.resize(n);
+	mDependentClosures.resize(n);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool DependencySolver::compileTopologicalOrder(std::list<std::string>& result)
+{
+	// compile the complete list to load node (requirements first)
+	//LOG4CXX_DEBUG(mLogger, "compile topological ordering");
+	for(std::vector<NodeId>::iterator it = mOrder.begin(); it != mOrder.end(); ++it)
 	{
-		LOG4CXX_ERROR(mLogger, "fail to compile node load order: " << ia.what());
-		return false;
+		if(*it != invalidNodeId())
+			result.push_back(mNodeNames[*it]);
 	}
 	return true;
 }
 
 bool DependencySolver::compileReversedTopologicalOrder(std::list<std::string>& result)
 {
-	// compile the complete list to unload node (by reversed topological sort)
+	// compile the complete list to unload node (dependents first)
 	//LOG4CXX_DEBUG(mLogger, "compile node unload order");
-	std::list<VertexDescriptor> make_order;
-	try
+	for(std::vector<NodeId>::iterator it = mOrder.begin(); it != mOrder.end(); ++it)
 	{
-		boost::graph_traits<Graph>::vertex_iterator vi, vi_end;
-		boost::graph_traits<Graph>::vertices_size_type cnt = 0;
-		for(boost::tie(vi,vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-			put(mIndex, *vi, cnt++);
-
-		boost::topological_sort(mDependencyGraph, std::front_inserter(make_order));
-		std::list<VertexDescriptor>::iterator it, it_end = make_order.end();
-		for (it = make_order.begin(); it != it_end; ++it)
-		{
-			result.push_back(vertex_ref(*it, mDependencyGraph, mMapping));
-		}
-	}
-	catch(const boost::not_a_dag &nad)
-	{
-		LOG4CXX_ERROR(mLogger, "dependency graph is not a DAG, topological sort failed: " << nad.what());
-		return false;
-	}
-	catch(std::invalid_argument& ia)
-	{
-		LOG4CXX_ERROR(mLogger, "fail to compile node unload order: " << ia.what());
-		return false;
+		if(*it != invalidNodeId())
+			result.push_front(mNodeNames[*it]);
 	}
 	return true;
 }
@@ -212,37 +337,16 @@ bool DependencySolver::compileRequireNodes(/*IN*/ const std::string& id, /*OUT*/
 	// find the list of node required by the given node
 	// sorted by load order, exclude the given node
 	//LOG4CXX_DEBUG(mLogger, "compile require node of " << id);
-	vertex_iter vi, vi_end;
-	for(boost::tie(vi, vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-	{
-		mGroupFlag[*vi] = false;
-	}
-	findRequireNode(vertex(id, mDependencyGraph, mMapping));
-	try
-	{
-		boost::graph_traits<Graph>::vertex_iterator vi, vi_end;
-		boost::graph_traits<Graph>::vertices_size_type cnt = 0;
-		for(boost::tie(vi,vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-			put(mIndex, *vi, cnt++);
-		std::list<VertexDescriptor> make_order;
-		boost::topological_sort(mDependencyGraph, std::front_inserter(make_order));
-		std::list<VertexDescriptor>::iterator it = make_order.begin(), it_end = make_order.end();
-		for (; it != it_end; ++it)
-		{
-			if(mGroupFlag[*it])
-				result.push_front(vertex_ref(*it, mDependencyGraph, mMapping));
-		}
-	}
-	catch(const boost::not_a_dag &nad)
+	NodeId node = getNodeId(id);
+	if(node == invalidNodeId())
 	{
-		LOG4CXX_ERROR(mLogger, "dependency graph is not a DAG, topological sort failed : " << nad.what());
-		return false;
-	}
-	catch(std::invalid_argument& ia)
-	{
-		LOG4CXX_ERROR(mLogger, "compile require nodes: " << ia.what());
+		LOG4CXX_ERROR(mLogger, "compile require nodes: invalid node " << id);
 		return false;
 	}
+
+	Closure closure = getClosure(node, true);
+	for(std::vector<NodeId>::const_iterator it = closure->begin(); it != closure->end(); ++it)
+		result.push_back(mNodeNames[*it]);
 	return true;
 }
 
@@ -251,69 +355,360 @@ bool DependencySolver::compileDependentNodes(/*IN*/ const std::string& id, /*OUT
 	// find the list of nodes which depend on the given node
 	// sorted by unload order, exclude the given node
 	//LOG4CXX_DEBUG(mLogger, "compile dependent nodes of " << id);
-	vertex_iter vi, vi_end;
-	for(boost::tie(vi, vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-	{
-		mGroupFlag[*vi] = false;
-	}
-	findDependentNode(vertex(id, mDependencyGraph, mMapping));
-	try
-	{
-		boost::graph_traits<Graph>::vertex_iterator vi, vi_end;
-		boost::graph_traits<Graph>::vertices_size_type cnt = 0;
-		for(boost::tie(vi,vi_end) = vertices(mDependencyGraph); vi != vi_end; ++vi)
-			put(mIndex, *vi, cnt++);
-		std::list<VertexDescriptor> make_order;
-		boost::topological_sort(mDependencyGraph, std::front_inserter(make_order));
-		std::list<VertexDescriptor>::iterator it = make_order.begin(), it_end = make_order.end();
-		for (; it != it_end; ++it)
-		{
-			if(mGroupFlag[*it])
-				result.push_back(vertex_ref(*it, mDependencyGraph, mMapping));
-		}
+	NodeId node = getNodeId(id);
+	if(node == invalidNodeId())
+	{
+		LOG4CXX_ERROR(mLogger, "compile dependent nodes: invalid node " << id);
+		return false;
 	}
-	catch(const boost::not_a_dag &nad)
+
+	Closure closure = getClosure(node, false);
+	for(std::vector<NodeId>::const_iterator it = closure->begin(); it != closure->end(); ++it)
+		result.push_front(mNodeNames[*it]);
+	return true;
+}
+
+bool DependencySolver::compileTopologicalLevels(/*OUT*/ Levels& result)
+{
+	//LOG4CXX_DEBUG(mLogger, "compile topological levels");
+	NodeIdLevels levels;
+	if(!compileTopologicalLevels(levels))
+		return false;
+
+	Levels names(levels.size());
+	for(std::size_t i = 0; i < levels.size(); ++i)
 	{
-		LOG4CXX_ERROR(mLogger, "dependency graph is not a DAG, topological sort failed : " << nad.what());
+		names[i].reserve(levels[i].size());
+		for(std::vector<NodeId>::iterator it = levels[i].begin(); it != levels[i].end(); ++it)
+			names[i].push_back(mNodeNames[*it]);
+	}
+
+	result.swap(names);
+	return true;
+}
+
+bool DependencySolver::compileTopologicalLevels(/*OUT*/ NodeIdLevels& result)
+{
+	NodeIdLevels levels;
+	if(!compileLevels(NULL, levels))
+	{
+		LOG4CXX_ERROR(mLogger, "dependency graph is not a DAG, fail to compile topological levels");
 		return false;
 	}
-	catch(std::invalid_argument& ia)
+
+	result.swap(levels);
+	return true;
+}
+
+namespace {
+
+struct LevelExecutor
+{
+	LevelExecutor(const std::vector<std::string>& level, const DependencySolver::NodeHandler& handler) : level(level), handler(handler)
+	{ }
+
+	void operator() (const tbb::blocked_range<std::size_t>& r) const
 	{
-		LOG4CXX_ERROR(mLogger, "fail to compile dependent nodes: " << ia.what());
+		for(std::size_t i = r.begin(); i != r.end(); ++i)
+			handler(level[i]);
+	}
+
+	const std::vector<std::string>& level;
+	const DependencySolver::NodeHandler& handler;
+};
+
+}
+
+bool DependencySolver::execute(const NodeHandler& handler)
+{
+	Levels levels;
+	if(!compileTopologicalLevels(levels))
 		return false;
+
+	for(Levels::iterator it = levels.begin(); it != levels.end(); ++it)
+	{
+		// each node is a task of its own, module initialization is far too coarse to batch
+		tbb::parallel_for(tbb::blocked_range<std::size_t>(0, it->size(), 1), LevelExecutor(*it, handler));
 	}
 	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
-void DependencySolver::findRequireNode(/*IN*/ const VertexDescriptor& v)
+bool DependencySolver::compileLevels(/*IN*/ const std::vector<bool>* mask, /*OUT*/ NodeIdLevels& levels)
+{
+	// Kahn's algorithm on the number of requirements not loaded yet, each round of
+	// nodes that becomes free makes up the next level
+	const std::size_t capacity = mGraph.vertexCapacity();
+	std::vector<std::size_t> pending(capacity, 0);
+	std::vector<NodeId> current;
+	std::size_t selected = 0;
+
+	for(NodeId u = 0; u < capacity; ++u)
+	{
+		if(!mGraph.isVertex(u) || (mask && !(*mask)[u]))
+			continue;
+
+		++selected;
+		const compact_digraph::edge_list& requirements = mGraph.outEdges(u);
+		for(compact_digraph::edge_list::const_iterator it = requirements.begin(); it != requirements.end(); ++it)
+		{
+			if(!mask || (*mask)[*it])
+				++pending[u];
+		}
+		if(pending[u] == 0)
+			current.push_back(u);
+	}
+
+	std::size_t visited = 0;
+	levels.clear();
+	while(!current.empty())
+	{
+		std::vector<NodeId> next;
+		for(std::vector<NodeId>::iterator it = current.begin(); it != current.end(); ++it)
+		{
+			const compact_digraph::edge_list& dependents = mGraph.inEdges(*it);
+			for(compact_digraph::edge_list::const_iterator d = dependents.begin(); d != dependents.end(); ++d)
+			{
+				if((!mask || (*mask)[*d]) && --pending[*d] == 0)
+					next.push_back(*d);
+			}
+		}
+
+		visited += current.size();
+		levels.push_back(std::vector<NodeId>());
+		levels.back().swap(current);
+		current.swap(next);
+	}
+
+	return visited == selected;
+}
+
+DependencySolver::Closure DependencySolver::getClosure(NodeId node, bool requirements) const
+{
+	std::vector<Closure>& closures = requirements ? mRequireClosures : mDependentClosures;
+	std::vector<NodeId> found;
+	{
+		boost::shared_lock<boost::shared_mutex> lock(mClosureMutex);
+		if(closures[node])
+			return closures[node];
+
+		// search with an explicit stack, the chains can be far deeper than the call stack,
+		// a node with a memoized closure contributes the closure without being searched
+		std::vector<bool> mask(mGraph.vertexCapacity(), false);
+		std::vector<NodeId> stack(1, node);
+		while(!stack.empty())
+		{
+			NodeId u = stack.back();
+			stack.pop_back();
+
+			const compact_digraph::edge_list& edges = requirements ? mGraph.outEdges(u) : mGraph.inEdges(u);
+			for(compact_digraph::edge_list::const_iterator it = edges.begin(); it != edges.end(); ++it)
+			{
+				if(mask[*it])
+					continue;
+				mask[*it] = true;
+				found.push_back(*it);
+
+				if(const Closure& memoized = closures[*it])
+				{
+					for(std::vector<NodeId>::const_iterator v = memoized->begin(); v != memoized->end(); ++v)
+					{
+						if(!mask[*v])
+						{
+							mask[*v] = true;
+							found.push_back(*v);
+						}
+					}
+				}
+				else
+					stack.push_back(*it);
+			}
+		}
+	}
+	sortByPosition(found);
+
+	// another reader may have compiled the same closure meanwhile, keep the first one
+	boost::unique_lock<boost::shared_mutex> lock(mClosureMutex);
+	if(!closures[node])
+	{
+		closures[node].reset(new std::vector<NodeId>(found.begin(), found.end()));
+		++mClosureCount[requirements];
+	}
+	return closures[node];
+}
+
+void DependencySolver::invalidateClosures(NodeId node, bool requirements)
 {
-	// recursively find the require nodes
-	out_edge_iter ei, ei_end;
-	for(boost::tie(ei, ei_end) = boost::out_edges(v, mDependencyGraph); ei != ei_end; ++ei)
+	// the require closures containing node belong to its dependents, and the other way around
+	std::vector<Closure>& closures = requirements ? mRequireClosures : mDependentClosures;
+	std::size_t& count = mClosureCount[requirements];
+	if(count == 0)
+		return;
+
+	std::vector<bool> mask(mGraph.vertexCapacity(), false);
+	std::vector<NodeId> stack(1, node);
+	mask[node] = true;
+	while(!stack.empty() && count > 0)
 	{
-		VertexDescriptor vd = boost::target(*ei, mDependencyGraph);
-		if(!mGroupFlag[vd])
+		NodeId u = stack.back();
+		stack.pop_back();
+		if(closures[u])
 		{
-			mGroupFlag[vd] = true;
-			findRequireNode(vd);
+			closures[u].reset();
+			--count;
+		}
+
+		const compact_digraph::edge_list& edges = requirements ? mGraph.inEdges(u) : mGraph.outEdges(u);
+		for(compact_digraph::edge_list::const_iterator it = edges.begin(); it != edges.end(); ++it)
+		{
+			if(!mask[*it])
+			{
+				mask[*it] = true;
+				stack.push_back(*it);
+			}
 		}
 	}
 }
 
-void DependencySolver::findDependentNode(/*IN*/ const VertexDescriptor& v)
+void DependencySolver::invalidateClosures()
 {
-	// recursively find the dependent nodes
-	in_edge_iter ei, ei_end;
-	for(boost::tie(ei, ei_end) = boost::in_edges(v, mDependencyGraph); ei != ei_end; ++ei)
+	if(mClosureCount[0] + mClosureCount[1] == 0)
+		return;
+
+	std::fill(mRequireClosures.begin(), mRequireClosures.end(), Closure());
+	std::fill(mDependentClosures.begin(), mDependentClosures.end(), Closure());
+	mClosureCount[0] = mClosureCount[1] = 0;
+}
+
+namespace {
+
+struct PositionLess
+{
+	PositionLess(const std::vector<std::size_t>& position) : position(position)
+	{ }
+
+	bool operator() (DependencySolver::NodeId a, DependencySolver::NodeId b) const
+	{
+		return position[a] < position[b];
+	}
+
+	const std::vector<std::size_t>& position;
+};
+
+}
+
+void DependencySolver::sortByPosition(std::vector<NodeId>& nodes) const
+{
+	std::sort(nodes.begin(), nodes.end(), PositionLess(mPosition));
+}
+
+bool DependencySolver::reorder(NodeId node, NodeId require_node)
+{
+	// Pearce-Kelly: the order is only broken if require_node is placed after node,
+	// and then only the nodes placed between the two have to move
+	const std::size_t lower = mPosition[node];
+	const std::size_t upper = mPosition[require_node];
+	if(upper < lower)
+		return true;
+	if(node == require_node)
+		return false;
+
+	// forward search on the dependents of node placed before require_node,
+	// reaching require_node itself means require_node already requires node
+	std::vector<NodeId> forward(1, node);
+	std::vector<NodeId> stack(1, node);
+	mVisited[node] = true;
+	bool cycle = false;
+	while(!stack.empty() && !cycle)
+	{
+		NodeId u = stack.back();
+		stack.pop_back();
+
+		const compact_digraph::edge_list& dependents = mGraph.inEdges(u);
+		for(compact_digraph::edge_list::const_iterator it = dependents.begin(); it != dependents.end(); ++it)
+		{
+			if(*it == require_node)
+			{
+				cycle = true;
+				break;
+			}
+			if(!mVisited[*it] && mPosition[*it] < upper)
+			{
+				mVisited[*it] = true;
+				stack.push_back(*it);
+				forward.push_back(*it);
+			}
+		}
+	}
+
+	if(cycle)
 	{
-		VertexDescriptor vd = boost::source(*ei, mDependencyGraph);
-		if(!mGroupFlag[vd])
+		for(std::vector<NodeId>::iterator it = forward.begin(); it != forward.end(); ++it)
+			mVisited[*it] = false;
+		return false;
+	}
+
+	// backward search on the requirements of require_node placed after node
+	std::vector<NodeId> backward(1, require_node);
+	stack.assign(1, require_node);
+	mVisited[require_node] = true;
+	while(!stack.empty())
+	{
+		NodeId u = stack.back();
+		stack.pop_back();
+
+		const compact_digraph::edge_list& requirements = mGraph.outEdges(u);
+		for(compact_digraph::edge_list::const_iterator it = requirements.begin(); it != requirements.end(); ++it)
 		{
-			mGroupFlag[vd] = true;
-			findDependentNode(vd);
+			if(!mVisited[*it] && mPosition[*it] > lower)
+			{
+				mVisited[*it] = true;
+				stack.push_back(*it);
+				backward.push_back(*it);
+			}
 		}
 	}
+
+	// both sets keep their relative order, but all of backward moves in front of
+	// all of forward, reusing the positions they occupied together
+	sortByPosition(forward);
+	sortByPosition(backward);
+
+	std::vector<std::size_t> positions;
+	positions.reserve(forward.size() + backward.size());
+	for(std::vector<NodeId>::iterator it = backward.begin(); it != backward.end(); ++it)
+	{
+		mVisited[*it] = false;
+		positions.push_back(mPosition[*it]);
+	}
+	for(std::vector<NodeId>::iterator it = forward.begin(); it != forward.end(); ++it)
+	{
+		mVisited[*it] = false;
+		positions.push_back(mPosition[*it]);
+	}
+	std::sort(positions.begin(), positions.end());
+
+	backward.insert(backward.end(), forward.begin(), forward.end());
+	for(std::size_t i = 0; i < backward.size(); ++i)
+	{
+		mPosition[backward[i]] = positions[i];
+		mOrder[positions[i]] = backward[i];
+	}
+	return true;
+}
+
+void DependencySolver::compactOrder()
+{
+	std::size_t n = 0;
+	for(std::size_t i = 0; i < mOrder.size(); ++i)
+	{
+		if(mOrder[i] == invalidNodeId())
+			continue;
+		mPosition[mOrder[i]] = n;
+		mOrder[n++] = mOrder[i];
+	}
+	mOrder.resize(n);
+	mOrderHoles = 0;
 }
 
 }
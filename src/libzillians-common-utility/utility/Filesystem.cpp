@@ -0,0 +1,697 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/Filesystem.h"
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <tbb/task_group.h>
+#include <tbb/concurrent_vector.h>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <set>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+typedef Filesystem::Watcher::Event Event;
+
+#if defined(__linux__)
+struct linux_dirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+struct DirectoryWalker
+{
+	DirectoryWalker(tbb::task_group& group, const Filesystem::FileVisitor& visitor) : group(group), visitor(visitor)
+	{ }
+
+	void spawn(const boost::filesystem::path& dir) const
+	{
+		// a directory is a task of its own, listing it blocks on the disk anyway
+		DirectoryWalker walker(*this);
+		group.run([walker, dir] { walker(dir); });
+	}
+
+#if defined(__linux__)
+	void operator() (const boost::filesystem::path& dir) const
+	{
+		int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(fd == -1)
+			return;
+
+		std::vector<char> buffer(32 * 1024);
+		long length;
+		while((length = syscall(SYS_getdents64, fd, &buffer[0], buffer.size())) > 0)
+		{
+			for(long pos = 0; pos < length; )
+			{
+				const linux_dirent64* entry = reinterpret_cast<const linux_dirent64*>(&buffer[pos]);
+				pos += entry->d_reclen;
+
+				const char* name = entry->d_name;
+				if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+					continue;
+
+				struct stat st;
+				unsigned char type = entry->d_type;
+				if(type == DT_UNKNOWN)
+				{
+					if(fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+						continue;
+					type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+				}
+				if(type == DT_LNK && fstatat(fd, name, &st, 0) == 0 && S_ISREG(st.st_mode))
+					type = DT_REG;
+
+				if(type == DT_DIR)
+					spawn(dir / name);
+				else if(type == DT_REG)
+					visitor(dir / name);
+			}
+		}
+		close(fd);
+	}
+#else
+	void operator() (const boost::filesystem::path& dir) const
+	{
+		boost::system::error_code ec;
+		for(boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+		{
+			boost::filesystem::file_status status = it->symlink_status(ec);
+			if(ec)
+				break;
+			if(boost::filesystem::is_directory(status))
+				spawn(it->path());
+			else if(boost::filesystem::is_regular_file(it->status(ec)))
+				visitor(it->path());
+		}
+	}
+#endif
+
+	tbb::task_group& group;
+	const Filesystem::FileVisitor& visitor;
+};
+
+/**
+ * Report everything under dir as added, for directories the watcher didn't see being filled.
+ */
+void reportTree(const boost::filesystem::path& dir, std::vector<Event>& events)
+{
+	boost::system::error_code ec;
+	for(boost::filesystem::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+		events.push_back(Event(it->path(), Filesystem::Watcher::ADDED));
+}
+
+/**
+ * Check if p is dir or lies under dir.
+ */
+bool isUnder(const std::string& p, const std::string& dir)
+{
+	return p.compare(0, dir.size(), dir) == 0 && (p.size() == dir.size() || p[dir.size()] == boost::filesystem::path::preferred_separator);
+}
+
+int toMilliseconds(const boost::posix_time::time_duration& d)
+{
+	return d.is_negative() ? 0 : static_cast<int>(std::min<boost::int64_t>(d.total_milliseconds(), std::numeric_limits<int>::max()));
+}
+
+}
+
+void Filesystem::walk(const boost::filesystem::path& root, const FileVisitor& visitor)
+{
+	tbb::task_group group;
+	DirectoryWalker(group, visitor)(root);
+	group.wait();
+}
+
+void Filesystem::scan(const boost::filesystem::path& root, std::vector<boost::filesystem::path>& files)
+{
+	tbb::concurrent_vector<boost::filesystem::path> found;
+	walk(root, [&found](const boost::filesystem::path& p) { found.push_back(p); });
+	files.assign(found.begin(), found.end());
+}
+
+//////////////////////////////////////////////////////////////////////////
+Filesystem::PathCache::PathCache(std::size_t capacity) : mCapacity(std::max<std::size_t>(capacity, 1))
+{
+}
+
+boost::filesystem::path Filesystem::PathCache::normalize(const boost::filesystem::path& p)
+{
+	// relative paths are only the same path in the same current directory
+	const std::string key = p.is_absolute() ? p.string() : boost::filesystem::absolute(p).string();
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		boost::unordered_map<std::string, Entries::iterator>::iterator it = mIndex.find(key);
+		if(it != mIndex.end())
+		{
+			mEntries.splice(mEntries.begin(), mEntries, it->second);
+			return it->second->second;
+		}
+	}
+
+	// resolving may stat(), so not under the lock
+	boost::filesystem::path resolved = resolve(key);
+
+	boost::mutex::scoped_lock lock(mMutex);
+	if(mIndex.find(key) == mIndex.end())
+	{
+		mEntries.push_front(std::make_pair(key, resolved));
+		mIndex[key] = mEntries.begin();
+		if(mEntries.size() > mCapacity)
+		{
+			mIndex.erase(mEntries.back().first);
+			mEntries.pop_back();
+		}
+	}
+	return resolved;
+}
+
+void Filesystem::PathCache::clear()
+{
+	boost::mutex::scoped_lock lock(mMutex);
+	mIndex.clear();
+	mEntries.clear();
+}
+
+std::size_t Filesystem::PathCache::size() const
+{
+	boost::mutex::scoped_lock lock(mMutex);
+	return mEntries.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+#if defined(__linux__)
+
+/**
+ * One inotify watch per directory, a new directory gets its watch when its creation is read.
+ */
+struct Filesystem::Watcher::Impl
+{
+	Impl(const boost::filesystem::path& root) : buffer(64 * 1024)
+	{
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if(fd != -1 && !watchTree(root, NULL))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	~Impl()
+	{
+		if(fd != -1)
+			close(fd);
+	}
+
+	bool valid() const
+	{
+		return fd != -1;
+	}
+
+	bool watchTree(const boost::filesystem::path& dir, std::vector<Event>* added)
+	{
+		const uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+		int wd = inotify_add_watch(fd, dir.c_str(), mask);
+		if(wd == -1)
+			return false;
+		directories[wd] = dir;
+		watches[dir.string()] = wd;
+
+		// whatever is created before the watches of the sub-directories are in place is only found by listing them
+		boost::system::error_code ec;
+		for(boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+		{
+			boost::filesystem::file_status status = it->symlink_status(ec);
+			if(ec)
+				break;
+			if(added)
+				added->push_back(Event(it->path(), ADDED));
+			if(boost::filesystem::is_directory(status))
+				watchTree(it->path(), added);
+		}
+		return true;
+	}
+
+	void unwatchTree(const boost::filesystem::path& dir)
+	{
+		const std::string prefix = dir.string();
+		for(boost::unordered_map<std::string, int>::iterator it = watches.begin(); it != watches.end(); )
+		{
+			if(isUnder(it->first, prefix))
+			{
+				inotify_rm_watch(fd, it->second);
+				directories.erase(it->second);
+				it = watches.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	bool read(std::vector<Event>& events, int timeout)
+	{
+		pollfd p = { fd, POLLIN, 0 };
+		int n = ::poll(&p, 1, timeout);
+		if(n <= 0)
+			return false;
+
+		ssize_t length;
+		while((length = ::read(fd, &buffer[0], buffer.size())) > 0)
+		{
+			for(char* pos = &buffer[0]; pos < &buffer[0] + length; )
+			{
+				const inotify_event* e = reinterpret_cast<const inotify_event*>(pos);
+				pos += sizeof(inotify_event) + e->len;
+				dispatch(*e, events);
+			}
+		}
+		return true;
+	}
+
+	void dispatch(const inotify_event& e, std::vector<Event>& events)
+	{
+		if(e.mask & IN_Q_OVERFLOW)
+		{
+			events.push_back(Event(boost::filesystem::path(), RESCAN));
+			return;
+		}
+
+		boost::unordered_map<int, boost::filesystem::path>::iterator dir = directories.find(e.wd);
+		if(dir == directories.end())
+			return;
+
+		if(e.mask & IN_IGNORED)
+		{
+			// the directory is gone, its parent reports it
+			watches.erase(dir->second.string());
+			directories.erase(dir);
+			return;
+		}
+		if(e.len == 0)
+			return;
+
+		const boost::filesystem::path path = dir->second / e.name;
+		if(e.mask & (IN_CREATE | IN_MOVED_TO))
+		{
+			events.push_back(Event(path, ADDED));
+			if(e.mask & IN_ISDIR)
+				watchTree(path, &events);
+		}
+		else if(e.mask & (IN_DELETE | IN_MOVED_FROM))
+		{
+			events.push_back(Event(path, REMOVED));
+			if(e.mask & IN_ISDIR)
+				unwatchTree(path);
+		}
+		else if(!(e.mask & IN_ISDIR))
+			events.push_back(Event(path, MODIFIED));
+	}
+
+	int fd;
+	std::vector<char> buffer;
+	boost::unordered_map<int, boost::filesystem::path> directories;	///< Watched directory of each watch
+	boost::unordered_map<std::string, int> watches;					///< Watch of each watched directory
+};
+
+//////////////////////////////////////////////////////////////////////////
+#elif defined(_WIN32)
+
+/**
+ * A single ReadDirectoryChangesW() on root follows the whole tree, one read is always pending.
+ */
+struct Filesystem::Watcher::Impl
+{
+	Impl(const boost::filesystem::path& root) : root(root), pending(false)
+	{
+		ZeroMemory(&overlapped, sizeof(overlapped));
+		overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		handle = CreateFileW(root.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		if(handle != INVALID_HANDLE_VALUE && !issue())
+		{
+			CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	~Impl()
+	{
+		if(handle != INVALID_HANDLE_VALUE)
+		{
+			if(pending)
+			{
+				DWORD bytes;
+				CancelIo(handle);
+				GetOverlappedResult(handle, &overlapped, &bytes, TRUE);
+			}
+			CloseHandle(handle);
+		}
+		if(overlapped.hEvent)
+			CloseHandle(overlapped.hEvent);
+	}
+
+	bool valid() const
+	{
+		return handle != INVALID_HANDLE_VALUE;
+	}
+
+	bool issue()
+	{
+		const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION;
+		ResetEvent(overlapped.hEvent);
+		pending = ReadDirectoryChangesW(handle, buffer, sizeof(buffer), TRUE, filter, NULL, &overlapped, NULL) != 0;
+		return pending;
+	}
+
+	bool read(std::vector<Event>& events, int timeout)
+	{
+		if(!pending && !issue())
+			return false;
+		if(WaitForSingleObject(overlapped.hEvent, static_cast<DWORD>(timeout)) != WAIT_OBJECT_0)
+			return false;
+
+		DWORD bytes = 0;
+		pending = false;
+		if(!GetOverlappedResult(handle, &overlapped, &bytes, FALSE))
+			return false;
+
+		// parse before re-issuing, the next read goes to the same buffer
+		if(bytes == 0)
+			events.push_back(Event(boost::filesystem::path(), RESCAN));
+		else
+		{
+			const char* pos = reinterpret_cast<const char*>(buffer);
+			while(true)
+			{
+				const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(pos);
+				const boost::filesystem::path path = root / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+				switch(info->Action)
+				{
+				case FILE_ACTION_ADDED:
+				case FILE_ACTION_RENAMED_NEW_NAME:
+					events.push_back(Event(path, ADDED));
+					if(info->Action == FILE_ACTION_RENAMED_NEW_NAME && boost::filesystem::is_directory(path))
+						reportTree(path, events);
+					break;
+				case FILE_ACTION_REMOVED:
+				case FILE_ACTION_RENAMED_OLD_NAME:
+					events.push_back(Event(path, REMOVED));
+					break;
+				default:
+					events.push_back(Event(path, MODIFIED));
+					break;
+				}
+				if(info->NextEntryOffset == 0)
+					break;
+				pos += info->NextEntryOffset;
+			}
+		}
+		issue();
+		return true;
+	}
+
+	boost::filesystem::path root;
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	bool pending;
+	DWORD buffer[16 * 1024];	///< Must be DWORD-aligned
+};
+
+//////////////////////////////////////////////////////////////////////////
+#else
+
+/**
+ * kqueue only tells that a directory changed, not what changed in it, so the entries of
+ * each watched directory are kept to find out by listing it again.
+ */
+struct Filesystem::Watcher::Impl
+{
+	Impl(const boost::filesystem::path& root) : root(root)
+	{
+		kq = kqueue();
+		if(kq != -1 && !watch(root, true, NULL))
+		{
+			close(kq);
+			kq = -1;
+		}
+	}
+
+	~Impl()
+	{
+		for(boost::unordered_map<int, Node>::iterator it = nodes.begin(); it != nodes.end(); ++it)
+			close(it->first);
+		if(kq != -1)
+			close(kq);
+	}
+
+	bool valid() const
+	{
+		return kq != -1;
+	}
+
+	bool watch(const boost::filesystem::path& path, bool directory, std::vector<Event>* added)
+	{
+#ifdef O_EVTONLY
+		int fd = open(path.c_str(), O_EVTONLY);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+#endif
+		if(fd == -1)
+			return false;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		struct kevent change;
+		EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+		if(kevent(kq, &change, 1, NULL, 0, NULL) == -1)
+		{
+			close(fd);
+			return false;
+		}
+
+		Node& node = nodes[fd];
+		node.path = path;
+		node.directory = directory;
+		descriptors[path.string()] = fd;
+		if(directory)
+			update(fd, added);
+		return true;
+	}
+
+	void unwatch(const boost::filesystem::path& path)
+	{
+		// closing the descriptor removes its kevent
+		const std::string prefix = path.string();
+		for(boost::unordered_map<std::string, int>::iterator it = descriptors.begin(); it != descriptors.end(); )
+		{
+			if(isUnder(it->first, prefix))
+			{
+				close(it->second);
+				nodes.erase(it->second);
+				it = descriptors.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	/**
+	 * List the directory again and report the difference to the entries seen before.
+	 */
+	void update(int fd, std::vector<Event>* events)
+	{
+		const boost::filesystem::path dir = nodes[fd].path;
+		std::set<std::string> entries;
+		std::vector<boost::filesystem::path> created;
+		boost::system::error_code ec;
+		for(boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+		{
+			entries.insert(it->path().filename().string());
+			if(!nodes[fd].entries.count(it->path().filename().string()))
+				created.push_back(it->path());
+		}
+
+		std::vector<std::string> removed;
+		std::set_difference(nodes[fd].entries.begin(), nodes[fd].entries.end(), entries.begin(), entries.end(), std::back_inserter(removed));
+		nodes[fd].entries.swap(entries);
+
+		for(std::vector<std::string>::iterator it = removed.begin(); it != removed.end(); ++it)
+		{
+			if(events)
+				events->push_back(Event(dir / *it, REMOVED));
+			unwatch(dir / *it);
+		}
+		// watch() may rehash nodes, so nothing refers into it from here on
+		for(std::vector<boost::filesystem::path>::iterator it = created.begin(); it != created.end(); ++it)
+		{
+			if(events)
+				events->push_back(Event(*it, ADDED));
+			watch(*it, boost::filesystem::is_directory(boost::filesystem::symlink_status(*it, ec)), events);
+		}
+	}
+
+	bool read(std::vector<Event>& events, int timeout)
+	{
+		struct kevent triggered[64];
+		timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+		int n = kevent(kq, NULL, 0, triggered, 64, &ts);
+		if(n <= 0)
+			return false;
+
+		for(int i = 0; i < n; ++i)
+		{
+			const int fd = static_cast<int>(triggered[i].ident);
+			boost::unordered_map<int, Node>::iterator node = nodes.find(fd);
+			if(node == nodes.end())
+				continue;
+
+			if(triggered[i].fflags & (NOTE_DELETE | NOTE_RENAME))
+			{
+				// the parent directory reports it, except for root itself
+				if(node->second.path == root)
+				{
+					events.push_back(Event(root, REMOVED));
+					unwatch(root);
+				}
+			}
+			else if(node->second.directory)
+			{
+				if(triggered[i].fflags & NOTE_WRITE)
+					update(fd, &events);
+			}
+			else
+				events.push_back(Event(node->second.path, MODIFIED));
+		}
+		return true;
+	}
+
+	struct Node
+	{
+		boost::filesystem::path path;
+		bool directory;
+		std::set<std::string> entries;	///< Names in a directory the last time it was listed
+	};
+
+	boost::filesystem::path root;
+	int kq;
+	boost::unordered_map<int, Node> nodes;				///< Watched file or directory of each descriptor
+	boost::unordered_map<std::string, int> descriptors;	///< Descriptor of each watched file or directory
+};
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+Filesystem::Watcher::Watcher(const boost::filesystem::path& root, const boost::posix_time::time_duration& latency) :
+	mRoot(root), mLatency(latency), mImpl(new Impl(root))
+{
+}
+
+Filesystem::Watcher::~Watcher()
+{
+}
+
+bool Filesystem::Watcher::valid() const
+{
+	return mImpl->valid();
+}
+
+std::size_t Filesystem::Watcher::poll(std::vector<Event>& events, const boost::posix_time::time_duration& timeout)
+{
+	events.clear();
+	if(!mImpl->valid())
+		return 0;
+
+	const boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + timeout;
+	std::vector<Event> raw;
+	while(true)
+	{
+		if(!mImpl->read(raw, toMilliseconds(deadline - boost::posix_time::microsec_clock::universal_time())))
+			return 0;
+
+		// keep reading until the tree settles down
+		const boost::posix_time::ptime settled = boost::posix_time::microsec_clock::universal_time() + mLatency;
+		while(mImpl->read(raw, toMilliseconds(settled - boost::posix_time::microsec_clock::universal_time())))
+			;
+
+		// coalesce by path, keeping the position of the first change
+		boost::unordered_map<std::string, std::size_t> index;
+		for(std::vector<Event>::iterator it = raw.begin(); it != raw.end(); ++it)
+		{
+			if(it->action == RESCAN)
+			{
+				events.assign(1, Event(mRoot, RESCAN));
+				return 1;
+			}
+
+			boost::unordered_map<std::string, std::size_t>::iterator i = index.find(it->path.string());
+			if(i == index.end())
+			{
+				index[it->path.string()] = events.size();
+				events.push_back(*it);
+				continue;
+			}
+
+			Event& merged = events[i->second];
+			if(merged.action == ADDED)
+			{
+				if(it->action == REMOVED)
+				{
+					// never existed as far as the caller is concerned, the slot is dropped below
+					merged.action = RESCAN;
+					index.erase(i);
+				}
+			}
+			else
+				merged.action = (it->action == REMOVED) ? REMOVED : MODIFIED;
+		}
+		raw.clear();
+
+		events.erase(std::remove_if(events.begin(), events.end(), [](const Event& e) { return e.action == RESCAN; }), events.end());
+		if(!events.empty())
+			return events.size();
+	}
+}
+
+}
@@ -22,27 +22,25 @@
 
 #include "utility/StringUtil.h"
 
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
 namespace zillians {
 
 //////////////////////////////////////////////////////////////////////////
 
-const char* StringUtil::itoaAlphabet[] = { "00", "01", "02", "03", "04", "05", "06", "07", "08", "09", "0A", "0B", "0C", "0D", "0E", "0F",
-										   "10", "11", "12", "13", "14", "15", "16", "17", "18", "19", "1A", "1B", "1C", "1D", "1E", "1F",
-										   "20", "21", "22", "23", "24", "25", "26", "27", "28", "29", "2A", "2B", "2C", "2D", "2E", "2F",
-										   "30", "31", "32", "33", "34", "35", "36", "37", "38", "39", "3A", "3B", "3C", "3D", "3E", "3F",
-										   "40", "41", "42", "43", "44", "45", "46", "47", "48", "49", "4A", "4B", "4C", "4D", "4E", "4F",
-										   "50", "51", "52", "53", "54", "55", "56", "57", "58", "59", "5A", "5B", "5C", "5D", "5E", "5F",
-										   "60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "6A", "6B", "6C", "6D", "6E", "6F",
-										   "70", "71", "72", "73", "74", "75", "76", "77", "78", "79", "7A", "7B", "7C", "7D", "7E", "7F",
-										   "80", "81", "82", "83", "84", "85", "86", "87", "88", "89", "8A", "8B", "8C", "8D", "8E", "8F",
-										   "90", "91", "92", "93", "94", "95", "96", "97", "98", "99", "9A", "9B", "9C", "9D", "9E", "9F",
-										   "A0", "A1", "A2", "A3", "A4", "A5", "A6", "A7", "A8", "A9", "AA", "AB", "AC", "AD", "AE", "AF",
-										   "B0", "B1", "B2", "B3", "B4", "B5", "B6", "B7", "B8", "B9", "BA", "BB", "BC", "BD", "BE", "BF",
-										   "C0", "C1", "C2", "C3", "C4", "C5", "C6", "C7", "C8", "C9", "CA", "CB", "CC", "CD", "CE", "CF",
-										   "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7", "D8", "D9", "DA", "DB", "DC", "DD", "DE", "DF",
-										   "E0", "E1", "E2", "E3", "E4", "E5", "E6", "E7", "E8", "E9", "EA", "EB", "EC", "ED", "EE", "EF",
-										   "F0", "F1", "F2", "F3", "F4", "F5", "F6", "F7", "F8", "F9", "FA", "FB", "FC", "FD", "FE", "FF"
-								   	     };
+const char StringUtil::digitPairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
 
 //////////////////////////////////////////////////////////////////////////
 StringUtil::StringUtil()
@@ -53,63 +51,258 @@ StringUtil::~StringUtil()
 
 bool StringUtil::substitute(std::string &s, const std::string &to_search, const std::string &to_replace)
 {
-	bool replace_found = false;
-    std::string::size_type p = 0;
-    while ((p = s.find(to_search, p)) != std::string::npos)
-    {
-        s.replace(p, to_search.size(), to_replace);
-        p++;
-        replace_found = true;
-    }
-    return replace_found;
+	if(to_search.empty())
+		return false;
+
+	std::string::size_type p = s.find(to_search);
+	if(p == std::string::npos)
+		return false;
+
+	// copy the untouched parts and the replacements once, instead of shifting the tail at every match
+	std::string result;
+	result.reserve(s.size() + (to_replace.size() > to_search.size() ? 4 * (to_replace.size() - to_search.size()) : 0));
+
+	std::string::size_type last = 0;
+	do
+	{
+		result.append(s, last, p - last);
+		result.append(to_replace);
+		last = p + to_search.size();
+	} while((p = s.find(to_search, last)) != std::string::npos);
+	result.append(s, last, std::string::npos);
+
+	s.swap(result);
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
-std::vector<std::string> StringUtil::tokenize(const std::string& str, const std::string& delimiters, bool allowEmptyTokenString)
+namespace {
+
+template<typename T>
+inline std::size_t countDigits(T value)
 {
-	std::vector<std::string> tokens;
-	std::string::size_type delimPos = 0, tokenPos = 0, pos = 0;
+	std::size_t n = 1;
+	while(true)
+	{
+		if(value < 10) return n;
+		if(value < 100) return n + 1;
+		if(value < 1000) return n + 2;
+		if(value < 10000) return n + 3;
+		value /= 10000;
+		n += 4;
+	}
+}
 
-	if (str.length() < 1)
-		return tokens;
+template<typename T>
+inline char* writeDigits(char* first, char* last, T value, const char* pairs)
+{
+	std::size_t n = countDigits(value);
+	if((std::size_t)(last - first) < n)
+		return NULL;
 
-	while (true)
+	// fill from the back, two digits per division
+	char* p = first + n;
+	while(value >= 100)
 	{
-		delimPos = str.find_first_of(delimiters, pos);
-		tokenPos = str.find_first_not_of(delimiters, pos);
+		std::size_t index = (std::size_t)(value % 100) * 2;
+		value /= 100;
+		p -= 2;
+		p[0] = pairs[index];
+		p[1] = pairs[index + 1];
+	}
 
-		if (std::string::npos != delimPos)
-		{
-			if (std::string::npos != tokenPos)
-			{
-				if (tokenPos < delimPos)
-				{
-					tokens.push_back(str.substr(pos, delimPos - pos));
-				}
-				else
-				{
-					if (allowEmptyTokenString)	tokens.push_back("");
-				}
-			}
-			else
-			{
-				if (allowEmptyTokenString) tokens.push_back("");
-			}
-			pos = delimPos + 1;
-		}
-		else
+	if(value >= 10)
+	{
+		p[-2] = pairs[value * 2];
+		p[-1] = pairs[value * 2 + 1];
+	}
+	else
+	{
+		p[-1] = (char)('0' + value);
+	}
+	return first + n;
+}
+
+/**
+ * Spread the four bytes of v into the odd and even bytes of the result, the
+ * high nibble of byte i goes to byte 2i and the low nibble to byte 2i+1.
+ */
+inline boost::uint64_t spreadNibbles(boost::uint32_t v)
+{
+	boost::uint64_t x = v;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	return ((x >> 4) & 0x000F000F000F000FULL) | ((x & 0x000F000F000F000FULL) << 8);
+}
+
+/**
+ * Turn eight nibbles, one per byte, into their hex characters.
+ */
+inline boost::uint64_t nibblesToHex(boost::uint64_t nibbles, boost::uint64_t alpha)
+{
+	// 1 in every byte holding a nibble above 9
+	boost::uint64_t letters = ((nibbles + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL;
+	return nibbles + 0x3030303030303030ULL + letters * alpha;
+}
+
+}
+
+char* StringUtil::toCharsUnsigned(char* first, char* last, boost::uint32_t value)
+{
+	return writeDigits(first, last, value, digitPairs);
+}
+
+char* StringUtil::toCharsUnsigned(char* first, char* last, boost::uint64_t value)
+{
+	if(value <= 0xFFFFFFFFULL)
+		return writeDigits(first, last, static_cast<boost::uint32_t>(value), digitPairs);
+	return writeDigits(first, last, value, digitPairs);
+}
+
+char* StringUtil::encodeHex(char* first, char* last, const void* data, std::size_t size, bool uppercase)
+{
+	if((std::size_t)(last - first) / 2 < size)
+		return NULL;
+
+	const unsigned char* in = static_cast<const unsigned char*>(data);
+	const unsigned char* end = in + size;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// 'A' - '9' - 1 or 'a' - '9' - 1 added to digits above 9
+	const boost::uint64_t alpha = uppercase ? 7 : 39;
+	while(end - in >= 8)
+	{
+		boost::uint32_t lo, hi;
+		std::memcpy(&lo, in, 4);
+		std::memcpy(&hi, in + 4, 4);
+
+		boost::uint64_t out[2] = { nibblesToHex(spreadNibbles(lo), alpha), nibblesToHex(spreadNibbles(hi), alpha) };
+		std::memcpy(first, out, 16);
+
+		in += 8;
+		first += 16;
+	}
+#endif
+
+	const char* digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+	for(; in != end; ++in)
+	{
+		*first++ = digits[*in >> 4];
+		*first++ = digits[*in & 0x0F];
+	}
+	return first;
+}
+
+//////////////////////////////////////////////////////////////////////////
+StringUtil::Delimiters::Delimiters(const std::string& delimiters)
+{
+	init(delimiters.data(), delimiters.length());
+}
+
+StringUtil::Delimiters::Delimiters(const char* delimiters, std::size_t count)
+{
+	init(delimiters, count);
+}
+
+void StringUtil::Delimiters::init(const char* delimiters, std::size_t count)
+{
+	std::memset(mTable, 0, sizeof(mTable));
+	std::memset(mSet, 0, sizeof(mSet));
+	mCount = 0;
+
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		if(mTable[(unsigned char)delimiters[i]])
+			continue;
+
+		mTable[(unsigned char)delimiters[i]] = true;
+		if(mCount < sizeof(mSet))
+			mSet[mCount] = delimiters[i];
+		++mCount;
+	}
+}
+
+const char* StringUtil::Delimiters::find(const char* first, const char* last) const
+{
+	if(mCount == 0)
+		return last;
+
+	if(mCount == 1)
+	{
+		const void* p = std::memchr(first, mSet[0], last - first);
+		return p ? static_cast<const char*>(p) : last;
+	}
+
+#ifdef __SSE4_2__
+	if(mCount <= sizeof(mSet))
+	{
+		// compare 16 bytes against the whole set at once, only full blocks are
+		// loaded so we never read past the end of the string
+		const __m128i set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mSet));
+		while(last - first >= 16)
 		{
-			if (std::string::npos != tokenPos)
-			{
-				tokens.push_back(str.substr(pos));
-			}
-			else
-			{
-				if (allowEmptyTokenString) tokens.push_back("");
-			}
-			break;
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+			int index = _mm_cmpestri(set, (int)mCount, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+			if(index < 16)
+				return first + index;
+			first += 16;
 		}
 	}
+#endif
+
+	for(; first != last; ++first)
+	{
+		if(mTable[(unsigned char)*first])
+			return first;
+	}
+	return last;
+}
+
+//////////////////////////////////////////////////////////////////////////
+namespace {
+
+struct TokenAppender
+{
+	TokenAppender(std::vector<StringUtil::Token>& tokens) : tokens(tokens)
+	{ }
+
+	inline void operator() (const char* data, std::size_t length) const
+	{
+		tokens.push_back(StringUtil::Token(data, length));
+	}
+
+	std::vector<StringUtil::Token>& tokens;
+};
+
+struct StringAppender
+{
+	StringAppender(std::vector<std::string>& tokens) : tokens(tokens)
+	{ }
+
+	inline void operator() (const char* data, std::size_t length) const
+	{
+		tokens.push_back(std::string(data, length));
+	}
+
+	std::vector<std::string>& tokens;
+};
+
+}
+
+std::size_t StringUtil::tokenize(const char* str, std::size_t length, const Delimiters& delimiters, std::vector<Token>& tokens, bool allowEmptyTokenString)
+{
+	return tokenize(str, length, delimiters, TokenAppender(tokens), allowEmptyTokenString);
+}
+
+std::size_t StringUtil::tokenize(const std::string& str, const Delimiters& delimiters, std::vector<Token>& tokens, bool allowEmptyTokenString)
+{
+	return tokenize(str.data(), str.length(), delimiters, TokenAppender(tokens), allowEmptyTokenString);
+}
+
+std::vector<std::string> StringUtil::tokenize(const std::string& str, const std::string& delimiters, bool allowEmptyTokenString)
+{
+	std::vector<std::string> tokens;
+	tokenize(str.data(), str.length(), Delimiters(delimiters), StringAppender(tokens), allowEmptyTokenString);
 	return tokens;
 }
 
@@ -0,0 +1,304 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/Symbol.h"
+
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+namespace zillians {
+
+namespace {
+
+typedef detail::SymbolEntry Entry;
+
+/**
+ * The global table behind Symbol.
+ *
+ * Strings are found through an open addressing hash table of entry pointers.
+ * Slots go from NULL to an entry once and never change again, so readers probe
+ * without any lock. Writers are serialized by a mutex, and growing the table
+ * publishes a new bucket array while the old ones are kept alive for readers
+ * which may still be probing them (a reader missing a new entry there just
+ * falls through to the locked path).
+ *
+ * Ids are resolved through segments of doubling size, so existing segments
+ * never move when more ids are needed.
+ */
+class SymbolTable
+{
+public:
+	static SymbolTable& instance()
+	{
+		// leaked on purpose, so symbols stay valid during static destruction
+		static SymbolTable* table = new SymbolTable;
+		return *table;
+	}
+
+public:
+	SymbolTable() : mBuckets(createBuckets(INITIAL_BUCKET_COUNT, NULL)), mCount(0), mChunkCurrent(NULL), mChunkEnd(NULL)
+	{
+		for(std::size_t i = 0; i < SEGMENT_COUNT; ++i)
+			mSegments[i].store(NULL, std::memory_order_relaxed);
+	}
+
+public:
+	const Entry* find(const char* name, std::size_t length) const
+	{
+		if(isTooLong(length))
+			return NULL;
+		return probe(mBuckets.load(std::memory_order_acquire), name, (boost::uint32_t)length, hash(name, length));
+	}
+
+	const Entry* intern(const char* name, std::size_t length)
+	{
+		if(isTooLong(length))
+			throw std::length_error("symbol is too long");
+
+		boost::uint32_t h = hash(name, length);
+		const Entry* entry = probe(mBuckets.load(std::memory_order_acquire), name, (boost::uint32_t)length, h);
+		if(entry)
+			return entry;
+
+		boost::mutex::scoped_lock lock(mMutex);
+
+		Buckets* buckets = mBuckets.load(std::memory_order_relaxed);
+		entry = probe(buckets, name, (boost::uint32_t)length, h);
+		if(entry)
+			return entry;
+
+		std::size_t id = mCount.load(std::memory_order_relaxed);
+		if(id >= Symbol::INVALID_ID)
+			throw std::length_error("symbol table is full");
+
+		// keep the load factor under one half so probe sequences stay short
+		if((id + 1) * 2 > buckets->mask + 1)
+			buckets = grow(buckets);
+
+		Entry* created = createEntry(name, (boost::uint32_t)length, h, (boost::uint32_t)id);
+		storeId(created);
+		insert(buckets, created);
+		mCount.store(id + 1, std::memory_order_release);
+		return created;
+	}
+
+	const Entry* get(boost::uint32_t id) const
+	{
+		if(id >= mCount.load(std::memory_order_acquire))
+			return NULL;
+
+		std::size_t segment, offset;
+		locate(id, segment, offset);
+		return mSegments[segment].load(std::memory_order_relaxed)[offset];
+	}
+
+	std::size_t count() const
+	{
+		return mCount.load(std::memory_order_acquire);
+	}
+
+private:
+	enum
+	{
+		INITIAL_BUCKET_COUNT = 1024,
+		FIRST_SEGMENT_SHIFT = 10,
+		SEGMENT_COUNT = 33 - FIRST_SEGMENT_SHIFT,
+		CHUNK_SIZE = 64 * 1024,
+	};
+
+	struct Buckets
+	{
+		std::size_t mask;
+		Buckets* previous;				///< Replaced bucket arrays, kept for concurrent readers
+		std::atomic<const Entry*>* slots;
+	};
+
+	static inline bool isTooLong(std::size_t length)
+	{
+		return length >= 0xFFFFFFFFu;
+	}
+
+	static boost::uint32_t hash(const char* name, std::size_t length)
+	{
+		// FNV-1a
+		boost::uint32_t h = 2166136261u;
+		for(std::size_t i = 0; i < length; ++i)
+		{
+			h ^= (unsigned char)name[i];
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+	static const Entry* probe(const Buckets* buckets, const char* name, boost::uint32_t length, boost::uint32_t h)
+	{
+		for(std::size_t i = h & buckets->mask; ; i = (i + 1) & buckets->mask)
+		{
+			const Entry* entry = buckets->slots[i].load(std::memory_order_acquire);
+			if(!entry)
+				return NULL;
+			if(entry->hash == h && entry->length == length && std::memcmp(entry->name, name, length) == 0)
+				return entry;
+		}
+	}
+
+	static void insert(Buckets* buckets, const Entry* entry)
+	{
+		std::size_t i = entry->hash & buckets->mask;
+		while(buckets->slots[i].load(std::memory_order_relaxed))
+			i = (i + 1) & buckets->mask;
+		buckets->slots[i].store(entry, std::memory_order_release);
+	}
+
+	static Buckets* createBuckets(std::size_t size, Buckets* previous)
+	{
+		Buckets* buckets = new Buckets;
+		buckets->mask = size - 1;
+		buckets->previous = previous;
+		buckets->slots = new std::atomic<const Entry*>[size];
+		for(std::size_t i = 0; i < size; ++i)
+			buckets->slots[i].store(NULL, std::memory_order_relaxed);
+		return buckets;
+	}
+
+	Buckets* grow(Buckets* buckets)
+	{
+		Buckets* grown = createBuckets((buckets->mask + 1) * 2, buckets);
+		for(std::size_t i = 0; i <= buckets->mask; ++i)
+		{
+			const Entry* entry = buckets->slots[i].load(std::memory_order_relaxed);
+			if(entry)
+				insert(grown, entry);
+		}
+		mBuckets.store(grown, std::memory_order_release);
+		return grown;
+	}
+
+	static inline void locate(boost::uint32_t id, std::size_t& segment, std::size_t& offset)
+	{
+		boost::uint64_t v = (boost::uint64_t)id + (1u << FIRST_SEGMENT_SHIFT);
+		std::size_t msb = 63 - __builtin_clzll(v);
+		segment = msb - FIRST_SEGMENT_SHIFT;
+		offset = (std::size_t)(v - ((boost::uint64_t)1 << msb));
+	}
+
+	void storeId(const Entry* entry)
+	{
+		std::size_t segment, offset;
+		locate(entry->id, segment, offset);
+
+		const Entry** ids = mSegments[segment].load(std::memory_order_relaxed);
+		if(!ids)
+		{
+			ids = new const Entry*[(std::size_t)1 << (segment + FIRST_SEGMENT_SHIFT)];
+			mSegments[segment].store(ids, std::memory_order_relaxed);
+		}
+		// published to get() by the release store of mCount
+		ids[offset] = entry;
+	}
+
+	Entry* createEntry(const char* name, boost::uint32_t length, boost::uint32_t h, boost::uint32_t id)
+	{
+		std::size_t size = (offsetof(Entry, name) + length + 1 + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
+
+		char* p;
+		if(size > CHUNK_SIZE / 4)
+		{
+			// long strings get their own block, so they don't waste the rest of the chunk
+			p = allocateBlock(size);
+		}
+		else
+		{
+			if((std::size_t)(mChunkEnd - mChunkCurrent) < size)
+			{
+				mChunkCurrent = allocateBlock(CHUNK_SIZE);
+				mChunkEnd = mChunkCurrent + CHUNK_SIZE;
+			}
+			p = mChunkCurrent;
+			mChunkCurrent += size;
+		}
+
+		Entry* entry = reinterpret_cast<Entry*>(p);
+		entry->hash = h;
+		entry->id = id;
+		entry->length = length;
+		std::memcpy(entry->name, name, length);
+		entry->name[length] = '\0';
+		return entry;
+	}
+
+	static char* allocateBlock(std::size_t size)
+	{
+		char* p = static_cast<char*>(std::malloc(size));
+		if(!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+private:
+	boost::mutex mMutex;
+	std::atomic<Buckets*> mBuckets;
+	std::atomic<std::size_t> mCount;
+	std::atomic<const Entry**> mSegments[SEGMENT_COUNT];
+
+	char* mChunkCurrent;	///< Next free byte of the current string chunk, guarded by mMutex
+	char* mChunkEnd;
+};
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+Symbol::Symbol(const std::string& name) : mEntry(SymbolTable::instance().intern(name.data(), name.length()))
+{ }
+
+Symbol::Symbol(const char* name) : mEntry(SymbolTable::instance().intern(name, std::strlen(name)))
+{ }
+
+Symbol::Symbol(const char* name, std::size_t length) : mEntry(SymbolTable::instance().intern(name, length))
+{ }
+
+Symbol Symbol::find(const std::string& name)
+{
+	return Symbol(SymbolTable::instance().find(name.data(), name.length()));
+}
+
+Symbol Symbol::find(const char* name)
+{
+	return Symbol(SymbolTable::instance().find(name, std::strlen(name)));
+}
+
+Symbol Symbol::find(const char* name, std::size_t length)
+{
+	return Symbol(SymbolTable::instance().find(name, length));
+}
+
+Symbol Symbol::fromId(id_type id)
+{
+	return Symbol(SymbolTable::instance().get(id));
+}
+
+std::size_t Symbol::count()
+{
+	return SymbolTable::instance().count();
+}
+
+}
@@ -22,12 +22,104 @@
 
 #include "utility/TimerUtil.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/timeb.h>
 #include <sys/time.h>
+#include <algorithm>
+#include <limits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
 
 namespace zillians {
 
+namespace {
+
+/**
+ * The rate of the cycle counter measured against CLOCK_MONOTONIC_RAW, taken once per process.
+ */
+struct CycleCalibration
+{
+	CycleCalibration() : constant(false), ns_per_cycle(1.0), base_cycles(0), base_ns(0)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		// the invariant TSC runs at the same rate in all power states and on all cores
+		unsigned int eax, ebx, ecx, edx;
+		if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000007)
+		{
+			__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+			constant = (edx & (1 << 8)) != 0;
+		}
+		if (!constant) return;
+
+		// ten milliseconds keep the rate within a few parts per million
+		uint64_t start_cycles = 0, start_ns = 0;
+		sample(start_cycles, start_ns);
+		timespec interval = { 0, 10 * 1000 * 1000 };
+		nanosleep(&interval, NULL);
+		uint64_t stop_cycles = 0, stop_ns = 0;
+		sample(stop_cycles, stop_ns);
+
+		if (stop_cycles <= start_cycles || stop_ns <= start_ns)
+		{
+			constant = false;
+			return;
+		}
+		ns_per_cycle = (double)(stop_ns - start_ns) / (double)(stop_cycles - start_cycles);
+		base_cycles = stop_cycles;
+		base_ns = stop_ns;
+#elif defined(__aarch64__)
+		// the generic timer is constant by architecture and tells its own frequency
+		uint64_t frequency;
+		__asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (frequency));
+		if (frequency == 0) return;
+
+		constant = true;
+		ns_per_cycle = 1e9 / (double)frequency;
+		sample(base_cycles, base_ns);
+#endif
+	}
+
+	/**
+	 * Read both clocks as close together as possible, keeping the tightest of a few tries.
+	 */
+	static void sample(uint64_t& cycles, uint64_t& ns)
+	{
+		uint64_t best = std::numeric_limits<uint64_t>::max();
+		for (int i = 0; i < 5; ++i)
+		{
+			const uint64_t before = TimerUtil::cycles();
+			const uint64_t clock = TimerUtil::clock_get_time_ns();
+			const uint64_t after = TimerUtil::cycles();
+			if (after - before < best)
+			{
+				best = after - before;
+				cycles = before + (after - before) / 2;
+				ns = clock;
+			}
+		}
+	}
+
+	bool constant;
+	double ns_per_cycle;
+	uint64_t base_cycles;
+	uint64_t base_ns;
+};
+
+const CycleCalibration& calibration()
+{
+	static CycleCalibration instance;
+	return instance;
+}
+
+}
+
 uint64_t TimerUtil::clock_get_time_ms()
 {
 	timespec ts;
@@ -36,4 +128,147 @@ uint64_t TimerUtil::clock_get_time_ms()
 	return time_mu_s/1000;
 }
 
+uint64_t TimerUtil::clock_get_time_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+uint64_t TimerUtil::now_ns()
+{
+	const CycleCalibration& c = calibration();
+	if (!c.constant)
+		return clock_get_time_ns();
+
+	// counters of other cores may be a few cycles behind the calibration point
+	const int64_t delta = (int64_t)(cycles() - c.base_cycles);
+	return c.base_ns + (int64_t)((double)delta * c.ns_per_cycle);
+}
+
+uint64_t TimerUtil::cycles_to_ns(uint64_t cycles)
+{
+	return (uint64_t)((double)cycles * calibration().ns_per_cycle);
+}
+
+double TimerUtil::ns_per_cycle()
+{
+	return calibration().ns_per_cycle;
+}
+
+bool TimerUtil::has_constant_cycle_counter()
+{
+	return calibration().constant;
+}
+
+//////////////////////////////////////////////////////////////////////////
+TimerHistogram::TimerHistogram()
+{
+	reset();
+}
+
+void TimerHistogram::merge(const TimerHistogram& other)
+{
+	for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+		mCounts[i] += other.mCounts[i];
+	mCount += other.mCount;
+	mSum += other.mSum;
+	mMin = std::min(mMin, other.mMin);
+	mMax = std::max(mMax, other.mMax);
+}
+
+void TimerHistogram::reset()
+{
+	memset(mCounts, 0, sizeof(mCounts));
+	mCount = 0;
+	mSum = 0;
+	mMin = std::numeric_limits<uint64_t>::max();
+	mMax = 0;
+}
+
+double TimerHistogram::mean() const
+{
+	return (mCount == 0) ? 0.0 : (double)mSum / (double)mCount;
+}
+
+uint64_t TimerHistogram::percentile(double percentage) const
+{
+	if (mCount == 0) return 0;
+
+	const double clamped = std::max(0.0, std::min(100.0, percentage));
+	const uint64_t rank = std::max<uint64_t>(1, (uint64_t)(clamped / 100.0 * (double)mCount + 0.5));
+
+	uint64_t accumulated = 0;
+	for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		accumulated += mCounts[i];
+		if (accumulated >= rank)
+			return std::max(min(), std::min(mMax, highestOf(i)));
+	}
+	return mMax;
+}
+
+void TimerHistogram::print(const std::string& name) const
+{
+	printf("%s: count = %llu, mean = %.3lf us, min = %.3lf us, p50 = %.3lf us, p99 = %.3lf us, p99.9 = %.3lf us, max = %.3lf us\n",
+			name.c_str(), (unsigned long long)mCount, mean() / 1000.0, min() / 1000.0,
+			percentile(50.0) / 1000.0, percentile(99.0) / 1000.0, percentile(99.9) / 1000.0, mMax / 1000.0);
+}
+
+uint64_t TimerHistogram::lowestOf(std::size_t bucket)
+{
+	if (bucket < SUB_BUCKET_COUNT) return bucket;
+	const int magnitude = bucket / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+	return (uint64_t)(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << (magnitude - SUB_BUCKET_BITS);
+}
+
+uint64_t TimerHistogram::highestOf(std::size_t bucket)
+{
+	if (bucket < SUB_BUCKET_COUNT) return bucket;
+	const int magnitude = bucket / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+	return lowestOf(bucket) + ((uint64_t)1 << (magnitude - SUB_BUCKET_BITS)) - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+namespace {
+
+// shards are owned by the statistics, so they survive the threads that recorded into them
+void keepShard(TimerHistogram*)
+{ }
+
+}
+
+TimerStatistics::TimerStatistics(const std::string& name) : mName(name), mLocal(&keepShard)
+{ }
+
+TimerStatistics::~TimerStatistics()
+{ }
+
+TimerHistogram TimerStatistics::collect() const
+{
+	TimerHistogram result;
+	boost::mutex::scoped_lock lock(mShardsLock);
+	for (std::size_t i = 0; i < mShards.size(); ++i)
+		result.merge(*mShards[i]);
+	return result;
+}
+
+void TimerStatistics::reset()
+{
+	boost::mutex::scoped_lock lock(mShardsLock);
+	for (std::size_t i = 0; i < mShards.size(); ++i)
+		mShards[i]->reset();
+}
+
+TimerHistogram* TimerStatistics::registerThread()
+{
+	boost::shared_ptr<TimerHistogram> shard(new TimerHistogram());
+	{
+		boost::mutex::scoped_lock lock(mShardsLock);
+		mShards.push_back(shard);
+	}
+	mLocal.reset(shard.get());
+	return shard.get();
+}
+
 }
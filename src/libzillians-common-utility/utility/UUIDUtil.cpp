@@ -21,6 +21,181 @@
  */
 
 #include "utility/UUIDUtil.h"
+#include <boost/thread/tss.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <random>
+
+#ifdef __PLATFORM_LINUX__
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+/// Incremented in the child after fork(), so the child never repeats the ids of its parent
+volatile uint32 gForkGeneration = 0;
+
+#ifdef __PLATFORM_LINUX__
+void onFork()
+{
+	gForkGeneration = gForkGeneration + 1;
+}
+#endif
+
+inline uint64 rotl(uint64 x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+inline uint64 splitmix64(uint64& x)
+{
+	uint64 z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+inline uint64 currentMillis()
+{
+#ifdef __PLATFORM_LINUX__
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return (uint64)(boost::posix_time::microsec_clock::universal_time() - epoch).total_milliseconds();
+#endif
+}
+
+class UUIDGenerator
+{
+public:
+	UUIDGenerator() : mLastMillis(0), mCounter(0)
+	{
+		seed();
+	}
+
+public:
+	static UUIDGenerator& local()
+	{
+		static boost::thread_specific_ptr<UUIDGenerator> instance;
+
+		UUIDGenerator* generator = instance.get();
+		if(UNLIKELY(!generator))
+		{
+			generator = new UUIDGenerator();
+			instance.reset(generator);
+		}
+		else if(UNLIKELY(generator->mForkGeneration != gForkGeneration))
+		{
+			generator->seed();
+		}
+		return *generator;
+	}
+
+	/// xoshiro256**
+	inline uint64 next()
+	{
+		const uint64 result = rotl(mState[1] * 5, 7) * 9;
+		const uint64 t = mState[1] << 17;
+		mState[2] ^= mState[0];
+		mState[3] ^= mState[1];
+		mState[1] ^= mState[2];
+		mState[0] ^= mState[3];
+		mState[2] ^= t;
+		mState[3] = rotl(mState[3], 45);
+		return result;
+	}
+
+	inline void random(UUID& id)
+	{
+		id.data.u64[0] = next();
+		id.data.u64[1] = next();
+		id.data.raw.data[6] = (id.data.raw.data[6] & 0x0F) | 0x40;// version 4
+		id.data.raw.data[8] = (id.data.raw.data[8] & 0x3F) | 0x80;// RFC 4122 variant
+	}
+
+	inline void ordered(UUID& id, uint64 now)
+	{
+		// a new millisecond starts the counter at a random point in its lower
+		// half, leaving room for many more ids within the same millisecond
+		if(now > mLastMillis)
+		{
+			mLastMillis = now;
+			mCounter = (uint32)(next() >> 53);
+		}
+		else if(++mCounter > 0xFFF)
+		{
+			// counter exhausted or clock went backwards, borrow from the next millisecond
+			++mLastMillis;
+			mCounter = (uint32)(next() >> 53);
+		}
+
+		unsigned char* raw = id.data.raw.data;
+		for(int i = 0; i < 6; ++i)
+			raw[i] = (unsigned char)(mLastMillis >> (40 - i * 8));
+		raw[6] = (unsigned char)(0x70 | (mCounter >> 8));// version 7
+		raw[7] = (unsigned char)mCounter;
+
+		id.data.u64[1] = next();
+		raw[8] = (raw[8] & 0x3F) | 0x80;// RFC 4122 variant
+	}
+
+private:
+	void seed()
+	{
+#ifdef __PLATFORM_LINUX__
+		static int registered = pthread_atfork(NULL, NULL, &onFork);
+		UNUSED_ARGUMENT(registered);
+#endif
+		mForkGeneration = gForkGeneration;
+
+		// mix the entropy source with the address and time, in case the
+		// source turns out to be deterministic on some platform
+		uint64 mix = (uint64)(uintptr_t)this ^ (currentMillis() << 20);
+		std::random_device device;
+		for(int i = 0; i < 4; ++i)
+		{
+			uint64 entropy = ((uint64)device() << 32) | device();
+			mState[i] = splitmix64(mix) ^ entropy;
+		}
+		if(!(mState[0] | mState[1] | mState[2] | mState[3]))
+			mState[0] = 1;
+	}
+
+private:
+	uint64 mState[4];
+	uint64 mLastMillis;
+	uint32 mCounter;
+	uint32 mForkGeneration;
+};
+
+}
+
+void UUID::random_n(UUID* ids, std::size_t n)
+{
+	UUIDGenerator& generator = UUIDGenerator::local();
+	for(std::size_t i = 0; i < n; ++i)
+		generator.random(ids[i]);
+}
+
+void UUID::ordered(UUID& id)
+{
+	UUIDGenerator::local().ordered(id, currentMillis());
+}
+
+void UUID::ordered_n(UUID* ids, std::size_t n)
+{
+	// one clock read for the batch, the counter keeps the ids apart
+	UUIDGenerator& generator = UUIDGenerator::local();
+	const uint64 now = currentMillis();
+	for(std::size_t i = 0; i < n; ++i)
+		generator.ordered(ids[i], now);
+}
+
+}
 
 namespace boost {
 
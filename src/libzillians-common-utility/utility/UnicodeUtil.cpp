@@ -23,6 +23,10 @@
 #include "utility/UnicodeUtil.h"
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define UNKNOWN_CHAR '?'
 
 #define BOOST_UTF8_BEGIN_NAMESPACE namespace zillians {
@@ -59,8 +63,287 @@ std::locale& get_default_locale()
 	return default_locale;
 }
 
+namespace {
+
+#ifdef __SSE2__
+template<std::size_t UnitSize>
+struct AsciiBlock;
+
+/// 16 ASCII characters to or from 16-bit units
+template<>
+struct AsciiBlock<2>
+{
+	static inline void widen(__m128i v, void* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 0, _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 1, _mm_unpackhi_epi8(v, zero));
+	}
+
+	static inline bool narrow(const void* in, char* out)
+	{
+		const __m128i v0 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 0);
+		const __m128i v1 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 1);
+		const __m128i high = _mm_and_si128(_mm_or_si128(v0, v1), _mm_set1_epi16((short)0xFF80));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v0, v1));
+		return true;
+	}
+};
+
+/// 16 ASCII characters to or from 32-bit units
+template<>
+struct AsciiBlock<4>
+{
+	static inline void widen(__m128i v, void* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i lo = _mm_unpacklo_epi8(v, zero);
+		const __m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 0, _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 1, _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 2, _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128(static_cast<__m128i*>(out) + 3, _mm_unpackhi_epi16(hi, zero));
+	}
+
+	static inline bool narrow(const void* in, char* out)
+	{
+		const __m128i v0 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 0);
+		const __m128i v1 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 1);
+		const __m128i v2 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 2);
+		const __m128i v3 = _mm_loadu_si128(static_cast<const __m128i*>(in) + 3);
+		const __m128i all = _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3));
+		const __m128i high = _mm_and_si128(all, _mm_set1_epi32((int)0xFFFFFF80));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+
+		// every value fits in 7 bits, so the saturating packs just drop the zero bytes
+		const __m128i p0 = _mm_packs_epi32(v0, v1);
+		const __m128i p1 = _mm_packs_epi32(v2, v3);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(p0, p1));
+		return true;
+	}
+};
+#endif
+
+/**
+ * Widen the leading ASCII characters of the input, return how many were converted.
+ */
+template<typename UnitT>
+inline std::size_t widen_ascii(const unsigned char* in, std::size_t length, UnitT* out)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	for(; length - i >= 16; i += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		if(_mm_movemask_epi8(v) != 0)
+			break;
+		AsciiBlock<sizeof(UnitT)>::widen(v, out + i);
+	}
+#endif
+	for(; i < length && in[i] < 0x80; ++i)
+		out[i] = static_cast<UnitT>(in[i]);
+	return i;
+}
+
+/**
+ * Narrow the leading ASCII characters of the input, return how many were converted.
+ */
+template<typename UnitT>
+inline std::size_t narrow_ascii(const UnitT* in, std::size_t length, char* out)
+{
+	std::size_t i = 0;
+#ifdef __SSE2__
+	for(; length - i >= 16; i += 16)
+	{
+		if(!AsciiBlock<sizeof(UnitT)>::narrow(in + i, out + i))
+			break;
+	}
+#endif
+	for(; i < length && static_cast<boost::uint32_t>(in[i]) < 0x80; ++i)
+		out[i] = static_cast<char>(in[i]);
+	return i;
+}
+
+inline bool decode_code_point(const unsigned char*& p, const unsigned char* end, boost::uint32_t& cp)
+{
+	const unsigned char c = *p;
+	std::size_t trailing;
+	boost::uint32_t min;
+	if((c & 0xE0) == 0xC0)      { trailing = 1; cp = c & 0x1F; min = 0x80; }
+	else if((c & 0xF0) == 0xE0) { trailing = 2; cp = c & 0x0F; min = 0x800; }
+	else if((c & 0xF8) == 0xF0) { trailing = 3; cp = c & 0x07; min = 0x10000; }
+	else return false;
+
+	if((std::size_t)(end - p) <= trailing)
+		return false;
+	for(std::size_t i = 1; i <= trailing; ++i)
+	{
+		if((p[i] & 0xC0) != 0x80)
+			return false;
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+
+	if(cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+		return false;
+
+	p += trailing + 1;
+	return true;
+}
+
+inline bool encode_code_point(boost::uint32_t cp, char*& out)
+{
+	if(cp < 0x80)
+	{
+		*out++ = static_cast<char>(cp);
+	}
+	else if(cp < 0x800)
+	{
+		*out++ = static_cast<char>(0xC0 | (cp >> 6));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	else if(cp < 0x10000)
+	{
+		if(cp >= 0xD800 && cp <= 0xDFFF)
+			return false;
+		*out++ = static_cast<char>(0xE0 | (cp >> 12));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	else if(cp <= 0x10FFFF)
+	{
+		*out++ = static_cast<char>(0xF0 | (cp >> 18));
+		*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+template<typename UnitT>
+bool decode_utf8(const char* input, std::size_t length, UnitT* output, std::size_t& written)
+{
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(input);
+	const unsigned char* const end = p + length;
+	UnitT* out = output;
+
+	while(true)
+	{
+		const std::size_t n = widen_ascii(p, end - p, out);
+		p += n;
+		out += n;
+		if(p == end)
+			break;
+
+		boost::uint32_t cp;
+		if(!decode_code_point(p, end, cp))
+		{
+			written = out - output;
+			return false;
+		}
+
+		if(sizeof(UnitT) == 2 && cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			*out++ = static_cast<UnitT>(0xD800 + (cp >> 10));
+			*out++ = static_cast<UnitT>(0xDC00 + (cp & 0x3FF));
+		}
+		else
+		{
+			*out++ = static_cast<UnitT>(cp);
+		}
+	}
+
+	written = out - output;
+	return true;
+}
+
+template<typename UnitT>
+bool encode_utf8(const UnitT* input, std::size_t length, char* output, std::size_t& written)
+{
+	const UnitT* in = input;
+	const UnitT* const end = in + length;
+	char* out = output;
+
+	while(true)
+	{
+		const std::size_t n = narrow_ascii(in, end - in, out);
+		in += n;
+		out += n;
+		if(in == end)
+			break;
+
+		boost::uint32_t cp = static_cast<boost::uint32_t>(*in++);
+		if(sizeof(UnitT) == 2)
+		{
+			cp &= 0xFFFF;
+			if(cp >= 0xD800 && cp <= 0xDBFF && in != end)
+			{
+				const boost::uint32_t low = static_cast<boost::uint32_t>(*in) & 0xFFFF;
+				if(low >= 0xDC00 && low <= 0xDFFF)
+				{
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					++in;
+				}
+			}
+		}
+
+		if(!encode_code_point(cp, out))
+		{
+			written = out - output;
+			return false;
+		}
+	}
+
+	written = out - output;
+	return true;
+}
+
+}
+
+bool utf8_to_ucs4(const char* input, std::size_t length, wchar_t* output, std::size_t& written)
+{
+	return decode_utf8(input, length, output, written);
+}
+
+bool ucs4_to_utf8(const wchar_t* input, std::size_t length, char* output, std::size_t& written)
+{
+	return encode_utf8(input, length, output, written);
+}
+
+bool utf8_to_utf16(const char* input, std::size_t length, boost::uint16_t* output, std::size_t& written)
+{
+	return decode_utf8(input, length, output, written);
+}
+
+bool utf16_to_utf8(const boost::uint16_t* input, std::size_t length, char* output, std::size_t& written)
+{
+	return encode_utf8(input, length, output, written);
+}
+
 void utf8_to_ucs4(const std::string& input, std::wstring& output)
 {
+	if(input.empty())
+		return;
+
+	const std::size_t offset = output.size();
+	std::size_t written = 0;
+	output.resize(offset + input.size());
+	if(utf8_to_ucs4(input.data(), input.size(), &output[offset], written))
+	{
+		output.resize(offset + written);
+		return;
+	}
+
+	// let the iterator report the invalid sequence as before
+	output.resize(offset);
 	typedef boost::u8_to_u32_iterator<std::string::const_iterator> iterator_type;
 	iterator_type first(input.begin());
 	iterator_type last(input.end());
@@ -69,6 +352,19 @@ void utf8_to_ucs4(const std::string& input, std::wstring& output)
 
 void ucs4_to_utf8(const std::wstring& input, std::string& output)
 {
+	if(input.empty())
+		return;
+
+	const std::size_t offset = output.size();
+	std::size_t written = 0;
+	output.resize(offset + 4 * input.size());
+	if(ucs4_to_utf8(input.data(), input.size(), &output[offset], written))
+	{
+		output.resize(offset + written);
+		return;
+	}
+
+	output.resize(offset);
 	typedef boost::u32_to_u8_iterator<std::wstring::const_iterator> iterator_type;
 	iterator_type first(input.begin());
 	iterator_type last(input.end());
@@ -89,24 +385,36 @@ void cstr_to_wcs(const char* src, wchar_t* dest)
 
 std::wstring s_to_ws(std::string s)
 {
-    std::wstring ws;
-    wchar_t* wcs = new wchar_t[s.length() + 1];
-    wcs[s.length()] = L'\0';
-    cstr_to_wcs(s.c_str(), wcs);
-    ws = wcs;
-    delete []wcs;
-    return ws;
+	// like cstr_to_wcs(), stop at the first null character
+	const std::size_t length = std::min(s.size(), s.find('\0'));
+	std::wstring ws(length, L'\0');
+	if(length == 0)
+		return ws;
+
+	// ASCII widens to itself, only the rest needs the facet
+	const std::size_t n = widen_ascii(reinterpret_cast<const unsigned char*>(s.data()), length, &ws[0]);
+	if(n < length)
+	{
+		static std::locale ascii_locale;
+		std::use_facet<std::ctype<wchar_t> >(ascii_locale).widen(s.data() + n, s.data() + length, &ws[n]);
+	}
+	return ws;
 }
 
 std::string ws_to_s(std::wstring ws)
 {
-    std::string s;
-    char* cstr = new char[ws.length() + 1];
-    cstr[ws.length()] = '\0';
-    wcs_to_cstr(ws.c_str(), cstr);
-    s = cstr;
-    delete []cstr;
-    return s;
+	const std::size_t length = std::min(ws.size(), ws.find(L'\0'));
+	std::string s(length, '\0');
+	if(length == 0)
+		return s;
+
+	const std::size_t n = narrow_ascii(ws.data(), length, &s[0]);
+	if(n < length)
+	{
+		static std::locale ascii_locale;
+		std::use_facet<std::ctype<wchar_t> >(ascii_locale).narrow(ws.data() + n, ws.data() + length, UNKNOWN_CHAR, &s[n]);
+	}
+	return s;
 }
 
 }
@@ -21,24 +21,442 @@
  */
 
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include "utility/archive/Archive.h"
+#include "core/MappedFileBufferAllocator.h"
+#include "utility/sha1.h"
+#include <boost/unordered_set.hpp>
+#include <tbb/pipeline.h>
+#include <tbb/atomic.h>
+#include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 
 namespace zillians {
 
-Archive::Archive(const std::string& archive_name, ArchiveMode mode) :
+namespace {
+
+inline uint32 readLE16(const byte* p)
+{
+	return (uint32)(unsigned char)p[0] | ((uint32)(unsigned char)p[1] << 8);
+}
+
+inline uint32 readLE32(const byte* p)
+{
+	return readLE16(p) | (readLE16(p + 2) << 16);
+}
+
+inline uint64 readLE64(const byte* p)
+{
+	return (uint64)readLE32(p) | ((uint64)readLE32(p + 4) << 32);
+}
+
+inline void writeLE32(unsigned char* p, uint32 value)
+{
+	p[0] = value & 0xFF;
+	p[1] = (value >> 8) & 0xFF;
+	p[2] = (value >> 16) & 0xFF;
+	p[3] = (value >> 24) & 0xFF;
+}
+
+inline void appendLE16(std::vector<unsigned char>& out, uint32 value)
+{
+	out.push_back(value & 0xFF);
+	out.push_back((value >> 8) & 0xFF);
+}
+
+inline void appendLE32(std::vector<unsigned char>& out, uint32 value)
+{
+	appendLE16(out, value & 0xFFFF);
+	appendLE16(out, value >> 16);
+}
+
+inline void appendLE64(std::vector<unsigned char>& out, uint64 value)
+{
+	appendLE32(out, (uint32)value);
+	appendLE32(out, (uint32)(value >> 32));
+}
+
+/**
+ * Layout of packed archives, all integers are little-endian:
+ *
+ *   header     : uint32 signature, uint32 version
+ *   entries    : the data as it is if stored, otherwise frames of uint32 size (with the high bit set if the frame is
+ *                stored) followed by the data, every frame but the last one holding frame size bytes uncompressed
+ *   dictionary : what the codec is initialized with, if any
+ *   index      : per entry uint16 name length, name, uint8 method, uint64 offset, uint64 size, uint64 uncompressed size, uint32 crc
+ *   trailer    : uint64 index offset, uint64 entry count, uint32 dictionary size, uint32 frame size, uint32 codec, uint32 version, uint32 signature
+ */
+const uint32 PACK_SIGNATURE = 0x4b41505a; // "ZPAK"
+const uint32 PACK_VERSION = 1;
+
+const std::size_t PACK_HEADER_SIZE = 8;
+const std::size_t PACK_TRAILER_SIZE = 36;
+const std::size_t PACK_INDEX_RECORD_SIZE = 31; // without the name
+const std::size_t PACK_FRAME_HEADER_SIZE = 4;
+
+const uint32 PACK_FRAME_STORED = 0x80000000;
+const std::size_t PACK_FRAME_SIZE = 1024 * 1024;
+const std::size_t PACK_MAX_FRAME_SIZE = 1024 * 1024 * 1024;
+
+const int PACK_METHOD_STORED = 0;
+const int PACK_METHOD_FRAMES = 1;
+
+/**
+ * Append a frame to the output, which is stored if the codec doesn't make it smaller.
+ *
+ * @return True if the frame is compressed
+ */
+bool appendFrame(const ArchiveCodec& codec, const unsigned char* data, std::size_t size, std::vector<unsigned char>& out)
+{
+	const std::size_t begin = out.size();
+	out.resize(begin + PACK_FRAME_HEADER_SIZE + std::max(size, codec.compressBound(size)));
+
+	unsigned char* payload = &out[begin + PACK_FRAME_HEADER_SIZE];
+	std::size_t compressed = codec.compress(data, size, payload, out.size() - begin - PACK_FRAME_HEADER_SIZE);
+	const bool stored = (compressed == 0 || compressed >= size);
+	if (stored)
+	{
+		std::memcpy(payload, data, size);
+		compressed = size;
+	}
+
+	out.resize(begin + PACK_FRAME_HEADER_SIZE + compressed);
+	writeLE32(&out[begin], compressed | (stored ? PACK_FRAME_STORED : 0));
+	return !stored;
+}
+
+/**
+ * Prepare an entry of a packed archive as a whole.
+ *
+ * @param codec : the codec to compress with, or NULL to store the entry
+ * @return The method of the entry
+ */
+int packEntry(const ArchiveCodec* codec, const unsigned char* data, std::size_t size, std::vector<unsigned char>& out)
+{
+	out.clear();
+	bool compressed = false;
+	if (codec != NULL)
+	{
+		for (std::size_t offset = 0; offset < size; offset += PACK_FRAME_SIZE)
+			compressed |= appendFrame(*codec, data + offset, std::min(PACK_FRAME_SIZE, size - offset), out);
+	}
+
+	// nothing could be saved, so store it as it is, which the mapped archive serves without copy
+	if (!compressed)
+	{
+		out.assign(data, data + size);
+		return PACK_METHOD_STORED;
+	}
+	return PACK_METHOD_FRAMES;
+}
+
+bool decodeFrames(ArchiveCodec& codec, const byte* source, uint64 source_size, byte* dest, uint64 dest_size, std::size_t frame_size)
+{
+	const byte* end = source + source_size;
+	while (dest_size > 0)
+	{
+		if ((std::size_t)(end - source) < PACK_FRAME_HEADER_SIZE) return false;
+		const uint32 header = readLE32(source);
+		source += PACK_FRAME_HEADER_SIZE;
+
+		const std::size_t size = header & ~PACK_FRAME_STORED;
+		const std::size_t uncompressed_size = std::min<uint64>(frame_size, dest_size);
+		if ((std::size_t)(end - source) < size) return false;
+
+		if (header & PACK_FRAME_STORED)
+		{
+			if (size != uncompressed_size) return false;
+			std::memcpy(dest, source, size);
+		}
+		else
+		{
+			if (!codec.decompress((const unsigned char*)source, size, (unsigned char*)dest, uncompressed_size)) return false;
+		}
+
+		source += size;
+		dest += uncompressed_size;
+		dest_size -= uncompressed_size;
+	}
+	return source == end;
+}
+
+std::string contentHash(const unsigned char* data, std::size_t size)
+{
+	unsigned char hash[20];
+	sha1::Context context;
+	context.update(data, size);
+	context.final(hash);
+	return std::string((const char*)hash, sizeof(hash));
+}
+
+/**
+ * A file of Archive::addAll() on its way through the pipeline.
+ */
+struct PendingFile
+{
+	PendingFile(const std::string& filename) : filename(filename), method(0), crc(0), size(0), stamp_size(0), stamp_time(0), duplicate(false), prepared(false)
+	{ }
+
+	std::string filename;
+	std::vector<unsigned char> compressed;
+	int method;
+	uLong crc;
+	ZPOS64_T size;
+
+	// only for deduplication, the hash is known before the file is read if the hash cache has it
+	std::string hash;
+	uint64 stamp_size;
+	uint64 stamp_time;
+	bool duplicate;
+
+	// false if the file is too large to be compressed as a whole, or a known duplicate, which is then left to the writer
+	bool prepared;
+};
+
+typedef boost::shared_ptr<PendingFile> PendingFilePtr;
+
+class PendingFileProducer
+{
+public:
+	typedef boost::function< void(PendingFile& file) > Stamper;
+
+	PendingFileProducer(const std::vector<std::string>& filenames, std::size_t* next, const tbb::atomic<bool>* failed, const Stamper& stamp) :
+		mFilenames(filenames), mNext(next), mFailed(failed), mStamp(stamp)
+	{ }
+
+	PendingFilePtr operator() (tbb::flow_control& control) const
+	{
+		if (*mFailed || *mNext == mFilenames.size())
+		{
+			control.stop();
+			return PendingFilePtr();
+		}
+
+		PendingFilePtr file(new PendingFile(mFilenames[(*mNext)++]));
+		if (mStamp)
+			mStamp(*file);
+		return file;
+	}
+
+private:
+	const std::vector<std::string>& mFilenames;
+	std::size_t* mNext;
+	const tbb::atomic<bool>* mFailed;
+	Stamper mStamp;
+};
+
+class PendingFileCompressor
+{
+public:
+	PendingFileCompressor(const ArchiveCodec* codec, bool packed, bool hash, std::size_t chunk_size) : mCodec(codec), mPacked(packed), mHash(hash), mChunkSize(chunk_size)
+	{ }
+
+	PendingFilePtr operator() (PendingFilePtr file) const
+	{
+		// the writer refers to the content added before, no need to read it
+		if (file->duplicate) return file;
+
+		// anything unexpected leaves the file to the writer, which reports the error if there's really one
+		std::ifstream in(file->filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+		if (!in) return file;
+
+		std::streamoff size = in.tellg();
+		if (size < 0 || static_cast<std::size_t>(size) > mChunkSize) return file;
+		in.seekg(0, std::ios::beg);
+
+		std::vector<unsigned char> raw(size);
+		if (size > 0 && !in.read((char*)&raw[0], size)) return file;
+
+		const unsigned char* data = raw.empty() ? NULL : &raw[0];
+		file->crc = crc32(0, data, raw.size());
+		file->size = raw.size();
+		if (mHash && file->hash.empty())
+			file->hash = contentHash(data, raw.size());
+
+		if (mPacked)
+		{
+			file->method = packEntry(mCodec, data, raw.size(), file->compressed);
+		}
+		else
+		if (mCodec == NULL)
+		{
+			// level 0 stores the file as it is
+			file->method = 0;
+			file->compressed.swap(raw);
+		}
+		else
+		{
+			file->compressed.resize(mCodec->compressBound(raw.size()));
+			std::size_t compressed = mCodec->compress(data, raw.size(), &file->compressed[0], file->compressed.size());
+			if (compressed == 0)
+			{
+				std::vector<unsigned char>().swap(file->compressed);
+				return file;
+			}
+			file->compressed.resize(compressed);
+			file->method = Z_DEFLATED;
+		}
+
+		file->prepared = true;
+		return file;
+	}
+
+private:
+	const ArchiveCodec* mCodec;
+	bool mPacked;
+	bool mHash;
+	std::size_t mChunkSize;
+};
+
+class PendingFileWriter
+{
+public:
+	typedef boost::function< bool(const std::string& filename, const std::vector<unsigned char>& data, int method, ZPOS64_T size, uLong crc, const std::string& hash) > PreparedFileWriter;
+	typedef boost::function< void(const std::string& filename, uint64 size, uint64 time, const std::string& hash) > HashRecorder;
+
+	PendingFileWriter(Archive& archive, const PreparedFileWriter& write_prepared, const HashRecorder& record_hash, tbb::atomic<bool>* failed) :
+		mArchive(archive), mWritePrepared(write_prepared), mRecordHash(record_hash), mFailed(failed)
+	{ }
+
+	void operator() (PendingFilePtr file) const
+	{
+		if (*mFailed) return;
+
+		if (!file->prepared)
+		{
+			*mFailed = !mArchive.add(file->filename);
+			return;
+		}
+
+		if (!mWritePrepared(file->filename, file->compressed, file->method, file->size, file->crc, file->hash))
+			*mFailed = true;
+		else if (mRecordHash && !file->hash.empty())
+			mRecordHash(file->filename, file->stamp_size, file->stamp_time, file->hash);
+	}
+
+private:
+	Archive& mArchive;
+	PreparedFileWriter mWritePrepared;
+	HashRecorder mRecordHash;
+	tbb::atomic<bool>* mFailed;
+};
+
+bool appendToBuffer(const ArchiveItem_t& item, const unsigned char* data, std::size_t size, std::vector<unsigned char>* buffer)
+{
+	if (data == NULL)
+		buffer->reserve(item.unzip_info.uncompressed_size);
+	else
+		buffer->insert(buffer->end(), data, data + size);
+	return true;
+}
+
+bool isPath(const std::string& path)
+{
+    return !path.empty() && path[path.size()-1] == '/';
+}
+
+/**
+ * Write entries to a folder while they are extracted.
+ */
+class FolderWriter
+{
+public:
+	FolderWriter(const boost::filesystem::path& folder, std::vector<ArchiveItem_t>* archive_items) :
+		mFolder(folder), mArchiveItems(archive_items), mFile(new std::ofstream())
+	{ }
+
+	bool operator() (const ArchiveItem_t& item, const unsigned char* data, std::size_t size) const
+	{
+		if (data != NULL)
+		{
+			mFile->write((const char*)data, size);
+			return mFile->good();
+		}
+
+		mArchiveItems->push_back(item);
+		mFile->close();
+		mFile->clear();
+
+		boost::filesystem::path path = mFolder / item.filename;
+		if (isPath(item.filename))
+		{
+			boost::filesystem::create_directories(path);
+			return true;
+		}
+
+		if (path.has_parent_path())
+			boost::filesystem::create_directories(path.parent_path());
+		mFile->open(path.string().c_str(), std::ios::out | std::ios::binary);
+		return mFile->good();
+	}
+
+private:
+	boost::filesystem::path mFolder;
+	std::vector<ArchiveItem_t>* mArchiveItems;
+	boost::shared_ptr<std::ofstream> mFile;
+};
+
+/**
+ * Release the mapped archive and then the mapping allocator, which must outlive the buffer.
+ */
+class MappedArchiveDeleter
+{
+public:
+	MappedArchiveDeleter(const shared_ptr<MappedFileBufferAllocator>& file) : mFile(file)
+	{ }
+
+	void operator() (Buffer* buffer) const
+	{
+		delete buffer;
+	}
+
+private:
+	shared_ptr<MappedFileBufferAllocator> mFile;
+};
+
+
+const uint32 LOCAL_HEADER_SIGNATURE = 0x04034b50;
+const uint32 CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+const uint32 END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+const uint32 ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06064b50;
+const uint32 ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE = 0x07064b50;
+
+const std::size_t LOCAL_HEADER_SIZE = 30;
+const std::size_t CENTRAL_HEADER_SIZE = 46;
+const std::size_t END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+const std::size_t ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE = 56;
+const std::size_t ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE = 20;
+
+}
+
+Archive::Archive(const std::string& archive_name, ArchiveMode mode, ArchiveCodecType codec) :
 	mArchive(NULL),
 	mArchiveName(archive_name),
 	mArchiveMode(mode),
-	mCompressLevel(Z_DEFAULT_COMPRESSION)
+	mCompressLevel(Z_DEFAULT_COMPRESSION),
+	mChunkSize(DEFAULT_CHUNK_SIZE),
+	mCodec(codec),
+	mPackFile(NULL),
+	mPackFrameSize(PACK_FRAME_SIZE),
+	mDeduplicate(false),
+	mDirectIoThreshold(0)
 {
     open();
 }
-
 Archive::~Archive()
 {
-	if (!!mArchive)
+	if (!!mArchive || mPackFile || mMappedArchive)
 	{
 		close();
 	}
@@ -48,19 +466,39 @@ bool Archive::open()
 {
 	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_COMPRESS)
 	{
+		if (mCodec != ARCHIVE_CODEC_ZIP) return openPacked();
 		mArchive = zipOpen64(mArchiveName.c_str(), 0);
 	}
 	else
 	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_DECOMPRESS)
 	{
+		// packed archives are recognized by their header, anything else is left to minizip
+		mCodec = ARCHIVE_CODEC_ZIP;
+		if (openPacked()) return true;
 		mArchive = unzOpen64(mArchiveName.c_str());
 	}
+	else
+	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_MAPPED)
+	{
+		return openMapped();
+	}
 
 	return mArchive != NULL;
 }
 
 bool Archive::close()
 {
+	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_MAPPED)
+	{
+		if (!mMappedArchive) return false;
+
+		// views handed out keep the mapping alive
+		mMappedArchive.reset();
+		mMappedEntries.clear();
+		return true;
+	}
+
+	if (mPackFile != NULL) return closePacked();
 	if (mArchive == NULL) return false;
 
 	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_COMPRESS)
@@ -78,55 +516,171 @@ bool Archive::close()
 }
 
 
-bool Archive::add(ArchiveItem_t& archive_item)
+bool Archive::openNewFile(const std::string& filename, zip_fileinfo& zip_info, bool raw, bool large_file)
 {
-	if (mArchive == NULL || mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS) return false;
-
-	// Open file in the archive
-	int result = ZIP_OK;
-	result = zipOpenNewFileInZip3_64(mArchive, archive_item.filename.c_str(), &archive_item.zip_info,
+	int result = zipOpenNewFileInZip3_64(mArchive, filename.c_str(), &zip_info,
 								NULL, 0, NULL, 0, NULL /* comment */,
-								Z_DEFLATED,
-								mCompressLevel, 0,
+								(mCompressLevel == 0) ? 0 : Z_DEFLATED,
+								mCompressLevel, raw ? 1 : 0,
 								/* -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, */
 								-MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
-								NULL /* PASSWORD */, 0 /* CRC */, 0 /* large file */);
-	if (result != ZIP_OK) return false;
+								NULL /* PASSWORD */, 0 /* CRC */, large_file ? 1 : 0 /* large file */);
+	return result == ZIP_OK;
+}
+
+bool Archive::addPrepared(const std::string& filename, const std::vector<unsigned char>& data, int method, ZPOS64_T size, uLong crc, const std::string& hash)
+{
+	if (mPackFile != NULL)
+	{
+		if (!hash.empty() && addReference(filename, hash)) return true;
+		if (!writePacked(filename, data.empty() ? NULL : &data[0], data.size(), method, size, crc)) return false;
+		if (!hash.empty()) rememberContent(hash);
+		return true;
+	}
+
+	// the data is compressed already, so write it raw along with its CRC and size
+	zip_fileinfo zip_info;
+	std::memset(&zip_info, 0, sizeof(zip_fileinfo));
+	if (zipOpenNewFileInZip2_64(mArchive, filename.c_str(), &zip_info, NULL, 0, NULL, 0, NULL /* comment */,
+								method, mCompressLevel, 1 /* raw */, 0 /* large file */) != ZIP_OK) return false;
+
+	bool success = data.empty() || zipWriteInFileInZip(mArchive, &data[0], data.size()) == ZIP_OK;
+	if (zipCloseFileInZipRaw64(mArchive, size, crc) != ZIP_OK) return false;
+
+	return success;
+}
+
+ArchiveCodec* Archive::codec()
+{
+	if (!mCodecInstance)
+		mCodecInstance = ArchiveCodec::create(mCodec, mCompressLevel, mDictionary);
+	return mCodecInstance.get();
+}
+
+bool Archive::add(ArchiveItem_t& archive_item)
+{
+	if ((mArchive == NULL && mPackFile == NULL) || mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS) return false;
+
+	if (mPackFile != NULL)
+	{
+		const unsigned char* data = archive_item.buffer.empty() ? NULL : &archive_item.buffer[0];
+		std::string hash;
+		if (mDeduplicate)
+		{
+			hash = contentHash(data, archive_item.buffer.size());
+			if (addReference(archive_item.filename, hash)) return true;
+		}
+
+		std::vector<unsigned char> packed;
+		int method = packEntry((mCompressLevel == 0) ? NULL : codec(), data, archive_item.buffer.size(), packed);
+		if (!writePacked(archive_item.filename, packed.empty() ? NULL : &packed[0], packed.size(), method,
+							archive_item.buffer.size(), crc32(0, data, archive_item.buffer.size()))) return false;
+		if (mDeduplicate) rememberContent(hash);
+		return true;
+	}
+
+	// Open file in the archive
+	if (!openNewFile(archive_item.filename, archive_item.zip_info, false, false)) return false;
 
 	// Write buffer to the file in the archive
-	result = zipWriteInFileInZip(mArchive, &archive_item.buffer[0], archive_item.buffer.size());
-	if (result != ZIP_OK) return false;
+	int result = ZIP_OK;
+	if (!archive_item.buffer.empty())
+		result = zipWriteInFileInZip(mArchive, &archive_item.buffer[0], archive_item.buffer.size());
 
 	// Close the file in the archive
-	result = zipCloseFileInZip(mArchive);
-	if (result != ZIP_OK) return false;
+	if (zipCloseFileInZip(mArchive) != ZIP_OK) return false;
 
-	return true;
+	return result == ZIP_OK;
 }
 
 bool Archive::add(const std::string& filename)
 {
-	if (mArchive == NULL || mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS) return false;
+	if ((mArchive == NULL && mPackFile == NULL) || mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS) return false;
+	if (mPackFile != NULL) return addPacked(filename);
 
-	ArchiveItem_t archive_item;
-	archive_item.filename = filename;
-
-	// read the file into the buffer
 	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-	archive_item.buffer.resize( file.tellg() );
+	if (!file) return false;
+	std::streamoff size = file.tellg();
+	if (size < 0) return false;
 	file.seekg(0, std::ios::beg);
-	file.read( (char*)&archive_item.buffer[0], archive_item.buffer.size() );
-	file.close();
 
-	// TODO: fill the archive_item.zip_info (which inculdes file date)
-	std::memset(&archive_item.zip_info, 0, sizeof(zip_fileinfo));
+	// TODO: fill the zip_info (which inculdes file date)
+	zip_fileinfo zip_info;
+	std::memset(&zip_info, 0, sizeof(zip_fileinfo));
+
+	if (!openNewFile(filename, zip_info, false, size >= 0xffffffffLL)) return false;
+
+	// read and compress the file chunk by chunk
+	std::vector<char> chunk(std::max<std::size_t>(1, std::min<std::size_t>(mChunkSize, size)));
+	int result = ZIP_OK;
+	while (result == ZIP_OK && file)
+	{
+		file.read(&chunk[0], chunk.size());
+		if (file.gcount() > 0)
+			result = zipWriteInFileInZip(mArchive, &chunk[0], file.gcount());
+	}
+	if (!file.eof())
+		result = ZIP_ERRNO;
+
+	// Close the file in the archive
+	if (zipCloseFileInZip(mArchive) != ZIP_OK) return false;
+
+	return result == ZIP_OK;
+}
+
+bool Archive::addAll(const std::vector<std::string>& filenames, std::size_t thread_count)
+{
+	if ((mArchive == NULL && mPackFile == NULL) || mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS) return false;
+
+	if (thread_count == 0)
+		thread_count = std::max(1u, boost::thread::hardware_concurrency());
+
+	// read in order, compress in parallel, write in order, with at most thread_count files in flight
+	std::size_t next = 0;
+	tbb::atomic<bool> failed;
+	failed = false;
+	const ArchiveCodec* compressor = (mCompressLevel == 0) ? NULL : codec();
+
+	// files with cached hashes are checked in order, so a duplicate is known before anyone reads it, and the writer
+	// then finds the content it refers to written already
+	const bool deduplicate = (mPackFile != NULL && mDeduplicate);
+	boost::unordered_set<std::string> claimed;
+	PendingFileProducer::Stamper stamp;
+	PendingFileWriter::HashRecorder record_hash;
+	if (deduplicate)
+	{
+		for (boost::unordered_map<std::string, MappedEntry>::const_iterator it = mContentEntries.begin(); it != mContentEntries.end(); ++it)
+			claimed.insert(it->first);
+		stamp = [this, &claimed](PendingFile& file) {
+			if (stampFile(file.filename, file.stamp_size, file.stamp_time, file.hash))
+				file.duplicate = !claimed.insert(file.hash).second;
+		};
+		if (!mHashCacheName.empty())
+			record_hash = boost::bind(&Archive::rememberHash, this, _1, _2, _3, _4);
+	}
 
-	return add(archive_item);
+	tbb::parallel_pipeline(thread_count,
+			tbb::make_filter<void, PendingFilePtr>(tbb::filter::serial_in_order, PendingFileProducer(filenames, &next, &failed, stamp)) &
+			tbb::make_filter<PendingFilePtr, PendingFilePtr>(tbb::filter::parallel, PendingFileCompressor(compressor, mPackFile != NULL, deduplicate, mChunkSize)) &
+			tbb::make_filter<PendingFilePtr, void>(tbb::filter::serial_in_order, PendingFileWriter(*this, boost::bind(&Archive::addPrepared, this, _1, _2, _3, _4, _5, _6), record_hash, &failed)));
+
+	return !failed;
 }
 
 bool Archive::extractAll(std::vector<ArchiveItem_t>& archive_items)
 {
-	if (mArchive == NULL || mArchiveMode != ArchiveMode::ARCHIVE_FILE_DECOMPRESS) return false;
+	if ((mArchive == NULL && mPackFile == NULL) || mArchiveMode != ArchiveMode::ARCHIVE_FILE_DECOMPRESS) return false;
+
+	if (mPackFile != NULL)
+	{
+		archive_items.resize(mPackedEntries.size());
+		for (std::size_t i = 0; i < mPackedEntries.size(); ++i)
+		{
+			archive_items[i].buffer.clear();
+			if (!extractPackedEntry(mPackedEntries[i], archive_items[i], boost::bind(appendToBuffer, _1, _2, _3, &archive_items[i].buffer))) return false;
+		}
+		return true;
+	}
 
     unz_global_info64 global_info;
 
@@ -149,48 +703,213 @@ bool Archive::extractAll(std::vector<ArchiveItem_t>& archive_items)
 	return true;
 }
 
-static bool isPath(const std::string& path)
+bool Archive::extractAll(const ExtractHandler& handler)
 {
-    return path[path.size()-1] == '/';
+	if ((mArchive == NULL && mPackFile == NULL) || mArchiveMode != ArchiveMode::ARCHIVE_FILE_DECOMPRESS) return false;
+
+	if (mPackFile != NULL)
+	{
+		for (std::size_t i = 0; i < mPackedEntries.size(); ++i)
+		{
+			ArchiveItem_t archive_item;
+			if (!extractPackedEntry(mPackedEntries[i], archive_item, handler)) return false;
+		}
+		return true;
+	}
+
+    unz_global_info64 global_info;
+
+    if ( unzGetGlobalInfo64(mArchive, &global_info) != UNZ_OK) return false;
+
+    for (size_t i = 0; i < global_info.number_entry; i++)
+    {
+    	ArchiveItem_t archive_item;
+    	if (!extractCurrentFile(archive_item, handler)) return false;
+
+    	if (i != global_info.number_entry - 1)
+    	{
+    		int result = unzGoToNextFile(mArchive);
+    		if (result != UNZ_OK) return false;
+    	}
+    }
+
+	return true;
 }
 
-bool Archive::extractAllToFolder(std::vector<ArchiveItem_t>& archive_items, std::string folder_path)
+bool Archive::extractAllToFolder(std::vector<ArchiveItem_t>& archive_items, std::string folder_path, std::size_t thread_count)
 {
-    // change to the target folder
-	if (!extractAll(archive_items)) return false;
-
     if (!folder_path.empty())
     {
-        boost::filesystem3::create_directories(folder_path);
+        boost::filesystem::create_directories(folder_path);
     }
 
-    boost::filesystem3::path originalCurrentPath = boost::filesystem3::current_path();
-    boost::filesystem3::current_path(folder_path);
+	if (thread_count == 0)
+		thread_count = std::max(1u, boost::thread::hardware_concurrency());
+
+	archive_items.clear();
+	if (thread_count > 1 && (mArchive != NULL || mPackFile != NULL) && mArchiveMode == ArchiveMode::ARCHIVE_FILE_DECOMPRESS)
+	{
+		bool handled = false;
+		bool success = extractAllInParallel(archive_items, folder_path, thread_count, handled);
+		if (handled) return success;
+		archive_items.clear();
+	}
+
+	// write each file to the disk while it's being extracted
+	return extractAll(FolderWriter(folder_path, &archive_items));
+}
 
-	// Now, write to the disk
-	for (size_t i = 0; i < archive_items.size(); i++)
+bool Archive::extractAllInParallel(std::vector<ArchiveItem_t>& archive_items, const boost::filesystem::path& folder, std::size_t thread_count, bool& handled)
+{
+	// anything the index can't be read from directly is left to the sequential extraction
+	shared_ptr<MappedFileBufferAllocator> file;
+	try
+	{
+		file.reset(new MappedFileBufferAllocator(mArchiveName));
+	}
+	catch (const std::runtime_error&)
 	{
+		return false;
+	}
+
+	const std::size_t size = file->fileSize();
+	const byte* base = file->map();
+	if (base == NULL) return false;
+
+	std::vector<PackedEntry> entries;
+	if (mPackFile != NULL)
+		entries = mPackedEntries;
+	else if (!readCentralDirectory(base, size, entries))
+		return false;
+	handled = true;
+
+	// the directories are made up front, so the workers never race on them
+	archive_items.resize(entries.size());
+	std::vector<std::size_t> order;
+	order.reserve(entries.size());
+	for (std::size_t i = 0; i < entries.size(); ++i)
+	{
+		const MappedEntry& entry = entries[i].second;
 		ArchiveItem_t& item = archive_items[i];
-        if(isPath(item.filename))
-        {
-            boost::filesystem::create_directories(item.filename);
-        }
-        else
-        {
-            std::ofstream file(item.filename.c_str(), std::ios::out | std::ios::binary);
-            file.write((char*)&item.buffer[0], item.buffer.size());
-            file.close();
-        }
+		item.filename = entries[i].first;
+		std::memset(&item.unzip_info, 0, sizeof(unz_file_info64));
+		item.unzip_info.compression_method = entry.method;
+		item.unzip_info.crc = entry.crc;
+		item.unzip_info.compressed_size = entry.compressed_size;
+		item.unzip_info.uncompressed_size = entry.uncompressed_size;
+
+		const boost::filesystem::path path = folder / item.filename;
+		if (isPath(item.filename))
+		{
+			boost::filesystem::create_directories(path);
+			continue;
+		}
+		if (path.has_parent_path())
+			boost::filesystem::create_directories(path.parent_path());
+		order.push_back(i);
 	}
 
-    // TODO: (not sure) write back unzip_info
+	// the largest entries go first, so the last one standing is a small one
+	std::sort(order.begin(), order.end(), [&entries](std::size_t a, std::size_t b) {
+		return entries[a].second.uncompressed_size > entries[b].second.uncompressed_size;
+	});
 
-    // change back the target folder
-    boost::filesystem3::current_path(originalCurrentPath);
-	return true;
+	tbb::atomic<std::size_t> next;
+	tbb::atomic<bool> failed;
+	next = 0;
+	failed = false;
+	boost::thread_group workers;
+	for (std::size_t t = 0; t < std::min(thread_count, order.size()); ++t)
+	{
+		workers.create_thread([&, this] {
+			// decoders keep state, so each worker has its own
+			shared_ptr<ArchiveCodec> decoder;
+			for (std::size_t n = next++; n < order.size() && !failed; n = next++)
+			{
+				const MappedEntry& entry = entries[order[n]].second;
+				const byte* data = locateEntryData(base, size, entry);
+				if (data != NULL && entry.method != 0 && !decoder)
+					decoder = ArchiveCodec::create(mCodec, mCompressLevel, mDictionary);
+				if (data == NULL || !extractEntryToFile(entry, data, decoder.get(), (folder / entries[order[n]].first).string()))
+					failed = true;
+			}
+		});
+	}
+	workers.join_all();
+
+	return !failed;
+}
+
+bool Archive::extractEntryToFile(const MappedEntry& entry, const byte* data, ArchiveCodec* decoder, const std::string& path)
+{
+	const std::size_t size = entry.uncompressed_size;
+	const bool direct = (mDirectIoThreshold > 0 && size >= mDirectIoThreshold);
+
+	int flags = O_RDWR | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (direct) flags |= O_DIRECT;
+#endif
+	int fd = ::open(path.c_str(), flags, 0644);
+	if (fd < 0 && direct)
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);	// the file system may not do direct I/O
+	if (fd < 0) return false;
+	if (size == 0) return ::close(fd) == 0;
+
+	// the blocks are allocated before anything is written, so a full disk fails here and not in the middle of the mapping
+	bool success = true;
+	const int allocated = posix_fallocate(fd, 0, size);
+	if (allocated != 0 && allocated != EOPNOTSUPP && allocated != EINVAL)
+		success = false;
+	else if (allocated != 0)
+		success = ::ftruncate(fd, size) == 0;
+
+	if (success && direct)
+	{
+		// direct I/O takes whole aligned blocks from aligned memory, the file is cut to its size afterwards
+		const std::size_t block = 4096;
+		const std::size_t aligned_size = (size + block - 1) & ~(block - 1);
+		void* buffer = NULL;
+		success = posix_memalign(&buffer, block, aligned_size) == 0;
+		if (success)
+		{
+			success = decodeMappedData(entry, data, (byte*)buffer, decoder);
+			for (std::size_t written = 0; success && written < aligned_size; )
+			{
+				const ssize_t count = ::pwrite(fd, (const char*)buffer + written, aligned_size - written, written);
+				success = (count > 0);
+				written += (count > 0) ? count : 0;
+			}
+			success = success && ::ftruncate(fd, size) == 0;
+			std::free(buffer);
+		}
+	}
+	else if (success)
+	{
+		void* mapped = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		success = (mapped != MAP_FAILED);
+		if (success)
+		{
+			success = decodeMappedData(entry, data, (byte*)mapped, decoder);
+			::munmap(mapped, size);
+		}
+	}
+
+	if (::close(fd) != 0) success = false;
+	return success;
+}
+
+void Archive::setDirectIoThreshold(std::size_t size)
+{
+	mDirectIoThreshold = size;
 }
 
 bool Archive::extractCurrentFile(ArchiveItem_t& archive_item)
+{
+	archive_item.buffer.clear();
+	return extractCurrentFile(archive_item, boost::bind(appendToBuffer, _1, _2, _3, &archive_item.buffer));
+}
+
+bool Archive::extractCurrentFile(ArchiveItem_t& archive_item, const ExtractHandler& handler)
 {
     unz_file_info64 file_info;
 	int result;
@@ -205,34 +924,756 @@ bool Archive::extractCurrentFile(ArchiveItem_t& archive_item)
 
     archive_item.filename = inzip_filename;
     archive_item.unzip_info = file_info;
+    if (!handler(archive_item, NULL, 0)) return false;
 
 	// Open current file
 	result = unzOpenCurrentFile(mArchive);
 	if (result != UNZ_OK) return false;
 
     // Now, retrieve the buffer chunk by chunk
+    std::vector<unsigned char> chunk(std::max<std::size_t>(1, std::min<ZPOS64_T>(mChunkSize, file_info.uncompressed_size)));
     int read_count = 0;
-    char byte;
+    bool accepted = true;
 
-    while ( (read_count = unzReadCurrentFile(mArchive, &byte, 1)) > 0 )
+    while ( accepted && (read_count = unzReadCurrentFile(mArchive, &chunk[0], chunk.size())) > 0 )
     {
-    	archive_item.buffer.push_back(byte);
+    	accepted = handler(archive_item, &chunk[0], read_count);
     }
-    // Check unzReadCurrentFile comment, you will know there's an error if the read count is negative.
-    if (read_count < 0) return false;
 
     // Close the current file
     result = unzCloseCurrentFile(mArchive);
+
+    // Check unzReadCurrentFile comment, you will know there's an error if the read count is negative.
+    if (!accepted || read_count < 0) return false;
     if (result != UNZ_OK) return false;
 
 	return true;
 }
 
+bool Archive::extract(const std::string& filename, Buffer& buffer)
+{
+	const MappedEntry* entry = NULL;
+	const byte* data = findMappedData(filename, entry);
+	if (data == NULL) return false;
+	if (entry->uncompressed_size == 0) return true;
+
+	if (buffer.freeSize() < entry->uncompressed_size)
+	{
+		if (!buffer.isOnDemand()) return false;
+		buffer.reserve(entry->uncompressed_size);
+	}
+
+	if (!decodeMappedData(*entry, data, buffer.wptr())) return false;
+
+	buffer.wpos(buffer.wpos() + entry->uncompressed_size);
+	return true;
+}
+
+BufferRef<true, false> Archive::extract(const std::string& filename)
+{
+	const MappedEntry* entry = NULL;
+	const byte* data = findMappedData(filename, entry);
+	if (data == NULL) return BufferRef<true, false>();
+
+	// stored entries are served right from the mapping
+	if (entry->method == 0)
+	{
+		return BufferRef<true, false>(mMappedArchive, data - mMappedArchive->baseptr(), entry->uncompressed_size);
+	}
+
+	if (entry->uncompressed_size == 0)
+	{
+		return BufferRef<true, false>(shared_ptr<Buffer>(new Buffer()));
+	}
+
+	shared_ptr<Buffer> buffer(new Buffer(entry->uncompressed_size));
+	if (!decodeMappedData(*entry, data, buffer->wptr())) return BufferRef<true, false>();
+	buffer->wpos(entry->uncompressed_size);
+
+	return BufferRef<true, false>(buffer);
+}
+
+bool Archive::contains(const std::string& filename) const
+{
+	return mMappedEntries.find(filename) != mMappedEntries.end();
+}
+
+bool Archive::openMapped()
+{
+	if (mMappedArchive) return true;
+
+	shared_ptr<MappedFileBufferAllocator> file;
+	try
+	{
+		file.reset(new MappedFileBufferAllocator(mArchiveName));
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	std::size_t size = file->fileSize();
+	byte* data = file->map();
+	if (data == NULL) return false;
+
+	mMappedArchive.reset(new Buffer(file.get(), data, size, true), MappedArchiveDeleter(file));
+
+	// packed archives are recognized by their header, anything else should be a zip file
+	mCodec = ARCHIVE_CODEC_ZIP;
+	const bool packed = (size >= PACK_HEADER_SIZE && readLE32(data) == PACK_SIGNATURE);
+	if (!(packed ? indexPackedArchive() : indexCentralDirectory()))
+	{
+		mMappedArchive.reset();
+		mMappedEntries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool Archive::indexCentralDirectory()
+{
+	std::vector<PackedEntry> entries;
+	if (!readCentralDirectory(mMappedArchive->baseptr(), mMappedArchive->allocatedSize(), entries)) return false;
+
+	mMappedEntries.clear();
+	mMappedEntries.rehash(entries.size());
+	for (std::size_t i = 0; i < entries.size(); ++i)
+		mMappedEntries[entries[i].first] = entries[i].second;
+	return true;
+}
+
+bool Archive::readCentralDirectory(const byte* base, std::size_t size, std::vector<PackedEntry>& entries) const
+{
+	if (size < END_OF_CENTRAL_DIRECTORY_SIZE) return false;
+
+	// the end of central directory record is followed by a comment of at most 64K
+	std::size_t eocd = size - END_OF_CENTRAL_DIRECTORY_SIZE;
+	const std::size_t lowest = (eocd > 0xFFFF) ? eocd - 0xFFFF : 0;
+	while (readLE32(base + eocd) != END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+	{
+		if (eocd == lowest) return false;
+		--eocd;
+	}
+
+	uint64 entry_count = readLE16(base + eocd + 10);
+	uint64 directory_size = readLE32(base + eocd + 12);
+	uint64 directory_offset = readLE32(base + eocd + 16);
+
+	if (entry_count == 0xFFFF || directory_size == 0xFFFFFFFF || directory_offset == 0xFFFFFFFF)
+	{
+		if (eocd < ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE) return false;
+		const byte* locator = base + eocd - ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE;
+		if (readLE32(locator) != ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE) return false;
+
+		uint64 zip64_eocd = readLE64(locator + 8);
+		if (zip64_eocd > size - ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE) return false;
+		if (readLE32(base + zip64_eocd) != ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE) return false;
+
+		entry_count = readLE64(base + zip64_eocd + 32);
+		directory_size = readLE64(base + zip64_eocd + 40);
+		directory_offset = readLE64(base + zip64_eocd + 48);
+	}
+
+	if (directory_offset > size || directory_size > size - directory_offset) return false;
+	if (entry_count > directory_size / CENTRAL_HEADER_SIZE) return false;
+
+	entries.clear();
+	entries.reserve(entry_count);
+
+	const byte* p = base + directory_offset;
+	const byte* end = p + directory_size;
+	for (uint64 i = 0; i < entry_count; ++i)
+	{
+		if ((std::size_t)(end - p) < CENTRAL_HEADER_SIZE || readLE32(p) != CENTRAL_HEADER_SIGNATURE) return false;
+
+		const std::size_t filename_length = readLE16(p + 28);
+		const std::size_t extra_length = readLE16(p + 30);
+		const std::size_t comment_length = readLE16(p + 32);
+		if ((std::size_t)(end - p) < CENTRAL_HEADER_SIZE + filename_length + extra_length + comment_length) return false;
+
+		MappedEntry entry;
+		entry.flag = readLE16(p + 8);
+		entry.method = readLE16(p + 10);
+		entry.crc = readLE32(p + 16);
+		entry.compressed_size = readLE32(p + 20);
+		entry.uncompressed_size = readLE32(p + 24);
+		entry.local_header_offset = readLE32(p + 42);
+
+		// the zip64 extra field has the 64-bit values of those saturated in the header, in this order
+		const byte* extra = p + CENTRAL_HEADER_SIZE + filename_length;
+		const byte* extra_end = extra + extra_length;
+		while (extra_end - extra >= 4)
+		{
+			const std::size_t id = readLE16(extra);
+			const std::size_t length = readLE16(extra + 2);
+			const byte* field = extra + 4;
+			const byte* field_end = field + std::min<std::size_t>(length, extra_end - field);
+			if (id == 0x0001)
+			{
+				if (entry.uncompressed_size == 0xFFFFFFFF && field_end - field >= 8) { entry.uncompressed_size = readLE64(field); field += 8; }
+				if (entry.compressed_size == 0xFFFFFFFF && field_end - field >= 8) { entry.compressed_size = readLE64(field); field += 8; }
+				if (entry.local_header_offset == 0xFFFFFFFF && field_end - field >= 8) { entry.local_header_offset = readLE64(field); field += 8; }
+				break;
+			}
+			extra = field_end;
+		}
+
+		entries.push_back(PackedEntry(std::string(p + CENTRAL_HEADER_SIZE, filename_length), entry));
+		p += CENTRAL_HEADER_SIZE + filename_length + extra_length + comment_length;
+	}
+
+	return true;
+}
+
+const byte* Archive::findMappedData(const std::string& filename, const MappedEntry*& entry) const
+{
+	if (mArchiveMode != ArchiveMode::ARCHIVE_FILE_MAPPED || !mMappedArchive) return NULL;
+
+	boost::unordered_map<std::string, MappedEntry>::const_iterator it = mMappedEntries.find(filename);
+	if (it == mMappedEntries.end()) return NULL;
+	entry = &it->second;
+
+	return locateEntryData(mMappedArchive->baseptr(), mMappedArchive->allocatedSize(), *entry);
+}
+
+const byte* Archive::locateEntryData(const byte* base, std::size_t size, const MappedEntry& entry) const
+{
+	// packed entries are checked against the archive size when indexed
+	if (mCodec != ARCHIVE_CODEC_ZIP)
+		return base + entry.local_header_offset;
+
+	// only stored and deflated entries without encryption
+	if ((entry.method != 0 && entry.method != Z_DEFLATED) || (entry.flag & 1)) return NULL;
+	if (entry.method == 0 && entry.compressed_size != entry.uncompressed_size) return NULL;
+
+	// the local header has its own variable length fields before the data
+	if (size < LOCAL_HEADER_SIZE || entry.local_header_offset > size - LOCAL_HEADER_SIZE) return NULL;
+
+	const byte* header = base + entry.local_header_offset;
+	if (readLE32(header) != LOCAL_HEADER_SIGNATURE) return NULL;
+
+	const uint64 data_offset = entry.local_header_offset + LOCAL_HEADER_SIZE + readLE16(header + 26) + readLE16(header + 28);
+	if (data_offset > size || entry.compressed_size > size - data_offset) return NULL;
+
+	return base + data_offset;
+}
+
+bool Archive::decodeMappedData(const MappedEntry& entry, const byte* data, byte* dest, ArchiveCodec* decoder)
+{
+	if (entry.method == 0)
+	{
+		std::memcpy(dest, data, entry.uncompressed_size);
+		return true;
+	}
+
+	if (decoder == NULL)
+		decoder = codec();
+	bool decoded;
+	if (mCodec == ARCHIVE_CODEC_ZIP)
+		decoded = decoder->decompress((const unsigned char*)data, entry.compressed_size, (unsigned char*)dest, entry.uncompressed_size);
+	else
+		decoded = decodeFrames(*decoder, data, entry.compressed_size, dest, entry.uncompressed_size, mPackFrameSize);
+
+	return decoded && crc32(0, (const Bytef*)dest, entry.uncompressed_size) == entry.crc;
+}
+
+bool Archive::openPacked()
+{
+	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_COMPRESS)
+	{
+		if (!ArchiveCodec::isSupported(mCodec)) return false;
+
+		mPackFile = std::fopen(mArchiveName.c_str(), "wb");
+		if (mPackFile == NULL) return false;
+
+		std::vector<unsigned char> header;
+		appendLE32(header, PACK_SIGNATURE);
+		appendLE32(header, PACK_VERSION);
+		if (std::fwrite(&header[0], header.size(), 1, mPackFile) != 1)
+		{
+			std::fclose(mPackFile);
+			mPackFile = NULL;
+			return false;
+		}
+
+		mPackedEntries.clear();
+		mContentEntries.clear();
+		mPackFrameSize = PACK_FRAME_SIZE;
+		return true;
+	}
+
+	std::FILE* file = std::fopen(mArchiveName.c_str(), "rb");
+	if (file == NULL) return false;
+
+	// read the dictionary and the index at once, the entries are read when extracted
+	byte header[PACK_HEADER_SIZE];
+	byte trailer[PACK_TRAILER_SIZE];
+	bool loaded = false;
+	if (std::fread(header, sizeof(header), 1, file) == 1 && readLE32(header) == PACK_SIGNATURE &&
+		fseeko(file, -(off_t)PACK_TRAILER_SIZE, SEEK_END) == 0 && std::fread(trailer, sizeof(trailer), 1, file) == 1)
+	{
+		const uint64 size = ftello(file);
+		const uint64 index_offset = readLE64(trailer);
+		const std::size_t dictionary_size = readLE32(trailer + 16);
+		if (index_offset >= PACK_HEADER_SIZE + dictionary_size && index_offset <= size - PACK_TRAILER_SIZE)
+		{
+			std::vector<byte> tail(size - PACK_TRAILER_SIZE - (index_offset - dictionary_size));
+			if (fseeko(file, index_offset - dictionary_size, SEEK_SET) == 0 && (tail.empty() || std::fread(&tail[0], tail.size(), 1, file) == 1))
+			{
+				const byte* dictionary = tail.empty() ? NULL : &tail[0];
+				loaded = loadPackedIndex(trailer, dictionary, dictionary + dictionary_size, tail.size() - dictionary_size);
+			}
+		}
+	}
+
+	if (!loaded)
+	{
+		std::fclose(file);
+		return false;
+	}
+	mPackFile = file;
+	return true;
+}
+
+bool Archive::closePacked()
+{
+	bool success = true;
+	if (mArchiveMode == ArchiveMode::ARCHIVE_FILE_COMPRESS)
+	{
+		// the dictionary, the index and then the trailer pointing back to them
+		const off_t position = ftello(mPackFile);
+		std::vector<unsigned char> tail(mDictionary);
+		for (std::size_t i = 0; i < mPackedEntries.size(); ++i)
+		{
+			const std::string& filename = mPackedEntries[i].first;
+			const MappedEntry& entry = mPackedEntries[i].second;
+			appendLE16(tail, filename.size());
+			tail.insert(tail.end(), filename.begin(), filename.end());
+			tail.push_back(entry.method);
+			appendLE64(tail, entry.local_header_offset);
+			appendLE64(tail, entry.compressed_size);
+			appendLE64(tail, entry.uncompressed_size);
+			appendLE32(tail, entry.crc);
+		}
+		appendLE64(tail, position + mDictionary.size());
+		appendLE64(tail, mPackedEntries.size());
+		appendLE32(tail, mDictionary.size());
+		appendLE32(tail, mPackFrameSize);
+		appendLE32(tail, mCodec);
+		appendLE32(tail, PACK_VERSION);
+		appendLE32(tail, PACK_SIGNATURE);
+
+		success = (position >= 0) && std::fwrite(&tail[0], tail.size(), 1, mPackFile) == 1;
+
+		// a duplicate found after streaming leaves its data behind, which may reach beyond the tail
+		if (success && mDeduplicate)
+			success = std::fflush(mPackFile) == 0 && ftruncate(fileno(mPackFile), position + tail.size()) == 0;
+		if (success && !mHashCacheName.empty())
+			success = saveHashCache();
+	}
+
+	if (std::fclose(mPackFile) != 0)
+		success = false;
+	mPackFile = NULL;
+	mPackedEntries.clear();
+	mContentEntries.clear();
+	mUpdatedHashCache.clear();
+	return success;
+}
+
+bool Archive::loadPackedIndex(const byte* trailer, const byte* dictionary, const byte* index, std::size_t index_size)
+{
+	const uint64 index_offset = readLE64(trailer);
+	const uint64 entry_count = readLE64(trailer + 8);
+	const std::size_t dictionary_size = readLE32(trailer + 16);
+	const std::size_t frame_size = readLE32(trailer + 20);
+	const uint32 codec = readLE32(trailer + 24);
+
+	if (readLE32(trailer + 28) != PACK_VERSION || readLE32(trailer + 32) != PACK_SIGNATURE) return false;
+	if (codec != ARCHIVE_CODEC_LZ4 && codec != ARCHIVE_CODEC_ZSTD) return false;
+	if (!ArchiveCodec::isSupported((ArchiveCodecType)codec)) return false;
+	if (frame_size == 0 || frame_size > PACK_MAX_FRAME_SIZE) return false;
+	if (index_offset < PACK_HEADER_SIZE + dictionary_size) return false;
+	if (entry_count > index_size / PACK_INDEX_RECORD_SIZE) return false;
+
+	// entries lie between the header and the dictionary
+	const uint64 data_end = index_offset - dictionary_size;
+
+	std::vector<PackedEntry> entries;
+	entries.reserve(entry_count);
+
+	const byte* p = index;
+	const byte* end = index + index_size;
+	for (uint64 i = 0; i < entry_count; ++i)
+	{
+		if ((std::size_t)(end - p) < PACK_INDEX_RECORD_SIZE) return false;
+		const std::size_t filename_length = readLE16(p);
+		if ((std::size_t)(end - p) < PACK_INDEX_RECORD_SIZE + filename_length) return false;
+
+		const byte* record = p + 2 + filename_length;
+		MappedEntry entry;
+		entry.method = (unsigned char)record[0];
+		entry.local_header_offset = readLE64(record + 1);
+		entry.compressed_size = readLE64(record + 9);
+		entry.uncompressed_size = readLE64(record + 17);
+		entry.crc = readLE32(record + 25);
+		entry.flag = 0;
+
+		if (entry.method != PACK_METHOD_STORED && entry.method != PACK_METHOD_FRAMES) return false;
+		if (entry.method == PACK_METHOD_STORED && entry.compressed_size != entry.uncompressed_size) return false;
+		if (entry.local_header_offset < PACK_HEADER_SIZE || entry.local_header_offset > data_end) return false;
+		if (entry.compressed_size > data_end - entry.local_header_offset) return false;
+
+		entries.push_back(PackedEntry(std::string(p + 2, filename_length), entry));
+		p = record + PACK_INDEX_RECORD_SIZE - 2;
+	}
+
+	mCodec = (ArchiveCodecType)codec;
+	mCodecInstance.reset();
+	mDictionary.assign((const unsigned char*)dictionary, (const unsigned char*)dictionary + dictionary_size);
+	mPackFrameSize = frame_size;
+	mPackedEntries.swap(entries);
+	return true;
+}
+
+bool Archive::indexPackedArchive()
+{
+	const byte* base = mMappedArchive->baseptr();
+	const std::size_t size = mMappedArchive->allocatedSize();
+	if (size < PACK_HEADER_SIZE + PACK_TRAILER_SIZE) return false;
+
+	const byte* trailer = base + size - PACK_TRAILER_SIZE;
+	const uint64 index_offset = readLE64(trailer);
+	const std::size_t dictionary_size = readLE32(trailer + 16);
+	if (index_offset < PACK_HEADER_SIZE + dictionary_size || index_offset > size - PACK_TRAILER_SIZE) return false;
+
+	if (!loadPackedIndex(trailer, base + index_offset - dictionary_size, base + index_offset, size - PACK_TRAILER_SIZE - index_offset)) return false;
+
+	mMappedEntries.clear();
+	mMappedEntries.rehash(mPackedEntries.size());
+	for (std::size_t i = 0; i < mPackedEntries.size(); ++i)
+		mMappedEntries[mPackedEntries[i].first] = mPackedEntries[i].second;
+	std::vector<PackedEntry>().swap(mPackedEntries);
+
+	return true;
+}
+
+bool Archive::writePacked(const std::string& filename, const unsigned char* data, std::size_t size, int method, ZPOS64_T uncompressed_size, uLong crc)
+{
+	if (filename.size() > 0xFFFF) return false;
+
+	const off_t offset = ftello(mPackFile);
+	if (offset < 0) return false;
+	if (size > 0 && std::fwrite(data, size, 1, mPackFile) != 1) return false;
+
+	MappedEntry entry;
+	entry.local_header_offset = offset;
+	entry.compressed_size = size;
+	entry.uncompressed_size = uncompressed_size;
+	entry.crc = crc;
+	entry.method = method;
+	entry.flag = 0;
+	mPackedEntries.push_back(PackedEntry(filename, entry));
+
+	return true;
+}
+
+bool Archive::addPacked(const std::string& filename)
+{
+	if (filename.size() > 0xFFFF) return false;
+
+	// the stamp is taken before reading, so a change while reading is seen by the next build
+	uint64 stamp_size = 0;
+	uint64 stamp_time = 0;
+	std::string hash;
+	if (mDeduplicate && stampFile(filename, stamp_size, stamp_time, hash) && addReference(filename, hash))
+	{
+		rememberHash(filename, stamp_size, stamp_time, hash);
+		return true;
+	}
+
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!file) return false;
+
+	const off_t offset = ftello(mPackFile);
+	if (offset < 0) return false;
+
+	// read and write the file frame by frame, level 0 stores it as it is
+	ArchiveCodec* compressor = (mCompressLevel == 0) ? NULL : codec();
+	std::vector<char> chunk(mPackFrameSize);
+	std::vector<unsigned char> frame;
+	ZPOS64_T size = 0;
+	ZPOS64_T written = 0;
+	uLong crc = 0;
+	sha1::Context context;
+	while (file)
+	{
+		file.read(&chunk[0], chunk.size());
+		std::size_t count = file.gcount();
+		if (count == 0) break;
+
+		const unsigned char* data = (const unsigned char*)&chunk[0];
+		crc = crc32(crc, data, count);
+		if (mDeduplicate)
+			context.update(data, count);
+		size += count;
+		if (compressor != NULL)
+		{
+			frame.clear();
+			appendFrame(*compressor, data, count, frame);
+			data = &frame[0];
+			count = frame.size();
+		}
+
+		if (std::fwrite(data, count, 1, mPackFile) != 1) return false;
+		written += count;
+	}
+	if (!file.eof()) return false;
+
+	MappedEntry entry;
+	entry.local_header_offset = offset;
+	entry.compressed_size = written;
+	entry.uncompressed_size = size;
+	entry.crc = crc;
+	entry.method = (compressor != NULL && size > 0) ? PACK_METHOD_FRAMES : PACK_METHOD_STORED;
+	entry.flag = 0;
+
+	if (mDeduplicate)
+	{
+		unsigned char digest[20];
+		context.final(digest);
+		hash.assign((const char*)digest, sizeof(digest));
+		rememberHash(filename, stamp_size, stamp_time, hash);
+
+		// the content turned out to be there already, so the next entry overwrites what was just written
+		if (addReference(filename, hash))
+			return fseeko(mPackFile, offset, SEEK_SET) == 0;
+	}
+
+	mPackedEntries.push_back(PackedEntry(filename, entry));
+	if (mDeduplicate) rememberContent(hash);
+
+	return true;
+}
+
+bool Archive::addReference(const std::string& filename, const std::string& hash)
+{
+	boost::unordered_map<std::string, MappedEntry>::const_iterator it = mContentEntries.find(hash);
+	if (it == mContentEntries.end()) return false;
+
+	mPackedEntries.push_back(PackedEntry(filename, it->second));
+	return true;
+}
+
+void Archive::rememberContent(const std::string& hash)
+{
+	mContentEntries[hash] = mPackedEntries.back().second;
+}
+
+bool Archive::stampFile(const std::string& filename, uint64& size, uint64& time, std::string& hash) const
+{
+	struct stat st;
+	if (::stat(filename.c_str(), &st) != 0) return false;
+
+	size = st.st_size;
+#if defined(__APPLE__)
+	time = (uint64)st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+	time = (uint64)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+
+	boost::unordered_map<std::string, HashCacheEntry>::const_iterator it = mHashCache.find(filename);
+	if (it == mHashCache.end() || it->second.size != size || it->second.time != time) return false;
+
+	hash = it->second.hash;
+	return true;
+}
+
+void Archive::rememberHash(const std::string& filename, uint64 size, uint64 time, const std::string& hash)
+{
+	// a file which couldn't be stamped is hashed again next time
+	if (mHashCacheName.empty() || time == 0) return;
+
+	HashCacheEntry& entry = mUpdatedHashCache[filename];
+	entry.size = size;
+	entry.time = time;
+	entry.hash = hash;
+}
+
+bool Archive::saveHashCache() const
+{
+	// one line per file: hash, size, time and the name, which takes the rest of the line
+	const std::string temporary = mHashCacheName + ".tmp";
+	{
+		std::ofstream out(temporary.c_str(), std::ios::out | std::ios::trunc);
+		for (boost::unordered_map<std::string, HashCacheEntry>::const_iterator it = mUpdatedHashCache.begin(); it != mUpdatedHashCache.end(); ++it)
+		{
+			char hex[41];
+			sha1::toHexString((const unsigned char*)it->second.hash.data(), hex);
+			out << hex << ' ' << it->second.size << ' ' << it->second.time << ' ' << it->first << '\n';
+		}
+		out.close();
+		if (!out) return false;
+	}
+
+	// replaced at once, so an interrupted build leaves the old cache
+	return std::rename(temporary.c_str(), mHashCacheName.c_str()) == 0;
+}
+
+bool Archive::extractPackedEntry(const PackedEntry& packed_entry, ArchiveItem_t& archive_item, const ExtractHandler& handler)
+{
+	const MappedEntry& entry = packed_entry.second;
+
+	archive_item.filename = packed_entry.first;
+	std::memset(&archive_item.unzip_info, 0, sizeof(unz_file_info64));
+	archive_item.unzip_info.compression_method = entry.method;
+	archive_item.unzip_info.crc = entry.crc;
+	archive_item.unzip_info.compressed_size = entry.compressed_size;
+	archive_item.unzip_info.uncompressed_size = entry.uncompressed_size;
+	if (!handler(archive_item, NULL, 0)) return false;
+
+	if (fseeko(mPackFile, entry.local_header_offset, SEEK_SET) != 0) return false;
+
+	// stored entries are read chunk by chunk, the others frame by frame
+	std::vector<unsigned char> chunk;
+	std::vector<unsigned char> frame;
+	ZPOS64_T remaining = entry.uncompressed_size;
+	ZPOS64_T compressed_remaining = entry.compressed_size;
+	uLong crc = 0;
+	while (remaining > 0)
+	{
+		const std::size_t size = std::min<ZPOS64_T>(remaining, (entry.method == PACK_METHOD_STORED) ? mChunkSize : mPackFrameSize);
+		const unsigned char* data = NULL;
+		if (entry.method == PACK_METHOD_STORED)
+		{
+			chunk.resize(size);
+			if (std::fread(&chunk[0], size, 1, mPackFile) != 1) return false;
+			data = &chunk[0];
+		}
+		else
+		{
+			byte header[PACK_FRAME_HEADER_SIZE];
+			if (compressed_remaining < PACK_FRAME_HEADER_SIZE || std::fread(header, sizeof(header), 1, mPackFile) != 1) return false;
+			compressed_remaining -= PACK_FRAME_HEADER_SIZE;
+
+			const uint32 frame_header = readLE32(header);
+			const std::size_t frame_size = frame_header & ~PACK_FRAME_STORED;
+			if (frame_size == 0 || frame_size > compressed_remaining) return false;
+			compressed_remaining -= frame_size;
+
+			frame.resize(frame_size);
+			if (std::fread(&frame[0], frame_size, 1, mPackFile) != 1) return false;
+
+			if (frame_header & PACK_FRAME_STORED)
+			{
+				if (frame_size != size) return false;
+				data = &frame[0];
+			}
+			else
+			{
+				chunk.resize(size);
+				if (!codec()->decompress(&frame[0], frame_size, &chunk[0], size)) return false;
+				data = &chunk[0];
+			}
+		}
+
+		crc = crc32(crc, data, size);
+		remaining -= size;
+		if (!handler(archive_item, data, size)) return false;
+	}
+
+	return crc == entry.crc;
+}
+
 void Archive::setCompressLevel(int level)
 {
 	// the range is 0~9
 	mCompressLevel = (level < 0) ? (0) : level;
 	mCompressLevel = (mCompressLevel > 9) ? (9) : mCompressLevel;
+
+	mCodecInstance.reset();
+}
+
+bool Archive::setDictionary(const std::vector<unsigned char>& dictionary)
+{
+	if (mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS || mCodec != ARCHIVE_CODEC_ZSTD || !mPackedEntries.empty()) return false;
+
+	mDictionary = dictionary;
+	mCodecInstance.reset();
+	return true;
+}
+
+bool Archive::trainDictionary(const std::vector<std::string>& filenames, std::size_t capacity)
+{
+	if (mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS || mCodec != ARCHIVE_CODEC_ZSTD || !mPackedEntries.empty()) return false;
+
+	std::vector< std::vector<unsigned char> > samples;
+	samples.reserve(filenames.size());
+	for (std::size_t i = 0; i < filenames.size(); ++i)
+	{
+		std::ifstream in(filenames[i].c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+		if (!in) continue;
+
+		std::streamoff size = in.tellg();
+		if (size <= 0 || static_cast<std::size_t>(size) > mChunkSize) continue;
+		in.seekg(0, std::ios::beg);
+
+		samples.push_back(std::vector<unsigned char>(size));
+		if (!in.read((char*)&samples.back()[0], size))
+			samples.pop_back();
+	}
+
+	std::vector<unsigned char> dictionary;
+	return ArchiveCodec::trainDictionary(samples, capacity, dictionary) && setDictionary(dictionary);
+}
+
+bool Archive::setDeduplication(bool enable)
+{
+	if (mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS || mPackFile == NULL || !mPackedEntries.empty()) return false;
+
+	mDeduplicate = enable;
+	return true;
+}
+
+bool Archive::setHashCache(const std::string& cache_name)
+{
+	if (mArchiveMode != ArchiveMode::ARCHIVE_FILE_COMPRESS || mPackFile == NULL) return false;
+
+	mHashCacheName = cache_name;
+	mHashCache.clear();
+
+	// a missing cache is just an empty one, lines which don't parse are skipped
+	std::ifstream in(cache_name.c_str());
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string hex;
+		HashCacheEntry entry;
+		if (!(fields >> hex >> entry.size >> entry.time) || hex.size() != 40 || fields.get() != ' ') continue;
+
+		std::string filename;
+		std::getline(fields, filename);
+		if (filename.empty()) continue;
+
+		for (std::size_t i = 0; i < 20; ++i)
+		{
+			char digits[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+			entry.hash.push_back((char)std::strtoul(digits, NULL, 16));
+		}
+		mHashCache[filename] = entry;
+	}
+	return true;
+}
+
+ArchiveCodecType Archive::getCodec() const
+{
+	return mCodec;
+}
+
+void Archive::setChunkSize(std::size_t size)
+{
+	mChunkSize = (size == 0) ? (1) : size;
 }
 
 }
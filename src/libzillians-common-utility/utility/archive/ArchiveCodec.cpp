@@ -0,0 +1,304 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/archive/ArchiveCodec.h"
+#include "core/Types.h"
+#include "zlib/minizip/zip.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef BUILD_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef BUILD_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+// zlib takes 32-bit lengths, so huge blocks are fed piece by piece
+const std::size_t MAX_PIECE_SIZE = 1 << 30;
+
+/**
+ * Raw deflate without zlib header, as stored in zip files.
+ */
+class DeflateCodec : public ArchiveCodec
+{
+public:
+	DeflateCodec(int level) : mLevel((level < 0) ? Z_DEFAULT_COMPRESSION : std::min(level, 9))
+	{ }
+
+	virtual ArchiveCodecType type() const
+	{
+		return ARCHIVE_CODEC_ZIP;
+	}
+
+	virtual std::size_t compressBound(std::size_t size) const
+	{
+		// same as deflateBound() with the default window and memory level, plus the stored block overhead
+		return size + (size >> 12) + (size >> 14) + (size >> 25) + 13 + 5 * (size / 16383 + 1);
+	}
+
+	virtual std::size_t compress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_capacity) const
+	{
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		if (deflateInit2(&stream, mLevel, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+
+		stream.next_in = (Bytef*)source;
+		stream.next_out = (Bytef*)dest;
+		int result = Z_OK;
+		while (result == Z_OK)
+		{
+			const std::size_t consumed = stream.next_in - (Bytef*)source;
+			if (stream.avail_in == 0)
+				stream.avail_in = std::min<std::size_t>(source_size - consumed, MAX_PIECE_SIZE);
+			if (stream.avail_out == 0)
+			{
+				stream.avail_out = std::min<std::size_t>(dest_capacity - (stream.next_out - (Bytef*)dest), MAX_PIECE_SIZE);
+				if (stream.avail_out == 0) break;
+			}
+			result = deflate(&stream, (consumed + stream.avail_in == source_size) ? Z_FINISH : Z_NO_FLUSH);
+		}
+		const std::size_t written = stream.next_out - (Bytef*)dest;
+		deflateEnd(&stream);
+
+		return (result == Z_STREAM_END) ? written : 0;
+	}
+
+	virtual bool decompress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_size)
+	{
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) return false;
+
+		stream.next_in = (Bytef*)source;
+		stream.next_out = (Bytef*)dest;
+		int result = Z_OK;
+		while (result == Z_OK)
+		{
+			if (stream.avail_in == 0)
+				stream.avail_in = std::min<std::size_t>(source_size - (stream.next_in - (Bytef*)source), MAX_PIECE_SIZE);
+			if (stream.avail_out == 0)
+				stream.avail_out = std::min<std::size_t>(dest_size - (stream.next_out - (Bytef*)dest), MAX_PIECE_SIZE);
+			result = inflate(&stream, Z_NO_FLUSH);
+		}
+		const bool complete = (result == Z_STREAM_END) && (stream.next_out == (Bytef*)dest + dest_size);
+		inflateEnd(&stream);
+
+		return complete;
+	}
+
+private:
+	int mLevel;
+};
+
+#ifdef BUILD_WITH_LZ4
+class Lz4Codec : public ArchiveCodec
+{
+public:
+	Lz4Codec(int level) : mLevel(std::min(level, (int)LZ4HC_CLEVEL_MAX))
+	{ }
+
+	virtual ArchiveCodecType type() const
+	{
+		return ARCHIVE_CODEC_LZ4;
+	}
+
+	virtual std::size_t compressBound(std::size_t size) const
+	{
+		return (size > LZ4_MAX_INPUT_SIZE) ? 0 : LZ4_compressBound(size);
+	}
+
+	virtual std::size_t compress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_capacity) const
+	{
+		if (source_size > LZ4_MAX_INPUT_SIZE) return 0;
+		const int capacity = std::min<std::size_t>(dest_capacity, LZ4_MAX_INPUT_SIZE);
+
+		// level 1~2 for the fast compressor, beyond that it's LZ4HC, which decompresses just as fast
+		int result;
+		if (mLevel >= LZ4HC_CLEVEL_MIN)
+			result = LZ4_compress_HC((const char*)source, (char*)dest, source_size, capacity, mLevel);
+		else
+			result = LZ4_compress_default((const char*)source, (char*)dest, source_size, capacity);
+		return (result > 0) ? result : 0;
+	}
+
+	virtual bool decompress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_size)
+	{
+		if (source_size > LZ4_MAX_INPUT_SIZE || dest_size > LZ4_MAX_INPUT_SIZE) return false;
+		return LZ4_decompress_safe((const char*)source, (char*)dest, source_size, dest_size) == (int)dest_size;
+	}
+
+private:
+	int mLevel;
+};
+#endif
+
+#ifdef BUILD_WITH_ZSTD
+class ZstdCodec : public ArchiveCodec
+{
+public:
+	ZstdCodec(int level, const std::vector<unsigned char>& dictionary) :
+		mLevel((level < 0) ? ZSTD_CLEVEL_DEFAULT : level), mDecompressContext(NULL), mCompressDictionary(NULL), mDecompressDictionary(NULL)
+	{
+		if (!dictionary.empty())
+		{
+			mCompressDictionary = ZSTD_createCDict(&dictionary[0], dictionary.size(), mLevel);
+			mDecompressDictionary = ZSTD_createDDict(&dictionary[0], dictionary.size());
+		}
+	}
+
+	virtual ~ZstdCodec()
+	{
+		if (mDecompressContext) ZSTD_freeDCtx(mDecompressContext);
+		if (mCompressDictionary) ZSTD_freeCDict(mCompressDictionary);
+		if (mDecompressDictionary) ZSTD_freeDDict(mDecompressDictionary);
+	}
+
+	virtual ArchiveCodecType type() const
+	{
+		return ARCHIVE_CODEC_ZSTD;
+	}
+
+	virtual std::size_t compressBound(std::size_t size) const
+	{
+		return ZSTD_compressBound(size);
+	}
+
+	virtual std::size_t compress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_capacity) const
+	{
+		// a context of its own for every call, the digested dictionary is shared by all threads
+		ZSTD_CCtx* context = ZSTD_createCCtx();
+		if (!context) return 0;
+
+		std::size_t result;
+		if (mCompressDictionary)
+			result = ZSTD_compress_usingCDict(context, dest, dest_capacity, source, source_size, mCompressDictionary);
+		else
+			result = ZSTD_compressCCtx(context, dest, dest_capacity, source, source_size, mLevel);
+		ZSTD_freeCCtx(context);
+
+		return ZSTD_isError(result) ? 0 : result;
+	}
+
+	virtual bool decompress(const unsigned char* source, std::size_t source_size, unsigned char* dest, std::size_t dest_size)
+	{
+		// the decompression context is large, so keep it for the many small blocks to come
+		if (!mDecompressContext)
+		{
+			mDecompressContext = ZSTD_createDCtx();
+			if (!mDecompressContext) return false;
+		}
+
+		std::size_t result;
+		if (mDecompressDictionary)
+			result = ZSTD_decompress_usingDDict(mDecompressContext, dest, dest_size, source, source_size, mDecompressDictionary);
+		else
+			result = ZSTD_decompressDCtx(mDecompressContext, dest, dest_size, source, source_size);
+
+		return !ZSTD_isError(result) && result == dest_size;
+	}
+
+private:
+	int mLevel;
+	ZSTD_DCtx* mDecompressContext;
+	ZSTD_CDict* mCompressDictionary;
+	ZSTD_DDict* mDecompressDictionary;
+};
+#endif
+
+}
+
+bool ArchiveCodec::isSupported(ArchiveCodecType type)
+{
+	switch (type)
+	{
+	case ARCHIVE_CODEC_ZIP:
+		return true;
+#ifdef BUILD_WITH_LZ4
+	case ARCHIVE_CODEC_LZ4:
+		return true;
+#endif
+#ifdef BUILD_WITH_ZSTD
+	case ARCHIVE_CODEC_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+shared_ptr<ArchiveCodec> ArchiveCodec::create(ArchiveCodecType type, int level, const std::vector<unsigned char>& dictionary)
+{
+	switch (type)
+	{
+	case ARCHIVE_CODEC_ZIP:
+		return shared_ptr<ArchiveCodec>(new DeflateCodec(level));
+#ifdef BUILD_WITH_LZ4
+	case ARCHIVE_CODEC_LZ4:
+		return shared_ptr<ArchiveCodec>(new Lz4Codec(level));
+#endif
+#ifdef BUILD_WITH_ZSTD
+	case ARCHIVE_CODEC_ZSTD:
+		return shared_ptr<ArchiveCodec>(new ZstdCodec(level, dictionary));
+#endif
+	default:
+		return shared_ptr<ArchiveCodec>();
+	}
+}
+
+bool ArchiveCodec::trainDictionary(const std::vector< std::vector<unsigned char> >& samples, std::size_t capacity, std::vector<unsigned char>& dictionary)
+{
+#ifdef BUILD_WITH_ZSTD
+	// the trainer takes all samples concatenated
+	std::vector<unsigned char> concatenated;
+	std::vector<std::size_t> sizes;
+	sizes.reserve(samples.size());
+	for (std::size_t i = 0; i < samples.size(); ++i)
+	{
+		if (samples[i].empty()) continue;
+		concatenated.insert(concatenated.end(), samples[i].begin(), samples[i].end());
+		sizes.push_back(samples[i].size());
+	}
+	if (sizes.empty() || capacity == 0) return false;
+
+	dictionary.resize(capacity);
+	std::size_t result = ZDICT_trainFromBuffer(&dictionary[0], capacity, &concatenated[0], &sizes[0], sizes.size());
+	if (ZDICT_isError(result))
+	{
+		dictionary.clear();
+		return false;
+	}
+	dictionary.resize(result);
+	return true;
+#else
+	UNUSED_ARGUMENT(samples);
+	UNUSED_ARGUMENT(capacity);
+	UNUSED_ARGUMENT(dictionary);
+	return false;
+#endif
+}
+
+}
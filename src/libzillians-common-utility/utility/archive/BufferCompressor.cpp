@@ -0,0 +1,284 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utility/archive/BufferCompressor.h"
+#include "core/Singleton.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef BUILD_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+enum FrameType
+{
+	FRAME_STORED = 0,		///< The message as it is
+	FRAME_LZ4 = 1,			///< An independent LZ4 block
+	FRAME_LZ4_STREAM = 2,	///< An LZ4 block using the previous messages as dictionary
+};
+
+// the header is little-endian whatever the encoding of the buffer is
+void writeHeader(byte* header, FrameType type, uint32 original_size, uint32 payload_size)
+{
+	header[0] = (byte)type;
+	for(int i = 0; i < 4; ++i)
+	{
+		header[1 + i] = (byte)(original_size >> (8 * i));
+		header[5 + i] = (byte)(payload_size >> (8 * i));
+	}
+}
+
+void readHeader(const byte* header, FrameType& type, uint32& original_size, uint32& payload_size)
+{
+	// byte may be signed
+	const uint8* p = reinterpret_cast<const uint8*>(header);
+	type = (FrameType)p[0];
+	original_size = payload_size = 0;
+	for(int i = 0; i < 4; ++i)
+	{
+		original_size |= (uint32)p[1 + i] << (8 * i);
+		payload_size |= (uint32)p[5 + i] << (8 * i);
+	}
+}
+
+// freeSize() of a plain buffer counts the consumed space before the read pointer as well
+inline std::size_t tailSize(const Buffer& buffer)
+{
+	return buffer.allocatedSize() - buffer.wpos();
+}
+
+bool ensureFree(Buffer& buffer, std::size_t size)
+{
+	if(tailSize(buffer) >= size)
+		return true;
+	if(!buffer.isOnDemand())
+		return false;
+	buffer.reserve(size);
+	return true;
+}
+
+#ifdef BUILD_WITH_LZ4
+const std::size_t MAX_MESSAGE_SIZE = LZ4_MAX_INPUT_SIZE;
+
+/**
+ * Per-thread memory for compressing into a full buffer and for the state of independent blocks,
+ * which LZ4 would otherwise put on the stack.
+ */
+struct CompressScratch : public ThreadLocalSingleton<CompressScratch>
+{
+	CompressScratch() : state(new char[LZ4_sizeofState()]), capacity(0)
+	{ }
+
+	char* reserve(std::size_t size)
+	{
+		if(capacity < size)
+		{
+			buffer.reset(new char[size]);
+			capacity = size;
+		}
+		return buffer.get();
+	}
+
+	boost::scoped_array<char> state;
+	boost::scoped_array<char> buffer;
+	std::size_t capacity;
+};
+#else
+const std::size_t MAX_MESSAGE_SIZE = 0xFFFFFFFF;
+#endif
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+BufferCompressor::BufferCompressor(Mode::type mode, std::size_t threshold, int acceleration) :
+	mMode(mode), mThreshold(threshold), mAcceleration(std::max(acceleration, 1)),
+	mStream(NULL), mCompressDictionarySize(0), mDecompressDictionarySize(0)
+{
+#ifdef BUILD_WITH_LZ4
+	if(mMode == Mode::streaming)
+	{
+		mStream = LZ4_createStream();
+		mCompressDictionary.reset(new char[DICTIONARY_SIZE]);
+	}
+#endif
+}
+
+BufferCompressor::~BufferCompressor()
+{
+#ifdef BUILD_WITH_LZ4
+	if(mStream)
+		LZ4_freeStream((LZ4_stream_t*)mStream);
+#endif
+}
+
+bool BufferCompressor::compressInto(Buffer& source, Buffer& dest)
+{
+	std::size_t size = source.dataSize();
+	if(size > MAX_MESSAGE_SIZE)
+		return false;
+
+#ifdef BUILD_WITH_LZ4
+	if(size < mThreshold || size == 0)
+		return store(source, size, dest);
+
+	const int bound = LZ4_compressBound(size);
+	CompressScratch* scratch = CompressScratch::instance();
+
+	// compress right behind the header if there's room, so there's nothing to copy afterwards
+	bool direct = ensureFree(dest, HEADER_SIZE + bound);
+	char* output = direct ? (char*)dest.wptr() + HEADER_SIZE : scratch->reserve(bound);
+
+	int compressed;
+	if(mMode == Mode::streaming)
+		compressed = LZ4_compress_fast_continue((LZ4_stream_t*)mStream, (const char*)source.rptr(), output, size, bound, mAcceleration);
+	else
+		compressed = LZ4_compress_fast_extState(scratch->state.get(), (const char*)source.rptr(), output, size, bound, mAcceleration);
+
+	if(compressed <= 0 || (std::size_t)compressed >= size || (!direct && tailSize(dest) < HEADER_SIZE + compressed))
+	{
+		// the message isn't part of the stream then, go back to the dictionary before it
+		if(mMode == Mode::streaming)
+			LZ4_loadDict((LZ4_stream_t*)mStream, mCompressDictionary.get(), mCompressDictionarySize);
+		return (compressed > 0 && (std::size_t)compressed < size) ? false : store(source, size, dest);
+	}
+
+	if(mMode == Mode::streaming)
+	{
+		// the source buffer is gone by the next message, keep the window in our own memory
+		mCompressDictionarySize = LZ4_saveDict((LZ4_stream_t*)mStream, mCompressDictionary.get(), DICTIONARY_SIZE);
+	}
+
+	writeHeader(dest.wptr(), (mMode == Mode::streaming) ? FRAME_LZ4_STREAM : FRAME_LZ4, size, compressed);
+	if(!direct)
+		memcpy(dest.wptr() + HEADER_SIZE, output, compressed);
+	dest.wskip(HEADER_SIZE + compressed);
+	source.rskip(size);
+	return true;
+#else
+	return store(source, size, dest);
+#endif
+}
+
+bool BufferCompressor::decompressInto(Buffer& source, Buffer& dest)
+{
+	if(source.dataSize() < HEADER_SIZE)
+		return false;
+
+	FrameType type;
+	uint32 original_size;
+	uint32 payload_size;
+	readHeader(source.rptr(), type, original_size, payload_size);
+	if(source.dataSize() < HEADER_SIZE + (std::size_t)payload_size)
+		return false;
+
+	const char* payload = (const char*)source.rptr() + HEADER_SIZE;
+	switch(type)
+	{
+	case FRAME_STORED:
+		if(payload_size != original_size || !ensureFree(dest, original_size))
+			return false;
+		memcpy(dest.wptr(), payload, original_size);
+		break;
+#ifdef BUILD_WITH_LZ4
+	case FRAME_LZ4:
+	case FRAME_LZ4_STREAM:
+	{
+		if(original_size > MAX_MESSAGE_SIZE || payload_size > MAX_MESSAGE_SIZE || !ensureFree(dest, original_size))
+			return false;
+
+		char* output = (char*)dest.wptr();
+		int decompressed;
+		if(type == FRAME_LZ4)
+			decompressed = LZ4_decompress_safe(payload, output, payload_size, original_size);
+		else
+			decompressed = LZ4_decompress_safe_usingDict(payload, output, payload_size, original_size, mDecompressDictionary.get(), mDecompressDictionarySize);
+		if(decompressed != (int)original_size)
+			return false;
+
+		if(type == FRAME_LZ4_STREAM)
+			appendDictionary(output, original_size);
+		break;
+	}
+#endif
+	default:
+		return false;
+	}
+
+	dest.wskip(original_size);
+	source.rskip(HEADER_SIZE + payload_size);
+	return true;
+}
+
+void BufferCompressor::reset()
+{
+#ifdef BUILD_WITH_LZ4
+	if(mStream)
+		LZ4_loadDict((LZ4_stream_t*)mStream, NULL, 0);
+#endif
+	mCompressDictionarySize = 0;
+	mDecompressDictionarySize = 0;
+}
+
+bool BufferCompressor::isSupported()
+{
+#ifdef BUILD_WITH_LZ4
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool BufferCompressor::store(Buffer& source, std::size_t size, Buffer& dest)
+{
+	if(!ensureFree(dest, HEADER_SIZE + size))
+		return false;
+
+	writeHeader(dest.wptr(), FRAME_STORED, size, size);
+	if(size > 0)
+		memcpy(dest.wptr() + HEADER_SIZE, source.rptr(), size);
+	dest.wskip(HEADER_SIZE + size);
+	source.rskip(size);
+	return true;
+}
+
+void BufferCompressor::appendDictionary(const char* data, std::size_t size)
+{
+	// the same window as LZ4_saveDict() keeps on the compressing side
+	if(!mDecompressDictionary)
+		mDecompressDictionary.reset(new char[DICTIONARY_SIZE]);
+
+	if(size >= DICTIONARY_SIZE)
+	{
+		memcpy(mDecompressDictionary.get(), data + size - DICTIONARY_SIZE, DICTIONARY_SIZE);
+		mDecompressDictionarySize = DICTIONARY_SIZE;
+	}
+	else
+	{
+		std::size_t kept = std::min<std::size_t>(mDecompressDictionarySize, DICTIONARY_SIZE - size);
+		memmove(mDecompressDictionary.get(), mDecompressDictionary.get() + mDecompressDictionarySize - kept, kept);
+		memcpy(mDecompressDictionary.get() + kept, data, size);
+		mDecompressDictionarySize = kept + size;
+	}
+}
+
+}
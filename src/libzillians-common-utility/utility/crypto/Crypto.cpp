@@ -24,6 +24,7 @@
 #include "utility/crypto/base64.h"
 #include "utility/crypto/machine_info.h"
 #include <ctype.h>
+#include <algorithm>
 #include <iostream>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
@@ -55,9 +56,9 @@ namespace zillians {
 
 std::string Crypto_t::encryptStringBasic(std::string Data, std::string Key, bool PostBase64Encode)
 {
-	std::string EncryptedData;
-	for(size_t i = 0; i<Data.length(); i++)
-		EncryptedData.append(1, _encode_char_rolling_offset(Data.c_str()[i], Key.c_str()[i%Key.length()]));
+	std::string EncryptedData(Data.length(), '\0');
+	for(size_t i = 0, k = 0; i<Data.length(); i++, k = (k+1 == Key.length()) ? 0 : k+1)
+		EncryptedData[i] = _encode_char_rolling_offset(Data[i], Key[k]);
 	if(PostBase64Encode)
 		return base64_encode(reinterpret_cast<const unsigned char*>(EncryptedData.c_str()), EncryptedData.length());
 	return EncryptedData;
@@ -66,9 +67,9 @@ std::string Crypto_t::decryptStringBasic(std::string Data, std::string Key, bool
 {
 	if(PreBase64Decode)
 		Data = base64_decode(Data);
-	std::string DecryptedData;
-	for(size_t i = 0; i<Data.length(); i++)
-		DecryptedData.append(1, _decode_char_rolling_offset(Data.c_str()[i], Key.c_str()[i%Key.length()]));
+	std::string DecryptedData(Data.length(), '\0');
+	for(size_t i = 0, k = 0; i<Data.length(); i++, k = (k+1 == Key.length()) ? 0 : k+1)
+		DecryptedData[i] = _decode_char_rolling_offset(Data[i], Key[k]);
 	return DecryptedData;
 }
 std::string Crypto_t::genHardwareIdentKey()
@@ -77,8 +78,19 @@ std::string Crypto_t::genHardwareIdentKey()
 }
 
 
-bool Crypto_t::symmetricCipher(const std::vector<unsigned char>& in_buffer, int nid, const std::string& key, const std::string& iv, bool encode, std::vector<unsigned char>& buffer)
+CipherContext::CipherContext() : mContext(EVP_CIPHER_CTX_new()), mIvLength(0), mAEAD(false), mInitialized(false)
+{ }
+
+CipherContext::~CipherContext()
+{
+	EVP_CIPHER_CTX_free(mContext);
+}
+
+bool CipherContext::init(int nid, const std::string& key, const std::string& iv, bool encode)
 {
+	mInitialized = false;
+	if (!mContext) return false;
+
 	// load all cipher modules
 	OpenSSL_add_all_ciphers();
 
@@ -87,56 +99,126 @@ bool Crypto_t::symmetricCipher(const std::vector<unsigned char>& in_buffer, int
 	if (!cipher) return false;
 
 	// Each cipher has its own taste for the key and IV. So we need to check if the input key and IV is appropriate
-	// for the specific cipher module
-	if (key.size() < static_cast<size_t>(EVP_CIPHER_key_length(cipher)) || iv.size() < static_cast<size_t>(EVP_CIPHER_iv_length(cipher)))
+	// for the specific cipher module, AEAD modes take the IV (nonce) length as given
+	mAEAD = (EVP_CIPHER_flags(cipher) & EVP_CIPH_FLAG_AEAD_CIPHER) != 0;
+	mIvLength = mAEAD ? iv.size() : static_cast<size_t>(EVP_CIPHER_iv_length(cipher));
+	if (key.size() < static_cast<size_t>(EVP_CIPHER_key_length(cipher)) || iv.size() < mIvLength || (mAEAD && mIvLength == 0))
 	{
 		return false;
 	}
 
-	EVP_CIPHER_CTX ctx;
-	EVP_CIPHER_CTX_init(&ctx);
-	EVP_CipherInit_ex(&ctx, cipher, NULL, (const unsigned char*)key.c_str(), (const unsigned char*)iv.c_str(), encode);
-	size_t block_size = EVP_CIPHER_block_size(cipher);
-	unsigned char* encrypt_buffer = (unsigned char*) malloc(block_size + in_buffer.size());
+	if (!EVP_CipherInit_ex(mContext, cipher, NULL, NULL, NULL, encode))
+		return false;
+	if (mAEAD && mIvLength != static_cast<size_t>(EVP_CIPHER_iv_length(cipher)))
+	{
+		if (!EVP_CIPHER_CTX_ctrl(mContext, EVP_CTRL_GCM_SET_IVLEN, mIvLength, NULL))
+			return false;
+	}
+	if (!EVP_CipherInit_ex(mContext, NULL, NULL, (const unsigned char*)key.c_str(), (const unsigned char*)iv.c_str(), encode))
+		return false;
+
+	mInitialized = true;
+	return true;
+}
+
+bool CipherContext::reset(const std::string& iv)
+{
+	if (!mInitialized || iv.size() < mIvLength) return false;
+
+	// keep the cipher and key schedule, only restart with the new IV
+	return EVP_CipherInit_ex(mContext, NULL, NULL, NULL, (const unsigned char*)iv.c_str(), -1) != 0;
+}
 
-	// Read the raw buffer and convert to encrypt one. And then collect to the output buffer
+bool CipherContext::updateAAD(const byte* data, std::size_t size)
+{
+	if (!mInitialized || !mAEAD) return false;
 
 	int out_count = 0;
-	buffer.clear();
-	bool fail = false;
+	return size == 0 || EVP_CipherUpdate(mContext, NULL, &out_count, (const unsigned char*)data, size) != 0;
+}
+
+bool CipherContext::update(const byte* in, std::size_t size, byte* out, std::size_t& written)
+{
+	written = 0;
+	if (!mInitialized) return false;
 
-	while (true)
+	// EVP takes int lengths, so feed huge inputs piece by piece
+	const std::size_t max_piece = 1 << 30;
+	while (size > 0)
 	{
-		if (!EVP_CipherUpdate(&ctx, encrypt_buffer, &out_count, &in_buffer[0], in_buffer.size()))
-		{
-			fail = true;
-			break;
-		}
-		for (int i = 0; i < out_count; i++)
-			buffer.push_back(encrypt_buffer[i]);
+		const std::size_t piece = std::min(size, max_piece);
+		int out_count = 0;
+		if (!EVP_CipherUpdate(mContext, (unsigned char*)out + written, &out_count, (const unsigned char*)in, piece))
+			return false;
+		written += out_count;
+		in += piece;
+		size -= piece;
+	}
+	return true;
+}
 
-		// handling the last block
-		unsigned char* block = encrypt_buffer + out_count;
-		if (!EVP_CipherFinal_ex(&ctx, block, &out_count))
-		{
-			fail = true;
-			break;
-		}
-		for (int i = 0; i < out_count; i++)
-			buffer.push_back(block[i]);
-		break;
+bool CipherContext::final(byte* out, std::size_t& written)
+{
+	written = 0;
+	if (!mInitialized) return false;
+
+	int out_count = 0;
+	if (!EVP_CipherFinal_ex(mContext, (unsigned char*)out, &out_count))
+		return false;
+	written = out_count;
+	return true;
+}
+
+bool CipherContext::getTag(byte* tag, std::size_t size)
+{
+	if (!mInitialized || !mAEAD) return false;
+	return EVP_CIPHER_CTX_ctrl(mContext, EVP_CTRL_GCM_GET_TAG, size, tag) != 0;
+}
+
+bool CipherContext::setTag(const byte* tag, std::size_t size)
+{
+	if (!mInitialized || !mAEAD) return false;
+	return EVP_CIPHER_CTX_ctrl(mContext, EVP_CTRL_GCM_SET_TAG, size, const_cast<byte*>(tag)) != 0;
+}
+
+std::size_t CipherContext::blockSize() const
+{
+	if (!mInitialized) return 0;
+	return EVP_CIPHER_CTX_block_size(mContext);
+}
+
+bool Crypto_t::symmetricCipher(const std::vector<unsigned char>& in_buffer, int nid, const std::string& key, const std::string& iv, bool encode, std::vector<unsigned char>& buffer)
+{
+	CipherContext context;
+	buffer.clear();
+	if (!context.init(nid, key, iv, encode))
+		return false;
+
+	// Convert the raw buffer to encrypt one directly into the output buffer, the last block may be padded
+	buffer.resize(in_buffer.size() + context.blockSize());
+
+	std::size_t out_count = 0;
+	std::size_t last_count = 0;
+	if (!context.update(in_buffer.empty() ? NULL : (const byte*)&in_buffer[0], in_buffer.size(), (byte*)&buffer[0], out_count) ||
+		!context.final((byte*)&buffer[out_count], last_count))
+	{
+		buffer.clear();
+		return false;
 	}
 
-	// free resource
-	free(encrypt_buffer);
-	EVP_CIPHER_CTX_cleanup(&ctx);
-	return (fail == true) ? (false) : (true);
+	buffer.resize(out_count + last_count);
+	return true;
 }
 
 bool Crypto_t::symmetricCipher(const std::string& file, int nid, const std::string& key, const std::string& iv, bool encode, std::vector<unsigned char>& buffer)
 {
+	CipherContext context;
+	buffer.clear();
+	if (!context.init(nid, key, iv, encode))
+		return false;
+
 	/*
-	 * Read the buffer from files
+	 * Read the file piece by piece and cipher each piece as it comes, so the raw content is never held as a whole
 	 */
 	BIO* bin;
 	if ( (bin = BIO_new_file(file.c_str(), "rb")) == NULL )
@@ -145,20 +227,37 @@ bool Crypto_t::symmetricCipher(const std::string& file, int nid, const std::stri
 	}
 
 	int read_count = 0;
-	unsigned char raw_buffer[1024];
-	std::vector<unsigned char> in_buffer;
+	unsigned char raw_buffer[64 * 1024];
+	bool fail = false;
+	std::size_t out_count = 0;
 	while ((read_count = BIO_read(bin, raw_buffer, sizeof(raw_buffer))) > 0)
 	{
-		for (int i = 0; i < read_count; i++)
-			in_buffer.push_back(raw_buffer[i]);
+		std::size_t size = buffer.size();
+		buffer.resize(size + read_count + context.blockSize());
+		if (!context.update((const byte*)raw_buffer, read_count, (byte*)&buffer[size], out_count))
+		{
+			fail = true;
+			break;
+		}
+		buffer.resize(size + out_count);
 	}
 
 	BIO_free_all(bin);
 
 	/*
-	 * Do the real symmetric cipher
+	 * Handling the last block
 	 */
-	return symmetricCipher(in_buffer, nid, key, iv, encode, buffer);
+	if (!fail)
+	{
+		std::size_t size = buffer.size();
+		buffer.resize(size + context.blockSize());
+		fail = !context.final((byte*)&buffer[size], out_count);
+		buffer.resize(size + out_count);
+	}
+
+	if (fail)
+		buffer.clear();
+	return !fail;
 }
 
 }
@@ -27,95 +27,356 @@
 #include "utility/crypto/base64.h"
 #include <iostream>
 
-static const std::string base64_chars =
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ * 100 + __GNUC_MINOR__) >= 409)
+#define BASE64_HAVE_AVX2
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BASE64_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+static const char base64_chars[] =
                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                          "abcdefghijklmnopqrstuvwxyz"
                          "0123456789+/";
 
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+namespace {
+
+/**
+ * Reverse of base64_chars, 0xFF for characters out of the alphabet.
+ */
+struct base64_reverse_table
+{
+    base64_reverse_table()
+    {
+        for (int i = 0; i < 256; ++i)
+            values[i] = 0xFF;
+        for (int i = 0; i < 64; ++i)
+            values[(unsigned char)base64_chars[i]] = i;
+    }
+
+    unsigned char values[256];
+};
+
+const base64_reverse_table base64_values;
+
+/**
+ * The vectorized kernels process whole blocks and return how much input they consumed,
+ * the remaining input is left to the scalar code.
+ */
+typedef std::size_t (*encode_kernel)(const unsigned char* src, std::size_t len, char* out);
+typedef std::size_t (*decode_kernel)(const char* src, std::size_t len, unsigned char* out);
+
+std::size_t encode_none(const unsigned char*, std::size_t, char*)
+{
+    return 0;
 }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for(i = 0; (i <4) ; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+std::size_t decode_none(const char*, std::size_t, unsigned char*)
+{
+    return 0;
+}
+
+#ifdef BASE64_HAVE_AVX2
+// see Wojciech Mula and Daniel Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions"
+__attribute__((target("avx2")))
+std::size_t encode_avx2(const unsigned char* src, std::size_t len, char* out)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    std::size_t consumed = 0;
+    // 24 bytes in, 32 characters out, each half loads 16 bytes of which 12 are used
+    while (len - consumed >= 28)
+    {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + consumed))), _mm_loadu_si128((const __m128i*)(src + consumed + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        // split each 3 bytes into four 6-bit indices, one per byte
+        const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t0, t1);
+
+        // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12, then add the offset of that range
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range));
+
+        _mm256_storeu_si256((__m256i*)out, chars);
+        consumed += 24;
+        out += 32;
     }
+    return consumed;
+}
 
-    if (i)
+__attribute__((target("avx2")))
+std::size_t decode_avx2(const char* src, std::size_t len, unsigned char* out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+
+    std::size_t consumed = 0;
+    // 32 characters in, 24 bytes out
+    while (len - consumed >= 32)
     {
-        for(j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+        const __m256i in = _mm256_loadu_si256((const __m256i*)(src + consumed));
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+        // every character out of the alphabet hits a common bit in both nibble tables
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_0f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(in, mask_0f));
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+        const __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        const __m256i values = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slash, hi_nibbles)));
 
-        while((i++ < 3))
-            ret += '=';
+        // merge four 6-bit values into 24 bits, then drop the empty byte of each dword
+        const __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
 
+        _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(bytes));
+        _mm_storel_epi64((__m128i*)(out + 16), _mm256_extracti128_si256(bytes, 1));
+        consumed += 32;
+        out += 24;
     }
+    return consumed;
+}
 
-    return ret;
+bool has_avx2()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // the OS must save the YMM registers as well
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return false;
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 0x6) != 0x6)
+        return false;
+    if (__get_cpuid_max(0, 0) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & bit_AVX2) != 0;
+}
+#endif
 
+#ifdef BASE64_HAVE_NEON
+std::size_t encode_neon(const unsigned char* src, std::size_t len, char* out)
+{
+    uint8x16x4_t alphabet;
+    for (int i = 0; i < 4; ++i)
+        alphabet.val[i] = vld1q_u8((const uint8_t*)base64_chars + i * 16);
+
+    std::size_t consumed = 0;
+    // 48 bytes in, 64 characters out
+    while (len - consumed >= 48)
+    {
+        const uint8x16x3_t in = vld3q_u8(src + consumed);
+        uint8x16x4_t indices;
+        indices.val[0] = vshrq_n_u8(in.val[0], 2);
+        indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), vdupq_n_u8(0x3F));
+        indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), vdupq_n_u8(0x3F));
+        indices.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+
+        uint8x16x4_t chars;
+        for (int i = 0; i < 4; ++i)
+            chars.val[i] = vqtbl4q_u8(alphabet, indices.val[i]);
+        vst4q_u8((uint8_t*)out, chars);
+
+        consumed += 48;
+        out += 64;
+    }
+    return consumed;
 }
 
-std::string base64_decode(std::string const& encoded_string) {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_]; in_++;
-        if (i ==4) {
-            for (i = 0; i <4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
+std::size_t decode_neon(const char* src, std::size_t len, unsigned char* out)
+{
+    // base64_values[0..127] in two halves, tbl gives 0 and tbx keeps the previous value for indices out of range
+    uint8x16x4_t lo_table, hi_table;
+    for (int i = 0; i < 4; ++i)
+    {
+        lo_table.val[i] = vld1q_u8(base64_values.values + i * 16);
+        hi_table.val[i] = vld1q_u8(base64_values.values + 64 + i * 16);
+    }
+
+    std::size_t consumed = 0;
+    // 64 characters in, 48 bytes out
+    while (len - consumed >= 64)
+    {
+        const uint8x16x4_t in = vld4q_u8((const uint8_t*)src + consumed);
+        uint8x16x4_t values;
+        uint8x16_t invalid = vdupq_n_u8(0);
+        for (int i = 0; i < 4; ++i)
+        {
+            values.val[i] = vqtbx4q_u8(vqtbl4q_u8(lo_table, in.val[i]), hi_table, vsubq_u8(in.val[i], vdupq_n_u8(64)));
+            // 0xFF for characters out of the alphabet, and non-ASCII characters miss both halves
+            invalid = vorrq_u8(invalid, vorrq_u8(values.val[i], vcgeq_u8(in.val[i], vdupq_n_u8(128))));
         }
+        if (vmaxvq_u8(invalid) >= 64)
+            break;
+
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+        vst3q_u8(out, bytes);
+
+        consumed += 64;
+        out += 48;
+    }
+    return consumed;
+}
+#endif
+
+encode_kernel select_encode_kernel()
+{
+#ifdef BASE64_HAVE_AVX2
+    if (has_avx2())
+        return encode_avx2;
+#endif
+#ifdef BASE64_HAVE_NEON
+    return encode_neon;
+#endif
+    return encode_none;
+}
+
+decode_kernel select_decode_kernel()
+{
+#ifdef BASE64_HAVE_AVX2
+    if (has_avx2())
+        return decode_avx2;
+#endif
+#ifdef BASE64_HAVE_NEON
+    return decode_neon;
+#endif
+    return decode_none;
+}
+
+/**
+ * Decode the longest prefix of base64 characters, which is what the std::string version always did.
+ */
+std::size_t base64_valid_prefix(const std::string& s)
+{
+    std::size_t i = 0;
+    while (i < s.size() && base64_values.values[(unsigned char)s[i]] != 0xFF)
+        ++i;
+    return i;
+}
+
+}
+
+std::size_t base64_encode(const unsigned char* src, std::size_t len, char* out)
+{
+    static const encode_kernel kernel = select_encode_kernel();
+
+    char* const begin = out;
+    std::size_t i = kernel(src, len, out);
+    out += i / 3 * 4;
+
+    for (; len - i >= 3; i += 3, out += 4)
+    {
+        const unsigned int v = ((unsigned int)src[i] << 16) | ((unsigned int)src[i + 1] << 8) | src[i + 2];
+        out[0] = base64_chars[v >> 18];
+        out[1] = base64_chars[(v >> 12) & 0x3F];
+        out[2] = base64_chars[(v >> 6) & 0x3F];
+        out[3] = base64_chars[v & 0x3F];
     }
 
-    if (i) {
-        for (j = i; j <4; j++)
-            char_array_4[j] = 0;
+    if (i < len)
+    {
+        const unsigned int v = ((unsigned int)src[i] << 16) | (len - i > 1 ? (unsigned int)src[i + 1] << 8 : 0);
+        out[0] = base64_chars[v >> 18];
+        out[1] = base64_chars[(v >> 12) & 0x3F];
+        out[2] = (len - i > 1) ? base64_chars[(v >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+
+    return out - begin;
+}
 
-        for (j = 0; j <4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
+bool base64_decode(const char* src, std::size_t len, unsigned char* out, std::size_t& written)
+{
+    static const decode_kernel kernel = select_decode_kernel();
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    written = 0;
+    for (int pad = 0; pad < 2 && len > 0 && src[len - 1] == '='; ++pad)
+        --len;
+    if (len % 4 == 1)
+        return false;
+
+    unsigned char* const begin = out;
+    std::size_t i = kernel(src, len, out);
+    out += i / 4 * 3;
+
+    const unsigned char* values = base64_values.values;
+    for (; len - i >= 4; i += 4, out += 3)
+    {
+        const unsigned int a = values[(unsigned char)src[i]], b = values[(unsigned char)src[i + 1]];
+        const unsigned int c = values[(unsigned char)src[i + 2]], d = values[(unsigned char)src[i + 3]];
+        if ((a | b | c | d) == 0xFF)
+            return false;
+        const unsigned int v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (unsigned char)(v >> 16);
+        out[1] = (unsigned char)(v >> 8);
+        out[2] = (unsigned char)v;
+    }
 
-        for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
+    if (i < len)
+    {
+        const unsigned int a = values[(unsigned char)src[i]], b = values[(unsigned char)src[i + 1]];
+        const unsigned int c = (len - i > 2) ? values[(unsigned char)src[i + 2]] : 0;
+        if ((a | b | c) == 0xFF)
+            return false;
+        const unsigned int v = (a << 18) | (b << 12) | (c << 6);
+        *out++ = (unsigned char)(v >> 16);
+        if (len - i > 2)
+            *out++ = (unsigned char)(v >> 8);
     }
 
+    written = out - begin;
+    return true;
+}
+
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+    std::string ret(base64_encoded_size(in_len), '\0');
+    if (in_len > 0)
+        base64_encode(bytes_to_encode, in_len, &ret[0]);
+    return ret;
+}
+
+std::string base64_decode(std::string const& encoded_string) {
+    // well-formed input goes straight through, otherwise decode up to the first unexpected character
+    std::size_t len = encoded_string.size();
+    std::string ret(base64_decoded_size(encoded_string.data(), len), '\0');
+    std::size_t written = 0;
+    if (!ret.empty() && base64_decode(encoded_string.data(), len, (unsigned char*)&ret[0], written))
+        return ret;
+
+    len = base64_valid_prefix(encoded_string);
+    len -= (len % 4 == 1) ? 1 : 0;
+    ret.assign(base64_decoded_size(encoded_string.data(), len), '\0');
+    if (!ret.empty())
+        base64_decode(encoded_string.data(), len, (unsigned char*)&ret[0], written);
     return ret;
 }
@@ -34,16 +34,43 @@ Several members in the gamedev.se forum.
 #include <string>
 #include "utility/sha1.h"
 #include <string.h>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ * 100 + __GNUC_MINOR__) >= 409)
+#define SHA1_HAVE_SHANI
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#define SHA1_HAVE_ARMV8
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace sha1
 {
         namespace // local
         {
+                const unsigned int initialState[5] = {0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,0xC3D2E1F0};
+
                 inline unsigned int rol(const unsigned int num, const unsigned int cnt)
                 {
                         return((num << cnt) | (num >> (32-cnt)));
                 }
 
+                inline unsigned int loadBigEndian(const unsigned char *p)
+                {
+                        return (unsigned int)p[3]|(((unsigned int)p[2])<<8)|(((unsigned int)p[1])<<16)|(((unsigned int)p[0])<<24);
+                }
+
                 void innerHash(unsigned int *result, unsigned int *w)
                 {
                         unsigned int save[5];
@@ -107,48 +134,403 @@ namespace sha1
                         result[3]+=save[3];
                         result[4]+=save[4];
                 }
+
+                void compressPortable(unsigned int *state, const unsigned char *data, std::size_t blocks)
+                {
+                        unsigned int w[80];
+                        for(; blocks > 0; --blocks, data += 64)
+                        {
+                                for(int k=0;k<16;++k)
+                                {
+                                        w[k]=loadBigEndian(data + k*4);
+                                }
+                                innerHash(state,w);
+                        }
+                }
+
+#ifdef SHA1_HAVE_SHANI
+                // Four rounds per step, the message schedule of the following steps is overlapped with the rounds,
+                // see Intel's "New Instructions Supporting the Secure Hash Algorithm on Intel Architecture Processors"
+                #define sha1niStep(i, func) \
+                        { \
+                                if(i < 4) msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i*16)), byteSwap); \
+                                if(i == 0) e0 = _mm_add_epi32(e0, msg[0]); else e0 = _mm_sha1nexte_epu32(e0, msg[i&3]); \
+                                e1 = abcd; \
+                                if(i >= 3 && i <= 18) msg[(i+1)&3] = _mm_sha1msg2_epu32(msg[(i+1)&3], msg[i&3]); \
+                                abcd = _mm_sha1rnds4_epu32(abcd, e0, func); \
+                                if(i >= 1 && i <= 16) msg[(i-1)&3] = _mm_sha1msg1_epu32(msg[(i-1)&3], msg[i&3]); \
+                                if(i >= 2 && i <= 17) msg[(i-2)&3] = _mm_xor_si128(msg[(i-2)&3], msg[i&3]); \
+                                tmp = e0; e0 = e1; e1 = tmp; \
+                        }
+
+                __attribute__((target("sha,sse4.1,ssse3")))
+                void compressShaNi(unsigned int *state, const unsigned char *data, std::size_t blocks)
+                {
+                        const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+                        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+                        __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+                        __m128i e1, tmp;
+                        __m128i msg[4];
+
+                        for(; blocks > 0; --blocks, data += 64)
+                        {
+                                const __m128i abcdSave = abcd;
+                                const __m128i eSave = e0;
+
+                                sha1niStep( 0, 0) sha1niStep( 1, 0) sha1niStep( 2, 0) sha1niStep( 3, 0) sha1niStep( 4, 0)
+                                sha1niStep( 5, 1) sha1niStep( 6, 1) sha1niStep( 7, 1) sha1niStep( 8, 1) sha1niStep( 9, 1)
+                                sha1niStep(10, 2) sha1niStep(11, 2) sha1niStep(12, 2) sha1niStep(13, 2) sha1niStep(14, 2)
+                                sha1niStep(15, 3) sha1niStep(16, 3) sha1niStep(17, 3) sha1niStep(18, 3) sha1niStep(19, 3)
+
+                                e0 = _mm_sha1nexte_epu32(e0, eSave);
+                                abcd = _mm_add_epi32(abcd, abcdSave);
+                        }
+
+                        _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+                        state[4] = _mm_extract_epi32(e0, 3);
+                }
+                #undef sha1niStep
+
+                bool hasShaNi()
+                {
+                        unsigned int eax, ebx, ecx, edx;
+                        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                                return false;
+                        if(!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+                                return false;
+                        if(__get_cpuid_max(0, 0) < 7)
+                                return false;
+                        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+                        return (ebx & (1u << 29)) != 0;
+                }
+#endif
+
+#ifdef SHA1_HAVE_ARMV8
+                void compressArmV8(unsigned int *state, const unsigned char *data, std::size_t blocks)
+                {
+                        const uint32_t k[4] = {0x5A827999,0x6ED9EBA1,0x8F1BBCDC,0xCA62C1D6};
+
+                        uint32x4_t abcd = vld1q_u32(state);
+                        uint32_t e = state[4];
+                        uint32x4_t msg[4];
+
+                        for(; blocks > 0; --blocks, data += 64)
+                        {
+                                const uint32x4_t abcdSave = abcd;
+                                const uint32_t eSave = e;
+
+                                for(int i=0;i<4;++i)
+                                {
+                                        msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i*16)));
+                                }
+
+                                // four rounds per step, W[4i+16..4i+19] replaces W[4i..4i+3] once it's consumed
+                                for(int i=0;i<20;++i)
+                                {
+                                        const uint32x4_t wk = vaddq_u32(msg[i&3], vdupq_n_u32(k[i/5]));
+                                        if(i < 16)
+                                                msg[i&3] = vsha1su1q_u32(vsha1su0q_u32(msg[i&3], msg[(i+1)&3], msg[(i+2)&3]), msg[(i+3)&3]);
+
+                                        const uint32_t next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+                                        if(i < 5)
+                                                abcd = vsha1cq_u32(abcd, e, wk);
+                                        else if(i >= 10 && i < 15)
+                                                abcd = vsha1mq_u32(abcd, e, wk);
+                                        else
+                                                abcd = vsha1pq_u32(abcd, e, wk);
+                                        e = next;
+                                }
+
+                                abcd = vaddq_u32(abcd, abcdSave);
+                                e += eSave;
+                        }
+
+                        vst1q_u32(state, abcd);
+                        state[4] = e;
+                }
+
+                bool hasArmV8Sha1()
+                {
+#if defined(__linux__) && defined(HWCAP_SHA1)
+                        return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#else
+                        return true;
+#endif
+                }
+#endif
+
+                typedef void (*CompressFunction)(unsigned int *state, const unsigned char *data, std::size_t blocks);
+
+                CompressFunction selectCompress()
+                {
+#ifdef SHA1_HAVE_SHANI
+                        if(hasShaNi())
+                                return compressShaNi;
+#endif
+#ifdef SHA1_HAVE_ARMV8
+                        if(hasArmV8Sha1())
+                                return compressArmV8;
+#endif
+                        return compressPortable;
+                }
+
+                inline CompressFunction compress()
+                {
+                        static const CompressFunction f = selectCompress();
+                        return f;
+                }
+
+                inline bool isAccelerated()
+                {
+                        return compress() != compressPortable;
+                }
+
+                inline void storeHash(const unsigned int *state, unsigned char *hash)
+                {
+                        for(int i=20;--i>=0;) 
+                        {
+                                hash[i]=(state[i>>2]>>(((3-i)&0x3)<<3))&0xFF;
+                        }
+                }
+
+                /**
+                        Pad the tail of a message into one or two blocks, returns the number of blocks.
+                */
+                std::size_t padTail(const unsigned char *tail, std::size_t tailsize, unsigned long long bytelength, unsigned char *blocks)
+                {
+                        const std::size_t count = (tailsize < 56) ? 1 : 2;
+                        if(tailsize > 0)
+                                memcpy(blocks, tail, tailsize);
+                        blocks[tailsize] = 0x80;
+                        memset(blocks + tailsize + 1, 0, count*64 - tailsize - 1);
+
+                        const unsigned long long bits = bytelength << 3;
+                        unsigned char *p = blocks + count*64 - 8;
+                        for(int i=0;i<8;++i)
+                        {
+                                p[i] = (unsigned char)(bits >> ((7-i)*8));
+                        }
+                        return count;
+                }
+
+#ifdef __SSE2__
+                /**
+                        One message being hashed in a lane of compressParallel().
+                */
+                struct Lane
+                {
+                        void start(const unsigned char *src, std::size_t bytelength)
+                        {
+                                data = src;
+                                blocks = bytelength / 64;
+                                tailBlocks = padTail(src + blocks*64, bytelength % 64, bytelength, tail);
+                                tailUsed = 0;
+                        }
+
+                        const unsigned char *next()
+                        {
+                                if(blocks > 0)
+                                {
+                                        const unsigned char *p = data;
+                                        data += 64;
+                                        --blocks;
+                                        return p;
+                                }
+                                if(tailUsed < tailBlocks)
+                                {
+                                        return tail + 64 * tailUsed++;
+                                }
+                                return NULL;
+                        }
+
+                        const unsigned char *data;
+                        std::size_t blocks;
+                        std::size_t tailBlocks;
+                        std::size_t tailUsed;
+                        unsigned char tail[128];
+                };
+
+                inline __m128i rol4(__m128i x, int cnt)
+                {
+                        return _mm_or_si128(_mm_slli_epi32(x, cnt), _mm_srli_epi32(x, 32-cnt));
+                }
+
+                /**
+                        Hash one block of each of four messages, state[i] holds word i of the four states.
+                */
+                void compressParallel(__m128i *state, const unsigned char *const *blocks)
+                {
+                        __m128i w[16];
+                        for(int j=0;j<16;++j)
+                        {
+                                w[j] = _mm_set_epi32(loadBigEndian(blocks[3] + j*4), loadBigEndian(blocks[2] + j*4), loadBigEndian(blocks[1] + j*4), loadBigEndian(blocks[0] + j*4));
+                        }
+
+                        __m128i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+                        #define sha1macro4(func,val) \
+                                { \
+                                        if(j >= 16) w[j&15] = rol4(_mm_xor_si128(_mm_xor_si128(w[(j-3)&15], w[(j-8)&15]), _mm_xor_si128(w[(j-14)&15], w[j&15])), 1); \
+                                        const __m128i t = _mm_add_epi32(_mm_add_epi32(rol4(a, 5), (func)), _mm_add_epi32(_mm_add_epi32(e, _mm_set1_epi32(val)), w[j&15])); \
+                                        e = d; d = c; \
+                                        c = rol4(b, 30); \
+                                        b = a; a = t; \
+                                }
+                        int j=0;
+                        for(;j<20;++j) sha1macro4(_mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d)), 0x5A827999)
+                        for(;j<40;++j) sha1macro4(_mm_xor_si128(_mm_xor_si128(b, c), d), 0x6ED9EBA1)
+                        for(;j<60;++j) sha1macro4(_mm_or_si128(_mm_and_si128(b, c), _mm_and_si128(d, _mm_or_si128(b, c))), (int)0x8F1BBCDC)
+                        for(;j<80;++j) sha1macro4(_mm_xor_si128(_mm_xor_si128(b, c), d), (int)0xCA62C1D6)
+                        #undef sha1macro4
+
+                        state[0] = _mm_add_epi32(state[0], a);
+                        state[1] = _mm_add_epi32(state[1], b);
+                        state[2] = _mm_add_epi32(state[2], c);
+                        state[3] = _mm_add_epi32(state[3], d);
+                        state[4] = _mm_add_epi32(state[4], e);
+                }
+
+                void calcParallel(const void *const *srcs, const std::size_t *bytelengths, std::size_t count, unsigned char *hashes)
+                {
+                        static const unsigned char idle[64] = { 0 };
+
+                        Lane lanes[4];
+                        std::size_t message[4];
+                        union { __m128i v[5]; unsigned int u[5][4]; } state;
+
+                        std::size_t started = 0;
+                        for(int l=0;l<4;++l)
+                        {
+                                message[l] = count;
+                                for(int i=0;i<5;++i) state.u[i][l] = initialState[i];
+                                if(started < count)
+                                {
+                                        message[l] = started;
+                                        lanes[l].start((const unsigned char*)srcs[started], bytelengths[started]);
+                                        ++started;
+                                }
+                        }
+
+                        while(true)
+                        {
+                                const unsigned char *blocks[4];
+                                int active = 0;
+                                for(int l=0;l<4;++l)
+                                {
+                                        blocks[l] = idle;
+                                        if(message[l] == count)
+                                                continue;
+
+                                        blocks[l] = lanes[l].next();
+                                        if(!blocks[l])
+                                        {
+                                                // the message in this lane is done, move on to the next one
+                                                unsigned int result[5];
+                                                for(int i=0;i<5;++i)
+                                                {
+                                                        result[i] = state.u[i][l];
+                                                        state.u[i][l] = initialState[i];
+                                                }
+                                                storeHash(result, hashes + 20 * message[l]);
+
+                                                blocks[l] = idle;
+                                                message[l] = count;
+                                                if(started == count)
+                                                        continue;
+                                                message[l] = started;
+                                                lanes[l].start((const unsigned char*)srcs[started], bytelengths[started]);
+                                                blocks[l] = lanes[l].next();
+                                                ++started;
+                                        }
+                                        ++active;
+                                }
+
+                                if(active == 0)
+                                        break;
+
+                                compressParallel(state.v, blocks);
+                        }
+                }
+#endif
         }
 
-        void calc(const void *src, const int bytelength, unsigned char *hash)
+        Context::Context()
         {
-                // Init the result array, and create references to the five unsigned integers for better readabillity.
-                unsigned int result[5]={0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,0xC3D2E1F0};
+                reset();
+        }
+
+        void Context::reset()
+        {
+                memcpy(mState, initialState, sizeof(mState));
+                mLength = 0;
+                mBlockSize = 0;
+        }
+
+        void Context::update(const void *src, std::size_t bytelength)
+        {
+                if(bytelength == 0)
+                        return;
 
                 const unsigned char *sarray=(const unsigned char*)src;
-                // The variables
-                unsigned int w[80];
-                int j,i,i1;
-                j=0;
-                // Loop through all complete 64byte blocks.
-                for(i=0,i1=64; i<=(bytelength-64); i=i1,i1+=64) 
-                {
-                        int k=0;
-                        for(j=i;j<i1;j+=4)
-                        {
-                                // This line will swap endian on big endian and keep endian on little endian.
-                                w[k++]=(unsigned int)sarray[j+3]|(((unsigned int)sarray[j+2])<<8)|(((unsigned int)sarray[j+1])<<16)|(((unsigned int)sarray[j])<<24);
-                        }
-                        innerHash(result,w);
+                mLength += bytelength;
+
+                if(mBlockSize > 0)
+                {
+                        const std::size_t n = std::min(bytelength, 64 - mBlockSize);
+                        memcpy(mBlock + mBlockSize, sarray, n);
+                        mBlockSize += n;
+                        sarray += n;
+                        bytelength -= n;
+                        if(mBlockSize < 64)
+                                return;
+                        compress()(mState, mBlock, 1);
+                        mBlockSize = 0;
                 }
-                // fill in reminder
-                i1=bytelength-i;
-                memset(w,0,sizeof(unsigned int)*16);
-                for(j=0;j<i1;j++)
+
+                // complete blocks are hashed directly from the source
+                if(bytelength >= 64)
                 {
-                        w[j>>2]|=(unsigned int)sarray[j+i]<<((3-(j&3))<<3);
+                        compress()(mState, sarray, bytelength / 64);
+                        sarray += bytelength & ~(std::size_t)63;
+                        bytelength &= 63;
                 }
-                w[j>>2]|=0x80<<((3-(j&3))<<3);
-                if(i1>=56)
+
+                memcpy(mBlock, sarray, bytelength);
+                mBlockSize = bytelength;
+        }
+
+        void Context::final(unsigned char *hash)
+        {
+                unsigned char blocks[128];
+                const std::size_t count = padTail(mBlock, mBlockSize, mLength, blocks);
+                compress()(mState, blocks, count);
+                storeHash(mState, hash);
+                reset();
+        }
+
+        void calc(const void *src, const int bytelength, unsigned char *hash)
+        {
+                Context context;
+                context.update(src, bytelength);
+                context.final(hash);
+        }
+
+        void calcMultiple(const void *const *srcs, const std::size_t *bytelengths, std::size_t count, unsigned char *hashes)
+        {
+#ifdef __SSE2__
+                // SHA instructions hash a single message faster than four SSE2 lanes do
+                if(!isAccelerated() && count > 1)
                 {
-                        innerHash(result,w);
-                        memset(w,0,sizeof(unsigned int)*16);
+                        calcParallel(srcs, bytelengths, count, hashes);
+                        return;
                 }
-                w[15]=bytelength<<3;
-                innerHash(result,w);
-                // Store hash in result pointer, and make sure we get in in the correct order on both endian models.
-                for(i=20;--i>=0;) 
+#endif
+                Context context;
+                for(std::size_t i = 0; i < count; ++i)
                 {
-                        hash[i]=(result[i>>2]>>(((3-i)&0x3)<<3))&0xFF;
+                        context.update(srcs[i], bytelengths[i]);
+                        context.final(hashes + 20 * i);
                 }
         }
 
@@ -0,0 +1,424 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "Benchmark.h"
+#include "core/ThreadPlacement.h"
+#include "utility/TimerUtil.h"
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifndef __PLATFORM_WINDOWS__
+#include <unistd.h>
+#endif
+
+namespace zillians {
+
+namespace {
+
+template<typename T>
+bool parseValue(const char* text, T& value)
+{
+	try
+	{
+		value = boost::lexical_cast<T>(text);
+		return true;
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		return false;
+	}
+}
+
+const char* getOption(const char* argument, const char* name)
+{
+	const std::size_t length = std::strlen(name);
+	if(std::strncmp(argument, "--", 2) != 0 || std::strncmp(argument + 2, name, length) != 0 || argument[length + 2] != '=')
+		return NULL;
+	return argument + length + 3;
+}
+
+std::vector<BenchmarkResult>& getResults()
+{
+	static std::vector<BenchmarkResult> results;
+	return results;
+}
+
+// print in the unit that keeps the median readable, the rest of the line follows
+std::string formatDuration(double ns, double reference)
+{
+	const char* unit = "ns";
+	double scale = 1.0;
+	if(reference >= 1000000.0)  { unit = "ms"; scale = 1000000.0; }
+	else if(reference >= 1000.0) { unit = "us"; scale = 1000.0; }
+
+	char text[64];
+	std::snprintf(text, sizeof(text), "%.3f %s", ns / scale, unit);
+	return text;
+}
+
+std::string formatRate(double count, double ns, const char* unit)
+{
+	const double rate = count * 1000000000.0 / ns;
+	const char* prefix = "";
+	double scale = 1.0;
+	if(rate >= 1000000000.0)  { prefix = "G"; scale = 1000000000.0; }
+	else if(rate >= 1000000.0) { prefix = "M"; scale = 1000000.0; }
+	else if(rate >= 1000.0)    { prefix = "K"; scale = 1000.0; }
+
+	char text[64];
+	std::snprintf(text, sizeof(text), "%.2f %s%s/s", rate / scale, prefix, unit);
+	return text;
+}
+
+void printStatistics(const std::string& name, const std::vector<uint64>& samples, uint64 items, uint64 bytes)
+{
+	const BenchmarkStatistics s(samples);
+	std::ostringstream line;
+	line << "[benchmark] " << name << ": median " << formatDuration(s.median, s.median)
+		 << " (min " << formatDuration(s.min, s.median)
+		 << ", p90 " << formatDuration(s.p90, s.median)
+		 << ", p99 " << formatDuration(s.p99, s.median)
+		 << ", max " << formatDuration(s.max, s.median)
+		 << ", stddev " << formatDuration(s.stddev, s.median)
+		 << ", " << s.count << " runs)";
+	if(s.median > 0 && items > 0) line << ", " << formatRate(items, s.median, "items");
+	if(s.median > 0 && bytes > 0) line << ", " << formatRate(bytes, s.median, "B");
+	std::cout << line.str() << std::endl;
+}
+
+std::string quote(const std::string& s)
+{
+	std::string result("\"");
+	for(std::size_t i = 0; i < s.size(); ++i)
+	{
+		const unsigned char c = s[i];
+		if(c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if(c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		}
+		else
+		{
+			result += c;
+		}
+	}
+	return result + "\"";
+}
+
+void writeStatistics(std::ostream& out, const std::vector<uint64>& samples, const char* indent)
+{
+	const BenchmarkStatistics s(samples);
+	out << indent << "\"unit\": \"ns\", \"count\": " << s.count
+		<< ", \"min\": " << s.min << ", \"median\": " << s.median << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99
+		<< ", \"max\": " << s.max << ", \"mean\": " << s.mean << ", \"stddev\": " << s.stddev << ",\n";
+
+	out << indent << "\"samples\": [";
+	for(std::size_t i = 0; i < samples.size(); ++i)
+		out << ((i == 0) ? "" : ", ") << samples[i];
+	out << "]";
+}
+
+std::string getHostName()
+{
+#ifdef __PLATFORM_WINDOWS__
+	const char* name = std::getenv("COMPUTERNAME");
+	return name ? name : "";
+#else
+	char name[256] = { 0 };
+	if(gethostname(name, sizeof(name) - 1) != 0) return "";
+	return name;
+#endif
+}
+
+void writeJsonToStandardOutput()
+{
+	Benchmark::writeJson("-");
+}
+
+std::string getDate()
+{
+	std::time_t now = std::time(NULL);
+	char text[32] = { 0 };
+	std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+	return text;
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+BenchmarkOptions::BenchmarkOptions() : warmup(1), repetitions(5), cpu(-1)
+{
+	const char* value;
+	if((value = std::getenv("ZILLIANS_BENCHMARK_WARMUP")) != NULL) parseValue(value, warmup);
+	if((value = std::getenv("ZILLIANS_BENCHMARK_REPETITIONS")) != NULL) parseValue(value, repetitions);
+	if((value = std::getenv("ZILLIANS_BENCHMARK_CPU")) != NULL) parseValue(value, cpu);
+	if((value = std::getenv("ZILLIANS_BENCHMARK_FILTER")) != NULL) filter = value;
+	if((value = std::getenv("ZILLIANS_BENCHMARK_JSON")) != NULL) json = value;
+	if(repetitions == 0) repetitions = 1;
+}
+
+bool BenchmarkOptions::parse(int& argc, char** argv)
+{
+	int kept = 1;
+	bool valid = true;
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* value;
+		if((value = getOption(argv[i], "warmup")) != NULL)
+			valid = parseValue(value, warmup) && valid;
+		else if((value = getOption(argv[i], "repetitions")) != NULL)
+			valid = parseValue(value, repetitions) && repetitions > 0 && valid;
+		else if((value = getOption(argv[i], "cpu")) != NULL)
+			valid = parseValue(value, cpu) && valid;
+		else if((value = getOption(argv[i], "filter")) != NULL)
+			filter = value;
+		else if((value = getOption(argv[i], "json")) != NULL)
+			json = value;
+		else
+			argv[kept++] = argv[i];
+	}
+	argc = kept;
+	argv[argc] = NULL;
+
+	if(!valid)
+	{
+		std::cerr << "benchmark options: [--warmup=runs] [--repetitions=runs] [--cpu=first cpu] [--filter=name part] [--json=file or -]" << std::endl;
+		if(repetitions == 0) repetitions = 1;
+	}
+	return valid;
+}
+
+//////////////////////////////////////////////////////////////////////////
+BenchmarkState::BenchmarkState(std::size_t repetition, bool warmup) :
+	mRepetition(repetition), mWarmup(warmup),
+	mTimed(false), mRunning(false), mStart(0), mElapsed(0),
+	mItems(0), mBytes(0)
+{ }
+
+void BenchmarkState::start()
+{
+	if(mRunning) return;
+	mTimed = true;
+	mRunning = true;
+	mStart = TimerUtil::now_ns();
+}
+
+void BenchmarkState::stop()
+{
+	if(!mRunning) return;
+	mElapsed += TimerUtil::now_ns() - mStart;
+	mRunning = false;
+}
+
+void BenchmarkState::recordPhase(const std::string& name, uint64 ns)
+{
+	for(std::size_t i = 0; i < mPhases.size(); ++i)
+	{
+		if(mPhases[i].first == name)
+		{
+			mPhases[i].second += ns;
+			return;
+		}
+	}
+	mPhases.push_back(std::make_pair(name, ns));
+}
+
+//////////////////////////////////////////////////////////////////////////
+BenchmarkStatistics::BenchmarkStatistics(const std::vector<uint64>& samples) :
+	count(samples.size()), min(0), median(0), p90(0), p99(0), max(0), mean(0), stddev(0)
+{
+	if(samples.empty()) return;
+
+	std::vector<uint64> sorted(samples);
+	std::sort(sorted.begin(), sorted.end());
+
+	// nearest rank, so every percentile is a run that really happened
+	const std::size_t n = sorted.size();
+	min = sorted.front();
+	max = sorted.back();
+	median = (n % 2 == 1) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+	p90 = sorted[std::min(n - 1, (std::size_t)std::ceil(0.90 * n) - 1)];
+	p99 = sorted[std::min(n - 1, (std::size_t)std::ceil(0.99 * n) - 1)];
+
+	double sum = 0;
+	for(std::size_t i = 0; i < n; ++i) sum += sorted[i];
+	mean = sum / n;
+
+	double squares = 0;
+	for(std::size_t i = 0; i < n; ++i) squares += (sorted[i] - mean) * (sorted[i] - mean);
+	stddev = (n > 1) ? std::sqrt(squares / (n - 1)) : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+BenchmarkOptions& Benchmark::options()
+{
+	static BenchmarkOptions options;
+	return options;
+}
+
+bool Benchmark::run(const std::string& name, const Function& function)
+{
+	const BenchmarkOptions& o = options();
+	if(!o.filter.empty() && name.find(o.filter) == std::string::npos)
+		return false;
+
+	static bool pinned = false;
+	if(!pinned && o.cpu >= 0)
+	{
+		pinThread(0);
+		pinned = true;
+	}
+
+	for(std::size_t i = 0; i < o.warmup; ++i)
+	{
+		BenchmarkState state(i, true);
+		function(state);
+	}
+
+	BenchmarkResult result;
+	result.name = name;
+	result.items = 0;
+	result.bytes = 0;
+	for(std::size_t i = 0; i < o.repetitions; ++i)
+	{
+		BenchmarkState state(i, false);
+		const uint64 start = TimerUtil::now_ns();
+		function(state);
+		const uint64 stop = TimerUtil::now_ns();
+		state.stop();
+
+		result.samples.push_back(state.mTimed ? state.mElapsed : stop - start);
+		for(std::size_t p = 0; p < state.mPhases.size(); ++p)
+		{
+			std::size_t j = 0;
+			while(j < result.phases.size() && result.phases[j].first != state.mPhases[p].first) ++j;
+			if(j == result.phases.size())
+				result.phases.push_back(std::make_pair(state.mPhases[p].first, std::vector<uint64>()));
+			result.phases[j].second.push_back(state.mPhases[p].second);
+		}
+		result.items = state.mItems;
+		result.bytes = state.mBytes;
+		result.counters.swap(state.mCounters);
+	}
+
+	printStatistics(result.name, result.samples, result.items, result.bytes);
+	for(std::size_t i = 0; i < result.phases.size(); ++i)
+		printStatistics(result.name + "/" + result.phases[i].first, result.phases[i].second, 0, 0);
+	for(std::map<std::string, double>::const_iterator it = result.counters.begin(); it != result.counters.end(); ++it)
+		std::cout << "[benchmark] " << result.name << ": " << it->first << " = " << it->second << std::endl;
+
+	getResults().push_back(result);
+
+	// files are rewritten after every benchmark, so a crash later on still leaves the results so far,
+	// while the standard output gets a single document at exit
+	static bool at_exit = false;
+	if(o.json == "-" && !at_exit)
+	{
+		std::atexit(writeJsonToStandardOutput);
+		at_exit = true;
+	}
+	else if(!o.json.empty() && o.json != "-" && !writeJson(o.json))
+	{
+		std::cerr << "[benchmark] failed to write " << o.json << std::endl;
+	}
+	return true;
+}
+
+bool Benchmark::pinThread(std::size_t index)
+{
+	const BenchmarkOptions& o = options();
+	if(o.cpu < 0) return true;
+
+	const uint32 cpus = std::max<uint32>(1, ThreadPlacement::getCpuCount());
+	return ThreadPlacement::onCpu((uint32)((o.cpu + index) % cpus)).apply();
+}
+
+const std::vector<BenchmarkResult>& Benchmark::results()
+{
+	return getResults();
+}
+
+bool Benchmark::writeJson(const std::string& path)
+{
+	std::ostringstream out;
+	out.precision(15);
+
+	const BenchmarkOptions& o = options();
+	out << "{\n";
+	out << "  \"context\": {\n";
+	out << "    \"host\": " << quote(getHostName()) << ", \"date\": " << quote(getDate()) << ",\n";
+	out << "    \"cpus\": " << ThreadPlacement::getCpuCount() << ", \"cpu\": " << o.cpu
+		<< ", \"constant_cycle_counter\": " << (TimerUtil::has_constant_cycle_counter() ? "true" : "false") << ",\n";
+	out << "    \"warmup\": " << o.warmup << ", \"repetitions\": " << o.repetitions << "\n";
+	out << "  },\n";
+	out << "  \"benchmarks\": [";
+
+	const std::vector<BenchmarkResult>& all = getResults();
+	for(std::size_t i = 0; i < all.size(); ++i)
+	{
+		const BenchmarkResult& r = all[i];
+		out << ((i == 0) ? "\n" : ",\n") << "    {\n";
+		out << "      \"name\": " << quote(r.name) << ",\n";
+		writeStatistics(out, r.samples, "      ");
+		out << ",\n      \"items\": " << r.items << ", \"bytes\": " << r.bytes << ",\n";
+
+		out << "      \"counters\": {";
+		for(std::map<std::string, double>::const_iterator it = r.counters.begin(); it != r.counters.end(); ++it)
+			out << ((it == r.counters.begin()) ? " " : ", ") << quote(it->first) << ": " << it->second;
+		out << (r.counters.empty() ? "" : " ") << "},\n";
+
+		out << "      \"phases\": [";
+		for(std::size_t p = 0; p < r.phases.size(); ++p)
+		{
+			out << ((p == 0) ? "\n" : ",\n") << "        {\n";
+			out << "          \"name\": " << quote(r.phases[p].first) << ",\n";
+			writeStatistics(out, r.phases[p].second, "          ");
+			out << "\n        }";
+		}
+		out << (r.phases.empty() ? "" : "\n      ") << "]\n";
+		out << "    }";
+	}
+	out << (all.empty() ? "" : "\n  ") << "]\n";
+	out << "}\n";
+
+	if(path == "-")
+	{
+		std::cout << out.str() << std::flush;
+		return true;
+	}
+
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	file << out.str();
+	return file.good();
+}
+
+}
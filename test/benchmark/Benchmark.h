@@ -0,0 +1,204 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ZILLIANS_BENCHMARK_H_
+#define ZILLIANS_BENCHMARK_H_
+
+#include "core/Types.h"
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace zillians {
+
+/**
+ * @brief How Benchmark::run() runs and reports benchmarks.
+ *
+ * The defaults are taken from the environment, so tests driven by Boost.Test are
+ * configured the same way as those with their own main():
+ *
+ * - ZILLIANS_BENCHMARK_WARMUP: runs thrown away before measuring, 1 by default
+ * - ZILLIANS_BENCHMARK_REPETITIONS: measured runs, 5 by default
+ * - ZILLIANS_BENCHMARK_CPU: pin the benchmark threads starting from this cpu, not pinned by default
+ * - ZILLIANS_BENCHMARK_FILTER: only run benchmarks whose name contains this
+ * - ZILLIANS_BENCHMARK_JSON: write all results to this file, "-" for the standard output
+ */
+struct BenchmarkOptions
+{
+	BenchmarkOptions();
+
+	/**
+	 * @brief Take --warmup=, --repetitions=, --cpu=, --filter= and --json= out of the command line.
+	 *
+	 * Other arguments are left in place, in their order, for the test to parse.
+	 *
+	 * @return False if a value is malformed, after printing the usage.
+	 */
+	bool parse(int& argc, char** argv);
+
+	std::size_t warmup;
+	std::size_t repetitions;
+	int cpu;				///< The first cpu to pin to, or -1
+	std::string filter;
+	std::string json;		///< The file to write results to, empty for none
+};
+
+/**
+ * @brief BenchmarkState is given to the benchmark on each run to report what it measured.
+ *
+ * Without start() and stop() the whole run is timed, use them to leave setup and tear down out.
+ */
+class BenchmarkState : public boost::noncopyable
+{
+	friend class Benchmark;
+public:
+	BenchmarkState(std::size_t repetition, bool warmup);
+
+public:
+	/**
+	 * @brief Start timing, all time between start() and stop() pairs of a run is added up.
+	 */
+	void start();
+	void stop();
+
+	/**
+	 * @brief Report the time of one part of the run, phases of the same name are added up.
+	 *
+	 * Phases are summarized and reported under the benchmark like the run itself.
+	 */
+	void recordPhase(const std::string& name, uint64 ns);
+
+	/**
+	 * @brief Report how much the run has done, to print items and bytes per second.
+	 */
+	inline void setItemsProcessed(uint64 items)
+	{ mItems = items; }
+
+	inline void setBytesProcessed(uint64 bytes)
+	{ mBytes = bytes; }
+
+	/**
+	 * @brief Report any other figure of the run, the one of the last measured run is kept.
+	 */
+	inline void setCounter(const std::string& name, double value)
+	{ mCounters[name] = value; }
+
+	inline std::size_t repetition() const
+	{ return mRepetition; }
+
+	inline bool isWarmup() const
+	{ return mWarmup; }
+
+private:
+	std::size_t mRepetition;
+	bool mWarmup;
+
+	bool mTimed;
+	bool mRunning;
+	uint64 mStart;
+	uint64 mElapsed;
+
+	std::vector<std::pair<std::string, uint64> > mPhases;
+	uint64 mItems;
+	uint64 mBytes;
+	std::map<std::string, double> mCounters;
+};
+
+/**
+ * @brief Order statistics of the measured runs of a benchmark or a phase, in nanoseconds.
+ */
+struct BenchmarkStatistics
+{
+	explicit BenchmarkStatistics(const std::vector<uint64>& samples);
+
+	std::size_t count;
+	double min;
+	double median;
+	double p90;
+	double p99;
+	double max;
+	double mean;
+	double stddev;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::vector<uint64> samples;
+	std::vector<std::pair<std::string, std::vector<uint64> > > phases;	///< In the order first reported
+	uint64 items;
+	uint64 bytes;
+	std::map<std::string, double> counters;
+};
+
+/**
+ * @brief Benchmark runs benchmarks the same way for all performance tests, so their results can be compared.
+ *
+ * Each benchmark is run for warmup, then measured a number of times. One line is printed per benchmark
+ * and per phase, with the median and the spread of the runs, and every result is added to the JSON file
+ * if one is given.
+ *
+ * @code
+ * Benchmark::run("memcpy/64MB", [&](BenchmarkState& state) {
+ *     memcpy(dest, src, size);
+ *     state.setBytesProcessed(size);
+ * });
+ * @endcode
+ *
+ * @note When pinning is enabled, the calling thread is pinned to the first cpu, and threads created by
+ * the benchmark inherit that cpu until they call pinThread().
+ */
+class Benchmark
+{
+public:
+	typedef boost::function<void (BenchmarkState&)> Function;
+
+	/**
+	 * @brief Get the options used by run(), change them before the first run.
+	 */
+	static BenchmarkOptions& options();
+
+	/**
+	 * @brief Run the benchmark, unless it's filtered out.
+	 *
+	 * @return True if it was run.
+	 */
+	static bool run(const std::string& name, const Function& function);
+
+	/**
+	 * @brief Pin the calling thread to the index-th cpu after the first one, if pinning is enabled.
+	 *
+	 * Threads of a benchmark call it with their own index, so they don't all share one cpu.
+	 */
+	static bool pinThread(std::size_t index);
+
+	static const std::vector<BenchmarkResult>& results();
+
+	/**
+	 * @brief Write the results so far as JSON, along with the options and the machine they ran on.
+	 */
+	static bool writeJson(const std::string& path);
+};
+
+}
+
+#endif/*ZILLIANS_BENCHMARK_H_*/
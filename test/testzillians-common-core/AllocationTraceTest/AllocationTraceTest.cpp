@@ -0,0 +1,147 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/AllocationTrace.h"
+#include "core/ScalablePoolAllocator.h"
+#include <boost/thread/thread.hpp>
+#include <stdexcept>
+#include <vector>
+
+#define BOOST_TEST_MODULE AllocationTraceTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( AllocationTraceTest )
+
+namespace {
+
+const char* TRACE_PATH = "AllocationTraceTest.trace";
+
+AllocationTraceRecord makeRecord(uint64 timestamp, uint16 thread, uint8 operation, uint64 address, uint32 size)
+{
+	AllocationTraceRecord r;
+	r.timestamp = timestamp;
+	r.address = address;
+	r.size = size;
+	r.thread = thread;
+	r.operation = operation;
+	r.reserved = 0;
+	return r;
+}
+
+void churn(ScalablePoolAllocator* pool, std::size_t rounds)
+{
+	std::vector<byte*> live;
+	for(std::size_t i = 0; i < rounds; ++i)
+	{
+		live.push_back(pool->allocate(16 + (i % 64) * 24));
+		if(live.size() > 256)
+		{
+			pool->deallocate(live.front());
+			live.erase(live.begin());
+		}
+	}
+	for(std::size_t i = 0; i < live.size(); ++i)
+		pool->deallocate(live[i]);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( AllocationTraceTestCase1 )
+{
+	// trace a multithreaded workload on a pool, then replay it on the heap
+	const std::size_t POOL_SIZE = 16 * 1024 * 1024;
+	const std::size_t THREADS = 4;
+	const std::size_t ROUNDS = 10000;
+
+	byte* memory = new byte[POOL_SIZE];
+	{
+		ScalablePoolAllocator pool(memory, POOL_SIZE);
+		AllocationTracer tracer(TRACE_PATH);
+		pool.setTracer(&tracer);
+
+		boost::thread_group group;
+		for(std::size_t i = 0; i < THREADS; ++i)
+			group.create_thread(boost::bind(churn, &pool, ROUNDS));
+		group.join_all();
+
+		pool.setTracer(NULL);
+		BOOST_CHECK_EQUAL(tracer.recordCount(), THREADS * ROUNDS * 2);
+	}
+	delete[] memory;
+
+	AllocationTrace trace(TRACE_PATH);
+	BOOST_CHECK_EQUAL(trace.threadCount(), THREADS);
+	BOOST_CHECK_EQUAL(trace.allocationCount(), THREADS * ROUNDS);
+	BOOST_CHECK_EQUAL(trace.operationCount(), THREADS * ROUNDS * 2);
+	BOOST_CHECK(trace.peakRequestedBytes() > 0);
+
+	DefaultBufferAllocator allocator;
+	AllocationReplayResult result = trace.replay(allocator);
+	BOOST_CHECK_EQUAL(result.operations, THREADS * ROUNDS * 2);
+	BOOST_CHECK_EQUAL(result.failures, 0);
+	BOOST_CHECK_EQUAL(result.allocateLatency.count(), THREADS * ROUNDS);
+	BOOST_CHECK_EQUAL(result.deallocateLatency.count(), THREADS * ROUNDS);
+	BOOST_CHECK(result.throughput() > 0.0);
+	result.print("DefaultBufferAllocator");
+
+	remove(TRACE_PATH);
+}
+
+BOOST_AUTO_TEST_CASE( AllocationTraceTestCase2 )
+{
+	// address reuse, cross-thread frees and frees of memory allocated before tracing
+	std::vector<AllocationTraceRecord> records;
+	records.push_back(makeRecord(5, 1, AllocationTraceRecord::DEALLOCATE, 0x1000, 0));
+	records.push_back(makeRecord(1, 0, AllocationTraceRecord::ALLOCATE, 0x1000, 100));
+	records.push_back(makeRecord(2, 0, AllocationTraceRecord::DEALLOCATE, 0x9000, 0));
+	records.push_back(makeRecord(3, 0, AllocationTraceRecord::ALLOCATE, 0x2000, 50));
+	records.push_back(makeRecord(7, 1, AllocationTraceRecord::ALLOCATE, 0x1000, 30));
+	records.push_back(makeRecord(8, 0, AllocationTraceRecord::DEALLOCATE, 0x1000, 0));
+
+	AllocationTrace trace(records);
+	BOOST_CHECK_EQUAL(trace.threadCount(), 2);
+	BOOST_CHECK_EQUAL(trace.allocationCount(), 3);
+	BOOST_CHECK_EQUAL(trace.operationCount(), 5);
+	BOOST_CHECK_EQUAL(trace.peakRequestedBytes(), 150);
+
+	DefaultBufferAllocator allocator;
+	AllocationReplayResult result = trace.replay(allocator);
+	BOOST_CHECK_EQUAL(result.operations, 5);
+	BOOST_CHECK_EQUAL(result.allocateLatency.count(), 3);
+	BOOST_CHECK_EQUAL(result.deallocateLatency.count(), 2);
+}
+
+BOOST_AUTO_TEST_CASE( AllocationTraceTestCase3 )
+{
+	BOOST_CHECK_THROW(AllocationTrace trace("AllocationTraceTest.missing"), std::runtime_error);
+
+	FILE* f = fopen(TRACE_PATH, "wb");
+	fputs("not a trace", f);
+	fclose(f);
+	BOOST_CHECK_THROW(AllocationTrace trace(TRACE_PATH), std::runtime_error);
+
+	remove(TRACE_PATH);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
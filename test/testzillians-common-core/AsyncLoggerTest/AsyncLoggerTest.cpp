@@ -0,0 +1,206 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/AsyncLogger.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#include <string>
+
+#define BOOST_TEST_MODULE AsyncLoggerTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( AsyncLoggerTest )
+
+struct CollectingSink
+{
+	CollectingSink() : blocked(false) { }
+
+	void write(LogLevel::type level, uint64 timestamp, const char* message)
+	{
+		UNUSED_ARGUMENT(timestamp);
+		boost::mutex::scoped_lock lock(mutex);
+		while(blocked)
+			condition.wait(lock);
+		levels.push_back(level);
+		lines.push_back(message);
+	}
+
+	void block()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		blocked = true;
+	}
+
+	void unblock()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		blocked = false;
+		condition.notify_all();
+	}
+
+	AsyncLogger::Sink sink()
+	{
+		return boost::bind(&CollectingSink::write, this, _1, _2, _3);
+	}
+
+	boost::mutex mutex;
+	boost::condition_variable condition;
+	bool blocked;
+	std::vector<LogLevel::type> levels;
+	std::vector<std::string> lines;
+};
+
+enum Color { red, green };
+
+static void logMany(AsyncLogger* logger, int id, int n)
+{
+	for(int i = 0; i < n; ++i)
+		logger->info("thread %d record %d", id, i);
+}
+
+BOOST_AUTO_TEST_CASE( AsyncLogger_Format_Test )
+{
+	CollectingSink collected;
+	{
+		AsyncLogger logger(collected.sink());
+
+		std::string name("session");
+		char buffer[16];
+		strcpy(buffer, "temporary");
+
+		logger.info("plain");
+		logger.warn("%d %u %ld %lld %x", -1, 2u, -3L, 4LL, 255);
+		logger.error("%.2f %e %5.1f|", 3.14159, 1000.0, 2.0f);
+		logger.debug("%s=%s [%-10s] %c", name, "literal", buffer, 'z');
+		strcpy(buffer, "overwritten");
+		logger.info("100%% %d%s", 5, "!");
+		logger.info("%s %d", 42, "text");
+		logger.info("missing %d %s", 1);
+		logger.info("color %d", green);
+		logger.flush();
+
+		BOOST_REQUIRE_EQUAL(collected.lines.size(), 8u);
+		BOOST_CHECK_EQUAL(collected.lines[0], "plain");
+		BOOST_CHECK_EQUAL(collected.levels[0], LogLevel::info);
+		BOOST_CHECK_EQUAL(collected.lines[1], "-1 2 -3 4 ff");
+		BOOST_CHECK_EQUAL(collected.levels[1], LogLevel::warn);
+		BOOST_CHECK_EQUAL(collected.lines[2], "3.14 1.000000e+03   2.0|");
+		BOOST_CHECK_EQUAL(collected.lines[3], "session=literal [temporary ] z");
+		BOOST_CHECK_EQUAL(collected.lines[4], "100% 5!");
+		BOOST_CHECK_EQUAL(collected.lines[5], "42 text");
+		BOOST_CHECK_EQUAL(collected.lines[6], "missing 1 %s");
+		BOOST_CHECK_EQUAL(collected.lines[7], "color 1");
+	}
+}
+
+BOOST_AUTO_TEST_CASE( AsyncLogger_LongString_Test )
+{
+	CollectingSink collected;
+	{
+		AsyncLogger logger(collected.sink());
+		std::string s(200, 'a');
+		logger.info("%s|%s", s, "b");
+	}
+	BOOST_REQUIRE_EQUAL(collected.lines.size(), 1u);
+	BOOST_CHECK_EQUAL(collected.lines[0], std::string(AsyncLogger::MAX_STRING_SIZE - 1, 'a') + "|");
+}
+
+BOOST_AUTO_TEST_CASE( AsyncLogger_Drop_Test )
+{
+	CollectingSink collected;
+	{
+		AsyncLogger logger(collected.sink(), 16, AsyncLogger::OverflowPolicy::drop);
+
+		// the first record stalls the background thread in the sink
+		collected.block();
+		logger.info("stalled");
+		boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+
+		int accepted = 0;
+		for(int i = 0; i < 100; ++i)
+		{
+			if(logger.info("record %d", i))
+				++accepted;
+		}
+		// the stalled record keeps its slot until the sink returns
+		BOOST_CHECK_EQUAL(accepted, 15);
+		BOOST_CHECK_EQUAL(logger.dropped(), 85u);
+
+		collected.unblock();
+		logger.flush();
+	}
+
+	// the drops are reported once, among the records accepted
+	BOOST_REQUIRE_EQUAL(collected.lines.size(), 1u + 15u + 1u);
+	BOOST_CHECK_EQUAL(collected.lines[0], "stalled");
+	int record = 0;
+	int reports = 0;
+	for(std::size_t i = 1; i < collected.lines.size(); ++i)
+	{
+		if(collected.lines[i] == "85 log records dropped")
+		{
+			BOOST_CHECK_EQUAL(collected.levels[i], LogLevel::warn);
+			++reports;
+		}
+		else
+		{
+			char expected[32];
+			sprintf(expected, "record %d", record++);
+			BOOST_CHECK_EQUAL(collected.lines[i], expected);
+		}
+	}
+	BOOST_CHECK_EQUAL(reports, 1);
+}
+
+BOOST_AUTO_TEST_CASE( AsyncLogger_Block_Test )
+{
+	const int threads = 4;
+	const int n = 5000;
+
+	CollectingSink collected;
+	{
+		AsyncLogger logger(collected.sink(), 64, AsyncLogger::OverflowPolicy::block);
+
+		boost::thread_group group;
+		for(int i = 0; i < threads; ++i)
+			group.create_thread(boost::bind(&logMany, &logger, i, n));
+		group.join_all();
+
+		BOOST_CHECK_EQUAL(logger.dropped(), 0u);
+	}
+
+	// records of each thread are written in order
+	BOOST_REQUIRE_EQUAL(collected.lines.size(), (std::size_t)(threads * n));
+	std::vector<int> expected(threads, 0);
+	for(std::size_t i = 0; i < collected.lines.size(); ++i)
+	{
+		int id = -1, record = -1;
+		BOOST_REQUIRE(sscanf(collected.lines[i].c_str(), "thread %d record %d", &id, &record) == 2);
+		BOOST_REQUIRE(id >= 0 && id < threads);
+		BOOST_CHECK_EQUAL(record, expected[id]++);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
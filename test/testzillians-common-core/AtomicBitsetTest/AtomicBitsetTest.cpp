@@ -0,0 +1,140 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Atomic.h"
+#include "utility/BitTrickUtil.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+
+#define BOOST_TEST_MODULE AtomicBitsetTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( AtomicBitsetTest )
+
+BOOST_AUTO_TEST_CASE( AtomicBitset_BitTrick_Test )
+{
+	BOOST_CHECK_EQUAL(count_trailing_zeros(uint64(0)), 64u);
+	BOOST_CHECK_EQUAL(count_trailing_zeros(uint64(8)), 3u);
+	BOOST_CHECK_EQUAL(count_leading_zeros(uint32(1)), 31u);
+	BOOST_CHECK_EQUAL(population_count(uint64(0xF0F0)), 8u);
+	BOOST_CHECK_EQUAL(floor_log2(uint64(1000)), 9u);
+	BOOST_CHECK_EQUAL(ceil_log2(uint64(1000)), 10u);
+	BOOST_CHECK_EQUAL(ceil_log2(uint32(1024)), 10u);
+	BOOST_CHECK(is_power_of_two(64) && !is_power_of_two(0) && !is_power_of_two(65));
+
+	BOOST_CHECK_EQUAL(round_up_to_nearest_power_of_two<uint32>::apply(0), 0u);
+	BOOST_CHECK_EQUAL(round_up_to_nearest_power_of_two<uint32>::apply(1), 1u);
+	BOOST_CHECK_EQUAL(round_up_to_nearest_power_of_two<uint32>::apply(33), 64u);
+	BOOST_CHECK_EQUAL(round_up_to_nearest_power_of_two<uint64>::apply(uint64(1) << 40), uint64(1) << 40);
+	BOOST_CHECK_EQUAL(round_up_to_nearest_power_of_two<uint64>::apply((uint64(1) << 40) + 1), uint64(1) << 41);
+
+	// usable in constant expressions
+	char buffer[round_up_to_nearest_power_of_two<uint32>::apply(100)];
+	BOOST_CHECK_EQUAL(sizeof(buffer), 128u);
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBitset_Basic_Test )
+{
+	AtomicBitset<200> bits;
+	BOOST_CHECK_EQUAL(bits.size(), 200u);
+	BOOST_CHECK(bits.none());
+	BOOST_CHECK_EQUAL(bits.find_first(), 200u);
+	BOOST_CHECK_EQUAL(bits.find_last(), 200u);
+
+	BOOST_CHECK(!bits.set(3));
+	BOOST_CHECK(bits.set(3));
+	BOOST_CHECK(!bits.test_and_set(64));
+	BOOST_CHECK(!bits.set(199));
+	BOOST_CHECK(bits.test(3) && bits.test(64) && bits.test(199) && !bits.test(4));
+	BOOST_CHECK_EQUAL(bits.count(), 3u);
+
+	BOOST_CHECK_EQUAL(bits.find_first(), 3u);
+	BOOST_CHECK_EQUAL(bits.find_next(3), 64u);
+	BOOST_CHECK_EQUAL(bits.find_next(64), 199u);
+	BOOST_CHECK_EQUAL(bits.find_next(199), 200u);
+	BOOST_CHECK_EQUAL(bits.find_last(), 199u);
+
+	std::vector<std::size_t> visited;
+	bits.for_each([&visited](std::size_t i) { visited.push_back(i); });
+	BOOST_REQUIRE_EQUAL(visited.size(), 3u);
+	BOOST_CHECK(visited[0] == 3 && visited[1] == 64 && visited[2] == 199);
+
+	BOOST_CHECK(bits.reset(64));
+	BOOST_CHECK(!bits.reset(64));
+	BOOST_CHECK_EQUAL(bits.take_word(0), uint64(1) << 3);
+	BOOST_CHECK_EQUAL(bits.word(0), 0u);
+	BOOST_CHECK_EQUAL(bits.count(), 1u);
+
+	bits.clear();
+	BOOST_CHECK(bits.none());
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBitset_Acquire_Test )
+{
+	AtomicBitset<130, false> slots;
+	for(std::size_t i = 0; i < 130; ++i)
+		BOOST_CHECK_EQUAL(slots.acquire(), i);
+	// the bits beyond the size of the last word are never handed out
+	BOOST_CHECK_EQUAL(slots.acquire(), 130u);
+
+	slots.reset(7);
+	slots.reset(129);
+	BOOST_CHECK_EQUAL(slots.acquire(128), 129u);
+	BOOST_CHECK_EQUAL(slots.acquire(128), 7u);
+	BOOST_CHECK_EQUAL(slots.acquire(), 130u);
+}
+
+static void acquireMany(AtomicBitset<4096>* slots, std::vector<std::size_t>* acquired, std::size_t hint)
+{
+	for(std::size_t i = 0; i < 1024; ++i)
+		acquired->push_back(slots->acquire(hint));
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBitset_Concurrent_Test )
+{
+	AtomicBitset<4096> slots;
+	std::vector<std::size_t> acquired[4];
+
+	boost::thread_group group;
+	for(int i = 0; i < 4; ++i)
+		group.create_thread(boost::bind(&acquireMany, &slots, &acquired[i], i * 1024));
+	group.join_all();
+
+	// every slot is handed out exactly once
+	std::vector<int> owners(4096, 0);
+	for(int i = 0; i < 4; ++i)
+	{
+		for(std::size_t j = 0; j < acquired[i].size(); ++j)
+		{
+			BOOST_REQUIRE(acquired[i][j] < 4096);
+			++owners[acquired[i][j]];
+		}
+	}
+	BOOST_CHECK(std::count(owners.begin(), owners.end(), 1) == 4096);
+	BOOST_CHECK_EQUAL(slots.count(), 4096u);
+	BOOST_CHECK_EQUAL(slots.acquire(), 4096u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -123,8 +123,154 @@ void ThreadWriter(atomic::AtomicPipe<int, numElements>* pipe)
 	}
 }
 
+void TestMessageOwnership()
+{
+	boost::shared_ptr<int> message(new int(1));
+
+	{
+		atomic::AtomicPipe<boost::shared_ptr<int>, 4> pipe;
+		for(int i = 0; i < 10; ++i)
+			pipe.write(message, i != 9);
+		pipe.flush();
+		BOOST_ASSERT(message.use_count() == 11);
+
+		// read moves the message out and destroys its slot
+		boost::shared_ptr<int> ret;
+		pipe.read(&ret);
+		ret.reset();
+		BOOST_ASSERT(message.use_count() == 10);
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+		boost::shared_ptr<int> moved(message);
+		pipe.write(std::move(moved), false);
+		BOOST_ASSERT(!moved && message.use_count() == 11);
+
+		pipe.emplace(false, message);
+		BOOST_ASSERT(message.use_count() == 12);
+#endif
+	}
+
+	// unread messages are destroyed along with the pipe
+	BOOST_ASSERT(message.use_count() == 1);
+	UNUSED_ARGUMENT(message);
+}
+
+#define numLockFreeThreads 4
+#define numLockFreeData 100000
+
+struct TestStackNode : atomic::stack_node
+{
+	int value;
+};
+
+void LockFreeStackPusher(atomic::stack<TestStackNode>* stack, int base)
+{
+	for(int i = 0; i < numLockFreeData; ++i)
+	{
+		TestStackNode* node = new TestStackNode;
+		node->value = base + i;
+		stack->push(node);
+	}
+}
+
+void LockFreeStackPopper(atomic::stack<TestStackNode>* stack, tbb::atomic<int>* remaining, tbb::atomic<int64>* sum)
+{
+	while(*remaining > 0)
+	{
+		TestStackNode* node = stack->pop();
+		if(node)
+		{
+			*sum += node->value;
+			--(*remaining);
+			// concurrent pops may still read the node
+			HazardPointer::retire(node);
+		}
+	}
+}
+
+void LockFreeQueuePusher(atomic::queue<int>* queue, int* values)
+{
+	for(int i = 0; i < numLockFreeData; ++i)
+		queue->push(&values[i]);
+}
+
+void LockFreeQueuePopper(atomic::queue<int>* queue, tbb::atomic<int>* remaining, tbb::atomic<int64>* sum, int* last)
+{
+	while(*remaining > 0)
+	{
+		int* value = queue->pop();
+		if(value)
+		{
+			// items of the same producer must come out in order
+			int producer = *value / numLockFreeData;
+			BOOST_ASSERT(*value > last[producer]);
+			last[producer] = *value;
+
+			*sum += *value;
+			--(*remaining);
+		}
+	}
+}
+
+void TestLockFreeContainers()
+{
+	const int64 total = (int64)numLockFreeThreads * numLockFreeData;
+	const int64 expected = total * (total - 1) / 2;
+
+	{
+		atomic::stack<TestStackNode> stack;
+		tbb::atomic<int> remaining; remaining = total;
+		tbb::atomic<int64> sum; sum = 0;
+
+		std::vector<tbb::tbb_thread*> threads;
+		for(int i = 0; i < numLockFreeThreads; ++i)
+		{
+			threads.push_back(new tbb::tbb_thread(boost::bind(&LockFreeStackPusher, &stack, i * numLockFreeData)));
+			threads.push_back(new tbb::tbb_thread(boost::bind(&LockFreeStackPopper, &stack, &remaining, &sum)));
+		}
+		for(std::size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		BOOST_ASSERT(stack.empty() && sum == expected);
+		cout << "atomic::stack: " << total << " elements pushed and popped" << endl;
+	}
+
+	{
+		atomic::queue<int> queue;
+		tbb::atomic<int> remaining; remaining = total;
+		tbb::atomic<int64> sum; sum = 0;
+
+		std::vector<int> values(total);
+		for(int64 i = 0; i < total; ++i)
+			values[i] = (int)i;
+
+		std::vector<int> last(numLockFreeThreads * numLockFreeThreads, -1);
+
+		std::vector<tbb::tbb_thread*> threads;
+		for(int i = 0; i < numLockFreeThreads; ++i)
+		{
+			threads.push_back(new tbb::tbb_thread(boost::bind(&LockFreeQueuePusher, &queue, &values[i * numLockFreeData])));
+			threads.push_back(new tbb::tbb_thread(boost::bind(&LockFreeQueuePopper, &queue, &remaining, &sum, &last[i * numLockFreeThreads])));
+		}
+		for(std::size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		BOOST_ASSERT(queue.empty() && sum == expected);
+		cout << "atomic::queue: " << total << " elements pushed and popped" << endl;
+	}
+}
+
 int main()
 {
+	TestMessageOwnership();
+	TestLockFreeContainers();
+
 	atomic::AtomicPipe<int, numElements> atomicPipe;
 
 	tbb::tick_count start, end;
@@ -23,12 +23,14 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <tbb/tick_count.h>
 #include <tbb/tbb_thread.h>
 //#include <boost/thread.hpp>
 //#include <boost/timer.hpp>
 #include <boost/assert.hpp>
 #include "core/Prerequisite.h"
+#include "core/AtomicSpscRing.h"
 
 // load with 'consume' (data-dependent) memory ordering
 	template<typename T>
@@ -168,6 +170,73 @@ void reader(spsc_queue<int>* q, int n)
 	}
 }
 
+int ring_errors = 0;
+
+void ring_writer(zillians::AtomicSpscRing<int>* q, int n)
+{
+	for(int i=0;i<n;++i)
+	{
+		while(!q->push(i));
+	}
+}
+
+void ring_reader(zillians::AtomicSpscRing<int>* q, int n)
+{
+	int v;
+	for(int i=0;i<n;++i)
+	{
+		while(!q->pop(v));
+		if(v != i) ++ring_errors;
+	}
+}
+
+#define RING_BATCH_SIZE 32
+
+void ring_batch_writer(zillians::AtomicSpscRing<int>* q, int n)
+{
+	int batch[RING_BATCH_SIZE];
+	for(int i=0;i<n;)
+	{
+		int count = std::min(RING_BATCH_SIZE, n - i);
+		for(int j=0;j<count;++j)
+			batch[j] = i + j;
+
+		// a partial push leaves the rest of the batch for the next round
+		i += q->push_n(batch, count);
+	}
+}
+
+void ring_batch_reader(zillians::AtomicSpscRing<int>* q, int n)
+{
+	int batch[RING_BATCH_SIZE];
+	for(int i=0;i<n;)
+	{
+		std::size_t count = q->pop_n(batch, RING_BATCH_SIZE);
+		for(std::size_t j=0;j<count;++j)
+		{
+			if(batch[j] != i + (int)j) ++ring_errors;
+		}
+		i += count;
+	}
+}
+
+template<typename Writer, typename Reader>
+float run_ring(Writer w, Reader r, int n)
+{
+	zillians::AtomicSpscRing<int> q(1024);
+
+	tbb::tick_count start = tbb::tick_count::now();
+	tbb::tbb_thread tw(boost::bind(w, &q, n));
+	tbb::tbb_thread tr(boost::bind(r, &q, n));
+
+	tr.join();
+	tw.join();
+	tbb::tick_count end = tbb::tick_count::now();
+
+	if(q.size() != 0) ++ring_errors;
+	return (end - start).seconds()*1000.0;
+}
+
 // usage example
 int main(int argc, char** argv)
 {
@@ -195,5 +264,28 @@ int main(int argc, char** argv)
 //	double elapsed = timer.elapsed();
 	printf("enqueue/dequeue %d elements in %f ms\n", n, total);
 
+	printf("AtomicSpscRing push/pop %d elements in %f ms\n", n, run_ring(&ring_writer, &ring_reader, n));
+	printf("AtomicSpscRing push_n/pop_n %d elements in %f ms\n", n, run_ring(&ring_batch_writer, &ring_batch_reader, n));
+
+	// the ring must hold exactly its capacity
+	{
+		zillians::AtomicSpscRing<int> ring(4);
+		int v = 0;
+		for(int i=0;i<4;++i)
+			if(!ring.push(i)) ++ring_errors;
+		if(ring.push(4)) ++ring_errors;
+		if(!ring.pop(v) || v != 0) ++ring_errors;
+		if(!ring.push(4)) ++ring_errors;
+		int batch[8];
+		if(ring.pop_n(batch, 8) != 4 || batch[0] != 1 || batch[3] != 4) ++ring_errors;
+		if(ring.pop(v)) ++ring_errors;
+	}
+
+	if(ring_errors)
+	{
+		printf("AtomicSpscRing failed with %d errors\n", ring_errors);
+		return 1;
+	}
+
 	return 0;
 }
@@ -24,50 +24,43 @@
 #include "core/Prerequisite.h"
 #include "core/BiMap.h"
 #include "utility/UUIDUtil.h"
+#include <tbb/tbb_thread.h>
+#include <tbb/tick_count.h>
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
 
 using namespace zillians;
 using namespace std;
 
-#define NUM_THREAD	2
-#define NUM_LOOKUP	10000
+#define MAX_THREAD	64
+#define NUM_PREFILL	100000
+#define NUM_LOOKUP	200000
 
 log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("zillians.common.core.BiMapTest"));
 
-volatile bool gTerminated = false;
+tbb::atomic<bool> gTerminated;
 
-void ThreadReader(volatile int* counter, shared_ptr<BiMap<int, UUID> > map)
+void ThreadReader(tbb::atomic<int>* counter, tbb::atomic<int>* start_flag, tbb::atomic<int>* missed, shared_ptr<BiMap<int, UUID> > map)
 {
-	LOG4CXX_INFO(logger, "Thread ID: " << tbb::this_tbb_thread::get_id());
+	while (*start_flag == 0);
 
-	while (*counter <= 0);
-
-	int missed = 0;
-	tbb::tick_count start, end;
-	start = tbb::tick_count::now();
+	unsigned int seed = (unsigned int)(uintptr_t)&seed;
+	int local_missed = 0;
 	for (int i=0; i<NUM_LOOKUP; i++)
 	{
-		int c = (*counter), r = rand();
-		int random = r % c;
-		try
-		{
-			//int tmp = map->mapLeft(UUID("e6cd9ec2-564a-11de-9c55-001d92648328"));
-			UUID tmp = map->mapRight(random);
-			//LOG4CXX_INFO(logger, tmp);
-		}
-		catch (...)
-		{
-			missed++;
-		}
+		// every key below the counter has been inserted, so it must be found
+		int c = (*counter);
+		int key = rand_r(&seed) % c;
+		UUID tmp;
+		if (!map->mapRight(key, tmp))
+			local_missed++;
+		else if (map->mapLeft(tmp) != key)
+			local_missed++;
 	}
-	end = tbb::tick_count::now();
-	float total = (end - start).seconds()*1000.0;
-	LOG4CXX_INFO(logger, "Thread " << tbb::this_tbb_thread::get_id() << ": " << total << " ms / " << total / NUM_LOOKUP << " ms");
-	LOG4CXX_INFO(logger, "Thread " << tbb::this_tbb_thread::get_id() << ": found: " << NUM_LOOKUP - missed << " missed: " << missed);
+	*missed += local_missed;
 }
 
-void ThreadWriter(volatile int* counter, shared_ptr<BiMap<int, UUID> > map)
+void ThreadWriter(tbb::atomic<int>* counter, shared_ptr<BiMap<int, UUID> > map)
 {
 	while (!gTerminated)
 	{
@@ -81,42 +74,69 @@ void ThreadWriter(volatile int* counter, shared_ptr<BiMap<int, UUID> > map)
 		map->insert((*counter), uuid);
 		(*counter)++;
 	}
-
 }
 
 int main()
 {
 	srand(time(NULL));
+	gTerminated = false;
 	log4cxx::BasicConfigurator::configure();
-	std::list<tbb::tbb_thread*> threads;
-	shared_ptr<BiMap<int, UUID> > map = shared_ptr<BiMap<int, UUID> >(new BiMap<int, UUID>());
-	volatile int counter = 0;
 
-	LOG4CXX_INFO(logger, "NUM_THREAD: " << NUM_THREAD);
-
-	tbb::tbb_thread* threadWriter = new tbb::tbb_thread(boost::bind(&ThreadWriter, &counter, map));
-	for (int i=0; i<NUM_THREAD; i++)
+	shared_ptr<BiMap<int, UUID> > map = shared_ptr<BiMap<int, UUID> >(new BiMap<int, UUID>());
+	tbb::atomic<int> counter;
+	counter = 0;
+	for (int i=0; i<NUM_PREFILL; i++)
 	{
-		tbb::tbb_thread* thread;
-		thread = new tbb::tbb_thread(boost::bind(&ThreadReader, &counter, map));
-		threads.push_back(thread);
+		UUID uuid;
+		uuid.random();
+		bool inserted = map->insert(counter, uuid);
+		bool duplicated = map->insert(counter, uuid);
+		BOOST_ASSERT(inserted && !duplicated);
+		UNUSED_ARGUMENT(inserted); UNUSED_ARGUMENT(duplicated);
+		counter++;
 	}
 
-	for (std::list<tbb::tbb_thread*>::iterator i=threads.begin(); i!=threads.end(); i++)
+	// keep inserting while readers are looking up
+	tbb::tbb_thread* threadWriter = new tbb::tbb_thread(boost::bind(&ThreadWriter, &counter, map));
+
+	int total_missed = 0;
+	for (int num_thread=1; num_thread<=MAX_THREAD; num_thread*=2)
 	{
-		(*i)->join();
-	}
+		std::list<tbb::tbb_thread*> threads;
+		tbb::atomic<int> start_flag; start_flag = 0;
+		tbb::atomic<int> missed; missed = 0;
 
-	gTerminated = true;
-	threadWriter->join();
+		for (int i=0; i<num_thread; i++)
+		{
+			tbb::tbb_thread* thread;
+			thread = new tbb::tbb_thread(boost::bind(&ThreadReader, &counter, &start_flag, &missed, map));
+			threads.push_back(thread);
+		}
 
-	for (std::list<tbb::tbb_thread*>::iterator i=threads.begin(); i!=threads.end(); i++)
-	{
-		SAFE_DELETE(*i);
+		tbb::tick_count start = tbb::tick_count::now();
+		start_flag = 1;
+		for (std::list<tbb::tbb_thread*>::iterator i=threads.begin(); i!=threads.end(); i++)
+		{
+			(*i)->join();
+		}
+		tbb::tick_count end = tbb::tick_count::now();
+
+		for (std::list<tbb::tbb_thread*>::iterator i=threads.begin(); i!=threads.end(); i++)
+		{
+			SAFE_DELETE(*i);
+		}
+		threads.clear();
+
+		double seconds = (end - start).seconds();
+		double lookups = (double)num_thread * NUM_LOOKUP * 2;
+		LOG4CXX_INFO(logger, num_thread << " threads: " << lookups / seconds / 1000000.0 << " M lookups/s, " << seconds * 1e9 * num_thread / lookups << " ns/lookup per thread, missed: " << missed);
+		total_missed += missed;
 	}
-	threads.clear();
 
+	gTerminated = true;
+	threadWriter->join();
 	SAFE_DELETE(threadWriter);
 
-	return 0;
+	LOG4CXX_INFO(logger, "entries: " << map->size() << ", total missed: " << total_missed);
+	return (total_missed == 0) ? 0 : 1;
 }
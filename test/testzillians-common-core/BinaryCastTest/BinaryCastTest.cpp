@@ -22,6 +22,7 @@
 #include <iostream>
 #include <string>
 #include <limits>
+#include <vector>
 
 #define BOOST_TEST_MODULE BinaryCastTest
 #define BOOST_TEST_MAIN
@@ -147,4 +148,32 @@ BOOST_AUTO_TEST_CASE( BinaryCastTestCase1 )
 	}
 }
 
+BOOST_AUTO_TEST_CASE( BinaryCastTestCase2 )
+{
+	BOOST_CHECK(byte_swap((uint16)0x0102) == 0x0201);
+	BOOST_CHECK(byte_swap((uint32)0x01020304) == 0x04030201);
+	BOOST_CHECK(byte_swap((uint64)0x0102030405060708ULL) == 0x0807060504030201ULL);
+	BOOST_CHECK(byte_swap(byte_swap(1.25)) == 1.25);
+
+	uint32 n = host_to_network((uint32)0x01020304);
+	BOOST_CHECK(((byte*)&n)[0] == 0x01 && ((byte*)&n)[3] == 0x04);
+	BOOST_CHECK(network_to_host(n) == 0x01020304);
+
+	// odd sizes leave a tail after the vectorized part
+	std::vector<uint32> a(43), b(43);
+	for(std::size_t i = 0; i < a.size(); ++i)
+		a[i] = (uint32)(i * 0x01020304u);
+	byte_swap_array(&b[0], &a[0], a.size());
+	for(std::size_t i = 0; i < a.size(); ++i)
+		BOOST_CHECK(b[i] == byte_swap(a[i]));
+
+	std::vector<double> d(19);
+	for(std::size_t i = 0; i < d.size(); ++i)
+		d[i] = i * 0.5;
+	std::vector<double> e(d);
+	byte_swap_array(&e[0], &e[0], e.size());
+	byte_swap_array(&e[0], &e[0], e.size());
+	BOOST_CHECK(e == d);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
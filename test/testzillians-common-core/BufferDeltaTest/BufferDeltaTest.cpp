@@ -0,0 +1,276 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/archive/BufferCompressor.h"
+
+#include "core/Prerequisite.h"
+#include "core/BufferDelta.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BOOST_TEST_MODULE BufferDeltaTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( BufferDeltaTest )
+
+struct EntityState
+{
+	uint32 id;
+	float x, y, z;
+	uint16 health;
+	uint16 flags;
+};
+
+static void writeWorld(Buffer& buffer, const std::vector<EntityState>& world)
+{
+	for(std::size_t i = 0; i < world.size(); ++i)
+	{
+		const EntityState& e = world[i];
+		buffer << e.id << e.x << e.y << e.z << e.health << e.flags;
+	}
+}
+
+static std::vector<EntityState> makeWorld(uint32 count)
+{
+	std::vector<EntityState> world(count);
+	for(uint32 i = 0; i < count; ++i)
+	{
+		world[i].id = 1000 + i;
+		world[i].x = i * 1.5f;
+		world[i].y = i * -0.25f;
+		world[i].z = 0.0f;
+		world[i].health = 100;
+		world[i].flags = i % 3;
+	}
+	return world;
+}
+
+static std::string drain(Buffer& buffer)
+{
+	std::string data((const char*)buffer.rptr(), buffer.dataSize());
+	buffer.rskip(buffer.dataSize());
+	return data;
+}
+
+static void fill(Buffer& buffer, const std::string& data)
+{
+	buffer.writeArray(data.data(), data.size());
+}
+
+BOOST_AUTO_TEST_CASE( BufferDelta_Snapshot_Test )
+{
+	std::vector<EntityState> world = makeWorld(500);
+	Buffer baseline;
+	writeWorld(baseline, world);
+
+	// a few entities move between the snapshots
+	for(uint32 i = 0; i < world.size(); i += 25)
+		world[i].x += 0.5f;
+	world[42].health = 80;
+	Buffer current;
+	writeWorld(current, world);
+	const std::string expected((const char*)current.rptr(), current.dataSize());
+
+	Buffer frame;
+	BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, 7, current, frame));
+	BOOST_CHECK_EQUAL(current.dataSize(), 0UL);
+	BOOST_CHECK(frame.dataSize() < expected.size() / 20);
+
+	uint32 sequence = 0;
+	BOOST_CHECK(BufferDelta::getFrameBaseline(frame, sequence));
+	BOOST_CHECK_EQUAL(sequence, 7u);
+
+	// the baseline is left as it is, and the frame is refused against another one
+	Buffer result;
+	BOOST_CHECK(!BufferDelta::applyDelta(baseline, 8, frame, result));
+	BOOST_REQUIRE(BufferDelta::applyDelta(baseline, 7, frame, result));
+	BOOST_CHECK_EQUAL(frame.dataSize(), 0UL);
+	BOOST_CHECK(drain(result) == expected);
+
+	// an unchanged snapshot is just the header
+	Buffer same;
+	fill(same, std::string((const char*)baseline.rptr(), baseline.dataSize()));
+	BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, 7, same, frame));
+	BOOST_CHECK_EQUAL(frame.dataSize(), (std::size_t)BufferDelta::HEADER_SIZE);
+	BOOST_REQUIRE(BufferDelta::applyDelta(baseline, 7, frame, result));
+	BOOST_CHECK(drain(result) == std::string((const char*)baseline.rptr(), baseline.dataSize()));
+}
+
+BOOST_AUTO_TEST_CASE( BufferDelta_Resize_Test )
+{
+	const std::string base = std::string(300, 'a') + std::string(300, 'b');
+	const char* cases[] = { "", "x", "aaaa" };
+	std::vector<std::string> currents;
+	currents.push_back(base + std::string(100, 'c'));				// grown
+	currents.push_back(base.substr(0, 450));						// shrunk
+	currents.push_back(base.substr(0, 200) + "zz" + base.substr(202));	// short change
+	for(int i = 0; i < 3; ++i)
+		currents.push_back(cases[i]);
+
+	Buffer baseline;
+	fill(baseline, base);
+	for(std::size_t i = 0; i < currents.size(); ++i)
+	{
+		Buffer current;
+		Buffer frame;
+		Buffer result;
+		fill(current, currents[i]);
+		BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, 1, current, frame));
+		BOOST_CHECK(frame.dataSize() <= BufferDelta::HEADER_SIZE + currents[i].size());
+		BOOST_REQUIRE(BufferDelta::applyDelta(baseline, 1, frame, result));
+		BOOST_CHECK(drain(result) == currents[i]);
+		BOOST_CHECK_EQUAL(baseline.dataSize(), base.size());
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferDelta_Random_Test )
+{
+	srand(12345);
+	for(int round = 0; round < 200; ++round)
+	{
+		std::string base(rand() % 2000, '\0');
+		for(std::size_t i = 0; i < base.size(); ++i)
+			base[i] = (char)(rand() % 4);
+
+		// mutations at random places, some short runs and some long ones
+		std::string next = base.substr(0, base.size() - std::min(base.size(), (std::size_t)(rand() % 50)));
+		next.append(rand() % 50, 'q');
+		int mutations = rand() % 20;
+		for(int m = 0; m < mutations && !next.empty(); ++m)
+		{
+			std::size_t at = rand() % next.size();
+			std::size_t len = std::min(next.size() - at, (std::size_t)(rand() % 40));
+			for(std::size_t k = 0; k < len; ++k)
+				next[at + k] = (char)rand();
+		}
+
+		Buffer baseline;
+		Buffer current;
+		Buffer frame;
+		Buffer result;
+		fill(baseline, base);
+		fill(current, next);
+		BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, round, current, frame));
+		BOOST_REQUIRE(frame.dataSize() <= BufferDelta::HEADER_SIZE + next.size());
+		BOOST_REQUIRE(BufferDelta::applyDelta(baseline, round, frame, result));
+		BOOST_REQUIRE(drain(result) == next);
+	}
+
+	// unrelated data falls back to a full frame
+	std::string noise(1000, '\0');
+	for(std::size_t i = 0; i < noise.size(); ++i)
+		noise[i] = (char)rand();
+	Buffer baseline;
+	Buffer current;
+	Buffer frame;
+	fill(baseline, std::string(1000, 'a'));
+	fill(current, noise);
+	BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, 1, current, frame));
+	BOOST_CHECK_EQUAL(frame.dataSize(), BufferDelta::HEADER_SIZE + noise.size());
+	uint32 sequence;
+	BOOST_CHECK(!BufferDelta::getFrameBaseline(frame, sequence));
+}
+
+BOOST_AUTO_TEST_CASE( BufferDelta_Context_Test )
+{
+	std::vector<EntityState> world = makeWorld(100);
+	shared_ptr<Buffer> acked(new Buffer);
+	writeWorld(*acked, world);
+	world[10].flags = 7;
+
+	// the sender has the acknowledged snapshot attached to the new one
+	Buffer current;
+	writeWorld(current, world);
+	const std::string expected((const char*)current.rptr(), current.dataSize());
+	BufferDelta::setBaseline(current, shared_ptr<DeltaBaseline>(new DeltaBaseline(acked, 3)));
+	BOOST_REQUIRE(BufferDelta::getBaseline(current));
+	BOOST_CHECK_EQUAL(BufferDelta::getBaseline(current)->sequence, 3u);
+
+	Buffer frame;
+	BOOST_REQUIRE(BufferDelta::encodeDelta(current, frame));
+	BOOST_CHECK(frame.dataSize() < expected.size() / 10);
+
+	// without a baseline the delta can't be applied, and the frame is left in place
+	Buffer result;
+	BOOST_CHECK(!BufferDelta::applyDelta(frame, result));
+	BufferDelta::setBaseline(result, shared_ptr<DeltaBaseline>(new DeltaBaseline(acked, 2)));
+	BOOST_CHECK(!BufferDelta::applyDelta(frame, result));
+	BufferDelta::setBaseline(result, shared_ptr<DeltaBaseline>(new DeltaBaseline(acked, 3)));
+	BOOST_REQUIRE(BufferDelta::applyDelta(frame, result));
+	BOOST_CHECK(drain(result) == expected);
+
+	// a snapshot with nothing attached goes in full, which applies anywhere
+	Buffer first;
+	writeWorld(first, world);
+	BOOST_REQUIRE(BufferDelta::encodeDelta(first, frame));
+	BOOST_CHECK_EQUAL(frame.dataSize(), BufferDelta::HEADER_SIZE + expected.size());
+	Buffer fresh;
+	BOOST_REQUIRE(BufferDelta::applyDelta(frame, fresh));
+	BOOST_CHECK(drain(fresh) == expected);
+}
+
+BOOST_AUTO_TEST_CASE( BufferDelta_Corrupted_Test )
+{
+	std::string base(512, 'a');
+	std::string next = base;
+	for(std::size_t i = 0; i < next.size(); i += 40)
+		next[i] = 'b';
+
+	Buffer baseline;
+	Buffer current;
+	Buffer frame;
+	fill(baseline, base);
+	fill(current, next);
+	BOOST_REQUIRE(BufferDelta::encodeDelta(baseline, 1, current, frame));
+	const std::string encoded = drain(frame);
+
+	// an incomplete frame is left in the source
+	Buffer partial;
+	Buffer result;
+	fill(partial, encoded.substr(0, encoded.size() - 1));
+	BOOST_CHECK(!BufferDelta::applyDelta(baseline, 1, partial, result));
+	BOOST_CHECK_EQUAL(partial.dataSize(), encoded.size() - 1);
+	BOOST_CHECK_EQUAL(result.dataSize(), 0UL);
+
+	// any corrupted byte is either refused or still gives a snapshot of the recorded size
+	for(std::size_t i = 0; i < encoded.size(); ++i)
+	{
+		for(int bit = 0; bit < 8; ++bit)
+		{
+			std::string broken = encoded;
+			broken[i] ^= (char)(1 << bit);
+			Buffer source;
+			Buffer output;
+			fill(source, broken);
+			if(BufferDelta::applyDelta(baseline, 1, source, output))
+				BOOST_CHECK_EQUAL(source.dataSize(), 0UL);
+			else
+				BOOST_CHECK_EQUAL(source.dataSize(), broken.size());
+		}
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
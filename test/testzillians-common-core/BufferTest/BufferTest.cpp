@@ -22,15 +22,33 @@
 
 #include "core/Prerequisite.h"
 #include "core/Buffer.h"
+#include "core/BufferChain.h"
+#include "core/BufferIo.h"
+#include "core/MappedFileBufferAllocator.h"
+#include "core/MirroredBufferAllocator.h"
 #include "utility/UUIDUtil.h"
 #include <iostream>
 #include <string>
 #include <limits>
+#include <tbb/tick_count.h>
+#include <tbb/atomic.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #define BOOST_TEST_MODULE BufferTest
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
 
+struct TelemetryDirectLayout
+{
+	zillians::int32 id;
+	zillians::int32 flags;
+	float x, y, z;
+	double timestamp;
+};
+
+ZILLIANS_BUFFER_DIRECT_LAYOUT(TelemetryDirectLayout)
+
 using namespace zillians;
 using namespace std;
 
@@ -1037,6 +1055,253 @@ BOOST_AUTO_TEST_CASE( CircularBufferSingleProducerSingleConsumerTest )
 	}
 }
 
+void CircularBuffer_MPSC_Writer(MpscCircularBuffer* b, uint32 id)
+{
+	for(uint32 i=0;i<1024;)
+	{
+		try
+		{
+			*b << std::make_pair(id, i);
+			++i;
+		}
+		catch(std::length_error&)
+		{
+			boost::this_thread::yield();
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( CircularBufferMultiProducerSingleConsumerTest )
+{
+	MpscCircularBuffer b(256);
+
+	boost::thread_group writers;
+	for(uint32 id = 0; id < 4; ++id)
+		writers.create_thread(boost::bind(CircularBuffer_MPSC_Writer, &b, id));
+
+	// values from the same producer must arrive in order and never interleaved with others
+	uint32 next[4] = { 0, 0, 0, 0 };
+	for(int n = 0; n < 4 * 1024; ++n)
+	{
+		while(b.dataSize() == 0) { boost::this_thread::yield(); }
+
+		std::pair<uint32, uint32> x;
+		b >> x;
+		BOOST_REQUIRE(x.first < 4);
+		BOOST_CHECK(x.second == next[x.first]);
+		next[x.first] = x.second + 1;
+	}
+
+	writers.join_all();
+	BOOST_CHECK(b.dataSize() == 0);
+}
+
+void CircularBuffer_MPMC_Writer(MpmcCircularBuffer* b)
+{
+	for(int i=0;i<1024;)
+	{
+		try
+		{
+			*b << std::string("multi-producer multi-consumer");
+			++i;
+		}
+		catch(std::length_error&)
+		{
+			boost::this_thread::yield();
+		}
+	}
+}
+
+void CircularBuffer_MPMC_Reader(MpmcCircularBuffer* b, tbb::atomic<int>* count)
+{
+	while(*count < 4 * 1024)
+	{
+		try
+		{
+			std::string x;
+			*b >> x;
+			BOOST_CHECK(x == "multi-producer multi-consumer");
+			++(*count);
+		}
+		catch(std::length_error&)
+		{
+			boost::this_thread::yield();
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( CircularBufferMultiProducerMultiConsumerTest )
+{
+	MpmcCircularBuffer b(250);
+	tbb::atomic<int> count; count = 0;
+
+	boost::thread_group threads;
+	for(int i = 0; i < 4; ++i)
+		threads.create_thread(boost::bind(CircularBuffer_MPMC_Writer, &b));
+	for(int i = 0; i < 3; ++i)
+		threads.create_thread(boost::bind(CircularBuffer_MPMC_Reader, &b, &count));
+
+	threads.join_all();
+	BOOST_CHECK(count == 4 * 1024);
+	BOOST_CHECK(b.dataSize() == 0);
+}
+
+struct ThrowingSerializableObject
+{
+	template <typename Archive>
+	void serialize(Archive& ar, const unsigned int version)
+	{
+		ar & x;
+		if(countdown >= 0 && countdown-- == 0)
+			throw std::runtime_error("throwing serializable object");
+	}
+
+	static int countdown;
+	int32 x;
+};
+
+int ThrowingSerializableObject::countdown = -1;
+
+void CircularBuffer_MPMC_ThrowingWriter(MpmcCircularBuffer* b, int32 x)
+{
+	ThrowingSerializableObject obj; obj.x = x;
+	*b << obj;
+}
+
+void CircularBuffer_MPMC_ThrowingReader(MpmcCircularBuffer* b, int32* x)
+{
+	ThrowingSerializableObject obj;
+	*b >> obj;
+	*x = obj.x;
+}
+
+BOOST_AUTO_TEST_CASE( CircularBufferMultiProducerMultiConsumerThrowTest )
+{
+	MpmcCircularBuffer b(250);
+
+	// the first call is from probeSize(), so the producer throws while serializing
+	ThrowingSerializableObject obj; obj.x = 1;
+	ThrowingSerializableObject::countdown = 1;
+	BOOST_CHECK_THROW(b << obj, std::runtime_error);
+	BOOST_CHECK(b.dataSize() == 0);
+
+	// a second producer is not blocked by the failed one
+	boost::thread writer(boost::bind(CircularBuffer_MPMC_ThrowingWriter, &b, 2));
+	BOOST_REQUIRE(writer.timed_join(boost::posix_time::seconds(10)));
+	writer = boost::thread(boost::bind(CircularBuffer_MPMC_ThrowingWriter, &b, 3));
+	BOOST_REQUIRE(writer.timed_join(boost::posix_time::seconds(10)));
+
+	// the consumer throws while reading, and the value is skipped
+	ThrowingSerializableObject::countdown = 0;
+	BOOST_CHECK_THROW(b >> obj, std::runtime_error);
+
+	// a second consumer is not blocked by the failed one
+	int32 x = 0;
+	boost::thread reader(boost::bind(CircularBuffer_MPMC_ThrowingReader, &b, &x));
+	BOOST_REQUIRE(reader.timed_join(boost::posix_time::seconds(10)));
+	BOOST_CHECK(x == 3);
+	BOOST_CHECK(b.dataSize() == 0);
+}
+
+
+BOOST_AUTO_TEST_CASE( MirroredCircularBufferTest )
+{
+	MirroredBufferAllocator allocator;
+	{
+		CircularBuffer b(1000, &allocator);
+		BOOST_CHECK(b.allocatedSize() >= 1000);
+		BOOST_CHECK((b.allocatedSize() + 1) % allocator.getGranularity() == 0);
+
+		// move the pointers close to the end so that following data crosses the boundary
+		std::size_t gap = b.allocatedSize() - 6;
+		b.wskip(gap);
+		b.rskip(gap);
+
+		b << (int64)0x0102030405060708LL << std::string("across the boundary");
+		BOOST_CHECK(b.wpos() < b.rpos());
+
+		std::vector<std::pair<byte*,std::size_t> > ranges;
+		std::size_t size = b.getDataRanges(ranges);
+		BOOST_CHECK(ranges.size() == 1);
+		BOOST_CHECK(ranges[0].second == size);
+
+		int64 x; std::string s;
+		b >> x >> s;
+		BOOST_CHECK(x == 0x0102030405060708LL);
+		BOOST_CHECK(s == "across the boundary");
+		BOOST_CHECK(b.dataSize() == 0);
+	}
+
+	{
+		SpscCircularBuffer b(256, &allocator);
+		for(int iter = 0; iter < 64; ++iter)
+		{
+			boost::thread reader(boost::bind(CircularBuffer_SPSC_Reader, &b));
+			boost::thread writer(boost::bind(CircularBuffer_SPSC_Writer, &b));
+
+			reader.join();
+			writer.join();
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferRefTest )
+{
+	shared_ptr<Buffer> frame(new Buffer(256));
+
+	// a frame made of a header and two sub-messages
+	*frame << (uint32)2;
+	std::size_t first = frame->wpos();
+	*frame << std::string("first") << (int32)1;
+	std::size_t second = frame->wpos();
+	*frame << std::string("second") << (int32)2;
+	std::size_t end = frame->wpos();
+
+	uint32 count; *frame >> count;
+	BOOST_CHECK(count == 2);
+
+	BufferRef<true, false> a(frame, first, second - first);
+	BufferRef<true, false> b(frame, second, end - second);
+	BOOST_CHECK(frame.use_count() == 3);
+
+	// copies share the data but not the cursors
+	BufferRef<true, false> c(b);
+	{
+		std::string s; int32 x;
+		b >> s >> x;
+		BOOST_CHECK(s == "second" && x == 2);
+		BOOST_CHECK(b.dataSize() == 0);
+	}
+	{
+		std::string s; int32 x;
+		c >> s >> x;
+		BOOST_CHECK(s == "second" && x == 2);
+	}
+	{
+		std::string s; int32 x;
+		a >> s >> x;
+		BOOST_CHECK(s == "first" && x == 1);
+	}
+
+	// the shared buffer is not altered by the views
+	BOOST_CHECK(frame->rpos() == sizeof(uint32));
+
+	// sub-view is relative to its parent view
+	BufferRef<true, false> sub = a.slice(Buffer::probeSize(std::string("first")), sizeof(int32));
+	int32 x; sub >> x;
+	BOOST_CHECK(x == 1);
+
+	// writable view writes in place into the shared buffer
+	BufferRef<true, true> w(frame, first + Buffer::probeSize(std::string("first")), sizeof(int32));
+	w << (int32)100;
+	BOOST_CHECK(w.freeSize() == 0);
+	a.reset();
+	{
+		std::string s;
+		a >> s >> x;
+		BOOST_CHECK(x == 100);
+	}
+}
 
 BOOST_AUTO_TEST_CASE( StdPairSerializeTest )
 {
@@ -1053,4 +1318,786 @@ BOOST_AUTO_TEST_CASE( StdPairSerializeTest )
 	BOOST_CHECK(result.second == uuid1);
 }
 
+struct CountingBufferAllocator : public DefaultBufferAllocator
+{
+	CountingBufferAllocator() : allocations(0), deallocations(0) { }
+
+	virtual byte* allocate(std::size_t size)
+	{
+		++allocations;
+		return DefaultBufferAllocator::allocate(size);
+	}
+
+	virtual void deallocate(byte* data)
+	{
+		++deallocations;
+		DefaultBufferAllocator::deallocate(data);
+	}
+
+	virtual byte* reallocate(byte* data, std::size_t old_size, std::size_t new_size)
+	{
+		return BufferAllocator::reallocate(data, old_size, new_size);
+	}
+
+	int allocations;
+	int deallocations;
+};
+
+BOOST_AUTO_TEST_CASE( BufferGrowthPolicyTest )
+{
+	{
+		Buffer b;
+		uint64 before = getBufferStat().Reallocations;
+		for(int32 i = 0; i < 4096; ++i)
+			b << i;
+		// geometric growth, not one reallocation per write
+		BOOST_CHECK(getBufferStat().Reallocations - before <= 16);
+	}
+
+	{
+		Buffer b;
+		b.reserve(4096 * sizeof(int32));
+		BOOST_CHECK(b.allocatedSize() == 4096 * sizeof(int32));
+
+		uint64 before = getBufferStat().Reallocations;
+		for(int32 i = 0; i < 4096; ++i)
+			b << i;
+		BOOST_CHECK(getBufferStat().Reallocations == before);
+
+		for(int32 i = 0; i < 1024; ++i)
+		{
+			int32 x; b >> x;
+		}
+		b.shrinkToFit();
+		BOOST_CHECK(b.allocatedSize() == 3072 * sizeof(int32));
+		for(int32 i = 1024; i < 4096; ++i)
+		{
+			int32 x; b >> x;
+			BOOST_CHECK(x == i);
+		}
+
+		b.shrinkToFit();
+		BOOST_CHECK(b.allocatedSize() == 0);
+	}
+
+	{
+		CircularBuffer b;
+		b.setGrowthFactor(4.0f);
+		b << (int64)0;
+		std::size_t first = b.allocatedSize();
+		for(int i = 0; i < 64; ++i)
+			b << (int64)i;
+		BOOST_CHECK(b.allocatedSize() >= first * 4);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferAllocatorTest )
+{
+	CountingBufferAllocator allocator;
+
+	{
+		Buffer b(64, &allocator);
+		BOOST_CHECK(allocator.allocations == 1);
+
+		Buffer c(b);
+		BOOST_CHECK(c.getAllocator() == &allocator);
+		BOOST_CHECK(allocator.allocations == 2);
+	}
+	BOOST_CHECK(allocator.deallocations == 2);
+
+	{
+		Buffer b;
+		b.setAllocator(&allocator);
+		for(int32 i = 0; i < 1024; ++i)
+			b << i;
+		for(int32 i = 0; i < 1024; ++i)
+		{
+			int32 x; b >> x;
+			BOOST_CHECK(x == i);
+		}
+	}
+	BOOST_CHECK(allocator.allocations == allocator.deallocations);
+}
+
+BOOST_AUTO_TEST_CASE( MappedFileBufferTest )
+{
+	char path[] = "/tmp/MappedFileBufferTest.XXXXXX";
+	int fd = mkstemp(path);
+	BOOST_REQUIRE(fd >= 0);
+	close(fd);
+
+	std::size_t written = 0;
+	{
+		MappedFileBufferAllocator file(path, true);
+		{
+			Buffer b(&file, file.map(), file.fileSize(), false);
+			BOOST_CHECK(b.dataSize() == 0);
+			for(int32 i = 0; i < 4096; ++i)
+				b << i << std::string("recorded session");
+			written = b.wpos();
+		}
+		file.truncate(written);
+		BOOST_CHECK(file.fileSize() == written);
+	}
+
+	{
+		MappedFileBufferAllocator file(path);
+		Buffer b(&file, file.map(), file.fileSize(), true);
+		BOOST_CHECK(b.dataSize() == written);
+		BOOST_CHECK(!b.isMutable());
+		for(int32 i = 0; i < 4096; ++i)
+		{
+			int32 x; std::string s;
+			b >> x >> s;
+			BOOST_CHECK(x == i);
+			BOOST_CHECK(s == "recorded session");
+		}
+		BOOST_CHECK(b.dataSize() == 0);
+	}
+
+	unlink(path);
+}
+
+struct TelemetrySerializable
+{
+	template<typename Archive>
+	void serialize(Archive& ar, const unsigned int version)
+	{
+		UNUSED_ARGUMENT(version);
+		ar & id;
+		ar & flags;
+		ar & x;
+		ar & y;
+		ar & z;
+		ar & timestamp;
+	}
+
+	int32 id;
+	int32 flags;
+	float x, y, z;
+	double timestamp;
+};
+
+BOOST_AUTO_TEST_CASE( DirectLayoutSerializationTest )
+{
+	BOOST_CHECK(Buffer::probeSize<TelemetryDirectLayout>() == sizeof(TelemetryDirectLayout));
+
+	TelemetryDirectLayout input;
+	input.id = 1; input.flags = 2; input.x = 3.0f; input.y = 4.0f; input.z = 5.0f; input.timestamp = 6.0;
+	BOOST_CHECK(Buffer::probeSize(input) == sizeof(TelemetryDirectLayout));
+
+	std::vector<TelemetryDirectLayout> inputs(16, input);
+	for(int i = 0; i < 16; ++i)
+		inputs[i].id = i;
+
+	Buffer b;
+	b << input << inputs;
+	BOOST_CHECK(b.dataSize() == Buffer::probeSize(input) + Buffer::probeSize(inputs));
+
+	TelemetryDirectLayout output;
+	std::vector<TelemetryDirectLayout> outputs;
+	b >> output >> outputs;
+
+	BOOST_CHECK(::memcmp(&input, &output, sizeof(TelemetryDirectLayout)) == 0);
+	BOOST_CHECK(outputs.size() == 16);
+	for(int i = 0; i < 16; ++i)
+		BOOST_CHECK(outputs[i].id == i && outputs[i].timestamp == 6.0);
+}
+
+BOOST_AUTO_TEST_CASE( DirectLayoutSerializationPerformanceTest )
+{
+	const int iterations = 1000000;
+
+	TelemetrySerializable serializable;
+	serializable.id = 1; serializable.flags = 2; serializable.x = 3.0f; serializable.y = 4.0f; serializable.z = 5.0f; serializable.timestamp = 6.0;
+
+	TelemetryDirectLayout direct;
+	direct.id = 1; direct.flags = 2; direct.x = 3.0f; direct.y = 4.0f; direct.z = 5.0f; direct.timestamp = 6.0;
+
+	Buffer b(sizeof(TelemetryDirectLayout) * 2);
+
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		b.clear();
+		b << serializable;
+		b >> serializable;
+	}
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("serializable write/read takes %lf ns per message\n", (end - start).seconds() * 1e9 / iterations);
+
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		b.clear();
+		b << direct;
+		b >> direct;
+	}
+	end = tbb::tick_count::now();
+	printf("direct layout write/read takes %lf ns per message\n", (end - start).seconds() * 1e9 / iterations);
+
+	BOOST_CHECK(serializable.id == direct.id);
+}
+
+BOOST_AUTO_TEST_CASE( BatchSerializationTest )
+{
+	TelemetryDirectLayout updates[100];
+	std::string names[100];
+	for(int i = 0; i < 100; ++i)
+	{
+		updates[i].id = i; updates[i].flags = 0; updates[i].x = updates[i].y = updates[i].z = (float)i; updates[i].timestamp = i;
+		names[i] = std::string(i % 10, 'x');
+	}
+
+	{
+		Buffer b;
+		b.writeBatch(updates, 100);
+		b.writeBatch(names, 100);
+		BOOST_CHECK(b.dataSize() == Buffer::probeBatchSize(updates, 100) + Buffer::probeBatchSize(names, 100));
+		BOOST_CHECK(Buffer::probeBatchSize(updates, 100) == sizeof(updates));
+
+		TelemetryDirectLayout output[100];
+		std::string output_names[100];
+		b.readBatch(output, 100);
+		b.readBatch(output_names, 100);
+		for(int i = 0; i < 100; ++i)
+		{
+			BOOST_CHECK(output[i].id == i && output[i].timestamp == i);
+			BOOST_CHECK(output_names[i] == names[i]);
+		}
+	}
+
+	{
+		// cross the boundary of circular buffer
+		CircularBuffer b(sizeof(updates) + 100);
+		b.wskip(sizeof(updates) / 2);
+		b.rskip(sizeof(updates) / 2);
+		b.writeBatch(updates, 100);
+
+		TelemetryDirectLayout output[100];
+		b.readBatch(output, 100);
+		for(int i = 0; i < 100; ++i)
+			BOOST_CHECK(output[i].id == i);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( VarintEncodingTest )
+{
+	VarintBuffer b;
+
+	std::string str("short string");
+	std::vector<int32> ints;
+	ints.push_back(0); ints.push_back(-1); ints.push_back(63); ints.push_back(-64); ints.push_back(std::numeric_limits<int32>::max()); ints.push_back(std::numeric_limits<int32>::min());
+	uint64 big = std::numeric_limits<uint64>::max();
+	int16 small = -3;
+
+	b << str << ints << big << small;
+	BOOST_CHECK(b.dataSize() == VarintBuffer::probeSize(str) + VarintBuffer::probeSize(ints) + VarintBuffer::probeSize(big) + VarintBuffer::probeSize(small));
+
+	// 1 byte length + content, 1 byte length + (1 + 1 + 1 + 1 + 5 + 5) bytes, 10 bytes, 1 byte
+	BOOST_CHECK(VarintBuffer::probeSize(str) == str.length() + 1);
+	BOOST_CHECK(VarintBuffer::probeSize(ints) == 1 + 14);
+	BOOST_CHECK(VarintBuffer::probeSize(big) == 10);
+	BOOST_CHECK(VarintBuffer::probeSize(small) == 1);
+
+	std::string str_result; std::vector<int32> ints_result; uint64 big_result; int16 small_result;
+	b >> str_result >> ints_result >> big_result >> small_result;
+
+	BOOST_CHECK(str == str_result);
+	BOOST_CHECK(ints == ints_result);
+	BOOST_CHECK(big == big_result);
+	BOOST_CHECK(small == small_result);
+	BOOST_CHECK(b.dataSize() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( VarintLengthEncodingTest )
+{
+	typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::none, BufferEncoding::varint_length> VarintLengthBuffer;
+	VarintLengthBuffer b;
+
+	std::string str(200, 'x');
+	int32 i = 12345;
+	b << str << i;
+	BOOST_CHECK(b.dataSize() == 2 + 200 + sizeof(int32));
+
+	std::string str_result; int32 i_result;
+	b >> str_result >> i_result;
+	BOOST_CHECK(str == str_result);
+	BOOST_CHECK(i == i_result);
+}
+
+BOOST_AUTO_TEST_CASE( VarintMalformedTest )
+{
+	// the data ends with the continuation bit still set
+	{
+		VarintBuffer b(64);
+		const unsigned char truncated[] = { 0x80, 0x80, 0x80 };
+		b.writeArray((const char*)truncated, sizeof(truncated));
+
+		uint32 x = 0;
+		BOOST_CHECK_THROW(b >> x, std::length_error);
+	}
+
+	// more than 10 bytes
+	{
+		VarintBuffer b(64);
+		const unsigned char overlong[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+		b.writeArray((const char*)overlong, sizeof(overlong));
+
+		uint64 x = 0;
+		BOOST_CHECK_THROW(b >> x, std::length_error);
+	}
+
+	// 10 bytes carrying more than 64 bits
+	{
+		VarintBuffer b(64);
+		const unsigned char overflow[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02 };
+		b.writeArray((const char*)overflow, sizeof(overflow));
+
+		uint64 x = 0;
+		BOOST_CHECK_THROW(b >> x, std::length_error);
+	}
+
+	// a string length beyond 32 bits isn't truncated
+	{
+		typedef BufferT<BufferMode::plain, BufferConcurrency::none, BufferObjectPoolStrategy::none, BufferEncoding::varint_length> VarintLengthBuffer;
+		VarintLengthBuffer b(64);
+		const unsigned char length[] = { 0x81, 0x80, 0x80, 0x80, 0x20, 'a' }; // 2^33 + 1
+		b.writeArray((const char*)length, sizeof(length));
+
+		std::string str;
+		BOOST_CHECK_THROW(b >> str, std::length_error);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferChainGatherTest )
+{
+	Buffer header(16);
+	Buffer payload0(16);
+	Buffer payload1(16);
+
+	header << (int32)1 << (int32)2;
+	payload0 << (int32)3;
+	payload1 << (int32)4 << (int32)5;
+
+	BufferChain chain;
+	chain.push_back(header);
+	chain.push_back(payload0);
+	chain.push_back(payload1);
+
+	BOOST_CHECK(chain.dataSize() == sizeof(int32) * 5);
+
+	std::vector<struct iovec> iovecs;
+	BOOST_CHECK(chain.getIoVecs(iovecs) == sizeof(int32) * 5);
+	BOOST_CHECK(iovecs.size() == 3);
+	BOOST_CHECK(iovecs[1].iov_base == (void*)payload0.rptr());
+
+	for(int32 i = 1; i <= 5; ++i)
+	{
+		int32 x = 0;
+		chain >> x;
+		BOOST_CHECK(x == i);
+	}
+
+	BOOST_CHECK(chain.dataSize() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BufferChainCrossBoundaryTest )
+{
+	Buffer segment0(6);
+	Buffer segment1(6);
+	Buffer segment2(64);
+
+	BufferChain chain;
+	chain.push_back(segment0);
+	chain.push_back(segment1);
+	chain.push_back(segment2);
+
+	std::string input("cross the boundary");
+	chain << (int32)0x12345678 << (int64)0x0123456789ABCDEFLL << input;
+
+	BOOST_CHECK(segment0.dataSize() == 6);
+	BOOST_CHECK(segment1.dataSize() == 6);
+
+	int32 a = 0; int64 b = 0; std::string c;
+	chain >> a >> b >> c;
+
+	BOOST_CHECK(a == 0x12345678);
+	BOOST_CHECK(b == 0x0123456789ABCDEFLL);
+	BOOST_CHECK(c == input);
+	BOOST_CHECK(chain.dataSize() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BufferChainGatherValueTest )
+{
+	Buffer segment0(7);
+	Buffer segment1(9);
+	Buffer segment2(256);
+
+	BufferChain chain;
+	chain.push_back(segment0);
+	chain.push_back(segment1);
+	chain.push_back(segment2);
+
+	std::vector<std::string> names;
+	names.push_back("alpha"); names.push_back("beta"); names.push_back("gamma");
+	std::map<int32, std::string> table;
+	table[1] = "one"; table[2] = "two";
+	std::vector<int64> numbers(5, 0x0102030405060708LL);
+	chain << names << table << numbers << std::string(100, 'x');
+
+	std::vector<std::string> names_result;
+	std::map<int32, std::string> table_result;
+	std::vector<int64> numbers_result;
+	std::string tail;
+	chain >> names_result >> table_result >> numbers_result;
+
+	BOOST_CHECK(names_result == names);
+	BOOST_CHECK(table_result == table);
+	BOOST_CHECK(numbers_result == numbers);
+
+	// the tail is left in the last segment untouched
+	BOOST_CHECK(chain.dataSize() == sizeof(uint32) + 100);
+	chain >> tail;
+	BOOST_CHECK(tail == std::string(100, 'x'));
+
+	// a value cut short by the end of the chain is reported, not read beyond
+	segment0.clear(); segment1.clear(); segment2.clear();
+	chain.clear();
+	chain.push_back(segment0);
+	chain.push_back(segment1);
+	segment0 << (uint32)20;
+	segment0.writeArray("ab", 2);
+	segment1.writeArray("c", 1);
+	std::string truncated;
+	BOOST_CHECK_THROW(chain >> truncated, std::length_error);
+	BOOST_CHECK(chain.dataSize() == sizeof(uint32) + 3);
+
+	struct iovec vectors[2];
+	std::size_t covered = 0;
+	BOOST_CHECK(chain.getIoVecs(vectors, 2, &covered) == 2);
+	BOOST_CHECK(covered == sizeof(uint32) + 3);
+	BOOST_CHECK(vectors[1].iov_base == (void*)segment1.rptr());
+}
+
+BOOST_AUTO_TEST_CASE( BufferFreeRangesTest )
+{
+	{
+		Buffer b(32);
+		b.wskip(10);
+		b.rskip(4);
+
+		std::vector<std::pair<byte*,std::size_t> > ranges;
+		BOOST_CHECK(b.getFreeRanges(ranges) == 22);
+		BOOST_CHECK(ranges.size() == 1);
+		BOOST_CHECK(ranges[0].first == b.wptr());
+
+		b.wskip(22);
+		ranges.clear();
+		BOOST_CHECK(b.getFreeRanges(ranges) == 0);
+		BOOST_CHECK(ranges.empty());
+		BOOST_CHECK(b.getMemoryRange().second == 32);
+	}
+
+	{
+		CircularBuffer b(32);
+		std::vector<std::pair<byte*,std::size_t> > ranges;
+		BOOST_CHECK(b.getFreeRanges(ranges) == 32);
+		BOOST_CHECK(ranges.size() == 1);
+
+		// free space wraps around the end
+		b.wskip(20);
+		b.rskip(12);
+		ranges.clear();
+		BOOST_CHECK(b.getFreeRanges(ranges) == 24);
+		BOOST_CHECK(ranges.size() == 2);
+		BOOST_CHECK(ranges[0].first == b.wptr());
+		BOOST_CHECK(ranges[1].first == b.getMemoryRange().first);
+		BOOST_CHECK(ranges[0].second + ranges[1].second == 24);
+
+		for(std::size_t i = 0; i < ranges.size(); ++i)
+			memset(ranges[i].first, 'x', ranges[i].second);
+		b.wskip(24);
+		BOOST_CHECK(b.freeSize() == 0);
+
+		ranges.clear();
+		BOOST_CHECK(b.getFreeRanges(ranges) == 0);
+
+		std::string data(8, 0);
+		b.readArray(&data[0], 8);
+		BOOST_CHECK(b.dataSize() == 24);
+		BOOST_CHECK(std::string((const char*)b.rptr(), 1) == "x");
+
+		// free space in front of the read pointer is a single range
+		ranges.clear();
+		BOOST_CHECK(b.getFreeRanges(ranges) == 8);
+		BOOST_CHECK(ranges.size() == 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferSequenceTest )
+{
+	CircularBuffer b(32);
+	std::string head(20, 'a');
+	b.writeArray(head.data(), head.size());
+	b.rskip(16);
+
+	// the next write wraps around the end
+	std::string tail(24, 'b');
+	BufferMutableSequence free_space = freeBuffers(b);
+	BOOST_CHECK(free_space.size() == 28);
+	BOOST_CHECK(std::distance(free_space.begin(), free_space.end()) == 2);
+	BOOST_CHECK(boost::asio::buffer_copy(free_space, boost::asio::buffer(tail)) == 24);
+	b.wskip(24);
+
+	BufferConstSequence data = dataBuffers(b);
+	BOOST_CHECK(data.size() == 28);
+	BOOST_CHECK(boost::asio::buffer_size(data) == 28);
+	BOOST_CHECK(std::distance(data.begin(), data.end()) == 2);
+
+	std::string received(28, 0);
+	BOOST_CHECK(boost::asio::buffer_copy(boost::asio::buffer(&received[0], received.size()), data) == 28);
+	BOOST_CHECK(received == std::string(4, 'a') + tail);
+
+	b.rskip(28);
+	BOOST_CHECK(boost::asio::buffer_size(dataBuffers(b)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BufferWriteBuffersTest )
+{
+	int fds[2];
+	BOOST_REQUIRE(::pipe(fds) == 0);
+	BOOST_REQUIRE(::fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+	long capacity = ::fcntl(fds[1], F_SETPIPE_SZ, 4096);
+	BOOST_REQUIRE(capacity > 0);
+
+	Buffer header(8);
+	Buffer payload(capacity * 2);
+	CircularBuffer trailer(16);
+
+	header << (int32)1 << (int32)2;
+	std::string p(capacity, 'p');
+	payload.writeArray(p.data(), p.size());
+	trailer.wskip(12);
+	trailer.rskip(12);
+	trailer.writeArray("0123456789", 10);
+
+	std::vector<Buffer*> buffers;
+	buffers.push_back(&header);
+	buffers.push_back(&payload);
+
+	std::vector<CircularBuffer*> trailers;
+	trailers.push_back(&trailer);
+
+	// the pipe takes less than the header and payload, the rest stays for the next call
+	ssize_t written = writeBuffers(fds[1], buffers.begin(), buffers.end());
+	BOOST_CHECK(written == capacity);
+	BOOST_CHECK(header.dataSize() == 0);
+	BOOST_CHECK(payload.dataSize() == 8);
+
+	BOOST_CHECK(writeBuffers(fds[1], buffers.begin(), buffers.end()) == -1);
+	BOOST_CHECK(errno == EAGAIN);
+
+	std::string drained(capacity, 0);
+	BOOST_REQUIRE(::read(fds[0], &drained[0], drained.size()) == capacity);
+	BOOST_CHECK(drained.substr(8) == p.substr(0, capacity - 8));
+
+	BOOST_CHECK(writeBuffers(fds[1], buffers.begin(), buffers.end()) == 8);
+	BOOST_CHECK(payload.dataSize() == 0);
+	BOOST_CHECK(writeBuffers(fds[1], buffers.begin(), buffers.end()) == 0);
+
+	// both ranges of a wrapped circular buffer go in one writev()
+	BOOST_CHECK(writeBuffers(fds[1], trailers.begin(), trailers.end()) == 10);
+	BOOST_CHECK(trailer.dataSize() == 0);
+
+	std::string rest(18, 0);
+	BOOST_REQUIRE(::read(fds[0], &rest[0], rest.size()) == 18);
+	BOOST_CHECK(rest == std::string(8, 'p') + "0123456789");
+
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE( BufferLengthPrefixTest )
+{
+	std::vector<std::map<std::string, std::string> > snapshot(64);
+	for(std::size_t i = 0; i < snapshot.size(); ++i)
+		for(int j = 0; j < 16; ++j)
+			snapshot[i][std::string(j + 1, 'k')] = std::string(i + j, 'v');
+
+	{
+		// an on-demand buffer grows while the payload is being written
+		Buffer b;
+		b << (int32)7;
+		uint32 length = b.writeLengthPrefixed(snapshot);
+		BOOST_CHECK(length == Buffer::probeSize(snapshot));
+		BOOST_CHECK(b.dataSize() == sizeof(int32) + sizeof(uint32) + length);
+
+		int32 x; b >> x;
+		BOOST_CHECK(b.readLengthPrefix() == length);
+		std::vector<std::map<std::string, std::string> > decoded;
+		b >> decoded;
+		BOOST_CHECK(decoded == snapshot);
+		BOOST_CHECK(b.dataSize() == 0);
+	}
+
+	{
+		// the prefix wraps around the end of a circular buffer, flags are kept in the prefix
+		CircularBuffer b(32);
+		b.wskip(30);
+		b.rskip(30);
+
+		std::size_t mark = b.beginLengthPrefix();
+		b << std::string("hello");
+		uint32 length = b.endLengthPrefix(mark, 0x80000000u);
+		BOOST_CHECK(length == Buffer::probeSize(std::string("hello")));
+
+		BOOST_CHECK(b.readLengthPrefix() == (length | 0x80000000u));
+		std::string s; b >> s;
+		BOOST_CHECK(s == "hello");
+	}
+
+	{
+		// varint buffers keep a fixed size prefix
+		VarintBuffer b(1024);
+		uint32 length = b.writeLengthPrefixed(std::string(300, 'x'));
+		BOOST_CHECK(b.dataSize() == sizeof(uint32) + length);
+		BOOST_CHECK(b.readLengthPrefix() == length);
+	}
+
+	const int iterations = 200;
+	Buffer b(4 * 1024 * 1024);
+
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		b.clear();
+		b << (uint32)Buffer::probeSize(snapshot) << snapshot;
+	}
+	tbb::tick_count end = tbb::tick_count::now();
+	double probed = (end - start).seconds();
+
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		b.clear();
+		b.writeLengthPrefixed(snapshot);
+	}
+	end = tbb::tick_count::now();
+	double patched = (end - start).seconds();
+
+	printf("probeSize and write takes %lf us, back-patched write takes %lf us per snapshot\n", probed * 1.0e6 / iterations, patched * 1.0e6 / iterations);
+}
+
+BOOST_AUTO_TEST_CASE( BufferChecksumTest )
+{
+	std::vector<std::string> names;
+	names.push_back("alpha");
+	names.push_back("beta");
+
+	CheckedBuffer sender;
+	sender << (int32)42 << std::string("payload") << names;
+	BOOST_CHECK(sender.checksum() == crc32c(0, sender.rptr(), sender.dataSize()));
+	sender.writeLengthPrefixed(std::string("framed"));
+	sender.writeChecksum();
+
+	std::string wire((const char*)sender.rptr(), sender.dataSize());
+
+	// the receiving side wraps around the end of a circular buffer, in small pieces
+	CheckedCircularBuffer receiver(64);
+	receiver.wskip(60);
+	receiver.rskip(60);
+	receiver.resetChecksum();
+	for(std::size_t i = 0; i < wire.size(); i += 7)
+		receiver.writeArray(wire.data() + i, std::min<std::size_t>(7, wire.size() - i));
+
+	int32 x; std::string s; std::vector<std::string> v;
+	receiver >> x >> s >> v;
+	BOOST_CHECK(receiver.readLengthPrefix() == Buffer::probeSize(std::string("framed")));
+	receiver >> s;
+	BOOST_CHECK(receiver.verify());
+	BOOST_CHECK(x == 42 && s == "framed" && v == names);
+	BOOST_CHECK(receiver.dataSize() == 0);
+
+	// a flipped bit is caught
+	wire[10] ^= 0x10;
+	CheckedBuffer corrupted((const byte*)wire.data(), wire.size());
+	corrupted >> x >> s >> v;
+	corrupted.readLengthPrefix();
+	corrupted >> s;
+	BOOST_CHECK(!corrupted.verify());
+
+	corrupted.clear();
+	BOOST_CHECK(corrupted.verify(0));
+}
+
+BOOST_AUTO_TEST_CASE( BufferNetworkByteOrderTest )
+{
+	{
+		NetworkBuffer b;
+		b << (uint32)0x01020304 << (int16)-2 << std::string("ab");
+
+		const unsigned char expected[] = { 0x01, 0x02, 0x03, 0x04, 0xFF, 0xFE, 0x00, 0x00, 0x00, 0x02, 'a', 'b' };
+		BOOST_CHECK(b.dataSize() == sizeof(expected));
+		BOOST_CHECK(memcmp(b.rptr(), expected, sizeof(expected)) == 0);
+
+		uint32 x; int16 y; std::string z;
+		b >> x >> y >> z;
+		BOOST_CHECK(x == 0x01020304 && y == -2 && z == "ab");
+	}
+
+	{
+		std::vector<uint16> u16;
+		std::vector<uint64> u64;
+		std::vector<double> f64;
+		boost::array<float, 37> f32;
+		for(int i = 0; i < 1000; ++i)
+		{
+			u16.push_back((uint16)(i * 31));
+			u64.push_back((uint64)i * 0x0102030405060708ULL);
+			f64.push_back(i * 0.25);
+		}
+		for(std::size_t i = 0; i < f32.size(); ++i)
+			f32[i] = i * 1.5f;
+		int32 batch[5] = { 1, -2, 3, -4, 5 };
+
+		NetworkBuffer b;
+		b << u16 << u64 << f64 << f32;
+		b.writeBatch(batch, 5);
+
+		// the first element of the uint16 vector follows its length, most significant byte first
+		BOOST_CHECK(b.rptr()[4 + 2] == 0x00 && b.rptr()[4 + 3] == 31);
+
+		std::vector<uint16> u16r;
+		std::vector<uint64> u64r;
+		std::vector<double> f64r;
+		boost::array<float, 37> f32r;
+		int32 batchr[5];
+		b >> u16r >> u64r >> f64r >> f32r;
+		b.readBatch(batchr, 5);
+		BOOST_CHECK(u16r == u16);
+		BOOST_CHECK(u64r == u64);
+		BOOST_CHECK(f64r == f64);
+		BOOST_CHECK(f32r == f32);
+		BOOST_CHECK(memcmp(batch, batchr, sizeof(batch)) == 0);
+		BOOST_CHECK(b.dataSize() == 0);
+	}
+
+	{
+		// arrays wrap around the end of a circular buffer
+		std::vector<uint32> v;
+		for(uint32 i = 0; i < 40; ++i)
+			v.push_back(i * 0x01010101u);
+
+		NetworkCircularBuffer b(256);
+		b.wskip(200);
+		b.rskip(200);
+		b << v;
+
+		std::vector<uint32> r;
+		b >> r;
+		BOOST_CHECK(r == v);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
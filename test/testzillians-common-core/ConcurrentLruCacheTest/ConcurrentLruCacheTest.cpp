@@ -0,0 +1,182 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/ConcurrentLruCache.h"
+#include "core/SharedPtr.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE ConcurrentLruCacheTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( ConcurrentLruCacheTest )
+
+// a single shard makes the eviction order exact
+typedef ConcurrentLruCache<int, int, tbb::tbb_hash_compare<int>, 1> SingleShardCache;
+
+BOOST_AUTO_TEST_CASE( ConcurrentLruCacheTestCase1 )
+{
+	SingleShardCache cache(3);
+	int v = 0;
+
+	cache.insert(1, 10);
+	cache.insert(2, 20);
+	cache.insert(3, 30);
+	BOOST_CHECK(cache.size() == 3);
+
+	// touching 1 makes 2 the least recently used
+	BOOST_CHECK(cache.find(1, v) && v == 10);
+	cache.insert(4, 40);
+	BOOST_CHECK(cache.size() == 3);
+	BOOST_CHECK(!cache.contains(2));
+	BOOST_CHECK(cache.contains(1) && cache.contains(3) && cache.contains(4));
+
+	// replacing counts as a use too
+	cache.insert(3, 31);
+	cache.insert(5, 50);
+	BOOST_CHECK(!cache.contains(1));
+	BOOST_CHECK(cache.find(3, v) && v == 31);
+
+	BOOST_CHECK(!cache.find(2, v));
+	BOOST_CHECK(cache.erase(3));
+	BOOST_CHECK(!cache.erase(3));
+
+	SingleShardCache::Statistics s = cache.statistics();
+	BOOST_CHECK(s.hits == 2);
+	BOOST_CHECK(s.misses == 1);
+	BOOST_CHECK(s.evictions == 2);
+	BOOST_CHECK(s.entries == 2);
+
+	cache.clear();
+	BOOST_CHECK(cache.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( ConcurrentLruCacheTestCase2 )
+{
+	SingleShardCache cache(3, 0, SingleShardCache::policy_t::clock);
+	int v = 0;
+
+	cache.insert(1, 10);
+	cache.insert(2, 20);
+	cache.insert(3, 30);
+
+	// 1 is the oldest but referenced, so it gets a second chance and 2 goes
+	BOOST_CHECK(cache.find(1, v) && v == 10);
+	cache.insert(4, 40);
+	BOOST_CHECK(cache.contains(1));
+	BOOST_CHECK(!cache.contains(2));
+
+	// the second chance requeued 1 ahead of 4, so 3 and 4 go first, then 1 without another hit
+	cache.insert(5, 50);
+	BOOST_CHECK(!cache.contains(3));
+	cache.insert(6, 60);
+	BOOST_CHECK(!cache.contains(4));
+	cache.insert(7, 70);
+	BOOST_CHECK(!cache.contains(1));
+	BOOST_CHECK(cache.contains(5) && cache.contains(6) && cache.contains(7));
+}
+
+BOOST_AUTO_TEST_CASE( ConcurrentLruCacheTestCase3 )
+{
+	SingleShardCache cache(0, 100);
+
+	cache.insert(1, 10, 40);
+	cache.insert(2, 20, 40);
+	cache.insert(3, 30, 40);
+	BOOST_CHECK(!cache.contains(1));
+	BOOST_CHECK(cache.statistics().bytes == 80);
+
+	// growing an entry evicts others, but never the entry itself
+	cache.insert(3, 31, 150);
+	BOOST_CHECK(cache.size() == 1);
+	BOOST_CHECK(cache.contains(3));
+	BOOST_CHECK(cache.statistics().bytes == 150);
+}
+
+BOOST_AUTO_TEST_CASE( ConcurrentLruCacheTestCase4 )
+{
+	typedef shared_ptr<int> key_type;
+	ConcurrentLruCache<key_type, int, SharedPointerHashCompare<key_type> > cache(1000);
+
+	std::vector<key_type> keys;
+	for(int i = 0; i < 100; ++i)
+	{
+		keys.push_back(key_type(new int(i)));
+		cache.insert(keys.back(), i);
+	}
+
+	int v = -1;
+	for(int i = 0; i < 100; ++i)
+		BOOST_CHECK(cache.find(keys[i], v) && v == i);
+	BOOST_CHECK(!cache.find(key_type(new int(0)), v));
+}
+
+namespace {
+
+void hammer(ConcurrentLruCache<int, int>* cache, int seed, std::atomic<int>* wrong)
+{
+	uint32 x = seed * 2654435761u + 1;
+	for(int i = 0; i < 50000; ++i)
+	{
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		int key = x % 2000;
+		int v;
+		if(cache->find(key, v))
+		{
+			if(v != key * 3)
+				++(*wrong);
+		}
+		else
+		{
+			cache->insert(key, key * 3, 16);
+		}
+		if(i % 97 == 0)
+			cache->erase(key);
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( ConcurrentLruCacheTestCase5 )
+{
+	for(int p = 0; p < 2; ++p)
+	{
+		ConcurrentLruCache<int, int> cache(512, 512 * 16, (p == 0) ? ConcurrentLruCache<int, int>::policy_t::lru : ConcurrentLruCache<int, int>::policy_t::clock);
+		std::atomic<int> wrong(0);
+
+		boost::thread_group threads;
+		for(int i = 0; i < 4; ++i)
+			threads.create_thread(boost::bind(hammer, &cache, i, &wrong));
+		threads.join_all();
+
+		ConcurrentLruCache<int, int>::Statistics s = cache.statistics();
+		BOOST_CHECK(wrong == 0);
+		BOOST_CHECK(s.entries <= 512);
+		BOOST_CHECK(s.bytes == s.entries * 16);
+		BOOST_CHECK(s.hits + s.misses == 4 * 50000);
+		BOOST_CHECK(s.evictions > 0);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -24,15 +24,17 @@
 #include "core/Prerequisite.h"
 #include "core/JustThread.h"
 
-#include "eventcount.h"
+#include "core/EventCount.h"
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
 #include <boost/thread.hpp>
 #include <tbb/spin_rw_mutex.h>
 #include <tbb/tbb_thread.h>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
 #include <tbb/concurrent_queue.h>
 #include "core/ConditionVariable.h"
+#include "core/Semaphore.h"
 
 #define BOOST_TEST_MODULE ConditionVarPerformanceTest
 #define BOOST_TEST_MAIN
@@ -51,7 +53,7 @@ struct EventcountPingPongTestLocal
 		consumer_ready = false;
 
 		counter = 0;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			while(!consumer_ready)
@@ -68,15 +70,13 @@ struct EventcountPingPongTestLocal
 			producer_ready = true;
 			producer_ec.notify_one();
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[Eventcount] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
 		producer_ready = false;
 
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			producer_ready = false;
@@ -93,15 +93,11 @@ struct EventcountPingPongTestLocal
 				producer_ec.wait();
 			}
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[Eventcount] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
-	zillians::mutex m;
-	//zillians::condition_variable var;
-	zillians::eventcount consumer_ec;
-	zillians::eventcount producer_ec;
+	zillians::EventCount consumer_ec;
+	zillians::EventCount producer_ec;
 	volatile bool consumer_ready;
 	volatile bool producer_ready;
 	const static uint32 iterations = 20000;
@@ -126,7 +122,7 @@ struct CondVarPingPongTestLocal
 
 		counter = 0;
 
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			{
@@ -152,14 +148,12 @@ struct CondVarPingPongTestLocal
 			producer_ready = true;
 			producer_cond.notify_one();
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[Boost ConditionVar] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
 		producer_ready = false;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			producer_ready = false;
@@ -183,8 +177,6 @@ struct CondVarPingPongTestLocal
 				waited = true;
 			}
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[Boost ConditionVar] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -215,7 +207,7 @@ struct StdConditionVariableTestCaseLocal
 		consumer_ready = false;
 		counter = 0;
 
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			{
@@ -241,14 +233,12 @@ struct StdConditionVariableTestCaseLocal
 			producer_ready = true;
 			producer_cond.notify_one();
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[STD ConditionVar] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
 		producer_ready = false;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 //			if(counter % 1000 == 0)
@@ -274,8 +264,6 @@ struct StdConditionVariableTestCaseLocal
 				producer_ready = false;
 			}
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[STD ConditionVar] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -306,7 +294,7 @@ struct ConcurrentQueuePingPongTestLocal
 	void consumer()
 	{
 		counter = 0;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = 0;
@@ -319,13 +307,11 @@ struct ConcurrentQueuePingPongTestLocal
 
 			producer_q.push(dummy);
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[ConcurrentQueue] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = counter;
@@ -338,8 +324,6 @@ struct ConcurrentQueuePingPongTestLocal
 //			BOOST_CHECK(counter % 2 == 1);
 			++counter;
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[ConcurrentQueue] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -350,13 +334,16 @@ struct ConcurrentQueuePingPongTestLocal
 
 BOOST_AUTO_TEST_CASE( ConcurrentQueuePingPongTestCase )
 {
-	ConcurrentQueuePingPongTestLocal obj;
+	Benchmark::run("ping_pong/tbb::concurrent_bounded_queue", [](BenchmarkState& state) {
+		ConcurrentQueuePingPongTestLocal obj;
 
-	tbb::tbb_thread t0(boost::bind(&ConcurrentQueuePingPongTestLocal::consumer, &obj));
-	tbb::tbb_thread t1(boost::bind(&ConcurrentQueuePingPongTestLocal::producer, &obj));
+		tbb::tbb_thread t0(boost::bind(&ConcurrentQueuePingPongTestLocal::consumer, &obj));
+		tbb::tbb_thread t1(boost::bind(&ConcurrentQueuePingPongTestLocal::producer, &obj));
 
-	t0.join();
-	t1.join();
+		t0.join();
+		t1.join();
+		state.setItemsProcessed(ConcurrentQueuePingPongTestLocal::iterations);
+	});
 }
 
 class AckQueue
@@ -402,8 +389,8 @@ public:
 		AckMap::iterator it = mAckMap.map.find(key);
 		//BOOST_ASSERT( it != mAckMap.map.end() );// NOTE: Commented out because of Win32 compilation error
 		/* Error
-			error C2668: '_wassert' : �ҸW��i���I�s�h��禡	
-			\zillians\projects\common\test\testzillians-core\ConditionVarPerformanceTest\ConditionVarPerformanceTest.cpp	307
+			error C2668: '_wassert' : �ҸW��i���I�s�h��禡	
+			\zillians\projects\common\test\testzillians-core\ConditionVarPerformanceTest\ConditionVarPerformanceTest.cpp	307
 		*/
 
 		try
@@ -477,7 +464,7 @@ struct AckQueuePingPongTestLocal
 	void consumer()
 	{
 		counter = 0;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			q.wait(key);
@@ -488,13 +475,11 @@ struct AckQueuePingPongTestLocal
 
 			q.signal(key);
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			q.signal(key);
@@ -503,8 +488,6 @@ struct AckQueuePingPongTestLocal
 			BOOST_CHECK(counter % 2 == 1);
 			++counter;
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -533,7 +516,7 @@ BOOST_AUTO_TEST_CASE( AckQueuePingPongTestCase )
 //	void consumer()
 //	{
 //		counter = 0;
-//		tbb::tick_count s = tbb::tick_count::now();
+//		Benchmark::pinThread(0);
 //		for(int i=0;i<iterations;++i)
 //		{
 //			q.wait(key);
@@ -544,13 +527,11 @@ BOOST_AUTO_TEST_CASE( AckQueuePingPongTestCase )
 //
 //			q.signal(key);
 //		}
-//		tbb::tick_count e = tbb::tick_count::now();
-//		printf("wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 //	}
 //
 //	void producer()
 //	{
-//		tbb::tick_count s = tbb::tick_count::now();
+//		Benchmark::pinThread(1);
 //		for(int i=0;i<iterations;++i)
 //		{
 //			q.signal(key);
@@ -559,8 +540,6 @@ BOOST_AUTO_TEST_CASE( AckQueuePingPongTestCase )
 //			BOOST_CHECK(counter % 2 == 1);
 //			++counter;
 //		}
-//		tbb::tick_count e = tbb::tick_count::now();
-//		printf("notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 //	}
 //
 //	volatile uint32 counter;
@@ -585,7 +564,7 @@ struct StdCondVarPingPongTestCaseLocal
 	void consumer()
 	{
 		counter = 0;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = 0;
@@ -598,13 +577,11 @@ struct StdCondVarPingPongTestCaseLocal
 
 			producer_cond.signal(dummy);
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[StdConditionVariable] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = counter;
@@ -617,8 +594,6 @@ struct StdCondVarPingPongTestCaseLocal
 			BOOST_CHECK(counter % 2 == 1);
 			++counter;
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[StdConditionVariable] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -629,22 +604,25 @@ struct StdCondVarPingPongTestCaseLocal
 
 BOOST_AUTO_TEST_CASE( StdCondVarPingPongTestCase )
 {
-	StdCondVarPingPongTestCaseLocal obj;
+	Benchmark::run("ping_pong/zillians::ConditionVariable", [](BenchmarkState& state) {
+		StdCondVarPingPongTestCaseLocal obj;
 
-	obj.counter = 0;
+		obj.counter = 0;
 
-	tbb::tbb_thread t0(boost::bind(&StdCondVarPingPongTestCaseLocal::consumer, &obj));
-	tbb::tbb_thread t1(boost::bind(&StdCondVarPingPongTestCaseLocal::producer, &obj));
+		tbb::tbb_thread t0(boost::bind(&StdCondVarPingPongTestCaseLocal::consumer, &obj));
+		tbb::tbb_thread t1(boost::bind(&StdCondVarPingPongTestCaseLocal::producer, &obj));
 
-	t0.join();
-	t1.join();
+		t0.join();
+		t1.join();
+		state.setItemsProcessed(StdCondVarPingPongTestCaseLocal::iterations);
+	});
 }
 
 struct TbbQueueCondVarPingPongTestCaseLocal
 {
 	void consumer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = 0;
@@ -657,13 +635,11 @@ struct TbbQueueCondVarPingPongTestCaseLocal
 
 			producer_cond.signal(dummy);
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[zillians::ConditionVariable] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = counter;
@@ -676,8 +652,6 @@ struct TbbQueueCondVarPingPongTestCaseLocal
 			BOOST_CHECK(counter % 2 == 1);
 			++counter;
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[zillians::ConditionVariable] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -771,7 +745,7 @@ struct StdQueueCondVarPingPongTestCaseLocal
 	void consumer()
 	{
 		counter = 0;
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(0);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = 0;
@@ -784,13 +758,11 @@ struct StdQueueCondVarPingPongTestCaseLocal
 
 			producer_cond.push(dummy);
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[StdQueueConditionVariable] wait for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	void producer()
 	{
-		tbb::tick_count s = tbb::tick_count::now();
+		Benchmark::pinThread(1);
 		for(int i=0;i<iterations;++i)
 		{
 			uint32 dummy = counter;
@@ -803,8 +775,6 @@ struct StdQueueCondVarPingPongTestCaseLocal
 			BOOST_CHECK(counter % 2 == 1);
 			++counter;
 		}
-		tbb::tick_count e = tbb::tick_count::now();
-		printf("[StdQueueConditionVariable] notify for %d times takes %f ms\n", iterations, (e-s).seconds()*1000.0);
 	}
 
 	volatile uint32 counter;
@@ -818,13 +788,122 @@ struct StdQueueCondVarPingPongTestCaseLocal
 
 BOOST_AUTO_TEST_CASE( StdQueueCondVarPingPongTestCase )
 {
-	StdQueueCondVarPingPongTestCaseLocal obj;
+	Benchmark::run("ping_pong/zillians::ConcurrentQueue", [](BenchmarkState& state) {
+		StdQueueCondVarPingPongTestCaseLocal obj;
 
-	tbb::tbb_thread t0(boost::bind(&StdQueueCondVarPingPongTestCaseLocal::consumer, &obj));
-	tbb::tbb_thread t1(boost::bind(&StdQueueCondVarPingPongTestCaseLocal::producer, &obj));
+		tbb::tbb_thread t0(boost::bind(&StdQueueCondVarPingPongTestCaseLocal::consumer, &obj));
+		tbb::tbb_thread t1(boost::bind(&StdQueueCondVarPingPongTestCaseLocal::producer, &obj));
 
-	t0.join();
-	t1.join();
+		t0.join();
+		t1.join();
+		state.setItemsProcessed(StdQueueCondVarPingPongTestCaseLocal::iterations);
+	});
+}
+
+struct SemaphorePingPongTestCaseLocal
+{
+	void consumer()
+	{
+		Benchmark::pinThread(0);
+		for(int i=0;i<iterations;++i)
+		{
+			consumer_sema.wait();
+
+			BOOST_CHECK(counter % 2 == 1);
+			++counter;
+
+			producer_sema.post();
+		}
+	}
+
+	void producer()
+	{
+		Benchmark::pinThread(1);
+		for(int i=0;i<iterations;++i)
+		{
+			BOOST_CHECK(counter % 2 == 0);
+			++counter;
+
+			consumer_sema.post();
+			producer_sema.wait();
+		}
+	}
+
+	volatile uint32 counter;
+	zillians::Semaphore consumer_sema;
+	zillians::Semaphore producer_sema;
+	const static uint32 iterations = 200000;
+};
+
+BOOST_AUTO_TEST_CASE( SemaphorePingPongTestCase )
+{
+	Benchmark::run("ping_pong/zillians::Semaphore", [](BenchmarkState& state) {
+		SemaphorePingPongTestCaseLocal obj;
+
+		obj.counter = 0;
+
+		tbb::tbb_thread t0(boost::bind(&SemaphorePingPongTestCaseLocal::consumer, &obj));
+		tbb::tbb_thread t1(boost::bind(&SemaphorePingPongTestCaseLocal::producer, &obj));
+
+		t0.join();
+		t1.join();
+		state.setItemsProcessed(SemaphorePingPongTestCaseLocal::iterations);
+	});
+}
+
+struct OneShotCondVarPingPongTestCaseLocal
+{
+	void consumer()
+	{
+		Benchmark::pinThread(0);
+		for(int i=0;i<iterations;++i)
+		{
+			uint32 dummy = 0;
+			consumer_cond.wait(dummy);
+			consumer_cond.reset();
+
+			BOOST_CHECK(dummy == counter);
+			BOOST_CHECK(counter % 2 == 1);
+			dummy = ++counter;
+
+			producer_cond.signal(dummy);
+		}
+	}
+
+	void producer()
+	{
+		Benchmark::pinThread(1);
+		for(int i=0;i<iterations;++i)
+		{
+			BOOST_CHECK(counter % 2 == 0);
+			uint32 dummy = ++counter;
+
+			consumer_cond.signal(dummy);
+			producer_cond.wait(dummy);
+			producer_cond.reset();
+		}
+	}
+
+	volatile uint32 counter;
+	zillians::OneShotConditionVariable<uint32> consumer_cond;
+	zillians::OneShotConditionVariable<uint32> producer_cond;
+	const static uint32 iterations = 200000;
+};
+
+BOOST_AUTO_TEST_CASE( OneShotCondVarPingPongTestCase )
+{
+	Benchmark::run("ping_pong/zillians::OneShotConditionVariable", [](BenchmarkState& state) {
+		OneShotCondVarPingPongTestCaseLocal obj;
+
+		obj.counter = 0;
+
+		tbb::tbb_thread t0(boost::bind(&OneShotCondVarPingPongTestCaseLocal::consumer, &obj));
+		tbb::tbb_thread t1(boost::bind(&OneShotCondVarPingPongTestCaseLocal::producer, &obj));
+
+		t0.join();
+		t1.join();
+		state.setItemsProcessed(OneShotCondVarPingPongTestCaseLocal::iterations);
+	});
 }
 
 BOOST_AUTO_TEST_SUITE_END()
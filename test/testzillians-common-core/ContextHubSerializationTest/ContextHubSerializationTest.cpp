@@ -25,6 +25,11 @@
 #include <limits>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <sstream>
+#include <cstdio>
 
 #define BOOST_TEST_MODULE ContextHubSerializationTest
 #define BOOST_TEST_MAIN
@@ -109,6 +114,161 @@ BOOST_AUTO_TEST_CASE( ContextHubSerializationTestCase1 )
 		}
 
 	}
+
+	std::remove(testfile);
+}
+
+BOOST_AUTO_TEST_CASE( ContextHubSerializationTestCase2 )
+{
+	typedef ContextHubSerialization<boost::mpl::vector<Context1, Context2> > Serializer;
+
+	Buffer buffer;
+
+	// serialize, Context2 is left empty to check null pointers
+	{
+		ContextHub<ContextOwnership::transfer> hub;
+
+		Context1* ctx1 = new Context1;
+		ctx1->data = "orz";
+		hub.set<Context1>(ctx1);
+
+		ContextHubBufferOArchive<Buffer> oa(buffer);
+		Serializer serializer(hub);
+		oa << serializer;
+	}
+
+	// deserialize
+	{
+		ContextHub<ContextOwnership::transfer> hub;
+
+		ContextHubBufferIArchive<Buffer> ia(buffer);
+		Serializer serializer(hub);
+		ia >> serializer;
+
+		Context1* ctx1 = hub.get<Context1>();
+		BOOST_CHECK(ctx1 != NULL);
+		if(ctx1)
+		{
+			BOOST_CHECK(ctx1->data == "orz");
+		}
+		BOOST_CHECK(hub.get<Context2>() == NULL);
+		BOOST_CHECK(buffer.dataSize() == 0);
+	}
+}
+
+namespace {
+
+typedef ContextHubSerialization<boost::mpl::vector<Context1, Context2> > BenchmarkSerializer;
+
+void prepareHubs(std::vector<ContextHub<ContextOwnership::transfer>*>& hubs, std::size_t count)
+{
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		ContextHub<ContextOwnership::transfer>* hub = new ContextHub<ContextOwnership::transfer>;
+		Context1* ctx1 = new Context1;
+		ctx1->data = "session context of some moderate length";
+		hub->set<Context1>(ctx1);
+		Context2* ctx2 = new Context2;
+		ctx2->a = (int)i; ctx2->b = (int)(i * 2);
+		hub->set<Context2>(ctx2);
+		hubs.push_back(hub);
+	}
+}
+
+void destroyHubs(std::vector<ContextHub<ContextOwnership::transfer>*>& hubs)
+{
+	for(std::size_t i = 0; i < hubs.size(); ++i)
+		SAFE_DELETE(hubs[i]);
+	hubs.clear();
+}
+
+void report(const char* name, std::size_t count, std::size_t bytes, const boost::posix_time::time_duration& save, const boost::posix_time::time_duration& load)
+{
+	printf("%-8s %zu hubs, %zu bytes, save %.3f us/hub, load %.3f us/hub\n", name, count, bytes,
+			(double)save.total_microseconds() / count, (double)load.total_microseconds() / count);
+}
+
+// each hub goes to its own archive, which is what checkpointing sessions does
+template<typename OArchive, typename IArchive>
+void benchmarkArchive(const char* name, std::vector<ContextHub<ContextOwnership::transfer>*>& hubs)
+{
+	using namespace boost::posix_time;
+	std::vector<std::string> images(hubs.size());
+	std::size_t bytes = 0;
+
+	ptime t0 = microsec_clock::universal_time();
+	for(std::size_t i = 0; i < hubs.size(); ++i)
+	{
+		std::ostringstream oss;
+		{
+			OArchive oa(oss);
+			BenchmarkSerializer serializer(*hubs[i]);
+			oa << serializer;
+		}
+		images[i] = oss.str();
+		bytes += images[i].size();
+	}
+
+	ptime t1 = microsec_clock::universal_time();
+	for(std::size_t i = 0; i < hubs.size(); ++i)
+	{
+		ContextHub<ContextOwnership::transfer> hub;
+		std::istringstream iss(images[i]);
+		IArchive ia(iss);
+		BenchmarkSerializer serializer(hub);
+		ia >> serializer;
+		BOOST_CHECK(hub.get<Context2>()->a == (int)i);
+	}
+	ptime t2 = microsec_clock::universal_time();
+
+	report(name, hubs.size(), bytes, t1 - t0, t2 - t1);
+}
+
+void benchmarkBuffer(std::vector<ContextHub<ContextOwnership::transfer>*>& hubs)
+{
+	using namespace boost::posix_time;
+	std::vector<Buffer*> images(hubs.size());
+	std::size_t bytes = 0;
+
+	ptime t0 = microsec_clock::universal_time();
+	for(std::size_t i = 0; i < hubs.size(); ++i)
+	{
+		images[i] = new Buffer;
+		ContextHubBufferOArchive<Buffer> oa(*images[i]);
+		BenchmarkSerializer serializer(*hubs[i]);
+		oa << serializer;
+		bytes += images[i]->dataSize();
+	}
+
+	ptime t1 = microsec_clock::universal_time();
+	for(std::size_t i = 0; i < hubs.size(); ++i)
+	{
+		ContextHub<ContextOwnership::transfer> hub;
+		ContextHubBufferIArchive<Buffer> ia(*images[i]);
+		BenchmarkSerializer serializer(hub);
+		ia >> serializer;
+		BOOST_CHECK(hub.get<Context2>()->a == (int)i);
+	}
+	ptime t2 = microsec_clock::universal_time();
+
+	for(std::size_t i = 0; i < images.size(); ++i)
+		SAFE_DELETE(images[i]);
+
+	report("buffer", hubs.size(), bytes, t1 - t0, t2 - t1);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( ContextHubSerializationTestCase3 )
+{
+	std::vector<ContextHub<ContextOwnership::transfer>*> hubs;
+	prepareHubs(hubs, 10000);
+
+	benchmarkArchive<boost::archive::text_oarchive, boost::archive::text_iarchive>("text", hubs);
+	benchmarkArchive<boost::archive::binary_oarchive, boost::archive::binary_iarchive>("binary", hubs);
+	benchmarkBuffer(hubs);
+
+	destroyHubs(hubs);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
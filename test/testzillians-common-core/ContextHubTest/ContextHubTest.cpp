@@ -22,6 +22,9 @@
 
 #include "core/Prerequisite.h"
 #include "core/ContextHub.h"
+#include <tbb/atomic.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <iostream>
 #include <string>
 #include <limits>
@@ -254,4 +257,122 @@ BOOST_AUTO_TEST_CASE( ContextHubTestCase5 )
 	BOOST_CHECK(hub.get<context_traits4>()->value == false);
 }
 
+class G { };
+
+BOOST_AUTO_TEST_CASE( ContextHubTestCase6 )
+{
+	ContextHub<ContextOwnership::transfer> hub;
+
+	int ctor_counter = 0;
+	int dtor_counter = 0;
+
+	// get() of a type never set doesn't create its slot
+	BOOST_CHECK(hub.get<G>() == NULL);
+
+	hub.set<CA>(new CA(ctor_counter, dtor_counter));
+	hub.set<CB>(new CB(ctor_counter, dtor_counter));
+	hub.freeze();
+	BOOST_CHECK(hub.isFrozen());
+
+	CA* a = hub.get<CA>(); BOOST_CHECK(a != NULL);
+	CB* b = hub.get<CB>(); BOOST_CHECK(b != NULL);
+	BOOST_CHECK(hub.get<G>() == NULL);
+
+	// slots of types known at freeze() time can still be replaced
+	hub.set<G>(new G);
+	BOOST_CHECK(hub.get<G>() != NULL);
+	hub.set<CA>(new CA(ctor_counter, dtor_counter));
+	BOOST_CHECK(hub.get<CA>() != a);
+	BOOST_CHECK(dtor_counter == 1);
+
+	hub.reset<CB>();
+	BOOST_CHECK(hub.get<CB>() == NULL);
+	BOOST_CHECK(dtor_counter == 2);
+
+	hub.resetAll();
+	BOOST_CHECK(hub.get<CA>() == NULL);
+	BOOST_CHECK(hub.get<G>() == NULL);
+	BOOST_CHECK(ctor_counter == 3);
+	BOOST_CHECK(dtor_counter == 3);
+	BOOST_CHECK(hub.isFrozen());
+}
+
+BOOST_AUTO_TEST_CASE( ContextHubTestCase7 )
+{
+	ContextHub<ContextOwnership::keep> hub;
+
+	A a; B b; C c;
+	hub.set<A>(&a);
+	hub.set<B>(&b);
+	hub.set<C>(&c);
+	hub.freeze(64);
+
+	// read the frozen hub from several threads at once
+	tbb::atomic<int> mismatches;
+	mismatches = 0;
+
+	struct Reader
+	{
+		static void run(ContextHub<ContextOwnership::keep>* hub, A* a, B* b, C* c, tbb::atomic<int>* mismatches)
+		{
+			for(int i = 0; i < 100000; ++i)
+			{
+				if(hub->get<A>() != a || hub->get<B>() != b || hub->get<C>() != c)
+					++(*mismatches);
+			}
+		}
+	};
+
+	boost::thread_group readers;
+	for(int i = 0; i < 4; ++i)
+		readers.create_thread(boost::bind(&Reader::run, &hub, &a, &b, &c, &mismatches));
+	readers.join_all();
+
+	BOOST_CHECK(mismatches == 0);
+}
+
+BOOST_AUTO_TEST_CASE( ContextHubTestCase8 )
+{
+	typedef NamedContextHub<ContextOwnership::transfer> Hub;
+	Hub hub;
+
+	int ctor_counter = 0;
+	int dtor_counter = 0;
+
+	Hub::Key ka = Hub::intern("CA");
+	Hub::Key kb = Hub::intern("CB");
+	BOOST_CHECK(ka.valid() && kb.valid());
+	BOOST_CHECK(ka != kb);
+	BOOST_CHECK(Hub::intern("CA") == ka);
+	BOOST_CHECK(Hub::find("CB") == kb);
+	BOOST_CHECK(!Hub::find("never interned").valid());
+
+	CA* a = new CA(ctor_counter, dtor_counter);
+	hub.set(a, ka);
+	BOOST_CHECK(hub.get<CA>(ka) == a);
+	BOOST_CHECK(hub.get<CB>(kb) == NULL);
+	BOOST_CHECK(hub.size() == 1);
+
+	// the string overloads share the slots of the interned keys
+	BOOST_CHECK(hub.get<CA>("CA") == a);
+	CB* b = new CB(ctor_counter, dtor_counter);
+	hub.set(b, "CB");
+	BOOST_CHECK(hub.get<CB>(kb) == b);
+	BOOST_CHECK(hub.size() == 2);
+	BOOST_CHECK(hub.get<CA>("never interned") == NULL);
+
+	// keys are shared by all hubs of the same type, but the slots are not
+	Hub other;
+	BOOST_CHECK(other.get<CA>(ka) == NULL);
+
+	hub.reset<CA>(ka);
+	BOOST_CHECK(hub.get<CA>("CA") == NULL);
+	BOOST_CHECK(dtor_counter == 1);
+	hub.reset<CB>("CB");
+	BOOST_CHECK(hub.get<CB>(kb) == NULL);
+	BOOST_CHECK(hub.size() == 0);
+	BOOST_CHECK(ctor_counter == 2);
+	BOOST_CHECK(dtor_counter == 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <string>
 #include <limits>
+#include <boost/thread/thread.hpp>
 
 #define BOOST_TEST_MODULE FragmentFreeAllocatorTest
 #define BOOST_TEST_MAIN
@@ -369,4 +370,281 @@ BOOST_AUTO_TEST_CASE( FragmentFreeAllocatorTestCase6 )
 	delete[] raw; raw = NULL;
 }
 
+namespace {
+
+struct RelocationCounter
+{
+	RelocationCounter() : count(0), bytes(0) { }
+	void operator() (byte* oldData, byte* newData, std::size_t size) { UNUSED_ARGUMENT(oldData); UNUSED_ARGUMENT(newData); ++count; bytes += size; }
+	std::size_t count;
+	std::size_t bytes;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE( FragmentFreeAllocatorTestCase7 )
+{
+	const std::size_t size = 20*1024*1024;
+	const std::size_t chunk = 1*1024*1024;
+	char* raw = new char[size];
+
+	// reserve 20MB at the beginning
+	FragmentAllocator allocator(raw, size);
+
+	// fill up the whole pool with 1MB blocks, each filled with its index
+	MutablePointer* ptrs[20] = { NULL };
+	for(int i = 0; i < 20; ++i)
+	{
+		BOOST_CHECK(allocator.allocate(&ptrs[i], chunk));
+		memset(ptrs[i]->data(), i, chunk);
+	}
+
+	// free every other block, so no 2MB allocation can be satisfied
+	for(int i = 0; i < 20; i += 2)
+	{
+		BOOST_CHECK(allocator.deallocate(ptrs[i]));
+		ptrs[i] = NULL;
+	}
+	BOOST_CHECK(allocator.available() == size / 2);
+
+	MutablePointer* big = NULL;
+	BOOST_CHECK(!allocator.allocate(&big, 2*chunk));
+
+	// compact with a budget of 3MB per call, each call moves at most one block over the budget
+	RelocationCounter counter;
+	FragmentFreeOperator defrag(
+			boost::bind(memmove,
+					FragmentFreeOperator::placeholders::dst,
+					FragmentFreeOperator::placeholders::src,
+					FragmentFreeOperator::placeholders::size),
+			boost::ref(counter));
+
+	int calls = 0;
+	while(!defrag.compact(allocator, 3*chunk))
+	{
+		++calls;
+		BOOST_CHECK(counter.bytes <= (std::size_t)calls * 3*chunk + chunk);
+		BOOST_CHECK(calls < 20);
+	}
+	BOOST_CHECK(counter.count == 10);
+	BOOST_CHECK(counter.bytes == 10*chunk);
+	BOOST_CHECK(allocator.available() == size / 2);
+
+	// all blocks are moved to the front in order, with their content and pointers updated
+	for(int i = 1, n = 0; i < 20; i += 2, ++n)
+	{
+		BOOST_CHECK(ptrs[i]->data() == (byte*)raw + n * chunk);
+		BOOST_CHECK(ptrs[i]->data()[0] == i && ptrs[i]->data()[chunk - 1] == i);
+	}
+
+	// the free space is merged into a single block at the end
+	BOOST_CHECK(defrag.compact(allocator, 0));
+	BOOST_CHECK(allocator.allocate(&big, size / 2));
+	BOOST_CHECK(allocator.available() == 0);
+
+	BOOST_CHECK(allocator.deallocate(big));
+	for(int i = 1; i < 20; i += 2)
+	{
+		BOOST_CHECK(allocator.deallocate(ptrs[i]));
+	}
+	BOOST_CHECK(allocator.available() == size);
+
+	delete[] raw; raw = NULL;
+}
+
+BOOST_AUTO_TEST_CASE( FragmentFreeAllocatorTestCase8 )
+{
+	const std::size_t size = 16*1024*1024;
+	char* raw = new char[size];
+
+	FragmentAllocator allocator(raw, size);
+
+	// random allocations and deallocations of different size classes
+	std::vector< std::pair<MutablePointer*, std::size_t> > live;
+	srand(0);
+	for(int i = 0; i < 2000; ++i)
+	{
+		if(live.empty() || rand() % 3 != 0)
+		{
+			std::size_t s = (rand() % 64 + 1) * 1024 * ((rand() % 4 == 0) ? 8 : 1);
+			MutablePointer* ptr = NULL;
+			if(allocator.allocate(&ptr, s))
+			{
+				BOOST_CHECK(allocator.isValid(ptr));
+				BOOST_CHECK(allocator.infoSize(ptr) == s);
+				memset(ptr->data(), (int)(live.size() & 0x7f), s);
+				live.push_back(std::make_pair(ptr, s));
+			}
+		}
+		else
+		{
+			std::size_t k = rand() % live.size();
+			std::swap(live[k], live.back());
+			BOOST_CHECK(allocator.deallocate(live.back().first));
+			live.pop_back();
+		}
+	}
+
+	std::size_t used = 0;
+	for(std::size_t k = 0; k < live.size(); ++k)
+		used += live[k].second;
+	BOOST_CHECK(allocator.available() == size - used);
+
+	// compact everything, the content must follow the pointers
+	std::vector<char> marks;
+	for(std::size_t k = 0; k < live.size(); ++k)
+		marks.push_back(live[k].first->data()[0]);
+
+	FragmentFreeOperator defrag(
+			boost::bind(memmove,
+					FragmentFreeOperator::placeholders::dst,
+					FragmentFreeOperator::placeholders::src,
+					FragmentFreeOperator::placeholders::size));
+	BOOST_CHECK(defrag(allocator));
+
+	for(std::size_t k = 0; k < live.size(); ++k)
+	{
+		BOOST_CHECK(allocator.isValid(live[k].first));
+		BOOST_CHECK(live[k].first->data()[0] == marks[k] && live[k].first->data()[live[k].second - 1] == marks[k]);
+	}
+
+	// all free space is in one block now
+	MutablePointer* rest = NULL;
+	BOOST_CHECK(allocator.allocate(&rest, size - used));
+	BOOST_CHECK(allocator.deallocate(rest));
+
+	for(std::size_t k = 0; k < live.size(); ++k)
+		BOOST_CHECK(allocator.deallocate(live[k].first));
+	BOOST_CHECK(allocator.available() == size);
+
+	delete[] raw; raw = NULL;
+}
+
+BOOST_AUTO_TEST_CASE( FragmentFreeAllocatorTestCase9 )
+{
+	// deferred deallocations are released by the next allocation
+	const std::size_t size = 1024*1024;
+	byte* raw = new byte[size];
+	FragmentAllocator allocator(raw, size);
+
+	MutablePointer* a = NULL;
+	MutablePointer* b = NULL;
+	BOOST_CHECK(allocator.allocate(&a, size / 2));
+	BOOST_CHECK(allocator.allocate(&b, size / 2));
+	BOOST_CHECK(allocator.available() == 0);
+
+	BOOST_CHECK(allocator.deallocateDeferred(a));
+	BOOST_CHECK(allocator.deallocateDeferred(b));
+	BOOST_CHECK(allocator.available() == 0);
+
+	MutablePointer* c = NULL;
+	BOOST_CHECK(allocator.allocate(&c, size));
+	BOOST_CHECK(allocator.deallocateDeferred(c));
+
+	allocator.drainDeferred();
+	BOOST_CHECK(allocator.available() == size);
+
+	delete[] raw; raw = NULL;
+}
+
+namespace {
+
+// Boost.Test checks aren't thread-safe, so failures are counted and checked by the main thread
+void allocateConcurrently(ConcurrentFragmentAllocator* allocator, std::vector<MutablePointer*>* kept, std::vector<MutablePointer*>* handoff, int seed, std::size_t* failures)
+{
+	srand(seed);
+	std::vector<MutablePointer*> live;
+	for(int i = 0; i < 2000; ++i)
+	{
+		MutablePointer* ptr = NULL;
+		if(allocator->allocate(&ptr, (rand() % 16 + 1) * 1024))
+		{
+			memset(ptr->data(), seed, 1024);
+			live.push_back(ptr);
+		}
+
+		if(live.size() > 32)
+		{
+			std::size_t k = rand() % live.size();
+			switch(k % 3)
+			{
+			case 0: handoff->push_back(live[k]); break;
+			case 1: kept->push_back(live[k]); break;
+			default: if(!allocator->deallocate(live[k])) ++*failures; break;
+			}
+			live[k] = live.back();
+			live.pop_back();
+		}
+	}
+	kept->insert(kept->end(), live.begin(), live.end());
+}
+
+void deallocateConcurrently(ConcurrentFragmentAllocator* allocator, std::vector<MutablePointer*>* pointers, std::size_t* failures)
+{
+	for(std::size_t i = 0; i < pointers->size(); ++i)
+	{
+		if(!allocator->deallocate((*pointers)[i]))
+			++*failures;
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( FragmentFreeAllocatorTestCase10 )
+{
+	const std::size_t size = 64*1024*1024;
+	const std::size_t threads = 4;
+	byte* raw = new byte[size];
+	ConcurrentFragmentAllocator allocator(raw, size, threads);
+	BOOST_CHECK(allocator.getRegionCount() == threads);
+	BOOST_CHECK(allocator.total() == size);
+
+	// allocate from all threads, some memory is freed by the next thread
+	std::vector< std::vector<MutablePointer*> > kept(threads);
+	std::vector< std::vector<MutablePointer*> > handoff(threads);
+	std::vector<std::size_t> failures(threads, 0);
+	{
+		boost::thread_group group;
+		for(std::size_t i = 0; i < threads; ++i)
+			group.create_thread(boost::bind(allocateConcurrently, &allocator, &kept[i], &handoff[i], (int)i + 1, &failures[i]));
+		group.join_all();
+	}
+	{
+		boost::thread_group group;
+		for(std::size_t i = 0; i < threads; ++i)
+			group.create_thread(boost::bind(deallocateConcurrently, &allocator, &handoff[(i + 1) % threads], &failures[i]));
+		group.join_all();
+	}
+	for(std::size_t i = 0; i < threads; ++i)
+		BOOST_CHECK(failures[i] == 0);
+
+	// the remaining pointers must survive compaction of every region
+	FragmentFreeOperator defrag(
+			boost::bind(memmove,
+					FragmentFreeOperator::placeholders::dst,
+					FragmentFreeOperator::placeholders::src,
+					FragmentFreeOperator::placeholders::size));
+	BOOST_CHECK(defrag(allocator));
+
+	for(std::size_t i = 0; i < threads; ++i)
+	{
+		for(std::size_t k = 0; k < kept[i].size(); ++k)
+		{
+			BOOST_CHECK(allocator.isValid(kept[i][k]));
+			BOOST_CHECK(kept[i][k]->data()[0] == (byte)(i + 1) && kept[i][k]->data()[1023] == (byte)(i + 1));
+		}
+	}
+
+	for(std::size_t i = 0; i < threads; ++i)
+	{
+		for(std::size_t k = 0; k < kept[i].size(); ++k)
+			BOOST_CHECK(allocator.deallocate(kept[i][k]));
+	}
+
+	allocator.drainDeferred();
+	BOOST_CHECK(allocator.available() == size);
+
+	delete[] raw; raw = NULL;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,71 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "core/Prerequisite.h"
+#include "core/HugePageRegion.h"
+#include <unistd.h>
+
+#define BOOST_TEST_MODULE HugePageRegionTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( HugePageRegionTest )
+
+static void touch(HugePageRegion& region)
+{
+	for(std::size_t i = 0; i < region.size(); i += 4096)
+		region.data()[i] = (byte)i;
+	region.data()[region.size() - 1] = 1;
+}
+
+BOOST_AUTO_TEST_CASE( HugePageRegionTestCase1 )
+{
+	// whatever the system provides, the region is aligned to and sized by its pages
+	HugePageRegion::Backing preferences[] = { HugePageRegion::HUGE_PAGES_1GB, HugePageRegion::HUGE_PAGES_2MB, HugePageRegion::TRANSPARENT_HUGE_PAGES };
+	for(std::size_t i = 0; i < sizeof(preferences) / sizeof(preferences[0]); ++i)
+	{
+		HugePageRegion region(5 * 1024 * 1024 + 1, preferences[i]);
+		BOOST_TEST_MESSAGE("backing = " << region.backing() << ", page size = " << region.pageSize());
+
+		BOOST_CHECK(region.backing() <= preferences[i]);
+		BOOST_CHECK(region.data() != NULL);
+		BOOST_CHECK_GE(region.size(), 5u * 1024 * 1024 + 1);
+		BOOST_CHECK_EQUAL(region.size() % region.pageSize(), 0u);
+		BOOST_CHECK_EQUAL((uintptr_t)region.data() % region.pageSize(), 0u);
+
+		// ScalablePoolAllocator blocks must never cross a page
+		if(region.backing() != HugePageRegion::NORMAL_PAGES)
+			BOOST_CHECK_EQUAL(region.pageSize() % 16384, 0u);
+
+		touch(region);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( HugePageRegionTestCase2 )
+{
+	HugePageRegion region(10000, HugePageRegion::NORMAL_PAGES);
+	BOOST_CHECK_EQUAL(region.backing(), HugePageRegion::NORMAL_PAGES);
+	BOOST_CHECK_EQUAL(region.pageSize(), (std::size_t)::sysconf(_SC_PAGESIZE));
+	BOOST_CHECK_EQUAL(region.size() % region.pageSize(), 0u);
+	touch(region);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
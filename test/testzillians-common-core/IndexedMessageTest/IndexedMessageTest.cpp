@@ -0,0 +1,116 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "core/Prerequisite.h"
+#include "core/IndexedMessage.h"
+#include <vector>
+#include <string>
+
+#define BOOST_TEST_MODULE IndexedMessageTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( IndexedMessageTest )
+
+typedef IndexedMessage<uint32, std::string, Indexed<std::string>, std::vector<int32> > Snapshot;
+
+static void makeSnapshot(std::vector<std::string>& names, std::vector<int32>& values)
+{
+	for(int i = 0; i < 100; ++i)
+	{
+		names.push_back(std::string(i, 'a' + i % 26));
+		values.push_back(i * 3);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( IndexedMessageTestCase1 )
+{
+	std::vector<std::string> names;
+	std::vector<int32> values;
+	makeSnapshot(names, values);
+
+	Buffer buffer;
+	buffer << (uint32)0xABCD;
+	buffer.rskip(sizeof(uint32));
+
+	std::size_t size = Snapshot::write(buffer, 77, "snapshot", names, values);
+	BOOST_CHECK_EQUAL(size, buffer.dataSize());
+	buffer << std::string("next");
+
+	Snapshot::View<> view(buffer);
+	BOOST_CHECK_EQUAL(view.size(), size);
+
+	// fields in any order
+	BOOST_CHECK(view.get<3>() == values);
+	BOOST_CHECK_EQUAL(view.get<1>(), "snapshot");
+	BOOST_CHECK_EQUAL(view.get<0>(), 77u);
+	BOOST_CHECK(view.get<2>() == names);
+
+	BOOST_CHECK_EQUAL(view.vectorSize<2>(), names.size());
+	for(std::size_t i = names.size(); i-- > 0;)
+		BOOST_CHECK_EQUAL(view.vectorAt<2>(i), names[i]);
+
+	// the view doesn't consume the buffer
+	BOOST_CHECK_EQUAL(buffer.dataSize(), size + sizeof(uint32) + 4);
+	buffer.rskip(view.size());
+
+	std::string next; buffer >> next;
+	BOOST_CHECK_EQUAL(next, "next");
+}
+
+BOOST_AUTO_TEST_CASE( IndexedMessageTestCase2 )
+{
+	std::vector<std::string> names;
+	std::vector<int32> values;
+	makeSnapshot(names, values);
+
+	NetworkBuffer buffer;
+	Snapshot::write(buffer, 77, "", names, std::vector<int32>());
+
+	// offsets are in network byte order like everything else
+	BOOST_CHECK_EQUAL(buffer.rptr()[0], 0);
+	BOOST_CHECK_EQUAL(buffer.rptr()[3], 4);
+
+	Snapshot::View<BufferEncoding::network> view(buffer.rptr(), buffer.dataSize());
+	BOOST_CHECK_EQUAL(view.get<0>(), 77u);
+	BOOST_CHECK(view.get<1>().empty());
+	BOOST_CHECK(view.get<3>().empty());
+	BOOST_CHECK_EQUAL(view.vectorAt<2>(99), names[99]);
+}
+
+BOOST_AUTO_TEST_CASE( IndexedMessageTestCase3 )
+{
+	Buffer buffer;
+	IndexedMessage<uint32, std::string>::write(buffer, 1, "two");
+
+	// field count mismatch
+	BOOST_CHECK_THROW(Snapshot::View<> view(buffer), std::runtime_error);
+
+	// truncated message
+	BOOST_CHECK_THROW((IndexedMessage<uint32, std::string>::View<>(buffer.rptr(), buffer.dataSize() - 1)), std::runtime_error);
+	BOOST_CHECK_THROW((IndexedMessage<uint32, std::string>::View<>(buffer.rptr(), 4)), std::length_error);
+
+	IndexedMessage<uint32, std::string>::View<> view(buffer);
+	BOOST_CHECK_EQUAL(view.get<1>(), "two");
+	BOOST_CHECK_EQUAL(view.fieldSize<0>(), sizeof(uint32));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
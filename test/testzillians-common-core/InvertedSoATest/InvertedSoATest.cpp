@@ -0,0 +1,141 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/InvertedSoA.h"
+#include <map>
+#include <string>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE InvertedSoATest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( InvertedSoATest )
+
+typedef InvertedSoA<float, float, std::string> Entities;
+
+struct Integrate
+{
+	Integrate(float dt) : dt(dt) { }
+	inline void operator() (float& position, const float& velocity) const
+	{
+		position += velocity * dt;
+	}
+	float dt;
+};
+
+struct Sum
+{
+	Sum(float* total, std::size_t* names) : total(total), names(names) { }
+	inline void operator() (const float& position, const float& velocity, const std::string& name) const
+	{
+		*total += position + velocity;
+		*names += name.size();
+	}
+	float* total;
+	std::size_t* names;
+};
+
+BOOST_AUTO_TEST_CASE( InvertedSoATestCase1 )
+{
+	Entities e;
+	BOOST_CHECK(e.empty());
+	BOOST_CHECK(!e.valid(Entities::Handle()));
+
+	Entities::Handle a = e.pushBack(1.0f, 10.0f, "a");
+	Entities::Handle b = e.pushBack(2.0f, 20.0f, "bb");
+	Entities::Handle c = e.pushBack(3.0f, 30.0f, "ccc");
+	BOOST_CHECK(e.size() == 3);
+	BOOST_CHECK(e.index(b) == 1);
+	BOOST_CHECK(e.handle(2) == c);
+	BOOST_CHECK(e.get<2>(c) == "ccc");
+
+	e.for_each_field<0, 1>(Integrate(0.5f));
+	BOOST_CHECK(e.get<0>(a) == 6.0f);
+	BOOST_CHECK(e.get<0>(b) == 12.0f);
+	BOOST_CHECK(e.data<0>()[2] == 18.0f);
+
+	// the last element takes the place of the erased one and keeps its handle
+	e.erase(a);
+	BOOST_CHECK(!e.valid(a));
+	BOOST_CHECK(e.size() == 2);
+	BOOST_CHECK(e.index(c) == 0);
+	BOOST_CHECK(e.get<2>(c) == "ccc");
+	BOOST_CHECK(e.get<1>(b) == 20.0f);
+
+	// a reused slot doesn't revive the old handle
+	Entities::Handle d = e.pushBack(4.0f, 40.0f, "dddd");
+	BOOST_CHECK(d.slot == a.slot);
+	BOOST_CHECK(!e.valid(a));
+	BOOST_CHECK(e.valid(d));
+
+	e.swap(0, 2);
+	BOOST_CHECK(e.index(c) == 2);
+	BOOST_CHECK(e.index(d) == 0);
+	BOOST_CHECK(e.at<2>(0) == "dddd");
+
+	float total = 0.0f;
+	std::size_t names = 0;
+	e.for_each(Sum(&total, &names));
+	BOOST_CHECK(names == 9);
+	BOOST_CHECK(total == 18.0f + 30.0f + 12.0f + 20.0f + 4.0f + 40.0f);
+
+	e.clear();
+	BOOST_CHECK(e.empty());
+	BOOST_CHECK(!e.valid(b) && !e.valid(c) && !e.valid(d));
+}
+
+// random insertions and removals against std::map keyed by a unique id field
+BOOST_AUTO_TEST_CASE( InvertedSoATestCase2 )
+{
+	InvertedSoA<int, double> e;
+	std::map<int, InvertedSoA<int, double>::Handle> handles;
+
+	std::srand(1);
+	for(int i = 0; i < 100000; ++i)
+	{
+		if(handles.empty() || std::rand() % 3)
+		{
+			handles[i] = e.pushBack(i, i * 0.5);
+		}
+		else
+		{
+			std::map<int, InvertedSoA<int, double>::Handle>::iterator it = handles.begin();
+			std::advance(it, std::rand() % std::min<std::size_t>(handles.size(), 16));
+			e.erase(it->second);
+			BOOST_CHECK(!e.valid(it->second));
+			handles.erase(it);
+		}
+	}
+
+	BOOST_CHECK(e.size() == handles.size());
+	for(std::map<int, InvertedSoA<int, double>::Handle>::iterator it = handles.begin(); it != handles.end(); ++it)
+	{
+		BOOST_REQUIRE(e.valid(it->second));
+		BOOST_CHECK(e.get<0>(it->second) == it->first);
+		BOOST_CHECK(e.get<1>(it->second) == it->first * 0.5);
+		BOOST_CHECK(e.handle(e.index(it->second)) == it->second);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/SharedPtr.h"
+#include "core/ContextHub.h"
+#include "core/Buffer.h"
+
+#define BOOST_TEST_MODULE LocalSharedPtrTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( LocalSharedPtrTest )
+
+namespace {
+
+struct Base
+{
+	Base() { ++alive; }
+	virtual ~Base() { --alive; }
+	static int alive;
+};
+int Base::alive = 0;
+
+struct Derived : public Base
+{
+	Derived(int v) : value(v) { }
+	int value;
+};
+
+struct Counted : public intrusive_ref_counter<Counted>
+{
+	Counted() { ++alive; }
+	Counted(const Counted& other) : intrusive_ref_counter<Counted>(other) { ++alive; }
+	~Counted() { --alive; }
+	static int alive;
+};
+int Counted::alive = 0;
+
+struct AtomicCounted : public intrusive_ref_counter<AtomicCounted, atomic_ref_count>
+{
+};
+
+struct CountingDeleter
+{
+	CountingDeleter(int* c) : calls(c) { }
+	void operator()(Base* p) const { ++*calls; delete p; }
+	int* calls;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE( LocalSharedPtrTestCase1 )
+{
+	{
+		local_shared_ptr<Derived> a(new Derived(7));
+		BOOST_CHECK(a.unique());
+		BOOST_CHECK_EQUAL(a->value, 7);
+
+		local_shared_ptr<Base> b(a);
+		BOOST_CHECK_EQUAL(a.use_count(), 2);
+		BOOST_CHECK(a == b);
+
+		// the aliasing pointer shares the ownership of a
+		local_shared_ptr<int> value(a, &a->value);
+		BOOST_CHECK_EQUAL(*value, 7);
+		BOOST_CHECK_EQUAL(a.use_count(), 3);
+
+		a.reset();
+		b.reset();
+		BOOST_CHECK_EQUAL(Base::alive, 1);
+		BOOST_CHECK(value.unique());
+
+		local_shared_ptr<int> moved(std::move(value));
+		BOOST_CHECK(!value);
+		BOOST_CHECK(moved);
+	}
+	BOOST_CHECK_EQUAL(Base::alive, 0);
+
+	int calls = 0;
+	{
+		local_shared_ptr<Base> p(new Derived(1), CountingDeleter(&calls));
+		local_shared_ptr<Base> q;
+		q = p;
+	}
+	BOOST_CHECK_EQUAL(calls, 1);
+	BOOST_CHECK_EQUAL(Base::alive, 0);
+
+	{
+		local_shared_ptr<Derived> p = make_local_shared<Derived>(42);
+		local_shared_ptr<Base> q = p;
+		BOOST_CHECK_EQUAL(p->value, 42);
+		BOOST_CHECK_EQUAL(q.use_count(), 2);
+	}
+	BOOST_CHECK_EQUAL(Base::alive, 0);
+}
+
+BOOST_AUTO_TEST_CASE( LocalSharedPtrTestCase2 )
+{
+	{
+		intrusive_ptr<Counted> a(new Counted);
+		intrusive_ptr<Counted> b = a;
+		BOOST_CHECK_EQUAL(a->use_count(), 2);
+
+		// copying the object doesn't copy the count
+		Counted copy(*a);
+		BOOST_CHECK_EQUAL(copy.use_count(), 0);
+	}
+	BOOST_CHECK_EQUAL(Counted::alive, 0);
+
+	intrusive_ptr<AtomicCounted> atomic(new AtomicCounted);
+	intrusive_ptr<AtomicCounted> other(atomic);
+	BOOST_CHECK_EQUAL(atomic->use_count(), 2);
+
+	intrusive_ptr<RefCountedBuffer> buffer(new RefCountedBuffer(64));
+	*buffer << (int32)123;
+	intrusive_ptr<RefCountedBuffer> reader = buffer;
+	int32 v = 0;
+	*reader >> v;
+	BOOST_CHECK_EQUAL(v, 123);
+	BOOST_CHECK_EQUAL(buffer->use_count(), 2);
+}
+
+BOOST_AUTO_TEST_CASE( LocalSharedPtrTestCase3 )
+{
+	ContextHub<ContextOwnership::transfer> hub;
+
+	intrusive_ptr<Counted> counted(new Counted);
+	hub.set(counted);
+	BOOST_CHECK(hub.get<Counted>() == counted.get());
+	BOOST_CHECK_EQUAL(counted->use_count(), 2);
+
+	local_shared_ptr<Derived> local = make_local_shared<Derived>(3);
+	hub.set(local);
+	BOOST_CHECK_EQUAL(hub.get<Derived>()->value, 3);
+	BOOST_CHECK_EQUAL(local.use_count(), 2);
+
+	shared_ptr<Base> shared(new Base);
+	hub.set(shared);
+	BOOST_CHECK(hub.get<Base>() == shared.get());
+	BOOST_CHECK_EQUAL(shared.use_count(), 2);
+
+	hub.resetAll();
+	BOOST_CHECK_EQUAL(counted->use_count(), 1);
+	BOOST_CHECK(local.unique());
+	BOOST_CHECK(shared.unique());
+}
+
+BOOST_AUTO_TEST_CASE( LocalSharedPtrTestCase4 )
+{
+	// the control block freed by the first pointer is reused by the second one
+	void* first = NULL;
+	{
+		shared_ptr<Derived> p = make_pooled_shared<Derived>(5);
+		BOOST_CHECK_EQUAL(p->value, 5);
+		first = p.get();
+	}
+	BOOST_CHECK_EQUAL(Base::alive, 0);
+
+	shared_ptr<Derived> q = make_pooled_shared<Derived>(6);
+	BOOST_CHECK(q.get() == first);
+	BOOST_CHECK_EQUAL(q->value, 6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
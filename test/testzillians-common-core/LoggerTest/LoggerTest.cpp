@@ -0,0 +1,76 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Logger.h"
+
+#define BOOST_TEST_MODULE LoggerTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( LoggerTest )
+
+static int gEvaluated = 0;
+
+static int evaluate()
+{
+	return ++gEvaluated;
+}
+
+BOOST_AUTO_TEST_CASE( Logger_LevelName_Test )
+{
+	BOOST_CHECK_EQUAL(std::string(LogLevel::name(LogLevel::debug)), "DEBUG");
+	BOOST_CHECK_EQUAL(std::string(LogLevel::name(LogLevel::fatal)), "FATAL");
+	BOOST_CHECK_EQUAL(std::string(LogLevel::name((LogLevel::type)42)), "?");
+}
+
+#ifdef BUILD_WITH_LOG4CXX
+BOOST_AUTO_TEST_CASE( Logger_LazyArguments_Test )
+{
+	log4cxx::LoggerPtr log4cxx_logger = log4cxx::Logger::getLogger("zillians.test.LoggerTest");
+	log4cxx_logger->setLevel(log4cxx::Level::getInfo());
+	CachedLogger logger(log4cxx_logger);
+
+	BOOST_CHECK(!logger.isEnabledFor(LogLevel::debug));
+	BOOST_CHECK(logger.isEnabledFor(LogLevel::info));
+
+	gEvaluated = 0;
+	ZILLIANS_LOG_TRACE(logger, "trace " << evaluate());
+	ZILLIANS_LOG_DEBUG(logger, "debug " << evaluate());
+	BOOST_CHECK_EQUAL(gEvaluated, 0);
+
+	ZILLIANS_LOG_INFO(logger, "info " << evaluate());
+	BOOST_CHECK_EQUAL(gEvaluated, 1);
+
+	// the cached threshold only follows log4cxx after a refresh
+	log4cxx_logger->setLevel(log4cxx::Level::getDebug());
+	BOOST_CHECK(!logger.isEnabledFor(LogLevel::debug));
+	CachedLogger::refreshAll();
+	BOOST_CHECK(logger.isEnabledFor(LogLevel::debug));
+	BOOST_CHECK(!logger.isEnabledFor(LogLevel::trace));
+
+	ZILLIANS_LOG_DEBUG(logger, "debug " << evaluate());
+	BOOST_CHECK_EQUAL(gEvaluated, 2);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "core/Prerequisite.h"
+#include "core/MemoryCopy.h"
+#include "core/Buffer.h"
+#include <vector>
+
+#define BOOST_TEST_MODULE MemoryCopyTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( MemoryCopyTest )
+
+static void fill(std::vector<byte>& v)
+{
+	for(std::size_t i = 0; i < v.size(); ++i)
+		v[i] = (byte)(i * 7 + i / 251);
+}
+
+BOOST_AUTO_TEST_CASE( MemoryCopyTestCase1 )
+{
+	const std::size_t threshold = ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD;
+	std::size_t sizes[] = { 0, 1, 63, 64, 4096, threshold - 1, threshold, threshold + 65 };
+
+	std::vector<byte> source(threshold + 256);
+	fill(source);
+
+	for(std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		// misaligned source and destination exercise the memcpy head and tail
+		for(std::size_t offset = 0; offset < 3; ++offset)
+		{
+			std::vector<byte> dest(sizes[i] + 128, (byte)0xFF);
+			memory_copy(&dest[offset * 5], &source[offset], sizes[i]);
+
+			BOOST_CHECK(std::equal(source.begin() + offset, source.begin() + offset + sizes[i], dest.begin() + offset * 5));
+			BOOST_CHECK_EQUAL(dest[offset * 5 + sizes[i]], (byte)0xFF);
+			if(offset > 0)
+				BOOST_CHECK_EQUAL(dest[offset * 5 - 1], (byte)0xFF);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( MemoryCopyTestCase2 )
+{
+	const std::size_t size = ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD + 100;
+
+	std::vector<byte> data(size * 2 + 10);
+	fill(data);
+	std::vector<byte> expected(data.begin() + 10, data.begin() + 10 + size);
+
+	// overlapping move falls back to memmove
+	memory_move(&data[0], &data[10], size);
+	BOOST_CHECK(std::equal(expected.begin(), expected.end(), data.begin()));
+
+	// non-overlapping move is streamed
+	memory_move(&data[size + 10], &data[0], size);
+	BOOST_CHECK(std::equal(expected.begin(), expected.end(), data.begin() + size + 10));
+}
+
+BOOST_AUTO_TEST_CASE( MemoryCopyTestCase3 )
+{
+	// a big buffer is cloned and crunched through the streaming path
+	const std::size_t size = ZILLIANS_NON_TEMPORAL_COPY_THRESHOLD * 2;
+
+	Buffer buffer(size + 64);
+	for(uint32 i = 0; i < size / sizeof(uint32); ++i)
+		buffer << i;
+
+	Buffer clone(buffer);
+	for(uint32 i = 0; i < size / sizeof(uint32); ++i)
+	{
+		uint32 v; clone >> v;
+		if(v != i) { BOOST_CHECK_EQUAL(v, i); break; }
+	}
+
+	buffer.rskip(64);
+	buffer.crunch();
+	BOOST_CHECK_EQUAL(buffer.rpos(), 0u);
+	uint32 v; buffer >> v;
+	BOOST_CHECK_EQUAL(v, 16u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
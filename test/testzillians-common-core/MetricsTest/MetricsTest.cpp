@@ -0,0 +1,129 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Metrics.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE MetricsTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( MetricsTest )
+
+static const MetricSample* findSample(const std::vector<MetricSample>& samples, const std::string& name)
+{
+	for(std::size_t i = 0; i < samples.size(); ++i)
+	{
+		if(samples[i].name == name)
+			return &samples[i];
+	}
+	return NULL;
+}
+
+static void countAndRecord(MetricCounter* counter, MetricHistogram* histogram, int n)
+{
+	for(int i = 1; i <= n; ++i)
+	{
+		counter->increment();
+		histogram->record(i);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Metrics_Counter_Test )
+{
+	MetricCounter counter("test.counter");
+	BOOST_CHECK_EQUAL(counter.value(), 0ULL);
+
+	counter.increment();
+	counter.increment(41);
+	BOOST_CHECK_EQUAL(counter.value(), 42ULL);
+
+	counter.reset();
+	BOOST_CHECK_EQUAL(counter.value(), 0ULL);
+	counter.increment();
+	BOOST_CHECK_EQUAL(counter.value(), 1ULL);
+}
+
+BOOST_AUTO_TEST_CASE( Metrics_Sharded_Test )
+{
+	MetricCounter counter("test.sharded.counter");
+	MetricHistogram histogram("test.sharded.histogram");
+
+	const int threads = 4;
+	const int n = 10000;
+	boost::thread_group group;
+	for(int i = 0; i < threads; ++i)
+		group.create_thread(boost::bind(&countAndRecord, &counter, &histogram, n));
+	group.join_all();
+
+	// the shards of exited threads are still counted
+	BOOST_CHECK_EQUAL(counter.value(), (uint64)(threads * n));
+
+	TimerHistogram merged = histogram.collect();
+	BOOST_CHECK_EQUAL(merged.count(), (uint64)(threads * n));
+	BOOST_CHECK_EQUAL(merged.min(), 1ULL);
+	BOOST_CHECK_EQUAL(merged.max(), (uint64)n);
+	BOOST_CHECK_EQUAL(merged.sum(), (uint64)threads * n * (n + 1) / 2);
+	BOOST_CHECK_CLOSE((double)merged.percentile(50.0), n / 2.0, 12.5);
+}
+
+BOOST_AUTO_TEST_CASE( Metrics_Registry_Test )
+{
+	std::vector<MetricSample> samples;
+	{
+		MetricCounter counter("test.registry.counter");
+		MetricHistogram histogram("test.registry.histogram");
+		counter.increment(3);
+		histogram.record(100);
+		histogram.record(200);
+
+		MetricRegistry::instance().scrape(samples);
+
+		const MetricSample* c = findSample(samples, "test.registry.counter");
+		BOOST_REQUIRE(c != NULL);
+		BOOST_CHECK_EQUAL(c->type, MetricSample::COUNTER);
+		BOOST_CHECK_EQUAL(c->value, 3ULL);
+
+		const MetricSample* h = findSample(samples, "test.registry.histogram");
+		BOOST_REQUIRE(h != NULL);
+		BOOST_CHECK_EQUAL(h->type, MetricSample::HISTOGRAM);
+		BOOST_CHECK_EQUAL(h->value, 2ULL);
+		BOOST_CHECK_EQUAL(h->histogram.min(), 100ULL);
+		BOOST_CHECK_EQUAL(h->histogram.max(), 200ULL);
+
+		MetricRegistry::instance().print();
+
+		MetricRegistry::instance().reset();
+		BOOST_CHECK_EQUAL(counter.value(), 0ULL);
+		BOOST_CHECK_EQUAL(histogram.collect().count(), 0ULL);
+	}
+
+	// destroyed metrics are gone from the registry
+	samples.clear();
+	MetricRegistry::instance().scrape(samples);
+	BOOST_CHECK(findSample(samples, "test.registry.counter") == NULL);
+	BOOST_CHECK(findSample(samples, "test.registry.histogram") == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,172 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/MonotonicArena.h"
+#include <vector>
+#include <list>
+#include <string>
+
+#define BOOST_TEST_MODULE MonotonicArenaTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( MonotonicArenaTest )
+
+class CountingBufferAllocator : public BufferAllocator
+{
+public:
+	CountingBufferAllocator() : allocations(0), deallocations(0) { }
+
+	virtual byte* allocate(std::size_t size)
+	{
+		++allocations;
+		return (byte*)malloc(size);
+	}
+
+	virtual void deallocate(byte* buffer)
+	{
+		++deallocations;
+		free(buffer);
+	}
+
+	virtual byte* reallocate(byte* buffer, std::size_t size)
+	{
+		return (byte*)realloc(buffer, size);
+	}
+
+	int allocations;
+	int deallocations;
+};
+
+BOOST_AUTO_TEST_CASE( MonotonicArenaTestCase1 )
+{
+	MonotonicArena arena;
+
+	BOOST_CHECK(arena.chunkCount() == 0);
+
+	for(int i = 0; i < 1000; ++i)
+	{
+		std::size_t alignment = (std::size_t)1 << (i % 7);
+		byte* p = (byte*)arena.allocate(1 + i % 37, alignment);
+		BOOST_CHECK(p != NULL);
+		BOOST_CHECK(((uintptr_t)p & (alignment - 1)) == 0);
+		memset(p, 0xcc, 1 + i % 37);
+	}
+
+	BOOST_CHECK(arena.chunkCount() == 1);
+	BOOST_CHECK(arena.reservedSize() == MonotonicArena::DEFAULT_CHUNK_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE( MonotonicArenaTestCase2 )
+{
+	CountingBufferAllocator upstream;
+	{
+		MonotonicArena arena(&upstream, 4096);
+
+		byte* small = (byte*)arena.allocate(16);
+		BOOST_CHECK(upstream.allocations == 1);
+
+		// large requests get a dedicated chunk and leave the current one alone
+		byte* large = (byte*)arena.allocate(100000);
+		BOOST_CHECK(large != NULL);
+		memset(large, 0, 100000);
+		BOOST_CHECK(upstream.allocations == 2);
+
+		byte* next = (byte*)arena.allocate(16);
+		BOOST_CHECK(next == small + 16);
+		BOOST_CHECK(upstream.allocations == 2);
+
+		// fill the first chunk to force a new one
+		for(int i = 0; i < 512; ++i)
+			BOOST_CHECK(arena.allocate(64) != NULL);
+		BOOST_CHECK(arena.chunkCount() > 2);
+
+		// reset keeps the first chunk only
+		arena.reset();
+		BOOST_CHECK(arena.chunkCount() == 1);
+		BOOST_CHECK(arena.reservedSize() == 4096);
+		BOOST_CHECK(upstream.deallocations == upstream.allocations - 1);
+
+		BOOST_CHECK(arena.allocate(16) == small);
+		BOOST_CHECK(upstream.deallocations == upstream.allocations - 1);
+	}
+	BOOST_CHECK(upstream.deallocations == upstream.allocations);
+}
+
+BOOST_AUTO_TEST_CASE( MonotonicArenaTestCase3 )
+{
+	CountingBufferAllocator upstream;
+	MonotonicArena arena(&upstream, 4096);
+
+	// a dedicated chunk is never kept by reset, even if it's allocated first
+	BOOST_CHECK(arena.allocate(10000) != NULL);
+	arena.reset();
+	BOOST_CHECK(arena.chunkCount() == 0);
+	BOOST_CHECK(upstream.deallocations == upstream.allocations);
+
+	BOOST_CHECK(arena.allocate(10000) != NULL);
+	BOOST_CHECK(arena.allocate(16) != NULL);
+	BOOST_CHECK(arena.chunkCount() == 2);
+
+	arena.reset();
+	BOOST_CHECK(arena.chunkCount() == 1);
+	BOOST_CHECK(arena.reservedSize() == 4096);
+	BOOST_CHECK(upstream.deallocations == upstream.allocations - 1);
+
+	BOOST_CHECK(arena.allocate(16) != NULL);
+	arena.release();
+	BOOST_CHECK(arena.chunkCount() == 0);
+	BOOST_CHECK(arena.reservedSize() == 0);
+	BOOST_CHECK(upstream.deallocations == upstream.allocations);
+}
+
+BOOST_AUTO_TEST_CASE( MonotonicArenaTestCase4 )
+{
+	MonotonicArena arena(NULL, 4096);
+
+	for(int round = 0; round < 10; ++round)
+	{
+		{
+			std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(arena)));
+			for(int i = 0; i < 10000; ++i)
+				v.push_back(i);
+			for(int i = 0; i < 10000; ++i)
+				BOOST_CHECK(v[i] == i);
+
+			std::list<std::string, ArenaAllocator<std::string> > l((ArenaAllocator<std::string>(arena)));
+			for(int i = 0; i < 100; ++i)
+				l.push_back("arena");
+			BOOST_CHECK(l.size() == 100);
+			BOOST_CHECK(l.front() == "arena");
+		}
+		arena.reset();
+		BOOST_CHECK(arena.chunkCount() == 1);
+	}
+
+	ArenaAllocator<int> a(arena);
+	ArenaAllocator<double> b(a);
+	BOOST_CHECK(a == b);
+	BOOST_CHECK(&b.arena() == &arena);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -104,4 +104,177 @@ BOOST_AUTO_TEST_CASE( ObjectPoolTestCase2 )
 	if(t2.joinable()) BOOST_CHECK_NO_THROW(t2.join());
 }
 
+class CappedPooledObject : public ObjectPool<CappedPooledObject>
+{
+};
+
+BOOST_AUTO_TEST_CASE( ObjectPoolTestCase3 )
+{
+	CappedPooledObject::setCapacity(16);
+
+	std::vector<CappedPooledObject*> objects;
+	for(int i=0;i<64;++i)
+		objects.push_back(new CappedPooledObject);
+	for(int i=0;i<64;++i)
+		delete objects[i];
+	objects.clear();
+
+	// only 16 objects are kept by the pool, the rest goes back to the heap
+	ObjectPoolStat stat = CappedPooledObject::getStat();
+	BOOST_CHECK(stat.Capacity == 16);
+	BOOST_CHECK(stat.Pooled == 16);
+	BOOST_CHECK(stat.Releases == 48);
+	BOOST_CHECK(stat.Misses == 64);
+
+	for(int i=0;i<16;++i)
+		objects.push_back(new CappedPooledObject);
+	BOOST_CHECK(CappedPooledObject::getStat().Hits == 16);
+	BOOST_CHECK(CappedPooledObject::getStat().Pooled == 0);
+	for(int i=0;i<16;++i)
+		delete objects[i];
+}
+
+class CrossThreadPooledObject : public ConcurrentObjectPool<CrossThreadPooledObject>
+{
+public:
+	int value;
+};
+
+void producerProc(std::vector<CrossThreadPooledObject*>& objects, int count)
+{
+	for(int i=0;i<count;++i)
+	{
+		CrossThreadPooledObject* obj = new CrossThreadPooledObject;
+		obj->value = i;
+		objects.push_back(obj);
+	}
+}
+
+void consumerProc(std::vector<CrossThreadPooledObject*>& objects)
+{
+	for(std::size_t i=0;i<objects.size();++i)
+	{
+		BOOST_CHECK(objects[i]->value == (int)i);
+		delete objects[i];
+	}
+	objects.clear();
+}
+
+BOOST_AUTO_TEST_CASE( ObjectPoolTestCase4 )
+{
+	// objects allocated by one thread and freed by another are cached by the freeing thread,
+	// and handed over to the depot as whole magazines
+	for(int round=0;round<4;++round)
+	{
+		std::vector<CrossThreadPooledObject*> objects;
+
+		boost::thread producer(boost::bind(producerProc, boost::ref(objects), TEST_NUM_POOLED_OBJECT));
+		producer.join();
+
+		boost::thread consumer(boost::bind(consumerProc, boost::ref(objects)));
+		consumer.join();
+	}
+
+	// after the first round, the producer takes everything from the depot where the exited consumer left it
+	ObjectPoolStat stat = CrossThreadPooledObject::getStat();
+	BOOST_CHECK(stat.Misses <= TEST_NUM_POOLED_OBJECT + 2 * ZILLIANS_OBJPOOL_MAGAZINE_SIZE);
+	BOOST_CHECK(stat.Hits > 0);
+	BOOST_CHECK(stat.Pooled >= TEST_NUM_POOLED_OBJECT - 2 * ZILLIANS_OBJPOOL_MAGAZINE_SIZE);
+
+	// bounded depot releases the objects beyond capacity
+	CrossThreadPooledObject::purge();
+	CrossThreadPooledObject::setCapacity(4 * ZILLIANS_OBJPOOL_MAGAZINE_SIZE);
+	{
+		std::vector<CrossThreadPooledObject*> objects;
+		producerProc(objects, TEST_NUM_POOLED_OBJECT);
+		boost::thread consumer(boost::bind(consumerProc, boost::ref(objects)));
+		consumer.join();
+	}
+	stat = CrossThreadPooledObject::getStat();
+	BOOST_CHECK(stat.Pooled <= stat.Capacity);
+	BOOST_CHECK(stat.Releases > 0);
+}
+
+class ReservedPooledObject : public ObjectPool<ReservedPooledObject>
+{
+public:
+	int value[4];
+};
+
+BOOST_AUTO_TEST_CASE( ObjectPoolTestCase5 )
+{
+	ReservedPooledObject::reservePool(TEST_NUM_POOLED_OBJECT);
+	BOOST_CHECK(ReservedPooledObject::getStat().Pooled == TEST_NUM_POOLED_OBJECT);
+
+	// reserved objects are handed out in address order and never miss
+	std::vector<ReservedPooledObject*> objects;
+	for(int i=0;i<TEST_NUM_POOLED_OBJECT;++i)
+		objects.push_back(new ReservedPooledObject);
+	BOOST_CHECK(ReservedPooledObject::getStat().Misses == 0);
+	BOOST_CHECK(ReservedPooledObject::getStat().Hits == TEST_NUM_POOLED_OBJECT);
+	BOOST_CHECK(objects[1] == objects[0] + 1);
+
+	// a heap object beyond the reservation goes away first
+	objects.push_back(new ReservedPooledObject);
+	BOOST_CHECK(ReservedPooledObject::getStat().Misses == 1);
+
+	// slabs with objects in use are kept
+	for(std::size_t i=1;i<objects.size();++i)
+		delete objects[i];
+	ReservedPooledObject::shrinkPool(0);
+	std::size_t pooled = ReservedPooledObject::getStat().Pooled;
+	BOOST_CHECK(pooled > 0);
+	BOOST_CHECK(pooled < TEST_NUM_POOLED_OBJECT);
+
+	delete objects[0];
+	ReservedPooledObject::shrinkPool(0);
+	BOOST_CHECK(ReservedPooledObject::getStat().Pooled == 0);
+
+	// reserve on top of pooled objects only tops up
+	ReservedPooledObject::reservePool(16);
+	ReservedPooledObject::reservePool(8);
+	BOOST_CHECK(ReservedPooledObject::getStat().Pooled == 16);
+	ReservedPooledObject::purge();
+	BOOST_CHECK(ReservedPooledObject::getStat().Pooled == 0);
+}
+
+class ReservedConcurrentPooledObject : public ConcurrentObjectPool<ReservedConcurrentPooledObject>
+{
+public:
+	int value;
+};
+
+void reservedAllocationProc(int count)
+{
+	std::vector<ReservedConcurrentPooledObject*> objects;
+	for(int i=0;i<count;++i)
+		objects.push_back(new ReservedConcurrentPooledObject);
+	for(int i=0;i<count;++i)
+		delete objects[i];
+}
+
+BOOST_AUTO_TEST_CASE( ObjectPoolTestCase6 )
+{
+	ReservedConcurrentPooledObject::reservePool(3 * TEST_NUM_POOLED_OBJECT);
+	BOOST_CHECK(ReservedConcurrentPooledObject::getStat().Pooled == 3 * TEST_NUM_POOLED_OBJECT);
+
+	boost::thread t0(boost::bind(reservedAllocationProc, TEST_NUM_POOLED_OBJECT));
+	boost::thread t1(boost::bind(reservedAllocationProc, TEST_NUM_POOLED_OBJECT));
+	boost::thread t2(boost::bind(reservedAllocationProc, TEST_NUM_POOLED_OBJECT));
+	t0.join();
+	t1.join();
+	t2.join();
+
+	// all objects come from the reservation, and return to the depot as the threads exit
+	ObjectPoolStat stat = ReservedConcurrentPooledObject::getStat();
+	BOOST_CHECK(stat.Misses == 0);
+	BOOST_CHECK(stat.Pooled == 3 * TEST_NUM_POOLED_OBJECT);
+
+	ReservedConcurrentPooledObject::shrinkPool(TEST_NUM_POOLED_OBJECT);
+	BOOST_CHECK(ReservedConcurrentPooledObject::getStat().Pooled <= TEST_NUM_POOLED_OBJECT);
+
+	ReservedConcurrentPooledObject::purge();
+	BOOST_CHECK(ReservedConcurrentPooledObject::getStat().Pooled == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
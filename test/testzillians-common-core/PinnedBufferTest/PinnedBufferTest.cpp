@@ -0,0 +1,97 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "core/Prerequisite.h"
+#include "core/PinnedBufferAllocator.h"
+#include <string>
+
+#define BOOST_TEST_MODULE PinnedBufferTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( PinnedBufferTest )
+
+static bool hasDevice()
+{
+	int count = 0;
+	if(::cudaGetDeviceCount(&count) != cudaSuccess || count == 0)
+	{
+		BOOST_TEST_MESSAGE("no CUDA device, skipped");
+		return false;
+	}
+	return true;
+}
+
+BOOST_AUTO_TEST_CASE( PinnedBufferTestCase1 )
+{
+	if(!hasDevice()) return;
+
+	PinnedBufferAllocator allocator;
+
+	byte* data;
+	{
+		Buffer b(100, &allocator);
+		b << std::string("pinned");
+		data = b.rptr();
+
+		cudaPointerAttributes attributes;
+		BOOST_CHECK(::cudaPointerGetAttributes(&attributes, data) == cudaSuccess);
+	}
+
+	// the freed block is cached and handed out again
+	Buffer b(200, &allocator);
+	BOOST_CHECK(b.rptr() == data);
+
+	allocator.trim();
+}
+
+BOOST_AUTO_TEST_CASE( PinnedBufferTestCase2 )
+{
+	if(!hasDevice()) return;
+
+	cudaStream_t stream;
+	BOOST_REQUIRE(::cudaStreamCreate(&stream) == cudaSuccess);
+	{
+		DeviceMirroredBuffer* b = new DeviceMirroredBuffer(4096, stream);
+		for(int32 i = 0; i < 1000; ++i)
+			b->host() << i;
+
+		BOOST_CHECK_EQUAL(b->upload(), 4000u);
+		b->synchronize();
+		b->host().clear();
+
+		// what went up comes back down
+		b->download(4000);
+		b->synchronize();
+		BOOST_CHECK_EQUAL(b->host().dataSize(), 4000u);
+		for(int32 i = 0; i < 1000; ++i)
+		{
+			int32 v; b->host() >> v;
+			if(v != i) { BOOST_CHECK_EQUAL(v, i); break; }
+		}
+
+		BOOST_CHECK_THROW(b->download(8192), std::length_error);
+		delete b;
+	}
+	::cudaStreamDestroy(stream);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
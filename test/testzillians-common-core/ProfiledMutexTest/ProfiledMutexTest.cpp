@@ -0,0 +1,121 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define ZILLIANS_ENABLE_LOCK_PROFILING
+#include "core/Prerequisite.h"
+#include "core/ProfiledMutex.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE ProfiledMutexTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+ZILLIANS_LOCK_SITE(ExclusiveLockSite, "test.exclusive");
+ZILLIANS_LOCK_SITE(SharedLockSite, "test.shared");
+
+typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_mutex, ExclusiveLockSite) exclusive_mutex_t;
+typedef ZILLIANS_PROFILED_MUTEX(tbb::spin_rw_mutex, SharedLockSite) shared_mutex_t;
+
+BOOST_AUTO_TEST_SUITE( ProfiledMutexTest )
+
+static void incrementLocked(exclusive_mutex_t* mutex, int* value, int n)
+{
+	for(int i = 0; i < n; ++i)
+	{
+		exclusive_mutex_t::scoped_lock lock(*mutex);
+		++(*value);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( ProfiledMutex_Uncontended_Test )
+{
+	LockSite& site = ExclusiveLockSite::site();
+	site.acquisitions.reset();
+	site.contentions.reset();
+	site.hold.reset();
+
+	exclusive_mutex_t mutex;
+	{
+		exclusive_mutex_t::scoped_lock lock(mutex);
+		exclusive_mutex_t::scoped_lock other;
+		BOOST_CHECK(!other.try_acquire(mutex));
+	}
+	{
+		exclusive_mutex_t::scoped_lock lock;
+		BOOST_CHECK(lock.try_acquire(mutex));
+	}
+	mutex.lock();
+	BOOST_CHECK(!mutex.try_lock());
+	mutex.unlock();
+
+	// failed try-locks are neither acquisitions nor contentions
+	BOOST_CHECK_EQUAL(site.acquisitions.value(), 3ULL);
+	BOOST_CHECK_EQUAL(site.contentions.value(), 0ULL);
+	BOOST_CHECK_EQUAL(site.hold.collect().count(), 3ULL);
+}
+
+BOOST_AUTO_TEST_CASE( ProfiledMutex_Contended_Test )
+{
+	LockSite& site = ExclusiveLockSite::site();
+	site.acquisitions.reset();
+	site.contentions.reset();
+	site.wait.reset();
+
+	const int threads = 4;
+	const int n = 10000;
+	exclusive_mutex_t mutex;
+	int value = 0;
+
+	boost::thread_group group;
+	for(int i = 0; i < threads; ++i)
+		group.create_thread(boost::bind(&incrementLocked, &mutex, &value, n));
+	group.join_all();
+
+	BOOST_CHECK_EQUAL(value, threads * n);
+	BOOST_CHECK_EQUAL(site.acquisitions.value(), (uint64)(threads * n));
+	BOOST_CHECK(site.contentions.value() <= site.acquisitions.value());
+	BOOST_CHECK_EQUAL(site.wait.collect().count(), site.contentions.value());
+}
+
+BOOST_AUTO_TEST_CASE( ProfiledMutex_ReadWrite_Test )
+{
+	LockSite& site = SharedLockSite::site();
+	site.acquisitions.reset();
+
+	shared_mutex_t mutex;
+	{
+		shared_mutex_t::scoped_lock reader(mutex, false);
+		shared_mutex_t::scoped_lock another_reader;
+		BOOST_CHECK(another_reader.try_acquire(mutex, false));
+
+		shared_mutex_t::scoped_lock writer;
+		BOOST_CHECK(!writer.try_acquire(mutex, true));
+	}
+	{
+		shared_mutex_t::scoped_lock writer(mutex, true);
+	}
+
+	BOOST_CHECK_EQUAL(site.acquisitions.value(), 3ULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@
 #include <iomanip>
 #include <vector>
 #include <list>
+#include <algorithm>
 #include "core/Types.h"
 #include "core/ScalablePoolAllocator.h"
 #include "log4cxx/basicconfigurator.h"
@@ -75,6 +76,8 @@ std::vector< std::list<TAction> > gThreadActionSeq;
 LoggerPtr logger(Logger::getLogger("MMTest"));
 
 void runTestSuite(zillians::ScalablePoolAllocator* alloc);
+int runRemoteFreeTest();
+int runLargeChunkTest();
 double runTest(zillians::ScalablePoolAllocator* alloc);
 int runTestThread(int idx, zillians::ScalablePoolAllocator* palloc);		// simple alloc/dealloc test
 int genSequences(size_t totalCount);
@@ -118,6 +121,12 @@ int main() {
     cout<<"* ALLOCATION COUNT    = "<<ALLOC_COUNT * REPEAT_COUNT<<endl;
     cout<<"* POOL SIZE           = "<<TEST_SIZE<<endl;
 
+	cout<<"Cross-thread free test"<<endl;
+	if( 0 != (ret = runRemoteFreeTest()) ) { return ret; }
+
+	cout<<"Large chunk reuse test"<<endl;
+	if( 0 != (ret = runLargeChunkTest()) ) { return ret; }
+
     LOG4CXX_INFO(logger, "Generating allocation sequence. # of allocation = "<<ALLOC_COUNT);
     if( 0 != (ret = genSequences(ALLOC_COUNT)) ) { return ret; }
     LOG4CXX_INFO(logger, "Generating allocation sequence complete");
@@ -131,6 +140,16 @@ int main() {
 	runTestSuite(palloc);
 	delete palloc;
 
+	// Compare cross-node block usage against the node partitioned pool, which needs untouched memory
+	delete[] mem;
+	mem = new byte[TEST_SIZE];
+
+	cout<<"ScalableAllocator (NUMA)"<<endl;
+	palloc = new ScalablePoolAllocator(mem, TEST_SIZE, 0, 0, 0);
+	cout<<"* NODE_COUNT          = "<<palloc->getNodeCount()<<endl;
+	runTestSuite(palloc);
+	delete palloc;
+
 
 
 	// Clean up
@@ -231,6 +250,41 @@ void showStat(ScalablePoolAllocator* alloc)
 	cout.flush();
 }
 
+void showPoolStat(ScalablePoolAllocator* alloc)
+{
+	ScalablePoolAllocator::PoolStat stat = alloc->getStats();
+
+	cout<<endl;
+	cout<<"=========================================="<<endl;
+	cout.setf(std::ios::right);
+	cout<<" PoolSize                 "<<setw(12)<<stat.PoolSize<<endl;
+	cout<<" BlockBytes               "<<setw(12)<<stat.BlockBytes<<endl;
+	cout<<" LargeChunkBytes          "<<setw(12)<<stat.LargeChunkBytes<<endl;
+	cout<<" LargeFreeBytes           "<<setw(12)<<stat.LargeFreeBytes<<endl;
+	cout<<" HighWaterMark            "<<setw(12)<<stat.HighWaterMark<<endl;
+	cout<<" ThreadCount              "<<setw(12)<<stat.ThreadCount<<endl;
+	cout<<" NodeCount                "<<setw(12)<<stat.NodeCount<<endl;
+	cout<<" LocalBlocks              "<<setw(12)<<stat.LocalBlocks<<endl;
+	cout<<" RemoteBlocks             "<<setw(12)<<stat.RemoteBlocks<<endl;
+	cout<<" TrimmedBytes             "<<setw(12)<<stat.TrimmedBytes<<endl;
+	cout<<"------------------------------------------"<<endl;
+	cout<<"   Size     Live     Free    TLS Global PublicFree"<<endl;
+	for(size_t i = 0; i < stat.Bins.size(); ++i)
+	{
+		const ScalablePoolAllocator::BinStat& b = stat.Bins[i];
+		if(b.TotalAllocations == 0 && b.BlocksInGlobalBin == 0) continue;
+		cout<<setw(7)<<b.ChunkSize<<setw(9)<<b.LiveChunks<<setw(9)<<b.FreeChunks<<setw(7)<<b.BlocksInTLS<<setw(7)<<b.BlocksInGlobalBin<<setw(11)<<b.PublicFreeListLength<<endl;
+
+		// all allocations are freed by the end of each run
+		if(b.LiveChunks != 0)
+		{
+			LOG4CXX_ERROR(logger, "Chunks of size " << b.ChunkSize << " are leaked, live chunks = " << b.LiveChunks);
+		}
+	}
+	cout<<"=========================================="<<endl;
+	cout.flush();
+}
+
 
 void runTestSuite(ScalablePoolAllocator* alloc)
 {
@@ -255,6 +309,14 @@ void runTestSuite(ScalablePoolAllocator* alloc)
 	cout<<sec<<" sec."<<endl;
 	cout<<sec * 1000000.0 / double(ALLOC_COUNT * REPEAT_COUNT)<<" us per allocation"<<endl;
 	showStat(sa);
+	showPoolStat(sa);
+
+	// give all free blocks back, then make sure the decommitted blocks are still usable
+	cout<<"Trim test                        ";
+	cout<<sa->trim(0)<<" bytes trimmed"<<endl;
+	sec = runTest(alloc);
+	cout<<sec * 1000000.0 / double(ALLOC_COUNT)<<" us per allocation after trim"<<endl;
+	showPoolStat(sa);
 }
 
 
@@ -315,3 +377,154 @@ int runTestThread(int idx, ScalablePoolAllocator* palloc)
 	return 0;
 }
 
+
+
+/**
+ * Frees chunks allocated by the main thread on another thread, through deallocateBatch() and
+ * through single deallocate() calls followed by flushRemoteFrees(), and makes sure every chunk
+ * went back to the block it came from by allocating them all again on the main thread.
+ */
+struct RemoteFreeContext
+{
+	ScalablePoolAllocator* alloc;
+	std::vector<byte*> mems;
+	bool batch;
+	tbb::atomic<int> phase;
+};
+
+int runRemoteFreeThread(int, ScalablePoolAllocator*);
+RemoteFreeContext gRemoteFree;
+
+int runRemoteFreeThread(int, ScalablePoolAllocator*)
+{
+	while(gRemoteFree.phase != 1) tbb::this_tbb_thread::yield();
+
+	if(gRemoteFree.batch)
+	{
+		gRemoteFree.alloc->deallocateBatch(&gRemoteFree.mems[0], gRemoteFree.mems.size());
+	}
+	else
+	{
+		for(size_t i = 0; i < gRemoteFree.mems.size(); ++i)
+			gRemoteFree.alloc->deallocate(gRemoteFree.mems[i]);
+		gRemoteFree.alloc->flushRemoteFrees();
+	}
+	gRemoteFree.phase = 2;
+
+	// stay alive until the owner is done, the remote free cache is also flushed on thread exit
+	while(gRemoteFree.phase != 3) tbb::this_tbb_thread::yield();
+	return 0;
+}
+
+int runRemoteFreeTest()
+{
+	const size_t poolSize = 64 * 1048576;
+	const size_t chunkSize = 64;
+	byte* mem = new byte[poolSize];
+	ScalablePoolAllocator* alloc = new ScalablePoolAllocator(mem, poolSize);
+	int ret = 0;
+
+	size_t idx = 0;
+	ScalablePoolAllocator::PoolStat stat = alloc->getStats();
+	while(stat.Bins[idx].ChunkSize < chunkSize) ++idx;
+
+	// fill whole blocks so there's no bump space left to hide chunks that never came back
+	const size_t count = stat.Bins[idx].ChunksPerBlock * 4;
+	std::vector<byte*> owned;
+	for(size_t i = 0; i < count; ++i)
+		owned.push_back(alloc->allocate(chunkSize));
+	std::sort(owned.begin(), owned.end());
+	const size_t blockBytes = alloc->getStats().BlockBytes;
+
+	for(int round = 0; round < 2 && ret == 0; ++round)
+	{
+		gRemoteFree.alloc = alloc;
+		gRemoteFree.mems = owned;
+		gRemoteFree.batch = (round == 0);
+		gRemoteFree.phase = 0;
+		if(!gRemoteFree.batch)
+			std::random_shuffle(gRemoteFree.mems.begin(), gRemoteFree.mems.end());
+
+		tbb::tbb_thread t(bindT(runRemoteFreeThread, 0, alloc));
+		gRemoteFree.phase = 1;
+		while(gRemoteFree.phase != 2) tbb::this_tbb_thread::yield();
+
+		stat = alloc->getStats();
+		if(stat.Bins[idx].LiveChunks != 0)
+		{
+			LOG4CXX_ERROR(logger, "Chunks freed by another thread are still live, live chunks = " << stat.Bins[idx].LiveChunks);
+			ret = EXIT_FAILURE;
+		}
+
+		std::vector<byte*> reused;
+		for(size_t i = 0; i < count; ++i)
+			reused.push_back(alloc->allocate(chunkSize));
+		std::sort(reused.begin(), reused.end());
+
+		stat = alloc->getStats();
+		if(reused != owned || stat.BlockBytes != blockBytes)
+		{
+			LOG4CXX_ERROR(logger, "Chunks freed by another thread " << (gRemoteFree.batch ? "in batch" : "one by one") << " didn't return to their blocks");
+			ret = EXIT_FAILURE;
+		}
+		if(stat.Bins[idx].PublicFreeListLength != 0 || stat.Bins[idx].LiveChunks != count)
+		{
+			LOG4CXX_ERROR(logger, "Public freelist length = " << stat.Bins[idx].PublicFreeListLength << ", live chunks = " << stat.Bins[idx].LiveChunks);
+			ret = EXIT_FAILURE;
+		}
+
+		gRemoteFree.phase = 3;
+		t.join();
+	}
+
+	for(size_t i = 0; i < count; ++i)
+		alloc->deallocate(owned[i]);
+
+	delete alloc;
+	delete[] mem;
+	return ret;
+}
+
+int runLargeChunkTest()
+{
+	const size_t MB = 1048576;
+	const size_t poolSize = 160 * MB;
+	byte* mem = new byte[poolSize];
+	ScalablePoolAllocator* alloc = new ScalablePoolAllocator(mem, poolSize);
+	int ret = 0;
+
+	// both chunks fall into the last size class, the separators keep them from being merged,
+	// and the 40MB chunk stays on top of the class after consolidation since it has the higher address
+	byte* small = alloc->allocate(40 * MB);
+	byte* separator0 = alloc->allocate(MB);
+	byte* large = alloc->allocate(64 * MB);
+	byte* separator1 = alloc->allocate(MB);
+	if(!small || !separator0 || !large || !separator1)
+	{
+		LOG4CXX_ERROR(logger, "Failed to allocate large chunks");
+		ret = EXIT_FAILURE;
+	}
+	else
+	{
+		alloc->deallocate(large);
+		alloc->deallocate(small);
+
+		// not enough uncarved memory left, so the 64MB chunk beneath the top must be found
+		byte* p = alloc->allocate(60 * MB);
+		if(!p)
+		{
+			LOG4CXX_ERROR(logger, "Failed to reuse a free large chunk below the top of its size class");
+			ret = EXIT_FAILURE;
+		}
+		else
+		{
+			alloc->deallocate(p);
+		}
+		alloc->deallocate(separator0);
+		alloc->deallocate(separator1);
+	}
+
+	delete alloc;
+	delete[] mem;
+	return ret;
+}
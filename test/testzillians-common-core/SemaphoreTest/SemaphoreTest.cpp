@@ -0,0 +1,133 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Semaphore.h"
+#include "core/ConditionVariable.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE SemaphoreTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+namespace {
+
+void waitAndCount(Semaphore* sema, std::atomic<int>* woken)
+{
+	sema->wait();
+	++(*woken);
+}
+
+void waitForValue(OneShotConditionVariable<int>* cond, std::atomic<int>* sum)
+{
+	int value = 0;
+	cond->wait(value);
+	*sum += value;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( SemaphoreTest )
+
+BOOST_AUTO_TEST_CASE( Semaphore_Count_Test )
+{
+	Semaphore sema(2);
+	BOOST_CHECK(sema.try_wait());
+	BOOST_CHECK(sema.try_wait());
+	BOOST_CHECK(!sema.try_wait());
+
+	sema.post(3);
+	sema.wait();
+	BOOST_CHECK(sema.timed_wait(boost::get_system_time() + boost::posix_time::milliseconds(10)));
+	BOOST_CHECK(sema.try_wait());
+	BOOST_CHECK(!sema.try_wait());
+}
+
+BOOST_AUTO_TEST_CASE( Semaphore_TimedWait_Test )
+{
+	Semaphore sema;
+	boost::system_time start = boost::get_system_time();
+	BOOST_CHECK(!sema.timed_wait(start + boost::posix_time::milliseconds(20)));
+	BOOST_CHECK(boost::get_system_time() - start >= boost::posix_time::milliseconds(15));
+
+	// the timed out waiter must not swallow a later post
+	sema.post();
+	BOOST_CHECK(sema.try_wait());
+	BOOST_CHECK(!sema.try_wait());
+}
+
+BOOST_AUTO_TEST_CASE( Semaphore_BatchPost_Test )
+{
+	const int waiters = 8;
+
+	Semaphore sema;
+	std::atomic<int> woken;
+	woken = 0;
+
+	boost::thread_group threads;
+	for(int i = 0; i < waiters; ++i)
+		threads.create_thread(boost::bind(waitAndCount, &sema, &woken));
+
+	sema.post(waiters / 2);
+	while(woken < waiters / 2)
+		boost::this_thread::yield();
+	boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+	BOOST_CHECK_EQUAL((int)woken, waiters / 2);
+
+	sema.post(waiters / 2);
+	threads.join_all();
+	BOOST_CHECK_EQUAL((int)woken, waiters);
+	BOOST_CHECK(!sema.try_wait());
+}
+
+BOOST_AUTO_TEST_CASE( OneShotConditionVariable_Test )
+{
+	const int waiters = 4;
+
+	OneShotConditionVariable<int> cond;
+	std::atomic<int> sum;
+	sum = 0;
+
+	int value = 0;
+	BOOST_CHECK(!cond.try_wait(value));
+	BOOST_CHECK(!cond.timed_wait(value, boost::posix_time::milliseconds(10)));
+
+	boost::thread_group threads;
+	for(int i = 0; i < waiters; ++i)
+		threads.create_thread(boost::bind(waitForValue, &cond, &sum));
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	cond.signal(5);
+	threads.join_all();
+	BOOST_CHECK_EQUAL((int)sum, 5 * waiters);
+
+	// stays signaled until reset
+	BOOST_CHECK(cond.try_wait(value) && value == 5);
+	cond.reset();
+	BOOST_CHECK(!cond.is_signaled());
+	cond.signal(7);
+	cond.wait(value);
+	BOOST_CHECK_EQUAL(value, 7);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
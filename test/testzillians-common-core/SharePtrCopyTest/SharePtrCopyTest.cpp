@@ -63,6 +63,64 @@ BOOST_AUTO_TEST_CASE ( SharePtrCopy )
 	cout << "SharePtrCopy total:" << total << endl;
 }
 
+BOOST_AUTO_TEST_CASE ( LocalSharePtrCopy )
+{
+	local_shared_ptr<Buffer> source(new Buffer(bufferSize));
+	local_shared_ptr<Buffer> dest;
+
+	tbb::tick_count start, end;
+	start = tbb::tick_count::now();
+
+	for (int i = 0; i < loop; i ++) {
+		dest = source;
+	}
+
+	end = tbb::tick_count::now();
+	float total = (end - start).seconds()*1000.0;
+	cout << "LocalSharePtrCopy total:" << total << endl;
+}
+
+BOOST_AUTO_TEST_CASE ( IntrusivePtrCopy )
+{
+	intrusive_ptr<RefCountedBuffer> source(new RefCountedBuffer(bufferSize));
+	intrusive_ptr<RefCountedBuffer> dest;
+
+	tbb::tick_count start, end;
+	start = tbb::tick_count::now();
+
+	for (int i = 0; i < loop; i ++) {
+		dest = source;
+	}
+
+	end = tbb::tick_count::now();
+	float total = (end - start).seconds()*1000.0;
+	cout << "IntrusivePtrCopy total:" << total << endl;
+}
+
+BOOST_AUTO_TEST_CASE ( PooledSharePtrCreate )
+{
+	tbb::tick_count start, end;
+	start = tbb::tick_count::now();
+
+	for (int i = 0; i < loop; i ++) {
+		shared_ptr<int> p = make_shared<int>(i);
+	}
+
+	end = tbb::tick_count::now();
+	float total = (end - start).seconds()*1000.0;
+	cout << "SharePtrCreate total:" << total << endl;
+
+	start = tbb::tick_count::now();
+
+	for (int i = 0; i < loop; i ++) {
+		shared_ptr<int> p = make_pooled_shared<int>(i);
+	}
+
+	end = tbb::tick_count::now();
+	total = (end - start).seconds()*1000.0;
+	cout << "PooledSharePtrCreate total:" << total << endl;
+}
+
 BOOST_AUTO_TEST_CASE ( VoidPtrCopy )
 {
 	Buffer* source = new Buffer(bufferSize);
@@ -0,0 +1,135 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Singleton.h"
+
+#define BOOST_TEST_MODULE SingletonTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <vector>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( SingletonTest )
+
+namespace {
+
+struct Manual : public Singleton<Manual>
+{
+	int value;
+};
+
+struct Automatic : public Singleton<Automatic, SingletonInitialization::automatic>
+{
+	Automatic() : value(0)
+	{
+		++constructed;
+		// give other threads a chance to see a half constructed instance
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		value = 42;
+	}
+
+	int value;
+	static std::atomic<int> constructed;
+};
+
+std::atomic<int> Automatic::constructed(0);
+
+struct Scratch : public ThreadLocalSingleton<Scratch>
+{
+	Scratch() : counter(0) { ++alive; }
+	~Scratch() { --alive; }
+
+	int counter;
+	static std::atomic<int> alive;
+};
+
+std::atomic<int> Scratch::alive(0);
+
+}
+
+BOOST_AUTO_TEST_CASE( SingletonTestCase1 )
+{
+	BOOST_CHECK(Manual::instance() == NULL);
+	{
+		Manual m;
+		BOOST_CHECK(Manual::instance() == &m);
+	}
+	BOOST_CHECK(Manual::instance() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( SingletonTestCase2 )
+{
+	const int threads = 8;
+
+	std::vector<Automatic*> seen(threads);
+	std::atomic<int> broken(0);
+	boost::thread_group group;
+	for(int i = 0; i < threads; ++i)
+	{
+		group.create_thread([&, i] {
+			Automatic* p = Automatic::instance();
+			if(p->value != 42) ++broken;
+			seen[i] = p;
+		});
+	}
+	group.join_all();
+
+	BOOST_CHECK_EQUAL(Automatic::constructed.load(), 1);
+	BOOST_CHECK_EQUAL(broken.load(), 0);
+	for(int i = 0; i < threads; ++i)
+		BOOST_CHECK(seen[i] == Automatic::instance());
+}
+
+BOOST_AUTO_TEST_CASE( SingletonTestCase3 )
+{
+	const int threads = 4;
+	const int rounds = 1000;
+
+	Scratch* mainScratch = Scratch::instance();
+	BOOST_CHECK(mainScratch == Scratch::instance());
+
+	std::vector<Scratch*> seen(threads);
+	std::atomic<int> broken(0);
+	boost::thread_group group;
+	for(int i = 0; i < threads; ++i)
+	{
+		group.create_thread([&, i] {
+			for(int j = 0; j < rounds; ++j)
+				++Scratch::instance()->counter;
+			if(Scratch::instance()->counter != rounds) ++broken;
+			seen[i] = Scratch::instance();
+		});
+	}
+	group.join_all();
+
+	BOOST_CHECK_EQUAL(broken.load(), 0);
+	for(int i = 0; i < threads; ++i)
+		BOOST_CHECK(seen[i] != mainScratch);
+	BOOST_CHECK_EQUAL(mainScratch->counter, 0);
+
+	// instances of the exited threads are gone, only the main thread's is left
+	BOOST_CHECK_EQUAL(Scratch::alive.load(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
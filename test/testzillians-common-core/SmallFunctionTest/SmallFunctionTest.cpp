@@ -0,0 +1,113 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/SmallFunction.h"
+#include <boost/bind.hpp>
+#include <string>
+#include <vector>
+
+#define BOOST_TEST_MODULE SmallFunctionTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( SmallFunctionTest )
+
+static int add(int& a, int b)
+{
+	a += b;
+	return a;
+}
+
+struct Counted
+{
+	Counted() : value(1) { ++instances; }
+	Counted(const Counted& other) : value(other.value) { ++instances; }
+	~Counted() { --instances; }
+
+	int operator() (int& a, int b) { return a += b * value; }
+
+	int value;
+	char padding[512];
+	static int instances;
+};
+
+int Counted::instances = 0;
+
+BOOST_AUTO_TEST_CASE( SmallFunctionTestCase1 )
+{
+	int x = 0;
+
+	SmallFunction<int(int&, int)> f;
+	BOOST_CHECK(f.empty());
+	BOOST_CHECK_THROW(f(x, 1), boost::bad_function_call);
+
+	f = add;
+	BOOST_CHECK(f.isInline());
+	BOOST_CHECK(f(x, 1) == 1);
+
+	f = boost::bind(add, _1, 10);
+	BOOST_CHECK(f.isInline());
+	BOOST_CHECK(f(x, 0) == 11);
+
+	std::string s("abc");
+	f = [s](int& a, int b) { return a += (int)s.size() * b; };
+	BOOST_CHECK(f.isInline());
+	BOOST_CHECK(f(x, 1) == 14);
+
+	boost::function<int(int&, int)> g(add);
+	f = g;
+	BOOST_CHECK(f(x, 1) == 15);
+
+	f = boost::function<int(int&, int)>();
+	BOOST_CHECK(f.empty());
+}
+
+BOOST_AUTO_TEST_CASE( SmallFunctionTestCase2 )
+{
+	int x = 0;
+	{
+		// callables bigger than the buffer go to the heap
+		SmallFunction<int(int&, int)> f = Counted();
+		BOOST_CHECK(!f.isInline());
+		BOOST_CHECK(Counted::instances == 1);
+
+		SmallFunction<int(int&, int)> copy(f);
+		BOOST_CHECK(Counted::instances == 2);
+
+		SmallFunction<int(int&, int)> moved(std::move(f));
+		BOOST_CHECK(f.empty());
+		BOOST_CHECK(Counted::instances == 2);
+		BOOST_CHECK(moved(x, 2) == 2);
+		BOOST_CHECK(copy(x, 3) == 5);
+
+		std::vector< SmallFunction<int(int&, int)> > v;
+		for(int i = 0; i < 100; ++i)
+			v.push_back(copy);
+		BOOST_CHECK(Counted::instances == 102);
+		v.clear();
+		BOOST_CHECK(Counted::instances == 2);
+	}
+	BOOST_CHECK(Counted::instances == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
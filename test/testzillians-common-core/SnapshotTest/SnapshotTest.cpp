@@ -0,0 +1,161 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Snapshot.h"
+#include "core/ContextHub.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE SnapshotTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( SnapshotTest )
+
+static std::atomic<int> gAlive(0);
+
+struct Version
+{
+	explicit Version(int v) : value(v), check(v) { ++gAlive; }
+	~Version() { value = -1; --gAlive; }
+
+	int value;
+	int check;	///< Always equal to value unless the version is freed under a reader
+};
+
+static void readUntil(Snapshot<Version>* snapshot, std::atomic<bool>* stop, std::atomic<int>* errors)
+{
+	int last = 0;
+	while(!stop->load())
+	{
+		Snapshot<Version>::ReadGuard version(*snapshot);
+		if(version->value != version->check || version->value < last)
+			++(*errors);
+		last = version->value;
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Snapshot_Publish_Test )
+{
+	{
+		Snapshot<Version> snapshot(new Version(1));
+		{
+			Snapshot<Version>::ReadGuard version(snapshot);
+			BOOST_CHECK_EQUAL(version->value, 1);
+		}
+
+		// no reader, so the replaced version is reclaimed at once
+		snapshot.publish(new Version(2));
+		BOOST_CHECK_EQUAL(snapshot.pending(), 0UL);
+		BOOST_CHECK_EQUAL(gAlive.load(), 1);
+		BOOST_CHECK_EQUAL(snapshot.unsafe_get()->value, 2);
+	}
+	BOOST_CHECK_EQUAL(gAlive.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( Snapshot_GracePeriod_Test )
+{
+	Snapshot<Version> snapshot(new Version(1));
+	std::atomic<bool> entered(false);
+	std::atomic<bool> leave(false);
+	std::atomic<int> seen(0);
+
+	// a reader on another thread keeps seeing version 1 until it leaves its section
+	boost::thread reader([&]() {
+		SnapshotEpoch::Section section;
+		const Version* version = snapshot.read();
+		entered = true;
+		while(!leave.load())
+			boost::this_thread::yield();
+		seen = version->value;
+	});
+	while(!entered.load())
+		boost::this_thread::yield();
+
+	snapshot.publish(new Version(2));
+	snapshot.publish(new Version(3));
+	BOOST_CHECK_EQUAL(snapshot.pending(), 2UL);
+	BOOST_CHECK_EQUAL(gAlive.load(), 3);
+
+	{
+		// nested sections enter the epoch once
+		SnapshotEpoch::Section outer;
+		Snapshot<Version>::ReadGuard version(snapshot);
+		BOOST_CHECK_EQUAL(version->value, 3);
+		BOOST_CHECK(SnapshotEpoch::inSection());
+	}
+	BOOST_CHECK(!SnapshotEpoch::inSection());
+
+	leave = true;
+	snapshot.synchronize();
+	reader.join();
+	BOOST_CHECK_EQUAL(seen.load(), 1);
+	BOOST_CHECK_EQUAL(snapshot.pending(), 0UL);
+	BOOST_CHECK_EQUAL(gAlive.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( Snapshot_Concurrent_Test )
+{
+	Snapshot<Version> snapshot(new Version(1));
+	std::atomic<bool> stop(false);
+	std::atomic<int> errors(0);
+
+	const int readers = 4;
+	boost::thread_group group;
+	for(int i = 0; i < readers; ++i)
+		group.create_thread(boost::bind(&readUntil, &snapshot, &stop, &errors));
+
+	for(int i = 2; i <= 2000; ++i)
+	{
+		snapshot.publish(new Version(i));
+		if(i % 100 == 0)
+			boost::this_thread::yield();
+	}
+
+	stop = true;
+	group.join_all();
+	snapshot.synchronize();
+
+	BOOST_CHECK_EQUAL(errors.load(), 0);
+	BOOST_CHECK_EQUAL(gAlive.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( Snapshot_ContextHub_Test )
+{
+	{
+		ContextHub<ContextOwnership::transfer> hub;
+		BOOST_CHECK(hub.getSnapshot<Version>() == NULL);
+
+		Snapshot<Version>* snapshot = hub.setSnapshot<Version>(new Version(1));
+		BOOST_CHECK(hub.getSnapshot<Version>() == snapshot);
+
+		hub.publish<Version>(new Version(2));
+		{
+			Snapshot<Version>::ReadGuard version(*hub.getSnapshot<Version>());
+			BOOST_CHECK_EQUAL(version->value, 2);
+		}
+	}
+	BOOST_CHECK_EQUAL(gAlive.load(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/ThreadPlacement.h"
+#include "core/Worker.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define BOOST_TEST_MODULE ThreadPlacementTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( ThreadPlacementTest )
+
+namespace {
+
+std::string currentThreadName()
+{
+	char name[16] = { 0 };
+	pthread_getname_np(pthread_self(), name, sizeof(name));
+	return name;
+}
+
+bool currentThreadAllowedOn(uint32 cpu, std::size_t* count = NULL)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+	if(count) *count = CPU_COUNT(&set);
+	return CPU_ISSET(cpu, &set);
+}
+
+void inspect(std::string* name, bool* pinned)
+{
+	std::size_t count = 0;
+	*name = currentThreadName();
+	*pinned = currentThreadAllowedOn(0, &count) && count == 1;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( ThreadPlacementTestCase1 )
+{
+	uint32 cpus = ThreadPlacement::getCpuCount();
+	BOOST_CHECK(cpus >= 1);
+	BOOST_CHECK(ThreadPlacement::getNumaNodeCount() >= 1);
+	BOOST_CHECK(!ThreadPlacement::getCpusOfNumaNode(0).empty());
+
+	std::vector<uint32> shared = ThreadPlacement::getCpusSharingCache(0);
+	BOOST_CHECK(std::find(shared.begin(), shared.end(), 0U) != shared.end());
+
+	BOOST_CHECK(ThreadPlacement().empty());
+	BOOST_CHECK(ThreadPlacement().at(3).empty());
+}
+
+BOOST_AUTO_TEST_CASE( ThreadPlacementTestCase2 )
+{
+	std::vector<uint32> list;
+	list.push_back(4); list.push_back(5); list.push_back(6);
+
+	ThreadPlacement group = ThreadPlacement::onCpus(list).withName("io").spread();
+	BOOST_CHECK(group.getCpus().size() == 3);
+
+	ThreadPlacement fourth = group.at(4);
+	BOOST_CHECK(fourth.getName() == "io/4");
+	BOOST_CHECK(fourth.getCpus().size() == 1 && fourth.getCpus()[0] == 5);
+
+	// without spread every thread may run on all cpus of the list
+	ThreadPlacement shared = ThreadPlacement::onCpus(list).at(1);
+	BOOST_CHECK(shared.getCpus() == list && shared.getName().empty());
+}
+
+BOOST_AUTO_TEST_CASE( ThreadPlacementTestCase3 )
+{
+	std::string name;
+	bool pinned = false;
+
+	// applied by the worker thread itself, the name is truncated to the kernel limit
+	Worker worker(ThreadPlacement::onCpu(0).withName("a-very-long-thread-name"));
+	worker.dispatch(boost::bind(inspect, &name, &pinned), true);
+	BOOST_CHECK(name == "a-very-long-thr");
+	BOOST_CHECK(pinned);
+
+	// workers of a group get their own names
+	WorkerGroup group(2, 1, WorkerGroup::load_balancing_t::round_robin, ThreadPlacement().withName("group"));
+	group.post(boost::bind(inspect, &name, &pinned), true);
+	BOOST_CHECK(name == "group/0");
+	group.post(boost::bind(inspect, &name, &pinned), true);
+	BOOST_CHECK(name == "group/1");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
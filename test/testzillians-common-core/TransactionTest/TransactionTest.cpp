@@ -22,6 +22,9 @@
 
 #include "core/Prerequisite.h"
 #include "core/Transaction.h"
+#include <atomic>
+#include <new>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <limits>
@@ -33,6 +36,21 @@
 using namespace zillians;
 using namespace std;
 
+static std::atomic<int> gAllocations(0);
+
+void* operator new(std::size_t size)
+{
+	++gAllocations;
+	void* p = std::malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
 BOOST_AUTO_TEST_SUITE( TransactionTest )
 
 struct Routines1
@@ -389,4 +407,132 @@ BOOST_AUTO_TEST_CASE( TransactionTestCase8 )
 	}
 }
 
+struct Routines5
+{
+	struct Context
+	{
+		Context() : currentState(0), arrived(0), rolledBack(0)
+		{ }
+
+		std::atomic<int> currentState;
+		std::atomic<int> arrived;
+		std::atomic<int> rolledBack;
+	};
+
+	static bool action(Context& c)
+	{
+		++c.currentState;
+		return true;
+	}
+
+	static void rollback(Context& c)
+	{
+		--c.currentState;
+		++c.rolledBack;
+	}
+
+	// only returns once the given number of steps are in it at the same time
+	static bool rendezvous(Context& c, int count)
+	{
+		++c.arrived;
+		for(int i = 0; i < 5000 && c.arrived < count; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// Boost.Test isn't thread-safe, so the main thread checks currentState instead
+		if(c.arrived >= count)
+			++c.currentState;
+		return true;
+	}
+
+	static bool fail(Context& c)
+	{
+		++c.currentState;
+		throw std::runtime_error("error");
+	}
+};
+
+BOOST_AUTO_TEST_CASE( TransactionTestCase9 )
+{
+	Routines5::Context c;
+
+	// steps of a group run in parallel, otherwise the rendezvous never completes
+	Transaction<Routines5::Context> transaction(c);
+	transaction
+		.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+		.beginGroup()
+			.add(boost::bind(Routines5::rendezvous, _1, 3), boost::bind(Routines5::rollback, _1))
+			.add(boost::bind(Routines5::rendezvous, _1, 3), boost::bind(Routines5::rollback, _1))
+			.add(boost::bind(Routines5::rendezvous, _1, 3), boost::bind(Routines5::rollback, _1))
+		.endGroup()
+		.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1));
+
+	BOOST_CHECK(transaction.next(true) == true);
+	BOOST_CHECK(c.currentState == 5);
+
+	BOOST_CHECK_NO_THROW(transaction.rollback());
+	BOOST_CHECK(c.currentState == 0);
+	BOOST_CHECK(c.rolledBack == 5);
+}
+
+BOOST_AUTO_TEST_CASE( TransactionTestCase10 )
+{
+	Routines5::Context c;
+
+	// a failing group rolls back all of its steps and everything before it, on a single worker thread
+	Worker worker;
+	Transaction<Routines5::Context> transaction(c, worker);
+	transaction
+		.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+		.beginGroup()
+			.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+			.add(boost::bind(Routines5::fail, _1), boost::bind(Routines5::rollback, _1))
+			.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+		.endGroup()
+		.beginGroup()
+			.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+			.add(boost::bind(Routines5::action, _1), boost::bind(Routines5::rollback, _1))
+		.endGroup();
+
+	BOOST_CHECK(transaction.next(false) == false);
+	BOOST_REQUIRE_THROW(transaction.waitForCompletion(), std::runtime_error);
+	BOOST_CHECK(c.currentState == 0);
+	BOOST_CHECK(c.rolledBack == 4);
+}
+
+static bool bumpBy(Routines5::Context& c, int a, int b, int d)
+{
+	c.currentState += a + b + d;
+	return true;
+}
+
+BOOST_AUTO_TEST_CASE( TransactionTestCase11 )
+{
+	Routines5::Context c;
+	Transaction<Routines5::Context> transaction(c);
+
+	for(int round = 0; round < 3; ++round)
+	{
+		int allocations = gAllocations;
+
+		// rebuilding the same shape of transaction reuses the step storage of the previous round
+		transaction.clear();
+		for(int i = 0; i < 10; ++i)
+		{
+			int x = i, y = i * 2;
+			transaction.add([x, y](Routines5::Context& context) { return bumpBy(context, x, y, 1); }, boost::bind(Routines5::rollback, _1));
+		}
+		transaction
+			.beginGroup()
+				.add(boost::bind(bumpBy, _1, 1, 2, 3), boost::bind(Routines5::rollback, _1))
+				.add(boost::bind(bumpBy, _1, 1, 2, 3), boost::bind(Routines5::rollback, _1))
+			.endGroup();
+
+		if(round > 0)
+			BOOST_CHECK(gAllocations == allocations);
+
+		c.currentState = 0;
+		BOOST_CHECK(transaction.next(true) == true);
+		BOOST_CHECK(c.currentState == 3 * 45 + 10 + 12);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,192 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/UUIDIndexRegistry.h"
+#include <boost/thread.hpp>
+#include <vector>
+#include <atomic>
+
+#define BOOST_TEST_MODULE UUIDIndexRegistryTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( UUIDIndexRegistryTest )
+
+typedef UUIDIndexRegistry<> Registry;
+
+static UUID makeKey(uint64 i)
+{
+	UUID id;
+	id.data.u64[0] = i * 0x2545F4914F6CDD1DULL + 0x12345;
+	id.data.u64[1] = (i >> 3) ^ 0x5DEECE66DULL;
+	return id;
+}
+
+BOOST_AUTO_TEST_CASE( UUIDIndexRegistryTestCase1 )
+{
+	Registry registry;
+	BOOST_CHECK(registry.size() == 0);
+	BOOST_CHECK(registry.capacity() == 0);
+	BOOST_CHECK(!registry.valid(Registry::Handle()));
+
+	bool inserted = false;
+	Registry::Handle a = registry.acquire(makeKey(1), &inserted);
+	BOOST_CHECK(inserted);
+	BOOST_CHECK(a.index == 0);
+	BOOST_CHECK(registry.valid(a));
+
+	// acquiring again gives the same handle
+	Registry::Handle again = registry.acquire(makeKey(1), &inserted);
+	BOOST_CHECK(!inserted);
+	BOOST_CHECK(again == a);
+
+	Registry::Handle b = registry.acquire(makeKey(2));
+	BOOST_CHECK(b.index == 1);
+	BOOST_CHECK(registry.size() == 2);
+	BOOST_CHECK(registry.capacity() == 2);
+
+	Registry::Handle found;
+	BOOST_CHECK(registry.find(makeKey(2), found));
+	BOOST_CHECK(found == b);
+	BOOST_CHECK(!registry.find(makeKey(3), found));
+
+	UUID id;
+	BOOST_CHECK(registry.getUUID(a, id));
+	BOOST_CHECK(id == makeKey(1));
+}
+
+BOOST_AUTO_TEST_CASE( UUIDIndexRegistryTestCase2 )
+{
+	// released indices are reused, and the old handles are stale for good
+	Registry registry;
+	Registry::Handle a = registry.acquire(makeKey(1));
+	Registry::Handle b = registry.acquire(makeKey(2));
+
+	BOOST_CHECK(registry.release(makeKey(1)));
+	BOOST_CHECK(!registry.release(makeKey(1)));
+	BOOST_CHECK(!registry.valid(a));
+	BOOST_CHECK(registry.valid(b));
+	BOOST_CHECK(registry.size() == 1);
+
+	Registry::Handle c = registry.acquire(makeKey(3));
+	BOOST_CHECK(c.index == a.index);
+	BOOST_CHECK(c.generation != a.generation);
+	BOOST_CHECK(!registry.valid(a));
+	BOOST_CHECK(registry.valid(c));
+	BOOST_CHECK(registry.capacity() == 2);
+
+	UUID id;
+	BOOST_CHECK(!registry.getUUID(a, id));
+	BOOST_CHECK(registry.getUUID(c, id));
+	BOOST_CHECK(id == makeKey(3));
+
+	// a stale handle releases nothing
+	BOOST_CHECK(!registry.release(a));
+	BOOST_CHECK(registry.valid(c));
+	BOOST_CHECK(registry.release(c));
+	BOOST_CHECK(!registry.release(c));
+	Registry::Handle found;
+	BOOST_CHECK(!registry.find(makeKey(3), found));
+	BOOST_CHECK(registry.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE( UUIDIndexRegistryTestCase3 )
+{
+	// indices stay dense across many segments
+	const uint64 count = 100000;
+	Registry registry;
+	for(uint64 i = 0; i < count; ++i)
+		BOOST_REQUIRE(registry.acquire(makeKey(i)).index == i);
+	BOOST_CHECK(registry.capacity() == count);
+
+	for(uint64 i = 0; i < count; i += 2)
+		BOOST_REQUIRE(registry.release(makeKey(i)));
+	BOOST_CHECK(registry.size() == count / 2);
+
+	std::vector<bool> used(count, false);
+	for(uint64 i = 0; i < count; i += 2)
+	{
+		Registry::Handle h = registry.acquire(makeKey(count + i));
+		BOOST_REQUIRE(h.index < count);
+		BOOST_REQUIRE(h.index % 2 == 0);
+		BOOST_REQUIRE(!used[h.index]);
+		used[h.index] = true;
+	}
+	BOOST_CHECK(registry.capacity() == count);
+
+	for(uint64 i = 1; i < count; i += 2)
+	{
+		Registry::Handle h;
+		UUID id;
+		BOOST_REQUIRE(registry.find(makeKey(i), h));
+		BOOST_REQUIRE(h.index == i);
+		BOOST_REQUIRE(registry.getUUID(h, id));
+		BOOST_REQUIRE(id == makeKey(i));
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UUIDIndexRegistryTestCase4 )
+{
+	// threads churn their own keys while readers check handles of the others
+	const int threads = 4;
+	const uint64 keys = 2000;
+	const int rounds = 20;
+	Registry registry;
+
+	std::atomic<int> failures(0);
+	boost::thread_group group;
+	for(int t = 0; t < threads; ++t)
+	{
+		group.create_thread([&, t] {
+			std::vector<Registry::Handle> handles(keys);
+			for(int r = 0; r < rounds; ++r)
+			{
+				for(uint64 k = 0; k < keys; ++k)
+					handles[k] = registry.acquire(makeKey(t * keys + k));
+				for(uint64 k = 0; k < keys; ++k)
+				{
+					UUID id;
+					if(!registry.valid(handles[k]) || !registry.getUUID(handles[k], id) || id != makeKey(t * keys + k))
+						++failures;
+
+					// a foreign handle is either live with its own key, or stale
+					Registry::Handle other;
+					if(registry.find(makeKey(((t + 1) % threads) * keys + k), other) && registry.getUUID(other, id) && id != makeKey(((t + 1) % threads) * keys + k))
+						++failures;
+				}
+				for(uint64 k = 0; k < keys; ++k)
+				{
+					if(!registry.release(handles[k]) || registry.valid(handles[k]))
+						++failures;
+				}
+			}
+		});
+	}
+	group.join_all();
+
+	BOOST_CHECK(failures == 0);
+	BOOST_CHECK(registry.size() == 0);
+	BOOST_CHECK(registry.capacity() <= (std::size_t)(threads * keys));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
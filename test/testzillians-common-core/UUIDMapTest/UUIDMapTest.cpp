@@ -0,0 +1,211 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/UUIDMap.h"
+#include <boost/thread.hpp>
+#include <map>
+#include <vector>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE UUIDMapTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( UUIDMapTest )
+
+/**
+ * Generate distinct keys without going through APR, so failures can be reproduced.
+ */
+static UUID makeKey(uint64 i)
+{
+	UUID id;
+	id.data.u64[0] = i * 0x2545F4914F6CDD1DULL + 0x12345;
+	id.data.u64[1] = (i >> 3) ^ 0x5DEECE66DULL;
+	return id;
+}
+
+BOOST_AUTO_TEST_CASE( UUIDMapTestCase1 )
+{
+	UUIDMap<int> m;
+	BOOST_CHECK(m.empty());
+	BOOST_CHECK(m.find(makeKey(0)) == m.end());
+	BOOST_CHECK(m.erase(makeKey(0)) == 0);
+	BOOST_CHECK(m.begin() == m.end());
+
+	for(int i = 0; i < 10000; ++i)
+	{
+		BOOST_CHECK(m.insert(std::make_pair(makeKey(i), i)).second);
+	}
+	BOOST_CHECK(m.size() == 10000);
+	BOOST_CHECK(!m.insert(std::make_pair(makeKey(42), -1)).second);
+	BOOST_CHECK(m.find(makeKey(42))->second == 42);
+
+	for(int i = 0; i < 10000; ++i)
+	{
+		UUIDMap<int>::iterator it = m.find(makeKey(i));
+		BOOST_REQUIRE(it != m.end());
+		BOOST_CHECK(it->second == i);
+	}
+	for(int i = 10000; i < 20000; ++i)
+	{
+		BOOST_CHECK(m.count(makeKey(i)) == 0);
+	}
+
+	std::size_t n = 0;
+	for(UUIDMap<int>::const_iterator it = m.begin(); it != m.end(); ++it)
+	{
+		++n;
+	}
+	BOOST_CHECK(n == 10000);
+
+	for(int i = 0; i < 10000; i += 2)
+	{
+		BOOST_CHECK(m.erase(makeKey(i)) == 1);
+	}
+	BOOST_CHECK(m.size() == 5000);
+	for(int i = 0; i < 10000; ++i)
+	{
+		BOOST_CHECK(m.count(makeKey(i)) == (std::size_t)(i % 2));
+	}
+
+	m[makeKey(1)] = 100;
+	m[makeKey(0)] = 200;
+	BOOST_CHECK(m.find(makeKey(1))->second == 100);
+	BOOST_CHECK(m.find(makeKey(0))->second == 200);
+
+	m.clear();
+	BOOST_CHECK(m.empty());
+	BOOST_CHECK(m.find(makeKey(1)) == m.end());
+	BOOST_CHECK(m.begin() == m.end());
+}
+
+// random insertions and removals against std::map, which stress the tombstones
+BOOST_AUTO_TEST_CASE( UUIDMapTestCase2 )
+{
+	UUIDMap<std::string> m;
+	std::map<UUID, std::string> reference;
+
+	std::srand(1);
+	for(int i = 0; i < 200000; ++i)
+	{
+		UUID key = makeKey(std::rand() % 2000);
+		switch(std::rand() % 3)
+		{
+		case 0:
+		{
+			std::string value(1 + std::rand() % 32, 'x');
+			BOOST_CHECK(m.insert(std::make_pair(key, value)).second == reference.insert(std::make_pair(key, value)).second);
+			break;
+		}
+		case 1:
+			BOOST_CHECK(m.erase(key) == reference.erase(key));
+			break;
+		default:
+		{
+			UUIDMap<std::string>::iterator it = m.find(key);
+			std::map<UUID, std::string>::iterator ref = reference.find(key);
+			BOOST_REQUIRE((it == m.end()) == (ref == reference.end()));
+			if(ref != reference.end())
+				BOOST_CHECK(it->second == ref->second);
+			break;
+		}
+		}
+	}
+	BOOST_CHECK(m.size() == reference.size());
+
+	// erasing through iterators and copying keep everything else in place
+	for(UUIDMap<std::string>::iterator it = m.begin(); it != m.end(); )
+	{
+		UUIDMap<std::string>::iterator current = it++;
+		if(current->second.size() % 2)
+		{
+			reference.erase(current->first);
+			m.erase(current);
+		}
+	}
+	UUIDMap<std::string> copy(m);
+	BOOST_CHECK(copy.size() == reference.size());
+	for(std::map<UUID, std::string>::iterator ref = reference.begin(); ref != reference.end(); ++ref)
+	{
+		BOOST_REQUIRE(copy.find(ref->first) != copy.end());
+		BOOST_CHECK(copy.find(ref->first)->second == ref->second);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UUIDMapTestCase3 )
+{
+	UUIDMap<int> m(1000);
+	std::size_t capacity = m.capacity();
+	BOOST_CHECK(capacity >= 1000);
+	for(int i = 0; i < 1000; ++i)
+		m[makeKey(i)] = i;
+	BOOST_CHECK(m.capacity() == capacity);
+
+	// churn on a fixed number of elements must not grow the table
+	for(int round = 0; round < 100; ++round)
+	{
+		for(int i = 0; i < 1000; ++i)
+			BOOST_CHECK(m.erase(makeKey(round * 1000 + i)) == 1);
+		for(int i = 0; i < 1000; ++i)
+			m[makeKey((round + 1) * 1000 + i)] = i;
+	}
+	BOOST_CHECK(m.size() == 1000);
+	BOOST_CHECK(m.capacity() == capacity);
+}
+
+static void concurrentWorker(ConcurrentUUIDMap<int>* m, int id, int count, bool* failed)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		UUID key = makeKey(id * count + i);
+		if(!m->insert(key, i)) *failed = true;
+		int value = -1;
+		if(!m->find(key, value) || value != i) *failed = true;
+		if((i % 2) && !m->erase(key)) *failed = true;
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UUIDMapTestCase4 )
+{
+	const int threads = 8;
+	const int count = 20000;
+
+	ConcurrentUUIDMap<int> m;
+	bool failed[threads] = { false };
+
+	boost::thread_group group;
+	for(int i = 0; i < threads; ++i)
+		group.create_thread(boost::bind(concurrentWorker, &m, i, count, &failed[i]));
+	group.join_all();
+
+	for(int i = 0; i < threads; ++i)
+		BOOST_CHECK(!failed[i]);
+	BOOST_CHECK(m.size() == (std::size_t)(threads * count / 2));
+	for(int i = 0; i < threads * count; ++i)
+		BOOST_CHECK(m.contains(makeKey(i)) == ((i % count) % 2 == 0));
+
+	m.clear();
+	BOOST_CHECK(m.size() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,232 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/UringReceiver.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define BOOST_TEST_MODULE UringReceiverTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( UringReceiverTest )
+
+struct SocketPair
+{
+	SocketPair()
+	{
+		int fds[2];
+		BOOST_REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		reader = fds[0];
+		writer = fds[1];
+	}
+
+	~SocketPair()
+	{
+		::close(reader);
+		if(writer >= 0) ::close(writer);
+	}
+
+	void send(const string& data)
+	{
+		BOOST_REQUIRE(::write(writer, data.data(), data.size()) == (ssize_t)data.size());
+	}
+
+	void shutdown()
+	{
+		::close(writer);
+		writer = -1;
+	}
+
+	int reader;
+	int writer;
+};
+
+template<typename BufferType>
+void drain(BufferType& buffer, string& received)
+{
+	std::vector<std::pair<byte*,std::size_t> > ranges;
+	std::size_t size = buffer.getDataRanges(ranges);
+	for(std::size_t i = 0; i < ranges.size(); ++i)
+		received.append((const char*)ranges[i].first, ranges[i].second);
+	buffer.rskip(size);
+}
+
+string pattern(int seed, std::size_t size)
+{
+	string s(size, 0);
+	for(std::size_t i = 0; i < size; ++i)
+		s[i] = (char)('a' + (seed * 7 + i) % 26);
+	return s;
+}
+
+BOOST_AUTO_TEST_CASE( UringReceiverTestCase1 )
+{
+	if(!UringReceiver::isSupported())
+	{
+		BOOST_TEST_MESSAGE("io_uring is not supported, skipped");
+		return;
+	}
+
+	// many sockets, each receiving several chunks into a plain buffer
+	const int sockets = 32;
+	const int chunks = 8;
+	const std::size_t chunk_size = 1000;
+
+	std::vector<SocketPair*> pairs;
+	std::vector<Buffer*> buffers;
+	std::vector<string> received(sockets);
+
+	{
+		UringReceiver receiver(16);
+		for(int i = 0; i < sockets; ++i)
+		{
+			pairs.push_back(new SocketPair);
+			buffers.push_back(new Buffer(chunks * chunk_size));
+			BOOST_CHECK(receiver.add(pairs[i]->reader, *buffers[i]) == (uint32)i);
+		}
+		receiver.start();
+
+		for(int c = 0; c < chunks; ++c)
+			for(int i = 0; i < sockets; ++i)
+				pairs[i]->send(pattern(i + c, chunk_size));
+
+		std::size_t total = 0;
+		std::vector<UringReceiver::Completion> completions;
+		while(total < sockets * chunks * chunk_size)
+		{
+			completions.clear();
+			BOOST_REQUIRE(receiver.poll(completions) > 0);
+			for(std::size_t i = 0; i < completions.size(); ++i)
+			{
+				BOOST_REQUIRE(completions[i].result > 0);
+				total += completions[i].result;
+				drain(*buffers[completions[i].id], received[completions[i].id]);
+			}
+		}
+		BOOST_CHECK(total == sockets * chunks * chunk_size);
+		BOOST_TEST_MESSAGE("registered = " << receiver.isRegistered() << ", io_uring_enter calls = " << receiver.getEnterCount());
+	}
+
+	for(int i = 0; i < sockets; ++i)
+	{
+		string expected;
+		for(int c = 0; c < chunks; ++c)
+			expected += pattern(i + c, chunk_size);
+		BOOST_CHECK(received[i] == expected);
+
+		delete pairs[i];
+		delete buffers[i];
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UringReceiverTestCase2 )
+{
+	if(!UringReceiver::isSupported())
+		return;
+
+	// reads into a circular buffer wrap around its end
+	SocketPair pair;
+	CircularBuffer buffer(64);
+	UringReceiver receiver;
+	receiver.add(pair.reader, buffer);
+	receiver.start();
+
+	string sent;
+	string received;
+	std::vector<UringReceiver::Completion> completions;
+	for(int i = 0; i < 20; ++i)
+	{
+		string chunk = pattern(i, 10 + (i * 13) % 50);
+		pair.send(chunk);
+		sent += chunk;
+
+		while(received.size() + buffer.dataSize() < sent.size())
+		{
+			completions.clear();
+			BOOST_REQUIRE(receiver.poll(completions) > 0);
+			BOOST_REQUIRE(completions[0].result > 0);
+			drain(buffer, received);
+			receiver.resume(0);
+		}
+		drain(buffer, received);
+		receiver.resume(0);
+	}
+	BOOST_CHECK(received == sent);
+}
+
+BOOST_AUTO_TEST_CASE( UringReceiverTestCase3 )
+{
+	if(!UringReceiver::isSupported())
+		return;
+
+	// a full buffer stalls the socket until resume(), then the end of stream closes it
+	SocketPair pair;
+	Buffer buffer(16);
+	UringReceiver receiver;
+	receiver.add(pair.reader, buffer);
+	receiver.start();
+
+	string sent = pattern(0, 40);
+	pair.send(sent);
+
+	string received;
+	std::vector<UringReceiver::Completion> completions;
+	while(buffer.freeSize() > 0)
+	{
+		completions.clear();
+		BOOST_REQUIRE(receiver.poll(completions) > 0);
+		BOOST_REQUIRE(completions[0].result > 0);
+	}
+	BOOST_CHECK(buffer.dataSize() == 16);
+	BOOST_CHECK(receiver.resume(0) == false);
+
+	completions.clear();
+	BOOST_CHECK(receiver.poll(completions, false) == 0);
+
+	drain(buffer, received);
+	BOOST_CHECK(receiver.resume(0));
+
+	pair.shutdown();
+	bool closed = false;
+	while(!closed)
+	{
+		completions.clear();
+		BOOST_REQUIRE(receiver.poll(completions) > 0);
+		for(std::size_t i = 0; i < completions.size(); ++i)
+		{
+			BOOST_REQUIRE(completions[i].result >= 0);
+			if(completions[i].result == 0)
+				closed = true;
+		}
+		drain(buffer, received);
+		receiver.resume(0);
+	}
+	BOOST_CHECK(receiver.isClosed(0));
+	BOOST_CHECK(receiver.resume(0) == false);
+	BOOST_CHECK(received == sent);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -25,6 +25,9 @@
 #include <iostream>
 #include <string>
 #include <limits>
+#include <atomic>
+#include <algorithm>
+#include <functional>
 #include <tbb/tick_count.h>
 
 #define BOOST_TEST_MODULE VisitorTest
@@ -116,6 +119,178 @@ public:
 	CREATE_INVOKER(CloneInvoker, clone)
 };
 
+// a hierarchy with a declared visitable list, dispatched through fixed-size tables
+class Node;
+class Leaf;
+class Branch;
+class Unregistered;
+ZILLIANS_VISITABLE_LIST(Node, Node, Leaf, Branch, Unregistered)
+
+class Node : public VisitableBase<Node> {
+public:
+	DEFINE_VISITABLE();
+	virtual ~Node() { }
+};
+
+class Leaf : public Node {
+public:
+	DEFINE_VISITABLE();
+
+	explicit Leaf(int _id) : id(_id) { }
+	int id;
+};
+
+class Branch : public Node {
+public:
+	DEFINE_VISITABLE();
+
+	explicit Branch(int _id) : id(_id) { }
+	int id;
+	std::vector<Node*> children;
+};
+
+class Unregistered : public Node {
+public:
+	DEFINE_VISITABLE();
+};
+
+template<VisitorImplementation Impl>
+class OrderCollector : public Visitor<const Node, void, Impl>
+{
+public:
+	typedef typename Visitor<const Node, void, Impl>::ReturnT ReturnT;
+
+	OrderCollector() : fallbacks(0)
+	{
+		REGISTER_VISITABLE(CollectInvoker, Node, Leaf, Branch);
+	}
+
+	void collect(const Node&)
+	{
+		++fallbacks;
+	}
+
+	void collect(const Leaf& leaf)
+	{
+		order.push_back(leaf.id);
+	}
+
+	void collect(const Branch& branch)
+	{
+		order.push_back(branch.id);
+		for(std::size_t i = 0; i < branch.children.size(); ++i)
+			this->visit(*branch.children[i]);
+	}
+
+	CREATE_INVOKER(CollectInvoker, collect)
+
+	std::vector<int> order;
+	int fallbacks;
+};
+
+class ShapeCounter : public Visitor<const Shape, void>
+{
+public:
+	ShapeCounter() : count(0)
+	{
+		REGISTER_VISITABLE(CountInvoker, Shape, Circle, CircleX);
+	}
+
+	void count_shape(const Shape&) { ++count; }
+	void count_shape(const Circle&) { ++count; }
+	void count_shape(const CircleX&) { ++count; }
+
+	CREATE_INVOKER(CountInvoker, count_shape)
+
+	std::size_t count;
+};
+
+class NodeCounter : public Visitor<const Node, void>
+{
+public:
+	NodeCounter() : count(0)
+	{
+		REGISTER_VISITABLE(CountInvoker, Node, Leaf, Branch);
+	}
+
+	void count_node(const Node&) { ++count; }
+	void count_node(const Leaf&) { ++count; }
+	void count_node(const Branch&) { ++count; }
+
+	CREATE_INVOKER(CountInvoker, count_node)
+
+	std::size_t count;
+};
+
+class ConcurrentNodeCounter : public Visitor<const Node, void>
+{
+public:
+	ConcurrentNodeCounter() : nodes(0), leaves(0), branches(0)
+	{
+		REGISTER_VISITABLE(CountInvoker, Node, Leaf, Branch);
+	}
+
+	void count_node(const Node&) { ++nodes; }
+	void count_node(const Leaf&) { ++leaves; }
+	void count_node(const Branch&) { ++branches; }
+
+	CREATE_INVOKER(CountInvoker, count_node)
+
+	std::atomic<std::size_t> nodes;
+	std::atomic<std::size_t> leaves;
+	std::atomic<std::size_t> branches;
+};
+
+class ParallelSum : public Visitor<const Node, long, VisitorImplementation::parallel_dfs>
+{
+public:
+	explicit ParallelSum(std::size_t grain) : Visitor<const Node, long, VisitorImplementation::parallel_dfs>(grain), fallbacks(0)
+	{
+		REGISTER_VISITABLE(SumInvoker, Node, Leaf, Branch);
+	}
+
+	long sum(const Node&)
+	{
+		++fallbacks;
+		return 0;
+	}
+
+	long sum(const Leaf& leaf)
+	{
+		return leaf.id;
+	}
+
+	long sum(const Branch& branch)
+	{
+		return branch.id + visit_all(branch.children.begin(), branch.children.end(), 0L, std::plus<long>());
+	}
+
+	CREATE_INVOKER(SumInvoker, sum)
+
+	std::atomic<int> fallbacks;
+};
+
+class ParallelMarker : public Visitor<const Node, void, VisitorImplementation::parallel_dfs>
+{
+public:
+	ParallelMarker() : visited(0)
+	{
+		REGISTER_VISITABLE(MarkInvoker, Node, Leaf, Branch);
+	}
+
+	void mark(const Node&) { ++visited; }
+	void mark(const Leaf&) { ++visited; }
+	void mark(const Branch& branch)
+	{
+		++visited;
+		visit_all(branch.children.begin(), branch.children.end());
+	}
+
+	CREATE_VOID_INVOKER(MarkInvoker, mark)
+
+	std::atomic<std::size_t> visited;
+};
+
 BOOST_AUTO_TEST_SUITE( VisitorTestSuite )
 
 BOOST_AUTO_TEST_CASE( VisitorTestCase1 )
@@ -140,4 +315,256 @@ BOOST_AUTO_TEST_CASE( VisitorTestCase2 )
 	renderer.visit(c);
 }
 
+BOOST_AUTO_TEST_CASE( VisitorTestCase3 )
+{
+	// static tags are the positions in the visitable list
+	Leaf leaf(0);
+	Branch branch(0);
+	Unregistered unregistered;
+	BOOST_CHECK(leaf._tag() == 1);
+	BOOST_CHECK(branch._tag() == 2);
+	BOOST_CHECK(unregistered._tag() == 3);
+
+	//        1
+	//     /  |  \
+	//    2   5   6
+	//   / \      |
+	//  3   4     7 (unregistered sibling of 7 goes to the Node fallback)
+	Branch b1(1), b2(2), b6(6);
+	Leaf l3(3), l4(4), l5(5), l7(7);
+	b1.children.push_back(&b2); b1.children.push_back(&l5); b1.children.push_back(&b6);
+	b2.children.push_back(&l3); b2.children.push_back(&l4);
+	b6.children.push_back(&l7); b6.children.push_back(&unregistered);
+
+	OrderCollector<VisitorImplementation::recursive_dfs> recursive;
+	recursive.visit(b1);
+
+	OrderCollector<VisitorImplementation::iterative_dfs> iterative;
+	iterative.visit(b1);
+
+	int expected[] = { 1, 2, 3, 4, 5, 6, 7 };
+	BOOST_CHECK(recursive.order == std::vector<int>(expected, expected + 7));
+	BOOST_CHECK(iterative.order == recursive.order);
+	BOOST_CHECK(recursive.fallbacks == 1);
+	BOOST_CHECK(iterative.fallbacks == 1);
+}
+
+BOOST_AUTO_TEST_CASE( VisitorTestCase4 )
+{
+	// a chain deep enough to blow the stack if visited recursively
+	const int depth = 1000000;
+	std::vector<Branch*> chain;
+	for(int i = 0; i < depth; ++i)
+	{
+		chain.push_back(new Branch(i));
+		if(i > 0)
+			chain[i - 1]->children.push_back(chain[i]);
+	}
+
+	OrderCollector<VisitorImplementation::iterative_dfs> iterative;
+	iterative.visit(*chain[0]);
+	BOOST_CHECK(iterative.order.size() == (std::size_t)depth);
+	BOOST_CHECK(iterative.order.back() == depth - 1);
+
+	for(int i = 0; i < depth; ++i)
+		delete chain[i];
+}
+
+BOOST_AUTO_TEST_CASE( VisitorTestCase5 )
+{
+	const int count = 1000000;
+	const int rounds = 10;
+
+	std::vector<Shape*> shapes;
+	std::vector<Node*> nodes;
+	for(int i = 0; i < count; ++i)
+	{
+		if(i % 2) shapes.push_back(new Circle); else shapes.push_back(new CircleX);
+		if(i % 2) nodes.push_back(new Leaf(i)); else nodes.push_back(new Branch(i));
+	}
+
+	ShapeCounter shape_counter;
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		for(int i = 0; i < count; ++i)
+			shape_counter.visit(*shapes[i]);
+	double dynamic_time = (tbb::tick_count::now() - start).seconds();
+
+	NodeCounter node_counter;
+	start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		for(int i = 0; i < count; ++i)
+			node_counter.visit(*nodes[i]);
+	double static_time = (tbb::tick_count::now() - start).seconds();
+
+	BOOST_CHECK(shape_counter.count == (std::size_t)count * rounds);
+	BOOST_CHECK(node_counter.count == (std::size_t)count * rounds);
+	printf("dynamic tags: %.2f ns/visit, static tags: %.2f ns/visit\n",
+			dynamic_time * 1e9 / ((double)count * rounds), static_time * 1e9 / ((double)count * rounds));
+
+	for(int i = 0; i < count; ++i)
+	{
+		delete shapes[i];
+		delete nodes[i];
+	}
+}
+
+BOOST_AUTO_TEST_CASE( VisitorTestCase6 )
+{
+	std::vector<Node*> nodes;
+	for(int i = 0; i < 12; ++i)
+	{
+		switch(i % 3)
+		{
+		case 0: nodes.push_back(new Branch(i)); break;
+		case 1: nodes.push_back(new Leaf(i)); break;
+		default: nodes.push_back(new Unregistered); break;
+		}
+	}
+
+	// grouped by tag, which is the position in the visitable list: leaves, then branches, then the rest
+	OrderCollector<VisitorImplementation::recursive_dfs> collector;
+	collector.visit_batch(nodes.begin(), nodes.end());
+	int expected[] = { 1, 4, 7, 10, 0, 3, 6, 9 };
+	BOOST_CHECK_EQUAL_COLLECTIONS(collector.order.begin(), collector.order.end(), expected, expected + 8);
+	BOOST_CHECK_EQUAL(collector.fallbacks, 4);
+
+	// buffers are reused by the next batch
+	collector.order.clear();
+	collector.visit_batch(nodes.begin(), nodes.begin() + 3);
+	BOOST_CHECK_EQUAL(collector.order.size(), 2u);
+	BOOST_CHECK_EQUAL(collector.fallbacks, 5);
+
+	collector.order.clear();
+	collector.visit_batch(nodes.end(), nodes.end());
+	BOOST_CHECK(collector.order.empty());
+
+	for(std::size_t i = 0; i < nodes.size(); ++i)
+		delete nodes[i];
+
+	// run time tags work the same
+	Circle circle;
+	CircleX circle_x;
+	Shape shape;
+	std::vector<Shape*> shapes;
+	shapes.push_back(&circle);
+	shapes.push_back(&circle_x);
+	shapes.push_back(&shape);
+	shapes.push_back(&circle);
+
+	ShapeCounter shape_counter;
+	shape_counter.visit_batch(shapes.begin(), shapes.end());
+	BOOST_CHECK_EQUAL(shape_counter.count, 4u);
+}
+
+BOOST_AUTO_TEST_CASE( VisitorTestCase7 )
+{
+	const int count = 1000000;
+	const int rounds = 10;
+
+	std::vector<Node*> nodes;
+	for(int i = 0; i < count; ++i)
+	{
+		switch(rand() % 3)
+		{
+		case 0: nodes.push_back(new Branch(i)); break;
+		case 1: nodes.push_back(new Leaf(i)); break;
+		default: nodes.push_back(new Unregistered); break;
+		}
+	}
+
+	ConcurrentNodeCounter one_by_one;
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		for(int i = 0; i < count; ++i)
+			one_by_one.visit(*nodes[i]);
+	double one_by_one_time = (tbb::tick_count::now() - start).seconds();
+
+	ConcurrentNodeCounter batch;
+	start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		batch.visit_batch(nodes.begin(), nodes.end());
+	double batch_time = (tbb::tick_count::now() - start).seconds();
+
+	// the list doesn't change between rounds, so bucket it only once
+	visitor::batch<const Node> bucketed;
+	bucketed.assign(nodes.begin(), nodes.end());
+	BOOST_CHECK_EQUAL(bucketed.size(), (std::size_t)count);
+
+	ConcurrentNodeCounter reused;
+	start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		reused.visit_batch(bucketed);
+	double reused_time = (tbb::tick_count::now() - start).seconds();
+
+	ConcurrentNodeCounter parallel;
+	start = tbb::tick_count::now();
+	for(int r = 0; r < rounds; ++r)
+		parallel.visit_batch_parallel(bucketed);
+	double parallel_time = (tbb::tick_count::now() - start).seconds();
+
+	BOOST_CHECK_EQUAL(one_by_one.nodes + one_by_one.leaves + one_by_one.branches, (std::size_t)count * rounds);
+	BOOST_CHECK_EQUAL(batch.nodes.load(), one_by_one.nodes.load());
+	BOOST_CHECK_EQUAL(batch.leaves.load(), one_by_one.leaves.load());
+	BOOST_CHECK_EQUAL(batch.branches.load(), one_by_one.branches.load());
+	BOOST_CHECK_EQUAL(reused.nodes.load(), one_by_one.nodes.load());
+	BOOST_CHECK_EQUAL(reused.leaves.load(), one_by_one.leaves.load());
+	BOOST_CHECK_EQUAL(reused.branches.load(), one_by_one.branches.load());
+	BOOST_CHECK_EQUAL(parallel.nodes.load(), one_by_one.nodes.load());
+	BOOST_CHECK_EQUAL(parallel.leaves.load(), one_by_one.leaves.load());
+	BOOST_CHECK_EQUAL(parallel.branches.load(), one_by_one.branches.load());
+	double visits = (double)count * rounds;
+	printf("one by one: %.2f ns/visit, batch: %.2f ns/visit, reused batch: %.2f ns/visit, parallel reused batch: %.2f ns/visit\n",
+			one_by_one_time * 1e9 / visits, batch_time * 1e9 / visits, reused_time * 1e9 / visits, parallel_time * 1e9 / visits);
+
+	for(int i = 0; i < count; ++i)
+		delete nodes[i];
+}
+
+BOOST_AUTO_TEST_CASE( VisitorTestCase8 )
+{
+	// three levels of wide branches with leaves at the bottom
+	std::vector<Node*> all;
+	int id = 0;
+	long expected = 0;
+	Branch* root = new Branch(id++);
+	all.push_back(root);
+	for(int i = 0; i < 16; ++i)
+	{
+		Branch* branch = new Branch(id);
+		expected += id++;
+		root->children.push_back(branch);
+		all.push_back(branch);
+		for(int j = 0; j < 64; ++j)
+		{
+			Node* child = (j % 8 == 7) ? (Node*)new Unregistered : (Node*)new Leaf(id);
+			if(j % 8 != 7) expected += id;
+			++id;
+			branch->children.push_back(child);
+			all.push_back(child);
+		}
+	}
+
+	ParallelSum sum(1);
+	BOOST_CHECK_EQUAL(sum.visit(*root), expected);
+	BOOST_CHECK_EQUAL(sum.fallbacks.load(), 16 * 8);
+
+	// a grain larger than any node visits everything serially, with the same result
+	ParallelSum serial_sum(1000);
+	BOOST_CHECK_EQUAL(serial_sum.visit(*root), expected);
+
+	ParallelMarker marker;
+	marker.visit(*root);
+	BOOST_CHECK_EQUAL(marker.visited.load(), all.size());
+
+	marker.terminate();
+	marker.visited = 0;
+	marker.visit(*root);
+	BOOST_CHECK_EQUAL(marker.visited.load(), 0u);
+	marker.reset();
+
+	for(std::size_t i = 0; i < all.size(); ++i)
+		delete all[i];
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -25,7 +25,10 @@
 #include <iostream>
 #include <string>
 #include <limits>
+#include <vector>
+#include <stdexcept>
 #include <tbb/tick_count.h>
+#include <tbb/atomic.h>
 
 #define BOOST_TEST_MODULE WorkerTest
 #define BOOST_TEST_MAIN
@@ -78,6 +81,127 @@ BOOST_AUTO_TEST_CASE( WorkerTestCase3 )
 	}
 	BOOST_CHECK(counter == 5000);
 }
+
+void block(tbb::atomic<bool>* released)
+{
+	while(!*released)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+}
+
+BOOST_AUTO_TEST_CASE( WorkerTestCase4 )
+{
+	Worker worker;
+
+	// far more outstanding calls than the former fixed slot table allowed
+	int counter = 0;
+	std::vector<WorkerFuture> keys;
+	for(int i=0;i<20000;++i)
+	{
+		keys.push_back(worker.async(boost::bind(increment, &counter)));
+	}
+	for(std::size_t i=0;i<keys.size();++i)
+	{
+		worker.wait(keys[i]);
+		BOOST_CHECK(keys[i].is_ready());
+	}
+	BOOST_CHECK(counter == 20000);
+}
+
+BOOST_AUTO_TEST_CASE( WorkerTestCase5 )
+{
+	Worker worker;
+
+	tbb::atomic<bool> released; released = false;
+	int counter = 0;
+
+	WorkerFuture blocker = worker.async(boost::bind(block, &released));
+	WorkerFuture cancelled = worker.async(boost::bind(increment, &counter));
+
+	// the second call can't start while the first one is blocked
+	BOOST_CHECK(!worker.timed_wait(blocker, boost::posix_time::milliseconds(50)));
+	BOOST_CHECK(cancelled.cancel());
+	BOOST_CHECK(cancelled.is_ready());
+
+	released = true;
+	BOOST_CHECK(worker.timed_wait(blocker, boost::posix_time::seconds(10)));
+	worker.dispatch(boost::bind(increment, &counter), true);
+	BOOST_CHECK(counter == 1);
+	BOOST_CHECK(!blocker.cancel());
+}
+
+void record(std::vector<int>* order, int value)
+{
+	order->push_back(value);
+}
+
+void fail()
+{
+	throw std::runtime_error("failed");
+}
+
+BOOST_AUTO_TEST_CASE( WorkerTestCase8 )
+{
+	Worker worker;
+
+	std::vector<int> order;
+	std::vector<boost::function<void()> > handlers;
+	for(int i=0;i<1000;++i)
+	{
+		handlers.push_back(boost::bind(record, &order, i));
+	}
+	// a throwing handler doesn't take the rest of the batch with it
+	handlers.insert(handlers.begin() + 500, &fail);
+
+	worker.post_batch(handlers.begin(), handlers.end());
+	worker.post(boost::bind(record, &order, 1000));
+	worker.dispatch(boost::bind(record, &order, 1001), true);
+
+	BOOST_REQUIRE(order.size() == 1002);
+	for(int i=0;i<1002;++i)
+	{
+		BOOST_CHECK(order[i] == i);
+	}
+}
+
+void stage(Worker* worker, Worker* other, std::vector<int>* order, std::vector<int>* seen)
+{
+	for(int i=0;i<200;++i)
+	{
+		worker->post(boost::bind(record, order, i));
+		other->post(boost::bind(record, seen, i));
+	}
+
+	// what is staged for other goes out before the blocking call
+	other->dispatch(boost::bind(record, seen, 200), true);
+
+	// nothing staged for this worker has run yet
+	order->push_back(-1);
+}
+
+BOOST_AUTO_TEST_CASE( WorkerTestCase9 )
+{
+	Worker worker;
+	Worker other;
+
+	std::vector<int> order;
+	std::vector<int> seen;
+	worker.post(boost::bind(stage, &worker, &other, &order, &seen), true);
+	worker.dispatch(boost::bind(record, &order, 200), true);
+
+	BOOST_REQUIRE(order.size() == 202);
+	BOOST_CHECK(order[0] == -1);
+	for(int i=0;i<=200;++i)
+	{
+		BOOST_CHECK(order[i + 1] == i);
+	}
+
+	other.dispatch(boost::bind(record, &seen, 201), true);
+	BOOST_REQUIRE(seen.size() == 202);
+	for(int i=0;i<202;++i)
+	{
+		BOOST_CHECK(seen[i] == i);
+	}
+}
 //
 //BOOST_AUTO_TEST_CASE( WorkerTestCase6 )
 //{
@@ -87,7 +211,7 @@ BOOST_AUTO_TEST_CASE( WorkerTestCase3 )
 //	int counter = 0;
 //	for(int i=0;i<5000;++i)
 //	{
-//		int key = GlobalWorker::instance()->async(boost::bind(increment, &counter));
+//		WorkerFuture key = GlobalWorker::instance()->async(boost::bind(increment, &counter));
 //		GlobalWorker::instance()->wait(key);
 //		BOOST_CHECK(counter == i+1);
 //	}
@@ -100,7 +224,7 @@ BOOST_AUTO_TEST_CASE( WorkerTestCase3 )
 //	int counter = 0;
 //	for(int i=0;i<5000;++i)
 //	{
-//		int key = group.async(boost::bind(increment, &counter));
+//		WorkerFuture key = group.async(boost::bind(increment, &counter));
 //		group.wait(key);
 //		BOOST_CHECK(counter == i+1);
 //	}
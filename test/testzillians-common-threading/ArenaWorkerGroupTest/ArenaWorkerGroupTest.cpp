@@ -0,0 +1,147 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/ArenaWorkerGroup.h"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <vector>
+
+#define BOOST_TEST_MODULE ArenaWorkerGroupTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( ArenaWorkerGroupTest )
+
+namespace {
+
+void increment(std::atomic<int>* counter)
+{
+	++(*counter);
+}
+
+void spawn(ArenaWorkerGroup* group, std::atomic<int>* counter, int depth)
+{
+	++(*counter);
+	if(depth > 0)
+	{
+		group->post(boost::bind(spawn, group, counter, depth - 1));
+		group->post(boost::bind(spawn, group, counter, depth - 1));
+	}
+}
+
+const std::size_t numParallelItems = 1000000;
+
+/**
+ * Sum up the items with a parallel_for, recording the concurrency and the
+ * slots of the arena the chunks ran in.
+ */
+void sum(const std::vector<int>* items, std::atomic<long long>* total, std::atomic<int>* concurrency, std::atomic<int>* maxSlot)
+{
+	tbb::parallel_for(tbb::blocked_range<std::size_t>(0, items->size(), 1024), [&](const tbb::blocked_range<std::size_t>& r) {
+		long long s = 0;
+		for(std::size_t i = r.begin(); i != r.end(); ++i)
+			s += (*items)[i];
+		*total += s;
+
+		int slot = tbb::this_task_arena::current_thread_index();
+		int seen = maxSlot->load();
+		while(slot > seen && !maxSlot->compare_exchange_weak(seen, slot));
+	});
+	*concurrency = tbb::this_task_arena::max_concurrency();
+}
+
+void isCurrent(ArenaWorkerGroup* group, bool* result)
+{
+	*result = (ArenaWorkerGroup::current() == group);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( ArenaWorkerGroupTestCase1 )
+{
+	std::atomic<int> counter(0);
+	{
+		ArenaWorkerGroup group(4);
+		BOOST_CHECK(group.size() == 4);
+
+		for(int i=0;i<5000;++i)
+			group.post(boost::bind(increment, &counter));
+		group.dispatch(boost::bind(increment, &counter), true);
+		BOOST_CHECK(counter >= 1);
+
+		WorkerFuture key = group.async(boost::bind(increment, &counter));
+		group.wait(key);
+
+		bool current = false;
+		group.post(boost::bind(isCurrent, &group, &current), true);
+		BOOST_CHECK(current);
+		BOOST_CHECK(ArenaWorkerGroup::current() == NULL);
+	}
+	// pending handlers are executed before the group is gone
+	BOOST_CHECK(counter == 5002);
+}
+
+BOOST_AUTO_TEST_CASE( ArenaWorkerGroupTestCase2 )
+{
+	std::atomic<int> counter(0);
+	{
+		ArenaWorkerGroup group(4);
+		group.post(boost::bind(spawn, &group, &counter, 12));
+	}
+	// stop() waits for the handlers posted by handlers too
+	BOOST_CHECK(counter == (1 << 13) - 1);
+}
+
+BOOST_AUTO_TEST_CASE( ArenaWorkerGroupTestCase3 )
+{
+	std::vector<int> items(numParallelItems);
+	for(std::size_t i = 0; i < items.size(); ++i)
+		items[i] = (int)(i % 7);
+	long long expected = 0;
+	for(std::size_t i = 0; i < items.size(); ++i)
+		expected += items[i];
+
+	ArenaWorkerGroup group(2);
+
+	// a parallel_for in a handler runs in the arena of the group
+	std::atomic<long long> total(0);
+	std::atomic<int> concurrency(0);
+	std::atomic<int> maxSlot(-1);
+	group.post(boost::bind(sum, &items, &total, &concurrency, &maxSlot), true);
+	BOOST_CHECK(total == expected);
+	BOOST_CHECK(concurrency == 2);
+	BOOST_CHECK(maxSlot >= 0 && maxSlot < 2);
+
+	// so does one called from a plain Worker through execute()
+	total = 0;
+	concurrency = 0;
+	maxSlot = -1;
+	Worker worker;
+	worker.dispatch(boost::bind(&ArenaWorkerGroup::execute< boost::function<void()> >, &group,
+			boost::function<void()>(boost::bind(sum, &items, &total, &concurrency, &maxSlot))), true);
+	BOOST_CHECK(total == expected);
+	BOOST_CHECK(concurrency == 2);
+	BOOST_CHECK(maxSlot >= 0 && maxSlot < 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
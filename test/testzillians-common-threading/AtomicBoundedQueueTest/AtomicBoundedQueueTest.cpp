@@ -22,6 +22,7 @@
 
 #include "core/Prerequisite.h"
 #include "core/AtomicBoundedQueue.h"
+#include "core/BlockingAtomicBoundedQueue.h"
 #include <iostream>
 #include <string>
 #include <limits>
@@ -377,4 +378,153 @@ BOOST_AUTO_TEST_CASE( AtomicBoundedQueueTestCase4_MultipleProducerMultipleConsum
 	test_mpmc_push_pop_tbb(64, 100, 65536, 4, 4);
 }
 
+BOOST_AUTO_TEST_CASE( AtomicBoundedQueueTestCase5_Batch )
+{
+	AtomicBoundedQueue<int> queue(64);
+	int data[100];
+	for(int i=0;i<100;++i)
+		data[i] = i;
+
+	BOOST_CHECK(queue.push_n(data, 40) == 40);
+	BOOST_CHECK(queue.push_n(data + 40, 60) == 24);
+	BOOST_CHECK(queue.push_n(data, 1) == 0);
+
+	int x[100];
+	BOOST_CHECK(queue.pop_n(x, 10) == 10);
+	BOOST_CHECK(queue.pop_n(x + 10, 100) == 54);
+	BOOST_CHECK(queue.pop_n(x, 1) == 0);
+	for(int i=0;i<64;++i)
+		BOOST_CHECK(x[i] == i);
+
+	// batches wrap around the end of the buffer
+	BOOST_CHECK(queue.push_n(data, 50) == 50);
+	BOOST_CHECK(queue.pop_n(x, 50) == 50);
+	for(int i=0;i<50;++i)
+		BOOST_CHECK(x[i] == i);
+}
+
+void batch_producer_thread_proc(AtomicBoundedQueue<int>* q, int items_to_push, int batch_size)
+{
+	std::vector<int> data(batch_size);
+	int next = 0;
+	while(next < items_to_push)
+	{
+		int n = std::min(batch_size, items_to_push - next);
+		for(int i=0;i<n;++i)
+			data[i] = next + i;
+		size_t pushed = q->push_n(&data[0], n);
+		if(pushed > 0)
+			next += pushed;
+		else
+			boost::this_thread::yield();
+	}
+}
+
+void batch_consumer_thread_proc(AtomicBoundedQueue<int>* q, int items_to_pop, int batch_size, std::atomic<long>* sum)
+{
+	std::vector<int> data(batch_size);
+	long local = 0;
+	while(items_to_pop > 0)
+	{
+		size_t popped = q->pop_n(&data[0], std::min(batch_size, items_to_pop));
+		if(popped > 0)
+		{
+			for(size_t i=0;i<popped;++i)
+				local += data[i];
+			items_to_pop -= popped;
+		}
+		else
+			boost::this_thread::yield();
+	}
+	sum->fetch_add(local);
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBoundedQueueTestCase6_BatchMultipleProducerMultipleConsumer )
+{
+	const int element_count = 65536;
+	AtomicBoundedQueue<int> queue(256);
+	std::atomic<long> sum(0);
+
+	tbb::tick_count start = tbb::tick_count::now();
+
+	std::vector<boost::thread*> threads;
+	for(int j=0;j<4;++j)
+		threads.push_back(new boost::thread(boost::bind(batch_producer_thread_proc, &queue, element_count/4, 32)));
+	for(int j=0;j<4;++j)
+		threads.push_back(new boost::thread(boost::bind(batch_consumer_thread_proc, &queue, element_count/4, 32, &sum)));
+
+	for(std::size_t j=0;j<threads.size();++j)
+	{
+		threads[j]->join();
+		delete threads[j];
+	}
+
+	printf("[batch] 4-producer-4-consumer scenario with batch size 32, time = %f ms\n", (tbb::tick_count::now() - start).seconds() * 1000.0);
+
+	long expected = 4L * ((long)(element_count/4) * (element_count/4 - 1) / 2);
+	BOOST_CHECK(sum == expected);
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBoundedQueueTestCase7_BlockingTimeout )
+{
+	BlockingAtomicBoundedQueue<int> queue(2);
+	int x;
+
+	tbb::tick_count start = tbb::tick_count::now();
+	BOOST_CHECK(!queue.timed_wait_and_pop(x, boost::posix_time::milliseconds(50)));
+	BOOST_CHECK((tbb::tick_count::now() - start).seconds() >= 0.04);
+
+	BOOST_CHECK(queue.push(1));
+	BOOST_CHECK(queue.push(2));
+	BOOST_CHECK(!queue.timed_wait_and_push(3, boost::posix_time::milliseconds(10)));
+
+	BOOST_CHECK(queue.timed_wait_and_pop(x, boost::posix_time::milliseconds(10)));
+	BOOST_CHECK(x == 1);
+	BOOST_CHECK(queue.timed_wait_and_push(3, boost::posix_time::milliseconds(10)));
+}
+
+void blocking_producer_thread_proc(BlockingAtomicBoundedQueue<int>* q, int items_to_push)
+{
+	for(int i=0;i<items_to_push;++i)
+		q->wait_and_push(i);
+}
+
+void blocking_consumer_thread_proc(BlockingAtomicBoundedQueue<int>* q, int items_to_pop, std::atomic<long>* sum)
+{
+	long local = 0;
+	for(int i=0;i<items_to_pop;++i)
+	{
+		int x;
+		q->wait_and_pop(x);
+		local += x;
+	}
+	sum->fetch_add(local);
+}
+
+BOOST_AUTO_TEST_CASE( AtomicBoundedQueueTestCase8_BlockingMultipleProducerMultipleConsumer )
+{
+	const int element_count = 65536;
+	BlockingAtomicBoundedQueue<int> queue(64);
+	std::atomic<long> sum(0);
+
+	tbb::tick_count start = tbb::tick_count::now();
+
+	std::vector<boost::thread*> threads;
+	for(int j=0;j<4;++j)
+		threads.push_back(new boost::thread(boost::bind(blocking_consumer_thread_proc, &queue, element_count/4, &sum)));
+	for(int j=0;j<4;++j)
+		threads.push_back(new boost::thread(boost::bind(blocking_producer_thread_proc, &queue, element_count/4)));
+
+	for(std::size_t j=0;j<threads.size();++j)
+	{
+		threads[j]->join();
+		delete threads[j];
+	}
+
+	printf("[blocking] 4-producer-4-consumer scenario, time = %f ms\n", (tbb::tick_count::now() - start).seconds() * 1000.0);
+
+	long expected = 4L * ((long)(element_count/4) * (element_count/4 - 1) / 2);
+	BOOST_CHECK(sum == expected);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/AtomicUnboundedQueue.h"
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+#define BOOST_TEST_MODULE AtomicUnboundedQueueTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( AtomicUnboundedQueueTest )
+
+BOOST_AUTO_TEST_CASE( AtomicUnboundedQueueTestCase1 )
+{
+	AtomicUnboundedQueue<int, 16> queue;
+	int x;
+
+	BOOST_CHECK(queue.empty());
+	BOOST_CHECK(!queue.try_pop(x));
+	BOOST_CHECK(!queue.try_peek(x));
+
+	// spans several segments
+	for(int i=0;i<100;++i)
+		queue.push(i);
+	BOOST_CHECK(!queue.empty());
+	BOOST_CHECK(queue.try_peek(x) && x == 0);
+
+	for(int i=0;i<100;++i)
+	{
+		BOOST_CHECK(queue.try_pop(x));
+		BOOST_CHECK(x == i);
+	}
+	BOOST_CHECK(queue.empty());
+	BOOST_CHECK(!queue.try_pop(x));
+
+	queue.push(1);
+	queue.push(2);
+	queue.clear();
+	BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_CASE( AtomicUnboundedQueueTestCase2 )
+{
+	// popped elements are released right away
+	AtomicUnboundedQueue<boost::shared_ptr<int> > queue;
+	boost::shared_ptr<int> p(new int(1));
+	queue.push(p);
+	BOOST_CHECK(p.use_count() == 2);
+
+	boost::shared_ptr<int> q;
+	BOOST_CHECK(queue.try_pop(q));
+	q.reset();
+	BOOST_CHECK(p.use_count() == 1);
+
+	int x;
+	AtomicUnboundedQueue<int> empty;
+	BOOST_CHECK(!empty.timed_wait_and_pop(x, boost::posix_time::milliseconds(20)));
+}
+
+void producer_thread_proc(AtomicUnboundedQueue<int, 64>* q, int items_to_push)
+{
+	for(int i=0;i<items_to_push;++i)
+		q->push(i);
+}
+
+void consumer_thread_proc(AtomicUnboundedQueue<int, 64>* q, int items_to_pop, bool blocking, std::atomic<long>* sum)
+{
+	long local = 0;
+	for(int i=0;i<items_to_pop;)
+	{
+		int x;
+		if(blocking)
+			q->wait_and_pop(x);
+		else if(!q->try_pop(x))
+			continue;
+		local += x;
+		++i;
+	}
+	sum->fetch_add(local);
+}
+
+void test_mpmc_push_pop(int element_count, int producer_count, int consumer_count, bool blocking)
+{
+	AtomicUnboundedQueue<int, 64> queue;
+	std::atomic<long> sum(0);
+
+	std::vector<boost::thread*> threads;
+	for(int j=0;j<consumer_count;++j)
+		threads.push_back(new boost::thread(boost::bind(consumer_thread_proc, &queue, element_count/consumer_count, blocking, &sum)));
+	for(int j=0;j<producer_count;++j)
+		threads.push_back(new boost::thread(boost::bind(producer_thread_proc, &queue, element_count/producer_count)));
+
+	for(std::size_t j=0;j<threads.size();++j)
+	{
+		threads[j]->join();
+		delete threads[j];
+	}
+
+	long n = element_count/producer_count;
+	BOOST_CHECK(sum == producer_count * (n * (n - 1) / 2));
+	BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_CASE( AtomicUnboundedQueueTestCase3_MultipleProducerMultipleConsumer )
+{
+	test_mpmc_push_pop(65536, 1, 1, false);
+	test_mpmc_push_pop(65536, 4, 1, false);
+	test_mpmc_push_pop(65536, 4, 4, false);
+	test_mpmc_push_pop(65536, 1, 1, true);
+	test_mpmc_push_pop(65536, 4, 4, true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,201 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Worker.h"
+#include "threading/Awaitable.h"
+#include "threading/Dispatcher.h"
+#include "threading/DispatcherThreadContext.h"
+#include "threading/DispatcherDestination.h"
+#include <tbb/atomic.h>
+#include <stdexcept>
+#include <vector>
+
+#define BOOST_TEST_MODULE AwaitableTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define MESSAGES	1000
+
+using namespace zillians;
+using namespace zillians::threading;
+using boost::asio::ip::tcp;
+
+BOOST_AUTO_TEST_SUITE( AwaitableTest )
+
+#ifdef ZILLIANS_HAS_COROUTINES
+
+void waitFor(tbb::atomic<bool>& flag)
+{
+	while(!flag)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+}
+
+Task<int> square(int value)
+{
+	co_return value * value;
+}
+
+Task<int> sumOfSquares(int n)
+{
+	int sum = 0;
+	for(int i = 1; i <= n; ++i)
+		sum += co_await square(i);
+	co_return sum;
+}
+
+Task<int> failing()
+{
+	throw std::runtime_error("failed");
+	co_return 0;
+}
+
+Task<void> chain(Worker& worker, int* result, bool* caught, bool* onWorker, tbb::atomic<bool>* done)
+{
+	co_await worker.schedule();
+	*onWorker = (Worker::current() == &worker);
+
+	*result = co_await sumOfSquares(10);
+	try
+	{
+		co_await failing();
+	}
+	catch(std::runtime_error&)
+	{
+		*caught = true;
+	}
+	*done = true;
+}
+
+BOOST_AUTO_TEST_CASE( Awaitable_Task_Test )
+{
+	Worker worker;
+
+	int result = 0;
+	bool caught = false, onWorker = false;
+	tbb::atomic<bool> done; done = false;
+
+	spawn(chain(worker, &result, &caught, &onWorker, &done));
+	waitFor(done);
+
+	BOOST_CHECK(onWorker);
+	BOOST_CHECK_EQUAL(result, 385);
+	BOOST_CHECK(caught);
+}
+
+Task<void> collect(DispatcherThreadContext<int>& context, std::vector<std::pair<uint32, int> >* received, tbb::atomic<bool>* done)
+{
+	while(received->size() < MESSAGES)
+		received->push_back(co_await context.read());
+	*done = true;
+}
+
+BOOST_AUTO_TEST_CASE( Awaitable_DispatcherRead_Test )
+{
+	Worker worker;
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > reader = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > writer = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherDestination<int> > destination = writer->createDestination(0);
+
+	std::vector<std::pair<uint32, int> > received;
+	tbb::atomic<bool> done; done = false;
+	spawn(worker, collect(*reader, &received, &done));
+
+	// let the reader poll an empty context for a while, then feed it in bursts
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	for(int i = 0; i < MESSAGES; ++i)
+	{
+		destination->write(i);
+		if(i % 100 == 99)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+	}
+	waitFor(done);
+
+	BOOST_REQUIRE_EQUAL(received.size(), (std::size_t)MESSAGES);
+	for(int i = 0; i < MESSAGES; ++i)
+	{
+		BOOST_CHECK_EQUAL(received[i].first, 1u);
+		BOOST_CHECK_EQUAL(received[i].second, i);
+	}
+}
+
+Task<void> echo(shared_ptr<tcp::socket> socket, std::size_t* echoed, tbb::atomic<bool>* done)
+{
+	Buffer buffer(1024);
+	boost::system::error_code ec;
+	for(;;)
+	{
+		std::size_t n = co_await asyncRead(*socket, buffer, ec);
+		if(ec)
+			break;
+		BOOST_ASSERT(buffer.dataSize() == n);
+
+		co_await asyncWrite(*socket, buffer, ec);
+		if(ec)
+			break;
+		BOOST_ASSERT(buffer.dataSize() == 0);
+		*echoed += n;
+		buffer.clear();
+	}
+	*done = true;
+}
+
+BOOST_AUTO_TEST_CASE( Awaitable_BufferIo_Test )
+{
+	Worker worker;
+	tcp::acceptor acceptor(worker.getIoService(), tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+	boost::asio::io_service io_service;
+	tcp::socket client(io_service);
+	client.connect(acceptor.local_endpoint());
+
+	shared_ptr<tcp::socket> server(new tcp::socket(worker.getIoService()));
+	acceptor.accept(*server);
+
+	std::size_t echoed = 0;
+	tbb::atomic<bool> done; done = false;
+	spawn(worker, echo(server, &echoed, &done));
+
+	std::size_t total = 0;
+	for(int i = 0; i < 100; ++i)
+	{
+		std::string request(1 + i * 7, 'a' + i % 26);
+		std::string reply(request.size(), 0);
+		boost::asio::write(client, boost::asio::buffer(request));
+		boost::asio::read(client, boost::asio::buffer(&reply[0], reply.size()));
+		BOOST_CHECK(reply == request);
+		total += request.size();
+	}
+
+	client.close();
+	waitFor(done);
+	BOOST_CHECK_EQUAL(echoed, total);
+}
+
+#else
+
+BOOST_AUTO_TEST_CASE( Awaitable_Unsupported_Test )
+{
+	BOOST_TEST_MESSAGE("built without C++20 coroutines, nothing to test");
+}
+
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
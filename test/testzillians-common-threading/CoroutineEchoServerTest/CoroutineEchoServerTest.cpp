@@ -22,9 +22,32 @@
 
 #include "core/Prerequisite.h"
 #include "threading/Coroutine.h"
+#include "threading/StackfulCoroutine.h"
+#include "core/Worker.h"
+#include "core/ShardedWorkerGroup.h"
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <cstdlib>
 
 using namespace zillians;
 
+// count heap allocations to check the per-message cost of each style
+tbb::atomic<std::size_t> gAllocations;
+
+void* operator new(std::size_t size)
+{
+	++gAllocations;
+	void* p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
 //int main()
 //{
 //	try
@@ -113,9 +136,10 @@ struct Session : public Coroutine
 {
 	boost::shared_ptr<tcp::socket> socket_;
 	boost::shared_ptr<std::vector<char> > buffer_;
+	boost::shared_ptr<CoroutineHandlerMemory> memory_;
 
 	Session(boost::shared_ptr<tcp::socket> socket) :
-		socket_(socket), buffer_(new std::vector<char>(1024))
+		socket_(socket), buffer_(new std::vector<char>(1024)), memory_(new CoroutineHandlerMemory)
 	{ }
 
 
@@ -128,8 +152,8 @@ struct Session : public Coroutine
 				CoroutineEntry:
 				for (;;)
 				{
-					CoroutineYield socket_->async_read_some(buffer(*buffer_), *this);
-					CoroutineYield boost::asio::async_write(*socket_, buffer(*buffer_, n), *this);
+					CoroutineYield socket_->async_read_some(buffer(*buffer_), makeCoroutineHandler(*memory_, *this));
+					CoroutineYield boost::asio::async_write(*socket_, buffer(*buffer_, n), makeCoroutineHandler(*memory_, *this));
 				}
 			}
 		}
@@ -148,9 +172,9 @@ struct Server : public Coroutine
 	boost::shared_ptr<tcp::acceptor> acceptor_;
 	boost::shared_ptr<tcp::socket> socket_;
 
-	Server(boost::asio::io_service& io_service) :
+	Server(boost::asio::io_service& io_service, unsigned short port = 54321) :
 		io_service_(io_service), acceptor_(new tcp::acceptor(io_service,
-				tcp::endpoint(tcp::v4(), 54321)))
+				tcp::endpoint(tcp::v4(), port)))
 	{ }
 
 	void operator()(error_code ec = error_code())
@@ -168,10 +192,261 @@ struct Server : public Coroutine
 	}
 };
 
-int main()
+// the same echo server written as stackful coroutines, locals survive across await()
+void StackfulSession(StackfulCoroutine& self, boost::shared_ptr<tcp::socket> socket)
+{
+	char data[1024];
+	error_code ec;
+	for(;;)
+	{
+		socket->async_read_some(buffer(data), self.handler());
+		size_t n = self.await(ec);
+		if(ec) break;
+
+		async_write(*socket, buffer(data, n), self.handler());
+		self.await(ec);
+		if(ec) break;
+	}
+}
+
+void StackfulServer(StackfulCoroutine& self, boost::shared_ptr<tcp::acceptor> acceptor)
+{
+	for(;;)
+	{
+		boost::shared_ptr<tcp::socket> socket(new tcp::socket(self.getIoService()));
+		acceptor->async_accept(*socket, self.handler());
+		self.await();
+		StackfulCoroutine::spawn(self.getIoService(), boost::bind(StackfulSession, _1, socket));
+	}
+}
+
+// one acceptor handing the sessions over to other workers, so every accept hops threads by post()
+struct FunnelServer : public Coroutine
+{
+	boost::shared_ptr<tcp::acceptor> acceptor_;
+	std::vector<Worker*> workers_;
+	boost::shared_ptr<tcp::socket> socket_;
+	Worker* target_;
+	size_t next_;
+
+	FunnelServer(boost::shared_ptr<tcp::acceptor> acceptor, const std::vector<Worker*>& workers) :
+		acceptor_(acceptor), workers_(workers), target_(NULL), next_(0)
+	{ }
+
+	void operator()(error_code ec = error_code())
+	{
+		CoroutineReenter (this)
+		{
+			CoroutineEntry:
+			for (;;)
+			{
+				target_ = workers_[next_++ % workers_.size()];
+				socket_.reset(new tcp::socket(target_->getIoService()));
+				CoroutineYield acceptor_->async_accept(*socket_, *this);
+				if(ec == boost::asio::error::operation_aborted)
+					break;
+				if(!ec)
+					target_->post(Session(socket_));
+			}
+		}
+	}
+};
+
+void StartStacklessServer(Worker& worker, unsigned short port)
+{
+	worker.getIoService().post(Server(worker.getIoService(), port));
+}
+
+void StartStackfulServer(Worker& worker, unsigned short port)
+{
+	boost::shared_ptr<tcp::acceptor> acceptor(new tcp::acceptor(worker.getIoService(), tcp::endpoint(tcp::v4(), port)));
+	StackfulCoroutine::spawn(worker, boost::bind(StackfulServer, _1, acceptor));
+}
+
+struct Barrier
+{
+	tbb::atomic<int> ready;
+	tbb::atomic<bool> go;
+};
+
+void WaitForClients(Barrier& barrier, int clients)
+{
+	while(barrier.ready < clients)
+		boost::this_thread::yield();
+}
+
+void Client(unsigned short port, int round_trips, size_t message_size, Barrier* barrier)
 {
 	boost::asio::io_service io_service;
-	io_service.post(Server(io_service));
-	io_service.run();
+	tcp::socket socket(io_service);
+	socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	socket.set_option(tcp::no_delay(true));
+
+	std::vector<char> request(message_size, 'z');
+	std::vector<char> reply(message_size);
+
+	// one round trip to get the session set up before measuring
+	boost::asio::write(socket, buffer(request));
+	boost::asio::read(socket, buffer(reply));
+
+	++barrier->ready;
+	while(!barrier->go)
+		boost::this_thread::yield();
+
+	for(int i = 0; i < round_trips; ++i)
+	{
+		boost::asio::write(socket, buffer(request));
+		boost::asio::read(socket, buffer(reply));
+		BOOST_ASSERT(reply == request);
+	}
+}
+
+// a fresh connection for every round trip, to measure the accept path
+void ConnectingClient(unsigned short port, int connections, Barrier* barrier)
+{
+	boost::asio::io_service io_service;
+	char request = 'z', reply = 0;
+
+	++barrier->ready;
+	while(!barrier->go)
+		boost::this_thread::yield();
+
+	for(int i = 0; i < connections; ++i)
+	{
+		tcp::socket socket(io_service);
+		socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		socket.set_option(tcp::no_delay(true));
+		boost::asio::write(socket, buffer(&request, 1));
+		boost::asio::read(socket, buffer(&reply, 1));
+		BOOST_ASSERT(reply == request);
+	}
+}
+
+double MeasureMessages(unsigned short port, int clients, int round_trips, size_t message_size, std::size_t& allocations)
+{
+	Barrier barrier;
+	barrier.ready = 0;
+	barrier.go = false;
+
+	boost::thread_group group;
+	for(int i = 0; i < clients; ++i)
+		group.create_thread(boost::bind(Client, port, round_trips, message_size, &barrier));
+
+	WaitForClients(barrier, clients);
+
+	allocations = gAllocations;
+	boost::posix_time::ptime begin = boost::posix_time::microsec_clock::universal_time();
+	barrier.go = true;
+	group.join_all();
+	boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+	allocations = gAllocations - allocations;
+
+	return (double)(end - begin).total_microseconds() / 1000000.0;
 }
 
+double MeasureConnections(unsigned short port, int clients, int connections)
+{
+	Barrier barrier;
+	barrier.ready = 0;
+	barrier.go = false;
+
+	boost::thread_group group;
+	for(int i = 0; i < clients; ++i)
+		group.create_thread(boost::bind(ConnectingClient, port, connections, &barrier));
+
+	WaitForClients(barrier, clients);
+
+	boost::posix_time::ptime begin = boost::posix_time::microsec_clock::universal_time();
+	barrier.go = true;
+	group.join_all();
+	boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+	return (double)(end - begin).total_microseconds() / 1000000.0;
+}
+
+void Benchmark(const char* name, void (*start)(Worker&, unsigned short), unsigned short port, int clients, int round_trips, size_t message_size)
+{
+	Worker worker;
+	start(worker, port);
+
+	std::size_t allocations = 0;
+	double elapsed = MeasureMessages(port, clients, round_trips, message_size, allocations);
+	double messages = (double)clients * round_trips;
+	printf("%-10s %d clients x %d round trips of %zu bytes: %.3f s, %.0f msg/s, %.2f MB/s, %.3f allocations/msg\n",
+			name, clients, round_trips, message_size, elapsed,
+			messages / elapsed, messages * message_size * 2.0 / elapsed / (1024.0 * 1024.0),
+			(double)allocations / messages);
+}
+
+void Report(const char* name, int clients, int round_trips, size_t message_size, int connections, double messages_elapsed, double connections_elapsed)
+{
+	printf("%-10s %.0f conn/s, %.0f msg/s (%d clients, %d connections and %d round trips of %zu bytes each)\n",
+			name, (double)clients * connections / connections_elapsed, (double)clients * round_trips / messages_elapsed,
+			clients, connections, round_trips, message_size);
+}
+
+void BenchmarkFunnel(int workers, unsigned short port, int clients, int round_trips, size_t message_size, int connections)
+{
+	Worker acceptor_worker;
+	std::vector<Worker*> session_workers;
+	for(int i = 0; i < workers; ++i)
+		session_workers.push_back(new Worker(ThreadPlacement().spread().at(i)));
+
+	boost::shared_ptr<tcp::acceptor> acceptor(new tcp::acceptor(acceptor_worker.getIoService(), tcp::endpoint(tcp::v4(), port)));
+	acceptor_worker.post(FunnelServer(acceptor, session_workers));
+
+	std::size_t allocations = 0;
+	double messages_elapsed = MeasureMessages(port, clients, round_trips, message_size, allocations);
+	double connections_elapsed = MeasureConnections(port, clients, connections);
+	Report("funnel", clients, round_trips, message_size, connections, messages_elapsed, connections_elapsed);
+
+	acceptor_worker.dispatch(boost::bind(&tcp::acceptor::close, acceptor.get()), true);
+	acceptor_worker.stop();
+	for(int i = 0; i < workers; ++i)
+		session_workers[i]->stop();
+	acceptor.reset();
+	for(int i = 0; i < workers; ++i)
+		delete session_workers[i];
+}
+
+void StartShardedSession(Worker& worker, const shared_ptr<tcp::socket>& socket)
+{
+	UNUSED_ARGUMENT(worker);
+
+	// the session is written with boost::shared_ptr, take the socket over
+	Session session(boost::shared_ptr<tcp::socket>(new tcp::socket(std::move(*socket))));
+	session();
+}
+
+void BenchmarkSharded(int workers, unsigned short port, int clients, int round_trips, size_t message_size, int connections)
+{
+	ShardedWorkerGroup group(workers);
+	group.listen(tcp::endpoint(tcp::v4(), port), StartShardedSession);
+
+	std::size_t allocations = 0;
+	double messages_elapsed = MeasureMessages(port, clients, round_trips, message_size, allocations);
+	double connections_elapsed = MeasureConnections(port, clients, connections);
+	Report("sharded", clients, round_trips, message_size, connections, messages_elapsed, connections_elapsed);
+
+	printf("%-10s accepted per worker:", "");
+	for(std::size_t i = 0; i < group.size(); ++i)
+		printf(" %llu", (unsigned long long)group.getAcceptCount(i));
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	int clients = (argc > 1) ? atoi(argv[1]) : 16;
+	int round_trips = (argc > 2) ? atoi(argv[2]) : 2000;
+	size_t message_size = (argc > 3) ? (size_t)atoi(argv[3]) : 512;
+	int workers = (argc > 4) ? atoi(argv[4]) : (int)ThreadPlacement::getCpuCount();
+	int connections = (argc > 5) ? atoi(argv[5]) : 500;
+
+	Benchmark("stackless", StartStacklessServer, 54321, clients, round_trips, message_size);
+	Benchmark("stackful", StartStackfulServer, 54322, clients, round_trips, message_size);
+
+	// the same stackless sessions on several workers, accepted by one thread or by every worker
+	BenchmarkFunnel(workers, 54323, clients, round_trips, message_size, connections);
+	BenchmarkSharded(workers, 54324, clients, round_trips, message_size, connections);
+	return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/Dispatcher.h"
+#include "threading/DispatcherThreadContext.h"
+#include "threading/DispatcherBalancedDestination.h"
+
+#include <vector>
+#include <map>
+
+#define BOOST_TEST_MODULE DispatcherBalancedDestinationTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define MESSAGES	1000
+#define KEYS		10000
+
+using namespace zillians;
+using namespace zillians::threading;
+
+BOOST_AUTO_TEST_SUITE( DispatcherBalancedDestinationTest )
+
+BOOST_AUTO_TEST_CASE( DispatcherBalancedDestination_LeastLoaded_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherThreadContext<int> > c2 = dispatcher.createThreadContext(2);
+
+	std::vector<uint32> members;
+	members.push_back(1);
+	members.push_back(2);
+	shared_ptr<DispatcherBalancedDestination<int> > balanced = c0->createBalancedDestination(members);
+	BOOST_CHECK_EQUAL(balanced->getMembers().size(), 2u);
+	BOOST_CHECK_EQUAL(balanced->getLane(), (uint32)ZILLIANS_DISPATCHER_DEFAULT_LANE);
+
+	// with two members both are always sampled, so the depths never differ by more than one
+	for(int i = 0; i < MESSAGES; ++i)
+	{
+		BOOST_REQUIRE(balanced->write(i));
+		std::size_t d1 = dispatcher.getPipeDepth(0, 1);
+		std::size_t d2 = dispatcher.getPipeDepth(0, 2);
+		BOOST_CHECK((d1 > d2 ? d1 - d2 : d2 - d1) <= 1);
+	}
+
+	// a member which keeps up gets all the new messages
+	uint32 source = 0;
+	int message = 0;
+	while(c1->read(source, message));
+	for(int i = 0; i < MESSAGES / 2; ++i)
+		BOOST_REQUIRE(balanced->write(i));
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)MESSAGES / 2);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 2), (std::size_t)MESSAGES / 2);
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherBalancedDestination_Spread_Test )
+{
+	Dispatcher<int> dispatcher(8);
+	std::vector<shared_ptr<DispatcherThreadContext<int> > > contexts;
+	std::vector<uint32> members;
+	for(uint32 i = 0; i < 8; ++i)
+	{
+		contexts.push_back(dispatcher.createThreadContext(i));
+		if(i > 0)
+			members.push_back(i);
+	}
+	shared_ptr<DispatcherBalancedDestination<int> > balanced = contexts[0]->createBalancedDestination(members);
+
+	for(int i = 0; i < MESSAGES * 7; ++i)
+		BOOST_REQUIRE(balanced->write(i));
+
+	// two choices keep the spread within a few messages of the mean
+	for(uint32 i = 1; i < 8; ++i)
+	{
+		BOOST_CHECK(dispatcher.getPipeDepth(0, i) >= (std::size_t)MESSAGES - 4);
+		BOOST_CHECK(dispatcher.getPipeDepth(0, i) <= (std::size_t)MESSAGES + 4);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherBalancedDestination_Affinity_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherThreadContext<int> > c2 = dispatcher.createThreadContext(2);
+	shared_ptr<DispatcherThreadContext<int> > c3 = dispatcher.createThreadContext(3);
+
+	std::vector<uint32> members;
+	members.push_back(1);
+	members.push_back(2);
+	members.push_back(3);
+	shared_ptr<DispatcherBalancedDestination<int> > balanced = c0->createBalancedDestination(members);
+
+	// all messages of a key go to the same member in order, whatever the load
+	const uint64 key = 42;
+	const uint32 bound = balanced->pick(key);
+	for(int i = 0; i < MESSAGES; ++i)
+		BOOST_REQUIRE(balanced->write(i, key));
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, bound), (std::size_t)MESSAGES);
+
+	shared_ptr<DispatcherThreadContext<int> > contexts[] = { c1, c2, c3 };
+	uint32 source = 0;
+	int message = 0;
+	for(int i = 0; i < MESSAGES; ++i)
+	{
+		BOOST_REQUIRE(contexts[bound - 1]->read(source, message));
+		BOOST_CHECK_EQUAL(message, i);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherBalancedDestination_JumpHash_Test )
+{
+	// growing from n to n + 1 buckets only moves keys into the new bucket, about 1/(n + 1) of them
+	for(uint32 n = 1; n < 16; ++n)
+	{
+		uint32 moved = 0;
+		std::map<uint32, uint32> counts;
+		for(uint64 key = 0; key < KEYS; ++key)
+		{
+			uint32 before = DispatcherBalancedDestination<int>::jump(key * 0x9E3779B97F4A7C15ULL, n);
+			uint32 after = DispatcherBalancedDestination<int>::jump(key * 0x9E3779B97F4A7C15ULL, n + 1);
+			BOOST_REQUIRE(before < n);
+			BOOST_REQUIRE(after < n + 1);
+			if(before != after)
+			{
+				BOOST_CHECK_EQUAL(after, n);
+				++moved;
+			}
+			++counts[after];
+		}
+		BOOST_CHECK(moved < 2 * KEYS / (n + 1));
+		BOOST_CHECK(moved > KEYS / (2 * (n + 1)));
+		for(std::map<uint32, uint32>::iterator it = counts.begin(); it != counts.end(); ++it)
+			BOOST_CHECK(it->second > KEYS / (2 * (n + 1)));
+	}
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherBalancedDestination_Batch_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherThreadContext<int> > c2 = dispatcher.createThreadContext(2);
+
+	std::vector<uint32> members;
+	members.push_back(1);
+	members.push_back(2);
+	shared_ptr<DispatcherBalancedDestination<int> > balanced = c0->createBalancedDestination(members);
+
+	std::vector<int> messages;
+	for(int i = 0; i < MESSAGES; ++i)
+		messages.push_back(i);
+
+	// a batch stays together, and the next one goes to the other member
+	BOOST_CHECK_EQUAL(balanced->write(&messages[0], MESSAGES), (uint32)MESSAGES);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1) + dispatcher.getPipeDepth(0, 2), (std::size_t)MESSAGES);
+	BOOST_CHECK(dispatcher.getPipeDepth(0, 1) == 0 || dispatcher.getPipeDepth(0, 2) == 0);
+
+	BOOST_CHECK_EQUAL(balanced->write(&messages[0], MESSAGES), (uint32)MESSAGES);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)MESSAGES);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 2), (std::size_t)MESSAGES);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
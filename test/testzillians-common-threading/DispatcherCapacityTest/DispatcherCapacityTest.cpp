@@ -0,0 +1,132 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/Dispatcher.h"
+#include "threading/DispatcherThreadContext.h"
+#include "threading/DispatcherDestination.h"
+
+#define BOOST_TEST_MODULE DispatcherCapacityTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define ITERATIONS	20000
+#define CAPACITY	16
+
+using namespace zillians;
+using namespace zillians::threading;
+
+BOOST_AUTO_TEST_SUITE( DispatcherCapacityTest )
+
+BOOST_AUTO_TEST_CASE( DispatcherCapacity_Reject_Test )
+{
+	Dispatcher<int> dispatcher(4, CAPACITY, DispatcherOverflowPolicy::reject);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherDestination<int> > to1 = c0->createDestination(1);
+
+	for(int i = 0; i < CAPACITY; ++i)
+		BOOST_CHECK(to1->write(i));
+	BOOST_CHECK(!to1->write(CAPACITY));
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)CAPACITY);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(1, 0), 0u);
+
+	uint32 source = 0;
+	int message = -1;
+	BOOST_CHECK(c1->read(source, message));
+	BOOST_CHECK_EQUAL(message, 0);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)CAPACITY - 1);
+
+	// a batch is cut at the capacity, and what fits still goes out
+	int batch[4] = { 100, 101, 102, 103 };
+	BOOST_CHECK_EQUAL(to1->write(batch, 4), 1u);
+
+	int expected[CAPACITY] = { 0 };
+	for(int i = 0; i < CAPACITY - 1; ++i)
+		expected[i] = i + 1;
+	expected[CAPACITY - 1] = 100;
+
+	for(int i = 0; i < CAPACITY; ++i)
+	{
+		BOOST_REQUIRE(c1->read(source, message));
+		BOOST_CHECK_EQUAL(message, expected[i]);
+	}
+	BOOST_CHECK(!c1->read(source, message));
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherCapacity_Block_Test )
+{
+	Dispatcher<int> dispatcher(4, CAPACITY, DispatcherOverflowPolicy::block);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+
+	// blocking writes never fail while the destination is attached
+	uint32 written = 0;
+	boost::thread writer([&]() {
+		shared_ptr<DispatcherDestination<int> > to1 = c0->createDestination(1);
+		int batch[5];
+		for(int i = 0; i < ITERATIONS; i += 5)
+		{
+			for(int j = 0; j < 5; ++j)
+				batch[j] = i + j;
+			written += to1->write(batch, 5);
+		}
+	});
+
+	int next = 0;
+	std::size_t deepest = 0;
+	while(next < ITERATIONS)
+	{
+		deepest = std::max(deepest, dispatcher.getPipeDepth(0, 1));
+
+		uint32 source = 0;
+		int message = -1;
+		if(!c1->read(source, message, true))
+			continue;
+		BOOST_REQUIRE_EQUAL(message, next);
+		++next;
+	}
+	writer.join();
+
+	BOOST_CHECK_EQUAL(written, (uint32)ITERATIONS);
+	BOOST_CHECK_LE(deepest, (std::size_t)CAPACITY);
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherCapacity_Unbounded_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherDestination<int> > to1 = c0->createDestination(1);
+
+	for(int i = 0; i < 10 * ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE; ++i)
+		BOOST_REQUIRE(to1->write(i));
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)(10 * ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE));
+
+	uint32 source = 0;
+	int message = -1;
+	for(int i = 0; i < 10 * ZILLIANS_DISPATCHER_PIPE_CHUNK_SIZE; ++i)
+	{
+		BOOST_REQUIRE(c1->read(source, message));
+		BOOST_REQUIRE_EQUAL(message, i);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/Dispatcher.h"
+#include "threading/DispatcherThreadContext.h"
+#include "threading/DispatcherDestination.h"
+
+#include <vector>
+
+#define BOOST_TEST_MODULE DispatcherLaneTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define BACKLOG	1000
+
+using namespace zillians;
+using namespace zillians::threading;
+
+BOOST_AUTO_TEST_SUITE( DispatcherLaneTest )
+
+BOOST_AUTO_TEST_CASE( DispatcherLane_UrgentFirst_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherDestination<int> > data = c0->createDestination(1);
+	shared_ptr<DispatcherDestination<int> > urgent = c0->createDestination(1, ZILLIANS_DISPATCHER_URGENT_LANE);
+
+	BOOST_CHECK_EQUAL(data->getLane(), (uint32)ZILLIANS_DISPATCHER_DEFAULT_LANE);
+	BOOST_CHECK_EQUAL(urgent->getLane(), (uint32)ZILLIANS_DISPATCHER_URGENT_LANE);
+
+	// the urgent messages are written behind a backlog of data
+	for(int i = 0; i < BACKLOG; ++i)
+		data->write(i);
+	urgent->write(-1);
+	urgent->write(-2);
+
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1), (std::size_t)BACKLOG);
+	BOOST_CHECK_EQUAL(dispatcher.getPipeDepth(0, 1, ZILLIANS_DISPATCHER_URGENT_LANE), 2u);
+
+	uint32 source = 0;
+	int message = 0;
+	BOOST_REQUIRE(c1->read(source, message));
+	BOOST_CHECK_EQUAL(source, 0u);
+	BOOST_CHECK_EQUAL(message, -1);
+	BOOST_REQUIRE(c1->read(source, message));
+	BOOST_CHECK_EQUAL(message, -2);
+
+	// an urgent message arriving in the middle of the backlog overtakes the rest
+	for(int i = 0; i < BACKLOG / 2; ++i)
+	{
+		BOOST_REQUIRE(c1->read(source, message));
+		BOOST_CHECK_EQUAL(message, i);
+	}
+	urgent->write(-3);
+	BOOST_REQUIRE(c1->read(source, message));
+	BOOST_CHECK_EQUAL(message, -3);
+
+	for(int i = BACKLOG / 2; i < BACKLOG; ++i)
+	{
+		BOOST_REQUIRE(c1->read(source, message));
+		BOOST_CHECK_EQUAL(message, i);
+	}
+	BOOST_CHECK(!c1->read(source, message));
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherLane_Batch_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherThreadContext<int> > c2 = dispatcher.createThreadContext(2);
+
+	std::vector<int> messages;
+	for(int i = 0; i < BACKLOG; ++i)
+		messages.push_back(i);
+	c0->createDestination(1)->write(&messages[0], BACKLOG);
+	c2->broadcast(-1, ZILLIANS_DISPATCHER_URGENT_LANE);
+
+	uint32 sources[64];
+	int received[64];
+	uint32 count = 64;
+	BOOST_REQUIRE(c1->read(sources, received, count));
+	BOOST_REQUIRE(count > 1);
+	BOOST_CHECK_EQUAL(sources[0], 2u);
+	BOOST_CHECK_EQUAL(received[0], -1);
+
+	int next = 0;
+	for(uint32 i = 1; i < count; ++i)
+	{
+		BOOST_CHECK_EQUAL(sources[i], 0u);
+		BOOST_CHECK_EQUAL(received[i], next++);
+	}
+
+	uint32 source = 0;
+	int message = 0;
+	while(c1->read(source, message))
+		BOOST_CHECK_EQUAL(message, next++);
+	BOOST_CHECK_EQUAL(next, BACKLOG);
+
+	BOOST_REQUIRE(c0->read(source, message));
+	BOOST_CHECK_EQUAL(source, 2u);
+	BOOST_CHECK_EQUAL(message, -1);
+}
+
+BOOST_AUTO_TEST_CASE( DispatcherLane_Drain_Test )
+{
+	Dispatcher<int> dispatcher(4);
+	shared_ptr<DispatcherThreadContext<int> > c0 = dispatcher.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<int> > c1 = dispatcher.createThreadContext(1);
+	shared_ptr<DispatcherThreadContext<int> > c2 = dispatcher.createThreadContext(2);
+
+	std::vector<uint32> destinations;
+	destinations.push_back(1);
+
+	// the data from 0 is written first, and the urgent lane of 2 is still drained first
+	for(int i = 0; i < 10; ++i)
+		c0->multicast(destinations, i);
+	for(int i = 0; i < 10; ++i)
+		c2->multicast(destinations, 100 + i, ZILLIANS_DISPATCHER_URGENT_LANE);
+
+	std::vector<int> seen;
+	BOOST_CHECK_EQUAL(c1->drain([&](uint32 source, int message) {
+		BOOST_CHECK_EQUAL(source, message < 100 ? 0u : 2u);
+		seen.push_back(message);
+	}), 20u);
+
+	BOOST_REQUIRE_EQUAL(seen.size(), 20u);
+	for(int i = 0; i < 10; ++i)
+	{
+		BOOST_CHECK_EQUAL(seen[i], 100 + i);
+		BOOST_CHECK_EQUAL(seen[10 + i], i);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
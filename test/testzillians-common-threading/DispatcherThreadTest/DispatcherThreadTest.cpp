@@ -89,6 +89,79 @@ void reader_thread(shared_ptr<DispatcherThreadContext<Message> > dt, uint32 sour
 	}
 }
 
+struct ordered_consumer
+{
+	ordered_consumer(uint32 source, uint32& count) : source(source), count(count)
+	{ }
+
+	void operator() (uint32 s, Message& m)
+	{
+		BOOST_ASSERT(s == source);
+		BOOST_ASSERT(m.count == (int)count);
+		++count;
+	}
+
+	uint32 source;
+	uint32& count;
+};
+
+void drain_thread(shared_ptr<DispatcherThreadContext<Message> > dt, uint32 source, bool blocking)
+{
+	uint32 count = 0;
+	while(count < ITERATIONS)
+	{
+		dt->drain(ordered_consumer(source, count), blocking);
+	}
+}
+
+#define WIDE_WRITER_THREAD_COUNT	129
+#define FANOUT_READER_THREAD_COUNT	8
+
+void broadcast_thread(shared_ptr<DispatcherThreadContext<Message> > dt)
+{
+	Message m;
+	for(int i=0;i<ITERATIONS;++i)
+	{
+		m.count = i;
+		dt->broadcast(m);
+	}
+}
+
+void multicast_thread(shared_ptr<DispatcherThreadContext<Message> > dt, std::vector<uint32> destinations)
+{
+	// two messages per call, delivered as one batch
+	Message m[2];
+	for(int i=0;i<ITERATIONS;i+=2)
+	{
+		m[0].count = i; m[1].count = i + 1;
+		dt->multicast(destinations, m, 2);
+	}
+}
+
+struct per_source_consumer
+{
+	per_source_consumer(std::vector<uint32>& counts) : counts(counts)
+	{ }
+
+	void operator() (uint32 s, Message& m)
+	{
+		BOOST_ASSERT(m.count == (int)counts[s]);
+		++counts[s];
+	}
+
+	std::vector<uint32>& counts;
+};
+
+void wide_reader_thread(shared_ptr<DispatcherThreadContext<Message> > dt, uint32 max_thread)
+{
+	std::vector<uint32> counts(max_thread, 0);
+	uint32 total = 0;
+	while(total < WIDE_WRITER_THREAD_COUNT * ITERATIONS)
+	{
+		total += dt->drain(per_source_consumer(counts), true);
+	}
+}
+
 void writer_reader_thread(shared_ptr<DispatcherThreadContext<Message> > dt, std::vector<uint32> destinations)
 {
 	Message m; m.count = 1;
@@ -147,6 +220,96 @@ int main (int argc, char** argv)
 		cout << "iteration: " << i+1 << " of 10, blocking reading ok" << endl;
 	}
 
+	for(int i=0;i<10;++i)
+	{
+		shared_ptr<DispatcherThreadContext<Message> > reader_dt = dispatcher.createThreadContext();
+		shared_ptr<DispatcherThreadContext<Message> > writer_dt = dispatcher.createThreadContext();
+
+		boost::thread t0(boost::bind(drain_thread, reader_dt, writer_dt->getIdentity(), (i % 2) == 0));
+		boost::thread t1(boost::bind(writer_thread, writer_dt, reader_dt->getIdentity()));
+
+		t0.join();
+		t1.join();
+
+		cout << "iteration: " << i+1 << " of 10, " << ((i % 2) == 0 ? "blocking" : "non-blocking") << " draining ok" << endl;
+	}
+
+	for(int i=0;i<8;++i)
+	{
+		DispatcherThreadSignaler::idle_policy_t::type policies[] = {
+				DispatcherThreadSignaler::idle_policy_t::park,
+				DispatcherThreadSignaler::idle_policy_t::busy_spin,
+				DispatcherThreadSignaler::idle_policy_t::spin_then_yield,
+				DispatcherThreadSignaler::idle_policy_t::adaptive };
+
+		shared_ptr<DispatcherThreadContext<Message> > reader_dt = dispatcher.createThreadContext();
+		shared_ptr<DispatcherThreadContext<Message> > writer_dt = dispatcher.createThreadContext();
+		reader_dt->getSignaler().setIdlePolicy(policies[i % 4]);
+
+		boost::thread t0(boost::bind(drain_thread, reader_dt, writer_dt->getIdentity(), true));
+		boost::thread t1(boost::bind(writer_thread, writer_dt, reader_dt->getIdentity()));
+
+		t0.join();
+		t1.join();
+
+		cout << "iteration: " << i+1 << " of 8, idle policy " << policies[i % 4] << " ok" << endl;
+	}
+
+	for(int i=0;i<2;++i)
+	{
+		shared_ptr<DispatcherThreadContext<Message> > writer_dt = dispatcher.createThreadContext();
+
+		std::vector<shared_ptr<DispatcherThreadContext<Message> > > reader_dts;
+		std::vector<uint32> destinations;
+		for(int j=0;j<FANOUT_READER_THREAD_COUNT;++j)
+		{
+			reader_dts.push_back(dispatcher.createThreadContext());
+			destinations.push_back(reader_dts.back()->getIdentity());
+		}
+
+		std::vector<boost::thread*> readers;
+		for(int j=0;j<FANOUT_READER_THREAD_COUNT;++j)
+			readers.push_back(new boost::thread(boost::bind(drain_thread, reader_dts[j], writer_dt->getIdentity(), true)));
+
+		if(i == 0)
+			broadcast_thread(writer_dt);
+		else
+			multicast_thread(writer_dt, destinations);
+
+		for(int j=0;j<FANOUT_READER_THREAD_COUNT;++j)
+		{
+			readers[j]->join();
+			delete readers[j];
+		}
+
+		cout << (i == 0 ? "broadcast" : "multicast") << " to " << FANOUT_READER_THREAD_COUNT << " readers ok" << endl;
+	}
+
+	{
+		// sources span several words of the signal bitmap
+		Dispatcher<Message> wide(WIDE_WRITER_THREAD_COUNT + 1);
+
+		shared_ptr<DispatcherThreadContext<Message> > reader_dt = wide.createThreadContext();
+		boost::thread reader(boost::bind(wide_reader_thread, reader_dt, WIDE_WRITER_THREAD_COUNT + 1));
+
+		std::vector<shared_ptr<DispatcherThreadContext<Message> > > writer_dts;
+		std::vector<boost::thread*> writers;
+		for(int i=0;i<WIDE_WRITER_THREAD_COUNT;++i)
+		{
+			writer_dts.push_back(wide.createThreadContext());
+			writers.push_back(new boost::thread(boost::bind(writer_thread, writer_dts.back(), reader_dt->getIdentity())));
+		}
+
+		for(int i=0;i<WIDE_WRITER_THREAD_COUNT;++i)
+		{
+			writers[i]->join();
+			delete writers[i];
+		}
+		reader.join();
+
+		cout << WIDE_WRITER_THREAD_COUNT << " writers to one reader ok" << endl;
+	}
+
 	for(int i=0;i<10;++i)
 	{
 		cout << "iteration: " << i+1 << " of 10" << endl;
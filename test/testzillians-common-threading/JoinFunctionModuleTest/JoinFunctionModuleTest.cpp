@@ -0,0 +1,126 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/JoinFunctionModule.h"
+#include <atomic>
+#include <numeric>
+
+#define BOOST_TEST_MODULE JoinFunctionModuleTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+namespace {
+
+std::atomic<int> gFired;
+std::atomic<int> gGathered;
+
+int countFire(int v)
+{
+	UNUSED_ARGUMENT(v);
+	++gFired;
+	return 0;
+}
+
+int sumAll(const std::vector<int>& values)
+{
+	int sum = std::accumulate(values.begin(), values.end(), 0);
+	gGathered += sum;
+	return sum;
+}
+
+int identity(int v)
+{
+	return v;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( JoinFunctionModuleTest )
+
+BOOST_AUTO_TEST_CASE( JoinFunctionModule_Barrier_Test )
+{
+	const int ports = 5;
+	const int rounds = 100;
+
+	tbb::flow::graph g;
+	gFired = 0;
+
+	JoinFunctionModule join(g, countFire, ports);
+	std::vector<std::shared_ptr<tbb::flow::function_node<int, int> > > sources;
+	for(int i = 0; i < ports; ++i)
+	{
+		sources.push_back(std::make_shared<tbb::flow::function_node<int, int> >(g, tbb::flow::unlimited, identity));
+		tbb::flow::make_edge(*sources[i], join.getNextInputPort());
+	}
+	BOOST_CHECK(join.verifyInput());
+
+	for(int r = 0; r < rounds; ++r)
+	{
+		// all but the last port delivered, the join must not fire yet
+		for(int i = 0; i < ports - 1; ++i)
+			sources[i]->try_put(r);
+		g.wait_for_all();
+		BOOST_CHECK_EQUAL((int)gFired, r);
+
+		sources[ports - 1]->try_put(r);
+		g.wait_for_all();
+		BOOST_CHECK_EQUAL((int)gFired, r + 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( JoinFunctionModule_GatherBatch_Test )
+{
+	const int ports = 3;
+	const int batch = 4;
+	const int rounds = 64;
+
+	tbb::flow::graph g;
+	gFired = 0;
+	gGathered = 0;
+
+	JoinFunctionModule join(g, ports, batch, sumAll);
+	tbb::flow::function_node<int, int> sink(g, 1, countFire);
+	tbb::flow::make_edge(join.getOutputPort(), sink);
+
+	std::vector<tbb::flow::function_node<int, int>*> inputs;
+	for(int i = 0; i < ports; ++i)
+		inputs.push_back(&join.getNextInputPort());
+
+	// port 0 runs far ahead of the others, more than MAX_BATCHES_IN_FLIGHT batches
+	for(int r = 0; r < rounds; ++r)
+		inputs[0]->try_put(1);
+	g.wait_for_all();
+	BOOST_CHECK_EQUAL((int)gFired, 0);
+
+	for(int r = 0; r < rounds; ++r)
+	{
+		inputs[1]->try_put(10);
+		inputs[2]->try_put(100);
+	}
+	g.wait_for_all();
+
+	BOOST_CHECK_EQUAL((int)gFired, rounds / batch);
+	BOOST_CHECK_EQUAL((int)gGathered, rounds * 111);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,181 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/RemoteDispatcher.h"
+
+#define BOOST_TEST_MODULE RemoteDispatcherTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define ITERATIONS	4096
+#define BATCH_SIZE	16
+
+using namespace zillians;
+using namespace zillians::threading;
+using boost::asio::ip::tcp;
+
+namespace {
+
+/**
+ * Two dispatchers in one process taking the roles of two nodes, context 0
+ * and 2 on the first one and context 1 on the second one.
+ */
+template<typename Message>
+struct TwoNodes
+{
+	TwoNodes() : work(new boost::asio::io_service::work(io)), node0(io), node1(io)
+	{
+		node0.listen(tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		node1.listen(tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+		node0.connect(std::vector<uint32>(1, 1), node1.getListenEndpoint());
+		node1.connect(std::vector<uint32>(1, 0), node0.getListenEndpoint());
+		node1.connect(std::vector<uint32>(1, 2), node0.getListenEndpoint());
+
+		runner = boost::thread(boost::bind(&boost::asio::io_service::run, &io));
+	}
+
+	~TwoNodes()
+	{
+		work.reset();
+		io.stop();
+		runner.join();
+	}
+
+	boost::asio::io_service io;
+	shared_ptr<boost::asio::io_service::work> work;
+	boost::thread runner;
+	RemoteDispatcher<Message> node0;
+	RemoteDispatcher<Message> node1;
+};
+
+template<typename Message>
+Message readFrom(DispatcherThreadContext<Message>& context, uint32 expected_source)
+{
+	uint32 source = 0;
+	Message message;
+	while(!context.read(source, message, true)) { }
+	BOOST_CHECK_EQUAL(source, expected_source);
+	return message;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( RemoteDispatcherTest )
+
+BOOST_AUTO_TEST_CASE( RemoteDispatcher_PingPong_Test )
+{
+	TwoNodes<uint64> nodes;
+	shared_ptr<DispatcherThreadContext<uint64> > c0 = nodes.node0.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<uint64> > c1 = nodes.node1.createThreadContext(1);
+
+	shared_ptr<DispatcherDestination<uint64> > to1 = c0->createDestination(1);
+	shared_ptr<DispatcherDestination<uint64> > to0 = c1->createDestination(0);
+
+	for(uint64 i = 0; i < 256; ++i)
+	{
+		to1->write(i);
+		uint64 request = readFrom(*c1, 0);
+		BOOST_CHECK_EQUAL(request, i);
+
+		to0->write(request * 2);
+		BOOST_CHECK_EQUAL(readFrom(*c0, 1), i * 2);
+	}
+
+	BOOST_CHECK(nodes.node0.isReachable(1));
+	BOOST_CHECK(nodes.node1.isReachable(0));
+	BOOST_CHECK(!nodes.node0.isReachable(2));
+}
+
+BOOST_AUTO_TEST_CASE( RemoteDispatcher_BatchOrder_Test )
+{
+	TwoNodes<uint64> nodes;
+	shared_ptr<DispatcherThreadContext<uint64> > c0 = nodes.node0.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<uint64> > c2 = nodes.node0.createThreadContext(2);
+	shared_ptr<DispatcherThreadContext<uint64> > c1 = nodes.node1.createThreadContext(1);
+
+	boost::thread writer0([&]() {
+		shared_ptr<DispatcherDestination<uint64> > to1 = c0->createDestination(1);
+		uint64 batch[BATCH_SIZE];
+		for(uint64 i = 0; i < ITERATIONS; i += BATCH_SIZE)
+		{
+			for(uint64 j = 0; j < BATCH_SIZE; ++j)
+				batch[j] = i + j;
+			to1->write(batch, BATCH_SIZE);
+		}
+	});
+	boost::thread writer2([&]() {
+		shared_ptr<DispatcherDestination<uint64> > to1 = c2->createDestination(1);
+		for(uint64 i = 0; i < ITERATIONS; ++i)
+			to1->write(i);
+	});
+
+	// messages from each source arrive in order, interleaved with the other source
+	uint64 next[3] = { 0, 0, 0 };
+	uint32 received = 0;
+	while(received < 2 * ITERATIONS)
+	{
+		uint32 sources[64];
+		uint64 messages[64];
+		uint32 n = 64;
+		if(!c1->read(sources, messages, n, true))
+			continue;
+
+		for(uint32 i = 0; i < n; ++i)
+		{
+			BOOST_REQUIRE(sources[i] == 0 || sources[i] == 2);
+			BOOST_REQUIRE_EQUAL(messages[i], next[sources[i]]);
+			++next[sources[i]];
+		}
+		received += n;
+	}
+
+	writer0.join();
+	writer2.join();
+}
+
+BOOST_AUTO_TEST_CASE( RemoteDispatcher_LocalAndBroadcast_Test )
+{
+	TwoNodes<std::string> nodes;
+	shared_ptr<DispatcherThreadContext<std::string> > c0 = nodes.node0.createThreadContext(0);
+	shared_ptr<DispatcherThreadContext<std::string> > c2 = nodes.node0.createThreadContext(2);
+	shared_ptr<DispatcherThreadContext<std::string> > c1 = nodes.node1.createThreadContext(1);
+
+	// local writes still go through the in-process pipes
+	c0->createDestination(2)->write(std::string("local"));
+	BOOST_CHECK_EQUAL(readFrom(*c2, 0), "local");
+
+	std::string large(8000, 'x');
+	c0->createDestination(1)->write(large);
+	BOOST_CHECK(readFrom(*c1, 0) == large);
+
+	c1->broadcast(std::string("everyone"));
+	BOOST_CHECK_EQUAL(readFrom(*c0, 1), "everyone");
+	BOOST_CHECK_EQUAL(readFrom(*c2, 1), "everyone");
+
+	std::vector<uint32> destinations;
+	destinations.push_back(1);
+	destinations.push_back(2);
+	c0->multicast(destinations, std::string("some"));
+	BOOST_CHECK_EQUAL(readFrom(*c1, 0), "some");
+	BOOST_CHECK_EQUAL(readFrom(*c2, 0), "some");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,231 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "threading/SharedMemoryDispatcher.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sstream>
+
+#define BOOST_TEST_MODULE SharedMemoryDispatcherTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define ITERATIONS	100000
+
+using namespace zillians;
+using namespace zillians::threading;
+
+namespace {
+
+struct Message
+{
+	uint32 sequence;
+	uint32 payload[3];
+};
+
+std::string segmentName(const char* test)
+{
+	std::ostringstream name;
+	name << "/zillians-" << test << "-" << ::getpid();
+	SharedMemoryDispatcher<Message>::remove(name.str());
+	return name.str();
+}
+
+Message readFrom(SharedMemoryThreadContext<Message>& context, uint32 expected_source)
+{
+	uint32 source = 0;
+	Message message;
+	while(!context.read(source, message, true)) { }
+	BOOST_CHECK_EQUAL(source, expected_source);
+	return message;
+}
+
+/**
+ * Echo every message back incremented, until a zero sequence.
+ */
+int runEchoProcess(const std::string& name, uint32 id, uint32 peer)
+{
+	SharedMemoryDispatcher<Message> dispatcher(name);
+	shared_ptr<SharedMemoryThreadContext<Message> > context = dispatcher.createThreadContext(id);
+	if(!context)
+		return 1;
+
+	shared_ptr<DispatcherDestination<Message> > reply = context->createDestination(peer);
+	while(true)
+	{
+		uint32 source = 0;
+		Message message;
+		if(!context->read(source, message, true))
+			continue;
+		if(source != peer)
+			return 2;
+		if(message.sequence == 0)
+			return 0;
+
+		++message.sequence;
+		reply->write(message);
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( SharedMemoryDispatcherTest )
+
+BOOST_AUTO_TEST_CASE( SharedMemoryDispatcher_CrossProcess_Test )
+{
+	std::string name = segmentName("cross");
+	SharedMemoryDispatcher<Message> dispatcher(name);
+	shared_ptr<SharedMemoryThreadContext<Message> > c0 = dispatcher.createThreadContext(0);
+
+	pid_t child = ::fork();
+	if(child == 0)
+		::_exit(runEchoProcess(name, 1, 0));
+
+	while(!dispatcher.isAttached(1))
+		boost::this_thread::yield();
+
+	shared_ptr<DispatcherDestination<Message> > to1 = c0->createDestination(1);
+	Message m = { 0, { 1, 2, 3 } };
+	for(uint32 i = 1; i < 1000; i += 2)
+	{
+		m.sequence = i;
+		to1->write(m);
+		Message r = readFrom(*c0, 1);
+		BOOST_REQUIRE_EQUAL(r.sequence, i + 1);
+		BOOST_CHECK_EQUAL(r.payload[2], 3u);
+	}
+
+	m.sequence = 0;
+	to1->write(m);
+
+	int status = 0;
+	::waitpid(child, &status, 0);
+	BOOST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	SharedMemoryDispatcher<Message>::remove(name);
+}
+
+BOOST_AUTO_TEST_CASE( SharedMemoryDispatcher_BatchOrder_Test )
+{
+	std::string name = segmentName("batch");
+
+	// two mappings of the same segment, just like two processes
+	SharedMemoryDispatcher<Message> node0(name, 4, 256);
+	SharedMemoryDispatcher<Message> node1(name, 4, 256);
+	shared_ptr<SharedMemoryThreadContext<Message> > c0 = node0.createThreadContext(0);
+	shared_ptr<SharedMemoryThreadContext<Message> > c2 = node0.createThreadContext(2);
+	shared_ptr<SharedMemoryThreadContext<Message> > c1 = node1.createThreadContext(1);
+
+	// the rings are smaller than what's written, so the writers have to wait for the reader
+	boost::thread writer0([&]() {
+		shared_ptr<DispatcherDestination<Message> > to1 = c0->createDestination(1);
+		Message batch[16];
+		for(uint32 i = 0; i < ITERATIONS; i += 16)
+		{
+			for(uint32 j = 0; j < 16; ++j)
+				batch[j].sequence = i + j;
+			to1->write(batch, 16);
+		}
+	});
+	boost::thread writer2([&]() {
+		shared_ptr<DispatcherDestination<Message> > to1 = c2->createDestination(1);
+		Message m;
+		for(uint32 i = 0; i < ITERATIONS; ++i)
+		{
+			m.sequence = i;
+			to1->write(m);
+		}
+	});
+
+	uint32 next[3] = { 0, 0, 0 };
+	uint32 received = 0;
+	while(received < 2 * ITERATIONS)
+	{
+		received += c1->drain([&](uint32 source, Message& message) {
+			BOOST_REQUIRE(source == 0 || source == 2);
+			BOOST_REQUIRE_EQUAL(message.sequence, next[source]);
+			++next[source];
+		}, true);
+	}
+
+	writer0.join();
+	writer2.join();
+
+	SharedMemoryDispatcher<Message>::remove(name);
+}
+
+BOOST_AUTO_TEST_CASE( SharedMemoryDispatcher_AttachDetach_Test )
+{
+	std::string name = segmentName("attach");
+	SharedMemoryDispatcher<Message> dispatcher(name);
+	shared_ptr<SharedMemoryThreadContext<Message> > c0 = dispatcher.createThreadContext(0);
+
+	// the same context can't be attached twice
+	BOOST_CHECK(!dispatcher.createThreadContext(0));
+
+	// writes to a detached context are dropped
+	Message m = { 7, { 0, 0, 0 } };
+	c0->createDestination(1)->write(m);
+	BOOST_CHECK(!dispatcher.isAttached(1));
+
+	shared_ptr<SharedMemoryThreadContext<Message> > c1 = dispatcher.createThreadContext(1);
+	uint32 source = 0;
+	BOOST_CHECK(!c1->read(source, m));
+
+	m.sequence = 8;
+	c0->createDestination(1)->write(m);
+	BOOST_CHECK_EQUAL(readFrom(*c1, 0).sequence, 8u);
+
+	// messages left to a detached context are discarded on the next attach
+	c0->createDestination(1)->write(m);
+	c1.reset();
+	c1 = dispatcher.createThreadContext(1);
+	BOOST_REQUIRE(c1);
+	BOOST_CHECK(!c1->read(source, m));
+
+	// a context left attached by a dead process is taken over
+	pid_t child = ::fork();
+	if(child == 0)
+	{
+		SharedMemoryDispatcher<Message> other(name);
+		shared_ptr<SharedMemoryThreadContext<Message> > c3 = other.createThreadContext(3);
+		::_exit(c3 ? 0 : 1);	// without detaching
+	}
+	int status = 0;
+	::waitpid(child, &status, 0);
+	BOOST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	BOOST_CHECK(dispatcher.isAttached(3));
+	BOOST_CHECK(dispatcher.createThreadContext(3));
+
+	SharedMemoryDispatcher<Message>::remove(name);
+}
+
+BOOST_AUTO_TEST_CASE( SharedMemoryDispatcher_Mismatch_Test )
+{
+	std::string name = segmentName("mismatch");
+	SharedMemoryDispatcher<Message> dispatcher(name, 4, 64);
+	BOOST_CHECK_THROW(SharedMemoryDispatcher<Message>(name, 4, 32), std::runtime_error);
+
+	SharedMemoryDispatcher<Message>::remove(name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
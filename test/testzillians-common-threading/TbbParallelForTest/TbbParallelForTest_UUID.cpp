@@ -31,6 +31,7 @@
 #include "utility/UUIDUtil.h"                         // UUID
 #include <tbb/concurrent_hash_map.h>                  // tbb::concurrent_hash_map
 #include <map>                                        // std::map
+#include <vector>                                     // std::vector
 #include <ext/hash_map>                               // __gnu_cxx::hash_map
 #include "vw/processors/cuda/kernel/api/RuntimeApi.h" // vw::processors::cuda::RuntimeApi
 #include "core/Singleton.h"                           // zillians::Singleton
@@ -194,6 +195,33 @@ struct query_rev_gnu_t
     }
 };
 
+// UUID generation
+struct generate_apr_t
+{
+    void operator()(const tbb::blocked_range<int> &r) const
+    {
+        for(int i = r.begin(); i != r.end(); i++)
+            UUID::random(uuid_buffer[i]);
+    }
+    UUID *uuid_buffer;
+};
+struct generate_v4_t
+{
+    void operator()(const tbb::blocked_range<int> &r) const
+    {
+        UUID::random_n(&uuid_buffer[r.begin()], r.end() - r.begin());
+    }
+    UUID *uuid_buffer;
+};
+struct generate_v7_t
+{
+    void operator()(const tbb::blocked_range<int> &r) const
+    {
+        UUID::ordered_n(&uuid_buffer[r.begin()], r.end() - r.begin());
+    }
+    UUID *uuid_buffer;
+};
+
 // Fixture: the RuntimeApi instance
 KernelApi Api;
 
@@ -447,6 +475,42 @@ static void test_query_rev_gnu(uint32 UUIDCount, uint32 QueryCount, uint32 Repea
     }
 }
 
+// UUID generation
+template<typename Functor>
+static void test_generate(const char *Name, uint32 UUIDCount, uint32 RepeatIters)
+{
+    std::vector<UUID> uuid_buffer(UUIDCount);
+    Functor f;
+    f.uuid_buffer = &uuid_buffer[0];
+
+    tbb::tick_count StartTick = tbb::tick_count::now();
+    for(int i = 0; i<RepeatIters; i++)
+        tbb::parallel_for(tbb::blocked_range<int>(0, UUIDCount, 256), f);
+    tbb::tick_count StopTick = tbb::tick_count::now();
+
+    std::cout << Name << ": " <<
+        (StopTick-StartTick).seconds()*1e9/(RepeatIters*(double)UUIDCount) << " ns per uuid" << std::endl;
+}
+
+static void test_generate_all(uint32 UUIDCount)
+{
+    std::cout << std::string(60, '=') << std::endl;
+    std::cout << "Testing UUID generation (UUIDCount=" << UUIDCount << ")" << std::endl;
+    std::cout << std::string(60, '=') << std::endl;
+    std::cout << std::endl;
+
+    // the APR generator is serialized, the thread-local ones should scale with the threads
+    for(int Threads = 1; Threads <= tbb::task_scheduler_init::default_num_threads(); Threads *= 2)
+    {
+        tbb::task_scheduler_init init(Threads);
+        std::cout << "[" << Threads << " thread(s)]" << std::endl;
+        test_generate<generate_apr_t>("APR random()", UUIDCount, 10);
+        test_generate<generate_v4_t>("random_n() v4", UUIDCount, 10);
+        test_generate<generate_v7_t>("ordered_n() v7", UUIDCount, 10);
+        std::cout << std::endl;
+    }
+}
+
 //=============================================================================
 // All Tests
 //=============================================================================
@@ -500,6 +564,8 @@ int main()
         }
     #endif
 
+    test_generate_all(MAX_UUID_COUNT);
+
     test_query_all(DEFAULT_UUID_COUNT_0, DEFAULT_QUERY_COUNT_0);
 
     test_query_all(DEFAULT_UUID_COUNT_1, DEFAULT_QUERY_COUNT_0);
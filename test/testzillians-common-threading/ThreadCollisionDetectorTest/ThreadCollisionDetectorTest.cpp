@@ -0,0 +1,109 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// check one in 8 entries and report instead of throwing, as production canaries would
+#define ZILLIANS_THREAD_COLLISION_SAMPLING 8
+
+#include "core/Prerequisite.h"
+#include "threading/ThreadCollisionDetector.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#define BOOST_TEST_MODULE ThreadCollisionDetectorTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+namespace {
+
+struct Guarded
+{
+	Guarded()
+	{
+		value = 0;
+	}
+
+	void update(int times)
+	{
+		for(int i = 0; i < times; ++i)
+		{
+			SCOPED_WATCH(update);
+			++value;
+			boost::this_thread::yield();
+		}
+	}
+
+	void own()
+	{
+		WATCH(owner);
+	}
+
+	DETECTOR(update)
+	DETECTOR(owner)
+	std::atomic<int> value;	// the collisions are made on purpose, keep them off the race detectors
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE( ThreadCollisionDetectorTest )
+
+BOOST_AUTO_TEST_CASE( ThreadCollisionDetector_SingleThread_Test )
+{
+	Guarded guarded;
+	uint64 before = ThreadCollisionDetector::collisions();
+
+	guarded.update(1000);
+	guarded.own();
+	guarded.own();
+
+	BOOST_CHECK_EQUAL(ThreadCollisionDetector::collisions(), before);
+}
+
+BOOST_AUTO_TEST_CASE( ThreadCollisionDetector_Sampled_Test )
+{
+	Guarded guarded;
+	uint64 before = ThreadCollisionDetector::collisions();
+
+	// overlapping scopes are only caught when one of them is sampled, so give it plenty of chances
+	for(int round = 0; round < 100 && ThreadCollisionDetector::collisions() == before; ++round)
+	{
+		boost::thread_group threads;
+		for(int i = 0; i < 4; ++i)
+			threads.create_thread(boost::bind(&Guarded::update, &guarded, 1000));
+		threads.join_all();
+	}
+
+	BOOST_CHECK(ThreadCollisionDetector::collisions() > before);
+}
+
+BOOST_AUTO_TEST_CASE( ThreadCollisionDetector_Owner_Test )
+{
+	Guarded guarded;
+	guarded.own();
+
+	uint64 before = ThreadCollisionDetector::collisions();
+	boost::thread other(boost::bind(&Guarded::own, &guarded));
+	other.join();
+
+	BOOST_CHECK_EQUAL(ThreadCollisionDetector::collisions(), before + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
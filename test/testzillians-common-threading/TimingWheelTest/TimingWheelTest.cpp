@@ -0,0 +1,197 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/Worker.h"
+#include "threading/TimingWheel.h"
+#include "utility/TimerUtil.h"
+#include <vector>
+
+#define BOOST_TEST_MODULE TimingWheelTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#define TIMERS	100000
+
+using namespace zillians;
+using namespace zillians::threading;
+
+BOOST_AUTO_TEST_SUITE( TimingWheelTest )
+
+BOOST_AUTO_TEST_CASE( TimingWheel_Order_Test )
+{
+	Worker worker;
+	TimingWheel wheel(worker.getIoService(), boost::posix_time::milliseconds(1));
+
+	std::vector<int> fired;
+	uint64 start = 0;
+	std::vector<uint64> elapsed;
+
+	worker.dispatch([&]() {
+		start = TimerUtil::now_ns();
+		int timeouts[] = { 30, 10, 20, 0, 5 };
+		for(int i = 0; i < 5; ++i)
+		{
+			int timeout = timeouts[i];
+			wheel.schedule(boost::posix_time::milliseconds(timeout), [&, timeout]() {
+				fired.push_back(timeout);
+				elapsed.push_back(TimerUtil::now_ns() - start);
+			});
+		}
+	}, true);
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+	std::size_t pending = 1;
+	worker.dispatch([&]() { pending = wheel.size(); }, true);
+	BOOST_CHECK_EQUAL(pending, 0u);
+
+	int expected[] = { 0, 5, 10, 20, 30 };
+	BOOST_REQUIRE_EQUAL(fired.size(), 5u);
+	for(int i = 0; i < 5; ++i)
+	{
+		BOOST_CHECK_EQUAL(fired[i], expected[i]);
+		BOOST_CHECK(elapsed[i] >= (uint64)expected[i] * 1000000);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( TimingWheel_CancelReschedule_Test )
+{
+	Worker worker;
+	TimingWheel wheel(worker.getIoService(), boost::posix_time::milliseconds(1));
+
+	int fired[3] = { 0 };
+	TimingWheel::TimerKey keys[3];
+	bool cancelled = false, rescheduled = false, pending = false;
+
+	worker.dispatch([&]() {
+		for(int i = 0; i < 3; ++i)
+			keys[i] = wheel.schedule(boost::posix_time::milliseconds(20), [&, i]() { ++fired[i]; });
+		BOOST_CHECK_EQUAL(wheel.size(), 3u);
+
+		cancelled = wheel.cancel(keys[0]);
+		rescheduled = wheel.reschedule(keys[1], boost::posix_time::milliseconds(200));
+		pending = wheel.isPending(keys[0]);
+	}, true);
+	BOOST_CHECK(cancelled);
+	BOOST_CHECK(rescheduled);
+	BOOST_CHECK(!pending);
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+	// only the untouched timer has fired, its key is stale now
+	int snapshot[3] = { 0 };
+	worker.dispatch([&]() {
+		std::copy(fired, fired + 3, snapshot);
+		pending = wheel.isPending(keys[1]);
+		cancelled = wheel.cancel(keys[2]);
+		rescheduled = wheel.reschedule(keys[2], boost::posix_time::milliseconds(1));
+	}, true);
+	BOOST_CHECK_EQUAL(snapshot[0], 0);
+	BOOST_CHECK_EQUAL(snapshot[1], 0);
+	BOOST_CHECK_EQUAL(snapshot[2], 1);
+	BOOST_CHECK(pending);
+	BOOST_CHECK(!cancelled);
+	BOOST_CHECK(!rescheduled);
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+	worker.dispatch([&]() { pending = wheel.isPending(keys[1]); cancelled = wheel.cancel(keys[0]); }, true);
+	BOOST_CHECK_EQUAL(fired[1], 1);
+	BOOST_CHECK(!pending);
+	BOOST_CHECK(!cancelled);
+}
+
+BOOST_AUTO_TEST_CASE( TimingWheel_Periodic_Test )
+{
+	Worker worker;
+	TimingWheel wheel(worker.getIoService(), boost::posix_time::milliseconds(1));
+
+	int count = 0;
+	TimingWheel::TimerKey key;
+	worker.dispatch([&]() {
+		key = wheel.schedule(boost::posix_time::milliseconds(2), [&]() {
+			if(++count < 5)
+				wheel.reschedule(key, boost::posix_time::milliseconds(2));
+		});
+	}, true);
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+	bool pending = true;
+	worker.dispatch([&]() { pending = wheel.isPending(key); }, true);
+	BOOST_CHECK_EQUAL(count, 5);
+	BOOST_CHECK(!pending);
+}
+
+BOOST_AUTO_TEST_CASE( TimingWheel_Cascade_Test )
+{
+	Worker worker;
+	// with a tick of 10us the timers spread over the first three levels
+	TimingWheel wheel(worker.getIoService(), boost::posix_time::microseconds(10));
+
+	std::vector<uint64> deadlines(TIMERS, 0);
+	std::vector<uint64> fired(TIMERS, 0);
+	std::vector<TimingWheel::TimerKey> keys(TIMERS);
+
+	worker.dispatch([&]() {
+		uint64 seed = 88172645463325252ULL;
+		for(int i = 0; i < TIMERS; ++i)
+		{
+			seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+			uint64 timeout = seed % 1000000;
+			deadlines[i] = TimerUtil::now_ns() + timeout * 1000;
+			keys[i] = wheel.schedule(boost::posix_time::microseconds(timeout), [&, i]() { fired[i] = TimerUtil::now_ns(); });
+		}
+
+		// every other timer is cancelled, and every fourth pushed back by half a second
+		for(int i = 0; i < TIMERS; i += 2)
+			wheel.cancel(keys[i]);
+		for(int i = 1; i < TIMERS; i += 4)
+		{
+			deadlines[i] = TimerUtil::now_ns() + 500000000;
+			wheel.reschedule(keys[i], boost::posix_time::milliseconds(500));
+		}
+	}, true);
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(1700));
+
+	std::size_t pending = 1;
+	worker.dispatch([&]() { pending = wheel.size(); }, true);
+	BOOST_CHECK_EQUAL(pending, 0u);
+
+	int early = 0, missing = 0, unexpected = 0;
+	for(int i = 0; i < TIMERS; ++i)
+	{
+		if(i % 2 == 0)
+		{
+			if(fired[i])
+				++unexpected;
+		}
+		else if(!fired[i])
+			++missing;
+		else if(fired[i] < deadlines[i])
+			++early;
+	}
+	BOOST_CHECK_EQUAL(unexpected, 0);
+	BOOST_CHECK_EQUAL(missing, 0);
+	BOOST_CHECK_EQUAL(early, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,191 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2010 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "core/WorkStealingWorkerGroup.h"
+#include <vector>
+
+#define BOOST_TEST_MODULE WorkStealingWorkerGroupTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( WorkStealingWorkerGroupTest )
+
+BOOST_AUTO_TEST_CASE( WorkStealingWorkerGroupTestCase1 )
+{
+	WorkStealingDeque<int> deque(2);
+	int x;
+
+	BOOST_CHECK(deque.empty());
+	BOOST_CHECK(!deque.pop(x));
+	BOOST_CHECK(!deque.steal(x));
+
+	// grows beyond the initial capacity
+	for(int i=0;i<100;++i)
+		deque.push(i);
+	BOOST_CHECK(deque.size() == 100);
+
+	// owner takes the newest, thieves take the oldest
+	BOOST_CHECK(deque.pop(x) && x == 99);
+	BOOST_CHECK(deque.steal(x) && x == 0);
+	BOOST_CHECK(deque.steal(x) && x == 1);
+
+	for(int i=98;i>=2;--i)
+	{
+		BOOST_CHECK(deque.pop(x));
+		BOOST_CHECK(x == i);
+	}
+	BOOST_CHECK(deque.empty());
+	BOOST_CHECK(!deque.pop(x));
+}
+
+namespace {
+
+const int numStealingItems = 200000;
+
+void steal(WorkStealingDeque<int>* deque, std::atomic<bool>* done, std::vector<int>* taken)
+{
+	int x;
+	while(!done->load())
+	{
+		if(deque->steal(x))
+			taken->push_back(x);
+	}
+	while(deque->steal(x))
+		taken->push_back(x);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( WorkStealingWorkerGroupTestCase2 )
+{
+	WorkStealingDeque<int> deque(16);
+	std::atomic<bool> done(false);
+	std::vector<int> taken[4];
+
+	std::vector<boost::thread*> thieves;
+	for(int i=0;i<3;++i)
+		thieves.push_back(new boost::thread(boost::bind(steal, &deque, &done, &taken[i])));
+
+	// every item is either popped by the owner or stolen exactly once
+	int x;
+	for(int i=0;i<numStealingItems;++i)
+	{
+		deque.push(i);
+		if(i % 3 == 0 && deque.pop(x))
+			taken[3].push_back(x);
+	}
+	while(deque.pop(x))
+		taken[3].push_back(x);
+
+	done = true;
+	for(int i=0;i<3;++i)
+	{
+		thieves[i]->join();
+		delete thieves[i];
+	}
+
+	std::vector<int> seen(numStealingItems, 0);
+	for(int i=0;i<4;++i)
+		for(std::size_t j=0;j<taken[i].size();++j)
+			++seen[taken[i][j]];
+
+	int wrong = 0;
+	for(int i=0;i<numStealingItems;++i)
+		if(seen[i] != 1) ++wrong;
+	BOOST_CHECK(wrong == 0);
+}
+
+namespace {
+
+void increment(std::atomic<int>* counter)
+{
+	++(*counter);
+}
+
+void slow(std::atomic<int>* counter, int expected, bool* unblocked)
+{
+	// the handlers posted after this one must still make progress
+	boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(10);
+	while(counter->load() < expected && boost::get_system_time() < deadline)
+		boost::this_thread::yield();
+	*unblocked = (counter->load() == expected);
+}
+
+void spawn(WorkStealingWorkerGroup* group, std::atomic<int>* counter, int depth)
+{
+	++(*counter);
+	if(depth > 0)
+	{
+		group->post(boost::bind(spawn, group, counter, depth - 1));
+		group->post(boost::bind(spawn, group, counter, depth - 1));
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( WorkStealingWorkerGroupTestCase3 )
+{
+	std::atomic<int> counter(0);
+	{
+		WorkStealingWorkerGroup group(4);
+		for(int i=0;i<5000;++i)
+			group.post(boost::bind(increment, &counter));
+		group.dispatch(boost::bind(increment, &counter), true);
+		BOOST_CHECK(counter >= 1);
+
+		WorkerFuture key = group.async(boost::bind(increment, &counter));
+		group.wait(key);
+	}
+	// pending handlers are executed before the group is gone
+	BOOST_CHECK(counter == 5002);
+}
+
+BOOST_AUTO_TEST_CASE( WorkStealingWorkerGroupTestCase4 )
+{
+	WorkStealingWorkerGroup group(2);
+
+	std::atomic<int> counter(0);
+	bool unblocked = false;
+
+	WorkerFuture key = group.async(boost::bind(slow, &counter, 100, &unblocked));
+	for(int i=0;i<100;++i)
+		group.post(boost::bind(increment, &counter));
+
+	group.wait(key);
+	BOOST_CHECK(unblocked);
+}
+
+BOOST_AUTO_TEST_CASE( WorkStealingWorkerGroupTestCase5 )
+{
+	std::atomic<int> counter(0);
+	{
+		WorkStealingWorkerGroup group(4);
+		// nested handlers are pushed to the local deque and stolen by the siblings
+		group.post(boost::bind(spawn, &group, &counter, 14));
+		while(counter < (1 << 15) - 1)
+			boost::this_thread::yield();
+	}
+	BOOST_CHECK(counter == (1 << 15) - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
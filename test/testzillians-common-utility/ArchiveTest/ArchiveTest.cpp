@@ -27,7 +27,11 @@
 #include <boost/mpl/if.hpp>
 #include <boost/mpl/bool.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <map>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <cstdio>
 #include <cstdlib>
 #include <stdlib.h>
@@ -124,4 +128,473 @@ BOOST_AUTO_TEST_CASE( Archive_Test )
 	}
 }
 
+static bool collectEntry(const ArchiveItem_t& item, const unsigned char* data, std::size_t size, std::map<std::string, std::vector<unsigned char> >* entries)
+{
+	std::vector<unsigned char>& buffer = (*entries)[item.filename];
+	if (data != NULL)
+		buffer.insert(buffer.end(), data, data + size);
+	return true;
+}
+
+BOOST_AUTO_TEST_CASE( Archive_Parallel_Test )
+{
+	// Create files of different sizes, some of them larger than the chunk size
+	const int generated_file_count = 40;
+	const std::size_t chunk_size = 64 * 1024;
+	std::vector<std::string> sources;
+	std::map<std::string, std::vector<unsigned char> > contents;
+
+	srand(55);
+	for (int i = 0; i < generated_file_count; i++)
+	{
+		UUID source_filename;
+		source_filename.random();
+		std::string source_filepath = (boost::filesystem::path("/tmp") / (std::string)source_filename).generic_string();
+
+		std::vector<unsigned char>& content = contents[source_filepath];
+		content.resize((i % 8 == 0) ? chunk_size * 3 + 17 : rand() % chunk_size);
+		for (std::size_t j = 0; j < content.size(); j++)
+			content[j] = (j % 3 == 0) ? (unsigned char)rand() : (unsigned char)('a' + j % 7);
+
+		std::ofstream file(source_filepath.c_str(), std::ios::out | std::ios::binary);
+		if (!content.empty())
+			file.write((const char*)&content[0], content.size());
+		file.close();
+		sources.push_back(source_filepath);
+	}
+
+	UUID archive_name;
+	archive_name.random();
+	boost::filesystem::path archive_path = boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".zip"));
+
+	// Compress in parallel
+	{
+		Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_COMPRESS);
+		ar.setChunkSize(chunk_size);
+		BOOST_CHECK( ar.addAll(sources, 4) );
+
+		std::vector<std::string> missing(1, "/tmp/this file does not exist");
+		BOOST_CHECK( !ar.addAll(missing, 2) );
+		BOOST_CHECK( ar.close() );
+	}
+
+	// Extract chunk by chunk, entries are in the order they were given
+	{
+		Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_DECOMPRESS);
+		std::map<std::string, std::vector<unsigned char> > entries;
+		BOOST_CHECK( ar.extractAll(boost::bind(collectEntry, _1, _2, _3, &entries)) );
+		BOOST_CHECK( entries == contents );
+		BOOST_CHECK( ar.close() );
+	}
+
+	// Extract straight to the disk
+	{
+		Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_DECOMPRESS);
+		std::vector<ArchiveItem_t> archive_items;
+		boost::filesystem::path folder = boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".d"));
+		BOOST_CHECK( ar.extractAllToFolder(archive_items, folder.generic_string()) );
+		BOOST_REQUIRE( archive_items.size() == sources.size() );
+
+		for (std::size_t i = 0; i < archive_items.size(); i++)
+		{
+			BOOST_CHECK( archive_items[i].filename == sources[i] );
+
+			std::ifstream file((folder / sources[i]).generic_string().c_str(), std::ios::in | std::ios::binary);
+			std::vector<unsigned char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			BOOST_CHECK( content == contents[sources[i]] );
+		}
+		BOOST_CHECK( ar.close() );
+		boost::filesystem::remove_all(folder);
+	}
+
+	std::remove(archive_path.generic_string().c_str());
+	for (std::size_t i = 0; i < sources.size(); i++)
+	{
+		std::remove(sources[i].c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Archive_Mapped_Test )
+{
+	// Half of the files are stored, the other half are deflated
+	const int generated_file_count = 20;
+	std::vector<std::string> sources;
+	std::map<std::string, std::vector<unsigned char> > contents;
+
+	srand(56);
+	for (int i = 0; i < generated_file_count; i++)
+	{
+		UUID source_filename;
+		source_filename.random();
+		std::string source_filepath = (boost::filesystem::path("/tmp") / (std::string)source_filename).generic_string();
+
+		std::vector<unsigned char>& content = contents[source_filepath];
+		content.resize((i % 5 == 0) ? 0 : rand() % 100000);
+		for (std::size_t j = 0; j < content.size(); j++)
+			content[j] = (j % 3 == 0) ? (unsigned char)rand() : (unsigned char)('a' + j % 7);
+
+		std::ofstream file(source_filepath.c_str(), std::ios::out | std::ios::binary);
+		if (!content.empty())
+			file.write((const char*)&content[0], content.size());
+		file.close();
+		sources.push_back(source_filepath);
+	}
+
+	UUID archive_name;
+	archive_name.random();
+	boost::filesystem::path archive_path = boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".zip"));
+	{
+		Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_COMPRESS);
+		ar.setCompressLevel(0);
+		for (int i = 0; i < generated_file_count; i++)
+		{
+			if (i == generated_file_count / 2)
+				ar.setCompressLevel(9);
+			BOOST_CHECK( ar.add(sources[i]) );
+		}
+		BOOST_CHECK( ar.close() );
+	}
+
+	// Look up files by name in reverse order
+	BufferRef<true, false> kept;
+	{
+		Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_MAPPED);
+		BOOST_CHECK( !ar.contains("/tmp/this file does not exist") );
+		BOOST_CHECK( !ar.extract("/tmp/this file does not exist").buffer() );
+
+		for (int i = generated_file_count - 1; i >= 0; i--)
+		{
+			const std::vector<unsigned char>& content = contents[sources[i]];
+			BOOST_CHECK( ar.contains(sources[i]) );
+
+			BufferRef<true, false> view = ar.extract(sources[i]);
+			BOOST_REQUIRE( view.buffer() );
+			BOOST_CHECK( view.dataSize() == content.size() );
+			BOOST_CHECK( content.empty() || std::memcmp(view.rptr(), &content[0], content.size()) == 0 );
+
+			Buffer buffer;
+			BOOST_CHECK( ar.extract(sources[i], buffer) );
+			BOOST_CHECK( buffer.dataSize() == content.size() );
+			BOOST_CHECK( content.empty() || std::memcmp(buffer.rptr(), &content[0], content.size()) == 0 );
+
+			if (i == 1)
+				kept = BufferRef<true, false>(view);
+		}
+
+		// a fixed size buffer doesn't grow
+		Buffer small(1);
+		BOOST_CHECK( !ar.extract(sources[1], small) );
+		BOOST_CHECK( ar.close() );
+	}
+
+	// views of stored files keep the mapping alive
+	BOOST_CHECK( kept.dataSize() == contents[sources[1]].size() );
+	BOOST_CHECK( std::memcmp(kept.rptr(), &contents[sources[1]][0], kept.dataSize()) == 0 );
+
+	std::remove(archive_path.generic_string().c_str());
+	for (std::size_t i = 0; i < sources.size(); i++)
+	{
+		std::remove(sources[i].c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Archive_Codec_Test )
+{
+	// Many small similar files, an incompressible one, an empty one and one spanning several frames
+	const int small_file_count = 200;
+	std::vector<std::string> sources;
+	std::map<std::string, std::vector<unsigned char> > contents;
+
+	srand(57);
+	for (int i = 0; i < small_file_count + 3; i++)
+	{
+		UUID source_filename;
+		source_filename.random();
+		std::string source_filepath = (boost::filesystem::path("/tmp") / (std::string)source_filename).generic_string();
+
+		std::vector<unsigned char>& content = contents[source_filepath];
+		if (i < small_file_count)
+		{
+			std::ostringstream text;
+			text << "{ \"id\": " << i << ", \"name\": \"entity_" << rand() % 1000 << "\", \"position\": [" << rand() % 100 << ", " << rand() % 100 << "], \"visible\": true }";
+			std::string s = text.str();
+			content.assign(s.begin(), s.end());
+		}
+		else if (i == small_file_count)
+		{
+			content.resize(50000);
+			for (std::size_t j = 0; j < content.size(); j++)
+				content[j] = (unsigned char)rand();
+		}
+		else if (i == small_file_count + 2)
+		{
+			content.resize(3 * 1024 * 1024 + 17);
+			for (std::size_t j = 0; j < content.size(); j++)
+				content[j] = (j % 5 == 0) ? (unsigned char)rand() : (unsigned char)('a' + j % 11);
+		}
+
+		std::ofstream file(source_filepath.c_str(), std::ios::out | std::ios::binary);
+		if (!content.empty())
+			file.write((const char*)&content[0], content.size());
+		file.close();
+		sources.push_back(source_filepath);
+	}
+
+	ArchiveCodecType codecs[] = { ARCHIVE_CODEC_LZ4, ARCHIVE_CODEC_ZSTD };
+	for (std::size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+	{
+		if (!ArchiveCodec::isSupported(codecs[c]))
+		{
+			BOOST_TEST_MESSAGE("Codec " << codecs[c] << " is not built in, skipped");
+			continue;
+		}
+
+		UUID archive_name;
+		archive_name.random();
+		boost::filesystem::path archive_path = boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".pak"));
+
+		ArchiveItem_t item;
+		item.filename = "generated/item";
+		item.buffer.assign(10000, 'z');
+		{
+			Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_COMPRESS, codecs[c]);
+			BOOST_CHECK( ar.getCodec() == codecs[c] );
+			if (codecs[c] == ARCHIVE_CODEC_ZSTD)
+				BOOST_CHECK( ar.trainDictionary(std::vector<std::string>(sources.begin(), sources.begin() + small_file_count), 4096) );
+
+			ar.setCompressLevel(5);
+			BOOST_CHECK( ar.addAll(std::vector<std::string>(sources.begin(), sources.begin() + small_file_count + 1)) );
+			BOOST_CHECK( ar.add(sources[small_file_count + 1]) );
+			BOOST_CHECK( ar.add(sources[small_file_count + 2]) );
+			BOOST_CHECK( ar.add(item) );
+
+			// the dictionary can't change once something is compressed with it
+			BOOST_CHECK( !ar.setDictionary(std::vector<unsigned char>(16, 'x')) );
+			BOOST_CHECK( ar.close() );
+		}
+
+		// Extract all in order, the codec is found in the archive
+		{
+			Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_DECOMPRESS);
+			BOOST_CHECK( ar.getCodec() == codecs[c] );
+
+			std::vector<ArchiveItem_t> archive_items;
+			BOOST_CHECK( ar.extractAll(archive_items) );
+			BOOST_REQUIRE( archive_items.size() == sources.size() + 1 );
+			for (std::size_t i = 0; i < sources.size(); i++)
+			{
+				BOOST_CHECK( archive_items[i].filename == sources[i] );
+				BOOST_CHECK( archive_items[i].buffer == contents[sources[i]] );
+			}
+			BOOST_CHECK( archive_items.back().filename == item.filename );
+			BOOST_CHECK( archive_items.back().buffer == item.buffer );
+			BOOST_CHECK( ar.close() );
+		}
+
+		// Extract straight to the disk in parallel, the file spanning several frames is written with direct I/O
+		{
+			Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_DECOMPRESS);
+			ar.setDirectIoThreshold(1024 * 1024);
+
+			std::vector<ArchiveItem_t> archive_items;
+			boost::filesystem::path folder = boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".d"));
+			BOOST_CHECK( ar.extractAllToFolder(archive_items, folder.generic_string(), 4) );
+			BOOST_REQUIRE( archive_items.size() == sources.size() + 1 );
+
+			for (std::size_t i = 0; i < archive_items.size(); i++)
+			{
+				const std::vector<unsigned char>& content = (i < sources.size()) ? contents[sources[i]] : item.buffer;
+				BOOST_CHECK( archive_items[i].filename == ((i < sources.size()) ? sources[i] : item.filename) );
+				BOOST_CHECK( archive_items[i].unzip_info.uncompressed_size == content.size() );
+				BOOST_CHECK( archive_items[i].buffer.empty() );
+
+				std::ifstream file((folder / archive_items[i].filename).generic_string().c_str(), std::ios::in | std::ios::binary);
+				std::vector<unsigned char> extracted((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				BOOST_CHECK( extracted == content );
+			}
+			BOOST_CHECK( ar.close() );
+			boost::filesystem::remove_all(folder);
+		}
+
+		// Random access, stored and compressed entries alike
+		{
+			Archive ar(archive_path.generic_string(), ArchiveMode::ARCHIVE_FILE_MAPPED);
+			BOOST_CHECK( ar.getCodec() == codecs[c] );
+			for (int i = sources.size() - 1; i >= 0; i--)
+			{
+				const std::vector<unsigned char>& content = contents[sources[i]];
+				BufferRef<true, false> view = ar.extract(sources[i]);
+				BOOST_REQUIRE( view.buffer() );
+				BOOST_CHECK( view.dataSize() == content.size() );
+				BOOST_CHECK( content.empty() || std::memcmp(view.rptr(), &content[0], content.size()) == 0 );
+
+				Buffer buffer;
+				BOOST_CHECK( ar.extract(sources[i], buffer) );
+				BOOST_CHECK( buffer.dataSize() == content.size() );
+				BOOST_CHECK( content.empty() || std::memcmp(buffer.rptr(), &content[0], content.size()) == 0 );
+			}
+			BOOST_CHECK( ar.extract(item.filename).dataSize() == item.buffer.size() );
+			BOOST_CHECK( ar.close() );
+		}
+
+		std::remove(archive_path.generic_string().c_str());
+	}
+
+	for (std::size_t i = 0; i < sources.size(); i++)
+	{
+		std::remove(sources[i].c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Archive_Codec_RoundTrip_Test )
+{
+	// The zip codec is always there, it's raw deflate as stored in zip files
+	BOOST_CHECK( ArchiveCodec::isSupported(ARCHIVE_CODEC_ZIP) );
+
+	std::vector<unsigned char> source(200000);
+	for (std::size_t i = 0; i < source.size(); i++)
+		source[i] = (unsigned char)('a' + (i * i) % 13);
+
+	ArchiveCodecType codecs[] = { ARCHIVE_CODEC_ZIP, ARCHIVE_CODEC_LZ4, ARCHIVE_CODEC_ZSTD };
+	for (std::size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+	{
+		for (int level = -1; level <= 9; level += 5)
+		{
+			shared_ptr<ArchiveCodec> codec = ArchiveCodec::create(codecs[c], level);
+			BOOST_CHECK( !codec == !ArchiveCodec::isSupported(codecs[c]) );
+			if (!codec) continue;
+			BOOST_CHECK( codec->type() == codecs[c] );
+
+			std::vector<unsigned char> compressed(codec->compressBound(source.size()));
+			std::size_t compressed_size = codec->compress(&source[0], source.size(), &compressed[0], compressed.size());
+			BOOST_CHECK( compressed_size > 0 && compressed_size < source.size() );
+
+			std::vector<unsigned char> decompressed(source.size());
+			BOOST_CHECK( codec->decompress(&compressed[0], compressed_size, &decompressed[0], decompressed.size()) );
+			BOOST_CHECK( decompressed == source );
+
+			// the uncompressed size must be exact
+			BOOST_CHECK( !codec->decompress(&compressed[0], compressed_size, &decompressed[0], decompressed.size() - 1) );
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( Archive_Deduplication_Test )
+{
+	ArchiveCodecType codec = ArchiveCodec::isSupported(ARCHIVE_CODEC_LZ4) ? ARCHIVE_CODEC_LZ4 : ARCHIVE_CODEC_ZSTD;
+	if (!ArchiveCodec::isSupported(codec))
+	{
+		BOOST_TEST_MESSAGE("No packed archive codec is built in, skipped");
+		return;
+	}
+
+	// Half of the files are copies of the other half, including a copy of a file streamed in frames
+	const int file_count = 20;
+	std::vector<std::string> sources;
+	std::map<std::string, std::vector<unsigned char> > contents;
+	srand(99);
+	for (int i = 0; i < file_count; i++)
+	{
+		UUID source_filename;
+		source_filename.random();
+		std::string source_filepath = (boost::filesystem::path("/tmp") / (std::string)source_filename).generic_string();
+
+		std::vector<unsigned char>& content = contents[source_filepath];
+		if (i >= file_count / 2)
+			content = contents[sources[i - file_count / 2]];
+		else
+		{
+			content.resize((i == 0) ? 3 * 1024 * 1024 + 5 : 20000 + i);
+			for (std::size_t j = 0; j < content.size(); j++)
+				content[j] = (j % 3 == 0) ? (unsigned char)rand() : (unsigned char)('a' + j % 7);
+		}
+
+		std::ofstream file(source_filepath.c_str(), std::ios::out | std::ios::binary);
+		file.write((const char*)&content[0], content.size());
+		file.close();
+		sources.push_back(source_filepath);
+	}
+
+	ArchiveItem_t item;
+	item.filename = "generated/copy";
+	item.buffer = contents[sources[1]];
+
+	UUID archive_name;
+	archive_name.random();
+	const std::string archive_path = (boost::filesystem::path("/tmp") / ((std::string)archive_name + std::string(".pak"))).generic_string();
+	const std::string plain_path = archive_path + ".plain";
+	const std::string cache_path = archive_path + ".hashes";
+
+	// Build the same archive without and then twice with deduplication, the second time with the hashes cached
+	{
+		Archive ar(plain_path, ArchiveMode::ARCHIVE_FILE_COMPRESS, codec);
+		BOOST_CHECK( ar.addAll(sources) );
+		BOOST_CHECK( ar.add(item) );
+		BOOST_CHECK( ar.close() );
+	}
+	for (int build = 0; build < 2; build++)
+	{
+		Archive ar(archive_path, ArchiveMode::ARCHIVE_FILE_COMPRESS, codec);
+		BOOST_CHECK( ar.setDeduplication(true) );
+		BOOST_CHECK( ar.setHashCache(cache_path) );
+		BOOST_CHECK( ar.add(sources[file_count / 2]) );
+		BOOST_CHECK( ar.addAll(sources) );
+		BOOST_CHECK( ar.add(item) );
+		BOOST_CHECK( !ar.setDeduplication(false) );
+		BOOST_CHECK( ar.close() );
+		BOOST_CHECK( boost::filesystem::file_size(archive_path) * 3 < boost::filesystem::file_size(plain_path) * 2 );
+	}
+	BOOST_CHECK( boost::filesystem::exists(cache_path) );
+
+	// A changed file gets its new content, even with its old hash cached
+	contents[sources[3]].assign(1000, 'c');
+	{
+		std::ofstream file(sources[3].c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write((const char*)&contents[sources[3]][0], contents[sources[3]].size());
+	}
+	{
+		Archive ar(archive_path, ArchiveMode::ARCHIVE_FILE_COMPRESS, codec);
+		BOOST_CHECK( ar.setDeduplication(true) );
+		BOOST_CHECK( ar.setHashCache(cache_path) );
+		BOOST_CHECK( ar.add(sources[file_count / 2]) );
+		BOOST_CHECK( ar.addAll(sources) );
+		BOOST_CHECK( ar.add(item) );
+		BOOST_CHECK( ar.close() );
+	}
+
+	{
+		Archive ar(archive_path, ArchiveMode::ARCHIVE_FILE_DECOMPRESS);
+		std::vector<ArchiveItem_t> archive_items;
+		BOOST_CHECK( ar.extractAll(archive_items) );
+		BOOST_REQUIRE( archive_items.size() == sources.size() + 2 );
+		BOOST_CHECK( archive_items[0].buffer == contents[sources[file_count / 2]] );
+		for (std::size_t i = 0; i < sources.size(); i++)
+		{
+			BOOST_CHECK( archive_items[i + 1].filename == sources[i] );
+			BOOST_CHECK( archive_items[i + 1].buffer == contents[sources[i]] );
+		}
+		BOOST_CHECK( archive_items.back().buffer == item.buffer );
+		BOOST_CHECK( ar.close() );
+	}
+	{
+		Archive ar(archive_path, ArchiveMode::ARCHIVE_FILE_MAPPED);
+		for (std::size_t i = 0; i < sources.size(); i++)
+		{
+			BufferRef<true, false> view = ar.extract(sources[i]);
+			BOOST_REQUIRE( view.buffer() );
+			BOOST_CHECK( view.dataSize() == contents[sources[i]].size() );
+			BOOST_CHECK( std::memcmp(view.rptr(), &contents[sources[i]][0], view.dataSize()) == 0 );
+		}
+		BOOST_CHECK( ar.close() );
+	}
+
+	std::remove(archive_path.c_str());
+	std::remove(plain_path.c_str());
+	std::remove(cache_path.c_str());
+	for (std::size_t i = 0; i < sources.size(); i++)
+	{
+		std::remove(sources[i].c_str());
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,215 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/BloomFilter.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+
+#define BOOST_TEST_MODULE BloomFilterTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( BloomFilterTest )
+
+static const std::size_t numKeys = 100000;
+
+static std::vector<UUID> makeIds(std::size_t n)
+{
+	std::vector<UUID> ids(n);
+	UUID::random_n(&ids[0], n);
+	return ids;
+}
+
+template<typename Filter>
+static std::size_t countFalsePositives(const Filter& filter, std::size_t n)
+{
+	std::vector<UUID> others = makeIds(n);
+	std::size_t positives = 0;
+	for(std::size_t i = 0; i < n; ++i)
+		if(filter.contains(others[i])) ++positives;
+	return positives;
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase1 )
+{
+	std::vector<UUID> ids = makeIds(numKeys);
+	BlockedBloomFilter filter(numKeys, 0.01);
+	BOOST_CHECK(filter.sizeInBytes() == filter.blockCount() * BlockedBloomFilter::BLOCK_SIZE);
+
+	for(std::size_t i = 0; i < numKeys; ++i)
+		filter.insert(ids[i]);
+
+	std::size_t missing = 0;
+	for(std::size_t i = 0; i < numKeys; ++i)
+		if(!filter.contains(ids[i])) ++missing;
+	BOOST_CHECK(missing == 0);
+
+	// the split block layout is a little worse than a classic filter of the same size
+	std::size_t positives = countFalsePositives(filter, numKeys);
+	BOOST_CHECK(positives < numKeys * 2 / 100);
+
+	filter.clear();
+	BOOST_CHECK(countFalsePositives(filter, 1000) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase2 )
+{
+	// time-ordered ids differ in a few bits only, which must still spread over the blocks
+	std::vector<UUID> ids(numKeys);
+	UUID::ordered_n(&ids[0], numKeys);
+
+	BlockedBloomFilter filter(numKeys, 0.01);
+	for(std::size_t i = 0; i < numKeys; ++i)
+		filter.insert(ids[i]);
+	BOOST_CHECK(countFalsePositives(filter, numKeys) < numKeys * 2 / 100);
+}
+
+static void insertRange(BlockedBloomFilter* filter, const std::vector<UUID>* ids, std::size_t begin, std::size_t end)
+{
+	for(std::size_t i = begin; i < end; ++i)
+		filter->insertConcurrent((*ids)[i]);
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase3 )
+{
+	std::vector<UUID> ids = makeIds(numKeys);
+	BlockedBloomFilter concurrent(numKeys, 0.01);
+	BlockedBloomFilter sequential(numKeys, 0.01);
+
+	boost::thread_group threads;
+	for(std::size_t t = 0; t < 4; ++t)
+		threads.create_thread(boost::bind(insertRange, &concurrent, &ids, numKeys * t / 4, numKeys * (t + 1) / 4));
+	threads.join_all();
+
+	for(std::size_t i = 0; i < numKeys; ++i)
+		sequential.insert(ids[i]);
+
+	// no bit is lost to a race, so both filters end up the same
+	Buffer a, b;
+	concurrent.serialize(a);
+	sequential.serialize(b);
+	BOOST_CHECK(a.dataSize() == b.dataSize());
+	BOOST_CHECK(memcmp(a.rptr(), b.rptr(), a.dataSize()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase4 )
+{
+	std::vector<UUID> ids = makeIds(2000);
+	BlockedBloomFilter filter(2000, 0.01);
+	for(std::size_t i = 0; i < 1000; ++i)
+		filter.insert(ids[i]);
+
+	Buffer buffer;
+	filter.serialize(buffer);
+	buffer << (uint32)0x12345678;
+
+	// a different size is replaced by the serialized one
+	BlockedBloomFilter received(10);
+	BOOST_CHECK(received.deserialize(buffer));
+	BOOST_CHECK(received.blockCount() == filter.blockCount());
+	uint32 trailer = 0;
+	buffer >> trailer;
+	BOOST_CHECK(trailer == 0x12345678);
+
+	std::size_t missing = 0;
+	for(std::size_t i = 0; i < 1000; ++i)
+		if(!received.contains(ids[i])) ++missing;
+	BOOST_CHECK(missing == 0);
+
+	BlockedBloomFilter other(2000, 0.01);
+	for(std::size_t i = 1000; i < 2000; ++i)
+		other.insert(ids[i]);
+	BOOST_CHECK(received.merge(other));
+	for(std::size_t i = 0; i < 2000; ++i)
+		if(!received.contains(ids[i])) ++missing;
+	BOOST_CHECK(missing == 0);
+	BOOST_CHECK(!received.merge(BlockedBloomFilter(100000)));
+
+	// truncated or foreign data is rejected without consuming it
+	Buffer truncated;
+	filter.serialize(truncated);
+	truncated.wpos(truncated.wpos() - 1);
+	BOOST_CHECK(!received.deserialize(truncated));
+	BOOST_CHECK(truncated.rpos() == 0);
+
+	CountingBloomFilter counting;
+	Buffer foreign;
+	counting.serialize(foreign);
+	BOOST_CHECK(!received.deserialize(foreign));
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase5 )
+{
+	std::vector<UUID> ids = makeIds(numKeys);
+	CountingBloomFilter filter(numKeys, 0.01);
+	BOOST_CHECK(filter.sizeInBytes() == filter.blockCount() * CountingBloomFilter::BLOCK_SIZE);
+
+	for(std::size_t i = 0; i < numKeys; ++i)
+		filter.insert(ids[i]);
+	BOOST_CHECK(countFalsePositives(filter, numKeys) < numKeys * 2 / 100);
+
+	// remove half of the keys, the other half is still there
+	std::size_t failed = 0;
+	for(std::size_t i = 0; i < numKeys; i += 2)
+		if(!filter.remove(ids[i])) ++failed;
+	BOOST_CHECK(failed == 0);
+
+	std::size_t missing = 0;
+	std::size_t remaining = 0;
+	for(std::size_t i = 0; i < numKeys; ++i)
+	{
+		if(i % 2)
+		{
+			if(!filter.contains(ids[i])) ++missing;
+		}
+		else if(filter.contains(ids[i]))
+		{
+			++remaining;
+		}
+	}
+	BOOST_CHECK(missing == 0);
+	BOOST_CHECK(remaining < numKeys / 2 * 2 / 100);
+
+	Buffer buffer;
+	filter.serialize(buffer);
+	CountingBloomFilter received;
+	BOOST_CHECK(received.deserialize(buffer));
+	for(std::size_t i = 1; i < numKeys; i += 2)
+		if(!received.remove(ids[i])) ++failed;
+	BOOST_CHECK(failed == 0);
+	BOOST_CHECK(countFalsePositives(received, 1000) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( BloomFilterTestCase6 )
+{
+	// saturated counters stay, so a key sharing them is never lost
+	CountingBloomFilter filter(1);
+	for(int i = 0; i < 100; ++i)
+		filter.insert(42);
+	for(int i = 0; i < 100; ++i)
+		filter.remove(42);
+	BOOST_CHECK(filter.contains(42));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,211 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/archive/BufferCompressor.h"
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#define BOOST_TEST_MODULE BufferCompressorTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE( BufferCompressorTest )
+
+static std::string makeMessage(int id)
+{
+	std::ostringstream ss;
+	ss << "{\"type\":\"position_update\",\"session\":" << id << ",\"x\":" << id * 7 << ",\"y\":" << id * 13 << ",\"zone\":\"market_square\",\"flags\":[\"visible\",\"moving\"]}";
+	return ss.str();
+}
+
+static void fill(Buffer& buffer, const std::string& data)
+{
+	buffer.writeArray(data.data(), data.size());
+}
+
+static std::string drain(Buffer& buffer)
+{
+	std::string data((const char*)buffer.rptr(), buffer.dataSize());
+	buffer.rskip(buffer.dataSize());
+	return data;
+}
+
+BOOST_AUTO_TEST_CASE( BufferCompressor_Threshold_Test )
+{
+	BufferCompressor compressor(BufferCompressor::Mode::independent, 64);
+	Buffer message;
+	Buffer frame;
+	Buffer result;
+
+	// small messages are passed through behind the header
+	fill(message, "ping");
+	BOOST_CHECK(compressor.compressInto(message, frame));
+	BOOST_CHECK_EQUAL(message.dataSize(), 0UL);
+	BOOST_CHECK_EQUAL(frame.dataSize(), (std::size_t)BufferCompressor::HEADER_SIZE + 4);
+
+	BOOST_CHECK(compressor.decompressInto(frame, result));
+	BOOST_CHECK_EQUAL(frame.dataSize(), 0UL);
+	BOOST_CHECK(drain(result) == "ping");
+
+	// an incomplete frame is left in the source
+	fill(message, "ping");
+	compressor.compressInto(message, frame);
+	Buffer partial;
+	partial.writeArray((const char*)frame.rptr(), frame.dataSize() - 1);
+	BOOST_CHECK(!compressor.decompressInto(partial, result));
+	BOOST_CHECK_EQUAL(partial.dataSize(), frame.dataSize() - 1);
+	BOOST_CHECK_EQUAL(result.dataSize(), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE( BufferCompressor_Independent_Test )
+{
+	BufferCompressor compressor;
+	std::string original;
+	for(int i = 0; i < 32; ++i)
+		original += makeMessage(i);
+
+	Buffer message;
+	Buffer frames;
+	fill(message, original);
+	BOOST_CHECK(compressor.compressInto(message, frames));
+	fill(message, original);
+	BOOST_CHECK(compressor.compressInto(message, frames));
+	if(BufferCompressor::isSupported())
+		BOOST_CHECK_LT(frames.dataSize(), original.size());
+
+	// independent frames can be decompressed by any compressor
+	BufferCompressor other;
+	Buffer result;
+	BOOST_CHECK(other.decompressInto(frames, result));
+	BOOST_CHECK(drain(result) == original);
+	BOOST_CHECK(compressor.decompressInto(frames, result));
+	BOOST_CHECK(drain(result) == original);
+	BOOST_CHECK_EQUAL(frames.dataSize(), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE( BufferCompressor_Streaming_Test )
+{
+	// the messages are below the default threshold, but in streaming mode short messages compress the best
+	BufferCompressor sender(BufferCompressor::Mode::streaming, 16);
+	BufferCompressor receiver(BufferCompressor::Mode::streaming, 16);
+	BufferCompressor independent(BufferCompressor::Mode::independent, 16);
+
+	std::size_t streamed = 0;
+	std::size_t unstreamed = 0;
+	Buffer message;
+	Buffer frame;
+	Buffer result;
+	for(int i = 0; i < 2000; ++i)
+	{
+		const std::string original = makeMessage(i);
+
+		fill(message, original);
+		BOOST_REQUIRE(independent.compressInto(message, frame));
+		unstreamed += frame.dataSize();
+		frame.clear();
+
+		fill(message, original);
+		BOOST_REQUIRE(sender.compressInto(message, frame));
+		streamed += frame.dataSize();
+
+		BOOST_REQUIRE(receiver.decompressInto(frame, result));
+		BOOST_REQUIRE(drain(result) == original);
+		frame.clear();
+		result.clear();
+	}
+
+	// the previous messages make each message cheaper to encode
+	if(BufferCompressor::isSupported())
+		BOOST_CHECK_LT(streamed, unstreamed);
+
+	sender.reset();
+	receiver.reset();
+	fill(message, makeMessage(0) + makeMessage(1));
+	BOOST_CHECK(sender.compressInto(message, frame));
+	BOOST_CHECK(receiver.decompressInto(frame, result));
+	BOOST_CHECK(drain(result) == makeMessage(0) + makeMessage(1));
+}
+
+BOOST_AUTO_TEST_CASE( BufferCompressor_Incompressible_Test )
+{
+	BufferCompressor sender(BufferCompressor::Mode::streaming);
+	BufferCompressor receiver(BufferCompressor::Mode::streaming);
+
+	std::string noise;
+	uint32 seed = 2463534242U;
+	for(int i = 0; i < 4096; ++i)
+	{
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+		noise.push_back((char)seed);
+	}
+
+	// a stored message must not end up in the dictionary of either side
+	const std::string messages[] = { makeMessage(1) + makeMessage(2), noise, makeMessage(3) + makeMessage(4) };
+	Buffer message;
+	Buffer frame;
+	Buffer result;
+	for(int i = 0; i < 3; ++i)
+	{
+		fill(message, messages[i]);
+		BOOST_CHECK(sender.compressInto(message, frame));
+		if(i == 1)
+			BOOST_CHECK_EQUAL(frame.dataSize(), (std::size_t)BufferCompressor::HEADER_SIZE + noise.size());
+		BOOST_CHECK(receiver.decompressInto(frame, result));
+		BOOST_CHECK(drain(result) == messages[i]);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( BufferCompressor_FixedBuffer_Test )
+{
+	// uncompressed frames never fit in half the message size
+	if(!BufferCompressor::isSupported())
+		return;
+
+	BufferCompressor compressor;
+	std::string original;
+	for(int i = 0; i < 64; ++i)
+		original += makeMessage(i);
+
+	// too small for the worst case, so it goes through the scratch buffer
+	Buffer frame(original.size() / 2);
+	Buffer message;
+	fill(message, original);
+	BOOST_CHECK(compressor.compressInto(message, frame));
+	BOOST_CHECK_EQUAL(message.dataSize(), 0UL);
+
+	// not even the compressed message fits
+	Buffer tiny(16);
+	fill(message, original);
+	BOOST_CHECK(!compressor.compressInto(message, tiny));
+	BOOST_CHECK_EQUAL(message.dataSize(), original.size());
+	BOOST_CHECK_EQUAL(tiny.dataSize(), 0UL);
+
+	Buffer small(original.size() - 1);
+	BOOST_CHECK(!compressor.decompressInto(frame, small));
+	Buffer result(original.size());
+	BOOST_CHECK(compressor.decompressInto(frame, result));
+	BOOST_CHECK(drain(result) == original);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
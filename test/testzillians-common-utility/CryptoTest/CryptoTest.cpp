@@ -22,6 +22,8 @@
 
 #include "core/Prerequisite.h"
 #include "utility/crypto/Crypto.h"
+#include "utility/crypto/base64.h"
+#include "core/Buffer.h"
 #include <tr1/unordered_set>
 #include <boost/type_traits.hpp>
 #include <boost/mpl/if.hpp>
@@ -33,6 +35,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <stdlib.h>
+#include <tbb/tick_count.h>
 
 #define BOOST_TEST_MODULE CryptoTest
 #define BOOST_TEST_MAIN
@@ -92,4 +95,208 @@ BOOST_AUTO_TEST_CASE( Cipher_AES_256_CBC_Test )
 	std::remove(encrypt_filepath.c_str());
 }
 
+static std::vector<unsigned char> randomBytes(std::size_t size)
+{
+	std::vector<unsigned char> bytes(size);
+	for(std::size_t i = 0; i < size; ++i)
+		bytes[i] = (unsigned char)(rand() & 0xFF);
+	return bytes;
+}
+
+BOOST_AUTO_TEST_CASE( CipherContext_AES_256_CBC_Test )
+{
+	std::string key = "37006c38e5a711e0b49b6cf0490d7a2f";
+	std::string iv = "4fcab246e5a711e0a5c36cf0490d7a2f";
+	std::vector<unsigned char> source_buffer = randomBytes(100000);
+
+	std::vector<unsigned char> expected;
+	BOOST_REQUIRE( Crypto_t::symmetricCipher(source_buffer, NID_aes_256_cbc, key, iv, true, expected) );
+
+	// Streaming in uneven pieces gives the same ciphertext, for two messages on the same context
+	CipherContext context;
+	BOOST_REQUIRE( context.init(NID_aes_256_cbc, key, iv, true) );
+	for(int message = 0; message < 2; ++message)
+	{
+		std::vector<unsigned char> encrypt_buffer(source_buffer.size() + context.blockSize());
+		std::size_t offset = 0;
+		std::size_t total = 0;
+		while(offset < source_buffer.size())
+		{
+			std::size_t piece = std::min<std::size_t>(1 + rand() % 3000, source_buffer.size() - offset);
+			std::size_t written = 0;
+			BOOST_REQUIRE( context.update((const byte*)&source_buffer[offset], piece, (byte*)&encrypt_buffer[total], written) );
+			offset += piece;
+			total += written;
+		}
+		std::size_t written = 0;
+		BOOST_REQUIRE( context.final((byte*)&encrypt_buffer[total], written) );
+		encrypt_buffer.resize(total + written);
+		BOOST_CHECK( encrypt_buffer == expected );
+
+		BOOST_REQUIRE( context.reset(iv) );
+	}
+
+	std::vector<unsigned char> decrypt_buffer;
+	BOOST_CHECK( Crypto_t::symmetricCipher(expected, NID_aes_256_cbc, key, iv, false, decrypt_buffer) );
+	BOOST_CHECK( decrypt_buffer == source_buffer );
+
+	// Block modes can't be done in place over buffers
+	Buffer b(1024);
+	b.writeArray((const char*)&source_buffer[0], 100);
+	BOOST_CHECK( !context.update(b) );
+
+	BOOST_CHECK( !context.init(NID_aes_256_cbc, "short key", iv, true) );
+}
+
+static void testAEAD(int nid)
+{
+	std::string key = "37006c38e5a711e0b49b6cf0490d7a2f";
+	std::string nonce = "4fcab246e5a7";
+	std::string aad = "header";
+	std::vector<unsigned char> source_buffer = randomBytes(300);
+
+	// Encrypt in place over the physical ranges of a circular buffer, wrapping around its end
+	CircularBuffer b(512);
+	std::vector<unsigned char> head = randomBytes(400);
+	b.writeArray((const char*)&head[0], head.size());
+	b.rskip(head.size());
+	b.writeArray((const char*)&source_buffer[0], source_buffer.size());
+
+	CipherContext encoder;
+	BOOST_REQUIRE( encoder.init(nid, key, nonce, true) );
+	BOOST_CHECK( encoder.isAEAD() );
+	BOOST_REQUIRE( encoder.updateAAD((const byte*)aad.data(), aad.size()) );
+	BOOST_REQUIRE( encoder.update(b) );
+	std::size_t written = 0;
+	byte tag[16];
+	BOOST_REQUIRE( encoder.final(NULL, written) );
+	BOOST_CHECK( written == 0 );
+	BOOST_REQUIRE( encoder.getTag(tag, sizeof(tag)) );
+
+	std::vector<unsigned char> encrypt_buffer(source_buffer.size());
+	b.readArray((char*)&encrypt_buffer[0], encrypt_buffer.size());
+	BOOST_CHECK( encrypt_buffer != source_buffer );
+
+	// Decrypt and verify the tag, then again on the same context with a tampered ciphertext
+	CipherContext decoder;
+	BOOST_REQUIRE( decoder.init(nid, key, nonce, false) );
+	for(int round = 0; round < 2; ++round)
+	{
+		std::vector<unsigned char> input = encrypt_buffer;
+		if(round == 1)
+			input[123] ^= 1;
+
+		std::vector<unsigned char> decrypt_buffer(input.size());
+		BOOST_REQUIRE( decoder.reset(nonce) );
+		BOOST_REQUIRE( decoder.updateAAD((const byte*)aad.data(), aad.size()) );
+		BOOST_REQUIRE( decoder.update((const byte*)&input[0], input.size(), (byte*)&decrypt_buffer[0], written) );
+		BOOST_CHECK( written == input.size() );
+		BOOST_REQUIRE( decoder.setTag(tag, sizeof(tag)) );
+
+		bool verified = decoder.final(NULL, written);
+		BOOST_CHECK( verified == (round == 0) );
+		if(round == 0)
+			BOOST_CHECK( decrypt_buffer == source_buffer );
+	}
+}
+
+BOOST_AUTO_TEST_CASE( CipherContext_AES_256_GCM_Test )
+{
+	testAEAD(NID_aes_256_gcm);
+}
+
+#ifdef NID_chacha20_poly1305
+BOOST_AUTO_TEST_CASE( CipherContext_ChaCha20_Poly1305_Test )
+{
+	testAEAD(NID_chacha20_poly1305);
+}
+#endif
+
+static std::string encode64(const std::string& s)
+{
+	std::string out(base64_encoded_size(s.size()), '\0');
+	BOOST_CHECK( base64_encode((const unsigned char*)s.data(), s.size(), &out[0]) == out.size() );
+	return out;
+}
+
+static bool decode64(const std::string& s, std::string& out)
+{
+	out.assign(base64_decoded_size(s.data(), s.size()), '\0');
+	std::size_t written = 0;
+	bool result = base64_decode(s.data(), s.size(), (unsigned char*)&out[0], written);
+	if(result)
+		BOOST_CHECK( written == out.size() );
+	return result;
+}
+
+BOOST_AUTO_TEST_CASE( Base64_Test )
+{
+	// RFC 4648 test vectors
+	const char* plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+	const char* encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+	for(int i = 0; i < 7; ++i)
+	{
+		BOOST_CHECK( encode64(plain[i]) == encoded[i] );
+		BOOST_CHECK( base64_encode((const unsigned char*)plain[i], strlen(plain[i])) == encoded[i] );
+
+		std::string decoded;
+		BOOST_CHECK( decode64(encoded[i], decoded) && decoded == plain[i] );
+		BOOST_CHECK( base64_decode(encoded[i]) == plain[i] );
+	}
+
+	// round trip of all lengths across the vectorized block sizes, with and without padding
+	srand(64);
+	for(std::size_t size = 0; size < 300; ++size)
+	{
+		std::vector<unsigned char> bytes = randomBytes(size);
+		std::string s(bytes.begin(), bytes.end());
+		std::string e = encode64(s);
+
+		std::string decoded;
+		BOOST_CHECK( decode64(e, decoded) && decoded == s );
+		std::string unpadded = e.substr(0, e.find('='));
+		BOOST_CHECK( decode64(unpadded, decoded) && decoded == s );
+	}
+
+	// invalid characters are caught anywhere, the string version decodes up to them
+	std::string e = encode64(std::string(200, 'z'));
+	for(std::size_t i = 0; i < e.size(); ++i)
+	{
+		std::string broken = e;
+		broken[i] = (i % 2) ? '*' : (char)0xC3;
+
+		std::string decoded;
+		BOOST_CHECK( !decode64(broken, decoded) );
+		BOOST_CHECK( base64_decode(broken) == std::string(i / 4 * 3 + (i % 4 ? i % 4 - 1 : 0), 'z') );
+	}
+	std::string decoded;
+	BOOST_CHECK( !decode64("Zm9vY", decoded) );
+
+	std::string basic = Crypto_t::encryptStringBasic("Hello, World", "key");
+	BOOST_CHECK( base64_decode(basic).size() == 12 );
+	BOOST_CHECK( Crypto_t::decryptStringBasic(basic, "key") == "Hello, World" );
+}
+
+BOOST_AUTO_TEST_CASE( Base64_Performance_Test )
+{
+	std::vector<unsigned char> bytes = randomBytes(48 * 1024);
+	std::string e(base64_encoded_size(bytes.size()), '\0');
+	std::vector<unsigned char> d(bytes.size());
+	const int iterations = 1000;
+
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+		base64_encode(&bytes[0], bytes.size(), &e[0]);
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("base64_encode takes %lf ns per byte\n", (end - start).seconds() * 1.0e9 / (double)(bytes.size() * iterations));
+
+	std::size_t written = 0;
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+		base64_decode(e.data(), e.size(), &d[0], written);
+	end = tbb::tick_count::now();
+	printf("base64_decode takes %lf ns per byte\n", (end - start).seconds() * 1.0e9 / (double)(bytes.size() * iterations));
+	BOOST_CHECK( d == bytes );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/DemanglingUtil.h"
+#include <atomic>
+#include <map>
+#include <vector>
+
+#define BOOST_TEST_MODULE DemanglingUtilTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+namespace {
+
+template<int N>
+struct Dummy
+{ };
+
+}
+
+BOOST_AUTO_TEST_SUITE( DemanglingUtilTestSuite )
+
+BOOST_AUTO_TEST_CASE( DemanglingUtilTestCase1 )
+{
+	BOOST_CHECK_EQUAL(demangle<int>(), "int");
+	BOOST_CHECK_EQUAL(demangle(typeid(std::vector<int>)), demangle<std::vector<int> >());
+	BOOST_CHECK_EQUAL((demangle_tuple<boost::tuple<int, float> >()), "tuple<int,float>");
+
+	// names are demangled once and handed out from the cache
+	BOOST_CHECK(&demangle(typeid(double)) == &demangle(typeid(double)));
+	BOOST_CHECK(&demangle<double>() == &demangle(typeid(double)));
+}
+
+BOOST_AUTO_TEST_CASE( DemanglingUtilTestCase2 )
+{
+	const std::type_info* types[] = { &typeid(Dummy<0>), &typeid(Dummy<1>), &typeid(Dummy<2>), &typeid(Dummy<3>), &typeid(Dummy<4>), &typeid(Dummy<5>) };
+	const int count = sizeof(types) / sizeof(types[0]);
+
+	std::atomic<int> failures(0);
+	std::vector<const std::string*> names[4];
+	boost::thread_group group;
+	for(int t = 0; t < 4; ++t)
+	{
+		group.create_thread([&, t] {
+			for(int i = 0; i < 1000; ++i)
+			{
+				const std::string& name = demangle(*types[(i + t) % count]);
+				if(name.find("Dummy") == std::string::npos)
+					++failures;
+				if(i < count)
+					names[t].push_back(&name);
+			}
+		});
+	}
+	group.join_all();
+	BOOST_CHECK_EQUAL(failures.load(), 0);
+
+	// every thread got the same string for the same type
+	for(int t = 1; t < 4; ++t)
+		for(int i = 0; i < count; ++i)
+			BOOST_CHECK(names[t][(i + count - t) % count] == names[0][i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,541 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/DependencySolver.h"
+#include "utility/DependencySnapshot.h"
+#include <tbb/atomic.h>
+#include <tbb/spin_mutex.h>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <boost/lexical_cast.hpp>
+
+#define BOOST_TEST_MODULE DependencySolverTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( DependencySolverTestSuite )
+
+static void buildGraph(DependencySolver& solver)
+{
+	// a and b need nothing, c needs a, d needs a and b, e needs c and d
+	const char* nodes[] = { "a", "b", "c", "d", "e" };
+	for(int i = 0; i < 5; ++i)
+		BOOST_CHECK(solver.addNode(nodes[i]));
+
+	BOOST_CHECK(solver.addDependency("c", "a"));
+	BOOST_CHECK(solver.addDependency("d", "a"));
+	BOOST_CHECK(solver.addDependency("d", "b"));
+	BOOST_CHECK(solver.addDependency("e", "c"));
+	BOOST_CHECK(solver.addDependency("e", "d"));
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase1 )
+{
+	DependencySolver solver;
+	buildGraph(solver);
+
+	DependencySolver::Levels levels;
+	BOOST_REQUIRE(solver.compileTopologicalLevels(levels));
+	BOOST_REQUIRE(levels.size() == 3);
+
+	std::map<std::string, std::size_t> levelOf;
+	for(std::size_t i = 0; i < levels.size(); ++i)
+		for(std::size_t j = 0; j < levels[i].size(); ++j)
+			levelOf[levels[i][j]] = i;
+
+	BOOST_CHECK(levelOf.size() == 5);
+	BOOST_CHECK(levelOf["a"] == 0 && levelOf["b"] == 0);
+	BOOST_CHECK(levelOf["c"] == 1 && levelOf["d"] == 1);
+	BOOST_CHECK(levelOf["e"] == 2);
+
+	// a cycle is rejected right away and leaves the graph as it was
+	BOOST_CHECK(!solver.addDependency("a", "e"));
+	BOOST_CHECK(!solver.isDependencyExist("a", "e"));
+	BOOST_CHECK(!solver.addDependency("a", "a"));
+	BOOST_CHECK(solver.compileTopologicalLevels(levels));
+	BOOST_CHECK(levels.size() == 3);
+}
+
+struct Recorder
+{
+	Recorder(tbb::spin_mutex* lock, std::vector<std::string>* order) : lock(lock), order(order)
+	{ }
+
+	void operator() (const std::string& id) const
+	{
+		tbb::spin_mutex::scoped_lock l(*lock);
+		order->push_back(id);
+	}
+
+	tbb::spin_mutex* lock;
+	std::vector<std::string>* order;
+};
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase2 )
+{
+	DependencySolver solver;
+	buildGraph(solver);
+
+	tbb::spin_mutex lock;
+	std::vector<std::string> order;
+	BOOST_REQUIRE(solver.execute(Recorder(&lock, &order)));
+	BOOST_REQUIRE(order.size() == 5);
+
+	// every node runs after all of its requirements
+	std::map<std::string, std::size_t> position;
+	for(std::size_t i = 0; i < order.size(); ++i)
+		position[order[i]] = i;
+	BOOST_CHECK(position["c"] > position["a"]);
+	BOOST_CHECK(position["d"] > position["a"] && position["d"] > position["b"]);
+	BOOST_CHECK(position["e"] > position["c"] && position["e"] > position["d"]);
+
+	BOOST_CHECK(!solver.addDependency("a", "e"));
+	order.clear();
+	BOOST_CHECK(solver.execute(Recorder(&lock, &order)));
+	BOOST_CHECK(order.size() == 5);
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase3 )
+{
+	DependencySolver solver;
+	buildGraph(solver);
+
+	BOOST_CHECK(!solver.addNode("a"));
+	BOOST_CHECK(!solver.addDependency("c", "a"));
+	BOOST_CHECK(!solver.addDependency("c", "x"));
+	BOOST_CHECK(solver.isDependencyExist("d", "b"));
+	BOOST_CHECK(!solver.isDependencyExist("b", "d"));
+
+	std::list<std::string> order;
+	BOOST_REQUIRE(solver.compileTopologicalOrder(order));
+	BOOST_CHECK(order.size() == 5);
+	BOOST_CHECK(order.back() == "e");
+
+	order.clear();
+	BOOST_REQUIRE(solver.compileReversedTopologicalOrder(order));
+	BOOST_CHECK(order.front() == "e");
+
+	order.clear();
+	BOOST_REQUIRE(solver.compileRequireNodes("d", order));
+	BOOST_CHECK(order.size() == 2);
+	BOOST_CHECK(std::find(order.begin(), order.end(), "c") == order.end());
+
+	order.clear();
+	BOOST_REQUIRE(solver.compileDependentNodes("a", order));
+	BOOST_REQUIRE(order.size() == 3);
+	BOOST_CHECK(order.front() == "e");
+	BOOST_CHECK(!solver.compileDependentNodes("x", order));
+
+	// the id of a removed node goes to the next node added
+	DependencySolver::NodeId d = solver.getNodeId("d");
+	BOOST_CHECK(solver.removeNode("d"));
+	BOOST_CHECK(!solver.isNodeExist("d"));
+	BOOST_CHECK(!solver.isDependencyExist("e", "d"));
+	BOOST_CHECK(solver.getNodeId("d") == DependencySolver::invalidNodeId());
+	BOOST_CHECK(solver.getNodeCount() == 4);
+
+	BOOST_CHECK(solver.addNode("f"));
+	BOOST_CHECK(solver.getNodeId("f") == d);
+	BOOST_CHECK(solver.getNodeName(d) == "f");
+	BOOST_CHECK(solver.addDependency(solver.getNodeId("f"), solver.getNodeId("e")));
+	BOOST_CHECK(solver.removeDependency("e", "c"));
+
+	DependencySolver::Levels levels;
+	BOOST_REQUIRE(solver.compileTopologicalLevels(levels));
+	BOOST_REQUIRE(levels.size() == 2);
+	BOOST_CHECK(levels[0].size() == 3);
+	BOOST_CHECK(std::find(levels[1].begin(), levels[1].end(), "f") != levels[1].end());
+
+	solver.clear();
+	BOOST_CHECK(solver.getNodeCount() == 0);
+	BOOST_CHECK(!solver.isNodeExist("a"));
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase4 )
+{
+	// a long chain and a wide fan-out, deeper than any recursion would survive
+	const int count = 200000;
+	DependencySolver solver;
+	for(int i = 0; i < count; ++i)
+		BOOST_CHECK(solver.addNode("node" + boost::lexical_cast<std::string>(i)));
+
+	std::vector<DependencySolver::NodeId> ids;
+	for(int i = 0; i < count; ++i)
+		ids.push_back(solver.getNodeId("node" + boost::lexical_cast<std::string>(i)));
+	for(int i = 1; i < count / 2; ++i)
+		BOOST_CHECK(solver.addDependency(ids[i], ids[i - 1]));
+	for(int i = count / 2; i < count; ++i)
+		BOOST_CHECK(solver.addDependency(ids[i], ids[0]));
+
+	DependencySolver::NodeIdLevels levels;
+	BOOST_REQUIRE(solver.compileTopologicalLevels(levels));
+	BOOST_CHECK(levels.size() == (std::size_t)(count / 2));
+	BOOST_CHECK(levels[1].size() == (std::size_t)(count / 2 + 1));
+
+	std::list<std::string> order;
+	BOOST_REQUIRE(solver.compileRequireNodes("node" + boost::lexical_cast<std::string>(count / 2 - 1), order));
+	BOOST_CHECK(order.size() == (std::size_t)(count / 2 - 1));
+	BOOST_CHECK(order.front() == "node0");
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase5 )
+{
+	// random dependencies added in an order unrelated to the final one, the
+	// maintained order must satisfy every dependency after each change
+	const int count = 300;
+	DependencySolver solver;
+	std::vector<DependencySolver::NodeId> ids;
+	for(int i = 0; i < count; ++i)
+	{
+		BOOST_CHECK(solver.addNode("node" + boost::lexical_cast<std::string>(i)));
+		ids.push_back(solver.getNodeId("node" + boost::lexical_cast<std::string>(i)));
+	}
+
+	// node i only requires nodes j > i, so requiring it back from j is always a cycle
+	srand(7);
+	std::vector< std::pair<int, int> > edges;
+	int rejected = 0;
+	for(int n = 0; n < 3000; ++n)
+	{
+		int i = rand() % count;
+		int j = rand() % count;
+		if(i == j || solver.isDependencyExist(ids[std::min(i, j)], ids[std::max(i, j)]))
+			continue;
+
+		BOOST_CHECK(solver.addDependency(ids[std::min(i, j)], ids[std::max(i, j)]));
+		edges.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
+
+		// close a cycle through the new dependency, directly or through a longer path
+		int k = rand() % count;
+		if(k < std::min(i, j) && solver.isDependencyExist(ids[k], ids[std::min(i, j)]))
+		{
+			BOOST_CHECK(!solver.addDependency(ids[std::max(i, j)], ids[k]));
+			++rejected;
+		}
+		BOOST_CHECK(!solver.addDependency(ids[std::max(i, j)], ids[std::min(i, j)]));
+
+		if(n % 100 == 0 && !edges.empty())
+		{
+			std::size_t k = rand() % edges.size();
+			BOOST_CHECK(solver.removeDependency(ids[edges[k].first], ids[edges[k].second]));
+			edges[k] = edges.back();
+			edges.pop_back();
+		}
+	}
+	BOOST_CHECK(rejected > 0);
+
+	std::list<std::string> order;
+	BOOST_REQUIRE(solver.compileTopologicalOrder(order));
+	BOOST_REQUIRE(order.size() == (std::size_t)count);
+
+	std::map<std::string, std::size_t> position;
+	std::size_t p = 0;
+	for(std::list<std::string>::iterator it = order.begin(); it != order.end(); ++it)
+		position[*it] = p++;
+
+	for(std::size_t k = 0; k < edges.size(); ++k)
+	{
+		BOOST_CHECK(solver.isDependencyExist(ids[edges[k].first], ids[edges[k].second]));
+		BOOST_CHECK(position[solver.getNodeName(ids[edges[k].first])] > position[solver.getNodeName(ids[edges[k].second])]);
+	}
+
+	// the levels computed from scratch agree with the maintained order
+	DependencySolver::Levels levels;
+	BOOST_REQUIRE(solver.compileTopologicalLevels(levels));
+	std::size_t total = 0;
+	for(std::size_t i = 0; i < levels.size(); ++i)
+		total += levels[i].size();
+	BOOST_CHECK(total == (std::size_t)count);
+
+	// removing most nodes compacts the order, which must stay valid
+	for(int i = 1; i < count; i += 2)
+		BOOST_CHECK(solver.removeNode(ids[i]));
+	for(int i = 4; i < count; i += 6)
+		BOOST_CHECK(solver.removeNode(ids[i]));
+
+	order.clear();
+	BOOST_REQUIRE(solver.compileTopologicalOrder(order));
+	BOOST_CHECK(order.size() == solver.getNodeCount());
+	BOOST_CHECK(solver.addNode("last"));
+	BOOST_CHECK(solver.addDependency("node2", "last"));
+	order.clear();
+	BOOST_REQUIRE(solver.compileReversedTopologicalOrder(order));
+	BOOST_REQUIRE(std::find(order.begin(), order.end(), "node2") != order.end());
+	BOOST_CHECK(std::distance(order.begin(), std::find(order.begin(), order.end(), "node2")) < std::distance(order.begin(), std::find(order.begin(), order.end(), "last")));
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase6 )
+{
+	// memoized closures agree with the graph after every kind of change
+	DependencySolver solver;
+	for(int i = 0; i < 6; ++i)
+		BOOST_CHECK(solver.addNode("m" + boost::lexical_cast<std::string>(i)));
+	// m5 -> m4 -> m3 -> m1 -> m0, m2 -> m1
+	BOOST_CHECK(solver.addDependency("m1", "m0"));
+	BOOST_CHECK(solver.addDependency("m2", "m1"));
+	BOOST_CHECK(solver.addDependency("m3", "m1"));
+	BOOST_CHECK(solver.addDependency("m4", "m3"));
+	BOOST_CHECK(solver.addDependency("m5", "m4"));
+
+	const DependencySolver::NodeId m0 = solver.getNodeId("m0");
+	const DependencySolver::NodeId m1 = solver.getNodeId("m1");
+	const DependencySolver::NodeId m3 = solver.getNodeId("m3");
+	const DependencySolver::NodeId m5 = solver.getNodeId("m5");
+
+	std::vector<DependencySolver::NodeId> result;
+	BOOST_REQUIRE(solver.compileRequireNodes(m5, result));
+	BOOST_CHECK(result.size() == 4 && result.front() == m0 && result.back() == solver.getNodeId("m4"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m5, result));
+	BOOST_CHECK(result.size() == 4);
+	BOOST_REQUIRE(solver.compileDependentNodes(m0, result));
+	BOOST_CHECK(result.size() == 5 && result.back() == m1);
+	BOOST_REQUIRE(solver.compileDependentNodes(m3, result));
+	BOOST_CHECK(result.size() == 2 && result.front() == m5);
+
+	// a removed dependency shrinks the closures on both sides
+	BOOST_CHECK(solver.removeDependency("m3", "m1"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m5, result));
+	BOOST_CHECK(result.size() == 2);
+	BOOST_REQUIRE(solver.compileDependentNodes(m0, result));
+	BOOST_CHECK(result.size() == 2);
+	BOOST_REQUIRE(solver.compileDependentNodes(m3, result));
+	BOOST_CHECK(result.size() == 2);
+
+	// m3 -> m0 needs no reordering, m0 -> m2 moves m0 behind m2
+	BOOST_CHECK(solver.addDependency("m3", "m0"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m5, result));
+	BOOST_CHECK(result.size() == 3 && result.front() == m0);
+	BOOST_CHECK(solver.removeDependency("m1", "m0"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m3, result));
+	BOOST_CHECK(result.size() == 1);
+	BOOST_CHECK(solver.addDependency("m0", "m2"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m3, result));
+	BOOST_CHECK(result.size() == 3 && result.front() == m1 && result.back() == m0);
+	BOOST_REQUIRE(solver.compileDependentNodes(solver.getNodeId("m2"), result));
+	BOOST_CHECK(result.size() == 4 && result.front() == m5 && result.back() == m0);
+	std::list<std::string> names;
+	BOOST_REQUIRE(solver.compileRequireNodes("m5", names));
+	BOOST_CHECK(names.size() == 5 && names.front() == "m1" && names.back() == "m4");
+
+	// a removed node leaves all closures it was part of
+	BOOST_CHECK(solver.removeNode("m0"));
+	BOOST_REQUIRE(solver.compileRequireNodes(m3, result));
+	BOOST_CHECK(result.empty());
+	BOOST_REQUIRE(solver.compileDependentNodes(m1, result));
+	BOOST_CHECK(result.size() == 1);
+	BOOST_CHECK(!solver.compileRequireNodes(m0, result));
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase7 )
+{
+	// concurrent readers compile and share the memoized closures
+	const int count = 2000;
+	DependencySolver solver;
+	std::vector<DependencySolver::NodeId> ids(count);
+	for(int i = 0; i < count; ++i)
+	{
+		BOOST_CHECK(solver.addNode("node" + boost::lexical_cast<std::string>(i)));
+		ids[i] = solver.getNodeId("node" + boost::lexical_cast<std::string>(i));
+	}
+	// every node requires the one before, and every tenth node the one ten before
+	for(int i = 1; i < count; ++i)
+	{
+		BOOST_CHECK(solver.addDependency(ids[i], ids[i - 1]));
+		if(i >= 10 && i % 10 == 0)
+			BOOST_CHECK(solver.addDependency(ids[i], ids[i - 10]));
+	}
+
+	const int threads = 4;
+	tbb::atomic<int> failures;
+	failures = 0;
+	boost::thread_group group;
+	for(int t = 0; t < threads; ++t)
+	{
+		group.create_thread([&, t] {
+			std::vector<DependencySolver::NodeId> result;
+			for(int i = 0; i < count; i += 7)
+			{
+				const int k = (t % 2) ? i : count - 1 - i;
+				if(!solver.compileRequireNodes(ids[k], result) || result.size() != (std::size_t)k)
+					++failures;
+				else if(k > 0 && (result.front() != ids[0] || result.back() != ids[k - 1]))
+					++failures;
+				if(!solver.compileDependentNodes(ids[k], result) || result.size() != (std::size_t)(count - 1 - k))
+					++failures;
+				else if(k < count - 1 && (result.front() != ids[count - 1] || result.back() != ids[k + 1]))
+					++failures;
+			}
+		});
+	}
+	group.join_all();
+	BOOST_CHECK(failures == 0);
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase8 )
+{
+	// a snapshot answers the same queries in place, with ids in load order
+	const std::string path = "DependencySolverTestCase8.dep";
+	DependencySolver solver;
+	buildGraph(solver);
+	BOOST_CHECK(solver.addNode("f"));
+	BOOST_CHECK(solver.addNode("g"));
+	BOOST_CHECK(solver.addDependency("f", "g"));
+	BOOST_CHECK(solver.removeNode("f"));
+	BOOST_REQUIRE(solver.save(path));
+
+	DependencySnapshot snapshot;
+	BOOST_REQUIRE(snapshot.open(path, true));
+	BOOST_CHECK(snapshot.getNodeCount() == 6);
+	BOOST_CHECK(snapshot.getNodeId("f") == DependencySnapshot::invalidNodeId());
+
+	std::list<std::string> order;
+	BOOST_CHECK(solver.compileTopologicalOrder(order));
+	DependencySnapshot::NodeId id = 0;
+	for(std::list<std::string>::iterator it = order.begin(); it != order.end(); ++it, ++id)
+	{
+		BOOST_CHECK(snapshot.getNodeId(*it) == id);
+		BOOST_CHECK(*it == snapshot.getNodeName(id));
+		BOOST_CHECK(it->size() == snapshot.getNodeNameLength(id));
+	}
+
+	DependencySnapshot::NodeId e = snapshot.getNodeId("e");
+	DependencySnapshot::NodeId a = snapshot.getNodeId("a");
+	BOOST_CHECK(snapshot.isDependencyExist(e, snapshot.getNodeId("c")));
+	BOOST_CHECK(!snapshot.isDependencyExist(e, a));
+
+	std::vector<DependencySnapshot::NodeId> result;
+	BOOST_REQUIRE(snapshot.compileRequireNodes(e, result));
+	BOOST_CHECK(result.size() == 4);
+	for(std::size_t i = 1; i < result.size(); ++i)
+		BOOST_CHECK(result[i - 1] < result[i]);
+	BOOST_REQUIRE(snapshot.compileDependentNodes(a, result));
+	BOOST_CHECK(result.size() == 3);
+	BOOST_CHECK(result.front() == e);
+
+	// loading it back gives the same graph and order
+	DependencySolver loaded;
+	BOOST_REQUIRE(loaded.load(path));
+	BOOST_CHECK(loaded.getNodeCount() == 6);
+	BOOST_CHECK(loaded.isDependencyExist("d", "b"));
+	BOOST_CHECK(!loaded.isDependencyExist("b", "d"));
+	std::list<std::string> loadedOrder;
+	BOOST_CHECK(loaded.compileTopologicalOrder(loadedOrder));
+	BOOST_CHECK(loadedOrder == order);
+
+	std::list<std::string> dependents;
+	BOOST_CHECK(loaded.compileDependentNodes("a", dependents));
+	BOOST_CHECK(dependents.size() == 3 && dependents.front() == "e");
+
+	// and it stays an ordinary solver
+	BOOST_CHECK(!loaded.addDependency("a", "e"));
+	BOOST_CHECK(loaded.addNode("f"));
+	BOOST_CHECK(loaded.addDependency("a", "f"));
+	std::list<std::string> requirements;
+	BOOST_CHECK(loaded.compileRequireNodes("e", requirements));
+	BOOST_CHECK(requirements.size() == 5 && requirements.front() == "f");
+
+	snapshot.close();
+	std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( DependencySolverTestCase9 )
+{
+	// broken snapshots are rejected, and a failed load leaves the solver as it is
+	const std::string path = "DependencySolverTestCase9.dep";
+	DependencySolver solver;
+	buildGraph(solver);
+	BOOST_REQUIRE(solver.save(path));
+
+	std::vector<char> image;
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	BOOST_REQUIRE(image.size() > 64);
+
+	DependencySnapshot snapshot;
+	{
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		file.write(&image[0], image.size() - 1);
+	}
+	BOOST_CHECK(!snapshot.open(path));
+	BOOST_CHECK(!solver.load(path));
+	BOOST_CHECK(solver.getNodeCount() == 5);
+
+	{
+		std::vector<char> broken(image);
+		broken[0] = 'X';
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		file.write(&broken[0], broken.size());
+	}
+	BOOST_CHECK(!snapshot.open(path));
+	BOOST_CHECK(!snapshot.isOpen());
+	BOOST_CHECK(!snapshot.open("DependencySolverTestCase9.missing"));
+
+	// a corrupted byte anywhere is either caught by the full check or harmless
+	std::size_t rejected = 0;
+	for(std::size_t i = 0; i < image.size(); ++i)
+	{
+		std::vector<char> broken(image);
+		broken[i] ^= 0x40;
+		{
+			std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+			file.write(&broken[0], broken.size());
+		}
+		if(!snapshot.open(path, true))
+			++rejected;
+		else
+		{
+			std::vector<DependencySnapshot::NodeId> result;
+			for(DependencySnapshot::NodeId u = 0; u < snapshot.getNodeCount(); ++u)
+			{
+				BOOST_CHECK(snapshot.compileRequireNodes(u, result));
+				BOOST_CHECK(snapshot.compileDependentNodes(u, result));
+			}
+		}
+	}
+	BOOST_CHECK(rejected > 0);
+
+	// a graph breaking the load order can't be written at all
+	std::vector<std::string> names;
+	names.push_back("a");
+	names.push_back("b");
+	std::vector<uint32> offsets;
+	offsets.push_back(0);
+	offsets.push_back(1);
+	offsets.push_back(1);
+	std::vector<DependencySnapshot::NodeId> requirements(1, 1);
+	BOOST_CHECK(!DependencySnapshot::write(path, names, offsets, requirements));
+	names[1] = "a";
+	requirements[0] = 0;
+	offsets[1] = 0;
+	offsets[2] = 1;
+	BOOST_CHECK(!DependencySnapshot::write(path, names, offsets, requirements));
+
+	snapshot.close();
+	std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,118 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/ExpressionParser.h"
+#include <vector>
+#include <string>
+
+#define BOOST_TEST_MODULE ExpressionParserTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( ExpressionParserTestSuite )
+
+BOOST_AUTO_TEST_CASE( ExpressionParser_Evaluate_Test )
+{
+	double value = 0;
+	BOOST_CHECK(ExpressionParser::evaluate(std::string("1 + 2 * (3 - 1) / 4"), value));
+	BOOST_CHECK_CLOSE(value, 2.0, 1e-9);
+	BOOST_CHECK(!ExpressionParser::evaluate(std::string("1 +"), value));
+}
+
+BOOST_AUTO_TEST_CASE( ExpressionParser_Compile_Test )
+{
+	CompiledExpression<double> e;
+	BOOST_REQUIRE(ExpressionParser::compile(std::string("base * (1 + bonus) - armor / 2 + -base"), e));
+	BOOST_REQUIRE_EQUAL(e.variables().size(), 3u);
+	BOOST_CHECK_EQUAL(e.indexOf("base"), 0);
+	BOOST_CHECK_EQUAL(e.indexOf("bonus"), 1);
+	BOOST_CHECK_EQUAL(e.indexOf("armor"), 2);
+	BOOST_CHECK_EQUAL(e.indexOf("missing"), -1);
+
+	double row1[] = { 100, 0.5, 20 };
+	BOOST_CHECK_CLOSE(e.evaluate(row1), 100 * 1.5 - 10 - 100, 1e-9);
+	double row2[] = { 10, 0, 4 };
+	BOOST_CHECK_CLOSE(e.evaluate(row2), -2.0, 1e-9);
+
+	CompiledExpression<double> constant;
+	BOOST_REQUIRE(ExpressionParser::compile(std::string("-(2 + 3) * 4"), constant));
+	BOOST_CHECK(constant.variables().empty());
+	BOOST_CHECK_CLOSE(constant.evaluate(), -20.0, 1e-9);
+
+	BOOST_CHECK(!ExpressionParser::compile(std::string("a +"), e));
+	BOOST_CHECK(e.empty());
+	BOOST_CHECK(!ExpressionParser::compile(std::string("a b"), e));
+	BOOST_CHECK(!ExpressionParser::compile(std::string(""), e));
+}
+
+BOOST_AUTO_TEST_CASE( ExpressionParser_Declared_Test )
+{
+	std::vector<std::string> variables;
+	variables.push_back("y");
+	variables.push_back("x");
+
+	CompiledExpression<double> e;
+	BOOST_REQUIRE(ExpressionParser::compile(std::string("x - y"), variables, e));
+	double row[] = { 1, 10 };
+	BOOST_CHECK_CLOSE(e.evaluate(row), 9.0, 1e-9);
+
+	BOOST_CHECK(!ExpressionParser::compile(std::string("x - z"), variables, e));
+}
+
+BOOST_AUTO_TEST_CASE( ExpressionParser_Depth_Test )
+{
+	// each "(1 -" opens one more stack slot
+	std::string deep;
+	for(int i = 0; i < CompiledExpression<double>::MAX_STACK_DEPTH + 1; ++i)
+		deep += "(1 - ";
+	deep += "1";
+	for(int i = 0; i < CompiledExpression<double>::MAX_STACK_DEPTH + 1; ++i)
+		deep += ")";
+
+	CompiledExpression<double> e;
+	BOOST_CHECK(!ExpressionParser::compile(deep, e));
+}
+
+BOOST_AUTO_TEST_CASE( ExpressionParser_Batch_Test )
+{
+	CompiledExpression<double> e;
+	BOOST_REQUIRE(ExpressionParser::compile(std::string("a * a + b / 2 - 1"), e));
+
+	const std::size_t n = CompiledExpression<double>::BATCH_SIZE * 3 + 7;
+	std::vector<double> rows(n * 2);
+	for(std::size_t r = 0; r < n; ++r)
+	{
+		rows[r * 2 + 0] = (double)r;
+		rows[r * 2 + 1] = (double)r * 3;
+	}
+
+	std::vector<double> out(n);
+	e.evaluate(&rows[0], n, &out[0]);
+	for(std::size_t r = 0; r < n; ++r)
+	{
+		BOOST_CHECK_EQUAL(out[r], e.evaluate(&rows[r * 2]));
+		BOOST_CHECK_EQUAL(out[r], (double)r * r + r * 1.5 - 1);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
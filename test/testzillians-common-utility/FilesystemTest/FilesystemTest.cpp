@@ -0,0 +1,194 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/Filesystem.h"
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <vector>
+
+#define BOOST_TEST_MODULE FilesystemTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct TemporaryTree
+{
+	TemporaryTree() : root(fs::temp_directory_path() / fs::unique_path("zillians-filesystem-test-%%%%-%%%%"))
+	{
+		fs::create_directories(root);
+	}
+
+	~TemporaryTree()
+	{
+		boost::system::error_code ec;
+		fs::remove_all(root, ec);
+	}
+
+	void write(const fs::path& p, const std::string& content)
+	{
+		fs::ofstream out(root / p);
+		out << content;
+	}
+
+	fs::path root;
+};
+
+std::map<std::string, Filesystem::Watcher::Action> collect(Filesystem::Watcher& watcher)
+{
+	std::map<std::string, Filesystem::Watcher::Action> actions;
+	std::vector<Filesystem::Watcher::Event> events;
+	while(watcher.poll(events, boost::posix_time::milliseconds(200)) > 0)
+	{
+		for(std::vector<Filesystem::Watcher::Event>::iterator it = events.begin(); it != events.end(); ++it)
+			actions[fs::relative(it->path, watcher.root()).generic_string()] = it->action;
+	}
+	return actions;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( FilesystemTestSuite )
+
+BOOST_AUTO_TEST_CASE( FilesystemTestCase1 )
+{
+	TemporaryTree tree;
+	for(int i = 0; i < 8; ++i)
+	{
+		fs::path dir = fs::path("d" + boost::lexical_cast<std::string>(i)) / "sub";
+		fs::create_directories(tree.root / dir);
+		for(int j = 0; j < 16; ++j)
+			tree.write(dir / ("f" + boost::lexical_cast<std::string>(j)), "x");
+	}
+	tree.write("top", "x");
+
+	std::vector<fs::path> files;
+	Filesystem::scan(tree.root, files);
+	BOOST_CHECK_EQUAL(files.size(), 8 * 16 + 1);
+	BOOST_CHECK(std::find(files.begin(), files.end(), tree.root / "d3" / "sub" / "f7") != files.end());
+
+	// links to files are visited, links to directories are not followed
+	fs::create_symlink(tree.root / "top", tree.root / "d0" / "link");
+	fs::create_directory_symlink(tree.root / "d1", tree.root / "d0" / "loop");
+	std::atomic<int> visited(0);
+	Filesystem::walk(tree.root, [&visited](const fs::path&) { ++visited; });
+	BOOST_CHECK_EQUAL(visited.load(), 8 * 16 + 2);
+}
+
+BOOST_AUTO_TEST_CASE( FilesystemTestCase2 )
+{
+	TemporaryTree tree;
+	fs::create_directories(tree.root / "a" / "b");
+	tree.write("a/b/old", "x");
+	tree.write("a/gone", "x");
+
+	Filesystem::Watcher watcher(tree.root, boost::posix_time::milliseconds(20));
+	BOOST_REQUIRE(watcher.valid());
+
+	std::vector<Filesystem::Watcher::Event> events;
+	BOOST_CHECK_EQUAL(watcher.poll(events, boost::posix_time::milliseconds(10)), 0);
+
+	// repeated writes to the same file come out as a single event
+	tree.write("a/b/old", "y");
+	tree.write("a/b/old", "z");
+	tree.write("a/new", "x");
+	fs::remove(tree.root / "a" / "gone");
+	std::map<std::string, Filesystem::Watcher::Action> actions = collect(watcher);
+	BOOST_CHECK_EQUAL(actions.size(), 3);
+	BOOST_CHECK(actions["a/b/old"] == Filesystem::Watcher::MODIFIED);
+	BOOST_CHECK(actions["a/new"] == Filesystem::Watcher::ADDED);
+	BOOST_CHECK(actions["a/gone"] == Filesystem::Watcher::REMOVED);
+
+	// a temporary file never shows up
+	tree.write("temp", "x");
+	fs::remove(tree.root / "temp");
+	tree.write("a/b/old", "w");
+	actions = collect(watcher);
+	BOOST_CHECK_EQUAL(actions.size(), 1);
+	BOOST_CHECK(actions["a/b/old"] == Filesystem::Watcher::MODIFIED);
+}
+
+BOOST_AUTO_TEST_CASE( FilesystemTestCase3 )
+{
+	TemporaryTree tree;
+	Filesystem::Watcher watcher(tree.root, boost::posix_time::milliseconds(20));
+	BOOST_REQUIRE(watcher.valid());
+
+	// a directory tree created or moved in is reported with everything in it
+	fs::create_directories(tree.root / "x" / "y");
+	tree.write("x/y/file", "x");
+	std::map<std::string, Filesystem::Watcher::Action> actions = collect(watcher);
+	BOOST_CHECK(actions["x"] == Filesystem::Watcher::ADDED);
+	BOOST_CHECK(actions["x/y"] == Filesystem::Watcher::ADDED);
+	BOOST_CHECK(actions["x/y/file"] == Filesystem::Watcher::ADDED);
+
+	// the new directories are watched as well
+	tree.write("x/y/file", "y");
+	tree.write("x/y/another", "y");
+	actions = collect(watcher);
+	BOOST_CHECK_EQUAL(actions.size(), 2);
+	BOOST_CHECK(actions["x/y/file"] == Filesystem::Watcher::MODIFIED);
+	BOOST_CHECK(actions["x/y/another"] == Filesystem::Watcher::ADDED);
+
+	TemporaryTree outside;
+	fs::create_directories(outside.root / "m");
+	outside.write("m/file", "x");
+	fs::rename(outside.root / "m", tree.root / "m");
+	fs::rename(tree.root / "x", outside.root / "x");
+	actions = collect(watcher);
+	BOOST_CHECK(actions["m"] == Filesystem::Watcher::ADDED);
+	BOOST_CHECK(actions["m/file"] == Filesystem::Watcher::ADDED);
+	BOOST_CHECK(actions["x"] == Filesystem::Watcher::REMOVED);
+
+	// nothing is heard from a directory moved out any more
+	outside.write("x/y/file", "z");
+	tree.write("m/file", "y");
+	actions = collect(watcher);
+	BOOST_CHECK_EQUAL(actions.size(), 1);
+	BOOST_CHECK(actions["m/file"] == Filesystem::Watcher::MODIFIED);
+}
+
+BOOST_AUTO_TEST_CASE( FilesystemTestCase4 )
+{
+	Filesystem::PathCache cache(2);
+	BOOST_CHECK(cache.normalize("/a/./b/../c") == fs::path("/a/c"));
+	BOOST_CHECK(cache.normalize("/a/./b/../c") == fs::path("/a/c"));
+	BOOST_CHECK_EQUAL(cache.size(), 1);
+	BOOST_CHECK(cache.normalize("x/../y") == Filesystem::normalize_path("x/../y"));
+
+	// the least recently used path goes first
+	BOOST_CHECK(cache.normalize("/a/./b/../c") == fs::path("/a/c"));
+	BOOST_CHECK(cache.normalize("/d/e/..") == fs::path("/d"));
+	BOOST_CHECK_EQUAL(cache.size(), 2);
+	BOOST_CHECK(cache.normalize("/a/./b/../c") == fs::path("/a/c"));
+
+	cache.clear();
+	BOOST_CHECK_EQUAL(cache.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -22,6 +22,8 @@
 
 #include "core/Prerequisite.h"
 #include "utility/Foreach.h"
+#include "utility/ParallelForeach.h"
+#include <tbb/atomic.h>
 #include <tr1/unordered_set>
 #include <boost/type_traits.hpp>
 #include <boost/mpl/if.hpp>
@@ -679,4 +681,77 @@ BOOST_AUTO_TEST_CASE( TemplateTricksTestCase9 )
 	BOOST_CHECK(c.sum() == 6);
 }
 
+BOOST_AUTO_TEST_CASE( ParallelForeachTestCase1 )
+{
+	tbb::atomic<int> sum;
+	sum = 0;
+	parallel_foreach(i, 1000)
+	{
+		sum += i;
+	};
+	BOOST_CHECK(sum == 999 * 1000 / 2);
+
+	int xs[] = { 1, 2, 3 };
+	sum = 0;
+	parallel_foreach(x, xs)
+	{
+		sum += *x;
+	};
+	BOOST_CHECK(sum == 6);
+}
+
+BOOST_AUTO_TEST_CASE( ParallelForeachTestCase2 )
+{
+	std::vector<int> vec(10000, 0);
+	parallel_foreach(i, vec)
+	{
+		*i += 1;
+	};
+	BOOST_CHECK(std::count(vec.begin(), vec.end(), 1) == 10000);
+
+	std::deque<int> deq(10000, 1);
+	tbb::atomic<int> sum;
+	sum = 0;
+	parallel_foreach(i, deq)
+	{
+		sum += *i;
+	};
+	BOOST_CHECK(sum == 10000);
+}
+
+BOOST_AUTO_TEST_CASE( ParallelForeachTestCase3 )
+{
+	std::list<int> lst;
+	std::map<int, int> m;
+	for(int i = 0; i < 1000; ++i)
+	{
+		lst.push_back(i);
+		m[i] = i;
+	}
+
+	// each element is visited exactly once
+	parallel_foreach(i, lst)
+	{
+		*i += 1;
+	};
+	int expected = 1;
+	foreach(i, lst)
+		BOOST_CHECK(*i == expected++);
+
+	tbb::atomic<int> sum;
+	sum = 0;
+	const std::map<int, int>& cm = m;
+	parallel_foreach(i, cm)
+	{
+		sum += i->second;
+	};
+	BOOST_CHECK(sum == 999 * 1000 / 2);
+
+	std::list<int> empty;
+	parallel_foreach(i, empty)
+	{
+		BOOST_CHECK(false);
+	};
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -440,4 +440,67 @@ BOOST_AUTO_TEST_CASE( IndirectMapTestCase8 )
 
 }
 
+BOOST_AUTO_TEST_CASE( CompactDigraphTestCase1 )
+{
+	compact_digraph g;
+	compact_digraph::vertex_id a = g.addVertex();
+	compact_digraph::vertex_id b = g.addVertex();
+	compact_digraph::vertex_id c = g.addVertex();
+	BOOST_CHECK(g.vertexCount() == 3);
+
+	BOOST_CHECK(g.addEdge(a, b));
+	BOOST_CHECK(g.addEdge(a, c));
+	BOOST_CHECK(g.addEdge(c, b));
+	BOOST_CHECK(!g.addEdge(a, b));
+	BOOST_CHECK(!g.addEdge(a, compact_digraph::null_vertex()));
+	BOOST_CHECK(g.hasEdge(a, b) && g.hasEdge(c, b) && !g.hasEdge(b, a));
+	BOOST_CHECK(g.outEdges(a).size() == 2);
+	BOOST_CHECK(g.inEdges(b).size() == 2);
+
+	BOOST_CHECK(g.removeEdge(a, b));
+	BOOST_CHECK(!g.removeEdge(a, b));
+	BOOST_CHECK(!g.hasEdge(a, b));
+
+	// removing a vertex drops its edges and frees its id for the next vertex
+	BOOST_CHECK(g.removeVertex(c));
+	BOOST_CHECK(!g.isVertex(c));
+	BOOST_CHECK(g.outEdges(a).empty());
+	BOOST_CHECK(g.inEdges(b).empty());
+	BOOST_CHECK(g.addVertex() == c);
+	BOOST_CHECK(g.vertexCount() == 3);
+	BOOST_CHECK(g.vertexCapacity() == 3);
+	BOOST_CHECK(!g.hasEdge(c, b));
+}
+
+BOOST_AUTO_TEST_CASE( CompactDigraphTestCase2 )
+{
+	// 0 -> 1, 0 -> 2, 1 -> 2 in CSR form, edge lists sorted
+	const boost::uint32_t outOffsets[] = { 0, 2, 3, 3 };
+	const compact_digraph_view::vertex_id outTargets[] = { 1, 2, 2 };
+	const boost::uint32_t inOffsets[] = { 0, 0, 1, 3 };
+	const compact_digraph_view::vertex_id inSources[] = { 0, 0, 1 };
+	compact_digraph_view view(3, outOffsets, outTargets, inOffsets, inSources);
+
+	BOOST_CHECK(view.vertexCount() == 3);
+	BOOST_CHECK(view.edgeCount() == 3);
+	BOOST_CHECK(view.isVertex(2) && !view.isVertex(3));
+	BOOST_CHECK(view.hasEdge(0, 1) && view.hasEdge(0, 2) && view.hasEdge(1, 2));
+	BOOST_CHECK(!view.hasEdge(2, 0) && !view.hasEdge(1, 0) && !view.hasEdge(0, 3));
+	BOOST_CHECK(view.outEdges(2).empty());
+	BOOST_CHECK(view.inEdges(2).size() == 2);
+
+	compact_digraph g;
+	g.addVertex();
+	g.assign(view);
+	BOOST_CHECK(g.vertexCount() == 3);
+	BOOST_CHECK(g.hasEdge(0, 1) && g.hasEdge(0, 2) && g.hasEdge(1, 2));
+	BOOST_CHECK(!g.hasEdge(2, 1));
+	BOOST_CHECK(g.inEdges(2).size() == 2);
+
+	// the copy is an ordinary graph again
+	BOOST_CHECK(g.removeVertex(1));
+	BOOST_CHECK(g.inEdges(2).size() == 1);
+	BOOST_CHECK(g.addVertex() == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,204 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/ParallelGraphUtil.h"
+#include <boost/graph/dijkstra_shortest_paths.hpp>
+#include <tbb/tick_count.h>
+#include <queue>
+
+#define BOOST_TEST_MODULE ParallelGraphUtilTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( ParallelGraphUtilTestSuite )
+
+namespace {
+
+typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS, boost::no_property, boost::property<boost::edge_weight_t, double> > RoutingGraph;
+
+// a grid with random shortcuts, which has both long paths and high fan-out vertices
+void buildRoutingGraph(RoutingGraph& g, int side)
+{
+	srand(7);
+	for(int y = 0; y < side; ++y)
+	{
+		for(int x = 0; x < side; ++x)
+		{
+			int u = y * side + x;
+			if(x + 1 < side) { boost::add_edge(u, u + 1, 1.0 + rand() % 10, g); boost::add_edge(u + 1, u, 1.0 + rand() % 10, g); }
+			if(y + 1 < side) { boost::add_edge(u, u + side, 1.0 + rand() % 10, g); boost::add_edge(u + side, u, 1.0 + rand() % 10, g); }
+			if(rand() % 50 == 0) boost::add_edge(u, rand() % (side * side), 5.0 + rand() % 100, g);
+		}
+	}
+}
+
+template<typename Snapshot>
+void serialBreadthFirstSearch(const Snapshot& s, typename Snapshot::index_type source, std::vector<typename Snapshot::index_type>& distances)
+{
+	distances.assign(s.vertex_count(), Snapshot::null_index());
+	std::queue<typename Snapshot::index_type> queue;
+	distances[source] = 0;
+	queue.push(source);
+	while(!queue.empty())
+	{
+		typename Snapshot::index_type u = queue.front();
+		queue.pop();
+		for(const typename Snapshot::index_type* v = s.targets_begin(u); v != s.targets_end(u); ++v)
+		{
+			if(distances[*v] == Snapshot::null_index())
+			{
+				distances[*v] = distances[u] + 1;
+				queue.push(*v);
+			}
+		}
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( ParallelGraphUtilTestCase1 )
+{
+	RoutingGraph g;
+	buildRoutingGraph(g, 300);
+
+	csr_snapshot<RoutingGraph> s(g);
+	BOOST_CHECK_EQUAL(s.vertex_count(), boost::num_vertices(g));
+	BOOST_CHECK_EQUAL(s.edge_count(), boost::num_edges(g));
+
+	std::vector<csr_snapshot<RoutingGraph>::index_type> expected, distances;
+	tbb::tick_count start = tbb::tick_count::now();
+	serialBreadthFirstSearch(s, 12345, expected);
+	double serial_time = (tbb::tick_count::now() - start).seconds();
+
+	start = tbb::tick_count::now();
+	parallel_breadth_first_search(s, 12345, distances);
+	double parallel_time = (tbb::tick_count::now() - start).seconds();
+
+	BOOST_CHECK(distances == expected);
+	printf("bfs over %lu vertices: serial %.2f ms, parallel %.2f ms\n", (unsigned long)s.vertex_count(), serial_time * 1e3, parallel_time * 1e3);
+
+	// a vertex without edges only reaches itself
+	boost::add_vertex(g);
+	csr_snapshot<RoutingGraph> isolated(g);
+	parallel_breadth_first_search(isolated, (csr_snapshot<RoutingGraph>::index_type)(isolated.vertex_count() - 1), distances);
+	BOOST_CHECK_EQUAL(std::count(distances.begin(), distances.end(), csr_snapshot<RoutingGraph>::null_index()), (std::ptrdiff_t)isolated.vertex_count() - 1);
+
+	BOOST_CHECK_THROW(parallel_breadth_first_search(s, (csr_snapshot<RoutingGraph>::index_type)s.vertex_count(), distances), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE( ParallelGraphUtilTestCase2 )
+{
+	RoutingGraph g;
+	buildRoutingGraph(g, 300);
+	const std::size_t source = 777;
+
+	std::vector<double> expected(boost::num_vertices(g));
+	tbb::tick_count start = tbb::tick_count::now();
+	boost::dijkstra_shortest_paths(g, boost::vertex(source, g), boost::distance_map(&expected[0]));
+	double serial_time = (tbb::tick_count::now() - start).seconds();
+
+	csr_snapshot<RoutingGraph, double> s(g, boost::get(boost::edge_weight, g));
+	std::vector<double> distances;
+	start = tbb::tick_count::now();
+	parallel_delta_stepping_shortest_paths(s, source, 5.0, distances);
+	double parallel_time = (tbb::tick_count::now() - start).seconds();
+
+	int mismatch = 0;
+	for(std::size_t u = 0; u < expected.size(); ++u)
+		if(distances[u] != expected[u]) ++mismatch;
+	BOOST_CHECK_EQUAL(mismatch, 0);
+	printf("shortest paths over %lu vertices: dijkstra %.2f ms, delta-stepping %.2f ms\n", (unsigned long)s.vertex_count(), serial_time * 1e3, parallel_time * 1e3);
+
+	// every predecessor lies on a shortest path
+	std::vector<csr_snapshot<RoutingGraph, double>::index_type> predecessors;
+	shortest_path_predecessors(s, source, distances, predecessors);
+	BOOST_CHECK((predecessors[source] == csr_snapshot<RoutingGraph, double>::null_index()));
+	int broken = 0;
+	for(std::size_t v = 0; v < predecessors.size(); ++v)
+	{
+		if(v == source) continue;
+		csr_snapshot<RoutingGraph, double>::index_type u = predecessors[v];
+		if(u == csr_snapshot<RoutingGraph, double>::null_index()) { ++broken; continue; }
+
+		bool found = false;
+		const double* w = s.weights_begin(u);
+		for(const csr_snapshot<RoutingGraph, double>::index_type* t = s.targets_begin(u); t != s.targets_end(u); ++t, ++w)
+			if(*t == v && distances[u] + *w == distances[v]) found = true;
+		if(!found) ++broken;
+	}
+	BOOST_CHECK_EQUAL(broken, 0);
+
+	// any delta gives the same distances, integer weights too
+	parallel_delta_stepping_shortest_paths(s, source, 1000.0, distances);
+	BOOST_CHECK(distances == expected);
+
+	csr_snapshot<RoutingGraph, boost::uint32_t> integral(g, boost::get(boost::edge_weight, g));
+	std::vector<boost::uint32_t> integral_distances;
+	parallel_delta_stepping_shortest_paths(integral, source, (boost::uint32_t)3, integral_distances);
+	mismatch = 0;
+	for(std::size_t u = 0; u < expected.size(); ++u)
+		if(integral_distances[u] != (boost::uint32_t)expected[u]) ++mismatch;
+	BOOST_CHECK_EQUAL(mismatch, 0);
+}
+
+BOOST_AUTO_TEST_CASE( ParallelGraphUtilTestCase3 )
+{
+	using namespace boost;
+
+	typedef indirect_graph_traits<int,int> IndirectGraphTraits;
+	typedef property<edge_weight_t, int, IndirectGraphTraits::edge_property > EdgeProperty;
+	typedef adjacency_list<listS, listS, bidirectionalS, IndirectGraphTraits::vertex_property, EdgeProperty> Graph;
+	typedef indirect_graph_mapping<IndirectGraphTraits, graph_traits<Graph>::vertex_descriptor, graph_traits<Graph>::edge_descriptor> IndirectGraphMapping;
+
+	Graph g;
+	IndirectGraphMapping mapping;
+	for(int i = 10; i <= 50; i += 10)
+		add_vertex(i, g, mapping);
+
+	// 10 -> 20 -> 30 -> 40, 10 -> 40 directly but longer, 50 is unreachable
+	int edge_id = 0;
+	put(edge_weight, g, add_edge(++edge_id, 10, 20, g, mapping), 1);
+	put(edge_weight, g, add_edge(++edge_id, 20, 30, g, mapping), 1);
+	put(edge_weight, g, add_edge(++edge_id, 30, 40, g, mapping), 1);
+	put(edge_weight, g, add_edge(++edge_id, 10, 40, g, mapping), 5);
+
+	csr_snapshot<Graph, int> s(g, get(edge_weight, g));
+
+	std::vector<csr_snapshot<Graph, int>::index_type> hops;
+	parallel_breadth_first_search(10, g, mapping, s, hops);
+	BOOST_CHECK_EQUAL(hops[s.index(vertex(40, g, mapping))], 1u);
+	BOOST_CHECK_EQUAL(hops[s.index(vertex(30, g, mapping))], 2u);
+	BOOST_CHECK((hops[s.index(vertex(50, g, mapping))] == csr_snapshot<Graph, int>::null_index()));
+
+	std::vector<int> distances;
+	parallel_delta_stepping_shortest_paths(10, g, mapping, s, 2, distances);
+	BOOST_CHECK_EQUAL(distances[s.index(vertex(40, g, mapping))], 3);
+	BOOST_CHECK_EQUAL(distances[s.index(vertex(50, g, mapping))], std::numeric_limits<int>::max());
+
+	// and back to the references through the descriptors
+	std::vector<csr_snapshot<Graph, int>::index_type> predecessors;
+	shortest_path_predecessors(s, s.index(vertex(10, g, mapping)), distances, predecessors);
+	BOOST_CHECK_EQUAL(vertex_ref(s.descriptor(predecessors[s.index(vertex(40, g, mapping))]), g, mapping), 30);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,185 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "core/Prerequisite.h"
+#include "core/Buffer.h"
+#include "utility/sha1.h"
+#include <tbb/tick_count.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE Sha1Test
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( Sha1TestSuite )
+
+static std::string toHex(const unsigned char* hash)
+{
+	char hex[41];
+	sha1::toHexString(hash, hex);
+	return hex;
+}
+
+static std::string calcHex(const std::string& s)
+{
+	unsigned char hash[20];
+	sha1::calc(s.data(), s.size(), hash);
+	return toHex(hash);
+}
+
+static std::string randomString(std::size_t size)
+{
+	std::string s(size, '\0');
+	for(std::size_t i = 0; i < size; ++i)
+		s[i] = (char)(rand() & 0xFF);
+	return s;
+}
+
+BOOST_AUTO_TEST_CASE( Sha1TestCase1 )
+{
+	// FIPS 180 test vectors
+	BOOST_CHECK(calcHex("") == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+	BOOST_CHECK(calcHex("abc") == "a9993e364706816aba3e25717850c26c9cd0d89d");
+	BOOST_CHECK(calcHex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") == "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+	BOOST_CHECK(calcHex(std::string(1000000, 'a')) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+BOOST_AUTO_TEST_CASE( Sha1TestCase2 )
+{
+	// streaming in random pieces gives the same hash as one-shot
+	srand(52);
+	for(int n = 0; n < 200; ++n)
+	{
+		std::string s = randomString(rand() % 1000);
+
+		sha1::Context context;
+		std::size_t offset = 0;
+		while(offset < s.size())
+		{
+			std::size_t piece = std::min<std::size_t>(rand() % 130, s.size() - offset);
+			context.update(s.data() + offset, piece);
+			offset += piece;
+		}
+
+		unsigned char hash[20];
+		context.final(hash);
+		BOOST_CHECK(toHex(hash) == calcHex(s));
+	}
+
+	// the context is reset by final()
+	sha1::Context context;
+	unsigned char hash[20];
+	context.update("xyz", 3);
+	context.final(hash);
+	context.update("abc", 3);
+	context.final(hash);
+	BOOST_CHECK(toHex(hash) == "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
+
+BOOST_AUTO_TEST_CASE( Sha1TestCase3 )
+{
+	// hash the readable data of buffers in place
+	std::string s = randomString(200);
+
+	Buffer b(1024);
+	b.writeArray(s.data(), s.size());
+
+	sha1::Context context;
+	unsigned char hash[20];
+	context.update(b);
+	context.final(hash);
+	BOOST_CHECK(toHex(hash) == calcHex(s));
+	BOOST_CHECK(b.dataSize() == s.size());
+
+	// data wrapping around the end of a circular buffer
+	CircularBuffer c(256);
+	std::string head = randomString(200);
+	c.writeArray(head.data(), head.size());
+	c.rskip(150);
+	c.writeArray(s.data(), s.size() - 50);
+
+	context.update(c);
+	context.final(hash);
+	BOOST_CHECK(toHex(hash) == calcHex(head.substr(150) + s.substr(0, s.size() - 50)));
+}
+
+BOOST_AUTO_TEST_CASE( Sha1TestCase4 )
+{
+	// multi-buffer hashing of messages of different lengths, including lengths around the padding boundary
+	srand(4);
+	std::vector<std::string> messages;
+	for(std::size_t i = 0; i < 130; ++i)
+		messages.push_back(randomString(i));
+	for(int i = 0; i < 37; ++i)
+		messages.push_back(randomString(rand() % 5000));
+
+	std::vector<const void*> srcs;
+	std::vector<std::size_t> lengths;
+	for(std::size_t i = 0; i < messages.size(); ++i)
+	{
+		srcs.push_back(messages[i].data());
+		lengths.push_back(messages[i].size());
+	}
+
+	std::vector<unsigned char> hashes(20 * messages.size());
+	sha1::calcMultiple(&srcs[0], &lengths[0], messages.size(), &hashes[0]);
+	for(std::size_t i = 0; i < messages.size(); ++i)
+		BOOST_CHECK(toHex(&hashes[20 * i]) == calcHex(messages[i]));
+
+	sha1::calcMultiple(&srcs[0], &lengths[0], 1, &hashes[0]);
+	BOOST_CHECK(toHex(&hashes[0]) == calcHex(messages[0]));
+}
+
+BOOST_AUTO_TEST_CASE( Sha1PerformanceCase1 )
+{
+	const std::size_t size = 16 * 1024 * 1024;
+	std::string data = randomString(size);
+	unsigned char hash[20];
+
+	tbb::tick_count start = tbb::tick_count::now();
+	sha1::calc(data.data(), data.size(), hash);
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("sha1::calc takes %lf ns per byte\n", (end - start).seconds() * 1.0e9 / (double)size);
+
+	const std::size_t count = size / 64;
+	std::vector<const void*> srcs;
+	std::vector<std::size_t> lengths(count, 40);
+	for(std::size_t i = 0; i < count; ++i)
+		srcs.push_back(data.data() + i * 64);
+	std::vector<unsigned char> hashes(20 * count);
+
+	start = tbb::tick_count::now();
+	sha1::calcMultiple(&srcs[0], &lengths[0], count, &hashes[0]);
+	end = tbb::tick_count::now();
+	printf("sha1::calcMultiple takes %lf ns per 40-byte message\n", (end - start).seconds() * 1.0e9 / (double)count);
+
+	start = tbb::tick_count::now();
+	for(std::size_t i = 0; i < count; ++i)
+		sha1::calc(srcs[i], lengths[i], &hashes[20 * i]);
+	end = tbb::tick_count::now();
+	printf("sha1::calc takes %lf ns per 40-byte message\n", (end - start).seconds() * 1.0e9 / (double)count);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,10 @@
 #include "core/Prerequisite.h"
 #include "utility/StringUtil.h"
 #include <tr1/unordered_set>
+#include <set>
+#include <tbb/tick_count.h>
+#include <limits>
+#include <cstdio>
 
 #define BOOST_TEST_MODULE StringUtilTest
 #define BOOST_TEST_MAIN
@@ -212,6 +216,96 @@ BOOST_AUTO_TEST_CASE( TokenizerCase9 )
 	BOOST_CHECK(compare_result(output, result));
 }
 
+struct TokenCounter
+{
+	TokenCounter(std::size_t* total) : total(total)
+	{ }
+
+	void operator() (const char* data, std::size_t length) const
+	{
+		UNUSED_ARGUMENT(data);
+		*total += length;
+	}
+
+	std::size_t* total;
+};
+
+BOOST_AUTO_TEST_CASE( TokenizerViewCase1 )
+{
+	string input = "set  key=value;;other , x";
+
+	StringUtil::Delimiters delimiters(" =;,");
+	vector<StringUtil::Token> tokens;
+	BOOST_CHECK(StringUtil::tokenize(input, delimiters, tokens) == 5);
+	BOOST_REQUIRE(tokens.size() == 5);
+	BOOST_CHECK(tokens[0] == "set");
+	BOOST_CHECK(tokens[1] == "key");
+	BOOST_CHECK(tokens[2] == "value");
+	BOOST_CHECK(tokens[3] == "other");
+	BOOST_CHECK(tokens[4] == "x");
+
+	// the tokens point into the input, nothing is copied
+	BOOST_CHECK(tokens[0].data == input.data());
+	BOOST_CHECK(tokens[4].data == input.data() + input.size() - 1);
+
+	std::size_t total = 0;
+	BOOST_CHECK(StringUtil::tokenize(input.data(), input.size(), delimiters, TokenCounter(&total)) == 5);
+	BOOST_CHECK(total == 3 + 3 + 5 + 5 + 1);
+}
+
+BOOST_AUTO_TEST_CASE( TokenizerViewCase2 )
+{
+	// the views must give the same tokens as the string version, for few and many delimiters
+	const char* delimiterSets[] = { ".", ".,;", "abcdefghijklmnopqrstu", "\t\n\r .,;:!?|/\\-+*&^%$#@" };
+	srand(11);
+	for(int n = 0; n < 2000; ++n)
+	{
+		string input;
+		int length = rand() % 80;
+		for(int i = 0; i < length; ++i)
+			input.push_back((rand() % 3 == 0) ? ".,;abc \t"[rand() % 8] : (char)('a' + rand() % 26));
+
+		string delimiters = delimiterSets[n % 4];
+		bool allowEmpty = (n % 2 == 0);
+
+		vector<string> expected = StringUtil::tokenize(input, delimiters, allowEmpty);
+		vector<StringUtil::Token> tokens;
+		StringUtil::tokenize(input, StringUtil::Delimiters(delimiters), tokens, allowEmpty);
+
+		BOOST_REQUIRE(tokens.size() == expected.size());
+		for(std::size_t i = 0; i < tokens.size(); ++i)
+		{
+			BOOST_CHECK(tokens[i] == expected[i]);
+			BOOST_CHECK(tokens[i].str().find_first_of(delimiters) == string::npos);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( SubstituteCase1 )
+{
+	string s = "a.b.c";
+	BOOST_CHECK(StringUtil::substitute(s, ".", "::"));
+	BOOST_CHECK(s == "a::b::c");
+
+	BOOST_CHECK(!StringUtil::substitute(s, ".", "::"));
+	BOOST_CHECK(s == "a::b::c");
+
+	BOOST_CHECK(StringUtil::substitute(s, "::", ""));
+	BOOST_CHECK(s == "abc");
+
+	// the replacement is never searched again
+	s = "xax";
+	BOOST_CHECK(StringUtil::substitute(s, "a", "aa"));
+	BOOST_CHECK(s == "xaax");
+
+	s = "aaaa";
+	BOOST_CHECK(StringUtil::substitute(s, "aa", "b"));
+	BOOST_CHECK(s == "bb");
+
+	BOOST_CHECK(!StringUtil::substitute(s, "", "x"));
+	BOOST_CHECK(s == "bb");
+}
+
 BOOST_AUTO_TEST_CASE( UpperLowerCaseConversionCase1 )
 {
 	string s0 = "abcDEFghijk";
@@ -400,6 +494,34 @@ BOOST_AUTO_TEST_CASE( WStringHashCase1 )
 	BOOST_CHECK(str_hash.count(value2) == 1);
 }
 
+BOOST_AUTO_TEST_CASE( StringHashCase2 )
+{
+	// every length goes through a different read pattern of HashUtil::hash()
+	std::string text;
+	std::set<std::size_t> hashes;
+	for(int i = 0; i < 256; ++i)
+	{
+		BOOST_CHECK_EQUAL(StringHasher::hash(text), StringHasher::hash(std::string(text.data(), text.length())));
+		hashes.insert(StringHasher::hash(text));
+		text.push_back((char)('a' + i % 26));
+	}
+	BOOST_CHECK_EQUAL(hashes.size(), 256u);
+
+	// a single flipped bit changes the hash
+	std::string flipped = text;
+	flipped[100] ^= 1;
+	BOOST_CHECK(StringHasher::hash(flipped) != StringHasher::hash(text));
+	BOOST_CHECK(StringHasher::equal(text, std::string(text)));
+	BOOST_CHECK(WStringHasher::hash(L"ABCDEFG") != WStringHasher::hash(L"ABCDEFH"));
+
+	// aligned addresses still spread over the low bits
+	const std::size_t buckets = 1024;
+	std::set<std::size_t> used;
+	for(std::size_t i = 0; i < buckets; ++i)
+		used.insert(HashUtil::hashPointer(reinterpret_cast<void*>(0x10000000 + i * 64)) & (buckets - 1));
+	BOOST_CHECK(used.size() > buckets / 2);
+}
+
 BOOST_AUTO_TEST_CASE( itoaCase1 )
 {
 	uint32 value1 = 0x12AB;
@@ -435,4 +557,115 @@ BOOST_AUTO_TEST_CASE( itoaCase2 )
 //	std::cout << value1 << std::endl;
 }
 
+template<typename T>
+static std::string formatDecimal(T value)
+{
+	char buffer[32];
+	char* end = StringUtil::toChars(buffer, buffer + sizeof(buffer), value);
+	BOOST_REQUIRE(end != NULL);
+	return std::string(buffer, end);
+}
+
+BOOST_AUTO_TEST_CASE( ToCharsCase1 )
+{
+	BOOST_CHECK(formatDecimal(0) == "0");
+	BOOST_CHECK(formatDecimal(7) == "7");
+	BOOST_CHECK(formatDecimal(10) == "10");
+	BOOST_CHECK(formatDecimal(-1234) == "-1234");
+	BOOST_CHECK(formatDecimal((uint8)255) == "255");
+	BOOST_CHECK(formatDecimal((int8)-128) == "-128");
+	BOOST_CHECK(formatDecimal(std::numeric_limits<int32>::min()) == "-2147483648");
+	BOOST_CHECK(formatDecimal(std::numeric_limits<uint32>::max()) == "4294967295");
+	BOOST_CHECK(formatDecimal(std::numeric_limits<int64>::min()) == "-9223372036854775808");
+	BOOST_CHECK(formatDecimal(std::numeric_limits<uint64>::max()) == "18446744073709551615");
+
+	srand(3);
+	for(int i = 0; i < 10000; ++i)
+	{
+		int64 value = ((int64)rand() << 33) ^ ((int64)rand() << 11) ^ rand();
+		value >>= rand() % 63;
+		if(i % 2) value = -value;
+		char expected[32];
+		snprintf(expected, sizeof(expected), "%lld", (long long)value);
+		BOOST_CHECK(formatDecimal(value) == expected);
+	}
+
+	// too small a buffer writes nothing useful and says so
+	char buffer[4];
+	BOOST_CHECK(StringUtil::toChars(buffer, buffer + 4, 12345) == NULL);
+	BOOST_CHECK(StringUtil::toChars(buffer, buffer + 4, -123) == buffer + 4);
+	BOOST_CHECK(StringUtil::toChars(buffer, buffer + 4, -1234) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( HexCase1 )
+{
+	unsigned char bytes[37];
+	for(std::size_t i = 0; i < sizeof(bytes); ++i)
+		bytes[i] = (unsigned char)(i * 37 + 11);
+
+	for(std::size_t size = 0; size <= sizeof(bytes); ++size)
+	{
+		std::string expected;
+		for(std::size_t i = 0; i < size; ++i)
+			expected.append(StringUtil::itoa((uint32)bytes[i] + 0x100, 16).substr(1));
+
+		char buffer[2 * sizeof(bytes)];
+		char* end = StringUtil::encodeHex(buffer, buffer + sizeof(buffer), bytes, size, false);
+		BOOST_REQUIRE(end == buffer + 2 * size);
+		BOOST_CHECK(std::string(buffer, end) == expected);
+	}
+
+	char buffer[16];
+	BOOST_CHECK(StringUtil::encodeHex(buffer, buffer + 15, bytes, 8) == NULL);
+
+	char* end = StringUtil::toHexChars(buffer, buffer + 16, (uint64)0x0123456789ABCDEFULL);
+	BOOST_CHECK(std::string(buffer, end) == "0123456789ABCDEF");
+	end = StringUtil::toHexChars(buffer, buffer + 16, (int16)-2, false);
+	BOOST_CHECK(std::string(buffer, end) == "fffe");
+}
+
+BOOST_AUTO_TEST_CASE( FormatPerformanceCase1 )
+{
+	const int iterations = 1000000;
+	char buffer[32];
+	std::size_t total = 0;
+
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+		total += StringUtil::itoa((uint64)i * 2654435761ULL, 10).size();
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("itoa(base 10) takes %lf ns per integer\n", (end - start).seconds() * 1e9 / iterations);
+
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+		total += StringUtil::toChars(buffer, buffer + sizeof(buffer), (uint64)i * 2654435761ULL) - buffer;
+	end = tbb::tick_count::now();
+	printf("toChars() takes %lf ns per integer\n", (end - start).seconds() * 1e9 / iterations);
+
+	std::vector<unsigned char> data(1024 * 1024);
+	for(std::size_t i = 0; i < data.size(); ++i)
+		data[i] = (unsigned char)rand();
+	std::string hex;
+	hex.reserve(data.size() * 2);
+
+	start = tbb::tick_count::now();
+	for(std::size_t i = 0; i < data.size(); i += sizeof(uint64))
+	{
+		uint64 value;
+		memcpy(&value, &data[i], sizeof(value));
+		StringUtil::itoa(value, hex);
+	}
+	end = tbb::tick_count::now();
+	printf("itoa(hex) takes %lf ns per byte\n", (end - start).seconds() * 1e9 / data.size());
+
+	std::vector<char> out(data.size() * 2);
+	start = tbb::tick_count::now();
+	StringUtil::encodeHex(&out[0], &out[0] + out.size(), &data[0], data.size());
+	end = tbb::tick_count::now();
+	printf("encodeHex() takes %lf ns per byte\n", (end - start).seconds() * 1e9 / data.size());
+
+	BOOST_CHECK(total > 0);
+	BOOST_CHECK(hex.size() == out.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,140 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "core/Prerequisite.h"
+#include "utility/Symbol.h"
+#include <boost/lexical_cast.hpp>
+#include <boost/unordered_set.hpp>
+#include <atomic>
+#include <vector>
+
+#define BOOST_TEST_MODULE SymbolTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( SymbolTestSuite )
+
+BOOST_AUTO_TEST_CASE( SymbolTestCase1 )
+{
+	Symbol invalid;
+	BOOST_CHECK(!invalid.valid());
+	BOOST_CHECK_EQUAL(invalid.id(), (Symbol::id_type)Symbol::INVALID_ID);
+	BOOST_CHECK_EQUAL(string(invalid.c_str()), "");
+
+	BOOST_CHECK(!Symbol::find("session").valid());
+
+	std::size_t count = Symbol::count();
+	Symbol a("session");
+	Symbol b(string("session"));
+	Symbol c("service");
+
+	BOOST_CHECK(a.valid());
+	BOOST_CHECK(a == b);
+	BOOST_CHECK(a != c);
+	BOOST_CHECK(a.c_str() == b.c_str());
+	BOOST_CHECK_EQUAL(a.str(), "session");
+	BOOST_CHECK_EQUAL(a.length(), 7u);
+	BOOST_CHECK_EQUAL(a.id(), count);
+	BOOST_CHECK_EQUAL(c.id(), count + 1);
+	BOOST_CHECK(a < c);
+	BOOST_CHECK_EQUAL(Symbol::count(), count + 2);
+
+	BOOST_CHECK(Symbol::find("session") == a);
+	BOOST_CHECK(Symbol::fromId(c.id()) == c);
+	BOOST_CHECK(!Symbol::fromId(count + 2).valid());
+
+	// the length counts, not the terminating null
+	const char name[] = "a\0b";
+	Symbol embedded(name, 3);
+	BOOST_CHECK(embedded != Symbol("a"));
+	BOOST_CHECK_EQUAL(embedded.length(), 3u);
+	BOOST_CHECK(Symbol::find(name, 3) == embedded);
+
+	Symbol empty("");
+	BOOST_CHECK(empty.valid());
+	BOOST_CHECK(Symbol::find("") == empty);
+}
+
+BOOST_AUTO_TEST_CASE( SymbolTestCase2 )
+{
+	// enough symbols to grow the hash table and the id segments several times
+	const int n = 20000;
+
+	std::vector<Symbol> symbols;
+	for(int i = 0; i < n; ++i)
+		symbols.push_back(Symbol("many_" + boost::lexical_cast<string>(i)));
+
+	boost::unordered_set<Symbol> distinct(symbols.begin(), symbols.end());
+	BOOST_CHECK_EQUAL(distinct.size(), (std::size_t)n);
+
+	for(int i = 0; i < n; ++i)
+	{
+		string name = "many_" + boost::lexical_cast<string>(i);
+		BOOST_CHECK(Symbol::find(name) == symbols[i]);
+		BOOST_CHECK(Symbol::fromId(symbols[i].id()) == symbols[i]);
+		BOOST_CHECK_EQUAL(symbols[i].str(), name);
+	}
+
+	// long names don't go into the shared chunks
+	string long_name(100000, 'x');
+	Symbol long_symbol(long_name);
+	BOOST_CHECK_EQUAL(long_symbol.str(), long_name);
+	BOOST_CHECK(Symbol::find(long_name) == long_symbol);
+}
+
+BOOST_AUTO_TEST_CASE( SymbolTestCase3 )
+{
+	const int threads = 8;
+	const int n = 5000;
+
+	std::vector< std::vector<Symbol> > symbols(threads);
+	boost::thread_group group;
+	for(int t = 0; t < threads; ++t)
+	{
+		group.create_thread([&, t] {
+			// every thread interns the same names, each in a different order
+			for(int i = 0; i < n; ++i)
+			{
+				int k = (i * (t * 2 + 1) + t * 7) % n;
+				symbols[t].push_back(Symbol("shared_" + boost::lexical_cast<string>(k)));
+			}
+		});
+	}
+	group.join_all();
+
+	int mismatch = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		Symbol expected = Symbol::find("shared_" + boost::lexical_cast<string>(i));
+		for(int t = 0; t < threads; ++t)
+		{
+			int k = (i * (t * 2 + 1) + t * 7) % n;
+			if(symbols[t][i] != Symbol::find("shared_" + boost::lexical_cast<string>(k)))
+				++mismatch;
+		}
+		if(!expected.valid() || Symbol::fromId(expected.id()) != expected)
+			++mismatch;
+	}
+	BOOST_CHECK_EQUAL(mismatch, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
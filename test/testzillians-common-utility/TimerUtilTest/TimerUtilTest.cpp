@@ -0,0 +1,172 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "core/Prerequisite.h"
+#include "utility/TimerUtil.h"
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE TimerUtilTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( TimerUtilTestSuite )
+
+BOOST_AUTO_TEST_CASE( TimerUtil_Monotonic_Test )
+{
+	uint64_t last = TimerUtil::now_ns();
+	for(int i = 0; i < 1000000; ++i)
+	{
+		uint64_t now = TimerUtil::now_ns();
+		BOOST_REQUIRE( now >= last );
+		last = now;
+	}
+}
+
+BOOST_AUTO_TEST_CASE( TimerUtil_Calibration_Test )
+{
+	// a 50ms sleep measured by the cycle counter and by the clock agree within a millisecond
+	uint64_t clock_start = TimerUtil::clock_get_time_ns();
+	uint64_t start = TimerUtil::now_ns();
+	uint64_t cycles_start = TimerUtil::cycles();
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	uint64_t cycles_stop = TimerUtil::cycles();
+	uint64_t stop = TimerUtil::now_ns();
+	uint64_t clock_stop = TimerUtil::clock_get_time_ns();
+
+	int64_t clock_elapsed = clock_stop - clock_start;
+	int64_t elapsed = stop - start;
+	BOOST_CHECK( clock_elapsed >= 50000000 );
+	BOOST_CHECK( llabs(elapsed - clock_elapsed) < 1000000 );
+	BOOST_CHECK( llabs((int64_t)TimerUtil::cycles_to_ns(cycles_stop - cycles_start) - clock_elapsed) < 1000000 );
+
+	printf("constant cycle counter = %s, ns per cycle = %lf\n", TimerUtil::has_constant_cycle_counter() ? "yes" : "no", TimerUtil::ns_per_cycle());
+}
+
+BOOST_AUTO_TEST_CASE( TimerUtil_Histogram_Test )
+{
+	// buckets are contiguous and cover every value
+	for(std::size_t i = 1; i < TimerHistogram::BUCKET_COUNT; ++i)
+		BOOST_REQUIRE( TimerHistogram::lowestOf(i) == TimerHistogram::highestOf(i - 1) + 1 );
+	BOOST_CHECK( TimerHistogram::highestOf(TimerHistogram::BUCKET_COUNT - 1) == ~(uint64_t)0 );
+	BOOST_CHECK( TimerHistogram::bucketOf(~(uint64_t)0) == TimerHistogram::BUCKET_COUNT - 1 );
+	for(uint64_t value = 0; value < 100000; value += 7)
+	{
+		std::size_t bucket = TimerHistogram::bucketOf(value);
+		BOOST_REQUIRE( TimerHistogram::lowestOf(bucket) <= value && value <= TimerHistogram::highestOf(bucket) );
+	}
+
+	TimerHistogram histogram;
+	BOOST_CHECK( histogram.count() == 0 && histogram.percentile(50.0) == 0 );
+
+	for(uint64_t value = 1; value <= 10000; ++value)
+		histogram.record(value);
+	BOOST_CHECK( histogram.count() == 10000 );
+	BOOST_CHECK( histogram.min() == 1 && histogram.max() == 10000 );
+	BOOST_CHECK_CLOSE( histogram.mean(), 5000.5, 0.001 );
+
+	// within the 12.5% precision of buckets
+	BOOST_CHECK_CLOSE( (double)histogram.percentile(50.0), 5000.0, 12.5 );
+	BOOST_CHECK_CLOSE( (double)histogram.percentile(99.0), 9900.0, 12.5 );
+	BOOST_CHECK( histogram.percentile(100.0) == 10000 );
+	BOOST_CHECK( histogram.percentile(0.0) == 1 );
+
+	TimerHistogram other;
+	other.record(1000000);
+	histogram.merge(other);
+	BOOST_CHECK( histogram.count() == 10001 && histogram.max() == 1000000 );
+
+	histogram.reset();
+	BOOST_CHECK( histogram.count() == 0 && histogram.max() == 0 && histogram.min() == 0 );
+}
+
+static TimerStatistics sleep_time("sleep");
+
+static void sleepFor(int times)
+{
+	for(int i = 0; i < times; ++i)
+	{
+		ScopedTimer timer(sleep_time);
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+}
+
+BOOST_AUTO_TEST_CASE( TimerUtil_ScopedTimer_Test )
+{
+	// every thread records into its own histogram, collected at the end
+	boost::thread_group threads;
+	for(int i = 0; i < 4; ++i)
+		threads.create_thread(boost::bind(sleepFor, 10));
+	threads.join_all();
+
+	TimerHistogram collected = sleep_time.collect();
+	BOOST_CHECK( collected.count() == 40 );
+	BOOST_CHECK( collected.min() >= 1000000 );
+	sleep_time.print();
+
+	sleep_time.reset();
+	BOOST_CHECK( sleep_time.collect().count() == 0 );
+
+	uint64_t elapsed = 0;
+	{
+		ScopedTimer timer(elapsed);
+		boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+		timer.stop();
+		boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+	}
+	BOOST_CHECK( elapsed >= 2000000 && elapsed < 20000000 );
+}
+
+BOOST_AUTO_TEST_CASE( TimerUtil_Performance_Test )
+{
+	const int iterations = 10000000;
+
+	uint64_t sum = 0;
+	uint64_t start = TimerUtil::now_ns();
+	for(int i = 0; i < iterations; ++i)
+		sum += TimerUtil::now_ns();
+	uint64_t stop = TimerUtil::now_ns();
+	printf("now_ns() takes %.2lf ns\n", (double)(stop - start) / iterations);
+
+	start = TimerUtil::now_ns();
+	for(int i = 0; i < iterations / 10; ++i)
+		sum += TimerUtil::clock_get_time_ns();
+	stop = TimerUtil::now_ns();
+	printf("clock_get_time_ns() takes %.2lf ns\n", (double)(stop - start) / (iterations / 10));
+
+	TimerHistogram histogram;
+	start = TimerUtil::now_ns();
+	for(int i = 0; i < iterations; ++i)
+	{
+		ScopedTimer timer(histogram);
+	}
+	stop = TimerUtil::now_ns();
+	printf("ScopedTimer into a histogram takes %.2lf ns\n", (double)(stop - start) / iterations);
+
+	BOOST_CHECK( sum != 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
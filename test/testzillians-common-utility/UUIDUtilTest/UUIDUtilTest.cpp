@@ -23,6 +23,13 @@
 #include "core/Prerequisite.h"
 #include "utility/UUIDUtil.h"
 #include "utility/StringUtil.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <set>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <tbb/tick_count.h>
 
 #define BOOST_TEST_MODULE UUIDUtilTest
 #define BOOST_TEST_MAIN
@@ -335,4 +342,161 @@ BOOST_AUTO_TEST_CASE( UUIDCase12 )
 	BOOST_CHECK(sizeof(UUID) == 16);
 }
 
+BOOST_AUTO_TEST_CASE( UUIDCase13 )
+{
+	// version 4 ids from the thread-local generator
+	std::vector<UUID> ids(100000);
+	UUID::random_n(&ids[0], ids.size());
+
+	std::set<UUID> unique(ids.begin(), ids.end());
+	BOOST_CHECK(unique.size() == ids.size());
+
+	for(std::size_t i = 0; i < ids.size(); ++i)
+	{
+		BOOST_CHECK((ids[i].data.raw.data[6] & 0xF0) == 0x40);
+		BOOST_CHECK((ids[i].data.raw.data[8] & 0xC0) == 0x80);
+	}
+}
+
+static void generateIds(std::vector<UUID>* ids, bool ordered)
+{
+	for(std::size_t i = 0; i < ids->size(); i += 100)
+	{
+		if(ordered)
+			UUID::ordered_n(&(*ids)[i], 100);
+		else
+			UUID::random_n(&(*ids)[i], 100);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UUIDCase14 )
+{
+	// every thread has its own generator, none of them may repeat another's ids
+	const int threads = 4;
+	std::vector< std::vector<UUID> > ids(threads * 2, std::vector<UUID>(20000));
+	boost::thread_group group;
+	for(int i = 0; i < threads * 2; ++i)
+		group.create_thread(boost::bind(&generateIds, &ids[i], i >= threads));
+	group.join_all();
+
+	std::set<UUID> unique;
+	for(std::size_t i = 0; i < ids.size(); ++i)
+		unique.insert(ids[i].begin(), ids[i].end());
+	BOOST_CHECK(unique.size() == ids.size() * ids[0].size());
+}
+
+BOOST_AUTO_TEST_CASE( UUIDCase15 )
+{
+	// version 7 ids of a thread are strictly increasing in byte order
+	std::vector<UUID> ids(50000);
+	for(std::size_t i = 0; i < ids.size() / 2; ++i)
+		UUID::ordered(ids[i]);
+	UUID::ordered_n(&ids[ids.size() / 2], ids.size() / 2);
+
+	for(std::size_t i = 0; i < ids.size(); ++i)
+	{
+		BOOST_CHECK((ids[i].data.raw.data[6] & 0xF0) == 0x70);
+		BOOST_CHECK((ids[i].data.raw.data[8] & 0xC0) == 0x80);
+		if(i > 0)
+			BOOST_CHECK(std::memcmp(ids[i - 1].data.raw.data, ids[i].data.raw.data, 16) < 0);
+	}
+
+	// the leading 48 bits are the Unix time in milliseconds
+	uint64 millis = 0;
+	for(int i = 0; i < 6; ++i)
+		millis = (millis << 8) | ids.back().data.raw.data[i];
+	uint64 now = (uint64)time(NULL) * 1000;
+	BOOST_CHECK(millis + 60000 > now && millis < now + 60000);
+}
+
+BOOST_AUTO_TEST_CASE( UUIDCase16 )
+{
+	// parse and format without going through strings
+	UUID id;
+	BOOST_REQUIRE(UUID::parse("1A03C570-379a-11de-9B9A-001d92648305", id));
+	BOOST_CHECK(id.data.raw.data[0] == 0x1a && id.data.raw.data[15] == 0x05);
+
+	char text[36];
+	UUID::format(id, text);
+	BOOST_CHECK(std::string(text, 36) == "1a03c570-379a-11de-9b9a-001d92648305");
+
+	// the text may go on with the const char* version, not with std::string
+	UUID other;
+	BOOST_CHECK(UUID::parse("1a03c570-379a-11de-9b9a-001d92648305 trailing", other));
+	BOOST_CHECK(other == id);
+	BOOST_CHECK(!UUID::parse(std::string("1a03c570-379a-11de-9b9a-001d92648305 "), other));
+
+	// anything else fails and leaves the id alone
+	const char* invalid[] = {
+		"",
+		"1a03c570-379a-11de-9b9a-001d9264830",
+		"1a03c570-379a-11de-9b9a-001d9264830g",
+		"1a03c570_379a-11de-9b9a-001d92648305",
+		"1a03c570-379a-11de-9b9a001d92648305ab",
+		"1a03c57-0379a-11de-9b9a-001d92648305",
+		"5a1e115437bf11deb7fc001d92648382"
+	};
+	for(std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+	{
+		BOOST_CHECK(!UUID::parse(invalid[i], other));
+		BOOST_CHECK(!UUID::parse(std::string(invalid[i]), other));
+		BOOST_CHECK(other == id);
+	}
+
+	// invalid text gives the invalid UUID
+	UUID parsed = "not a uuid";
+	BOOST_CHECK(parsed.invalid());
+
+	// round trip of random ids
+	std::vector<UUID> ids(1000);
+	UUID::random_n(&ids[0], ids.size());
+	for(std::size_t i = 0; i < ids.size(); ++i)
+	{
+		UUID::format(ids[i], text);
+		BOOST_CHECK(UUID::parse(std::string(text, 36), other));
+		BOOST_CHECK(other == ids[i]);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UUIDPerformanceCase1 )
+{
+	const std::size_t count = 1000000;
+	std::vector<UUID> ids(1000);
+	UUID::random_n(&ids[0], ids.size());
+
+	std::vector<char> text(ids.size() * 36);
+	tbb::tick_count start = tbb::tick_count::now();
+	for(std::size_t n = 0; n < count; n += ids.size())
+		for(std::size_t i = 0; i < ids.size(); ++i)
+			UUID::format(ids[i], &text[i * 36]);
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("UUID::format() takes %lf ns per uuid\n", (end - start).seconds() * 1e9 / count);
+
+	std::size_t valid = 0;
+	UUID id;
+	start = tbb::tick_count::now();
+	for(std::size_t n = 0; n < count; n += ids.size())
+		for(std::size_t i = 0; i < ids.size(); ++i)
+			valid += UUID::parse(&text[i * 36], id);
+	end = tbb::tick_count::now();
+	printf("UUID::parse() takes %lf ns per uuid\n", (end - start).seconds() * 1e9 / count);
+	BOOST_CHECK(valid == count);
+
+	char temp[APR_UUID_FORMATTED_LENGTH + 1];
+	start = tbb::tick_count::now();
+	for(std::size_t n = 0; n < count; n += ids.size())
+		for(std::size_t i = 0; i < ids.size(); ++i)
+			apr_uuid_format(temp, &ids[i].data.raw);
+	end = tbb::tick_count::now();
+	printf("apr_uuid_format() takes %lf ns per uuid\n", (end - start).seconds() * 1e9 / count);
+
+	UUID::format(ids[0], temp);
+	temp[APR_UUID_FORMATTED_LENGTH] = '\0';
+	start = tbb::tick_count::now();
+	for(std::size_t n = 0; n < count; ++n)
+		apr_uuid_parse(&id.data.raw, temp);
+	end = tbb::tick_count::now();
+	printf("apr_uuid_parse() takes %lf ns per uuid\n", (end - start).seconds() * 1e9 / count);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,204 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "core/Prerequisite.h"
+#include "utility/UnicodeUtil.h"
+#include <tbb/tick_count.h>
+#include <vector>
+#include <cstdio>
+
+#define BOOST_TEST_MODULE UnicodeUtilTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace zillians;
+
+BOOST_AUTO_TEST_SUITE( UnicodeUtilTestSuite )
+
+static std::wstring toUcs4(const std::string& utf8)
+{
+	std::wstring result;
+	utf8_to_ucs4(utf8, result);
+	return result;
+}
+
+BOOST_AUTO_TEST_CASE( UnicodeUtilTestCase1 )
+{
+	// ASCII longer than a block, one, two, three and four byte sequences
+	std::string utf8 = "hello world, this is plain ascii \xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80!";
+	std::wstring ucs4 = toUcs4(utf8);
+
+	BOOST_REQUIRE(ucs4.size() == 33 + 4);
+	BOOST_CHECK(ucs4.compare(0, 33, L"hello world, this is plain ascii ") == 0);
+	BOOST_CHECK(ucs4[33] == 0xE9);
+	BOOST_CHECK(ucs4[34] == 0x4E2D);
+	BOOST_CHECK((boost::uint32_t)ucs4[35] == 0x1F600);
+	BOOST_CHECK(ucs4[36] == L'!');
+
+	std::string back;
+	ucs4_to_utf8(ucs4, back);
+	BOOST_CHECK(back == utf8);
+
+	std::vector<boost::uint16_t> utf16(utf8.size());
+	std::size_t written = 0;
+	BOOST_REQUIRE(utf8_to_utf16(utf8.data(), utf8.size(), &utf16[0], written));
+	BOOST_REQUIRE(written == 33 + 5);
+	BOOST_CHECK(utf16[35] == 0xD83D && utf16[36] == 0xDE00);
+
+	std::vector<char> buffer(3 * written);
+	std::size_t length = 0;
+	BOOST_REQUIRE(utf16_to_utf8(&utf16[0], written, &buffer[0], length));
+	BOOST_CHECK(std::string(&buffer[0], length) == utf8);
+}
+
+BOOST_AUTO_TEST_CASE( UnicodeUtilTestCase2 )
+{
+	// invalid input is reported with the valid prefix written
+	const char* invalid[] = {
+		"abc\x80",				// stray continuation byte
+		"abc\xC0\xAF",			// overlong '/'
+		"abc\xE0\x80\xAF",		// overlong '/'
+		"abc\xED\xA0\x80",		// surrogate
+		"abc\xF4\x90\x80\x80",	// above U+10FFFF
+		"abc\xE4\xB8",			// truncated
+		"abc\xF8\x88\x80\x80\x80"	// five bytes
+	};
+
+	wchar_t ucs4[16];
+	boost::uint16_t utf16[16];
+	for(std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+	{
+		std::size_t written = 0;
+		BOOST_CHECK(!utf8_to_ucs4(invalid[i], strlen(invalid[i]), ucs4, written));
+		BOOST_CHECK(written == 3);
+		BOOST_CHECK(!utf8_to_utf16(invalid[i], strlen(invalid[i]), utf16, written));
+		BOOST_CHECK(written == 3);
+	}
+
+	char utf8[64];
+	std::size_t written = 0;
+	wchar_t surrogate[] = { L'a', (wchar_t)0xD800 };
+	BOOST_CHECK(!ucs4_to_utf8(surrogate, 2, utf8, written));
+	BOOST_CHECK(written == 1);
+	wchar_t large[] = { (wchar_t)0x110000 };
+	BOOST_CHECK(!ucs4_to_utf8(large, 1, utf8, written));
+
+	boost::uint16_t unpaired[] = { 'a', 0xDC00, 'b' };
+	BOOST_CHECK(!utf16_to_utf8(unpaired, 3, utf8, written));
+	boost::uint16_t truncated[] = { 'a', 0xD800 };
+	BOOST_CHECK(!utf16_to_utf8(truncated, 2, utf8, written));
+}
+
+BOOST_AUTO_TEST_CASE( UnicodeUtilTestCase3 )
+{
+	// random code points, with ASCII runs of all lengths around the block size
+	srand(5);
+	for(int n = 0; n < 500; ++n)
+	{
+		std::wstring ucs4;
+		int count = rand() % 100;
+		for(int i = 0; i < count; ++i)
+		{
+			boost::uint32_t cp;
+			switch(rand() % 4)
+			{
+			case 0: cp = 0x80 + rand() % 0x780; break;
+			case 1: cp = 0x800 + rand() % 0xD000; break;
+			case 2: cp = 0x10000 + rand() % 0x100000; break;
+			default: cp = 0;
+			}
+			if(cp == 0)
+			{
+				for(int j = rand() % 40; j > 0; --j)
+					ucs4.push_back((wchar_t)(' ' + rand() % 90));
+			}
+			else
+				ucs4.push_back((wchar_t)cp);
+		}
+
+		std::string utf8;
+		ucs4_to_utf8(ucs4, utf8);
+
+		std::string expected;
+		typedef boost::u32_to_u8_iterator<std::wstring::const_iterator> iterator_type;
+		std::copy(iterator_type(ucs4.begin()), iterator_type(ucs4.end()), std::back_inserter(expected));
+		BOOST_CHECK(utf8 == expected);
+		BOOST_CHECK(toUcs4(utf8) == ucs4);
+
+		std::vector<boost::uint16_t> utf16(utf8.size() + 1);
+		std::vector<char> back(3 * utf16.size() + 1);
+		std::size_t written = 0, length = 0;
+		BOOST_CHECK(utf8_to_utf16(utf8.data(), utf8.size(), &utf16[0], written));
+		BOOST_CHECK(utf16_to_utf8(&utf16[0], written, &back[0], length));
+		BOOST_CHECK(std::string(&back[0], length) == utf8);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( UnicodeUtilTestCase4 )
+{
+	BOOST_CHECK(s_to_ws("plain ascii string longer than sixteen") == L"plain ascii string longer than sixteen");
+	BOOST_CHECK(ws_to_s(L"plain ascii string longer than sixteen") == "plain ascii string longer than sixteen");
+	BOOST_CHECK(s_to_ws(std::string("ab\0cd", 5)) == L"ab");
+	BOOST_CHECK(ws_to_s(L"") == "");
+}
+
+BOOST_AUTO_TEST_CASE( UnicodePerformanceTestCase1 )
+{
+	const int iterations = 100;
+	std::string text;
+	for(int i = 0; i < 20000; ++i)
+		text.append((i % 10 == 0) ? "\xE4\xB8\xAD\xE6\x96\x87 " : "chat text ");
+
+	std::wstring ucs4;
+	tbb::tick_count start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		ucs4.clear();
+		utf8_to_ucs4(text, ucs4);
+	}
+	tbb::tick_count end = tbb::tick_count::now();
+	printf("utf8_to_ucs4 takes %lf ns per byte\n", (end - start).seconds() * 1e9 / (iterations * text.size()));
+
+	std::wstring reference;
+	typedef boost::u8_to_u32_iterator<std::string::const_iterator> iterator_type;
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		reference.clear();
+		std::copy(iterator_type(text.begin()), iterator_type(text.end()), std::back_inserter(reference));
+	}
+	end = tbb::tick_count::now();
+	printf("u8_to_u32_iterator takes %lf ns per byte\n", (end - start).seconds() * 1e9 / (iterations * text.size()));
+	BOOST_CHECK(ucs4 == reference);
+
+	std::string utf8;
+	start = tbb::tick_count::now();
+	for(int i = 0; i < iterations; ++i)
+	{
+		utf8.clear();
+		ucs4_to_utf8(ucs4, utf8);
+	}
+	end = tbb::tick_count::now();
+	printf("ucs4_to_utf8 takes %lf ns per character\n", (end - start).seconds() * 1e9 / (iterations * ucs4.size()));
+	BOOST_CHECK(utf8 == text);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,145 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2009 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "core/Prerequisite.h"
+#include "core/AllocationTrace.h"
+#include "core/HugePageRegion.h"
+#include "core/ScalablePoolAllocator.h"
+#include "Benchmark.h"
+#include <boost/thread/thread.hpp>
+#include <stdlib.h>
+#include <vector>
+
+#define BOOST_TEST_MODULE AllocationReplayPerformanceTest
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+using namespace zillians;
+
+namespace {
+
+const std::size_t POOL_SIZE = 256 * 1024 * 1024;
+const char* SYNTHETIC_TRACE_PATH = "AllocationReplayPerformanceTest.trace";
+
+// a stand-in for a production trace: message sized allocations, some of them freed by the next thread
+void produce(ScalablePoolAllocator* pool, std::vector<byte*>* handoff, std::size_t rounds, unsigned seed)
+{
+	std::vector<byte*> live;
+	for(std::size_t i = 0; i < rounds; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		std::size_t size = ((seed >> 16) % 64 == 0) ? 8192 + (seed >> 8) % 32768 : 16 + (seed >> 12) % 512;
+		live.push_back(pool->allocate(size));
+		if(live.size() > 1024)
+		{
+			std::size_t victim = (seed >> 4) % live.size();
+			if(victim % 16 == 0)
+				handoff->push_back(live[victim]);
+			else
+				pool->deallocate(live[victim]);
+			live[victim] = live.back();
+			live.pop_back();
+		}
+	}
+	for(std::size_t i = 0; i < live.size(); ++i)
+		pool->deallocate(live[i]);
+}
+
+void consume(ScalablePoolAllocator* pool, std::vector<byte*>* handoff)
+{
+	for(std::size_t i = 0; i < handoff->size(); ++i)
+		pool->deallocate((*handoff)[i]);
+}
+
+std::string getTracePath()
+{
+	const char* path = getenv("ZILLIANS_ALLOCATION_TRACE");
+	if(path)
+		return path;
+
+	HugePageRegion region(POOL_SIZE, HugePageRegion::TRANSPARENT_HUGE_PAGES);
+	ScalablePoolAllocator pool(region.data(), region.size(), 0, 0, 1, true);
+	{
+		AllocationTracer tracer(SYNTHETIC_TRACE_PATH);
+		pool.setTracer(&tracer);
+
+		const std::size_t THREADS = 4;
+		std::vector< std::vector<byte*> > handoffs(THREADS);
+		{
+			boost::thread_group group;
+			for(std::size_t i = 0; i < THREADS; ++i)
+				group.create_thread(boost::bind(produce, &pool, &handoffs[i], 100000, i + 1));
+			group.join_all();
+		}
+		{
+			boost::thread_group group;
+			for(std::size_t i = 0; i < THREADS; ++i)
+				group.create_thread(boost::bind(consume, &pool, &handoffs[(i + 1) % THREADS]));
+			group.join_all();
+		}
+
+		pool.setTracer(NULL);
+	}
+	return SYNTHETIC_TRACE_PATH;
+}
+
+uint64 replay(BenchmarkState& state, AllocationTrace& trace, BufferAllocator& allocator, const std::string& name)
+{
+	state.start();
+	AllocationReplayResult result = trace.replay(allocator);
+	state.stop();
+
+	state.setItemsProcessed(result.operations);
+	state.setCounter("failures", result.failures);
+	state.setCounter("peak resident KB", result.peakResidentBytes / 1024);
+
+	// the latency histograms of the first measured run
+	if(!state.isWarmup() && state.repetition() == 0)
+		result.print(name);
+
+	return result.failures;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE( AllocationReplayPerformanceTestSuite )
+
+BOOST_AUTO_TEST_CASE( AllocationReplayPerformanceTestCase1 )
+{
+	// set ZILLIANS_ALLOCATION_TRACE to replay a trace recorded from production
+	AllocationTrace trace(getTracePath());
+	printf("%lu threads, %lu allocations, %lu operations, peak requested %lu KB\n",
+			(unsigned long)trace.threadCount(), (unsigned long)trace.allocationCount(),
+			(unsigned long)trace.operationCount(), (unsigned long)(trace.peakRequestedBytes() / 1024));
+
+	Benchmark::run("allocation_replay/DefaultBufferAllocator", [&](BenchmarkState& state) {
+		DefaultBufferAllocator allocator;
+		BOOST_CHECK_EQUAL(replay(state, trace, allocator, "DefaultBufferAllocator"), 0);
+	});
+
+	Benchmark::run("allocation_replay/ScalablePoolBufferAllocator", [&](BenchmarkState& state) {
+		HugePageRegion region(POOL_SIZE, HugePageRegion::TRANSPARENT_HUGE_PAGES);
+		ScalablePoolAllocator pool(region.data(), region.size(), 0, 0, 1, true);
+		ScalablePoolBufferAllocator allocator(pool);
+		replay(state, trace, allocator, "ScalablePoolBufferAllocator");
+	});
+
+	remove(SYNTHETIC_TRACE_PATH);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
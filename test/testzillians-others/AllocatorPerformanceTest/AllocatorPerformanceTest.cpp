@@ -1,6 +1,7 @@
 #include <boost/pool/object_pool.hpp>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
 #include <list>
+#include <map>
 #include <queue>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,11 +9,16 @@
 #include <string.h>
 #include "tbb/tbb_thread.h"
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "core/ScalablePoolAllocator.h"
+#include "Benchmark.h"
 
 //#include <core/SharedCount.h>
 //#include <core/ObjectPool.h>
 
 //using namespace zillians;
+using zillians::Benchmark;
+using zillians::BenchmarkState;
 
 class DummyMessage
 {
@@ -24,26 +30,22 @@ public:
 	int data;
 };
 
-void testNaiveAllocationSingle(int iterations)
+void testNaiveAllocationSingle(BenchmarkState& state, int iterations)
 {
-	tbb::tick_count start, end;
-	
-	start = tbb::tick_count::now();
+	state.start();
 	{
 		DummyMessage *obj = new DummyMessage();
 		delete obj;
 	}
-	end = tbb::tick_count::now();
-	printf("\tnative allocate/delete (single) takes %lf ms\n", (end - start).seconds()*1000.0);
+	state.stop();
+	state.setItemsProcessed(1);
 }
 
-void testNaiveAllocationArray(int iterations)
+void testNaiveAllocationArray(BenchmarkState& state, int iterations)
 {
-	tbb::tick_count start, end;
-	
 	DummyMessage** objlist = new DummyMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	state.start();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -54,20 +56,18 @@ void testNaiveAllocationArray(int iterations)
 			delete objlist[j];
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tnative allocate/delete (array) takes %lf ms\n", (end - start).seconds()*1000.0);
+	state.stop();
+	state.setItemsProcessed(iterations);
 	
 	delete[] objlist;
 }
 
-void testNaiveReplacementAllocationArray(int iterations)
+void testNaiveReplacementAllocationArray(BenchmarkState& state, int iterations)
 {
-	tbb::tick_count start, end;
-	
 	char* buffer = new char[sizeof(DummyMessage)*iterations];
 	DummyMessage** objlist = new DummyMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	state.start();
 	{
 		size_t offset = 0;
 		for(int i=0;i<iterations;++i)
@@ -80,8 +80,8 @@ void testNaiveReplacementAllocationArray(int iterations)
 			objlist[j]->~DummyMessage();
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tnative placement allocate/delete (array) takes %lf ms\n", (end - start).seconds()*1000.0);
+	state.stop();
+	state.setItemsProcessed(iterations);
 	
 	delete[] objlist;
 	delete[] buffer;
@@ -101,25 +101,25 @@ boost::object_pool<DummyBoostPooledMessage> pool;
 
 void testBoostObjectPoolSingle(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		DummyBoostPooledMessage *obj = pool.malloc();
 		pool.destroy(obj);
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on boost object pool (single) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on boost object pool (single) takes %lf ms\n", (end - start) / 1000000.0);
 	
 }
 
 void testBoostObjectPoolArraySameOrder(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
 	DummyBoostPooledMessage** objlist = new DummyBoostPooledMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -130,18 +130,18 @@ void testBoostObjectPoolArraySameOrder(int iterations)
 			pool.destroy(objlist[j]);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on boost object pool (array) (same order) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on boost object pool (array) (same order) takes %lf ms\n", (end - start) / 1000000.0);
 	delete [] objlist;
 }
 
 void testBoostObjectPoolArrayReversedOrder(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
 	DummyBoostPooledMessage** objlist = new DummyBoostPooledMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -152,8 +152,8 @@ void testBoostObjectPoolArrayReversedOrder(int iterations)
 			pool.destroy(objlist[j]);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on boost object pool (array) (reversed order) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on boost object pool (array) (reversed order) takes %lf ms\n", (end - start) / 1000000.0);
 	delete [] objlist;
 }
 */
@@ -170,11 +170,11 @@ public:
 
 void testMyObjectPoolSameOrder(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
 	DummyMyPooledMessage** objlist = new DummyMyPooledMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -186,18 +186,18 @@ void testMyObjectPoolSameOrder(int iterations)
 			//ZN_SAFE_RELEASE(objlist[j]);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on my object pool (reversed order) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on my object pool (reversed order) takes %lf ms\n", (end - start) / 1000000.0);
 	delete [] objlist;	
 }
 
 void testMyObjectPoolReversedOrder(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
 	DummyMyPooledMessage** objlist = new DummyMyPooledMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -209,8 +209,8 @@ void testMyObjectPoolReversedOrder(int iterations)
 			//ZN_SAFE_RELEASE(objlist[j]);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on my object pool (reversed order) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on my object pool (reversed order) takes %lf ms\n", (end - start) / 1000000.0);
 	delete [] objlist;	
 }
 */
@@ -233,11 +233,11 @@ void testMyObjectPoolReversedOrder(int iterations)
 
 void testBoostSandboxMemorySameOrder(int iterations)
 {
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
 	DummyBoostPooledMessage** objlist = new DummyBoostPooledMessage*[iterations];
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		boost::scoped_alloc mScopedAlloc;
 		for(int i=0;i<iterations;++i)
@@ -245,25 +245,214 @@ void testBoostSandboxMemorySameOrder(int iterations)
 			objlist[i] = BOOST_MEMORY_NEW(mScopedAlloc, DummyBoostPooledMessage);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tallocate/delete on boost object pool (array) (reversed order) takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	printf("\tallocate/delete on boost object pool (array) (reversed order) takes %lf ms\n", (end - start) / 1000000.0);
 	delete [] objlist;
 }
 */
 
 
+/**
+ * Compare buffer payload allocation from the global heap and from ScalablePoolAllocator
+ * on a message mix between 64 bytes and 64 kilobytes.
+ */
+#define BUFFER_POOL_SIZE (256 * 1048576)
+#define BUFFER_MIN_MESSAGE_SIZE 64
+#define BUFFER_MAX_MESSAGE_SIZE 65536
+
+void prepareBufferMessageSizes(std::vector<size_t>& sizes, int iterations)
+{
+	srand(0xdeadbeef);
+	sizes.reserve(iterations);
+	for(int i=0;i<iterations;++i)
+	{
+		// pick a power-of-two bucket so that small messages dominate the mix like real traffic
+		size_t bucket = BUFFER_MIN_MESSAGE_SIZE << (rand() % 11);
+		sizes.push_back(bucket / 2 + rand() % (bucket / 2 + 1));
+	}
+}
+
+void testBufferAllocation(BenchmarkState& state, zillians::BufferAllocator* allocator, const std::vector<size_t>& sizes)
+{
+	zillians::BufferT<zillians::BufferMode::plain, zillians::BufferConcurrency::none, zillians::BufferObjectPoolStrategy::none>** objlist =
+			new zillians::BufferT<zillians::BufferMode::plain, zillians::BufferConcurrency::none, zillians::BufferObjectPoolStrategy::none>*[sizes.size()];
+
+	state.start();
+	{
+		for(size_t i=0;i<sizes.size();++i)
+		{
+			objlist[i] = new zillians::BufferT<zillians::BufferMode::plain, zillians::BufferConcurrency::none, zillians::BufferObjectPoolStrategy::none>(sizes[i], allocator);
+		}
+		for(size_t j=0;j<sizes.size();++j)
+		{
+			delete objlist[j];
+		}
+	}
+	state.stop();
+	state.setItemsProcessed(sizes.size());
+
+	delete[] objlist;
+}
+
+void testBufferAllocationMix(BenchmarkState& state, int iterations, bool pooled)
+{
+	std::vector<size_t> sizes;
+	prepareBufferMessageSizes(sizes, iterations);
+
+	if(!pooled)
+	{
+		testBufferAllocation(state, NULL, sizes);
+		return;
+	}
+
+	zillians::byte* memory = new zillians::byte[BUFFER_POOL_SIZE];
+	{
+		zillians::ScalablePoolAllocator pool(memory, BUFFER_POOL_SIZE);
+		zillians::ScalablePoolBufferAllocator allocator(pool);
+		testBufferAllocation(state, &allocator, sizes);
+	}
+	delete[] memory;
+}
+
+
+/**
+ * Allocate and free 128KB-4MB asset buffers from multiple threads at once, which all go
+ * through the large chunk path of ScalablePoolAllocator. With a fixed size all threads
+ * hit the freelist of the same large size class, the worst case for contention.
+ */
+#define LARGE_POOL_SIZE (1024 * 1048576)
+#define LARGE_MIN_SIZE (128 * 1024)
+#define LARGE_MAX_SIZE (4 * 1048576)
+#define LARGE_THREAD_ITERATIONS 2000
+#define LARGE_LIVE_COUNT 8
+#define LARGE_FIXED_SIZE (256 * 1024)
+
+void runLargeAllocationThread(zillians::ScalablePoolAllocator* pool, unsigned int seed, size_t fixedSize)
+{
+	zillians::byte* live[LARGE_LIVE_COUNT] = { 0 };
+	for(int i=0;i<LARGE_THREAD_ITERATIONS;++i)
+	{
+		int slot = i % LARGE_LIVE_COUNT;
+		size_t size = fixedSize ? fixedSize : LARGE_MIN_SIZE + rand_r(&seed) % (LARGE_MAX_SIZE - LARGE_MIN_SIZE);
+
+		if(pool)
+		{
+			pool->deallocate(live[slot]);
+			live[slot] = pool->allocate(size);
+		}
+		else
+		{
+			free(live[slot]);
+			live[slot] = (zillians::byte*)malloc(size);
+		}
+		if(live[slot]) live[slot][0] = 0;
+	}
+	for(int i=0;i<LARGE_LIVE_COUNT;++i)
+	{
+		if(pool)
+			pool->deallocate(live[i]);
+		else
+			free(live[i]);
+	}
+}
+
+void testLargeAllocationThreaded(BenchmarkState& state, int threads, bool pooled, size_t fixedSize)
+{
+	zillians::byte* memory = NULL;
+	zillians::ScalablePoolAllocator* pool = NULL;
+	if(pooled)
+	{
+		memory = new zillians::byte[LARGE_POOL_SIZE];
+		pool = new zillians::ScalablePoolAllocator(memory, LARGE_POOL_SIZE);
+	}
+
+	std::vector<tbb::tbb_thread*> workers;
+
+	state.start();
+	for(int i=0;i<threads;++i)
+		workers.push_back(new tbb::tbb_thread(boost::bind(runLargeAllocationThread, pool, (unsigned int)i, fixedSize)));
+	for(int i=0;i<threads;++i)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+	state.stop();
+	state.setItemsProcessed((zillians::uint64)threads * LARGE_THREAD_ITERATIONS);
+
+	delete pool;
+	delete[] memory;
+}
+
+
+/**
+ * Build and tear down a std::map, whose nodes are small allocations like most STL traffic,
+ * from the global heap and from the per-thread bins of ScalablePoolAllocator.
+ *
+ * Run AllocatorPerformanceTestScalableMalloc for the global heap replaced by the pool, and
+ * LD_PRELOAD tcmalloc or jemalloc into AllocatorPerformanceTest to compare against them.
+ */
+#define STL_POOL_SIZE (256 * 1048576)
+
+template<typename Map>
+void runStlContainer(BenchmarkState& state, Map& m, int iterations)
+{
+	state.start();
+	{
+		for(int i=0;i<iterations;++i)
+			m.insert(std::make_pair(i * 7919 % iterations, i));
+		for(int i=0;i<iterations;++i)
+			m.erase(i);
+	}
+	state.stop();
+	state.setItemsProcessed(iterations);
+}
+
+void testStlContainer(BenchmarkState& state, int iterations, bool pooled)
+{
+	if(!pooled)
+	{
+		std::map<int, int> m;
+		runStlContainer(state, m, iterations);
+		return;
+	}
+
+	zillians::byte* memory = new zillians::byte[STL_POOL_SIZE];
+	{
+		typedef zillians::ScalablePoolStlAllocator<std::pair<const int, int> > allocator_type;
+		zillians::ScalablePoolAllocator pool(memory, STL_POOL_SIZE);
+		allocator_type allocator(pool);
+		std::map<int, int, std::less<int>, allocator_type> m(std::less<int>(), allocator);
+		runStlContainer(state, m, iterations);
+	}
+	delete[] memory;
+}
+
+
 #define ITERATION_COUNT 2
 #define ELEMENT_COUNT 20000
 int main(int argc, char** argv)
 {
-	for(int i=0;i<ITERATION_COUNT;++i)
-		testNaiveAllocationSingle(ELEMENT_COUNT);
-	
-	for(int i=0;i<ITERATION_COUNT;++i)
-		testNaiveAllocationArray(ELEMENT_COUNT);
-		
-	for(int i=0;i<ITERATION_COUNT;++i)
-		testNaiveReplacementAllocationArray(ELEMENT_COUNT);
+	if(!Benchmark::options().parse(argc, argv))
+		return 1;
+
+	Benchmark::run("allocator/native/single", boost::bind(testNaiveAllocationSingle, _1, ELEMENT_COUNT));
+	Benchmark::run("allocator/native/array", boost::bind(testNaiveAllocationArray, _1, ELEMENT_COUNT));
+	Benchmark::run("allocator/native/placement_array", boost::bind(testNaiveReplacementAllocationArray, _1, ELEMENT_COUNT));
+
+	Benchmark::run("allocator/buffer_mix/global_heap", boost::bind(testBufferAllocationMix, _1, ELEMENT_COUNT, false));
+	Benchmark::run("allocator/buffer_mix/scalable_pool", boost::bind(testBufferAllocationMix, _1, ELEMENT_COUNT, true));
+
+	for(int threads=1;threads<=8;threads*=2)
+	{
+		std::string suffix = "/" + boost::lexical_cast<std::string>(threads) + "_threads";
+		Benchmark::run("allocator/large/global_heap" + suffix, boost::bind(testLargeAllocationThreaded, _1, threads, false, 0));
+		Benchmark::run("allocator/large/scalable_pool" + suffix, boost::bind(testLargeAllocationThreaded, _1, threads, true, 0));
+		Benchmark::run("allocator/large_one_class/global_heap" + suffix, boost::bind(testLargeAllocationThreaded, _1, threads, false, LARGE_FIXED_SIZE));
+		Benchmark::run("allocator/large_one_class/scalable_pool" + suffix, boost::bind(testLargeAllocationThreaded, _1, threads, true, LARGE_FIXED_SIZE));
+	}
+
+	Benchmark::run("allocator/std_map/global_heap", boost::bind(testStlContainer, _1, ELEMENT_COUNT * 10, false));
+	Benchmark::run("allocator/std_map/scalable_pool", boost::bind(testStlContainer, _1, ELEMENT_COUNT * 10, true));
 	
 /*	for(int i=0;i<ITERATION_COUNT;++i)
 		testBoostObjectPoolSingle(ELEMENT_COUNT);
@@ -3,25 +3,26 @@
 
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
 
 // test boost::unordered_map insertion and deletion performance (in same order)
-void test_boost_unordered_map_insert_search_delete_in_same_order(int iterations)
+void test_boost_unordered_map_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	boost::unordered_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -29,37 +30,37 @@ void test_boost_unordered_map_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test boost::unordered_map insertion and deletion performance (in reversed order)
-void test_boost_unordered_map_insert_search_delete_in_reverse_order(int iterations)
+void test_boost_unordered_map_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	boost::unordered_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -67,37 +68,37 @@ void test_boost_unordered_map_insert_search_delete_in_reverse_order(int iteratio
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test boost::unordered_set insertion and deletion performance (in same order)
-void test_boost_unordered_set_insert_search_delete_in_same_order(int iterations)
+void test_boost_unordered_set_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	boost::unordered_set<int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.insert(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -105,37 +106,37 @@ void test_boost_unordered_set_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test boost::unordered_set insertion and deletion performance (in reversed order)
-void test_boost_unordered_set_insert_search_delete_in_reverse_order(int iterations)
+void test_boost_unordered_set_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	boost::unordered_set<int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.insert(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -143,18 +144,18 @@ void test_boost_unordered_set_insert_search_delete_in_reverse_order(int iteratio
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 #endif /*BOOSTCONTAINERPERFORMANCETEST_H_*/
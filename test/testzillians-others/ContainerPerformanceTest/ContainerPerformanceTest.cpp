@@ -22,6 +22,9 @@
 #define TEST_STLPORT 0
 
 #include "core/Types.h"
+#include "Benchmark.h"
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 #if TEST_STLPORT
 	#include "STLPortContainerPerformance.h"
@@ -29,112 +32,104 @@
 	#include "STDContainerPerformanceTest.h"
 	#include "BoostContainerPerformanceTest.h"
 	#include "TBBContainerPerformanceTest.h"
+	#include "QueueContainerPerformanceTest.h"
+	#include "UUIDContainerPerformanceTest.h"
+	#include "HashContainerPerformanceTest.h"
 #endif
 
-#define ITERATION_COUNT 1
+using zillians::Benchmark;
+
 #define ELEMENT_COUNT 20000
 int main(int argc, char** argv)
 {
-	printf("ITERATION_COUNT = %d, ELEMENT_COUNT = %d\n", ITERATION_COUNT, ELEMENT_COUNT);
+	if(!Benchmark::options().parse(argc, argv))
+		return 1;
+
+	printf("ELEMENT_COUNT = %d\n", ELEMENT_COUNT);
 
 #if TEST_STLPORT
-	printf("[test_stlport_hash_map_insert_search_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_stlport_hash_map_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/stlport_hash_map_insert_search_delete_in_same_order", boost::bind(test_stlport_hash_map_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_stlport_hash_map_insert_search_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_stlport_hash_map_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/stlport_hash_map_insert_search_delete_in_reverse_order", boost::bind(test_stlport_hash_map_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
 #else
-	printf("[test_std_map_insert_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_map_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_map_insert_delete_in_same_order", boost::bind(test_std_map_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_std_map_insert_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_map_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_map_insert_delete_in_reverse_order", boost::bind(test_std_map_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
-	printf("[test_gnucxx_hash_map_insert_search_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_gnucxx_hash_map_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/gnucxx_hash_map_insert_search_delete_in_same_order", boost::bind(test_gnucxx_hash_map_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_gnucxx_hash_map_insert_search_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_gnucxx_hash_map_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/gnucxx_hash_map_insert_search_delete_in_reverse_order", boost::bind(test_gnucxx_hash_map_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
-	printf("[test_gnucxx_hash_set_insert_search_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_gnucxx_hash_set_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/gnucxx_hash_set_insert_search_delete_in_same_order", boost::bind(test_gnucxx_hash_set_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_gnucxx_hash_set_insert_search_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_gnucxx_hash_set_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/gnucxx_hash_set_insert_search_delete_in_reverse_order", boost::bind(test_gnucxx_hash_set_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
-	printf("[test_boost_unordered_map_insert_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_boost_unordered_map_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/boost_unordered_map_insert_delete_in_same_order", boost::bind(test_boost_unordered_map_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_boost_unordered_map_insert_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_boost_unordered_map_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/boost_unordered_map_insert_delete_in_reverse_order", boost::bind(test_boost_unordered_map_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
-	printf("[test_boost_unordered_set_insert_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_boost_unordered_set_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/boost_unordered_set_insert_delete_in_same_order", boost::bind(test_boost_unordered_set_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_boost_unordered_set_insert_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_boost_unordered_set_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/boost_unordered_set_insert_delete_in_reverse_order", boost::bind(test_boost_unordered_set_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
 
-	printf("[test_tbb_concurrent_hash_map_insert_search_delete_in_same_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/tbb_concurrent_hash_map_insert_search_delete_in_same_order", boost::bind(test_tbb_concurrent_hash_map_insert_search_delete_in_same_order, _1, ELEMENT_COUNT));
 
-	printf("[test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/tbb_concurrent_hash_map_insert_search_delete_in_reverse_order", boost::bind(test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order, _1, ELEMENT_COUNT));
+
+	Benchmark::run("container/uuid_std_map_insert_search_delete", boost::bind(test_uuid_std_map_insert_search_delete, _1, ELEMENT_COUNT));
+
+	Benchmark::run("container/uuid_gnucxx_hash_map_insert_search_delete", boost::bind(test_uuid_gnucxx_hash_map_insert_search_delete, _1, ELEMENT_COUNT));
+
+	Benchmark::run("container/uuid_boost_unordered_map_insert_search_delete", boost::bind(test_uuid_boost_unordered_map_insert_search_delete, _1, ELEMENT_COUNT));
+
+	Benchmark::run("container/uuid_tbb_concurrent_hash_map_insert_search_delete", boost::bind(test_uuid_tbb_concurrent_hash_map_insert_search_delete, _1, ELEMENT_COUNT));
+
+	// there's a template of the same name, which boost::bind can't tell apart
+	Benchmark::run("container/uuid_map_insert_search_delete", [](zillians::BenchmarkState& state) { test_uuid_map_insert_search_delete(state, ELEMENT_COUNT); });
+
+	Benchmark::run("container/uuid_concurrent_map_insert_search_delete", boost::bind(test_uuid_concurrent_map_insert_search_delete, _1, ELEMENT_COUNT));
+
+	for(int threads=1;threads<=8;threads*=2)
+		Benchmark::run("container/uuid_concurrent_lookup<tbb::concurrent_hash_map>/threads:" + boost::lexical_cast<std::string>(threads),
+				boost::bind(test_uuid_concurrent_lookup< tbb::concurrent_hash_map<UUID,int,UUIDHasher> >, _1, ELEMENT_COUNT, threads));
+
+	for(int threads=1;threads<=8;threads*=2)
+		Benchmark::run("container/uuid_concurrent_lookup<ConcurrentUUIDMap>/threads:" + boost::lexical_cast<std::string>(threads),
+				boost::bind(test_uuid_concurrent_lookup< ConcurrentUUIDMap<int> >, _1, ELEMENT_COUNT, threads));
 
-	printf("[test_concurrent_queue_push_pop]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
 	{
-		test_concurrent_queue_push_pop(ELEMENT_COUNT);
+		std::vector<void*> pointers = make_pointer_keys(ELEMENT_COUNT);
+		std::vector<std::string> strings = make_string_keys(ELEMENT_COUNT);
+
+		Benchmark::run("container/hash_collision<RawPointerHashCompare>", boost::bind(test_hash_collision<RawPointerHashCompare, void*>, _1, boost::cref(pointers)));
+		Benchmark::run("container/hash_collision<PointerHashCompare>", boost::bind(test_hash_collision< PointerHashCompare<void*>, void* >, _1, boost::cref(pointers)));
+		Benchmark::run("container/hash_collision<ByteLoopStringHasher>", boost::bind(test_hash_collision<ByteLoopStringHasher, std::string>, _1, boost::cref(strings)));
+		Benchmark::run("container/hash_collision<StringHasher>", boost::bind(test_hash_collision<StringHasher, std::string>, _1, boost::cref(strings)));
+
+		Benchmark::run("container/hash_throughput<RawPointerHashCompare>", boost::bind(test_hash_throughput<RawPointerHashCompare, void*>, _1, boost::cref(pointers)));
+		Benchmark::run("container/hash_throughput<PointerHashCompare>", boost::bind(test_hash_throughput< PointerHashCompare<void*>, void* >, _1, boost::cref(pointers)));
+		Benchmark::run("container/hash_throughput<tbb::tbb_hash_compare<std::string>>", boost::bind(test_hash_throughput< tbb::tbb_hash_compare<std::string>, std::string >, _1, boost::cref(strings)));
+		Benchmark::run("container/hash_throughput<StringHasher>", boost::bind(test_hash_throughput<StringHasher, std::string>, _1, boost::cref(strings)));
+
+		free_pointer_keys(pointers);
 	}
 
-	printf("[test_std_priority_queue_push_pop]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
+	Benchmark::run("container/concurrent_queue_push_pop", boost::bind(test_concurrent_queue_push_pop, _1, ELEMENT_COUNT));
+
+	for(int threads=1;threads<=4;threads*=2)
 	{
-		test_std_priority_queue_push_pop(ELEMENT_COUNT);
+		const std::string suffix = "/threads:" + boost::lexical_cast<std::string>(threads);
+		Benchmark::run("container/mpmc_queue_push_pop<tbb::concurrent_bounded_queue>" + suffix,
+				boost::bind(test_mpmc_queue_push_pop< tbb::concurrent_bounded_queue<int> >, _1, ELEMENT_COUNT, threads));
+		Benchmark::run("container/mpmc_queue_push_pop<ConcurrentQueue>" + suffix,
+				boost::bind(test_mpmc_queue_push_pop< zillians::ConcurrentQueue<int> >, _1, ELEMENT_COUNT, threads));
+		Benchmark::run("container/mpmc_queue_push_pop<AtomicUnboundedQueue>" + suffix,
+				boost::bind(test_mpmc_queue_push_pop< zillians::AtomicUnboundedQueue<int> >, _1, ELEMENT_COUNT, threads));
 	}
 
+	Benchmark::run("container/std_priority_queue_push_pop", boost::bind(test_std_priority_queue_push_pop, _1, ELEMENT_COUNT));
+
 
 #endif
 	/*
@@ -145,37 +140,17 @@ int main(int argc, char** argv)
 	}
 	*/
 	/*
-	printf("[test_std_queue_push_pop_with_boost_mutex]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_queue_push_pop_with_boost_mutex(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_queue_push_pop_with_boost_mutex", boost::bind(test_std_queue_push_pop_with_boost_mutex, _1, ELEMENT_COUNT));
 
-	printf("[test_std_queue_push_pop_with_mutex]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_queue_push_pop_with_mutex(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_queue_push_pop_with_mutex", boost::bind(test_std_queue_push_pop_with_mutex, _1, ELEMENT_COUNT));
 
-	printf("[test_std_queue_push_pop_with_spin_rw_mutex]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_queue_push_pop_with_spin_rw_mutex(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_queue_push_pop_with_spin_rw_mutex", boost::bind(test_std_queue_push_pop_with_spin_rw_mutex, _1, ELEMENT_COUNT));
 
-	printf("[test_std_queue_push_pop_with_spin_mutex]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_queue_push_pop_with_spin_mutex(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_queue_push_pop_with_spin_mutex", boost::bind(test_std_queue_push_pop_with_spin_mutex, _1, ELEMENT_COUNT));
 
 
 
-	printf("[test_std_queue_push_pop_with_recursive_mutex]\n");
-	for(int i=0;i<ITERATION_COUNT;++i)
-	{
-		test_std_queue_push_pop_with_recursive_mutex(ELEMENT_COUNT);
-	}
+	Benchmark::run("container/std_queue_push_pop_with_recursive_mutex", boost::bind(test_std_queue_push_pop_with_recursive_mutex, _1, ELEMENT_COUNT));
 	*/
 
 	return 0;
@@ -0,0 +1,123 @@
+#ifndef HASHCONTAINERPERFORMANCETEST_H_
+#define HASHCONTAINERPERFORMANCETEST_H_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <tbb/concurrent_hash_map.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
+#include "utility/StringUtil.h"
+#include "core/HashMap.h"
+
+using zillians::HashUtil;
+using zillians::StringHasher;
+using zillians::PointerHashCompare;
+
+// the hash compare PointerHashCompare used to be, hashing the raw address
+struct RawPointerHashCompare
+{
+	static size_t hash( void* const& x ) { return reinterpret_cast<size_t>(x); }
+	static bool equal( void* const& x, void* const& y ) { return x==y; }
+};
+
+// the byte loop StringHasher used to be
+struct ByteLoopStringHasher
+{
+	static size_t hash( const std::string& x )
+	{
+		size_t s = 0;
+		for(size_t i = 0; i < x.length(); ++i) s += x[i];
+		return s;
+	}
+	static bool equal( const std::string& x, const std::string& y ) { return x==y; }
+};
+
+std::vector<void*> make_pointer_keys(int iterations)
+{
+	std::vector<void*> keys;
+	keys.reserve(iterations);
+	for(int i=0;i<iterations;++i)
+		keys.push_back(new char[48]);
+	return keys;
+}
+
+void free_pointer_keys(std::vector<void*>& keys)
+{
+	for(std::size_t i=0;i<keys.size();++i)
+		delete[] static_cast<char*>(keys[i]);
+	keys.clear();
+}
+
+std::vector<std::string> make_string_keys(int iterations)
+{
+	std::vector<std::string> keys;
+	keys.reserve(iterations);
+	for(int i=0;i<iterations;++i)
+		keys.push_back("zillians.service." + boost::lexical_cast<std::string>(i));
+	return keys;
+}
+
+// report how the keys spread over a power-of-two bucket table, as in tbb::concurrent_hash_map
+template<typename HashCompare, typename Key>
+void test_hash_collision(zillians::BenchmarkState& state, const std::vector<Key>& keys)
+{
+	std::size_t buckets = 1;
+	while(buckets < keys.size()) buckets <<= 1;
+
+	HashCompare hasher;
+	std::vector<int> chains(buckets, 0);
+	for(std::size_t i=0;i<keys.size();++i)
+		++chains[hasher.hash(keys[i]) & (buckets - 1)];
+
+	std::size_t used = buckets - std::count(chains.begin(), chains.end(), 0);
+	int longest = *std::max_element(chains.begin(), chains.end());
+	state.setCounter("buckets", buckets);
+	state.setCounter("buckets used", used);
+	state.setCounter("longest chain", longest);
+}
+
+// test hashing throughput and tbb::concurrent_hash_map insert/search with the given hash compare
+template<typename HashCompare, typename Key>
+void test_hash_throughput(zillians::BenchmarkState& state, const std::vector<Key>& keys)
+{
+	uint64_t start, end;
+
+	HashCompare hasher;
+	std::size_t sum = 0;
+	start = zillians::TimerUtil::now_ns();
+	for(int round=0;round<10;++round)
+		for(std::size_t i=0;i<keys.size();++i)
+			sum += hasher.hash(keys[i]);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("hashing", end - start);
+	volatile std::size_t sink = sum;	// keeps the hashing from being optimized away
+	(void)sink;
+
+	tbb::concurrent_hash_map<Key,int,HashCompare> m;
+	start = zillians::TimerUtil::now_ns();
+	{
+		typename tbb::concurrent_hash_map<Key,int,HashCompare>::accessor a;
+		for(std::size_t i=0;i<keys.size();++i)
+		{
+			m.insert(a, keys[i]);
+			a->second = (int)i;
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
+
+	int found = 0;
+	start = zillians::TimerUtil::now_ns();
+	{
+		typename tbb::concurrent_hash_map<Key,int,HashCompare>::const_accessor a;
+		for(std::size_t i=0;i<keys.size();++i)
+			if(m.find(a, keys[i])) ++found;
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
+	state.setCounter("found", found);
+}
+
+#endif/*HASHCONTAINERPERFORMANCETEST_H_*/
@@ -0,0 +1,84 @@
+#ifndef QUEUECONTAINERPERFORMANCETEST_H_
+#define QUEUECONTAINERPERFORMANCETEST_H_
+
+// head-to-head multiple-producer-multiple-consumer hand-off performance of
+// tbb::concurrent_bounded_queue, ConcurrentQueue and AtomicUnboundedQueue
+#include <boost/bind.hpp>
+#include <tbb/tbb_thread.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
+#include <tbb/concurrent_queue.h>
+#include <vector>
+#include "core/ConcurrentQueue.h"
+#include "core/AtomicUnboundedQueue.h"
+
+template<typename Queue>
+struct queue_blocking_pop
+{
+	static void pop(Queue& q, int& result) { q.wait_and_pop(result); }
+};
+
+template<>
+struct queue_blocking_pop< tbb::concurrent_bounded_queue<int> >
+{
+	static void pop(tbb::concurrent_bounded_queue<int>& q, int& result) { q.pop(result); }
+};
+
+template<typename Queue>
+class test_mpmc_queue
+{
+public:
+	test_mpmc_queue(int _iterations) : iterations(_iterations)
+	{ }
+
+public:
+	int iterations;
+	Queue q;
+
+public:
+	void push_worker(int index)
+	{
+		zillians::Benchmark::pinThread(index);
+		int iter = iterations;
+		for(int i=0;i<iter;++i)
+		{
+			q.push(i);
+		}
+	}
+
+	void pop_worker(int index)
+	{
+		zillians::Benchmark::pinThread(index);
+		int iter = iterations;
+		for(int i=0;i<iter;++i)
+		{
+			int result;
+			queue_blocking_pop<Queue>::pop(q, result);
+		}
+	}
+
+	void run(int producers, int consumers)
+	{
+		std::vector<tbb::tbb_thread*> threads;
+		for(int i=0;i<consumers;++i)
+			threads.push_back(new tbb::tbb_thread(boost::bind(&test_mpmc_queue::pop_worker, this, i)));
+		for(int i=0;i<producers;++i)
+			threads.push_back(new tbb::tbb_thread(boost::bind(&test_mpmc_queue::push_worker, this, consumers + i)));
+		for(std::size_t i=0;i<threads.size();++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+	}
+};
+
+template<typename Queue>
+void test_mpmc_queue_push_pop(zillians::BenchmarkState& state, int iterations, int threads)
+{
+	// every producer pushes and every consumer pops the same number of elements
+	test_mpmc_queue<Queue> base(iterations);
+	base.run(threads, threads);
+	state.setItemsProcessed((uint64_t)iterations * threads);
+}
+
+#endif /*QUEUECONTAINERPERFORMANCETEST_H_*/
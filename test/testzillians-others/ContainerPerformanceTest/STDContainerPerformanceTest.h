@@ -4,25 +4,26 @@
 #include <map>
 #include <ext/hash_map>
 #include <ext/hash_set>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
 
 // test std::map insertion and deletion performance (in same order)
-void test_std_map_insert_search_delete_in_same_order(int iterations)
+void test_std_map_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	std::map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -30,37 +31,37 @@ void test_std_map_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test std::map insertion and deletion performance (in reversed order)
-void test_std_map_insert_search_delete_in_reverse_order(int iterations)
+void test_std_map_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	std::map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -68,37 +69,37 @@ void test_std_map_insert_search_delete_in_reverse_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test __gnu_cxx::hash_map insertion and deletion performance (in same order)
-void test_gnucxx_hash_map_insert_search_delete_in_same_order(int iterations)
+void test_gnucxx_hash_map_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	__gnu_cxx::hash_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -106,37 +107,37 @@ void test_gnucxx_hash_map_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test __gnu_cxx::hash_map insertion and deletion performance (in reverse order)
-void test_gnucxx_hash_map_insert_search_delete_in_reverse_order(int iterations)
+void test_gnucxx_hash_map_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	__gnu_cxx::hash_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -144,37 +145,37 @@ void test_gnucxx_hash_map_insert_search_delete_in_reverse_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test __gnu_cxx::hash_set insertion and deletion performance (in same order)
-void test_gnucxx_hash_set_insert_search_delete_in_same_order(int iterations)
+void test_gnucxx_hash_set_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	__gnu_cxx::hash_set<int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.insert(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -182,10 +183,10 @@ void test_gnucxx_hash_set_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -193,27 +194,27 @@ void test_gnucxx_hash_set_insert_search_delete_in_same_order(int iterations)
 			m.erase(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test __gnu_cxx::hash_set insertion and deletion performance (in reverse order)
-void test_gnucxx_hash_set_insert_search_delete_in_reverse_order(int iterations)
+void test_gnucxx_hash_set_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	__gnu_cxx::hash_set<int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.insert(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -221,10 +222,10 @@ void test_gnucxx_hash_set_insert_search_delete_in_reverse_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -232,8 +233,8 @@ void test_gnucxx_hash_set_insert_search_delete_in_reverse_order(int iterations)
 			m.erase(i);
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 #include <boost/bind.hpp>
@@ -265,12 +266,11 @@ public:
 public:
 	int iterations;
 	std::queue<int> q;
-	tbb::tick_count start, end;
 	mutex_type m;
 public:
 	void push_worker()
 	{
-		start = tbb::tick_count::now();
+		zillians::Benchmark::pinThread(0);
 		int iter = iterations;
 		for(int i=0;i<iter;++i)
 		{
@@ -281,6 +281,7 @@ public:
 
 	void pop_worker()
 	{
+		zillians::Benchmark::pinThread(1);
 		int iter = iterations;
 		for(int i=0;i<iter;++i)
 		{
@@ -295,97 +296,100 @@ public:
 				--i;
 			}
 		}
-		end = tbb::tick_count::now();
-		printf("\tpush/pop takes %lf ms\n", (end - start).seconds()*1000.0);
 	}
 };
 
-void test_std_queue_push_pop_with_spin_rw_mutex(int iterations)
+void test_std_queue_push_pop_with_spin_rw_mutex(zillians::BenchmarkState& state, int iterations)
 {
 	test_std_queue<tbb::spin_rw_mutex> base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_std_queue<tbb::spin_rw_mutex>::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_std_queue<tbb::spin_rw_mutex>::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
-void test_std_queue_push_pop_with_spin_mutex(int iterations)
+void test_std_queue_push_pop_with_spin_mutex(zillians::BenchmarkState& state, int iterations)
 {
 	test_std_queue<tbb::recursive_mutex> base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_std_queue<tbb::recursive_mutex>::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_std_queue<tbb::recursive_mutex>::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
-void test_std_queue_push_pop_with_mutex(int iterations)
+void test_std_queue_push_pop_with_mutex(zillians::BenchmarkState& state, int iterations)
 {
 	test_std_queue<tbb::mutex> base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_std_queue<tbb::mutex>::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_std_queue<tbb::mutex>::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
-void test_std_queue_push_pop_with_recursive_mutex(int iterations)
+void test_std_queue_push_pop_with_recursive_mutex(zillians::BenchmarkState& state, int iterations)
 {
 	test_std_queue<tbb::recursive_mutex> base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_std_queue<tbb::recursive_mutex>::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_std_queue<tbb::recursive_mutex>::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
-void test_std_queue_push_pop_with_boost_mutex(int iterations)
+void test_std_queue_push_pop_with_boost_mutex(zillians::BenchmarkState& state, int iterations)
 {
 	test_std_queue<boost::mutex> base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_std_queue<boost::mutex>::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_std_queue<boost::mutex>::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
-void test_std_priority_queue_push_pop(int iterations)
+void test_std_priority_queue_push_pop(zillians::BenchmarkState& state, int iterations)
 {
 	std::priority_queue<int, std::vector<int>, std::greater<int>> q;
 	{
-		tbb::tick_count start = tbb::tick_count::now();
+		uint64_t start = zillians::TimerUtil::now_ns();
 		for(int i=0;i<iterations;++i)
 		{
 			q.push(rand());
 		}
-		tbb::tick_count end = tbb::tick_count::now();
-		printf("\tpush takes %lf ms\n", (end-start).seconds() * 1000.0);
+		uint64_t end = zillians::TimerUtil::now_ns();
+		state.recordPhase("push", end - start);
 	}
 
 	{
-		tbb::tick_count start = tbb::tick_count::now();
+		uint64_t start = zillians::TimerUtil::now_ns();
 		for(int i=0;i<iterations;++i)
 		{
 			q.pop();
 		}
-		tbb::tick_count end = tbb::tick_count::now();
-		printf("\tpop takes %lf ms\n", (end-start).seconds() * 1000.0);
+		uint64_t end = zillians::TimerUtil::now_ns();
+		state.recordPhase("pop", end - start);
 	}
 
 	{
-		tbb::tick_count start = tbb::tick_count::now();
+		uint64_t start = zillians::TimerUtil::now_ns();
 		for(int i=0;i<iterations;++i)
 		{
 			q.push(rand());
 		}
-		tbb::tick_count end = tbb::tick_count::now();
-		printf("\tpush takes %lf ms\n", (end-start).seconds() * 1000.0);
+		uint64_t end = zillians::TimerUtil::now_ns();
+		state.recordPhase("second push", end - start);
 	}
 
 	{
-		tbb::tick_count start = tbb::tick_count::now();
+		uint64_t start = zillians::TimerUtil::now_ns();
 		for(int i=0;i<iterations;++i)
 		{
 			q.pop();
 		}
-		tbb::tick_count end = tbb::tick_count::now();
-		printf("\tpop takes %lf ms\n", (end-start).seconds() * 1000.0);
+		uint64_t end = zillians::TimerUtil::now_ns();
+		state.recordPhase("second pop", end - start);
 	}
 }
 
@@ -2,25 +2,26 @@
 #define STLPORTCONTAINERPERFORMANCE_H_
 
 #include <stlport/hash_map>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
 
 // test stlport::hash_map insertion and deletion performance (in same order)
-void test_stlport_hash_map_insert_search_delete_in_same_order(int iterations)
+void test_stlport_hash_map_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	std::hash_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
@@ -28,36 +29,36 @@ void test_stlport_hash_map_insert_search_delete_in_same_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
-void test_stlport_hash_map_insert_search_delete_in_reverse_order(int iterations)
+void test_stlport_hash_map_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	std::hash_map<int,int> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=0;i<iterations;++i)
 		{
 			m[i] = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
@@ -65,18 +66,18 @@ void test_stlport_hash_map_insert_search_delete_in_reverse_order(int iterations)
 			it;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		for(int i=iterations-1;i>=0;--i)
 		{
 			m.erase(m.find(i));
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 
@@ -2,7 +2,8 @@
 #define TBBCONTAINERPERFORMANCETEST_H_
 
 #include <tbb/concurrent_hash_map.h>
-#include <tbb/tick_count.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
 
 struct MyHashCompare {
     static size_t hash( const int& x ) {
@@ -17,12 +18,12 @@ struct MyHashCompare {
 
 
 // test tbb::concurrent_hash_map insertion and deleltion performance (in same order)
-void test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(int iterations)
+void test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(zillians::BenchmarkState& state, int iterations)
 {
 	tbb::concurrent_hash_map<int,int,MyHashCompare> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
 		for(int i=0;i<iterations;++i)
@@ -31,10 +32,10 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(int iterati
 			a->second = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		//tbb::concurrent_hash_map<int,int,MyHashCompare>::const_accessor a;
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
@@ -44,10 +45,10 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(int iterati
 			a;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
 		for(int i=0;i<iterations;++i)
@@ -56,17 +57,17 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_same_order(int iterati
 			if(m.find(a, i)) m.erase(a); // SLOWER
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test tbb::concurrent_hash_map insertion and deleltion performance (in reversed order)
-void test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(int iterations)
+void test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(zillians::BenchmarkState& state, int iterations)
 {
 	tbb::concurrent_hash_map<int,int,MyHashCompare> m;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
 		for(int i=0;i<iterations;++i)
@@ -75,10 +76,10 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(int iter
 			a->second = i;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tinsertion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		//tbb::concurrent_hash_map<int,int,MyHashCompare>::const_accessor a;
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
@@ -88,10 +89,10 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(int iter
 			a;
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tsearch takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
 	
-	start = tbb::tick_count::now();
+	start = zillians::TimerUtil::now_ns();
 	{
 		tbb::concurrent_hash_map<int,int,MyHashCompare>::accessor a;
 		for(int i=iterations-1;i>=0;--i)
@@ -100,8 +101,8 @@ void test_tbb_concurrent_hash_map_insert_search_delete_in_reverse_order(int iter
 			if(m.find(a, i)) m.erase(a); // SLOWER
 		}
 	}
-	end = tbb::tick_count::now();
-	printf("\tdeletion takes %lf ms\n", (end - start).seconds()*1000.0);
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
 }
 
 // test tbb::concurrent_queue concurrent push/pop performance
@@ -128,11 +129,10 @@ public:
 public:
 	int iterations;
 	tbb::concurrent_bounded_queue<int> q;
-	tbb::tick_count start, end;
 public:
 	void push_worker()
 	{
-		start = tbb::tick_count::now();
+		zillians::Benchmark::pinThread(0);
 		int iter = iterations;
 		for(int i=0;i<iter;++i)
 		{
@@ -142,24 +142,24 @@ public:
 	
 	void pop_worker()
 	{
+		zillians::Benchmark::pinThread(1);
 		int iter = iterations;
 		for(int i=0;i<iter;++i)
 		{
 			int result;
 			q.pop(result);
 		}
-		end = tbb::tick_count::now();
-		printf("\tpush/pop takes %lf ms\n", (end - start).seconds()*1000.0);		
 	}
 };
 
-void test_concurrent_queue_push_pop(int iterations)
+void test_concurrent_queue_push_pop(zillians::BenchmarkState& state, int iterations)
 {
 	test_concurrent_queue base(iterations);
 	tbb::tbb_thread push_worker(boost::bind(&test_concurrent_queue::push_worker, &base));
 	tbb::tbb_thread pop_worker(boost::bind(&test_concurrent_queue::pop_worker, &base));
 	push_worker.join();
 	pop_worker.join();
+	state.setItemsProcessed(iterations);
 }
 
 
@@ -184,11 +184,11 @@ public:
 public:
 	int iterations;
 	ConcurrentQueue<int> q;
-	tbb::tick_count start, end;
+	uint64_t start, end;
 public:
 	void push_worker()
 	{
-		start = tbb::tick_count::now();
+		start = zillians::TimerUtil::now_ns();
 		int iter = iterations;
 		for(int i=0;i<iter;++i)
 		{
@@ -204,8 +204,8 @@ public:
 			int result;
 			q.wait_and_pop(result);
 		}
-		end = tbb::tick_count::now();
-		printf("\tpush/pop takes %lf ms\n", (end - start).seconds()*1000.0);		
+		end = zillians::TimerUtil::now_ns();
+		printf("\tpush/pop takes %lf ms\n", (end - start) / 1000000.0);		
 	}
 };
 
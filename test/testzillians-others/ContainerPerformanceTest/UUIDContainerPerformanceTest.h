@@ -0,0 +1,252 @@
+#ifndef UUIDCONTAINERPERFORMANCETEST_H_
+#define UUIDCONTAINERPERFORMANCETEST_H_
+
+#include <map>
+#include <vector>
+#include <ext/hash_map>
+#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <tbb/concurrent_hash_map.h>
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
+#include "utility/UUIDUtil.h"
+#include "core/UUIDMap.h"
+
+using zillians::UUID;
+using zillians::UUIDHasher;
+using zillians::UUIDMap;
+using zillians::ConcurrentUUIDMap;
+
+std::vector<UUID> make_uuid_keys(int iterations)
+{
+	std::vector<UUID> keys;
+	keys.reserve(iterations);
+	for(int i=0;i<iterations;++i)
+	{
+		UUID id;
+		UUID::random(id);
+		keys.push_back(id);
+	}
+	return keys;
+}
+
+// test insertion, search and deletion performance of a std-like map with UUID keys (in same order)
+template<typename Map>
+void test_uuid_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	std::vector<UUID> keys = make_uuid_keys(iterations);
+	std::vector<UUID> misses = make_uuid_keys(iterations);
+	Map m;
+	uint64_t start, end;
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			m.insert(std::make_pair(keys[i], i));
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
+
+	int found = 0;
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			if(m.find(keys[i]) != m.end()) ++found;
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			if(m.find(misses[i]) != m.end()) --found;
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("failed search", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			m.erase(keys[i]);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
+
+	if(found != iterations || !m.empty())
+		printf("\tERROR: %d of %d keys found, %d left\n", found, iterations, (int)m.size());
+	state.setItemsProcessed(iterations);
+}
+
+void test_uuid_std_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	test_uuid_map_insert_search_delete< std::map<UUID,int> >(state, iterations);
+}
+
+void test_uuid_gnucxx_hash_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	test_uuid_map_insert_search_delete< __gnu_cxx::hash_map<UUID,int> >(state, iterations);
+}
+
+void test_uuid_boost_unordered_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	test_uuid_map_insert_search_delete< boost::unordered_map<UUID,int> >(state, iterations);
+}
+
+void test_uuid_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	test_uuid_map_insert_search_delete< UUIDMap<int> >(state, iterations);
+}
+
+// test tbb::concurrent_hash_map with UUID keys from a single thread
+void test_uuid_tbb_concurrent_hash_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	typedef tbb::concurrent_hash_map<UUID,int,UUIDHasher> MapType;
+
+	std::vector<UUID> keys = make_uuid_keys(iterations);
+	MapType m;
+	uint64_t start, end;
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		MapType::accessor a;
+		for(int i=0;i<iterations;++i)
+		{
+			m.insert(a, keys[i]);
+			a->second = i;
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		MapType::const_accessor a;
+		for(int i=0;i<iterations;++i)
+		{
+			m.find(a, keys[i]);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			m.erase(keys[i]);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
+}
+
+// test ConcurrentUUIDMap from a single thread, to see the cost of the shard locks
+void test_uuid_concurrent_map_insert_search_delete(zillians::BenchmarkState& state, int iterations)
+{
+	std::vector<UUID> keys = make_uuid_keys(iterations);
+	ConcurrentUUIDMap<int> m;
+	uint64_t start, end;
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			m.insert(keys[i], i);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("insertion", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		int value;
+		for(int i=0;i<iterations;++i)
+		{
+			m.find(keys[i], value);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("search", end - start);
+
+	start = zillians::TimerUtil::now_ns();
+	{
+		for(int i=0;i<iterations;++i)
+		{
+			m.erase(keys[i]);
+		}
+	}
+	end = zillians::TimerUtil::now_ns();
+	state.recordPhase("deletion", end - start);
+}
+
+inline bool uuid_concurrent_find(tbb::concurrent_hash_map<UUID,int,UUIDHasher>& m, const UUID& key)
+{
+	tbb::concurrent_hash_map<UUID,int,UUIDHasher>::const_accessor a;
+	return m.find(a, key);
+}
+
+inline bool uuid_concurrent_find(ConcurrentUUIDMap<int>& m, const UUID& key)
+{
+	int value;
+	return m.find(key, value);
+}
+
+inline void uuid_concurrent_insert(tbb::concurrent_hash_map<UUID,int,UUIDHasher>& m, const UUID& key, int value)
+{
+	m.insert(std::make_pair(key, value));
+}
+
+inline void uuid_concurrent_insert(ConcurrentUUIDMap<int>& m, const UUID& key, int value)
+{
+	m.insert(key, value);
+}
+
+template<typename Map>
+void uuid_concurrent_lookup_worker(Map* m, const std::vector<UUID>* keys, int rounds, int index)
+{
+	zillians::Benchmark::pinThread(index);
+	for(int r=0;r<rounds;++r)
+	{
+		for(std::size_t i=0;i<keys->size();++i)
+		{
+			uuid_concurrent_find(*m, (*keys)[i]);
+		}
+	}
+}
+
+// test lookups from several threads at once on a shared map
+template<typename Map>
+void test_uuid_concurrent_lookup(zillians::BenchmarkState& state, int iterations, int threads)
+{
+	std::vector<UUID> keys = make_uuid_keys(iterations);
+	Map m;
+	for(int i=0;i<iterations;++i)
+	{
+		uuid_concurrent_insert(m, keys[i], i);
+	}
+
+	const int rounds = 10;
+
+	state.start();
+	{
+		boost::thread_group group;
+		for(int i=0;i<threads;++i)
+		{
+			group.create_thread(boost::bind(uuid_concurrent_lookup_worker<Map>, &m, &keys, rounds, i));
+		}
+		group.join_all();
+	}
+	state.stop();
+	state.setItemsProcessed((uint64_t)iterations * rounds * threads);
+}
+
+#endif /* UUIDCONTAINERPERFORMANCETEST_H_ */
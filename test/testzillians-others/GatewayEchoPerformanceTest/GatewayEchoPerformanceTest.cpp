@@ -0,0 +1,677 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// end-to-end echo through a gateway: clients send length-prefixed frames over
+// loopback TCP, gateway workers cut them out of the socket Buffer and fan them
+// out through the Dispatcher to logic threads, which hand the replies back to
+// the gateway worker owning the session
+//
+// the load generator is open loop: every frame has an intended send time on a
+// fixed schedule and carries it in its payload, latency is measured from that
+// time rather than from the actual send, so a stalled gateway is charged for
+// all the frames the clients could not send meanwhile (coordinated omission)
+
+#include "core/Prerequisite.h"
+#include "core/Buffer.h"
+#include "core/Worker.h"
+#include "threading/Dispatcher.h"
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+using namespace zillians;
+using namespace zillians::threading;
+using boost::asio::ip::tcp;
+
+#define DEFAULT_CONNECTIONS		1000
+#define DEFAULT_RATE			20000
+#define DEFAULT_SECONDS			2
+#define DEFAULT_PAYLOAD_SIZE	64
+
+#define DEFAULT_GATEWAY_THREADS	1
+#define DEFAULT_LOGIC_THREADS	1
+#define DEFAULT_CLIENT_THREADS	1
+
+// frames on the wire are a uint32 payload size followed by the payload, the
+// first 8 bytes of the payload are the intended send time of the frame
+#define FRAME_HEADER_SIZE		sizeof(uint32)
+#define MIN_PAYLOAD_SIZE		sizeof(uint64)
+#define RECEIVE_CHUNK_SIZE		(16 * 1024)
+#define DRAIN_TIMEOUT_NS		(2ULL * 1000 * 1000 * 1000)
+
+class GatewaySession;
+
+struct EchoRequest
+{
+	EchoRequest() : session(NULL), frame(NULL)
+	{ }
+
+	EchoRequest(GatewaySession* s, Buffer* f) : session(s), frame(f)
+	{ }
+
+	GatewaySession* session;	///< NULL asks the logic thread to quit
+	Buffer* frame;				///< One whole frame including its header, owned by the request
+};
+
+typedef Dispatcher<EchoRequest> EchoDispatcher;
+typedef DispatcherThreadContext<EchoRequest> EchoContext;
+typedef DispatcherDestination<EchoRequest> EchoDestination;
+
+/**
+ * A gateway thread is a Worker running the sockets of its sessions, with its
+ * own dispatcher context to write to the logic threads.
+ */
+struct GatewayThread : public boost::noncopyable
+{
+	Worker worker;
+	shared_ptr<EchoContext> context;
+	std::vector< shared_ptr<EchoDestination> > logic;
+};
+
+class GatewaySession : public boost::noncopyable
+{
+public:
+	GatewaySession(GatewayThread& thread, uint32 id) :
+		mThread(thread), mId(id), mSocket(thread.worker.getIoService()), mWriting(false),
+		mSending(new Buffer()), mPending(new Buffer())
+	{ }
+
+	~GatewaySession()
+	{
+		delete mSending;
+		delete mPending;
+	}
+
+public:
+	tcp::socket& socket()
+	{
+		return mSocket;
+	}
+
+	GatewayThread& thread()
+	{
+		return mThread;
+	}
+
+	void start()
+	{
+		mSocket.set_option(tcp::no_delay(true));
+		receive();
+	}
+
+	/**
+	 * Queue a reply, called on the worker of the session.
+	 */
+	void send(Buffer* frame)
+	{
+		mPending->writeArray((const char*)frame->rptr(), frame->dataSize());
+		delete frame;
+
+		if(!mWriting)
+			flush();
+	}
+
+private:
+	void receive()
+	{
+		mReceived.reserve(RECEIVE_CHUNK_SIZE);
+		mSocket.async_read_some(
+				boost::asio::buffer(mReceived.wptr(), mReceived.freeSize()),
+				boost::bind(&GatewaySession::handleReceive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	}
+
+	void handleReceive(const boost::system::error_code& error, std::size_t bytes_transferred)
+	{
+		if(error)
+		{
+			close();
+			return;
+		}
+
+		mReceived.wskip(bytes_transferred);
+
+		EchoDestination& logic = *mThread.logic[mId % mThread.logic.size()];
+		while(mReceived.dataSize() >= FRAME_HEADER_SIZE)
+		{
+			uint32 size;
+			memcpy(&size, mReceived.rptr(), sizeof(size));
+			if(mReceived.dataSize() < FRAME_HEADER_SIZE + size)
+				break;
+
+			Buffer* frame = new Buffer(FRAME_HEADER_SIZE + size);
+			frame->writeArray((const char*)mReceived.rptr(), FRAME_HEADER_SIZE + size);
+			mReceived.rskip(FRAME_HEADER_SIZE + size);
+			logic.write(EchoRequest(this, frame));
+		}
+
+		if(mReceived.dataSize() == 0)
+			mReceived.clear();
+		else
+			mReceived.crunch();
+
+		receive();
+	}
+
+	void flush()
+	{
+		std::swap(mSending, mPending);
+		mWriting = true;
+		boost::asio::async_write(mSocket,
+				boost::asio::buffer(mSending->rptr(), mSending->dataSize()),
+				boost::bind(&GatewaySession::handleSend, this, boost::asio::placeholders::error));
+	}
+
+	void handleSend(const boost::system::error_code& error)
+	{
+		mSending->clear();
+		mWriting = false;
+
+		if(error)
+		{
+			close();
+			return;
+		}
+
+		if(mPending->dataSize() > 0)
+			flush();
+	}
+
+	void close()
+	{
+		boost::system::error_code ignored;
+		mSocket.close(ignored);
+	}
+
+private:
+	GatewayThread& mThread;
+	uint32 mId;
+	tcp::socket mSocket;
+
+	Buffer mReceived;
+	bool mWriting;
+	Buffer* mSending;	///< Replies being written
+	Buffer* mPending;	///< Replies queued while a write is in progress
+};
+
+/**
+ * The echo gateway, G gateway workers accepting and framing, L logic threads
+ * answering, all connected by one Dispatcher.
+ */
+class EchoGateway : public boost::noncopyable
+{
+public:
+	EchoGateway(std::size_t gatewayThreads, std::size_t logicThreads) :
+		mDispatcher(gatewayThreads + logicThreads + 1),
+		mAccepted(0)
+	{
+		mControl = mDispatcher.createThreadContext();
+
+		for(std::size_t i = 0; i < logicThreads; ++i)
+		{
+			shared_ptr<EchoContext> context = mDispatcher.createThreadContext();
+			mLogicContexts.push_back(context);
+			mLogicThreads.push_back(new boost::thread(boost::bind(&EchoGateway::runLogic, context, gatewayThreads + i)));
+		}
+
+		for(std::size_t i = 0; i < gatewayThreads; ++i)
+		{
+			GatewayThread* thread = new GatewayThread();
+			thread->context = mDispatcher.createThreadContext();
+			for(std::size_t j = 0; j < logicThreads; ++j)
+				thread->logic.push_back(thread->context->createDestination(mLogicContexts[j]->getIdentity()));
+			thread->worker.dispatch(boost::bind(&EchoGateway::pinGateway, i), true);
+			mGatewayThreads.push_back(thread);
+		}
+
+		mAcceptor = new tcp::acceptor(mGatewayThreads[0]->worker.getIoService(), tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		mAcceptor->listen(SOMAXCONN);
+		mGatewayThreads[0]->worker.post(boost::bind(&EchoGateway::accept, this));
+	}
+
+	~EchoGateway()
+	{
+		mGatewayThreads[0]->worker.dispatch(boost::bind(&EchoGateway::closeAcceptor, this), true);
+
+		for(std::size_t i = 0; i < mLogicContexts.size(); ++i)
+			mControl->createDestination(mLogicContexts[i]->getIdentity())->write(EchoRequest());
+		for(std::size_t i = 0; i < mLogicThreads.size(); ++i)
+		{
+			mLogicThreads[i]->join();
+			delete mLogicThreads[i];
+		}
+
+		for(std::size_t i = 0; i < mGatewayThreads.size(); ++i)
+			mGatewayThreads[i]->worker.stop();
+		for(std::size_t i = 0; i < mSessions.size(); ++i)
+			delete mSessions[i];
+		delete mAcceptor;
+		for(std::size_t i = 0; i < mGatewayThreads.size(); ++i)
+			delete mGatewayThreads[i];
+	}
+
+public:
+	uint16 port() const
+	{
+		return mAcceptor->local_endpoint().port();
+	}
+
+private:
+	void accept()
+	{
+		GatewayThread& thread = *mGatewayThreads[mAccepted % mGatewayThreads.size()];
+		GatewaySession* session = new GatewaySession(thread, mAccepted++);
+		mSessions.push_back(session);
+		mAcceptor->async_accept(session->socket(), boost::bind(&EchoGateway::handleAccept, this, session, boost::asio::placeholders::error));
+	}
+
+	void handleAccept(GatewaySession* session, const boost::system::error_code& error)
+	{
+		if(error)
+			return;
+
+		session->thread().worker.post(boost::bind(&GatewaySession::start, session));
+		accept();
+	}
+
+	void closeAcceptor()
+	{
+		boost::system::error_code ignored;
+		mAcceptor->close(ignored);
+	}
+
+	static void pinGateway(std::size_t index)
+	{
+		Benchmark::pinThread(index);
+	}
+
+	static void runLogic(shared_ptr<EchoContext> context, std::size_t index)
+	{
+		Benchmark::pinThread(index);
+
+		uint32 source;
+		EchoRequest request;
+		while(true)
+		{
+			if(!context->read(source, request, true))
+				continue;
+			if(!request.session)
+				break;
+
+			// stand-in for the request handler, which has to look at the whole payload
+			uint32 checksum = 0;
+			const byte* payload = request.frame->rptr() + FRAME_HEADER_SIZE;
+			for(std::size_t i = MIN_PAYLOAD_SIZE; i + FRAME_HEADER_SIZE < request.frame->dataSize(); ++i)
+				checksum = checksum * 31 + (uint8)payload[i];
+			UNUSED_ARGUMENT(checksum);
+
+			request.session->thread().worker.post(boost::bind(&GatewaySession::send, request.session, request.frame));
+		}
+	}
+
+private:
+	EchoDispatcher mDispatcher;
+	shared_ptr<EchoContext> mControl;
+	std::vector< shared_ptr<EchoContext> > mLogicContexts;
+	std::vector<boost::thread*> mLogicThreads;
+	std::vector<GatewayThread*> mGatewayThreads;
+
+	tcp::acceptor* mAcceptor;
+	std::vector<GatewaySession*> mSessions;	///< Only touched by the first gateway worker until shut down
+	uint32 mAccepted;
+};
+
+struct ClientConnection
+{
+	int fd;
+	bool waitingForWrite;
+	Buffer outgoing;	///< Frames the socket did not take yet
+	Buffer incoming;
+};
+
+/**
+ * The load generator of one client thread, it owns a share of the connections
+ * and sends to them in round robin at a fixed rate.
+ */
+class LoadGenerator : public boost::noncopyable
+{
+public:
+	LoadGenerator(uint16 port, std::size_t connections) : mConnections(connections)
+	{
+		mEpoll = epoll_create1(0);
+		if(mEpoll < 0)
+			throw std::runtime_error("epoll_create1() failed");
+
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		for(std::size_t i = 0; i < mConnections.size(); ++i)
+		{
+			ClientConnection& c = mConnections[i];
+			c.waitingForWrite = false;
+			c.fd = socket(AF_INET, SOCK_STREAM, 0);
+			if(c.fd < 0 || connect(c.fd, (sockaddr*)&address, sizeof(address)) != 0)
+				throw std::runtime_error(std::string("failed to connect to the gateway: ") + strerror(errno));
+
+			int one = 1;
+			setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+
+			epoll_event event;
+			event.events = EPOLLIN;
+			event.data.ptr = &c;
+			epoll_ctl(mEpoll, EPOLL_CTL_ADD, c.fd, &event);
+		}
+	}
+
+	~LoadGenerator()
+	{
+		for(std::size_t i = 0; i < mConnections.size(); ++i)
+			::close(mConnections[i].fd);
+		::close(mEpoll);
+	}
+
+public:
+	/**
+	 * Send at the given rate for the given time, then wait for the outstanding
+	 * replies for at most DRAIN_TIMEOUT_NS.
+	 */
+	void run(double rate, uint64 duration, std::size_t payloadSize)
+	{
+		mLatency.reset();
+		mSent = mReceived = 0;
+
+		std::vector<byte> frame(FRAME_HEADER_SIZE + payloadSize, 0);
+		uint32 size = payloadSize;
+		memcpy(&frame[0], &size, sizeof(size));
+
+		const uint64 start = TimerUtil::now_ns();
+		const uint64 end = start + duration;
+		uint64 next = start;
+
+		while(next < end)
+		{
+			uint64 now = TimerUtil::now_ns();
+
+			// catch up on the schedule, even if the gateway kept us from sending for a while
+			while(next <= now && next < end)
+			{
+				memcpy(&frame[FRAME_HEADER_SIZE], &next, sizeof(next));
+				send(mConnections[mSent % mConnections.size()], &frame[0], frame.size());
+				++mSent;
+				next = start + (uint64)((double)mSent * 1e9 / rate);
+			}
+
+			now = TimerUtil::now_ns();
+			poll((next > now + 1000000) ? (next - now) / 1000000 : 0);
+		}
+
+		const uint64 deadline = TimerUtil::now_ns() + DRAIN_TIMEOUT_NS;
+		while(mReceived < mSent && TimerUtil::now_ns() < deadline)
+			poll(10);
+	}
+
+	const TimerHistogram& latency() const
+	{
+		return mLatency;
+	}
+
+	uint64 sent() const
+	{
+		return mSent;
+	}
+
+	uint64 received() const
+	{
+		return mReceived;
+	}
+
+private:
+	void send(ClientConnection& c, const byte* data, std::size_t size)
+	{
+		if(c.outgoing.dataSize() == 0)
+		{
+			ssize_t written = ::write(c.fd, data, size);
+			if(written == (ssize_t)size)
+				return;
+			if(written < 0)
+				written = 0;
+			data += written;
+			size -= written;
+		}
+
+		c.outgoing.writeArray((const char*)data, size);
+		watchWrite(c, true);
+	}
+
+	void flush(ClientConnection& c)
+	{
+		ssize_t written = ::write(c.fd, c.outgoing.rptr(), c.outgoing.dataSize());
+		if(written > 0)
+			c.outgoing.rskip(written);
+
+		if(c.outgoing.dataSize() == 0)
+		{
+			c.outgoing.clear();
+			watchWrite(c, false);
+		}
+	}
+
+	void watchWrite(ClientConnection& c, bool enable)
+	{
+		if(c.waitingForWrite == enable)
+			return;
+
+		epoll_event event;
+		event.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		event.data.ptr = &c;
+		epoll_ctl(mEpoll, EPOLL_CTL_MOD, c.fd, &event);
+		c.waitingForWrite = enable;
+	}
+
+	void receive(ClientConnection& c)
+	{
+		while(true)
+		{
+			c.incoming.reserve(RECEIVE_CHUNK_SIZE);
+			ssize_t n = ::read(c.fd, c.incoming.wptr(), c.incoming.freeSize());
+			if(n <= 0)
+				break;
+			c.incoming.wskip(n);
+
+			const uint64 now = TimerUtil::now_ns();
+			while(c.incoming.dataSize() >= FRAME_HEADER_SIZE)
+			{
+				uint32 size;
+				memcpy(&size, c.incoming.rptr(), sizeof(size));
+				if(c.incoming.dataSize() < FRAME_HEADER_SIZE + size)
+					break;
+
+				uint64 intended;
+				memcpy(&intended, c.incoming.rptr() + FRAME_HEADER_SIZE, sizeof(intended));
+				mLatency.record((now > intended) ? now - intended : 0);
+				++mReceived;
+
+				c.incoming.rskip(FRAME_HEADER_SIZE + size);
+			}
+
+			if(c.incoming.dataSize() == 0)
+				c.incoming.clear();
+			else
+				c.incoming.crunch();
+		}
+	}
+
+	void poll(int timeout)
+	{
+		epoll_event events[64];
+		int n = epoll_wait(mEpoll, events, 64, timeout);
+		for(int i = 0; i < n; ++i)
+		{
+			ClientConnection& c = *static_cast<ClientConnection*>(events[i].data.ptr);
+			if(events[i].events & EPOLLOUT)
+				flush(c);
+			if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				receive(c);
+		}
+	}
+
+private:
+	std::vector<ClientConnection> mConnections;
+	int mEpoll;
+
+	TimerHistogram mLatency;
+	uint64 mSent;
+	uint64 mReceived;
+};
+
+static void runClient(LoadGenerator* generator, std::size_t index, double rate, uint64 duration, std::size_t payloadSize)
+{
+	Benchmark::pinThread(index);
+	generator->run(rate, duration, payloadSize);
+}
+
+static void runEchoBenchmark(BenchmarkState& state, std::vector<LoadGenerator*>& generators, std::size_t firstCpu, double rate, uint64 duration, std::size_t payloadSize)
+{
+	std::vector<boost::thread*> clients;
+
+	state.start();
+	const uint64 start = TimerUtil::now_ns();
+	for(std::size_t i = 0; i < generators.size(); ++i)
+		clients.push_back(new boost::thread(boost::bind(&runClient, generators[i], firstCpu + i, rate / generators.size(), duration, payloadSize)));
+	for(std::size_t i = 0; i < clients.size(); ++i)
+	{
+		clients[i]->join();
+		delete clients[i];
+	}
+	const uint64 elapsed = TimerUtil::now_ns() - start;
+	state.stop();
+
+	TimerHistogram latency;
+	uint64 sent = 0;
+	uint64 received = 0;
+	for(std::size_t i = 0; i < generators.size(); ++i)
+	{
+		latency.merge(generators[i]->latency());
+		sent += generators[i]->sent();
+		received += generators[i]->received();
+	}
+
+	// replies still drained after the schedule ended count against the achieved rate
+	state.setItemsProcessed(received);
+	state.setBytesProcessed(received * (FRAME_HEADER_SIZE + payloadSize) * 2);
+	state.setCounter("offered msgs/s", (double)sent * 1e9 / (double)duration);
+	state.setCounter("achieved msgs/s", (double)received * 1e9 / (double)elapsed);
+	state.setCounter("p50 us", (double)latency.percentile(50.0) / 1000.0);
+	state.setCounter("p99 us", (double)latency.percentile(99.0) / 1000.0);
+	state.setCounter("p99.9 us", (double)latency.percentile(99.9) / 1000.0);
+	state.setCounter("max us", (double)latency.max() / 1000.0);
+	state.setCounter("unanswered", (double)(sent - received));
+}
+
+static void raiseFileLimit(std::size_t descriptors)
+{
+	rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= descriptors)
+		return;
+
+	limit.rlim_cur = std::min<rlim_t>(descriptors, limit.rlim_max);
+	if(setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < descriptors)
+		fprintf(stderr, "warning: can only open %lu files, %lu connections need %lu\n", (unsigned long)limit.rlim_cur, (unsigned long)(descriptors / 2), (unsigned long)descriptors);
+}
+
+int main(int argc, char** argv)
+{
+	if(!Benchmark::options().parse(argc, argv))
+		return 1;
+
+	std::size_t gatewayThreads = DEFAULT_GATEWAY_THREADS;
+	std::size_t logicThreads = DEFAULT_LOGIC_THREADS;
+	std::size_t clientThreads = DEFAULT_CLIENT_THREADS;
+
+	int ch;
+	while((ch = getopt(argc, argv, "g:l:c:")) != -1)
+	{
+		switch(ch)
+		{
+		case 'g': gatewayThreads = std::max(1, atoi(optarg)); break;
+		case 'l': logicThreads = std::max(1, atoi(optarg)); break;
+		case 'c': clientThreads = std::max(1, atoi(optarg)); break;
+		default: optind = argc + 1; break;
+		}
+	}
+
+	if(optind > argc || argc - optind > 4)
+	{
+		printf("Usage: GatewayEchoPerformanceTest [-g gateway threads (default %d)] [-l logic threads (default %d)] [-c client threads (default %d)] "
+				"[connections (default %d)] [offered msgs/sec (default %d)] [seconds per run (default %d)] [payload bytes (default %d)] [benchmark options]\n",
+				DEFAULT_GATEWAY_THREADS, DEFAULT_LOGIC_THREADS, DEFAULT_CLIENT_THREADS, DEFAULT_CONNECTIONS, DEFAULT_RATE, DEFAULT_SECONDS, DEFAULT_PAYLOAD_SIZE);
+		return 1;
+	}
+
+	char** args = argv + optind;
+	const int count = argc - optind;
+	const std::size_t connections = (count > 0) ? std::max(1, atoi(args[0])) : DEFAULT_CONNECTIONS;
+	const double rate = (count > 1) ? std::max(1.0, atof(args[1])) : DEFAULT_RATE;
+	const double seconds = (count > 2) ? std::max(0.1, atof(args[2])) : DEFAULT_SECONDS;
+	const std::size_t payloadSize = (count > 3) ? std::max<int>(MIN_PAYLOAD_SIZE, atoi(args[3])) : DEFAULT_PAYLOAD_SIZE;
+
+	clientThreads = std::min(clientThreads, connections);
+
+	// both ends of every connection live in this process
+	raiseFileLimit(connections * 2 + 64);
+
+	EchoGateway gateway(gatewayThreads, logicThreads);
+
+	std::vector<LoadGenerator*> generators;
+	for(std::size_t i = 0; i < clientThreads; ++i)
+		generators.push_back(new LoadGenerator(gateway.port(), connections / clientThreads + ((i < connections % clientThreads) ? 1 : 0)));
+
+	std::string name = "gateway_echo/" +
+			boost::lexical_cast<std::string>(connections) + "_connections/" +
+			boost::lexical_cast<std::string>((uint64)rate) + "_msgs_per_sec/" +
+			boost::lexical_cast<std::string>(payloadSize) + "_bytes/" +
+			boost::lexical_cast<std::string>(gatewayThreads) + "g" + boost::lexical_cast<std::string>(logicThreads) + "l" + boost::lexical_cast<std::string>(clientThreads) + "c";
+	Benchmark::run(name, boost::bind(&runEchoBenchmark, _1, boost::ref(generators), gatewayThreads + logicThreads, rate, (uint64)(seconds * 1e9), payloadSize));
+
+	for(std::size_t i = 0; i < generators.size(); ++i)
+		delete generators[i];
+
+	return 0;
+}
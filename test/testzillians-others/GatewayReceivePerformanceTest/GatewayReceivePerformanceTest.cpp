@@ -30,6 +30,9 @@
 #include <boost/bind.hpp>
 #include <boost/thread/thread_time.hpp>
 #include <tbb/atomic.h>
+#include "core/Buffer.h"
+#include "Benchmark.h"
+#include <boost/lexical_cast.hpp>
 #include <iostream>
 #include <vector>
 
@@ -52,6 +55,10 @@ typedef char BYTE;
 	tbb::atomic<int> mWritePosList[20];
 	BYTE* mCurrentBufferList[20];
 
+	zillians::MpscCircularBuffer* mMpscBuffer;
+	zillians::CircularBuffer* mLockedBuffer;
+	boost::mutex mLockedBufferMutex;
+
 
 	// simulate copying messages to a buffer that shared by all threads
 	void runThreadSharedBuffer(int singleMsgSize, int delayTime, int threadid)
@@ -86,6 +93,82 @@ typedef char BYTE;
 		}
 	}
 
+	// simulate copying messages to a circular buffer shared by all threads with lock-free reserve/commit
+	void runThreadSharedMpscBuffer(int singleMsgSize, int delayTime)
+	{
+		BYTE* message = (BYTE*)malloc(singleMsgSize);
+		memset(message, 1, singleMsgSize);
+		while(true)
+		{
+			// the free size may be taken by other producers in between, so we still have to catch the failure
+			try
+			{
+				if(mMpscBuffer->freeSize() >= (std::size_t)singleMsgSize)
+					mMpscBuffer->writeArray(message, singleMsgSize);
+				else
+					boost::this_thread::yield();
+			}
+			catch(std::length_error&)
+			{
+				boost::this_thread::yield();
+			}
+
+			if(mTerminateThreadFlag) break;
+			if(delayTime > 0)usleep(delayTime);
+		}
+		free(message);
+	}
+
+	// simulate copying messages to a circular buffer shared by all threads and protected by a mutex
+	void runThreadSharedLockedBuffer(int singleMsgSize, int delayTime)
+	{
+		BYTE* message = (BYTE*)malloc(singleMsgSize);
+		memset(message, 1, singleMsgSize);
+		while(true)
+		{
+			{
+				boost::mutex::scoped_lock lock(mLockedBufferMutex);
+				if(mLockedBuffer->freeSize() >= (std::size_t)singleMsgSize)
+					mLockedBuffer->writeArray(message, singleMsgSize);
+			}
+
+			if(mTerminateThreadFlag) break;
+			if(delayTime > 0)usleep(delayTime);
+		}
+		free(message);
+	}
+
+	// simulate the sender thread which drains the shared circular buffer
+	template<typename BufferType, bool Locked>
+	void runThreadSharedBufferSender(BufferType* buffer)
+	{
+		while(!mTerminateThreadFlag)
+		{
+			std::size_t size;
+			if(Locked)
+			{
+				boost::mutex::scoped_lock lock(mLockedBufferMutex);
+				size = buffer->dataSize();
+				buffer->rskip(size);
+			}
+			else
+			{
+				size = buffer->dataSize();
+				buffer->rskip(size);
+			}
+
+			if(size > 0)
+			{
+				mThroughPut += size;
+				mSendCount++;
+			}
+			else
+			{
+				boost::this_thread::yield();
+			}
+		}
+	}
+
 	// simulate copying messages to a local buffer
 	void runThreadMultiBuffer(int singleMsgSize, int delayTime)
 	{
@@ -156,36 +239,14 @@ typedef char BYTE;
 		}
 	}
 
-	// print performance result every second
-	void timer(int totalTime, long long maxFlow)
+	// stop all threads after the given time, the throughput is reported by the benchmark harness
+	void timer(int totalTime)
 	{
-		int currentTime = 0;
-		cout<<"Thread: "<<mThreadNum<<endl;
-		cout<<"Buffer: "<<mBufferNum<<"*"<<mBufferSize<<endl;
-		cout<<"Time\tThroughPut\tCost"<<endl;
-		cout<<"----------------------------"<<endl;
-		while(currentTime < totalTime)
-		{
-			sleep(1);
-			{
-				currentTime++;
-				// print mThroughPut (mb/s)
-				cout<< currentTime <<"\t"<<mThroughPut / 1000000.0<<"\t\t"<<mSendCount<<endl;
-			}
-		}
+		sleep(totalTime);
 		mTerminateThreadFlag = true;
-		// print mThroughPut (mb/s)
-		cout<<"-----{avg  performance}-----"<<endl;
-		cout<<"1\t"<<mThroughPut / (totalTime * 1000000.0) << "\t" << mSendCount/totalTime<<endl;
-
-		if(maxFlow != 0)
-		{
-			cout << "MaxFlow:" << maxFlow << endl;
-			cout << "Ratio  :" << (double)mThroughPut / (maxFlow * 1000000.0) << endl;
-		}
 	}
 
-	void run(int totalTime, int bufferOption, int singleMsgSize, int delayTime, double balanceRatio)
+	void run(zillians::BenchmarkState& state, int totalTime, int bufferOption, int singleMsgSize, int delayTime, double balanceRatio)
 	{
 		boost::thread_group threadGroup;
 		mThroughPut = 0;
@@ -195,6 +256,7 @@ typedef char BYTE;
 		time(&mStartTime);
 		double maxFlow = 0;
 
+		state.start();
 		switch(bufferOption)
 		{
 		case 0:
@@ -239,6 +301,26 @@ typedef char BYTE;
 //			mCurrentBuffer = (BYTE*)malloc(mBufferSize);
 //			threadGroup.create_thread(boost::bind(&runThreadSharedBuffer, singleMsgSize, delayTime*balanceRatio, 10));
 
+			break;
+		case 3:
+			mBufferNum = 1;
+			mBufferSize = THREAD_BUFFER_SIZE;
+			mMpscBuffer = new zillians::MpscCircularBuffer(mBufferSize);
+			for(int i = 0; i < mThreadNum; i++)
+			{
+				threadGroup.create_thread(boost::bind(&runThreadSharedMpscBuffer, singleMsgSize, delayTime));
+			}
+			threadGroup.create_thread(boost::bind(&runThreadSharedBufferSender<zillians::MpscCircularBuffer, false>, mMpscBuffer));
+			break;
+		case 4:
+			mBufferNum = 1;
+			mBufferSize = THREAD_BUFFER_SIZE;
+			mLockedBuffer = new zillians::CircularBuffer(mBufferSize);
+			for(int i = 0; i < mThreadNum; i++)
+			{
+				threadGroup.create_thread(boost::bind(&runThreadSharedLockedBuffer, singleMsgSize, delayTime));
+			}
+			threadGroup.create_thread(boost::bind(&runThreadSharedBufferSender<zillians::CircularBuffer, true>, mLockedBuffer));
 			break;
 		}
 
@@ -248,12 +330,20 @@ typedef char BYTE;
 			maxFlow = (double)totalTime * singleMsgSize * mThreadNum / delayTime;
 		}
 
-		threadGroup.create_thread(boost::bind(&timer, totalTime, maxFlow));
+		threadGroup.create_thread(boost::bind(&timer, totalTime));
 
 
 		threadGroup.join_all();
+		state.stop();
+
+		state.setBytesProcessed(mThroughPut);
+		state.setCounter("sends", mSendCount);
+		if(maxFlow != 0)
+			state.setCounter("flow ratio", (double)mThroughPut / (maxFlow * 1000000.0));
 
 		if(bufferOption == 0)free(mCurrentBuffer);
+		else if(bufferOption == 3) delete mMpscBuffer;
+		else if(bufferOption == 4) delete mLockedBuffer;
 		else if(bufferOption == 2)
 		{
 			for(int i = 0; i < mBufferNum; i++)
@@ -265,6 +355,9 @@ typedef char BYTE;
 
 	int main(int argc, char* argv[])
 	{
+		if(!zillians::Benchmark::options().parse(argc, argv))
+			return 1;
+
 		int ch;
 		int optionCount = 0;
 		while ((ch = getopt(argc, argv, "t:b:")) != -1)
@@ -282,13 +375,26 @@ typedef char BYTE;
 		if(argc != 6)
 		{
 			cout<<"Usage: progname [-t ThreadNumber(default 4)][-b BufferNumber(default 4)]\n"
-					"[TotalTime(s)] [BufferOption(share/multi/shareMulti)] [SingleMsgSize(byte)] [DelayTime(ms)] [BalanceRatio(0.1~1)]\n"
+					"[TotalTime(s)] [BufferOption(share/multi/shareMulti/shareMpsc/shareLocked)] [SingleMsgSize(byte)] [DelayTime(ms)] [BalanceRatio(0.1~1)]\n"
+					"(and the benchmark options [--warmup=N] [--repetitions=N] [--cpu=N] [--json=path])\n"
 				<<"Example: ./GatewayReceivePerformanceTest -b 2 10 2 256 5 0.5\n";
 
 			return 0;
 		}
 
-		run(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atof(argv[5]));
+		const char* bufferOptionNames[] = { "share", "multi", "shareMulti", "shareMpsc", "shareLocked" };
+		int bufferOption = atoi(argv[2]);
+		if(bufferOption < 0 || bufferOption > 4)
+		{
+			cout << "Invalid buffer option " << bufferOption << "\n";
+			return 1;
+		}
+
+		cout<<"Thread: "<<mThreadNum<<endl;
+		cout<<"Buffer: "<<mBufferNum<<endl;
+
+		std::string name = std::string("gateway_receive/") + bufferOptionNames[bufferOption] + "/" + boost::lexical_cast<std::string>(atoi(argv[3])) + "B";
+		zillians::Benchmark::run(name, boost::bind(&run, _1, atoi(argv[1]), bufferOption, atoi(argv[3]), atoi(argv[4]), atof(argv[5])));
 
 		return 0;
 	}
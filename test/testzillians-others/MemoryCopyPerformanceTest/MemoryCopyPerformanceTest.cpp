@@ -21,7 +21,9 @@
  */
 
 #include "core/Prerequisite.h"
-#include <tbb/tick_count.h>
+#include "core/MemoryCopy.h"
+#include "Benchmark.h"
+#include <boost/bind.hpp>
 
 #define BOOST_TEST_MODULE MemoryCopyPerformanceTest
 #define BOOST_TEST_MAIN
@@ -33,7 +35,7 @@ using namespace zillians;
 BOOST_AUTO_TEST_SUITE( MemoryCopyPerformanceTestCase )
 
 template<typename T>
-double test_memcpy_single_thread(int size, int count)
+void test_memcpy_single_thread(BenchmarkState& state, int size, int count)
 {
 	T* input = new T[size * count];
 	T* output = new T[size * count];
@@ -41,24 +43,45 @@ double test_memcpy_single_thread(int size, int count)
 	T* it_input = input;
 	T* it_output = output;
 
-	tbb::tick_count start, stop;
-	start = tbb::tick_count::now();
+	state.start();
 	for(int i=0;i<count;++i)
 	{
 		memcpy((void*)it_output, (void*)it_input, size * sizeof(T));
 		it_input += size;
 		it_output += size;
 	}
-	stop = tbb::tick_count::now();
+	state.stop();
+	state.setBytesProcessed(size * count * sizeof(T));
 
 	delete[] input;
 	delete[] output;
+}
+
+template<typename T>
+void test_memory_copy_single_thread(BenchmarkState& state, int size, int count)
+{
+	T* input = new T[size * count];
+	T* output = new T[size * count];
 
-	return (stop-start).seconds() * 1000.0;
+	T* it_input = input;
+	T* it_output = output;
+
+	state.start();
+	for(int i=0;i<count;++i)
+	{
+		memory_copy((void*)it_output, (void*)it_input, size * sizeof(T));
+		it_input += size;
+		it_output += size;
+	}
+	state.stop();
+	state.setBytesProcessed(size * count * sizeof(T));
+
+	delete[] input;
+	delete[] output;
 }
 
 template<typename T>
-double test_strncpy_single_thread(int size, int count)
+void test_strncpy_single_thread(BenchmarkState& state, int size, int count)
 {
 	T* input = new T[size * count];
 	T* output = new T[size * count];
@@ -66,24 +89,22 @@ double test_strncpy_single_thread(int size, int count)
 	T* it_input = input;
 	T* it_output = output;
 
-	tbb::tick_count start, stop;
-	start = tbb::tick_count::now();
+	state.start();
 	for(int i=0;i<count;++i)
 	{
 		strncpy((char*)it_output, (char*)it_input, size * sizeof(T));
 		it_input += size;
 		it_output += size;
 	}
-	stop = tbb::tick_count::now();
+	state.stop();
+	state.setBytesProcessed(size * count * sizeof(T));
 
 	delete[] input;
 	delete[] output;
-
-	return (stop-start).seconds() * 1000.0;
 }
 
 template<typename T>
-double test_forloop_single_thread(int size, int count)
+void test_forloop_single_thread(BenchmarkState& state, int size, int count)
 {
 	T* input = new T[size * count];
 	T* output = new T[size * count];
@@ -91,8 +112,7 @@ double test_forloop_single_thread(int size, int count)
 	T* it_input = input;
 	T* it_output = output;
 
-	tbb::tick_count start, stop;
-	start = tbb::tick_count::now();
+	state.start();
 	for(int i=0;i<count;++i)
 	{
 		for(int j=0;j<size;++j)
@@ -101,52 +121,23 @@ double test_forloop_single_thread(int size, int count)
 			++it_output; ++it_input;
 		}
 	}
-	stop = tbb::tick_count::now();
+	state.stop();
+	state.setBytesProcessed(size * count * sizeof(T));
 
 	delete[] input;
 	delete[] output;
-
-	return (stop-start).seconds() * 1000.0;
 }
 
 BOOST_AUTO_TEST_CASE( MemoryCopyPerformanceTestCase1 )
 {
-	//for(int size = 1; size <= 8192; size *= 2)
-	std::size_t size = 64*1024*1024;
-	{
-		//for(int count = 1024; count <= 32768; count *= 2)
-		int count = 1;
-		{
-			double t_memcpy = 0.0;
-			double t_strncpy = 0.0;
-			double t_forloop = 0.0;
-			for(int iter = 0; iter < 10; ++iter)
-			{
-				t_memcpy += test_memcpy_single_thread<int>(size, count);
-				t_strncpy += test_strncpy_single_thread<int>(size, count);
-				t_forloop += test_forloop_single_thread<int>(size, count);
-			}
-			t_memcpy /= 10.0;
-			t_strncpy /= 10.0;
-			t_forloop /= 10.0;
-
-			//printf("size = %4d, count = %5d, total bytes = %9ld KB, memcpy time = %5.6f ms, strncpy time = %5.6f ms", size, count, size * count * sizeof(int) / 1024, t_memcpy, t_strncpy);
-			cout << "size = " << setw(4) << size <<
-					", count = " << setw(5) << count <<
-					", total bytes = " << setw(7) << size * count * sizeof(int) / 1024 << " KB" <<
-					", memcpy time = " << setprecision(5) << setw(10) << t_memcpy << " ms" <<
-					", strncpy time = " << setprecision(5) << setw(10) << t_strncpy << " ms" <<
-					", forloop time = " << setprecision(5) << setw(10) << t_forloop << " ms";
-			if(t_memcpy < t_strncpy)
-			{
-				cout << ", winner: " << "memcpy  is " << t_strncpy / t_memcpy << " times faster" << endl;
-			}
-			else
-			{
-				cout << ", winner: " << "strncpy is " << t_memcpy / t_strncpy << " times faster" << endl;
-			}
-		}
-	}
+	// 64M ints copied at once
+	int size = 64*1024*1024;
+	int count = 1;
+
+	Benchmark::run("memory_copy/memcpy/256MB", boost::bind(test_memcpy_single_thread<int>, _1, size, count));
+	Benchmark::run("memory_copy/strncpy/256MB", boost::bind(test_strncpy_single_thread<int>, _1, size, count));
+	Benchmark::run("memory_copy/forloop/256MB", boost::bind(test_forloop_single_thread<int>, _1, size, count));
+	Benchmark::run("memory_copy/memory_copy/256MB", boost::bind(test_memory_copy_single_thread<int>, _1, size, count));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,439 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// throughput and end-to-end latency of all queue implementations under the same
+// producer/consumer workloads, swept over thread counts, payload size, burstiness
+// and thread placement
+
+#include "core/Prerequisite.h"
+#include "core/AtomicQueue.h"
+#include "core/AtomicBoundedQueue.h"
+#include "core/AtomicSpscRing.h"
+#include "core/AtomicUnboundedQueue.h"
+#include "core/ConcurrentQueue.h"
+#include "core/ThreadPlacement.h"
+#include "utility/TimerUtil.h"
+#include "Benchmark.h"
+#include <tbb/concurrent_queue.h>
+#include <tbb/tbb_thread.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace zillians;
+
+#define QUEUE_CAPACITY 4096			// capacity of the bounded queues, the unbounded ones are not throttled
+#define BURST_SIZE 64				// messages a bursty producer sends back to back
+#define BURST_PAUSE_NS 50000		// idle time of a bursty producer between bursts
+#define DEFAULT_MAX_THREADS 4
+#define DEFAULT_MESSAGE_COUNT 20000
+
+/**
+ * The message passed through the queues, stamped by the producer on push.
+ */
+template<std::size_t Size>
+struct Message
+{
+	uint64 stamp;
+	uint64 sequence;
+	byte payload[Size - 2 * sizeof(uint64)];
+};
+
+/**
+ * Adapters give every queue the same non-blocking push()/pop(), push() fails when
+ * a bounded queue is full. Queues which only allow a single producer or consumer
+ * say so, and are only run with one thread on that side.
+ */
+template<typename T>
+struct AtomicPipeAdapter
+{
+	static const bool multi_producer = false;
+	static const bool multi_consumer = false;
+	static const char* name() { return "zillians::AtomicPipe"; }
+
+	inline bool push(const T& value)
+	{
+		if(mPipe.full(QUEUE_CAPACITY))
+			return false;
+		mPipe.write(value, false);
+		mPipe.flush();
+		return true;
+	}
+
+	inline bool pop(T& value)
+	{
+		return mPipe.read(&value);
+	}
+
+	zillians::atomic::AtomicPipe<T, 256> mPipe;
+};
+
+template<typename T>
+struct AtomicSpscRingAdapter
+{
+	static const bool multi_producer = false;
+	static const bool multi_consumer = false;
+	static const char* name() { return "zillians::AtomicSpscRing"; }
+
+	AtomicSpscRingAdapter() : mQueue(QUEUE_CAPACITY)
+	{ }
+
+	inline bool push(const T& value) { return mQueue.push(value); }
+	inline bool pop(T& value) { return mQueue.pop(value); }
+
+	AtomicSpscRing<T> mQueue;
+};
+
+template<typename T>
+struct AtomicBoundedQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "zillians::AtomicBoundedQueue"; }
+
+	AtomicBoundedQueueAdapter() : mQueue(QUEUE_CAPACITY)
+	{ }
+
+	inline bool push(const T& value) { return mQueue.push(value); }
+	inline bool pop(T& value) { return mQueue.pop(value); }
+
+	AtomicBoundedQueue<T> mQueue;
+};
+
+template<typename T>
+struct AtomicUnboundedQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "zillians::AtomicUnboundedQueue"; }
+
+	inline bool push(const T& value) { mQueue.push(value); return true; }
+	inline bool pop(T& value) { return mQueue.try_pop(value); }
+
+	AtomicUnboundedQueue<T> mQueue;
+};
+
+template<typename T>
+struct ConcurrentQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "zillians::ConcurrentQueue"; }
+
+	inline bool push(const T& value) { mQueue.push(value); return true; }
+	inline bool pop(T& value) { return mQueue.try_pop(value); }
+
+	ConcurrentQueue<T> mQueue;
+};
+
+// atomic::queue passes pointers, so each message is copied to the heap like its users do
+template<typename T>
+struct AtomicLinkedQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "zillians::atomic::queue"; }
+
+	~AtomicLinkedQueueAdapter()
+	{
+		T* p;
+		while((p = mQueue.pop()) != NULL)
+			delete p;
+	}
+
+	inline bool push(const T& value) { mQueue.push(new T(value)); return true; }
+
+	inline bool pop(T& value)
+	{
+		T* p = mQueue.pop();
+		if(!p)
+			return false;
+		value = *p;
+		delete p;
+		return true;
+	}
+
+	zillians::atomic::queue<T> mQueue;
+};
+
+template<typename T>
+struct TbbQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "tbb::concurrent_queue"; }
+
+	inline bool push(const T& value) { mQueue.push(value); return true; }
+	inline bool pop(T& value) { return mQueue.try_pop(value); }
+
+	tbb::concurrent_queue<T> mQueue;
+};
+
+template<typename T>
+struct TbbBoundedQueueAdapter
+{
+	static const bool multi_producer = true;
+	static const bool multi_consumer = true;
+	static const char* name() { return "tbb::concurrent_bounded_queue"; }
+
+	TbbBoundedQueueAdapter()
+	{
+		mQueue.set_capacity(QUEUE_CAPACITY);
+	}
+
+	inline bool push(const T& value) { return mQueue.try_push(value); }
+	inline bool pop(T& value) { return mQueue.try_pop(value); }
+
+	tbb::concurrent_bounded_queue<T> mQueue;
+};
+
+struct QueueWorkload
+{
+	int producers;
+	int consumers;
+	int messages;		///< Messages sent by each producer
+	bool bursty;
+	bool pinned;
+};
+
+/**
+ * Pin the index-th thread of a run to its own cpu, or let it run anywhere even
+ * if the main thread is pinned by --cpu.
+ */
+void placeThread(bool pinned, std::size_t index)
+{
+	const uint32 cpus = std::max<uint32>(1, ThreadPlacement::getCpuCount());
+	if(pinned)
+	{
+		const int first = std::max(0, Benchmark::options().cpu);
+		ThreadPlacement::onCpu((uint32)((first + index) % cpus)).apply();
+	}
+	else
+	{
+		std::vector<uint32> all;
+		for(uint32 i = 0; i < cpus; ++i)
+			all.push_back(i);
+		ThreadPlacement::onCpus(all).apply();
+	}
+}
+
+// spin for a while before giving the cpu away, so oversubscribed runs still make progress
+inline void backoff(int& failures)
+{
+	if(++failures > 64)
+	{
+		boost::this_thread::yield();
+		failures = 0;
+	}
+}
+
+template<typename Queue, typename T>
+class QueueBenchmark
+{
+public:
+	QueueBenchmark(const QueueWorkload& workload) : mWorkload(workload), mLatency(workload.consumers)
+	{
+		mConsumed.store(0);
+		mReady.store(0);
+		mStarted.store(false);
+	}
+
+public:
+	void run(BenchmarkState& state)
+	{
+		std::vector<tbb::tbb_thread*> threads;
+		for(int i = 0; i < mWorkload.consumers; ++i)
+			threads.push_back(new tbb::tbb_thread(boost::bind(&QueueBenchmark::consume, this, i)));
+		for(int i = 0; i < mWorkload.producers; ++i)
+			threads.push_back(new tbb::tbb_thread(boost::bind(&QueueBenchmark::produce, this, i)));
+
+		while(mReady.load() < (int)threads.size())
+			boost::this_thread::yield();
+
+		state.start();
+		mStarted.store(true, std::memory_order_release);
+		for(std::size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+		state.stop();
+
+		TimerHistogram latency;
+		for(std::size_t i = 0; i < mLatency.size(); ++i)
+			latency.merge(mLatency[i]);
+
+		const uint64 total = (uint64)mWorkload.producers * mWorkload.messages;
+		state.setItemsProcessed(total);
+		state.setBytesProcessed(total * sizeof(T));
+		state.setCounter("latency p50 ns", latency.percentile(50));
+		state.setCounter("latency p99 ns", latency.percentile(99));
+		state.setCounter("latency p99.9 ns", latency.percentile(99.9));
+		state.setCounter("latency max ns", latency.max());
+	}
+
+private:
+	void waitForStart(std::size_t index)
+	{
+		placeThread(mWorkload.pinned, index);
+		mReady.fetch_add(1);
+		while(!mStarted.load(std::memory_order_acquire))
+			boost::this_thread::yield();
+	}
+
+	void produce(int index)
+	{
+		waitForStart(mWorkload.consumers + index);
+
+		T message;
+		memset(&message, 0, sizeof(message));
+		for(int i = 0; i < mWorkload.messages; ++i)
+		{
+			if(mWorkload.bursty && i > 0 && i % BURST_SIZE == 0)
+			{
+				const uint64 resume = TimerUtil::now_ns() + BURST_PAUSE_NS;
+				while(TimerUtil::now_ns() < resume)
+					boost::this_thread::yield();
+			}
+
+			message.sequence = i;
+			message.stamp = TimerUtil::now_ns();
+			int failures = 0;
+			while(!mQueue.push(message))
+				backoff(failures);
+		}
+	}
+
+	void consume(int index)
+	{
+		waitForStart(index);
+
+		// the shared count is only updated when the queue looks empty, so it isn't contended on every pop
+		const uint64 total = (uint64)mWorkload.producers * mWorkload.messages;
+		TimerHistogram& latency = mLatency[index];
+		uint64 consumed = 0;
+		int failures = 0;
+		T message;
+		while(true)
+		{
+			if(mQueue.pop(message))
+			{
+				latency.record(TimerUtil::now_ns() - message.stamp);
+				++consumed;
+				continue;
+			}
+
+			if(consumed > 0)
+			{
+				mConsumed.fetch_add(consumed);
+				consumed = 0;
+			}
+			if(mConsumed.load() >= total)
+				break;
+			backoff(failures);
+		}
+	}
+
+private:
+	QueueWorkload mWorkload;
+	Queue mQueue;
+	std::vector<TimerHistogram> mLatency;	///< One per consumer
+	std::atomic<uint64> mConsumed;
+	std::atomic<int> mReady;
+	std::atomic<bool> mStarted;
+};
+
+template<template<typename> class Adapter, typename T>
+void runQueueBenchmark(BenchmarkState& state, QueueWorkload workload)
+{
+	QueueBenchmark<Adapter<T>, T> benchmark(workload);
+	benchmark.run(state);
+}
+
+template<template<typename> class Adapter, std::size_t Size>
+void runQueueMatrix(int maxThreads, int messages)
+{
+	typedef Adapter< Message<Size> > Queue;
+
+	const int maxProducers = Queue::multi_producer ? maxThreads : 1;
+	const int maxConsumers = Queue::multi_consumer ? maxThreads : 1;
+	for(int producers = 1; producers <= maxProducers; producers *= 2)
+	{
+		for(int consumers = 1; consumers <= maxConsumers; consumers *= 2)
+		{
+			for(int bursty = 0; bursty < 2; ++bursty)
+			{
+				for(int pinned = 0; pinned < 2; ++pinned)
+				{
+					QueueWorkload workload;
+					workload.producers = producers;
+					workload.consumers = consumers;
+					workload.messages = messages;
+					workload.bursty = bursty;
+					workload.pinned = pinned;
+
+					std::string name = std::string("queue/") + Queue::name() + "/" +
+							boost::lexical_cast<std::string>(producers) + "p" + boost::lexical_cast<std::string>(consumers) + "c/" +
+							boost::lexical_cast<std::string>(Size) + "B/" +
+							(bursty ? "bursty" : "steady") + "/" + (pinned ? "pinned" : "unpinned");
+					Benchmark::run(name, boost::bind(runQueueBenchmark<Adapter, Message<Size> >, _1, workload));
+				}
+			}
+		}
+	}
+}
+
+template<template<typename> class Adapter>
+void runQueueMatrix(int maxThreads, int messages)
+{
+	runQueueMatrix<Adapter, 16>(maxThreads, messages);
+	runQueueMatrix<Adapter, 128>(maxThreads, messages);
+	runQueueMatrix<Adapter, 1024>(maxThreads, messages);
+}
+
+int main(int argc, char** argv)
+{
+	if(!Benchmark::options().parse(argc, argv))
+		return 1;
+
+	if(argc > 3)
+	{
+		printf("Usage: QueuePerformanceTest [max producers/consumers (default %d)] [messages per producer (default %d)] [benchmark options]\n", DEFAULT_MAX_THREADS, DEFAULT_MESSAGE_COUNT);
+		return 1;
+	}
+
+	const int maxThreads = (argc > 1) ? std::max(1, atoi(argv[1])) : DEFAULT_MAX_THREADS;
+	const int messages = (argc > 2) ? std::max(1, atoi(argv[2])) : DEFAULT_MESSAGE_COUNT;
+	printf("max producers/consumers = %d, messages per producer = %d\n", maxThreads, messages);
+
+	runQueueMatrix<AtomicPipeAdapter>(maxThreads, messages);
+	runQueueMatrix<AtomicSpscRingAdapter>(maxThreads, messages);
+	runQueueMatrix<AtomicBoundedQueueAdapter>(maxThreads, messages);
+	runQueueMatrix<AtomicUnboundedQueueAdapter>(maxThreads, messages);
+	runQueueMatrix<ConcurrentQueueAdapter>(maxThreads, messages);
+	runQueueMatrix<AtomicLinkedQueueAdapter>(maxThreads, messages);
+	runQueueMatrix<TbbQueueAdapter>(maxThreads, messages);
+	runQueueMatrix<TbbBoundedQueueAdapter>(maxThreads, messages);
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * Zillians MMO
+ * Copyright (C) 2007-2012 Zillians.com, Inc.
+ * For more information see http://www.zillians.com
+ *
+ * Zillians MMO is the library and runtime for massive multiplayer online game
+ * development in utility computing model, which runs as a service for every
+ * developer to build their virtual world running on our GPU-assisted machines.
+ *
+ * This is a close source library intended to be used solely within Zillians.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// scaling of atomic::stack with its elimination array against a plain Treiber
+// stack, from 1 to 64 threads each pushing and popping freshly allocated nodes
+
+#include "core/Prerequisite.h"
+#include "core/AtomicStack.h"
+#include "Benchmark.h"
+#include <tbb/tbb_thread.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace zillians;
+
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_OPERATION_COUNT 20000
+
+struct StackNode : atomic::stack_node
+{
+	int value;
+};
+
+/**
+ * atomic::stack without the elimination array, as the baseline.
+ */
+template<class T>
+class TreiberStack
+{
+public:
+	TreiberStack() : mHead(NULL)
+	{ }
+
+	void push(T* item)
+	{
+		atomic::stack_node* node = item;
+		atomic::stack_node* head = mHead.load(std::memory_order_relaxed);
+		do
+		{
+			node->_nexts.store(head, std::memory_order_relaxed);
+		} while(!mHead.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	T* pop()
+	{
+		atomic::stack_node* head;
+		while(true)
+		{
+			head = HazardPointer::protect(mHead);
+			if(head == NULL)
+				break;
+
+			atomic::stack_node* next = head->_nexts.load(std::memory_order_relaxed);
+			if(mHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_relaxed))
+				break;
+		}
+		HazardPointer::clear();
+		return static_cast<T*>(head);
+	}
+
+private:
+	std::atomic<atomic::stack_node*> mHead;
+};
+
+template<typename Stack>
+class StackBenchmark
+{
+public:
+	StackBenchmark(int threads, int operations) : mThreads(threads), mOperations(operations)
+	{
+		mReady.store(0);
+		mStarted.store(false);
+	}
+
+	~StackBenchmark()
+	{
+		StackNode* node;
+		while((node = mStack.pop()) != NULL)
+			HazardPointer::retire(node);
+	}
+
+public:
+	void run(BenchmarkState& state)
+	{
+		std::vector<tbb::tbb_thread*> threads;
+		for(int i = 0; i < mThreads; ++i)
+			threads.push_back(new tbb::tbb_thread(boost::bind(&StackBenchmark::work, this, i)));
+
+		while(mReady.load() < mThreads)
+			boost::this_thread::yield();
+
+		state.start();
+		mStarted.store(true, std::memory_order_release);
+		for(std::size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+		state.stop();
+
+		state.setItemsProcessed((uint64)mThreads * mOperations * 2);
+	}
+
+private:
+	// push and pop in turn like free-node recycling does, popped nodes are retired since they can't be pushed again
+	void work(int index)
+	{
+		Benchmark::pinThread(index);
+		mReady.fetch_add(1);
+		while(!mStarted.load(std::memory_order_acquire))
+			boost::this_thread::yield();
+
+		for(int i = 0; i < mOperations; ++i)
+		{
+			StackNode* node = new StackNode;
+			node->value = i;
+			mStack.push(node);
+
+			if((node = mStack.pop()) != NULL)
+				HazardPointer::retire(node);
+		}
+	}
+
+private:
+	int mThreads;
+	int mOperations;
+	Stack mStack;
+	std::atomic<int> mReady;
+	std::atomic<bool> mStarted;
+};
+
+template<typename Stack>
+void runStackBenchmark(BenchmarkState& state, int threads, int operations)
+{
+	StackBenchmark<Stack> benchmark(threads, operations);
+	benchmark.run(state);
+}
+
+int main(int argc, char** argv)
+{
+	if(!Benchmark::options().parse(argc, argv))
+		return 1;
+
+	if(argc > 3)
+	{
+		printf("Usage: StackPerformanceTest [max threads (default %d)] [push/pop pairs per thread (default %d)] [benchmark options]\n", DEFAULT_MAX_THREADS, DEFAULT_OPERATION_COUNT);
+		return 1;
+	}
+
+	const int maxThreads = (argc > 1) ? std::max(1, atoi(argv[1])) : DEFAULT_MAX_THREADS;
+	const int operations = (argc > 2) ? std::max(1, atoi(argv[2])) : DEFAULT_OPERATION_COUNT;
+
+	for(int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		std::string suffix = "/" + boost::lexical_cast<std::string>(threads) + "_threads";
+		Benchmark::run("stack/treiber" + suffix, boost::bind(runStackBenchmark< TreiberStack<StackNode> >, _1, threads, operations));
+		Benchmark::run("stack/elimination" + suffix, boost::bind(runStackBenchmark< atomic::stack<StackNode> >, _1, threads, operations));
+	}
+
+	return 0;
+}